@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2001-2003 Paul Davis
+
+    Generic version, overridden by OS-specific definition when needed.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+#ifndef __jack_futex_h__
+#define __jack_futex_h__
+
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+
+#define JACK_HAVE_FUTEX 0
+
+static inline int
+jack_futex_wait (volatile int32_t *addr, int32_t val,
+		 const struct timespec *timeout)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+static inline int
+jack_futex_wake (volatile int32_t *addr, int nwaiters)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* __jack_futex_h__ */
@@ -27,4 +27,8 @@ void jack_set_clock_source (jack_timer_type_t clocksrc)
 {
 	/* only one clock source on a generic system */
 }
+int jack_tsc_clock_init (jack_tsc_clock_t *tsc, int calibrate)
+{
+	return -1;
+}
 
@@ -0,0 +1,49 @@
+/*
+    Copyright (C) 2001-2003 Paul Davis
+
+    This is the GNU/Linux version.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+#ifndef __jack_futex_h__
+#define __jack_futex_h__
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define JACK_HAVE_FUTEX 1
+
+/* These are deliberately not the _PRIVATE variants: the words live in
+   shared memory and are waited on and woken from different processes.
+ */
+
+static inline int
+jack_futex_wait (volatile int32_t *addr, int32_t val,
+		 const struct timespec *timeout)
+{
+	return syscall (SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static inline int
+jack_futex_wake (volatile int32_t *addr, int nwaiters)
+{
+	return syscall (SYS_futex, addr, FUTEX_WAKE, nwaiters, NULL, NULL, 0);
+}
+
+#endif /* __jack_futex_h__ */
@@ -22,6 +22,7 @@
 #include <config.h>
 
 #include <stdint.h>
+#include <time.h>
 
 jack_time_t (*_jack_get_microseconds)(void) = 0;
 
@@ -43,6 +44,11 @@ static uint32_t hpet_period; /* period length in femto secs */
 static uint64_t hpet_offset = 0;
 static uint64_t hpet_wrap;
 static hpet_counter_t hpet_previous = 0;
+
+#define TSC_SUPPORT
+#define TSC_CALIBRATION_NSECS           50000000
+#include <cpuid.h>
+static const jack_tsc_clock_t *tsc_clock = NULL;
 #endif /* defined(__gnu_linux__) && (__i386__ || __x86_64__) */
 
 #ifdef HPET_SUPPORT
@@ -112,6 +118,137 @@ jack_get_microseconds_from_hpet (void)
 
 #endif /* HPET_SUPPORT */
 
+#ifdef TSC_SUPPORT
+
+static inline uint64_t
+jack_rdtsc (void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t
+jack_tsc_nsecs (const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/* Read CLOCK_MONOTONIC and the TSC as close together as we can: keep
+   the tightest of a few tries, and take the TSC halfway through. */
+static void
+jack_tsc_sample (uint64_t *nsecs, uint64_t *tsc)
+{
+	struct timespec ts;
+	uint64_t before, after, best = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		before = jack_rdtsc ();
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		after = jack_rdtsc ();
+		if (after - before < best) {
+			best = after - before;
+			*nsecs = jack_tsc_nsecs (&ts);
+			*tsc = before + (after - before) / 2;
+		}
+	}
+}
+
+/* Only use a TSC that ticks at a constant rate in all power states,
+   and that the kernel itself trusts to be in step across CPUs. */
+static int
+jack_tsc_usable (void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	char source[32] = "";
+	FILE *f;
+
+	if (!__get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx) ||
+	    !(edx & (1 << 8))) {
+		jack_error ("This CPU has no invariant TSC.");
+		return 0;
+	}
+
+	if ((f = fopen ("/sys/devices/system/clocksource/clocksource0/"
+			"current_clocksource", "r")) != NULL) {
+		if (fgets (source, sizeof(source), f) == NULL) {
+			source[0] = '\0';
+		}
+		fclose (f);
+		if (strncmp (source, "tsc", 3) != 0) {
+			jack_error ("The kernel does not use the TSC as its clock "
+				    "source, so JACK will not either.");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int
+jack_tsc_clock_init (jack_tsc_clock_t *tsc, int calibrate)
+{
+	struct timespec delay = { 0, TSC_CALIBRATION_NSECS };
+	uint64_t nsecs0, tsc0, nsecs1, tsc1;
+
+	if (!jack_tsc_usable ()) {
+		return -1;
+	}
+
+	if (calibrate) {
+		jack_tsc_sample (&nsecs0, &tsc0);
+		nanosleep (&delay, NULL);
+		jack_tsc_sample (&nsecs1, &tsc1);
+
+		if (tsc1 <= tsc0) {
+			jack_error ("cannot calibrate the TSC");
+			return -1;
+		}
+
+		tsc->mult = (uint32_t)(((long double)(nsecs1 - nsecs0) / 1000.0L
+					/ (long double)(tsc1 - tsc0))
+				       * 4294967296.0L + 0.5L);
+		tsc->tsc_base = tsc1;
+		tsc->usecs_base = nsecs1 / 1000;
+	}
+
+	tsc_clock = tsc;
+
+	return 0;
+}
+
+static jack_time_t
+jack_get_microseconds_from_tsc (void)
+{
+	uint64_t delta = jack_rdtsc () - tsc_clock->tsc_base;
+	uint64_t mult = tsc_clock->mult;
+
+	/* split so the product cannot overflow */
+	return tsc_clock->usecs_base + (delta >> 32) * mult +
+	       (((delta & 0xffffffff) * mult) >> 32);
+}
+
+#else
+
+int
+jack_tsc_clock_init (jack_tsc_clock_t *tsc, int calibrate)
+{
+	jack_error ("This version of JACK or this computer does not have TSC support.\n"
+		    "Please choose a different clock source.");
+	return -1;
+}
+
+static jack_time_t
+jack_get_microseconds_from_tsc (void)
+{
+	/* never called */
+	return 0;
+}
+
+#endif /* TSC_SUPPORT */
+
 
 void
 jack_init_time ()
@@ -131,6 +268,16 @@ jack_set_clock_source (jack_timer_type_t clocksrc)
 		}
 		break;
 
+	case JACK_TIMER_TSC:
+#ifdef TSC_SUPPORT
+		if (tsc_clock) {
+			_jack_get_microseconds = jack_get_microseconds_from_tsc;
+			break;
+		}
+#endif /* TSC_SUPPORT */
+		_jack_get_microseconds = jack_get_microseconds_from_system;
+		break;
+
 	case JACK_TIMER_SYSTEM_CLOCK:
 	default:
 		_jack_get_microseconds = jack_get_microseconds_from_system;
@@ -29,10 +29,16 @@
 #include "libjack/local.h"              /* JOQ: fix me */
 
 /*
-    RPC without time out can put the jack server in a blocked state
-    (waiting for the client answer) when a client is killed.  The
-    mach_msg function does not return any error in this case. Using
-    time out solve the problem but does not seems really satisfactory.
+    The engine and the process thread of each client hand the cycle
+    to each other through a pair of Mach semaphores that the server
+    creates and registers with the bootstrap server under the
+    client's port number: the engine signals `wake' to run the
+    client, and the client signals `done' when it has finished. Each
+    side signals one and waits on the other in a single trap, which
+    the scheduler can treat as a direct handoff.
+
+    A client that was killed never signals, so the engine waits with
+    a time out, after which the client is removed.
  */
 
 #define WAIT 2500 /* in millisecond */
@@ -40,54 +46,16 @@
 static inline int
 jack_client_resume (jack_client_internal_t *client)
 {
-	mach_msg_header_t *head =  &client->message.header;
-	int err;
-
-	if (!client->running) {
-		err = mach_msg (head, MACH_RCV_MSG, 0, sizeof(client->message),
-				client->serverport, 0, MACH_PORT_NULL);
-		if (err) {
-			jack_error ("jack_client_resume: priming receive error: %s\n",
-				    mach_error_string (err));
-			return -1;
-		}
-		client->running = TRUE;
-	} else {
-		/* remote port is already the send-once he sent us */
-		head->msgh_bits = MACH_MSGH_BITS (MACH_MSG_TYPE_MOVE_SEND_ONCE, 0);
-		head->msgh_local_port = MACH_PORT_NULL;
-		head->msgh_size = sizeof(mach_msg_header_t);
-
-		err = mach_msg (head, (MACH_SEND_MSG | MACH_RCV_MSG |
-				       MACH_SEND_TIMEOUT | MACH_RCV_TIMEOUT),
-				sizeof(*head), sizeof(client->message),
-				client->serverport, WAIT, MACH_PORT_NULL);
-
-		if (err) {
-
-			/*
-			   switch(err) {
-			    case MACH_SEND_TIMED_OUT:
-			             jack_error("MACH_SEND_TIMED_OUT %s\n",
-			                        client->control->name);
-			             break;
-
-			       case MACH_RCV_TIMED_OUT:
-			             jack_error("MACH_RCV_TIMED_OUT %s\n",
-			                        client->control->name);
-			             break;
-
-			     case MACH_SEND_INVALID_DEST:
-			             jack_error("MACH_SEND_INVALID_DEST %s\n",
-			                        client->control->name);
-			             break;
-			   }
-			 */
-
-			jack_error ("jack_client_resume: send error for %s\n",
-				    mach_error_string (err));
-			return err;
-		}
+	mach_timespec_t timeout = { WAIT / 1000, (WAIT % 1000) * 1000000 };
+	kern_return_t err;
+
+	err = semaphore_timedwait_signal (client->done_sem, client->wake_sem,
+					  timeout);
+	if (err != KERN_SUCCESS) {
+		jack_error ("jack_client_resume: %s for %s",
+			    err == KERN_OPERATION_TIMED_OUT ? "timed out" :
+			    mach_error_string (err), client->control->name);
+		return -1;
 	}
 
 	return 0;
@@ -96,21 +64,18 @@ jack_client_resume (jack_client_internal_t *client)
 static inline int
 jack_client_suspend (jack_client_t * client)
 {
-	int err = 0;
-	mach_msg_header_t * head = &client->message.header;
+	kern_return_t err;
 
-	head->msgh_bits = MACH_MSGH_BITS (MACH_MSG_TYPE_COPY_SEND,
-					  MACH_MSG_TYPE_MAKE_SEND_ONCE);
-	head->msgh_remote_port = client->serverport;
-	head->msgh_local_port = client->replyport;
-	head->msgh_size = sizeof(mach_msg_header_t);
-
-	err = mach_msg (head, MACH_SEND_MSG | MACH_RCV_MSG | MACH_SEND_TIMEOUT,
-			sizeof(mach_msg_header_t), sizeof(client->message),
-			client->replyport, WAIT, MACH_PORT_NULL);
+	if (client->resumed) {
+		/* finish the cycle we were woken for */
+		err = semaphore_signal_wait (client->wake_sem, client->done_sem);
+	} else {
+		err = semaphore_wait (client->wake_sem);
+		client->resumed = TRUE;
+	}
 
-	if (err) {
-		jack_error ("jack_client_suspend: RPC error: %s\n",
+	if (err != KERN_SUCCESS) {
+		jack_error ("jack_client_suspend: semaphore error: %s",
 			    mach_error_string (err));
 		return -1;
 	}
@@ -118,29 +83,49 @@ jack_client_suspend (jack_client_t * client)
 	return 0;
 }
 
+static inline int
+allocate_mach_semaphore (jack_engine_t * engine, semaphore_t *sem,
+			 const char *name)
+{
+	if (semaphore_create (engine->servertask, sem, SYNC_POLICY_FIFO, 0)) {
+		jack_error ("allocate_mach_serverport: can't create semaphore %s",
+			    name);
+		return -1;
+	}
+
+	if (bootstrap_register (engine->bp, (char*)name, *sem)) {
+		jack_error ("allocate_mach_serverport: can't check in %s", name);
+		semaphore_destroy (engine->servertask, *sem);
+		*sem = MACH_PORT_NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
 static inline void
 allocate_mach_serverport (jack_engine_t * engine, jack_client_internal_t *client)
 {
 	char buf[256];
 
-	snprintf (buf, 256, "JackMachPort_%d", engine->portnum);
+	snprintf (buf, 256, "JackMachWake_%d", engine->portnum);
+	allocate_mach_semaphore (engine, &client->wake_sem, buf);
+	snprintf (buf, 256, "JackMachDone_%d", engine->portnum);
+	allocate_mach_semaphore (engine, &client->done_sem, buf);
 
-	if (mach_port_allocate (engine->servertask, MACH_PORT_RIGHT_RECEIVE,
-				&client->serverport)) {
-		jack_error ("allocate_mach_serverport: can't allocate mach port");
-	}
+	client->portnum = engine->portnum;
+	engine->portnum++;
+}
 
-	if (mach_port_insert_right (engine->servertask, client->serverport,
-				    client->serverport, MACH_MSG_TYPE_MAKE_SEND)) {
-		jack_error ("allocate_mach_serverport: error inserting mach rights");
+static inline void
+release_mach_serverport (jack_engine_t * engine, jack_client_internal_t *client)
+{
+	if (client->wake_sem != MACH_PORT_NULL) {
+		semaphore_destroy (engine->servertask, client->wake_sem);
 	}
-
-	if (bootstrap_register (engine->bp, buf, client->serverport)) {
-		jack_error ("allocate_mach_serverport: can't check in mach port");
+	if (client->done_sem != MACH_PORT_NULL) {
+		semaphore_destroy (engine->servertask, client->done_sem);
 	}
-
-	client->portnum = engine->portnum;
-	engine->portnum++;
 }
 
 static inline int
@@ -148,20 +133,83 @@ allocate_mach_clientport (jack_client_t * client, int portnum)
 {
 	char buf[256];
 
-	snprintf (buf, 256, "JackMachPort_%d", portnum);
-
-	if (bootstrap_look_up (client->bp, buf, &client->serverport)) {
-		jack_error ("allocate_mach_clientport: can't find mach server port");
+	snprintf (buf, 256, "JackMachWake_%d", portnum);
+	if (bootstrap_look_up (client->bp, buf, &client->wake_sem)) {
+		jack_error ("allocate_mach_clientport: can't find %s", buf);
 		return -1;
 	}
 
-	if (mach_port_allocate (client->clienttask, MACH_PORT_RIGHT_RECEIVE,
-				&client->replyport)) {
-		jack_error ("allocate_mach_clientport: can't allocate mach port");
+	snprintf (buf, 256, "JackMachDone_%d", portnum);
+	if (bootstrap_look_up (client->bp, buf, &client->done_sem)) {
+		jack_error ("allocate_mach_clientport: can't find %s", buf);
 		return -1;
 	}
 
+	client->resumed = FALSE;
+
 	return 0;
 }
 
+/*
+    The CoreAudio driver hands the os_workgroup of its device's IO
+    thread, which runs the engine cycle, to the server, which makes it
+    known to clients through engine->control->workgroup. Each client
+    joins its process thread to it, so that the scheduler sees the
+    whole graph as one realtime workload with one deadline, and keeps
+    its threads together on performance cores.
+ */
+
+static inline void
+jack_engine_publish_workgroup (jack_engine_t * engine, mach_port_t port)
+{
+	char buf[256];
+
+	snprintf (buf, 256, "JackMachWorkgroup_%d", engine->portnum);
+	if (bootstrap_register (engine->bp, buf, port)) {
+		jack_error ("jack_engine_publish_workgroup: can't check in %s",
+			    buf);
+		return;
+	}
+
+	engine->control->workgroup = engine->portnum;
+	engine->portnum++;
+}
+
+/* called on the process thread */
+static inline void
+jack_client_join_workgroup (jack_client_t * client)
+{
+#ifdef JACK_USE_OS_WORKGROUP
+	char buf[256];
+	mach_port_t port;
+
+	if (client->engine->workgroup < 0) {
+		return;
+	}
+
+	if (__builtin_available (macOS 11.0, *)) {
+		snprintf (buf, 256, "JackMachWorkgroup_%d",
+			  client->engine->workgroup);
+		if (bootstrap_look_up (client->bp, buf, &port)) {
+			jack_error ("jack_client_join_workgroup: can't find %s", buf);
+			return;
+		}
+
+		client->workgroup = os_workgroup_create_with_port (
+			client->control->name, port);
+		if (client->workgroup == NULL) {
+			return;
+		}
+
+		if (os_workgroup_join (client->workgroup,
+				       &client->workgroup_token)) {
+			jack_error ("jack_client_join_workgroup: cannot join "
+				    "the audio device's workgroup");
+			os_release (client->workgroup);
+			client->workgroup = NULL;
+		}
+	}
+#endif
+}
+
 #endif /* __ipc__ */
@@ -26,10 +26,16 @@
 #include <mach/mach_types.h>
 #include <mach/message.h>
 
-/* specific ressources for server/client real-time thread communication */
-typedef struct {
-	mach_msg_header_t header;
-	mach_msg_trailer_t trailer;
-} trivial_message;
+#include <mach/semaphore.h>
+#include <mach/task.h>
+#include <AvailabilityMacros.h>
+
+/* audio workgroups, that realtime threads of several processes can
+   join to be scheduled as one workload, are in the macOS 11 SDK */
+#if defined(MAC_OS_VERSION_11_0) && \
+	MAC_OS_X_VERSION_MAX_ALLOWED >= MAC_OS_VERSION_11_0
+#include <os/workgroup.h>
+#define JACK_USE_OS_WORKGROUP 1
+#endif
 
 #endif
\ No newline at end of file
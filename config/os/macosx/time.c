@@ -39,6 +39,11 @@ void jack_set_clock_source (jack_timer_type_t clocksrc)
 	/* only one clock source for os x */
 }
 
+int jack_tsc_clock_init (jack_tsc_clock_t *tsc, int calibrate)
+{
+	return -1;
+}
+
 jack_time_t
 jack_get_microseconds_symbol (void)
 {
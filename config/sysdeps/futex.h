@@ -0,0 +1,10 @@
+#ifndef _jack_sysdep_futex_h_
+#define _jack_sysdep_futex_h_
+
+#if defined(__gnu_linux__)
+#include <config/os/gnu-linux/futex.h>
+#else
+#include <config/os/generic/futex.h>
+#endif
+
+#endif /* _jack_sysdep_futex_h_ */
@@ -0,0 +1,1657 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    AES67 driver: RTP audio streams timed by PTP
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/* The driver receives one AES67 stream into its capture ports and sends
+ * its playback ports as another: linear 24 or 16 bit PCM in RTP, 1 ms
+ * packets, any number of channels that fits in one packet. Streams are
+ * configured by hand; the SDP of the stream it sends is logged at start
+ * so that it can be given to the other end. There is no SAP or mDNS.
+ *
+ * Both ends are timed by the PTP clock rather than by each other. RTP
+ * timestamps are the media clock, that is PTP time in frames (RTP
+ * offset 0, as SMPTE 2110 and most AES67 gear use). As the master
+ * driver it wakes up when the PTP clock reaches the next multiple of
+ * the period, so jackd's cycles are locked to PTP and servers on the
+ * same PTP domain with the same period run in step. The PTP clock is
+ * the hardware clock (PHC) of the interface, kept on the grandmaster
+ * by ptp4l, or with no PHC, CLOCK_TAI kept there by phc2sys. A PHC
+ * cannot be slept on, so every cycle the driver measures it against
+ * CLOCK_MONOTONIC and sleeps on that.
+ *
+ * Received packets go into a ring by their timestamp, so jitter and
+ * reordering take care of themselves; a cycle that starts at media
+ * frame N reads the frames stamped from N - link offset on, and any
+ * that did not arrive yet are silence. Where the NIC can stamp all
+ * received packets on its PHC (SO_TIMESTAMPING), the time from each
+ * packet's timestamp to its arrival is measured on the PTP clock
+ * itself, unaffected by when the driver gets round to reading it;
+ * the worst of it is logged at stop, and is what the link offset has
+ * to cover. Sent packets are stamped one period ahead of the cycle
+ * that computed them, so a receiver's link offset only has to cover
+ * the network.
+ *
+ * Loaded with -X, the driver follows another master driver. It then
+ * stamps each cycle by the PTP clock at the time it reads, and when
+ * the master drifts away from PTP by more than a period, starts over
+ * there (a "slip").
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <linux/errqueue.h>
+#include <linux/ethtool.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+
+#include <jack/types.h>
+#include "internal.h"
+#include "engine.h"
+
+#include "aes67_driver.h"
+
+#define AES67_DEFAULT_PORT 5004
+#define AES67_TTL          16
+#define AES67_CONTROL      256          /* bytes of ancillary data per packet */
+
+#ifndef FD_TO_CLOCKID
+#define FD_TO_CLOCKID(fd) ((~(clockid_t)(fd) << 3) | 3)
+#endif
+
+#define NSEC_PER_SEC 1000000000LL
+
+/* CLOCKS */
+
+static inline int64_t
+aes67_ts_to_nsec (struct timespec ts)
+{
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline int64_t
+aes67_clock_now (clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime (clock, &ts);
+	return aes67_ts_to_nsec (ts);
+}
+
+static inline uint64_t
+aes67_nsec_to_frames (aes67_driver_t *driver, int64_t nsecs)
+{
+	return (uint64_t)(nsecs / NSEC_PER_SEC) * driver->sample_rate +
+	       (uint64_t)(nsecs % NSEC_PER_SEC) * driver->sample_rate / NSEC_PER_SEC;
+}
+
+static inline int64_t
+aes67_frames_to_nsec (aes67_driver_t *driver, uint64_t frames)
+{
+	return (int64_t)(frames / driver->sample_rate) * NSEC_PER_SEC +
+	       (int64_t)(frames % driver->sample_rate) * NSEC_PER_SEC /
+	       driver->sample_rate;
+}
+
+static inline uint64_t
+aes67_ptp_frames (aes67_driver_t *driver)
+{
+	return aes67_nsec_to_frames (driver, aes67_clock_now (driver->ptp_clock));
+}
+
+/* where the PTP clock is against CLOCK_MONOTONIC, from the closest of
+   a few readings between two of the latter; and against CLOCK_REALTIME,
+   which software timestamps are in */
+static void
+aes67_clock_sync (aes67_driver_t *driver)
+{
+	int64_t t1, t2, p, best = INT64_MAX;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		t1 = aes67_clock_now (CLOCK_MONOTONIC);
+		p = aes67_clock_now (driver->ptp_clock);
+		t2 = aes67_clock_now (CLOCK_MONOTONIC);
+		if (t2 - t1 < best) {
+			best = t2 - t1;
+			driver->ptp_mono_offset = p - (t1 + (t2 - t1) / 2);
+		}
+	}
+
+	t1 = aes67_clock_now (CLOCK_REALTIME);
+	driver->ptp_real_offset = aes67_clock_now (driver->ptp_clock) - t1;
+}
+
+static int
+aes67_phc_index (const char *ifname)
+{
+	struct ethtool_ts_info info;
+	struct ifreq ifr;
+	int fd, ret;
+
+	memset (&info, 0, sizeof(info));
+	memset (&ifr, 0, sizeof(ifr));
+	info.cmd = ETHTOOL_GET_TS_INFO;
+	strncpy (ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ifr.ifr_data = (char*)&info;
+
+	if ((fd = socket (AF_INET, SOCK_DGRAM, 0)) < 0) {
+		return -1;
+	}
+	ret = ioctl (fd, SIOCETHTOOL, &ifr);
+	close (fd);
+
+	return ret < 0 ? -1 : info.phc_index;
+}
+
+static int
+aes67_clock_open (aes67_driver_t *driver)
+{
+	char path[sizeof(driver->ptp_device) + 16];
+	struct timespec ts;
+	int phc;
+
+	driver->ptp_fd = -1;
+	driver->ptp_clock = CLOCK_TAI;
+
+	if (driver->ptp_device[0]) {
+		snprintf (path, sizeof(path), "%s", driver->ptp_device);
+	} else if (driver->interface[0] &&
+		   (phc = aes67_phc_index (driver->interface)) >= 0) {
+		snprintf (path, sizeof(path), "/dev/ptp%d", phc);
+	} else {
+		jack_info ("aes67: no PTP hardware clock, following CLOCK_TAI "
+			   "(keep it on PTP with phc2sys)");
+		return 0;
+	}
+
+	if ((driver->ptp_fd = open (path, O_RDONLY)) < 0) {
+		jack_error ("aes67: cannot open PTP clock %s (%s)", path,
+			    strerror (errno));
+		return -1;
+	}
+
+	driver->ptp_clock = FD_TO_CLOCKID (driver->ptp_fd);
+
+	if (clock_gettime (driver->ptp_clock, &ts)) {
+		jack_error ("aes67: cannot read PTP clock %s (%s)", path,
+			    strerror (errno));
+		close (driver->ptp_fd);
+		driver->ptp_fd = -1;
+		return -1;
+	}
+
+	jack_info ("aes67: period clock follows %s", path);
+
+	return 0;
+}
+
+static void
+aes67_clock_close (aes67_driver_t *driver)
+{
+	if (driver->ptp_fd >= 0) {
+		close (driver->ptp_fd);
+		driver->ptp_fd = -1;
+	}
+	driver->ptp_clock = CLOCK_TAI;
+}
+
+/* SAMPLES */
+
+static inline float
+aes67_decode (const uint8_t *p, unsigned int bytes)
+{
+	int32_t v;
+
+	if (bytes == 3) {
+		v = (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+			      (uint32_t)p[2] << 8) >> 8;
+		return v * (1.0f / 8388608.0f);
+	}
+
+	return (int16_t)((p[0] << 8) | p[1]) * (1.0f / 32768.0f);
+}
+
+static inline void
+aes67_encode (uint8_t *p, float x, unsigned int bytes)
+{
+	int32_t v;
+
+	if (x > 1.0f) {
+		x = 1.0f;
+	} else if (x < -1.0f) {
+		x = -1.0f;
+	}
+
+	if (bytes == 3) {
+		v = lrintf (x * 8388607.0f);
+		p[0] = v >> 16;
+		p[1] = v >> 8;
+		p[2] = v;
+	} else {
+		v = lrintf (x * 32767.0f);
+		p[0] = v >> 8;
+		p[1] = v;
+	}
+}
+
+/* RECEIVE */
+
+/* when the packet arrived, on the PTP clock */
+static int
+aes67_arrival (aes67_driver_t *driver, struct msghdr *msg, int64_t *nsecs)
+{
+	struct scm_timestamping stamps;
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR (msg); cmsg; cmsg = CMSG_NXTHDR (msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SO_TIMESTAMPING) {
+			continue;
+		}
+		memcpy (&stamps, CMSG_DATA (cmsg), sizeof(stamps));
+		if (driver->hw_timestamps &&
+		    (stamps.ts[2].tv_sec || stamps.ts[2].tv_nsec)) {
+			*nsecs = aes67_ts_to_nsec (stamps.ts[2]);
+			return 1;
+		}
+		if (stamps.ts[0].tv_sec || stamps.ts[0].tv_nsec) {
+			*nsecs = aes67_ts_to_nsec (stamps.ts[0]) +
+				 driver->ptp_real_offset;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* one packet into the ring; 1 if it was from our stream */
+static int
+aes67_packet (aes67_driver_t *driver, const uint8_t *buf, unsigned int len,
+	      struct msghdr *msg)
+{
+	const aes67_rtp_header_t *hdr = (const aes67_rtp_header_t*)buf;
+	unsigned int off, plen, frame_bytes, frames, f, ch;
+	uint32_t ts, ssrc, window, idx;
+	int64_t arrival;
+	int32_t transit;
+	const uint8_t *p;
+
+	if (len < sizeof(aes67_rtp_header_t) || (hdr->vpxcc >> 6) != 2 ||
+	    (hdr->mpt & 0x7f) != driver->payload_type) {
+		return 0;
+	}
+
+	off = sizeof(aes67_rtp_header_t) + 4 * (hdr->vpxcc & 0x0f);
+
+	if (hdr->vpxcc & 0x10) {
+		/* header extension */
+		if (off + 4 > len) {
+			return 0;
+		}
+		off += 4 + 4 * ((buf[off + 2] << 8) | buf[off + 3]);
+	}
+
+	if (off > len) {
+		return 0;
+	}
+
+	plen = len - off;
+
+	if (hdr->vpxcc & 0x20) {
+		/* padding */
+		if (plen == 0 || buf[len - 1] > plen) {
+			return 0;
+		}
+		plen -= buf[len - 1];
+	}
+
+	frame_bytes = driver->capture_channels * driver->sample_bytes;
+	if (plen == 0 || plen % frame_bytes) {
+		/* another channel count or format */
+		driver->rx_foreign++;
+		return 0;
+	}
+	frames = plen / frame_bytes;
+
+	ssrc = ntohl (hdr->ssrc);
+	if (!driver->ssrc_locked) {
+		driver->ssrc_in = ssrc;
+		driver->ssrc_locked = 1;
+	} else if (ssrc != driver->ssrc_in) {
+		driver->rx_foreign++;
+		return 0;
+	}
+
+	ts = ntohl (hdr->timestamp);
+	window = (uint32_t)(driver->cycle_frame - driver->link_offset);
+
+	if ((int32_t)(ts + frames - window) <= 0) {
+		/* every frame in it was needed by an earlier cycle */
+		driver->rx_late++;
+		return 1;
+	}
+
+	if ((int32_t)(ts + frames - window) > (int32_t)driver->jb_frames) {
+		/* far ahead: the sender is not on our PTP clock */
+		driver->rx_foreign++;
+		return 1;
+	}
+
+	if (aes67_arrival (driver, msg, &arrival)) {
+		transit = (int32_t)((uint32_t)aes67_nsec_to_frames (driver, arrival)
+				    - (ts + frames));
+		if (transit > driver->transit_max) {
+			driver->transit_max = transit;
+		}
+	}
+
+	p = buf + off;
+
+	for (f = 0; f < frames; f++) {
+		idx = (ts + f) & (driver->jb_frames - 1);
+		for (ch = 0; ch < driver->capture_channels; ch++) {
+			driver->jb[ch * driver->jb_frames + idx] =
+				aes67_decode (p, driver->sample_bytes);
+			p += driver->sample_bytes;
+		}
+		driver->jb_tag[idx] = ts + f;
+	}
+
+	driver->rx_packets++;
+
+	return 1;
+}
+
+/* everything that arrived so far */
+static void
+aes67_receive (aes67_driver_t *driver)
+{
+	unsigned int got = 0;
+	int i, n;
+
+	if (driver->rx_fd < 0) {
+		return;
+	}
+
+	do {
+		for (i = 0; i < AES67_RX_BATCH; i++) {
+			driver->rx_msgs[i].msg_hdr.msg_controllen = AES67_CONTROL;
+		}
+
+		n = recvmmsg (driver->rx_fd, driver->rx_msgs, AES67_RX_BATCH,
+			      MSG_DONTWAIT, NULL);
+
+		for (i = 0; i < n; i++) {
+			got += aes67_packet (driver,
+					     driver->rx_bufs + i * AES67_MAX_PACKET,
+					     driver->rx_msgs[i].msg_len,
+					     &driver->rx_msgs[i].msg_hdr);
+		}
+	} while (n == AES67_RX_BATCH);
+
+	/* take the next sender after a second of nothing from this one */
+	if (got) {
+		driver->rx_idle = 0;
+	} else if (driver->ssrc_locked &&
+		   ++driver->rx_idle > driver->sample_rate / driver->period_size) {
+		driver->ssrc_locked = 0;
+	}
+}
+
+/* SEND */
+
+static void
+aes67_flush (aes67_driver_t *driver, unsigned int npackets)
+{
+	unsigned int sent = 0;
+	int n;
+
+	while (sent < npackets) {
+		if ((n = sendmmsg (driver->tx_fd, driver->tx_msgs + sent,
+				   npackets - sent, MSG_DONTWAIT)) <= 0) {
+			driver->tx_errors += npackets - sent;
+			break;
+		}
+		sent += n;
+	}
+
+	driver->tx_packets += sent;
+}
+
+/* the playback ports, or silence, for the cycle at cycle_frame */
+static void
+aes67_send (aes67_driver_t *driver, jack_nframes_t nframes, int silent)
+{
+	unsigned int frame_bytes = driver->playback_channels * driver->sample_bytes;
+	unsigned int npackets = 0;
+	uint32_t expected = (uint32_t)(driver->cycle_frame + nframes);
+	aes67_rtp_header_t *hdr;
+	jack_nframes_t i;
+	unsigned int ch;
+	uint8_t *p;
+
+	if (driver->tx_fd < 0) {
+		return;
+	}
+
+	/* stamped one cycle ahead; start a new packet after a gap */
+	if (driver->tx_timestamp + driver->tx_fill != expected) {
+		driver->tx_timestamp = expected;
+		driver->tx_fill = 0;
+	}
+
+	for (i = 0; i < nframes; i++) {
+		p = driver->tx_bufs + npackets * AES67_MAX_PACKET +
+		    sizeof(aes67_rtp_header_t) + driver->tx_fill * frame_bytes;
+
+		for (ch = 0; ch < driver->playback_channels; ch++) {
+			aes67_encode (p, silent ? 0.0f : driver->tx_src[ch][i],
+				      driver->sample_bytes);
+			p += driver->sample_bytes;
+		}
+
+		if (++driver->tx_fill < driver->packet_frames) {
+			continue;
+		}
+
+		hdr = (aes67_rtp_header_t*)(driver->tx_bufs +
+					    npackets * AES67_MAX_PACKET);
+		hdr->vpxcc = 0x80;
+		hdr->mpt = driver->payload_type;
+		hdr->seq = htons (driver->tx_seq++);
+		hdr->timestamp = htonl (driver->tx_timestamp);
+		hdr->ssrc = htonl (driver->ssrc_out);
+
+		driver->tx_timestamp += driver->packet_frames;
+		driver->tx_fill = 0;
+
+		if (++npackets == driver->tx_max - 1) {
+			aes67_flush (driver, npackets);
+			npackets = 0;
+		}
+	}
+
+	if (npackets) {
+		aes67_flush (driver, npackets);
+		if (driver->tx_fill) {
+			/* the partial packet carries on from the first slot */
+			memcpy (driver->tx_bufs + sizeof(aes67_rtp_header_t),
+				driver->tx_bufs + npackets * AES67_MAX_PACKET +
+				sizeof(aes67_rtp_header_t),
+				driver->tx_fill * frame_bytes);
+		}
+	}
+}
+
+/* SOCKETS */
+
+static int
+aes67_parse_address (const char *str, struct sockaddr_in *sa)
+{
+	char host[64];
+	char *colon;
+
+	memset (sa, 0, sizeof(*sa));
+	sa->sin_family = AF_INET;
+	sa->sin_port = htons (AES67_DEFAULT_PORT);
+
+	snprintf (host, sizeof(host), "%s", str);
+
+	if ((colon = strrchr (host, ':'))) {
+		*colon++ = '\0';
+		sa->sin_port = htons (atoi (colon));
+	}
+
+	return inet_pton (AF_INET, host, &sa->sin_addr) == 1 ? 0 : -1;
+}
+
+static int
+aes67_hw_timestamps (aes67_driver_t *driver, int fd)
+{
+	struct hwtstamp_config cfg;
+	struct ifreq ifr;
+
+	if (!driver->interface[0] || driver->ptp_fd < 0) {
+		return 0;
+	}
+
+	memset (&cfg, 0, sizeof(cfg));
+	memset (&ifr, 0, sizeof(ifr));
+	strncpy (ifr.ifr_name, driver->interface, IFNAMSIZ - 1);
+	ifr.ifr_data = (char*)&cfg;
+
+	if (ioctl (fd, SIOCGHWTSTAMP, &ifr) == 0) {
+		if (cfg.rx_filter == HWTSTAMP_FILTER_ALL) {
+			return 1;
+		}
+	} else {
+		/* ptp4l needs its transmit timestamps */
+		cfg.tx_type = HWTSTAMP_TX_ON;
+	}
+
+	cfg.flags = 0;
+	cfg.rx_filter = HWTSTAMP_FILTER_ALL;
+
+	if (ioctl (fd, SIOCSHWTSTAMP, &ifr) == 0 &&
+	    cfg.rx_filter == HWTSTAMP_FILTER_ALL) {
+		return 1;
+	}
+
+	jack_info ("aes67: %s cannot timestamp every received packet, "
+		   "using software timestamps", driver->interface);
+
+	return 0;
+}
+
+static int
+aes67_rx_open (aes67_driver_t *driver)
+{
+	struct sockaddr_in addr = driver->source;
+	struct ip_mreqn mreq;
+	int fd, one = 1, flags;
+
+	if ((fd = socket (AF_INET, SOCK_DGRAM, 0)) < 0) {
+		jack_error ("aes67: cannot create receive socket (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	/* unicast streams come in on the port at any address */
+	if (!IN_MULTICAST (ntohl (addr.sin_addr.s_addr))) {
+		addr.sin_addr.s_addr = htonl (INADDR_ANY);
+	}
+
+	if (bind (fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		jack_error ("aes67: cannot bind to port %d (%s)",
+			    ntohs (addr.sin_port), strerror (errno));
+		close (fd);
+		return -1;
+	}
+
+	if (IN_MULTICAST (ntohl (driver->source.sin_addr.s_addr))) {
+		memset (&mreq, 0, sizeof(mreq));
+		mreq.imr_multiaddr = driver->source.sin_addr;
+		mreq.imr_address.s_addr = htonl (INADDR_ANY);
+		mreq.imr_ifindex = driver->ifindex;
+		if (setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+				sizeof(mreq))) {
+			jack_error ("aes67: cannot join %s (%s)",
+				    inet_ntoa (driver->source.sin_addr),
+				    strerror (errno));
+			close (fd);
+			return -1;
+		}
+	}
+
+	driver->hw_timestamps = aes67_hw_timestamps (driver, fd);
+
+	flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (driver->hw_timestamps) {
+		flags |= SOF_TIMESTAMPING_RX_HARDWARE |
+			 SOF_TIMESTAMPING_RAW_HARDWARE;
+	}
+
+	if (setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+			sizeof(flags))) {
+		jack_info ("aes67: no receive timestamps (%s)", strerror (errno));
+		driver->hw_timestamps = 0;
+	}
+
+	driver->rx_fd = fd;
+
+	return 0;
+}
+
+static int
+aes67_tx_open (aes67_driver_t *driver)
+{
+	struct ip_mreqn mreq;
+	int fd, tos = driver->dscp << 2, ttl = AES67_TTL;
+
+	if ((fd = socket (AF_INET, SOCK_DGRAM, 0)) < 0) {
+		jack_error ("aes67: cannot create send socket (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	setsockopt (fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+	if (IN_MULTICAST (ntohl (driver->destination.sin_addr.s_addr))) {
+		memset (&mreq, 0, sizeof(mreq));
+		mreq.imr_ifindex = driver->ifindex;
+		setsockopt (fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+		setsockopt (fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	}
+
+	driver->tx_fd = fd;
+
+	return 0;
+}
+
+static void
+aes67_print_sdp (aes67_driver_t *driver)
+{
+	char group[INET_ADDRSTRLEN];
+	char local[INET_ADDRSTRLEN] = "0.0.0.0";
+	struct ifreq ifr;
+	int fd;
+
+	inet_ntop (AF_INET, &driver->destination.sin_addr, group, sizeof(group));
+
+	if (driver->interface[0] &&
+	    (fd = socket (AF_INET, SOCK_DGRAM, 0)) >= 0) {
+		memset (&ifr, 0, sizeof(ifr));
+		strncpy (ifr.ifr_name, driver->interface, IFNAMSIZ - 1);
+		ifr.ifr_addr.sa_family = AF_INET;
+		if (ioctl (fd, SIOCGIFADDR, &ifr) == 0) {
+			inet_ntop (AF_INET,
+				   &((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr,
+				   local, sizeof(local));
+		}
+		close (fd);
+	}
+
+	jack_info ("aes67: the playback stream is");
+	jack_info ("v=0");
+	jack_info ("o=- %" PRIu32 " 0 IN IP4 %s", driver->ssrc_out, local);
+	jack_info ("s=jackd");
+	if (IN_MULTICAST (ntohl (driver->destination.sin_addr.s_addr))) {
+		jack_info ("c=IN IP4 %s/%d", group, AES67_TTL);
+	} else {
+		jack_info ("c=IN IP4 %s", group);
+	}
+	jack_info ("t=0 0");
+	jack_info ("m=audio %d RTP/AVP %u", ntohs (driver->destination.sin_port),
+		   driver->payload_type);
+	jack_info ("a=rtpmap:%u L%u/%" PRIu32 "/%u", driver->payload_type,
+		   driver->sample_bytes * 8, driver->sample_rate,
+		   driver->playback_channels);
+	jack_info ("a=ptime:1");
+	jack_info ("a=ts-refclk:ptp=IEEE1588-2008:traceable");
+	jack_info ("a=mediaclk:direct=0");
+}
+
+/* CYCLES */
+
+static void
+aes67_driver_reset_stats (aes67_driver_t *driver)
+{
+	driver->stats_start = driver->engine->get_microseconds ();
+	driver->cycles = 0;
+	driver->xruns = 0;
+	driver->slips = 0;
+	driver->jitter_sum = 0;
+	driver->jitter_max = 0;
+	driver->rx_packets = 0;
+	driver->rx_late = 0;
+	driver->rx_foreign = 0;
+	driver->rx_missing = 0;
+	driver->transit_max = INT32_MIN;
+	driver->tx_packets = 0;
+	driver->tx_errors = 0;
+}
+
+/* start at the next multiple of the period */
+static void
+aes67_anchor (aes67_driver_t *driver)
+{
+	uint64_t now = aes67_ptp_frames (driver);
+
+	driver->next_frame = (now / driver->period_size + 1) * driver->period_size;
+	driver->anchored = 1;
+}
+
+static jack_nframes_t
+aes67_driver_wait (aes67_driver_t *driver, int *status, float *delayed_usecs)
+{
+	int64_t period_nsecs = aes67_frames_to_nsec (driver, driver->period_size);
+	int64_t deadline, target, now;
+	struct timespec ts;
+	float late;
+	int err;
+
+	*status = 0;
+	*delayed_usecs = 0;
+
+	aes67_clock_sync (driver);
+
+	if (!driver->anchored) {
+		aes67_anchor (driver);
+	}
+
+	deadline = aes67_frames_to_nsec (driver, driver->next_frame);
+	target = deadline - driver->ptp_mono_offset;
+	now = aes67_clock_now (CLOCK_MONOTONIC);
+
+	if (target - now > 4 * period_nsecs) {
+		/* the PTP clock was stepped back */
+		jack_info ("aes67: the PTP clock jumped, following it");
+		aes67_anchor (driver);
+		deadline = aes67_frames_to_nsec (driver, driver->next_frame);
+		target = deadline - driver->ptp_mono_offset;
+	}
+
+	if (target > now) {
+		ts.tv_sec = target / NSEC_PER_SEC;
+		ts.tv_nsec = target % NSEC_PER_SEC;
+		while ((err = clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &ts, NULL)) == EINTR) {
+		}
+		if (err) {
+			jack_error ("aes67: error while sleeping (%s)",
+				    strerror (err));
+			*status = -1;
+		}
+	}
+
+	late = (aes67_clock_now (driver->ptp_clock) - deadline) / 1000.0f;
+	if (late < 0) {
+		late = 0;
+	}
+
+	driver->cycle_frame = driver->next_frame;
+	driver->next_frame += driver->period_size;
+
+	aes67_receive (driver);
+
+	if (late > driver->period_usecs) {
+		/* xrun: the cycle's slot went by */
+		jack_error ("**** aes67: xrun of %.0f usec", late);
+		driver->xruns++;
+		driver->anchored = 0;
+		*delayed_usecs = late;
+		return 0;
+	}
+
+	driver->jitter_sum += late;
+	if (late > driver->jitter_max) {
+		driver->jitter_max = late;
+	}
+	*delayed_usecs = late;
+
+	driver->last_wait_ust = driver->engine->get_microseconds ();
+	driver->engine->transport_cycle_start (driver->engine,
+					       driver->last_wait_ust);
+
+	return driver->period_size;
+}
+
+/* as a slave: stamp the cycle the master started by the PTP clock */
+static void
+aes67_slave_clock (aes67_driver_t *driver, jack_nframes_t nframes)
+{
+	uint64_t now;
+	int64_t drift;
+	int64_t slack = nframes > driver->packet_frames ?
+			nframes : driver->packet_frames;
+
+	aes67_clock_sync (driver);
+	now = aes67_ptp_frames (driver);
+
+	if (driver->anchored) {
+		driver->cycle_frame = driver->next_frame;
+		drift = (int64_t)(now - driver->cycle_frame);
+		if (drift < -slack || drift > slack) {
+			driver->slips++;
+			driver->anchored = 0;
+		}
+	}
+
+	if (!driver->anchored) {
+		driver->cycle_frame = now;
+		driver->anchored = 1;
+	}
+
+	driver->next_frame = driver->cycle_frame + nframes;
+	driver->cycles++;
+}
+
+static int
+aes67_driver_run_cycle (aes67_driver_t *driver)
+{
+	jack_engine_t *engine = driver->engine;
+	int wait_status;
+	float delayed_usecs;
+	jack_nframes_t nframes;
+
+	nframes = aes67_driver_wait (driver, &wait_status, &delayed_usecs);
+
+	if (nframes == 0) {
+		/* we detected an xrun and restarted: notify
+		 * clients about the delay. */
+		engine->delay (engine, delayed_usecs);
+		return 0;
+	}
+
+	driver->cycles++;
+
+	if (wait_status == 0) {
+		return engine->run_cycle (engine, nframes, delayed_usecs);
+	}
+
+	if (wait_status < 0) {
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+static int
+aes67_driver_read (aes67_driver_t *driver, jack_nframes_t nframes)
+{
+	jack_default_audio_sample_t *buf;
+	uint32_t start, frame, idx, mask = driver->jb_frames - 1;
+	unsigned int ch;
+	jack_nframes_t i;
+	JSList *node;
+
+	if (driver->slave) {
+		aes67_slave_clock (driver, nframes);
+		aes67_receive (driver);
+	}
+
+	start = (uint32_t)(driver->cycle_frame - driver->link_offset);
+
+	if (driver->rx_fd >= 0) {
+		for (i = 0; i < nframes; i++) {
+			frame = start + i;
+			if (driver->jb_tag[frame & mask] != frame) {
+				driver->rx_missing++;
+			}
+		}
+	}
+
+	for (node = driver->capture_ports, ch = 0; node;
+	     node = jack_slist_next (node), ch++) {
+		buf = jack_port_get_buffer ((jack_port_t*)node->data, nframes);
+
+		if (driver->rx_fd < 0) {
+			memset (buf, 0, nframes * sizeof(*buf));
+			continue;
+		}
+
+		for (i = 0; i < nframes; i++) {
+			frame = start + i;
+			idx = frame & mask;
+			buf[i] = driver->jb_tag[idx] == frame ?
+				 driver->jb[ch * driver->jb_frames + idx] : 0.0f;
+		}
+	}
+
+	return 0;
+}
+
+static int
+aes67_driver_write (aes67_driver_t *driver, jack_nframes_t nframes)
+{
+	JSList *node;
+	unsigned int ch;
+
+	if (driver->tx_fd < 0) {
+		return 0;
+	}
+
+	for (node = driver->playback_ports, ch = 0; node;
+	     node = jack_slist_next (node), ch++) {
+		driver->tx_src[ch] = jack_port_get_buffer ((jack_port_t*)node->data,
+							   nframes);
+	}
+
+	aes67_send (driver, nframes, 0);
+
+	return 0;
+}
+
+/* keep the streams going without the engine */
+static int
+aes67_driver_null_cycle (aes67_driver_t *driver, jack_nframes_t nframes)
+{
+	if (driver->slave) {
+		aes67_slave_clock (driver, nframes);
+		aes67_receive (driver);
+	}
+
+	aes67_send (driver, nframes, 1);
+
+	return 0;
+}
+
+/* SETUP */
+
+static void
+aes67_driver_set_latencies (aes67_driver_t *driver)
+{
+	jack_latency_range_t range;
+	JSList *node;
+
+	/* a frame is read link_offset after its timestamp */
+	range.min = range.max = driver->link_offset;
+	for (node = driver->capture_ports; node; node = jack_slist_next (node)) {
+		jack_port_set_latency_range ((jack_port_t*)node->data,
+					     JackCaptureLatency, &range);
+	}
+
+	/* sent stamped a period ahead, plus whatever the receiver adds */
+	range.min = range.max = driver->period_size;
+	for (node = driver->playback_ports; node; node = jack_slist_next (node)) {
+		jack_port_set_latency_range ((jack_port_t*)node->data,
+					     JackPlaybackLatency, &range);
+	}
+}
+
+/* the receive ring and send slots for a period of `nframes' */
+static int
+aes67_driver_layout (aes67_driver_t *driver, jack_nframes_t nframes)
+{
+	uint32_t need, jb_frames;
+	unsigned int i;
+
+	driver->link_offset = driver->link_offset_set ?
+			      driver->link_offset_set :
+			      nframes + driver->packet_frames;
+
+	if (driver->capture_channels) {
+		need = 4 * (driver->link_offset + nframes + driver->packet_frames);
+		for (jb_frames = AES67_MIN_JB; jb_frames < need; jb_frames <<= 1) {
+		}
+
+		if (jb_frames != driver->jb_frames) {
+			free (driver->jb);
+			free (driver->jb_tag);
+			driver->jb = (float*)calloc (driver->capture_channels * jb_frames,
+						     sizeof(float));
+			driver->jb_tag = (uint32_t*)malloc (jb_frames * sizeof(uint32_t));
+			if (driver->jb == NULL || driver->jb_tag == NULL) {
+				driver->jb_frames = 0;
+				return -1;
+			}
+			/* no frame anyone will ask for soon */
+			for (i = 0; i < jb_frames; i++) {
+				driver->jb_tag[i] = i ^ 0x80000000;
+			}
+			driver->jb_frames = jb_frames;
+		}
+	}
+
+	if (driver->playback_channels) {
+		driver->tx_max = nframes / driver->packet_frames + 2;
+		free (driver->tx_bufs);
+		free (driver->tx_msgs);
+		free (driver->tx_iov);
+		driver->tx_bufs = (uint8_t*)calloc (driver->tx_max, AES67_MAX_PACKET);
+		driver->tx_msgs = (struct mmsghdr*)calloc (driver->tx_max,
+							   sizeof(struct mmsghdr));
+		driver->tx_iov = (struct iovec*)calloc (driver->tx_max,
+							sizeof(struct iovec));
+		if (driver->tx_bufs == NULL || driver->tx_msgs == NULL ||
+		    driver->tx_iov == NULL) {
+			return -1;
+		}
+		for (i = 0; i < driver->tx_max; i++) {
+			driver->tx_iov[i].iov_base = driver->tx_bufs + i * AES67_MAX_PACKET;
+			driver->tx_iov[i].iov_len = sizeof(aes67_rtp_header_t) +
+						    driver->packet_frames *
+						    driver->playback_channels *
+						    driver->sample_bytes;
+			driver->tx_msgs[i].msg_hdr.msg_name = &driver->destination;
+			driver->tx_msgs[i].msg_hdr.msg_namelen = sizeof(driver->destination);
+			driver->tx_msgs[i].msg_hdr.msg_iov = &driver->tx_iov[i];
+			driver->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		driver->tx_fill = 0;
+	}
+
+	return 0;
+}
+
+static int
+aes67_driver_nt_start (aes67_driver_t *driver)
+{
+	if (aes67_clock_open (driver)) {
+		return -1;
+	}
+
+	if (driver->have_source && aes67_rx_open (driver)) {
+		aes67_clock_close (driver);
+		return -1;
+	}
+
+	if (driver->have_destination && aes67_tx_open (driver)) {
+		if (driver->rx_fd >= 0) {
+			close (driver->rx_fd);
+			driver->rx_fd = -1;
+		}
+		aes67_clock_close (driver);
+		return -1;
+	}
+
+	if (driver->rx_fd >= 0) {
+		jack_info ("aes67: receiving %s:%d, %s timestamps, link offset "
+			   "%" PRIu32 " frames", inet_ntoa (driver->source.sin_addr),
+			   ntohs (driver->source.sin_port),
+			   driver->hw_timestamps ? "hardware" : "software",
+			   driver->link_offset);
+	}
+
+	if (driver->tx_fd >= 0) {
+		aes67_print_sdp (driver);
+	}
+
+	driver->anchored = 0;
+	driver->ssrc_locked = 0;
+	driver->rx_idle = 0;
+	aes67_driver_reset_stats (driver);
+
+	return 0;
+}
+
+static int
+aes67_driver_nt_stop (aes67_driver_t *driver)
+{
+	jack_time_t elapsed =
+		driver->engine->get_microseconds () - driver->stats_start;
+
+	if (driver->cycles && elapsed) {
+		jack_info ("aes67: %lu cycles in %.3f secs, %lu xruns, %lu slips",
+			   driver->cycles, elapsed / 1000000.0, driver->xruns,
+			   driver->slips);
+		if (!driver->slave) {
+			jack_info ("aes67: wakeup jitter mean %.1f usecs, "
+				   "max %.1f usecs",
+				   driver->jitter_sum / driver->cycles,
+				   driver->jitter_max);
+		}
+	}
+
+	if (driver->rx_fd >= 0) {
+		jack_info ("aes67: received %lu packets, %lu late, %lu foreign, "
+			   "%lu frames missing", driver->rx_packets,
+			   driver->rx_late, driver->rx_foreign, driver->rx_missing);
+		if (driver->transit_max != INT32_MIN) {
+			jack_info ("aes67: worst transit %.0f usecs (%s "
+				   "timestamps), link offset %.0f usecs",
+				   driver->transit_max * 1000000.0 / driver->sample_rate,
+				   driver->hw_timestamps ? "hardware" : "software",
+				   driver->link_offset * 1000000.0 / driver->sample_rate);
+		}
+		close (driver->rx_fd);
+		driver->rx_fd = -1;
+	}
+
+	if (driver->tx_fd >= 0) {
+		jack_info ("aes67: sent %lu packets, %lu failed",
+			   driver->tx_packets, driver->tx_errors);
+		close (driver->tx_fd);
+		driver->tx_fd = -1;
+	}
+
+	aes67_clock_close (driver);
+
+	return 0;
+}
+
+/* a slave has no thread of its own: the master's cycle calls read and
+   write */
+static int
+aes67_driver_start (aes67_driver_t *driver)
+{
+	if (driver->slave) {
+		return aes67_driver_nt_start (driver);
+	}
+	return driver->nt_master_start ((jack_driver_t*)driver);
+}
+
+static int
+aes67_driver_stop (aes67_driver_t *driver)
+{
+	if (driver->slave) {
+		return aes67_driver_nt_stop (driver);
+	}
+	return driver->nt_master_stop ((jack_driver_t*)driver);
+}
+
+static int
+aes67_driver_bufsize (aes67_driver_t *driver, jack_nframes_t nframes)
+{
+	driver->period_size = nframes;
+	driver->period_usecs = (jack_time_t)floor ((((float)nframes) /
+						    driver->sample_rate)
+						   * 1000000.0f);
+
+	if (aes67_driver_layout (driver, nframes)) {
+		jack_error ("aes67: cannot allocate buffers for %" PRIu32
+			    " frames", nframes);
+		return -1;
+	}
+
+	/* tell the engine to change its buffer size */
+	if (driver->engine->set_buffer_size (driver->engine, nframes)) {
+		jack_error ("aes67: cannot set engine buffer size to %d", nframes);
+		return -1;
+	}
+
+	aes67_driver_set_latencies (driver);
+	driver->anchored = 0;
+
+	return 0;
+}
+
+static int
+aes67_driver_attach (aes67_driver_t *driver)
+{
+	jack_port_t *port;
+	char buf[32];
+	unsigned int chn;
+	int port_flags;
+
+	driver->slave = (driver->engine->driver != (jack_driver_t*)driver);
+
+	if (driver->slave) {
+		if (driver->engine->control->current_time.frame_rate !=
+		    driver->sample_rate) {
+			jack_error ("aes67: the master runs at %" PRIu32 " Hz, "
+				    "not %" PRIu32,
+				    driver->engine->control->current_time.frame_rate,
+				    driver->sample_rate);
+			return -1;
+		}
+		driver->period_size = driver->engine->control->buffer_size;
+	} else {
+		if (driver->engine->set_buffer_size (driver->engine,
+						     driver->period_size)) {
+			jack_error ("aes67: cannot set engine buffer size to %d",
+				    driver->period_size);
+			return -1;
+		}
+		driver->engine->set_sample_rate (driver->engine,
+						 driver->sample_rate);
+	}
+
+	if (aes67_driver_layout (driver, driver->period_size)) {
+		jack_error ("aes67: cannot allocate buffers");
+		return -1;
+	}
+
+	port_flags = JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal;
+
+	for (chn = 0; chn < driver->capture_channels; chn++) {
+		snprintf (buf, sizeof(buf) - 1, "capture_%u", chn + 1);
+
+		port = jack_port_register (driver->client, buf,
+					   JACK_DEFAULT_AUDIO_TYPE,
+					   port_flags, 0);
+		if (!port) {
+			jack_error ("aes67: cannot register port for %s", buf);
+			return -1;
+		}
+
+		driver->capture_ports =
+			jack_slist_append (driver->capture_ports, port);
+	}
+
+	port_flags = JackPortIsInput | JackPortIsPhysical | JackPortIsTerminal;
+
+	for (chn = 0; chn < driver->playback_channels; chn++) {
+		snprintf (buf, sizeof(buf) - 1, "playback_%u", chn + 1);
+
+		port = jack_port_register (driver->client, buf,
+					   JACK_DEFAULT_AUDIO_TYPE,
+					   port_flags, 0);
+		if (!port) {
+			jack_error ("aes67: cannot register port for %s", buf);
+			return -1;
+		}
+
+		driver->playback_ports =
+			jack_slist_append (driver->playback_ports, port);
+	}
+
+	aes67_driver_set_latencies (driver);
+
+	jack_activate (driver->client);
+
+	return 0;
+}
+
+static int
+aes67_driver_detach (aes67_driver_t *driver)
+{
+	JSList * node;
+
+	if (driver->engine == 0) {
+		return 0;
+	}
+
+	for (node = driver->capture_ports; node; node = jack_slist_next (node))
+		jack_port_unregister (driver->client,
+				      ((jack_port_t*)node->data));
+
+	jack_slist_free (driver->capture_ports);
+	driver->capture_ports = NULL;
+
+	for (node = driver->playback_ports; node; node = jack_slist_next (node))
+		jack_port_unregister (driver->client,
+				      ((jack_port_t*)node->data));
+
+	jack_slist_free (driver->playback_ports);
+	driver->playback_ports = NULL;
+
+	return 0;
+}
+
+static void
+aes67_driver_delete (aes67_driver_t *driver)
+{
+	free (driver->jb);
+	free (driver->jb_tag);
+	free (driver->rx_bufs);
+	free (driver->rx_control);
+	free (driver->rx_msgs);
+	free (driver->rx_iov);
+	free (driver->tx_src);
+	free (driver->tx_bufs);
+	free (driver->tx_msgs);
+	free (driver->tx_iov);
+	jack_driver_nt_finish ((jack_driver_nt_t*)driver);
+	free (driver);
+}
+
+static jack_driver_t *
+aes67_driver_new (jack_client_t *client, aes67_driver_t *params)
+{
+	aes67_driver_t *driver;
+	unsigned int i;
+
+	driver = (aes67_driver_t*)calloc (1, sizeof(aes67_driver_t));
+
+	jack_driver_nt_init ((jack_driver_nt_t*)driver);
+
+	driver->nt_master_start = driver->start;
+	driver->nt_master_stop = driver->stop;
+	driver->start         = (JackDriverStartFunction)aes67_driver_start;
+	driver->stop          = (JackDriverStopFunction)aes67_driver_stop;
+
+	driver->read          = (JackDriverReadFunction)aes67_driver_read;
+	driver->write         = (JackDriverWriteFunction)aes67_driver_write;
+	driver->null_cycle    = (JackDriverNullCycleFunction)aes67_driver_null_cycle;
+	driver->nt_attach     = (JackDriverNTAttachFunction)aes67_driver_attach;
+	driver->nt_start      = (JackDriverNTStartFunction)aes67_driver_nt_start;
+	driver->nt_stop       = (JackDriverNTStopFunction)aes67_driver_nt_stop;
+	driver->nt_detach     = (JackDriverNTDetachFunction)aes67_driver_detach;
+	driver->nt_bufsize    = (JackDriverNTBufSizeFunction)aes67_driver_bufsize;
+	driver->nt_run_cycle  = (JackDriverNTRunCycleFunction)aes67_driver_run_cycle;
+
+	driver->sample_rate = params->sample_rate;
+	driver->period_size = params->period_size;
+	driver->period_usecs =
+		(jack_time_t)floor ((((float)driver->period_size) /
+				     driver->sample_rate) * 1000000.0f);
+	driver->packet_frames = driver->sample_rate / 1000;
+	driver->link_offset_set = params->link_offset_set;
+	driver->sample_bytes = params->sample_bytes;
+	driver->payload_type = params->payload_type;
+	driver->dscp = params->dscp;
+	strcpy (driver->interface, params->interface);
+	driver->ifindex = params->ifindex;
+	strcpy (driver->ptp_device, params->ptp_device);
+	driver->ptp_fd = -1;
+	driver->ptp_clock = CLOCK_TAI;
+
+	driver->source = params->source;
+	driver->have_source = params->have_source;
+	driver->capture_channels = params->have_source ?
+				   params->capture_channels : 0;
+	driver->rx_fd = -1;
+
+	driver->destination = params->destination;
+	driver->have_destination = params->have_destination;
+	driver->playback_channels = params->have_destination ?
+				    params->playback_channels : 0;
+	driver->tx_fd = -1;
+
+	if (getrandom (&driver->ssrc_out, sizeof(driver->ssrc_out), 0) !=
+	    sizeof(driver->ssrc_out)) {
+		driver->ssrc_out = (uint32_t)(time (NULL) ^ (getpid () << 16));
+	}
+	driver->tx_seq = (uint16_t)driver->ssrc_out;
+
+	if (driver->capture_channels) {
+		driver->rx_bufs = (uint8_t*)malloc (AES67_RX_BATCH * AES67_MAX_PACKET);
+		driver->rx_control = (char*)malloc (AES67_RX_BATCH * AES67_CONTROL);
+		driver->rx_msgs = (struct mmsghdr*)calloc (AES67_RX_BATCH,
+							   sizeof(struct mmsghdr));
+		driver->rx_iov = (struct iovec*)calloc (AES67_RX_BATCH,
+							sizeof(struct iovec));
+		if (driver->rx_bufs == NULL || driver->rx_control == NULL ||
+		    driver->rx_msgs == NULL || driver->rx_iov == NULL) {
+			aes67_driver_delete (driver);
+			return NULL;
+		}
+		for (i = 0; i < AES67_RX_BATCH; i++) {
+			driver->rx_iov[i].iov_base = driver->rx_bufs + i * AES67_MAX_PACKET;
+			driver->rx_iov[i].iov_len = AES67_MAX_PACKET;
+			driver->rx_msgs[i].msg_hdr.msg_iov = &driver->rx_iov[i];
+			driver->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+			driver->rx_msgs[i].msg_hdr.msg_control =
+				driver->rx_control + i * AES67_CONTROL;
+			driver->rx_msgs[i].msg_hdr.msg_controllen = AES67_CONTROL;
+		}
+	}
+
+	if (driver->playback_channels &&
+	    (driver->tx_src = (jack_default_audio_sample_t**)
+		  calloc (driver->playback_channels,
+			  sizeof(jack_default_audio_sample_t*))) == NULL) {
+		aes67_driver_delete (driver);
+		return NULL;
+	}
+
+	driver->client = client;
+	driver->engine = NULL;
+
+	return (jack_driver_t*)driver;
+}
+
+
+/* DRIVER "PLUGIN" INTERFACE */
+
+jack_driver_desc_t *
+driver_get_descriptor ()
+{
+	jack_driver_desc_t * desc;
+	jack_driver_param_desc_t * params;
+	unsigned int i;
+
+	desc = calloc (1, sizeof(jack_driver_desc_t));
+	strcpy (desc->name, "aes67");
+	desc->nparams = 12;
+
+	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
+
+	i = 0;
+	strcpy (params[i].name, "interface");
+	params[i].character  = 'i';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "Network interface of the streams");
+	strcpy (params[i].long_desc,
+		"Network interface to join and send multicast streams on. "
+		"Its PTP hardware clock, if it has one, times the cycles, and "
+		"it is asked to timestamp received packets");
+
+	i++;
+	strcpy (params[i].name, "ptp-device");
+	params[i].character  = 't';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "PTP clock device, e.g. /dev/ptp0");
+	strcpy (params[i].long_desc,
+		"PTP hardware clock to follow instead of the interface's own. "
+		"Without either, CLOCK_TAI is followed");
+
+	i++;
+	strcpy (params[i].name, "source");
+	params[i].character  = 's';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "Stream to capture, address[:port]");
+	strcpy (params[i].long_desc,
+		"Multicast group and port of the stream to capture, or a "
+		"unicast address to take any stream sent to the port. "
+		"The port defaults to 5004");
+
+	i++;
+	strcpy (params[i].name, "destination");
+	params[i].character  = 'd';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "Where to send playback, address[:port]");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "capture");
+	params[i].character  = 'C';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 2U;
+	strcpy (params[i].short_desc,
+		"Number of capture ports, the channels of the source stream");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "playback");
+	params[i].character  = 'P';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 2U;
+	strcpy (params[i].short_desc, "Number of playback ports");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "rate");
+	params[i].character  = 'r';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 48000U;
+	strcpy (params[i].short_desc, "Sample rate");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "period");
+	params[i].character  = 'p';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 48U;
+	strcpy (params[i].short_desc, "Frames per period");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "link-offset");
+	params[i].character  = 'l';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc, "Receive latency in frames");
+	strcpy (params[i].long_desc,
+		"Frames from a received frame's timestamp to the cycle that "
+		"reads it. It has to cover the sender's packet time and the "
+		"network. The default is a period and a packet");
+
+	i++;
+	strcpy (params[i].name, "wordlength");
+	params[i].character  = 'w';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 24U;
+	strcpy (params[i].short_desc, "Sample size in bits, 24 or 16");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "payload-type");
+	params[i].character  = 'y';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 98U;
+	strcpy (params[i].short_desc, "RTP payload type of both streams");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "dscp");
+	params[i].character  = 'q';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 34U;
+	strcpy (params[i].short_desc, "DSCP of sent packets");
+	strcpy (params[i].long_desc,
+		"Differentiated services code point of sent packets. AES67 "
+		"recommends 34 (AF41) for media");
+
+	desc->params = params;
+
+	return desc;
+}
+
+const char driver_client_name[] = "aes67_pcm";
+
+jack_driver_t *
+driver_initialize (jack_client_t *client, const JSList * params)
+{
+	aes67_driver_t cfg;
+	unsigned int wordlength = 24;
+	unsigned int frame_bytes;
+	const JSList * node;
+	const jack_driver_param_t * param;
+
+	memset (&cfg, 0, sizeof(cfg));
+	cfg.sample_rate = 48000;
+	cfg.period_size = 48;
+	cfg.capture_channels = 2;
+	cfg.playback_channels = 2;
+	cfg.payload_type = 98;
+	cfg.dscp = 34;
+
+	for (node = params; node; node = jack_slist_next (node)) {
+		param = (const jack_driver_param_t*)node->data;
+
+		switch (param->character) {
+
+		case 'i':
+			snprintf (cfg.interface, sizeof(cfg.interface), "%s",
+				  param->value.str);
+			break;
+
+		case 't':
+			snprintf (cfg.ptp_device, sizeof(cfg.ptp_device), "%s",
+				  param->value.str);
+			break;
+
+		case 's':
+			if (aes67_parse_address (param->value.str, &cfg.source)) {
+				jack_error ("aes67: bad source \"%s\"",
+					    param->value.str);
+				return NULL;
+			}
+			cfg.have_source = 1;
+			break;
+
+		case 'd':
+			if (aes67_parse_address (param->value.str,
+						 &cfg.destination)) {
+				jack_error ("aes67: bad destination \"%s\"",
+					    param->value.str);
+				return NULL;
+			}
+			cfg.have_destination = 1;
+			break;
+
+		case 'C':
+			cfg.capture_channels = param->value.ui;
+			break;
+
+		case 'P':
+			cfg.playback_channels = param->value.ui;
+			break;
+
+		case 'r':
+			cfg.sample_rate = param->value.ui;
+			break;
+
+		case 'p':
+			cfg.period_size = param->value.ui;
+			break;
+
+		case 'l':
+			cfg.link_offset_set = param->value.ui;
+			break;
+
+		case 'w':
+			wordlength = param->value.ui;
+			break;
+
+		case 'y':
+			cfg.payload_type = param->value.ui;
+			break;
+
+		case 'q':
+			cfg.dscp = param->value.ui;
+			break;
+
+		}
+	}
+
+	if (!cfg.have_source && !cfg.have_destination) {
+		jack_error ("aes67: give a source (-s), a destination (-d) "
+			    "or both");
+		return NULL;
+	}
+
+	if (cfg.sample_rate == 0 || cfg.sample_rate % 1000) {
+		jack_error ("aes67: 1 ms packets need a rate that is a "
+			    "multiple of 1000");
+		return NULL;
+	}
+
+	if (cfg.period_size == 0) {
+		jack_error ("aes67: the period cannot be empty");
+		return NULL;
+	}
+
+	if (wordlength != 24 && wordlength != 16) {
+		jack_error ("aes67: the word length is 24 or 16 bits");
+		return NULL;
+	}
+	cfg.sample_bytes = wordlength / 8;
+
+	if (cfg.payload_type > 127 || cfg.dscp > 63) {
+		jack_error ("aes67: the payload type is at most 127, the DSCP "
+			    "at most 63");
+		return NULL;
+	}
+
+	frame_bytes = cfg.sample_bytes *
+		      (cfg.capture_channels > cfg.playback_channels ?
+		       cfg.capture_channels : cfg.playback_channels);
+	if (sizeof(aes67_rtp_header_t) + frame_bytes * (cfg.sample_rate / 1000)
+	    > AES67_MAX_PACKET) {
+		jack_error ("aes67: too many channels for one packet a ms");
+		return NULL;
+	}
+
+	if ((cfg.have_source && cfg.capture_channels == 0) ||
+	    (cfg.have_destination && cfg.playback_channels == 0)) {
+		jack_error ("aes67: a stream needs at least one channel");
+		return NULL;
+	}
+
+	if (cfg.interface[0] &&
+	    (cfg.ifindex = if_nametoindex (cfg.interface)) == 0) {
+		jack_error ("aes67: no interface %s", cfg.interface);
+		return NULL;
+	}
+
+	return aes67_driver_new (client, &cfg);
+}
+
+void
+driver_finish (jack_driver_t *driver)
+{
+	aes67_driver_delete ((aes67_driver_t*)driver);
+}
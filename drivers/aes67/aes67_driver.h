@@ -0,0 +1,136 @@
+/*
+    AES67 driver: RTP audio streams timed by PTP
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __JACK_AES67_DRIVER_H__
+#define __JACK_AES67_DRIVER_H__
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <time.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <jack/types.h>
+#include <jack/jslist.h>
+#include <jack/jack.h>
+#include "driver.h"
+#include <config.h>
+
+#define AES67_RX_BATCH   16             /* packets per recvmmsg() */
+#define AES67_MAX_PACKET 1500           /* bytes, RTP header included */
+#define AES67_MIN_JB     4096           /* frames of receive buffer, at least */
+
+/* RFC 3550 fixed header, without CSRCs */
+typedef struct {
+	uint8_t vpxcc;                  /* version 2, padding, extension, CSRC count */
+	uint8_t mpt;                    /* marker, payload type */
+	uint16_t seq;
+	uint32_t timestamp;             /* media clock, the first frame */
+	uint32_t ssrc;
+} aes67_rtp_header_t;
+
+typedef struct _aes67_driver aes67_driver_t;
+
+struct _aes67_driver {
+	JACK_DRIVER_NT_DECL;
+
+	jack_client_t *client;
+	int slave;                      /* loaded with -X, another driver runs the cycle */
+	JackDriverStartFunction nt_master_start;
+	JackDriverStopFunction nt_master_stop;
+
+	jack_nframes_t sample_rate;
+	jack_nframes_t period_size;
+	jack_nframes_t packet_frames;   /* 1 ms */
+	jack_nframes_t link_offset;     /* from a frame's timestamp to its cycle */
+	jack_nframes_t link_offset_set; /* 0: one period and one packet */
+	unsigned int sample_bytes;      /* 3: L24, 2: L16 */
+	unsigned int payload_type;
+	int dscp;
+
+	char interface[IFNAMSIZ];       /* "": the kernel picks */
+	unsigned int ifindex;
+	char ptp_device[64];            /* "": the interface's own, if it has one */
+
+	/* the PTP clock, and where it stands against the others as of
+	   the last aes67_clock_sync() */
+	int ptp_fd;
+	clockid_t ptp_clock;            /* CLOCK_TAI without a PHC */
+	int64_t ptp_mono_offset;        /* ns */
+	int64_t ptp_real_offset;        /* ns, for software timestamps */
+	int hw_timestamps;              /* the NIC stamps our packets on the PHC */
+
+	/* the media clock, in frames since the PTP epoch */
+	int anchored;
+	uint64_t cycle_frame;           /* of the cycle running now */
+	uint64_t next_frame;            /* of the next one */
+
+	/* receive */
+	struct sockaddr_in source;
+	int have_source;
+	int rx_fd;
+	unsigned int capture_channels;
+	JSList *capture_ports;
+	float *jb;                      /* capture_channels rings of jb_frames */
+	uint32_t *jb_tag;               /* the timestamp of each frame in them */
+	uint32_t jb_frames;             /* a power of two */
+	uint32_t ssrc_in;
+	int ssrc_locked;
+	unsigned int rx_idle;           /* cycles without a packet from ssrc_in */
+	uint8_t *rx_bufs;
+	char *rx_control;
+	struct mmsghdr *rx_msgs;
+	struct iovec *rx_iov;
+
+	/* send */
+	struct sockaddr_in destination;
+	int have_destination;
+	int tx_fd;
+	unsigned int playback_channels;
+	JSList *playback_ports;
+	jack_default_audio_sample_t **tx_src;
+	uint8_t *tx_bufs;               /* tx_max packets, the last one may be partial */
+	struct mmsghdr *tx_msgs;
+	struct iovec *tx_iov;
+	unsigned int tx_max;
+	unsigned int tx_fill;           /* frames in the packet being filled */
+	uint32_t tx_timestamp;          /* of that packet */
+	uint16_t tx_seq;
+	uint32_t ssrc_out;
+
+	/* reported by nt_stop */
+	jack_time_t stats_start;
+	unsigned long cycles;
+	unsigned long xruns;
+	unsigned long slips;            /* slave: the master drifted from PTP */
+	double jitter_sum;              /* usecs */
+	float jitter_max;
+	unsigned long rx_packets;
+	unsigned long rx_late;
+	unsigned long rx_foreign;
+	unsigned long rx_missing;       /* frames */
+	int32_t transit_max;            /* frames, from timestamp to arrival */
+	unsigned long tx_packets;
+	unsigned long tx_errors;
+};
+
+#endif /* __JACK_AES67_DRIVER_H__ */
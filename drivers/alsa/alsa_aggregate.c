@@ -0,0 +1,1026 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Secondary cards of the ALSA driver, resampled to the master's clock.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "internal.h"
+#include "engine.h"
+
+#include "alsa_driver.h"
+#include "alsa_aggregate.h"
+
+/* frames of the ring beyond what one cycle consumes. The capture ring
+   is held at this many frames more than a cycle needs, the playback
+   device buffer at this many frames. Secondaries report their hardware
+   pointer at no better than period granularity on some cards, so two
+   periods leave room for a whole period of jitter either way.
+ */
+#define AGG_TARGET_PERIODS      2
+#define AGG_BUFFER_PERIODS      4
+#define AGG_MAX_CHANNELS        64
+
+/* loop bandwidth in Hz, and how far the ratio may stray from 1 */
+#define AGG_DLL_BANDWIDTH       0.1
+#define AGG_MAX_DRIFT           0.005
+
+/* the interpolator reads one frame behind and two ahead */
+#define AGG_HISTORY             1
+#define AGG_LOOKAHEAD           2
+
+typedef struct {
+	snd_pcm_t *handle;
+	snd_pcm_format_t format;
+	unsigned int nchannels;
+	unsigned int sample_bytes;
+	snd_pcm_uframes_t buffer_size;
+
+	char *io_buf;                   /* interleaved device frames */
+	snd_pcm_uframes_t io_frames;
+
+	/* nchannels rings of ring_size floats. head counts the frames
+	   put in, pos/frac is where the interpolator reads next.
+	 */
+	float *ring;
+	uint32_t ring_size;             /* a power of two */
+	uint32_t head;
+	uint32_t pos;
+	double frac;
+
+	/* second order loop on the fill level, see agg_dll_update() */
+	double ratio;
+	double drift;
+	double target;
+	double b, c;
+	int resync;
+
+	JSList *ports;
+	unsigned int xruns;
+} agg_stream_t;
+
+typedef struct {
+	char *name;
+	agg_stream_t capture;
+	agg_stream_t playback;
+} agg_device_t;
+
+struct _alsa_aggregate {
+	alsa_driver_t *driver;
+	agg_device_t *devices;
+	unsigned int ndevices;
+	jack_nframes_t frames_per_cycle;
+
+	/* read positions and phases of one cycle, shared by all
+	   channels of a stream */
+	uint32_t *idx;
+	float *phase;
+	size_t max_out;
+	float *scratch;                 /* one cycle of one channel */
+};
+
+static inline uint32_t
+agg_fill (agg_stream_t *s)
+{
+	return s->head - s->pos;
+}
+
+static inline float *
+agg_ring (agg_stream_t *s, unsigned int chn)
+{
+	return s->ring + (size_t)chn * s->ring_size;
+}
+
+/* Catmull-Rom interpolation between r[i] and r[i+1] */
+static inline float
+agg_interp (const float *r, uint32_t mask, uint32_t i, float t)
+{
+	float xm1 = r[(i - 1) & mask];
+	float x0 = r[i & mask];
+	float x1 = r[(i + 1) & mask];
+	float x2 = r[(i + 2) & mask];
+	float c1 = 0.5f * (x1 - xm1);
+	float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+	float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+
+	return ((c3 * t + c2) * t + c1) * t + x0;
+}
+
+/* The loop follows jack_frame_timer_t: with omega = 2 pi B T for a
+   bandwidth B and a cycle of T seconds, b = sqrt(2) omega and
+   c = omega^2. The error is the distance of the fill from its target
+   in cycles, drift integrates it, and the ratio is the drift plus the
+   proportional term. For capture the ratio is input frames consumed
+   per output frame; for playback output frames made per input frame,
+   and the error is negated.
+ */
+static void
+agg_dll_init (agg_stream_t *s, jack_nframes_t frames_per_cycle,
+	      jack_nframes_t rate)
+{
+	double omega = 2.0 * M_PI * AGG_DLL_BANDWIDTH *
+		       (double)frames_per_cycle / (double)rate;
+
+	s->b = sqrt (2.0) * omega;
+	s->c = omega * omega;
+	s->target = AGG_TARGET_PERIODS * frames_per_cycle;
+	s->drift = 0.0;
+	s->ratio = 1.0;
+}
+
+static void
+agg_dll_update (agg_stream_t *s, double error, jack_nframes_t nframes)
+{
+	double e = error / (double)nframes;
+
+	s->drift += s->c * e;
+	if (s->drift > AGG_MAX_DRIFT) {
+		s->drift = AGG_MAX_DRIFT;
+	} else if (s->drift < -AGG_MAX_DRIFT) {
+		s->drift = -AGG_MAX_DRIFT;
+	}
+
+	s->ratio = 1.0 + s->drift + s->b * e;
+	if (s->ratio > 1.0 + 2 * AGG_MAX_DRIFT) {
+		s->ratio = 1.0 + 2 * AGG_MAX_DRIFT;
+	} else if (s->ratio < 1.0 - 2 * AGG_MAX_DRIFT) {
+		s->ratio = 1.0 - 2 * AGG_MAX_DRIFT;
+	}
+}
+
+/* conversion between interleaved device frames and the rings */
+
+static void
+agg_to_ring (agg_stream_t *s, const char *src, snd_pcm_uframes_t nframes)
+{
+	unsigned int chn, nch = s->nchannels;
+	uint32_t mask = s->ring_size - 1;
+	snd_pcm_uframes_t i;
+	float *r;
+
+	for (chn = 0; chn < nch; chn++) {
+		r = agg_ring (s, chn);
+		switch (s->format) {
+		case SND_PCM_FORMAT_FLOAT:
+			for (i = 0; i < nframes; i++) {
+				r[(s->head + i) & mask] =
+					((const float*)src)[i * nch + chn];
+			}
+			break;
+		case SND_PCM_FORMAT_S32:
+			for (i = 0; i < nframes; i++) {
+				r[(s->head + i) & mask] = (float)
+					(((const int32_t*)src)[i * nch + chn] *
+					 (1.0 / 2147483648.0));
+			}
+			break;
+		default:
+			for (i = 0; i < nframes; i++) {
+				r[(s->head + i) & mask] =
+					((const int16_t*)src)[i * nch + chn] *
+					(1.0f / 32768.0f);
+			}
+			break;
+		}
+	}
+
+	s->head += nframes;
+}
+
+static inline float
+agg_clip (float x)
+{
+	return x > 1.0f ? 1.0f : (x < -1.0f ? -1.0f : x);
+}
+
+static void
+agg_from_float (agg_stream_t *s, char *dst, const float *src,
+		unsigned int chn, size_t nframes)
+{
+	unsigned int nch = s->nchannels;
+	size_t i;
+
+	switch (s->format) {
+	case SND_PCM_FORMAT_FLOAT:
+		for (i = 0; i < nframes; i++) {
+			((float*)dst)[i * nch + chn] = src[i];
+		}
+		break;
+	case SND_PCM_FORMAT_S32:
+		for (i = 0; i < nframes; i++) {
+			((int32_t*)dst)[i * nch + chn] = (int32_t)
+				lrint (agg_clip (src[i]) * 2147483647.0);
+		}
+		break;
+	default:
+		for (i = 0; i < nframes; i++) {
+			((int16_t*)dst)[i * nch + chn] = (int16_t)
+				lrintf (agg_clip (src[i]) * 32767.0f);
+		}
+		break;
+	}
+}
+
+/* Work out where each of n output frames reads, stepping by `step'
+   input frames from the stream's position, and move the position on.
+ */
+static void
+agg_plan (alsa_aggregate_t *agg, agg_stream_t *s, size_t n, double step)
+{
+	double p = s->frac;
+	double whole;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		whole = floor (p);
+		agg->idx[i] = s->pos + (uint32_t)whole;
+		agg->phase[i] = (float)(p - whole);
+		p += step;
+	}
+
+	whole = floor (p);
+	s->pos += (uint32_t)whole;
+	s->frac = p - whole;
+}
+
+/* interpolate frames [offset, offset + n) of the plan of one channel */
+static void
+agg_render (alsa_aggregate_t *agg, agg_stream_t *s, unsigned int chn,
+	    size_t offset, float *dst, size_t n)
+{
+	const float *r = agg_ring (s, chn);
+	uint32_t mask = s->ring_size - 1;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] = agg_interp (r, mask, agg->idx[offset + i],
+				     agg->phase[offset + i]);
+	}
+}
+
+/* PCM setup */
+
+static int
+agg_configure (agg_device_t *dev, agg_stream_t *s, snd_pcm_stream_t stream,
+	       jack_nframes_t rate, jack_nframes_t frames_per_cycle)
+{
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t period = frames_per_cycle;
+	snd_pcm_uframes_t ring;
+	static const snd_pcm_format_t formats[] = {
+		SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S16
+	};
+	const char *what = stream == SND_PCM_STREAM_CAPTURE ?
+			   "capture" : "playback";
+	unsigned int actual_rate = rate;
+	unsigned int i;
+	int dir = 0;
+	int err;
+
+	snd_pcm_hw_params_alloca (&hw);
+	snd_pcm_sw_params_alloca (&sw);
+
+	if ((err = snd_pcm_hw_params_any (s->handle, hw)) < 0 ||
+	    (err = snd_pcm_hw_params_set_access (s->handle, hw,
+						 SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+		jack_error ("ALSA: aggregate %s \"%s\" does not support "
+			    "interleaved access (%s)", what, dev->name,
+			    snd_strerror (err));
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (snd_pcm_hw_params_set_format (s->handle, hw, formats[i]) == 0) {
+			break;
+		}
+	}
+	if (i == sizeof(formats) / sizeof(formats[0])) {
+		jack_error ("ALSA: aggregate %s \"%s\" has no usable "
+			    "sample format", what, dev->name);
+		return -1;
+	}
+	s->format = formats[i];
+	s->sample_bytes = snd_pcm_format_physical_width (s->format) / 8;
+
+	if ((err = snd_pcm_hw_params_set_rate_near (s->handle, hw,
+						    &actual_rate, 0)) < 0 ||
+	    actual_rate != rate) {
+		jack_error ("ALSA: aggregate %s \"%s\" cannot run at %" PRIu32
+			    " Hz", what, dev->name, rate);
+		return -1;
+	}
+
+	if ((err = snd_pcm_hw_params_get_channels_max (hw, &s->nchannels)) < 0) {
+		return -1;
+	}
+	if (s->nchannels > AGG_MAX_CHANNELS) {
+		s->nchannels = AGG_MAX_CHANNELS;
+	}
+	if ((err = snd_pcm_hw_params_set_channels (s->handle, hw,
+						   s->nchannels)) < 0) {
+		jack_error ("ALSA: cannot set %u channels on aggregate %s "
+			    "\"%s\" (%s)", s->nchannels, what, dev->name,
+			    snd_strerror (err));
+		return -1;
+	}
+
+	s->buffer_size = AGG_BUFFER_PERIODS * frames_per_cycle;
+	if ((err = snd_pcm_hw_params_set_period_size_near (s->handle, hw,
+							   &period, &dir)) < 0 ||
+	    (err = snd_pcm_hw_params_set_buffer_size_near (s->handle, hw,
+							   &s->buffer_size)) < 0 ||
+	    (err = snd_pcm_hw_params (s->handle, hw)) < 0) {
+		jack_error ("ALSA: cannot configure aggregate %s \"%s\" (%s)",
+			    what, dev->name, snd_strerror (err));
+		return -1;
+	}
+
+	if (s->buffer_size < (AGG_TARGET_PERIODS + 1) * frames_per_cycle) {
+		jack_error ("ALSA: buffer of aggregate %s \"%s\" is too "
+			    "small (%lu frames)", what, dev->name,
+			    (unsigned long)s->buffer_size);
+		return -1;
+	}
+
+	/* both directions are started by hand, and playback keeps
+	   running through an underrun into silence rather than stop */
+	snd_pcm_sw_params_current (s->handle, sw);
+	snd_pcm_sw_params_set_start_threshold (s->handle, sw,
+					       s->buffer_size * 2);
+	snd_pcm_sw_params_set_avail_min (s->handle, sw, period);
+	if ((err = snd_pcm_sw_params (s->handle, sw)) < 0) {
+		jack_error ("ALSA: cannot set software parameters of "
+			    "aggregate %s \"%s\" (%s)", what, dev->name,
+			    snd_strerror (err));
+		return -1;
+	}
+
+	free (s->io_buf);
+	free (s->ring);
+
+	s->io_frames = s->buffer_size;
+	s->io_buf = malloc (s->io_frames * s->nchannels * s->sample_bytes);
+
+	for (ring = 1; ring < 2 * s->buffer_size + AGG_LOOKAHEAD + 1; ring <<= 1) {
+		;
+	}
+	s->ring_size = ring;
+	s->ring = calloc ((size_t)s->ring_size * s->nchannels, sizeof(float));
+
+	if (s->io_buf == NULL || s->ring == NULL) {
+		jack_error ("ALSA: out of memory for aggregate \"%s\"",
+			    dev->name);
+		return -1;
+	}
+
+	agg_dll_init (s, frames_per_cycle, rate);
+
+	jack_info ("ALSA: aggregate %s \"%s\": %u channels, %s, "
+		   "buffer %lu frames", what, dev->name, s->nchannels,
+		   snd_pcm_format_name (s->format),
+		   (unsigned long)s->buffer_size);
+
+	return 0;
+}
+
+static int
+agg_open (alsa_aggregate_t *agg, agg_device_t *dev, agg_stream_t *s,
+	  snd_pcm_stream_t stream)
+{
+	int err;
+
+	if ((err = snd_pcm_open (&s->handle, dev->name, stream,
+				 SND_PCM_NONBLOCK)) < 0) {
+		jack_error ("ALSA: cannot open aggregate %s device \"%s\" (%s)",
+			    stream == SND_PCM_STREAM_CAPTURE ?
+			    "capture" : "playback", dev->name,
+			    snd_strerror (err));
+		s->handle = NULL;
+		return -1;
+	}
+
+	if (agg_configure (dev, s, stream, agg->driver->frame_rate,
+			   agg->frames_per_cycle)) {
+		snd_pcm_close (s->handle);
+		s->handle = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+agg_stream_free (agg_stream_t *s)
+{
+	if (s->handle) {
+		snd_pcm_close (s->handle);
+		s->handle = NULL;
+	}
+	free (s->io_buf);
+	free (s->ring);
+	s->io_buf = NULL;
+	s->ring = NULL;
+}
+
+static int
+agg_alloc_plan (alsa_aggregate_t *agg)
+{
+	/* playback makes at most nframes * (1 + 2 * AGG_MAX_DRIFT)
+	   frames a cycle, plus rounding */
+	agg->max_out = agg->frames_per_cycle +
+		       (size_t)(agg->frames_per_cycle * 4 * AGG_MAX_DRIFT) + 4;
+
+	free (agg->idx);
+	free (agg->phase);
+	free (agg->scratch);
+	agg->idx = malloc (agg->max_out * sizeof(uint32_t));
+	agg->phase = malloc (agg->max_out * sizeof(float));
+	agg->scratch = malloc (agg->frames_per_cycle * sizeof(float));
+
+	return (agg->idx && agg->phase && agg->scratch) ? 0 : -1;
+}
+
+alsa_aggregate_t *
+alsa_aggregate_new (alsa_driver_t *driver, const JSList *devices)
+{
+	alsa_aggregate_t *agg;
+	agg_device_t *dev;
+	const JSList *node;
+
+	if (devices == NULL) {
+		return NULL;
+	}
+
+	if ((agg = calloc (1, sizeof(alsa_aggregate_t))) == NULL) {
+		return NULL;
+	}
+
+	agg->driver = driver;
+	agg->frames_per_cycle = driver->frames_per_cycle;
+	agg->devices = calloc (jack_slist_length ((JSList*)devices),
+			       sizeof(agg_device_t));
+	if (agg->devices == NULL || agg_alloc_plan (agg)) {
+		alsa_aggregate_delete (agg);
+		return NULL;
+	}
+
+	for (node = devices; node; node = jack_slist_next (node)) {
+		dev = &agg->devices[agg->ndevices];
+		dev->name = strdup ((const char*)node->data);
+
+		if (driver->capture_handle &&
+		    agg_open (agg, dev, &dev->capture, SND_PCM_STREAM_CAPTURE)) {
+			agg_stream_free (&dev->capture);
+		}
+		if (driver->playback_handle &&
+		    agg_open (agg, dev, &dev->playback, SND_PCM_STREAM_PLAYBACK)) {
+			agg_stream_free (&dev->playback);
+		}
+
+		if (!dev->capture.handle && !dev->playback.handle) {
+			jack_error ("ALSA: leaving \"%s\" out of the aggregate",
+				    dev->name);
+			free (dev->name);
+			continue;
+		}
+
+		agg->ndevices++;
+	}
+
+	if (agg->ndevices == 0) {
+		alsa_aggregate_delete (agg);
+		return NULL;
+	}
+
+	return agg;
+}
+
+void
+alsa_aggregate_delete (alsa_aggregate_t *agg)
+{
+	unsigned int i;
+
+	if (agg == NULL) {
+		return;
+	}
+
+	for (i = 0; i < agg->ndevices; i++) {
+		agg_stream_free (&agg->devices[i].capture);
+		agg_stream_free (&agg->devices[i].playback);
+		free (agg->devices[i].name);
+	}
+
+	free (agg->devices);
+	free (agg->idx);
+	free (agg->phase);
+	free (agg->scratch);
+	free (agg);
+}
+
+int
+alsa_aggregate_set_period (alsa_aggregate_t *agg,
+			   jack_nframes_t frames_per_cycle)
+{
+	agg_device_t *dev;
+	unsigned int i;
+
+	agg->frames_per_cycle = frames_per_cycle;
+	if (agg_alloc_plan (agg)) {
+		return -1;
+	}
+
+	for (i = 0; i < agg->ndevices; i++) {
+		dev = &agg->devices[i];
+		if (dev->capture.handle) {
+			snd_pcm_drop (dev->capture.handle);
+			if (agg_configure (dev, &dev->capture,
+					   SND_PCM_STREAM_CAPTURE,
+					   agg->driver->frame_rate,
+					   frames_per_cycle)) {
+				return -1;
+			}
+		}
+		if (dev->playback.handle) {
+			snd_pcm_drop (dev->playback.handle);
+			if (agg_configure (dev, &dev->playback,
+					   SND_PCM_STREAM_PLAYBACK,
+					   agg->driver->frame_rate,
+					   frames_per_cycle)) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* ports */
+
+static void
+agg_set_latency (alsa_aggregate_t *agg, agg_stream_t *s,
+		 jack_latency_callback_mode_t mode)
+{
+	alsa_driver_t *driver = agg->driver;
+	jack_latency_range_t range;
+	JSList *node;
+
+	/* the master's latency, plus what the ring or the device buffer
+	   is held at */
+	if (mode == JackCaptureLatency) {
+		range.min = range.max = driver->frames_per_cycle +
+					driver->capture_frame_latency +
+					(jack_nframes_t)s->target;
+	} else {
+		range.min = range.max = (jack_nframes_t)s->target +
+					driver->playback_frame_latency;
+	}
+
+	for (node = s->ports; node; node = jack_slist_next (node)) {
+		jack_port_set_latency_range ((jack_port_t*)node->data, mode,
+					     &range);
+	}
+}
+
+static void
+agg_register (alsa_aggregate_t *agg, agg_stream_t *s, const char *fmt,
+	      unsigned long *number, int flags)
+{
+	char buf[32];
+	jack_port_t *port;
+	unsigned int chn;
+
+	for (chn = 0; chn < s->nchannels; chn++) {
+		snprintf (buf, sizeof(buf), fmt, ++(*number));
+		if ((port = jack_port_register (agg->driver->client, buf,
+						JACK_DEFAULT_AUDIO_TYPE,
+						flags, 0)) == NULL) {
+			jack_error ("ALSA: cannot register port for %s", buf);
+			break;
+		}
+		s->ports = jack_slist_append (s->ports, port);
+	}
+}
+
+int
+alsa_aggregate_attach (alsa_aggregate_t *agg)
+{
+	alsa_driver_t *driver = agg->driver;
+	unsigned long capture = driver->capture_nchannels;
+	unsigned long playback = driver->playback_nchannels;
+	agg_device_t *dev;
+	unsigned int i;
+
+	/* the secondaries' ports follow on from the master's */
+	for (i = 0; i < agg->ndevices; i++) {
+		dev = &agg->devices[i];
+		if (dev->capture.handle) {
+			agg_register (agg, &dev->capture, "capture_%lu",
+				      &capture, JackPortIsOutput |
+				      JackPortIsPhysical | JackPortIsTerminal);
+			agg_set_latency (agg, &dev->capture, JackCaptureLatency);
+		}
+		if (dev->playback.handle) {
+			agg_register (agg, &dev->playback, "playback_%lu",
+				      &playback, JackPortIsInput |
+				      JackPortIsPhysical | JackPortIsTerminal);
+			agg_set_latency (agg, &dev->playback, JackPlaybackLatency);
+		}
+	}
+
+	return 0;
+}
+
+static void
+agg_unregister (alsa_aggregate_t *agg, agg_stream_t *s)
+{
+	JSList *node;
+
+	for (node = s->ports; node; node = jack_slist_next (node)) {
+		jack_port_unregister (agg->driver->client,
+				      (jack_port_t*)node->data);
+	}
+	jack_slist_free (s->ports);
+	s->ports = NULL;
+}
+
+void
+alsa_aggregate_detach (alsa_aggregate_t *agg)
+{
+	unsigned int i;
+
+	for (i = 0; i < agg->ndevices; i++) {
+		agg_unregister (agg, &agg->devices[i].capture);
+		agg_unregister (agg, &agg->devices[i].playback);
+	}
+}
+
+void
+alsa_aggregate_latency (alsa_aggregate_t *agg,
+			jack_latency_callback_mode_t mode)
+{
+	unsigned int i;
+
+	for (i = 0; i < agg->ndevices; i++) {
+		agg_set_latency (agg, mode == JackCaptureLatency ?
+				 &agg->devices[i].capture :
+				 &agg->devices[i].playback, mode);
+	}
+}
+
+/* running */
+
+static void
+agg_reset_ring (agg_stream_t *s, uint32_t fill)
+{
+	memset (s->ring, 0, (size_t)s->ring_size * s->nchannels * sizeof(float));
+	s->pos = AGG_HISTORY;
+	s->head = AGG_HISTORY + fill;
+	s->frac = 0.0;
+}
+
+/* queue `nframes' frames of silence on a playback device */
+static int
+agg_write_silence (agg_stream_t *s, snd_pcm_uframes_t nframes)
+{
+	snd_pcm_sframes_t n;
+
+	memset (s->io_buf, 0, s->io_frames * s->nchannels * s->sample_bytes);
+
+	while (nframes) {
+		n = snd_pcm_writei (s->handle, s->io_buf,
+				    nframes < s->io_frames ? nframes : s->io_frames);
+		if (n < 0) {
+			return n;
+		}
+		nframes -= n;
+	}
+
+	return 0;
+}
+
+static int
+agg_start_capture (agg_device_t *dev)
+{
+	agg_stream_t *s = &dev->capture;
+	int err;
+
+	if ((err = snd_pcm_prepare (s->handle)) < 0 ||
+	    (err = snd_pcm_start (s->handle)) < 0) {
+		jack_error ("ALSA: could not start aggregate capture \"%s\" (%s)",
+			    dev->name, snd_strerror (err));
+		return -1;
+	}
+
+	/* the first cycle puts the read position where it belongs */
+	agg_reset_ring (s, 0);
+	s->resync = 1;
+
+	return 0;
+}
+
+static int
+agg_start_playback (agg_device_t *dev)
+{
+	agg_stream_t *s = &dev->playback;
+	int err;
+
+	if ((err = snd_pcm_prepare (s->handle)) < 0 ||
+	    (err = agg_write_silence (s, (snd_pcm_uframes_t)s->target)) < 0 ||
+	    (err = snd_pcm_start (s->handle)) < 0) {
+		jack_error ("ALSA: could not start aggregate playback \"%s\" (%s)",
+			    dev->name, snd_strerror (err));
+		return -1;
+	}
+
+	agg_reset_ring (s, 0);
+
+	return 0;
+}
+
+int
+alsa_aggregate_start (alsa_aggregate_t *agg)
+{
+	agg_device_t *dev;
+	unsigned int i;
+
+	for (i = 0; i < agg->ndevices; i++) {
+		dev = &agg->devices[i];
+		if (dev->playback.handle && agg_start_playback (dev)) {
+			return -1;
+		}
+		if (dev->capture.handle && agg_start_capture (dev)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void
+alsa_aggregate_stop (alsa_aggregate_t *agg)
+{
+	agg_device_t *dev;
+	jack_nframes_t nframes = agg->driver->engine->control->buffer_size;
+	JSList *node;
+	unsigned int i;
+
+	for (i = 0; i < agg->ndevices; i++) {
+		dev = &agg->devices[i];
+		if (dev->capture.handle) {
+			snd_pcm_drop (dev->capture.handle);
+		}
+		if (dev->playback.handle) {
+			snd_pcm_drop (dev->playback.handle);
+		}
+
+		/* as for the master, in case we go offline */
+		for (node = dev->capture.ports; node;
+		     node = jack_slist_next (node)) {
+			memset (jack_port_get_buffer ((jack_port_t*)node->data,
+						      nframes),
+				0, sizeof(jack_default_audio_sample_t) * nframes);
+		}
+	}
+}
+
+static void
+agg_xrun (agg_device_t *dev, agg_stream_t *s, int err)
+{
+	s->xruns++;
+	jack_error ("ALSA: xrun on aggregate %s \"%s\" (%s), restarting it",
+		    s == &dev->capture ? "capture" : "playback", dev->name,
+		    snd_strerror (err));
+
+	if (s == &dev->capture) {
+		agg_start_capture (dev);
+	} else {
+		agg_start_playback (dev);
+	}
+}
+
+/* move everything the card has captured into the ring */
+static int
+agg_pull (agg_stream_t *s)
+{
+	snd_pcm_sframes_t avail, n;
+	uint32_t space;
+
+	if ((avail = snd_pcm_avail (s->handle)) < 0) {
+		return avail;
+	}
+
+	while (avail > 0) {
+		space = s->ring_size - agg_fill (s) - AGG_HISTORY;
+		n = avail;
+		if ((snd_pcm_uframes_t)n > s->io_frames) {
+			n = s->io_frames;
+		}
+		if ((uint32_t)n > space) {
+			/* way behind: forget the oldest frames */
+			s->pos += (uint32_t)n - space;
+		}
+		if ((n = snd_pcm_readi (s->handle, s->io_buf, n)) < 0) {
+			return n == -EAGAIN ? 0 : n;
+		}
+		agg_to_ring (s, s->io_buf, n);
+		avail -= n;
+	}
+
+	return 0;
+}
+
+static void
+agg_capture (alsa_aggregate_t *agg, agg_device_t *dev, jack_nframes_t nframes,
+	     int silent)
+{
+	agg_stream_t *s = &dev->capture;
+	jack_default_audio_sample_t *buf;
+	uint32_t need;
+	unsigned int chn;
+	JSList *node;
+	int err;
+
+	if ((err = agg_pull (s)) < 0) {
+		agg_xrun (dev, s, err);
+		agg_pull (s);
+	}
+
+	if (s->resync) {
+		/* start out with the fill on target */
+		s->pos = s->head - (uint32_t)s->target;
+		s->frac = 0.0;
+		s->resync = 0;
+	} else {
+		agg_dll_update (s, (double)agg_fill (s) - s->frac - s->target,
+				nframes);
+	}
+
+	need = (uint32_t)ceil (s->frac + nframes * s->ratio) + AGG_LOOKAHEAD;
+	if (agg_fill (s) < need ||
+	    agg_fill (s) > s->ring_size - AGG_HISTORY - AGG_LOOKAHEAD) {
+		/* lost track: go back to the target, dropping or
+		   repeating audio once rather than every cycle */
+		s->xruns++;
+		s->pos = s->head - (uint32_t)s->target;
+		s->frac = 0.0;
+		s->ratio = 1.0 + s->drift;
+	}
+
+	agg_plan (agg, s, nframes, s->ratio);
+
+	if (silent) {
+		return;
+	}
+
+	for (chn = 0, node = s->ports; node;
+	     node = jack_slist_next (node), chn++) {
+		if (!jack_port_connected ((jack_port_t*)node->data)) {
+			continue;
+		}
+		buf = jack_port_get_buffer ((jack_port_t*)node->data, nframes);
+		agg_render (agg, s, chn, 0, buf, nframes);
+	}
+}
+
+static void
+agg_playback (alsa_aggregate_t *agg, agg_device_t *dev, jack_nframes_t nframes,
+	      int silent)
+{
+	agg_stream_t *s = &dev->playback;
+	jack_default_audio_sample_t *buf;
+	snd_pcm_sframes_t avail, n;
+	uint32_t mask = s->ring_size - 1;
+	size_t nout, done;
+	unsigned int chn;
+	jack_nframes_t i;
+	double have;
+	JSList *node;
+	float *r;
+
+	if (agg_fill (s) + nframes > s->ring_size - AGG_HISTORY) {
+		/* the device has not been taking frames: start over */
+		agg_start_playback (dev);
+	}
+
+	if ((avail = snd_pcm_avail (s->handle)) < 0) {
+		agg_xrun (dev, s, avail);
+		if ((avail = snd_pcm_avail (s->handle)) < 0) {
+			return;
+		}
+	}
+
+	/* the jack side goes into the ring at the master's rate */
+	for (chn = 0, node = s->ports; chn < s->nchannels;
+	     chn++, node = node ? jack_slist_next (node) : NULL) {
+		r = agg_ring (s, chn);
+		if (silent || node == NULL ||
+		    !jack_port_connected ((jack_port_t*)node->data)) {
+			for (i = 0; i < nframes; i++) {
+				r[(s->head + i) & mask] = 0.0f;
+			}
+			continue;
+		}
+		buf = jack_port_get_buffer ((jack_port_t*)node->data, nframes);
+		for (i = 0; i < nframes; i++) {
+			r[(s->head + i) & mask] = buf[i];
+		}
+	}
+	s->head += nframes;
+
+	/* hold the device's fill on target */
+	agg_dll_update (s, s->target - (double)(s->buffer_size - avail),
+			nframes);
+
+	/* make as many output frames as the input allows, stepping by
+	   1/ratio input frames, but never more than the device takes */
+	have = (double)agg_fill (s) - AGG_LOOKAHEAD - s->frac;
+	nout = have > 0.0 ? (size_t)(have * s->ratio) : 0;
+	if (nout > agg->max_out) {
+		nout = agg->max_out;
+	}
+	if (nout > (size_t)avail) {
+		s->xruns++;
+		nout = avail;
+	}
+
+	agg_plan (agg, s, nout, 1.0 / s->ratio);
+
+	for (done = 0; done < nout; done += n) {
+		n = nout - done;
+		if ((snd_pcm_uframes_t)n > agg->frames_per_cycle) {
+			n = agg->frames_per_cycle;
+		}
+		for (chn = 0; chn < s->nchannels; chn++) {
+			agg_render (agg, s, chn, done, agg->scratch, n);
+			agg_from_float (s, s->io_buf, agg->scratch, chn, n);
+		}
+		if ((n = snd_pcm_writei (s->handle, s->io_buf, n)) < 0) {
+			if (n != -EAGAIN) {
+				agg_xrun (dev, s, n);
+			}
+			return;
+		}
+	}
+}
+
+void
+alsa_aggregate_read (alsa_aggregate_t *agg, jack_nframes_t nframes)
+{
+	unsigned int i;
+
+	for (i = 0; i < agg->ndevices; i++) {
+		if (agg->devices[i].capture.handle) {
+			agg_capture (agg, &agg->devices[i], nframes, 0);
+		}
+	}
+}
+
+void
+alsa_aggregate_write (alsa_aggregate_t *agg, jack_nframes_t nframes)
+{
+	unsigned int i;
+
+	for (i = 0; i < agg->ndevices; i++) {
+		if (agg->devices[i].playback.handle) {
+			agg_playback (agg, &agg->devices[i], nframes, 0);
+		}
+	}
+}
+
+void
+alsa_aggregate_null_cycle (alsa_aggregate_t *agg, jack_nframes_t nframes)
+{
+	unsigned int i;
+
+	/* keep the secondaries and their loops running on silence */
+	for (i = 0; i < agg->ndevices; i++) {
+		if (agg->devices[i].capture.handle) {
+			agg_capture (agg, &agg->devices[i], nframes, 1);
+		}
+		if (agg->devices[i].playback.handle) {
+			agg_playback (agg, &agg->devices[i], nframes, 1);
+		}
+	}
+}
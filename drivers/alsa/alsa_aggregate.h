@@ -0,0 +1,61 @@
+/*
+    Secondary cards of the ALSA driver, resampled to the master's clock.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#ifndef __jack_alsa_aggregate_h__
+#define __jack_alsa_aggregate_h__
+
+#include <jack/jack.h>
+#include <jack/types.h>
+#include <jack/jslist.h>
+
+/* Secondary cards of an aggregate ALSA driver.
+ *
+ * Each PCM given with -A/--aggregate is opened next to the master
+ * device and its ports are added after the master's. The secondaries
+ * are not clock-synced to the master: every cycle the driver thread
+ * moves whatever they have captured (or can take for playback)
+ * through a small ring, measures the ring fill against its target with
+ * a second order delay-locked loop like the one of jack_frame_timer_t,
+ * and resamples by the resulting ratio with a cubic interpolator, so
+ * a slow drift between the cards turns into a tiny, smoothly varying
+ * rate change rather than xruns.
+ */
+
+struct _alsa_driver;
+
+typedef struct _alsa_aggregate alsa_aggregate_t;
+
+alsa_aggregate_t *alsa_aggregate_new (struct _alsa_driver *driver,
+				      const JSList *devices);
+void alsa_aggregate_delete (alsa_aggregate_t *agg);
+
+int  alsa_aggregate_attach (alsa_aggregate_t *agg);
+void alsa_aggregate_detach (alsa_aggregate_t *agg);
+int  alsa_aggregate_start (alsa_aggregate_t *agg);
+void alsa_aggregate_stop (alsa_aggregate_t *agg);
+int  alsa_aggregate_set_period (alsa_aggregate_t *agg,
+				jack_nframes_t frames_per_cycle);
+
+void alsa_aggregate_read (alsa_aggregate_t *agg, jack_nframes_t nframes);
+void alsa_aggregate_write (alsa_aggregate_t *agg, jack_nframes_t nframes);
+void alsa_aggregate_null_cycle (alsa_aggregate_t *agg, jack_nframes_t nframes);
+void alsa_aggregate_latency (alsa_aggregate_t *agg,
+			     jack_latency_callback_mode_t mode);
+
+#endif /* __jack_alsa_aggregate_h__ */
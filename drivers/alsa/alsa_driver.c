@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <regex.h>
 #include <string.h>
@@ -54,11 +55,16 @@ extern void show_work_times();
 /* Delay (in process calls) before jackd will report an xrun */
 #define XRUN_REPORT_DELAY 0
 
+/* Hardware buffer used in timer-based scheduling mode */
+#define ALSA_TSCHED_BUFFER_MSECS 250
+#define ALSA_TSCHED_PERIODS 2
+
 static void
 alsa_driver_release_channel_dependent_memory (alsa_driver_t *driver)
 {
 	bitset_destroy (&driver->channels_done);
 	bitset_destroy (&driver->channels_not_done);
+	bitset_destroy (&driver->channels_early);
 
 	if (driver->playback_addr) {
 		free (driver->playback_addr);
@@ -70,6 +76,16 @@ alsa_driver_release_channel_dependent_memory (alsa_driver_t *driver)
 		driver->capture_addr = 0;
 	}
 
+	if (driver->playback_bufs) {
+		free (driver->playback_bufs);
+		driver->playback_bufs = NULL;
+	}
+
+	if (driver->capture_bufs) {
+		free (driver->capture_bufs);
+		driver->capture_bufs = NULL;
+	}
+
 	if (driver->playback_interleave_skip) {
 		free (driver->playback_interleave_skip);
 		driver->playback_interleave_skip = NULL;
@@ -250,6 +266,14 @@ alsa_driver_hw_specific (alsa_driver_t *driver, int hw_monitoring,
 static void
 alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 {
+	const char *simd = memops_simd_init ();
+
+	if (simd) {
+		jack_info ("ALSA: using %s sample conversion", simd);
+	}
+
+	driver->write_multi = NULL;
+
 	if (driver->playback_handle) {
 		if (SND_PCM_FORMAT_FLOAT_LE == driver->playback_sample_format) {
 			driver->write_via_copy = sample_move_dS_floatLE;
@@ -269,6 +293,10 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 					driver->write_via_copy = driver->quirk_bswap ?
 								 sample_move_dither_tri_d16_sSs :
 								 sample_move_dither_tri_d16_sS;
+					if (!driver->quirk_bswap && !driver->exact_dither) {
+						driver->write_multi =
+							sample_move_dither_tri_d16_sS_multi;
+					}
 					break;
 
 				case Shaped:
@@ -276,11 +304,16 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 					driver->write_via_copy = driver->quirk_bswap ?
 								 sample_move_dither_shaped_d16_sSs :
 								 sample_move_dither_shaped_d16_sS;
+					if (!driver->quirk_bswap && !driver->exact_dither) {
+						driver->write_multi =
+							sample_move_dither_shaped_d16_sS_multi;
+					}
 					break;
 
 				default:
 					driver->write_via_copy = driver->quirk_bswap ?
 								 sample_move_d16_sSs :
+								 simd ? sample_move_d16_sS_simd :
 								 sample_move_d16_sS;
 					break;
 				}
@@ -289,6 +322,7 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 			case 3: /* NO DITHER */
 				driver->write_via_copy = driver->quirk_bswap ?
 							 sample_move_d24_sSs :
+							 simd ? sample_move_d24_sS_simd :
 							 sample_move_d24_sS;
 
 				break;
@@ -296,6 +330,7 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 			case 4: /* NO DITHER */
 				driver->write_via_copy = driver->quirk_bswap ?
 							 sample_move_d32u24_sSs :
+							 simd ? sample_move_d32u24_sS_simd :
 							 sample_move_d32u24_sS;
 				break;
 
@@ -307,24 +342,34 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 		}
 	}
 
+	driver->read_double = NULL;
+
 	if (driver->capture_handle) {
 		if (SND_PCM_FORMAT_FLOAT_LE == driver->capture_sample_format) {
 			driver->read_via_copy = sample_move_floatLE_sSs;
 		} else {
+			if (driver->capture_sample_bytes == 4) {
+				driver->read_double = driver->quirk_bswap ?
+						      sample_move_dD_s32s :
+						      sample_move_dD_s32;
+			}
 			switch (driver->capture_sample_bytes) {
 			case 2:
 				driver->read_via_copy = driver->quirk_bswap ?
 							sample_move_dS_s16s :
+							simd ? sample_move_dS_s16_simd :
 							sample_move_dS_s16;
 				break;
 			case 3:
 				driver->read_via_copy = driver->quirk_bswap ?
 							sample_move_dS_s24s :
+							simd ? sample_move_dS_s24_simd :
 							sample_move_dS_s24;
 				break;
 			case 4:
 				driver->read_via_copy = driver->quirk_bswap ?
 							sample_move_dS_s32u24s :
+							simd ? sample_move_dS_s32u24_simd :
 							sample_move_dS_s32u24;
 				break;
 			}
@@ -332,6 +377,68 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 	}
 }
 
+/* frames of playback data kept queued ahead of the hardware pointer
+   in timer-based scheduling mode
+ */
+static inline jack_nframes_t
+alsa_driver_tsched_fill (alsa_driver_t *driver)
+{
+	return driver->user_nperiods * driver->frames_per_cycle
+	       + driver->tsched_margin;
+}
+
+/* In timer-based scheduling mode the hardware gets a buffer much
+   larger than the playback latency, split into as few periods as it
+   allows, so that it rarely interrupts. Only alsa_driver_tsched_fill()
+   frames of it are kept queued and alsa_driver_wait() sleeps on a
+   timer until snd_pcm_avail_update() says a cycle is due.
+ */
+static int
+alsa_driver_configure_tsched (alsa_driver_t *driver, const char *stream_name,
+			      snd_pcm_t *handle, snd_pcm_hw_params_t *hw_params,
+			      unsigned int *nperiodsp)
+{
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t min_size;
+	unsigned int periods = ALSA_TSCHED_PERIODS;
+
+	min_size = alsa_driver_tsched_fill (driver) + driver->frames_per_cycle;
+	buffer_size = ((snd_pcm_uframes_t)driver->frame_rate
+		       * ALSA_TSCHED_BUFFER_MSECS) / 1000;
+	if (buffer_size < min_size) {
+		buffer_size = min_size;
+	}
+
+	if (snd_pcm_hw_params_set_buffer_size_near (handle, hw_params,
+						    &buffer_size) < 0) {
+		jack_error ("ALSA: cannot set buffer length to %lu for %s",
+			    buffer_size, stream_name);
+		return -1;
+	}
+
+	if (buffer_size < min_size) {
+		jack_error ("ALSA: got a buffer of %lu frames for %s, timer "
+			    "scheduling needs at least %lu",
+			    buffer_size, stream_name, min_size);
+		return -1;
+	}
+
+	if (snd_pcm_hw_params_set_periods_near (handle, hw_params,
+						&periods, NULL) < 0) {
+		jack_error ("ALSA: cannot set number of periods to %u for %s",
+			    periods, stream_name);
+		return -1;
+	}
+
+	*nperiodsp = buffer_size / driver->frames_per_cycle;
+
+	jack_info ("ALSA: timer scheduling for %s, buffer = %lu frames in "
+		   "%u periods, wakeup margin = %" PRIu32 " frames",
+		   stream_name, buffer_size, periods, driver->tsched_margin);
+
+	return 0;
+}
+
 static int
 alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 			      const char *stream_name,
@@ -345,6 +452,7 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 	int err, format;
 	unsigned int frame_rate;
 	snd_pcm_uframes_t stop_th;
+	snd_pcm_uframes_t buffer_size;
 
 	static struct {
 		char Name[40];
@@ -463,52 +571,59 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 		return -1;
 	}
 
-	if ((err = snd_pcm_hw_params_set_period_size (handle, hw_params,
-						      driver->frames_per_cycle,
-						      0))
-	    < 0) {
-		jack_error ("ALSA: cannot set period size to %" PRIu32
-			    " frames for %s", driver->frames_per_cycle,
-			    stream_name);
-		return -1;
-	}
+	if (driver->tsched_margin_usecs) {
+		if (alsa_driver_configure_tsched (driver, stream_name, handle,
+						  hw_params, nperiodsp)) {
+			return -1;
+		}
+	} else {
+		if ((err = snd_pcm_hw_params_set_period_size (handle, hw_params,
+							      driver->frames_per_cycle,
+							      0))
+		    < 0) {
+			jack_error ("ALSA: cannot set period size to %" PRIu32
+				    " frames for %s", driver->frames_per_cycle,
+				    stream_name);
+			return -1;
+		}
 
-	*nperiodsp = driver->user_nperiods;
-	snd_pcm_hw_params_set_periods_min (handle, hw_params, nperiodsp, NULL);
-	if (*nperiodsp < driver->user_nperiods) {
 		*nperiodsp = driver->user_nperiods;
-	}
-	if (snd_pcm_hw_params_set_periods_near (handle, hw_params,
-						nperiodsp, NULL) < 0) {
-		jack_error ("ALSA: cannot set number of periods to %u for %s",
-			    *nperiodsp, stream_name);
-		return -1;
-	}
+		snd_pcm_hw_params_set_periods_min (handle, hw_params, nperiodsp, NULL);
+		if (*nperiodsp < driver->user_nperiods) {
+			*nperiodsp = driver->user_nperiods;
+		}
+		if (snd_pcm_hw_params_set_periods_near (handle, hw_params,
+							nperiodsp, NULL) < 0) {
+			jack_error ("ALSA: cannot set number of periods to %u for %s",
+				    *nperiodsp, stream_name);
+			return -1;
+		}
 
-	if (*nperiodsp < driver->user_nperiods) {
-		jack_error ("ALSA: got smaller periods %u than %u for %s",
-			    *nperiodsp, (unsigned int)driver->user_nperiods,
-			    stream_name);
-		return -1;
-	}
-	jack_info ("ALSA: use %d periods for %s", *nperiodsp, stream_name);
+		if (*nperiodsp < driver->user_nperiods) {
+			jack_error ("ALSA: got smaller periods %u than %u for %s",
+				    *nperiodsp, (unsigned int)driver->user_nperiods,
+				    stream_name);
+			return -1;
+		}
+		jack_info ("ALSA: use %d periods for %s", *nperiodsp, stream_name);
 #if 0
-	if (!jack_power_of_two (driver->frames_per_cycle)) {
-		jack_error ("JACK: frames must be a power of two "
-			    "(64, 512, 1024, ...)\n");
-		return -1;
-	}
+		if (!jack_power_of_two (driver->frames_per_cycle)) {
+			jack_error ("JACK: frames must be a power of two "
+				    "(64, 512, 1024, ...)\n");
+			return -1;
+		}
 #endif
 
-	if ((err = snd_pcm_hw_params_set_buffer_size (handle, hw_params,
-						      *nperiodsp *
-						      driver->frames_per_cycle))
-	    < 0) {
-		jack_error ("ALSA: cannot set buffer length to %" PRIu32
-			    " for %s",
-			    *nperiodsp * driver->frames_per_cycle,
-			    stream_name);
-		return -1;
+		if ((err = snd_pcm_hw_params_set_buffer_size (handle, hw_params,
+							      *nperiodsp *
+							      driver->frames_per_cycle))
+		    < 0) {
+			jack_error ("ALSA: cannot set buffer length to %" PRIu32
+				    " for %s",
+				    *nperiodsp * driver->frames_per_cycle,
+				    stream_name);
+			return -1;
+		}
 	}
 
 	if ((err = snd_pcm_hw_params (handle, hw_params)) < 0) {
@@ -517,6 +632,13 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 		return -1;
 	}
 
+	snd_pcm_hw_params_get_buffer_size (hw_params, &buffer_size);
+	if (handle == driver->playback_handle) {
+		driver->playback_buffer_size = buffer_size;
+	} else {
+		driver->capture_buffer_size = buffer_size;
+	}
+
 	snd_pcm_sw_params_current (handle, sw_params);
 
 	if ((err = snd_pcm_sw_params_set_start_threshold (handle, sw_params,
@@ -526,6 +648,9 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 	}
 
 	stop_th = *nperiodsp * driver->frames_per_cycle;
+	if (driver->tsched_margin_usecs) {
+		stop_th = buffer_size;
+	}
 	if (driver->soft_mode) {
 		stop_th = (snd_pcm_uframes_t)-1;
 	}
@@ -558,7 +683,14 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 	}
 #endif
 
-	if (handle == driver->playback_handle) {
+	if (driver->tsched_margin_usecs) {
+		/* the timer wakes us up, not the period interrupts */
+		err = snd_pcm_sw_params_set_avail_min (
+			handle, sw_params, buffer_size);
+		if (err == 0) {
+			snd_pcm_sw_params_set_period_event (handle, sw_params, 0);
+		}
+	} else if (handle == driver->playback_handle) {
 		err = snd_pcm_sw_params_set_avail_min (
 			handle, sw_params,
 			driver->frames_per_cycle
@@ -578,6 +710,16 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 		return -1;
 	}
 
+#if SND_LIB_VERSION >= 0x01001d
+	/* gettimeofday() steps with the wall clock; without this the
+	   timestamps are still good for xrun lengths, and the period
+	   times are worked out against CLOCK_REALTIME */
+	if (snd_pcm_sw_params_set_tstamp_type (
+		    handle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0) {
+		driver->hw_clock = CLOCK_MONOTONIC;
+	}
+#endif
+
 	if ((err = snd_pcm_sw_params (handle, sw_params)) < 0) {
 		jack_error ("ALSA: cannot set software parameters for %s\n",
 			    stream_name);
@@ -607,6 +749,8 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 	driver->frame_rate = rate;
 	driver->frames_per_cycle = frames_per_cycle;
 	driver->user_nperiods = user_nperiods;
+	driver->tsched_margin = (jack_nframes_t)
+				((driver->tsched_margin_usecs * rate) / 1000000);
 
 	jack_info ("configuring for %" PRIu32 "Hz, period = %"
 		   PRIu32 " frames (%.1f ms), buffer = %" PRIu32 " periods",
@@ -718,7 +862,8 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 			(access == SND_PCM_ACCESS_MMAP_INTERLEAVED)
 			|| (access == SND_PCM_ACCESS_MMAP_COMPLEX);
 
-		if (p_period_size != driver->frames_per_cycle) {
+		if (p_period_size != driver->frames_per_cycle
+		    && !driver->tsched_margin_usecs) {
 			jack_error ("alsa_pcm: requested an interrupt every %"
 				    PRIu32
 				    " frames but got %u frames for playback",
@@ -756,7 +901,8 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 			(access == SND_PCM_ACCESS_MMAP_INTERLEAVED)
 			|| (access == SND_PCM_ACCESS_MMAP_COMPLEX);
 
-		if (c_period_size != driver->frames_per_cycle) {
+		if (c_period_size != driver->frames_per_cycle
+		    && !driver->tsched_margin_usecs) {
 			jack_error ("alsa_pcm: requested an interrupt every %"
 				    PRIu32
 				    " frames but got %uc frames for capture",
@@ -860,12 +1006,16 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 
 	bitset_create (&driver->channels_done, driver->max_nchannels);
 	bitset_create (&driver->channels_not_done, driver->max_nchannels);
+	bitset_create (&driver->channels_early, driver->max_nchannels);
 
 	if (driver->playback_handle) {
 		driver->playback_addr = (char**)
 					malloc (sizeof(char *) * driver->playback_nchannels);
 		memset (driver->playback_addr, 0,
 			sizeof(char *) * driver->playback_nchannels);
+		driver->playback_bufs = (jack_default_audio_sample_t**)
+					calloc (driver->playback_nchannels,
+						sizeof(jack_default_audio_sample_t *));
 		driver->playback_interleave_skip = (unsigned long*)
 						   malloc (sizeof(unsigned long *) * driver->playback_nchannels);
 		memset (driver->playback_interleave_skip, 0,
@@ -890,6 +1040,9 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 				       malloc (sizeof(char *) * driver->capture_nchannels);
 		memset (driver->capture_addr, 0,
 			sizeof(char *) * driver->capture_nchannels);
+		driver->capture_bufs = (jack_default_audio_sample_t**)
+				       calloc (driver->capture_nchannels,
+					       sizeof(jack_default_audio_sample_t *));
 		driver->capture_interleave_skip = (unsigned long*)
 						  malloc (sizeof(unsigned long *) * driver->capture_nchannels);
 		memset (driver->capture_interleave_skip, 0,
@@ -991,12 +1144,53 @@ alsa_driver_get_channel_addresses (alsa_driver_t *driver,
 	return 0;
 }
 
+/* what alsa_driver_start() queues before it starts playback, and
+   what the playback stream holds after every cycle */
+static jack_nframes_t
+alsa_driver_start_fill (alsa_driver_t *driver)
+{
+	if (driver->tsched_margin_usecs) {
+		return alsa_driver_tsched_fill (driver);
+	}
+	return driver->user_nperiods * driver->frames_per_cycle;
+}
+
+/* Queue `frames' of silence for playback. */
+static int
+alsa_driver_queue_silence (alsa_driver_t *driver, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t poffset, pavail = frames;
+	channel_t chn;
+
+	if (alsa_driver_get_channel_addresses (driver,
+					       0, &pavail, 0, &poffset)) {
+		return -1;
+	}
+
+	/* XXX this is cheating. ALSA offers no guarantee that
+	   we can access the entire buffer at any one time. It
+	   works on most hardware tested so far, however, buts
+	   its a liability in the long run. I think that
+	   alsa-lib may have a better function for doing this
+	   here, where the goal is to silence the entire
+	   buffer.
+	 */
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		alsa_driver_silence_on_channel (driver, chn, frames);
+	}
+
+	snd_pcm_mmap_commit (driver->playback_handle, poffset, frames);
+
+	return 0;
+}
+
 static int
 alsa_driver_start (alsa_driver_t *driver)
 {
 	int err;
-	snd_pcm_uframes_t poffset, pavail;
-	channel_t chn;
+	snd_pcm_uframes_t pavail;
+	jack_nframes_t fill;
 
 	driver->poll_last = 0;
 	driver->poll_next = 0;
@@ -1062,38 +1256,23 @@ alsa_driver_start (alsa_driver_t *driver)
 		 */
 
 		pavail = snd_pcm_avail_update (driver->playback_handle);
+		fill = alsa_driver_start_fill (driver);
 
-		if (pavail !=
-		    driver->frames_per_cycle * driver->playback_nperiods) {
+		if (driver->tsched_margin_usecs) {
+			if (pavail != driver->playback_buffer_size) {
+				jack_error ("ALSA: full buffer not available at start");
+				return -1;
+			}
+		} else if (pavail !=
+			   driver->frames_per_cycle * driver->playback_nperiods) {
 			jack_error ("ALSA: full buffer not available at start");
 			return -1;
 		}
 
-		if (alsa_driver_get_channel_addresses (driver,
-						       0, &pavail, 0, &poffset)) {
+		if (alsa_driver_queue_silence (driver, fill)) {
 			return -1;
 		}
 
-		/* XXX this is cheating. ALSA offers no guarantee that
-		   we can access the entire buffer at any one time. It
-		   works on most hardware tested so far, however, buts
-		   its a liability in the long run. I think that
-		   alsa-lib may have a better function for doing this
-		   here, where the goal is to silence the entire
-		   buffer.
-		 */
-
-		for (chn = 0; chn < driver->playback_nchannels; chn++) {
-			alsa_driver_silence_on_channel (
-				driver, chn,
-				driver->user_nperiods
-				* driver->frames_per_cycle);
-		}
-
-		snd_pcm_mmap_commit (driver->playback_handle, poffset,
-				     driver->user_nperiods
-				     * driver->frames_per_cycle);
-
 		if ((err = snd_pcm_start (driver->playback_handle)) < 0) {
 			jack_error ("ALSA: could not start playback (%s)",
 				    snd_strerror (err));
@@ -1110,6 +1289,10 @@ alsa_driver_start (alsa_driver_t *driver)
 		}
 	}
 
+	if (driver->aggregate && alsa_aggregate_start (driver->aggregate)) {
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1136,6 +1319,16 @@ alsa_driver_stop (alsa_driver_t *driver)
 		memset (buf, 0, sizeof(jack_default_audio_sample_t) * nframes);
 	}
 
+	for (node = driver->capture_double_ports; node;
+	     node = jack_slist_next (node)) {
+
+		jack_port_t* port = (jack_port_t*)node->data;
+		jack_nframes_t nframes = driver->engine->control->buffer_size;
+
+		memset (jack_port_get_buffer (port, nframes), 0,
+			sizeof(double) * nframes);
+	}
+
 	if (driver->playback_handle) {
 		if ((err = snd_pcm_drop (driver->playback_handle)) < 0) {
 			jack_error ("ALSA: channel flush for playback "
@@ -1160,6 +1353,10 @@ alsa_driver_stop (alsa_driver_t *driver)
 		driver->hw->set_input_monitor_mask (driver->hw, 0);
 	}
 
+	if (driver->aggregate) {
+		alsa_aggregate_stop (driver->aggregate);
+	}
+
 	return 0;
 }
 
@@ -1177,11 +1374,111 @@ alsa_driver_restart (alsa_driver_t *driver)
 	return res;
 }
 
+/* Get going again after an xrun without stopping the driver. Only the
+ * stream that ran over is prepared and started again, the other one
+ * goes on where it is, and the two are lined up again as they are
+ * after a cycle: playback holds alsa_driver_start_fill() frames and
+ * capture has nothing left to read, so the next cycle comes one period
+ * later. Linked streams run over together and are prepared and
+ * started together, but even then the ports, poll descriptors and
+ * monitoring are left alone. Returns -1 if the driver has to be
+ * restarted instead.
+ */
+static int
+alsa_driver_xrun_resume (alsa_driver_t *driver)
+{
+	snd_pcm_sframes_t avail, delay, fill;
+	int capture_xrun, playback_xrun, err;
+
+	if (driver->aggregate) {
+		return -1;
+	}
+
+	capture_xrun = driver->capture_handle &&
+		       snd_pcm_state (driver->capture_handle)
+		       == SND_PCM_STATE_XRUN;
+	playback_xrun = driver->playback_handle &&
+			snd_pcm_state (driver->playback_handle)
+			== SND_PCM_STATE_XRUN;
+
+	if (!capture_xrun && !playback_xrun) {
+		return -1;
+	}
+
+	if (driver->capture_handle && driver->playback_handle &&
+	    !driver->capture_and_playback_not_synced) {
+		capture_xrun = playback_xrun = TRUE;
+	}
+
+	driver->poll_last = 0;
+	driver->poll_next = 0;
+
+	if (playback_xrun) {
+		if ((err = snd_pcm_prepare (driver->playback_handle)) < 0) {
+			jack_error ("ALSA: prepare error for playback on "
+				    "\"%s\" (%s)", driver->alsa_name_playback,
+				    snd_strerror (err));
+			return -1;
+		}
+		if (alsa_driver_queue_silence (driver,
+					       alsa_driver_start_fill (driver))) {
+			return -1;
+		}
+	} else if (driver->playback_handle) {
+		/* it played on from what it had queued */
+		fill = alsa_driver_start_fill (driver);
+		if (snd_pcm_delay (driver->playback_handle, &delay) < 0) {
+			return -1;
+		}
+		if (delay < fill) {
+			if (alsa_driver_queue_silence (driver, fill - delay)) {
+				return -1;
+			}
+		} else if (delay > fill) {
+			snd_pcm_rewind (driver->playback_handle, delay - fill);
+		}
+	}
+
+	if (capture_xrun &&
+	    (!driver->playback_handle || driver->capture_and_playback_not_synced)) {
+		if ((err = snd_pcm_prepare (driver->capture_handle)) < 0) {
+			jack_error ("ALSA: prepare error for capture on \"%s\""
+				    " (%s)", driver->alsa_name_capture,
+				    snd_strerror (err));
+			return -1;
+		}
+	}
+
+	if (playback_xrun &&
+	    (err = snd_pcm_start (driver->playback_handle)) < 0) {
+		jack_error ("ALSA: could not start playback (%s)",
+			    snd_strerror (err));
+		return -1;
+	}
+
+	if (capture_xrun &&
+	    (!driver->playback_handle || driver->capture_and_playback_not_synced)) {
+		if ((err = snd_pcm_start (driver->capture_handle)) < 0) {
+			jack_error ("ALSA: could not start capture (%s)",
+				    snd_strerror (err));
+			return -1;
+		}
+	} else if (driver->capture_handle && !capture_xrun) {
+		/* drop what it took in while playback was down */
+		if ((avail = snd_pcm_avail_update (driver->capture_handle)) > 0) {
+			snd_pcm_forward (driver->capture_handle, avail);
+		}
+	}
+
+	return 0;
+}
+
 static int
 alsa_driver_xrun_recovery (alsa_driver_t *driver, float *delayed_usecs)
 {
 	snd_pcm_status_t *status;
-	int res;
+	jack_time_t start, took;
+	int res, resumed = FALSE;
 
 	snd_pcm_status_alloca (&status);
 
@@ -1212,6 +1509,22 @@ alsa_driver_xrun_recovery (alsa_driver_t *driver, float *delayed_usecs)
 		}
 	}
 
+	start = driver->engine->get_microseconds ();
+
+	if (snd_pcm_status_get_state (status) == SND_PCM_STATE_XRUN &&
+	    alsa_driver_xrun_resume (driver) == 0) {
+		resumed = TRUE;
+		driver->xrun_resumed++;
+	} else if (alsa_driver_restart (driver)) {
+		return -1;
+	}
+
+	took = driver->engine->get_microseconds () - start;
+	if (took > driver->xrun_recovery_max) {
+		driver->xrun_recovery_max = took;
+	}
+	driver->engine->control->driver_recovery_usecs = (uint32_t)took;
+
 	if (snd_pcm_status_get_state (status) == SND_PCM_STATE_XRUN
 	    && driver->process_count > XRUN_REPORT_DELAY) {
 		struct timeval now, diff, tstamp;
@@ -1221,13 +1534,11 @@ alsa_driver_xrun_recovery (alsa_driver_t *driver, float *delayed_usecs)
 		timersub (&now, &tstamp, &diff);
 		*delayed_usecs = diff.tv_sec * 1000000.0 + diff.tv_usec;
 		MESSAGE ("\n\n**** alsa_pcm: xrun of at least %.3f "
-			 "msecs\n\n",
-			 *delayed_usecs / 1000.0);
+			 "msecs, %s in %.3f msecs\n\n",
+			 *delayed_usecs / 1000.0,
+			 resumed ? "resumed" : "restarted", took / 1000.0);
 	}
 
-	if (alsa_driver_restart (driver)) {
-		return -1;
-	}
 	return 0;
 }
 
@@ -1236,8 +1547,11 @@ alsa_driver_silence_untouched_channels (alsa_driver_t *driver,
 					jack_nframes_t nframes)
 {
 	channel_t chn;
-	jack_nframes_t buffer_frames =
-		driver->frames_per_cycle * driver->playback_nperiods;
+	jack_nframes_t buffer_frames = driver->playback_buffer_size;
+
+	/* once a channel's whole ring buffer holds silence there is
+	   nothing left to write until it is touched again.
+	 */
 
 	for (chn = 0; chn < driver->playback_nchannels; chn++) {
 		if (bitset_contains (driver->channels_not_done, chn)) {
@@ -1260,6 +1574,155 @@ alsa_driver_set_clock_sync_status (alsa_driver_t *driver, channel_t chn,
 
 static int under_gdb = FALSE;
 
+/* playback frames that may be written without queueing more than
+   alsa_driver_tsched_fill() frames
+ */
+static inline snd_pcm_sframes_t
+alsa_driver_tsched_space (alsa_driver_t *driver, snd_pcm_sframes_t avail)
+{
+	return avail - (snd_pcm_sframes_t)(driver->playback_buffer_size
+					   - alsa_driver_tsched_fill (driver));
+}
+
+/* Sleep on a high resolution timer until the hardware pointers have
+   moved far enough for a full cycle. The sleep is computed from
+   snd_pcm_avail_update() and the sample rate, and recomputed after
+   every wakeup so that clock drift between the timer and the card
+   does not accumulate. Returns 0 when a cycle is due, 1 on an xrun
+   and a negative wait status on failure.
+ */
+static int
+alsa_driver_tsched_sleep (alsa_driver_t *driver)
+{
+	snd_pcm_sframes_t avail;
+	snd_pcm_sframes_t ready;
+	jack_time_t usecs;
+	jack_time_t slept = 0;
+	struct timespec ts;
+	int err;
+
+	while (1) {
+
+		ready = INT_MAX;
+
+		if (driver->capture_handle) {
+			if ((avail = snd_pcm_avail_update (
+				     driver->capture_handle)) < 0) {
+				if (avail == -EPIPE) {
+					return 1;
+				}
+				jack_error ("ALSA: capture avail_update failed (%s)",
+					    snd_strerror (avail));
+				return -6;
+			}
+			ready = avail;
+		}
+
+		if (driver->playback_handle) {
+			if ((avail = snd_pcm_avail_update (
+				     driver->playback_handle)) < 0) {
+				if (avail == -EPIPE) {
+					return 1;
+				}
+				jack_error ("ALSA: playback avail_update failed (%s)",
+					    snd_strerror (avail));
+				return -6;
+			}
+			avail = alsa_driver_tsched_space (driver, avail);
+			if (avail < ready) {
+				ready = avail;
+			}
+		}
+
+		if (ready >= (snd_pcm_sframes_t)driver->frames_per_cycle) {
+			return 0;
+		}
+
+		if (ready < 0) {
+			ready = 0;
+		}
+
+		/* slept through the whole playback latency: the
+		   hardware pointers are not moving
+		 */
+		if (slept > driver->period_usecs * driver->user_nperiods) {
+			jack_error ("ALSA: timer wait timed out, slept for %"
+				    PRIu64 " usecs", slept);
+			return -5;
+		}
+
+		usecs = ((driver->frames_per_cycle - ready) * 1000000ULL
+			 + driver->frame_rate - 1) / driver->frame_rate;
+
+		ts.tv_sec = usecs / 1000000;
+		ts.tv_nsec = (usecs % 1000000) * 1000;
+
+		if ((err = clock_nanosleep (CLOCK_MONOTONIC, 0, &ts, NULL))
+		    != 0) {
+			if (err == EINTR) {
+				jack_info ("timer interrupt");
+				if (under_gdb) {
+					continue;
+				}
+				return -2;
+			}
+			jack_error ("ALSA: clock_nanosleep failed (%s)",
+				    strerror (err));
+			return -3;
+		}
+
+		slept += usecs;
+	}
+}
+
+/* When the last period boundary went by, from the timestamp the
+   kernel took at the last update of the hardware pointer rather than
+   from when poll() returned, which adds however long the scheduler
+   took to wake the driver thread. The frames past the boundary came in
+   after it. Falls back to `now' when the device gives no timestamps,
+   or implausible ones.
+ */
+static jack_time_t
+alsa_driver_period_ust (alsa_driver_t *driver, jack_time_t now)
+{
+	snd_pcm_t *handle = driver->capture_handle ?
+			    driver->capture_handle : driver->playback_handle;
+	snd_pcm_uframes_t avail;
+	snd_htimestamp_t ts;
+	struct timespec clk;
+	int64_t age;
+
+	if (snd_pcm_htimestamp (handle, &avail, &ts) < 0 ||
+	    (ts.tv_sec == 0 && ts.tv_nsec == 0) ||
+	    clock_gettime (driver->hw_clock, &clk)) {
+		return now;
+	}
+
+	age = ((int64_t)(clk.tv_sec - ts.tv_sec) * 1000000000LL
+	       + (clk.tv_nsec - ts.tv_nsec)) / 1000
+	      + (int64_t)(avail % driver->frames_per_cycle) * 1000000
+	      / driver->frame_rate;
+
+	if (age < 0 || age > (int64_t)driver->period_usecs) {
+		return now;
+	}
+
+	return driver->engine->get_microseconds () - age;
+}
+
+/* account for a wakeup of the driver thread at poll_ret */
+static void
+alsa_driver_woken (alsa_driver_t *driver, jack_time_t poll_ret,
+		   float *delayed_usecs)
+{
+	if (driver->poll_next && poll_ret > driver->poll_next) {
+		*delayed_usecs = poll_ret - driver->poll_next;
+	}
+	driver->poll_last = poll_ret;
+	driver->poll_next = poll_ret + driver->period_usecs;
+	driver->engine->transport_cycle_start (driver->engine, poll_ret);
+}
+
 static jack_nframes_t
 alsa_driver_wait (alsa_driver_t *driver, int extra_fd, int *status, float
 		  *delayed_usecs)
@@ -1287,6 +1750,31 @@ alsa_driver_wait (alsa_driver_t *driver, int extra_fd, int *status, float
 
 again:
 
+	if (driver->tsched_margin_usecs && extra_fd < 0) {
+		int err;
+
+		poll_enter = driver->engine->get_microseconds ();
+
+		if (poll_enter > driver->poll_next) {
+			driver->poll_next = 0;
+			driver->poll_late++;
+		}
+
+		if ((err = alsa_driver_tsched_sleep (driver)) < 0) {
+			*status = err;
+			return 0;
+		}
+		if (err > 0) {
+			xrun_detected = TRUE;
+		}
+
+		poll_ret = driver->engine->get_microseconds ();
+		alsa_driver_woken (driver, poll_ret, delayed_usecs);
+
+		need_playback = 0;
+		need_capture = 0;
+	}
+
 	while (need_playback || need_capture) {
 
 		int poll_result;
@@ -1360,13 +1848,7 @@ again:
 		poll_ret = driver->engine->get_microseconds ();
 
 		if (extra_fd < 0) {
-			if (driver->poll_next && poll_ret > driver->poll_next) {
-				*delayed_usecs = poll_ret - driver->poll_next;
-			}
-			driver->poll_last = poll_ret;
-			driver->poll_next = poll_ret + driver->period_usecs;
-			driver->engine->transport_cycle_start (driver->engine,
-							       poll_ret);
+			alsa_driver_woken (driver, poll_ret, delayed_usecs);
 		}
 
 #ifdef DEBUG_WAKEUP
@@ -1472,6 +1954,9 @@ again:
 				jack_error ("unknown ALSA avail_update return"
 					    " value (%u)", playback_avail);
 			}
+		} else if (driver->tsched_margin_usecs) {
+			playback_avail = alsa_driver_tsched_space (
+				driver, playback_avail);
 		}
 	} else {
 		/* odd, but see min() computation below */
@@ -1484,7 +1969,7 @@ again:
 	}
 
 	*status = 0;
-	driver->last_wait_ust = poll_ret;
+	driver->last_wait_ust = alsa_driver_period_ust (driver, poll_ret);
 
 	avail = capture_avail < playback_avail ? capture_avail : playback_avail;
 
@@ -1561,15 +2046,28 @@ alsa_driver_null_cycle (alsa_driver_t* driver, jack_nframes_t nframes)
 		}
 	}
 
+	if (driver->aggregate) {
+		alsa_aggregate_null_cycle (driver->aggregate, nframes);
+	}
+
 	return 0;
 }
 
 static int
 alsa_driver_bufsize (alsa_driver_t* driver, jack_nframes_t nframes)
 {
-	return alsa_driver_reset_parameters (driver, nframes,
-					     driver->user_nperiods,
-					     driver->frame_rate);
+	if (alsa_driver_reset_parameters (driver, nframes,
+					  driver->user_nperiods,
+					  driver->frame_rate)) {
+		return -1;
+	}
+
+	if (driver->aggregate &&
+	    alsa_aggregate_set_period (driver->aggregate, nframes)) {
+		return -1;
+	}
+
+	return 0;
 }
 
 static int
@@ -1583,8 +2081,13 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 	channel_t chn;
 	JSList *node;
 	jack_port_t* port;
+	unsigned long nactive;
 	int err;
 
+	/* a new cycle: nothing written ahead of alsa_driver_write() yet */
+	driver->early_state = 0;
+	bitset_clear (driver->channels_early);
+
 	if (nframes > driver->frames_per_cycle) {
 		return -1;
 	}
@@ -1593,6 +2096,10 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 		return 0;
 	}
 
+	if (driver->aggregate) {
+		alsa_aggregate_read (driver->aggregate, nframes);
+	}
+
 	if (!driver->capture_handle) {
 		return 0;
 	}
@@ -1613,6 +2120,14 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 			return -1;
 		}
 
+		if (driver->capture_interleaved) {
+			memset (driver->capture_bufs, 0,
+				sizeof(jack_default_audio_sample_t *)
+				* driver->capture_nchannels);
+		}
+
+		nactive = 0;
+
 		for (chn = 0, node = driver->capture_ports; node;
 		     node = jack_slist_next (node), chn++) {
 
@@ -1623,8 +2138,37 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 				continue;
 			}
 			buf = jack_port_get_buffer (port, orig_nframes);
-			alsa_driver_read_from_channel (driver, chn,
-						       buf + nread, contiguous);
+			nactive++;
+			if (driver->capture_interleaved) {
+				driver->capture_bufs[chn] = buf + nread;
+			} else {
+				alsa_driver_read_from_channel (driver, chn,
+							       buf + nread, contiguous);
+			}
+		}
+
+		/* 64 bit ports straight from the 32 bit samples */
+		for (chn = 0, node = driver->capture_double_ports; node;
+		     node = jack_slist_next (node), chn++) {
+
+			port = (jack_port_t*)node->data;
+
+			if (!jack_port_connected (port)) {
+				continue;
+			}
+			alsa_driver_read_double_from_channel (
+				driver, chn,
+				(double*)jack_port_get_buffer (port, orig_nframes)
+				+ nread, contiguous);
+		}
+
+		if (driver->capture_interleaved && nactive) {
+			sample_move_blocked_dS (driver->capture_bufs,
+						driver->capture_addr,
+						driver->capture_nchannels,
+						contiguous,
+						driver->capture_interleave_skip,
+						driver->read_via_copy);
 		}
 
 		if ((err = snd_pcm_mmap_commit (driver->capture_handle,
@@ -1641,6 +2185,139 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 	return 0;
 }
 
+/* Passthrough offload (-W).
+ *
+ * A capture channel whose one connection is the playback channel of
+ * the same number, which has no other, only copies the input to the
+ * output a couple of periods late. The cards with hardware monitoring
+ * route input N to output N in their own mixer, so with -W and -H such
+ * a pair is monitored there instead, and the playback channel is not
+ * written. As soon as anything else is connected to either end the
+ * pair goes back to the software path. The connection lists come from
+ * the port table, so this costs no request to the engine.
+ */
+#define ALSA_PASSTHRU_MAX 32
+
+static int
+alsa_driver_is_passthru (jack_port_t *capture, jack_port_t *playback)
+{
+	jack_port_shared_t *c = capture->shared;
+	jack_port_shared_t *p = playback->shared;
+	uint32_t seq;
+	int ret;
+
+	if ((seq = c->conn_seq) & 1) {
+		return 0;
+	}
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+	ret = c->n_connections == 1 && p->n_connections == 1 &&
+	      c->connection_ids[0] == p->id;
+
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+	return ret && c->conn_seq == seq;
+}
+
+static void
+alsa_driver_find_passthru (alsa_driver_t *driver)
+{
+	JSList *cnode, *pnode;
+	unsigned long mask = 0;
+	channel_t chn;
+
+	for (chn = 0, cnode = driver->capture_ports,
+	     pnode = driver->playback_ports;
+	     cnode && pnode && chn < ALSA_PASSTHRU_MAX;
+	     cnode = jack_slist_next (cnode), pnode = jack_slist_next (pnode),
+	     chn++) {
+		if (alsa_driver_is_passthru ((jack_port_t*)cnode->data,
+					     (jack_port_t*)pnode->data)) {
+			mask |= (1UL << chn);
+		}
+	}
+
+	if (mask != driver->passthru_mask) {
+		VERBOSE (driver->engine, "ALSA: hardware passthrough on "
+			 "channels 0x%lx", mask);
+	}
+	driver->passthru_mask = mask;
+}
+
+/* Early writes.
+ *
+ * In parallel mode the engine hands over a playback port as soon as
+ * the clients feeding it are done, see jack_dag_plan_early_writes(),
+ * and the channel is converted into the mmap area while the rest of
+ * the graph still runs. The first such port of a cycle maps the area
+ * for the whole period, which alsa_driver_write() then fills in and
+ * commits. If the period does not map in one piece, or monitor ports
+ * want copies of the playback data, the cycle is left to
+ * alsa_driver_write() as a whole.
+ */
+static int
+alsa_driver_write_port (alsa_driver_t *driver, jack_port_id_t port_id,
+			jack_nframes_t nframes)
+{
+	snd_pcm_sframes_t contiguous;
+	jack_default_audio_sample_t *buf;
+	jack_port_t *port = NULL;
+	JSList *node;
+	channel_t chn;
+	void *zero_buf;
+
+	if (driver->early_state < 0) {
+		return -1;
+	}
+
+	if (nframes > driver->frames_per_cycle || !driver->playback_handle ||
+	    driver->engine->freewheeling || driver->monitor_ports) {
+		driver->early_state = -1;
+		return -1;
+	}
+
+	for (chn = 0, node = driver->playback_ports; node;
+	     node = jack_slist_next (node), chn++) {
+		if (((jack_port_t*)node->data)->shared->id == port_id) {
+			port = (jack_port_t*)node->data;
+			break;
+		}
+	}
+
+	if (port == NULL ||
+	    (chn < ALSA_PASSTHRU_MAX && (driver->passthru_mask & (1UL << chn)))) {
+		return -1;
+	}
+
+	if (driver->early_state == 0) {
+		contiguous = nframes;
+		if (alsa_driver_get_channel_addresses (
+			    driver,
+			    (snd_pcm_uframes_t*)0,
+			    (snd_pcm_uframes_t*)&contiguous,
+			    0, &driver->early_offset) < 0 ||
+		    contiguous < nframes) {
+			driver->early_state = -1;
+			return -1;
+		}
+		driver->early_state = 1;
+	}
+
+	buf = jack_port_get_buffer (port, nframes);
+
+	/* silence is left to alsa_driver_silence_untouched_channels() */
+	zero_buf = (char*)*port->client_segment_base
+		   + port->type_info->zero_buffer_offset;
+	if ((void*)buf == zero_buf) {
+		return -1;
+	}
+
+	alsa_driver_write_to_channel (driver, chn, buf, nframes);
+	bitset_add (driver->channels_early, chn);
+
+	return 0;
+}
+
 static int
 alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 {
@@ -1654,16 +2331,21 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 	snd_pcm_sframes_t contiguous;
 	snd_pcm_uframes_t offset;
 	jack_port_t *port;
+	void *zero_buf;
+	unsigned long nactive;
 	int err;
 
 	driver->process_count++;
 
-	if (!driver->playback_handle || driver->engine->freewheeling) {
-		return 0;
-	}
 	if (nframes > driver->frames_per_cycle) {
 		return -1;
 	}
+	if (driver->aggregate && !driver->engine->freewheeling) {
+		alsa_aggregate_write (driver->aggregate, nframes);
+	}
+	if (!driver->playback_handle || driver->engine->freewheeling) {
+		return 0;
+	}
 
 	nwritten = 0;
 	contiguous = 0;
@@ -1680,6 +2362,11 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 		}
 	}
 
+	if (driver->hw_passthru && driver->hw_monitoring) {
+		alsa_driver_find_passthru (driver);
+		driver->input_monitor_mask |= driver->passthru_mask;
+	}
+
 	if (driver->hw_monitoring) {
 		if ((driver->hw->input_monitor_mask
 		     != driver->input_monitor_mask)
@@ -1693,26 +2380,60 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 
 		contiguous = nframes;
 
-		if (alsa_driver_get_channel_addresses (
-			    driver,
-			    (snd_pcm_uframes_t*)0,
-			    (snd_pcm_uframes_t*)&contiguous,
-			    0, &offset) < 0) {
+		if (driver->early_state > 0) {
+			/* the whole period, mapped by alsa_driver_write_port() */
+			offset = driver->early_offset;
+			driver->early_state = 0;
+		} else if (alsa_driver_get_channel_addresses (
+				   driver,
+				   (snd_pcm_uframes_t*)0,
+				   (snd_pcm_uframes_t*)&contiguous,
+				   0, &offset) < 0) {
 			return -1;
 		}
 
+		if (driver->playback_interleaved || driver->write_multi) {
+			memset (driver->playback_bufs, 0,
+				sizeof(jack_default_audio_sample_t *)
+				* driver->playback_nchannels);
+		}
+
+		nactive = 0;
+
 		for (chn = 0, node = driver->playback_ports, mon_node = driver->monitor_ports;
 		     node;
 		     node = jack_slist_next (node), chn++) {
 
 			port = (jack_port_t*)node->data;
 
-			if (!jack_port_connected (port)) {
+			/* a channel the card monitors itself is left to go
+			   silent like an unconnected one */
+			if (!jack_port_connected (port) ||
+			    (chn < ALSA_PASSTHRU_MAX &&
+			     (driver->passthru_mask & (1UL << chn))) ||
+			    bitset_contains (driver->channels_early, chn)) {
 				continue;
 			}
 			buf = jack_port_get_buffer (port, orig_nframes);
-			alsa_driver_write_to_channel (driver, chn,
-						      buf + nwritten, contiguous);
+
+			/* a port whose only feed is the engine's zero
+			   buffer is left to
+			   alsa_driver_silence_untouched_channels(), which
+			   stops writing once the ring holds silence.
+			 */
+			zero_buf = (char*)*port->client_segment_base
+				   + port->type_info->zero_buffer_offset;
+			if ((void*)buf == zero_buf) {
+				/* nothing to convert */
+			} else if (driver->playback_interleaved || driver->write_multi) {
+				/* written below, all channels at once */
+				driver->playback_bufs[chn] = buf + nwritten;
+				alsa_driver_mark_channel_done (driver, chn);
+				nactive++;
+			} else {
+				alsa_driver_write_to_channel (driver, chn,
+							      buf + nwritten, contiguous);
+			}
 
 			if (mon_node) {
 				port = (jack_port_t*)mon_node->data;
@@ -1726,6 +2447,25 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 		}
 
 
+		if (nactive == 0) {
+			/* every channel is idle or fed silence */
+		} else if (driver->write_multi) {
+			driver->write_multi (driver->playback_addr,
+					     driver->playback_bufs,
+					     driver->playback_nchannels,
+					     contiguous,
+					     driver->playback_interleave_skip,
+					     driver->dither_state);
+		} else if (driver->playback_interleaved) {
+			sample_move_blocked_d (driver->playback_addr,
+					       driver->playback_bufs,
+					       driver->playback_nchannels,
+					       contiguous,
+					       driver->playback_interleave_skip,
+					       driver->dither_state,
+					       driver->write_via_copy);
+		}
+
 		if (!bitset_empty (driver->channels_not_done)) {
 			alsa_driver_silence_untouched_channels (driver,
 								contiguous);
@@ -1800,6 +2540,10 @@ alsa_driver_latency_callback (jack_latency_callback_mode_t mode, void* arg)
 
 	for (node = client->ports; node; node = jack_slist_next (node))
 		jack_port_set_latency_range ((jack_port_t*)node->data, mode, &range);
+
+	if (driver->aggregate) {
+		alsa_aggregate_latency (driver->aggregate, mode);
+	}
 }
 
 static int
@@ -1841,6 +2585,31 @@ alsa_driver_attach (alsa_driver_t *driver)
 			jack_slist_append (driver->capture_ports, port);
 	}
 
+	if (driver->double_capture && driver->capture_handle &&
+	    driver->read_double == NULL) {
+		jack_info ("ALSA: the capture device does not deliver 32 bit"
+			   " samples, no 64 bit capture ports");
+	}
+
+	for (chn = 0; driver->double_capture && driver->read_double &&
+	     chn < driver->capture_nchannels; chn++) {
+
+		snprintf (buf, sizeof(buf), "capture_f64_%lu", chn + 1);
+
+		if ((port = jack_port_register (driver->client, buf,
+						JACK_DOUBLE_AUDIO_TYPE,
+						port_flags, 0)) == NULL) {
+			jack_error ("ALSA: cannot register port for %s", buf);
+			break;
+		}
+
+		range.min = range.max = driver->frames_per_cycle + driver->capture_frame_latency;
+		jack_port_set_latency_range (port, JackCaptureLatency, &range);
+
+		driver->capture_double_ports =
+			jack_slist_append (driver->capture_double_ports, port);
+	}
+
 	port_flags = JackPortIsInput | JackPortIsPhysical | JackPortIsTerminal;
 
 	for (chn = 0; chn < driver->playback_nchannels; chn++) {
@@ -1855,7 +2624,7 @@ alsa_driver_attach (alsa_driver_t *driver)
 			break;
 		}
 
-		range.min = range.max = (driver->frames_per_cycle * (driver->user_nperiods - 1)) + driver->playback_frame_latency;
+		range.min = range.max = (driver->frames_per_cycle * (driver->user_nperiods - 1)) + driver->tsched_margin + driver->playback_frame_latency;
 		jack_port_set_latency_range (port, JackPlaybackLatency, &range);
 
 		driver->playback_ports =
@@ -1882,6 +2651,10 @@ alsa_driver_attach (alsa_driver_t *driver)
 		}
 	}
 
+	if (driver->aggregate) {
+		alsa_aggregate_attach (driver->aggregate);
+	}
+
 	return jack_activate (driver->client);
 }
 
@@ -1902,6 +2675,14 @@ alsa_driver_detach (alsa_driver_t *driver)
 	jack_slist_free (driver->capture_ports);
 	driver->capture_ports = 0;
 
+	for (node = driver->capture_double_ports; node;
+	     node = jack_slist_next (node))
+		jack_port_unregister (driver->client,
+				      ((jack_port_t*)node->data));
+
+	jack_slist_free (driver->capture_double_ports);
+	driver->capture_double_ports = 0;
+
 	for (node = driver->playback_ports; node;
 	     node = jack_slist_next (node))
 		jack_port_unregister (driver->client,
@@ -1920,6 +2701,10 @@ alsa_driver_detach (alsa_driver_t *driver)
 		driver->monitor_ports = 0;
 	}
 
+	if (driver->aggregate) {
+		alsa_aggregate_detach (driver->aggregate);
+	}
+
 	return 0;
 }
 
@@ -1987,6 +2772,15 @@ alsa_driver_delete (alsa_driver_t *driver)
 		free (node->data);
 	jack_slist_free (driver->clock_sync_listeners);
 
+	if (driver->xrun_count) {
+		jack_info ("ALSA: %d xruns, %lu resumed without a restart,"
+			   " the longest recovery took %.3f msecs",
+			   driver->xrun_count, driver->xrun_resumed,
+			   driver->xrun_recovery_max / 1000.0);
+	}
+
+	alsa_aggregate_delete (driver->aggregate);
+
 	if (driver->ctl_handle) {
 		snd_ctl_close (driver->ctl_handle);
 		driver->ctl_handle = 0;
@@ -2158,7 +2952,12 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 		 int user_playback_nchnls,
 		 int shorts_first,
 		 jack_nframes_t capture_latency,
-		 jack_nframes_t playback_latency
+		 jack_nframes_t playback_latency,
+		 jack_time_t tsched_margin,
+		 int exact_dither,
+		 const JSList *aggregate_devices,
+		 int double_capture,
+		 int hw_passthru
 		 )
 {
 	int err;
@@ -2184,6 +2983,7 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 	driver->nt_detach = (JackDriverNTDetachFunction)alsa_driver_detach;
 	driver->read = (JackDriverReadFunction)alsa_driver_read;
 	driver->write = (JackDriverReadFunction)alsa_driver_write;
+	driver->write_port = (JackDriverWritePortFunction)alsa_driver_write_port;
 	driver->null_cycle =
 		(JackDriverNullCycleFunction)alsa_driver_null_cycle;
 	driver->nt_bufsize = (JackDriverNTBufSizeFunction)alsa_driver_bufsize;
@@ -2204,9 +3004,13 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 	driver->capture_sample_bytes = (shorts_first ? 2 : 4);
 	driver->capture_frame_latency = capture_latency;
 	driver->playback_frame_latency = playback_latency;
+	driver->tsched_margin_usecs = tsched_margin;
+	driver->hw_clock = CLOCK_REALTIME;
 
 	driver->playback_addr = 0;
 	driver->capture_addr = 0;
+	driver->playback_bufs = NULL;
+	driver->capture_bufs = NULL;
 	driver->playback_interleave_skip = NULL;
 	driver->capture_interleave_skip = NULL;
 	driver->previously_successfully_configured = FALSE;
@@ -2219,6 +3023,7 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 	driver->input_monitor_mask = 0;         /* XXX is it? */
 
 	driver->capture_ports = 0;
+	driver->capture_double_ports = 0;
 	driver->playback_ports = 0;
 	driver->monitor_ports = 0;
 
@@ -2227,6 +3032,11 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 	driver->capture_nfds = 0;
 
 	driver->dither = dither;
+	driver->exact_dither = exact_dither;
+	driver->double_capture = double_capture;
+	driver->hw_passthru = hw_passthru;
+	driver->passthru_mask = 0;
+	driver->read_double = NULL;
 	driver->soft_mode = soft_mode;
 
 	driver->quirk_bswap = 0;
@@ -2237,6 +3047,8 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 	driver->poll_late = 0;
 	driver->xrun_count = 0;
 	driver->process_count = 0;
+	driver->xrun_resumed = 0;
+	driver->xrun_recovery_max = 0;
 
 	driver->alsa_name_playback = strdup (playback_alsa_device);
 	driver->alsa_name_capture = strdup (capture_alsa_device);
@@ -2434,6 +3246,17 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 		}
 	}
 
+	if (aggregate_devices) {
+		driver->aggregate = alsa_aggregate_new (driver,
+							aggregate_devices);
+		if (driver->aggregate == NULL) {
+			jack_error ("ALSA: none of the aggregate devices "
+				    "could be used");
+			alsa_driver_delete (driver);
+			return NULL;
+		}
+	}
+
 	jack_set_latency_callback (client, alsa_driver_latency_callback, driver);
 
 	driver->client = client;
@@ -2544,7 +3367,7 @@ driver_get_descriptor ()
 	desc = calloc (1, sizeof(jack_driver_desc_t));
 
 	strcpy (desc->name, "alsa");
-	desc->nparams = 18;
+	desc->nparams = 23;
 
 	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
 
@@ -2606,6 +3429,16 @@ driver_get_descriptor ()
 	strcpy (params[i].short_desc, "Hardware monitoring, if available");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "hwpassthru");
+	params[i].character  = 'W';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = 0;
+	strcpy (params[i].short_desc, "Monitor direct capture to playback connections in hardware");
+	strcpy (params[i].long_desc,
+		"With --hwmon, route capture_N connected only to playback_N "
+		"through the card's mixer instead of the host");
+
 	i++;
 	strcpy (params[i].name, "hwmeter");
 	params[i].character  = 'M';
@@ -2703,6 +3536,47 @@ driver_get_descriptor ()
 	strcpy (params[i].short_desc, "legacy");
 	strcpy (params[i].long_desc, "legacy option - do not use");
 
+	i++;
+	strcpy (params[i].name, "tsched");
+	params[i].character  = 'T';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Timer-based scheduling, wakeup margin (usecs)");
+	strcpy (params[i].long_desc,
+		"Wake up from a timer instead of period interrupts, keeping "
+		"this many usecs of extra playback data queued (0 = off)");
+
+	i++;
+	strcpy (params[i].name, "exactdither");
+	params[i].character  = 'E';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = FALSE;
+	strcpy (params[i].short_desc, "Bit-exact serial dithering");
+	strcpy (params[i].long_desc,
+		"Dither one channel at a time, giving the same output as "
+		"older versions instead of dithering channels in parallel");
+
+	i++;
+	strcpy (params[i].name, "aggregate");
+	params[i].character  = 'A';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "none");
+	strcpy (params[i].short_desc, "Add a secondary ALSA device");
+	strcpy (params[i].long_desc,
+		"Open this PCM as well and resample it to the master "
+		"device's clock (may be given more than once)");
+
+	i++;
+	strcpy (params[i].name, "float64");
+	params[i].character  = 'F';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = FALSE;
+	strcpy (params[i].short_desc, "Add 64 bit float capture ports");
+	strcpy (params[i].long_desc,
+		"With 32 bit capture hardware, also provide capture_f64_N "
+		"ports that carry all 32 bits as 64 bit floats");
+
 	desc->params = params;
 
 	return desc;
@@ -2718,6 +3592,7 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	char *capture_pcm_name = "hw:0";
 	int hw_monitoring = FALSE;
 	int hw_metering = FALSE;
+	int hw_passthru = FALSE;
 	int capture = FALSE;
 	int playback = FALSE;
 	int soft_mode = FALSE;
@@ -2728,6 +3603,11 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	int shorts_first = FALSE;
 	jack_nframes_t systemic_input_latency = 0;
 	jack_nframes_t systemic_output_latency = 0;
+	jack_time_t tsched_margin = 0;
+	int exact_dither = FALSE;
+	JSList *aggregate_devices = NULL;
+	int double_capture = FALSE;
+	jack_driver_t *driver;
 	const JSList * node;
 	const jack_driver_param_t * param;
 
@@ -2772,6 +3652,10 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			hw_metering = param->value.i;
 			break;
 
+		case 'W':
+			hw_passthru = param->value.i;
+			break;
+
 		case 'r':
 			srate = param->value.ui;
 			jack_info ("apparent rate = %d", srate);
@@ -2821,6 +3705,25 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			/* ignored, legacy option */
 			break;
 
+		case 'T':
+			tsched_margin = param->value.ui;
+			break;
+
+		case 'E':
+			exact_dither = param->value.i;
+			break;
+
+		case 'A':
+			if (strcmp (param->value.str, "none") != 0) {
+				aggregate_devices = jack_slist_append (
+					aggregate_devices, (void*)param->value.str);
+			}
+			break;
+
+		case 'F':
+			double_capture = param->value.i;
+			break;
+
 		}
 	}
 
@@ -2830,16 +3733,23 @@ driver_initialize (jack_client_t *client, const JSList * params)
 		playback = TRUE;
 	}
 
-	return alsa_driver_new ("alsa_pcm", playback_pcm_name,
-				capture_pcm_name, client,
-				frames_per_interrupt,
-				user_nperiods, srate, hw_monitoring,
-				hw_metering, capture, playback, dither,
-				soft_mode, monitor,
-				user_capture_nchnls, user_playback_nchnls,
-				shorts_first,
-				systemic_input_latency,
-				systemic_output_latency);
+	driver = alsa_driver_new ("alsa_pcm", playback_pcm_name,
+				  capture_pcm_name, client,
+				  frames_per_interrupt,
+				  user_nperiods, srate, hw_monitoring,
+				  hw_metering, capture, playback, dither,
+				  soft_mode, monitor,
+				  user_capture_nchnls, user_playback_nchnls,
+				  shorts_first,
+				  systemic_input_latency,
+				  systemic_output_latency,
+				  tsched_margin, exact_dither,
+				  aggregate_devices, double_capture,
+				  hw_passthru);
+
+	jack_slist_free (aggregate_devices);
+
+	return driver;
 }
 
 void
@@ -37,6 +37,7 @@
 #include "hardware.h"
 #include "driver.h"
 #include "memops.h"
+#include "alsa_aggregate.h"
 
 typedef void (*ReadCopyFunction)(jack_default_audio_sample_t *dst, char *src,
 				 unsigned long src_bytes,
@@ -52,8 +53,20 @@ typedef struct _alsa_driver {
 	int poll_timeout;
 	jack_time_t poll_last;
 	jack_time_t poll_next;
+
+	/* the clock of the PCM timestamps, which place the period
+	   boundaries for the frame timer; see alsa_driver_period_ust() */
+	clockid_t hw_clock;
+
+	/* timer-based scheduling, off when tsched_margin_usecs is 0 */
+	jack_time_t tsched_margin_usecs;
+	jack_nframes_t tsched_margin;
+	snd_pcm_uframes_t playback_buffer_size;
+	snd_pcm_uframes_t capture_buffer_size;
 	char                        **playback_addr;
 	char                        **capture_addr;
+	jack_default_audio_sample_t **playback_bufs;   /* interleaved only */
+	jack_default_audio_sample_t **capture_bufs;    /* interleaved only */
 	const snd_pcm_channel_area_t *capture_areas;
 	const snd_pcm_channel_area_t *playback_areas;
 	struct pollfd                *pfd;
@@ -80,6 +93,9 @@ typedef struct _alsa_driver {
 	char                         *alsa_driver;
 	bitset_t channels_not_done;
 	bitset_t channels_done;
+	bitset_t channels_early;        /* written by alsa_driver_write_port() */
+	int early_state;                /* 1: period mapped, -1: not this cycle */
+	snd_pcm_uframes_t early_offset;
 	snd_pcm_format_t playback_sample_format;
 	snd_pcm_format_t capture_sample_format;
 	float max_sample_val;
@@ -98,13 +114,16 @@ typedef struct _alsa_driver {
 	ClockSyncStatus              *clock_sync_data;
 	jack_client_t                *client;
 	JSList                       *capture_ports;
+	JSList                       *capture_double_ports;
 	JSList                       *playback_ports;
 	JSList                       *monitor_ports;
 
 	unsigned long input_monitor_mask;
+	unsigned long passthru_mask;    /* channels on the card's own mixer */
 
 	char soft_mode;
 	char hw_monitoring;
+	char hw_passthru;
 	char hw_metering;
 	char all_monitor_in;
 	char capture_and_playback_not_synced;
@@ -117,11 +136,17 @@ typedef struct _alsa_driver {
 	char quirk_bswap;
 
 	ReadCopyFunction read_via_copy;
+	sample_read_double_func_t read_double; /* NULL: not 32 bit */
+	int double_capture;
 	WriteCopyFunction write_via_copy;
+	sample_write_multi_func_t write_multi;  /* NULL: per channel */
 
 	int dither;
+	int exact_dither;
 	dither_state_t *dither_state;
 
+	alsa_aggregate_t *aggregate;    /* secondary devices, or NULL */
+
 	SampleClockMode clock_mode;
 	JSList *clock_sync_listeners;
 	pthread_mutex_t clock_sync_lock;
@@ -133,6 +158,8 @@ typedef struct _alsa_driver {
 	int poll_late;
 	int xrun_count;
 	int process_count;
+	unsigned long xrun_resumed;     /* recovered without a restart */
+	jack_time_t xrun_recovery_max;  /* usecs */
 
 	int xrun_recovery;
 	int previously_successfully_configured;
@@ -191,6 +218,18 @@ alsa_driver_read_from_channel (alsa_driver_t *driver,
 			       driver->capture_interleave_skip[channel]);
 }
 
+static inline void
+alsa_driver_read_double_from_channel (alsa_driver_t *driver,
+				      channel_t channel,
+				      double *buf,
+				      jack_nframes_t nsamples)
+{
+	driver->read_double (buf,
+			     driver->capture_addr[channel],
+			     nsamples,
+			     driver->capture_interleave_skip[channel]);
+}
+
 static inline void
 alsa_driver_write_to_channel (alsa_driver_t *driver,
 			      channel_t channel,
@@ -89,6 +89,9 @@ typedef struct alsa_midi_driver {
 	jack_ringbuffer_t* outbound_events;     // struct a2j_delivery_event
 	jack_nframes_t cycle_start;
 
+	struct a2j_delivery_ref *out_heap;      // min-heap of the events being delivered
+	size_t out_heap_size;
+
 	sem_t output_semaphore;
 
 	struct a2j_stream stream[2];
@@ -105,8 +108,6 @@ struct a2j_alsa_midi_event {
 #define MAX_JACKMIDI_EV_SIZE 64
 
 struct a2j_delivery_event {
-	struct list_head siblings;
-
 	/* a jack MIDI event, plus the port its destined for: everything
 	   the ALSA output thread needs to deliver the event. time is
 	   part of the jack_event.
@@ -117,6 +118,14 @@ struct a2j_delivery_event {
 	char midistring[MAX_JACKMIDI_EV_SIZE];
 };
 
+/* the output thread's heap entry for an outbound event; seq keeps
+   events with the same time in the order they were queued */
+struct a2j_delivery_ref {
+	jack_nframes_t time;
+	uint32_t seq;
+	struct a2j_delivery_event* ev;
+};
+
 void a2j_error(const char* fmt, ...);
 
 #define A2J_DEBUG
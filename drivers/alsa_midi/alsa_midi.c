@@ -22,6 +22,7 @@
 
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <alsa/asoundlib.h>
@@ -172,15 +173,12 @@ a2j_port_event (alsa_midi_driver_t* driver, snd_seq_event_t * ev)
 /* --- INBOUND FROM ALSA TO JACK ---- */
 
 static void
-a2j_input_event (alsa_midi_driver_t* driver, snd_seq_event_t * alsa_event)
+a2j_input_event (alsa_midi_driver_t* driver, snd_seq_event_t * alsa_event, jack_nframes_t now)
 {
 	jack_midi_data_t data[MAX_EVENT_SIZE];
 	struct a2j_stream *str = &driver->stream[A2J_PORT_CAPTURE];
 	long size;
 	struct a2j_port *port;
-	jack_nframes_t now;
-
-	now = jack_frame_time (driver->jack_client);
 
 	if ((port = a2j_port_get (str->port_hash, alsa_event->source)) == NULL) {
 		return;
@@ -339,6 +337,10 @@ alsa_input_thread (void* arg)
 	while (driver->running) {
 		if ((ret = poll (pfd, npfd, 1000)) > 0) {
 
+			/* drain everything that is queued: it all arrived by now,
+			   so one timestamp does for the whole batch */
+			jack_nframes_t now = jack_frame_time (driver->jack_client);
+
 			while (snd_seq_event_input (driver->seq, &event) > 0) {
 				if (initial) {
 					snd_seq_client_info_alloca (&client_info);
@@ -358,7 +360,7 @@ alsa_input_thread (void* arg)
 				if (event->source.client == SND_SEQ_CLIENT_SYSTEM) {
 					a2j_port_event (driver, event);
 				} else {
-					a2j_input_event (driver, event);
+					a2j_input_event (driver, event, now);
 				}
 
 				snd_seq_free_event (event);
@@ -438,15 +440,75 @@ a2j_process_outgoing (
 	return nevents;
 }
 
-static int
-time_sorter (struct a2j_delivery_event * a, struct a2j_delivery_event * b)
+static inline int
+a2j_delivery_before (const struct a2j_delivery_ref * a, const struct a2j_delivery_ref * b)
 {
-	if (a->time < b->time) {
-		return -1;
-	} else if (a->time > b->time) {
-		return 1;
+	/* times are frame offsets into the cycle */
+	if (a->time != b->time) {
+		return a->time < b->time;
 	}
-	return 0;
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void
+a2j_heap_push (struct a2j_delivery_ref * heap, size_t n, const struct a2j_delivery_ref * ref)
+{
+	size_t i = n;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!a2j_delivery_before (ref, &heap[parent])) {
+			break;
+		}
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = *ref;
+}
+
+/* remove heap[0]; n is the size before removal */
+static void
+a2j_heap_pop (struct a2j_delivery_ref * heap, size_t n)
+{
+	struct a2j_delivery_ref last;
+	size_t i = 0;
+
+	if (--n == 0) {
+		return;
+	}
+	last = heap[n];
+	for (;; ) {
+		size_t child = 2 * i + 1;
+		if (child >= n) {
+			break;
+		}
+		if (child + 1 < n && a2j_delivery_before (&heap[child + 1], &heap[child])) {
+			child++;
+		}
+		if (!a2j_delivery_before (&heap[child], &last)) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+}
+
+static size_t
+a2j_heap_fill (alsa_midi_driver_t * driver, jack_ringbuffer_data_t * vec, size_t n, uint32_t * seq)
+{
+	struct a2j_delivery_event* ev = (struct a2j_delivery_event*)vec->buf;
+	size_t limit = vec->len / sizeof(struct a2j_delivery_event);
+	size_t i;
+
+	for (i = 0; i < limit && n < driver->out_heap_size; ++i, ++ev) {
+		struct a2j_delivery_ref ref;
+		ref.time = ev->time;
+		ref.seq = (*seq)++;
+		ref.ev = ev;
+		a2j_heap_push (driver->out_heap, n++, &ref);
+	}
+	return n;
 }
 
 static void*
@@ -454,24 +516,21 @@ alsa_output_thread (void * arg)
 {
 	alsa_midi_driver_t * driver = (alsa_midi_driver_t*)arg;
 	struct a2j_stream *str = &driver->stream[A2J_PORT_PLAYBACK];
-	int i;
-	struct list_head evlist;
-	struct list_head * node_ptr;
 	jack_ringbuffer_data_t vec[2];
 	snd_seq_event_t alsa_event;
 	struct a2j_delivery_event* ev;
 	float sr;
 	jack_nframes_t now;
-	int limit;
+	size_t n;
+	uint32_t seq = 0;
+	int pending;
 
 	while (driver->running) {
 		/* pre-first, handle port deletion requests */
 
 		a2j_free_ports (driver);
 
-		/* first, make a list of all events in the outbound_events FIFO */
-
-		INIT_LIST_HEAD (&evlist);
+		/* first, put all events in the outbound_events FIFO into the heap */
 
 		jack_ringbuffer_get_read_vector (driver->outbound_events, vec);
 
@@ -479,20 +538,6 @@ alsa_output_thread (void * arg)
 			   (vec[0].len / sizeof(struct a2j_delivery_event)),
 			   (vec[1].len / sizeof(struct a2j_delivery_event)));
 
-		ev = (struct a2j_delivery_event*)vec[0].buf;
-		limit = vec[0].len / sizeof(struct a2j_delivery_event);
-		for (i = 0; i < limit; ++i) {
-			list_add_tail (&ev->siblings, &evlist);
-			ev++;
-		}
-
-		ev = (struct a2j_delivery_event*)vec[1].buf;
-		limit = vec[1].len / sizeof(struct a2j_delivery_event);
-		for (i = 0; i < limit; ++i) {
-			list_add_tail (&ev->siblings, &evlist);
-			ev++;
-		}
-
 		if (vec[0].len < sizeof(struct a2j_delivery_event) && (vec[1].len == 0)) {
 			/* no events: wait for some */
 			a2j_debug ("alsa_out: output thread: wait for events");
@@ -501,16 +546,18 @@ alsa_output_thread (void * arg)
 			continue;
 		}
 
-		/* now sort this list by time */
-
-		list_sort (&evlist, struct a2j_delivery_event, siblings, time_sorter);
+		n = a2j_heap_fill (driver, &vec[0], 0, &seq);
+		n = a2j_heap_fill (driver, &vec[1], n, &seq);
 
-		/* now deliver */
+		/* now deliver in time order. events that are due are only
+		   queued in the sequencer's output buffer, which is drained
+		   before sleeping for the next one and once at the end. */
 
 		sr = jack_get_sample_rate (driver->jack_client);
+		pending = 0;
 
-		list_for_each (node_ptr, &evlist){
-			ev = list_entry (node_ptr, struct a2j_delivery_event, siblings);
+		for (; n > 0; a2j_heap_pop (driver->out_heap, n--)) {
+			ev = driver->out_heap[0].ev;
 
 			snd_seq_ev_clear (&alsa_event);
 			snd_midi_event_reset_encode (str->codec);
@@ -539,6 +586,11 @@ alsa_output_thread (void * arg)
 				/* if the gap is long enough, sleep */
 
 				if (seconds > 0.001) {
+					if (pending) {
+						snd_seq_drain_output (driver->seq);
+						pending = 0;
+					}
+
 					nanoseconds.tv_sec = (time_t)seconds;
 					nanoseconds.tv_nsec = (long)NSEC_PER_SEC * (seconds - nanoseconds.tv_sec);
 
@@ -553,10 +605,12 @@ alsa_output_thread (void * arg)
 
 			/* its time to deliver */
 			snd_seq_event_output (driver->seq, &alsa_event);
+			pending = 1;
+			a2j_debug ("alsa_out: queued %d bytes for %s at %d", ev->jack_event.size, ev->port->name, ev->time);
+		}
+
+		if (pending) {
 			snd_seq_drain_output (driver->seq);
-			now = jack_frame_time (driver->jack_client);
-			a2j_debug ("alsa_out: written %d bytes to %s at %d, DELTA = %d", ev->jack_event.size, ev->port->name, now,
-				   (int32_t)(now - ev->time));
 		}
 
 		/* free up space in the FIFO */
@@ -702,6 +756,13 @@ alsa_midi_attach (alsa_midi_driver_t* driver, jack_engine_t* engine)
 		return -1;
 	}
 
+	/* room for everything the FIFO can hold, so the output thread never allocates */
+	driver->out_heap_size = driver->outbound_events->size / sizeof(struct a2j_delivery_event) + 1;
+	driver->out_heap = malloc (driver->out_heap_size * sizeof(struct a2j_delivery_ref));
+	if (driver->out_heap == NULL) {
+		return -1;
+	}
+
 	if (!a2j_stream_init (driver, A2J_PORT_CAPTURE)) {
 		return -1;
 	}
@@ -804,6 +865,7 @@ alsa_midi_driver_delete (alsa_midi_driver_t* driver)
 
 	jack_ringbuffer_free (driver->outbound_events);
 	jack_ringbuffer_free (driver->port_del);
+	free (driver->out_heap);
 }
 
 /* DRIVER "PLUGIN" INTERFACE */
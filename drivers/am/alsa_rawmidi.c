@@ -21,14 +21,20 @@
 /* Required for clock_nanosleep(). Thanks, Nedko */
 #define _GNU_SOURCE
 
+#include <config.h>
+
 #include "alsa_midi.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdio.h>
 #include <pthread.h>
 #include <time.h>
 #include <limits.h>
 #include <ctype.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 #include <alsa/asoundlib.h>
 #include <jack/thread.h>
 #include <jack/ringbuffer.h>
@@ -75,6 +81,24 @@ enum {
 #endif
 };
 
+/* Hotplug.
+ *
+ * The scan thread watches /dev/snd, where udev creates and removes the
+ * controlCn and midiCnDm nodes, and rescans only the cards whose nodes
+ * changed. Events are let settle for SCAN_SETTLE_MSEC first, since udev
+ * fixes up the permissions of a new node only after creating it.
+ *
+ * Without inotify, or if /dev/snd can't be watched, every card is
+ * rescanned each SCAN_INTERVAL_MSEC as before. $JACK_RAWMIDI_SCAN_INTERVAL
+ * (msecs, 0 for never) keeps such a periodic full scan running next to
+ * the events too.
+ */
+enum {
+	SCAN_MAX_CARDS = 32,
+	SCAN_SETTLE_MSEC = 100,
+	SCAN_INTERVAL_MSEC = 2000
+};
+
 enum PortState {
 	PORT_DESTROYED,
 	PORT_CREATED,
@@ -111,6 +135,7 @@ struct midi_port_t {
 	snd_rawmidi_t *rawmidi;
 	int npfds;
 	int is_ready;
+	int tstamp;     // input read with snd_rawmidi_tread()
 
 	jack_ringbuffer_t *event_ring;
 	jack_ringbuffer_t *data_ring;
@@ -158,6 +183,7 @@ typedef struct {
 	jack_nframes_t cur_frames;
 	jack_time_t cur_time;
 	jack_time_t next_time;
+	jack_nframes_t sample_rate;
 } process_midi_t;
 
 typedef struct midi_stream_t {
@@ -191,6 +217,10 @@ struct alsa_rawmidi_t {
 		pthread_t thread;
 		midi_port_t *ports;
 		int wake_pipe[2];
+		int notify_fd;              // inotify on /dev/snd, or -1
+		int interval;               // msecs between full scans, -1 for never
+		int all_dirty;
+		char dirty[SCAN_MAX_CARDS]; // cards to rescan
 	} scan;
 
 	midi_stream_t in;
@@ -260,6 +290,7 @@ alsa_midi_t* alsa_rawmidi_new (jack_client_t *jack)
 		goto fail_0;
 	}
 	midi->client = jack;
+	midi->scan.notify_fd = -1;
 	if (pipe (midi->scan.wake_pipe) == -1) {
 		error_log ("pipe() in alsa_midi_new failed: %s", strerror (errno));
 		goto fail_1;
@@ -460,6 +491,28 @@ inline int midi_port_open_jack (const alsa_rawmidi_t *midi, midi_port_t *port, i
 	return port->jack == NULL;
 }
 
+#ifdef HAVE_SND_RAWMIDI_TREAD
+/* have the kernel stamp the input bytes as they arrive (linux 5.14 and later) */
+static
+int midi_port_set_tstamp (snd_rawmidi_t *rawmidi)
+{
+	snd_rawmidi_params_t *params;
+	int err;
+
+	snd_rawmidi_params_alloca (&params);
+	if ((err = snd_rawmidi_params_current (rawmidi, params)) < 0) {
+		return err;
+	}
+	if ((err = snd_rawmidi_params_set_read_mode (rawmidi, params, SND_RAWMIDI_READ_TSTAMP)) < 0) {
+		return err;
+	}
+	if ((err = snd_rawmidi_params_set_clock_type (rawmidi, params, SND_RAWMIDI_CLOCK_MONOTONIC)) < 0) {
+		return err;
+	}
+	return snd_rawmidi_params (rawmidi, params);
+}
+#endif
+
 static
 int midi_port_open (const alsa_rawmidi_t *midi, midi_port_t *port)
 {
@@ -480,6 +533,12 @@ int midi_port_open (const alsa_rawmidi_t *midi, midi_port_t *port)
 	if ((err = snd_rawmidi_open (in, out, port->dev, SND_RAWMIDI_NONBLOCK)) < 0) {
 		return err;
 	}
+#ifdef HAVE_SND_RAWMIDI_TREAD
+	if (in) {
+		port->tstamp = midi_port_set_tstamp (port->rawmidi) == 0;
+		debug_log ("port %s: kernel timestamps %s", port->dev, port->tstamp ? "on" : "off");
+	}
+#endif
 
 	/* Some devices (emu10k1) have subdevs with the same name,
 	 * and we need to generate unique port name for jack */
@@ -566,26 +625,60 @@ typedef struct {
 
 static midi_port_t** scan_port_del(alsa_rawmidi_t *midi, midi_port_t **list);
 
+static
+void scan_mark_dirty (alsa_rawmidi_t *midi, int card)
+{
+	if (card >= 0 && card < SCAN_MAX_CARDS) {
+		midi->scan.dirty[card] = 1;
+	} else {
+		midi->scan.all_dirty = 1;
+	}
+}
+
 static
 void scan_cleanup (alsa_rawmidi_t *midi)
 {
 	midi_port_t **list = &midi->scan.ports;
 
-	while (*list)
+	while (*list) {
+		midi_port_t *port = *list;
+		if (port->state == PORT_REMOVED_FROM_JACK) {
+			// the device may be back already; its new port is only found by a rescan
+			scan_mark_dirty (midi, port->id.id[0]);
+		}
 		list = scan_port_del (midi, list);
+	}
 }
 
 static void scan_card(scan_t *scan);
 static midi_port_t** scan_port_open(alsa_rawmidi_t *midi, midi_port_t **list);
 
+static
+void scan_open_ports (alsa_rawmidi_t *midi)
+{
+	midi_port_t **ports;
+
+	// delayed open to workaround alsa<1.0.14 bug (can't open more than 1 subdevice if ctl is opened).
+	ports = &midi->scan.ports;
+	while (*ports) {
+		midi_port_t *port = *ports;
+		if (port->state == PORT_CREATED) {
+			ports = scan_port_open (midi, ports);
+		} else {
+			ports = &port->next;
+		}
+	}
+}
+
 void scan_cycle (alsa_rawmidi_t *midi)
 {
 	int card = -1, err;
 	scan_t scan;
-	midi_port_t **ports;
 
 	//debug_log("scan: cleanup");
 	scan_cleanup (midi);
+	midi->scan.all_dirty = 0;
+	memset (midi->scan.dirty, 0, sizeof(midi->scan.dirty));
 
 	scan.midi = midi;
 	scan.iterator = &midi->scan.ports;
@@ -603,18 +696,73 @@ void scan_cycle (alsa_rawmidi_t *midi)
 		}
 	}
 
-	// delayed open to workaround alsa<1.0.14 bug (can't open more than 1 subdevice if ctl is opened).
-	ports = &midi->scan.ports;
-	while (*ports) {
-		midi_port_t *port = *ports;
-		if (port->state == PORT_CREATED) {
-			ports = scan_port_open (midi, ports);
-		} else {
-			ports = &port->next;
+	scan_open_ports (midi);
+}
+
+/* like scan_cycle(), for the ports of one card only */
+static
+void scan_card_cycle (alsa_rawmidi_t *midi, int card)
+{
+	int err;
+	scan_t scan;
+	char name[32];
+
+	scan.midi = midi;
+	scan.iterator = &midi->scan.ports;
+	snd_rawmidi_info_alloca (&scan.info);
+
+	// the list is sorted by id, and the card comes first in it
+	while (*scan.iterator && (*scan.iterator)->id.id[0] < card)
+		scan.iterator = &(*scan.iterator)->next;
+
+	debug_log ("scan: rescan card %d", card);
+	snprintf (name, sizeof(name), "hw:%d", card);
+	if ((err = snd_ctl_open (&scan.ctl, name, SND_CTL_NONBLOCK)) >= 0) {
+		scan_card (&scan);
+		snd_ctl_close (scan.ctl);
+	} else if (err != -ENOENT && err != -ENODEV) {
+		alsa_error ("scan: snd_ctl_open", err);
+	}
+
+	while (*scan.iterator && (*scan.iterator)->id.id[0] == card)
+		scan.iterator = scan_port_del (midi, scan.iterator);
+
+	scan_open_ports (midi);
+}
+
+static
+void scan_dirty_cards (alsa_rawmidi_t *midi)
+{
+	int card;
+
+	scan_cleanup (midi);
+	if (midi->scan.all_dirty) {
+		scan_cycle (midi);
+		return;
+	}
+	for (card = 0; card < SCAN_MAX_CARDS; ++card) {
+		if (midi->scan.dirty[card]) {
+			midi->scan.dirty[card] = 0;
+			scan_card_cycle (midi, card);
 		}
 	}
 }
 
+static
+int scan_is_dirty (alsa_rawmidi_t *midi)
+{
+	int card;
+
+	if (midi->scan.all_dirty) {
+		return 1;
+	}
+	for (card = 0; card < SCAN_MAX_CARDS; ++card)
+		if (midi->scan.dirty[card]) {
+			return 1;
+		}
+	return 0;
+}
+
 static void scan_device(scan_t *scan);
 
 static
@@ -762,25 +910,145 @@ midi_port_t** scan_port_del (alsa_rawmidi_t *midi, midi_port_t **list)
 	}
 }
 
+static
+void scan_notify_open (alsa_rawmidi_t *midi)
+{
+	const char *interval = getenv ("JACK_RAWMIDI_SCAN_INTERVAL");
+
+	midi->scan.notify_fd = -1;
+	midi->scan.interval = -1;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	midi->scan.notify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (midi->scan.notify_fd < 0) {
+		error_log ("scan: inotify_init1: %s", strerror (errno));
+	} else if (inotify_add_watch (midi->scan.notify_fd, "/dev/snd",
+				      IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM) < 0) {
+		error_log ("scan: can't watch /dev/snd: %s", strerror (errno));
+		close (midi->scan.notify_fd);
+		midi->scan.notify_fd = -1;
+	}
+#endif
+
+	if (interval) {
+		midi->scan.interval = atoi (interval);
+		if (midi->scan.interval <= 0) {
+			midi->scan.interval = -1;
+		}
+	} else if (midi->scan.notify_fd < 0) {
+		midi->scan.interval = SCAN_INTERVAL_MSEC;
+	}
+	if (midi->scan.notify_fd < 0 && midi->scan.interval < 0) {
+		info_log ("scan: no hotplug events and no periodic scan, ports are only found at start");
+	}
+}
+
+static
+void scan_notify_close (alsa_rawmidi_t *midi)
+{
+	if (midi->scan.notify_fd >= 0) {
+		close (midi->scan.notify_fd);
+		midi->scan.notify_fd = -1;
+	}
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static
+void scan_notify_read (alsa_rawmidi_t *midi)
+{
+	char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read (midi->scan.notify_fd, buf, sizeof(buf))) > 0) {
+		char *p = buf;
+		while (p < buf + len) {
+			struct inotify_event *ev = (struct inotify_event*)p;
+			int card, dev;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				midi->scan.all_dirty = 1;
+			} else if (ev->mask & IN_IGNORED) {
+				// /dev/snd itself went away, no more events from it
+				error_log ("scan: lost the watch on /dev/snd, scanning periodically");
+				midi->scan.all_dirty = 1;
+				if (midi->scan.interval < 0) {
+					midi->scan.interval = SCAN_INTERVAL_MSEC;
+				}
+			} else if (ev->len) {
+				if (sscanf (ev->name, "midiC%dD%d", &card, &dev) == 2
+				    || sscanf (ev->name, "controlC%d", &card) == 1) {
+					scan_mark_dirty (midi, card);
+				}
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+}
+#endif
+
 void* scan_thread (void *arg)
 {
 	alsa_rawmidi_t *midi = arg;
-	struct pollfd wakeup;
+	struct pollfd pfds[2];
+	int npfds = 1;
+	jack_time_t next_scan;
+
+	scan_notify_open (midi);
+
+	pfds[0].fd = midi->scan.wake_pipe[0];
+	pfds[0].events = POLLIN | POLLERR | POLLNVAL;
+	if (midi->scan.notify_fd >= 0) {
+		pfds[1].fd = midi->scan.notify_fd;
+		pfds[1].events = POLLIN | POLLERR | POLLNVAL;
+		npfds = 2;
+	}
+
+	scan_cycle (midi);
+	next_scan = jack_get_time ();
+	if (midi->scan.interval > 0) {
+		next_scan += (jack_time_t)midi->scan.interval * 1000;
+	}
 
-	wakeup.fd = midi->scan.wake_pipe[0];
-	wakeup.events = POLLIN | POLLERR | POLLNVAL;
 	while (midi->keep_walking) {
-		int res;
-		//error_log("scanning....");
-		scan_cycle (midi);
-		res = poll (&wakeup, 1, 2000);
+		int res, timeout = -1;
+		jack_time_t now = jack_get_time ();
+
+		if (midi->scan.interval >= 0) {
+			if (now >= next_scan) {
+				//error_log("scanning....");
+				scan_cycle (midi);
+				next_scan = now + (jack_time_t)midi->scan.interval * 1000;
+			}
+			timeout = (next_scan - now) / 1000;
+		}
+		if (scan_is_dirty (midi) && (timeout < 0 || timeout > SCAN_SETTLE_MSEC)) {
+			// rescan once the events have settled, see res == 0 below
+			timeout = SCAN_SETTLE_MSEC;
+		}
+
+		res = poll (pfds, npfds, timeout);
 		if (res > 0) {
-			char c;
-			read (wakeup.fd, &c, 1);
-		} else if (res < 0 && errno != EINTR) {
+			if (pfds[0].revents) {
+				// a stop request, or the jack thread let go of some removed ports
+				char c[64];
+				read (pfds[0].fd, c, sizeof(c));
+				scan_cleanup (midi);
+			}
+#ifdef HAVE_SYS_INOTIFY_H
+			if (npfds > 1 && pfds[1].revents) {
+				scan_notify_read (midi);
+			}
+#endif
+		} else if (res == 0) {
+			if (scan_is_dirty (midi)) {
+				scan_dirty_cards (midi);
+			}
+		} else if (errno != EINTR) {
 			break;
 		}
 	}
+
+	scan_notify_close (midi);
 	return NULL;
 }
 
@@ -837,6 +1105,7 @@ void jack_process (midi_stream_t *str, jack_nframes_t nframes)
 
 		if (port->state == PORT_REMOVED_FROM_MIDI) {
 			port->state = PORT_REMOVED_FROM_JACK;   // this signals to scan thread
+			write (str->owner->scan.wake_pipe[1], &r, 1);
 			continue;                               // this effectively removes port from the midi->in.jack.ports[]
 		}
 
@@ -932,6 +1201,7 @@ void *midi_thread (void *arg)
 		// process ports
 		proc.cur_time = 0; //jack_frame_time(midi->client);
 		proc.next_time = NFRAMES_INF;
+		proc.sample_rate = jack_get_sample_rate (midi->client);
 
 		for (rp = 0; rp < str->midi.nports; ++rp) {
 			midi_port_t *port = str->midi.ports[rp];
@@ -1091,6 +1361,26 @@ void do_jack_input (process_jack_t *p)
 /*
  * Low level input.
  */
+#ifdef HAVE_SND_RAWMIDI_TREAD
+/* the frame time a CLOCK_MONOTONIC kernel timestamp corresponds to */
+static
+jack_time_t midi_tstamp_to_frames (process_midi_t *proc, const struct timespec *tstamp)
+{
+	struct timespec now;
+	int64_t age_nsec;
+	jack_time_t age;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	age_nsec = (int64_t)(now.tv_sec - tstamp->tv_sec) * (1000 * 1000 * 1000)
+		   + (now.tv_nsec - tstamp->tv_nsec);
+	if (age_nsec <= 0) {
+		return proc->cur_time;
+	}
+	age = (age_nsec * proc->sample_rate) / (1000 * 1000 * 1000);
+	return age < proc->cur_time ? proc->cur_time - age : 0;
+}
+#endif
+
 static
 int do_midi_input (process_midi_t *proc)
 {
@@ -1102,6 +1392,10 @@ int do_midi_input (process_midi_t *proc)
 
 	if (port->base.is_ready) {
 		jack_ringbuffer_data_t vec[2];
+		jack_time_t time = proc->cur_time;
+#ifdef HAVE_SND_RAWMIDI_TREAD
+		struct timespec tstamp;
+#endif
 		int res;
 
 		jack_ringbuffer_get_write_vector (port->base.data_ring, vec);
@@ -1114,13 +1408,21 @@ int do_midi_input (process_midi_t *proc)
 			port->base.npfds = 0;
 			return 1;
 		}
+#ifdef HAVE_SND_RAWMIDI_TREAD
+		if (port->base.tstamp) {
+			res = snd_rawmidi_tread (port->base.rawmidi, &tstamp, vec[0].buf, vec[0].len);
+			if (res > 0) {
+				time = midi_tstamp_to_frames (proc, &tstamp);
+			}
+		} else
+#endif
 		res = snd_rawmidi_read (port->base.rawmidi, vec[0].buf, vec[0].len);
 		if (res < 0 && res != -EWOULDBLOCK) {
 			error_log ("midi_in: reading from port %s failed: %s", port->base.name, snd_strerror (res));
 			return 0;
 		} else if (res > 0) {
 			event_head_t event;
-			event.time = proc->cur_time;
+			event.time = time;
 			event.size = res;
 			event.overruns = port->overruns;
 			port->overruns = 0;
@@ -288,6 +288,7 @@ static
 int alsa_seqmidi_attach (alsa_midi_t *m)
 {
 	alsa_seqmidi_t *self = (alsa_seqmidi_t*)m;
+	snd_seq_port_info_t *pinfo;
 	int err;
 
 	debug_log ("midi: attach\n");
@@ -301,17 +302,33 @@ int alsa_seqmidi_attach (alsa_midi_t *m)
 		return err;
 	}
 	snd_seq_set_client_name (self->seq, self->alsa_name);
-	self->port_id = snd_seq_create_simple_port (self->seq, "port",
-						    SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_WRITE
-#ifndef JACK_MIDI_DEBUG
-						    | SND_SEQ_PORT_CAP_NO_EXPORT
-#endif
-						    , SND_SEQ_PORT_TYPE_APPLICATION);
 	self->client_id = snd_seq_client_id (self->seq);
 
 	self->queue = snd_seq_alloc_queue (self->seq);
 	snd_seq_start_queue (self->seq, self->queue, 0);
 
+	/* the kernel stamps everything delivered to the port with the queue's
+	 * real time, also over connections made by others (aconnect etc.)
+	 */
+	snd_seq_port_info_alloca (&pinfo);
+	snd_seq_port_info_set_name (pinfo, "port");
+	snd_seq_port_info_set_capability (pinfo, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_WRITE
+#ifndef JACK_MIDI_DEBUG
+					  | SND_SEQ_PORT_CAP_NO_EXPORT
+#endif
+					  );
+	snd_seq_port_info_set_type (pinfo, SND_SEQ_PORT_TYPE_APPLICATION);
+	snd_seq_port_info_set_timestamping (pinfo, 1);
+	snd_seq_port_info_set_timestamp_real (pinfo, 1);
+	snd_seq_port_info_set_timestamp_queue (pinfo, self->queue);
+	if ((err = snd_seq_create_port (self->seq, pinfo)) < 0) {
+		error_log ("failed to create alsa seq port");
+		snd_seq_close (self->seq);
+		self->seq = NULL;
+		return err;
+	}
+	self->port_id = snd_seq_port_info_get_port (pinfo);
+
 	stream_attach (self, PORT_INPUT);
 	stream_attach (self, PORT_OUTPUT);
 
@@ -838,8 +855,14 @@ void input_event (alsa_seqmidi_t *self, snd_seq_event_t *alsa_event, struct proc
 		data[2] = 0x40;
 	}
 
-	alsa_time = alsa_event->time.time.tv_sec * NSEC_PER_SEC + alsa_event->time.time.tv_nsec;
-	time_offset = info->alsa_time - alsa_time;
+	if ((alsa_event->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL
+	    && alsa_event->queue == self->queue) {
+		alsa_time = alsa_event->time.time.tv_sec * NSEC_PER_SEC + alsa_event->time.time.tv_nsec;
+		time_offset = info->alsa_time - alsa_time;
+	} else {
+		// not stamped by our queue, all we know is that it is here by now
+		time_offset = 0;
+	}
 	frame_offset = (info->sample_rate * time_offset) / NSEC_PER_SEC;
 	event_frame = (int64_t)info->cur_frames - info->period_start - frame_offset + info->nframes;
 
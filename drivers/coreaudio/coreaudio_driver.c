@@ -54,6 +54,7 @@
 
 #include "engine.h"
 #include "coreaudio_driver.h"
+#include <sysdeps/ipc.h>
 
 const int CAVersion = 3;
 
@@ -297,6 +298,15 @@ error:
 	return err;
 }
 
+/* silence the playback buffers of a render call */
+static void silence_output (AudioBufferList *ioData, UInt32 inNumberFrames)
+{
+	UInt32 i;
+
+	for (i = 0; i < ioData->mNumberBuffers; i++)
+		memset ((float*)ioData->mBuffers[i].mData, 0, sizeof(float) * inNumberFrames);
+}
+
 static OSStatus render (void *inRefCon,
 			AudioUnitRenderActionFlags      *ioActionFlags,
 			const AudioTimeStamp            *inTimeStamp,
@@ -304,8 +314,7 @@ static OSStatus render (void *inRefCon,
 			UInt32 inNumberFrames,
 			AudioBufferList                         *ioData)
 {
-	int res, i;
-	JSList *node;
+	int res;
 	coreaudio_driver_t* ca_driver = (coreaudio_driver_t*)inRefCon;
 
 	AudioUnitRender (ca_driver->au_hal, ioActionFlags, inTimeStamp, 1, inNumberFrames, ca_driver->input_list);
@@ -316,29 +325,52 @@ static OSStatus render (void *inRefCon,
 					  (ca_driver->last_wait_ust + ca_driver->period_usecs));
 		ca_driver->last_wait_ust = current_time;
 		ca_driver->xrun_detected = 0;
+		silence_output (ioData, inNumberFrames);
 		return 0;
-	} else {
-		ca_driver->last_wait_ust = ca_driver->engine->get_microseconds ();
-		ca_driver->engine->transport_cycle_start (ca_driver->engine,
-							  ca_driver->engine->get_microseconds ());
-		res = ca_driver->engine->run_cycle (ca_driver->engine, inNumberFrames, 0);
 	}
 
-	if (ca_driver->null_cycle_occured) {
-		ca_driver->null_cycle_occured = 0;
-		for (i = 0; i < ca_driver->playback_nchannels; i++)
-			memset ((float*)ioData->mBuffers[i].mData, 0, sizeof(float) * inNumberFrames);
-	} else {
-		for (i = 0, node = ca_driver->playback_ports; i < ca_driver->playback_nchannels; i++, node = jack_slist_next (node)) {
-			memcpy ((float*)ioData->mBuffers[i].mData,
-				(jack_default_audio_sample_t*)jack_port_get_buffer (((jack_port_t*)node->data), inNumberFrames),
-				sizeof(float) * inNumberFrames);
-		}
+	/* the cycle runs right here on the HAL's IO thread: write or
+	   null_cycle fill ioData from the playback ports and clear
+	   output_list, if neither ran the buffers are silenced */
+	ca_driver->output_list = ioData;
+	ca_driver->last_wait_ust = ca_driver->engine->get_microseconds ();
+	ca_driver->engine->transport_cycle_start (ca_driver->engine,
+						  ca_driver->last_wait_ust);
+	res = ca_driver->engine->run_cycle (ca_driver->engine, inNumberFrames, 0);
+
+	if (ca_driver->output_list != NULL) {
+		ca_driver->output_list = NULL;
+		silence_output (ioData, inNumberFrames);
 	}
 
 	return res;
 }
 
+/* When the HAL captured the first frame of this buffer, in engine time,
+   which is not shifted by how long the IO thread took to get here.
+   Only input timestamps are behind us; output ones lie ahead. */
+static jack_time_t
+coreaudio_period_ust (coreaudio_driver_t *ca_driver,
+		      const AudioTimeStamp *inTimeStamp)
+{
+	jack_time_t now = ca_driver->engine->get_microseconds ();
+	int64_t age;
+
+	if (!(inTimeStamp->mFlags & kAudioTimeStampHostTimeValid)) {
+		return now;
+	}
+
+	age = ((int64_t)AudioConvertHostTimeToNanos (AudioGetCurrentHostTime ())
+	       - (int64_t)AudioConvertHostTimeToNanos (inTimeStamp->mHostTime))
+	      / 1000;
+
+	if (age < 0 || age > (int64_t)ca_driver->period_usecs) {
+		return now;
+	}
+
+	return now - age;
+}
+
 static OSStatus render_input (void *inRefCon,
 			      AudioUnitRenderActionFlags      *ioActionFlags,
 			      const AudioTimeStamp            *inTimeStamp,
@@ -358,7 +390,8 @@ static OSStatus render_input (void *inRefCon,
 		ca_driver->xrun_detected = 0;
 		return 0;
 	} else {
-		ca_driver->last_wait_ust = ca_driver->engine->get_microseconds ();
+		ca_driver->last_wait_ust = coreaudio_period_ust (ca_driver,
+								 inTimeStamp);
 		ca_driver->engine->transport_cycle_start (ca_driver->engine,
 							  ca_driver->engine->get_microseconds ());
 		return ca_driver->engine->run_cycle (ca_driver->engine, inNumberFrames, 0);
@@ -439,6 +472,37 @@ static OSStatus notification (AudioDeviceID inDevice,
 	return noErr;
 }
 
+/* let clients join their process threads to the workgroup of the
+   device's IO thread, which runs the engine cycle */
+static void
+coreaudio_driver_publish_workgroup (coreaudio_driver_t * driver)
+{
+#ifdef JACK_USE_OS_WORKGROUP
+	if (__builtin_available (macOS 11.0, *)) {
+		AudioObjectPropertyAddress address = {
+			kAudioDevicePropertyIOThreadOSWorkgroup,
+			kAudioObjectPropertyScopeGlobal,
+			0                       /* the main element */
+		};
+		os_workgroup_t workgroup = NULL;
+		UInt32 size = sizeof(workgroup);
+		mach_port_t port;
+
+		if (AudioObjectGetPropertyData (driver->device_id, &address,
+						0, NULL, &size, &workgroup)
+		    != noErr || workgroup == NULL) {
+			JCALog ("no IO thread workgroup for the device\n");
+			return;
+		}
+
+		if (os_workgroup_copy_port (workgroup, &port) == 0) {
+			jack_engine_publish_workgroup (driver->engine, port);
+		}
+		os_release (workgroup);
+	}
+#endif
+}
+
 static int
 coreaudio_driver_attach (coreaudio_driver_t * driver, jack_engine_t * engine)
 {
@@ -462,6 +526,8 @@ coreaudio_driver_attach (coreaudio_driver_t * driver, jack_engine_t * engine)
 	}
 	driver->engine->set_sample_rate (engine, driver->frame_rate);
 
+	coreaudio_driver_publish_workgroup (driver);
+
 	port_flags = JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal;
 
 	/*
@@ -583,19 +649,48 @@ coreaudio_driver_detach (coreaudio_driver_t * driver, jack_engine_t * engine)
 static int
 coreaudio_driver_null_cycle (coreaudio_driver_t * driver, jack_nframes_t nframes)
 {
-	driver->null_cycle_occured = 1;
+	if (driver->output_list != NULL) {
+		silence_output (driver->output_list, nframes);
+		driver->output_list = NULL;
+	}
 	return 0;
 }
 
 static int
 coreaudio_driver_read (coreaudio_driver_t * driver, jack_nframes_t nframes)
 {
+	/* input_list points at the capture port buffers, so
+	   AudioUnitRender has already filled them */
 	return 0;
 }
 
 static int
 coreaudio_driver_write (coreaudio_driver_t * driver, jack_nframes_t nframes)
 {
+	AudioBufferList *ioData = driver->output_list;
+	JSList *node;
+	jack_port_t *port;
+	int i;
+
+	if (ioData == NULL) {
+		return 0;
+	}
+
+	/* copy while the port buffers are still warm from the graph;
+	   a playback port with one connection hands out the source
+	   buffer, so this single copy is all it costs */
+	for (i = 0, node = driver->playback_ports; i < driver->playback_nchannels && node; i++, node = jack_slist_next (node)) {
+		port = (jack_port_t*)node->data;
+		if (jack_port_connected (port)) {
+			memcpy ((float*)ioData->mBuffers[i].mData,
+				(jack_default_audio_sample_t*)jack_port_get_buffer (port, nframes),
+				sizeof(float) * nframes);
+		} else {
+			memset ((float*)ioData->mBuffers[i].mData, 0, sizeof(float) * nframes);
+		}
+	}
+
+	driver->output_list = NULL;
 	return 0;
 }
 
@@ -69,7 +69,10 @@ typedef struct {
 	jack_nframes_t playback_frame_latency;
 
 	int xrun_detected;
-	int null_cycle_occured;
+
+	/* playback buffers of the render call in progress, NULL once
+	   write or null_cycle has filled them */
+	AudioBufferList* output_list;
 
 } coreaudio_driver_t;
 
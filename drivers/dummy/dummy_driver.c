@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <string.h>
 #include <sys/mman.h>
 
 #include <jack/types.h>
@@ -73,83 +74,94 @@ FakeVideoSync ( dummy_driver_t *driver )
 	}
 }
 
-#if HAVE_CLOCK_GETTIME && HAVE_CLOCK_NANOSLEEP
-static inline unsigned long long ts_to_nsec (struct timespec ts)
+static void
+dummy_driver_reset_stats (dummy_driver_t *driver)
 {
-	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	driver->stats_start = driver->engine->get_microseconds ();
+	driver->cycles = 0;
+	driver->xruns = 0;
+	driver->jitter_sum = 0;
+	driver->jitter_max = 0;
 }
 
-static inline struct timespec nsec_to_ts (unsigned long long nsecs)
+static int
+dummy_driver_nt_stop (dummy_driver_t *driver)
 {
-	struct timespec ts;
+	jack_time_t elapsed =
+		driver->engine->get_microseconds () - driver->stats_start;
 
-	ts.tv_sec = nsecs / (1000000000LL);
-	ts.tv_nsec = nsecs % (1000000000LL);
-	return ts;
-}
+	if (driver->cycles == 0 || elapsed == 0) {
+		return 0;
+	}
 
-static inline struct timespec add_ts (struct timespec ts, unsigned int usecs)
-{
-	unsigned long long nsecs = ts_to_nsec (ts);
+	jack_info ("dummy: %lu cycles in %.3f secs (%.2fx realtime), "
+		   "%lu xruns", driver->cycles, elapsed / 1000000.0,
+		   ((double)driver->cycles * driver->period_size
+		    / driver->sample_rate) / (elapsed / 1000000.0),
+		   driver->xruns);
+
+#if HAVE_CLOCK_GETTIME && HAVE_CLOCK_NANOSLEEP
+	if (!driver->benchmark) {
+		jack_info ("dummy: wakeup jitter mean %.1f usecs, max %.1f usecs",
+			   driver->jitter_sum / driver->cycles,
+			   driver->jitter_max);
+	}
+#endif
 
-	nsecs += usecs * 1000LL;
-	return nsec_to_ts (nsecs);
+	return 0;
 }
 
-static inline int cmp_lt_ts (struct timespec ts1, struct timespec ts2)
+/* benchmark mode: start the next cycle as soon as the engine is done
+   with the last one, which measures the throughput of the graph.
+ */
+static jack_nframes_t
+dummy_driver_no_wait (dummy_driver_t *driver, int *status,
+		      float *delayed_usecs)
 {
-	if (ts1.tv_sec < ts2.tv_sec) {
-		return 1;
-	} else if (ts1.tv_sec == ts2.tv_sec && ts1.tv_nsec < ts2.tv_nsec) {
-		return 1;
-	} else { return 0; }
+	*status = 0;
+	*delayed_usecs = 0;
+
+	driver->last_wait_ust = driver->engine->get_microseconds ();
+	driver->engine->transport_cycle_start (driver->engine,
+					       driver->last_wait_ust);
+
+	return driver->period_size;
 }
 
+#if HAVE_CLOCK_GETTIME && HAVE_CLOCK_NANOSLEEP
+/* Wake up on the nt layer's timer. A cycle that starts after the
+   following deadline has already passed missed its slot and is
+   reported to the engine as an xrun, as a sound card with two
+   periods would; otherwise the wakeup lateness is passed on as the
+   cycle's delay.
+ */
 static jack_nframes_t
 dummy_driver_wait (dummy_driver_t *driver, int extra_fd, int *status,
 		   float *delayed_usecs)
 {
 	jack_nframes_t nframes = driver->period_size;
-	struct timespec now;
-    struct timespec ts;
+	float late;
+	int err;
 
 	*status = 0;
-	/* this driver doesn't work so well if we report a delay */
-	*delayed_usecs = 0;             /* lie about it */
-
-	clock_gettime (CLOCK_REALTIME, &now);
-
-	if (cmp_lt_ts (driver->next_wakeup, now)) {
-		if (driver->next_wakeup.tv_sec == 0) {
-			/* first time through */
-			clock_gettime (CLOCK_REALTIME, &driver->next_wakeup);
-		} else if ((ts_to_nsec (now) - ts_to_nsec (driver->next_wakeup)) / 1000LL
-			   > (PRETEND_BUFFER_SIZE * 1000000LL
-			      / driver->sample_rate)) {
-			/* xrun */
-			jack_error ("**** dummy: xrun of %ju usec",
-				    (uintmax_t)(ts_to_nsec (now) - ts_to_nsec (driver->next_wakeup)) / 1000LL);
-			nframes = 0;
-			driver->next_wakeup.tv_sec = 0;
-		} else {
-			/* late, but handled by our "buffer"; try to
-			 * get back on track */
-		}
-		driver->next_wakeup = add_ts (driver->next_wakeup, driver->wait_time);
+	*delayed_usecs = 0;
+
+	err = jack_driver_nt_timer_wait ((jack_driver_nt_t*)driver,
+					 driver->wait_time, &late);
+	if (err < 0) {
+		*status = -1;
+	} else if (err > 0) {
+		/* xrun */
+		jack_error ("**** dummy: xrun of %.0f usec", late);
+		driver->xruns++;
+		nframes = 0;
 	} else {
-        ts.tv_sec = 0;
-        ts.tv_nsec = ts_to_nsec(driver->next_wakeup) - ts_to_nsec(now);
-		if (nanosleep (&ts, NULL)) {
-			jack_error ("error while sleeping");
-			*status = -1;
-		} else {
-			clock_gettime (CLOCK_REALTIME, &now);
-			// guaranteed to sleep long enough for this to be correct
-			*delayed_usecs = (ts_to_nsec (now) - ts_to_nsec (driver->next_wakeup));
-			*delayed_usecs /= 1000.0;
+		driver->jitter_sum += late;
+		if (late > driver->jitter_max) {
+			driver->jitter_max = late;
 		}
-		driver->next_wakeup = add_ts (driver->next_wakeup, driver->wait_time);
 	}
+	*delayed_usecs = late;
 
 	driver->last_wait_ust = driver->engine->get_microseconds ();
 	driver->engine->transport_cycle_start (driver->engine,
@@ -160,7 +172,7 @@ dummy_driver_wait (dummy_driver_t *driver, int extra_fd, int *status,
 
 static int dummy_driver_nt_start (dummy_driver_t *drv)
 {
-	drv->next_wakeup.tv_sec = 0;
+	dummy_driver_reset_stats (drv);
 	return 0;
 }
 
@@ -182,6 +194,7 @@ dummy_driver_wait (dummy_driver_t *driver, int extra_fd, int *status,
 			/* xrun */
 			jack_error ("**** dummy: xrun of %ju usec",
 				    (uintmax_t)now - driver->next_time);
+			driver->xruns++;
 			driver->next_time = now + driver->wait_time;
 		} else {
 			/* late, but handled by our "buffer"; try to
@@ -209,6 +222,7 @@ dummy_driver_wait (dummy_driver_t *driver, int extra_fd, int *status,
 static int dummy_driver_nt_start (dummy_driver_t *drv)
 {
 	drv->next_time = 0;
+	dummy_driver_reset_stats (drv);
 	return 0;
 }
 #endif
@@ -219,9 +233,15 @@ dummy_driver_run_cycle (dummy_driver_t *driver)
 	jack_engine_t *engine = driver->engine;
 	int wait_status;
 	float delayed_usecs;
+	jack_nframes_t nframes;
 
-	jack_nframes_t nframes = dummy_driver_wait (driver, -1, &wait_status,
-						    &delayed_usecs);
+	if (driver->benchmark) {
+		nframes = dummy_driver_no_wait (driver, &wait_status,
+						&delayed_usecs);
+	} else {
+		nframes = dummy_driver_wait (driver, -1, &wait_status,
+					     &delayed_usecs);
+	}
 
 	if (nframes == 0) {
 		/* we detected an xrun and restarted: notify
@@ -230,6 +250,8 @@ dummy_driver_run_cycle (dummy_driver_t *driver)
 		return 0;
 	}
 
+	driver->cycles++;
+
 	// FakeVideoSync (driver);
 
 	if (wait_status == 0) {
@@ -369,7 +391,8 @@ dummy_driver_new (jack_client_t * client,
 		  unsigned int playback_ports,
 		  jack_nframes_t sample_rate,
 		  jack_nframes_t period_size,
-		  unsigned long wait_time)
+		  unsigned long wait_time,
+		  int benchmark)
 {
 	dummy_driver_t * driver;
 
@@ -385,6 +408,7 @@ dummy_driver_new (jack_client_t * client,
 	driver->null_cycle    = (JackDriverNullCycleFunction)dummy_driver_null_cycle;
 	driver->nt_attach     = (JackDriverNTAttachFunction)dummy_driver_attach;
 	driver->nt_start      = (JackDriverNTStartFunction)dummy_driver_nt_start;
+	driver->nt_stop       = (JackDriverNTStopFunction)dummy_driver_nt_stop;
 	driver->nt_detach     = (JackDriverNTDetachFunction)dummy_driver_detach;
 	driver->nt_bufsize    = (JackDriverNTBufSizeFunction)dummy_driver_bufsize;
 	driver->nt_run_cycle  = (JackDriverNTRunCycleFunction)dummy_driver_run_cycle;
@@ -395,6 +419,7 @@ dummy_driver_new (jack_client_t * client,
 	driver->sample_rate = sample_rate;
 	driver->period_size = period_size;
 	driver->wait_time   = wait_time;
+	driver->benchmark   = benchmark;
 	//driver->next_time   = 0; // not needed since calloc clears the memory
 	driver->last_wait_ust = 0;
 
@@ -421,7 +446,7 @@ driver_get_descriptor ()
 
 	desc = calloc (1, sizeof(jack_driver_desc_t));
 	strcpy (desc->name, "dummy");
-	desc->nparams = 5;
+	desc->nparams = 6;
 
 	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
 
@@ -466,6 +491,16 @@ driver_get_descriptor ()
 		"Number of usecs to wait between engine processes");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "benchmark");
+	params[i].character  = 'b';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = FALSE;
+	strcpy (params[i].short_desc, "Run cycles back to back without waiting");
+	strcpy (params[i].long_desc,
+		"Start each cycle as soon as the previous one is done, to "
+		"measure how fast the graph can run");
+
 	desc->params = params;
 
 	return desc;
@@ -482,6 +517,7 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	unsigned int playback_ports = 2;
 	int wait_time_set = 0;
 	unsigned long wait_time = 0;
+	int benchmark = FALSE;
 	const JSList * node;
 	const jack_driver_param_t * param;
 
@@ -511,6 +547,10 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			wait_time_set = 1;
 			break;
 
+		case 'b':
+			benchmark = param->value.i;
+			break;
+
 		}
 	}
 
@@ -520,7 +560,7 @@ driver_initialize (jack_client_t *client, const JSList * params)
 
 	return dummy_driver_new (client, "dummy_pcm", capture_ports,
 				 playback_ports, sample_rate, period_size,
-				 wait_time);
+				 wait_time, benchmark);
 }
 
 void
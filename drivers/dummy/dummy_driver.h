@@ -42,10 +42,16 @@ struct _dummy_driver {
 	jack_nframes_t sample_rate;
 	jack_nframes_t period_size;
 	unsigned long wait_time;
+	int benchmark;                  /* don't wait at all */
 
-#if HAVE_CLOCK_GETTIME && HAVE_CLOCK_NANOSLEEP
-	struct timespec next_wakeup;
-#else
+	/* reported by nt_stop */
+	jack_time_t stats_start;
+	unsigned long cycles;
+	unsigned long xruns;
+	double jitter_sum;              /* usecs */
+	float jitter_max;
+
+#if !(HAVE_CLOCK_GETTIME && HAVE_CLOCK_NANOSLEEP)
 	jack_time_t next_time;
 #endif
 
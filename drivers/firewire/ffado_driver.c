@@ -87,6 +87,58 @@ ffado_latency_callback (jack_latency_callback_mode_t mode, void* arg)
 		jack_port_set_latency_range ((jack_port_t*)node->data, mode, &range);
 }
 
+/* FFADO keeps the stream buffer pointers it is given, so a stream is
+   only rebound, or switched on or off, when that changes. Most cycles
+   that is never: capture port buffers stay put, and a playback port
+   returns the same buffer as long as its connections do. A buffer of
+   NULL or an on of -1 leaves that part alone.
+ */
+static inline void
+ffado_capture_bind (ffado_driver_t *driver, channel_t chn, char *buf, int on)
+{
+	ffado_capture_channel_t *channel = &driver->capture_channels[chn];
+
+	if (on >= 0 && channel->stream_on != on) {
+		ffado_streaming_capture_stream_onoff (driver->dev, chn, on);
+		channel->stream_on = on;
+	}
+	if (buf && channel->stream_buffer != buf) {
+		ffado_streaming_set_capture_stream_buffer (driver->dev, chn, buf);
+		channel->stream_buffer = buf;
+	}
+}
+
+static inline void
+ffado_playback_bind (ffado_driver_t *driver, channel_t chn, char *buf, int on)
+{
+	ffado_playback_channel_t *channel = &driver->playback_channels[chn];
+
+	if (on >= 0 && channel->stream_on != on) {
+		ffado_streaming_playback_stream_onoff (driver->dev, chn, on);
+		channel->stream_on = on;
+	}
+	if (buf && channel->stream_buffer != buf) {
+		ffado_streaming_set_playback_stream_buffer (driver->dev, chn, buf);
+		channel->stream_buffer = buf;
+	}
+}
+
+/* forget the bindings, so that the next cycle makes them all again */
+static void
+ffado_driver_unbind (ffado_driver_t *driver)
+{
+	channel_t chn;
+
+	for (chn = 0; chn < driver->capture_nchannels; chn++) {
+		driver->capture_channels[chn].stream_buffer = NULL;
+		driver->capture_channels[chn].stream_on = -1;
+	}
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		driver->playback_channels[chn].stream_buffer = NULL;
+		driver->playback_channels[chn].stream_on = -1;
+	}
+}
+
 static int
 ffado_driver_attach (ffado_driver_t *driver)
 {
@@ -278,6 +330,8 @@ ffado_driver_attach (ffado_driver_t *driver)
 		}
 	}
 
+	ffado_driver_unbind (driver);
+
 	if (ffado_streaming_prepare (driver->dev)) {
 		printError ("Could not prepare streaming device!");
 		return -1;
@@ -356,26 +410,18 @@ ffado_driver_read (ffado_driver_t * driver, jack_nframes_t nframes)
 
 			/* if there are no connections, use the dummy buffer and disable the stream */
 			if (nb_connections) {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 1);
-				ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(jack_port_get_buffer (port, nframes)));
+				ffado_capture_bind (driver, chn, (char*)(jack_port_get_buffer (port, nframes)), 1);
 			} else {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 0);
-				ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(driver->scratchbuffer));
+				ffado_capture_bind (driver, chn, (char*)(driver->scratchbuffer), 0);
 			}
 		} else if (driver->capture_channels[chn].stream_type == ffado_stream_type_midi) {
 			port = (jack_port_t*)node->data;
 			nb_connections = jack_port_connected (port);
-			if (nb_connections) {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 1);
-			} else {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 0);
-			}
 			/* always set a buffer */
-			ffado_streaming_set_capture_stream_buffer (driver->dev, chn,
-								   (char*)(driver->capture_channels[chn].midi_buffer));
+			ffado_capture_bind (driver, chn, (char*)(driver->capture_channels[chn].midi_buffer),
+					    nb_connections ? 1 : 0);
 		} else { /* ensure a valid buffer */
-			ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(driver->scratchbuffer));
-			ffado_streaming_capture_stream_onoff (driver->dev, chn, 0);
+			ffado_capture_bind (driver, chn, (char*)(driver->scratchbuffer), 0);
 		}
 	}
 
@@ -442,11 +488,9 @@ ffado_driver_write (ffado_driver_t * driver, jack_nframes_t nframes)
 
 			/* use the silent buffer + disable if there are no connections */
 			if (nb_connections) {
-				ffado_streaming_playback_stream_onoff (driver->dev, chn, 1);
-				ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(jack_port_get_buffer (port, nframes)));
+				ffado_playback_bind (driver, chn, (char*)(jack_port_get_buffer (port, nframes)), 1);
 			} else {
-				ffado_streaming_playback_stream_onoff (driver->dev, chn, 0);
-				ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
+				ffado_playback_bind (driver, chn, (char*)(driver->nullbuffer), 0);
 			}
 		} else if (driver->playback_channels[chn].stream_type == ffado_stream_type_midi) {
 			jack_default_audio_sample_t* buf;
@@ -461,14 +505,12 @@ ffado_driver_write (ffado_driver_t * driver, jack_nframes_t nframes)
 
 			/* skip if no connections */
 			if (nb_connections == 0) {
-				ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
-				ffado_streaming_playback_stream_onoff (driver->dev, chn, 0);
+				ffado_playback_bind (driver, chn, (char*)(driver->nullbuffer), 0);
 				continue;
 			}
 
 			memset (midi_buffer, 0, nframes * sizeof(uint32_t));
-			ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(midi_buffer));
-			ffado_streaming_playback_stream_onoff (driver->dev, chn, 1);
+			ffado_playback_bind (driver, chn, (char*)(midi_buffer), 1);
 
 			/* check if we still have to process bytes from the previous period */
 			/*
@@ -526,8 +568,7 @@ ffado_driver_write (ffado_driver_t * driver, jack_nframes_t nframes)
 				}
 			}
 		} else { /* ensure a valid buffer */
-			ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
-			ffado_streaming_playback_stream_onoff (driver->dev, chn, 0);
+			ffado_playback_bind (driver, chn, (char*)(driver->nullbuffer), 0);
 		}
 	}
 
@@ -654,7 +695,7 @@ ffado_driver_null_cycle (ffado_driver_t* driver, jack_nframes_t nframes)
 		stream_type = ffado_streaming_get_playback_stream_type (driver->dev, chn);
 
 		if (stream_type == ffado_stream_type_audio) {
-			ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
+			ffado_playback_bind (driver, chn, (char*)(driver->nullbuffer), -1);
 		}
 	}
 	ffado_streaming_transfer_playback_buffers (driver->dev);
@@ -663,7 +704,7 @@ ffado_driver_null_cycle (ffado_driver_t* driver, jack_nframes_t nframes)
 	for (chn = 0, node = driver->capture_ports; node; node = jack_slist_next (node), chn++) {
 		stream_type = ffado_streaming_get_capture_stream_type (driver->dev, chn);
 		if (stream_type == ffado_stream_type_audio) {
-			ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(driver->scratchbuffer));
+			ffado_capture_bind (driver, chn, (char*)(driver->scratchbuffer), -1);
 		}
 	}
 	ffado_streaming_transfer_capture_buffers (driver->dev);
@@ -748,6 +789,9 @@ ffado_driver_bufsize (ffado_driver_t* driver, jack_nframes_t nframes)
 		}
 	}
 
+	// The port buffers move with the new size.
+	ffado_driver_unbind (driver);
+
 	// Notify FFADO of the period size change
 	if (ffado_streaming_set_period_size (driver->dev, nframes) != 0) {
 		printError ("could not alter FFADO device period size");
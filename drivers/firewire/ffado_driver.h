@@ -143,6 +143,9 @@ typedef struct _ffado_capture_channel {
 	ffado_streaming_stream_type stream_type;
 	midi_unpack_t midi_unpack;
 	uint32_t *midi_buffer;
+	// what the stream is bound to, see ffado_capture_bind()
+	char *stream_buffer;
+	int stream_on;
 } ffado_capture_channel_t;
 
 #define MIDI_OVERFLOW_BUFFER_SIZE 4
@@ -154,6 +157,9 @@ typedef struct _ffado_playback_channel {
 	// during the previous period
 	char overflow_buffer[MIDI_OVERFLOW_BUFFER_SIZE];
 	unsigned int nb_overflow_bytes;
+	// what the stream is bound to, see ffado_playback_bind()
+	char *stream_buffer;
+	int stream_on;
 } ffado_playback_channel_t;
 
 /*
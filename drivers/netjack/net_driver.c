@@ -142,7 +142,7 @@ net_driver_read (net_driver_t* driver, jack_nframes_t nframes)
 	unsigned int *packet_buf, *packet_bufX;
 
 	if ( !netj->packet_data_valid ) {
-		render_payload_to_jack_ports (netj->bitdepth, NULL, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes, netj->dont_htonl_floats );
+		render_payload_to_jack_ports_pool (netj->codec_pool, netj->bitdepth, NULL, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes, netj->dont_htonl_floats );
 		return 0;
 	}
 	packet_buf = netj->rx_buf;
@@ -212,7 +212,9 @@ net_driver_read (net_driver_t* driver, jack_nframes_t nframes)
 		}
 	}
 
-	render_payload_to_jack_ports (netj->bitdepth, packet_bufX, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes, netj->dont_htonl_floats );
+	netj->peer_float_flags = pkthdr->mtu & NETJACK_MTU_FLAGS;
+	render_payload_to_jack_ports_pool (netj->codec_pool, netj->bitdepth, packet_bufX, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes,
+					   netj->dont_htonl_floats || netjack_floats_native (netj->peer_float_flags) );
 	packet_cache_release_packet (netj->packcache, netj->expected_framecnt );
 
 	return 0;
@@ -226,6 +228,7 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
 	int sync_state = (driver->engine->control->sync_remain <= 1);;
 
 	uint32_t *packet_buf, *packet_bufX;
+	int native;
 
 	int packet_size = get_sample_size (netj->bitdepth) * netj->playback_channels * netj->net_period_up + sizeof(jacknet_packet_header);
 	jacknet_packet_header *pkthdr;
@@ -251,7 +254,14 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
 	pkthdr->transport_state = 0;
 	pkthdr->framecnt = 0;
 	pkthdr->reply_port = 0;
-	pkthdr->mtu = 0;
+
+	// the mtu field carries the float byte order.
+	if ( netj->dont_htonl_floats ) {
+		pkthdr->mtu = 0;
+		native = 1;
+	} else {
+		pkthdr->mtu = netjack_floats_flags (netj->peer_float_flags, &native);
+	}
 
 	// set used header fields
 	pkthdr->sync_state = sync_state;
@@ -260,10 +270,10 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
 	pkthdr->framecnt = netj->expected_framecnt;
 
 
-	render_jack_ports_to_payload (netj->bitdepth, netj->playback_ports, netj->playback_srcs, nframes, packet_bufX, netj->net_period_up, netj->dont_htonl_floats );
+	render_jack_ports_to_payload_pool (netj->codec_pool, netj->bitdepth, netj->playback_ports, netj->playback_srcs, nframes, packet_bufX, netj->net_period_up, native );
 
 	packet_header_hton (pkthdr);
-	if (netj->srcaddress_valid) {
+	if (netj->srcaddress_valid && !netj->no_reply) {
 		int r;
 
 #ifndef MSG_CONFIRM
@@ -273,12 +283,14 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
 #endif
 
 		if (netj->reply_port) {
-			netj->syncsource_address.sin_port = htons (netj->reply_port);
+			netjack_sockaddr_set_port (&netj->syncsource_address, netj->reply_port);
 		}
 
 		for ( r = 0; r < netj->redundancy; r++ )
-			netjack_sendto (netj->sockfd, (char*)packet_buf, packet_size,
-					flag, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu);
+			netjack_sendto_at (netj->sockfd, (char*)packet_buf, packet_size,
+					   flag, (struct sockaddr*)&(netj->syncsource_address),
+					   netjack_sockaddr_len (&netj->syncsource_address), netj->mtu,
+					   netj->fec_group, netjack_reply_txtime (netj));
 	}
 
 	return 0;
@@ -296,6 +308,9 @@ net_driver_attach (net_driver_t *driver)
 	}
 	driver->engine->set_sample_rate (driver->engine, netj->sample_rate);
 
+	netj->lost_counter = jack_engine_counter (driver->engine, "netjack_lost_packets");
+	netj->resync_counter = jack_engine_counter (driver->engine, "netjack_resyncs");
+
 	netjack_attach ( netj );
 	return 0;
 }
@@ -310,6 +325,8 @@ net_driver_detach (net_driver_t *driver)
 	}
 
 	netjack_detach ( netj );
+	netj->lost_counter = NULL;
+	netj->resync_counter = NULL;
 	return 0;
 }
 
@@ -342,7 +359,17 @@ net_driver_new (jack_client_t * client,
 		unsigned int redundancy,
 		int dont_htonl_floats,
 		int always_deadline,
-		int jitter_val)
+		int jitter_val,
+		unsigned int codec_threads,
+		unsigned int adaptive,
+		unsigned int fec_group,
+		const char *multicast_group,
+		int no_reply,
+		unsigned int busy_poll,
+		unsigned int spin_usecs,
+		unsigned int priority,
+		unsigned int dscp,
+		unsigned int txtime)
 {
 	net_driver_t * driver;
 
@@ -386,7 +413,17 @@ net_driver_new (jack_client_t * client,
 		       redundancy,
 		       dont_htonl_floats,
 		       always_deadline,
-		       jitter_val      );
+		       jitter_val,
+		       codec_threads,
+		       adaptive,
+		       fec_group,
+		       multicast_group,
+		       no_reply,
+		       busy_poll,
+		       spin_usecs,
+		       priority,
+		       dscp,
+		       txtime          );
 
 	netjack_startup ( netj );
 
@@ -411,7 +448,7 @@ driver_get_descriptor ()
 
 	desc = calloc (1, sizeof(jack_driver_desc_t));
 	strcpy (desc->name, "net");
-	desc->nparams = 18;
+	desc->nparams = 29;
 
 	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
 
@@ -499,6 +536,26 @@ driver_get_descriptor ()
 		"Factor for sample rate reduction on the upstream (deprecated)");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "multicast");
+	params[i].character  = 'M';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc,
+		"Receive from this IPv4 or IPv6 multicast group");
+	strcpy (params[i].long_desc,
+		"Join this IPv4 or IPv6 multicast group on the listen port, so that "
+		"several slaves can share one stream from the master");
+
+	i++;
+	strcpy (params[i].name, "no-reply");
+	params[i].character  = 'N';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Listen only, send nothing back to the master");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
 	i++;
 	strcpy (params[i].name, "celt");
 	params[i].character  = 'c';
@@ -508,6 +565,39 @@ driver_get_descriptor ()
 		"sets celt encoding and kbits value one channel is encoded at");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "opus");
+	params[i].character  = 'P';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"sets opus encoding and kbits value one channel is encoded at");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "codec-threads");
+	params[i].character  = 'T';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Number of extra threads running the celt or opus codecs");
+	strcpy (params[i].long_desc,
+		"Number of extra threads running the celt or opus codecs. "
+		"Channels are encoded and decoded in parallel on these and "
+		"the driver thread. 0 runs them one after the other");
+
+	i++;
+	strcpy (params[i].name, "fec");
+	params[i].character  = 'F';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Send a parity fragment for every N fragments");
+	strcpy (params[i].long_desc,
+		"Send a parity fragment for every N fragments of a period, so "
+		"that the master can rebuild one lost fragment out of each N+1 "
+		"without a resend. 0 sends no parity");
+
 	i++;
 	strcpy (params[i].name, "bit-depth");
 	params[i].character  = 'b';
@@ -569,6 +659,77 @@ driver_get_descriptor ()
 	strcpy (params[i].short_desc,
 		"Always wait until deadline");
 	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "adaptive");
+	params[i].character  = 'A';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Adapt the jitter buffer to the link");
+	strcpy (params[i].long_desc,
+		"Start every cycle a measured margin after the predicted packet "
+		"arrival. The margin follows the arrival jitter, grows when "
+		"packets come late and is kept within the master's latency");
+
+	i++;
+	strcpy (params[i].name, "busy-poll");
+	params[i].character  = 'B';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Busy poll the receive queue for N microseconds (SO_BUSY_POLL)");
+	strcpy (params[i].long_desc,
+		"Busy poll the network device for up to N microseconds when "
+		"reading the socket, instead of waiting for its interrupt. "
+		"Needs CAP_NET_ADMIN above net.core.busy_read. 0 disables it");
+
+	i++;
+	strcpy (params[i].name, "spin");
+	params[i].character  = 'S';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Spin for the last N microseconds before the deadline");
+	strcpy (params[i].long_desc,
+		"Sleep only until N microseconds before the deadline and spin "
+		"on the socket from there, so that a late wakeup does not eat "
+		"into short periods. Keeps a core busy. 0 disables it");
+
+	i++;
+	strcpy (params[i].name, "priority");
+	params[i].character  = 'Q';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Socket priority for the packets sent (SO_PRIORITY)");
+	strcpy (params[i].long_desc,
+		"Queue the packets sent with this socket priority, which the "
+		"qdisc and VLAN egress map turn into a traffic class. 0 leaves "
+		"the default");
+
+	i++;
+	strcpy (params[i].name, "dscp");
+	params[i].character  = 'd';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"DSCP to mark the packets sent with (46 is EF)");
+	strcpy (params[i].long_desc,
+		"Mark the packets sent with this DiffServ code point, so that "
+		"the network can prioritise them. 0 leaves them unmarked");
+
+	i++;
+	strcpy (params[i].name, "txtime");
+	params[i].character  = 'X';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Send replies N microseconds after the cycle start (SO_TXTIME)");
+	strcpy (params[i].long_desc,
+		"Have the kernel put each reply on the wire N microseconds "
+		"after its cycle started, whenever the clients are done. Needs "
+		"the fq qdisc on the interface. 0 sends right away");
 	desc->params = params;
 
 	return desc;
@@ -596,6 +757,16 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	int dont_htonl_floats = 0;
 	int always_deadline = 0;
 	int jitter_val = 0;
+	unsigned int codec_threads = 0;
+	unsigned int adaptive = 0;
+	unsigned int fec_group = 0;
+	const char *multicast_group = NULL;
+	int no_reply = 0;
+	unsigned int busy_poll = 0;
+	unsigned int spin_usecs = 0;
+	unsigned int priority = 0;
+	unsigned int dscp = 0;
+	unsigned int txtime = 0;
 	const JSList * node;
 	const jack_driver_param_t * param;
 
@@ -664,6 +835,16 @@ driver_initialize (jack_client_t *client, const JSList * params)
 #endif
 			break;
 
+		case 'P':
+#if HAVE_OPUS
+			bitdepth = OPUS_MODE;
+			resample_factor = param->value.ui;
+#else
+			printf ( "not built with opus support\n" );
+			exit (10);
+#endif
+			break;
+
 		case 't':
 			handle_transport_sync = param->value.ui;
 			break;
@@ -689,6 +870,36 @@ driver_initialize (jack_client_t *client, const JSList * params)
 		case 'D':
 			always_deadline = param->value.ui;
 			break;
+		case 'T':
+			codec_threads = param->value.ui;
+			break;
+		case 'A':
+			adaptive = param->value.ui;
+			break;
+		case 'F':
+			fec_group = param->value.ui;
+			break;
+		case 'M':
+			multicast_group = param->value.str;
+			break;
+		case 'N':
+			no_reply = param->value.ui;
+			break;
+		case 'B':
+			busy_poll = param->value.ui;
+			break;
+		case 'S':
+			spin_usecs = param->value.ui;
+			break;
+		case 'Q':
+			priority = param->value.ui;
+			break;
+		case 'd':
+			dscp = param->value.ui;
+			break;
+		case 'X':
+			txtime = param->value.ui;
+			break;
 		}
 	}
 
@@ -698,7 +909,10 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			       listen_port, handle_transport_sync,
 			       resample_factor, resample_factor_up, bitdepth,
 			       use_autoconfig, latency, redundancy,
-			       dont_htonl_floats, always_deadline, jitter_val);
+			       dont_htonl_floats, always_deadline, jitter_val,
+			       codec_threads, adaptive, fec_group,
+			       multicast_group, no_reply,
+			       busy_poll, spin_usecs, priority, dscp, txtime);
 }
 
 void
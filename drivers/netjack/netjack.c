@@ -29,6 +29,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <memory.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -43,11 +44,13 @@
 #include <sys/types.h>
 
 #ifdef WIN32
-#include <winsock.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <malloc.h>
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netdb.h>
 #endif
 
 #include "config.h"
@@ -63,6 +66,10 @@
 #include <celt/celt.h>
 #endif
 
+#if HAVE_OPUS
+#include <opus/opus_custom.h>
+#endif
+
 #include "netjack.h"
 #include "netjack_packet.h"
 
@@ -88,6 +95,126 @@ net_driver_sync_cb (jack_transport_state_t state, jack_position_t *pos, void *da
 	return retval;
 }
 
+// How early the master should get our replies, in the terms of the
+// deadline_goodness it sends back.
+static int
+netjack_want_deadline ( netjack_driver_state_t *netj )
+{
+	if ( netj->jitter_val != 0 ) {
+		return netj->jitter_val;
+	} else if ( netj->latency < 4 ) {
+		return -netj->period_usecs / 2;
+	} else {
+		return (netj->period_usecs / 4 + 10 * (int)netj->period_usecs * netj->latency / 100);
+	}
+}
+
+// Adaptive jitter buffer.
+//
+// In adaptive mode every cycle starts at its deadline, which is the
+// predicted arrival time of the expected packet plus playout_depth.
+// The prediction follows the arrival times of the packets we get with
+// a second order loop, so playout_period converges on the period of the
+// master as seen by our clock, and drift between the two does not make
+// the buffer creep. Only the timing of our cycles moves, a packet is
+// still rendered as one period, so there is nothing to resample.
+//
+// playout_depth grows at once when a packet misses its deadline, and
+// otherwise decays slowly towards three times the arrival jitter the
+// packet cache measures. playout_max bounds it from above: while the
+// master reports our replies later than netjack_want_deadline() it is
+// pulled in by 1% of a period per cycle, like the deadline is without
+// adaptive mode, and it creeps back up towards the latency the master
+// configured while they are not.
+//
+// recv_time is 0 when there was no packet for this cycle.
+static void
+netjack_playout_update ( netjack_driver_state_t *netj, jack_time_t recv_time )
+{
+	double period = netj->period_usecs;
+	double margin = period / 16.0;
+	double target = 3.0 * packet_cache_get_jitter (netj->packcache) + margin;
+	double limit = (netj->latency ? netj->latency : 1) * period;
+	int want_deadline = netjack_want_deadline ( netj );
+
+	if ( !netj->playout_valid ) {
+		if ( recv_time == 0 ) {
+			return;
+		}
+		netj->playout_time = recv_time;
+		netj->playout_period = period;
+		netj->playout_depth = period / 4.0;
+		netj->playout_max = limit;
+		netj->playout_valid = 1;
+	} else if ( recv_time ) {
+		double err = (double)recv_time - netj->playout_time;
+
+		// a single very late packet must not drag the clock along.
+		if ( err > period ) {
+			err = period;
+		} else if ( err < -period ) {
+			err = -period;
+		}
+
+		netj->playout_time += err / 16.0;
+		netj->playout_period += err / 1024.0;
+		if ( netj->playout_period > period * 1.01 ) {
+			netj->playout_period = period * 1.01;
+		} else if ( netj->playout_period < period * 0.99 ) {
+			netj->playout_period = period * 0.99;
+		}
+
+		if ( netj->playout_depth > target ) {
+			netj->playout_depth -= (netj->playout_depth - target) / 256.0;
+		} else {
+			netj->playout_depth += (target - netj->playout_depth) / 16.0;
+		}
+
+		if ( netj->deadline_goodness != MASTER_FREEWHEELS ) {
+			if ( netj->deadline_goodness < want_deadline ) {
+				if ( netj->playout_max > netj->playout_depth ) {
+					netj->playout_max = netj->playout_depth;
+				}
+				netj->playout_max -= period / 100.0;
+			} else {
+				netj->playout_max += period / 1000.0;
+			}
+		}
+	} else {
+		// lost, or late.
+		netj->playout_depth += target > period / 8.0 ? target : period / 8.0;
+	}
+
+	if ( netj->playout_max > limit ) {
+		netj->playout_max = limit;
+	}
+	if ( netj->playout_max < margin ) {
+		netj->playout_max = margin;
+	}
+	if ( netj->playout_depth > netj->playout_max ) {
+		netj->playout_depth = netj->playout_max;
+	}
+	if ( netj->playout_depth < margin ) {
+		netj->playout_depth = margin;
+	}
+
+	// on to the next packet.
+	netj->playout_time += netj->playout_period;
+	netj->next_deadline = (jack_time_t)(netj->playout_time + netj->playout_depth);
+}
+
+// When the reply to this cycle should leave, 0 for right away. A fixed
+// offset from the cycle start keeps the variation in process time off
+// the wire.
+uint64_t netjack_reply_txtime ( netjack_driver_state_t *netj )
+{
+	if ( !netj->txtime || !netj->txtime_base ) {
+		return 0;
+	}
+
+	return netj->txtime_base + (uint64_t)netj->txtime * 1000;
+}
+
 int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(void) )
 {
 	int we_have_the_expected_frame = 0;
@@ -126,22 +253,27 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 		if ( packet_cache_get_next_available_framecnt ( netj->packcache, netj->expected_framecnt, &next_frame_avail) ) {
 			if ( next_frame_avail == netj->expected_framecnt ) {
 				we_have_the_expected_frame = 1;
-				if ( !netj->always_deadline ) {
+				if ( !netj->always_deadline && !netj->playout_valid ) {
 					break;
 				}
 			}
 		}
-		if ( !netjack_poll_deadline ( netj->sockfd, netj->next_deadline, get_microseconds ) ) {
+		if ( !netjack_poll_deadline_spin ( netj->sockfd, netj->next_deadline, netj->spin_usecs, get_microseconds ) ) {
 			break;
 		}
 
 		packet_cache_drain_socket ( netj->packcache, netj->sockfd, get_microseconds );
 	}
 
+	// the cycle starts now, replies are scheduled from here.
+	if ( netj->txtime ) {
+		netj->txtime_base = netjack_txtime_now ();
+	}
+
 	// check if we know who to send our packets too.
 	if (!netj->srcaddress_valid) {
 		if ( netj->packcache->master_address_valid ) {
-			memcpy (&(netj->syncsource_address), &(netj->packcache->master_address), sizeof( struct sockaddr_in ) );
+			memcpy (&(netj->syncsource_address), &(netj->packcache->master_address), sizeof( struct sockaddr_storage ) );
 			netj->srcaddress_valid = 1;
 		}
 	}
@@ -171,31 +303,28 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 		netj->deadline_goodness = (int)pkthdr->sync_state;
 		netj->packet_data_valid = 1;
 
-		int want_deadline;
-		if ( netj->jitter_val != 0 ) {
-			want_deadline = netj->jitter_val;
-		} else if ( netj->latency < 4 ) {
-			want_deadline = -netj->period_usecs / 2;
+		if ( netj->adaptive ) {
+			netjack_playout_update ( netj, packet_recv_time_stamp );
 		} else {
-			want_deadline = (netj->period_usecs / 4 + 10 * (int)netj->period_usecs * netj->latency / 100);
-		}
+			int want_deadline = netjack_want_deadline ( netj );
 
-		if ( netj->deadline_goodness != MASTER_FREEWHEELS ) {
-			if ( netj->deadline_goodness < want_deadline ) {
-				netj->next_deadline -= netj->period_usecs / 100;
-				//jack_log( "goodness: %d, Adjust deadline: --- %d\n", netj->deadline_goodness, (int) netj->period_usecs*netj->latency/100 );
-			}
-			if ( netj->deadline_goodness > want_deadline ) {
-				netj->next_deadline += netj->period_usecs / 100;
-				//jack_log( "goodness: %d, Adjust deadline: +++ %d\n", netj->deadline_goodness, (int) netj->period_usecs*netj->latency/100 );
+			if ( netj->deadline_goodness != MASTER_FREEWHEELS ) {
+				if ( netj->deadline_goodness < want_deadline ) {
+					netj->next_deadline -= netj->period_usecs / 100;
+					//jack_log( "goodness: %d, Adjust deadline: --- %d\n", netj->deadline_goodness, (int) netj->period_usecs*netj->latency/100 );
+				}
+				if ( netj->deadline_goodness > want_deadline ) {
+					netj->next_deadline += netj->period_usecs / 100;
+					//jack_log( "goodness: %d, Adjust deadline: +++ %d\n", netj->deadline_goodness, (int) netj->period_usecs*netj->latency/100 );
+				}
 			}
-		}
 //	if( netj->next_deadline < (netj->period_usecs*70/100) ) {
 //		jack_error( "master is forcing deadline_offset to below 70%% of period_usecs... increase latency setting on master" );
 //		netj->deadline_offset = (netj->period_usecs*90/100);
 //	}
 
-		netj->next_deadline += netj->period_usecs;
+			netj->next_deadline += netj->period_usecs;
+		}
 	} else {
 		netj->time_to_deadline = 0;
 		netj->next_deadline += netj->period_usecs;
@@ -241,6 +370,9 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 				netj->deadline_goodness = (int)pkthdr->sync_state - (int)netj->period_usecs * offset;
 				netj->next_deadline_valid = 0;
 				netj->packet_data_valid = 1;
+				if ( netj->resync_counter ) {
+					*netj->resync_counter += 1;
+				}
 			}
 
 		} else {
@@ -291,6 +423,9 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 					netj->next_deadline_valid = 0;
 					netj->packet_data_valid = 1;
 					netj->running_free = 0;
+					if ( netj->resync_counter ) {
+						*netj->resync_counter += 1;
+					}
 					jack_info ( "resync after freerun... %d", netj->expected_framecnt );
 				} else {
 					if ( netj->num_lost_packets == 101 ) {
@@ -310,12 +445,24 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 				}
 			}
 		}
+
+		if ( netj->adaptive ) {
+			if ( !netj->next_deadline_valid || netj->running_free ) {
+				// resynced or lost the master, start over.
+				netj->playout_valid = 0;
+			} else if ( !netj->packet_data_valid ) {
+				netjack_playout_update ( netj, 0 );
+			}
+		}
 	}
 
 	int retval = 0;
 
 	if ( !netj->packet_data_valid ) {
 		netj->num_lost_packets += 1;
+		if ( netj->lost_counter ) {
+			*netj->lost_counter += 1;
+		}
 		if ( netj->num_lost_packets == 1 ) {
 			retval = netj->period_usecs;
 		}
@@ -348,21 +495,29 @@ void netjack_send_silence ( netjack_driver_state_t *netj, int syncstate )
 
 	tx_pkthdr->sync_state = syncstate;
 	tx_pkthdr->framecnt = netj->expected_framecnt;
+	if ( netj->dont_htonl_floats ) {
+		tx_pkthdr->mtu = 0;
+	} else {
+		int native;
+		tx_pkthdr->mtu = netjack_floats_flags (netj->peer_float_flags, &native);
+	}
 
 	// memset 0 the payload.
 	int payload_size = get_sample_size (netj->bitdepth) * netj->playback_channels * netj->net_period_up;
 	memset (packet_bufX, 0, payload_size);
 
 	packet_header_hton (tx_pkthdr);
-	if (netj->srcaddress_valid) {
+	if (netj->srcaddress_valid && !netj->no_reply) {
 		int r;
 		if (netj->reply_port) {
-			netj->syncsource_address.sin_port = htons (netj->reply_port);
+			netjack_sockaddr_set_port (&netj->syncsource_address, netj->reply_port);
 		}
 
 		for ( r = 0; r < netj->redundancy; r++ )
-			netjack_sendto (netj->outsockfd, (char*)packet_buf, tx_size,
-					0, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu);
+			netjack_sendto_at (netj->outsockfd, (char*)packet_buf, tx_size,
+					   0, (struct sockaddr*)&(netj->syncsource_address),
+					   netjack_sockaddr_len (&netj->syncsource_address), netj->mtu,
+					   netj->fec_group, netjack_reply_txtime (netj));
 	}
 }
 
@@ -390,6 +545,25 @@ void netjack_attach ( netjack_driver_state_t *netj )
 #endif
 	}
 
+	if ( netj->bitdepth == OPUS_MODE ) {
+#if HAVE_OPUS
+		// one opus frame per period, so the codec adds no buffering.
+		netj->opus_mode = opus_custom_mode_create ( netj->sample_rate, netj->period_size, NULL );
+		if ( netj->opus_mode == NULL ) {
+			jack_error ("NET: opus cannot use a period of %u frames at %u Hz",
+				    netj->period_size, netj->sample_rate);
+		} else {
+			OpusCustomEncoder *encoder = opus_custom_encoder_create ( netj->opus_mode, 1, NULL );
+			opus_int32 lookahead = 0;
+			if ( encoder ) {
+				opus_custom_encoder_ctl ( encoder, OPUS_GET_LOOKAHEAD (&lookahead) );
+				opus_custom_encoder_destroy ( encoder );
+			}
+			netj->codec_latency = 2 * lookahead;
+		}
+#endif
+	}
+
 	if (netj->handle_transport_sync) {
 		jack_set_sync_callback (netj->client, (JackSyncCallback)net_driver_sync_cb, NULL);
 	}
@@ -417,6 +591,14 @@ void netjack_attach ( netjack_driver_state_t *netj )
 #else
 			netj->capture_srcs = jack_slist_append (netj->capture_srcs, celt_decoder_create ( netj->celt_mode ) );
 #endif
+#endif
+		} else if ( netj->bitdepth == OPUS_MODE ) {
+#if HAVE_OPUS
+			OpusCustomDecoder *decoder = NULL;
+			if ( netj->opus_mode ) {
+				decoder = opus_custom_decoder_create ( netj->opus_mode, 1, NULL );
+			}
+			netj->capture_srcs = jack_slist_append (netj->capture_srcs, decoder );
 #endif
 		} else {
 #if HAVE_SAMPLERATE
@@ -465,6 +647,20 @@ void netjack_attach ( netjack_driver_state_t *netj )
 			CELTMode *celt_mode = celt_mode_create ( netj->sample_rate, 1, netj->period_size, NULL );
 			netj->playback_srcs = jack_slist_append (netj->playback_srcs, celt_encoder_create ( celt_mode ) );
 #endif
+#endif
+		} else if ( netj->bitdepth == OPUS_MODE ) {
+#if HAVE_OPUS
+			OpusCustomEncoder *encoder = NULL;
+			if ( netj->opus_mode ) {
+				encoder = opus_custom_encoder_create ( netj->opus_mode, 1, NULL );
+			}
+			if ( encoder ) {
+				// fixed size slots in the packet, so there is nothing to gain from VBR.
+				opus_custom_encoder_ctl ( encoder, OPUS_SET_VBR (0) );
+				opus_custom_encoder_ctl ( encoder, OPUS_SET_COMPLEXITY (10) );
+				opus_custom_encoder_ctl ( encoder, OPUS_SET_SIGNAL (OPUS_SIGNAL_MUSIC) );
+			}
+			netj->playback_srcs = jack_slist_append (netj->playback_srcs, encoder );
 #endif
 		} else {
 #if HAVE_SAMPLERATE
@@ -488,6 +684,15 @@ void netjack_attach ( netjack_driver_state_t *netj )
 			jack_slist_append (netj->playback_ports, port);
 	}
 
+	if ( netj->codec_threads && (netj->bitdepth == CELT_MODE || netj->bitdepth == OPUS_MODE) ) {
+		unsigned int max_jobs = netj->capture_channels_audio > netj->playback_channels_audio ?
+					netj->capture_channels_audio : netj->playback_channels_audio;
+		netj->codec_pool = netjack_codec_pool_new (netj->client, netj->codec_threads, max_jobs);
+		if ( netj->codec_pool ) {
+			jack_info ("netjack: running the codec on %d extra threads", netj->codec_pool->nthreads);
+		}
+	}
+
 	jack_activate (netj->client);
 }
 
@@ -496,6 +701,9 @@ void netjack_detach ( netjack_driver_state_t *netj )
 {
 	JSList * node;
 
+	netjack_codec_pool_free (netj->codec_pool);
+	netj->codec_pool = NULL;
+
 	for (node = netj->capture_ports; node; node = jack_slist_next (node))
 		jack_port_unregister (netj->client,
 				      ((jack_port_t*)node->data));
@@ -509,6 +717,14 @@ void netjack_detach ( netjack_driver_state_t *netj )
 			CELTDecoder * decoder = node->data;
 			celt_decoder_destroy (decoder);
 		} else
+#endif
+#if HAVE_OPUS
+		if ( netj->bitdepth == OPUS_MODE ) {
+			OpusCustomDecoder * decoder = node->data;
+			if ( decoder ) {
+				opus_custom_decoder_destroy (decoder);
+			}
+		} else
 #endif
 		{
 #if HAVE_SAMPLERATE
@@ -533,6 +749,14 @@ void netjack_detach ( netjack_driver_state_t *netj )
 			CELTEncoder * encoder = node->data;
 			celt_encoder_destroy (encoder);
 		} else
+#endif
+#if HAVE_OPUS
+		if ( netj->bitdepth == OPUS_MODE ) {
+			OpusCustomEncoder * encoder = node->data;
+			if ( encoder ) {
+				opus_custom_encoder_destroy (encoder);
+			}
+		} else
 #endif
 		{
 #if HAVE_SAMPLERATE
@@ -549,6 +773,12 @@ void netjack_detach ( netjack_driver_state_t *netj )
 		celt_mode_destroy (netj->celt_mode);
 	}
 #endif
+#if HAVE_OPUS
+	if ( netj->bitdepth == OPUS_MODE && netj->opus_mode ) {
+		opus_custom_mode_destroy (netj->opus_mode);
+		netj->opus_mode = NULL;
+	}
+#endif
 }
 
 
@@ -571,7 +801,17 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 				      unsigned int redundancy,
 				      int dont_htonl_floats,
 				      int always_deadline,
-				      int jitter_val )
+				      int jitter_val,
+				      unsigned int codec_threads,
+				      unsigned int adaptive,
+				      unsigned int fec_group,
+				      const char *multicast_group,
+				      int no_reply,
+				      unsigned int busy_poll,
+				      unsigned int spin_usecs,
+				      unsigned int priority,
+				      unsigned int dscp,
+				      unsigned int txtime )
 {
 
 	// Fill in netj values.
@@ -599,6 +839,8 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 	netj->mtu = 1400;
 	netj->latency = latency;
 	netj->redundancy = redundancy;
+	netj->fec_group = fec_group;
+	netj->peer_float_flags = 0;
 	netj->use_autoconfig = use_autoconfig;
 	netj->always_deadline = always_deadline;
 
@@ -606,7 +848,7 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 	netj->client = client;
 
 
-	if ((bitdepth != 0) && (bitdepth != 8) && (bitdepth != 16) && (bitdepth != CELT_MODE)) {
+	if ((bitdepth != 0) && (bitdepth != 8) && (bitdepth != 16) && (bitdepth != CELT_MODE) && (bitdepth != OPUS_MODE)) {
 		jack_info ("Invalid bitdepth: %d (8, 16 or 0 for float) !!!", bitdepth);
 		return NULL;
 	}
@@ -621,6 +863,18 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 	netj->resample_factor_up = resample_factor_up;
 
 	netj->jitter_val = jitter_val;
+	netj->codec_threads = codec_threads;
+	netj->codec_pool = NULL;
+	netj->adaptive = adaptive;
+	netj->playout_valid = 0;
+	netj->multicast_group = (multicast_group && *multicast_group) ? strdup (multicast_group) : NULL;
+	netj->no_reply = no_reply;
+	netj->busy_poll = busy_poll;
+	netj->spin_usecs = spin_usecs;
+	netj->priority = priority;
+	netj->dscp = dscp;
+	netj->txtime = txtime;
+	netj->txtime_base = 0;
 
 	return netj;
 }
@@ -632,16 +886,43 @@ void netjack_release ( netjack_driver_state_t *netj )
 
 	packet_cache_free ( netj->packcache );
 	netj->packcache = NULL;
+
+	free ( netj->multicast_group );
+	netj->multicast_group = NULL;
 }
 
 int
 netjack_startup ( netjack_driver_state_t *netj )
 {
 	int first_pack_len;
-	struct sockaddr_in address;
+	struct sockaddr_storage address;
+	struct addrinfo hints, *group = NULL;
+	int family = AF_INET6;
+
+	if (netj->multicast_group) {
+		memset (&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_NUMERICHOST;
+		if (getaddrinfo (netj->multicast_group, NULL, &hints, &group) != 0) {
+			jack_error ("NET: %s is not an IPv4 or IPv6 address", netj->multicast_group);
+			return -1;
+		}
+		family = group->ai_family;
+	}
 
 	// Now open the socket, and wait for the first packet to arrive...
-	netj->sockfd = socket (AF_INET, SOCK_DGRAM, 0);
+	// Without a group we listen on IPv6 and IPv4 both, if we can.
+	netj->sockfd = socket (family, SOCK_DGRAM, 0);
+#ifdef WIN32
+	if (netj->sockfd == INVALID_SOCKET && group == NULL)
+#else
+	if (netj->sockfd == -1 && group == NULL)
+#endif
+	{
+		family = AF_INET;
+		netj->sockfd = socket (family, SOCK_DGRAM, 0);
+	}
 #ifdef WIN32
 	if (netj->sockfd == INVALID_SOCKET)
 #else
@@ -649,17 +930,48 @@ netjack_startup ( netjack_driver_state_t *netj )
 #endif
 	{
 		jack_info ("socket error");
+		if (group) {
+			freeaddrinfo (group);
+		}
 		return -1;
 	}
-	address.sin_family = AF_INET;
-	address.sin_port = htons (netj->listen_port);
-	address.sin_addr.s_addr = htonl (INADDR_ANY);
-	if (bind (netj->sockfd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+
+	memset (&address, 0, sizeof(address));
+	address.ss_family = family;
+	if (family == AF_INET6) {
+		int off = 0;
+		setsockopt (netj->sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&off, sizeof(off));
+		((struct sockaddr_in6*)&address)->sin6_addr = in6addr_any;
+	} else {
+		((struct sockaddr_in*)&address)->sin_addr.s_addr = htonl (INADDR_ANY);
+	}
+	netjack_sockaddr_set_port (&address, netj->listen_port);
+
+	if (group) {
+		// let several slaves on one host share the stream.
+		int on = 1;
+		setsockopt (netj->sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&on, sizeof(on));
+	}
+
+	if (bind (netj->sockfd, (struct sockaddr*)&address, netjack_sockaddr_len (&address)) < 0) {
 		jack_info ("bind error");
+		if (group) {
+			freeaddrinfo (group);
+		}
 		return -1;
 	}
 
-	netj->outsockfd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (group) {
+		if (netjack_multicast_join (netj->sockfd, group->ai_addr) < 0) {
+			jack_error ("NET: cannot join multicast group %s", netj->multicast_group);
+			freeaddrinfo (group);
+			return -1;
+		}
+		jack_info ("netjack: joined multicast group %s", netj->multicast_group);
+		freeaddrinfo (group);
+	}
+
+	netj->outsockfd = socket (family, SOCK_DGRAM, 0);
 #ifdef WIN32
 	if (netj->outsockfd == INVALID_SOCKET)
 #else
@@ -669,13 +981,19 @@ netjack_startup ( netjack_driver_state_t *netj )
 		jack_info ("socket error");
 		return -1;
 	}
+
+	if (netj->busy_poll || netj->priority || netj->dscp || netj->txtime) {
+		netjack_socket_lowlatency (netj->sockfd, netj->busy_poll, netj->priority, netj->dscp, netj->txtime);
+		netjack_socket_lowlatency (netj->outsockfd, 0, netj->priority, netj->dscp, netj->txtime);
+	}
+
 	netj->srcaddress_valid = 0;
 	if (netj->use_autoconfig) {
 		jacknet_packet_header *first_packet = alloca (sizeof(jacknet_packet_header));
 #ifdef WIN32
-		int address_size = sizeof( struct sockaddr_in );
+		int address_size = sizeof( struct sockaddr_storage );
 #else
-		socklen_t address_size = sizeof(struct sockaddr_in);
+		socklen_t address_size = sizeof(struct sockaddr_storage);
 #endif
 		//jack_info ("Waiting for an incoming packet !!!");
 		//jack_info ("*** IMPORTANT *** Dont connect a client to jackd until the driver is attached to a clock source !!!");
@@ -729,8 +1047,8 @@ netjack_startup ( netjack_driver_state_t *netj )
 				netj->playback_channels_midi = first_packet->playback_channels_midi;
 			}
 
-			netj->mtu = first_packet->mtu;
-			jack_info ("MTU is set to %d bytes", first_packet->mtu);
+			netj->mtu = first_packet->mtu & ~NETJACK_MTU_FLAGS;
+			jack_info ("MTU is set to %d bytes", netj->mtu);
 			netj->latency = first_packet->latency;
 		}
 	}
@@ -769,8 +1087,8 @@ netjack_startup ( netjack_driver_state_t *netj )
 		netj->deadline_offset = netj->period_usecs + 10 * netj->latency * netj->period_usecs / 100;
 	}
 
-	if ( netj->bitdepth == CELT_MODE ) {
-		// celt mode.
+	if ( netj->bitdepth == CELT_MODE || netj->bitdepth == OPUS_MODE ) {
+		// celt and opus mode.
 		// TODO: this is a hack. But i dont want to change the packet header.
 		netj->resample_factor = (netj->resample_factor * netj->period_size * 1024 / netj->sample_rate / 8) & (~1);
 		netj->resample_factor_up = (netj->resample_factor_up * netj->period_size * 1024 / netj->sample_rate / 8) & (~1);
@@ -784,6 +1102,14 @@ netjack_startup ( netjack_driver_state_t *netj )
 
 	netj->rx_bufsize = sizeof(jacknet_packet_header) + netj->net_period_down * netj->capture_channels * get_sample_size(netj->bitdepth);
 	netj->packcache = packet_cache_new (netj->latency + 50, netj->rx_bufsize, netj->mtu);
+	if ( netj->packcache && netj->adaptive ) {
+		netj->packcache->period_usecs = netj->period_usecs;
+	}
+	// a master sending parity most likely wants ours as well, so get
+	// the memory for its parity now rather than in the first cycle.
+	if ( netj->packcache && netj->fec_group ) {
+		packet_cache_enable_fec ( netj->packcache );
+	}
 
 	netj->expected_framecnt_valid = 0;
 	netj->num_lost_packets = 0;
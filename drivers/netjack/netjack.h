@@ -29,18 +29,24 @@
 
 #include "jack/jslist.h"
 
+#include <sys/socket.h>
 #include <netinet/in.h>
 
 #if HAVE_CELT
 #include <celt/celt.h>
 #endif
 
+#if HAVE_OPUS
+#include <opus/opus_custom.h>
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
 struct _packet_cache;
+struct _netjack_codec_pool;
 
 typedef struct _netjack_driver_state netjack_driver_state_t;
 
@@ -81,7 +87,21 @@ struct _netjack_driver_state {
 	int outsockfd;
 #endif
 
-	struct sockaddr_in syncsource_address;
+	struct sockaddr_storage syncsource_address;
+
+	// NULL, or the multicast group to receive the master's stream on
+	char *multicast_group;
+	// listen only, send nothing back to the master
+	int no_reply;
+
+	// low latency socket mode, see netjack_socket_lowlatency()
+	unsigned int busy_poll;
+	unsigned int spin_usecs;
+	unsigned int priority;
+	unsigned int dscp;
+	// send replies txtime usecs after the cycle started at txtime_base
+	unsigned int txtime;
+	uint64_t txtime_base;
 
 	int reply_port;
 	int srcaddress_valid;
@@ -95,6 +115,9 @@ struct _netjack_driver_state {
 	unsigned int mtu;
 	unsigned int latency;
 	unsigned int redundancy;
+	unsigned int fec_group;
+	// float byte order flags of the master's last packet
+	jack_nframes_t peer_float_flags;
 
 	jack_nframes_t expected_framecnt;
 	int expected_framecnt_valid;
@@ -111,14 +134,33 @@ struct _netjack_driver_state {
 	unsigned int resample_factor;
 	unsigned int resample_factor_up;
 	int jitter_val;
+
+	// adaptive jitter buffer, see netjack_playout_update()
+	unsigned int adaptive;
+	int playout_valid;
+	double playout_time;
+	double playout_period;
+	double playout_depth;
+	double playout_max;
+
+	// engine counters, see jack_engine_counter(); NULL until attached
+	volatile uint64_t *lost_counter;
+	volatile uint64_t *resync_counter;
+
 	struct _packet_cache * packcache;
+	unsigned int codec_threads;
+	struct _netjack_codec_pool * codec_pool;
 #if HAVE_CELT
 	CELTMode       *celt_mode;
 #endif
+#if HAVE_OPUS
+	OpusCustomMode *opus_mode;
+#endif
 };
 
 int netjack_wait ( netjack_driver_state_t * netj, jack_time_t (*get_microseconds)(void) );
 void netjack_send_silence( netjack_driver_state_t *netj, int syncstate );
+uint64_t netjack_reply_txtime( netjack_driver_state_t *netj );
 void netjack_read( netjack_driver_state_t *netj, jack_nframes_t nframes );
 void netjack_write( netjack_driver_state_t *netj, jack_nframes_t nframes, int syncstate );
 void netjack_attach( netjack_driver_state_t *netj );
@@ -143,7 +185,17 @@ netjack_driver_state_t *netjack_init(netjack_driver_state_t *netj,
 				     unsigned int redundancy,
 				     int dont_htonl_floats,
 				     int always_deadline,
-				     int jitter_val );
+				     int jitter_val,
+				     unsigned int codec_threads,
+				     unsigned int adaptive,
+				     unsigned int fec_group,
+				     const char *multicast_group,
+				     int no_reply,
+				     unsigned int busy_poll,
+				     unsigned int spin_usecs,
+				     unsigned int priority,
+				     unsigned int dscp,
+				     unsigned int txtime );
 
 void netjack_release( netjack_driver_state_t *netj );
 int netjack_startup( netjack_driver_state_t *netj );
@@ -32,19 +32,21 @@
 #define _DARWIN_C_SOURCE
 #endif
 
-#if HAVE_PPOLL
+#if HAVE_PPOLL || HAVE_SENDMMSG || HAVE_RECVMMSG
 #define _GNU_SOURCE
 #endif
 
 #include <math.h>
 #include <stdio.h>
 #include <memory.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stdarg.h>
 
 #include <jack/types.h>
+#include <jack/thread.h>
 
 // for jack_error in jack1
 #include "internal.h"
@@ -53,16 +55,34 @@
 
 #ifdef WIN32
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <malloc.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <poll.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
 #endif
 
 #include <errno.h>
 #include <signal.h>
 
+#if defined(SO_TXTIME) && defined(SCM_TXTIME)
+#define NETJACK_HAVE_TXTIME 1
+#else
+#define NETJACK_HAVE_TXTIME 0
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define NETJACK_HOST_LE 1
+#else
+#define NETJACK_HOST_LE 0
+#endif
+
 #if HAVE_SAMPLERATE
 #include <samplerate.h>
 #endif
@@ -71,8 +91,22 @@
 #include <celt/celt.h>
 #endif
 
+#if HAVE_OPUS
+#include <opus/opus_custom.h>
+#endif
+
 #include "netjack_packet.h"
 
+#ifdef USE_DYNSIMD
+#include "intsimd.h"
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
+#ifdef ARCH_ARM64
+#include <arm_neon.h>
+#endif
+#endif
+
 // JACK2 specific.
 //#include "jack/control.h"
 
@@ -120,6 +154,396 @@ packet_header_ntoh (jacknet_packet_header *pkthdr)
 	pkthdr->fragment_nr = ntohl (pkthdr->fragment_nr);
 }
 
+// float byte order
+
+int
+netjack_floats_native (jack_nframes_t mtu_flags)
+{
+	if (NETJACK_HOST_LE) {
+		return (mtu_flags & NETJACK_LE_FLOATS) != 0;
+	}
+	return 1;
+}
+
+jack_nframes_t
+netjack_floats_flags (jack_nframes_t peer_flags, int *native)
+{
+	if (!NETJACK_HOST_LE) {
+		*native = 1;
+		return 0;
+	}
+
+	*native = (peer_flags & NETJACK_ACCEPTS_LE) != 0;
+	return NETJACK_ACCEPTS_LE | (*native ? NETJACK_LE_FLOATS : 0);
+}
+
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+
+// built with target attributes like libjack/simd.c, so that the
+// driver still loads on CPUs without them.
+__attribute__((target ("avx2"))) static unsigned long
+avx2_swap32 (uint32_t *dst, const uint32_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m256i shuf = _mm256_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+					 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	for (i = 0; i < nv; i += 8) {
+		__m256i v = _mm256_loadu_si256 ((const __m256i*)(src + i));
+		_mm256_storeu_si256 ((__m256i*)(dst + i), _mm256_shuffle_epi8 (v, shuf));
+	}
+	return nv;
+}
+
+__attribute__((target ("sse2"))) static unsigned long
+sse2_swap32 (uint32_t *dst, const uint32_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x3UL;
+
+	for (i = 0; i < nv; i += 4) {
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+		// swap the bytes of each half word, then the half words.
+		v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+		v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+		v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+		_mm_storeu_si128 ((__m128i*)(dst + i), v);
+	}
+	return nv;
+}
+
+#endif /* ARCH_X86 */
+
+#ifdef ARCH_ARM64
+
+static unsigned long
+neon_swap32 (uint32_t *dst, const uint32_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x3UL;
+
+	for (i = 0; i < nv; i += 4) {
+		vst1q_u8 ((uint8_t*)(dst + i), vrev32q_u8 (vld1q_u8 ((const uint8_t*)(src + i))));
+	}
+	return nv;
+}
+
+#endif /* ARCH_ARM64 */
+#endif /* USE_DYNSIMD */
+
+// dst = ntohl (src), which may be the same buffer.
+static void
+netjack_ntoh32 (uint32_t *dst, const uint32_t *src, unsigned long n)
+{
+	unsigned long i = 0;
+
+	if (!NETJACK_HOST_LE) {
+		if (dst != src) {
+			memcpy (dst, src, n * sizeof(uint32_t));
+		}
+		return;
+	}
+
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+	if (ARCH_X86_HAVE_AVX2 (cpu_type)) {
+		i = avx2_swap32 (dst, src, n);
+	} else if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		i = sse2_swap32 (dst, src, n);
+	}
+#endif
+#ifdef ARCH_ARM64
+	if (ARCH_ARM64_HAVE_NEON (cpu_type)) {
+		i = neon_swap32 (dst, src, n);
+	}
+#endif
+#endif
+	for (; i < n; i++) {
+		dst[i] = ntohl (src[i]);
+	}
+}
+
+// 16 and 8 bit samples.
+//
+// 16 bit samples are unsigned offset binary in network order, 8 bit
+// ones signed. The encoders clip to [-1, 1] and truncate, like the
+// casts they replace did for samples in range.
+
+static inline uint16_t
+s16_from_float (float f)
+{
+	if (f < -1.0f) {
+		f = -1.0f;
+	} else if (f > 1.0f) {
+		f = 1.0f;
+	}
+	return htons ((uint16_t)(f * 32767.0f + 32767.0f));
+}
+
+static inline int8_t
+s8_from_float (float f)
+{
+	if (f < -1.0f) {
+		f = -1.0f;
+	} else if (f > 1.0f) {
+		f = 1.0f;
+	}
+	return (int8_t)(f * 127.0f);
+}
+
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+
+__attribute__((target ("sse2"))) static unsigned long
+sse2_s16_to_float (float *dst, const uint16_t *src, unsigned long n, float scale)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m128 s = _mm_set1_ps (scale);
+	__m128 one = _mm_set1_ps (1.0f);
+	__m128i zero = _mm_setzero_si128 ();
+	__m128i v;
+
+	for (i = 0; i < nv; i += 8) {
+		v = _mm_loadu_si128 ((const __m128i*)(src + i));
+		v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+		_mm_storeu_ps (dst + i, _mm_sub_ps (_mm_mul_ps (_mm_cvtepi32_ps (
+						_mm_unpacklo_epi16 (v, zero)), s), one));
+		_mm_storeu_ps (dst + i + 4, _mm_sub_ps (_mm_mul_ps (_mm_cvtepi32_ps (
+						    _mm_unpackhi_epi16 (v, zero)), s), one));
+	}
+	return nv;
+}
+
+__attribute__((target ("sse2"))) static unsigned long
+sse2_float_to_s16 (uint16_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m128 lo = _mm_set1_ps (-1.0f);
+	__m128 hi = _mm_set1_ps (1.0f);
+	__m128 s = _mm_set1_ps (32767.0f);
+	__m128i bias = _mm_set1_epi32 (32768);
+	__m128i sign = _mm_set1_epi16 ((short)0x8000);
+	__m128i a, b, v;
+
+	for (i = 0; i < nv; i += 8) {
+		// truncate while positive, then pack the signed range and
+		// flip it back to offset binary.
+		a = _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (_mm_min_ps (_mm_max_ps (
+								   _mm_loadu_ps (src + i), lo), hi), s), s));
+		b = _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (_mm_min_ps (_mm_max_ps (
+								   _mm_loadu_ps (src + i + 4), lo), hi), s), s));
+		v = _mm_xor_si128 (_mm_packs_epi32 (_mm_sub_epi32 (a, bias),
+						    _mm_sub_epi32 (b, bias)), sign);
+		v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+		_mm_storeu_si128 ((__m128i*)(dst + i), v);
+	}
+	return nv;
+}
+
+__attribute__((target ("sse2"))) static unsigned long
+sse2_s8_to_float (float *dst, const int8_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0xfUL;
+	__m128 s = _mm_set1_ps (1.0f / 127.0f);
+	__m128i v, w;
+
+	for (i = 0; i < nv; i += 16) {
+		v = _mm_loadu_si128 ((const __m128i*)(src + i));
+		w = _mm_srai_epi16 (_mm_unpacklo_epi8 (v, v), 8);
+		_mm_storeu_ps (dst + i, _mm_mul_ps (_mm_cvtepi32_ps (
+							   _mm_srai_epi32 (_mm_unpacklo_epi16 (w, w), 16)), s));
+		_mm_storeu_ps (dst + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (
+							       _mm_srai_epi32 (_mm_unpackhi_epi16 (w, w), 16)), s));
+		w = _mm_srai_epi16 (_mm_unpackhi_epi8 (v, v), 8);
+		_mm_storeu_ps (dst + i + 8, _mm_mul_ps (_mm_cvtepi32_ps (
+							       _mm_srai_epi32 (_mm_unpacklo_epi16 (w, w), 16)), s));
+		_mm_storeu_ps (dst + i + 12, _mm_mul_ps (_mm_cvtepi32_ps (
+								_mm_srai_epi32 (_mm_unpackhi_epi16 (w, w), 16)), s));
+	}
+	return nv;
+}
+
+__attribute__((target ("sse2"))) static unsigned long
+sse2_float_to_s8 (int8_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i, j, nv = n & ~0xfUL;
+	__m128 lo = _mm_set1_ps (-1.0f);
+	__m128 hi = _mm_set1_ps (1.0f);
+	__m128 s = _mm_set1_ps (127.0f);
+	__m128i v[4];
+
+	for (i = 0; i < nv; i += 16) {
+		for (j = 0; j < 4; j++) {
+			v[j] = _mm_cvttps_epi32 (_mm_mul_ps (_mm_min_ps (_mm_max_ps (
+									  _mm_loadu_ps (src + i + 4 * j), lo), hi), s));
+		}
+		_mm_storeu_si128 ((__m128i*)(dst + i),
+				  _mm_packs_epi16 (_mm_packs_epi32 (v[0], v[1]),
+						   _mm_packs_epi32 (v[2], v[3])));
+	}
+	return nv;
+}
+
+#endif /* ARCH_X86 */
+
+#ifdef ARCH_ARM64
+
+static unsigned long
+neon_s16_to_float (float *dst, const uint16_t *src, unsigned long n, float scale)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	float32x4_t one = vdupq_n_f32 (1.0f);
+	uint16x8_t v;
+
+	for (i = 0; i < nv; i += 8) {
+		v = vreinterpretq_u16_u8 (vrev16q_u8 (vld1q_u8 ((const uint8_t*)(src + i))));
+		vst1q_f32 (dst + i, vsubq_f32 (vmulq_n_f32 (vcvtq_f32_u32 (
+								   vmovl_u16 (vget_low_u16 (v))), scale), one));
+		vst1q_f32 (dst + i + 4, vsubq_f32 (vmulq_n_f32 (vcvtq_f32_u32 (
+								       vmovl_u16 (vget_high_u16 (v))), scale), one));
+	}
+	return nv;
+}
+
+static unsigned long
+neon_float_to_s16 (uint16_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	float32x4_t lo = vdupq_n_f32 (-1.0f);
+	float32x4_t hi = vdupq_n_f32 (1.0f);
+	float32x4_t s = vdupq_n_f32 (32767.0f);
+	uint32x4_t a, b;
+
+	for (i = 0; i < nv; i += 8) {
+		a = vcvtq_u32_f32 (vmlaq_f32 (s, vminq_f32 (vmaxq_f32 (vld1q_f32 (src + i), lo), hi), s));
+		b = vcvtq_u32_f32 (vmlaq_f32 (s, vminq_f32 (vmaxq_f32 (vld1q_f32 (src + i + 4), lo), hi), s));
+		vst1q_u8 ((uint8_t*)(dst + i), vrev16q_u8 (vreinterpretq_u8_u16 (
+								   vcombine_u16 (vmovn_u32 (a), vmovn_u32 (b)))));
+	}
+	return nv;
+}
+
+static unsigned long
+neon_s8_to_float (float *dst, const int8_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	int16x8_t v;
+
+	for (i = 0; i < nv; i += 8) {
+		v = vmovl_s8 (vld1_s8 (src + i));
+		vst1q_f32 (dst + i, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v))), 1.0f / 127.0f));
+		vst1q_f32 (dst + i + 4, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v))), 1.0f / 127.0f));
+	}
+	return nv;
+}
+
+static unsigned long
+neon_float_to_s8 (int8_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	float32x4_t lo = vdupq_n_f32 (-1.0f);
+	float32x4_t hi = vdupq_n_f32 (1.0f);
+	int32x4_t a, b;
+
+	for (i = 0; i < nv; i += 8) {
+		a = vcvtq_s32_f32 (vmulq_n_f32 (vminq_f32 (vmaxq_f32 (vld1q_f32 (src + i), lo), hi), 127.0f));
+		b = vcvtq_s32_f32 (vmulq_n_f32 (vminq_f32 (vmaxq_f32 (vld1q_f32 (src + i + 4), lo), hi), 127.0f));
+		vst1_s8 (dst + i, vmovn_s16 (vcombine_s16 (vmovn_s32 (a), vmovn_s32 (b))));
+	}
+	return nv;
+}
+
+#endif /* ARCH_ARM64 */
+#endif /* USE_DYNSIMD */
+
+// dst = ntohs (src) * scale - 1
+static void
+netjack_s16_to_float (float *dst, const uint16_t *src, unsigned long n, float scale)
+{
+	unsigned long i = 0;
+
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		i = sse2_s16_to_float (dst, src, n, scale);
+	}
+#endif
+#ifdef ARCH_ARM64
+	if (ARCH_ARM64_HAVE_NEON (cpu_type)) {
+		i = neon_s16_to_float (dst, src, n, scale);
+	}
+#endif
+#endif
+	for (; i < n; i++) {
+		dst[i] = (float)ntohs (src[i]) * scale - 1.0f;
+	}
+}
+
+static void
+netjack_float_to_s16 (uint16_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i = 0;
+
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		i = sse2_float_to_s16 (dst, src, n);
+	}
+#endif
+#ifdef ARCH_ARM64
+	if (ARCH_ARM64_HAVE_NEON (cpu_type)) {
+		i = neon_float_to_s16 (dst, src, n);
+	}
+#endif
+#endif
+	for (; i < n; i++) {
+		dst[i] = s16_from_float (src[i]);
+	}
+}
+
+static void
+netjack_s8_to_float (float *dst, const int8_t *src, unsigned long n)
+{
+	unsigned long i = 0;
+
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		i = sse2_s8_to_float (dst, src, n);
+	}
+#endif
+#ifdef ARCH_ARM64
+	if (ARCH_ARM64_HAVE_NEON (cpu_type)) {
+		i = neon_s8_to_float (dst, src, n);
+	}
+#endif
+#endif
+	for (; i < n; i++) {
+		dst[i] = (float)src[i] * (1.0f / 127.0f);
+	}
+}
+
+static void
+netjack_float_to_s8 (int8_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i = 0;
+
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		i = sse2_float_to_s8 (dst, src, n);
+	}
+#endif
+#ifdef ARCH_ARM64
+	if (ARCH_ARM64_HAVE_NEON (cpu_type)) {
+		i = neon_float_to_s8 (dst, src, n);
+	}
+#endif
+#endif
+	for (; i < n; i++) {
+		dst[i] = s8_from_float (src[i]);
+	}
+}
+
 int get_sample_size (int bitdepth)
 {
 	if (bitdepth == 8) {
@@ -130,7 +554,7 @@ int get_sample_size (int bitdepth)
 	}
 	//JN: why? is this for buffer sizes before or after encoding?
 	//JN: if the former, why not int16_t, if the latter, shouldn't it depend on -c N?
-	if ( bitdepth == CELT_MODE ) {
+	if ( bitdepth == CELT_MODE || bitdepth == OPUS_MODE ) {
 		return sizeof( unsigned char );
 	}
 	return sizeof(int32_t);
@@ -147,13 +571,50 @@ int jack_port_is_midi (const char *porttype)
 }
 
 
+// at most this many fragments are moved per sendmmsg()/recvmmsg() call.
+#define NETJACK_MMSG_BATCH 64
+
 // fragment management functions.
 
+// slots, bitmaps and packet buffers each start on a cache line.
+#define PACKET_CACHE_ALIGN 64
+#define PACKET_CACHE_ROUND(x) (((x) + PACKET_CACHE_ALIGN - 1) & ~(PACKET_CACHE_ALIGN - 1))
+
+static inline cache_packet *
+packet_cache_slot (packet_cache *pcache, jack_nframes_t framecnt)
+{
+	return &(pcache->packets[framecnt & pcache->mask]);
+}
+
+// the slot holding framecnt, or NULL.
+static inline cache_packet *
+packet_cache_lookup (packet_cache *pcache, jack_nframes_t framecnt)
+{
+	cache_packet *cpack = packet_cache_slot (pcache, framecnt);
+
+	if (cpack->valid && (cpack->framecnt == framecnt)) {
+		return cpack;
+	}
+	return NULL;
+}
+
+static inline void
+netjack_xor (char *dst, const char *src, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		dst[i] ^= src[i];
+	}
+}
+
 packet_cache
 *packet_cache_new (int num_packets, int pkt_size, int mtu)
 {
 	int fragment_payload_size = mtu - sizeof(jacknet_packet_header);
-	int i, fragment_number;
+	int i, fragment_number, bitmap_words, size;
+	size_t slots_size, bitmaps_size, buf_stride;
+	char *storage;
 
 	if ( pkt_size == sizeof(jacknet_packet_header) ) {
 		fragment_number = 1;
@@ -167,79 +628,141 @@ packet_cache
 		return NULL;
 	}
 
-	pcache->size = num_packets;
-	pcache->packets = malloc (sizeof(cache_packet) * num_packets);
+	for (size = 1; size < num_packets; size <<= 1)
+		;
+
+	bitmap_words = (fragment_number + 31) / 32;
+	slots_size = PACKET_CACHE_ROUND (sizeof(cache_packet) * size);
+	bitmaps_size = PACKET_CACHE_ROUND (sizeof(uint32_t) * bitmap_words * size);
+	buf_stride = PACKET_CACHE_ROUND (pkt_size);
+
+	pcache->size = size;
+	pcache->mask = size - 1;
 	pcache->master_address_valid = 0;
 	pcache->last_framecnt_retreived = 0;
 	pcache->last_framecnt_retreived_valid = 0;
-
-	if (pcache->packets == NULL) {
+	pcache->highest_framecnt_valid = 0;
+	pcache->cleared_framecnt_valid = 0;
+	pcache->period_usecs = 0;
+	pcache->last_arrival_valid = 0;
+	pcache->arrival_jitter = 0.0;
+
+	storage = malloc (slots_size + bitmaps_size + buf_stride * size);
+	if (storage == NULL) {
 		jack_error ("could not allocate packet cache (2)");
 		return NULL;
 	}
+	memset (storage, 0, slots_size + bitmaps_size);
+	pcache->packets = (cache_packet*)storage;
 
-	for (i = 0; i < num_packets; i++) {
+	for (i = 0; i < size; i++) {
 		pcache->packets[i].valid = 0;
 		pcache->packets[i].num_fragments = fragment_number;
+		pcache->packets[i].num_fragments_received = 0;
 		pcache->packets[i].packet_size = pkt_size;
 		pcache->packets[i].mtu = mtu;
 		pcache->packets[i].framecnt = 0;
-		pcache->packets[i].fragment_array = malloc (sizeof(char) * fragment_number);
-		pcache->packets[i].packet_buf = malloc (pkt_size);
-		if ((pcache->packets[i].fragment_array == NULL) || (pcache->packets[i].packet_buf == NULL)) {
-			jack_error ("could not allocate packet cache (3)");
-			return NULL;
-		}
+		pcache->packets[i].fragment_bits = (uint32_t*)(storage + slots_size) + i * bitmap_words;
+		pcache->packets[i].packet_buf = storage + slots_size + bitmaps_size + i * buf_stride;
+		pcache->packets[i].fec_group = 0;
+		pcache->packets[i].fec_bits = NULL;
+		pcache->packets[i].fec_buf = NULL;
 	}
 	pcache->mtu = mtu;
+	pcache->fec_storage = NULL;
+
+	pcache->rx_batch = 0;
+	pcache->rx_buf = NULL;
+	pcache->rx_msgs = NULL;
+	pcache->rx_iov = NULL;
+	pcache->rx_addrs = NULL;
+
+#if HAVE_RECVMMSG
+	pcache->rx_batch = fragment_number < NETJACK_MMSG_BATCH ?
+			   fragment_number : NETJACK_MMSG_BATCH;
+	pcache->rx_buf = malloc (pcache->rx_batch * mtu);
+	pcache->rx_msgs = calloc (pcache->rx_batch, sizeof(struct mmsghdr));
+	pcache->rx_iov = calloc (pcache->rx_batch, sizeof(struct iovec));
+	pcache->rx_addrs = calloc (pcache->rx_batch, sizeof(struct sockaddr_storage));
+	if (pcache->rx_buf == NULL || pcache->rx_msgs == NULL ||
+	    pcache->rx_iov == NULL || pcache->rx_addrs == NULL) {
+		jack_error ("could not allocate packet cache (4)");
+		return NULL;
+	}
+
+	for (i = 0; i < pcache->rx_batch; i++) {
+		pcache->rx_iov[i].iov_base = pcache->rx_buf + i * mtu;
+		pcache->rx_iov[i].iov_len = mtu;
+		pcache->rx_msgs[i].msg_hdr.msg_iov = &pcache->rx_iov[i];
+		pcache->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		pcache->rx_msgs[i].msg_hdr.msg_name = &pcache->rx_addrs[i];
+	}
+#endif
 
 	return pcache;
 }
 
-void
-packet_cache_free (packet_cache *pcache)
+// Parity storage is only allocated once a sender uses it. It mirrors the
+// packet buffers, parity for the group starting at fragment i is kept
+// where the payload of fragment i goes.
+int
+packet_cache_enable_fec (packet_cache *pcache)
 {
-	int i;
+	int i, bitmap_words;
+	size_t bitmaps_size, buf_stride;
 
-	if ( pcache == NULL ) {
-		return;
+	if (pcache->fec_storage) {
+		return 0;
+	}
+
+	bitmap_words = (pcache->packets[0].num_fragments + 31) / 32;
+	bitmaps_size = PACKET_CACHE_ROUND (sizeof(uint32_t) * bitmap_words * pcache->size);
+	buf_stride = PACKET_CACHE_ROUND (pcache->packets[0].packet_size);
+
+	pcache->fec_storage = malloc (bitmaps_size + buf_stride * pcache->size);
+	if (pcache->fec_storage == NULL) {
+		jack_error ("could not allocate packet cache parity");
+		return -1;
 	}
+	memset (pcache->fec_storage, 0, bitmaps_size);
 
 	for (i = 0; i < pcache->size; i++) {
-		free (pcache->packets[i].fragment_array);
-		free (pcache->packets[i].packet_buf);
+		pcache->packets[i].fec_bits = (uint32_t*)pcache->fec_storage + i * bitmap_words;
+		pcache->packets[i].fec_buf = pcache->fec_storage + bitmaps_size + i * buf_stride;
+	}
+
+	return 0;
+}
+
+void
+packet_cache_free (packet_cache *pcache)
+{
+	if ( pcache == NULL ) {
+		return;
 	}
 
 	free (pcache->packets);
+	free (pcache->fec_storage);
+	free (pcache->rx_buf);
+	free (pcache->rx_msgs);
+	free (pcache->rx_iov);
+	free (pcache->rx_addrs);
 	free (pcache);
 }
 
 cache_packet
 *packet_cache_get_packet (packet_cache *pcache, jack_nframes_t framecnt)
 {
-	int i;
-	cache_packet *retval;
+	cache_packet *retval = packet_cache_slot (pcache, framecnt);
 
-	for (i = 0; i < pcache->size; i++)
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-			return &(pcache->packets[i]);
-		}
-
-	// The Packet is not in the packet cache.
-	// find a free packet.
-
-	retval = packet_cache_get_free_packet (pcache);
-	if (retval != NULL) {
-		cache_packet_set_framecnt (retval, framecnt);
+	if (retval->valid && (retval->framecnt == framecnt)) {
 		return retval;
 	}
 
-	// No Free Packet available
-	// Get The Oldest packet and reset it.
+	// The Packet is not in the packet cache. Its slot is either free,
+	// or holds a packet size frames away from it, which we drop.
 
-	retval = packet_cache_get_oldest_packet (pcache);
-	//printf( "Dropping %d from Cache :S\n", retval->framecnt );
-	cache_packet_reset (retval);
+	//if (retval->valid) printf( "Dropping %d from Cache :S\n", retval->framecnt );
 	cache_packet_set_framecnt (retval, framecnt);
 
 	return retval;
@@ -283,30 +806,105 @@ cache_packet
 void
 cache_packet_reset (cache_packet *pack)
 {
-	int i;
-
 	pack->valid = 0;
-
-	// XXX: i dont think this is necessary here...
-	//      fragement array is cleared in _set_framecnt()
-
-	for (i = 0; i < pack->num_fragments; i++)
-		pack->fragment_array[i] = 0;
 }
 
 void
 cache_packet_set_framecnt (cache_packet *pack, jack_nframes_t framecnt)
 {
-	int i;
-
 	pack->framecnt = framecnt;
 
-	for (i = 0; i < pack->num_fragments; i++)
-		pack->fragment_array[i] = 0;
+	memset (pack->fragment_bits, 0, sizeof(uint32_t) * ((pack->num_fragments + 31) / 32));
+	pack->num_fragments_received = 0;
+
+	pack->fec_group = 0;
+	if (pack->fec_bits) {
+		memset (pack->fec_bits, 0, sizeof(uint32_t) * ((pack->num_fragments + 31) / 32));
+	}
 
 	pack->valid = 1;
 }
 
+static inline void
+cache_packet_mark_fragment (cache_packet *pack, jack_nframes_t fragment_nr)
+{
+	uint32_t bit = 1U << (fragment_nr & 31);
+
+	if (!(pack->fragment_bits[fragment_nr >> 5] & bit)) {
+		pack->fragment_bits[fragment_nr >> 5] |= bit;
+		pack->num_fragments_received++;
+	}
+}
+
+static inline int
+cache_packet_has_fragment (cache_packet *pack, jack_nframes_t fragment_nr)
+{
+	return (pack->fragment_bits[fragment_nr >> 5] & (1U << (fragment_nr & 31))) != 0;
+}
+
+// payload bytes fragment_nr carries.
+static inline int
+cache_packet_fragment_len (cache_packet *pack, jack_nframes_t fragment_nr)
+{
+	int fragment_payload_size = pack->mtu - sizeof(jacknet_packet_header);
+	int left = pack->packet_size - sizeof(jacknet_packet_header) - fragment_nr * fragment_payload_size;
+
+	return left < fragment_payload_size ? left : fragment_payload_size;
+}
+
+// Rebuild the fragment of the group starting at first, if it is the
+// only one missing and the group's parity is there.
+static void
+cache_packet_fec_recover (cache_packet *pack, jack_nframes_t first)
+{
+	int fragment_payload_size = pack->mtu - sizeof(jacknet_packet_header);
+	char *packet_bufX = pack->packet_buf + sizeof(jacknet_packet_header);
+	char *dst;
+	jack_nframes_t i, last;
+	int missing = -1;
+	int len, n;
+
+	if ((pack->fec_group == 0) || !(pack->fec_bits[first >> 5] & (1U << (first & 31)))) {
+		return;
+	}
+
+	last = first + pack->fec_group;
+	if (last > pack->num_fragments) {
+		last = pack->num_fragments;
+	}
+
+	for (i = first; i < last; i++) {
+		if (!cache_packet_has_fragment (pack, i)) {
+			if (missing >= 0) {
+				return;
+			}
+			missing = i;
+		}
+	}
+	if (missing < 0) {
+		return;
+	}
+
+	len = cache_packet_fragment_len (pack, missing);
+	dst = packet_bufX + missing * fragment_payload_size;
+	memcpy (dst, pack->fec_buf + first * fragment_payload_size, len);
+
+	for (i = first; i < last; i++) {
+		if (i == missing) {
+			continue;
+		}
+		n = cache_packet_fragment_len (pack, i);
+		netjack_xor (dst, packet_bufX + i * fragment_payload_size, n < len ? n : len);
+	}
+
+	// cache_packet_add_parity() left the header there.
+	if (missing == 0) {
+		((jacknet_packet_header*)pack->packet_buf)->fragment_nr = htonl (0);
+	}
+
+	cache_packet_mark_fragment (pack, missing);
+}
+
 void
 cache_packet_add_fragment (cache_packet *pack, char *packet_buf, int rcv_len)
 {
@@ -324,34 +922,68 @@ cache_packet_add_fragment (cache_packet *pack, char *packet_buf, int rcv_len)
 	}
 
 
-	if (fragment_nr == 0) {
-		memcpy (pack->packet_buf, packet_buf, rcv_len);
-		pack->fragment_array[0] = 1;
-
+	if (fragment_nr == 0) {
+		memcpy (pack->packet_buf, packet_buf, rcv_len);
+		cache_packet_mark_fragment (pack, 0);
+	} else if ((fragment_nr < pack->num_fragments) && (fragment_nr > 0)) {
+		if ((fragment_nr * fragment_payload_size + rcv_len - sizeof(jacknet_packet_header)) <= (pack->packet_size - sizeof(jacknet_packet_header))) {
+			memcpy (packet_bufX + fragment_nr * fragment_payload_size, dataX, rcv_len - sizeof(jacknet_packet_header));
+			cache_packet_mark_fragment (pack, fragment_nr);
+		} else {
+			jack_error ("too long packet received...");
+			return;
+		}
+	} else {
+		return;
+	}
+
+	if (pack->fec_group) {
+		cache_packet_fec_recover (pack, fragment_nr - fragment_nr % pack->fec_group);
+	}
+}
+
+void
+cache_packet_add_parity (cache_packet *pack, char *packet_buf, int rcv_len)
+{
+	jacknet_packet_header *pkthdr = (jacknet_packet_header*)packet_buf;
+	int fragment_payload_size = pack->mtu - sizeof(jacknet_packet_header);
+
+	jack_nframes_t fragment_nr = ntohl (pkthdr->fragment_nr);
+	jack_nframes_t framecnt    = ntohl (pkthdr->framecnt);
+	jack_nframes_t group = (fragment_nr >> 16) & NETJACK_FEC_MAX_GROUP;
+	jack_nframes_t first = fragment_nr & (NETJACK_FEC_MAX_FRAGMENTS - 1);
+	int len;
+
+	if ((pack->fec_bits == NULL) || (framecnt != pack->framecnt)) {
+		return;
+	}
+
+	if ((group == 0) || (first >= pack->num_fragments) || (first % group)) {
+		return;
+	}
+
+	len = cache_packet_fragment_len (pack, first);
+	if (rcv_len - (int)sizeof(jacknet_packet_header) < len) {
+		jack_error ("too short parity fragment received...");
 		return;
 	}
 
-	if ((fragment_nr < pack->num_fragments) && (fragment_nr > 0)) {
-		if ((fragment_nr * fragment_payload_size + rcv_len - sizeof(jacknet_packet_header)) <= (pack->packet_size - sizeof(jacknet_packet_header))) {
-			memcpy (packet_bufX + fragment_nr * fragment_payload_size, dataX, rcv_len - sizeof(jacknet_packet_header));
-			pack->fragment_array[fragment_nr] = 1;
-		} else {
-			jack_error ("too long packet received...");
-		}
+	memcpy (pack->fec_buf + first * fragment_payload_size, packet_buf + sizeof(jacknet_packet_header), len);
+	pack->fec_bits[first >> 5] |= 1U << (first & 31);
+	pack->fec_group = group;
+
+	// in case it is fragment 0 we have to rebuild.
+	if (!cache_packet_has_fragment (pack, 0)) {
+		memcpy (pack->packet_buf, packet_buf, sizeof(jacknet_packet_header));
 	}
+
+	cache_packet_fec_recover (pack, first);
 }
 
 int
 cache_packet_is_complete (cache_packet *pack)
 {
-	int i;
-
-	for (i = 0; i < pack->num_fragments; i++)
-		if (pack->fragment_array[i] == 0) {
-			return 0;
-		}
-
-	return 1;
+	return pack->num_fragments_received == pack->num_fragments;
 }
 
 #ifndef WIN32
@@ -417,6 +1049,17 @@ netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_micro
 	return poll_err;
 }
 
+static int
+netjack_poll_now (int sockfd)
+{
+	struct pollfd fds;
+
+	fds.fd = sockfd;
+	fds.events = POLLIN;
+
+	return poll (&fds, 1, 0);
+}
+
 int
 netjack_poll (int sockfd, int timeout)
 {
@@ -510,28 +1153,182 @@ netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_micro
 
 	return 0;
 }
+
+static int
+netjack_poll_now (int sockfd)
+{
+	fd_set fds;
+	struct timeval timeout = { 0, 0 };
+
+	FD_ZERO ( &fds );
+	FD_SET ( sockfd, &fds );
+
+	return select (0, &fds, NULL, NULL, &timeout);
+}
 #endif
+
+// The sleep in poll wakes up late by up to the scheduler's latency, or
+// rounded to a millisecond without ppoll. Spinning the last stretch
+// keeps that out of short network periods, at the cost of a core.
+int
+netjack_poll_deadline_spin (int sockfd, jack_time_t deadline, jack_time_t spin_usecs, jack_time_t (*get_microseconds)(void))
+{
+	int poll_err;
+
+	if ( spin_usecs == 0 ) {
+		return netjack_poll_deadline ( sockfd, deadline, get_microseconds );
+	}
+
+	if ( deadline > spin_usecs ) {
+		poll_err = netjack_poll_deadline ( sockfd, deadline - spin_usecs, get_microseconds );
+		if ( poll_err != 0 ) {
+			return poll_err;
+		}
+	}
+
+	while ( get_microseconds () < deadline ) {
+		poll_err = netjack_poll_now ( sockfd );
+		if ( poll_err != 0 ) {
+			return poll_err;
+		}
+	}
+
+	return 0;
+}
+
 // This now reads all a socket has into the cache.
 // replacing netjack_recv functions.
 
+// Called when the last fragment of a packet came in. D is how much
+// later (or earlier) than its send time says it got here compared to
+// the previous packet.
+static void
+packet_cache_update_arrival ( packet_cache *pcache, jack_nframes_t framecnt, jack_time_t now )
+{
+	double d;
+
+	if ( pcache->period_usecs == 0 ) {
+		return;
+	}
+
+	if ( pcache->last_arrival_valid ) {
+		d = (double)now - (double)pcache->last_arrival
+		    - (double)(int32_t)(framecnt - pcache->last_arrival_framecnt) * (double)pcache->period_usecs;
+		pcache->arrival_jitter += (fabs (d) - pcache->arrival_jitter) / 16.0;
+	}
+
+	pcache->last_arrival_framecnt = framecnt;
+	pcache->last_arrival = now;
+	pcache->last_arrival_valid = 1;
+}
+
+static void
+packet_cache_add_received ( packet_cache *pcache, char *rx_packet, int rcv_len,
+			    struct sockaddr_storage *sender_address, size_t senderlen,
+			    jack_time_t (*get_microseconds)(void) )
+{
+	jacknet_packet_header *pkthdr = (jacknet_packet_header*)rx_packet;
+	jack_nframes_t framecnt, fragment_nr;
+	cache_packet *cpack;
+	int was_complete;
+
+	if (pcache->master_address_valid) {
+		// Verify its from our master.
+		if (memcmp (sender_address, &(pcache->master_address), senderlen) != 0) {
+			return;
+		}
+	} else {
+		// Setup this one as master
+		//printf( "setup master...\n" );
+		memcpy ( &(pcache->master_address), sender_address, senderlen );
+		pcache->master_address_valid = 1;
+	}
+
+	framecnt = ntohl (pkthdr->framecnt);
+	if ( pcache->last_framecnt_retreived_valid && (framecnt <= pcache->last_framecnt_retreived )) {
+		return;
+	}
+
+	cpack = packet_cache_get_packet (pcache, framecnt);
+	was_complete = cache_packet_is_complete (cpack);
+
+	fragment_nr = ntohl (pkthdr->fragment_nr);
+	if (fragment_nr & NETJACK_FEC_FRAGMENT) {
+		if (was_complete || packet_cache_enable_fec (pcache)) {
+			return;
+		}
+		cache_packet_add_parity (cpack, rx_packet, rcv_len);
+	} else {
+		cache_packet_add_fragment (cpack, rx_packet, rcv_len);
+	}
+	cpack->recv_timestamp = get_microseconds ();
+
+	if (was_complete || !cache_packet_is_complete (cpack)) {
+		return;
+	}
+
+	packet_cache_update_arrival (pcache, framecnt, cpack->recv_timestamp);
+
+	if (!pcache->highest_framecnt_valid || framecnt > pcache->highest_framecnt) {
+		pcache->highest_framecnt = framecnt;
+		pcache->highest_framecnt_valid = 1;
+	}
+}
+
+#if HAVE_RECVMMSG
+
+// Receive up to a whole period of fragments per syscall. A short
+// batch means the socket has been emptied.
+void
+packet_cache_drain_socket ( packet_cache *pcache, int sockfd, jack_time_t (*get_microseconds)(void) )
+{
+	int i, n;
+
+	while (1) {
+		for (i = 0; i < pcache->rx_batch; i++) {
+			pcache->rx_msgs[i].msg_hdr.msg_namelen = sizeof( struct sockaddr_storage );
+		}
+
+		n = recvmmsg (sockfd, pcache->rx_msgs, pcache->rx_batch, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+
+		for (i = 0; i < n; i++) {
+			packet_cache_add_received (pcache, pcache->rx_iov[i].iov_base,
+						   pcache->rx_msgs[i].msg_len,
+						   &pcache->rx_addrs[i],
+						   pcache->rx_msgs[i].msg_hdr.msg_namelen,
+						   get_microseconds);
+		}
+
+		if (n < pcache->rx_batch) {
+			return;
+		}
+	}
+}
+
+#else
+
 void
 packet_cache_drain_socket ( packet_cache *pcache, int sockfd, jack_time_t (*get_microseconds)(void) )
 {
 	char *rx_packet = alloca (pcache->mtu);
-	jacknet_packet_header *pkthdr = (jacknet_packet_header*)rx_packet;
 	int rcv_len;
-	jack_nframes_t framecnt;
-	cache_packet *cpack;
-	struct sockaddr_in sender_address;
+	struct sockaddr_storage sender_address;
 
 #ifdef WIN32
-	size_t senderlen = sizeof( struct sockaddr_in );
+	size_t senderlen = sizeof( struct sockaddr_storage );
 	u_long parm = 1;
 	ioctlsocket ( sockfd, FIONBIO, &parm );
 #else
-	socklen_t senderlen = sizeof( struct sockaddr_in );
+	socklen_t senderlen;
 #endif
 	while (1) {
+		senderlen = sizeof( struct sockaddr_storage );
 #ifdef WIN32
 		rcv_len = recvfrom (sockfd, rx_packet, pcache->mtu, 0,
 				    (struct sockaddr*)&sender_address, &senderlen);
@@ -543,62 +1340,57 @@ packet_cache_drain_socket ( packet_cache *pcache, int sockfd, jack_time_t (*get_
 			return;
 		}
 
-		if (pcache->master_address_valid) {
-			// Verify its from our master.
-			if (memcmp (&sender_address, &(pcache->master_address), senderlen) != 0) {
-				continue;
-			}
-		} else {
-			// Setup this one as master
-			//printf( "setup master...\n" );
-			memcpy ( &(pcache->master_address), &sender_address, senderlen );
-			pcache->master_address_valid = 1;
-		}
-
-		framecnt = ntohl (pkthdr->framecnt);
-		if ( pcache->last_framecnt_retreived_valid && (framecnt <= pcache->last_framecnt_retreived )) {
-			continue;
-		}
-
-		cpack = packet_cache_get_packet (pcache, framecnt);
-		cache_packet_add_fragment (cpack, rx_packet, rcv_len);
-		cpack->recv_timestamp = get_microseconds ();
+		packet_cache_add_received (pcache, rx_packet, rcv_len,
+					   &sender_address, senderlen,
+					   get_microseconds);
 	}
 }
 
+#endif
+
 void
 packet_cache_reset_master_address ( packet_cache *pcache )
 {
 	pcache->master_address_valid = 0;
 	pcache->last_framecnt_retreived = 0;
 	pcache->last_framecnt_retreived_valid = 0;
+	pcache->cleared_framecnt_valid = 0;
+	pcache->last_arrival_valid = 0;
 }
 
 void
 packet_cache_clear_old_packets (packet_cache *pcache, jack_nframes_t framecnt )
 {
+	cache_packet *cpack;
+	jack_nframes_t f;
 	int i;
 
-	for (i = 0; i < pcache->size; i++) {
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt < framecnt)) {
-			cache_packet_reset (&(pcache->packets[i]));
+	// Usually only the frames since the last call can be left, as
+	// older ones are refused once a later one has been retreived.
+	if (pcache->cleared_framecnt_valid &&
+	    (framecnt >= pcache->cleared_framecnt) &&
+	    (framecnt - pcache->cleared_framecnt < pcache->size)) {
+		for (f = pcache->cleared_framecnt; f < framecnt; f++) {
+			if ((cpack = packet_cache_lookup (pcache, f)) != NULL) {
+				cache_packet_reset (cpack);
+			}
+		}
+	} else {
+		for (i = 0; i < pcache->size; i++) {
+			if (pcache->packets[i].valid && (pcache->packets[i].framecnt < framecnt)) {
+				cache_packet_reset (&(pcache->packets[i]));
+			}
 		}
 	}
+
+	pcache->cleared_framecnt = framecnt;
+	pcache->cleared_framecnt_valid = 1;
 }
 
 int
 packet_cache_retreive_packet_pointer ( packet_cache *pcache, jack_nframes_t framecnt, char **packet_buf, int pkt_size, jack_time_t *timestamp )
 {
-	int i;
-	cache_packet *cpack = NULL;
-
-
-	for (i = 0; i < pcache->size; i++) {
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-			cpack = &(pcache->packets[i]);
-			break;
-		}
-	}
+	cache_packet *cpack = packet_cache_lookup (pcache, framecnt);
 
 	if ( cpack == NULL ) {
 		//printf( "retreive packet: %d....not found\n", framecnt );
@@ -624,16 +1416,7 @@ packet_cache_retreive_packet_pointer ( packet_cache *pcache, jack_nframes_t fram
 int
 packet_cache_release_packet ( packet_cache *pcache, jack_nframes_t framecnt )
 {
-	int i;
-	cache_packet *cpack = NULL;
-
-
-	for (i = 0; i < pcache->size; i++) {
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-			cpack = &(pcache->packets[i]);
-			break;
-		}
-	}
+	cache_packet *cpack = packet_cache_lookup (pcache, framecnt);
 
 	if ( cpack == NULL ) {
 		//printf( "retreive packet: %d....not found\n", framecnt );
@@ -667,16 +1450,57 @@ packet_cache_get_fill ( packet_cache *pcache, jack_nframes_t expected_framecnt )
 	return 100.0 * (float)num_packets_before_us / (float)( pcache->size );
 }
 
+float
+packet_cache_get_jitter ( packet_cache *pcache )
+{
+	return pcache->arrival_jitter;
+}
+
 // Returns 0 when no valid packet is inside the cache.
+//
+// Probes the slots in framecnt order from expected_framecnt, so the
+// common case of the expected packet being there is a single lookup.
 int
 packet_cache_get_next_available_framecnt ( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt )
+{
+	cache_packet *cpack;
+	jack_nframes_t offset;
+
+	for (offset = 0; offset < pcache->size; offset++) {
+		cpack = packet_cache_lookup (pcache, expected_framecnt + offset);
+
+		if (cpack && cache_packet_is_complete ( cpack ) &&
+		    (cpack->framecnt >= expected_framecnt)) {
+			if ( framecnt ) {
+				*framecnt = cpack->framecnt;
+			}
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+packet_cache_get_highest_available_framecnt ( packet_cache *pcache, jack_nframes_t *framecnt )
 {
 	int i;
-	jack_nframes_t best_offset = JACK_MAX_FRAMES / 2 - 1;
+	jack_nframes_t best_value = 0;
 	int retval = 0;
+	cache_packet *cpack;
+
+	// the newest complete packet is usually still there.
+	if (pcache->highest_framecnt_valid &&
+	    (cpack = packet_cache_lookup (pcache, pcache->highest_framecnt)) != NULL &&
+	    cache_packet_is_complete ( cpack )) {
+		if ( framecnt ) {
+			*framecnt = pcache->highest_framecnt;
+		}
+		return 1;
+	}
 
 	for (i = 0; i < pcache->size; i++) {
-		cache_packet *cpack = &(pcache->packets[i]);
+		cpack = &(pcache->packets[i]);
 		//printf( "p%d: valid=%d, frame %d\n", i, cpack->valid, cpack->framecnt );
 
 		if (!cpack->valid || !cache_packet_is_complete ( cpack )) {
@@ -684,33 +1508,30 @@ packet_cache_get_next_available_framecnt ( packet_cache *pcache, jack_nframes_t
 			continue;
 		}
 
-		if ( cpack->framecnt < expected_framecnt ) {
-			continue;
-		}
-
-		if ( (cpack->framecnt - expected_framecnt) > best_offset ) {
+		if (cpack->framecnt < best_value) {
 			continue;
 		}
 
-		best_offset = cpack->framecnt - expected_framecnt;
+		best_value = cpack->framecnt;
 		retval = 1;
 
-		if ( best_offset == 0 ) {
-			break;
-		}
 	}
 	if ( retval && framecnt ) {
-		*framecnt = expected_framecnt + best_offset;
+		*framecnt = best_value;
 	}
 
+	pcache->highest_framecnt = best_value;
+	pcache->highest_framecnt_valid = retval;
+
 	return retval;
 }
 
+// Returns 0 when no valid packet is inside the cache.
 int
-packet_cache_get_highest_available_framecnt ( packet_cache *pcache, jack_nframes_t *framecnt )
+packet_cache_find_latency ( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt )
 {
 	int i;
-	jack_nframes_t best_value = 0;
+	jack_nframes_t best_offset = 0;
 	int retval = 0;
 
 	for (i = 0; i < pcache->size; i++) {
@@ -722,66 +1543,262 @@ packet_cache_get_highest_available_framecnt ( packet_cache *pcache, jack_nframes
 			continue;
 		}
 
-		if (cpack->framecnt < best_value) {
+		if ( (cpack->framecnt - expected_framecnt) < best_offset ) {
 			continue;
 		}
 
-		best_value = cpack->framecnt;
+		best_offset = cpack->framecnt - expected_framecnt;
 		retval = 1;
 
+		if ( best_offset == 0 ) {
+			break;
+		}
 	}
 	if ( retval && framecnt ) {
-		*framecnt = best_value;
+		*framecnt = JACK_MAX_FRAMES - best_offset;
 	}
 
 	return retval;
 }
+// addresses
 
-// Returns 0 when no valid packet is inside the cache.
 int
-packet_cache_find_latency ( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt )
+netjack_sockaddr_len (const struct sockaddr_storage *addr)
+{
+	if (addr->ss_family == AF_INET6) {
+		return sizeof(struct sockaddr_in6);
+	}
+	return sizeof(struct sockaddr_in);
+}
+
+void
+netjack_sockaddr_set_port (struct sockaddr_storage *addr, int port)
+{
+	if (addr->ss_family == AF_INET6) {
+		((struct sockaddr_in6*)addr)->sin6_port = htons (port);
+	} else {
+		((struct sockaddr_in*)addr)->sin_port = htons (port);
+	}
+}
+
+// Join group on the default interface, or for a link local IPv6 group
+// on the one its scope id names.
+int
+netjack_multicast_join (int sockfd, const struct sockaddr *group)
+{
+	if (group->sa_family == AF_INET6) {
+		struct ipv6_mreq mreq;
+
+		memset (&mreq, 0, sizeof(mreq));
+		mreq.ipv6mr_multiaddr = ((const struct sockaddr_in6*)group)->sin6_addr;
+		mreq.ipv6mr_interface = ((const struct sockaddr_in6*)group)->sin6_scope_id;
+		return setsockopt (sockfd, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char*)&mreq, sizeof(mreq));
+	} else {
+		struct ip_mreq mreq;
+
+		memset (&mreq, 0, sizeof(mreq));
+		mreq.imr_multiaddr = ((const struct sockaddr_in*)group)->sin_addr;
+		mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+		return setsockopt (sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&mreq, sizeof(mreq));
+	}
+}
+
+// socket options
+
+// Settings the kernel refuses are reported and skipped, the socket
+// still works without them. Returns the number refused.
+int
+netjack_socket_lowlatency (int sockfd, unsigned int busy_poll, unsigned int priority, unsigned int dscp, int txtime)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	int val, failed = 0;
+
+	if (busy_poll) {
+#ifdef SO_BUSY_POLL
+		val = busy_poll;
+		if (setsockopt (sockfd, SOL_SOCKET, SO_BUSY_POLL, (char*)&val, sizeof(val)) < 0) {
+			jack_error ("NET: cannot set SO_BUSY_POLL (%s)", strerror (errno));
+			failed++;
+		}
+#else
+		jack_error ("NET: SO_BUSY_POLL is not supported on this system");
+		failed++;
+#endif
+	}
+
+	if (priority) {
+#ifdef SO_PRIORITY
+		val = priority;
+		if (setsockopt (sockfd, SOL_SOCKET, SO_PRIORITY, (char*)&val, sizeof(val)) < 0) {
+			jack_error ("NET: cannot set SO_PRIORITY (%s)", strerror (errno));
+			failed++;
+		}
+#else
+		jack_error ("NET: SO_PRIORITY is not supported on this system");
+		failed++;
+#endif
+	}
+
+	if (dscp) {
+		// the DSCP is the upper six bits of the TOS / traffic class.
+		val = (dscp & 0x3f) << 2;
+		memset (&addr, 0, sizeof(addr));
+		getsockname (sockfd, (struct sockaddr*)&addr, &addr_len);
+		if (addr.ss_family == AF_INET6) {
+			if (setsockopt (sockfd, IPPROTO_IPV6, IPV6_TCLASS, (char*)&val, sizeof(val)) < 0) {
+				jack_error ("NET: cannot set IPV6_TCLASS (%s)", strerror (errno));
+				failed++;
+			}
+		}
+		// a dual stack socket sends IPv4 to mapped addresses.
+		if (setsockopt (sockfd, IPPROTO_IP, IP_TOS, (char*)&val, sizeof(val)) < 0
+		    && addr.ss_family != AF_INET6) {
+			jack_error ("NET: cannot set IP_TOS (%s)", strerror (errno));
+			failed++;
+		}
+	}
+
+	if (txtime) {
+#if NETJACK_HAVE_TXTIME
+		struct sock_txtime cfg;
+
+		memset (&cfg, 0, sizeof(cfg));
+		cfg.clockid = CLOCK_MONOTONIC;
+		if (setsockopt (sockfd, SOL_SOCKET, SO_TXTIME, (char*)&cfg, sizeof(cfg)) < 0) {
+			jack_error ("NET: cannot set SO_TXTIME (%s)", strerror (errno));
+			failed++;
+		}
+#else
+		jack_error ("NET: SO_TXTIME is not supported on this system");
+		failed++;
+#endif
+	}
+
+	return failed;
+}
+
+uint64_t
+netjack_txtime_now (void)
+{
+#if NETJACK_HAVE_TXTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+#if NETJACK_HAVE_TXTIME
+// attach an SCM_TXTIME to msg, cbuf holds CMSG_SPACE(sizeof(uint64_t)).
+static void
+netjack_msg_set_txtime (struct msghdr *msg, char *cbuf, uint64_t txtime)
+{
+	struct cmsghdr *cmsg;
+
+	msg->msg_control = cbuf;
+	msg->msg_controllen = CMSG_SPACE (sizeof(uint64_t));
+	cmsg = CMSG_FIRSTHDR (msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_TXTIME;
+	cmsg->cmsg_len = CMSG_LEN (sizeof(uint64_t));
+	memcpy (CMSG_DATA (cmsg), &txtime, sizeof(uint64_t));
+}
+#endif
+
+// one datagram, at txtime when it is not 0.
+static int
+netjack_sendto_one (int sockfd, char *buf, int len, int flags, struct sockaddr *addr, int addr_size, uint64_t txtime)
+{
+#if NETJACK_HAVE_TXTIME
+	if (txtime) {
+		struct msghdr msg;
+		struct iovec iov;
+		union {
+			char buf[CMSG_SPACE (sizeof(uint64_t))];
+			struct cmsghdr align;
+		} cbuf;
+
+		memset (&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		msg.msg_name = addr;
+		msg.msg_namelen = addr_size;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		netjack_msg_set_txtime (&msg, cbuf.buf, txtime);
+
+		return sendmsg (sockfd, &msg, flags);
+	}
+#endif
+	return sendto (sockfd, buf, len, flags, addr, addr_size);
+}
+
+// fragmented packet IO
+
+// one parity fragment per fec_group data fragments, see netjack_packet.h
+static void
+netjack_send_parity (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group, uint64_t txtime)
 {
-	int i;
-	jack_nframes_t best_offset = 0;
-	int retval = 0;
+	int fragment_payload_size = mtu - sizeof(jacknet_packet_header);
+	int payload_size = pkt_size - sizeof(jacknet_packet_header);
+	int frag_total = (pkt_size <= mtu) ? 1 : (payload_size - 1) / fragment_payload_size + 1;
+	char *tx_packet = alloca (mtu);
+	char *dataX = tx_packet + sizeof(jacknet_packet_header);
+	char *packet_bufX = packet_buf + sizeof(jacknet_packet_header);
+	jacknet_packet_header *pkthdr = (jacknet_packet_header*)tx_packet;
+	int first, i, len, n;
+
+	if (fec_group > NETJACK_FEC_MAX_GROUP) {
+		fec_group = NETJACK_FEC_MAX_GROUP;
+	}
+	if (frag_total > NETJACK_FEC_MAX_FRAGMENTS) {
+		return;
+	}
 
-	for (i = 0; i < pcache->size; i++) {
-		cache_packet *cpack = &(pcache->packets[i]);
-		//printf( "p%d: valid=%d, frame %d\n", i, cpack->valid, cpack->framecnt );
+	memcpy (tx_packet, packet_buf, sizeof(jacknet_packet_header));
 
-		if (!cpack->valid || !cache_packet_is_complete ( cpack )) {
-			//printf( "invalid\n" );
-			continue;
+	for (first = 0; first < frag_total; first += fec_group) {
+		len = payload_size - first * fragment_payload_size;
+		if (len > fragment_payload_size) {
+			len = fragment_payload_size;
 		}
+		memcpy (dataX, packet_bufX + first * fragment_payload_size, len);
 
-		if ( (cpack->framecnt - expected_framecnt) < best_offset ) {
-			continue;
+		for (i = first + 1; (i < first + fec_group) && (i < frag_total); i++) {
+			n = payload_size - i * fragment_payload_size;
+			if (n > fragment_payload_size) {
+				n = fragment_payload_size;
+			}
+			netjack_xor (dataX, packet_bufX + i * fragment_payload_size, n);
 		}
 
-		best_offset = cpack->framecnt - expected_framecnt;
-		retval = 1;
-
-		if ( best_offset == 0 ) {
-			break;
+		pkthdr->fragment_nr = htonl (NETJACK_FEC_FRAGMENT | (fec_group << 16) | first);
+		if (netjack_sendto_one (sockfd, tx_packet, len + sizeof(jacknet_packet_header), flags, addr, addr_size, txtime) < 0) {
+			perror ( "send" );
+			return;
 		}
 	}
-	if ( retval && framecnt ) {
-		*framecnt = JACK_MAX_FRAMES - best_offset;
-	}
-
-	return retval;
 }
-// fragmented packet IO
+
 void
 netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu)
 {
-	int frag_cnt = 0;
-	char *tx_packet, *dataX;
-	jacknet_packet_header *pkthdr;
+	netjack_sendto_fec (sockfd, packet_buf, pkt_size, flags, addr, addr_size, mtu, 0);
+}
+
+void
+netjack_sendto_fec (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group)
+{
+	netjack_sendto_at (sockfd, packet_buf, pkt_size, flags, addr, addr_size, mtu, fec_group, 0);
+}
 
-	tx_packet = alloca (mtu + 10);
-	dataX = tx_packet + sizeof(jacknet_packet_header);
-	pkthdr = (jacknet_packet_header*)tx_packet;
+void
+netjack_sendto_at (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group, uint64_t txtime)
+{
+	jacknet_packet_header *pkthdr;
 
 	int fragment_payload_size = mtu - sizeof(jacknet_packet_header);
 
@@ -789,13 +1806,81 @@ netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct so
 		int err;
 		pkthdr = (jacknet_packet_header*)packet_buf;
 		pkthdr->fragment_nr = htonl (0);
-		err = sendto (sockfd, packet_buf, pkt_size, flags, addr, addr_size);
+		err = netjack_sendto_one (sockfd, packet_buf, pkt_size, flags, addr, addr_size, txtime);
 		if ( err < 0 ) {
 			//printf( "error in send\n" );
 			perror ( "send" );
 		}
 	} else {
+#if HAVE_SENDMMSG
+		// Send the fragments in batches. Each one is gathered from a
+		// copy of the header with its fragment_nr, and its slice of
+		// packet_buf, so the payload is not copied.
+		int payload_size = pkt_size - sizeof(jacknet_packet_header);
+		int frag_total = (payload_size - 1) / fragment_payload_size + 1;
+		int batch = frag_total < NETJACK_MMSG_BATCH ? frag_total : NETJACK_MMSG_BATCH;
+		jacknet_packet_header *headers = alloca (batch * sizeof(jacknet_packet_header));
+		struct iovec *iov = alloca (2 * batch * sizeof(struct iovec));
+		struct mmsghdr *msgs = alloca (batch * sizeof(struct mmsghdr));
+#if NETJACK_HAVE_TXTIME
+		char *cbufs = txtime ? alloca (batch * CMSG_SPACE (sizeof(uint64_t))) : NULL;
+#endif
+		int frag_cnt = 0;
+		int i, n, sent, err;
+
+		while (frag_cnt < frag_total) {
+			n = frag_total - frag_cnt;
+			if (n > batch) {
+				n = batch;
+			}
+
+			for (i = 0; i < n; i++) {
+				int offset = (frag_cnt + i) * fragment_payload_size;
+
+				memcpy (&headers[i], packet_buf, sizeof(jacknet_packet_header));
+				headers[i].fragment_nr = htonl (frag_cnt + i);
+
+				iov[2 * i].iov_base = &headers[i];
+				iov[2 * i].iov_len = sizeof(jacknet_packet_header);
+				iov[2 * i + 1].iov_base = packet_buf + sizeof(jacknet_packet_header) + offset;
+				iov[2 * i + 1].iov_len = (payload_size - offset < fragment_payload_size) ?
+							 payload_size - offset : fragment_payload_size;
+
+				memset (&msgs[i], 0, sizeof(struct mmsghdr));
+				msgs[i].msg_hdr.msg_name = addr;
+				msgs[i].msg_hdr.msg_namelen = addr_size;
+				msgs[i].msg_hdr.msg_iov = &iov[2 * i];
+				msgs[i].msg_hdr.msg_iovlen = 2;
+#if NETJACK_HAVE_TXTIME
+				if (txtime) {
+					netjack_msg_set_txtime (&msgs[i].msg_hdr, cbufs + i * CMSG_SPACE (sizeof(uint64_t)), txtime);
+				}
+#endif
+			}
+
+			for (sent = 0; sent < n; sent += err) {
+				err = sendmmsg (sockfd, msgs + sent, n - sent, flags);
+				if (err < 0) {
+					if (errno == EINTR) {
+						err = 0;
+						continue;
+					}
+					perror ( "send" );
+					return;
+				}
+			}
+
+			frag_cnt += n;
+		}
+#else
 		int err;
+		int frag_cnt = 0;
+		char *tx_packet, *dataX;
+
+		tx_packet = alloca (mtu + 10);
+		dataX = tx_packet + sizeof(jacknet_packet_header);
+		pkthdr = (jacknet_packet_header*)tx_packet;
+
 		// Copy the packet header to the tx pack first.
 		memcpy (tx_packet, packet_buf, sizeof(jacknet_packet_header));
 
@@ -805,7 +1890,7 @@ netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct so
 		while (packet_bufX < (packet_buf + pkt_size - fragment_payload_size)) {
 			pkthdr->fragment_nr = htonl (frag_cnt++);
 			memcpy (dataX, packet_bufX, fragment_payload_size);
-			sendto (sockfd, tx_packet, mtu, flags, addr, addr_size);
+			netjack_sendto_one (sockfd, tx_packet, mtu, flags, addr, addr_size, txtime);
 			packet_bufX += fragment_payload_size;
 		}
 
@@ -815,11 +1900,16 @@ netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct so
 		//jack_log("last fragment_count = %d, payload_size = %d\n", fragment_count, last_payload_size);
 
 		// sendto(last_pack_size);
-		err = sendto (sockfd, tx_packet, last_payload_size + sizeof(jacknet_packet_header), flags, addr, addr_size);
+		err = netjack_sendto_one (sockfd, tx_packet, last_payload_size + sizeof(jacknet_packet_header), flags, addr, addr_size, txtime);
 		if ( err < 0 ) {
 			//printf( "error in send\n" );
 			perror ( "send" );
 		}
+#endif
+	}
+
+	if (fec_group > 0) {
+		netjack_send_parity (sockfd, packet_buf, pkt_size, flags, addr, addr_size, mtu, fec_group, txtime);
 	}
 }
 
@@ -906,8 +1996,6 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 	}
 
 	while (node != NULL) {
-		int i;
-		int_float_t val;
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
@@ -922,8 +2010,9 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 			// audio port, resample if necessary
 			if (net_period_down != nframes) {
 				SRC_STATE *src_state = src_node->data;
-				for (i = 0; i < net_period_down; i++)
-					packet_bufX[i] = ntohl (packet_bufX[i]);
+				if ( !dont_htonl_floats ) {
+					netjack_ntoh32 (packet_bufX, packet_bufX, net_period_down);
+				}
 
 				src.data_in = (float*)packet_bufX;
 				src.input_frames = net_period_down;
@@ -943,11 +2032,7 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 				if ( dont_htonl_floats ) {
 					memcpy ( buf, packet_bufX, net_period_down * sizeof(jack_default_audio_sample_t));
 				} else {
-					for (i = 0; i < net_period_down; i++) {
-						val.i = packet_bufX[i];
-						val.i = ntohl (val.i);
-						buf[i] = val.f;
-					}
+					netjack_ntoh32 ((uint32_t*)buf, packet_bufX, net_period_down);
 				}
 			}
 		} else if (jack_port_is_midi (porttype)) {
@@ -979,8 +2064,6 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
-		int i;
-		int_float_t val;
 		jack_port_t *port = (jack_port_t*)node->data;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
@@ -1004,8 +2087,9 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
 
-				for (i = 0; i < net_period_up; i++)
-					packet_bufX[i] = htonl (packet_bufX[i]);
+				if ( !dont_htonl_floats ) {
+					netjack_ntoh32 (packet_bufX, packet_bufX, net_period_up);
+				}
 				src_node = jack_slist_next (src_node);
 			} else
 #endif
@@ -1013,11 +2097,8 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 				if ( dont_htonl_floats ) {
 					memcpy ( packet_bufX, buf, net_period_up * sizeof(jack_default_audio_sample_t) );
 				} else {
-					for (i = 0; i < net_period_up; i++) {
-						val.f = buf[i];
-						val.i = htonl (val.i);
-						packet_bufX[i] = val.i;
-					}
+					// htonl is the same swap as ntohl.
+					netjack_ntoh32 (packet_bufX, (uint32_t*)buf, net_period_up);
 				}
 			}
 		} else if (jack_port_is_midi (porttype)) {
@@ -1051,7 +2132,6 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 	}
 
 	while (node != NULL) {
-		int i;
 		//uint32_t val;
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
@@ -1071,8 +2151,7 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 #if HAVE_SAMPLERATE
 			if (net_period_down != nframes) {
 				SRC_STATE *src_state = src_node->data;
-				for (i = 0; i < net_period_down; i++)
-					floatbuf[i] = ((float)ntohs (packet_bufX[i])) / 32767.0 - 1.0;
+				netjack_s16_to_float (floatbuf, packet_bufX, net_period_down, 1.0f / 32767.0f);
 
 				src.data_in = floatbuf;
 				src.input_frames = net_period_down;
@@ -1088,8 +2167,7 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 				src_node = jack_slist_next (src_node);
 			} else
 #endif
-			for (i = 0; i < net_period_down; i++)
-				buf[i] = ((float)ntohs (packet_bufX[i])) / 32768.0 - 1.0;
+			netjack_s16_to_float (buf, packet_bufX, net_period_down, 1.0f / 32768.0f);
 		} else if (jack_port_is_midi (porttype)) {
 			// midi port, decode midi events
 			// convert the data buffer to a standard format (uint32_t based)
@@ -1119,7 +2197,6 @@ render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_src
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
-		int i;
 		jack_port_t *port = (jack_port_t*)node->data;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 		const char *porttype = jack_port_type (port);
@@ -1145,13 +2222,11 @@ render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_src
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
 
-				for (i = 0; i < net_period_up; i++)
-					packet_bufX[i] = htons (((uint16_t)((floatbuf[i] + 1.0) * 32767.0)));
+				netjack_float_to_s16 (packet_bufX, floatbuf, net_period_up);
 				src_node = jack_slist_next (src_node);
 			} else
 #endif
-			for (i = 0; i < net_period_up; i++)
-				packet_bufX[i] = htons (((uint16_t)((buf[i] + 1.0) * 32767.0)));
+			netjack_float_to_s16 (packet_bufX, buf, net_period_up);
 		} else if (jack_port_is_midi (porttype)) {
 			// encode midi events from port to packet
 			// convert the data buffer to a standard format (uint32_t based)
@@ -1183,7 +2258,6 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 	}
 
 	while (node != NULL) {
-		int i;
 		//uint32_t val;
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
@@ -1202,8 +2276,7 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 			// audio port, resample if necessary
 			if (net_period_down != nframes) {
 				SRC_STATE *src_state = src_node->data;
-				for (i = 0; i < net_period_down; i++)
-					floatbuf[i] = ((float)packet_bufX[i]) / 127.0;
+				netjack_s8_to_float (floatbuf, packet_bufX, net_period_down);
 
 				src.data_in = floatbuf;
 				src.input_frames = net_period_down;
@@ -1219,8 +2292,7 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 				src_node = jack_slist_next (src_node);
 			} else
 #endif
-			for (i = 0; i < net_period_down; i++)
-				buf[i] = ((float)packet_bufX[i]) / 127.0;
+			netjack_s8_to_float (buf, packet_bufX, net_period_down);
 		} else if (jack_port_is_midi (porttype)) {
 			// midi port, decode midi events
 			// convert the data buffer to a standard format (uint32_t based)
@@ -1250,7 +2322,6 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
-		int i;
 		jack_port_t *port = (jack_port_t*)node->data;
 
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
@@ -1277,13 +2348,11 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
 
-				for (i = 0; i < net_period_up; i++)
-					packet_bufX[i] = floatbuf[i] * 127.0;
+				netjack_float_to_s8 (packet_bufX, floatbuf, net_period_up);
 				src_node = jack_slist_next (src_node);
 			} else
 #endif
-			for (i = 0; i < net_period_up; i++)
-				packet_bufX[i] = buf[i] * 127.0;
+			netjack_float_to_s8 (packet_bufX, buf, net_period_up);
 		} else if (jack_port_is_midi (porttype)) {
 			// encode midi events from port to packet
 			// convert the data buffer to a standard format (uint32_t based)
@@ -1297,14 +2366,201 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 	}
 }
 
+// codec worker pool.
+
+static void
+netjack_codec_pool_work (netjack_codec_pool_t *pool)
+{
+	int i;
+
+	while ((i = __atomic_fetch_add (&pool->next_job, 1, __ATOMIC_RELAXED)) < pool->njobs) {
+		pool->jobs[i].fn (&pool->jobs[i]);
+	}
+}
+
+static void *
+netjack_codec_pool_thread (void *arg)
+{
+	netjack_codec_pool_t *pool = (netjack_codec_pool_t*)arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock (&pool->lock);
+
+	while (1) {
+		while (pool->running && pool->generation == generation) {
+			pthread_cond_wait (&pool->start_cond, &pool->lock);
+		}
+		if (!pool->running) {
+			break;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock (&pool->lock);
+
+		netjack_codec_pool_work (pool);
+
+		pthread_mutex_lock (&pool->lock);
+		if (--pool->pending == 0) {
+			pthread_cond_signal (&pool->done_cond);
+		}
+	}
+
+	pthread_mutex_unlock (&pool->lock);
+
+	return NULL;
+}
+
+netjack_codec_pool_t *
+netjack_codec_pool_new (jack_client_t *client, int nthreads, int max_jobs)
+{
+	netjack_codec_pool_t *pool;
+
+	if (nthreads <= 0 || max_jobs <= 0) {
+		return NULL;
+	}
+
+	if ((pool = (netjack_codec_pool_t*)calloc (1, sizeof(netjack_codec_pool_t))) == NULL) {
+		return NULL;
+	}
+
+	pool->threads = (pthread_t*)calloc (nthreads, sizeof(pthread_t));
+	pool->jobs = (netjack_codec_job_t*)calloc (max_jobs, sizeof(netjack_codec_job_t));
+	if (pool->threads == NULL || pool->jobs == NULL) {
+		free (pool->threads);
+		free (pool->jobs);
+		free (pool);
+		return NULL;
+	}
+
+	pool->max_jobs = max_jobs;
+	pool->running = 1;
+	pthread_mutex_init (&pool->lock, NULL);
+	pthread_cond_init (&pool->start_cond, NULL);
+	pthread_cond_init (&pool->done_cond, NULL);
+
+	for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++) {
+		if (jack_client_create_thread (client, &pool->threads[pool->nthreads],
+					       jack_client_real_time_priority (client),
+					       jack_is_realtime (client),
+					       netjack_codec_pool_thread, pool)) {
+			jack_error ("NET: cannot create codec thread %d", pool->nthreads);
+			break;
+		}
+	}
+
+	if (pool->nthreads == 0) {
+		netjack_codec_pool_free (pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void
+netjack_codec_pool_free (netjack_codec_pool_t *pool)
+{
+	int i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&pool->lock);
+	pool->running = 0;
+	pthread_cond_broadcast (&pool->start_cond);
+	pthread_mutex_unlock (&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++) {
+		pthread_join (pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy (&pool->done_cond);
+	pthread_cond_destroy (&pool->start_cond);
+	pthread_mutex_destroy (&pool->lock);
+	free (pool->threads);
+	free (pool->jobs);
+	free (pool);
+}
+
+void
+netjack_codec_pool_add (netjack_codec_pool_t *pool, netjack_codec_job_t *job)
+{
+	if (pool == NULL || pool->njobs == pool->max_jobs) {
+		job->fn (job);
+		return;
+	}
+
+	pool->jobs[pool->njobs++] = *job;
+}
+
+void
+netjack_codec_pool_run (netjack_codec_pool_t *pool)
+{
+	if (pool == NULL || pool->njobs == 0) {
+		return;
+	}
+
+	// a single job is not worth waking anybody for.
+	if (pool->njobs > 1) {
+		pthread_mutex_lock (&pool->lock);
+		pool->next_job = 0;
+		pool->pending = pool->nthreads;
+		pool->generation++;
+		pthread_cond_broadcast (&pool->start_cond);
+		pthread_mutex_unlock (&pool->lock);
+
+		netjack_codec_pool_work (pool);
+
+		pthread_mutex_lock (&pool->lock);
+		while (pool->pending) {
+			pthread_cond_wait (&pool->done_cond, &pool->lock);
+		}
+		pthread_mutex_unlock (&pool->lock);
+	} else {
+		pool->jobs[0].fn (&pool->jobs[0]);
+	}
+
+	pool->njobs = 0;
+}
+
 #if HAVE_CELT
 // render functions for celt.
+static void
+celt_decode_job (netjack_codec_job_t *job)
+{
+	CELTDecoder *decoder = job->codec;
+
+#if HAVE_CELT_API_0_8
+	celt_decode_float ( decoder, job->data, job->nbytes, job->buf, job->nframes );
+#else
+	celt_decode_float ( decoder, job->data, job->nbytes, job->buf );
+#endif
+}
+
+static void
+celt_encode_job (netjack_codec_job_t *job)
+{
+	CELTEncoder *encoder = job->codec;
+	int encoded_bytes;
+	float *floatbuf = alloca (sizeof(float) * job->nframes );
+
+	memcpy ( floatbuf, job->buf, job->nframes * sizeof(float) );
+#if HAVE_CELT_API_0_8
+	encoded_bytes = celt_encode_float ( encoder, floatbuf, job->nframes, job->data, job->nbytes );
+#else
+	encoded_bytes = celt_encode_float ( encoder, floatbuf, NULL, job->data, job->nbytes );
+#endif
+	if ( encoded_bytes != job->nbytes ) {
+		printf ( "something in celt changed. netjack needs to be changed to handle this.\n" );
+	}
+}
+
 void
-render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+render_payload_to_jack_ports_celt (netjack_codec_pool_t *pool, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
 {
 	int chn = 0;
 	JSList *node = capture_ports;
 	JSList *src_node = capture_srcs;
+	netjack_codec_job_t job;
 
 	unsigned char *packet_bufX = (unsigned char*)packet_payload;
 
@@ -1316,21 +2572,13 @@ render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_peri
 
 		if (jack_port_is_audio (porttype)) {
 			// audio port, decode celt data.
-
-			CELTDecoder *decoder = src_node->data;
-#if HAVE_CELT_API_0_8
-			if ( !packet_payload ) {
-				celt_decode_float ( decoder, NULL, net_period_down, buf, nframes );
-			} else {
-				celt_decode_float ( decoder, packet_bufX, net_period_down, buf, nframes );
-			}
-#else
-			if ( !packet_payload ) {
-				celt_decode_float ( decoder, NULL, net_period_down, buf );
-			} else {
-				celt_decode_float ( decoder, packet_bufX, net_period_down, buf );
-			}
-#endif
+			job.fn = celt_decode_job;
+			job.codec = src_node->data;
+			job.buf = buf;
+			job.data = packet_payload ? packet_bufX : NULL;
+			job.nframes = nframes;
+			job.nbytes = net_period_down;
+			netjack_codec_pool_add (pool, &job);
 
 			src_node = jack_slist_next (src_node);
 		} else if (jack_port_is_midi (porttype)) {
@@ -1346,14 +2594,17 @@ render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_peri
 		node = jack_slist_next (node);
 		chn++;
 	}
+
+	netjack_codec_pool_run (pool);
 }
 
 void
-render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+render_jack_ports_to_payload_celt (netjack_codec_pool_t *pool, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
 {
 	int chn = 0;
 	JSList *node = playback_ports;
 	JSList *src_node = playback_srcs;
+	netjack_codec_job_t job;
 
 	unsigned char *packet_bufX = (unsigned char*)packet_payload;
 
@@ -1364,19 +2615,146 @@ render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs
 
 		if (jack_port_is_audio (porttype)) {
 			// audio port, encode celt data.
+			job.fn = celt_encode_job;
+			job.codec = src_node->data;
+			job.buf = buf;
+			job.data = packet_bufX;
+			job.nframes = nframes;
+			job.nbytes = net_period_up;
+			netjack_codec_pool_add (pool, &job);
+
+			src_node = jack_slist_next ( src_node );
+		} else if (jack_port_is_midi (porttype)) {
+			// encode midi events from port to packet
+			// convert the data buffer to a standard format (uint32_t based)
+			unsigned int buffer_size_uint32 = net_period_up / 2;
+			uint32_t * buffer_uint32 = (uint32_t*)packet_bufX;
+			encode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
+		}
+		packet_bufX = (packet_bufX + net_period_up);
+		node = jack_slist_next (node);
+		chn++;
+	}
+
+	netjack_codec_pool_run (pool);
+}
 
-			int encoded_bytes;
-			float *floatbuf = alloca (sizeof(float) * nframes );
-			memcpy ( floatbuf, buf, nframes * sizeof(float) );
-			CELTEncoder *encoder = src_node->data;
-#if HAVE_CELT_API_0_8
-			encoded_bytes = celt_encode_float ( encoder, floatbuf, nframes, packet_bufX, net_period_up );
-#else
-			encoded_bytes = celt_encode_float ( encoder, floatbuf, NULL, packet_bufX, net_period_up );
 #endif
-			if ( encoded_bytes != net_period_up ) {
-				printf ( "something in celt changed. netjack needs to be changed to handle this.\n" );
+
+#if HAVE_OPUS
+// render functions for opus.
+//
+// Each channel's slot holds the frame length as a 16 bit big endian
+// value followed by the frame. A length of 0 is decoded as a lost
+// frame.
+#define OPUS_LEN_SIZE (sizeof(uint16_t))
+
+static void
+opus_decode_job (netjack_codec_job_t *job)
+{
+	OpusCustomDecoder *decoder = job->codec;
+	int err = -1;
+
+	if (decoder) {
+		if ( !job->data ) {
+			err = opus_custom_decode_float ( decoder, NULL, 0, job->buf, job->nframes );
+		} else {
+			uint16_t len = ntohs (*((uint16_t*)job->data));
+			if (len > job->nbytes - OPUS_LEN_SIZE) {
+				len = 0;
+			}
+			err = opus_custom_decode_float ( decoder, len ? job->data + OPUS_LEN_SIZE : NULL,
+							 len, job->buf, job->nframes );
+		}
+	}
+	if (err < 0) {
+		memset (job->buf, 0, job->nframes * sizeof(jack_default_audio_sample_t));
+	}
+}
+
+static void
+opus_encode_job (netjack_codec_job_t *job)
+{
+	OpusCustomEncoder *encoder = job->codec;
+	int encoded_bytes = 0;
+
+	if (encoder) {
+		encoded_bytes = opus_custom_encode_float ( encoder, job->buf, job->nframes,
+							   job->data + OPUS_LEN_SIZE,
+							   job->nbytes - OPUS_LEN_SIZE );
+		if (encoded_bytes < 0) {
+			encoded_bytes = 0;
+		}
+	}
+	*((uint16_t*)job->data) = htons (encoded_bytes);
+}
+
+void
+render_payload_to_jack_ports_opus (netjack_codec_pool_t *pool, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+{
+	JSList *node = capture_ports;
+	JSList *src_node = capture_srcs;
+	netjack_codec_job_t job;
+
+	unsigned char *packet_bufX = (unsigned char*)packet_payload;
+
+	while (node != NULL) {
+		jack_port_t *port = (jack_port_t*)node->data;
+		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
+
+		const char *porttype = jack_port_type (port);
+
+		if (jack_port_is_audio (porttype)) {
+			// audio port, decode opus data.
+			job.fn = opus_decode_job;
+			job.codec = src_node->data;
+			job.buf = buf;
+			job.data = packet_payload ? packet_bufX : NULL;
+			job.nframes = nframes;
+			job.nbytes = net_period_down;
+			netjack_codec_pool_add (pool, &job);
+
+			src_node = jack_slist_next (src_node);
+		} else if (jack_port_is_midi (porttype)) {
+			// midi port, decode midi events
+			// convert the data buffer to a standard format (uint32_t based)
+			unsigned int buffer_size_uint32 = net_period_down / 2;
+			uint32_t * buffer_uint32 = (uint32_t*)packet_bufX;
+			if ( packet_payload ) {
+				decode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 			}
+		}
+		packet_bufX = (packet_bufX + net_period_down);
+		node = jack_slist_next (node);
+	}
+
+	netjack_codec_pool_run (pool);
+}
+
+void
+render_jack_ports_to_payload_opus (netjack_codec_pool_t *pool, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+{
+	JSList *node = playback_ports;
+	JSList *src_node = playback_srcs;
+	netjack_codec_job_t job;
+
+	unsigned char *packet_bufX = (unsigned char*)packet_payload;
+
+	while (node != NULL) {
+		jack_port_t *port = (jack_port_t*)node->data;
+		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
+		const char *porttype = jack_port_type (port);
+
+		if (jack_port_is_audio (porttype)) {
+			// audio port, encode opus data.
+			job.fn = opus_encode_job;
+			job.codec = src_node->data;
+			job.buf = buf;
+			job.data = packet_bufX;
+			job.nframes = nframes;
+			job.nbytes = net_period_up;
+			netjack_codec_pool_add (pool, &job);
+
 			src_node = jack_slist_next ( src_node );
 		} else if (jack_port_is_midi (porttype)) {
 			// encode midi events from port to packet
@@ -1387,14 +2765,15 @@ render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs
 		}
 		packet_bufX = (packet_bufX + net_period_up);
 		node = jack_slist_next (node);
-		chn++;
 	}
+
+	netjack_codec_pool_run (pool);
 }
 
 #endif
 /* Wrapper functions with bitdepth argument... */
 void
-render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
+render_payload_to_jack_ports_pool (netjack_codec_pool_t *pool, int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
 {
 	if (bitdepth == 8) {
 		render_payload_to_jack_ports_8bit (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
@@ -1403,7 +2782,12 @@ render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t
 	}
 #if HAVE_CELT
 	else if (bitdepth == CELT_MODE) {
-		render_payload_to_jack_ports_celt (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+		render_payload_to_jack_ports_celt (pool, packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+	}
+#endif
+#if HAVE_OPUS
+	else if (bitdepth == OPUS_MODE) {
+		render_payload_to_jack_ports_opus (pool, packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
 	}
 #endif
 	else {
@@ -1412,7 +2796,7 @@ render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t
 }
 
 void
-render_jack_ports_to_payload (int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats)
+render_jack_ports_to_payload_pool (netjack_codec_pool_t *pool, int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats)
 {
 	if (bitdepth == 8) {
 		render_jack_ports_to_payload_8bit (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
@@ -1421,10 +2805,27 @@ render_jack_ports_to_payload (int bitdepth, JSList *playback_ports, JSList *play
 	}
 #if HAVE_CELT
 	else if (bitdepth == CELT_MODE) {
-		render_jack_ports_to_payload_celt (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+		render_jack_ports_to_payload_celt (pool, playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+	}
+#endif
+#if HAVE_OPUS
+	else if (bitdepth == OPUS_MODE) {
+		render_jack_ports_to_payload_opus (pool, playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
 	}
 #endif
 	else {
 		render_jack_ports_to_payload_float (playback_ports, playback_srcs, nframes, packet_payload, net_period_up, dont_htonl_floats);
 	}
 }
+
+void
+render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
+{
+	render_payload_to_jack_ports_pool (NULL, bitdepth, packet_payload, net_period_down, capture_ports, capture_srcs, nframes, dont_htonl_floats);
+}
+
+void
+render_jack_ports_to_payload (int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats)
+{
+	render_jack_ports_to_payload_pool (NULL, bitdepth, playback_ports, playback_srcs, nframes, packet_payload, net_period_up, dont_htonl_floats);
+}
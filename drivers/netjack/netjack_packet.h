@@ -38,12 +38,34 @@ extern "C"
 
 #include <jack/midiport.h>
 
+#include <pthread.h>
+
 //#include <netinet/in.h>
 // The Packet Header.
 
 #define CELT_MODE 1000   // Magic bitdepth value that indicates CELT compression
+#define OPUS_MODE 999    // Magic bitdepth value that indicates OPUS compression
 #define MASTER_FREEWHEELS 0x80000000
 
+// Parity fragments. Their fragment_nr has NETJACK_FEC_FRAGMENT set,
+// the group size k in the next 15 bits and the first fragment of the
+// group in the low 16 bits. The payload is the XOR of the payloads of
+// those k fragments, shorter ones padded with zeros. A receiver can
+// rebuild any single fragment missing from a group.
+#define NETJACK_FEC_FRAGMENT 0x80000000
+#define NETJACK_FEC_MAX_GROUP 0x7fff
+#define NETJACK_FEC_MAX_FRAGMENTS 0x10000
+
+// Float byte order, flags in the mtu field above any real mtu. Only
+// little endian hosts set them, big endian ones have their floats in
+// network order anyway.
+// NETJACK_ACCEPTS_LE: the sender is little endian and takes little
+// endian floats, so its peer may send them without swapping.
+// NETJACK_LE_FLOATS: the floats of this packet are little endian.
+#define NETJACK_LE_FLOATS 0x80000000
+#define NETJACK_ACCEPTS_LE 0x40000000
+#define NETJACK_MTU_FLAGS (NETJACK_LE_FLOATS | NETJACK_ACCEPTS_LE)
+
 typedef struct _jacknet_packet_header jacknet_packet_header;
 
 struct _jacknet_packet_header {
@@ -77,29 +99,66 @@ union _int_float {
 };
 
 // fragment reorder cache.
+//
+// A ring of a power of two packets, where framecnt lives in slot
+// framecnt & mask. The slots, their fragment bitmaps and their packet
+// buffers are one allocation, starting at packets.
 typedef struct _cache_packet cache_packet;
 
 struct _cache_packet {
 	int valid;
 	int num_fragments;
+	int num_fragments_received;
 	int packet_size;
 	int mtu;
 	jack_time_t recv_timestamp;
 	jack_nframes_t framecnt;
-	char *          fragment_array;
+	uint32_t *      fragment_bits;
 	char *          packet_buf;
+
+	// parity received for this packet, by the first fragment of
+	// each group. NULL until the cache has seen parity.
+	int fec_group;
+	uint32_t *      fec_bits;
+	char *          fec_buf;
 };
 
 typedef struct _packet_cache packet_cache;
 
 struct _packet_cache {
 	int size;
+	int mask;
 	cache_packet *packets;
 	int mtu;
-	struct sockaddr_in master_address;
+	struct sockaddr_storage master_address;
 	int master_address_valid;
 	jack_nframes_t last_framecnt_retreived;
 	int last_framecnt_retreived_valid;
+
+	// newest complete packet seen, and the framecnt below which
+	// packet_cache_clear_old_packets() has emptied the ring.
+	jack_nframes_t highest_framecnt;
+	int highest_framecnt_valid;
+	jack_nframes_t cleared_framecnt;
+	int cleared_framecnt_valid;
+
+	// arrival statistics, kept once period_usecs is set: the
+	// interarrival jitter estimate of RFC 3550, in usecs.
+	jack_time_t period_usecs;
+	jack_nframes_t last_arrival_framecnt;
+	jack_time_t last_arrival;
+	int last_arrival_valid;
+	float arrival_jitter;
+
+	// backing store for the slots' fec_bits and fec_buf.
+	char *fec_storage;
+
+	// receive batch for recvmmsg(), one mtu sized slot per fragment
+	int rx_batch;
+	char *rx_buf;
+	struct mmsghdr *rx_msgs;
+	struct iovec *rx_iov;
+	struct sockaddr_storage *rx_addrs;
 };
 
 // fragment cache function prototypes
@@ -114,22 +173,100 @@ cache_packet *packet_cache_get_free_packet(packet_cache *pkt_cache);
 void    cache_packet_reset(cache_packet *pack);
 void    cache_packet_set_framecnt(cache_packet *pack, jack_nframes_t framecnt);
 void    cache_packet_add_fragment(cache_packet *pack, char *packet_buf, int rcv_len);
+void    cache_packet_add_parity(cache_packet *pack, char *packet_buf, int rcv_len);
+int     packet_cache_enable_fec(packet_cache *pcache);
 int     cache_packet_is_complete(cache_packet *pack);
 
 void packet_cache_drain_socket ( packet_cache * pcache, int sockfd, jack_time_t (*get_microseconds)(void) );
 void packet_cache_reset_master_address( packet_cache *pcache );
 float packet_cache_get_fill( packet_cache *pcache, jack_nframes_t expected_framecnt );
+float packet_cache_get_jitter( packet_cache *pcache );
 int packet_cache_retreive_packet_pointer( packet_cache *pcache, jack_nframes_t framecnt, char **packet_buf, int pkt_size, jack_time_t *timestamp );
 int packet_cache_release_packet( packet_cache *pcache, jack_nframes_t framecnt );
 int packet_cache_get_next_available_framecnt( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt );
 int packet_cache_get_highest_available_framecnt( packet_cache *pcache, jack_nframes_t *framecnt );
 int packet_cache_find_latency( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt );
+
+// codec worker pool.
+//
+// The celt and opus render functions queue one job per audio channel
+// instead of running the codec inline. netjack_codec_pool_run() hands
+// the queued jobs to the worker threads, works on them from the calling
+// thread as well, and returns once all of them are done. Without a pool
+// every job runs at once in the calling thread.
+typedef struct _netjack_codec_job netjack_codec_job_t;
+
+struct _netjack_codec_job {
+	void (*fn)(netjack_codec_job_t *job);
+	void *codec;
+	jack_default_audio_sample_t *buf;
+	unsigned char *data;            // NULL if the packet was lost
+	jack_nframes_t nframes;
+	jack_nframes_t nbytes;
+};
+
+typedef struct _netjack_codec_pool netjack_codec_pool_t;
+
+struct _netjack_codec_pool {
+	int nthreads;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	unsigned int generation;
+	int running;
+	int pending;                    // workers still busy with this run
+
+	int max_jobs;
+	int njobs;
+	int next_job;
+	netjack_codec_job_t *jobs;
+};
+
+netjack_codec_pool_t *netjack_codec_pool_new (jack_client_t *client, int nthreads, int max_jobs);
+void netjack_codec_pool_free (netjack_codec_pool_t *pool);
+void netjack_codec_pool_add (netjack_codec_pool_t *pool, netjack_codec_job_t *job);
+void netjack_codec_pool_run (netjack_codec_pool_t *pool);
+
 // Function Prototypes
 
 int netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_microseconds)(void));
 
+// same, but sleeps only until spin_usecs before the deadline, and
+// spins from there on. spin_usecs 0 is netjack_poll_deadline().
+int netjack_poll_deadline_spin (int sockfd, jack_time_t deadline, jack_time_t spin_usecs, jack_time_t (*get_microseconds)(void));
+
+// low latency socket options, each one left alone when 0:
+// SO_BUSY_POLL for busy_poll usecs, SO_PRIORITY, DSCP in the IP header
+// and SO_TXTIME, which lets netjack_sendto_at() schedule transmission.
+int netjack_socket_lowlatency (int sockfd, unsigned int busy_poll, unsigned int priority, unsigned int dscp, int txtime);
+
+// CLOCK_MONOTONIC nanoseconds, the clock SO_TXTIME times are in.
+uint64_t netjack_txtime_now (void);
+
+// masters and slaves may be IPv4 or IPv6.
+int  netjack_sockaddr_len (const struct sockaddr_storage *addr);
+void netjack_sockaddr_set_port (struct sockaddr_storage *addr, int port);
+int  netjack_multicast_join (int sockfd, const struct sockaddr *group);
+
 void netjack_sendto(int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu);
 
+// same, followed by a parity fragment for every fec_group fragments.
+// fec_group 0 sends no parity.
+void netjack_sendto_fec(int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group);
+
+// same, asking the kernel to put the fragments on the wire at txtime,
+// see netjack_txtime_now(). txtime 0 sends them right away.
+void netjack_sendto_at(int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group, uint64_t txtime);
+
+
+// whether the floats of a packet with these (host order) mtu field
+// flags can be copied as they are.
+int netjack_floats_native (jack_nframes_t mtu_flags);
+
+// mtu field flags for a packet to a peer that sent peer_flags. Sets
+// *native when its floats may go out in host byte order.
+jack_nframes_t netjack_floats_flags (jack_nframes_t peer_flags, int *native);
 
 int get_sample_size(int bitdepth);
 void packet_header_hton(jacknet_packet_header *pkthdr);
@@ -140,6 +277,11 @@ void render_payload_to_jack_ports(int bitdepth, void *packet_payload, jack_nfram
 
 void render_jack_ports_to_payload(int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats );
 
+// same as above, running the codecs on pool when it is not NULL.
+void render_payload_to_jack_ports_pool(netjack_codec_pool_t *pool, int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats );
+
+void render_jack_ports_to_payload_pool(netjack_codec_pool_t *pool, int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats );
+
 
 // XXX: This is sort of deprecated:
 //      This one waits forever. an is not using ppoll
@@ -51,10 +51,12 @@
 #include <stdarg.h>
 #include <getopt.h>
 #include <semaphore.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/soundcard.h>
 
 #include <jack/types.h>
@@ -77,7 +79,7 @@
 #endif  /* _SIOWR */
 #endif  /* SNDCTL_DSP_COOKEDMODE */
 
-#define OSS_DRIVER_N_PARAMS     11
+#define OSS_DRIVER_N_PARAMS     12
 const static jack_driver_param_desc_t oss_params[OSS_DRIVER_N_PARAMS] = {
 	{ "rate",
 	    'r',
@@ -155,7 +157,14 @@ const static jack_driver_param_desc_t oss_params[OSS_DRIVER_N_PARAMS] = {
 	    { .ui = 0 },
 	    NULL,
 	    "system output latency",
-	    "system output latency" }
+	    "system output latency" },
+	{ "mmap",
+	    'm',
+	    JackDriverParamBool,
+	    { },
+	    NULL,
+	    "convert directly from/to the mmap()ed DMA buffer",
+	    "convert directly from/to the mmap()ed DMA buffer, without I/O thread copies" }
 };
 
 
@@ -204,101 +213,21 @@ static inline void driver_cycle (oss_driver_t *driver)
 }
 
 
-static void copy_and_convert_in (jack_sample_t *dst, void *src,
-				 size_t nframes, int channel, int chcount, int bits)
+static void copy_and_convert_in (oss_driver_t *driver, jack_sample_t *dst,
+				 void *src, size_t nframes, int channel,
+				 int chcount)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16src = (signed short*)src;
-	signed int *s32src = (signed int*)src;
-	double *f64src = (double*)src;
-	jack_sample_t scale;
-
-	srcidx = channel;
-	switch (bits) {
-	case 16:
-		scale = 1.0f / 0x7fff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s16src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
-	case 24:
-		scale = 1.0f / 0x7fffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
-	case 32:
-		scale = 1.0f / 0x7fffffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
-	case 64:
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)f64src[srcidx];
-			srcidx += chcount;
-		}
-		break;
-	}
+	driver->convert_in (dst, (char*)src + channel * driver->sample_bytes,
+			    nframes, chcount * driver->sample_bytes);
 }
 
 
-static void copy_and_convert_out (void *dst, jack_sample_t *src,
-				  size_t nframes, int channel, int chcount, int bits)
+static void copy_and_convert_out (oss_driver_t *driver, void *dst,
+				  jack_sample_t *src, size_t nframes,
+				  int channel, int chcount)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16dst = (signed short*)dst;
-	signed int *s32dst = (signed int*)dst;
-	double *f64dst = (double*)dst;
-	jack_sample_t scale;
-
-	dstidx = channel;
-	switch (bits) {
-	case 16:
-		scale = 0x7fff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s16dst[dstidx] = (signed short)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
-		break;
-	case 24:
-		scale = 0x7fffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
-		break;
-	case 32:
-		scale = 0x7fffffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
-		break;
-	case 64:
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			f64dst[dstidx] = (double)src[srcidx];
-			dstidx += chcount;
-		}
-		break;
-	}
+	driver->convert_out ((char*)dst + channel * driver->sample_bytes, src,
+			     nframes, chcount * driver->sample_bytes, NULL);
 }
 
 
@@ -329,7 +258,175 @@ static int get_fragment (int fd)
 }
 
 
+/* mmap mode */
+
+
+static void *mmap_buffer (int fd, int prot, unsigned long request,
+			  size_t framesize, size_t *size)
+{
+	audio_buf_info info;
+	void *buf;
+
+	if (ioctl (fd, request, &info) < 0) {
+		return NULL;
+	}
+	*size = (size_t)info.fragstotal * info.fragsize;
+	/* periods are converted in at most two pieces, which must
+	   not split a frame */
+	if (*size == 0 || *size % framesize != 0) {
+		return NULL;
+	}
+	buf = mmap (NULL, *size, prot, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED) {
+		return NULL;
+	}
+	return buf;
+}
+
+
+static int mmap_capable (int fd)
+{
+	int caps;
+
+	if (ioctl (fd, SNDCTL_DSP_GETCAPS, &caps) < 0) {
+		return 0;
+	}
+	return (caps & DSP_CAP_MMAP) && (caps & DSP_CAP_TRIGGER);
+}
+
+
+static void mmap_stop (oss_driver_t *driver)
+{
+	if (driver->indma != NULL) {
+		munmap (driver->indma, driver->indmasize);
+		driver->indma = NULL;
+	}
+	if (driver->outdma != NULL) {
+		munmap (driver->outdma, driver->outdmasize);
+		driver->outdma = NULL;
+	}
+	driver->indmasize = 0;
+	driver->outdmasize = 0;
+}
+
+
+static int mmap_start (oss_driver_t *driver)
+{
+	int trigger = 0;
+
+	if ((driver->infd >= 0 && !mmap_capable (driver->infd)) ||
+	    (driver->outfd >= 0 && !mmap_capable (driver->outfd))) {
+		return -1;
+	}
+
+	/* the devices must be stopped while mapping, mmap_thread
+	   starts them */
+	if (driver->infd >= 0) {
+		ioctl (driver->infd, SNDCTL_DSP_SETTRIGGER, &trigger);
+		driver->indma = mmap_buffer (driver->infd, PROT_READ,
+					     SNDCTL_DSP_GETISPACE,
+					     driver->indevbufsize /
+					     driver->period_size,
+					     &driver->indmasize);
+		if (driver->indma == NULL) {
+			goto failed;
+		}
+	}
+	if (driver->outfd >= 0) {
+		if (driver->outfd != driver->infd) {
+			ioctl (driver->outfd, SNDCTL_DSP_SETTRIGGER, &trigger);
+		}
+		driver->outdma = mmap_buffer (driver->outfd, PROT_WRITE,
+					      SNDCTL_DSP_GETOSPACE,
+					      driver->outdevbufsize /
+					      driver->period_size,
+					      &driver->outdmasize);
+		if (driver->outdma == NULL) {
+			goto failed;
+		}
+		memset (driver->outdma, 0x00, driver->outdmasize);
+	}
+
+	jack_info ("oss_driver: mmap mode, indma %zd B, outdma %zd B",
+		   driver->indmasize, driver->outdmasize);
+
+	return 0;
+
+failed:
+	mmap_stop (driver);
+	/* in the shared duplex case io_thread sets the trigger */
+	if (!driver->trigger) {
+		if (driver->infd >= 0) {
+			trigger = PCM_ENABLE_INPUT;
+			ioctl (driver->infd, SNDCTL_DSP_SETTRIGGER, &trigger);
+		}
+		if (driver->outfd >= 0) {
+			trigger = PCM_ENABLE_OUTPUT;
+			ioctl (driver->outfd, SNDCTL_DSP_SETTRIGGER, &trigger);
+		}
+	}
+	return -1;
+}
+
+
+/* convert the period at byte position pos of the capture ring */
+static void mmap_convert_in (oss_driver_t *driver, jack_sample_t *dst,
+			     int channel, uint32_t pos, jack_nframes_t nframes)
+{
+	size_t framesize = driver->indevbufsize / driver->period_size;
+	size_t offset = pos % driver->indmasize;
+	jack_nframes_t n = (driver->indmasize - offset) / framesize;
+
+	if (n > nframes) {
+		n = nframes;
+	}
+	copy_and_convert_in (driver, dst, (char*)driver->indma + offset, n,
+			     channel, driver->capture_channels);
+	if (n < nframes) {
+		copy_and_convert_in (driver, dst + n, driver->indma,
+				     nframes - n, channel,
+				     driver->capture_channels);
+	}
+}
+
+
+static void mmap_convert_out (oss_driver_t *driver, jack_sample_t *src,
+			      int channel, uint32_t pos, jack_nframes_t nframes)
+{
+	size_t framesize = driver->outdevbufsize / driver->period_size;
+	size_t offset = pos % driver->outdmasize;
+	jack_nframes_t n = (driver->outdmasize - offset) / framesize;
+
+	if (n > nframes) {
+		n = nframes;
+	}
+	copy_and_convert_out (driver, (char*)driver->outdma + offset, src, n,
+			      channel, driver->playback_channels);
+	if (n < nframes) {
+		copy_and_convert_out (driver, driver->outdma, src + n,
+				      nframes - n, channel,
+				      driver->playback_channels);
+	}
+}
+
+
+static void mmap_silence_out (oss_driver_t *driver, uint32_t pos)
+{
+	size_t offset = pos % driver->outdmasize;
+	size_t n = driver->outdmasize - offset;
+
+	if (n > driver->outdevbufsize) {
+		n = driver->outdevbufsize;
+	}
+	memset ((char*)driver->outdma + offset, 0x00, n);
+	if (n < driver->outdevbufsize) {
+		memset (driver->outdma, 0x00, driver->outdevbufsize - n);
+	}
+}
+
+
 static void *io_thread(void *);
+static void *mmap_thread(void *);
 
 
 /* jack driver interface */
@@ -673,7 +770,24 @@ static int oss_driver_start (oss_driver_t *driver)
 	sem_init (&driver->sem_start, 0, 0);
 	driver->run = 1;
 	driver->threads = 0;
-	if (infd >= 0) {
+	if (driver->use_mmap) {
+		if (mmap_start (driver) == 0) {
+			if (jack_client_create_thread (NULL, &driver->thread_in,
+						       driver->engine->rtpriority,
+						       driver->engine->control->real_time,
+						       mmap_thread, driver) < 0) {
+				jack_error ("OSS: jack_client_create_thread() failed: %s@%i",
+					    __FILE__, __LINE__);
+				mmap_stop (driver);
+				return -1;
+			}
+			driver->threads |= 1;
+		} else {
+			jack_info ("oss_driver: mmap mode not available, "
+				   "using read()/write()");
+		}
+	}
+	if (infd >= 0 && driver->threads == 0) {
 		if (jack_client_create_thread (NULL, &driver->thread_in,
 					       driver->engine->rtpriority,
 					       driver->engine->control->real_time,
@@ -685,7 +799,7 @@ static int oss_driver_start (oss_driver_t *driver)
 		driver->threads |= 1;
 	}
 #       ifdef USE_BARRIER
-	if (outfd >= 0) {
+	if (outfd >= 0 && driver->indma == NULL && driver->outdma == NULL) {
 		if (jack_client_create_thread (NULL, &driver->thread_out,
 					       driver->engine->rtpriority,
 					       driver->engine->control->real_time,
@@ -739,6 +853,8 @@ static int oss_driver_stop (oss_driver_t *driver)
 	pthread_mutex_destroy (&driver->mutex_in);
 	pthread_mutex_destroy (&driver->mutex_out);
 
+	mmap_stop (driver);
+
 	if (driver->outfd >= 0 && driver->outfd != driver->infd) {
 		close (driver->outfd);
 		driver->outfd = -1;
@@ -778,6 +894,25 @@ static int oss_driver_read (oss_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
+	if (driver->indma != NULL) {
+		/* mmap_thread does not touch the ring while we run */
+		node = driver->capture_ports;
+		channel = 0;
+		while (node != NULL) {
+			port = (jack_port_t*)node->data;
+
+			if (jack_port_connected (port)) {
+				portbuf = jack_port_get_buffer (port, nframes);
+				mmap_convert_in (driver, portbuf, channel,
+						 driver->in_pos, nframes);
+			}
+
+			node = jack_slist_next (node);
+			channel++;
+		}
+		return 0;
+	}
+
 	pthread_mutex_lock (&driver->mutex_in);
 
 	node = driver->capture_ports;
@@ -787,10 +922,9 @@ static int oss_driver_read (oss_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_in (portbuf, driver->indevbuf,
+			copy_and_convert_in (driver, portbuf, driver->indevbuf,
 					     nframes, channel,
-					     driver->capture_channels,
-					     driver->bits);
+					     driver->capture_channels);
 		}
 
 		node = jack_slist_next (node);
@@ -820,6 +954,27 @@ static int oss_driver_write (oss_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
+	if (driver->outdma != NULL) {
+		/* the ring holds what was played a buffer ago, so
+		   channels without connections need silence */
+		mmap_silence_out (driver, driver->out_pos);
+		node = driver->playback_ports;
+		channel = 0;
+		while (node != NULL) {
+			port = (jack_port_t*)node->data;
+
+			if (jack_port_connected (port)) {
+				portbuf = jack_port_get_buffer (port, nframes);
+				mmap_convert_out (driver, portbuf, channel,
+						  driver->out_pos, nframes);
+			}
+
+			node = jack_slist_next (node);
+			channel++;
+		}
+		return 0;
+	}
+
 	pthread_mutex_lock (&driver->mutex_out);
 
 	node = driver->playback_ports;
@@ -829,10 +984,9 @@ static int oss_driver_write (oss_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_out (driver->outdevbuf, portbuf,
+			copy_and_convert_out (driver, driver->outdevbuf, portbuf,
 					      nframes, channel,
-					      driver->playback_channels,
-					      driver->bits);
+					      driver->playback_channels);
 		}
 
 		node = jack_slist_next (node);
@@ -847,6 +1001,13 @@ static int oss_driver_write (oss_driver_t *driver, jack_nframes_t nframes)
 
 static int oss_driver_null_cycle (oss_driver_t *driver, jack_nframes_t nframes)
 {
+	if (driver->indma != NULL || driver->outdma != NULL) {
+		if (driver->outdma != NULL) {
+			mmap_silence_out (driver, driver->out_pos);
+		}
+		return 0;
+	}
+
 	pthread_mutex_lock (&driver->mutex_in);
 	memset (driver->indevbuf, 0x00, driver->indevbufsize);
 	pthread_mutex_unlock (&driver->mutex_in);
@@ -894,6 +1055,125 @@ static inline void synchronize (oss_driver_t *driver)
 #endif
 
 
+static inline void mmap_sleep (oss_driver_t *driver, size_t frames)
+{
+	struct timespec ts;
+	long usecs;
+
+	usecs = (long)((double)frames * 1e6 / (double)driver->sample_rate);
+	if (usecs < 100) {
+		usecs = 100;
+	}
+	ts.tv_sec = usecs / 1000000;
+	ts.tv_nsec = (usecs % 1000000) * 1000;
+	nanosleep (&ts, NULL);
+}
+
+
+/* resynchronize both rings on the current hardware positions after the
+   hardware lapped us */
+static void mmap_restart (oss_driver_t *driver)
+{
+	count_info ci;
+
+	if (driver->indma != NULL &&
+	    ioctl (driver->infd, SNDCTL_DSP_GETIPTR, &ci) == 0) {
+		driver->in_pos = (uint32_t)ci.bytes;
+	}
+	if (driver->outdma != NULL &&
+	    ioctl (driver->outfd, SNDCTL_DSP_GETOPTR, &ci) == 0) {
+		memset (driver->outdma, 0x00, driver->outdmasize);
+		driver->out_pos = (uint32_t)ci.bytes + driver->outdmasize;
+	}
+}
+
+
+/* mmap mode: instead of blocking in read()/write() this thread polls the
+   hardware pointer of the clocking ring (capture if there is any) and
+   sleeps for as long as the rest of the period should take to arrive.
+   The driver callbacks convert straight from and to the DMA buffers.
+   Playback runs one buffer behind its pointer: a cycle refills the
+   period the hardware has just played.
+ */
+static void *mmap_thread (void *param)
+{
+	oss_driver_t *driver = (oss_driver_t*)param;
+	count_info ci;
+	int fd, trigger;
+	unsigned long request;
+	uint32_t avail;
+	size_t period, dmasize, framesize;
+
+	sem_wait (&driver->sem_start);
+
+	if (driver->indma != NULL) {
+		fd = driver->infd;
+		request = SNDCTL_DSP_GETIPTR;
+		period = driver->indevbufsize;
+		dmasize = driver->indmasize;
+	} else {
+		fd = driver->outfd;
+		request = SNDCTL_DSP_GETOPTR;
+		period = driver->outdevbufsize;
+		dmasize = driver->outdmasize;
+	}
+	framesize = period / driver->period_size;
+
+	driver->in_pos = 0;
+	driver->out_pos = driver->outdmasize;
+
+	if (driver->infd >= 0 && driver->infd == driver->outfd) {
+		trigger = PCM_ENABLE_INPUT | PCM_ENABLE_OUTPUT;
+		ioctl (driver->infd, SNDCTL_DSP_SETTRIGGER, &trigger);
+	} else {
+		if (driver->outfd >= 0) {
+			trigger = PCM_ENABLE_OUTPUT;
+			ioctl (driver->outfd, SNDCTL_DSP_SETTRIGGER, &trigger);
+		}
+		if (driver->infd >= 0) {
+			trigger = PCM_ENABLE_INPUT;
+			ioctl (driver->infd, SNDCTL_DSP_SETTRIGGER, &trigger);
+		}
+	}
+
+	while (driver->run) {
+		if (ioctl (fd, request, &ci) < 0) {
+			jack_error ("OSS: failed to get DMA pointer: %s@%i, errno=%d",
+				    __FILE__, __LINE__, errno);
+			break;
+		}
+
+		if (driver->indma != NULL) {
+			avail = (uint32_t)ci.bytes - driver->in_pos;
+		} else {
+			avail = (uint32_t)ci.bytes + driver->outdmasize -
+				driver->out_pos;
+		}
+
+		if (avail < period) {
+			mmap_sleep (driver, (period - avail) / framesize);
+			continue;
+		}
+
+		if (avail >= dmasize) {
+			driver->engine->delay (driver->engine,
+					       (float)((avail - period) /
+						       framesize) * 1e6f /
+					       (float)driver->sample_rate);
+			mmap_restart (driver);
+			continue;
+		}
+
+		driver_cycle (driver);
+
+		driver->in_pos += driver->indevbufsize;
+		driver->out_pos += driver->outdevbufsize;
+	}
+
+	return NULL;
+}
+
+
 static void *io_thread (void *param)
 {
 	size_t localsize;
@@ -1076,6 +1356,7 @@ jack_driver_t * driver_initialize (jack_client_t *client,
 	const JSList *pnode;
 	const jack_driver_param_t *param;
 	oss_driver_t *driver;
+	memops_format_t format;
 
 	driver = (oss_driver_t*)malloc (sizeof(oss_driver_t));
 	if (driver == NULL) {
@@ -1100,6 +1381,9 @@ jack_driver_t * driver_initialize (jack_client_t *client,
 	driver->outdev = NULL;
 	driver->ignorehwbuf = 0;
 	driver->trigger = 0;
+	driver->use_mmap = 0;
+	driver->indma = NULL;
+	driver->outdma = NULL;
 
 	pnode = params;
 	while (pnode != NULL) {
@@ -1133,6 +1417,9 @@ jack_driver_t * driver_initialize (jack_client_t *client,
 		case 'b':
 			driver->ignorehwbuf = 1;
 			break;
+		case 'm':
+			driver->use_mmap = 1;
+			break;
 		case 'I':
 			in_latency = param->value.ui;
 			break;
@@ -1147,6 +1434,29 @@ jack_driver_t * driver_initialize (jack_client_t *client,
 	driver->period_size = period_size;
 	driver->nperiods = nperiods;
 	driver->bits = bits;
+
+	/* the conversions are memops', the same as every backend's */
+	switch (bits) {
+	case 24:
+		format = MemopsS32L24;
+		driver->sample_bytes = sizeof(int32_t);
+		break;
+	case 32:
+		format = MemopsS32;
+		driver->sample_bytes = sizeof(int32_t);
+		break;
+	case 64:
+		format = MemopsDouble;
+		driver->sample_bytes = sizeof(double);
+		break;
+	case 16:
+	default:
+		format = MemopsS16;
+		driver->sample_bytes = sizeof(int16_t);
+		break;
+	}
+	driver->convert_in = memops_read_func (format);
+	driver->convert_out = memops_write_func (format);
 	driver->capture_channels = capture_channels;
 	driver->playback_channels = playback_channels;
 	driver->sys_in_latency = in_latency;
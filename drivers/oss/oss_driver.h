@@ -24,6 +24,7 @@
 #ifndef __JACK_OSS_DRIVER_H__
 #define __JACK_OSS_DRIVER_H__
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -33,6 +34,7 @@
 #include <jack/jack.h>
 
 #include "driver.h"
+#include "memops.h"
 
 
 #define OSS_DRIVER_DEF_DEV      "/dev/dsp"
@@ -53,6 +55,9 @@ typedef struct _oss_driver {
 	jack_nframes_t period_size;
 	unsigned int nperiods;
 	int bits;
+	size_t sample_bytes;
+	sample_read_func_t convert_in;
+	sample_write_func_t convert_out;
 	unsigned int capture_channels;
 	unsigned int playback_channels;
 
@@ -70,6 +75,16 @@ typedef struct _oss_driver {
 	void *indevbuf;
 	void *outdevbuf;
 
+	/* mmap mode: the DMA buffers and the running byte positions
+	   of the next period in them */
+	int use_mmap;
+	void *indma;
+	void *outdma;
+	size_t indmasize;
+	size_t outdmasize;
+	uint32_t in_pos;
+	uint32_t out_pos;
+
 	float iodelay;
 	jack_time_t last_periodtime;
 	jack_time_t next_periodtime;
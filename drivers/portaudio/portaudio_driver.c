@@ -259,20 +259,24 @@ portaudio_driver_write (portaudio_driver_t *driver, jack_nframes_t nframes)
 	channel_t chn;
 	jack_port_t *port;
 	JSList *node;
-	int i, bytes = nframes * sizeof(float);
+	int i, channels = driver->playback_nchannels;
+	float* out = driver->outPortAudio;
 
-	/* Clear in case of nothing is connected */
-	memset (driver->outPortAudio, 0, driver->playback_nchannels * bytes);
+	if (out == NULL) {
+		return 0;
+	}
 
+	/* the stream is interleaved, so every channel is written exactly
+	   once: from its port, or with silence if nothing is connected */
 	for (chn = 0, node = driver->playback_ports; node; node = jack_slist_next (node), chn++) {
 
 		port = (jack_port_t*)node->data;
 
-		if (jack_port_connected (port) && (driver->outPortAudio != NULL)) {
-			int channels = driver->playback_nchannels;
-			float* out = driver->outPortAudio;
+		if (jack_port_connected (port)) {
 			buf = jack_port_get_buffer (port, nframes);
 			for (i = 0; i < nframes; i++) out[channels * i + chn] = buf[i];
+		} else {
+			for (i = 0; i < nframes; i++) out[channels * i + chn] = 0.0f;
 		}
 	}
 
@@ -144,75 +144,98 @@ set_period_size (sndio_driver_t *driver, jack_nframes_t new_period_size)
 }
 
 
+/* silence goes through playbuf/capbuf a period at a time, so the
+ * null cycles and the priming in sndio_driver_start() don't allocate.
+ * playbuf is left zeroed by every sndio_driver_write().
+ */
 static void
 sndio_driver_write_silence (sndio_driver_t *driver, jack_nframes_t nframes)
 {
-	size_t localsize, io_res, nbytes, offset;
-	void *localbuf;
+	size_t framebytes, localsize, io_res, nbytes, offset;
 
-	localsize = nframes * driver->sample_bytes * driver->playback_channels;
-	localbuf = malloc(localsize);
-	if (localbuf == NULL)
-	{
-		jack_error("sndio_driver: malloc() failed: %s@%i",
-			__FILE__, __LINE__);
+	if (driver->playbuf == NULL)
 		return;
-	}
-	memset(localbuf, 0, localsize);
 
-	offset = 0;
-	nbytes = localsize;
-	while (nbytes > 0)
+	framebytes = driver->sample_bytes * driver->playback_channels;
+	memset(driver->playbuf, 0, driver->playbufsize);
+
+	while (nframes > 0)
 	{
-		io_res = sio_write(driver->hdl, localbuf + offset, nbytes);
-		if (io_res == 0)
+		localsize = nframes * framebytes;
+		if (localsize > driver->playbufsize)
+			localsize = driver->playbufsize;
+
+		offset = 0;
+		nbytes = localsize;
+		while (nbytes > 0)
 		{
-			jack_error("sndio_driver: sio_write() failed: "
-				"count=%d/%d: %s@%i", io_res, localsize,
-				__FILE__, __LINE__);
+			io_res = sio_write(driver->hdl,
+				driver->playbuf + offset, nbytes);
+			if (io_res == 0)
+			{
+				jack_error("sndio_driver: sio_write() failed: "
+					"count=%d/%d: %s@%i", offset, localsize,
+					__FILE__, __LINE__);
+				return;
+			}
+			offset += io_res;
+			nbytes -= io_res;
 		}
-		offset += io_res;
-		nbytes -= io_res;
+		nframes -= localsize / framebytes;
 	}
-	free(localbuf);
 }
 
 
 static void
 sndio_driver_read_silence (sndio_driver_t *driver, jack_nframes_t nframes)
 {
-	size_t localsize, io_res, nbytes, offset;
-	void *localbuf;
+	size_t framebytes, localsize, io_res, nbytes, offset;
 
-	localsize = nframes * driver->sample_bytes * driver->capture_channels;
-	localbuf = malloc(localsize);
-	if (localbuf == NULL)
-	{
-		jack_error("sndio_driver: malloc() failed: %s@%i",
-			__FILE__, __LINE__);
+	if (driver->capbuf == NULL)
 		return;
-	}
 
-	offset = 0;
-	nbytes = localsize;
-	while (nbytes > 0) {
-		io_res = sio_read(driver->hdl, localbuf + offset, nbytes);
-		if (io_res == 0) {
-			jack_error("sndio_driver: sio_read() failed: "
-				"count=%d/%d: %s@%i", io_res, nbytes,
-				__FILE__, __LINE__);
-			break;
+	framebytes = driver->sample_bytes * driver->capture_channels;
+
+	while (nframes > 0)
+	{
+		localsize = nframes * framebytes;
+		if (localsize > driver->capbufsize)
+			localsize = driver->capbufsize;
+
+		offset = 0;
+		nbytes = localsize;
+		while (nbytes > 0) {
+			io_res = sio_read(driver->hdl,
+				driver->capbuf + offset, nbytes);
+			if (io_res == 0) {
+				jack_error("sndio_driver: sio_read() failed: "
+					"count=%d/%d: %s@%i", offset, localsize,
+					__FILE__, __LINE__);
+				return;
+			}
+			offset += io_res;
+			nbytes -= io_res;
 		}
-		offset +=- io_res;
-		nbytes -= io_res;
+		nframes -= localsize / framebytes;
 	}
-	free(localbuf);
+}
+
+
+/* called from sio_revents() whenever the hardware pointer moves */
+static void
+sndio_driver_onmove (void *arg, int delta)
+{
+	sndio_driver_t *driver = (sndio_driver_t *)arg;
+
+	driver->hw_pos += delta;
 }
 
 
 static int
 sndio_driver_start (sndio_driver_t *driver)
 {
+	driver->hw_pos = driver->cycle_pos = 0;
+
 	if (!sio_start(driver->hdl))
 		jack_error("sio_start failed: %s@%i",
 			__FILE__, __LINE__);
@@ -248,6 +271,8 @@ sndio_driver_set_parameters (sndio_driver_t *driver)
 		return -1;
 	}
 
+	sio_onmove(driver->hdl, sndio_driver_onmove, driver);
+
 	if (driver->bits != 16 && driver->bits != 24 && driver->bits != 32)
 	{
 		jack_error("sndio_driver: invalid sample bits");
@@ -257,6 +282,7 @@ sndio_driver_set_parameters (sndio_driver_t *driver)
 	sio_initpar(&par);
 	par.sig = 1;
 	par.bits = driver->bits;
+	par.msb = 1;	/* 24 bits in 32 are converted as 32 */
 	par.pchan = driver->playback_channels;
 	par.rchan = driver->capture_channels;
 	par.rate = driver->sample_rate;
@@ -363,6 +389,7 @@ sndio_driver_wait (sndio_driver_t *driver, int *status, float *iodelay)
 	struct pollfd pfd;
 	nfds_t snfds, nfds;
 	jack_time_t poll_ret;
+	long long excess;
 	int need_capture, need_playback;
 	int events, revents;
 
@@ -440,6 +467,24 @@ sndio_driver_wait (sndio_driver_t *driver, int *status, float *iodelay)
 	}
 	poll_ret = jack_get_microseconds();
 
+	/* the hardware may already be past the period we woke for; if so,
+	 * backdate the cycle start by that much, so that the timestamps
+	 * follow the device position rather than the wakeup latency.
+	 */
+	driver->cycle_pos += driver->period_size;
+	excess = driver->hw_pos - driver->cycle_pos;
+	if (excess > 0 && excess < (long long)driver->period_size)
+	{
+		poll_ret -= ((double)excess /
+			(double)driver->sample_rate) * 1e6;
+	}
+	else if (excess >= (long long)driver->period_size ||
+		 excess <= -(long long)driver->period_size)
+	{
+		/* xrun or restart; resync instead of drifting */
+		driver->cycle_pos = driver->hw_pos;
+	}
+
 	if (driver->poll_next && poll_ret > driver->poll_next)
 		*iodelay = poll_ret - driver->poll_next;
 
@@ -469,77 +514,20 @@ sndio_driver_run_cycle (sndio_driver_t *driver)
 
 
 static void
-copy_and_convert_in (jack_sample_t *dst, void *src, 
-	size_t nframes,	int channel, int chcount, int bits)
+copy_and_convert_in (sndio_driver_t *driver, jack_sample_t *dst, void *src,
+	size_t nframes, int channel, int chcount)
 {
-	int srcidx, dstidx;
-	signed short *s16src = (signed short *)src;
-	signed int *s32src = (signed int *)src;
-	jack_sample_t scale;
-
-	srcidx = channel;
-	switch (bits)
-	{
-		case 16:
-			scale = 1.0f / 0x7fff;
-			for (dstidx = 0; dstidx < nframes; dstidx++)
-			{
-				dst[dstidx] = (jack_sample_t) 
-					s16src[srcidx] * scale;
-				srcidx += chcount;
-			}
-			break;
-		case 24:
-		case 32:
-			scale = 1.0f / 0x7fffffff;
-			for (dstidx = 0; dstidx < nframes; dstidx++)
-			{
-				dst[dstidx] = (jack_sample_t)
-					s32src[srcidx] * scale;
-				srcidx += chcount;
-			}
-			break;
-	}
+	driver->convert_in(dst, (char *)src + channel * driver->sample_bytes,
+		nframes, chcount * driver->sample_bytes);
 }
 
 
 static void
-copy_and_convert_out (void *dst, jack_sample_t *src, 
-	size_t nframes,	int channel, int chcount, int bits)
+copy_and_convert_out (sndio_driver_t *driver, void *dst, jack_sample_t *src,
+	size_t nframes, int channel, int chcount)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16dst = (signed short *)dst;
-	signed int *s32dst = (signed int *)dst;
-	jack_sample_t scale;
-
-	dstidx = channel;
-	switch (bits)
-	{
-		case 16:
-			scale = 0x7fff;
-			for (srcidx = 0; srcidx < nframes; srcidx++)
-			{
-				s16dst[dstidx] = (signed short)
-					(src[srcidx] >= 0.0f) ?
-					(src[srcidx] * scale + 0.5f) :
-					(src[srcidx] * scale - 0.5f);
-				dstidx += chcount;
-			}
-			break;
-		case 24:
-		case 32:
-			scale = 0x7fffffff;
-			for (srcidx = 0; srcidx < nframes; srcidx++)
-			{
-				s32dst[dstidx] = (signed int)
-					(src[srcidx] >= 0.0f) ?
-					(src[srcidx] * scale + 0.5f) :
-					(src[srcidx] * scale - 0.5f);
-				dstidx += chcount;
-			}
-			break;
-	}
+	driver->convert_out((char *)dst + channel * driver->sample_bytes, src,
+		nframes, chcount * driver->sample_bytes, NULL);
 }
 
 
@@ -661,6 +649,22 @@ sndio_driver_read (sndio_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
+	/* read this period first, then hand it to the ports */
+	io_res = offset = 0;
+	nbytes = nframes * driver->capture_channels * driver->sample_bytes;
+	while (nbytes > 0)
+	{
+		io_res = sio_read(driver->hdl, driver->capbuf + offset, nbytes);
+		if (io_res == 0)
+		{
+			jack_error("sndio_driver: sio_read() failed: %s@%i",
+				__FILE__, __LINE__);
+			break;
+		}
+		offset += io_res;
+		nbytes -= io_res;
+	}
+
 	node = driver->capture_ports;
 	channel = 0;
 	while (node != NULL)
@@ -670,30 +674,15 @@ sndio_driver_read (sndio_driver_t *driver, jack_nframes_t nframes)
 		if (jack_port_connected(port))
 		{
 			portbuf = jack_port_get_buffer(port, nframes);
-			copy_and_convert_in(portbuf, driver->capbuf, 
+			copy_and_convert_in(driver, portbuf, driver->capbuf, 
 				nframes, channel, 
-				driver->capture_channels,
-				driver->bits);
+				driver->capture_channels);
 		}
 
 		node = jack_slist_next(node);
 		channel++;
 	}
 
-	io_res = offset = 0;
-	nbytes = nframes * driver->capture_channels * driver->sample_bytes;
-	while (nbytes > 0)
-	{
-		io_res = sio_read(driver->hdl, driver->capbuf + offset, nbytes);
-		if (io_res == 0)
-		{
-			jack_error("sndio_driver: sio_read() failed: %s@%i",
-				__FILE__, __LINE__);
-			break;
-		}
-		offset += io_res;
-		nbytes -= io_res;
-	}
 	return 0;
 }
 
@@ -728,10 +717,9 @@ sndio_driver_write (sndio_driver_t *driver, jack_nframes_t nframes)
 		if (jack_port_connected(port))
 		{
 			portbuf = jack_port_get_buffer(port, nframes);
-			copy_and_convert_out(driver->playbuf, portbuf, 
+			copy_and_convert_out(driver, driver->playbuf, portbuf, 
 				nframes, channel,
-				driver->playback_channels,
-				driver->bits);
+				driver->playback_channels);
 		}
 
 		node = jack_slist_next(node);
@@ -839,6 +827,7 @@ sndio_driver_new (char *dev, jack_client_t *client,
 	int ignorehwbuf)
 {
 	sndio_driver_t *driver;
+	memops_format_t format;
 
 	driver = (sndio_driver_t *)calloc(1, sizeof(sndio_driver_t));
 	if (driver == NULL)
@@ -872,6 +861,21 @@ sndio_driver_new (char *dev, jack_client_t *client,
 	driver->orig_period_size = period_size;
 	driver->nperiods = nperiods;
 	driver->bits = bits;
+
+	/* the conversions are memops', the same as every backend's;
+	   24 bits come MSB aligned in 32 */
+	if (bits == 16)
+	{
+		format = MemopsS16;
+		driver->sample_bytes = sizeof(int16_t);
+	}
+	else
+	{
+		format = MemopsS32;
+		driver->sample_bytes = sizeof(int32_t);
+	}
+	driver->convert_in = memops_read_func(format);
+	driver->convert_out = memops_write_func(format);
 	driver->capture_channels = capture_channels;
 	driver->playback_channels = playback_channels;
 	driver->sys_cap_latency = cap_latency;
@@ -24,6 +24,7 @@
 #include <jack/types.h>
 #include <jack/jslist.h>
 #include <driver.h>
+#include <memops.h>
 #include <jack/jack.h>
 
 #define SNDIO_DRIVER_DEF_DEV		"default"
@@ -45,6 +46,9 @@ typedef struct _sndio_driver
 	jack_nframes_t orig_period_size;
 	unsigned int nperiods;
 	int bits;
+	size_t sample_bytes;
+	sample_read_func_t convert_in;
+	sample_write_func_t convert_out;
 	unsigned int capture_channels;
 	unsigned int playback_channels;
 	jack_nframes_t sys_cap_latency;
@@ -67,6 +71,11 @@ typedef struct _sndio_driver
 	int poll_timeout;
 	jack_time_t poll_next;
 
+	/* frames the hardware has moved (from sio_onmove), and the
+	 * frames the cycles so far account for */
+	long long hw_pos;
+	long long cycle_pos;
+
 	jack_client_t *client;
 
 } sndio_driver_t;
@@ -144,58 +144,131 @@ set_period_size (sun_driver_t *driver, jack_nframes_t new_period_size)
 		 (double)driver->sample_rate) * 1e6;
 	driver->last_wait_ust = 0;
 	driver->iodelay = 0.0F;
-	driver->poll_timeout = (int)(driver->period_usecs / 666);
+	/* poll() only times out if the device stalls; it wakes on the
+	 * device itself.  round up, so that short periods don't end up
+	 * with a zero (non-blocking) timeout.
+	 */
+	driver->poll_timeout = (int)ceil (driver->period_usecs / 666.0);
+	if (driver->poll_timeout < 1) {
+		driver->poll_timeout = 1;
+	}
 }
 
 
+/* the silence is written and read through the device buffers, a
+ * period at a time, so that the null cycles and the xrun recovery in
+ * sun_driver_wait() do no allocation.
+ */
 static void
 sun_driver_write_silence (sun_driver_t *driver, jack_nframes_t nframes)
 {
+	size_t framebytes;
 	size_t localsize;
 	ssize_t io_res;
-	void *localbuf;
 
-	localsize = nframes * driver->sample_bytes * driver->playback_channels;
-	localbuf = malloc (localsize);
-	if (localbuf == NULL) {
-		jack_error ("sun_driver: malloc() failed: %s@%i",
-			    __FILE__, __LINE__);
+	if (driver->outdevbuf == NULL) {
 		return;
 	}
 
-	bzero (localbuf, localsize);
-	io_res = write (driver->outfd, localbuf, localsize);
-	if (io_res < (ssize_t)localsize) {
-		jack_error ("sun_driver: write() failed: %s: "
-			    "count=%d/%d: %s@%i", strerror (errno), io_res,
-			    localsize, __FILE__, __LINE__);
+	framebytes = driver->sample_bytes * driver->playback_channels;
+	bzero (driver->outdevbuf, driver->outdevbufsize);
+
+	while (nframes) {
+		localsize = nframes * framebytes;
+		if (localsize > driver->outdevbufsize) {
+			localsize = driver->outdevbufsize;
+		}
+		io_res = write (driver->outfd, driver->outdevbuf, localsize);
+		if (io_res < (ssize_t)localsize) {
+			jack_error ("sun_driver: write() failed: %s: "
+				    "count=%d/%d: %s@%i", strerror (errno), io_res,
+				    localsize, __FILE__, __LINE__);
+			return;
+		}
+		nframes -= localsize / framebytes;
 	}
-	free (localbuf);
 }
 
 
 static void
 sun_driver_read_silence (sun_driver_t *driver, jack_nframes_t nframes)
 {
+	size_t framebytes;
 	size_t localsize;
 	ssize_t io_res;
-	void *localbuf;
 
-	localsize = nframes * driver->sample_bytes * driver->capture_channels;
-	localbuf = malloc (localsize);
-	if (localbuf == NULL) {
-		jack_error ("sun_driver: malloc() failed: %s@%i",
-			    __FILE__, __LINE__);
+	if (driver->indevbuf == NULL) {
 		return;
 	}
 
-	io_res = read (driver->infd, localbuf, localsize);
-	if (io_res < (ssize_t)localsize) {
-		jack_error ("sun_driver: read() failed: %s: "
-			    "count=%d/%d: %s@%i", strerror (errno), io_res,
-			    localsize, __FILE__, __LINE__);
+	framebytes = driver->sample_bytes * driver->capture_channels;
+
+	while (nframes) {
+		localsize = nframes * framebytes;
+		if (localsize > driver->indevbufsize) {
+			localsize = driver->indevbufsize;
+		}
+		io_res = read (driver->infd, driver->indevbuf, localsize);
+		if (io_res < (ssize_t)localsize) {
+			jack_error ("sun_driver: read() failed: %s: "
+				    "count=%d/%d: %s@%i", strerror (errno), io_res,
+				    localsize, __FILE__, __LINE__);
+			return;
+		}
+		nframes -= localsize / framebytes;
+	}
+}
+
+
+/* how many frames past the period we woke for the device has already
+ * moved, from the capture side if there is one.  the wakeup is
+ * backdated by that much, so the cycle timestamps follow the hardware
+ * position rather than the scheduler latency of the poll() return.
+ */
+static jack_nframes_t
+sun_driver_hw_excess (sun_driver_t *driver)
+{
+	audio_info_t auinfo;
+	int fd;
+	int bytes;
+	int ready;
+
+	if (driver->infd >= 0) {
+		fd = driver->infd;
+	} else {
+		fd = driver->outfd;
+	}
+
+#if defined(AUDIO_GETBUFINFO)
+	if (ioctl (fd, AUDIO_GETBUFINFO, &auinfo) < 0) {
+		return 0;
+	}
+#else
+	if (ioctl (fd, AUDIO_GETINFO, &auinfo) < 0) {
+		return 0;
+	}
+#endif
+
+	if (fd == driver->infd) {
+		/* capture data waiting to be read */
+		bytes = driver->sample_bytes * driver->capture_channels;
+		ready = auinfo.record.seek / bytes;
+	} else {
+		/* playback space free for writing */
+		bytes = driver->sample_bytes * driver->playback_channels;
+		ready = (driver->nperiods * driver->period_size) -
+			(auinfo.play.seek / bytes);
+	}
+
+	if (ready <= (int)driver->period_size) {
+		return 0;
 	}
-	free (localbuf);
+	ready -= driver->period_size;
+	if (ready > (int)driver->period_size) {
+		/* that's an xrun, which is reported separately */
+		return 0;
+	}
+	return ready;
 }
 
 
@@ -266,6 +339,8 @@ sun_driver_wait (sun_driver_t *driver, int *status, float *iodelay)
 	}
 
 	poll_ret = driver->engine->get_microseconds ();
+	poll_ret -= ((double)sun_driver_hw_excess (driver) /
+		     (double)driver->sample_rate) * 1e6;
 
 	if (driver->poll_next && poll_ret > driver->poll_next) {
 		*iodelay = poll_ret - driver->poll_next;
@@ -411,102 +486,20 @@ sun_driver_run_cycle (sun_driver_t *driver)
 
 
 static void
-copy_and_convert_in (jack_sample_t *dst, void *src,
-		     size_t nframes, int channel, int chcount, int bits)
+copy_and_convert_in (sun_driver_t *driver, jack_sample_t *dst, void *src,
+		     size_t nframes, int channel, int chcount)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16src = (signed short*)src;
-	signed int *s32src = (signed int*)src;
-	double *f64src = (double*)src;
-	jack_sample_t scale;
-
-	srcidx = channel;
-	switch (bits) {
-	case 16:
-		scale = 1.0f / 0x7fff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s16src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
-	case 24:
-		scale = 1.0f / 0x7fffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
-	case 32:
-		scale = 1.0f / 0x7fffffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
-	case 64:
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)f64src[srcidx];
-			srcidx += chcount;
-		}
-		break;
-	}
+	driver->convert_in (dst, (char*)src + channel * driver->sample_bytes,
+			    nframes, chcount * driver->sample_bytes);
 }
 
 
 static void
-copy_and_convert_out (void *dst, jack_sample_t *src,
-		      size_t nframes, int channel, int chcount, int bits)
+copy_and_convert_out (sun_driver_t *driver, void *dst, jack_sample_t *src,
+		      size_t nframes, int channel, int chcount)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16dst = (signed short*)dst;
-	signed int *s32dst = (signed int*)dst;
-	double *f64dst = (double*)dst;
-	jack_sample_t scale;
-
-	dstidx = channel;
-	switch (bits) {
-	case 16:
-		scale = 0x7fff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s16dst[dstidx] = (signed short)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
-		break;
-	case 24:
-		scale = 0x7fffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
-		break;
-	case 32:
-		scale = 0x7fffffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
-		break;
-	case 64:
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			f64dst[dstidx] = (double)src[srcidx];
-			dstidx += chcount;
-		}
-		break;
-	}
+	driver->convert_out ((char*)dst + channel * driver->sample_bytes, src,
+			     nframes, chcount * driver->sample_bytes, NULL);
 }
 
 
@@ -1011,6 +1004,7 @@ static int
 sun_driver_read (sun_driver_t *driver, jack_nframes_t nframes)
 {
 	jack_nframes_t nbytes;
+	jack_nframes_t offset;
 	int channel;
 	ssize_t io_res;
 	jack_sample_t *portbuf;
@@ -1028,6 +1022,20 @@ sun_driver_read (sun_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
+	/* read this period before handing it to the ports */
+	nbytes = nframes * driver->capture_channels * driver->sample_bytes;
+	offset = 0;
+	while (offset < nbytes) {
+		io_res = read (driver->infd, (char*)driver->indevbuf + offset,
+			       nbytes - offset);
+		if (io_res < 0) {
+			jack_error ("sun_driver: read() failed: %s: %s@%i",
+				    strerror (errno), __FILE__, __LINE__);
+			break;
+		}
+		offset += io_res;
+	}
+
 	node = driver->capture_ports;
 	channel = 0;
 	while (node != NULL) {
@@ -1035,29 +1043,15 @@ sun_driver_read (sun_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_in (portbuf, driver->indevbuf,
+			copy_and_convert_in (driver, portbuf, driver->indevbuf,
 					     nframes, channel,
-					     driver->capture_channels,
-					     driver->bits);
+					     driver->capture_channels);
 		}
 
 		node = jack_slist_next (node);
 		channel++;
 	}
 
-	nbytes = nframes * driver->capture_channels * driver->sample_bytes;
-	io_res = 0;
-	while (nbytes) {
-		io_res = read (driver->infd, driver->indevbuf, nbytes);
-		if (io_res < 0) {
-			jack_error ("sun_driver: read() failed: %s: %s@%i",
-				    strerror (errno), __FILE__, __LINE__);
-			break;
-		} else {
-			nbytes -= io_res;
-		}
-	}
-
 	return 0;
 }
 
@@ -1066,6 +1060,7 @@ static int
 sun_driver_write (sun_driver_t *driver, jack_nframes_t nframes)
 {
 	jack_nframes_t nbytes;
+	jack_nframes_t offset;
 	int channel;
 	ssize_t io_res;
 	jack_sample_t *portbuf;
@@ -1093,10 +1088,9 @@ sun_driver_write (sun_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_out (driver->outdevbuf, portbuf,
+			copy_and_convert_out (driver, driver->outdevbuf, portbuf,
 					      nframes, channel,
-					      driver->playback_channels,
-					      driver->bits);
+					      driver->playback_channels);
 		}
 
 		node = jack_slist_next (node);
@@ -1104,16 +1098,16 @@ sun_driver_write (sun_driver_t *driver, jack_nframes_t nframes)
 	}
 
 	nbytes = nframes * driver->playback_channels * driver->sample_bytes;
-	io_res = 0;
-	while (nbytes) {
-		io_res = write (driver->outfd, driver->outdevbuf, nbytes);
+	offset = 0;
+	while (offset < nbytes) {
+		io_res = write (driver->outfd, (char*)driver->outdevbuf + offset,
+				nbytes - offset);
 		if (io_res < 0) {
 			jack_error ("sun_driver: write() failed: %s: %s@%i",
 				    strerror (errno), __FILE__, __LINE__);
 			break;
-		} else {
-			nbytes -= io_res;
 		}
+		offset += io_res;
 	}
 
 	return 0;
@@ -1202,6 +1196,7 @@ sun_driver_new (char *indev, char *outdev, jack_client_t *client,
 		int ignorehwbuf)
 {
 	sun_driver_t *driver;
+	memops_format_t format;
 
 	driver = (sun_driver_t*)malloc (sizeof(sun_driver_t));
 	if (driver == NULL) {
@@ -1236,6 +1231,26 @@ sun_driver_new (char *indev, char *outdev, jack_client_t *client,
 	driver->period_size = period_size;
 	driver->nperiods = nperiods;
 	driver->bits = bits;
+
+	/* the conversions are memops', the same as every backend's;
+	   the device buffers hold bits / 8 bytes per sample */
+	switch (bits) {
+	case 24:
+		format = MemopsS24;
+		break;
+	case 32:
+		format = MemopsS32;
+		break;
+	case 64:
+		format = MemopsDouble;
+		break;
+	case 16:
+	default:
+		format = MemopsS16;
+		break;
+	}
+	driver->convert_in = memops_read_func (format);
+	driver->convert_out = memops_write_func (format);
 	driver->capture_channels = capture_channels;
 	driver->playback_channels = playback_channels;
 	driver->sys_in_latency = in_latency;
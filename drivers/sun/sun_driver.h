@@ -37,6 +37,7 @@
 #include <jack/jack.h>
 
 #include "driver.h"
+#include "memops.h"
 
 #define SUN_DRIVER_DEF_DEV      "/dev/audio"
 #define SUN_DRIVER_DEF_FS       48000
@@ -57,6 +58,8 @@ typedef struct _sun_driver {
 	unsigned int nperiods;
 	int bits;
 	int sample_bytes;
+	sample_read_func_t convert_in;
+	sample_write_func_t convert_out;
 	unsigned int capture_channels;
 	unsigned int playback_channels;
 
@@ -0,0 +1,262 @@
+/*
+    Copyright (C) 2001-2003 Paul Davis
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+#ifndef __jack_activation_h__
+#define __jack_activation_h__
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sysdeps/futex.h>
+
+/* Graph activation through futex words.
+ *
+ * By default the process graph is driven by writing single bytes to
+ * the inter-client FIFOs. When the server runs with "--activation
+ * futex", every external client owns a slot in the activation table
+ * of the engine's shared memory, and the engine owns slot 0. Waking a
+ * client adds one to the count in its slot and calls FUTEX_WAKE; the
+ * client waits with FUTEX_WAIT and consumes the count, so a hop costs
+ * one system call on each side and no pipe buffer.
+ *
+ * A thread sleeping on a futex cannot also poll its event socket, so
+ * the engine sets JACK_ACTIVATION_EVENT in a client's slot after it
+ * has written an event to that client.
+ *
+ * A client that could not be given a slot (the table is full) uses
+ * the FIFOs, so both mechanisms may be in use in the same graph.
+ *
+ * With parallel execution the engine also gives each client the list
+ * of slots it has to complete when its process callback returns
+ * (jack_client_control_t.activation_successors). The `pending' count
+ * of a slot is set to the number of upstream clients at the start of
+ * each cycle, and whoever brings it to zero wakes the slot's owner,
+ * so clients start their successors without a trip through the
+ * server. Clients at the end of the graph wake the engine instead.
+ *
+ * With "--spin-wait" the waits that pass a jack_activation_spin_t
+ * watch the word for a while before they go to sleep, for threads
+ * that have a cpu to themselves and short periods, where waking from
+ * FUTEX_WAIT takes a good part of the cycle. Waiters count themselves
+ * in `sleepers' only around FUTEX_WAIT, and a waker skips FUTEX_WAKE
+ * while there are none, so a waiter that is still spinning costs the
+ * waker no system call.
+ */
+
+typedef enum {
+	JackActivationFIFO = 0,
+	JackActivationFutex = 1
+} jack_activation_type_t;
+
+#define JACK_ACTIVATION_MAX     256
+#define JACK_ACTIVATION_ENGINE  0               /* slot the engine waits on */
+#define JACK_ACTIVATION_EVENT   0x40000000
+#define JACK_ACTIVATION_COUNT   0x0000ffff
+#define JACK_ACTIVATION_MAX_SUCCESSORS 32
+
+/* one slot per cache line, they are written from different CPUs */
+typedef struct {
+	volatile int32_t word;
+	volatile int32_t pending;       /* upstream clients still running */
+	volatile int32_t sleepers;      /* waiters in FUTEX_WAIT on `word' */
+	char pad[52];
+} jack_activation_t;
+
+/* how a spinning waiter tunes itself, one per waiting thread */
+typedef struct {
+	int64_t limit;                  /* usecs it may spin, 0: never */
+	int64_t average;                /* of recent arrivals, usecs * 8 */
+	int64_t budget;                 /* usecs it spins next time */
+} jack_activation_spin_t;
+
+/* after a change of the word: the waiter either sees the change
+   before it sleeps, or is counted in `sleepers' by the time we look */
+static inline void
+jack_activation_wake (jack_activation_t *act)
+{
+	if (__atomic_load_n (&act->sleepers, __ATOMIC_SEQ_CST)) {
+		jack_futex_wake (&act->word, 1);
+	}
+}
+
+static inline void
+jack_activation_signal (jack_activation_t *act)
+{
+	__atomic_fetch_add (&act->word, 1, __ATOMIC_SEQ_CST);
+	jack_activation_wake (act);
+}
+
+static inline void
+jack_activation_post_event (jack_activation_t *act)
+{
+	__atomic_fetch_or (&act->word, JACK_ACTIVATION_EVENT, __ATOMIC_SEQ_CST);
+	jack_activation_wake (act);
+}
+
+/* one of the upstream clients of the slot's owner has finished: wake
+   the owner if it was the last one.
+ */
+static inline void
+jack_activation_complete (jack_activation_t *act)
+{
+	if (__atomic_sub_fetch (&act->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+		jack_activation_signal (act);
+	}
+}
+
+static inline void
+jack_activation_reset (jack_activation_t *act)
+{
+	/* drop activations left over by aborted cycles, but keep
+	   any pending event notification.
+	 */
+	__atomic_fetch_and (&act->word, JACK_ACTIVATION_EVENT, __ATOMIC_RELAXED);
+}
+
+/* Wait for the slot to become non-zero, for at most timeout_usecs
+ * (forever if negative). Consumes one activation and any pending
+ * event notification, and returns the bits that were found: test
+ * the result against JACK_ACTIVATION_COUNT and JACK_ACTIVATION_EVENT.
+ * Returns 0 on timeout and -1 on error.
+ */
+static inline int32_t
+jack_activation_wait (jack_activation_t *act, int64_t timeout_usecs)
+{
+	struct timespec ts;
+	int32_t val, nval;
+	int ret, err;
+
+	while (1) {
+		val = __atomic_load_n (&act->word, __ATOMIC_ACQUIRE);
+
+		if (val) {
+			nval = (val & JACK_ACTIVATION_COUNT) ?
+			       (val & JACK_ACTIVATION_COUNT) - 1 : 0;
+			if (__atomic_compare_exchange_n (&act->word, &val, nval,
+							 0, __ATOMIC_ACQ_REL,
+							 __ATOMIC_ACQUIRE)) {
+				return val;
+			}
+			continue;
+		}
+
+		if (timeout_usecs >= 0) {
+			ts.tv_sec = timeout_usecs / 1000000;
+			ts.tv_nsec = (timeout_usecs % 1000000) * 1000;
+		}
+
+		__atomic_fetch_add (&act->sleepers, 1, __ATOMIC_SEQ_CST);
+		ret = jack_futex_wait (&act->word, 0,
+				       timeout_usecs >= 0 ? &ts : NULL);
+		err = errno;
+		__atomic_fetch_sub (&act->sleepers, 1, __ATOMIC_RELAXED);
+
+		if (ret < 0) {
+			if (err == ETIMEDOUT) {
+				return 0;
+			}
+			if (err != EAGAIN && err != EINTR) {
+				errno = err;
+				return -1;
+			}
+		}
+	}
+}
+
+static inline void
+jack_cpu_relax (void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause ();
+#elif defined(__aarch64__)
+	__asm__ __volatile__ ("yield" ::: "memory");
+#else
+	__atomic_signal_fence (__ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline int64_t
+jack_activation_usecs (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* learn from an activation that took `arrival' usecs to come: spin a
+   little longer than the last few took, or not at all if that would
+   be longer than the limit, where the cpu is better given away */
+static inline void
+jack_activation_spin_tune (jack_activation_spin_t *spin, int64_t arrival)
+{
+	int64_t average;
+
+	spin->average += arrival - (spin->average >> 3);
+	average = spin->average >> 3;
+	spin->budget = average + average / 2 + 1;
+	if (spin->budget > spin->limit) {
+		spin->budget = 0;
+	}
+}
+
+/* jack_activation_wait(), spinning first as `spin' says */
+static inline int32_t
+jack_activation_spin_wait (jack_activation_t *act,
+			   jack_activation_spin_t *spin, int64_t timeout_usecs)
+{
+	int64_t start, now;
+	uint32_t n = 0;
+	int32_t bits;
+
+	if (spin->limit <= 0) {
+		return jack_activation_wait (act, timeout_usecs);
+	}
+
+	now = start = jack_activation_usecs ();
+
+	if (spin->budget > 0) {
+		/* look at the clock only now and then, it costs more
+		   than the load */
+		while (__atomic_load_n (&act->word, __ATOMIC_RELAXED) == 0) {
+			jack_cpu_relax ();
+			if ((++n & 31) == 0
+			    && (now = jack_activation_usecs ()) - start
+			    >= spin->budget) {
+				break;
+			}
+		}
+	}
+
+	if (timeout_usecs >= 0) {
+		timeout_usecs = timeout_usecs > now - start ?
+				timeout_usecs - (now - start) : 0;
+	}
+
+	if ((bits = jack_activation_wait (act, timeout_usecs)) > 0
+	    && (bits & JACK_ACTIVATION_COUNT)) {
+		jack_activation_spin_tune (spin,
+					   jack_activation_usecs () - start);
+	}
+
+	return bits;
+}
+
+#endif /* __jack_activation_h__ */
@@ -108,4 +108,21 @@ bitset_remove (bitset_t set, unsigned int element)
 	set[WORD_INDEX (element)] &= ~(1 << BIT_INDEX (element));
 }
 
+static inline void
+bitset_clear (bitset_t set)
+{
+	memset (set + 1, 0, BYTE_SIZE (set[0]) - sizeof(_bitset_word_t));
+}
+
+static inline void
+bitset_union (bitset_t to_set, bitset_t from_set)
+{
+	int i;
+	int nwords = WORD_SIZE (to_set[0]);
+
+	assert (to_set[0] == from_set[0]);
+	for (i = 1; i < nwords; i++)
+		to_set[i] |= from_set[i];
+}
+
 #endif /* __bitset_h__ */
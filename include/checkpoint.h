@@ -0,0 +1,105 @@
+/*
+    The server's graph checkpoint, kept across restarts.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+#ifndef __jack_checkpoint_h__
+#define __jack_checkpoint_h__
+
+#include <pthread.h>
+
+#include <jack/types.h>
+#include <jack/jslist.h>
+#include <jack/uuid.h>
+
+#include "internal.h"
+#include "port.h"
+
+/* With "--checkpoint-file FILE" the server keeps the graph in FILE:
+ * the clients with their UUIDs, every port with its aliases, the
+ * connections and the buffer size. The next server started with the
+ * same FILE gives a returning client its old UUID, its ports their
+ * aliases as they are registered, and makes the connections the
+ * moment both ends are back and active (jackd/checkpoint.c).
+ *
+ * What the file holds that has not come back yet stays in the lists
+ * below, and is written again along with the live graph, so that a
+ * client that is slow to return is not forgotten by the first change
+ * somebody else makes. The lists are under the checkpoint's lock,
+ * which nests inside the graph lock.
+ */
+
+#define JACK_CHECKPOINT_MAX_MISSED 4    /* restarts a client may sit out */
+
+typedef struct {
+	jack_uuid_t uuid;
+	char name[JACK_CLIENT_NAME_SIZE];
+	uint32_t missed;                /* restarts it did not come back for */
+} POST_PACKED_STRUCTURE jack_checkpoint_client_t;
+
+typedef struct {
+	char name[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	char alias1[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	char alias2[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+} POST_PACKED_STRUCTURE jack_checkpoint_port_t;
+
+typedef struct {
+	char source[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	char destination[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+} POST_PACKED_STRUCTURE jack_checkpoint_connection_t;
+
+typedef struct _jack_checkpoint {
+	struct _jack_engine *engine;
+	char *path;
+
+	/* as the file had them */
+	jack_nframes_t buffer_size;
+	jack_nframes_t start_buffer_size; /* that its driver started with */
+
+	/* what we started with, for the next snapshot */
+	jack_nframes_t driver_buffer_size;
+
+	JSList *clients;                /* jack_checkpoint_client_t */
+	JSList *ports;                  /* jack_checkpoint_port_t */
+	JSList *connections;            /* jack_checkpoint_connection_t */
+
+	pthread_mutex_t lock;
+	pthread_t thread;
+	pthread_cond_t dirty_cond;
+	int dirty;
+	int running;
+} jack_checkpoint_t;
+
+jack_checkpoint_t *jack_checkpoint_new (struct _jack_engine *engine,
+					const char *path);
+void jack_checkpoint_delete (jack_checkpoint_t *cp);
+
+/* the graph changed, write it out soon */
+void jack_checkpoint_dirty (jack_checkpoint_t *cp);
+
+/* the UUID the file had for a client called `name', or 0; it is
+   handed out once */
+jack_uuid_t jack_checkpoint_take_client (jack_checkpoint_t *cp,
+					 const char *name, jack_uuid_t uuid);
+int  jack_checkpoint_holds_uuid (jack_checkpoint_t *cp, jack_uuid_t uuid);
+
+/* the record for the port called `name', removed from the list;
+   free() it */
+jack_checkpoint_port_t *jack_checkpoint_take_port (jack_checkpoint_t *cp,
+						   const char *name);
+
+#endif /* __jack_checkpoint_h__ */
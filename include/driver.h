@@ -61,6 +61,9 @@ typedef int (*JackDriverStopFunction)(struct _jack_driver *);
 typedef int (*JackDriverStartFunction)(struct _jack_driver *);
 typedef int (*JackDriverBufSizeFunction)(struct _jack_driver *,
 					 jack_nframes_t nframes);
+typedef int (*JackDriverWritePortFunction)(struct _jack_driver *,
+					   jack_port_id_t port,
+					   jack_nframes_t nframes);
 /*
    Call sequence summary:
 
@@ -206,6 +209,16 @@ typedef struct _jack_driver {
    prior to this, and the start function after this one has returned.
 
     JackDriverBufSizeFunction bufsize;
+
+   Optional. In parallel mode the engine will call this as soon as
+   every client that feeds one of the driver's playback ports has
+   finished the cycle, so that the driver can move that port's data
+   to its output ahead of the others. it runs on the engine thread,
+   between `read' and `write', and `write' must then leave alone the
+   ports it has already handled. a driver that returns nonzero, or
+   leaves this NULL, has all of its ports written by `write'.
+
+    JackDriverWritePortFunction write_port;
  */
 
 /* define the fields here... */
@@ -222,7 +235,8 @@ typedef struct _jack_driver {
 	JackDriverNullCycleFunction null_cycle;	\
 	JackDriverStopFunction stop; \
 	JackDriverStartFunction start; \
-	JackDriverBufSizeFunction bufsize;
+	JackDriverBufSizeFunction bufsize; \
+	JackDriverWritePortFunction write_port;
 
 	JACK_DRIVER_DECL                /* expand the macro */
 
@@ -262,7 +276,21 @@ void jack_driver_unload(jack_driver_t *);
      Note that stop/start may be called multiple times in the event of an
      error return from the `wait' function.
 
-
+   The nt thread reads nt_run without a lock: the lock is only held
+   while a start is in progress, to keep the new thread from running
+   a cycle before the device has been started.
+
+   The nt layer times the phases of each cycle for every nt driver:
+   the wait, from the end of the last cycle to the driver's
+   last_wait_ust, the driver's read and write (the nt layer puts
+   itself between the engine and both, see jack_driver_nt_attach())
+   and the engine's process cycle in between. They are reported
+   with -v whenever the driver is stopped.
+
+   A driver that has no device clock to wait for can call
+   jack_driver_nt_timer_wait() from its cycle, which sleeps until
+   deadlines of CLOCK_MONOTONIC one period apart, restarted by
+   every start.
  */
 
 struct _jack_driver_nt;
@@ -275,6 +303,22 @@ typedef int (*JackDriverNTBufSizeFunction)(struct _jack_driver_nt *,
 					   jack_nframes_t nframes);
 typedef int (*JackDriverNTRunCycleFunction)(struct _jack_driver_nt *);
 
+enum {
+	JackDriverNTWait = 0,
+	JackDriverNTRead,
+	JackDriverNTProcess,
+	JackDriverNTWrite,
+	JackDriverNTPhases
+};
+
+typedef struct {
+	unsigned long cycles;
+	jack_time_t sum[JackDriverNTPhases];    /* usecs */
+	jack_time_t max[JackDriverNTPhases];
+	jack_time_t read_usecs;                 /* of the cycle running */
+	jack_time_t write_usecs;
+} jack_driver_nt_timing_t;
+
 typedef struct _jack_driver_nt {
 
 #define JACK_DRIVER_NT_DECL \
@@ -288,7 +332,11 @@ typedef struct _jack_driver_nt {
 	JackDriverNTStopFunction nt_stop; \
 	JackDriverNTStartFunction nt_start; \
 	JackDriverNTBufSizeFunction nt_bufsize;	\
-	JackDriverNTRunCycleFunction nt_run_cycle;
+	JackDriverNTRunCycleFunction nt_run_cycle; \
+	JackDriverReadFunction nt_timed_read; \
+	JackDriverWriteFunction nt_timed_write;	\
+	jack_driver_nt_timing_t nt_timing; \
+	uint64_t nt_next_wakeup;        /* nsecs of CLOCK_MONOTONIC, 0: none yet */
 #define nt_read read
 #define nt_write write
 #define nt_null_cycle null_cycle
@@ -300,6 +348,8 @@ typedef struct _jack_driver_nt {
 
 void jack_driver_nt_init(jack_driver_nt_t * driver);
 void jack_driver_nt_finish(jack_driver_nt_t * driver);
+int jack_driver_nt_timer_wait(jack_driver_nt_t * driver,
+			      jack_time_t period_usecs, float *late_usecs);
 
 
 #endif /* __jack_driver_h__ */
@@ -0,0 +1,54 @@
+/*
+    Driver descriptor cache for jackd and the control API.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#ifndef __jack_drivercache_h__
+#define __jack_drivercache_h__
+
+#include <jack/jslist.h>
+
+#include "driver_interface.h"
+
+/* Driver descriptor cache.
+ *
+ * Getting the descriptors of the drivers means dlopen()ing every
+ * jack_*.so in the driver directory, which pulls in and initializes
+ * each backend's libraries. jackd and the control API only need one
+ * or two of them, so the descriptors are kept in a cache file, and
+ * only the driver that is started gets loaded (by the engine).
+ *
+ * The cache lives in $JACK_DRIVER_CACHE, or JACK_DRIVER_CACHE_NAME in
+ * the driver directory; jackd writes it whenever it had to scan, so
+ * running it once after installing, as the user that installed, puts
+ * it in place. It holds the mtime, size and inode of every jack_*.so
+ * that was in the directory, and is only used while the directory has
+ * exactly those files, all of them unchanged.
+ */
+
+#define JACK_DRIVER_CACHE_NAME  ".jack_drivers.cache"
+
+/* the descriptors from the cache, or NULL if there is no usable one */
+JSList *jack_driver_cache_load (const char *driver_dir);
+
+/* write the descriptors found by scanning `driver_dir' */
+int     jack_driver_cache_save (const char *driver_dir, JSList *descriptors);
+
+/* does `name' look like a driver file? */
+int     jack_driver_file_name (const char *name);
+
+#endif /* __jack_drivercache_h__ */
@@ -24,6 +24,10 @@
 #include <jack/jack.h>
 #include "internal.h"
 #include "driver_interface.h"
+#include "trace.h"
+#include "propstore.h"
+#include "checkpoint.h"
+#include "wsdeque.h"
 
 struct _jack_driver;
 struct _jack_client_internal;
@@ -40,24 +44,87 @@ typedef struct {
 /* The engine keeps an array of these in its local memory. */
 typedef struct _jack_port_internal {
 	struct _jack_port_shared *shared;
+	struct _jack_port_names  *names;
 	JSList                   *connections;
 	jack_port_buffer_info_t  *buffer_info;
+	jack_port_buffer_info_t  *delay_info;   /* pipelined graphs */
+	jack_port_buffer_info_t  *share_info;   /* --share-buffers, if pooled */
+	int early_feeders;                      /* see jack_dag_plan_early_writes() */
+	int early_pending;
 } jack_port_internal_t;
 
+/* A connection, on the lists of both its ports. */
+typedef struct {
+
+	jack_port_internal_t *source;
+	jack_port_internal_t *destination;
+	signed int dir; /* -1 = feedback, 0 = self, 1 = forward */
+	jack_client_internal_t *srcclient;
+	jack_client_internal_t *dstclient;
+	float gain;     /* applied by the destination's mixdown */
+	int muted;
+} jack_connection_internal_t;
+
 /* The engine's internal port type structure. */
 typedef struct _jack_port_buffer_list {
 	pthread_mutex_t lock;                   /* only lock within server */
 	JSList                  *freelist;      /* list of free buffers */
 	jack_port_buffer_info_t *info;          /* jack_buffer_info_t array */
+	unsigned long nbuffers;                 /* entries of info in use */
 } jack_port_buffer_list_t;
 
 typedef struct _jack_reserved_name {
 	jack_uuid_t uuid;
 	char name[JACK_CLIENT_NAME_SIZE];
+	struct _jack_reserved_name *name_next;  /* in engine->reserved_by_name */
+	struct _jack_reserved_name *uuid_next;  /* in engine->reserved_by_uuid */
 } jack_reserved_name_t;
 
+/* buckets of the engine's client and reservation indexes */
+#define JACK_CLIENT_HASH_SIZE 256       /* a power of two */
+
+/* One step of the serial execution plan: an internal client, or the
+   first external client of a chained subgraph. */
+typedef struct _jack_exec_step {
+	struct _jack_client_internal *client;
+	jack_client_control_t *control;
+	jack_activation_t *start_act;   /* NULL: write to subgraph_start_fd */
+	int internal;
+	int decimated;                  /* only when client->ring_due */
+} jack_exec_step_t;
+
+/* What a cycle needs to know about the clients, compiled from the
+   sorted client list whenever the graph changes, so that the driver
+   thread does not have to walk and test the list itself. `controls'
+   holds every runnable client, in execution order, `steps' the ones
+   the engine has to start, `decimated' the clients whose inputs the
+   engine piles up at the end of every cycle. A plan is never changed
+   once published.
+ */
+typedef struct _jack_exec_plan {
+	unsigned int ncontrols;
+	unsigned int nsteps;
+	unsigned int ndecimated;
+	jack_client_control_t **controls;
+	jack_exec_step_t *steps;
+	struct _jack_client_internal **decimated;
+} jack_exec_plan_t;
+
+/* a disconnection made while unlinking a failed client, announced
+   once the graph is running again, see jack_remove_clients() */
+typedef struct _jack_disconnect_notice {
+	jack_uuid_t src_client;
+	jack_uuid_t dst_client;
+	jack_port_id_t src;
+	jack_port_id_t dst;
+} jack_disconnect_notice_t;
+
 #define JACKD_WATCHDOG_TIMEOUT 10000
 #define JACKD_CLIENT_EVENT_TIMEOUT 2000
+#define JACKD_SESSION_REPLY_TIMEOUT 60000
+
+/* frame timer DLL bandwidth unless --dll-bandwidth says otherwise, Hz */
+#define JACK_DLL_BANDWIDTH 0.125f
 
 /* The main engine structure in local memory. */
 struct _jack_engine {
@@ -70,6 +137,47 @@ struct _jack_engine {
 
 	JSList                *slave_drivers;
 
+	/* jack_slave_io_t for each slave driver, in the same order */
+	JSList                *slave_io;
+	int slave_threads;                      /* slave I/O on helper threads */
+
+	/* jack_worker_t for each thread that runs internal clients
+	   during parallel execution */
+	JSList                *workers;
+	unsigned int nworkers;                  /* --internal-threads */
+
+	/* with direct activation, internal clients are shared out
+	   through work-stealing deques: [0] is the engine thread's,
+	   then one for each worker */
+	jack_wsdeque_t        *steal_deques;
+	unsigned int nsteal_deques;
+	volatile int32_t steal_left;            /* internal clients to finish */
+	volatile int32_t steal_sleeping;        /* engine waits on its slot */
+	jack_nframes_t steal_nframes;
+
+	/* where in its batch the next decimated client starts, so that
+	   they do not all wake in the same cycle */
+	unsigned int ring_stagger;
+
+	jack_time_t driver_io_usecs;            /* master read + write */
+
+	jack_time_t cycle_end_at;
+
+	/* port buffers have room for port_buffer_frames, the larger of
+	   the buffer size and max_buffer_size (--max-buffer-size) */
+	jack_nframes_t max_buffer_size;
+	jack_nframes_t port_buffer_frames;
+
+	/* --pm-qos: the open /dev/cpu_dma_latency while the driver runs
+	   realtime, or -1, and the latency last written to it */
+	int pm_qos;
+	int pm_qos_fd;
+	int32_t pm_qos_usecs;
+
+	/* bandwidth of the frame timer DLL once it has locked, in Hz
+	   (--dll-bandwidth) */
+	float dll_bandwidth;
+
 	/* these are "callbacks" made by the driver backend */
 	int (*set_buffer_size)(struct _jack_engine *, jack_nframes_t frames);
 	int (*set_sample_rate)(struct _jack_engine *, jack_nframes_t frames);
@@ -97,13 +205,24 @@ struct _jack_engine {
 
 	jack_shm_info_t control_shm;
 
+	/* the control blocks of external clients, see
+	   JACK_CLIENT_TABLE_MAX, and which of its slots are taken */
+
+	jack_shm_info_t client_table_shm;
+	char client_table_used[JACK_CLIENT_TABLE_MAX];
+
 	/* address-space local port buffer and segment info,
 	   indexed by the port type_id
 	 */
 	jack_port_buffer_list_t port_buffers[JACK_MAX_PORT_TYPES];
 	jack_shm_info_t port_segment[JACK_MAX_PORT_TYPES];
 
-	unsigned int port_max;
+	unsigned int port_max;          /* current size of the port table */
+	int hugepages;                  /* back port buffers with huge pages */
+	int share_buffers;              /* pool serial audio outputs by lifetime */
+	JSList *share_pool;             /* the audio buffers they use then */
+	jack_port_table_t port_table;
+	unsigned int port_hash_deleted; /* tombstones in the port name index */
 	pthread_t server_thread;
 
 	int fds[2];
@@ -111,6 +230,7 @@ struct _jack_engine {
 	size_t pfd_size;
 	size_t pfd_max;
 	struct pollfd  *pfd;
+	int epoll_fd;                   /* server thread, with epoll; else -1 */
 	char fifo_prefix[PATH_MAX + 1];
 	int            *fifo;
 	unsigned long fifo_size;
@@ -118,6 +238,11 @@ struct _jack_engine {
 	/* session handling */
 	int session_reply_fd;
 	int session_pending_replies;
+	jack_time_t session_started;
+	jack_time_t session_deadline;   /* for the delayed replies */
+	int session_replies;
+	jack_time_t session_slowest_usecs;
+	char session_slowest[JACK_CLIENT_NAME_SIZE];
 
 	unsigned long external_client_cnt;
 	int rtpriority;
@@ -125,18 +250,39 @@ struct _jack_engine {
 	volatile char stop_freewheeling;
 	jack_uuid_t fwclient;
 	pthread_t freewheel_thread;
+	jack_nframes_t freewheel_period;        /* 0: keep the buffer size */
+	int freewheel_parallel;                 /* run the graph in parallel */
+	jack_nframes_t saved_buffer_size;       /* while freewheeling */
+	int saved_parallel;
+
+	/* --freewheel-keep-driver: leave the drivers running on null
+	   cycles while freewheeling. freewheel_driver_live is set for a
+	   freewheel that does, and freewheel_driver_idle by the driver
+	   thread once it has seen that it is on */
+	int freewheel_keep_driver;
+	int freewheel_driver_live;
+	volatile int freewheel_driver_idle;
 	char verbose;
 	char do_munlock;
 	const char     *server_name;
 	char temporary;
 	int reordered;
 	int feedbackcount;
+
+	/* connection changes not yet announced as a graph epoch */
+	int graph_epoch_pending;
+	jack_time_t graph_epoch_deadline;
+
 	int removing_clients;
+	int defer_disconnect_notices;
+	JSList *disconnect_notices;     /* of jack_disconnect_notice_t */
 	pid_t wait_pid;
 	int nozombies;
 	int timeout_count_threshold;
 	volatile int problems;
 	volatile int timeout_count;
+	jack_time_t late_since;         /* when a cycle was given up on for a
+					   late client, 0: none. driver thread */
 	volatile int new_clients_allowed;
 
 	/* these lists are protected by `client_lock' */
@@ -144,8 +290,17 @@ struct _jack_engine {
 	JSList         *clients_waiting;
 	JSList         *reserved_client_names;
 
+	/* clients and reserved_client_names, chained by name and by
+	   UUID, see jack_client_hash_insert(). changed by the server
+	   thread, under the graph lock */
+	jack_client_internal_t *clients_by_name[JACK_CLIENT_HASH_SIZE];
+	jack_client_internal_t *clients_by_uuid[JACK_CLIENT_HASH_SIZE];
+	jack_reserved_name_t *reserved_by_name[JACK_CLIENT_HASH_SIZE];
+	jack_reserved_name_t *reserved_by_uuid[JACK_CLIENT_HASH_SIZE];
+
 	jack_port_internal_t    *internal_ports;
 	jack_client_internal_t  *timebase_client;
+	JSList                  *sync_clients;  /* the active_slowsync ones */
 	jack_port_buffer_info_t *silent_buffer;
 	jack_client_internal_t  *current_client;
 
@@ -159,8 +314,70 @@ struct _jack_engine {
 	float max_usecs;
 	float spare_usecs;
 
+	/* the load of the last JACK_XRUN_LOAD_HISTORY cycles, for
+	   the xrun reports; the oldest is at load_history_next */
+	float load_history[JACK_XRUN_LOAD_HISTORY];
+	unsigned int load_history_next;
+
 	int first_wakeup;
 
+	/* parallel execution of independent parts of the graph.
+	   the dag_* members are rebuilt by jack_rechain_graph()
+	   and protected by `client_lock'.
+	 */
+	int parallel;
+	jack_exec_plan_t *volatile plan;   /* see jack_engine_compile_plan() */
+	JSList                  *dag_clients;
+	jack_client_internal_t **dag_ready;
+	jack_client_internal_t **dag_order;     /* dag_clients, as an array */
+	unsigned int dag_nclients;
+	jack_client_internal_t **dag_running;
+	struct pollfd           *dag_pfd;
+	unsigned int dag_size;
+	unsigned int dag_mark;
+	int dag_direct;         /* clients wake their successors themselves */
+
+	/* pipelined execution: the plan is cut into pipeline_stages
+	   stages (0 or 1: not pipelined) that run side by side, each
+	   on what the one before it made a cycle earlier. the plan
+	   has dag_nstages of them.
+	 */
+	unsigned int pipeline_stages;
+	unsigned int dag_nstages;
+
+	/* driver playback ports written as soon as their feeders are
+	   done, see jack_dag_plan_early_writes() */
+	JSList *early_ports;
+	jack_nframes_t early_nframes;
+
+	/* reach sets of the clients, see jack_reach_attach() */
+	bitset_t reach_used;
+	unsigned int reach_size;
+	int reach_dirty;
+
+	/* which slots of control->activation are owned by a client */
+	char activation_used[JACK_ACTIVATION_MAX];
+
+	/* the driver thread's wait for the graph, with --spin-wait */
+	jack_activation_spin_t graph_spin;
+
+	/* cycle trace, NULL unless running with --trace */
+	jack_trace_t *trace;
+
+	/* metadata, published in control->propstore_index */
+	jack_propstore_server_t *propstore;
+
+	/* the graph kept across restarts, NULL without --checkpoint-file */
+	jack_checkpoint_t *checkpoint;
+
+	/* cpu affinity. the driver and freewheel threads run on
+	   engine_cpus. client_cpus are the cpus suggested to clients
+	   for their process threads, ordered by shared L2 cache.
+	 */
+	char *engine_cpus;
+	int *client_cpus;
+	unsigned int nclient_cpus;
+
 #ifdef JACK_USE_MACH_THREADS
 	/* specific resources for server/client real-time thread communication */
 	mach_port_t servertask, bp;
@@ -182,7 +399,20 @@ jack_engine_t  *jack_engine_new(int real_time, int real_time_priority,
 				int verbose, int client_timeout,
 				unsigned int port_max,
 				pid_t waitpid, jack_nframes_t frame_time_offset, int nozombies,
-				int timeout_count_threshold,
+				int timeout_count_threshold, int parallel,
+				unsigned int pipeline_stages,
+				int activation_type, const char *trace_file,
+				jack_nframes_t freewheel_period,
+				int freewheel_parallel, int hugepages,
+				uint32_t load_window, const char *engine_cpus,
+				const char *client_cpus, int deadline,
+				int slave_threads, jack_nframes_t max_buffer_size,
+				int pm_qos, float dll_bandwidth,
+				unsigned int internal_threads,
+				int freewheel_keep_driver,
+				const char *metadata_file, int share_buffers,
+				const char *checkpoint_file,
+				unsigned int spin_usecs, int cpu_times,
 				JSList *drivers);
 void            jack_engine_delete(jack_engine_t *);
 int             jack_run(jack_engine_t *engine);
@@ -193,6 +423,9 @@ int             jack_engine_load_driver(jack_engine_t *engine,
 int             jack_engine_load_slave_driver(jack_engine_t *engine,
 					      jack_driver_desc_t * driver_desc,
 					      JSList * driver_params);
+int             jack_engine_switch_master(jack_engine_t *engine,
+					  jack_driver_desc_t * driver_desc,
+					  JSList * driver_params);
 void            jack_dump_configuration(jack_engine_t *engine, int take_lock);
 
 /* private engine functions */
@@ -200,6 +433,26 @@ void            jack_engine_reset_rolling_usecs(jack_engine_t *engine);
 int             internal_client_request(void* ptr, jack_request_t *request);
 int             jack_get_fifo_fd(jack_engine_t *engine,
 				 unsigned int which_fifo);
+int             jack_activation_slot_alloc(jack_engine_t *engine);
+void            jack_activation_slot_free(jack_engine_t *engine, int slot);
+int             jack_timing_slot_alloc(jack_engine_t *engine, const char *name);
+void            jack_timing_slot_free(jack_engine_t *engine, int slot);
+void            jack_checkpoint_reconnect(jack_engine_t *engine);
+int             jack_client_table_slot_alloc(jack_engine_t *engine);
+void            jack_client_table_slot_free(jack_engine_t *engine, int slot);
+void            jack_engine_watch_client(jack_engine_t *engine,
+					 jack_client_internal_t *client);
+void            jack_engine_unwatch_client(jack_engine_t *engine,
+					   jack_client_internal_t *client);
+void            jack_engine_watch_pid(jack_engine_t *engine,
+				      jack_client_internal_t *client);
+int             jack_session_finish(jack_engine_t *engine);
+void            jack_send_disconnect_notices(jack_engine_t *engine);
+void            jack_engine_compile_plan(jack_engine_t *engine);
+void            jack_reach_attach(jack_engine_t *engine,
+				  jack_client_internal_t *client);
+void            jack_reach_detach(jack_engine_t *engine,
+				  jack_client_internal_t *client);
 
 extern jack_timer_type_t clock_source;
 
@@ -252,9 +505,18 @@ void    jack_port_clear_connections(jack_engine_t *engine,
 void jack_port_registration_notify (jack_engine_t *, jack_port_id_t, int);
 void    jack_port_release(jack_engine_t *engine, jack_port_internal_t *);
 void    jack_sort_graph(jack_engine_t *engine);
+int     jack_client_ring_layout(jack_engine_t *engine,
+				jack_client_internal_t *client);
+void    jack_client_ring_release(jack_client_internal_t *client);
+void    jack_dag_remove_client(jack_engine_t *engine,
+			       jack_client_internal_t *client);
 int     jack_stop_freewheeling(jack_engine_t* engine, int engine_exiting);
 jack_client_internal_t *
 jack_client_by_name(jack_engine_t *engine, const char *name);
+jack_client_internal_t *
+jack_client_lookup_name(jack_engine_t *engine, const char *name);
+void    jack_client_reservation_add(jack_engine_t *engine,
+				    jack_reserved_name_t *reservation);
 
 int  jack_deliver_event(jack_engine_t *, jack_client_internal_t *, const jack_event_t *, ...);
 
@@ -267,4 +529,10 @@ jack_drivers_start(jack_engine_t *engine);
 int
 jack_add_slave_driver(jack_engine_t *engine, struct _jack_driver *driver);
 
+/* the counter called `name' in the engine segment, added (at zero) if
+   it is not there yet; NULL if there is no room. for drivers to
+   publish their statistics, see jack_counter_t. */
+volatile uint64_t *
+jack_engine_counter(jack_engine_t *engine, const char *name);
+
 #endif /* __jack_engine_h__ */
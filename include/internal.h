@@ -27,12 +27,15 @@
 #define __jack_internal_h__
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include <dlfcn.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
 
 /* Needed by <sysdeps/time.h> */
 extern void jack_error(const char *fmt, ...);
@@ -53,14 +56,30 @@ extern jack_thread_creator_t jack_thread_creator;
 typedef enum {
 	JACK_TIMER_SYSTEM_CLOCK,
 	JACK_TIMER_HPET,
+	JACK_TIMER_TSC,
 } jack_timer_type_t;
 
+/* The server calibrates the TSC against the system clock once and
+   publishes the result, so that every process turns cycle counts into
+   the same microseconds:
+
+	usecs = usecs_base + (((tsc - tsc_base) * mult) >> 32)
+ */
+typedef struct {
+	uint64_t tsc_base;
+	uint64_t usecs_base;
+	uint32_t mult;
+} POST_PACKED_STRUCTURE jack_tsc_clock_t;
+
 void        jack_init_time();
 void jack_set_clock_source (jack_timer_type_t);
+int  jack_tsc_clock_init (jack_tsc_clock_t *tsc, int calibrate);
 const char* jack_clock_source_name (jack_timer_type_t);
 
 #include <sysdeps/time.h>
 #include "atomicity.h"
+#include "activation.h"
+#include "bitset.h"
 
 #ifdef JACK_USE_MACH_THREADS
 #include <sysdeps/mach_port.h>
@@ -126,6 +145,14 @@ const char* jack_clock_source_name (jack_timer_type_t);
 typedef struct _jack_engine jack_engine_t;
 typedef struct _jack_request jack_request_t;
 
+/* the port table grows up to this many times its initial size */
+#define JACK_PORT_SEGMENTS_MAX  32
+
+/* AttachPortSegment for a port table segment rather than a buffer
+   segment: x.n is the segment number.
+ */
+#define JACK_PORT_TABLE_SEGMENT ((jack_port_type_id_t)-1)
+
 typedef void * dlhandle;
 
 typedef enum {
@@ -142,15 +169,120 @@ typedef struct {
 	volatile jack_time_t next_wakeup;
 	volatile float period_usecs;
 	volatile int32_t initialized;
+	volatile float error_usecs;     /* smoothed |wakeup - prediction| */
 	volatile uint32_t guard2;
 
 	/* not accessed by clients */
 
 	int32_t reset_pending;          /* xrun happened, deal with it */
-	float filter_omega;             /* set once, never altered */
+	float filter_omega;             /* 2 pi * bandwidth * period */
+	float bandwidth;                /* Hz, see jack_run_cycle() */
 
 } POST_PACKED_STRUCTURE jack_frame_timer_t;
 
+/* DSP load distribution.
+ *
+ * Alongside the smoothed cpu_load, the engine keeps a histogram of the
+ * load of every cycle (the time from the start of the cycle to the end
+ * of the last client, as a percentage of the period), in the same two
+ * halves as the per-client timing below: one half of `window' cycles
+ * is being filled while the other holds the previous window. Buckets
+ * are JACK_LOAD_STEP percent wide; the last one also counts every cycle
+ * that overran by more. `seq' is odd while the engine updates it.
+ */
+#define JACK_LOAD_BUCKETS 256
+#define JACK_LOAD_STEP    0.5f
+
+typedef struct {
+	volatile uint32_t seq;
+	uint32_t window;                /* cycles per half */
+	uint32_t current;
+	uint32_t cycles[2];
+	float max[2];
+	uint32_t hist[2][JACK_LOAD_BUCKETS];
+} POST_PACKED_STRUCTURE jack_load_stats_t;
+
+static inline int
+jack_load_bucket (float load)
+{
+	int b = (int)(load / JACK_LOAD_STEP);
+
+	if (b < 0) {
+		return 0;
+	}
+	return b < JACK_LOAD_BUCKETS ? b : JACK_LOAD_BUCKETS - 1;
+}
+
+/* Named counters in the engine segment.
+ *
+ * Drivers publish their own statistics (packets lost, resyncs, ...)
+ * here through jack_engine_counter(), so that any client can read
+ * them the way it reads cpu_load. Each value is a single word written
+ * by one thread; on 32 bit machines a reader may see a torn update,
+ * which a monitoring scrape can live with.
+ */
+#define JACK_COUNTERS_MAX      32
+#define JACK_COUNTER_NAME_SIZE 48
+
+typedef struct {
+	char name[JACK_COUNTER_NAME_SIZE];
+	volatile uint64_t value;
+} POST_PACKED_STRUCTURE jack_counter_t;
+
+/* Connection changes, for clients that take them a graph epoch at a
+ * time instead of as one PortConnected event per connection (see
+ * jack_set_graph_changed_callback()). The engine appends an entry for
+ * every connection made or broken, stamped with the epoch it will be
+ * announced in, then bumps graph_changes_head. graph_epoch is bumped
+ * when the epoch is announced, after all of its entries are written.
+ */
+#define JACK_GRAPH_CHANGES_MAX 1024     /* a power of two */
+
+typedef struct {
+	uint32_t epoch;
+	jack_port_id_t source;
+	jack_port_id_t destination;
+	uint32_t connected;
+} POST_PACKED_STRUCTURE jack_graph_change_t;
+
+typedef int (*JackGraphChangedCallback)(uint32_t epoch, void *arg);
+
+/* Transport events.
+ *
+ * What changed in the transport for the current cycle, with the frame
+ * offset in the cycle at which it takes effect, so that process() can
+ * react without comparing whole positions, and so that a locate armed
+ * with jack_transport_locate_at() can land on an exact sample. The
+ * engine writes the list at the end of the previous cycle, together
+ * with current_time and under the same position_seq. The types belong
+ * in <jack/transport.h>.
+ */
+#define JACK_TRANSPORT_EVENTS_MAX 8
+
+typedef enum {
+	JackTransportEventStart,        /* started rolling */
+	JackTransportEventStop,         /* stopped rolling */
+	JackTransportEventLocate,       /* position jumped to `frame' */
+	JackTransportEventTempo         /* BBT tempo or meter changed */
+} jack_transport_event_type_t;
+
+typedef struct {
+	jack_transport_event_type_t type;
+	jack_nframes_t offset;          /* frames into the cycle */
+	jack_nframes_t frame;           /* transport frame at `offset' */
+	float beats_per_bar;            /* JackTransportEventTempo */
+	float beat_type;
+	double beats_per_minute;
+} POST_PACKED_STRUCTURE jack_transport_event_t;
+
+/* a jack_transport_locate_at() request, whole if the uniques match */
+typedef struct {
+	volatile jack_unique_t unique_1;
+	volatile jack_nframes_t when;
+	volatile jack_nframes_t frame;
+	volatile jack_unique_t unique_2;
+} POST_PACKED_STRUCTURE jack_locate_at_t;
+
 /* JACK engine shared memory data structure. */
 typedef struct {
 
@@ -158,9 +290,18 @@ typedef struct {
 	volatile transport_command_t transport_cmd;
 	transport_command_t previous_cmd;       /* previous transport_cmd */
 	jack_position_t current_time;           /* position for current cycle */
+	volatile uint32_t position_seq;         /* odd while current_time changes */
 	jack_position_t pending_time;           /* position for next cycle */
 	jack_position_t request_time;           /* latest requested position */
 	jack_unique_t prev_request;             /* previous request unique ID */
+	uint32_t transport_nevents;             /* under position_seq */
+	jack_transport_event_t transport_events[JACK_TRANSPORT_EVENTS_MAX];
+	jack_locate_at_t locate_at_request;     /* latest jack_transport_locate_at() */
+	jack_unique_t prev_locate_at;           /* w: engine */
+	jack_nframes_t locate_at_when;          /* w: engine, while armed */
+	jack_nframes_t locate_at_frame;
+	int8_t locate_at_armed;
+	int8_t pending_jump;                    /* next cycle jumps inside its period */
 	volatile _Atomic_word seq_number;       /* unique ID sequence number */
 	int8_t new_pos;                         /* new position this cycle */
 	int8_t pending_pos;                     /* new position request pending */
@@ -172,6 +313,7 @@ typedef struct {
 	jack_frame_timer_t frame_timer;
 	int32_t internal;
 	jack_timer_type_t clock_source;
+	jack_tsc_clock_t tsc_clock;             /* if clock_source is JACK_TIMER_TSC */
 	pid_t engine_pid;
 	jack_nframes_t buffer_size;
 	int8_t real_time;
@@ -180,14 +322,46 @@ typedef struct {
 	int32_t client_priority;
 	int32_t max_client_priority;
 	int32_t has_capabilities;
+	int8_t deadline;                        /* realtime threads use SCHED_DEADLINE */
+#ifdef JACK_USE_MACH_THREADS
+	int32_t workgroup;                      /* bootstrap number of the audio
+						   device's os_workgroup, -1: none */
+#endif
 	float cpu_load;
+	jack_load_stats_t load_stats;
+	float freewheel_rate;                   /* frames/sec of the last freewheel run */
 	float xrun_delayed_usecs;
 	float max_delayed_usecs;
-	uint32_t port_max;
+	volatile uint64_t cycles;               /* completed process cycles */
+	volatile uint32_t cycle_serial;         /* bumped as each cycle starts */
+	volatile uint32_t xruns;
+	volatile uint32_t driver_wait_usecs;    /* end of a cycle to the next wakeup */
+	volatile uint32_t driver_process_usecs; /* master read + write, last cycle */
+	volatile uint32_t driver_recovery_usecs; /* master, its last xrun, 0 if it doesn't say */
+	volatile uint32_t n_counters;
+	jack_counter_t counters[JACK_COUNTERS_MAX];
+	volatile uint32_t port_max;             /* current size of the port table */
+	uint32_t port_segment_size;             /* ports per port table segment */
+	volatile uint32_t n_port_segments;
+	jack_shm_registry_index_t port_segment_index[JACK_PORT_SEGMENTS_MAX];
+	jack_shm_registry_index_t port_names_index[JACK_PORT_SEGMENTS_MAX];
+	uint32_t port_hash_size;                /* entries, a power of two */
+	uint32_t port_hash_offset;              /* from the start of this segment */
+	volatile uint32_t port_generation;      /* bumped when ports come, go or are renamed */
+	volatile uint32_t graph_epoch;          /* last epoch announced */
+	volatile uint32_t graph_changes_head;   /* entries ever written */
+	volatile jack_graph_change_t graph_changes[JACK_GRAPH_CHANGES_MAX];
+	uint32_t timing_offset;                 /* jack_client_timing_t[JACK_TIMING_MAX] */
+	uint32_t xrun_reports_offset;           /* jack_xrun_report_t[JACK_XRUN_REPORTS] */
+	volatile jack_shm_registry_index_t propstore_index; /* metadata, see propstore.h */
 	int32_t engine_ok;
+	int32_t activation_type;                /* jack_activation_type_t */
+	int32_t spin_usecs;                     /* --spin-wait, 0: off */
+	int32_t cpu_times;                      /* --cpu-times: sample process() */
+	jack_activation_t activation[JACK_ACTIVATION_MAX] __attribute__((aligned (64)));
 	jack_port_type_id_t n_port_types;
 	jack_port_type_info_t port_types[JACK_MAX_PORT_TYPES];
-	jack_port_shared_t ports[0];
+	jack_port_shared_t ports[0];            /* port table segment 0 */
 
 } POST_PACKED_STRUCTURE jack_control_t;
 
@@ -208,11 +382,18 @@ typedef enum  {
 	SaveSession,
 	LatencyCallback,
 	PropertyChange,
-	PortRename
+	PortRename,
+	GraphChanged,
+	EventsQueued,           /* look at jack_client_control_t.event_queue */
+	PortsRegistered,        /* x.n ports, listed in z.port_ids */
+	PortsUnregistered
 } JackEventType;
 
 const char* jack_event_type_name (JackEventType);
 
+/* ports listed in one PortsRegistered or PortsUnregistered event */
+#define JACK_EVENT_PORT_IDS (JACK_PORT_NAME_SIZE / sizeof(jack_port_id_t))
+
 typedef struct {
 	JackEventType type;
 	union {
@@ -231,9 +412,45 @@ typedef struct {
 	union {
 		char other_name[JACK_PORT_NAME_SIZE];
 		jack_property_change_t property_change;
+		int32_t next_slot;      /* GraphReordered: activation slot to wake */
+		jack_port_id_t port_ids[JACK_EVENT_PORT_IDS];
 	} z;
 } POST_PACKED_STRUCTURE jack_event_t;
 
+/* Asynchronous event delivery.
+ *
+ * Events that only notify a client, and whose result the engine
+ * does not need, are put into a ring in the client's control block
+ * instead of being written to its event socket one at a time
+ * followed by a wait for the reply. When the ring goes from idle to
+ * non-empty the engine sends a single EventsQueued event on the
+ * socket, which is not answered. The client clears
+ * `event_signalled', handles everything up to `event_head' and then
+ * moves `event_tail' forward in one step. Events that need an answer,
+ * or that do not fit, still go through the socket; since they are
+ * written after any EventsQueued event, the client has emptied the
+ * ring by the time it gets to them.
+ *
+ * A client that handles its events on a separate thread (see
+ * jack_event_thread_work() in libjack/client.c) sets `event_thread'.
+ * The engine then wakes that thread with a futex on `event_signalled'
+ * instead of the socket, and waits for room rather than falling back
+ * to the socket when the ring is full.
+ */
+#define JACK_EVENT_QUEUE_SIZE     64            /* a power of two */
+#define JACK_EVENT_QUEUE_KEY_SIZE 128
+
+/* the most periods a client can have batched into one wakeup */
+#define JACK_DECIMATION_MAX       64
+
+/* the most threads a client worker pool can be granted */
+#define JACK_POOL_MAX_THREADS     16
+
+typedef struct {
+	jack_event_t event;
+	char key[JACK_EVENT_QUEUE_KEY_SIZE];    /* PropertyChange key */
+} POST_PACKED_STRUCTURE jack_queued_event_t;
+
 typedef enum {
 	ClientInternal, /* connect request just names .so */
 	ClientDriver,   /* code is loaded along with driver */
@@ -252,8 +469,6 @@ typedef volatile struct {
 
 	jack_uuid_t uuid;                       /* w: engine r: engine and client */
 	volatile jack_client_state_t state;     /* w: engine and client r: engine */
-	volatile char name[JACK_CLIENT_NAME_SIZE];
-	volatile char session_command[JACK_PORT_NAME_SIZE];
 	volatile jack_session_flags_t session_flags;
 	volatile ClientType type;               /* w: engine r: engine and client */
 	volatile int8_t active;                 /* w: engine r: engine and client */
@@ -270,7 +485,13 @@ typedef volatile struct {
 	volatile uint64_t signalled_at;
 	volatile uint64_t awake_at;
 	volatile uint64_t finished_at;
+	volatile uint32_t process_cpu_usecs;    /* w: client r: engine; cpu time from awake_at to finished_at */
+	volatile uint32_t process_preemptions;  /* w: client r: engine; involuntary switches in that time */
 	volatile int32_t last_status;        /* w: client, r: engine and client */
+	volatile int32_t activation_slot;    /* w: engine r: engine and client */
+	volatile int32_t timing_slot;        /* w: engine r: engine and client */
+	volatile int32_t activation_nsuccessors; /* w: engine r: client */
+	int32_t activation_successors[JACK_ACTIVATION_MAX_SUCCESSORS]; /* w: engine r: client */
 
 	/* indicators for whether callbacks have been set for this client.
 	   We do not include ptrs to the callbacks here (or their arguments)
@@ -296,6 +517,46 @@ typedef volatile struct {
 	volatile uint8_t latency_cbset;
 	volatile uint8_t property_cbset;
 	volatile uint8_t port_rename_cbset;
+	volatile uint8_t graph_changed_cbset;
+	volatile uint8_t process_async;         /* w: client r: engine; runs
+						   one period behind the graph */
+
+	/* kept clear of the words above, which the engine and the
+	   client touch every cycle */
+	volatile char name[JACK_CLIENT_NAME_SIZE];
+	volatile char session_command[JACK_PORT_NAME_SIZE];
+
+	/* asynchronous events, see jack_queued_event_t */
+	volatile uint32_t event_head;           /* w: engine r: client */
+	volatile uint32_t event_tail;           /* w: client r: engine */
+	volatile int32_t event_signalled;       /* w: engine and client */
+	volatile int32_t event_thread;          /* w: client r: engine */
+	jack_queued_event_t event_queue[JACK_EVENT_QUEUE_SIZE]; /* w: engine r: client */
+
+	/* the cpu the engine suggests for the process thread, -1: none */
+	volatile int32_t suggested_cpu;         /* w: engine r: client */
+
+	/* the worker pool threads the engine granted, out of the cpus
+	   left over by the engine's own threads and other pools, and a
+	   cpu for each, following suggested_cpu in client_cpus (-1: none) */
+	volatile int32_t pool_threads;          /* w: engine r: client */
+	volatile int32_t pool_cpus[JACK_POOL_MAX_THREADS]; /* w: engine r: client */
+
+	/* SCHED_DEADLINE runtime asked for, usecs per period, 0 for
+	   JACK_DEADLINE_CLIENT_SHARE */
+	volatile uint32_t deadline_budget;      /* w: client r: engine */
+
+	/* batched wakeups, see jack_set_process_decimation(): woken
+	   once every `decimation' cycles (0: every cycle), its inputs
+	   read from the segment at ring_index, which the engine lays
+	   out anew (and bumps ring_serial) when the ports or the
+	   period change */
+	volatile uint32_t decimation;           /* w: client r: engine */
+	volatile uint32_t ring_serial;          /* w: engine r: client */
+	volatile jack_shm_registry_index_t ring_index; /* w: engine r: client */
+
+	/* shm request slot, see jack_client_request_slot() */
+	volatile int32_t request_state __attribute__((aligned (4))); /* futex, w: engine and client */
 
 } POST_PACKED_STRUCTURE jack_client_control_t;
 
@@ -319,6 +580,8 @@ typedef struct {
 
 	jack_shm_registry_index_t client_shm_index;
 	jack_shm_registry_index_t engine_shm_index;
+	int32_t client_table_slot;      /* in client_shm_index, -1: that
+					   segment is the client's alone */
 
 	char fifo_prefix[PATH_MAX + 1];
 
@@ -383,9 +646,32 @@ typedef enum {
 	SessionReply = 31,
 	SessionHasCallback = 32,
 	PropertyChangeNotify = 33,
-	PortNameChanged = 34
+	PortNameChanged = 34,
+	ConnectPortsBatch = 35,
+	DisconnectPortsBatch = 36,
+	RegisterPorts = 37,
+	UnRegisterPorts = 38,
+	SetConnectionGain = 39,
+	SetProperty = 40,
+	RemoveProperties = 41,
+	RemoveAllProperties = 42,
+	CreateRingbuffer = 43,
+	OpenRingbuffer = 44,
+	DestroyRingbuffer = 45,
+	SetWorkerPool = 46
 } RequestType;
 
+/* what a SetConnectionGain request changes */
+enum {
+	JackConnectionGain = 0x1,
+	JackConnectionMute = 0x2
+};
+
+/* largest number of port pairs in one ConnectPortsBatch or
+   DisconnectPortsBatch request, and of ports in one RegisterPorts or
+   UnRegisterPorts request */
+#define JACK_PORT_BATCH_MAX 4096
+
 struct _jack_request {
 
 	//RequestType type;
@@ -403,6 +689,13 @@ struct _jack_request {
 			char source_port[JACK_PORT_NAME_SIZE];
 			char destination_port[JACK_PORT_NAME_SIZE];
 		} POST_PACKED_STRUCTURE connect;
+		struct {
+			char source_port[JACK_PORT_NAME_SIZE];
+			char destination_port[JACK_PORT_NAME_SIZE];
+			uint32_t what;
+			float gain;
+			int32_t mute;
+		} POST_PACKED_STRUCTURE connection_gain;
 		struct {
 			char path[JACK_PORT_NAME_SIZE];
 			jack_session_event_type_t type;
@@ -437,12 +730,39 @@ struct _jack_request {
 			char path[PATH_MAX + 1];
 			char init[JACK_LOAD_INIT_LIMIT];
 		} POST_PACKED_STRUCTURE intclient;
+		struct {
+			uint32_t npairs;
+			const char* ports; /* 2 * npairs names of JACK_PORT_NAME_SIZE, source first.
+			                      not delivered inline to server, see oop_client_deliver_request() */
+		} POST_PACKED_STRUCTURE batch;
+		struct {
+			char type[JACK_PORT_TYPE_SIZE];
+			uint32_t flags;
+			jack_shmsize_t buffer_size;
+			jack_uuid_t client_id;
+			uint32_t nports;
+			char* names;                    /* RegisterPorts: nports names of JACK_PORT_NAME_SIZE */
+			jack_port_id_t* port_ids;       /* RegisterPorts: result, UnRegisterPorts: the ports.
+			                                   neither delivered inline, see oop_client_deliver_request() */
+		} POST_PACKED_STRUCTURE port_batch;
 		struct {
 			jack_property_change_t change;
 			jack_uuid_t uuid;
 			size_t keylen;
-			const char* key; /* not delivered inline to server, see oop_client_deliver_request() */
+			const char* key; /* not delivered inline to server, see oop_client_deliver_request().
+			                    SetProperty: "key\0value\0type\0", the type may be empty */
 		} POST_PACKED_STRUCTURE property;
+		struct {
+			char name[JACK_PORT_NAME_SIZE]; /* CreateRingbuffer: the short name,
+			                                   answered with "client:name" */
+			jack_uuid_t client_id;
+			uint32_t size;                  /* answered rounded up */
+			jack_shm_registry_index_t index; /* answered */
+		} POST_PACKED_STRUCTURE ringbuffer;
+		struct {
+			jack_uuid_t client_id;
+			uint32_t nthreads;              /* asked for, 0 releases them */
+		} POST_PACKED_STRUCTURE pool;
 		jack_uuid_t client_id;
 		jack_nframes_t nframes;
 		jack_time_t timeout;
@@ -452,6 +772,419 @@ struct _jack_request {
 	int32_t status;
 } POST_PACKED_STRUCTURE;
 
+/* Shared memory request channel.
+ *
+ * The control block of an external client is followed by a
+ * jack_request_t in the same segment. Instead of writing a whole
+ * request to its socket and reading a whole one back, a client copies
+ * the header and the part of `x' that the request type uses into the
+ * slot, sets request_state to JackRequestPosted and rings the server
+ * with a single byte on the socket. The server thread handles the
+ * request in place, copies the result back the same way, sets
+ * JackRequestDone and wakes the client's futex. Requests that are
+ * followed by more data, or answered with more than the request, keep
+ * using the socket; jack_request_payload() returns -1 for them.
+ */
+enum {
+	JackRequestIdle = 0,
+	JackRequestPosted,
+	JackRequestDone
+};
+
+static inline size_t
+jack_client_control_size (void)
+{
+	return sizeof(jack_client_control_t) + sizeof(jack_request_t);
+}
+
+static inline jack_request_t *
+jack_client_request_slot (jack_client_control_t *ctl)
+{
+	return (jack_request_t*)((char*)ctl + sizeof(jack_client_control_t));
+}
+
+/* external clients get their control block out of one segment the
+   engine maps for all of them, up to JACK_CLIENT_TABLE_MAX, each in a
+   slot of its own cache lines so that no two clients write to the same
+   one; past that, a client gets a segment of its own as before. */
+#define JACK_CLIENT_TABLE_MAX 128
+
+static inline size_t
+jack_client_control_slot_size (void)
+{
+	return (jack_client_control_size () + 63) & ~(size_t)63;
+}
+
+#define jack_request_member_size(m) ((int)sizeof(((jack_request_t*)0)->x.m))
+
+static inline int
+jack_request_payload (uint32_t type)
+{
+	switch (type) {
+	case RegisterPort:
+	case UnRegisterPort:
+	case DisconnectPort:
+	case RecomputeTotalLatency:
+	case GetClientByUUID:           /* answered in x.port_info.name */
+		return jack_request_member_size (port_info);
+	case ConnectPorts:
+	case DisconnectPorts:
+	case PortNameChanged:
+		return jack_request_member_size (connect);
+	case SetConnectionGain:
+		return jack_request_member_size (connection_gain);
+	case ActivateClient:
+	case DeactivateClient:
+	case ResetTimeBaseClient:
+	case SetSyncClient:
+	case ResetSyncClient:
+	case FreeWheel:
+		return jack_request_member_size (client_id);
+	case SetTimeBaseClient:
+		return jack_request_member_size (timebase);
+	case SetSyncTimeout:
+		return jack_request_member_size (timeout);
+	case SetBufferSize:
+		return jack_request_member_size (nframes);
+	case SetClientCapabilities:
+		return jack_request_member_size (cap_pid);
+	case GetUUIDByClientName:       /* answered in x.client_id */
+	case SessionHasCallback:
+		return jack_request_member_size (name);
+	case ReserveName:
+		return jack_request_member_size (reservename);
+	case CreateRingbuffer:
+	case OpenRingbuffer:
+	case DestroyRingbuffer:
+		return jack_request_member_size (ringbuffer);
+	case SetWorkerPool:
+		return jack_request_member_size (pool);
+	case StopFreeWheel:
+	case RecomputeTotalLatencies:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* Shared memory ringbuffers.
+ *
+ * A client can ask the server for a ringbuffer of its own, named
+ * "client:name", that any other client can then open by that name, to
+ * pass data to it outside of the graph. The server allocates the
+ * segment, keeps it for as long as the owner is there and sets
+ * `closed' once it is not. The segment starts with this header and the
+ * data follows; the pointers run freely and are masked by size - 1, so
+ * that all of `size' can be used. One thread writes and one reads,
+ * which ones is up to the clients; see libjack/shmringbuffer.c.
+ */
+
+#define JACK_SHM_RINGBUFFER_MAGIC 0x4a524221      /* "JRB!" */
+#define JACK_SHM_RINGBUFFER_MAX   (256 * 1024 * 1024)
+#define JACK_SHM_RINGBUFFERS_PER_CLIENT 16
+
+typedef struct {
+	uint32_t magic;
+	uint32_t size;                  /* of the data, a power of two */
+	volatile uint32_t closed;       /* the owner went away */
+	jack_uuid_t owner;
+	char pad0[44];
+	volatile uint32_t write_ptr;    /* only the writer stores either one */
+	char pad1[60];
+	volatile uint32_t read_ptr;     /* ... and the reader this one */
+	char pad2[60];
+} POST_PACKED_STRUCTURE jack_shm_ringbuffer_shared_t;
+
+static inline char *
+jack_shm_ringbuffer_data (jack_shm_ringbuffer_shared_t *shared)
+{
+	return (char*)shared + sizeof(jack_shm_ringbuffer_shared_t);
+}
+
+/* Activation slot lookup in the engine's shared memory. A slot of -1 means
+ * "use the FIFO".
+ */
+static inline jack_activation_t *
+jack_activation_slot (jack_control_t *ctl, int32_t slot)
+{
+	if (ctl->activation_type != JackActivationFutex ||
+	    slot < 0 || slot >= JACK_ACTIVATION_MAX) {
+		return NULL;
+	}
+	return &ctl->activation[slot];
+}
+
+/* The calling thread's cpu time, and the times it was switched out
+   against its will, sampled where a client wakes for a cycle and where
+   it finishes when the server runs with --cpu-times. The difference
+   between the cpu time and the wall time of process() is the time it
+   was kept off its cpu, which tells a client that computes for too
+   long from one that is starved. Neither call has a fast path, so
+   this costs four system calls per client and cycle. */
+static inline void
+jack_thread_usage (uint64_t *cpu_nsecs, uint32_t *preemptions)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+#endif
+#ifdef RUSAGE_THREAD
+	struct rusage ru;
+#endif
+
+	*cpu_nsecs = 0;
+	*preemptions = 0;
+
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		*cpu_nsecs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+#endif
+#ifdef RUSAGE_THREAD
+	if (getrusage (RUSAGE_THREAD, &ru) == 0) {
+		*preemptions = (uint32_t)ru.ru_nivcsw;
+	}
+#endif
+}
+
+/* Per-client cycle timing.
+ *
+ * The engine keeps a histogram of each client's wake latency (from the
+ * moment it could run to the moment it woke up) and of its process
+ * duration, along with the cpu time process() used and how many cycles
+ * it was preempted in, in an array of JACK_TIMING_MAX entries in its shared
+ * memory segment, so that any client can read them without a server
+ * round trip (see libjack/timing.c). Every entry has two halves of
+ * load_stats.window cycles (JACK_TIMING_WINDOW unless jackd was started
+ * with --load-window): one is being filled while the other holds
+ * the previous window, so readers always see between one and two
+ * windows' worth of cycles. `seq' is odd while the engine updates the
+ * entry.
+ *
+ * Bucket 0 counts 0 usecs; after that there are two buckets per power
+ * of two, see jack_timing_bucket().
+ */
+#define JACK_TIMING_MAX     256
+#define JACK_TIMING_BUCKETS 32
+#define JACK_TIMING_WINDOW  1024       /* default window, cycles */
+
+typedef struct {
+	volatile uint32_t seq;
+	int32_t in_use;
+	char name[JACK_CLIENT_NAME_SIZE];
+	uint32_t current;
+	uint32_t cycles[2];
+	uint32_t wake_max[2];
+	uint32_t process_max[2];
+	uint64_t process_total[2];      /* usecs spent in process() */
+	uint64_t period_total[2];       /* usecs of the periods it ran in */
+	uint64_t cpu_total[2];          /* usecs of cpu time in process() */
+	uint32_t preempted[2];          /* cycles it was switched out in */
+	uint32_t wake[2][JACK_TIMING_BUCKETS];
+	uint32_t process[2][JACK_TIMING_BUCKETS];
+} jack_client_timing_t;
+
+static inline int
+jack_timing_bucket (uint64_t usecs)
+{
+	int log2, b;
+
+	if (usecs == 0) {
+		return 0;
+	}
+
+	log2 = 63 - __builtin_clzll (usecs);
+	b = 1 + 2 * log2 + (log2 > 0 ? (int)((usecs >> (log2 - 1)) & 1) : 0);
+
+	return b < JACK_TIMING_BUCKETS ? b : JACK_TIMING_BUCKETS - 1;
+}
+
+static inline jack_client_timing_t *
+jack_client_timing (jack_control_t *ctl, int32_t slot)
+{
+	if (slot < 0 || slot >= JACK_TIMING_MAX || ctl->timing_offset == 0) {
+		return NULL;
+	}
+	return &((jack_client_timing_t*)((char*)ctl + ctl->timing_offset))[slot];
+}
+
+/* Xrun reports.
+ *
+ * Whenever it sees an xrun, the engine writes down what the cycle
+ * before it looked like, before the next cycle wipes the clients'
+ * times: how late the driver was, how long the driver waited and took,
+ * where each client got to and when, how much of its process() time
+ * it spent on a cpu, which client the engine had
+ * running last, and the loads of the cycles leading up to it. That is
+ * usually enough to tell a client overrunning from the kernel waking
+ * the driver late or the hardware losing its place. The last
+ * JACK_XRUN_REPORTS reports are kept in the engine's segment, after
+ * the client timing table, and one is complete before the XRun event
+ * for it goes out. Client times are in usecs from the start of that
+ * cycle, 0 for never. `seq' is odd while the engine writes the entry.
+ * The types belong in <jack/jack.h>.
+ */
+#define JACK_XRUN_REPORTS      8        /* a power of two */
+#define JACK_XRUN_CLIENTS      32
+#define JACK_XRUN_LOAD_HISTORY 16
+
+typedef struct {
+	char name[JACK_CLIENT_NAME_SIZE];
+	int32_t state;                  /* jack_client_state_t */
+	uint32_t signalled_usecs;
+	uint32_t awake_usecs;
+	uint32_t finished_usecs;
+	uint32_t cpu_usecs;             /* cpu time between awake and finished */
+	uint32_t preemptions;           /* involuntary switches in that time */
+} POST_PACKED_STRUCTURE jack_xrun_client_t;
+
+typedef struct {
+	volatile uint32_t seq;
+	uint32_t xrun;                  /* jack_control_t.xruns, from 1 */
+	jack_time_t when;               /* when the engine was told */
+	jack_time_t cycle_usecs;        /* start of the cycle before it */
+	uint64_t cycle;                 /* cycles completed by then */
+	float delayed_usecs;            /* as given to the XRun callback */
+	uint32_t period_usecs;
+	uint32_t driver_wait_usecs;
+	uint32_t driver_process_usecs;
+	uint32_t recovery_usecs;        /* how long the driver took to recover */
+	uint32_t graph_epoch;
+	char current_client[JACK_CLIENT_NAME_SIZE];
+	float load[JACK_XRUN_LOAD_HISTORY];     /* %, oldest first */
+	uint32_t nclients;              /* may be more than are listed */
+	jack_xrun_client_t clients[JACK_XRUN_CLIENTS];
+} POST_PACKED_STRUCTURE jack_xrun_report_t;
+
+static inline jack_xrun_report_t *
+jack_xrun_report (jack_control_t *ctl, uint32_t xrun)
+{
+	if (ctl->xrun_reports_offset == 0) {
+		return NULL;
+	}
+	return &((jack_xrun_report_t*)((char*)ctl + ctl->xrun_reports_offset))
+	       [xrun & (JACK_XRUN_REPORTS - 1)];
+}
+
+extern int jack_xrun_report_read(jack_control_t *ctl, uint32_t xrun,
+				 jack_xrun_report_t *copy);
+
+/* Port table.
+ *
+ * Ports live in up to JACK_PORT_SEGMENTS_MAX segments of
+ * port_segment_size entries each, and port id N is entry N %
+ * port_segment_size of segment N / port_segment_size. Segment 0 is
+ * jack_control_t.ports; the engine adds the others as shm segments
+ * when it runs out of ports, and tells clients with an
+ * AttachPortSegment event for JACK_PORT_TABLE_SEGMENT. Every address
+ * space keeps a jack_port_table_t of the segments it has attached.
+ *
+ * Each segment has its names in a segment of its own, even segment 0,
+ * so that the control segment holds only what a process cycle may
+ * read. A segment and its names are attached together.
+ */
+typedef struct {
+	jack_port_shared_t *segment[JACK_PORT_SEGMENTS_MAX];
+	jack_shm_info_t shm_info[JACK_PORT_SEGMENTS_MAX];
+	jack_port_names_t *names[JACK_PORT_SEGMENTS_MAX];
+	jack_shm_info_t names_info[JACK_PORT_SEGMENTS_MAX];
+	volatile uint32_t n_segments;           /* attached so far */
+	pthread_mutex_t lock;                   /* serializes attaching */
+} jack_port_table_t;
+
+static inline jack_port_shared_t *
+jack_port_table_entry (jack_port_table_t *table, jack_control_t *ctl,
+		       jack_port_id_t id)
+{
+	uint32_t seg = id / ctl->port_segment_size;
+
+	if (seg >= __atomic_load_n (&table->n_segments, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return &table->segment[seg][id % ctl->port_segment_size];
+}
+
+static inline jack_port_names_t *
+jack_port_table_names (jack_port_table_t *table, jack_control_t *ctl,
+		       jack_port_id_t id)
+{
+	uint32_t seg = id / ctl->port_segment_size;
+
+	if (seg >= __atomic_load_n (&table->n_segments, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return &table->names[seg][id % ctl->port_segment_size];
+}
+
+/* Port name index.
+ *
+ * The engine keeps an open addressing hash table of port ids, keyed on
+ * the port name, after the port array in its shared memory segment.
+ * Only the server writes it (with port_lock held). Clients read it
+ * without locking, so a hit is always checked against the port
+ * itself, and callers fall back to scanning the port array on a miss.
+ * The scan also finds aliases, and ports whose new name has not yet
+ * reached the server.
+ */
+#define JACK_PORT_HASH_EMPTY   ((jack_port_id_t)-1)
+#define JACK_PORT_HASH_DELETED ((jack_port_id_t)-2)
+
+static inline uint32_t
+jack_port_name_hash (const char *name)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static inline volatile jack_port_id_t *
+jack_port_hash_table (jack_control_t *ctl)
+{
+	return (volatile jack_port_id_t*)((char*)ctl + ctl->port_hash_offset);
+}
+
+static inline jack_port_shared_t *
+jack_port_hash_lookup (jack_control_t *ctl, jack_port_table_t *ports,
+		       const char *name)
+{
+	volatile jack_port_id_t *table;
+	jack_port_shared_t *port;
+	jack_port_id_t id;
+	uint32_t mask, i, n;
+
+	if (ctl->port_hash_size == 0) {
+		return NULL;
+	}
+
+	table = jack_port_hash_table (ctl);
+	mask = ctl->port_hash_size - 1;
+
+	for (i = jack_port_name_hash (name) & mask, n = 0; n <= mask;
+	     i = (i + 1) & mask, n++) {
+
+		if ((id = table[i]) == JACK_PORT_HASH_EMPTY) {
+			break;
+		}
+
+		if (id < ctl->port_max &&
+		    (port = jack_port_table_entry (ports, ctl, id)) != NULL &&
+		    port->in_use &&
+		    strcmp (jack_port_table_names (ports, ctl, id)->name,
+			    name) == 0) {
+			return port;
+		}
+	}
+
+	return NULL;
+}
+
 /* Per-client structure allocated in the server's address space.
  * It's here because its not part of the engine structure.
  */
@@ -460,8 +1193,15 @@ typedef struct _jack_client_internal {
 
 	jack_client_control_t *control;
 
+	/* chains of engine->clients_by_name and clients_by_uuid */
+	struct _jack_client_internal *name_next;
+	struct _jack_client_internal *uuid_next;
+
 	int request_fd;
+	int watch_events;               /* registered with the epoll set, or -1 */
+	int pid_fd;                     /* pidfd of the client process, or -1 */
 	int event_fd;
+	pthread_mutex_t event_lock;     /* serializes writers of the event queue */
 	int subgraph_start_fd;
 	int subgraph_wait_fd;
 	JSList    *ports;       /* protected by engine->client_lock */
@@ -469,7 +1209,41 @@ typedef struct _jack_client_internal {
 	JSList    *sortfeeds;   /* protected by engine->client_lock */
 	int fedcount;
 	int tfedcount;
+	jack_time_t ready_at;           /* when the client could have run */
+	unsigned int sort_index;        /* position in engine->clients */
+	unsigned int reach_index;       /* bit of this client in reach sets */
+	bitset_t reach;                 /* clients fed, directly or not */
+	int sort_pending;
+	int latency_dirty;              /* latency passes to run, 1 << mode */
+	JSList    *dag_successors; /* protected by engine->client_lock */
+	int dag_fedcount;               /* runnable upstream clients */
+	int dag_pending;                /* upstream clients not yet finished */
+	JSList    *dag_engine_successors; /* completed by the engine on our behalf */
+	int dag_notify;                 /* wakes the engine when finished */
+	unsigned int dag_mark;
+	unsigned int dag_depth;         /* longest upstream chain in the plan */
+	float dag_weight;               /* smoothed process usecs */
+	float dag_rank;                 /* usecs of work left from its start */
+	int pipeline_stage;             /* -1: not in a pipelined plan */
+	JSList    *early_ports;         /* driver playback ports it feeds */
+	unsigned int pool_requested;    /* worker pool threads asked for */
+
+	/* decimated clients: control->decimation as of activation, and
+	   the ring their audio inputs pile up in, see
+	   jack_client_ring_layout() */
+	unsigned int decimation;        /* 0: woken every cycle */
+	jack_shm_info_t ring_shm;
+	jack_nframes_t ring_frames;     /* the period it was laid out for */
+	unsigned int ring_filled;       /* periods in it */
+	int ring_due;                   /* runs this cycle */
+	struct _jack_port_internal **ring_ports;
+	unsigned int nring_ports;
+
+	JSList    *ringbuffers; /* shared memory ones it created, see
+	                           jack_ringbuffer_create_request() */
+
 	jack_shm_info_t control_shm;
+	int control_slot;               /* in engine->client_table_shm, -1: none */
 	unsigned long execution_order;
 	struct  _jack_client_internal *next_client;     /* not a linked list! */
 	dlhandle handle;
@@ -478,12 +1252,11 @@ typedef struct _jack_client_internal {
 	int error;
 
 	int session_reply_pending;
+	jack_time_t session_sent;
 
 #ifdef JACK_USE_MACH_THREADS
 	/* specific resources for server/client real-time thread communication */
-	mach_port_t serverport;
-	trivial_message message;
-	int running;
+	semaphore_t wake_sem, done_sem;
 	int portnum;
 #endif  /* JACK_USE_MACH_THREADS */
 
@@ -497,6 +1270,7 @@ typedef struct _jack_thread_arg {
 	int realtime;
 	void* arg;
 	pid_t cap_pid;
+	size_t stack_touch;             /* bytes of stack to fault in */
 } jack_thread_arg_t;
 
 extern int  jack_client_handle_port_connection(jack_client_t *client,
@@ -523,14 +1297,49 @@ extern jack_port_type_info_t jack_builtin_port_types[];
 
 extern void jack_client_fix_port_buffers(jack_client_t *client);
 
-extern void jack_transport_copy_position(jack_position_t *from,
-					 jack_position_t *to);
+extern int jack_transport_copy_position(const jack_position_t *from,
+					jack_position_t *to);
 extern void jack_call_sync_client(jack_client_t *client);
 
 extern void jack_call_timebase_master(jack_client_t *client);
 
 extern char *jack_default_server_name(void);
 
+extern float jack_load_percentile(jack_control_t *ctl, float percentile);
+
+/* one timing entry boiled down, see jack_timing_summarize() */
+typedef struct {
+	char name[JACK_CLIENT_NAME_SIZE];
+	uint32_t cycles;
+	jack_time_t wake_usecs;         /* at the percentile asked for */
+	jack_time_t wake_max;
+	jack_time_t process_usecs;
+	jack_time_t process_max;
+	float load;                     /* mean share of the period, % */
+	float cpu_load;                 /* the same in cpu time, % */
+	float preempted;                /* share of cycles preempted in, % */
+} jack_timing_summary_t;
+
+extern int jack_timing_summarize(jack_control_t *ctl, int32_t slot,
+				 float percentile, jack_timing_summary_t *sum);
+
+/* SCHED_DEADLINE budgets, in percent of the period. the engine
+   admits clients while the driver thread's share and the budgets of
+   all active clients add up to at most JACK_DEADLINE_LIMIT, since
+   the serial graph runs them one after another in every period.
+ */
+#define JACK_DEADLINE_ENGINE_SHARE  20
+#define JACK_DEADLINE_CLIENT_SHARE  10
+#define JACK_DEADLINE_LIMIT         90
+
+extern int jack_set_deadline_scheduling(int tid, jack_time_t runtime_usecs,
+					jack_time_t period_usecs);
+
+/* cpu affinity, see libjack/thread.c */
+#define JACK_MAX_CPUS 1024
+extern int jack_cpu_list_parse(const char *list, int *cpus, int max);
+extern int jack_set_thread_cpus(pthread_t thread, const char *cpus);
+
 void silent_jack_error_callback(const char *desc);
 
 /* needed for port management */
@@ -539,7 +1348,7 @@ extern jack_port_t *jack_port_by_id_int(const jack_client_t *client,
 
 extern jack_port_t *jack_port_by_name_int(jack_client_t *client,
                                           const char *port_name, int* free);
-extern int jack_port_name_equals(jack_port_shared_t* port, const char* target);
+extern int jack_port_name_equals(jack_port_names_t* port, const char* target);
 
 /** Get the size (in bytes) of the data structure used to store
  *  MIDI events internally.
@@ -547,6 +1356,7 @@ extern int jack_port_name_equals(jack_port_shared_t* port, const char* target);
 extern size_t jack_midi_internal_event_size();
 
 extern int jack_client_handle_latency_callback(jack_client_t *client, jack_event_t *event, int is_driver);
+extern int jack_client_handle_ports_registration(jack_client_t *client, jack_event_t *event);
 
 #ifdef __GNUC__
 #  define likely(x)     __builtin_expect ((x), 1)
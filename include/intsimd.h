@@ -23,34 +23,111 @@
 #ifdef USE_DYNSIMD
 #if (defined(__i386__) || defined(__x86_64__))
 #define ARCH_X86
+#elif defined(__aarch64__)
+#define ARCH_ARM64
 #endif  /* __i386__ || __x86_64__ */
 #endif  /* USE_DYNSIMD */
 
 #ifdef ARCH_X86
 #define ARCH_X86_SSE(x)         ((x) & 0xff)
 #define ARCH_X86_HAVE_SSE2(x)   (ARCH_X86_SSE (x) >= 2)
-#define ARCH_X86_3DNOW(x)       ((x) >> 8)
+#define ARCH_X86_3DNOW(x)       (((x) >> 8) & 0xff)
 #define ARCH_X86_HAVE_3DNOW(x)  (ARCH_X86_3DNOW (x))
+#define ARCH_X86_AVX2           (1 << 16)
+#define ARCH_X86_AVX512F        (1 << 17)
+#define ARCH_X86_HAVE_AVX2(x)   ((x) & ARCH_X86_AVX2)
+#define ARCH_X86_HAVE_AVX512F(x) ((x) & ARCH_X86_AVX512F)
 
 typedef float v2sf __attribute__((vector_size (8)));
 typedef float v4sf __attribute__((vector_size (16)));
 typedef v2sf * pv2sf;
 typedef v4sf * pv4sf;
 
-extern int cpu_type;
-
 int have_3dnow(void);
 int have_sse(void);
+int have_avx(void);
 void x86_3dnow_copyf(float *, const float *, int);
 void x86_3dnow_add2f(float *, const float *, int);
 void x86_sse_copyf(float *, const float *, int);
 void x86_sse_add2f(float *, const float *, int);
+void x86_sse_mixnf(float *, const float **, int, int);
+void x86_sse_mixgainf(float *, const float **, const float *, const float *, int, int);
+void x86_sse_mixnd(double *, const double **, int, int);
+void x86_sse_meterf(const float *, int, float *, float *);
 void x86_sse_f2i(int *, const float *, int, float);
 void x86_sse_i2f(float *, const int *, int, float);
+void x86_avx2_copyf(float *, const float *, int);
+void x86_avx2_add2f(float *, const float *, int);
+void x86_avx2_mixnf(float *, const float **, int, int);
+void x86_avx2_mixgainf(float *, const float **, const float *, const float *, int, int);
+void x86_avx2_mixnd(double *, const double **, int, int);
+void x86_avx2_meterf(const float *, int, float *, float *);
+void x86_avx2_f2i(int *, const float *, int, float);
+void x86_avx2_i2f(float *, const int *, int, float);
+void x86_avx512_copyf(float *, const float *, int);
+void x86_avx512_add2f(float *, const float *, int);
+void x86_avx512_mixnf(float *, const float **, int, int);
+void x86_avx512_mixgainf(float *, const float **, const float *, const float *, int, int);
+void x86_avx512_mixnd(double *, const double **, int, int);
+void x86_avx512_meterf(const float *, int, float *, float *);
+void x86_avx512_f2i(int *, const float *, int, float);
+void x86_avx512_i2f(float *, const int *, int, float);
 
 #endif /* ARCH_X86 */
 
-void jack_port_set_funcs(void);
+#ifdef ARCH_ARM64
+#define ARCH_ARM64_NEON         (1 << 0)
+#define ARCH_ARM64_HAVE_NEON(x) ((x) & ARCH_ARM64_NEON)
+
+int have_neon(void);
+void arm64_neon_copyf(float *, const float *, int);
+void arm64_neon_add2f(float *, const float *, int);
+void arm64_neon_mixnf(float *, const float **, int, int);
+void arm64_neon_mixgainf(float *, const float **, const float *, const float *, int, int);
+void arm64_neon_mixnd(double *, const double **, int, int);
+void arm64_neon_meterf(const float *, int, float *, float *);
+void arm64_neon_f2i(int *, const float *, int, float);
+void arm64_neon_i2f(float *, const int *, int, float);
+
+#endif /* ARCH_ARM64 */
+
+#ifdef USE_DYNSIMD
+
+/* The kernels chosen for this CPU by jack_simd_init(), shared by the
+ * port code and the drivers. f2i clamps to [-1, 1] before scaling and
+ * rounds to nearest; mixnf sums nsrc sources into dest, which may be
+ * one of them, mixgainf does so with a gain per source that moves by
+ * step[s] every sample, and mixnd sums doubles. meterf gives the
+ * largest magnitude in src and the sum of its squares.
+ */
+/* A mixnf for one length, 64-byte aligned buffers only, see
+ * jack_simd_set_length(). */
+typedef struct {
+	int length;
+	void (*mixnf)(float *dest, const float **src, int nsrc, int length);
+} jack_simd_fixed_t;
+
+typedef struct {
+	const char *name;
+	void (*copyf)(float *dest, const float *src, int length);
+	void (*add2f)(float *dest, const float *src, int length);
+	void (*mixnf)(float *dest, const float **src, int nsrc, int length);
+	void (*mixgainf)(float *dest, const float **src, const float *gain,
+			 const float *step, int nsrc, int length);
+	void (*mixnd)(double *dest, const double **src, int nsrc, int length);
+	void (*meterf)(const float *src, int length, float *peak, float *sumsq);
+	void (*f2i)(int *dest, const float *src, int length, float scale);
+	void (*i2f)(float *dest, const int *src, int length, float scale);
+	const jack_simd_fixed_t *fixed; /* NULL for periods it doesn't cover */
+} jack_simd_t;
+
+extern int cpu_type;
+extern jack_simd_t jack_simd;
+
+void jack_simd_init(void);
+void jack_simd_set_length(int length);
+
+#endif /* USE_DYNSIMD */
 
 #endif /* __jack_intsimd_h__ */
 
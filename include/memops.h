@@ -37,15 +37,24 @@ typedef struct {
 	float rm1;
 	unsigned int idx;
 	float e[DITHER_BUF_SIZE];
+	unsigned int seed;      /* per-channel noise, *_multi dither only */
 } dither_state_t;
 
+/* the signatures shared by every sample_move_dS_* (read) and
+   sample_move_d*_sS (write) function below */
+typedef void (*sample_read_func_t)(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+typedef void (*sample_write_func_t)(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+
 /* float functions */
 void sample_move_floatLE_sSs(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long dst_skip);
 void sample_move_dS_floatLE(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_dS_s64f(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_d64f_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 
 /* integer functions */
 void sample_move_d32u24_sSs(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d32u24_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_d32l24_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d24_sSs(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d24_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d16_sSs(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
@@ -72,11 +81,66 @@ void sample_move_dither_shaped_d16_sS(char *dst, jack_default_audio_sample_t *sr
 
 void sample_move_dS_s32u24s(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s32u24(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dS_s32l24(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s24s(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s24(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s16s(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s16(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 
+/* 32 bit hardware samples to 64 bit float, keeping all 32 bits */
+typedef void (*sample_read_double_func_t)(double *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dD_s32s(double *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dD_s32(double *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+
+/* SIMD versions of the native-endian, undithered functions above,
+   only usable once memops_simd_init() returned non-NULL */
+const char *memops_simd_init(void);
+void sample_move_d32u24_sS_simd(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_d32l24_sS_simd(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_d24_sS_simd(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_d16_sS_simd(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_dS_s32u24_simd(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dS_s32l24_simd(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dS_s24_simd(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dS_s16_simd(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+
+/* Native-endian sample formats of the backends, and the fastest
+   undithered movers for each (SIMD when the CPU has it). memops is
+   part of libjackserver, so every driver gets the same code.
+ */
+typedef enum {
+	MemopsS16,
+	MemopsS24,              /* packed in 3 bytes */
+	MemopsS32L24,           /* in the low 3 bytes of 32, sign extended */
+	MemopsS32,              /* 32 bits, 24 of them kept */
+	MemopsFloat,
+	MemopsDouble
+} memops_format_t;
+
+sample_read_func_t memops_read_func(memops_format_t format);
+sample_write_func_t memops_write_func(memops_format_t format);
+
+/* Cache-blocked (de)interleaving: convert nchannels channels of an
+   interleaved buffer MEMOPS_BLOCK_FRAMES frames at a time, so that
+   each block of the hardware buffer stays in cache while all channels
+   are converted. Channels with a NULL port buffer are skipped. state
+   may be NULL if the write function does not dither.
+ */
+#define MEMOPS_BLOCK_FRAMES 64
+
+void sample_move_blocked_dS(jack_default_audio_sample_t **dst, char **src, unsigned long nchannels, unsigned long nsamples, unsigned long *src_skip, sample_read_func_t read);
+void sample_move_blocked_d(char **dst, jack_default_audio_sample_t **src, unsigned long nchannels, unsigned long nsamples, unsigned long *dst_skip, dither_state_t *state, sample_write_func_t write);
+
+/* Dithered 16 bit output for several channels at once, one channel per
+   SIMD lane, each with its own noise generator and error filter state.
+   The noise differs from the serial functions, which remain the
+   bit-exact choice.
+ */
+typedef void (*sample_write_multi_func_t)(char **dst, jack_default_audio_sample_t **src, unsigned long nchannels, unsigned long nsamples, unsigned long *dst_skip, dither_state_t *state);
+
+void sample_move_dither_tri_d16_sS_multi(char **dst, jack_default_audio_sample_t **src, unsigned long nchannels, unsigned long nsamples, unsigned long *dst_skip, dither_state_t *state);
+void sample_move_dither_shaped_d16_sS_multi(char **dst, jack_default_audio_sample_t **src, unsigned long nchannels, unsigned long nsamples, unsigned long *dst_skip, dither_state_t *state);
+
 void sample_merge_d16_sS(char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_merge_d32u24_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 
@@ -37,6 +37,8 @@ void jack_messagebuffer_init();
 void jack_messagebuffer_exit();
 void jack_message_buffer_thread_init(void (*cb)(void*), void*);
 
+/* fmt and string arguments are copied, up to a limit, and the message
+   is formatted later by the writer thread */
 void jack_messagebuffer_add(const char *fmt, ...);
 
 void jack_messagebuffer_thread_init(void (*cb)(void*), void* arg);
@@ -24,5 +24,8 @@
 
 void * jack_pool_alloc(size_t bytes);
 void   jack_pool_release(void *);
+int    jack_pool_reserve(size_t bytes);
+void   jack_pool_expect(size_t bytes);
+void   jack_pool_activate(int do_mlock);
 
 #endif /* __jack_pool_h__ */
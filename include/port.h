@@ -42,6 +42,39 @@
 #define JACK_MAX_PORT_TYPES 4
 #define JACK_AUDIO_PORT_TYPE 0
 #define JACK_MIDI_PORT_TYPE 1
+#define JACK_MULTICHANNEL_PORT_TYPE 2
+#define JACK_DOUBLE_PORT_TYPE 3
+
+/* Multichannel audio ports carry up to JACK_MULTICHANNEL_MAX_CHANNELS
+ * planar channels in one buffer, so that a surround or ambisonic bus is
+ * one port and one connection rather than one per channel. Every
+ * buffer of the type is that large, and its segment is only created
+ * once the first such port is registered. The type name belongs with
+ * JACK_DEFAULT_AUDIO_TYPE in <jack/types.h>.
+ */
+#define JACK_MULTICHANNEL_MAX_CHANNELS 36
+#ifndef JACK_MULTICHANNEL_AUDIO_TYPE
+#define JACK_MULTICHANNEL_AUDIO_TYPE "32 bit float planar audio"
+#endif
+
+/* Mono audio as 64 bit floats, for chains that would otherwise
+ * convert to double and back at every hop. Like the multichannel type,
+ * its segment is created with the first port, and the name belongs in
+ * <jack/types.h>.
+ */
+#ifndef JACK_DOUBLE_AUDIO_TYPE
+#define JACK_DOUBLE_AUDIO_TYPE "64 bit float mono audio"
+#endif
+
+/* MIDI output ports may ask jack_port_register() for a smaller buffer
+ * than --midi-bufsize gives every MIDI port; the engine uses at least
+ * this much. jack_midi_get_high_water() tells how much a port needs.
+ */
+#define JACK_MIDI_MIN_BUFFER_BYTES 256
+
+/* the engine lays out port buffers at, and pads them to, a multiple
+ * of this, so that the fixed length mixes may assume it */
+#define JACK_PORT_BUFFER_ALIGN 64
 
 /* these should probably go somewhere else, but not in <jack/types.h> */
 #define JACK_CLIENT_NAME_SIZE 33
@@ -54,6 +87,14 @@ typedef int32_t jack_port_type_id_t;
 
 #define JACK_BACKEND_ALIAS "system"
 
+/* connections of a port listed in its jack_port_shared_t; a port with
+ * more than this is looked up with a GetPortConnections request.
+ */
+#define JACK_PORT_CONNECTIONS_SHARED 16
+
+/* the largest gain a connection can be given, +24 dB */
+#define JACK_CONNECTION_GAIN_MAX 16.0f
+
 /* Port type structure.
  *
  *  (1) One for each port type is part of the engine's jack_control_t
@@ -91,31 +132,108 @@ typedef struct _jack_port_type_info {
 
 } POST_PACKED_STRUCTURE jack_port_type_info_t;
 
-/* Allocated by the engine in shared memory. */
+/* Allocated by the engine in shared memory.
+ *
+ * The fields that scans over the port table look at (in use, flags,
+ * type, owner, latencies) come first, within the first 64 bytes of the
+ * entry. A scan that skips most ports on flags or owner then touches
+ * one cache line per port. The names are not here at all, see
+ * jack_port_names_t.
+ */
 typedef struct _jack_port_shared {
 
+	jack_port_id_t id;              /* index into engine port array */
 	jack_port_type_id_t ptype_id;   /* index into port type array */
 	jack_shmsize_t offset;          /* buffer offset in shm segment */
-	jack_port_id_t id;              /* index into engine port array */
-	jack_uuid_t uuid;
 	uint32_t flags;
-	char name[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
-	char alias1[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
-	char alias2[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	char in_use;
+	char has_mixdown;               /* port has a mixdown function */
+	char unused;                    /* legacy locked field */
+	volatile uint8_t monitor_requests;
 	jack_uuid_t client_id;          /* who owns me */
 
 	volatile jack_nframes_t latency;
 	volatile jack_nframes_t total_latency;
 	volatile jack_latency_range_t playback_latency;
 	volatile jack_latency_range_t capture_latency;
-	volatile uint8_t monitor_requests;
 
-	char has_mixdown;               /* port has a mixdown function */
-	char in_use;
-	char unused;                    /* legacy locked field */
+	/* what the port is connected to, so that clients can look
+	   without asking the engine. conn_seq is odd while the engine
+	   changes the list; the ids are only all there if n_connections
+	   is at most JACK_PORT_CONNECTIONS_SHARED. */
+	volatile uint32_t conn_seq;
+	volatile uint32_t n_connections;
+	volatile jack_port_id_t connection_ids[JACK_PORT_CONNECTIONS_SHARED];
+
+	/* the gain of each of those connections, 0 if it is muted; an
+	   input applies it in its mixdown, ramping to it over the cycle
+	   from what it used the cycle before. connections beyond
+	   JACK_PORT_CONNECTIONS_SHARED are at unity gain */
+	volatile float connection_gains[JACK_PORT_CONNECTIONS_SHARED];
+
+	/* the jack_control_t.cycle_serial of the cycle in which the
+	   owner marked the buffer silent */
+	volatile uint32_t silent_cycle;
+
+	/* the cycle in which the owner made the output pass on what one
+	   of its inputs reads, at passthrough_offset, rather than its own
+	   buffer; see jack_port_set_passthrough() */
+	volatile uint32_t passthrough_cycle;
+	volatile jack_shmsize_t passthrough_offset;
+
+	/* outputs: set while the engine lends the port a buffer that
+	   other outputs use too in other parts of the cycle (see
+	   --share-buffers); its data lasts only until the last of its
+	   readers has run */
+	volatile uint32_t pooled;
+
+	/* multichannel ports: how many channels the buffer holds, 0
+	   until it is set or taken from the first connection */
+	volatile uint32_t channels;
+
+	/* pipelined graphs: the stage of the owner, -1 if it is in
+	   none. an output read by a later stage has `delayed' set,
+	   and the copy of what it held last cycle at delay_offset,
+	   made by the engine at the start of every cycle */
+	volatile int32_t stage;                 /* w: engine */
+	volatile jack_shmsize_t delay_offset;   /* w: engine */
+	volatile uint32_t delay_silent_cycle;   /* w: engine */
+	volatile char delayed;                  /* w: engine */
+
+	/* inputs of a decimated client: where the ring of the last
+	   periods is in its segment, see jack_client_ring_layout() */
+	volatile jack_shmsize_t ring_offset;    /* w: engine */
+
+	/* MIDI outputs: how much of the buffer to use, from the size
+	   given to jack_port_register(); 0 for all of it */
+	uint32_t buffer_bytes;                  /* w: engine */
+
+	/* metering: while meter_requests is non-zero the owner of an
+	   audio output puts the peak and the RMS of what it held here
+	   at the end of every cycle, along with the cycle. the peak
+	   falls off by 20dB a second and the RMS is averaged over
+	   about 300ms, so that a reader looking a few times a second
+	   still sees what went by */
+	volatile uint32_t meter_requests;
+	volatile float meter_peak;              /* w: owner */
+	volatile float meter_rms;               /* w: owner */
+	volatile uint32_t meter_cycle;          /* w: owner */
+
+	jack_uuid_t uuid;
 
 } POST_PACKED_STRUCTURE jack_port_shared_t;
 
+/* The names of a port, nearly 900 bytes of them, kept next to the
+ * port table in segments of their own. Nothing in a process cycle
+ * reads them, so those segments are left out of mlock()ing and
+ * prefaulting, and only the pages of the names in use are ever touched.
+ */
+typedef struct _jack_port_names {
+	char name[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	char alias1[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	char alias2[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+} POST_PACKED_STRUCTURE jack_port_names_t;
+
 typedef struct _jack_port_functions {
 
 	/* Function to initialize port buffer. Cannot be NULL.
@@ -150,10 +268,51 @@ struct _jack_port {
 	void                     *mix_buffer;
 	jack_port_type_info_t    *type_info;    /* shared memory type info */
 	struct _jack_port_shared *shared;       /* corresponding shm struct */
+	struct _jack_port_names  *names;        /* and its names */
 	struct _jack_port        *tied;         /* locally tied source port */
 	jack_port_functions_t fptr;
 	pthread_mutex_t connection_lock;
 	JSList                   *connections;
+
+	/* the ports in `connections', in the same order, copied into an
+	   array whenever the list changes so that the process thread
+	   walks contiguous memory; `sources' points at `inline_sources'
+	   unless there are more than JACK_PORT_INLINE_SOURCES of them */
+#define JACK_PORT_INLINE_SOURCES 4
+	struct _jack_port       **sources;
+	uint32_t                  nsources;
+	struct _jack_port        *inline_sources[JACK_PORT_INLINE_SOURCES];
+
+	/* the gain the last mixdown ended each source at, alongside
+	   `sources' (and in `inline_gains' when that is inline) */
+	float                    *gains;
+	float                     inline_gains[JACK_PORT_INLINE_SOURCES];
+
+	/* input ports: what jack_port_get_buffer() returned, good for
+	   the rest of the cycle it was worked out in */
+	volatile uint32_t        *cycle;        /* jack_control_t.cycle_serial */
+	void                     *buffer;
+	uint32_t                  buffer_cycle;
+	jack_nframes_t            buffer_nframes;
+
+	/* own outputs: whether the buffer at `written_offset' has been
+	   handed out to be written since the engine assigned it, see
+	   jack_client_mark_unwritten() */
+	int                       written;
+	jack_shmsize_t            written_offset;
+
+	/* own ports of a client running one period behind: what its
+	   process() works on, see jack_port_async_exchange() */
+	void                     *async_buffer;
+	int                       async_silent;
+
+	/* own ports: the client's mapping of its input ring, NULL
+	   unless it is decimated, see jack_set_process_decimation() */
+	char                    **ring_base;
+
+	/* own outputs being metered: the running mean square behind
+	   shared->meter_rms */
+	float                     meter_ms;
 };
 
 /*  Inline would be cleaner, but it needs to be fast even in
@@ -165,6 +324,35 @@ struct _jack_port {
 		 *(p)->client_segment_base + (p)->shared->offset))
 #define jack_output_port_buffer(p) \
 	((void*)(*(p)->client_segment_base + (p)->shared->offset))
+#define jack_port_zero_buffer(p) \
+	((void*)(*(p)->client_segment_base + (p)->type_info->zero_buffer_offset))
+
+/* does output `p' pass one of its owner's inputs on this cycle? */
+#define jack_port_passes_through(p) \
+	((p)->shared->passthrough_cycle == *(p)->cycle)
+
+/* the buffer the readers of output `p' see this cycle */
+#define jack_output_port_graph_buffer(p) \
+	((void*)(*(p)->client_segment_base + \
+		 (jack_port_passes_through (p) ? (p)->shared->passthrough_offset \
+		  : (p)->shared->offset)))
+
+/* has the owner of output `p' marked it silent this cycle? */
+#define jack_port_is_silent(p) \
+	((p)->shared->silent_cycle == *(p)->cycle)
+
+/* does input `d' see output `s' a cycle late, from the copy, because
+   `s' is in an earlier stage of a pipelined graph? */
+#define jack_port_source_delayed(d, s) \
+	((s)->shared->delayed && (d)->shared->stage > (s)->shared->stage)
+#define jack_port_source_buffer(d, s) \
+	(jack_port_source_delayed (d, s) ? \
+	 (void*)(*(s)->client_segment_base + (s)->shared->delay_offset) : \
+	 jack_output_port_graph_buffer (s))
+#define jack_port_source_silent(d, s) \
+	(jack_port_source_delayed (d, s) ? \
+	 (s)->shared->delay_silent_cycle == *(s)->cycle : \
+	 jack_port_is_silent (s))
 
 /* not for use by JACK applications */
 size_t jack_port_type_buffer_size(jack_port_type_info_t* port_type_info, jack_nframes_t nframes);
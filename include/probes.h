@@ -0,0 +1,67 @@
+/*
+    Static tracepoints on the cycle path.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+#ifndef __jack_probes_h__
+#define __jack_probes_h__
+
+/* With --enable-sdt, jackd and libjack carry systemtap SDT (USDT)
+ * probes in provider "jack", which perf, bpftrace and systemtap can
+ * attach to by name, for instance
+ *
+ *	bpftrace -e 'usdt:/usr/bin/jackd:jack:xrun { printf ("%d\n", arg1); }'
+ *
+ * A probe that nothing is attached to is a single nop, and without
+ * --enable-sdt the macros below expand to nothing at all. Arguments
+ * are integers or pointers; times are in usecs, and `name' arguments
+ * are NUL-terminated client or port names.
+ *
+ * jackd:
+ *	cycle_start (cycle_serial, nframes)
+ *	cycle_end (cycle_serial, usecs since cycle_start)
+ *	driver_wait (nframes, delayed_usecs)    driver woke the engine
+ *	client_trigger (name, cycle_serial)     external client signalled
+ *	client_return (name, status)            ... and done
+ *	internal_start (name) / internal_end (name)
+ *	xrun (xruns, delayed_usecs)
+ *
+ * libjack:
+ *	cycle_wait (name) / cycle_wake (name, nframes)
+ *	cycle_signal (name, status)
+ *	mixdown_start (name, nsources, nframes) / mixdown_end (name)
+ */
+
+#ifdef USE_SDT_PROBES
+
+#include <sys/sdt.h>
+
+#define JACK_PROBE(name)                DTRACE_PROBE (jack, name)
+#define JACK_PROBE1(name, a)            DTRACE_PROBE1 (jack, name, a)
+#define JACK_PROBE2(name, a, b)         DTRACE_PROBE2 (jack, name, a, b)
+#define JACK_PROBE3(name, a, b, c)      DTRACE_PROBE3 (jack, name, a, b, c)
+
+#else
+
+#define JACK_PROBE(name)                do { } while (0)
+#define JACK_PROBE1(name, a)            do { } while (0)
+#define JACK_PROBE2(name, a, b)         do { } while (0)
+#define JACK_PROBE3(name, a, b, c)      do { } while (0)
+
+#endif /* USE_SDT_PROBES */
+
+#endif /* __jack_probes_h__ */
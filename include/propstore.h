@@ -0,0 +1,216 @@
+/*
+    The server's metadata store, in shared memory.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+#ifndef __jack_propstore_h__
+#define __jack_propstore_h__
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <jack/types.h>
+#include <jack/uuid.h>
+#include <jack/metadata.h>
+
+#include "shm.h"
+
+/* Metadata lives in one shm segment that only the server writes
+ * (jackd/propstore.c); clients ask it to with SetProperty,
+ * RemoveProperties and RemoveAllProperties requests. The engine
+ * control block names the segment in propstore_index.
+ *
+ * The segment is append-only. A record is never changed once it is
+ * linked in, except for being marked dead when a newer record for the
+ * same subject and key replaces it, or when it is removed. The newest
+ * record of a hash chain is at its head, published with a release
+ * store, so a lookup needs no lock at all: it walks the chain and
+ * takes the first live record that matches.
+ *
+ * A reader that needs a consistent view of many records, such as
+ * jack_get_properties(), checks `seq' around its walk: the writer
+ * makes it odd while it is at work and even again when it is done.
+ *
+ * When the segment is full, the server copies the live records into a
+ * new one, publishes its index in the engine control block, and only
+ * then sets `retired' in the old one. The old segment is destroyed
+ * but stays mapped wherever it was, so that a reader that sees
+ * `retired' can finish what it was doing and map the new one.
+ */
+
+#define JACK_PROPSTORE_MAGIC    0x4a4d4554      /* "JMET" */
+#define JACK_PROPSTORE_BUCKETS  1024            /* a power of two */
+#define JACK_PROPSTORE_MIN_SIZE (64 * 1024)
+#define JACK_PROPSTORE_MAX_SIZE (256 * 1024 * 1024)
+#define JACK_PROPSTORE_RECORD_MAX (16 * 1024 * 1024) /* key, value and type */
+
+typedef struct {
+	volatile uint32_t next;         /* offset of the next record in the chain, 0: none */
+	volatile uint32_t dead;         /* replaced or removed */
+	uint32_t size;                  /* of the whole record, a multiple of 8 */
+	uint32_t keylen;                /* all three including the NUL */
+	uint32_t valuelen;
+	uint32_t typelen;               /* 0: no type */
+	jack_uuid_t subject;
+	char data[0];                   /* key, value, type */
+} POST_PACKED_STRUCTURE jack_propstore_record_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t size;                  /* of the segment */
+	volatile uint32_t seq;          /* odd while the server writes */
+	volatile uint32_t retired;      /* a compacted copy replaces this one */
+	volatile uint32_t used;         /* bytes, the header included */
+	volatile uint32_t count;        /* live records */
+	uint32_t dead_bytes;            /* in records marked dead */
+	uint32_t reserved;
+	volatile uint32_t buckets[JACK_PROPSTORE_BUCKETS]; /* newest record, 0: none */
+} POST_PACKED_STRUCTURE jack_propstore_t;
+
+static inline unsigned int
+jack_propstore_hash (jack_uuid_t subject, const char *key)
+{
+	uint32_t h = 2166136261u;       /* FNV-1a */
+
+	for (; *key; key++) {
+		h = (h ^ (unsigned char)*key) * 16777619u;
+	}
+
+	h ^= (uint32_t)(subject ^ (subject >> 32));
+
+	return h & (JACK_PROPSTORE_BUCKETS - 1);
+}
+
+static inline jack_propstore_record_t *
+jack_propstore_at (jack_propstore_t *store, uint32_t offset)
+{
+	return (jack_propstore_record_t*)((char*)store + offset);
+}
+
+static inline const char *
+jack_propstore_key (jack_propstore_record_t *rec)
+{
+	return rec->data;
+}
+
+static inline const char *
+jack_propstore_value (jack_propstore_record_t *rec)
+{
+	return rec->data + rec->keylen;
+}
+
+static inline const char *
+jack_propstore_type (jack_propstore_record_t *rec)
+{
+	return rec->typelen ? rec->data + rec->keylen + rec->valuelen : NULL;
+}
+
+/* the live record for `subject' and `key', or NULL. safe in any
+   thread of any process, at any time.
+ */
+static inline jack_propstore_record_t *
+jack_propstore_find (jack_propstore_t *store, jack_uuid_t subject,
+		     const char *key)
+{
+	jack_propstore_record_t *rec;
+	uint32_t offset;
+
+	offset = __atomic_load_n (&store->buckets[jack_propstore_hash (subject, key)],
+				  __ATOMIC_ACQUIRE);
+
+	for (; offset; offset = __atomic_load_n (&rec->next, __ATOMIC_ACQUIRE)) {
+		rec = jack_propstore_at (store, offset);
+		if (!__atomic_load_n (&rec->dead, __ATOMIC_ACQUIRE) &&
+		    jack_uuid_compare (rec->subject, subject) == 0 &&
+		    strcmp (jack_propstore_key (rec), key) == 0) {
+			return rec;
+		}
+	}
+
+	return NULL;
+}
+
+/* A walk over all live records, in the order they were written:
+ *
+ *	do {
+ *		seq = jack_propstore_read_begin (store);
+ *		for (off = jack_propstore_first (); off < end; off += rec->size)
+ *			...
+ *	} while (jack_propstore_read_retry (store, seq));
+ *
+ * with `end' read once, from `used', after read_begin().
+ */
+static inline uint32_t
+jack_propstore_read_begin (jack_propstore_t *store)
+{
+	uint32_t seq;
+
+	while ((seq = __atomic_load_n (&store->seq, __ATOMIC_ACQUIRE)) & 1) {
+		sched_yield ();
+	}
+
+	return seq;
+}
+
+static inline int
+jack_propstore_read_retry (jack_propstore_t *store, uint32_t seq)
+{
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	return __atomic_load_n (&store->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline uint32_t
+jack_propstore_first (void)
+{
+	return sizeof(jack_propstore_t);
+}
+
+/* the server side, jackd/propstore.c */
+
+typedef struct {
+	pthread_mutex_t lock;
+	jack_shm_info_t shm;
+	jack_propstore_t *store;
+	volatile jack_shm_registry_index_t *index; /* published here */
+
+	/* snapshots, when there is a file to keep them in */
+	char *path;
+	pthread_t thread;
+	pthread_cond_t dirty_cond;
+	int dirty;
+	int running;
+} jack_propstore_server_t;
+
+jack_propstore_server_t *jack_propstore_new (volatile jack_shm_registry_index_t *index,
+					     const char *path);
+void jack_propstore_delete (jack_propstore_server_t *ps);
+
+/* `*change' says whether the property was created or changed */
+int  jack_propstore_set (jack_propstore_server_t *ps, jack_uuid_t subject,
+			 const char *key, const char *value, const char *type,
+			 jack_property_change_t *change);
+
+/* the property `key' of `subject', or all of them if `key' is NULL.
+   returns how many were removed.
+ */
+int  jack_propstore_remove (jack_propstore_server_t *ps, jack_uuid_t subject,
+			    const char *key);
+int  jack_propstore_clear (jack_propstore_server_t *ps);
+
+#endif /* __jack_propstore_h__ */
@@ -30,7 +30,8 @@ typedef int jack_shm_id_t;
 /* shared memory type */
 typedef enum {
 	shm_POSIX = 1,                  /* POSIX shared memory */
-	shm_SYSV = 2                    /* System V shared memory */
+	shm_SYSV = 2,                   /* System V shared memory */
+	shm_MEMFD = 3                   /* Linux memfd, POSIX registry */
 } jack_shmtype_t;
 
 typedef int16_t jack_shm_registry_index_t;
@@ -88,6 +89,15 @@ extern void jack_shm_copy_from_registry (jack_shm_info_t *,
 extern void jack_shm_copy_to_registry(jack_shm_info_t*,
 				      jack_shm_registry_index_t*);
 extern void jack_release_shm_info (jack_shm_registry_index_t);
+extern jack_shm_registry_index_t jack_shm_next_server_segment
+	(jack_shm_registry_index_t after, jack_shmsize_t *size);
+
+#ifdef USE_MEMFD_SHM
+/* the server hands out descriptors of its memfd segments while the
+   broker runs, see libjack/shm.c */
+extern int  jack_shm_broker_start (void);
+extern void jack_shm_broker_stop (void);
+#endif
 
 static inline char* jack_shm_addr (jack_shm_info_t* si)
 {
@@ -107,5 +117,9 @@ extern void jack_release_shm(jack_shm_info_t*);
 extern void jack_destroy_shm(jack_shm_info_t*);
 extern int  jack_attach_shm(jack_shm_info_t*);
 extern int  jack_resize_shm(jack_shm_info_t*, jack_shmsize_t size);
+extern void jack_prefault_shm(jack_shm_info_t*);
+extern void jack_prefault_shm_range(jack_shm_info_t*, jack_shmsize_t offset,
+				    jack_shmsize_t len);
+extern void jack_unlock_shm(jack_shm_info_t*);
 
 #endif /* __jack_shm_h__ */
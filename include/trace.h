@@ -0,0 +1,136 @@
+/*
+    Copyright (C) 2001-2003 Paul Davis
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#ifndef __jack_trace_h__
+#define __jack_trace_h__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <jack/types.h>
+#include <jack/jslist.h>
+
+/* Engine cycle tracing.
+ *
+ * When jackd runs with "--trace FILE", the engine thread appends a
+ * fixed-size record for every step of a cycle to a preallocated
+ * single-producer, single-consumer ring. Appending is a handful of
+ * stores and never blocks: when the ring is full the record is
+ * dropped and counted. A non-realtime thread (jackd/trace.c) empties
+ * the ring into FILE every JACK_TRACE_FLUSH_USECS.
+ *
+ * The file starts with a jack_trace_header_t, followed by records.
+ * A JackTraceClientName record is followed by JACK_CLIENT_NAME_SIZE
+ * bytes holding the name of the client with that uuid. jack_trace2json
+ * turns a file into Chrome trace / Perfetto JSON.
+ */
+
+#define JACK_TRACE_MAGIC        0x4a54524b      /* "JTRK" */
+#define JACK_TRACE_VERSION      1
+#define JACK_TRACE_RING_SIZE    65536           /* records, a power of two */
+#define JACK_TRACE_FLUSH_USECS  20000
+
+typedef enum {
+	JackTraceCycleStart = 1,        /* arg: nframes */
+	JackTraceReadDone,
+	JackTraceClientTriggered,
+	JackTraceClientAwake,
+	JackTraceClientFinished,        /* arg: client status */
+	JackTraceWriteDone,
+	JackTraceXRun,                  /* arg: delay in usecs */
+	JackTraceDropped,               /* arg: records lost */
+	JackTraceClientName             /* followed by the name */
+} jack_trace_event_t;
+
+typedef struct {
+	uint64_t time;                  /* usecs, jack_get_microseconds() */
+	uint64_t uuid;                  /* client, 0 for the engine */
+	uint32_t cycle;
+	uint32_t type;                  /* jack_trace_event_t */
+	uint32_t arg;
+	uint32_t reserved;
+} jack_trace_record_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t name_size;
+} jack_trace_header_t;
+
+typedef struct {
+	/* w: engine thread */
+	volatile uint32_t head __attribute__((aligned (64)));
+	uint32_t cycle;
+	uint32_t dropped;
+
+	/* w: trace thread */
+	volatile uint32_t tail __attribute__((aligned (64)));
+
+	jack_trace_record_t *ring;
+	int fd;
+	volatile int running;
+	pthread_t thread;
+
+	/* client names, written out by the trace thread */
+	pthread_mutex_t names_lock;
+	JSList *names;
+} jack_trace_t;
+
+jack_trace_t *jack_trace_start (const char *path);
+void          jack_trace_stop (jack_trace_t *trace);
+void          jack_trace_client_name (jack_trace_t *trace, jack_uuid_t uuid,
+				      const char *name);
+
+/* must only be called from the engine thread */
+static inline void
+jack_trace_at (jack_trace_t *trace, jack_time_t time, jack_trace_event_t type,
+	       jack_uuid_t uuid, uint32_t arg)
+{
+	jack_trace_record_t *rec;
+	uint32_t head;
+
+	if (trace == NULL) {
+		return;
+	}
+
+	head = trace->head;
+
+	if (head - __atomic_load_n (&trace->tail, __ATOMIC_ACQUIRE)
+	    >= JACK_TRACE_RING_SIZE) {
+		__atomic_fetch_add (&trace->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (type == JackTraceCycleStart) {
+		trace->cycle++;
+	}
+
+	rec = &trace->ring[head & (JACK_TRACE_RING_SIZE - 1)];
+	rec->time = time;
+	rec->uuid = uuid;
+	rec->cycle = trace->cycle;
+	rec->type = type;
+	rec->arg = arg;
+	rec->reserved = 0;
+
+	__atomic_store_n (&trace->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* __jack_trace_h__ */
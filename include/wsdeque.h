@@ -0,0 +1,138 @@
+/*
+    Work-stealing deques for the engine's worker threads.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+#ifndef __jack_wsdeque_h__
+#define __jack_wsdeque_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A Chase-Lev deque, in the C11 formulation of Lê, Pop, Cohen and
+ * Zappa Nardelli ("Correct and Efficient Work-Stealing for Weak Memory
+ * Models", PPoPP 2013), with a fixed ring instead of a growing one:
+ * nothing ever holds more than a cycle's worth of clients, and the
+ * realtime threads that use it must not allocate. One thread owns the
+ * deque and pushes and takes at the bottom, LIFO; any other thread may
+ * steal from the top. No operation takes a lock or blocks. A take or a
+ * steal that races for the last entry and loses returns NULL.
+ */
+
+#define JACK_WSDEQUE_SIZE 256           /* a power of two */
+
+typedef struct {
+	volatile int64_t top;
+	char pad0[56];                  /* thieves write top, the owner bottom */
+	volatile int64_t bottom;
+	char pad1[56];
+	void *volatile ring[JACK_WSDEQUE_SIZE];
+} jack_wsdeque_t;
+
+static inline void
+jack_wsdeque_init (jack_wsdeque_t *dq)
+{
+	dq->top = 0;
+	dq->bottom = 0;
+}
+
+static inline int64_t
+jack_wsdeque_size (jack_wsdeque_t *dq)
+{
+	int64_t b = __atomic_load_n (&dq->bottom, __ATOMIC_ACQUIRE);
+	int64_t t = __atomic_load_n (&dq->top, __ATOMIC_ACQUIRE);
+
+	return b > t ? b - t : 0;
+}
+
+/* owner only. returns -1 if the deque is full */
+static inline int
+jack_wsdeque_push (jack_wsdeque_t *dq, void *item)
+{
+	int64_t b = __atomic_load_n (&dq->bottom, __ATOMIC_RELAXED);
+	int64_t t = __atomic_load_n (&dq->top, __ATOMIC_ACQUIRE);
+
+	if (b - t >= JACK_WSDEQUE_SIZE) {
+		return -1;
+	}
+
+	__atomic_store_n (&dq->ring[b & (JACK_WSDEQUE_SIZE - 1)], item,
+			  __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	__atomic_store_n (&dq->bottom, b + 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/* owner only */
+static inline void *
+jack_wsdeque_take (jack_wsdeque_t *dq)
+{
+	int64_t b = __atomic_load_n (&dq->bottom, __ATOMIC_RELAXED) - 1;
+	int64_t t;
+	void *item = NULL;
+
+	__atomic_store_n (&dq->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	t = __atomic_load_n (&dq->top, __ATOMIC_RELAXED);
+
+	if (t <= b) {
+		item = __atomic_load_n (&dq->ring[b & (JACK_WSDEQUE_SIZE - 1)],
+					__ATOMIC_RELAXED);
+		if (t == b) {
+			/* the last one: beat the thieves to it */
+			if (!__atomic_compare_exchange_n (&dq->top, &t, t + 1, 0,
+							  __ATOMIC_SEQ_CST,
+							  __ATOMIC_RELAXED)) {
+				item = NULL;
+			}
+			__atomic_store_n (&dq->bottom, b + 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		__atomic_store_n (&dq->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+
+	return item;
+}
+
+/* any thread but the owner */
+static inline void *
+jack_wsdeque_steal (jack_wsdeque_t *dq)
+{
+	int64_t t = __atomic_load_n (&dq->top, __ATOMIC_ACQUIRE);
+	int64_t b;
+	void *item;
+
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	b = __atomic_load_n (&dq->bottom, __ATOMIC_ACQUIRE);
+
+	if (t >= b) {
+		return NULL;
+	}
+
+	item = __atomic_load_n (&dq->ring[t & (JACK_WSDEQUE_SIZE - 1)],
+				__ATOMIC_RELAXED);
+
+	if (!__atomic_compare_exchange_n (&dq->top, &t, t + 1, 0,
+					  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+
+	return item;
+}
+
+#endif /* __jack_wsdeque_h__ */
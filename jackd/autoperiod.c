@@ -0,0 +1,352 @@
+/*
+    autoperiod -- internal client that tunes the period at run time
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Load it into jackd with
+ *
+ *    jackd -I autoperiod:autoperiod/min=64,max=1024 ...
+ *
+ * and it watches the xrun count and the 99.9th percentile of the DSP
+ * load. The period is doubled as soon as there were xruns, or the
+ * percentile went over `high', and halved again once it has stayed
+ * under `low' with no xruns for `stable' seconds. Every step goes
+ * through jack_set_buffer_size(), that is the driver's own bufsize()
+ * path, so it needs a server built with DO_BUFFER_RESIZE; without one
+ * the client says so and stays idle.
+ *
+ * The load histogram holds between one and two windows of cycles, so
+ * after each change nothing is judged until two full windows at the
+ * new size have gone by. A step down that turns out to cause xruns is
+ * not tried again for `stable' seconds times the number of times it
+ * failed.
+ *
+ * Like metrics, the client never activates and takes no graph slot.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <jack/jack.h>
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "libjack/local.h"
+
+#define AUTOPERIOD_PERCENTILE 99.9f
+
+typedef struct {
+	jack_client_t *client;
+	jack_native_thread_t thread;
+	int stop_fds[2];
+
+	jack_nframes_t min;
+	jack_nframes_t max;
+	float high;                     /* % of the period */
+	float low;
+	unsigned int stable;            /* secs */
+	unsigned int interval;          /* msecs */
+
+	uint32_t xruns;                 /* engine count at the last look */
+	jack_time_t settled_at;         /* judge nothing before this */
+	jack_time_t calm_since;         /* under low, no xruns, since */
+	jack_nframes_t failed_down;     /* the size a step down went to */
+	unsigned int failures;          /* ... and how often it xrun'd */
+	jack_time_t retry_at;           /* when it may be tried again */
+} autoperiod_t;
+
+/* two load windows at `nframes', from now */
+static jack_time_t
+autoperiod_settle (autoperiod_t *a, jack_nframes_t nframes)
+{
+	jack_control_t *ctl = a->client->engine;
+	jack_nframes_t rate = jack_get_sample_rate (a->client);
+	uint64_t window = ctl->load_stats.window;
+
+	if (rate == 0) {
+		rate = 48000;
+	}
+
+	return jack_get_time () +
+	       (2 * window * nframes * 1000000ULL) / rate;
+}
+
+static int
+autoperiod_step (autoperiod_t *a, jack_nframes_t from, jack_nframes_t to,
+		 const char *why, float load)
+{
+	int err;
+
+	jack_info ("autoperiod: %" PRIu32 " -> %" PRIu32 " frames (%s, "
+		   "p99.9 load %.1f%%)", from, to, why, load);
+
+	if ((err = jack_set_buffer_size (a->client, to)) != 0) {
+		if (err == ENOSYS) {
+			jack_error ("autoperiod: this server cannot change "
+				    "its buffer size; giving up");
+			return -1;
+		}
+		jack_error ("autoperiod: cannot change the period to %"
+			    PRIu32 " frames (%s)", to, strerror (err));
+		/* do not hammer a driver that refuses */
+		a->settled_at = jack_get_time () + a->stable * 1000000ULL;
+		return 0;
+	}
+
+	/* the xruns of the change itself do not count against it */
+	a->xruns = a->client->engine->xruns;
+	a->settled_at = autoperiod_settle (a, to);
+	a->calm_since = 0;
+
+	return 0;
+}
+
+/* one look at the engine; -1 to stop for good */
+static int
+autoperiod_check (autoperiod_t *a)
+{
+	jack_control_t *ctl = a->client->engine;
+	jack_nframes_t nframes = jack_get_buffer_size (a->client);
+	jack_time_t now = jack_get_time ();
+	uint32_t xruns = ctl->xruns;
+	uint32_t new_xruns = xruns - a->xruns;
+	float load;
+
+	a->xruns = xruns;
+
+	if (now < a->settled_at) {
+		/* an xrun right after a step down means it went too far */
+		if (new_xruns && nframes == a->failed_down &&
+		    nframes < a->max) {
+			a->failures++;
+			a->retry_at = now + (jack_time_t)a->stable *
+				      a->failures * 1000000ULL;
+			return autoperiod_step (a, nframes, nframes * 2,
+						"xruns after a step down", 0.0f);
+		}
+		return 0;
+	}
+
+	if ((load = jack_cpu_load_percentile (a->client,
+					      AUTOPERIOD_PERCENTILE)) < 0.0f) {
+		return 0;
+	}
+
+	if (new_xruns || load > a->high) {
+		a->calm_since = 0;
+		if (nframes >= a->max) {
+			return 0;
+		}
+		return autoperiod_step (a, nframes, nframes * 2,
+					new_xruns ? "xruns" : "load", load);
+	}
+
+	if (load >= a->low || nframes <= a->min) {
+		a->calm_since = 0;
+		return 0;
+	}
+
+	if (a->calm_since == 0) {
+		a->calm_since = now;
+		return 0;
+	}
+
+	if (now - a->calm_since < a->stable * 1000000ULL) {
+		return 0;
+	}
+
+	if (nframes / 2 == a->failed_down && now < a->retry_at) {
+		return 0;
+	}
+
+	a->failed_down = nframes / 2;
+
+	return autoperiod_step (a, nframes, nframes / 2, "stable", load);
+}
+
+static void *
+autoperiod_thread (void *arg)
+{
+	autoperiod_t *a = (autoperiod_t*)arg;
+	struct pollfd pfd;
+	int n;
+
+	pfd.fd = a->stop_fds[0];
+	pfd.events = POLLIN;
+
+	a->xruns = a->client->engine->xruns;
+	a->settled_at = autoperiod_settle (a, jack_get_buffer_size (a->client));
+
+	for (;; ) {
+		if ((n = poll (&pfd, 1, a->interval)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (n > 0) {
+			break;
+		}
+
+		if (autoperiod_check (a)) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int
+autoperiod_parse (autoperiod_t *a, const char *load_init)
+{
+	char *args, *opt, *value, *save = NULL;
+	int ret = 0;
+
+	if (load_init == NULL || *load_init == '\0') {
+		return 0;
+	}
+
+	if ((args = strdup (load_init)) == NULL) {
+		return -1;
+	}
+
+	for (opt = strtok_r (args, ",", &save); opt;
+	     opt = strtok_r (NULL, ",", &save)) {
+
+		if ((value = strchr (opt, '=')) == NULL) {
+			jack_error ("autoperiod: \"%s\" is not key=value", opt);
+			ret = -1;
+			break;
+		}
+		*value++ = '\0';
+
+		if (strcmp (opt, "min") == 0) {
+			a->min = atoi (value);
+		} else if (strcmp (opt, "max") == 0) {
+			a->max = atoi (value);
+		} else if (strcmp (opt, "high") == 0) {
+			a->high = atof (value);
+		} else if (strcmp (opt, "low") == 0) {
+			a->low = atof (value);
+		} else if (strcmp (opt, "stable") == 0) {
+			a->stable = atoi (value);
+		} else if (strcmp (opt, "interval") == 0) {
+			a->interval = atof (value) * 1000.0;
+		} else {
+			jack_error ("autoperiod: unknown option \"%s\"", opt);
+			ret = -1;
+			break;
+		}
+	}
+
+	free (args);
+
+	if (ret) {
+		return ret;
+	}
+
+	if (a->min == 0 || (a->min & (a->min - 1)) ||
+	    a->max == 0 || (a->max & (a->max - 1)) || a->min > a->max) {
+		jack_error ("autoperiod: min and max must be powers of two, "
+			    "min no more than max");
+		return -1;
+	}
+
+	if (!(a->low > 0.0f && a->low < a->high && a->high <= 100.0f)) {
+		jack_error ("autoperiod: need 0 < low < high <= 100");
+		return -1;
+	}
+
+	if (a->interval < 10) {
+		a->interval = 10;
+	}
+
+	return 0;
+}
+
+int
+jack_initialize (jack_client_t *client, const char *load_init)
+{
+	autoperiod_t *a;
+
+	if ((a = (autoperiod_t*)calloc (1, sizeof(autoperiod_t))) == NULL) {
+		return -1;
+	}
+
+	a->client = client;
+	a->min = 32;
+	a->max = 2048;
+	a->high = 70.0f;
+	a->low = 30.0f;
+	a->stable = 300;
+	a->interval = 1000;
+
+	if (autoperiod_parse (a, load_init)) {
+		free (a);
+		return -1;
+	}
+
+	if (pipe (a->stop_fds)) {
+		free (a);
+		return -1;
+	}
+
+	/* not realtime: it wakes up once an interval */
+	if (jack_client_create_thread (client, &a->thread, 0, 0,
+				       autoperiod_thread, a)) {
+		jack_error ("autoperiod: cannot start the control thread");
+		close (a->stop_fds[0]);
+		close (a->stop_fds[1]);
+		free (a);
+		return -1;
+	}
+
+	jack_info ("autoperiod: %" PRIu32 " to %" PRIu32 " frames, up over "
+		   "%.0f%%, down under %.0f%% for %us", a->min, a->max,
+		   a->high, a->low, a->stable);
+
+	/* see metrics.c: this keeps the client out of the graph */
+	client->process_arg = a;
+
+	return 0;
+}
+
+void
+jack_finish (void *arg)
+{
+	autoperiod_t *a = (autoperiod_t*)arg;
+	char c = 0;
+
+	if (a == NULL) {
+		return;
+	}
+
+	if (write (a->stop_fds[1], &c, 1) == 1) {
+		pthread_join (a->thread, NULL);
+	}
+
+	close (a->stop_fds[0]);
+	close (a->stop_fds[1]);
+	free (a);
+}
@@ -0,0 +1,391 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Startup latency calibration for jackd.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/* jackd --calibrate runs this before the engine exists, in the style
+ * of cyclictest: a thread at the priority and on the CPUs the driver
+ * thread will get sleeps to an absolute deadline every
+ * JACK_CALIBRATE_INTERVAL usecs and notes how late it woke up. Each
+ * time it then wakes a second thread, at client priority and on the
+ * client CPUs, through the same kind of activation the engine will
+ * use, and waits for it to answer: that round trip is what one client
+ * with an empty process() adds to a cycle. The tails of the two
+ * distributions decide which periods the machine can keep up with.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "calibrate.h"
+
+#define JACK_CALIBRATE_INTERVAL 1000    /* usecs */
+
+typedef struct {
+	jack_calibration_t *cal;
+	uint32_t max;
+	int futex;
+	jack_activation_t act[2];       /* 0: to the client, 1: back */
+	int to_client[2];
+	int to_driver[2];
+	volatile int done;
+	const char *driver_cpus;
+	const char *client_cpus;
+} jack_calibrate_run_t;
+
+static inline uint64_t
+jack_calibrate_nsecs (const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void
+jack_calibrate_signal (jack_calibrate_run_t *run, int to_client)
+{
+	char c = 0;
+
+	if (run->futex) {
+		jack_activation_signal (&run->act[to_client ? 0 : 1]);
+	} else if (write (to_client ? run->to_client[1] : run->to_driver[1],
+			  &c, 1) != 1) {
+		run->done = 1;
+	}
+}
+
+static int
+jack_calibrate_wait (jack_calibrate_run_t *run, int in_client)
+{
+	char c;
+
+	if (run->futex) {
+		return jack_activation_wait (&run->act[in_client ? 0 : 1],
+					     1000000) > 0 ? 0 : -1;
+	}
+	return read (in_client ? run->to_client[0] : run->to_driver[0],
+		     &c, 1) == 1 ? 0 : -1;
+}
+
+static void *
+jack_calibrate_client_thread (void *arg)
+{
+	jack_calibrate_run_t *run = (jack_calibrate_run_t*)arg;
+
+	if (run->client_cpus) {
+		jack_set_thread_cpus (pthread_self (), run->client_cpus);
+	}
+
+	while (jack_calibrate_wait (run, TRUE) == 0 && !run->done) {
+		jack_calibrate_signal (run, FALSE);
+	}
+
+	return NULL;
+}
+
+static void *
+jack_calibrate_driver_thread (void *arg)
+{
+	jack_calibrate_run_t *run = (jack_calibrate_run_t*)arg;
+	jack_calibration_t *cal = run->cal;
+	struct timespec next, now, back;
+	uint64_t deadline;
+	uint32_t i;
+
+	if (run->driver_cpus) {
+		jack_set_thread_cpus (pthread_self (), run->driver_cpus);
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &next);
+
+	for (i = 0; i < run->max && !run->done; i++) {
+
+		next.tv_nsec += JACK_CALIBRATE_INTERVAL * 1000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&next, NULL) == EINTR) {
+		}
+
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		deadline = jack_calibrate_nsecs (&next);
+		cal->wake_nsecs[i] = jack_calibrate_nsecs (&now) > deadline ?
+				     (uint32_t)(jack_calibrate_nsecs (&now) - deadline) : 0;
+
+		jack_calibrate_signal (run, TRUE);
+		if (jack_calibrate_wait (run, FALSE)) {
+			break;
+		}
+		clock_gettime (CLOCK_MONOTONIC, &back);
+		cal->hop_nsecs[i] = (uint32_t)(jack_calibrate_nsecs (&back)
+					       - jack_calibrate_nsecs (&now));
+
+		/* a tick missed entirely counts once; start afresh */
+		if (jack_calibrate_nsecs (&back) >
+		    deadline + JACK_CALIBRATE_INTERVAL * 1000) {
+			next = back;
+		}
+	}
+
+	cal->samples = i;
+	run->done = 1;
+	jack_calibrate_signal (run, TRUE);
+
+	return NULL;
+}
+
+static int
+jack_calibrate_cmp (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int
+jack_calibrate_start (pthread_t *thread, int priority, int realtime,
+		      void *(*fn)(void*), jack_calibrate_run_t *run)
+{
+	if (realtime &&
+	    jack_client_create_thread (NULL, thread, priority, TRUE, fn, run) == 0) {
+		return 0;
+	}
+
+	run->cal->realtime = FALSE;
+
+	return jack_client_create_thread (NULL, thread, 0, FALSE, fn, run);
+}
+
+int
+jack_calibrate (jack_calibration_t *cal, unsigned int seconds, int realtime,
+		int priority, jack_activation_type_t activation_type,
+		const char *driver_cpus, const char *client_cpus)
+{
+	jack_calibrate_run_t run;
+	pthread_t driver_thread, client_thread;
+
+	memset (cal, 0, sizeof(*cal));
+	memset (&run, 0, sizeof(run));
+
+	run.cal = cal;
+	run.max = seconds * (1000000 / JACK_CALIBRATE_INTERVAL);
+	run.futex = (activation_type == JackActivationFutex);
+	run.driver_cpus = driver_cpus;
+	run.client_cpus = client_cpus;
+	run.to_client[0] = run.to_client[1] = -1;
+	run.to_driver[0] = run.to_driver[1] = -1;
+
+	cal->interval_usecs = JACK_CALIBRATE_INTERVAL;
+	cal->realtime = realtime;
+
+	if (run.max == 0 ||
+	    (cal->wake_nsecs = calloc (run.max, sizeof(uint32_t))) == NULL ||
+	    (cal->hop_nsecs = calloc (run.max, sizeof(uint32_t))) == NULL) {
+		jack_error ("cannot allocate calibration samples");
+		jack_calibration_free (cal);
+		return -1;
+	}
+
+	if (!run.futex && (pipe (run.to_client) || pipe (run.to_driver))) {
+		jack_error ("cannot create calibration FIFOs (%s)",
+			    strerror (errno));
+		goto fail;
+	}
+
+	/* clients run 5 below the driver thread, see jack_engine_new() */
+	if (jack_calibrate_start (&client_thread, priority > 5 ? priority - 5 : 1,
+				  realtime, jack_calibrate_client_thread, &run)) {
+		jack_error ("cannot start calibration client thread");
+		goto fail;
+	}
+
+	if (jack_calibrate_start (&driver_thread, priority, cal->realtime,
+				  jack_calibrate_driver_thread, &run)) {
+		jack_error ("cannot start calibration driver thread");
+		run.done = 1;
+		jack_calibrate_signal (&run, TRUE);
+		pthread_join (client_thread, NULL);
+		goto fail;
+	}
+
+	pthread_join (driver_thread, NULL);
+	pthread_join (client_thread, NULL);
+
+	if (!run.futex) {
+		close (run.to_client[0]);
+		close (run.to_client[1]);
+		close (run.to_driver[0]);
+		close (run.to_driver[1]);
+	}
+
+	if (cal->samples == 0) {
+		jack_error ("calibration took no samples");
+		jack_calibration_free (cal);
+		return -1;
+	}
+
+	qsort (cal->wake_nsecs, cal->samples, sizeof(uint32_t), jack_calibrate_cmp);
+	qsort (cal->hop_nsecs, cal->samples, sizeof(uint32_t), jack_calibrate_cmp);
+
+	return 0;
+
+fail:
+	if (run.to_client[0] >= 0) {
+		close (run.to_client[0]);
+		close (run.to_client[1]);
+	}
+	if (run.to_driver[0] >= 0) {
+		close (run.to_driver[0]);
+		close (run.to_driver[1]);
+	}
+	jack_calibration_free (cal);
+	return -1;
+}
+
+void
+jack_calibration_free (jack_calibration_t *cal)
+{
+	free (cal->wake_nsecs);
+	free (cal->hop_nsecs);
+	cal->wake_nsecs = cal->hop_nsecs = NULL;
+	cal->samples = 0;
+}
+
+double
+jack_calibration_quantile (const uint32_t *sorted, uint32_t n, double q)
+{
+	uint32_t i;
+
+	if (n == 0) {
+		return 0.0;
+	}
+	if (q >= 1.0) {
+		return sorted[n - 1];
+	}
+
+	i = (uint32_t)(q * n);
+
+	return sorted[i < n ? i : n - 1];
+}
+
+/* How long the start of a cycle with `hops' clients can take, in
+ * usecs, when it may overrun once in 1/target cycles. A target rarer
+ * than one in the number of samples cannot be read off them, so the
+ * worst case seen is used with half as much again on top.
+ */
+static double
+jack_calibration_tail (const jack_calibration_t *cal, double target,
+		       unsigned int hops)
+{
+	double wake, hop;
+
+	if (target * cal->samples < 1.0) {
+		wake = cal->wake_nsecs[cal->samples - 1] * 1.5;
+		hop = cal->hop_nsecs[cal->samples - 1] * 1.5;
+	} else {
+		wake = jack_calibration_quantile (cal->wake_nsecs, cal->samples,
+						  1.0 - target);
+		hop = jack_calibration_quantile (cal->hop_nsecs, cal->samples,
+						 1.0 - target);
+	}
+
+	return (wake + hops * hop) / 1000.0;
+}
+
+int
+jack_calibration_recommend (const jack_calibration_t *cal, jack_nframes_t rate,
+			    double target, unsigned int hops,
+			    jack_nframes_t *period, unsigned int *nperiods)
+{
+	double tail, period_usecs;
+	jack_nframes_t p;
+	unsigned int n;
+
+	if (cal->samples == 0 || rate == 0) {
+		return -1;
+	}
+
+	tail = jack_calibration_tail (cal, target, hops);
+
+	/* the graph has (n - 1) periods to get a period's audio to the
+	   hardware, and the clients get their share of one of them */
+
+	for (p = 16; p <= 4096; p *= 2) {
+		period_usecs = p * 1000000.0 / rate;
+		for (n = 2; n <= 3; n++) {
+			if (tail + JACK_CALIBRATE_DSP_SHARE * period_usecs
+			    <= (n - 1) * period_usecs) {
+				*period = p;
+				*nperiods = n;
+				return 0;
+			}
+		}
+	}
+
+	return -1;
+}
+
+void
+jack_calibration_report (const jack_calibration_t *cal, jack_nframes_t rate,
+			 double target, FILE *file)
+{
+	jack_nframes_t period;
+	unsigned int nperiods;
+
+	fprintf (file, "calibration: %u ticks of %u usecs%s\n",
+		 cal->samples, cal->interval_usecs,
+		 cal->realtime ? "" : " (NOT realtime, expect it to look bad)");
+	fprintf (file, "  wakeup latency usecs: p50 %.1f  p99 %.1f  p99.9 %.1f  p99.99 %.1f  max %.1f\n",
+		 jack_calibration_quantile (cal->wake_nsecs, cal->samples, 0.5) / 1000.0,
+		 jack_calibration_quantile (cal->wake_nsecs, cal->samples, 0.99) / 1000.0,
+		 jack_calibration_quantile (cal->wake_nsecs, cal->samples, 0.999) / 1000.0,
+		 jack_calibration_quantile (cal->wake_nsecs, cal->samples, 0.9999) / 1000.0,
+		 cal->wake_nsecs[cal->samples - 1] / 1000.0);
+	fprintf (file, "  empty client hop usecs: p50 %.1f  p99 %.1f  p99.9 %.1f  p99.99 %.1f  max %.1f\n",
+		 jack_calibration_quantile (cal->hop_nsecs, cal->samples, 0.5) / 1000.0,
+		 jack_calibration_quantile (cal->hop_nsecs, cal->samples, 0.99) / 1000.0,
+		 jack_calibration_quantile (cal->hop_nsecs, cal->samples, 0.999) / 1000.0,
+		 jack_calibration_quantile (cal->hop_nsecs, cal->samples, 0.9999) / 1000.0,
+		 cal->hop_nsecs[cal->samples - 1] / 1000.0);
+
+	if (target * cal->samples < 1.0) {
+		fprintf (file, "  (a target of %g is rarer than the run could see; "
+			 "using the worst case plus 50%%)\n", target);
+	}
+
+	if (jack_calibration_recommend (cal, rate, target, 1,
+					&period, &nperiods) == 0) {
+		fprintf (file, "recommended at %u Hz, for xruns in at most %g of "
+			 "cycles: -p %u -n %u (%.1f msecs)\n", rate, target,
+			 period, nperiods, period * nperiods * 1000.0 / rate);
+	} else {
+		fprintf (file, "no period up to 4096 frames at %u Hz keeps xruns "
+			 "below %g of cycles on this machine\n", rate, target);
+	}
+}
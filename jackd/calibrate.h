@@ -0,0 +1,69 @@
+/*
+ *  Startup latency calibration for jackd.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __jack_calibrate_h__
+#define __jack_calibrate_h__
+
+#include <stdio.h>
+#include <jack/types.h>
+
+#include "activation.h"
+
+/* What jackd --calibrate measured: for every tick of a timer running
+ * at the driver thread's priority, how late the thread woke up, and
+ * how long a round trip to a thread at client priority took after
+ * that, which is what waking one client that does nothing costs. Both
+ * sample arrays are sorted, in nanoseconds.
+ */
+typedef struct {
+	uint32_t samples;
+	uint32_t interval_usecs;        /* between ticks */
+	int realtime;                   /* did the threads get SCHED_FIFO? */
+	uint32_t *wake_nsecs;
+	uint32_t *hop_nsecs;
+} jack_calibration_t;
+
+/* the share of a period left for process() callbacks when choosing */
+#define JACK_CALIBRATE_DSP_SHARE 0.5
+
+extern int jack_calibrate(jack_calibration_t *cal, unsigned int seconds,
+			  int realtime, int priority,
+			  jack_activation_type_t activation_type,
+			  const char *driver_cpus, const char *client_cpus);
+extern void jack_calibration_free(jack_calibration_t *cal);
+
+/* the value that a share `q' (0 to 1) of the samples do not exceed */
+extern double jack_calibration_quantile(const uint32_t *sorted,
+					uint32_t n, double q);
+
+/* The smallest period, and the fewest periods with it, for which a
+ * cycle of `hops' empty clients misses its deadline with a probability
+ * of at most `target' per cycle on this machine. Returns -1 if no
+ * period up to 4096 frames will do.
+ */
+extern int jack_calibration_recommend(const jack_calibration_t *cal,
+				      jack_nframes_t rate, double target,
+				      unsigned int hops, jack_nframes_t *period,
+				      unsigned int *nperiods);
+
+extern void jack_calibration_report(const jack_calibration_t *cal,
+				    jack_nframes_t rate, double target,
+				    FILE *file);
+
+#endif /* __jack_calibrate_h__ */
@@ -0,0 +1,582 @@
+/*
+    The graph checkpoint -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "engine.h"
+#include "checkpoint.h"
+
+/* A non-realtime thread writes the graph to the file a little while
+ * after it changed, and once more when the server stops, before its
+ * clients are taken down. The file is a jack_checkpoint_header_t
+ * followed by the clients, the ports and the connections, each a
+ * fixed size record, and is replaced by rename(), so it is never seen
+ * half written. Port aliases that clients set go to shared memory
+ * without the server hearing about it; they are kept as they stand
+ * when the graph next changes.
+ */
+
+#define JACK_CHECKPOINT_MAGIC 0x4a474331        /* "JGC1" */
+#define JACK_CHECKPOINT_USECS 250000            /* let changes pile up */
+
+typedef struct {
+	uint32_t magic;
+	uint32_t client_size;           /* sizeof(jack_checkpoint_client_t) */
+	uint32_t port_size;             /* sizeof(jack_checkpoint_port_t) */
+	uint32_t connection_size;       /* sizeof(jack_checkpoint_connection_t) */
+	uint32_t buffer_size;
+	uint32_t start_buffer_size;
+	uint32_t nclients;
+	uint32_t nports;
+	uint32_t nconnections;
+} jack_checkpoint_header_t;
+
+void
+jack_checkpoint_dirty (jack_checkpoint_t *cp)
+{
+	if (cp == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&cp->lock);
+	cp->dirty = 1;
+	pthread_cond_signal (&cp->dirty_cond);
+	pthread_mutex_unlock (&cp->lock);
+}
+
+/* called with cp->lock */
+static jack_checkpoint_client_t *
+jack_checkpoint_find_client (jack_checkpoint_t *cp, const char *name,
+			     jack_uuid_t uuid, JSList **where)
+{
+	jack_checkpoint_client_t *c;
+	JSList *node;
+
+	for (node = cp->clients; node; node = jack_slist_next (node)) {
+		c = (jack_checkpoint_client_t*)node->data;
+		if (name ? strcmp (c->name, name) == 0
+		    : jack_uuid_compare (c->uuid, uuid) == 0) {
+			if (where) {
+				*where = node;
+			}
+			return c;
+		}
+	}
+
+	return NULL;
+}
+
+jack_uuid_t
+jack_checkpoint_take_client (jack_checkpoint_t *cp, const char *name,
+			     jack_uuid_t uuid)
+{
+	jack_checkpoint_client_t *c;
+	jack_uuid_t kept = 0;
+	JSList *node;
+
+	pthread_mutex_lock (&cp->lock);
+
+	/* a session manager that reserved the name hands the UUID over
+	   itself; otherwise the name has to do */
+	if ((c = jack_checkpoint_find_client (cp, jack_uuid_empty (uuid) ?
+					      name : NULL, uuid, &node))) {
+		jack_uuid_copy (&kept, c->uuid);
+		cp->clients = jack_slist_remove_link (cp->clients, node);
+		jack_slist_free_1 (node);
+		free (c);
+	}
+
+	pthread_mutex_unlock (&cp->lock);
+
+	return kept;
+}
+
+int
+jack_checkpoint_holds_uuid (jack_checkpoint_t *cp, jack_uuid_t uuid)
+{
+	int held;
+
+	pthread_mutex_lock (&cp->lock);
+	held = jack_checkpoint_find_client (cp, NULL, uuid, NULL) != NULL;
+	pthread_mutex_unlock (&cp->lock);
+
+	return held;
+}
+
+jack_checkpoint_port_t *
+jack_checkpoint_take_port (jack_checkpoint_t *cp, const char *name)
+{
+	jack_checkpoint_port_t *p = NULL;
+	JSList *node;
+
+	pthread_mutex_lock (&cp->lock);
+
+	for (node = cp->ports; node; node = jack_slist_next (node)) {
+		if (strcmp (((jack_checkpoint_port_t*)node->data)->name,
+			    name) == 0) {
+			p = (jack_checkpoint_port_t*)node->data;
+			cp->ports = jack_slist_remove_link (cp->ports, node);
+			jack_slist_free_1 (node);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock (&cp->lock);
+
+	return p;
+}
+
+/* whether the client a port name starts with is here, or may still
+   come back; called with the graph lock and cp->lock */
+static int
+jack_checkpoint_owner_known (jack_checkpoint_t *cp, const char *port_name)
+{
+	char client_name[JACK_CLIENT_NAME_SIZE];
+	const char *colon;
+	size_t len;
+
+	if ((colon = strchr (port_name, ':')) == NULL ||
+	    (len = colon - port_name) >= sizeof(client_name)) {
+		return FALSE;
+	}
+
+	memcpy (client_name, port_name, len);
+	client_name[len] = '\0';
+
+	/* not jack_client_by_name(), we have the graph lock already */
+	return jack_client_lookup_name (cp->engine, client_name) != NULL ||
+	       jack_checkpoint_find_client (cp, client_name, 0, NULL) != NULL;
+}
+
+static int
+jack_checkpoint_write (int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = write (fd, p, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+jack_checkpoint_read (int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = read (fd, p, len)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Copy the graph out under the graph's read lock, which the process
+ * cycle can share, and write it without.
+ */
+static int
+jack_checkpoint_save (jack_checkpoint_t *cp)
+{
+	jack_engine_t *engine = cp->engine;
+	jack_checkpoint_header_t hdr;
+	jack_checkpoint_client_t *clients;
+	jack_checkpoint_port_t *ports;
+	jack_checkpoint_connection_t *connections;
+	jack_client_internal_t *client;
+	jack_port_internal_t *port;
+	jack_connection_internal_t *c;
+	JSList *node, *pnode, *cnode;
+	uint32_t maxclients = 0, maxports = 0, maxconnections = 0;
+	char tmp[PATH_MAX + 1];
+	int fd, err;
+
+	memset (&hdr, 0, sizeof(hdr));
+	hdr.magic = JACK_CHECKPOINT_MAGIC;
+	hdr.client_size = sizeof(jack_checkpoint_client_t);
+	hdr.port_size = sizeof(jack_checkpoint_port_t);
+	hdr.connection_size = sizeof(jack_checkpoint_connection_t);
+
+	jack_rdlock_graph (engine);
+	pthread_mutex_lock (&cp->lock);
+
+	cp->dirty = 0;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		maxclients++;
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			port = (jack_port_internal_t*)pnode->data;
+			maxports++;
+			maxconnections += jack_slist_length (port->connections);
+		}
+	}
+	maxclients += jack_slist_length (cp->clients);
+	maxports += jack_slist_length (cp->ports);
+	maxconnections += jack_slist_length (cp->connections);
+
+	clients = (jack_checkpoint_client_t*)
+		  calloc (maxclients + 1, sizeof(jack_checkpoint_client_t));
+	ports = (jack_checkpoint_port_t*)
+		calloc (maxports + 1, sizeof(jack_checkpoint_port_t));
+	connections = (jack_checkpoint_connection_t*)
+		      calloc (maxconnections + 1,
+			      sizeof(jack_checkpoint_connection_t));
+
+	if (clients == NULL || ports == NULL || connections == NULL) {
+		cp->dirty = 1;
+		pthread_mutex_unlock (&cp->lock);
+		jack_unlock_graph (engine);
+		free (clients);
+		free (ports);
+		free (connections);
+		return -1;
+	}
+
+	hdr.buffer_size = engine->control->buffer_size;
+	hdr.start_buffer_size = cp->driver_buffer_size;
+
+	/* the live graph; drivers come back with their ports by
+	   themselves, but their ports may have aliases and connections */
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+
+		if (client->control->dead) {
+			continue;
+		}
+
+		if (client->control->type != ClientDriver) {
+			jack_checkpoint_client_t *r = &clients[hdr.nclients++];
+			jack_uuid_copy (&r->uuid, client->control->uuid);
+			snprintf (r->name, sizeof(r->name), "%s",
+				  (char*)client->control->name);
+		}
+
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			jack_checkpoint_port_t *r = &ports[hdr.nports++];
+
+			port = (jack_port_internal_t*)pnode->data;
+			memcpy (r->name, port->names->name, sizeof(r->name));
+			memcpy (r->alias1, port->names->alias1, sizeof(r->alias1));
+			memcpy (r->alias2, port->names->alias2, sizeof(r->alias2));
+
+			for (cnode = port->connections; cnode;
+			     cnode = jack_slist_next (cnode)) {
+				c = (jack_connection_internal_t*)cnode->data;
+				if (c->source != port) {
+					continue;
+				}
+				memcpy (connections[hdr.nconnections].source,
+					c->source->names->name,
+					sizeof(connections[0].source));
+				memcpy (connections[hdr.nconnections].destination,
+					c->destination->names->name,
+					sizeof(connections[0].destination));
+				hdr.nconnections++;
+			}
+		}
+	}
+
+	/* and what has not come back yet, as long as its clients may */
+
+	for (node = cp->clients; node; node = jack_slist_next (node)) {
+		clients[hdr.nclients++] = *(jack_checkpoint_client_t*)node->data;
+	}
+
+	for (node = cp->ports; node; node = jack_slist_next (node)) {
+		jack_checkpoint_port_t *p = (jack_checkpoint_port_t*)node->data;
+		if (jack_checkpoint_owner_known (cp, p->name)) {
+			ports[hdr.nports++] = *p;
+		}
+	}
+
+	for (node = cp->connections; node; node = jack_slist_next (node)) {
+		jack_checkpoint_connection_t *p =
+			(jack_checkpoint_connection_t*)node->data;
+		if (jack_checkpoint_owner_known (cp, p->source) &&
+		    jack_checkpoint_owner_known (cp, p->destination)) {
+			connections[hdr.nconnections++] = *p;
+		}
+	}
+
+	pthread_mutex_unlock (&cp->lock);
+	jack_unlock_graph (engine);
+
+	snprintf (tmp, sizeof(tmp), "%s.tmp", cp->path);
+
+	if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		jack_error ("cannot write the graph to %s (%s)", tmp,
+			    strerror (errno));
+		free (clients);
+		free (ports);
+		free (connections);
+		return -1;
+	}
+
+	err = jack_checkpoint_write (fd, &hdr, sizeof(hdr)) ||
+	      jack_checkpoint_write (fd, clients, hdr.nclients
+				     * sizeof(jack_checkpoint_client_t)) ||
+	      jack_checkpoint_write (fd, ports, hdr.nports
+				     * sizeof(jack_checkpoint_port_t)) ||
+	      jack_checkpoint_write (fd, connections, hdr.nconnections
+				     * sizeof(jack_checkpoint_connection_t));
+
+	free (clients);
+	free (ports);
+	free (connections);
+
+	if (err || fsync (fd)) {
+		jack_error ("cannot write the graph to %s (%s)", tmp,
+			    strerror (errno));
+		close (fd);
+		unlink (tmp);
+		return -1;
+	}
+
+	close (fd);
+
+	if (rename (tmp, cp->path)) {
+		jack_error ("cannot replace %s (%s)", cp->path, strerror (errno));
+		unlink (tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* read `n' records of `size' bytes onto the front of `*list' */
+static int
+jack_checkpoint_read_records (int fd, uint32_t n, size_t size, JSList **list)
+{
+	void *rec;
+
+	while (n--) {
+		if ((rec = malloc (size)) == NULL ||
+		    jack_checkpoint_read (fd, rec, size)) {
+			free (rec);
+			return -1;
+		}
+		*list = jack_slist_prepend (*list, rec);
+	}
+
+	return 0;
+}
+
+/* a file that cannot be read is reported, and the server starts with
+   an empty graph rather than not at all */
+static void
+jack_checkpoint_load (jack_checkpoint_t *cp)
+{
+	jack_checkpoint_header_t hdr;
+	jack_checkpoint_client_t *c;
+	JSList *node, *next;
+	int fd;
+
+	if ((fd = open (cp->path, O_RDONLY)) < 0) {
+		if (errno != ENOENT) {
+			jack_error ("cannot read the graph from %s (%s)",
+				    cp->path, strerror (errno));
+		}
+		return;
+	}
+
+	if (jack_checkpoint_read (fd, &hdr, sizeof(hdr)) ||
+	    hdr.magic != JACK_CHECKPOINT_MAGIC ||
+	    hdr.client_size != sizeof(jack_checkpoint_client_t) ||
+	    hdr.port_size != sizeof(jack_checkpoint_port_t) ||
+	    hdr.connection_size != sizeof(jack_checkpoint_connection_t)) {
+		jack_error ("%s does not hold a JACK graph", cp->path);
+		close (fd);
+		return;
+	}
+
+	if (jack_checkpoint_read_records (fd, hdr.nclients,
+					  sizeof(jack_checkpoint_client_t),
+					  &cp->clients) ||
+	    jack_checkpoint_read_records (fd, hdr.nports,
+					  sizeof(jack_checkpoint_port_t),
+					  &cp->ports) ||
+	    jack_checkpoint_read_records (fd, hdr.nconnections,
+					  sizeof(jack_checkpoint_connection_t),
+					  &cp->connections)) {
+		jack_error ("%s is damaged, some of the graph is lost",
+			    cp->path);
+	}
+
+	close (fd);
+
+	for (node = cp->ports; node; node = jack_slist_next (node)) {
+		jack_checkpoint_port_t *p = (jack_checkpoint_port_t*)node->data;
+		p->name[sizeof(p->name) - 1] = '\0';
+		p->alias1[sizeof(p->alias1) - 1] = '\0';
+		p->alias2[sizeof(p->alias2) - 1] = '\0';
+	}
+
+	for (node = cp->connections; node; node = jack_slist_next (node)) {
+		jack_checkpoint_connection_t *p =
+			(jack_checkpoint_connection_t*)node->data;
+		p->source[sizeof(p->source) - 1] = '\0';
+		p->destination[sizeof(p->destination) - 1] = '\0';
+	}
+
+	/* a client that stayed away for too many restarts is not
+	   coming back; its ports and connections go with it at the
+	   next snapshot */
+	for (node = cp->clients; node; node = next) {
+		next = jack_slist_next (node);
+		c = (jack_checkpoint_client_t*)node->data;
+		c->name[sizeof(c->name) - 1] = '\0';
+		if (++c->missed > JACK_CHECKPOINT_MAX_MISSED) {
+			cp->clients = jack_slist_remove_link (cp->clients, node);
+			jack_slist_free_1 (node);
+			free (c);
+		}
+	}
+
+	cp->buffer_size = hdr.buffer_size;
+	cp->start_buffer_size = hdr.start_buffer_size;
+
+	jack_info ("graph of %" PRIu32 " clients, %" PRIu32 " ports and %"
+		   PRIu32 " connections read from %s", hdr.nclients,
+		   hdr.nports, hdr.nconnections, cp->path);
+}
+
+static void *
+jack_checkpoint_thread (void *arg)
+{
+	jack_checkpoint_t *cp = (jack_checkpoint_t*)arg;
+
+	pthread_mutex_lock (&cp->lock);
+
+	while (cp->running) {
+		if (!cp->dirty) {
+			pthread_cond_wait (&cp->dirty_cond, &cp->lock);
+			continue;
+		}
+		pthread_mutex_unlock (&cp->lock);
+		usleep (JACK_CHECKPOINT_USECS);
+		jack_checkpoint_save (cp);
+		pthread_mutex_lock (&cp->lock);
+	}
+
+	pthread_mutex_unlock (&cp->lock);
+
+	return NULL;
+}
+
+jack_checkpoint_t *
+jack_checkpoint_new (jack_engine_t *engine, const char *path)
+{
+	jack_checkpoint_t *cp;
+
+	if ((cp = (jack_checkpoint_t*)calloc (1, sizeof(jack_checkpoint_t)))
+	    == NULL) {
+		return NULL;
+	}
+
+	if ((cp->path = strdup (path)) == NULL) {
+		free (cp);
+		return NULL;
+	}
+
+	cp->engine = engine;
+	pthread_mutex_init (&cp->lock, NULL);
+	pthread_cond_init (&cp->dirty_cond, NULL);
+
+	jack_checkpoint_load (cp);
+
+	cp->running = 1;
+
+	if (jack_client_create_thread (NULL, &cp->thread, 0, FALSE,
+				       jack_checkpoint_thread, cp)) {
+		jack_error ("cannot create the graph checkpoint thread; "
+			    "the graph will not be kept in %s", path);
+		cp->running = 0;
+		jack_checkpoint_delete (cp);
+		return NULL;
+	}
+
+	return cp;
+}
+
+static void
+jack_checkpoint_free_list (JSList *list)
+{
+	JSList *node;
+
+	for (node = list; node; node = jack_slist_next (node)) {
+		free (node->data);
+	}
+	jack_slist_free (list);
+}
+
+void
+jack_checkpoint_delete (jack_checkpoint_t *cp)
+{
+	if (cp == NULL) {
+		return;
+	}
+
+	if (cp->running) {
+		pthread_mutex_lock (&cp->lock);
+		cp->running = 0;
+		pthread_cond_signal (&cp->dirty_cond);
+		pthread_mutex_unlock (&cp->lock);
+		pthread_join (cp->thread, NULL);
+
+		if (cp->dirty) {
+			jack_checkpoint_save (cp);
+		}
+	}
+
+	jack_checkpoint_free_list (cp->clients);
+	jack_checkpoint_free_list (cp->ports);
+	jack_checkpoint_free_list (cp->connections);
+
+	pthread_cond_destroy (&cp->dirty_cond);
+	pthread_mutex_destroy (&cp->lock);
+	free (cp->path);
+	free (cp);
+}
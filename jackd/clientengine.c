@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/socket.h>
 
 #include "internal.h"
 #include "engine.h"
@@ -45,6 +46,57 @@
 
 #include "libjack/local.h"
 
+static inline unsigned int
+jack_client_name_bucket (const char *name)
+{
+	return jack_port_name_hash (name) & (JACK_CLIENT_HASH_SIZE - 1);
+}
+
+static inline unsigned int
+jack_client_uuid_bucket (jack_uuid_t uuid)
+{
+	/* the low word counts up, and spreads them well enough */
+	return (uint32_t)(uuid ^ (uuid >> 32)) & (JACK_CLIENT_HASH_SIZE - 1);
+}
+
+/* index a client that has just gone onto engine->clients; its name
+   and UUID do not change after that. caller holds the graph lock */
+static void
+jack_client_hash_insert (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	unsigned int n = jack_client_name_bucket ((const char*)client->control->name);
+	unsigned int u = jack_client_uuid_bucket (client->control->uuid);
+
+	client->name_next = engine->clients_by_name[n];
+	engine->clients_by_name[n] = client;
+	client->uuid_next = engine->clients_by_uuid[u];
+	engine->clients_by_uuid[u] = client;
+}
+
+static void
+jack_client_hash_remove (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	jack_client_internal_t **pp;
+
+	for (pp = &engine->clients_by_name[jack_client_name_bucket ((const char*)client->control->name)];
+	     *pp; pp = &(*pp)->name_next) {
+		if (*pp == client) {
+			*pp = client->name_next;
+			break;
+		}
+	}
+
+	for (pp = &engine->clients_by_uuid[jack_client_uuid_bucket (client->control->uuid)];
+	     *pp; pp = &(*pp)->uuid_next) {
+		if (*pp == client) {
+			*pp = client->uuid_next;
+			break;
+		}
+	}
+
+	client->name_next = client->uuid_next = NULL;
+}
+
 static void
 jack_client_disconnect_ports (jack_engine_t *engine,
 			      jack_client_internal_t *client)
@@ -82,6 +134,11 @@ jack_client_do_deactivate (jack_engine_t *engine,
 
 	jack_transport_client_exit (engine, client);
 
+	if (jack_client_is_decimated (client)) {
+		jack_client_ring_release (client);
+		client->decimation = 0;
+	}
+
 	if (!jack_client_is_internal (client) &&
 	    engine->external_client_cnt > 0) {
 		engine->external_client_cnt--;
@@ -166,18 +223,48 @@ jack_zombify_client (jack_engine_t *engine, jack_client_internal_t *client)
 	/* this stops jack_deliver_event() from contacing this client */
 
 	client->control->dead = TRUE;
+	jack_engine_watch_client (engine, client);
 
 	jack_client_disconnect_ports (engine, client);
 	jack_client_do_deactivate (engine, client, FALSE);
 }
 
+/* The quick half of removing a failed client, done with the graph write
+   lock held for as short as possible: take the client out of the
+   processing chain and cut its connections, but leave the notifications
+   and the release of its ports and segments to jack_teardown_clients().
+ */
+static void
+jack_unlink_client (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	JSList *node;
+
+	/* caller must hold the client_lock */
+
+	if (client->control->dead) {
+		return;
+	}
+
+	VERBOSE (engine, "unlinking client \"%s\" from the processing chain",
+		 client->control->name);
+
+	client->control->dead = TRUE;
+	jack_engine_watch_client (engine, client);
+
+	engine->defer_disconnect_notices = TRUE;
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		jack_port_clear_connections (engine,
+					     (jack_port_internal_t*)node->data);
+	}
+	engine->defer_disconnect_notices = FALSE;
+
+	jack_client_do_deactivate (engine, client, FALSE);
+}
+
 void
 jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 {
 	JSList *node;
-	jack_uuid_t finalizer = JACK_UUID_EMPTY_INITIALIZER;
-
-	jack_uuid_clear (&finalizer);
 
 	/* caller must write-hold the client lock */
 
@@ -193,19 +280,16 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 
 	if (!client->control->dead) {
 		jack_zombify_client (engine, client);
+	} else if (client->ports) {
+		/* unlinked, see jack_unlink_client() */
+		jack_client_disconnect_ports (engine, client);
 	}
 
 	if (client->session_reply_pending) {
 		engine->session_pending_replies -= 1;
 
 		if (engine->session_pending_replies == 0) {
-			if (write (engine->session_reply_fd, &finalizer, sizeof(finalizer))
-			    < (ssize_t)sizeof(finalizer)) {
-				jack_error ("cannot write SessionNotify result "
-					    "to client via fd = %d (%s)",
-					    engine->session_reply_fd, strerror (errno));
-			}
-			engine->session_reply_fd = -1;
+			jack_session_finish (engine);
 		}
 	}
 
@@ -213,8 +297,13 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 
 		/* try to force the server thread to return from poll */
 
+		jack_engine_unwatch_client (engine, client);
 		close (client->event_fd);
 		close (client->request_fd);
+		if (client->pid_fd >= 0) {
+			close (client->pid_fd);
+			client->pid_fd = -1;
+		}
 	}
 
 	VERBOSE (engine, "before: client list contains %d", jack_slist_length (engine->clients));
@@ -223,6 +312,7 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 		if (jack_uuid_compare (((jack_client_internal_t*)node->data)->control->uuid, client->control->uuid) == 0) {
 			engine->clients = jack_slist_remove_link (engine->clients, node);
 			jack_slist_free_1 (node);
+			jack_client_hash_remove (engine, client);
 			VERBOSE (engine, "removed from client list, via matching UUID");
 			break;
 		}
@@ -230,6 +320,13 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 
 	VERBOSE (engine, "after: client list contains %d", jack_slist_length (engine->clients));
 
+	jack_reach_detach (engine, client);
+
+	/* the execution plans may still refer to this client */
+
+	jack_dag_remove_client (engine, client);
+	jack_engine_compile_plan (engine);
+
 	jack_client_delete (engine, client);
 
 	if (engine->temporary) {
@@ -273,6 +370,7 @@ jack_check_clients (jack_engine_t* engine, int with_timeout_check)
 	JSList* node;
 	jack_client_internal_t* client;
 	int errs = 0;
+	int late = 0;
 
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
 
@@ -302,28 +400,26 @@ jack_check_clients (jack_engine_t* engine, int with_timeout_check)
 					jack_time_t now = jack_get_microseconds ();
 
 					if ((now - client->control->awake_at) < engine->driver->period_usecs) {
-						/* we give the client a bit of time, to finish the cycle
-						 * we assume here, that we dont get signals delivered to this thread.
+						/* it is late, not dead. waiting for it here
+						 * would cost the driver the cycle anyway, so
+						 * give up on the rest of this one and let the
+						 * client finish by itself, see
+						 * jack_engine_late_clients(). a single
+						 * occurence is probably fine; a stream of them
+						 * runs into timeout_count_threshold.
 						 */
-						struct timespec wait_time;
-						wait_time.tv_sec = 0;
-						wait_time.tv_nsec = (engine->driver->period_usecs - (now - client->control->awake_at)) * 1000;
-						VERBOSE (engine, "client %s seems to have timed out. we may have mercy of %d ns.", client->control->name, (int)wait_time.tv_nsec );
-						nanosleep (&wait_time, NULL);
-					}
-
-					if (client->control->finished_at == 0) {
+						VERBOSE (engine, "client %s is late, giving up on the rest of the cycle", client->control->name);
+						client->control->timed_out++;
+						engine->timeout_count += 1;
+						if (engine->late_since == 0) {
+							engine->late_since = now;
+						}
+						late++;
+					} else {
 						client->control->timed_out++;
 						client->error++;
 						errs++;
 						VERBOSE (engine, "client %s has timed out", client->control->name);
-					} else {
-						/*
-						 * the client recovered. if this is a single occurence, thats probably fine.
-						 * however, we increase the continuous_stream flag.
-						 */
-
-						engine->timeout_count += 1;
 					}
 				}
 			}
@@ -334,7 +430,7 @@ jack_check_clients (jack_engine_t* engine, int with_timeout_check)
 		jack_engine_signal_problems (engine);
 	}
 
-	return errs;
+	return errs + late;
 }
 
 void
@@ -379,9 +475,12 @@ jack_remove_clients (jack_engine_t* engine, int* exit_freewheeling_when_done)
 					 client->control->name,
 					 jack_client_state_name (client),
 					 client->error);
-				jack_remove_client (engine,
-						    (jack_client_internal_t*)
-						    node->data);
+				if (jack_client_is_internal (client)) {
+					jack_remove_client (engine, client);
+				} else {
+					/* jack_teardown_clients() does the rest */
+					jack_unlink_client (engine, client);
+				}
 			} else {
 				VERBOSE (engine, "client failure: "
 					 "client %s state = %s errors"
@@ -412,47 +511,76 @@ jack_remove_clients (jack_engine_t* engine, int* exit_freewheeling_when_done)
 	VERBOSE (engine, "-- Removing failed clients ...");
 }
 
-jack_client_internal_t *
-jack_client_by_name (jack_engine_t *engine, const char *name)
+void
+jack_teardown_clients (jack_engine_t* engine)
 {
-	jack_client_internal_t *client = NULL;
-	JSList *node;
+	JSList *tmp, *node;
+	jack_client_internal_t *client;
 
-	jack_rdlock_graph (engine);
+	/* CALLER MUST HOLD GRAPH LOCK */
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		if (strcmp ((const char*)((jack_client_internal_t*)
-					  node->data)->control->name,
-			    name) == 0) {
-			client = (jack_client_internal_t*)node->data;
+	/* the clients that jack_remove_clients() unlinked; any that failed
+	   since then are left for its next round
+	 */
+
+	for (node = engine->clients; node; ) {
+
+		tmp = jack_slist_next (node);
+
+		client = (jack_client_internal_t*)node->data;
+
+		if (client->error >= JACK_ERROR_WITH_SOCKETS &&
+		    client->control->dead &&
+		    !jack_client_is_internal (client)) {
+			jack_remove_client (engine, client);
+		}
+
+		node = tmp;
+	}
+}
+
+/* like jack_client_by_name(), for a caller that holds the graph lock
+   or is the server thread, which is the only one to change the index */
+jack_client_internal_t *
+jack_client_lookup_name (jack_engine_t *engine, const char *name)
+{
+	jack_client_internal_t *client;
+
+	for (client = engine->clients_by_name[jack_client_name_bucket (name)];
+	     client; client = client->name_next) {
+		if (strcmp ((const char*)client->control->name, name) == 0) {
 			break;
 		}
 	}
 
+	return client;
+}
+
+jack_client_internal_t *
+jack_client_by_name (jack_engine_t *engine, const char *name)
+{
+	jack_client_internal_t *client;
+
+	jack_rdlock_graph (engine);
+	client = jack_client_lookup_name (engine, name);
 	jack_unlock_graph (engine);
+
 	return client;
 }
 
 static int
-jack_client_id_by_name (jack_engine_t *engine, const char *name, jack_uuid_t id)
+jack_client_id_by_name (jack_engine_t *engine, const char *name, jack_uuid_t *id)
 {
-	JSList *node;
+	jack_client_internal_t *client;
 	int ret = -1;
 
-	jack_uuid_clear (&id);
+	jack_uuid_clear (id);
 
 	jack_rdlock_graph (engine);
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		if (strcmp ((const char*)((jack_client_internal_t*)
-					  node->data)->control->name,
-			    name) == 0) {
-			jack_client_internal_t *client =
-				(jack_client_internal_t*)node->data;
-			jack_uuid_copy (&id, client->control->uuid);
-			ret = 0;
-			break;
-		}
+	if ((client = jack_client_lookup_name (engine, name)) != NULL) {
+		jack_uuid_copy (id, client->control->uuid);
+		ret = 0;
 	}
 
 	jack_unlock_graph (engine);
@@ -462,15 +590,13 @@ jack_client_id_by_name (jack_engine_t *engine, const char *name, jack_uuid_t id)
 jack_client_internal_t *
 jack_client_internal_by_id (jack_engine_t *engine, jack_uuid_t id)
 {
-	jack_client_internal_t *client = NULL;
-	JSList *node;
+	jack_client_internal_t *client;
 
 	/* call tree ***MUST HOLD*** the graph lock */
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-
-		if (jack_uuid_compare (((jack_client_internal_t*)node->data)->control->uuid, id) == 0) {
-			client = (jack_client_internal_t*)node->data;
+	for (client = engine->clients_by_uuid[jack_client_uuid_bucket (id)];
+	     client; client = client->uuid_next) {
+		if (jack_uuid_compare (client->control->uuid, id) == 0) {
 			break;
 		}
 	}
@@ -478,13 +604,57 @@ jack_client_internal_by_id (jack_engine_t *engine, jack_uuid_t id)
 	return client;
 }
 
+/* a name held for a session client to come back under, see
+   jack_do_reserve_name() */
+void
+jack_client_reservation_add (jack_engine_t *engine,
+			     jack_reserved_name_t *reservation)
+{
+	unsigned int n = jack_client_name_bucket (reservation->name);
+	unsigned int u = jack_client_uuid_bucket (reservation->uuid);
+
+	reservation->name_next = engine->reserved_by_name[n];
+	engine->reserved_by_name[n] = reservation;
+	reservation->uuid_next = engine->reserved_by_uuid[u];
+	engine->reserved_by_uuid[u] = reservation;
+
+	engine->reserved_client_names =
+		jack_slist_append (engine->reserved_client_names, reservation);
+}
+
+static void
+jack_client_reservation_remove (jack_engine_t *engine,
+				jack_reserved_name_t *reservation)
+{
+	jack_reserved_name_t **pp;
+
+	for (pp = &engine->reserved_by_name[jack_client_name_bucket (reservation->name)];
+	     *pp; pp = &(*pp)->name_next) {
+		if (*pp == reservation) {
+			*pp = reservation->name_next;
+			break;
+		}
+	}
+
+	for (pp = &engine->reserved_by_uuid[jack_client_uuid_bucket (reservation->uuid)];
+	     *pp; pp = &(*pp)->uuid_next) {
+		if (*pp == reservation) {
+			*pp = reservation->uuid_next;
+			break;
+		}
+	}
+
+	engine->reserved_client_names =
+		jack_slist_remove (engine->reserved_client_names, reservation);
+}
+
 int
 jack_client_name_reserved ( jack_engine_t *engine, const char *name )
 {
-	JSList *node;
+	jack_reserved_name_t *reservation;
 
-	for (node = engine->reserved_client_names; node; node = jack_slist_next (node)) {
-		jack_reserved_name_t *reservation = (jack_reserved_name_t*)node->data;
+	for (reservation = engine->reserved_by_name[jack_client_name_bucket (name)];
+	     reservation; reservation = reservation->name_next) {
 		if (!strcmp (reservation->name, name)) {
 			return 1;
 		}
@@ -514,7 +684,7 @@ jack_generate_unique_name (jack_engine_t *engine, char *name)
 	name[tens] = '0';
 	name[ones] = '1';
 	name[length] = '\0';
-	while (jack_client_by_name (engine, name) || jack_client_name_reserved ( engine, name )) {
+	while (jack_client_lookup_name (engine, name) || jack_client_name_reserved ( engine, name )) {
 		if (name[ones] == '9') {
 			if (name[tens] == '9') {
 				jack_error ("client %s has 99 extra"
@@ -542,7 +712,7 @@ jack_client_name_invalid (jack_engine_t *engine, char *name,
 	 * startup.  There are no other clients at that point, anyway.
 	 */
 
-	if (jack_client_by_name (engine, name) || jack_client_name_reserved (engine, name )) {
+	if (jack_client_lookup_name (engine, name) || jack_client_name_reserved (engine, name )) {
 
 		*status |= JackNameNotUnique;
 
@@ -573,10 +743,40 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 		 malloc (sizeof(jack_client_internal_t));
 
 	client->request_fd = fd;
+	client->watch_events = -1;
+	client->pid_fd = -1;
 	client->event_fd = -1;
+	pthread_mutex_init (&client->event_lock, NULL);
 	client->ports = 0;
 	client->truefeeds = 0;
 	client->sortfeeds = 0;
+	client->dag_successors = 0;
+	client->dag_fedcount = 0;
+	client->dag_pending = 0;
+	client->dag_engine_successors = 0;
+	client->dag_notify = 0;
+	client->dag_mark = 0;
+	client->dag_depth = 0;
+	client->dag_weight = 0.0f;
+	client->dag_rank = 0.0f;
+	client->pipeline_stage = -1;
+	client->early_ports = 0;
+	client->pool_requested = 0;
+	client->decimation = 0;
+	client->ring_shm.index = JACK_SHM_NULL_INDEX;
+	client->ring_shm.attached_at = 0;
+	client->ring_frames = 0;
+	client->ring_filled = 0;
+	client->ring_due = 0;
+	client->ring_ports = NULL;
+	client->nring_ports = 0;
+	client->ringbuffers = NULL;
+	client->sort_index = 0;
+	client->reach_index = 0;
+	client->reach = NULL;
+	client->sort_pending = 0;
+	client->latency_dirty = 0;
+	client->ready_at = 0;
 	client->execution_order = UINT_MAX;
 	client->next_client = NULL;
 	client->handle = NULL;
@@ -584,14 +784,26 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	client->error = 0;
 	client->private_client = NULL;
 
+	client->control_slot = -1;
+
 	if (type != ClientExternal) {
 
 		client->control = (jack_client_control_t*)
 				  malloc (sizeof(jack_client_control_t));
 
+	} else if ((client->control_slot =
+			    jack_client_table_slot_alloc (engine)) >= 0) {
+
+		/* the slot may have been another client's */
+		client->control = (jack_client_control_t*)
+				  ((char*)jack_shm_addr (&engine->client_table_shm)
+				   + client->control_slot
+				   * jack_client_control_slot_size ());
+		memset (client->control, 0, jack_client_control_size ());
+
 	} else {
 
-		if (jack_shmalloc (sizeof(jack_client_control_t),
+		if (jack_shmalloc (jack_client_control_size (),
 				   &client->control_shm)) {
 			jack_error ("cannot create client control block for %s",
 				    name);
@@ -615,18 +827,47 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	client->control->active = 0;
 	client->control->dead = FALSE;
 	client->control->timed_out = 0;
+	client->control->activation_slot = (type == ClientExternal ?
+					    jack_activation_slot_alloc (engine) : -1);
+	client->control->activation_nsuccessors = 0;
+	client->control->timing_slot = jack_timing_slot_alloc (engine, name);
+	client->control->request_state = JackRequestIdle;
+	client->control->event_head = 0;
+	client->control->event_tail = 0;
+	client->control->event_signalled = 0;
+
+	/* a client coming back after a restart gets the UUID it had,
+	   and a new one does not get one that is held for somebody
+	   who has not come back yet */
+	if (engine->checkpoint && type != ClientDriver) {
+		jack_uuid_t kept = jack_checkpoint_take_client (engine->checkpoint,
+								 name, uuid);
+		if (jack_uuid_empty (uuid) && !jack_uuid_empty (kept) &&
+		    jack_client_internal_by_id (engine, kept) == NULL) {
+			VERBOSE (engine, "%s takes back its UUID from the "
+				 "checkpoint", name);
+			jack_uuid_copy (&uuid, kept);
+		}
+	}
 
 	if (jack_uuid_empty (uuid)) {
-		client->control->uuid = jack_client_uuid_generate ();
+		do {
+			client->control->uuid = jack_client_uuid_generate ();
+		} while (engine->checkpoint &&
+			 jack_checkpoint_holds_uuid (engine->checkpoint,
+						     client->control->uuid));
 	} else {
 		jack_uuid_copy (&client->control->uuid, uuid);
 	}
 
+	jack_trace_client_name (engine->trace, client->control->uuid, name);
+
 	strcpy ((char*)client->control->name, name);
 	client->subgraph_start_fd = -1;
 	client->subgraph_wait_fd = -1;
 
 	client->session_reply_pending = FALSE;
+	client->session_sent = 0;
 
 	client->control->process_cbset = FALSE;
 	client->control->bufsize_cbset = FALSE;
@@ -639,6 +880,14 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	client->control->thread_cb_cbset = FALSE;
 	client->control->session_cbset = FALSE;
 	client->control->property_cbset = FALSE;
+	client->control->process_async = FALSE;
+	client->control->decimation = 0;
+	client->control->ring_serial = 0;
+	client->control->ring_index = JACK_SHM_NULL_INDEX;
+	client->control->graph_changed_cbset = FALSE;
+	client->control->suggested_cpu = -1;
+	client->control->pool_threads = 0;
+	client->control->deadline_budget = 0;
 	client->control->latency_cbset = FALSE;
 
 #if 0
@@ -669,7 +918,6 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	/* specific resources for server/client real-time thread
 	 * communication */
 	allocate_mach_serverport (engine, client);
-	client->running = FALSE;
 #endif
 
 	return client;
@@ -761,6 +1009,8 @@ setup_client (jack_engine_t *engine, ClientType type, char *name,
 	/* add new client to the clients list */
 	jack_lock_graph (engine);
 	engine->clients = jack_slist_prepend (engine->clients, client);
+	jack_client_hash_insert (engine, client);
+	jack_reach_attach (engine, client);
 	jack_engine_reset_rolling_usecs (engine);
 
 	if (jack_client_is_internal (client)) {
@@ -794,6 +1044,8 @@ setup_client (jack_engine_t *engine, ClientType type, char *name,
 
 	} else {                        /* external client */
 
+		jack_engine_watch_client (engine, client);
+		jack_engine_watch_pid (engine, client);
 		jack_unlock_graph (engine);
 	}
 
@@ -850,20 +1102,74 @@ handle_unload_client (jack_engine_t *engine, jack_uuid_t id)
 static char *
 jack_get_reserved_name (jack_engine_t *engine, jack_uuid_t uuid)
 {
-	JSList *node;
+	jack_reserved_name_t *reservation;
 
-	for (node = engine->reserved_client_names; node; node = jack_slist_next (node)) {
-		jack_reserved_name_t *reservation = (jack_reserved_name_t*)node->data;
-		if (jack_uuid_compare (reservation->uuid, uuid) != 0) {
+	for (reservation = engine->reserved_by_uuid[jack_client_uuid_bucket (uuid)];
+	     reservation; reservation = reservation->uuid_next) {
+		if (jack_uuid_compare (reservation->uuid, uuid) == 0) {
 			char *retval = strdup (reservation->name);
+			jack_client_reservation_remove (engine, reservation);
 			free (reservation);
-			engine->reserved_client_names =
-				jack_slist_remove (engine->reserved_client_names, reservation);
 			return retval;
 		}
 	}
 	return 0;
 }
+/* Reply to an external client's connection request and hand it the
+ * client end of a new event socket along with the result, so that it
+ * need not connect back to the ACK socket (see server_event_connect()
+ * in libjack/client.c).
+ */
+static int
+jack_send_connect_result (jack_engine_t *engine, jack_client_internal_t *client,
+			  int client_fd, jack_client_connect_result_t *res)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE (sizeof(int))];
+	int sv[2];
+	ssize_t n;
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv)) {
+		jack_error ("cannot create event socket for client %s (%s)",
+			    client->control->name, strerror (errno));
+		return -1;
+	}
+
+	memset (&msg, 0, sizeof(msg));
+	memset (cbuf, 0, sizeof(cbuf));
+	iov.iov_base = res;
+	iov.iov_len = sizeof(*res);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR (&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN (sizeof(int));
+	memcpy (CMSG_DATA (cmsg), &sv[1], sizeof(int));
+
+	do {
+		n = sendmsg (client_fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+
+	close (sv[1]);
+
+	if (n != sizeof(*res)) {
+		close (sv[0]);
+		return -1;
+	}
+
+	client->event_fd = sv[0];
+	VERBOSE (engine, "new client %s using %d for events", client->control->name,
+		 client->event_fd);
+
+	return 0;
+}
+
 int
 jack_client_create (jack_engine_t *engine, int client_fd)
 {
@@ -904,7 +1210,7 @@ jack_client_create (jack_engine_t *engine, int client_fd)
 		int rc = -1;
 		jack_uuid_t id = JACK_UUID_EMPTY_INITIALIZER;
 
-		if (jack_client_id_by_name (engine, req.name, id) == 0) {
+		if (jack_client_id_by_name (engine, req.name, &id) == 0) {
 			rc = handle_unload_client (engine, id);
 		}
 
@@ -929,7 +1235,12 @@ jack_client_create (jack_engine_t *engine, int client_fd)
 		res.status |= JackFailure; /* just making sure */
 		return -1;
 	}
-	res.client_shm_index = client->control_shm.index;
+	if (client->control_slot >= 0) {
+		res.client_shm_index = engine->client_table_shm.index;
+	} else {
+		res.client_shm_index = client->control_shm.index;
+	}
+	res.client_table_slot = client->control_slot;
 	res.engine_shm_index = engine->control_shm.index;
 	res.realtime = engine->control->real_time;
 	res.realtime_priority = engine->rtpriority - 1;
@@ -955,7 +1266,9 @@ jack_client_create (jack_engine_t *engine, int client_fd)
 		strcpy (res.fifo_prefix, engine->fifo_prefix);
 	}
 
-	if (write (client_fd, &res, sizeof(res)) != sizeof(res)) {
+	if (jack_client_is_internal (client) ?
+	    write (client_fd, &res, sizeof(res)) != sizeof(res) :
+	    jack_send_connect_result (engine, client, client_fd, &res) != 0) {
 		jack_error ("cannot write connection response to client");
 		jack_lock_graph (engine);
 		client->control->dead = 1;
@@ -973,6 +1286,98 @@ jack_client_create (jack_engine_t *engine, int client_fd)
 	return 0;
 }
 
+/* SCHED_DEADLINE admission control: the budgets of the active
+   external clients, `client' and the driver thread's share must fit
+   into JACK_DEADLINE_LIMIT percent of the period.
+ */
+static int
+jack_client_deadline_admit (jack_engine_t *engine,
+			    jack_client_internal_t *client)
+{
+	JSList *node;
+	jack_time_t period, total;
+
+	if (!engine->control->deadline || engine->driver == NULL ||
+	    jack_client_is_internal (client)) {
+		return 0;
+	}
+
+	period = engine->driver->period_usecs;
+	total = period * JACK_DEADLINE_ENGINE_SHARE / 100;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *other =
+			(jack_client_internal_t*)node->data;
+
+		if (other != client && (!other->control->active ||
+					jack_client_is_internal (other))) {
+			continue;
+		}
+
+		total += other->control->deadline_budget ?
+			 other->control->deadline_budget :
+			 period * JACK_DEADLINE_CLIENT_SHARE / 100;
+	}
+
+	if (total > period * JACK_DEADLINE_LIMIT / 100) {
+		jack_error ("cannot activate %s: process budgets of %" PRIu64
+			    " usecs would overcommit the %" PRIu64 " usec period",
+			    client->control->name, total, period);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a client that asked to be woken once every few cycles, see
+   jack_set_process_decimation(), gets its ring here. libjack has
+   checked the request already, but the control block is the client's
+   to write.
+ */
+static int
+jack_client_decimation_admit (jack_engine_t *engine,
+			      jack_client_internal_t *client)
+{
+	uint32_t decimation = client->control->decimation;
+	JSList *node;
+
+	client->decimation = 0;
+
+	if (decimation == 0) {
+		return 0;
+	}
+
+	if (jack_client_is_internal (client) ||
+	    decimation > JACK_DECIMATION_MAX ||
+	    client->control->thread_cb_cbset ||
+	    client->control->process_async) {
+		jack_error ("cannot activate %s: bad process decimation %" PRIu32,
+			    client->control->name, decimation);
+		return -1;
+	}
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		jack_port_internal_t *port = (jack_port_internal_t*)node->data;
+
+		if ((port->shared->flags & JackPortIsOutput) ||
+		    port->shared->ptype_id != JACK_AUDIO_PORT_TYPE) {
+			jack_error ("cannot activate %s: a decimated client can "
+				    "only have audio inputs (%s)",
+				    client->control->name, port->names->name);
+			return -1;
+		}
+	}
+
+	client->decimation = decimation;
+
+	if (jack_client_ring_layout (engine, client)) {
+		client->decimation = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
 int
 jack_client_activate (jack_engine_t *engine, jack_uuid_t id)
 {
@@ -986,7 +1391,9 @@ jack_client_activate (jack_engine_t *engine, jack_uuid_t id)
 
 	jack_lock_graph (engine);
 
-	if ((client = jack_client_internal_by_id (engine, id))) {
+	if ((client = jack_client_internal_by_id (engine, id)) &&
+	    jack_client_deadline_admit (engine, client) == 0 &&
+	    jack_client_decimation_admit (engine, client) == 0) {
 		client->control->active = TRUE;
 
 		jack_transport_activate (engine, client);
@@ -1002,7 +1409,12 @@ jack_client_activate (jack_engine_t *engine, jack_uuid_t id)
 		jack_sort_graph (engine);
 
 
+		/* segments of types that nobody has used yet come
+		   with the first port of the type */
 		for (i = 0; i < engine->control->n_port_types; ++i) {
+			if (!engine->port_segment[i].attached_at) {
+				continue;
+			}
 			event.type = AttachPortSegment;
 			event.y.ptid = i;
 			jack_deliver_event (engine, client, &event);
@@ -1018,6 +1430,9 @@ jack_client_activate (jack_engine_t *engine, jack_uuid_t id)
 			jack_port_registration_notify (engine, port->shared->id, TRUE);
 		}
 
+		/* and the connections it had before a restart */
+		jack_checkpoint_reconnect (engine);
+
 		ret = 0;
 	}
 
@@ -1088,11 +1503,252 @@ jack_mark_client_socket_error (jack_engine_t *engine, int fd)
 			 jack_client_state_name (client),
 			 client->error);
 		client->error += JACK_ERROR_WITH_SOCKETS;
+		jack_engine_unwatch_client (engine, client);
+	}
+
+	return 0;
+}
+
+/* `fd' is readable: if it is the pidfd of a client, the client's
+   process has exited */
+int
+jack_mark_client_exited (jack_engine_t *engine, int fd)
+{
+	/* CALLER MUST HOLD GRAPH LOCK */
+
+	jack_client_internal_t *client;
+	JSList *node;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+
+		client = (jack_client_internal_t*)node->data;
+
+		if (client->pid_fd != fd || jack_client_is_internal (client)) {
+			continue;
+		}
+
+		VERBOSE (engine, "client %s has exited, state = %s errors = %d",
+			 client->control->name,
+			 jack_client_state_name (client),
+			 client->error);
+
+		if (client->error < JACK_ERROR_WITH_SOCKETS) {
+			client->error += JACK_ERROR_WITH_SOCKETS;
+		}
+		jack_engine_unwatch_client (engine, client);
+
+		return 1;
 	}
 
 	return 0;
 }
 
+/* Shared memory ringbuffers, see internal.h. Each client's list is
+ * only changed by requests, with the graph lock, and freed by
+ * jack_client_delete() once the client is off engine->clients.
+ */
+
+typedef struct {
+	char name[JACK_PORT_NAME_SIZE];         /* "client:name" */
+	jack_shm_info_t shm;
+} jack_ringbuffer_internal_t;
+
+static jack_ringbuffer_internal_t *
+jack_ringbuffer_by_name (jack_engine_t *engine, const char *name)
+{
+	JSList *node, *rbnode;
+	jack_client_internal_t *client;
+	jack_ringbuffer_internal_t *rb;
+
+	/* call tree ***MUST HOLD*** the graph lock */
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		for (rbnode = client->ringbuffers; rbnode;
+		     rbnode = jack_slist_next (rbnode)) {
+			rb = (jack_ringbuffer_internal_t*)rbnode->data;
+			if (strcmp (rb->name, name) == 0) {
+				return rb;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void
+jack_ringbuffer_internal_free (jack_ringbuffer_internal_t *rb)
+{
+	jack_shm_ringbuffer_shared_t *shared;
+
+	shared = (jack_shm_ringbuffer_shared_t*)jack_shm_addr (&rb->shm);
+
+	/* readers and writers that still have it mapped keep it until
+	   they close it, but can tell that nobody is at the other end
+	   any more */
+	__atomic_store_n (&shared->closed, 1, __ATOMIC_RELEASE);
+
+	jack_release_shm (&rb->shm);
+	jack_destroy_shm (&rb->shm);
+	free (rb);
+}
+
+void
+jack_ringbuffer_create_request (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_client_internal_t *client;
+	jack_ringbuffer_internal_t *rb;
+	jack_shm_ringbuffer_shared_t *shared;
+	char name[JACK_PORT_NAME_SIZE];
+	uint32_t size;
+
+	req->status = -1;
+	req->x.ringbuffer.name[sizeof(req->x.ringbuffer.name) - 1] = '\0';
+
+	if (req->x.ringbuffer.name[0] == '\0' ||
+	    req->x.ringbuffer.size == 0 ||
+	    req->x.ringbuffer.size > JACK_SHM_RINGBUFFER_MAX) {
+		return;
+	}
+
+	size = 64;
+	while (size < req->x.ringbuffer.size) {
+		size <<= 1;
+	}
+
+	jack_lock_graph (engine);
+
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.ringbuffer.client_id)) == NULL) {
+		goto out;
+	}
+
+	if (jack_slist_length (client->ringbuffers) >=
+	    JACK_SHM_RINGBUFFERS_PER_CLIENT) {
+		jack_error ("client %s has too many ringbuffers",
+			    client->control->name);
+		goto out;
+	}
+
+	if (snprintf (name, sizeof(name), "%s:%s", client->control->name,
+		      req->x.ringbuffer.name) >= (int)sizeof(name)) {
+		goto out;
+	}
+
+	if (jack_ringbuffer_by_name (engine, name)) {
+		jack_error ("there is already a ringbuffer named %s", name);
+		goto out;
+	}
+
+	if ((rb = (jack_ringbuffer_internal_t*)
+		  malloc (sizeof(jack_ringbuffer_internal_t))) == NULL) {
+		goto out;
+	}
+
+	if (jack_shmalloc (sizeof(jack_shm_ringbuffer_shared_t) + size,
+			   &rb->shm)) {
+		jack_error ("cannot create shared memory for ringbuffer %s",
+			    name);
+		free (rb);
+		goto out;
+	}
+
+	if (jack_attach_shm (&rb->shm)) {
+		jack_error ("cannot attach shared memory for ringbuffer %s",
+			    name);
+		jack_destroy_shm (&rb->shm);
+		free (rb);
+		goto out;
+	}
+
+	/* freshly allocated segments are zeroed */
+	shared = (jack_shm_ringbuffer_shared_t*)jack_shm_addr (&rb->shm);
+	shared->size = size;
+	jack_uuid_copy (&shared->owner, client->control->uuid);
+	__atomic_store_n (&shared->magic, JACK_SHM_RINGBUFFER_MAGIC,
+			  __ATOMIC_RELEASE);
+
+	strcpy (rb->name, name);
+	client->ringbuffers = jack_slist_prepend (client->ringbuffers, rb);
+
+	strcpy (req->x.ringbuffer.name, name);
+	req->x.ringbuffer.size = size;
+	req->x.ringbuffer.index = rb->shm.index;
+	req->status = 0;
+
+	VERBOSE (engine, "ringbuffer %s, %" PRIu32 " bytes", name, size);
+
+out:
+	jack_unlock_graph (engine);
+}
+
+void
+jack_ringbuffer_open_request (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_ringbuffer_internal_t *rb;
+
+	req->status = -1;
+	req->x.ringbuffer.name[sizeof(req->x.ringbuffer.name) - 1] = '\0';
+
+	jack_rdlock_graph (engine);
+
+	if ((rb = jack_ringbuffer_by_name (engine, req->x.ringbuffer.name))) {
+		req->x.ringbuffer.size =
+			((jack_shm_ringbuffer_shared_t*)
+			 jack_shm_addr (&rb->shm))->size;
+		req->x.ringbuffer.index = rb->shm.index;
+		req->status = 0;
+	}
+
+	jack_unlock_graph (engine);
+}
+
+/* only the owner can destroy one, and it does when it closes it */
+void
+jack_ringbuffer_destroy_request (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_client_internal_t *client;
+	jack_ringbuffer_internal_t *rb;
+	JSList *node;
+
+	req->status = -1;
+	req->x.ringbuffer.name[sizeof(req->x.ringbuffer.name) - 1] = '\0';
+
+	jack_lock_graph (engine);
+
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.ringbuffer.client_id))) {
+		for (node = client->ringbuffers; node;
+		     node = jack_slist_next (node)) {
+			rb = (jack_ringbuffer_internal_t*)node->data;
+			if (strcmp (rb->name, req->x.ringbuffer.name) == 0) {
+				client->ringbuffers =
+					jack_slist_remove_link (client->ringbuffers,
+								node);
+				jack_slist_free_1 (node);
+				jack_ringbuffer_internal_free (rb);
+				req->status = 0;
+				break;
+			}
+		}
+	}
+
+	jack_unlock_graph (engine);
+}
+
+static void
+jack_client_ringbuffers_release (jack_client_internal_t *client)
+{
+	JSList *node;
+
+	for (node = client->ringbuffers; node; node = jack_slist_next (node)) {
+		jack_ringbuffer_internal_free ((jack_ringbuffer_internal_t*)
+					       node->data);
+	}
+	jack_slist_free (client->ringbuffers);
+	client->ringbuffers = NULL;
+}
+
 void
 jack_client_delete (jack_engine_t *engine, jack_client_internal_t *client)
 {
@@ -1102,12 +1758,13 @@ jack_client_delete (jack_engine_t *engine, jack_client_internal_t *client)
 
 	jack_client_registration_notify (engine, (const char*)client->control->name, 0);
 
-	jack_remove_properties (NULL, uuid);
-	/* have to do the notification ourselves, since the client argument
-	   to jack_remove_properties() was NULL
-	 */
+	jack_propstore_remove (engine->propstore, uuid, NULL);
 	jack_property_change_notify (engine, PropertyDeleted, uuid, NULL);
 
+	jack_timing_slot_free (engine, client->control->timing_slot);
+	jack_client_ring_release (client);
+	jack_client_ringbuffers_release (client);
+
 	if (jack_client_is_internal (client)) {
 
 		free (client->private_client);
@@ -1115,15 +1772,31 @@ jack_client_delete (jack_engine_t *engine, jack_client_internal_t *client)
 
 	} else {
 
-		/* release the client segment, mark it for
-		   destruction, and free up the shm registry
-		   information so that it can be reused.
-		 */
+		jack_activation_slot_free (engine, client->control->activation_slot);
+
+		if (client->control_slot >= 0) {
+
+			/* the table stays mapped, only the slot is given up */
 
-		jack_release_shm (&client->control_shm);
-		jack_destroy_shm (&client->control_shm);
+			jack_client_table_slot_free (engine, client->control_slot);
+
+		} else {
+
+			/* release the client segment, mark it for
+			   destruction, and free up the shm registry
+			   information so that it can be reused.
+			 */
+
+			jack_release_shm (&client->control_shm);
+			jack_destroy_shm (&client->control_shm);
+		}
 	}
 
+#ifdef JACK_USE_MACH_THREADS
+	release_mach_serverport (engine, client);
+#endif
+
+	pthread_mutex_destroy (&client->event_lock);
 	free (client);
 
 }
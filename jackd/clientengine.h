@@ -27,6 +27,14 @@ jack_client_is_internal (jack_client_internal_t *client)
 	       (client->control->type == ClientDriver);
 }
 
+/* woken once every client->decimation cycles, see
+   jack_client_ring_layout() */
+static inline int
+jack_client_is_decimated (jack_client_internal_t *client)
+{
+	return client->decimation != 0;
+}
+
 static inline char *
 jack_client_state_name (jack_client_internal_t *client)
 {
@@ -48,6 +56,7 @@ int     jack_client_create(jack_engine_t *engine, int client_fd);
 void    jack_client_delete(jack_engine_t *engine,
 			   jack_client_internal_t *client);
 int     jack_mark_client_socket_error(jack_engine_t *engine, int fd);
+int     jack_mark_client_exited(jack_engine_t *engine, int fd);
 jack_client_internal_t *
 jack_create_driver_client(jack_engine_t *engine, char *name);
 void    jack_intclient_handle_request(jack_engine_t *engine,
@@ -58,8 +67,15 @@ void    jack_intclient_name_request(jack_engine_t *engine,
 				    jack_request_t *req);
 void    jack_intclient_unload_request(jack_engine_t *engine,
 				      jack_request_t *req);
+void    jack_ringbuffer_create_request(jack_engine_t *engine,
+				       jack_request_t *req);
+void    jack_ringbuffer_open_request(jack_engine_t *engine,
+				     jack_request_t *req);
+void    jack_ringbuffer_destroy_request(jack_engine_t *engine,
+					jack_request_t *req);
 int     jack_check_clients(jack_engine_t* engine, int with_timeout_check);
 void    jack_remove_clients(jack_engine_t* engine, int* exit_freewheeling);
+void    jack_teardown_clients(jack_engine_t* engine);
 void    jack_client_registration_notify(jack_engine_t *engine,
 					const char* name, int yn);
 void jack_property_change_notify(jack_engine_t *engine, jack_property_change_t change, jack_uuid_t uuid, const char* key);
@@ -0,0 +1,1654 @@
+/*
+    cluster -- internal client sharing ports between jackd nodes
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Load it into every jackd of a rack with
+ *
+ *    jackd -I cluster:cluster/node=rack1 ...
+ *    jack_load cluster cluster -i node=rack2,format=s24,...
+ *
+ * and each node announces its audio output ports to the others on a
+ * multicast group, once a second. Every port another node announces
+ * gets one of this node's proxy ports, cluster:remote_N, with the alias
+ * "NODE:CLIENT:PORT", so that
+ *
+ *    jack_connect rack2:synth:out_1 system:playback_1
+ *
+ * on rack1 just works. While a proxy is connected, its node is asked
+ * for the port; that node connects the port to one of its send ports,
+ * cluster:send_N, and streams it from then on, in one batch of packets
+ * a cycle for all the ports a node asked it for. The request is renewed
+ * every second and lapses after three, so streams stop by themselves
+ * once nothing here listens any more. The init string is a comma
+ * separated list of
+ *
+ *    node=NAME       this node's name in aliases (the host name)
+ *    group=ADDR[:PORT]  where announcements go, and requests come in
+ *                    on PORT (239.255.74.75:19000)
+ *    interface=NAME  the network interface of the group (the kernel's
+ *                    choice)
+ *    data=PORT       where streams come in (the group's port plus one)
+ *    ports=N         proxy ports for other nodes' ports (64)
+ *    sends=N         send ports for this node's streams (64)
+ *    format=FMT      what other nodes send here: float, s24 or s16
+ *                    (float)
+ *    latency=N       periods a remote port is read behind the newest
+ *                    one received, at least 1 (2)
+ *
+ * The nodes are expected to run in lock-step: the same rate and period
+ * and one clock, as with the aes67 driver on a PTP network or cards on
+ * a common word clock. A proxy then reads its port's frames at a fixed
+ * distance from the local frame timer, found from the first packets
+ * and kept for as long as the two stay within a period of it; when
+ * they drift further, the stream starts over (a "slip"). A node that
+ * announces another rate or period is ignored.
+ *
+ * The proxies' capture latency is their port's on its own node plus
+ * `latency' periods. Packets are only ever handled in the process
+ * thread, so there is no hop through another thread per cycle; the
+ * control thread does the announcements, the requests and the
+ * connections, and hands process() what to send and receive as a plan
+ * that it replaces whole.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <jack/jack.h>
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "libjack/local.h"
+
+#define CLUSTER_GROUP       "239.255.74.75"
+#define CLUSTER_PORT        19000
+#define CLUSTER_PORTS       64
+#define CLUSTER_SENDS       64
+#define CLUSTER_MAX_PORTS   1024
+#define CLUSTER_LATENCY     2
+
+#define CLUSTER_MAGIC       0x4a434c31          /* "JCL1" */
+#define CLUSTER_VERSION     "jack-cluster 1"
+#define CLUSTER_MTU         1472                /* UDP payload */
+#define CLUSTER_BATCH       64                  /* packets per sendmmsg/recvmmsg */
+#define CLUSTER_RING        8192                /* frames per proxy, a power of two */
+#define CLUSTER_NODE_SIZE   64
+
+#define CLUSTER_TICK        250                 /* msecs */
+#define CLUSTER_ANNOUNCE    1000000             /* usecs */
+#define CLUSTER_EXPIRE      3500000
+#define CLUSTER_LEASE       3000000
+
+typedef enum {
+	ClusterFloat = 0,
+	ClusterS24 = 1,
+	ClusterS16 = 2
+} cluster_format_t;
+
+static const char *cluster_format_names[] = { "float", "s24", "s16" };
+static const unsigned int cluster_format_bytes[] = { 4, 3, 2 };
+
+/* a data packet: the header, `nchannels' channel ids (padded to 4
+   bytes), then `nframes' samples of each channel in turn */
+typedef struct {
+	uint32_t magic;
+	uint32_t node;                  /* cluster_hash() of the sender's name */
+	uint32_t frame;                 /* the sender's frame time of the first sample */
+	uint16_t nframes;
+	uint8_t format;
+	uint8_t nchannels;
+} POST_PACKED_STRUCTURE cluster_header_t;
+
+/* CONTROL THREAD STATE */
+
+typedef struct {
+	char name[JACK_PORT_NAME_SIZE]; /* on its own node */
+	jack_nframes_t latency;
+	jack_time_t seen;
+} cluster_remote_port_t;
+
+typedef struct {
+	char name[CLUSTER_NODE_SIZE];
+	uint32_t id;
+	struct sockaddr_in control;     /* where its announcements come from */
+	uint16_t data_port;
+	int mismatch;                   /* another rate or period */
+	jack_time_t seen;
+	int nports;
+	cluster_remote_port_t *ports;
+} cluster_node_t;
+
+typedef struct {
+	jack_port_t *port;
+	uint32_t node;                  /* 0: free */
+	char remote[JACK_PORT_NAME_SIZE];
+	char alias[sizeof(((jack_port_names_t*)0)->alias1)];
+	volatile jack_nframes_t latency; /* r: latency callback */
+	int connected;
+} cluster_proxy_t;
+
+typedef struct {
+	jack_port_t *port;
+	char source[JACK_PORT_NAME_SIZE]; /* connected from, "": free */
+	int leases;
+} cluster_send_t;
+
+/* another node's request for one of our ports */
+typedef struct {
+	uint32_t node;
+	struct sockaddr_in data;
+	cluster_format_t format;
+	uint16_t chan;                  /* its proxy */
+	int send;
+	jack_time_t expires;
+} cluster_lease_t;
+
+/* PROCESS THREAD STATE */
+
+typedef struct {
+	struct sockaddr_in addr;
+	cluster_format_t format;
+	int nentries;
+	int *send;
+	uint16_t *chan;
+} cluster_target_t;
+
+/* what process() sends and receives, immutable once published */
+typedef struct {
+	int ntargets;
+	cluster_target_t *targets;
+	uint32_t *source;               /* per proxy, the node it carries, 0: none */
+	uint32_t *gen;                  /* per proxy, bumped when that changes */
+} cluster_plan_t;
+
+typedef struct {
+	float ring[CLUSTER_RING];
+	uint32_t tag[CLUSTER_RING];     /* the remote frame in each slot */
+	uint32_t gen;
+	int have;                       /* `newest' is valid */
+	int locked;
+	uint32_t newest;                /* end of the newest packet */
+	uint32_t offset;                /* remote frame - local frame of a read */
+	unsigned int idle;              /* cycles without a packet */
+} cluster_rx_t;
+
+typedef struct {
+	jack_client_t *client;
+	jack_native_thread_t thread;
+	int stop_fds[2];
+
+	char node[CLUSTER_NODE_SIZE];
+	uint32_t id;
+	struct sockaddr_in group;
+	char interface[IFNAMSIZ];
+	unsigned int ifindex;
+	uint16_t data_port;
+	int nproxies;
+	int nsends;
+	cluster_format_t format;
+	unsigned int latency;           /* periods */
+
+	int ctl_fd;
+	int data_fd;
+
+	/* control thread */
+	JSList *nodes;
+	JSList *leases;
+	cluster_proxy_t *proxies;
+	cluster_send_t *sends;
+	uint32_t *gens;
+	int dirty;                      /* the plan is out of date */
+	cluster_plan_t *retired;        /* freed once process() moved on */
+	jack_time_t announced;
+
+	/* handover */
+	cluster_plan_t *volatile plan;
+	cluster_plan_t *volatile seen;
+
+	/* process thread */
+	cluster_plan_t *cur;
+	cluster_rx_t *rx;
+	uint8_t *tx_bufs;
+	struct mmsghdr *tx_msgs;
+	struct iovec *tx_iov;
+	uint8_t *rx_bufs;
+	struct mmsghdr *rx_msgs;
+	struct iovec *rx_iov;
+
+	/* reported at unload */
+	unsigned long tx_packets;
+	unsigned long tx_errors;
+	unsigned long rx_packets;
+	unsigned long rx_foreign;
+	unsigned long rx_late;
+	unsigned long rx_missing;       /* frames */
+	unsigned long slips;
+} cluster_t;
+
+static uint32_t
+cluster_hash (const char *name)
+{
+	uint32_t h = 2166136261u;       /* FNV-1a */
+
+	for (; *name; name++) {
+		h = (h ^ (unsigned char)*name) * 16777619u;
+	}
+
+	return h ? h : 1;
+}
+
+/* SAMPLES */
+
+static inline void
+cluster_encode (uint8_t *p, const float *src, jack_nframes_t nframes,
+		cluster_format_t format)
+{
+	jack_nframes_t i;
+	uint32_t u;
+	int32_t v;
+	float x;
+
+	for (i = 0; i < nframes; i++) {
+		if (format == ClusterFloat) {
+			memcpy (&u, &src[i], sizeof(u));
+			u = htonl (u);
+			memcpy (p, &u, sizeof(u));
+			p += 4;
+			continue;
+		}
+
+		x = src[i];
+		if (x > 1.0f) {
+			x = 1.0f;
+		} else if (x < -1.0f) {
+			x = -1.0f;
+		}
+
+		if (format == ClusterS24) {
+			v = lrintf (x * 8388607.0f);
+			*p++ = v >> 16;
+			*p++ = v >> 8;
+			*p++ = v;
+		} else {
+			v = lrintf (x * 32767.0f);
+			*p++ = v >> 8;
+			*p++ = v;
+		}
+	}
+}
+
+static inline float
+cluster_decode (const uint8_t *p, cluster_format_t format)
+{
+	uint32_t u;
+	float f;
+
+	switch (format) {
+	case ClusterFloat:
+		memcpy (&u, p, sizeof(u));
+		u = ntohl (u);
+		memcpy (&f, &u, sizeof(f));
+		return f;
+	case ClusterS24:
+		return ((int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+				  (uint32_t)p[2] << 8) >> 8) * (1.0f / 8388608.0f);
+	default:
+		return (int16_t)((p[0] << 8) | p[1]) * (1.0f / 32768.0f);
+	}
+}
+
+/* PROCESS */
+
+static void
+cluster_rx_reset (cluster_rx_t *rx, uint32_t gen)
+{
+	int i;
+
+	for (i = 0; i < CLUSTER_RING; i++) {
+		rx->tag[i] = i ^ 0x80000000;
+	}
+	rx->gen = gen;
+	rx->have = FALSE;
+	rx->locked = FALSE;
+	rx->idle = 0;
+}
+
+static void
+cluster_packet (cluster_t *m, const uint8_t *buf, unsigned int len,
+		jack_nframes_t local)
+{
+	const cluster_header_t *hdr = (const cluster_header_t*)buf;
+	unsigned int bytes, off, c, i;
+	uint32_t frame, end, idx;
+	const uint8_t *p;
+	cluster_rx_t *rx;
+	uint16_t chan;
+
+	if (len < sizeof(cluster_header_t) || ntohl (hdr->magic) != CLUSTER_MAGIC ||
+	    hdr->format > ClusterS16 || hdr->nchannels == 0 ||
+	    hdr->nframes == 0) {
+		m->rx_foreign++;
+		return;
+	}
+
+	bytes = cluster_format_bytes[hdr->format];
+	off = sizeof(cluster_header_t) + ((2 * hdr->nchannels + 3) & ~3);
+
+	if (off + hdr->nchannels * ntohs (hdr->nframes) * bytes > len) {
+		m->rx_foreign++;
+		return;
+	}
+
+	frame = ntohl (hdr->frame);
+	end = frame + ntohs (hdr->nframes);
+	p = buf + off;
+
+	for (c = 0; c < hdr->nchannels; c++, p += ntohs (hdr->nframes) * bytes) {
+		memcpy (&chan, buf + sizeof(cluster_header_t) + 2 * c, sizeof(chan));
+		chan = ntohs (chan);
+
+		if (chan >= m->nproxies ||
+		    m->cur->source[chan] != ntohl (hdr->node)) {
+			m->rx_foreign++;
+			continue;
+		}
+
+		rx = &m->rx[chan];
+
+		if (rx->locked && (int32_t)(end - (local + rx->offset)) <= 0) {
+			/* needed by an earlier cycle */
+			m->rx_late++;
+			continue;
+		}
+
+		for (i = 0; i < ntohs (hdr->nframes); i++) {
+			idx = (frame + i) & (CLUSTER_RING - 1);
+			rx->ring[idx] = cluster_decode (p + i * bytes, hdr->format);
+			rx->tag[idx] = frame + i;
+		}
+
+		if (!rx->have || (int32_t)(end - rx->newest) > 0) {
+			rx->newest = end;
+			rx->have = TRUE;
+		}
+		rx->idle = 0;
+	}
+
+	m->rx_packets++;
+}
+
+static void
+cluster_receive (cluster_t *m, jack_nframes_t local)
+{
+	int i, n;
+
+	do {
+		n = recvmmsg (m->data_fd, m->rx_msgs, CLUSTER_BATCH,
+			      MSG_DONTWAIT, NULL);
+
+		for (i = 0; i < n; i++) {
+			cluster_packet (m, m->rx_bufs + i * CLUSTER_MTU,
+					m->rx_msgs[i].msg_len, local);
+		}
+	} while (n == CLUSTER_BATCH);
+}
+
+/* a proxy's frames for the cycle at `local', or silence */
+static void
+cluster_read (cluster_t *m, int p, jack_nframes_t local,
+	      jack_nframes_t nframes)
+{
+	cluster_rx_t *rx = &m->rx[p];
+	uint32_t distance = m->latency * nframes;
+	uint32_t start, frame, idx;
+	jack_nframes_t i;
+	int32_t drift;
+	float *out;
+
+	if (rx->have && ++rx->idle > jack_get_sample_rate (m->client) / nframes) {
+		/* a second of nothing: start again when it comes back */
+		rx->have = FALSE;
+		rx->locked = FALSE;
+	}
+
+	if (!rx->have || distance + 2 * nframes > CLUSTER_RING / 2) {
+		jack_port_set_silent (m->proxies[p].port);
+		return;
+	}
+
+	if (rx->locked) {
+		drift = (int32_t)(rx->newest - (local + rx->offset)) - (int32_t)distance;
+		if (rx->idle == 0 && (drift > (int32_t)nframes ||
+				      drift < -(int32_t)nframes)) {
+			m->slips++;
+			rx->locked = FALSE;
+		}
+	}
+
+	if (!rx->locked) {
+		rx->offset = rx->newest - distance - local;
+		rx->locked = TRUE;
+	}
+
+	out = (float*)jack_port_get_buffer (m->proxies[p].port, nframes);
+	start = local + rx->offset;
+
+	for (i = 0; i < nframes; i++) {
+		frame = start + i;
+		idx = frame & (CLUSTER_RING - 1);
+		if (rx->tag[idx] == frame) {
+			out[i] = rx->ring[idx];
+		} else {
+			out[i] = 0.0f;
+			m->rx_missing++;
+		}
+	}
+}
+
+static void
+cluster_flush (cluster_t *m, unsigned int npackets)
+{
+	unsigned int sent = 0;
+	int n;
+
+	while (sent < npackets) {
+		if ((n = sendmmsg (m->data_fd, m->tx_msgs + sent,
+				   npackets - sent, MSG_DONTWAIT)) <= 0) {
+			m->tx_errors += npackets - sent;
+			break;
+		}
+		sent += n;
+	}
+
+	m->tx_packets += sent;
+}
+
+/* all of a target's ports for this cycle, as few packets as fit */
+static unsigned int
+cluster_send (cluster_t *m, cluster_target_t *t, unsigned int npackets,
+	      jack_nframes_t local, jack_nframes_t nframes)
+{
+	unsigned int bytes = cluster_format_bytes[t->format];
+	unsigned int room = CLUSTER_MTU - sizeof(cluster_header_t);
+	unsigned int per_packet, frames, chans, c, e;
+	jack_nframes_t off, n;
+	cluster_header_t *hdr;
+	const float *src;
+	uint16_t chan;
+	uint8_t *buf, *p;
+
+	if (nframes * bytes + 4 <= room) {
+		frames = nframes;
+		per_packet = (room - 4) / (nframes * bytes + 2);
+		if (per_packet > 255) {
+			per_packet = 255;
+		}
+	} else {
+		frames = (room - 4) / bytes;
+		per_packet = 1;
+	}
+
+	for (e = 0; e < (unsigned int)t->nentries; e += chans) {
+		chans = t->nentries - e;
+		if (chans > per_packet) {
+			chans = per_packet;
+		}
+
+		for (off = 0; off < nframes; off += n) {
+			n = frames < nframes - off ? frames : nframes - off;
+
+			buf = m->tx_bufs + npackets * CLUSTER_MTU;
+			hdr = (cluster_header_t*)buf;
+			hdr->magic = htonl (CLUSTER_MAGIC);
+			hdr->node = htonl (m->id);
+			hdr->frame = htonl (local + off);
+			hdr->nframes = htons (n);
+			hdr->format = t->format;
+			hdr->nchannels = chans;
+
+			p = buf + sizeof(cluster_header_t);
+			for (c = 0; c < chans; c++) {
+				chan = htons (t->chan[e + c]);
+				memcpy (p + 2 * c, &chan, sizeof(chan));
+			}
+			p += (2 * chans + 3) & ~3;
+
+			for (c = 0; c < chans; c++) {
+				src = (const float*)jack_port_get_buffer (
+					m->sends[t->send[e + c]].port, nframes);
+				cluster_encode (p, src + off, n, t->format);
+				p += n * bytes;
+			}
+
+			m->tx_msgs[npackets].msg_hdr.msg_name = &t->addr;
+			m->tx_iov[npackets].iov_len = p - buf;
+
+			if (++npackets == CLUSTER_BATCH) {
+				cluster_flush (m, npackets);
+				npackets = 0;
+			}
+		}
+	}
+
+	return npackets;
+}
+
+static int
+cluster_process (jack_nframes_t nframes, void *arg)
+{
+	cluster_t *m = (cluster_t*)arg;
+	jack_nframes_t local = jack_last_frame_time (m->client);
+	cluster_plan_t *plan;
+	unsigned int npackets = 0;
+	int i;
+
+	plan = __atomic_load_n (&m->plan, __ATOMIC_ACQUIRE);
+	if (plan != m->cur) {
+		m->cur = plan;
+		__atomic_store_n (&m->seen, plan, __ATOMIC_RELEASE);
+	}
+
+	for (i = 0; i < m->nproxies; i++) {
+		if (m->rx[i].gen != plan->gen[i]) {
+			cluster_rx_reset (&m->rx[i], plan->gen[i]);
+		}
+	}
+
+	cluster_receive (m, local);
+
+	for (i = 0; i < m->nproxies; i++) {
+		if (plan->source[i]) {
+			cluster_read (m, i, local, nframes);
+		} else {
+			jack_port_set_silent (m->proxies[i].port);
+		}
+	}
+
+	for (i = 0; i < plan->ntargets; i++) {
+		npackets = cluster_send (m, &plan->targets[i], npackets, local,
+					 nframes);
+	}
+
+	if (npackets) {
+		cluster_flush (m, npackets);
+	}
+
+	return 0;
+}
+
+static void
+cluster_latency (jack_latency_callback_mode_t mode, void *arg)
+{
+	cluster_t *m = (cluster_t*)arg;
+	jack_latency_range_t range;
+	jack_nframes_t link = m->latency * jack_get_buffer_size (m->client);
+	int i;
+
+	if (mode == JackCaptureLatency) {
+		for (i = 0; i < m->nproxies; i++) {
+			range.min = range.max = m->proxies[i].node ?
+						m->proxies[i].latency + link : 0;
+			jack_port_set_latency_range (m->proxies[i].port,
+						     JackCaptureLatency, &range);
+		}
+	} else {
+		/* the send ports are where the graph ends, here */
+		range.min = range.max = 0;
+		for (i = 0; i < m->nsends; i++) {
+			jack_port_set_latency_range (m->sends[i].port,
+						     JackPlaybackLatency, &range);
+		}
+	}
+}
+
+/* PLANS */
+
+static void
+cluster_plan_free (cluster_plan_t *plan)
+{
+	int i;
+
+	if (plan == NULL) {
+		return;
+	}
+
+	for (i = 0; i < plan->ntargets; i++) {
+		free (plan->targets[i].send);
+		free (plan->targets[i].chan);
+	}
+	free (plan->targets);
+	free (plan->source);
+	free (plan->gen);
+	free (plan);
+}
+
+static cluster_plan_t *
+cluster_plan_build (cluster_t *m)
+{
+	cluster_plan_t *plan;
+	cluster_target_t *t;
+	cluster_lease_t *l, *first;
+	JSList *node, *other;
+	int i, n;
+
+	if ((plan = (cluster_plan_t*)calloc (1, sizeof(cluster_plan_t))) == NULL ||
+	    (plan->source = (uint32_t*)calloc (m->nproxies,
+					       sizeof(uint32_t))) == NULL ||
+	    (plan->gen = (uint32_t*)calloc (m->nproxies,
+					    sizeof(uint32_t))) == NULL) {
+		cluster_plan_free (plan);
+		return NULL;
+	}
+
+	for (i = 0; i < m->nproxies; i++) {
+		plan->source[i] = m->proxies[i].node;
+		plan->gen[i] = m->gens[i];
+	}
+
+	/* one target per node and format that asked for ports */
+	n = jack_slist_length (m->leases);
+	if (n && (plan->targets = (cluster_target_t*)calloc (n,
+				   sizeof(cluster_target_t))) == NULL) {
+		cluster_plan_free (plan);
+		return NULL;
+	}
+
+	for (node = m->leases; node; node = jack_slist_next (node)) {
+		first = (cluster_lease_t*)node->data;
+
+		for (i = 0; i < plan->ntargets; i++) {
+			t = &plan->targets[i];
+			if (t->addr.sin_addr.s_addr == first->data.sin_addr.s_addr &&
+			    t->addr.sin_port == first->data.sin_port &&
+			    t->format == first->format) {
+				break;
+			}
+		}
+		if (i < plan->ntargets) {
+			continue;       /* done with its first lease */
+		}
+
+		t = &plan->targets[plan->ntargets++];
+		t->addr = first->data;
+		t->format = first->format;
+
+		for (other = node; other; other = jack_slist_next (other)) {
+			l = (cluster_lease_t*)other->data;
+			if (l->data.sin_addr.s_addr == t->addr.sin_addr.s_addr &&
+			    l->data.sin_port == t->addr.sin_port &&
+			    l->format == t->format) {
+				t->nentries++;
+			}
+		}
+
+		if ((t->send = (int*)calloc (t->nentries, sizeof(int))) == NULL ||
+		    (t->chan = (uint16_t*)calloc (t->nentries,
+						  sizeof(uint16_t))) == NULL) {
+			cluster_plan_free (plan);
+			return NULL;
+		}
+
+		t->nentries = 0;
+		for (other = node; other; other = jack_slist_next (other)) {
+			l = (cluster_lease_t*)other->data;
+			if (l->data.sin_addr.s_addr == t->addr.sin_addr.s_addr &&
+			    l->data.sin_port == t->addr.sin_port &&
+			    l->format == t->format) {
+				t->send[t->nentries] = l->send;
+				t->chan[t->nentries] = l->chan;
+				t->nentries++;
+			}
+		}
+	}
+
+	return plan;
+}
+
+/* hand process() a new plan, unless it has yet to pick up the last */
+static void
+cluster_publish (cluster_t *m)
+{
+	cluster_plan_t *plan;
+
+	if (!m->dirty) {
+		return;
+	}
+
+	if (__atomic_load_n (&m->seen, __ATOMIC_ACQUIRE) != m->plan) {
+		return;
+	}
+
+	cluster_plan_free (m->retired);
+	m->retired = NULL;
+
+	if ((plan = cluster_plan_build (m)) == NULL) {
+		jack_error ("cluster: out of memory for the stream plan");
+		return;
+	}
+
+	m->retired = m->plan;
+	__atomic_store_n (&m->plan, plan, __ATOMIC_RELEASE);
+	m->dirty = FALSE;
+}
+
+/* MESSAGES */
+
+static void
+cluster_sendto (cluster_t *m, const char *buf, size_t len,
+		const struct sockaddr_in *to)
+{
+	if (sendto (m->ctl_fd, buf, len, 0, (const struct sockaddr*)to,
+		    sizeof(*to)) < 0) {
+		jack_info ("cluster: cannot send to %s (%s)",
+			 inet_ntoa (to->sin_addr), strerror (errno));
+	}
+}
+
+/* our own audio outputs, in as many datagrams as it takes */
+static void
+cluster_announce (cluster_t *m)
+{
+	char buf[CLUSTER_MTU];
+	char line[JACK_PORT_NAME_SIZE + 32];
+	const char **ports;
+	jack_latency_range_t range;
+	jack_port_t *port;
+	size_t own = strlen (jack_get_client_name (m->client));
+	int head, len, n, i;
+
+	head = snprintf (buf, sizeof(buf), "%s announce %s %" PRIu32 " %" PRIu32
+			 " %u\n", CLUSTER_VERSION, m->node,
+			 jack_get_sample_rate (m->client),
+			 jack_get_buffer_size (m->client), m->data_port);
+	len = head;
+
+	ports = jack_get_ports (m->client, NULL, JACK_DEFAULT_AUDIO_TYPE,
+				JackPortIsOutput);
+
+	for (i = 0; ports && ports[i]; i++) {
+		if (strncmp (ports[i], jack_get_client_name (m->client), own) == 0 &&
+		    ports[i][own] == ':') {
+			continue;       /* no re-exporting other nodes' ports */
+		}
+		if ((port = jack_port_by_name (m->client, ports[i])) == NULL) {
+			continue;
+		}
+		jack_port_get_latency_range (port, JackCaptureLatency, &range);
+
+		n = snprintf (line, sizeof(line), "%" PRIu32 " %s\n", range.max,
+			      ports[i]);
+		if (len + n > (int)sizeof(buf)) {
+			cluster_sendto (m, buf, len, &m->group);
+			len = head;
+		}
+		memcpy (buf + len, line, n);
+		len += n;
+	}
+
+	jack_free (ports);
+
+	cluster_sendto (m, buf, len, &m->group);
+}
+
+static cluster_node_t *
+cluster_node (cluster_t *m, const char *name)
+{
+	JSList *node;
+
+	for (node = m->nodes; node; node = jack_slist_next (node)) {
+		if (strcmp (((cluster_node_t*)node->data)->name, name) == 0) {
+			return (cluster_node_t*)node->data;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+cluster_proxy_release (cluster_t *m, cluster_proxy_t *proxy)
+{
+	jack_port_unset_alias (proxy->port, proxy->alias);
+	proxy->node = 0;
+	proxy->alias[0] = '\0';
+	m->gens[proxy - m->proxies]++;
+	m->dirty = TRUE;
+}
+
+/* give a remote port a proxy, if it has none */
+static void
+cluster_proxy_assign (cluster_t *m, cluster_node_t *n,
+		      cluster_remote_port_t *rp)
+{
+	cluster_proxy_t *proxy, *free_proxy = NULL;
+	int i;
+
+	for (i = 0; i < m->nproxies; i++) {
+		proxy = &m->proxies[i];
+		if (proxy->node == n->id && strcmp (proxy->remote, rp->name) == 0) {
+			proxy->latency = rp->latency;
+			return;
+		}
+		if (proxy->node == 0 && free_proxy == NULL) {
+			free_proxy = proxy;
+		}
+	}
+
+	if ((proxy = free_proxy) == NULL) {
+		jack_info ("cluster: no proxy left for %s:%s",
+			 n->name, rp->name);
+		return;
+	}
+
+	if (snprintf (proxy->alias, sizeof(proxy->alias), "%s:%s", n->name,
+		      rp->name) >= (int)sizeof(proxy->alias) ||
+	    jack_port_set_alias (proxy->port, proxy->alias)) {
+		proxy->alias[0] = '\0';
+		return;
+	}
+
+	proxy->node = n->id;
+	snprintf (proxy->remote, sizeof(proxy->remote), "%s", rp->name);
+	proxy->latency = rp->latency;
+	m->gens[proxy - m->proxies]++;
+	m->dirty = TRUE;
+}
+
+static void
+cluster_handle_announce (cluster_t *m, char *body,
+			 const struct sockaddr_in *from, jack_time_t now)
+{
+	char name[CLUSTER_NODE_SIZE];
+	unsigned int rate, period, data;
+	cluster_remote_port_t *rp;
+	cluster_node_t *n;
+	char *line, *save = NULL, *sp;
+	unsigned long latency;
+	int i;
+
+	line = strtok_r (body, "\n", &save);
+	if (line == NULL ||
+	    sscanf (line, "%63s %u %u %u", name, &rate, &period, &data) != 4 ||
+	    strcmp (name, m->node) == 0) {
+		return;
+	}
+
+	if ((n = cluster_node (m, name)) == NULL) {
+		if ((n = (cluster_node_t*)calloc (1, sizeof(cluster_node_t))) == NULL) {
+			return;
+		}
+		snprintf (n->name, sizeof(n->name), "%s", name);
+		n->id = cluster_hash (name);
+		m->nodes = jack_slist_append (m->nodes, n);
+		jack_info ("cluster: node %s at %s", name, inet_ntoa (from->sin_addr));
+	}
+
+	n->control = *from;
+	n->data_port = data;
+	n->seen = now;
+
+	if (rate != jack_get_sample_rate (m->client) ||
+	    period != jack_get_buffer_size (m->client)) {
+		if (!n->mismatch) {
+			jack_error ("cluster: node %s runs at %u Hz, %u frames, "
+				    "not in step with this one; ignoring it",
+				    name, rate, period);
+			n->mismatch = TRUE;
+		}
+		return;
+	}
+	n->mismatch = FALSE;
+
+	while ((line = strtok_r (NULL, "\n", &save)) != NULL) {
+		latency = strtoul (line, &sp, 10);
+		if (*sp != ' ' || *++sp == '\0') {
+			continue;
+		}
+
+		for (i = 0; i < n->nports; i++) {
+			if (strcmp (n->ports[i].name, sp) == 0) {
+				break;
+			}
+		}
+		if (i == n->nports) {
+			rp = (cluster_remote_port_t*)realloc (n->ports,
+							      (n->nports + 1) * sizeof(*rp));
+			if (rp == NULL) {
+				return;
+			}
+			n->ports = rp;
+			n->nports++;
+			snprintf (n->ports[i].name, sizeof(n->ports[i].name), "%s", sp);
+		}
+		n->ports[i].latency = latency;
+		n->ports[i].seen = now;
+
+		cluster_proxy_assign (m, n, &n->ports[i]);
+	}
+}
+
+static cluster_send_t *
+cluster_send_for (cluster_t *m, const char *source)
+{
+	cluster_send_t *free_send = NULL;
+	int i;
+
+	for (i = 0; i < m->nsends; i++) {
+		if (strcmp (m->sends[i].source, source) == 0) {
+			return &m->sends[i];
+		}
+		if (m->sends[i].source[0] == '\0' && free_send == NULL) {
+			free_send = &m->sends[i];
+		}
+	}
+
+	if (free_send == NULL) {
+		jack_error ("cluster: no send port left for %s", source);
+		return NULL;
+	}
+
+	if (jack_connect (m->client, source, jack_port_name (free_send->port))) {
+		jack_error ("cluster: cannot connect %s to %s", source,
+			    jack_port_name (free_send->port));
+		return NULL;
+	}
+
+	snprintf (free_send->source, sizeof(free_send->source), "%s", source);
+	free_send->leases = 0;
+
+	return free_send;
+}
+
+static void
+cluster_handle_subscribe (cluster_t *m, char *body,
+			  const struct sockaddr_in *from, jack_time_t now)
+{
+	char name[CLUSTER_NODE_SIZE], format[16];
+	struct sockaddr_in data = *from;
+	cluster_format_t fmt;
+	cluster_lease_t *l;
+	cluster_send_t *s;
+	jack_port_t *port;
+	char *line, *save = NULL, *sp;
+	unsigned int dport;
+	unsigned long chan;
+	uint32_t id;
+	JSList *node;
+
+	line = strtok_r (body, "\n", &save);
+	if (line == NULL ||
+	    sscanf (line, "%63s %u %15s", name, &dport, format) != 3) {
+		return;
+	}
+
+	for (fmt = ClusterFloat; fmt <= ClusterS16; fmt++) {
+		if (strcmp (format, cluster_format_names[fmt]) == 0) {
+			break;
+		}
+	}
+	if (fmt > ClusterS16) {
+		return;
+	}
+
+	id = cluster_hash (name);
+	data.sin_port = htons (dport);
+
+	while ((line = strtok_r (NULL, "\n", &save)) != NULL) {
+		chan = strtoul (line, &sp, 10);
+		if (*sp != ' ' || *++sp == '\0' || chan > 0xffff) {
+			continue;
+		}
+
+		for (node = m->leases; node; node = jack_slist_next (node)) {
+			l = (cluster_lease_t*)node->data;
+			if (l->node == id && l->chan == chan) {
+				break;
+			}
+		}
+
+		if (node) {
+			l = (cluster_lease_t*)node->data;
+			if (strcmp (m->sends[l->send].source, sp) == 0 &&
+			    l->format == fmt &&
+			    l->data.sin_addr.s_addr == data.sin_addr.s_addr &&
+			    l->data.sin_port == data.sin_port) {
+				l->expires = now + CLUSTER_LEASE;
+				continue;
+			}
+			/* the proxy carries something else now */
+			l->expires = 0;
+		}
+
+		if ((port = jack_port_by_name (m->client, sp)) == NULL ||
+		    !(jack_port_flags (port) & JackPortIsOutput) ||
+		    jack_port_is_mine (m->client, port) ||
+		    strcmp (jack_port_type (port), JACK_DEFAULT_AUDIO_TYPE) != 0) {
+			continue;
+		}
+
+		if ((s = cluster_send_for (m, jack_port_name (port))) == NULL) {
+			continue;
+		}
+
+		if ((l = (cluster_lease_t*)calloc (1, sizeof(cluster_lease_t))) == NULL) {
+			continue;
+		}
+		l->node = id;
+		l->data = data;
+		l->format = fmt;
+		l->chan = chan;
+		l->send = s - m->sends;
+		l->expires = now + CLUSTER_LEASE;
+		s->leases++;
+		m->leases = jack_slist_append (m->leases, l);
+		m->dirty = TRUE;
+
+		jack_info ("cluster: sending %s to %s as %lu",
+			 s->source, name, chan);
+	}
+}
+
+/* ask each node for the ports of ours that are connected */
+static void
+cluster_subscribe (cluster_t *m)
+{
+	char buf[CLUSTER_MTU];
+	char line[JACK_PORT_NAME_SIZE + 16];
+	cluster_node_t *n;
+	const char **conns;
+	JSList *node;
+	int head, len, l, i;
+
+	for (i = 0; i < m->nproxies; i++) {
+		if (m->proxies[i].node == 0) {
+			m->proxies[i].connected = FALSE;
+			continue;
+		}
+		conns = jack_port_get_connections (m->proxies[i].port);
+		m->proxies[i].connected = (conns != NULL);
+		jack_free (conns);
+	}
+
+	for (node = m->nodes; node; node = jack_slist_next (node)) {
+		n = (cluster_node_t*)node->data;
+		if (n->mismatch) {
+			continue;
+		}
+
+		head = snprintf (buf, sizeof(buf), "%s subscribe %s %u %s\n",
+				 CLUSTER_VERSION, m->node, m->data_port,
+				 cluster_format_names[m->format]);
+		len = head;
+
+		for (i = 0; i < m->nproxies; i++) {
+			if (m->proxies[i].node != n->id || !m->proxies[i].connected) {
+				continue;
+			}
+			l = snprintf (line, sizeof(line), "%d %s\n", i,
+				      m->proxies[i].remote);
+			if (len + l > (int)sizeof(buf)) {
+				cluster_sendto (m, buf, len, &n->control);
+				len = head;
+			}
+			memcpy (buf + len, line, l);
+			len += l;
+		}
+
+		if (len > head) {
+			cluster_sendto (m, buf, len, &n->control);
+		}
+	}
+}
+
+static void
+cluster_expire (cluster_t *m, jack_time_t now)
+{
+	cluster_node_t *n;
+	cluster_lease_t *l;
+	cluster_send_t *s;
+	JSList *node, *next;
+	int i, j, live;
+
+	/* our streams nobody renewed */
+	for (node = m->leases; node; node = next) {
+		next = jack_slist_next (node);
+		l = (cluster_lease_t*)node->data;
+		if (l->expires > now) {
+			continue;
+		}
+		s = &m->sends[l->send];
+		if (--s->leases == 0) {
+			jack_disconnect (m->client, s->source,
+					 jack_port_name (s->port));
+			s->source[0] = '\0';
+		}
+		m->leases = jack_slist_remove_link (m->leases, node);
+		jack_slist_free_1 (node);
+		free (l);
+		m->dirty = TRUE;
+	}
+
+	/* ports and nodes that went quiet */
+	for (node = m->nodes; node; node = next) {
+		next = jack_slist_next (node);
+		n = (cluster_node_t*)node->data;
+
+		for (i = 0, j = 0; i < n->nports; i++) {
+			if (n->seen - n->ports[i].seen < CLUSTER_EXPIRE &&
+			    now - n->seen < CLUSTER_EXPIRE) {
+				n->ports[j++] = n->ports[i];
+			}
+		}
+		n->nports = j;
+
+		for (i = 0; i < m->nproxies; i++) {
+			if (m->proxies[i].node != n->id) {
+				continue;
+			}
+			for (live = FALSE, j = 0; j < n->nports && !live; j++) {
+				live = strcmp (n->ports[j].name,
+					       m->proxies[i].remote) == 0;
+			}
+			if (live) {
+				continue;
+			}
+			/* a connected proxy keeps its name, silent, so
+			   the connection is there when the port is back */
+			if (!m->proxies[i].connected) {
+				cluster_proxy_release (m, &m->proxies[i]);
+			}
+		}
+
+		if (now - n->seen >= CLUSTER_EXPIRE) {
+			jack_info ("cluster: node %s went away", n->name);
+			for (i = 0; i < m->nproxies; i++) {
+				if (m->proxies[i].node == n->id) {
+					cluster_proxy_release (m, &m->proxies[i]);
+					m->proxies[i].connected = FALSE;
+				}
+			}
+			m->nodes = jack_slist_remove_link (m->nodes, node);
+			jack_slist_free_1 (node);
+			free (n->ports);
+			free (n);
+		}
+	}
+}
+
+static void
+cluster_control (cluster_t *m, jack_time_t now)
+{
+	char buf[CLUSTER_MTU + 1];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	size_t vlen = strlen (CLUSTER_VERSION);
+	char *body;
+	ssize_t n;
+
+	for (;; ) {
+		fromlen = sizeof(from);
+		n = recvfrom (m->ctl_fd, buf, CLUSTER_MTU, MSG_DONTWAIT,
+			      (struct sockaddr*)&from, &fromlen);
+		if (n <= 0) {
+			break;
+		}
+		buf[n] = '\0';
+
+		if ((size_t)n <= vlen || strncmp (buf, CLUSTER_VERSION, vlen) ||
+		    buf[vlen] != ' ') {
+			continue;
+		}
+		body = buf + vlen + 1;
+
+		if (strncmp (body, "announce ", 9) == 0) {
+			cluster_handle_announce (m, body + 9, &from, now);
+		} else if (strncmp (body, "subscribe ", 10) == 0) {
+			cluster_handle_subscribe (m, body + 10, &from, now);
+		}
+	}
+}
+
+static void *
+cluster_thread (void *arg)
+{
+	cluster_t *m = (cluster_t*)arg;
+	struct pollfd pfd[2];
+	jack_time_t now;
+	int was_dirty;
+
+	pfd[0].fd = m->ctl_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = m->stop_fds[0];
+	pfd[1].events = POLLIN;
+
+	for (;; ) {
+		if (poll (pfd, 2, CLUSTER_TICK) < 0 && errno != EINTR) {
+			break;
+		}
+
+		if (pfd[1].revents) {
+			break;
+		}
+
+		now = jack_get_time ();
+		was_dirty = m->dirty;
+
+		if (pfd[0].revents & POLLIN) {
+			cluster_control (m, now);
+		}
+
+		if (now - m->announced >= CLUSTER_ANNOUNCE) {
+			cluster_announce (m);
+			cluster_subscribe (m);
+			cluster_expire (m, now);
+			m->announced = now;
+		}
+
+		if (m->dirty && !was_dirty) {
+			/* proxies changed hands: their latency did too */
+			jack_recompute_total_latencies (m->client);
+		}
+
+		cluster_publish (m);
+	}
+
+	return NULL;
+}
+
+/* SETUP */
+
+static int
+cluster_parse_address (const char *str, struct sockaddr_in *sa)
+{
+	char host[64];
+	char *colon;
+
+	snprintf (host, sizeof(host), "%s", str);
+
+	if ((colon = strrchr (host, ':'))) {
+		*colon++ = '\0';
+		sa->sin_port = htons (atoi (colon));
+	}
+
+	return inet_pton (AF_INET, host, &sa->sin_addr) == 1 ? 0 : -1;
+}
+
+static int
+cluster_parse (cluster_t *m, const char *load_init)
+{
+	char *args, *opt, *save = NULL, *value;
+	int ret = 0;
+
+	if (load_init == NULL || *load_init == '\0') {
+		return 0;
+	}
+
+	if ((args = strdup (load_init)) == NULL) {
+		return -1;
+	}
+
+	for (opt = strtok_r (args, ",", &save); opt && ret == 0;
+	     opt = strtok_r (NULL, ",", &save)) {
+
+		if ((value = strchr (opt, '=')) == NULL) {
+			jack_error ("cluster: \"%s\" is not key=value", opt);
+			ret = -1;
+			break;
+		}
+		*value++ = '\0';
+
+		if (strcmp (opt, "node") == 0) {
+			if (*value == '\0' || strpbrk (value, ": \n") ||
+			    strlen (value) >= sizeof(m->node)) {
+				jack_error ("cluster: bad node name \"%s\"", value);
+				ret = -1;
+			}
+			snprintf (m->node, sizeof(m->node), "%s", value);
+		} else if (strcmp (opt, "group") == 0) {
+			if (cluster_parse_address (value, &m->group) ||
+			    !IN_MULTICAST (ntohl (m->group.sin_addr.s_addr))) {
+				jack_error ("cluster: bad multicast group \"%s\"",
+					    value);
+				ret = -1;
+			}
+		} else if (strcmp (opt, "interface") == 0) {
+			snprintf (m->interface, sizeof(m->interface), "%s", value);
+		} else if (strcmp (opt, "data") == 0) {
+			m->data_port = atoi (value);
+		} else if (strcmp (opt, "ports") == 0) {
+			m->nproxies = atoi (value);
+		} else if (strcmp (opt, "sends") == 0) {
+			m->nsends = atoi (value);
+		} else if (strcmp (opt, "format") == 0) {
+			for (m->format = ClusterFloat; m->format <= ClusterS16;
+			     m->format++) {
+				if (strcmp (value, cluster_format_names[m->format]) == 0) {
+					break;
+				}
+			}
+			if (m->format > ClusterS16) {
+				jack_error ("cluster: unknown format \"%s\"", value);
+				ret = -1;
+			}
+		} else if (strcmp (opt, "latency") == 0) {
+			m->latency = atoi (value);
+		} else {
+			jack_error ("cluster: unknown option \"%s\"", opt);
+			ret = -1;
+		}
+	}
+
+	free (args);
+
+	if (ret == 0 && (m->nproxies < 0 || m->nproxies > CLUSTER_MAX_PORTS ||
+			 m->nsends < 0 || m->nsends > CLUSTER_MAX_PORTS ||
+			 m->nproxies + m->nsends == 0)) {
+		jack_error ("cluster: up to %d ports and sends, and some of one",
+			    CLUSTER_MAX_PORTS);
+		ret = -1;
+	}
+
+	if (ret == 0 && m->latency < 1) {
+		jack_error ("cluster: the latency is at least one period");
+		ret = -1;
+	}
+
+	if (ret == 0 && m->interface[0] &&
+	    (m->ifindex = if_nametoindex (m->interface)) == 0) {
+		jack_error ("cluster: no interface %s", m->interface);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int
+cluster_sockets (cluster_t *m)
+{
+	struct sockaddr_in addr;
+	struct ip_mreqn mreq;
+	int one = 1, tos = 46 << 2;
+
+	if ((m->ctl_fd = socket (AF_INET, SOCK_DGRAM, 0)) < 0 ||
+	    (m->data_fd = socket (AF_INET, SOCK_DGRAM, 0)) < 0) {
+		jack_error ("cluster: cannot create sockets (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	setsockopt (m->ctl_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_ANY);
+	addr.sin_port = m->group.sin_port;
+
+	if (bind (m->ctl_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		jack_error ("cluster: cannot bind to port %d (%s)",
+			    ntohs (addr.sin_port), strerror (errno));
+		return -1;
+	}
+
+	memset (&mreq, 0, sizeof(mreq));
+	mreq.imr_multiaddr = m->group.sin_addr;
+	mreq.imr_address.s_addr = htonl (INADDR_ANY);
+	mreq.imr_ifindex = m->ifindex;
+	if (setsockopt (m->ctl_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+			sizeof(mreq))) {
+		jack_error ("cluster: cannot join %s (%s)",
+			    inet_ntoa (m->group.sin_addr), strerror (errno));
+		return -1;
+	}
+	if (m->ifindex) {
+		setsockopt (m->ctl_fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq,
+			    sizeof(mreq));
+	}
+	/* nodes on one host see each other; our own are ignored by name */
+	setsockopt (m->ctl_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one));
+
+	addr.sin_port = htons (m->data_port);
+	if (bind (m->data_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		jack_error ("cluster: cannot bind to port %d (%s)",
+			    m->data_port, strerror (errno));
+		return -1;
+	}
+
+	/* expedited forwarding, as for other realtime media */
+	setsockopt (m->data_fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+	return 0;
+}
+
+static void
+cluster_free (cluster_t *m)
+{
+	cluster_lease_t *l;
+	cluster_node_t *n;
+	JSList *node;
+
+	if (m->ctl_fd >= 0) {
+		close (m->ctl_fd);
+	}
+	if (m->data_fd >= 0) {
+		close (m->data_fd);
+	}
+
+	for (node = m->leases; node; node = jack_slist_next (node)) {
+		l = (cluster_lease_t*)node->data;
+		free (l);
+	}
+	jack_slist_free (m->leases);
+
+	for (node = m->nodes; node; node = jack_slist_next (node)) {
+		n = (cluster_node_t*)node->data;
+		free (n->ports);
+		free (n);
+	}
+	jack_slist_free (m->nodes);
+
+	cluster_plan_free (m->retired);
+	cluster_plan_free (m->plan);
+	free (m->proxies);
+	free (m->sends);
+	free (m->gens);
+	free (m->rx);
+	free (m->tx_bufs);
+	free (m->tx_msgs);
+	free (m->tx_iov);
+	free (m->rx_bufs);
+	free (m->rx_msgs);
+	free (m->rx_iov);
+	free (m);
+}
+
+static int
+cluster_setup (cluster_t *m)
+{
+	char name[32];
+	int i;
+
+	if ((m->proxies = (cluster_proxy_t*)calloc (m->nproxies + 1,
+						    sizeof(cluster_proxy_t))) == NULL ||
+	    (m->sends = (cluster_send_t*)calloc (m->nsends + 1,
+						 sizeof(cluster_send_t))) == NULL ||
+	    (m->gens = (uint32_t*)calloc (m->nproxies + 1,
+					  sizeof(uint32_t))) == NULL ||
+	    (m->rx = (cluster_rx_t*)calloc (m->nproxies + 1,
+					    sizeof(cluster_rx_t))) == NULL ||
+	    (m->tx_bufs = (uint8_t*)malloc (CLUSTER_BATCH * CLUSTER_MTU)) == NULL ||
+	    (m->tx_msgs = (struct mmsghdr*)calloc (CLUSTER_BATCH,
+						   sizeof(struct mmsghdr))) == NULL ||
+	    (m->tx_iov = (struct iovec*)calloc (CLUSTER_BATCH,
+						sizeof(struct iovec))) == NULL ||
+	    (m->rx_bufs = (uint8_t*)malloc (CLUSTER_BATCH * CLUSTER_MTU)) == NULL ||
+	    (m->rx_msgs = (struct mmsghdr*)calloc (CLUSTER_BATCH,
+						   sizeof(struct mmsghdr))) == NULL ||
+	    (m->rx_iov = (struct iovec*)calloc (CLUSTER_BATCH,
+						sizeof(struct iovec))) == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < CLUSTER_BATCH; i++) {
+		m->tx_iov[i].iov_base = m->tx_bufs + i * CLUSTER_MTU;
+		m->tx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		m->tx_msgs[i].msg_hdr.msg_iov = &m->tx_iov[i];
+		m->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+		m->rx_iov[i].iov_base = m->rx_bufs + i * CLUSTER_MTU;
+		m->rx_iov[i].iov_len = CLUSTER_MTU;
+		m->rx_msgs[i].msg_hdr.msg_iov = &m->rx_iov[i];
+		m->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (i = 0; i < m->nproxies; i++) {
+		cluster_rx_reset (&m->rx[i], 0);
+		snprintf (name, sizeof(name), "remote_%d", i + 1);
+		if ((m->proxies[i].port = jack_port_register (m->client, name,
+							      JACK_DEFAULT_AUDIO_TYPE,
+							      JackPortIsOutput, 0)) == NULL) {
+			jack_error ("cluster: cannot register %s", name);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < m->nsends; i++) {
+		snprintf (name, sizeof(name), "send_%d", i + 1);
+		if ((m->sends[i].port = jack_port_register (m->client, name,
+							    JACK_DEFAULT_AUDIO_TYPE,
+							    JackPortIsInput, 0)) == NULL) {
+			jack_error ("cluster: cannot register %s", name);
+			return -1;
+		}
+	}
+
+	if ((m->plan = cluster_plan_build (m)) == NULL) {
+		return -1;
+	}
+	m->seen = m->cur = m->plan;
+
+	return 0;
+}
+
+int
+jack_initialize (jack_client_t *client, const char *load_init)
+{
+	cluster_t *m;
+
+	if ((m = (cluster_t*)calloc (1, sizeof(cluster_t))) == NULL) {
+		return -1;
+	}
+
+	m->client = client;
+	m->ctl_fd = m->data_fd = -1;
+	m->stop_fds[0] = m->stop_fds[1] = -1;
+	m->group.sin_family = AF_INET;
+	m->group.sin_port = htons (CLUSTER_PORT);
+	inet_pton (AF_INET, CLUSTER_GROUP, &m->group.sin_addr);
+	m->nproxies = CLUSTER_PORTS;
+	m->nsends = CLUSTER_SENDS;
+	m->format = ClusterFloat;
+	m->latency = CLUSTER_LATENCY;
+
+	if (gethostname (m->node, sizeof(m->node) - 1) || m->node[0] == '\0') {
+		snprintf (m->node, sizeof(m->node), "jackd");
+	}
+	m->node[strcspn (m->node, ".: ")] = '\0';
+
+	if (cluster_parse (m, load_init)) {
+		cluster_free (m);
+		return -1;
+	}
+
+	if (m->data_port == 0) {
+		m->data_port = ntohs (m->group.sin_port) + 1;
+	}
+	m->id = cluster_hash (m->node);
+
+	if (cluster_sockets (m) || cluster_setup (m)) {
+		cluster_free (m);
+		return -1;
+	}
+
+	if (jack_set_process_callback (client, cluster_process, m) ||
+	    jack_set_latency_callback (client, cluster_latency, m) ||
+	    jack_activate (client)) {
+		client->process_arg = NULL;
+		cluster_free (m);
+		return -1;
+	}
+
+	if (pipe (m->stop_fds)) {
+		jack_deactivate (client);
+		client->process_arg = NULL;
+		cluster_free (m);
+		return -1;
+	}
+
+	/* not realtime: it wakes up a few times a second */
+	if (jack_client_create_thread (client, &m->thread, 0, 0,
+				       cluster_thread, m)) {
+		jack_error ("cluster: cannot start the control thread");
+		jack_deactivate (client);
+		close (m->stop_fds[0]);
+		close (m->stop_fds[1]);
+		client->process_arg = NULL;
+		cluster_free (m);
+		return -1;
+	}
+
+	jack_info ("cluster: node %s on %s:%d, streams on port %u, %d proxies, "
+		   "%d sends, %s", m->node, inet_ntoa (m->group.sin_addr),
+		   ntohs (m->group.sin_port), m->data_port, m->nproxies,
+		   m->nsends, cluster_format_names[m->format]);
+
+	return 0;
+}
+
+void
+jack_finish (void *arg)
+{
+	cluster_t *m = (cluster_t*)arg;
+	char c = 0;
+
+	if (m == NULL) {
+		return;
+	}
+
+	if (write (m->stop_fds[1], &c, 1) == 1) {
+		pthread_join (m->thread, NULL);
+	}
+
+	close (m->stop_fds[0]);
+	close (m->stop_fds[1]);
+
+	jack_info ("cluster: sent %lu packets (%lu failed), received %lu "
+		   "(%lu late, %lu foreign), %lu frames missing, %lu slips",
+		   m->tx_packets, m->tx_errors, m->rx_packets, m->rx_late,
+		   m->rx_foreign, m->rx_missing, m->slips);
+
+	cluster_free (m);
+}
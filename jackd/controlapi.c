@@ -32,6 +32,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <signal.h>
 
@@ -39,6 +40,7 @@
 #include "jack/control.h"
 
 #include "driver_interface.h"
+#include "drivercache.h"
 #include "driver.h"
 #include "engine.h"
 #include "clientengine.h"
@@ -116,6 +118,94 @@ struct jackctl_server {
 	/* int, timeout thres... */
 	union jackctl_parameter_value timothres;
 	union jackctl_parameter_value default_timothres;
+
+	/* bool, run independent clients in parallel */
+	union jackctl_parameter_value parallel;
+	union jackctl_parameter_value default_parallel;
+
+	/* uint, stages to pipeline the graph in, 0 or 1 for none */
+	union jackctl_parameter_value pipeline;
+	union jackctl_parameter_value default_pipeline;
+
+	/* string, graph activation mechanism */
+	union jackctl_parameter_value activation;
+	union jackctl_parameter_value default_activation;
+
+	/* string, file to trace engine cycles to */
+	union jackctl_parameter_value trace;
+	union jackctl_parameter_value default_trace;
+
+	/* uint, buffer size while freewheeling, 0 to keep it */
+	union jackctl_parameter_value freewheel_period;
+	union jackctl_parameter_value default_freewheel_period;
+
+	/* bool, run independent clients in parallel while freewheeling */
+	union jackctl_parameter_value freewheel_parallel;
+	union jackctl_parameter_value default_freewheel_parallel;
+
+	/* bool, keep the drivers running on null cycles while freewheeling */
+	union jackctl_parameter_value freewheel_keep_driver;
+	union jackctl_parameter_value default_freewheel_keep_driver;
+
+	/* string, file to keep metadata in across restarts */
+	union jackctl_parameter_value metadata_file;
+	union jackctl_parameter_value default_metadata_file;
+
+	/* string, file to keep the graph in across restarts */
+	union jackctl_parameter_value checkpoint_file;
+	union jackctl_parameter_value default_checkpoint_file;
+
+	/* bool, back port buffers with huge pages */
+	union jackctl_parameter_value hugepages;
+	union jackctl_parameter_value default_hugepages;
+
+	/* bool, let audio outputs of a serial graph share buffers */
+	union jackctl_parameter_value share_buffers;
+	union jackctl_parameter_value default_share_buffers;
+
+	/* bool, sample the cpu time of process() */
+	union jackctl_parameter_value cpu_times;
+	union jackctl_parameter_value default_cpu_times;
+
+	/* uint32_t, usecs graph waits may spin for, 0: none */
+	union jackctl_parameter_value spin_wait;
+	union jackctl_parameter_value default_spin_wait;
+
+	/* uint32_t, cycles per half of the load statistics window */
+	union jackctl_parameter_value load_window;
+	union jackctl_parameter_value default_load_window;
+
+	/* string, cpus for the driver thread */
+	union jackctl_parameter_value engine_cpus;
+	union jackctl_parameter_value default_engine_cpus;
+
+	/* string, cpus to suggest for client process threads */
+	union jackctl_parameter_value client_cpus;
+	union jackctl_parameter_value default_client_cpus;
+
+	/* bool, use SCHED_DEADLINE for realtime threads */
+	union jackctl_parameter_value deadline;
+	union jackctl_parameter_value default_deadline;
+
+	/* bool, run slave driver I/O on helper threads */
+	union jackctl_parameter_value slave_threads;
+	union jackctl_parameter_value default_slave_threads;
+
+	/* uint, threads that run internal clients in a parallel graph */
+	union jackctl_parameter_value internal_threads;
+	union jackctl_parameter_value default_internal_threads;
+
+	/* uint, period the port buffers are preallocated for */
+	union jackctl_parameter_value max_buffer_size;
+	union jackctl_parameter_value default_max_buffer_size;
+
+	/* bool, keep cpus out of deep idle states while running realtime */
+	union jackctl_parameter_value pm_qos;
+	union jackctl_parameter_value default_pm_qos;
+
+	/* string, frame timer DLL bandwidth in Hz, empty for the default */
+	union jackctl_parameter_value dll_bandwidth;
+	union jackctl_parameter_value default_dll_bandwidth;
 };
 
 struct jackctl_driver {
@@ -365,7 +455,6 @@ jack_drivers_load ()
 {
 	struct dirent * dir_entry;
 	DIR * dir_stream;
-	const char * ptr;
 	int err;
 	JSList * driver_list = NULL;
 	jack_driver_desc_t * desc;
@@ -375,6 +464,11 @@ jack_drivers_load ()
 		driver_dir = ADDON_DIR;
 	}
 
+	/* the cached descriptors, unless a driver changed since */
+	if ((driver_list = jack_driver_cache_load (driver_dir)) != NULL) {
+		return driver_list;
+	}
+
 	/* search through the driver_dir and add get descriptors
 	   from the .so files in it */
 	dir_stream = opendir (driver_dir);
@@ -386,16 +480,7 @@ jack_drivers_load ()
 
 	while ( (dir_entry = readdir (dir_stream)) ) {
 		/* check the filename is of the right format */
-		if (strncmp ("jack_", dir_entry->d_name, 5) != 0) {
-			continue;
-		}
-
-		ptr = strrchr (dir_entry->d_name, '.');
-		if (!ptr) {
-			continue;
-		}
-		ptr++;
-		if (strncmp ("so", ptr, 2) != 0) {
+		if (!jack_driver_file_name (dir_entry->d_name)) {
 			continue;
 		}
 
@@ -416,6 +501,8 @@ jack_drivers_load ()
 		return NULL;
 	}
 
+	jack_driver_cache_save (driver_dir, driver_list);
+
 	return driver_list;
 }
 
@@ -956,7 +1043,7 @@ jackctl_server_t * jackctl_server_create (
 		    &server_ptr->parameters,
 		    'c',
 		    "clock-source",
-		    "Clocksource type : c(ycle) | h(pet) | s(ystem).",
+		    "Clocksource type : t(sc) | c(ycle) | h(pet) | s(ystem).",
 		    "",
 		    JackParamUInt,
 		    &server_ptr->clock_source,
@@ -970,7 +1057,7 @@ jackctl_server_t * jackctl_server_create (
 		    &server_ptr->parameters,
 		    'p',
 		    "port-max",
-		    "Maximum number of ports.",
+		    "Initial number of ports.",
 		    "",
 		    JackParamUInt,
 		    &server_ptr->port_max,
@@ -1049,6 +1136,314 @@ jackctl_server_t * jackctl_server_create (
 		goto fail_free_parameters;
 	}
 
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "parallel",
+		    "run clients that do not feed each other in parallel",
+		    "",
+		    JackParamBool,
+		    &server_ptr->parallel,
+		    &server_ptr->default_parallel,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "pipeline",
+		    "run the graph as a pipeline of this many stages, each a period behind the one before",
+		    "",
+		    JackParamUInt,
+		    &server_ptr->pipeline,
+		    &server_ptr->default_pipeline,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	strcpy (value.str, "fifo");
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'a',
+		    "activation",
+		    "graph activation mechanism (fifo or futex)",
+		    "",
+		    JackParamString,
+		    &server_ptr->activation,
+		    &server_ptr->default_activation,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "trace",
+		    "file to write a trace of every engine cycle to",
+		    "",
+		    JackParamString,
+		    &server_ptr->trace,
+		    &server_ptr->default_trace,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "freewheel-period",
+		    "buffer size while freewheeling (0: keep the current one)",
+		    "",
+		    JackParamUInt,
+		    &server_ptr->freewheel_period,
+		    &server_ptr->default_freewheel_period,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "freewheel-parallel",
+		    "run clients that do not feed each other in parallel while freewheeling",
+		    "",
+		    JackParamBool,
+		    &server_ptr->freewheel_parallel,
+		    &server_ptr->default_freewheel_parallel,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "freewheel-keep-driver",
+		    "keep the hardware running on silence while freewheeling, so that it need not restart afterwards",
+		    "",
+		    JackParamBool,
+		    &server_ptr->freewheel_keep_driver,
+		    &server_ptr->default_freewheel_keep_driver,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "metadata-file",
+		    "file to keep client metadata in across server restarts",
+		    "",
+		    JackParamString,
+		    &server_ptr->metadata_file,
+		    &server_ptr->default_metadata_file,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "checkpoint-file",
+		    "file to keep the graph in across server restarts",
+		    "",
+		    JackParamString,
+		    &server_ptr->checkpoint_file,
+		    &server_ptr->default_checkpoint_file,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "hugepages",
+		    "back port buffers with huge pages",
+		    "",
+		    JackParamBool,
+		    &server_ptr->hugepages,
+		    &server_ptr->default_hugepages,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "share-buffers",
+		    "let audio outputs whose data is not needed at the same time in the cycle share buffers",
+		    "",
+		    JackParamBool,
+		    &server_ptr->share_buffers,
+		    &server_ptr->default_share_buffers,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "cpu-times",
+		    "sample the cpu time and preemptions of every process() call",
+		    "",
+		    JackParamBool,
+		    &server_ptr->cpu_times,
+		    &server_ptr->default_cpu_times,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "spin-wait",
+		    "usecs the graph waits may spin before sleeping, for cpus that do nothing else (futex activation only)",
+		    "",
+		    JackParamUInt,
+		    &server_ptr->spin_wait,
+		    &server_ptr->default_spin_wait,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = JACK_TIMING_WINDOW;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "load-window",
+		    "cycles per window of the DSP load statistics",
+		    "",
+		    JackParamUInt,
+		    &server_ptr->load_window,
+		    &server_ptr->default_load_window,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "engine-cpus",
+		    "cpus to run the driver thread on, e.g. 2 or 2-3",
+		    "",
+		    JackParamString,
+		    &server_ptr->engine_cpus,
+		    &server_ptr->default_engine_cpus,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "client-cpus",
+		    "cpus to suggest for client process threads, e.g. 4-7",
+		    "",
+		    JackParamString,
+		    &server_ptr->client_cpus,
+		    &server_ptr->default_client_cpus,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "deadline",
+		    "schedule the driver and client threads with SCHED_DEADLINE",
+		    "",
+		    JackParamBool,
+		    &server_ptr->deadline,
+		    &server_ptr->default_deadline,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "slave-threads",
+		    "run the I/O of each slave driver on its own thread, in parallel with the master driver",
+		    "",
+		    JackParamBool,
+		    &server_ptr->slave_threads,
+		    &server_ptr->default_slave_threads,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "internal-threads",
+		    "threads to run internal clients on beside the rest of a parallel graph (0: on the driver thread)",
+		    "",
+		    JackParamUInt,
+		    &server_ptr->internal_threads,
+		    &server_ptr->default_internal_threads,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "max-buffer-size",
+		    "largest buffer size to preallocate port buffers for, so that changes up to it need no remapping (0: the current one)",
+		    "",
+		    JackParamUInt,
+		    &server_ptr->max_buffer_size,
+		    &server_ptr->default_max_buffer_size,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "pm-qos",
+		    "keep cpus out of idle states slower to leave than a twentieth of the period while running realtime",
+		    "",
+		    JackParamBool,
+		    &server_ptr->pm_qos,
+		    &server_ptr->default_pm_qos,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    '\0',
+		    "dll-bandwidth",
+		    "bandwidth of the frame timer filter in Hz once it has locked (default 0.125)",
+		    "",
+		    JackParamString,
+		    &server_ptr->dll_bandwidth,
+		    &server_ptr->default_dll_bandwidth,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
 	//TODO: need
 	//JackServerGlobals::on_device_acquire = on_device_acquire;
 	//JackServerGlobals::on_device_release = on_device_release;
@@ -1112,6 +1507,136 @@ const JSList * jackctl_server_get_parameters (jackctl_server_t *server_ptr)
 	return server_ptr->parameters;
 }
 
+float jackctl_server_get_cpu_load (jackctl_server_t *server_ptr, float percentile)
+{
+	if (server_ptr->engine == NULL) {
+		return -1.0f;
+	}
+
+	if (percentile <= 0.0f) {
+		return server_ptr->engine->control->cpu_load;
+	}
+
+	return jack_load_percentile (server_ptr->engine->control, percentile);
+}
+
+/* A snapshot of the running server, taken from engine memory without
+   a client connection. These belong in <jack/control.h>. */
+typedef struct {
+	char name[JACK_CLIENT_NAME_SIZE];
+	uint32_t cycles;                /* in the timing window */
+	uint32_t wake_p99_usecs;
+	uint32_t wake_max_usecs;
+	uint32_t process_p99_usecs;
+	uint32_t process_max_usecs;
+	float load;                     /* mean share of the period, % */
+	float cpu_load;                 /* the same in cpu time, the rest
+					   it was kept off its cpu */
+	float preempted;                /* share of cycles it was switched
+					   out in, % */
+} jackctl_client_stats_t;
+
+typedef struct {
+	uint64_t cycles;
+	uint32_t xruns;
+	float cpu_load;                 /* smoothed */
+	float load_p50;
+	float load_p90;
+	float load_p99;
+	float load_max;
+	float xrun_delayed_usecs;       /* of the last xrun */
+	float max_delayed_usecs;
+	uint32_t driver_wait_usecs;     /* last cycle */
+	uint32_t driver_process_usecs;  /* last cycle, master read + write */
+	uint32_t xrun_recovery_usecs;   /* of the last xrun */
+	uint32_t nclients;              /* with a timing entry */
+} jackctl_server_stats_t;
+
+/* Fill in `stats', and the first `max_clients' entries of `clients'
+   (which may be NULL). Returns the number of clients, which may be
+   more than `max_clients', or -1 if the server is not running.
+
+   Nothing here takes a lock: the counters are single words written by
+   the engine thread and the histograms are seqlocked, so this is cheap
+   enough to poll at a high rate.
+ */
+int jackctl_server_get_stats (jackctl_server_t *server_ptr,
+			      jackctl_server_stats_t *stats,
+			      jackctl_client_stats_t *clients,
+			      unsigned int max_clients)
+{
+	jack_engine_t *engine = server_ptr->engine;
+	jack_control_t *control;
+	jack_timing_summary_t sum;
+	jackctl_client_stats_t *cs;
+	unsigned int n = 0;
+	int slot;
+
+	if (engine == NULL) {
+		return -1;
+	}
+
+	control = engine->control;
+
+	memset (stats, 0, sizeof(*stats));
+	stats->cycles = control->cycles;
+	stats->xruns = control->xruns;
+	stats->cpu_load = control->cpu_load;
+	stats->load_p50 = jack_load_percentile (control, 50.0f);
+	stats->load_p90 = jack_load_percentile (control, 90.0f);
+	stats->load_p99 = jack_load_percentile (control, 99.0f);
+	stats->load_max = jack_load_percentile (control, 100.0f);
+	stats->xrun_delayed_usecs = control->xrun_delayed_usecs;
+	stats->max_delayed_usecs = control->max_delayed_usecs;
+	stats->driver_wait_usecs = control->driver_wait_usecs;
+	stats->driver_process_usecs = control->driver_process_usecs;
+	stats->xrun_recovery_usecs = control->driver_recovery_usecs;
+
+	for (slot = 0; slot < JACK_TIMING_MAX; slot++) {
+		if (jack_timing_summarize (control, slot, 99.0f, &sum)) {
+			continue;
+		}
+		if (clients && n < max_clients) {
+			cs = &clients[n];
+			memcpy (cs->name, sum.name, sizeof(cs->name));
+			cs->cycles = sum.cycles;
+			cs->wake_p99_usecs = (uint32_t)sum.wake_usecs;
+			cs->wake_max_usecs = (uint32_t)sum.wake_max;
+			cs->process_p99_usecs = (uint32_t)sum.process_usecs;
+			cs->process_max_usecs = (uint32_t)sum.process_max;
+			cs->load = sum.load;
+			cs->cpu_load = sum.cpu_load;
+			cs->preempted = sum.preempted;
+		}
+		n++;
+	}
+
+	stats->nclients = n;
+
+	return n;
+}
+
+/* Copy the report on xrun number `xrun' (0 for the latest) into
+   `report', see jack_get_xrun_report(). Returns -1 if the server is
+   not running or the report is gone. Belongs in <jack/control.h>. */
+int jackctl_server_get_xrun_report (jackctl_server_t *server_ptr,
+				    uint32_t xrun, jack_xrun_report_t *report)
+{
+	jack_control_t *control;
+
+	if (server_ptr->engine == NULL) {
+		return -1;
+	}
+
+	control = server_ptr->engine->control;
+
+	if (xrun == 0) {
+		xrun = control->xruns;
+	}
+
+	return jack_xrun_report_read (control, xrun, report);
+}
+
 bool
 jackctl_server_start (
 	jackctl_server_t *server_ptr,
@@ -1154,7 +1679,34 @@ jackctl_server_start (
 						   server_ptr->do_mlock.b, server_ptr->do_unlock.b, server_ptr->name.str,
 						   server_ptr->temporary.b, server_ptr->verbose.b, server_ptr->client_timeout.i,
 						   server_ptr->port_max.i, getpid (), frame_time_offset,
-						   server_ptr->nozombies.b, server_ptr->timothres.ui, drivers)) == 0) {
+						   server_ptr->nozombies.b, server_ptr->timothres.ui,
+						   server_ptr->parallel.b,
+						   server_ptr->pipeline.ui,
+						   strcmp (server_ptr->activation.str, "futex") == 0 ?
+						   JackActivationFutex : JackActivationFIFO,
+						   server_ptr->trace.str[0] ? server_ptr->trace.str : NULL,
+						   server_ptr->freewheel_period.ui,
+						   server_ptr->freewheel_parallel.b,
+						   server_ptr->hugepages.b,
+						   server_ptr->load_window.ui,
+						   server_ptr->engine_cpus.str[0] ? server_ptr->engine_cpus.str : NULL,
+						   server_ptr->client_cpus.str[0] ? server_ptr->client_cpus.str : NULL,
+						   server_ptr->deadline.b,
+						   server_ptr->slave_threads.b,
+						   server_ptr->max_buffer_size.ui,
+						   server_ptr->pm_qos.b,
+						   server_ptr->dll_bandwidth.str[0] ?
+						   (float)atof (server_ptr->dll_bandwidth.str) : 0.0f,
+						   server_ptr->internal_threads.ui,
+						   server_ptr->freewheel_keep_driver.b,
+						   server_ptr->metadata_file.str[0] ?
+						   server_ptr->metadata_file.str : NULL,
+						   server_ptr->share_buffers.b,
+						   server_ptr->checkpoint_file.str[0] ?
+						   server_ptr->checkpoint_file.str : NULL,
+						   server_ptr->spin_wait.ui,
+						   server_ptr->cpu_times.b,
+						   drivers)) == 0) {
 		jack_error ("cannot create engine");
 		goto fail_unregister;
 	}
@@ -1440,47 +1992,13 @@ bool jackctl_server_remove_slave (jackctl_server_t * server_ptr, jackctl_driver_
 
 bool jackctl_server_switch_master (jackctl_server_t * server_ptr, jackctl_driver_t * driver_ptr)
 {
-	jack_driver_t *old_driver;
-
 	if (server_ptr->engine == NULL) {
-		goto fail_nostart;
-	}
-
-	old_driver = server_ptr->engine->driver;
-
-	if (old_driver) {
-		old_driver->stop (old_driver );
-		old_driver->detach (old_driver, server_ptr->engine);
-
-		pthread_mutex_lock (&server_ptr->engine->request_lock);
-		jack_lock_graph (server_ptr->engine);
-		jack_remove_client (server_ptr->engine, old_driver->internal_client);
-		jack_unlock_graph (server_ptr->engine);
-		pthread_mutex_unlock (&server_ptr->engine->request_lock);
-
-		server_ptr->engine->driver = NULL;
-
-		jack_driver_unload (old_driver);
-	}
-
-	if (jack_engine_load_driver (server_ptr->engine, driver_ptr->desc_ptr, driver_ptr->set_parameters)) {
-		jack_error ("cannot load driver module %s", driver_ptr->desc_ptr->name);
-		goto fail_nodriver;
-	}
-
-
-	if (server_ptr->engine->driver->start (server_ptr->engine->driver) != 0) {
-		jack_error ("cannot start driver");
-		jack_use_driver (server_ptr->engine, NULL);
-		goto fail_nodriver;
+		return false;
 	}
 
-	return true;
-
-fail_nodriver:
-	jack_error ("could not initialise new driver, leaving without driver");
-
-fail_nostart:
-	return false;
+	/* clients and their connections to the driver's ports are kept */
+	return jack_engine_switch_master (server_ptr->engine,
+					  driver_ptr->desc_ptr,
+					  driver_ptr->set_parameters) == 0;
 }
 
@@ -0,0 +1,373 @@
+/*
+    Driver descriptor cache -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+#include "drivercache.h"
+
+#define JACK_DRIVER_CACHE_MAGIC   0x4a445243      /* "JDRC" */
+#define JACK_DRIVER_CACHE_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t desc_size;             /* sizeof(jack_driver_desc_t) */
+	uint32_t param_size;            /* sizeof(jack_driver_param_desc_t) */
+	uint32_t nfiles;
+} jack_driver_cache_header_t;
+
+/* one per jack_*.so, followed by its descriptor and parameters if it
+   had a usable one */
+typedef struct {
+	char name[NAME_MAX + 1];
+	int64_t mtime;
+	int64_t size;
+	uint64_t ino;
+	uint32_t has_desc;
+} jack_driver_cache_file_t;
+
+int
+jack_driver_file_name (const char *name)
+{
+	const char *ptr;
+
+	if (strncmp ("jack_", name, 5) != 0) {
+		return FALSE;
+	}
+
+	if ((ptr = strrchr (name, '.')) == NULL) {
+		return FALSE;
+	}
+
+	return strncmp ("so", ptr + 1, 2) == 0;
+}
+
+/* an empty $JACK_DRIVER_CACHE turns the cache off */
+static int
+jack_driver_cache_path (const char *driver_dir, char *path, size_t len)
+{
+	const char *env;
+
+	if ((env = getenv ("JACK_DRIVER_CACHE")) != NULL) {
+		if (env[0] == '\0') {
+			return -1;
+		}
+		snprintf (path, len, "%s", env);
+	} else {
+		snprintf (path, len, "%s/%s", driver_dir, JACK_DRIVER_CACHE_NAME);
+	}
+
+	return 0;
+}
+
+static int
+jack_driver_cache_stat (const char *driver_dir, const char *name,
+			jack_driver_cache_file_t *file)
+{
+	char path[PATH_MAX + 1];
+	struct stat st;
+
+	snprintf (path, sizeof(path), "%s/%s", driver_dir, name);
+
+	if (stat (path, &st)) {
+		return -1;
+	}
+
+	memset (file, 0, sizeof(*file));
+	snprintf (file->name, sizeof(file->name), "%s", name);
+	file->mtime = (int64_t)st.st_mtime;
+	file->size = (int64_t)st.st_size;
+	file->ino = (uint64_t)st.st_ino;
+
+	return 0;
+}
+
+static void
+jack_driver_cache_free (JSList *descriptors)
+{
+	JSList *node;
+	jack_driver_desc_t *desc;
+
+	for (node = descriptors; node; node = jack_slist_next (node)) {
+		desc = (jack_driver_desc_t*)node->data;
+		free (desc->params);
+		free (desc);
+	}
+
+	jack_slist_free (descriptors);
+}
+
+/* The cache is only good while the directory holds exactly the driver
+   files it lists, unchanged. Checking that takes a readdir() and a
+   stat() per file, which is nothing next to opening them.
+ */
+static int
+jack_driver_cache_current (const char *driver_dir,
+			   jack_driver_cache_file_t *files, uint32_t nfiles)
+{
+	jack_driver_cache_file_t now;
+	struct dirent *dir_entry;
+	DIR *dir_stream;
+	uint32_t seen = 0, i;
+	int ok = TRUE;
+
+	if ((dir_stream = opendir (driver_dir)) == NULL) {
+		return FALSE;
+	}
+
+	while (ok && (dir_entry = readdir (dir_stream))) {
+		if (!jack_driver_file_name (dir_entry->d_name)) {
+			continue;
+		}
+
+		for (i = 0; i < nfiles; i++) {
+			if (strcmp (files[i].name, dir_entry->d_name) == 0) {
+				break;
+			}
+		}
+
+		if (i == nfiles ||
+		    jack_driver_cache_stat (driver_dir, dir_entry->d_name, &now) ||
+		    now.mtime != files[i].mtime ||
+		    now.size != files[i].size ||
+		    now.ino != files[i].ino) {
+			ok = FALSE;
+		}
+
+		seen++;
+	}
+
+	closedir (dir_stream);
+
+	return ok && seen == nfiles;
+}
+
+JSList *
+jack_driver_cache_load (const char *driver_dir)
+{
+	char path[PATH_MAX + 1];
+	jack_driver_cache_header_t hdr;
+	jack_driver_cache_file_t *files = NULL;
+	jack_driver_desc_t *desc;
+	JSList *descriptors = NULL;
+	FILE *f;
+	uint32_t i, p;
+
+	if (jack_driver_cache_path (driver_dir, path, sizeof(path)) ||
+	    (f = fopen (path, "rb")) == NULL) {
+		return NULL;
+	}
+
+	if (fread (&hdr, sizeof(hdr), 1, f) != 1 ||
+	    hdr.magic != JACK_DRIVER_CACHE_MAGIC ||
+	    hdr.version != JACK_DRIVER_CACHE_VERSION ||
+	    hdr.desc_size != sizeof(jack_driver_desc_t) ||
+	    hdr.param_size != sizeof(jack_driver_param_desc_t) ||
+	    hdr.nfiles == 0 || hdr.nfiles > 4096) {
+		goto stale;
+	}
+
+	if ((files = (jack_driver_cache_file_t*)
+		     calloc (hdr.nfiles, sizeof(jack_driver_cache_file_t))) == NULL) {
+		goto stale;
+	}
+
+	for (i = 0; i < hdr.nfiles; i++) {
+
+		if (fread (&files[i], sizeof(files[i]), 1, f) != 1) {
+			goto stale;
+		}
+		files[i].name[NAME_MAX] = '\0';
+
+		if (!files[i].has_desc) {
+			continue;
+		}
+
+		if ((desc = (jack_driver_desc_t*)
+			    malloc (sizeof(jack_driver_desc_t))) == NULL) {
+			goto stale;
+		}
+
+		if (fread (desc, sizeof(*desc), 1, f) != 1 ||
+		    desc->nparams > 256) {
+			free (desc);
+			goto stale;
+		}
+		desc->name[JACK_DRIVER_NAME_MAX] = '\0';
+		snprintf (desc->file, sizeof(desc->file), "%s/%s",
+			  driver_dir, files[i].name);
+
+		desc->params = (jack_driver_param_desc_t*)
+			       calloc (desc->nparams ? desc->nparams : 1,
+				       sizeof(jack_driver_param_desc_t));
+		if (desc->params == NULL ||
+		    fread (desc->params, sizeof(jack_driver_param_desc_t),
+			   desc->nparams, f) != desc->nparams) {
+			free (desc->params);
+			free (desc);
+			goto stale;
+		}
+
+		/* only descriptors without constraints get cached */
+		for (p = 0; p < desc->nparams; p++) {
+			desc->params[p].constraint = NULL;
+		}
+
+		descriptors = jack_slist_append (descriptors, desc);
+	}
+
+	fclose (f);
+
+	if (!descriptors ||
+	    !jack_driver_cache_current (driver_dir, files, hdr.nfiles)) {
+		free (files);
+		jack_driver_cache_free (descriptors);
+		return NULL;
+	}
+
+	free (files);
+
+	return descriptors;
+
+stale:
+	fclose (f);
+	free (files);
+	jack_driver_cache_free (descriptors);
+
+	return NULL;
+}
+
+static const jack_driver_desc_t *
+jack_driver_cache_find (JSList *descriptors, const char *name)
+{
+	JSList *node;
+	const jack_driver_desc_t *desc;
+	const char *base;
+
+	for (node = descriptors; node; node = jack_slist_next (node)) {
+		desc = (const jack_driver_desc_t*)node->data;
+		base = strrchr (desc->file, '/');
+		base = base ? base + 1 : desc->file;
+		if (strcmp (base, name) == 0) {
+			return desc;
+		}
+	}
+
+	return NULL;
+}
+
+int
+jack_driver_cache_save (const char *driver_dir, JSList *descriptors)
+{
+	char path[PATH_MAX + 1];
+	char tmp[PATH_MAX + 16];
+	jack_driver_cache_header_t hdr;
+	jack_driver_cache_file_t file;
+	const jack_driver_desc_t *desc;
+	struct dirent *dir_entry;
+	DIR *dir_stream;
+	JSList *node;
+	FILE *f;
+	uint32_t p;
+	int fd, ok = TRUE;
+
+	/* constraints point to more memory than the cache has room for;
+	   a driver with them means scanning every time */
+	for (node = descriptors; node; node = jack_slist_next (node)) {
+		desc = (const jack_driver_desc_t*)node->data;
+		for (p = 0; p < desc->nparams; p++) {
+			if (desc->params[p].constraint) {
+				return -1;
+			}
+		}
+	}
+
+	if (jack_driver_cache_path (driver_dir, path, sizeof(path))) {
+		return -1;
+	}
+	snprintf (tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+	if ((fd = mkstemp (tmp)) < 0) {
+		/* not our directory: fine, just slower next time */
+		return -1;
+	}
+
+	if ((f = fdopen (fd, "wb")) == NULL ||
+	    (dir_stream = opendir (driver_dir)) == NULL) {
+		if (f) {
+			fclose (f);
+		} else {
+			close (fd);
+		}
+		unlink (tmp);
+		return -1;
+	}
+
+	memset (&hdr, 0, sizeof(hdr));
+	hdr.magic = JACK_DRIVER_CACHE_MAGIC;
+	hdr.version = JACK_DRIVER_CACHE_VERSION;
+	hdr.desc_size = sizeof(jack_driver_desc_t);
+	hdr.param_size = sizeof(jack_driver_param_desc_t);
+
+	/* the count goes in once it is known */
+	ok = fwrite (&hdr, sizeof(hdr), 1, f) == 1;
+
+	while (ok && (dir_entry = readdir (dir_stream))) {
+		if (!jack_driver_file_name (dir_entry->d_name) ||
+		    jack_driver_cache_stat (driver_dir, dir_entry->d_name, &file)) {
+			continue;
+		}
+
+		desc = jack_driver_cache_find (descriptors, dir_entry->d_name);
+		file.has_desc = desc != NULL;
+
+		ok = fwrite (&file, sizeof(file), 1, f) == 1;
+		if (ok && desc) {
+			ok = fwrite (desc, sizeof(*desc), 1, f) == 1 &&
+			     fwrite (desc->params, sizeof(jack_driver_param_desc_t),
+				     desc->nparams, f) == desc->nparams;
+		}
+		hdr.nfiles++;
+	}
+
+	closedir (dir_stream);
+
+	if (ok) {
+		ok = fseek (f, 0, SEEK_SET) == 0 &&
+		     fwrite (&hdr, sizeof(hdr), 1, f) == 1;
+	}
+
+	if (fclose (f) || !ok || rename (tmp, path)) {
+		unlink (tmp);
+		return -1;
+	}
+
+	chmod (path, 0644);
+
+	return 0;
+}
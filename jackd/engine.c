@@ -50,11 +50,15 @@
 #include "shm.h"
 
 #include <sysdeps/poll.h>
+#ifdef HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
 #include <sysdeps/ipc.h>
 
-#ifdef USE_MLOCK
 #include <sys/mman.h>
-#endif /* USE_MLOCK */
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #ifdef USE_CAPABILITIES
 /* capgetp and capsetp are linux only extensions, not posix */
@@ -64,18 +68,10 @@
 
 #include "clientengine.h"
 #include "transengine.h"
+#include "probes.h"
 
 #include "libjack/local.h"
 
-typedef struct {
-
-	jack_port_internal_t *source;
-	jack_port_internal_t *destination;
-	signed int dir; /* -1 = feedback, 0 = self, 1 = forward */
-	jack_client_internal_t *srcclient;
-	jack_client_internal_t *dstclient;
-} jack_connection_internal_t;
-
 typedef struct _jack_driver_info {
 	jack_driver_t *(*initialize)(jack_client_t *, const JSList *);
 	void (*finish);
@@ -86,9 +82,13 @@ typedef struct _jack_driver_info {
 jack_timer_type_t clock_source = JACK_TIMER_SYSTEM_CLOCK;
 
 static int      jack_port_assign_buffer(jack_engine_t *,
+					jack_client_internal_t *,
 					jack_port_internal_t *);
 static jack_port_internal_t *jack_get_port_by_name(jack_engine_t *,
 						   const char *name);
+static void jack_port_hash_insert(jack_engine_t *engine, jack_port_id_t id);
+static void jack_port_hash_remove(jack_engine_t *engine, jack_port_id_t id,
+				  const char *name);
 static int  jack_rechain_graph(jack_engine_t *engine);
 static void jack_clear_fifos(jack_engine_t *engine);
 static int  jack_port_do_connect(jack_engine_t *engine,
@@ -103,9 +103,16 @@ static int  jack_port_do_unregister(jack_engine_t *engine, jack_request_t *);
 static int  jack_port_do_register(jack_engine_t *engine, jack_request_t *, int);
 static int  jack_do_get_port_connections(jack_engine_t *engine,
 					 jack_request_t *req, int reply_fd);
+static int  jack_port_connect_internal(jack_engine_t *engine,
+				       const char *source_port,
+				       const char *destination_port,
+				       int sort_graph);
+static int  jack_port_do_connect_batch(jack_engine_t *engine,
+				       jack_request_t *req, int connect);
 static int  jack_port_disconnect_internal(jack_engine_t *engine,
 					  jack_port_internal_t *src,
-					  jack_port_internal_t *dst);
+					  jack_port_internal_t *dst,
+					  int sort_graph);
 static int  jack_send_connection_notification(jack_engine_t *,
 					      jack_uuid_t,
 					      jack_port_id_t,
@@ -119,6 +126,9 @@ static void jack_notify_all_port_interested_clients(jack_engine_t *engine,
 						    jack_port_id_t b,
 						    int connect);
 static void jack_engine_post_process(jack_engine_t *);
+static void jack_engine_record_timing(jack_engine_t *engine);
+static void jack_drivers_record_timing(jack_engine_t *engine);
+static void jack_engine_trace_clients(jack_engine_t *engine);
 static int  jack_run_cycle(jack_engine_t *engine, jack_nframes_t nframes,
 			   float delayed_usecs);
 static int   jack_run_one_cycle(jack_engine_t *engine, jack_nframes_t nframes,
@@ -127,11 +137,12 @@ static void jack_engine_delay(jack_engine_t *engine,
 			      float delayed_usecs);
 static void jack_engine_driver_exit(jack_engine_t* engine);
 static int  jack_start_freewheeling(jack_engine_t* engine, jack_uuid_t);
-static int jack_client_feeds_transitive(jack_client_internal_t *source,
-					jack_client_internal_t *dest);
-static int jack_client_sort(jack_client_internal_t *a,
-			    jack_client_internal_t *b);
-static void jack_check_acyclic(jack_engine_t* engine);
+static int jack_client_order_connection(jack_engine_t *engine,
+					jack_client_internal_t *src,
+					jack_client_internal_t *dst);
+static void jack_sort_clients(jack_engine_t *engine);
+static void jack_update_graph(jack_engine_t *engine);
+static int jack_check_acyclic(jack_engine_t* engine);
 static void jack_compute_all_port_total_latencies(jack_engine_t *engine);
 static void jack_compute_port_total_latency(jack_engine_t *engine, jack_port_shared_t*);
 static int jack_check_client_status(jack_engine_t* engine);
@@ -142,7 +153,27 @@ static void jack_do_get_uuid_by_client_name(jack_engine_t *engine, jack_request_
 static void jack_do_reserve_name(jack_engine_t *engine, jack_request_t *req);
 static void jack_do_session_reply(jack_engine_t *engine, jack_request_t *req );
 static void jack_compute_new_latency(jack_engine_t *engine);
+static void jack_latency_mark_all(jack_engine_t *engine);
+static void jack_graph_change_note(jack_engine_t *engine, jack_port_id_t src, jack_port_id_t dst, int connected);
+static void jack_graph_epoch_flush(jack_engine_t *engine);
+static int  jack_graph_epoch_timeout(jack_engine_t *engine);
+static int  jack_server_timeout(jack_engine_t *engine);
+static void jack_session_expire(jack_engine_t *engine);
+static void jack_post_event(jack_engine_t *engine, jack_client_internal_t *client,
+			    const jack_event_t *event, const char *key, size_t keylen);
+static void jack_wake_server_thread(jack_engine_t* engine);
+static void jack_port_publish_connections(jack_port_internal_t *port);
+static int  jack_port_do_register_many(jack_engine_t *engine, jack_request_t *req, int internal);
+static int  jack_port_do_unregister_many(jack_engine_t *engine, jack_request_t *req);
+static int  jack_port_do_set_connection_gain(jack_engine_t *engine, jack_request_t *req);
+static void jack_ports_registration_notify(jack_engine_t *engine, const jack_port_id_t *ids, uint32_t n, int yn);
+static void jack_freewheel_set_buffer_size(jack_engine_t *engine,
+					   jack_nframes_t nframes);
+static void jack_freewheel_wait_driver(jack_engine_t *engine);
 static int jack_do_has_session_cb(jack_engine_t *engine, jack_request_t *req);
+static int jack_do_set_property(jack_engine_t *engine, jack_request_t *req);
+static int jack_do_remove_properties(jack_engine_t *engine, jack_request_t *req);
+static int jack_do_set_worker_pool(jack_engine_t *engine, jack_request_t *req);
 
 static inline int
 jack_rolling_interval (jack_time_t period_usecs)
@@ -184,6 +215,69 @@ jack_port_buffer_list (jack_engine_t *engine, jack_port_internal_t *port)
 	return &engine->port_buffers[port->shared->ptype_id];
 }
 
+static inline jack_port_shared_t *
+jack_engine_port (jack_engine_t *engine, jack_port_id_t id)
+{
+	/* all segments of the port table are attached in the server,
+	   so this never fails for id < engine->port_max.
+	 */
+	return &engine->port_table.segment[id / engine->control->port_segment_size]
+	       [id % engine->control->port_segment_size];
+}
+
+static inline jack_port_names_t *
+jack_engine_port_names (jack_engine_t *engine, jack_port_id_t id)
+{
+	return &engine->port_table.names[id / engine->control->port_segment_size]
+	       [id % engine->control->port_segment_size];
+}
+
+/* Create the names segment of port table segment `seg'. A new segment
+ * is all zeroes, so every name and alias starts out empty. It is not
+ * kept locked even under mlockall(), as nothing in a cycle reads it.
+ */
+static int
+jack_port_names_alloc (jack_engine_t *engine, uint32_t seg)
+{
+	jack_shm_info_t *shm_info = &engine->port_table.names_info[seg];
+
+	if (jack_shmalloc (sizeof(jack_port_names_t)
+			   * engine->control->port_segment_size, shm_info)) {
+		jack_error ("cannot create port names segment (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	if (jack_attach_shm (shm_info)) {
+		jack_error ("cannot attach to port names segment (%s)",
+			    strerror (errno));
+		jack_destroy_shm (shm_info);
+		return -1;
+	}
+
+	jack_unlock_shm (shm_info);
+
+	engine->port_table.names[seg] = (jack_port_names_t*)
+					jack_shm_addr (shm_info);
+	engine->control->port_names_index[seg] = shm_info->index;
+
+	return 0;
+}
+
+static void
+jack_port_names_free (jack_engine_t *engine, uint32_t seg)
+{
+	jack_release_shm (&engine->port_table.names_info[seg]);
+	jack_destroy_shm (&engine->port_table.names_info[seg]);
+}
+
+static inline unsigned int
+jack_port_table_max (jack_engine_t *engine)
+{
+	/* the most ports the port table can grow to */
+	return engine->control->port_segment_size * JACK_PORT_SEGMENTS_MAX;
+}
+
 static int
 make_directory (const char *path)
 {
@@ -352,6 +446,59 @@ make_sockets (const char *server_name, int fd[2])
 	return 0;
 }
 
+/* Give the buffer of an output port the size it asked for when it was
+ * registered (MIDI only), or all of it. A small buffer leaves the rest
+ * of its slot alone, so a port that is mostly idle only ever touches
+ * the first few cache lines of it.
+ */
+static void
+jack_port_buffer_init_hinted (jack_engine_t *engine, jack_port_shared_t *port,
+			      jack_port_buffer_info_t *bi, jack_nframes_t nframes)
+{
+	jack_port_type_id_t ptid = port->ptype_id;
+	jack_port_type_info_t *port_type = &engine->control->port_types[ptid];
+	char *shm_segment = (char*)jack_shm_addr (&engine->port_segment[ptid]);
+	jack_shmsize_t one_buffer;
+
+	one_buffer = jack_port_type_buffer_size (port_type,
+						 engine->port_buffer_frames);
+
+	if (port->buffer_bytes && port->buffer_bytes < one_buffer) {
+		one_buffer = port->buffer_bytes;
+	}
+
+	jack_get_port_functions (ptid)->buffer_init (shm_segment + bi->offset,
+						     one_buffer, nframes);
+}
+
+/* Start the buffers of the outputs of `ptid' over, where that matters:
+ * MIDI buffers begin with a header that says how big they are and how
+ * many events they hold, and its readers rely on it, but doing that is
+ * only a few stores per port. Audio buffers are not touched, as an
+ * output whose owner has not got its buffer since it was assigned is
+ * silent (see jack_client_mark_unwritten()).
+ */
+static void
+jack_port_buffers_init_headers (jack_engine_t *engine, jack_port_type_id_t ptid,
+				jack_nframes_t nframes)
+{
+	jack_port_shared_t *port;
+	jack_port_buffer_info_t *bi;
+	unsigned int i;
+
+	if (ptid != JACK_MIDI_PORT_TYPE) {
+		return;
+	}
+
+	for (i = 0; i < engine->port_max; i++) {
+		port = jack_engine_port (engine, i);
+		if (port->in_use && port->ptype_id == ptid &&
+		    (bi = engine->internal_ports[i].buffer_info) != NULL) {
+			jack_port_buffer_init_hinted (engine, port, bi, nframes);
+		}
+	}
+}
+
 void
 jack_engine_place_port_buffers (jack_engine_t* engine,
 				jack_port_type_id_t ptid,
@@ -373,7 +520,8 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		/* Buffer info array already allocated for this port
 		 * type.  This must be a resize operation, so
 		 * recompute the buffer offsets, but leave the free
-		 * list alone.
+		 * list alone, except for adding the buffers of ports
+		 * that the port table has grown by.
 		 */
 		int i;
 
@@ -384,16 +532,28 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 			++bi;
 		}
 
+		for (; pti->nbuffers < nports; pti->nbuffers++) {
+			pti->freelist = jack_slist_append (pti->freelist,
+							   &pti->info[pti->nbuffers]);
+		}
+
 		/* update any existing output port offsets */
 		for (i = 0; i < engine->port_max; i++) {
-			jack_port_shared_t *port = &engine->control->ports[i];
+			jack_port_shared_t *port = jack_engine_port (engine, i);
 			if (port->in_use &&
 			    (port->flags & JackPortIsOutput) &&
 			    port->ptype_id == ptid) {
-				bi = engine->internal_ports[i].buffer_info;
+				bi = engine->internal_ports[i].share_info;
+				if (bi == NULL) {
+					bi = engine->internal_ports[i].buffer_info;
+				}
 				if (bi) {
 					port->offset = bi->offset;
 				}
+				bi = engine->internal_ports[i].delay_info;
+				if (bi) {
+					port->delay_offset = bi->offset;
+				}
 			}
 		}
 
@@ -401,12 +561,14 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
 
 		/* Allocate an array of buffer info structures for all
-		 * the buffers in the segment.  Chain them to the free
-		 * list in memory address order, offset zero must come
-		 * first.
+		 * the buffers the segment can ever hold, as ports keep
+		 * pointers into it.  Chain the ones in the segment to
+		 * the free list in memory address order, offset zero
+		 * must come first.
 		 */
 		bi = pti->info = (jack_port_buffer_info_t*)
-				 malloc (nports * sizeof(jack_port_buffer_info_t));
+				 malloc (jack_port_table_max (engine)
+					 * sizeof(jack_port_buffer_info_t));
 
 		while (offset < size) {
 			bi->offset = offset;
@@ -414,6 +576,7 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 			offset += one_buffer;
 			++bi;
 		}
+		pti->nbuffers = nports;
 
 		/* Allocate the first buffer of the port segment
 		 * for an empy buffer area.
@@ -427,20 +590,63 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 			engine->silent_buffer = bi;
 		}
 	}
-	/* initialize buffers */
+	/* initialize the zero buffer, and what the output buffers
+	   need of it; a buffer that is not in use gets the rest when
+	   it is assigned */
 	{
-		int i;
 		jack_shm_info_t *shm_info = &engine->port_segment[ptid];
 		char* shm_segment = (char*)jack_shm_addr (shm_info);
 
-		bi = pti->info;
-		for (i = 0; i < nports; ++i, ++bi)
-			pfuncs->buffer_init (shm_segment + bi->offset, one_buffer, nframes);
+		pfuncs->buffer_init (shm_segment +
+				     engine->control->port_types[ptid].zero_buffer_offset,
+				     one_buffer, nframes);
+		jack_port_buffers_init_headers (engine, ptid, nframes);
 	}
 
 	pthread_mutex_unlock (&pti->lock);
 }
 
+/* With --hugepages, port buffer segments are a whole number of huge
+ * pages, and the kernel is asked to back them with transparent huge
+ * pages. That works the same for POSIX and System V shm, which are
+ * both shmem underneath.
+ */
+#define JACK_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static void
+jack_port_segment_advise (jack_engine_t *engine, jack_shm_info_t *shm_info,
+			  jack_shmsize_t size)
+{
+#ifdef MADV_HUGEPAGE
+	if (engine->hugepages &&
+	    madvise (jack_shm_addr (shm_info), size, MADV_HUGEPAGE)) {
+		jack_error ("cannot use huge pages for port buffers (%s)",
+			    strerror (errno));
+	}
+#endif
+}
+
+/* Multichannel buffers are JACK_MULTICHANNEL_MAX_CHANNELS times the
+ * size of audio ones, and double ones twice, while few setups use
+ * either; so their segments are left alone until a port of the type is
+ * registered.
+ */
+static int
+jack_port_type_on_demand (jack_port_type_id_t ptid)
+{
+	return ptid == JACK_MULTICHANNEL_PORT_TYPE ||
+	       ptid == JACK_DOUBLE_PORT_TYPE;
+}
+
+/* How far apart the buffers of a port type are in its segment. */
+static jack_shmsize_t
+jack_port_slot_size (jack_port_type_info_t *port_type, jack_nframes_t nframes)
+{
+	jack_shmsize_t size = jack_port_type_buffer_size (port_type, nframes);
+
+	return (size + JACK_PORT_BUFFER_ALIGN - 1)
+	       & ~(jack_shmsize_t)(JACK_PORT_BUFFER_ALIGN - 1);
+}
 
 static int
 jack_resize_port_segment (jack_engine_t *engine,
@@ -449,21 +655,28 @@ jack_resize_port_segment (jack_engine_t *engine,
 {
 	jack_event_t event;
 	jack_shmsize_t one_buffer;      /* size of one buffer */
-	jack_shmsize_t size;            /* segment size */
+	jack_shmsize_t size;            /* size of the buffers */
+	jack_shmsize_t shm_size;        /* segment size */
 	jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
 	jack_shm_info_t* shm_info = &engine->port_segment[ptid];
 
-	one_buffer = jack_port_type_buffer_size (port_type, engine->control->buffer_size);
+	one_buffer = jack_port_slot_size (port_type, engine->port_buffer_frames);
 	VERBOSE (engine, "resizing port buffer segment for type %d, one buffer = %u bytes", ptid, one_buffer);
 
 	size = nports * one_buffer;
+	shm_size = size;
+
+	if (engine->hugepages) {
+		shm_size = (size + JACK_HUGE_PAGE_SIZE - 1)
+			   & ~(JACK_HUGE_PAGE_SIZE - 1);
+	}
 
 	if (shm_info->attached_at == 0) {
 
-		if (jack_shmalloc (size, shm_info)) {
+		if (jack_shmalloc (shm_size, shm_info)) {
 			jack_error ("cannot create new port segment of %d"
 				    " bytes (%s)",
-				    size,
+				    shm_size,
 				    strerror (errno));
 			return -1;
 		}
@@ -480,14 +693,16 @@ jack_resize_port_segment (jack_engine_t *engine,
 	} else {
 
 		/* resize existing buffer segment */
-		if (jack_resize_shm (shm_info, size)) {
+		if (jack_resize_shm (shm_info, shm_size)) {
 			jack_error ("cannot resize port segment to %d bytes,"
-				    " (%s)", size,
+				    " (%s)", shm_size,
 				    strerror (errno));
 			return -1;
 		}
 	}
 
+	jack_port_segment_advise (engine, shm_info, shm_size);
+
 	jack_engine_place_port_buffers (engine, ptid, one_buffer, size, nports, engine->control->buffer_size);
 
 #ifdef USE_MLOCK
@@ -502,7 +717,7 @@ jack_resize_port_segment (jack_engine_t *engine,
 		 * munlockall().
 		 */
 
-		int rc = mlock (jack_shm_addr (shm_info), size);
+		int rc = mlock (jack_shm_addr (shm_info), shm_size);
 		if (rc < 0) {
 			jack_error ("JACK: unable to mlock() port buffers: "
 				    "%s", strerror (errno));
@@ -520,29 +735,146 @@ jack_resize_port_segment (jack_engine_t *engine,
 	return 0;
 }
 
+/* Start the buffers of a port type over for the current buffer size,
+ * in place: the zero buffer, and the headers of the ones in use. This
+ * is the whole of a buffer size change when the segment is already
+ * laid out for port_buffer_frames.
+ */
+static void
+jack_reinit_port_buffers (jack_engine_t *engine, jack_port_type_id_t ptid)
+{
+	jack_port_buffer_list_t* pti = &engine->port_buffers[ptid];
+	jack_port_functions_t *pfuncs = jack_get_port_functions (ptid);
+	jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
+	char* shm_segment = (char*)jack_shm_addr (&engine->port_segment[ptid]);
+	jack_shmsize_t one_buffer;
+
+	one_buffer = jack_port_slot_size (port_type, engine->port_buffer_frames);
+
+	pthread_mutex_lock (&pti->lock);
+	pfuncs->buffer_init (shm_segment + port_type->zero_buffer_offset,
+			     one_buffer, engine->control->buffer_size);
+	jack_port_buffers_init_headers (engine, ptid,
+					engine->control->buffer_size);
+	pthread_mutex_unlock (&pti->lock);
+}
+
 /* The driver invokes this callback both initially and whenever its
  * buffer size changes.
+ *
+ * Port buffers are laid out for the larger of the buffer size and
+ * --max-buffer-size. As long as that stays the same, a change only
+ * reinitializes the buffers in place: port offsets do not move and
+ * clients keep their mappings, so there is no AttachPortSegment round.
+ */
+/* PM QoS. With --pm-qos the engine holds a cpu latency request for as
+ * long as the driver runs realtime: while /dev/cpu_dma_latency is open,
+ * no cpu enters an idle state that takes longer to leave than the
+ * latency written to it. The target is a twentieth of the period, which
+ * rules out the deep C-states whose exit latency can eat a good part
+ * of a short cycle but leaves the shallow ones. Stopping the driver,
+ * which freewheeling does, drops the request.
  */
+#define JACK_PM_QOS_DEVICE "/dev/cpu_dma_latency"
+
+static void
+jack_pm_qos_update (jack_engine_t *engine)
+{
+	int32_t usecs;
+
+	if (!engine->pm_qos || !engine->control->real_time ||
+	    engine->driver == NULL || engine->driver->period_usecs == 0) {
+		return;
+	}
+
+	usecs = (int32_t)(engine->driver->period_usecs / 20);
+
+	if (engine->pm_qos_fd < 0) {
+		if ((engine->pm_qos_fd = open (JACK_PM_QOS_DEVICE,
+					       O_WRONLY | O_CLOEXEC)) < 0) {
+			jack_error ("cannot open %s (%s); cpus may enter "
+				    "deep idle states", JACK_PM_QOS_DEVICE,
+				    strerror (errno));
+			/* not going to work any better next time */
+			engine->pm_qos = 0;
+			return;
+		}
+	} else if (usecs == engine->pm_qos_usecs) {
+		return;
+	}
+
+	if (write (engine->pm_qos_fd, &usecs, sizeof(usecs)) != sizeof(usecs)) {
+		jack_error ("cannot set the cpu latency request (%s)",
+			    strerror (errno));
+		close (engine->pm_qos_fd);
+		engine->pm_qos_fd = -1;
+		engine->pm_qos = 0;
+		return;
+	}
+
+	engine->pm_qos_usecs = usecs;
+	VERBOSE (engine, "holding cpu wakeup latency to %" PRId32 " usecs",
+		 usecs);
+}
+
+static void
+jack_pm_qos_release (jack_engine_t *engine)
+{
+	if (engine->pm_qos_fd >= 0) {
+		close (engine->pm_qos_fd);
+		engine->pm_qos_fd = -1;
+		engine->pm_qos_usecs = 0;
+		VERBOSE (engine, "cpu latency request released");
+	}
+}
+
 static int
 jack_driver_buffer_size (jack_engine_t *engine, jack_nframes_t nframes)
 {
 	int i;
 	jack_event_t event;
+	jack_nframes_t frames;
 
 	VERBOSE (engine, "new buffer size %" PRIu32, nframes);
 
 	engine->control->buffer_size = nframes;
+	jack_checkpoint_dirty (engine->checkpoint);
 	if (engine->driver) {
 		engine->rolling_interval =
 			jack_rolling_interval (engine->driver->period_usecs);
 	}
 
-	for (i = 0; i < engine->control->n_port_types; ++i) {
-		if (jack_resize_port_segment (engine, i, engine->control->port_max)) {
-			return -1;
+	frames = nframes > engine->max_buffer_size ?
+		 nframes : engine->max_buffer_size;
+
+	if (frames == engine->port_buffer_frames) {
+		for (i = 0; i < engine->control->n_port_types; ++i) {
+			if (engine->port_segment[i].attached_at) {
+				jack_reinit_port_buffers (engine, i);
+			} else if (!jack_port_type_on_demand (i) &&
+				   jack_resize_port_segment (engine, i,
+							     engine->control->port_max)) {
+				return -1;
+			}
+		}
+	} else {
+		engine->port_buffer_frames = frames;
+		for (i = 0; i < engine->control->n_port_types; ++i) {
+			if (jack_port_type_on_demand (i) &&
+			    !engine->port_segment[i].attached_at) {
+				continue;
+			}
+			if (jack_resize_port_segment (engine, i, engine->control->port_max)) {
+				return -1;
+			}
 		}
 	}
 
+	/* the period changed, so does the latency we can live with */
+	if (engine->pm_qos_fd >= 0) {
+		jack_pm_qos_update (engine);
+	}
+
 	event.type = BufferSizeChange;
 	event.x.n = engine->control->buffer_size;
 	jack_deliver_event_to_all (engine, &event);
@@ -578,21 +910,27 @@ jack_set_buffer_size_request (jack_engine_t *engine, jack_nframes_t nframes)
 }
 
 
-static JSList *
-jack_process_internal (jack_engine_t *engine, JSList *node,
-		       jack_nframes_t nframes)
+static void
+jack_run_internal_client (jack_engine_t *engine,
+			  jack_client_internal_t *client,
+			  jack_nframes_t nframes)
 {
-	jack_client_internal_t *client;
-	jack_client_control_t *ctl;
-
-	client = (jack_client_internal_t*)node->data;
-	ctl = client->control;
+	jack_client_control_t *ctl = client->control;
+	uint64_t cpu_start = 0, cpu_end;
+	uint32_t preempt_start = 0, preempt_end;
 
 	/* internal client */
 
 	DEBUG ("invoking an internal client's (%s) callbacks", ctl->name);
+	JACK_PROBE1 (internal_start, ctl->name);
 	ctl->state = Running;
-	engine->current_client = client;
+	ctl->awake_at = jack_get_microseconds ();
+	if (engine->control->cpu_times) {
+		jack_thread_usage (&cpu_start, &preempt_start);
+	}
+	if (!ctl->signalled_at) {
+		ctl->signalled_at = ctl->awake_at;
+	}
 
 	/* XXX how to time out an internal client? */
 
@@ -603,7 +941,8 @@ jack_process_internal (jack_engine_t *engine, JSList *node,
 	if (ctl->process_cbset) {
 		if (client->private_client->process (nframes, client->private_client->process_arg)) {
 			jack_error ("internal client %s failed", ctl->name);
-			engine->process_errors++;
+			/* may be running on a worker, see jack_worker_start() */
+			__atomic_add_fetch (&engine->process_errors, 1, __ATOMIC_RELAXED);
 		}
 	}
 
@@ -611,13 +950,27 @@ jack_process_internal (jack_engine_t *engine, JSList *node,
 		jack_call_timebase_master (client->private_client);
 	}
 
-	ctl->state = Finished;
+	jack_client_mark_unwritten (client->private_client);
+	jack_client_update_meters (client->private_client, nframes);
 
-	if (engine->process_errors) {
-		return NULL;            /* will stop the loop */
-	} else {
-		return jack_slist_next (node);
+	if (engine->control->cpu_times) {
+		jack_thread_usage (&cpu_end, &preempt_end);
+		ctl->process_cpu_usecs = (uint32_t)((cpu_end - cpu_start) / 1000);
+		ctl->process_preemptions = preempt_end - preempt_start;
 	}
+	ctl->finished_at = jack_get_microseconds ();
+	__atomic_store_n (&ctl->state, Finished, __ATOMIC_RELEASE);
+	JACK_PROBE1 (internal_end, ctl->name);
+}
+
+static int
+jack_process_internal (jack_engine_t *engine, jack_exec_step_t *step,
+		       jack_nframes_t nframes)
+{
+	engine->current_client = step->client;
+	jack_run_internal_client (engine, step->client, nframes);
+
+	return engine->process_errors ? -1 : 0;
 }
 
 #ifdef __linux
@@ -657,31 +1010,29 @@ linux_poll_bug_encountered (jack_engine_t* engine, jack_time_t then, jack_time_t
 #endif
 
 #ifdef JACK_USE_MACH_THREADS
-static JSList *
-jack_process_external (jack_engine_t *engine, JSList *node)
+static int
+jack_process_external (jack_engine_t *engine, jack_exec_step_t *step)
 {
-	jack_client_internal_t * client = (jack_client_internal_t*)node->data;
-	jack_client_control_t *ctl;
-
-	client = (jack_client_internal_t*)node->data;
-	ctl = client->control;
+	jack_client_internal_t *client = step->client;
+	jack_client_control_t *ctl = step->control;
 
 	engine->current_client = client;
 
 	// a race exists if we do this after the write(2)
 	ctl->state = Triggered;
 	ctl->signalled_at = jack_get_microseconds ();
+	JACK_PROBE2 (client_trigger, ctl->name, engine->control->cycle_serial);
 
 	if (jack_client_resume (client) < 0) {
 		jack_error ("Client will be removed\n");
 		ctl->state = Finished;
 	}
 
-	return jack_slist_next (node);
+	return 0;
 }
 #else /* !JACK_USE_MACH_THREADS */
-static JSList *
-jack_process_external (jack_engine_t *engine, JSList *node)
+static int
+jack_process_external (jack_engine_t *engine, jack_exec_step_t *step)
 {
 	int status = 0;
 	char c = 0;
@@ -690,12 +1041,16 @@ jack_process_external (jack_engine_t *engine, JSList *node)
 	jack_time_t poll_timeout_usecs;
 	jack_client_internal_t *client;
 	jack_client_control_t *ctl;
+	jack_activation_t *start_act, *wait_act;
 	jack_time_t now, then;
 	int pollret;
 
-	client = (jack_client_internal_t*)node->data;
+	client = step->client;
 
-	ctl = client->control;
+	ctl = step->control;
+
+	start_act = step->start_act;
+	wait_act = jack_activation_slot (engine->control, JACK_ACTIVATION_ENGINE);
 
 	/* external subgraph */
 
@@ -706,15 +1061,19 @@ jack_process_external (jack_engine_t *engine, JSList *node)
 
 	engine->current_client = client;
 
+	JACK_PROBE2 (client_trigger, ctl->name, engine->control->cycle_serial);
+
 	DEBUG ("calling process() on an external subgraph, fd==%d",
 	       client->subgraph_start_fd);
 
-	if (write (client->subgraph_start_fd, &c, sizeof(c)) != sizeof(c)) {
+	if (start_act) {
+		jack_activation_signal (start_act);
+	} else if (write (client->subgraph_start_fd, &c, sizeof(c)) != sizeof(c)) {
 		jack_error ("cannot initiate graph processing (%s)",
 			    strerror (errno));
 		engine->process_errors++;
 		jack_engine_signal_problems (engine);
-		return NULL; /* will stop the loop */
+		return -1; /* will stop the loop */
 	}
 
 	then = jack_get_microseconds ();
@@ -735,7 +1094,22 @@ again:
 	DEBUG ("waiting on fd==%d for process() subgraph to finish (timeout = %d, period_usecs = %d)",
 	       client->subgraph_wait_fd, poll_timeout, engine->driver->period_usecs);
 
-	if ((pollret = poll (pfd, 1, poll_timeout)) < 0) {
+	if (wait_act) {
+		int32_t bits = jack_activation_spin_wait (wait_act,
+							  &engine->graph_spin,
+							  poll_timeout_usecs);
+
+		if (bits < 0) {
+			jack_error ("wait on subgraph processing failed (%s)",
+				    strerror (errno));
+			pfd[0].revents = 0;
+			status = -1;
+			pollret = -1;
+		} else {
+			pfd[0].revents = (bits & JACK_ACTIVATION_COUNT) ? POLLIN : 0;
+			pollret = (bits != 0);
+		}
+	} else if ((pollret = poll (pfd, 1, poll_timeout)) < 0) {
 		jack_error ("poll on subgraph processing failed (%s)",
 			    strerror (errno));
 		status = -1;
@@ -761,7 +1135,7 @@ again:
 
 		if (engine->freewheeling) {
 			if (jack_check_client_status (engine)) {
-				return NULL;
+				return -1;
 			} else {
 				/* all clients are fine - we're just not done yet. since
 				   we're freewheeling, that is fine.
@@ -794,6 +1168,8 @@ again:
 
 	now = jack_get_microseconds ();
 
+	JACK_PROBE2 (client_return, ctl->name, status);
+
 	if (status != 0) {
 		VERBOSE (engine, "at %" PRIu64
 			 " waiting on %d for %" PRIu64
@@ -813,7 +1189,7 @@ again:
 		if (jack_check_clients (engine, 1)) {
 
 			engine->process_errors++;
-			return NULL;            /* will stop the loop */
+			return -1;            /* will stop the loop */
 		}
 	} else {
 		engine->timeout_count = 0;
@@ -823,7 +1199,9 @@ again:
 	DEBUG ("reading byte from subgraph_wait_fd==%d",
 	       client->subgraph_wait_fd);
 
-	if (read (client->subgraph_wait_fd, &c, sizeof(c)) != sizeof(c)) {
+	if (wait_act) {
+		/* the activation was consumed by jack_activation_wait() */
+	} else if (read (client->subgraph_wait_fd, &c, sizeof(c)) != sizeof(c)) {
 		if (errno == EAGAIN) {
 			jack_error ("pp: cannot clean up byte from graph wait "
 				    "fd - no data present");
@@ -832,2361 +1210,6732 @@ again:
 				    strerror (errno));
 			client->error++;
 		}
-		return NULL;    /* will stop the loop */
-	}
-
-	/* Move to next internal client (or end of client list) */
-	while (node) {
-		if (jack_client_is_internal ((jack_client_internal_t*)
-					     node->data)) {
-			break;
-		}
-		node = jack_slist_next (node);
+		return -1;    /* will stop the loop */
 	}
 
-	return node;
+	return 0;
 }
 
 #endif /* JACK_USE_MACH_THREADS */
 
-static int
-jack_engine_process (jack_engine_t *engine, jack_nframes_t nframes)
+/* Parallel graph execution.
+ *
+ * When the engine runs with `parallel' set, jack_rechain_graph() does
+ * not chain external clients together. Each one gets its own pair of
+ * FIFOs, exactly like the first client of a subgraph in the serial
+ * case, and jack_dag_build() derives the data dependencies between
+ * runnable clients from their sortfeeds lists. During a cycle a
+ * client is started as soon as all of its upstream clients have
+ * finished, so clients that do not feed each other run concurrently.
+ * The cycle is complete once every client in the plan has finished.
+ */
+
+static inline int
+jack_client_is_runnable (jack_client_internal_t *client)
 {
-	/* precondition: caller has graph_lock */
-	jack_client_internal_t *client;
-	JSList *node;
+	return client->control->active && !client->control->dead &&
+	       (client->control->process_cbset ||
+		client->control->thread_cb_cbset);
+}
 
-	engine->process_errors = 0;
+/* Internal client workers.
+ *
+ * Internal clients normally run on the engine thread, in between
+ * starting and reaping the external ones. With --internal-threads the
+ * engine also keeps that many worker threads at its own priority.
+ *
+ * With FIFO activation, whenever an internal client becomes ready
+ * while other clients are ready or running, it is handed to an idle
+ * worker, so it runs alongside the rest of the graph like an external
+ * client does, only without leaving the server. The worker tells the
+ * engine it is done through a pipe the engine polls together with the
+ * clients' FIFOs.
+ *
+ * With direct activation the workers schedule themselves instead. The
+ * engine thread and every worker own a work-stealing deque (see
+ * wsdeque.h). Whoever finishes an internal client counts down its
+ * internal successors and pushes the ones that became ready onto its
+ * own deque, so a successor normally runs on the CPU that just wrote
+ * its input, then takes the next client from the bottom of that deque.
+ * A thread whose deque is empty steals from the top of the others',
+ * and sleeps on its futex once there is nothing left to steal. The
+ * engine thread is one of them: it runs internal clients itself until
+ * there is no work anywhere, and only then waits on its slot for the
+ * external clients it watches.
+ *
+ * jack_workers_wait() keeps a cycle from ending while a worker is still
+ * busy.
+ */
+typedef struct {
+	jack_engine_t *engine;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t done_cond;
+	jack_activation_t wake;         /* signalled to start or steal */
+	jack_client_internal_t *client; /* protected by lock, NULL if idle */
+	int stealing;                   /* protected by lock */
+	int quit;                       /* protected by lock */
+	jack_nframes_t nframes;
+	int done_fd[2];                 /* done: write here */
+	jack_wsdeque_t *deque;          /* ours, in engine->steal_deques */
+	volatile int32_t sleeping;      /* waiting for `wake' */
+} jack_worker_t;
+
+/* is there anything left to steal? */
+static int
+jack_steal_pending (jack_engine_t *engine)
+{
+	unsigned int i;
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_control_t *ctl =
-			((jack_client_internal_t*)node->data)->control;
-		ctl->state = NotTriggered;
-		ctl->timed_out = 0;
-		ctl->awake_at = 0;
-		ctl->finished_at = 0;
+	for (i = 0; i < engine->nsteal_deques; i++) {
+		if (jack_wsdeque_size (&engine->steal_deques[i])) {
+			return 1;
+		}
 	}
 
-	for (node = engine->clients; engine->process_errors == 0 && node; ) {
+	return 0;
+}
 
-		client = (jack_client_internal_t*)node->data;
+/* wake up to `n' threads sleeping for want of work, workers first */
+static void
+jack_steal_wake (jack_engine_t *engine, unsigned int n)
+{
+	JSList *node;
 
-		DEBUG ("considering client %s for processing",
-		       client->control->name);
+	/* pairs with the fence between a sleeper setting its flag and
+	   looking at the deques one last time */
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
 
-		if (!client->control->active ||
-		    (!client->control->process_cbset && !client->control->thread_cb_cbset) ||
-		    client->control->dead) {
-			node = jack_slist_next (node);
-		} else if (jack_client_is_internal (client)) {
-			node = jack_process_internal (engine, node, nframes);
-		} else {
-			node = jack_process_external (engine, node);
+	for (node = engine->workers; node && n; node = jack_slist_next (node)) {
+		jack_worker_t *worker = (jack_worker_t*)node->data;
+
+		if (__atomic_load_n (&worker->sleeping, __ATOMIC_RELAXED) &&
+		    __atomic_exchange_n (&worker->sleeping, 0, __ATOMIC_SEQ_CST)) {
+			jack_activation_signal (&worker->wake);
+			n--;
 		}
 	}
 
-	return engine->process_errors > 0;
+	if (n && __atomic_load_n (&engine->steal_sleeping, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n (&engine->steal_sleeping, 0, __ATOMIC_SEQ_CST)) {
+		jack_activation_signal (&engine->control->activation
+					[JACK_ACTIVATION_ENGINE]);
+	}
 }
 
-static void
-jack_calc_cpu_load (jack_engine_t *engine)
+/* the bottom of our own deque, else the top of somebody else's */
+static jack_client_internal_t *
+jack_steal_next (jack_engine_t *engine, jack_wsdeque_t *own)
 {
-	jack_time_t cycle_end = jack_get_microseconds ();
+	jack_client_internal_t *client;
+	unsigned int i;
 
-	/* store the execution time for later averaging */
+	if ((client = (jack_client_internal_t*)jack_wsdeque_take (own)) != NULL) {
+		return client;
+	}
 
-	engine->rolling_client_usecs[engine->rolling_client_usecs_index++] =
-		cycle_end - engine->control->current_time.usecs;
+	/* a steal that lost a race leaves the entry to the winner, so
+	   go round again for as long as there is anything at all */
+	do {
+		for (i = 0; i < engine->nsteal_deques; i++) {
+			if (&engine->steal_deques[i] != own &&
+			    (client = (jack_client_internal_t*)
+				      jack_wsdeque_steal (&engine->steal_deques[i]))) {
+				return client;
+			}
+		}
+	} while (jack_steal_pending (engine));
 
-	//jack_info ("cycle_end - engine->control->current_time.usecs %ld",
-	//	(long) (cycle_end - engine->control->current_time.usecs));
+	return NULL;
+}
 
-	if (engine->rolling_client_usecs_index >= JACK_ENGINE_ROLLING_COUNT) {
-		engine->rolling_client_usecs_index = 0;
-	}
+static void jack_steal_run (jack_engine_t *engine,
+			    jack_client_internal_t *client,
+			    jack_wsdeque_t *own, int on_worker);
 
-	/* every so often, recompute the current maximum use over the
-	   last JACK_ENGINE_ROLLING_COUNT client iterations.
-	 */
+/* counts down the successors of a client that has finished: external
+   ones through their activation slots, internal ones here, onto `own'
+   when they become ready */
+static void
+jack_steal_complete (jack_engine_t *engine, JSList *successors,
+		     jack_wsdeque_t *own, int on_worker)
+{
+	JSList *node;
+	int64_t queued;
 
-	if (++engine->rolling_client_usecs_cnt
-	    % engine->rolling_interval == 0) {
-		float max_usecs = 0.0f;
-		int i;
+	for (node = successors; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *dst =
+			(jack_client_internal_t*)node->data;
 
-		for (i = 0; i < JACK_ENGINE_ROLLING_COUNT; i++) {
-			if (engine->rolling_client_usecs[i] > max_usecs) {
-				max_usecs = engine->rolling_client_usecs[i];
-			}
+		if (!jack_client_is_internal (dst)) {
+			jack_activation_complete (&engine->control->activation
+						  [dst->control->activation_slot]);
+		} else if (__atomic_sub_fetch (&dst->dag_pending, 1,
+					       __ATOMIC_ACQ_REL) == 0 &&
+			   jack_wsdeque_push (own, dst)) {
+			/* no room: run it right away */
+			jack_steal_run (engine, dst, own, on_worker);
 		}
+	}
 
-		if (max_usecs > engine->max_usecs) {
-			engine->max_usecs = max_usecs;
-		}
+	/* we will take one ourselves; the rest is for whoever is idle */
+	if ((queued = jack_wsdeque_size (own)) > 1) {
+		jack_steal_wake (engine, queued - 1);
+	}
+}
 
-		if (max_usecs < engine->driver->period_usecs) {
-			engine->spare_usecs =
-				engine->driver->period_usecs - max_usecs;
-		} else {
-			engine->spare_usecs = 0;
+static void
+jack_steal_run (jack_engine_t *engine, jack_client_internal_t *client,
+		jack_wsdeque_t *own, int on_worker)
+{
+	if (jack_client_is_runnable (client)) {
+		if (!on_worker) {
+			engine->current_client = client;
 		}
+		jack_run_internal_client (engine, client, engine->steal_nframes);
+	}
 
-		engine->control->cpu_load =
-			(1.0f - (engine->spare_usecs /
-				 engine->driver->period_usecs)) * 50.0f
-			+ (engine->control->cpu_load * 0.5f);
+	jack_steal_complete (engine, client->dag_successors, own, on_worker);
 
-		VERBOSE (engine, "load = %.4f max usecs: %.3f, "
-			 "spare = %.3f", engine->control->cpu_load,
-			 max_usecs, engine->spare_usecs);
+	if (__atomic_sub_fetch (&engine->steal_left, 1, __ATOMIC_ACQ_REL) == 0 &&
+	    on_worker) {
+		jack_activation_signal (&engine->control->activation
+					[JACK_ACTIVATION_ENGINE]);
 	}
-
 }
 
 static void
-jack_engine_post_process (jack_engine_t *engine)
-{
-	/* precondition: caller holds the graph lock. */
-
-	jack_transport_cycle_end (engine);
-	jack_calc_cpu_load (engine);
-	jack_check_clients (engine, 0);
-}
-
-
-static jack_driver_info_t *
-jack_load_driver (jack_engine_t *engine, jack_driver_desc_t * driver_desc)
+jack_worker_steal (jack_worker_t *worker)
 {
-	const char *errstr;
-	jack_driver_info_t *info;
+	jack_engine_t *engine = worker->engine;
+	jack_client_internal_t *client;
 
-	info = (jack_driver_info_t*)calloc (1, sizeof(*info));
+	pthread_mutex_lock (&worker->lock);
+	worker->stealing = 1;
+	pthread_mutex_unlock (&worker->lock);
 
-	info->handle = dlopen (driver_desc->file, RTLD_NOW | RTLD_GLOBAL);
+	while (1) {
+		while ((client = jack_steal_next (engine, worker->deque)) != NULL) {
+			jack_steal_run (engine, client, worker->deque, 1);
+		}
 
-	if (info->handle == NULL) {
-		if ((errstr = dlerror ()) != 0) {
-			jack_error ("can't load \"%s\": %s", driver_desc->file,
-				    errstr);
-		} else {
-			jack_error ("bizarre error loading driver shared "
-				    "object %s", driver_desc->file);
+		/* going to sleep: say so, then look once more, so that
+		   a push in between cannot go unnoticed */
+		__atomic_store_n (&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!jack_steal_pending (engine) ||
+		    !__atomic_exchange_n (&worker->sleeping, 0, __ATOMIC_SEQ_CST)) {
+			/* nothing, or somebody already woke us */
+			break;
 		}
-		goto fail;
 	}
 
-	info->initialize = dlsym (info->handle, "driver_initialize");
+	pthread_mutex_lock (&worker->lock);
+	worker->stealing = 0;
+	pthread_cond_signal (&worker->done_cond);
+	pthread_mutex_unlock (&worker->lock);
+}
 
-	if ((errstr = dlerror ()) != 0) {
-		jack_error ("no initialize function in shared object %s\n",
-			    driver_desc->file);
-		goto fail;
-	}
+static void *
+jack_worker_thread (void *arg)
+{
+	jack_worker_t *worker = (jack_worker_t*)arg;
+	jack_engine_t *engine = worker->engine;
+	jack_client_internal_t *client;
+	char c = 0;
 
-	info->finish = dlsym (info->handle, "driver_finish");
+	while (1) {
+		if (jack_activation_wait (&worker->wake, -1) < 0) {
+			jack_error ("internal client worker cannot wait (%s)",
+				    strerror (errno));
+			break;
+		}
 
-	if ((errstr = dlerror ()) != 0) {
-		jack_error ("no finish function in in shared driver object %s",
-			    driver_desc->file);
-		goto fail;
-	}
+		pthread_mutex_lock (&worker->lock);
+		if (worker->quit) {
+			pthread_mutex_unlock (&worker->lock);
+			break;
+		}
+		client = worker->client;
+		pthread_mutex_unlock (&worker->lock);
 
-	info->client_name = (char*)dlsym (info->handle, "driver_client_name");
+		if (client == NULL) {
+			jack_worker_steal (worker);
+			continue;
+		}
 
-	if ((errstr = dlerror ()) != 0) {
-		jack_error ("no client name in in shared driver object %s",
-			    driver_desc->file);
-		goto fail;
-	}
+		jack_run_internal_client (engine, client, worker->nframes);
 
-	return info;
+		/* idle again before the engine hears about it, so it
+		   can have this worker run the next one straight away */
+		pthread_mutex_lock (&worker->lock);
+		worker->client = NULL;
+		pthread_cond_signal (&worker->done_cond);
+		pthread_mutex_unlock (&worker->lock);
 
-fail:
-	if (info->handle) {
-		dlclose (info->handle);
+		if (write (worker->done_fd[1], &c, sizeof(c)) != sizeof(c)) {
+			jack_error ("internal client worker cannot wake the "
+				    "engine (%s)", strerror (errno));
+		}
 	}
-	free (info);
-	return NULL;
 
+	return NULL;
 }
 
-void
-jack_driver_unload (jack_driver_t *driver)
+/* run `client' on an idle worker. returns the worker, or NULL if there
+   is none and the caller has to run the client itself.
+ */
+static jack_worker_t *
+jack_worker_start (jack_engine_t *engine, jack_client_internal_t *client,
+		   jack_nframes_t nframes)
 {
-	void* handle = driver->handle;
+	JSList *node;
+	char buf[16];
 
-	driver->finish (driver);
-	dlclose (handle);
-}
+	for (node = engine->workers; node; node = jack_slist_next (node)) {
+		jack_worker_t *worker = (jack_worker_t*)node->data;
 
-int
-jack_engine_load_driver (jack_engine_t *engine,
-			 jack_driver_desc_t * driver_desc,
-			 JSList * driver_params)
-{
-	jack_client_internal_t *client;
-	jack_driver_t *driver;
-	jack_driver_info_t *info;
+		pthread_mutex_lock (&worker->lock);
+		if (worker->client || worker->stealing) {
+			pthread_mutex_unlock (&worker->lock);
+			continue;
+		}
 
-	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
-		return -1;
-	}
+		/* drop a wakeup left over by an aborted cycle */
+		while (read (worker->done_fd[0], buf, sizeof(buf)) > 0) {
+		}
 
-	if ((client = jack_create_driver_client (engine, info->client_name)
-	     ) == NULL) {
-		return -1;
+		client->control->state = Triggered;
+		client->control->signalled_at = jack_get_microseconds ();
+		worker->nframes = nframes;
+		worker->client = client;
+		pthread_mutex_unlock (&worker->lock);
+		jack_activation_signal (&worker->wake);
+		return worker;
 	}
 
-	if ((driver = info->initialize (client->private_client,
-					driver_params)) == NULL) {
-		free (info);
-		return -1;
-	}
+	return NULL;
+}
 
-	driver->handle = info->handle;
-	driver->finish = info->finish;
-	driver->internal_client = client;
-	free (info);
+static void
+jack_workers_wait (jack_engine_t *engine)
+{
+	JSList *node;
+	unsigned int i;
 
-	if (jack_use_driver (engine, driver) < 0) {
-		jack_remove_client (engine, client);
-		return -1;
+	for (node = engine->workers; node; node = jack_slist_next (node)) {
+		jack_worker_t *worker = (jack_worker_t*)node->data;
+
+		pthread_mutex_lock (&worker->lock);
+		while (worker->client || worker->stealing) {
+			pthread_cond_wait (&worker->done_cond, &worker->lock);
+		}
+		pthread_mutex_unlock (&worker->lock);
 	}
 
-	engine->driver_desc   = driver_desc;
-	engine->driver_params = driver_params;
+	/* an aborted cycle can leave clients queued */
+	for (i = 0; i < engine->nsteal_deques; i++) {
+		while (jack_wsdeque_steal (&engine->steal_deques[i])) {
+		}
+	}
+}
 
-	return 0;
+static void
+jack_worker_free (jack_worker_t *worker)
+{
+	pthread_mutex_lock (&worker->lock);
+	worker->quit = 1;
+	pthread_mutex_unlock (&worker->lock);
+	jack_activation_signal (&worker->wake);
+	pthread_join (worker->thread, NULL);
+
+	pthread_cond_destroy (&worker->done_cond);
+	pthread_mutex_destroy (&worker->lock);
+	close (worker->done_fd[0]);
+	close (worker->done_fd[1]);
+	free (worker);
 }
 
-int
-jack_engine_load_slave_driver (jack_engine_t *engine,
-			       jack_driver_desc_t * driver_desc,
-			       JSList * driver_params)
+static void
+jack_workers_start (jack_engine_t *engine)
 {
-	jack_client_internal_t *client;
-	jack_driver_t *driver;
-	jack_driver_info_t *info;
+	unsigned int i;
 
-	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
-		jack_info ("Loading slave failed\n");
-		return -1;
+	/* the engine thread's deque, and one for each worker */
+	if (posix_memalign ((void**)&engine->steal_deques, 64,
+			    (engine->nworkers + 1) * sizeof(jack_wsdeque_t))) {
+		jack_error ("cannot allocate internal client run queues");
+		engine->steal_deques = NULL;
+		engine->nworkers = 0;
+		return;
 	}
 
-	if ((client = jack_create_driver_client (engine, info->client_name)
-	     ) == NULL) {
-		jack_info ("Creating slave failed\n");
-		return -1;
+	for (i = 0; i <= engine->nworkers; i++) {
+		jack_wsdeque_init (&engine->steal_deques[i]);
 	}
+	engine->nsteal_deques = 1;
 
-	if ((driver = info->initialize (client->private_client,
-					driver_params)) == NULL) {
-		free (info);
-		jack_info ("Initializing slave failed\n");
-		return -1;
-	}
+	for (i = 0; i < engine->nworkers; i++) {
+		jack_worker_t *worker;
 
-	driver->handle = info->handle;
-	driver->finish = info->finish;
-	driver->internal_client = client;
-	free (info);
+		if ((worker = (jack_worker_t*)calloc (1, sizeof(*worker))) == NULL) {
+			break;
+		}
+		worker->engine = engine;
+		worker->deque = &engine->steal_deques[i + 1];
+		worker->sleeping = 1;
+
+		if (pipe (worker->done_fd)) {
+			jack_error ("cannot create pipe for internal client "
+				    "worker (%s)", strerror (errno));
+			free (worker);
+			break;
+		}
+		fcntl (worker->done_fd[0], F_SETFL, O_NONBLOCK);
+
+		pthread_mutex_init (&worker->lock, NULL);
+		pthread_cond_init (&worker->done_cond, NULL);
+
+		if (jack_client_create_thread (NULL, &worker->thread,
+					       engine->rtpriority,
+					       engine->control->real_time,
+					       jack_worker_thread, worker)) {
+			jack_error ("cannot create internal client worker");
+			pthread_cond_destroy (&worker->done_cond);
+			pthread_mutex_destroy (&worker->lock);
+			close (worker->done_fd[0]);
+			close (worker->done_fd[1]);
+			free (worker);
+			break;
+		}
 
-	if (jack_add_slave_driver (engine, driver) < 0) {
-		jack_info ("Adding slave failed\n");
-		jack_client_delete (engine, client);
-		return -1;
+		engine->workers = jack_slist_append (engine->workers, worker);
+		engine->nsteal_deques++;
 	}
 
-	//engine->driver_desc   = driver_desc;
-	//engine->driver_params = driver_params;
-
-	return 0;
+	engine->nworkers = jack_slist_length (engine->workers);
+	if (engine->nworkers) {
+		VERBOSE (engine, "%u threads for internal clients",
+			 engine->nworkers);
+	}
 }
 
-#ifdef USE_CAPABILITIES
+#ifndef JACK_USE_MACH_THREADS
 
-static int check_capabilities (jack_engine_t *engine)
+/* dag_ready is a stack kept in order of dag_rank, so that of the
+   clients that could start, the one heading the longest remaining
+   chain of work is popped, and triggered, first */
+static inline void
+jack_dag_make_ready (jack_engine_t *engine, jack_client_internal_t *client,
+		     unsigned int *nready)
 {
-	cap_t caps = cap_init ();
-	cap_flag_value_t cap;
-	pid_t pid;
-	int have_all_caps = 1;
+	jack_client_internal_t **ready = engine->dag_ready;
+	unsigned int i = (*nready)++;
 
-	if (caps == NULL) {
-		VERBOSE (engine, "check: could not allocate capability"
-			 " working storage");
-		return 0;
-	}
-	pid = getpid ();
-	cap_clear (caps);
-	if (capgetp (pid, caps)) {
-		VERBOSE (engine, "check: could not get capabilities "
-			 "for process %d", pid);
-		return 0;
+	while (i > 0 && ready[i - 1]->dag_rank > client->dag_rank) {
+		ready[i] = ready[i - 1];
+		i--;
 	}
-	/* check that we are able to give capabilites to other processes */
-	cap_get_flag (caps, CAP_SETPCAP, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
-	}
-	/* check that we have the capabilities we want to transfer */
-	cap_get_flag (caps, CAP_SYS_NICE, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
-	}
-	cap_get_flag (caps, CAP_SYS_RESOURCE, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
-	}
-	cap_get_flag (caps, CAP_IPC_LOCK, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
-	}
-done:
-	cap_free (caps);
-	return have_all_caps;
+	ready[i] = client;
 }
 
-
-static int give_capabilities (jack_engine_t *engine, pid_t pid)
+static void
+jack_dag_client_finished (jack_engine_t *engine,
+			  jack_client_internal_t *client,
+			  unsigned int *nready)
 {
-	cap_t caps = cap_init ();
-	const unsigned caps_size = 3;
-	cap_value_t cap_list[] = { CAP_SYS_NICE, CAP_SYS_RESOURCE, CAP_IPC_LOCK };
+	JSList *node;
 
-	if (caps == NULL) {
-		VERBOSE (engine, "give: could not allocate capability"
-			 " working storage");
-		return -1;
-	}
-	cap_clear (caps);
-	if (capgetp (pid, caps)) {
-		VERBOSE (engine, "give: could not get current "
-			 "capabilities for process %d", pid);
-		cap_clear (caps);
+	for (node = client->dag_successors; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *dst =
+			(jack_client_internal_t*)node->data;
+
+		if (--dst->dag_pending == 0) {
+			jack_dag_make_ready (engine, dst, nready);
+		}
 	}
-	cap_set_flag (caps, CAP_EFFECTIVE, caps_size, cap_list, CAP_SET);
-	cap_set_flag (caps, CAP_INHERITABLE, caps_size, cap_list, CAP_SET);
-	cap_set_flag (caps, CAP_PERMITTED, caps_size, cap_list, CAP_SET);
-	if (capsetp (pid, caps)) {
-		cap_free (caps);
-		return -1;
+
+	for (node = client->early_ports; node; node = jack_slist_next (node)) {
+		jack_port_internal_t *port = (jack_port_internal_t*)node->data;
+
+		if (--port->early_pending == 0) {
+			engine->driver->write_port (engine->driver,
+						    port->shared->id,
+						    engine->early_nframes);
+		}
 	}
-	cap_free (caps);
-	return 0;
 }
 
 static int
-jack_set_client_capabilities (jack_engine_t *engine, pid_t cap_pid)
+jack_dag_trigger (jack_engine_t *engine, jack_client_internal_t *client)
 {
-	int ret = -1;
+	char c = 0;
+	jack_client_control_t *ctl = client->control;
+	jack_activation_t *act;
 
-	/* before sending this request the client has
-	   already checked that the engine has
-	   realtime capabilities, that it is running
-	   realtime and that the pid is defined
-	 */
+	act = jack_activation_slot (engine->control, ctl->activation_slot);
 
-	if ((ret = give_capabilities (engine, cap_pid)) != 0) {
-		jack_error ("could not give capabilities to "
-			    "process %d",
-			    cap_pid);
-	} else {
-		VERBOSE (engine, "gave capabilities to"
-			 " process %d",
-			 cap_pid);
+	/* a race exists if we do this after the write(2) */
+	ctl->state = Triggered;
+	ctl->signalled_at = jack_get_microseconds ();
+
+	engine->current_client = client;
+
+	DEBUG ("starting %s, fd==%d", ctl->name, client->subgraph_start_fd);
+
+	if (act) {
+		jack_activation_signal (act);
+	} else if (write (client->subgraph_start_fd, &c, sizeof(c)) != sizeof(c)) {
+		jack_error ("cannot initiate processing of %s (%s)",
+			    ctl->name, strerror (errno));
+		engine->process_errors++;
+		jack_engine_signal_problems (engine);
+		return -1;
 	}
 
-	return ret;
+	return 0;
 }
 
-#endif /* USE_CAPABILITIES */
-
-/* perform internal or external client request
+/* Direct activation.
  *
- * reply_fd is NULL for internal requests
+ * With futex activation, external clients count down the `pending'
+ * word of each successor's activation slot and wake it themselves
+ * (see jack_wake_next_client()), so the engine only starts the
+ * clients at the top of the graph and runs internal clients, sharing
+ * them with the workers (see jack_steal_next()). It waits on its own
+ * slot, which is woken by every client that has no successors or that
+ * feeds something only the engine can start, by the worker that
+ * finishes the last internal client, and by a worker with work to
+ * spare while the engine has none.
  */
-static void
-do_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
+
+static int
+jack_engine_process_direct (jack_engine_t *engine, jack_nframes_t nframes)
 {
-	/* The request_lock serializes internal requests (from any
-	 * thread in the server) with external requests (always from "the"
-	 * server thread).
-	 */
-	pthread_mutex_lock (&engine->request_lock);
+	/* precondition: caller has graph_lock */
+	jack_client_internal_t *client;
+	jack_activation_t *wait_act;
+	jack_wsdeque_t *own = &engine->steal_deques[0];
+	JSList *node;
+	unsigned int nready = 0;
+	unsigned int nwatched = 0;
+	unsigned int ninternal = 0;
+	unsigned int i, j;
+	jack_time_t then, now, timeout_usecs;
+	int32_t bits;
 
-	DEBUG ("got a request of type %d (%s)", req->type, jack_event_type_name (req->type));
+	wait_act = &engine->control->activation[JACK_ACTIVATION_ENGINE];
 
-	switch (req->type) {
-	case RegisterPort:
-		req->status = jack_port_do_register (engine, req, reply_fd ? FALSE : TRUE);
-		break;
+	/* arm every slot before anything can run */
 
-	case UnRegisterPort:
-		req->status = jack_port_do_unregister (engine, req);
-		break;
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (jack_client_is_decimated (client) && !client->ring_due) {
+			continue;
+		}
+		client->dag_pending = client->dag_fedcount;
+		if (jack_client_is_internal (client)) {
+			ninternal++;
+		} else {
+			engine->control->activation
+			[client->control->activation_slot].pending =
+				client->dag_fedcount;
+			if (client->dag_notify) {
+				engine->dag_running[nwatched++] = client;
+			}
+		}
+		if (client->dag_fedcount == 0) {
+			jack_dag_make_ready (engine, client, &nready);
+		}
+	}
 
-	case ConnectPorts:
-		req->status = jack_port_do_connect
-				      (engine, req->x.connect.source_port,
-				      req->x.connect.destination_port);
-		break;
+	engine->steal_nframes = nframes;
+	__atomic_store_n (&engine->steal_left, ninternal, __ATOMIC_RELEASE);
 
-	case DisconnectPort:
-		req->status = jack_port_do_disconnect_all
-				      (engine, req->x.port_info.port_id);
-		break;
+	/* start the external clients at the top, longest chain first,
+	   then queue the internal ones so that the longest is taken
+	   first */
 
-	case DisconnectPorts:
-		req->status = jack_port_do_disconnect
-				      (engine, req->x.connect.source_port,
-				      req->x.connect.destination_port);
-		break;
+	for (i = nready; i-- > 0; ) {
+		client = engine->dag_ready[i];
 
-	case ActivateClient:
-		req->status = jack_client_activate (engine, req->x.client_id);
-		break;
+		if (jack_client_is_internal (client)) {
+			continue;
+		}
 
-	case DeactivateClient:
-		req->status = jack_client_deactivate (engine, req->x.client_id);
-		break;
+		if (jack_client_is_runnable (client)) {
+			jack_dag_trigger (engine, client);
+			continue;
+		}
 
-	case SetTimeBaseClient:
-		req->status = jack_timebase_set (engine,
-						 req->x.timebase.client_id,
-						 req->x.timebase.conditional);
-		break;
+		/* zombified since the plan was built */
 
-	case ResetTimeBaseClient:
-		req->status = jack_timebase_reset (engine, req->x.client_id);
-		break;
+		jack_steal_complete (engine, client->dag_successors, own, 0);
+		for (j = 0; j < nwatched; j++) {
+			if (engine->dag_running[j] == client) {
+				engine->dag_running[j] =
+					engine->dag_running[--nwatched];
+				break;
+			}
+		}
+	}
 
-	case SetSyncClient:
-		req->status =
-			jack_transport_client_set_sync (engine,
-							req->x.client_id);
-		break;
+	for (i = 0; i < nready; i++) {
+		client = engine->dag_ready[i];
+		if (jack_client_is_internal (client) &&
+		    jack_wsdeque_push (own, client)) {
+			jack_steal_run (engine, client, own, 0);
+		}
+	}
 
-	case ResetSyncClient:
-		req->status =
-			jack_transport_client_reset_sync (engine,
-							  req->x.client_id);
-		break;
+	if (jack_wsdeque_size (own) > 1) {
+		jack_steal_wake (engine, jack_wsdeque_size (own) - 1);
+	}
 
-	case SetSyncTimeout:
-		req->status = jack_transport_set_sync_timeout (engine,
-							       req->x.timeout);
-		break;
+	if (engine->freewheeling) {
+		timeout_usecs = 250000; /* 0.25 seconds */
+	} else {
+		timeout_usecs = (engine->client_timeout_msecs > 0 ?
+				 engine->client_timeout_msecs * 1000 :
+				 engine->driver->period_usecs);
+	}
 
-#ifdef USE_CAPABILITIES
-	case SetClientCapabilities:
-		req->status = jack_set_client_capabilities (engine,
-							    req->x.cap_pid);
-		break;
-#endif          /* USE_CAPABILITIES */
+	then = jack_get_microseconds ();
 
-	case GetPortConnections:
-	case GetPortNConnections:
-		//JOQ bug: reply_fd may be NULL if internal request
-		if ((req->status =
-			     jack_do_get_port_connections (engine, req, *reply_fd))
-		    == 0) {
-			/* we have already replied, don't do it again */
-			*reply_fd = -1;
+	while (engine->process_errors == 0) {
+
+		while (engine->process_errors == 0 &&
+		       (client = jack_steal_next (engine, own)) != NULL) {
+			DEBUG ("invoking an internal client's (%s) callbacks",
+			       client->control->name);
+			jack_steal_run (engine, client, own, 0);
 		}
-		break;
 
-	case FreeWheel:
-		req->status = jack_start_freewheeling (engine, req->x.client_id);
-		break;
+		if ((nwatched == 0 &&
+		     __atomic_load_n (&engine->steal_left, __ATOMIC_ACQUIRE) == 0) ||
+		    engine->process_errors) {
+			break;
+		}
 
-	case StopFreeWheel:
-		req->status = jack_stop_freewheeling (engine, 0);
-		break;
+		/* as in jack_worker_steal(): say we are going to sleep,
+		   then look once more */
+		__atomic_store_n (&engine->steal_sleeping, 1, __ATOMIC_SEQ_CST);
+		if (jack_steal_pending (engine) &&
+		    __atomic_exchange_n (&engine->steal_sleeping, 0,
+					 __ATOMIC_SEQ_CST)) {
+			continue;
+		}
 
-	case SetBufferSize:
-		req->status = jack_set_buffer_size_request (engine, req->x.nframes);
-		jack_lock_graph (engine);
-		jack_compute_new_latency (engine);
-		jack_unlock_graph (engine);
-		break;
+		now = jack_get_microseconds ();
 
-	case IntClientHandle:
-		jack_intclient_handle_request (engine, req);
-		break;
+		if (now - then < timeout_usecs) {
+			bits = jack_activation_wait (wait_act,
+						     timeout_usecs - (now - then));
+		} else {
+			bits = 0;
+		}
 
-	case IntClientLoad:
-		jack_intclient_load_request (engine, req);
-		break;
+		__atomic_store_n (&engine->steal_sleeping, 0, __ATOMIC_RELAXED);
 
-	case IntClientName:
-		jack_intclient_name_request (engine, req);
-		break;
+		if (bits < 0) {
+			jack_error ("wait on parallel graph processing failed (%s)",
+				    strerror (errno));
+			engine->process_errors++;
+			break;
+		}
 
-	case IntClientUnload:
-		jack_intclient_unload_request (engine, req);
-		break;
+		if (bits & JACK_ACTIVATION_COUNT) {
 
-	case RecomputeTotalLatencies:
-		jack_lock_graph (engine);
-		jack_compute_all_port_total_latencies (engine);
-		jack_compute_new_latency (engine);
-		jack_unlock_graph (engine);
-		req->status = 0;
-		break;
+			/* one or more of the clients we watch are done, or
+			   there is work to steal. a wakeup may also be left
+			   over from an earlier cycle, so go by the client
+			   state.
+			 */
 
-	case RecomputeTotalLatency:
-		jack_lock_graph (engine);
-		jack_compute_port_total_latency (engine, &engine->control->ports[req->x.port_info.port_id]);
-		jack_unlock_graph (engine);
-		req->status = 0;
-		break;
+			for (i = nwatched; i-- > 0; ) {
+				client = engine->dag_running[i];
+				if (__atomic_load_n (&client->control->state,
+						     __ATOMIC_ACQUIRE) != Finished) {
+					continue;
+				}
+				engine->dag_running[i] = engine->dag_running[--nwatched];
+				jack_steal_complete (engine,
+						     client->dag_engine_successors,
+						     own, 0);
+			}
+			continue;
+		}
 
-	case GetClientByUUID:
-		jack_rdlock_graph (engine);
-		jack_do_get_client_by_uuid (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case GetUUIDByClientName:
-		jack_rdlock_graph (engine);
-		jack_do_get_uuid_by_client_name (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case ReserveName:
-		jack_rdlock_graph (engine);
-		jack_do_reserve_name (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case SessionReply:
-		jack_rdlock_graph (engine);
-		jack_do_session_reply (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case SessionNotify:
-		jack_rdlock_graph (engine);
-		if ((req->status =
-			     jack_do_session_notify (engine, req, *reply_fd))
-		    >= 0) {
-			/* we have already replied, don't do it again */
-			*reply_fd = -1;
+		if (jack_get_microseconds () - then < timeout_usecs) {
+			continue;
 		}
-		jack_unlock_graph (engine);
-		break;
-	case SessionHasCallback:
-		jack_rdlock_graph (engine);
-		req->status = jack_do_has_session_cb (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case PropertyChangeNotify:
-		jack_property_change_notify (engine, req->x.property.change, req->x.property.uuid, req->x.property.key);
-		break;
 
-	case PortNameChanged:
-		jack_rdlock_graph (engine);
-		jack_port_rename_notify (engine, req->x.connect.source_port, req->x.connect.destination_port);
-		jack_unlock_graph (engine);
-		break;
+		if (engine->freewheeling) {
+			if (jack_check_client_status (engine)) {
+				engine->process_errors++;
+				break;
+			}
+			then = jack_get_microseconds ();
+			continue;
+		}
 
-	default:
-		/* some requests are handled entirely on the client
-		 * side, by adjusting the shared memory area(s) */
+		if (nwatched) {
+			jack_error ("parallel graph timed out waiting for %u "
+				    "clients (first is %s, state = %s)",
+				    nwatched,
+				    engine->dag_running[0]->control->name,
+				    jack_client_state_name (engine->dag_running[0]));
+		} else {
+			jack_error ("parallel graph timed out waiting for %d "
+				    "internal clients",
+				    __atomic_load_n (&engine->steal_left,
+						     __ATOMIC_ACQUIRE));
+		}
+
+		if (jack_check_clients (engine, 1)) {
+			engine->process_errors++;
+		}
 		break;
 	}
 
-	pthread_mutex_unlock (&engine->request_lock);
+	if (nwatched == 0) {
+		engine->timeout_count = 0;
+	}
 
-	DEBUG ("status of request: %d", req->status);
+	return engine->process_errors > 0;
 }
 
-int
-internal_client_request (void* ptr, jack_request_t *request)
+/* Copy what the outputs read by later stages of a pipelined plan held
+ * at the end of the last cycle, before any stage runs again. An output
+ * its owner marked silent needs no copy, only the mark.
+ */
+static void
+jack_engine_pipeline_snapshot (jack_engine_t *engine, jack_nframes_t nframes)
 {
-	do_request ((jack_engine_t*)ptr, request, NULL);
-	return request->status;
-}
+	uint32_t serial = engine->control->cycle_serial;
+	JSList *node, *pnode;
 
-static int
-handle_external_client_request (jack_engine_t *engine, int fd)
-{
-	/* CALLER holds read lock on graph */
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-	jack_request_t req;
-	jack_client_internal_t *client = 0;
-	int reply_fd;
-	JSList *node;
-	ssize_t r;
-
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		if (((jack_client_internal_t*)node->data)->request_fd == fd) {
-			client = (jack_client_internal_t*)node->data;
-			break;
-		}
-	}
-
-	if (client == NULL) {
-		jack_error ("client input on unknown fd %d!", fd);
-		return -1;
-	}
-
-	if ((r = read (client->request_fd, &req, sizeof(req)))
-	    < (ssize_t)sizeof(req)) {
-		if (r == 0) {
-#if defined(JACK_USE_MACH_THREADS) || defined(__OpenBSD__)
-			/* poll is implemented using
-			   select (see the macosx/fakepoll
-			   code). When the socket is closed
-			   select does not return any error,
-			   POLLIN is true and the next read
-			   will return 0 bytes. This
-			   behaviour is diffrent from the
-			   Linux poll behaviour. Thus we use
-			   this condition as a socket error
-			   and remove the client.
-			 */
-			jack_mark_client_socket_error (engine, fd);
-#endif                  /* JACK_USE_MACH_THREADS */
-			return 1;
-		} else {
-			jack_error ("cannot read request from client (%d/%d/%s)",
-				    r, sizeof(req), strerror (errno));
-			// XXX: shouldnt we mark this client as error now ?
-
-			return -1;
-		}
-	}
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			jack_port_internal_t *port =
+				(jack_port_internal_t*)pnode->data;
+			jack_port_shared_t *shared = port->shared;
+			char *base;
 
-	if (req.type == PropertyChangeNotify) {
-		if (req.x.property.keylen) {
-			req.x.property.key = (char*)malloc (req.x.property.keylen);
-			if ((r = read (client->request_fd, (char*)req.x.property.key, req.x.property.keylen)) != req.x.property.keylen) {
-				jack_error ("cannot read property key from client (%d/%d/%s)",
-					    r, sizeof(req), strerror (errno));
-				return -1;
+			if (port->delay_info == NULL || port->buffer_info == NULL) {
+				continue;
 			}
-		} else {
-			req.x.property.key = 0;
-		}
-	}
-
-	reply_fd = client->request_fd;
-
-	jack_unlock_graph (engine);
-	do_request (engine, &req, &reply_fd);
-	jack_lock_graph (engine);
 
-	if (req.type == PropertyChangeNotify && req.x.property.key) {
-		free ((char*)req.x.property.key);
-	}
+			if (shared->silent_cycle == serial - 1) {
+				shared->delay_silent_cycle = serial;
+				continue;
+			}
 
-	if (reply_fd >= 0) {
-		DEBUG ("replying to client");
-		if (write (reply_fd, &req, sizeof(req))
-		    < (ssize_t)sizeof(req)) {
-			jack_error ("cannot write request result to client");
-			return -1;
+			base = (char*)jack_shm_addr (&engine->port_segment[shared->ptype_id]);
+			memcpy (base + shared->delay_offset, base + shared->offset,
+				jack_port_type_buffer_size (
+					&engine->control->port_types[shared->ptype_id],
+					nframes));
 		}
-	} else {
-		DEBUG ("*not* replying to client");
 	}
-
-	return 0;
 }
 
 static int
-handle_client_ack_connection (jack_engine_t *engine, int client_fd)
+jack_engine_process_parallel (jack_engine_t *engine, jack_nframes_t nframes)
 {
+	/* precondition: caller has graph_lock */
 	jack_client_internal_t *client;
-	jack_client_connect_ack_request_t req;
-	jack_client_connect_ack_result_t res;
+	JSList *node;
+	unsigned int nready = 0;
+	unsigned int nrunning = 0;
+	unsigned int remaining = 0;
+	unsigned int i;
+	jack_time_t then, now, timeout_usecs;
+	int pollret;
+	char c;
 
-	if (read (client_fd, &req, sizeof(req)) != sizeof(req)) {
-		jack_error ("cannot read ACK connection request from client");
-		return -1;
+	if (engine->dag_direct) {
+		return jack_engine_process_direct (engine, nframes);
 	}
 
-	if ((client = jack_client_internal_by_id (engine, req.client_id))
-	    == NULL) {
-		jack_error ("unknown client ID in ACK connection request");
-		return -1;
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (jack_client_is_decimated (client) && !client->ring_due) {
+			/* nothing waits for it */
+			continue;
+		}
+		client->dag_pending = client->dag_fedcount;
+		if (client->dag_pending == 0) {
+			jack_dag_make_ready (engine, client, &nready);
+		}
+		remaining++;
 	}
 
-	client->event_fd = client_fd;
-	VERBOSE (engine, "new client %s using %d for events", client->control->name,
-		 client->event_fd);
-
-	res.status = 0;
-
-	if (write (client->event_fd, &res, sizeof(res)) != sizeof(res)) {
-		jack_error ("cannot write ACK connection response to client");
-		return -1;
+	engine->early_nframes = nframes;
+	for (node = engine->early_ports; node; node = jack_slist_next (node)) {
+		jack_port_internal_t *port = (jack_port_internal_t*)node->data;
+		port->early_pending = port->early_feeders;
 	}
 
-	return 0;
-}
-
-
-static void *
-jack_server_thread (void *arg)
+	if (engine->freewheeling) {
+		timeout_usecs = 250000; /* 0.25 seconds */
+	} else {
+		timeout_usecs = (engine->client_timeout_msecs > 0 ?
+				 engine->client_timeout_msecs * 1000 :
+				 engine->driver->period_usecs);
+	}
 
-{
-	jack_engine_t *engine = (jack_engine_t*)arg;
-	struct sockaddr_un client_addr;
-	socklen_t client_addrlen;
-	int problemsProblemsPROBLEMS = 0;
-	int client_socket;
-	int done = 0;
-	int i;
-	const int fixed_fd_cnt = 3;
-	int stop_freewheeling;
+	then = jack_get_microseconds ();
 
-	while (!done) {
-		JSList* node;
-		int clients;
+	while (remaining && engine->process_errors == 0) {
 
-		jack_rdlock_graph (engine);
+		/* start everything whose inputs are complete. internal
+		   clients are run right here, which may in turn make
+		   more clients ready.
+		 */
 
-		clients = jack_slist_length (engine->clients);
+		while (nready && engine->process_errors == 0) {
 
-		if (engine->pfd_size < fixed_fd_cnt + clients) {
-			if (engine->pfd) {
-				free (engine->pfd);
-			}
+			client = engine->dag_ready[--nready];
 
-			engine->pfd = (struct pollfd*)malloc (sizeof(struct pollfd) *
-							      (fixed_fd_cnt + clients));
+			if (!jack_client_is_runnable (client)) {
+				/* zombified since the plan was built */
+				remaining--;
+				jack_dag_client_finished (engine, client, &nready);
+			} else if (jack_client_is_internal (client)) {
+				jack_worker_t *worker = NULL;
 
-			if (engine->pfd == NULL) {
-				/*
-				 * this can happen if limits.conf was changed
-				 * but the user hasn't logged out and back in yet
-				 */
-				if (errno == EAGAIN) {
-					jack_error ("malloc failed (%s) - make"
-						    "sure you log out and back"
-						    "in after changing limits"
-						    ".conf!", strerror (errno));
-				} else {
-					jack_error ("malloc failed (%s)", strerror (errno));
+				if (nready || nrunning) {
+					worker = jack_worker_start (engine, client,
+								    nframes);
 				}
-
-				break;
+				if (worker) {
+					engine->dag_pfd[nrunning].fd = worker->done_fd[0];
+					engine->dag_pfd[nrunning].events =
+						POLLERR | POLLIN | POLLHUP | POLLNVAL;
+					engine->dag_pfd[nrunning].revents = 0;
+					engine->dag_running[nrunning++] = client;
+					continue;
+				}
+				DEBUG ("invoking an internal client's (%s) callbacks",
+				       client->control->name);
+				engine->current_client = client;
+				jack_run_internal_client (engine, client, nframes);
+				remaining--;
+				jack_dag_client_finished (engine, client, &nready);
+			} else if (jack_dag_trigger (engine, client) == 0) {
+				engine->dag_pfd[nrunning].fd = client->subgraph_wait_fd;
+				engine->dag_pfd[nrunning].events =
+					POLLERR | POLLIN | POLLHUP | POLLNVAL;
+				engine->dag_pfd[nrunning].revents = 0;
+				engine->dag_running[nrunning++] = client;
 			}
 		}
 
-		engine->pfd[0].fd = engine->fds[0];
-		engine->pfd[0].events = POLLIN | POLLERR;
-		engine->pfd[1].fd = engine->fds[1];
-		engine->pfd[1].events = POLLIN | POLLERR;
-		engine->pfd[2].fd = engine->cleanup_fifo[0];
-		engine->pfd[2].events = POLLIN | POLLERR;
-		engine->pfd_max = fixed_fd_cnt;
-
-		for (node = engine->clients; node; node = node->next) {
-
-			jack_client_internal_t* client = (jack_client_internal_t*)(node->data);
-
-			if (client->request_fd < 0 || client->error >= JACK_ERROR_WITH_SOCKETS) {
-				continue;
-			}
-			if ( client->control->dead ) {
-				engine->pfd[engine->pfd_max].fd = client->request_fd;
-				engine->pfd[engine->pfd_max].events = POLLHUP | POLLNVAL;
-				engine->pfd_max++;
-				continue;
-			}
-			engine->pfd[engine->pfd_max].fd = client->request_fd;
-			engine->pfd[engine->pfd_max].events = POLLIN | POLLPRI | POLLERR | POLLHUP | POLLNVAL;
-			engine->pfd_max++;
+		if (remaining == 0 || engine->process_errors) {
+			break;
 		}
 
-		jack_unlock_graph (engine);
+		if (nrunning == 0) {
+			jack_error ("parallel graph execution stalled with "
+				    "%u clients left", remaining);
+			engine->process_errors++;
+			break;
+		}
 
-		VERBOSE (engine, "start poll on %d fd's", engine->pfd_max);
+		now = jack_get_microseconds ();
 
-		/* go to sleep for a long, long time, or until a request
-		   arrives, or until a communication channel is broken
-		 */
+		if (now - then < timeout_usecs) {
+			pollret = poll (engine->dag_pfd, nrunning,
+					1 + (timeout_usecs - (now - then)) / 1000);
+		} else {
+			pollret = 0;
+		}
 
-		if (poll (engine->pfd, engine->pfd_max, -1) < 0) {
+		if (pollret < 0) {
 			if (errno == EINTR) {
 				continue;
 			}
-			jack_error ("poll failed (%s)", strerror (errno));
+			jack_error ("poll on parallel graph processing failed (%s)",
+				    strerror (errno));
+			engine->process_errors++;
 			break;
 		}
 
-		VERBOSE (engine, "server thread back from poll");
+		if (pollret == 0) {
 
-		/* Stephane Letz: letz@grame.fr : has to be added
-		 * otherwise pthread_cancel() does not work on MacOSX */
-		pthread_testcancel ();
+			/* poll(2) may return early on some kernels,
+			   so check the clock before giving up.
+			 */
 
+			if (jack_get_microseconds () - then < timeout_usecs) {
+				continue;
+			}
 
-		/* empty cleanup FIFO if necessary */
+			if (engine->freewheeling) {
+				if (jack_check_client_status (engine)) {
+					engine->process_errors++;
+					break;
+				}
+				/* all clients are fine - we're just
+				   not done yet. since we're
+				   freewheeling, that is fine.
+				 */
+				then = jack_get_microseconds ();
+				continue;
+			}
 
-		if (engine->pfd[2].revents & ~POLLIN) {
-			/* time to die */
-			break;
-		}
+			jack_error ("parallel graph timed out with %u "
+				    "clients running (first is %s, state = %s)",
+				    nrunning,
+				    engine->dag_running[0]->control->name,
+				    jack_client_state_name (engine->dag_running[0]));
 
-		if (engine->pfd[2].revents & POLLIN) {
-			char c;
-			while (read (engine->cleanup_fifo[0], &c, 1) == 1) ;
+			if (jack_check_clients (engine, 1)) {
+				engine->process_errors++;
+			}
+			break;
 		}
 
-		/* check each client socket before handling other request*/
-
-		jack_rdlock_graph (engine);
-
-		for (i = fixed_fd_cnt; i < engine->pfd_max; i++) {
+		for (i = nrunning; i-- > 0; ) {
 
-			if (engine->pfd[i].fd < 0) {
+			if (engine->dag_pfd[i].revents == 0) {
 				continue;
 			}
 
-			if (engine->pfd[i].revents & ~POLLIN) {
+			client = engine->dag_running[i];
 
-				jack_mark_client_socket_error (engine, engine->pfd[i].fd);
-				jack_engine_signal_problems (engine);
-				VERBOSE (engine, "non-POLLIN events on fd %d", engine->pfd[i].fd);
-			} else if (engine->pfd[i].revents & POLLIN) {
-
-				if (handle_external_client_request (engine, engine->pfd[i].fd)) {
-					jack_error ("could not handle external"
-						    " client request");
-					jack_engine_signal_problems (engine);
+			if (engine->dag_pfd[i].revents & ~POLLIN) {
+				jack_error ("parallel graph lost client %s",
+					    client->control->name);
+				if (jack_check_clients (engine, 1)) {
+					engine->process_errors++;
 				}
+				return engine->process_errors > 0;
 			}
-		}
 
-		problemsProblemsPROBLEMS = engine->problems;
+			if (read (engine->dag_pfd[i].fd, &c, sizeof(c)) != sizeof(c)) {
+				if (errno == EAGAIN) {
+					jack_error ("pp: cannot clean up byte from "
+						    "%s wait fd - no data present",
+						    client->control->name);
+				} else {
+					jack_error ("pp: cannot clean up byte from "
+						    "%s wait fd (%s)",
+						    client->control->name,
+						    strerror (errno));
+					client->error++;
+				}
+				return engine->process_errors > 0;
+			}
 
-		jack_unlock_graph (engine);
+			--nrunning;
+			engine->dag_pfd[i] = engine->dag_pfd[nrunning];
+			engine->dag_running[i] = engine->dag_running[nrunning];
 
-		/* need to take write lock since we may/will rip out some clients,
-		   and reset engine->problems
-		 */
+			remaining--;
+			jack_dag_client_finished (engine, client, &nready);
+		}
+	}
 
-		stop_freewheeling = 0;
+	if (remaining == 0) {
+		engine->timeout_count = 0;
+	}
 
-		while (problemsProblemsPROBLEMS) {
+	return engine->process_errors > 0;
+}
 
-			VERBOSE (engine, "trying to lock graph to remove %d problems", problemsProblemsPROBLEMS);
-			jack_lock_graph (engine);
-			VERBOSE (engine, "we have problem clients (problems = %d", problemsProblemsPROBLEMS);
-			jack_remove_clients (engine, &stop_freewheeling);
-			if (stop_freewheeling) {
-				VERBOSE (engine, "need to stop freewheeling once problems are cleared");
-			}
-			jack_unlock_graph (engine);
+#endif /* !JACK_USE_MACH_THREADS */
 
-			jack_lock_problems (engine);
-			engine->problems -= problemsProblemsPROBLEMS;
-			problemsProblemsPROBLEMS = engine->problems;
-			jack_unlock_problems (engine);
+static int
+jack_engine_process (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	/* precondition: caller has graph_lock */
+	jack_exec_plan_t *plan;
+	jack_exec_step_t *step;
+	unsigned int i;
 
-			VERBOSE (engine, "after removing clients, problems = %d", problemsProblemsPROBLEMS);
-		}
+	engine->process_errors = 0;
 
-		if (engine->freewheeling && stop_freewheeling) {
-			jack_stop_freewheeling (engine, 0);
-		}
+	plan = __atomic_load_n (&engine->plan, __ATOMIC_ACQUIRE);
+	if (plan == NULL) {
+		return 0;
+	}
 
-		/* check the master server socket */
-
-		if (engine->pfd[0].revents & POLLERR) {
-			jack_error ("error on server socket");
-			break;
-		}
-
-		if (engine->control->engine_ok && engine->pfd[0].revents & POLLIN) {
-			DEBUG ("pfd[0].revents & POLLIN");
+	for (i = 0; i < plan->ncontrols; i++) {
+		jack_client_control_t *ctl = plan->controls[i];
+		ctl->state = NotTriggered;
+		ctl->timed_out = 0;
+		ctl->signalled_at = 0;
+		ctl->awake_at = 0;
+		ctl->finished_at = 0;
+		ctl->process_cpu_usecs = 0;
+		ctl->process_preemptions = 0;
+	}
 
-			memset (&client_addr, 0, sizeof(client_addr));
-			client_addrlen = sizeof(client_addr);
+#ifndef JACK_USE_MACH_THREADS
+	if (engine->dag_nstages > 1) {
+		jack_engine_pipeline_snapshot (engine, nframes);
+	}
+	if (engine->parallel) {
+		int rc = jack_engine_process_parallel (engine, nframes);
+		/* the plan may change once we return */
+		jack_workers_wait (engine);
+		return rc;
+	}
+#endif
 
-			if ((client_socket =
-				     accept (engine->fds[0],
-					     (struct sockaddr*)&client_addr,
-					     &client_addrlen)) < 0) {
-				jack_error ("cannot accept new connection (%s)",
-					    strerror (errno));
-			} else if (!engine->new_clients_allowed || jack_client_create (engine, client_socket) < 0) {
-				jack_error ("cannot complete client "
-					    "connection process");
-				close (client_socket);
-			}
-		}
+	for (i = 0; engine->process_errors == 0 && i < plan->nsteps; i++) {
 
-		/* check the ACK server socket */
+		step = &plan->steps[i];
 
-		if (engine->pfd[1].revents & POLLERR) {
-			jack_error ("error on server ACK socket");
-			break;
+		if (step->decimated && !step->client->ring_due) {
+			continue;
 		}
 
-		if (engine->control->engine_ok && engine->pfd[1].revents & POLLIN) {
-			DEBUG ("pfd[1].revents & POLLIN");
-
-			memset (&client_addr, 0, sizeof(client_addr));
-			client_addrlen = sizeof(client_addr);
+		DEBUG ("processing client %s", step->control->name);
 
-			if ((client_socket =
-				     accept (engine->fds[1],
-					     (struct sockaddr*)&client_addr,
-					     &client_addrlen)) < 0) {
-				jack_error ("cannot accept new ACK connection"
-					    " (%s)", strerror (errno));
-			} else if (handle_client_ack_connection
-					   (engine, client_socket)) {
-				jack_error ("cannot complete client ACK "
-					    "connection process");
-				close (client_socket);
+		if (step->internal) {
+			if (jack_process_internal (engine, step, nframes)) {
+				break;
 			}
+		} else if (jack_process_external (engine, step)) {
+			break;
 		}
 	}
 
-	return 0;
+	return engine->process_errors > 0;
 }
 
-jack_engine_t *
-jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
-		 const char *server_name, int temporary, int verbose,
-		 int client_timeout, unsigned int port_max, pid_t wait_pid,
-		 jack_nframes_t frame_time_offset, int nozombies, int timeout_count_threshold, JSList *drivers)
+static void
+jack_load_stats_add (jack_load_stats_t *stats, float load)
 {
-	jack_engine_t *engine;
-	unsigned int i;
-	char server_dir[PATH_MAX + 1] = "";
-
-#ifdef USE_CAPABILITIES
-	uid_t uid = getuid ();
-	uid_t euid = geteuid ();
-#endif  /* USE_CAPABILITIES */
-
-	/* before we start allocating resources, make sure that if realtime was requested that we can
-	   actually do it.
-	 */
-
-	if (realtime) {
-		if (jack_acquire_real_time_scheduling (pthread_self (), 10) != 0) {
-			/* can't run realtime - time to bomb */
-			return NULL;
-		}
+	uint32_t h;
 
-		jack_drop_real_time_scheduling (pthread_self ());
+	stats->seq++;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
 
-#ifdef USE_MLOCK
+	if (stats->cycles[stats->current] >= stats->window) {
+		h = stats->current = !stats->current;
+		stats->cycles[h] = 0;
+		stats->max[h] = 0.0f;
+		memset (stats->hist[h], 0, sizeof(stats->hist[h]));
+	}
 
-		if (do_mlock && (mlockall (MCL_CURRENT | MCL_FUTURE) != 0)) {
-			jack_error ("cannot lock down memory for jackd (%s)",
-				    strerror (errno));
-#ifdef ENSURE_MLOCK
-			return NULL;
-#endif  /* ENSURE_MLOCK */
-		}
-#endif  /* USE_MLOCK */
+	h = stats->current;
+	stats->cycles[h]++;
+	stats->hist[h][jack_load_bucket (load)]++;
+	if (load > stats->max[h]) {
+		stats->max[h] = load;
 	}
 
-	/* start a thread to display messages from realtime threads */
-	jack_messagebuffer_init ();
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	stats->seq++;
+}
 
-	jack_init_time ();
+static void
+jack_calc_cpu_load (jack_engine_t *engine)
+{
+	jack_time_t cycle_end = jack_get_microseconds ();
+	jack_time_t cycle_usecs = cycle_end - engine->control->current_time.usecs;
+	float load;
 
-	/* allocate the engine, zero the structure to ease debugging */
-	engine = (jack_engine_t*)calloc (1, sizeof(jack_engine_t));
+	/* the distribution of per-cycle load, for the percentiles */
 
-	engine->drivers = drivers;
-	engine->driver = NULL;
-	engine->driver_desc = NULL;
-	engine->driver_params = NULL;
+	if (engine->driver->period_usecs) {
+		load = (cycle_usecs * 100.0f) / engine->driver->period_usecs;
+		jack_load_stats_add (&engine->control->load_stats, load);
 
-	engine->slave_drivers = NULL;
+		/* and the last few, for the xrun reports */
+		engine->load_history[engine->load_history_next] = load;
+		engine->load_history_next = (engine->load_history_next + 1)
+					    % JACK_XRUN_LOAD_HISTORY;
+	}
 
-	engine->set_sample_rate = jack_set_sample_rate;
-	engine->set_buffer_size = jack_driver_buffer_size;
-	engine->run_cycle = jack_run_cycle;
-	engine->delay = jack_engine_delay;
-	engine->driver_exit = jack_engine_driver_exit;
-	engine->transport_cycle_start = jack_transport_cycle_start;
-	engine->client_timeout_msecs = client_timeout;
-	engine->timeout_count = 0;
-	engine->problems = 0;
+	/* store the execution time for later averaging */
 
-	engine->port_max = port_max;
-	engine->server_thread = 0;
-	engine->rtpriority = rtpriority;
-	engine->silent_buffer = 0;
-	engine->verbose = verbose;
-	engine->server_name = server_name;
-	engine->temporary = temporary;
-	engine->freewheeling = 0;
-	engine->stop_freewheeling = 0;
-	jack_uuid_clear (&engine->fwclient);
-	engine->feedbackcount = 0;
-	engine->wait_pid = wait_pid;
-	engine->nozombies = nozombies;
-	engine->timeout_count_threshold = timeout_count_threshold;
-	engine->removing_clients = 0;
-	engine->new_clients_allowed = 1;
+	engine->rolling_client_usecs[engine->rolling_client_usecs_index++] =
+		cycle_usecs;
 
-	engine->session_reply_fd = -1;
-	engine->session_pending_replies = 0;
+	//jack_info ("cycle_end - engine->control->current_time.usecs %ld",
+	//	(long) (cycle_end - engine->control->current_time.usecs));
 
-	engine->audio_out_cnt = 0;
-	engine->audio_in_cnt = 0;
-	engine->midi_out_cnt = 0;
-	engine->midi_in_cnt = 0;
+	if (engine->rolling_client_usecs_index >= JACK_ENGINE_ROLLING_COUNT) {
+		engine->rolling_client_usecs_index = 0;
+	}
 
-	jack_engine_reset_rolling_usecs (engine);
-	engine->max_usecs = 0.0f;
+	/* every so often, recompute the current maximum use over the
+	   last JACK_ENGINE_ROLLING_COUNT client iterations.
+	 */
 
-	pthread_rwlock_init (&engine->client_lock, 0);
-	pthread_mutex_init (&engine->port_lock, 0);
-	pthread_mutex_init (&engine->request_lock, 0);
-	pthread_mutex_init (&engine->problem_lock, 0);
+	if (++engine->rolling_client_usecs_cnt
+	    % engine->rolling_interval == 0) {
+		float max_usecs = 0.0f;
+		int i;
 
-	engine->clients = 0;
-	engine->reserved_client_names = 0;
+		for (i = 0; i < JACK_ENGINE_ROLLING_COUNT; i++) {
+			if (engine->rolling_client_usecs[i] > max_usecs) {
+				max_usecs = engine->rolling_client_usecs[i];
+			}
+		}
 
-	engine->pfd_size = 0;
-	engine->pfd_max = 0;
-	engine->pfd = 0;
+		if (max_usecs > engine->max_usecs) {
+			engine->max_usecs = max_usecs;
+		}
 
-	engine->fifo_size = 16;
-	engine->fifo = (int*)malloc (sizeof(int) * engine->fifo_size);
-	for (i = 0; i < engine->fifo_size; i++)
-		engine->fifo[i] = -1;
+		if (max_usecs < engine->driver->period_usecs) {
+			engine->spare_usecs =
+				engine->driver->period_usecs - max_usecs;
+		} else {
+			engine->spare_usecs = 0;
+		}
 
-	if (pipe (engine->cleanup_fifo)) {
-		jack_error ("cannot create cleanup FIFOs (%s)", strerror (errno));
-		return NULL;
-	}
+		engine->control->cpu_load =
+			(1.0f - (engine->spare_usecs /
+				 engine->driver->period_usecs)) * 50.0f
+			+ (engine->control->cpu_load * 0.5f);
 
-	if (fcntl (engine->cleanup_fifo[0], F_SETFL, O_NONBLOCK)) {
-		jack_error ("cannot set O_NONBLOCK on cleanup read FIFO (%s)", strerror (errno));
-		return NULL;
+		VERBOSE (engine, "load = %.4f max usecs: %.3f, "
+			 "spare = %.3f", engine->control->cpu_load,
+			 max_usecs, engine->spare_usecs);
 	}
 
-	if (fcntl (engine->cleanup_fifo[1], F_SETFL, O_NONBLOCK)) {
-		jack_error ("cannot set O_NONBLOCK on cleanup write FIFO (%s)", strerror (errno));
-		return NULL;
-	}
+}
 
-	engine->external_client_cnt = 0;
+/* Batched wakeups.
+ *
+ * A client that set a process decimation of N (it can only have audio
+ * inputs) is left out of the cycle's dependencies altogether. At the
+ * end of every cycle the engine mixes what its inputs are connected to
+ * into the next period of a ring of N periods per input, in a segment
+ * of the client's own, and once all N are there the client is run at
+ * the start of the next cycle, with N times the period and
+ * jack_port_get_buffer() pointing at the ring. Its input is then up to
+ * N periods late, and its process() still has to be done within the
+ * cycle. The clients start their batches at different points, so that
+ * with several of them only some wake in any one cycle.
+ */
 
-	srandom (time ((time_t*)0));
+void
+jack_client_ring_release (jack_client_internal_t *client)
+{
+	if (client->ring_shm.attached_at) {
+		jack_release_shm (&client->ring_shm);
+		jack_destroy_shm (&client->ring_shm);
+	}
+	client->ring_shm.index = JACK_SHM_NULL_INDEX;
+	client->ring_shm.attached_at = 0;
+
+	free (client->ring_ports);
+	client->ring_ports = NULL;
+	client->nring_ports = 0;
+	client->ring_frames = 0;
+	client->ring_filled = 0;
+	client->ring_due = 0;
+}
 
-	if (jack_shmalloc (sizeof(jack_control_t)
-			   + ((sizeof(jack_port_shared_t) * engine->port_max)),
-			   &engine->control_shm)) {
-		jack_error ("cannot create engine control shared memory "
-			    "segment (%s)", strerror (errno));
-		return NULL;
-	}
+/* a new ring for the ports of `client' at the current period, empty.
+   caller must hold the graph lock */
+int
+jack_client_ring_layout (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	jack_client_control_t *ctl = client->control;
+	jack_nframes_t nframes = engine->control->buffer_size;
+	jack_port_internal_t **ports = NULL;
+	jack_shm_info_t ring;
+	jack_shmsize_t one;
+	JSList *node;
+	unsigned int n = 0;
 
-	if (jack_attach_shm (&engine->control_shm)) {
-		jack_error ("cannot attach to engine control shared memory"
-			    " (%s)", strerror (errno));
-		jack_destroy_shm (&engine->control_shm);
-		return NULL;
+	if (!jack_client_is_decimated (client)) {
+		return 0;
 	}
 
-	engine->control = (jack_control_t*)
-			  jack_shm_addr (&engine->control_shm);
+	ring.index = JACK_SHM_NULL_INDEX;
+	ring.attached_at = 0;
 
-	/* Setup port type information from builtins. buffer space is
-	 * allocated when the driver calls jack_driver_buffer_size().
-	 */
-	for (i = 0; jack_builtin_port_types[i].type_name[0]; ++i) {
+	n = jack_slist_length (client->ports);
+	one = client->decimation * nframes * sizeof(jack_default_audio_sample_t);
 
-		memcpy (&engine->control->port_types[i],
-			&jack_builtin_port_types[i],
-			sizeof(jack_port_type_info_t));
+	if (n) {
+		if ((ports = (jack_port_internal_t**)
+			     malloc (n * sizeof(jack_port_internal_t*))) == NULL) {
+			return -1;
+		}
 
-		VERBOSE (engine, "registered builtin port type %s",
-			 engine->control->port_types[i].type_name);
+		if (jack_shmalloc (n * one, &ring)) {
+			jack_error ("cannot create the input ring of %s (%s)",
+				    ctl->name, strerror (errno));
+			free (ports);
+			return -1;
+		}
 
-		/* the port type id is index into port_types array */
-		engine->control->port_types[i].ptype_id = i;
+		if (jack_attach_shm (&ring)) {
+			jack_error ("cannot attach the input ring of %s (%s)",
+				    ctl->name, strerror (errno));
+			jack_destroy_shm (&ring);
+			free (ports);
+			return -1;
+		}
 
-		/* be sure to initialize mutex correctly */
-		pthread_mutex_init (&engine->port_buffers[i].lock, NULL);
+		memset (jack_shm_addr (&ring), 0, n * one);
+	}
 
-		/* set buffer list info correctly */
-		engine->port_buffers[i].freelist = NULL;
-		engine->port_buffers[i].info = NULL;
+	jack_client_ring_release (client);
 
-		/* mark each port segment as not allocated */
-		engine->port_segment[i].index = -1;
-		engine->port_segment[i].attached_at = 0;
+	n = 0;
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		jack_port_internal_t *port = (jack_port_internal_t*)node->data;
+		port->shared->ring_offset = n * one;
+		ports[n++] = port;
 	}
 
-	engine->control->n_port_types = i;
+	client->ring_shm = ring;
+	client->ring_ports = ports;
+	client->nring_ports = n;
+	client->ring_frames = nframes;
+	client->ring_filled = engine->ring_stagger++ % client->decimation;
 
-	/* Mark all ports as available */
+	ctl->ring_index = ring.index;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	ctl->ring_serial++;
 
-	for (i = 0; i < engine->port_max; i++) {
-		engine->control->ports[i].in_use = 0;
-		engine->control->ports[i].id = i;
-		engine->control->ports[i].alias1[0] = '\0';
-		engine->control->ports[i].alias2[0] = '\0';
-	}
+	VERBOSE (engine, "client %s: woken every %u cycles, %u inputs, "
+		 "first batch after %u", ctl->name, client->decimation, n,
+		 client->decimation - client->ring_filled);
 
-	/* allocate internal port structures so that we can keep track
-	 * of port connections.
-	 */
-	engine->internal_ports = (jack_port_internal_t*)
-				 malloc (sizeof(jack_port_internal_t) * engine->port_max);
+	return 0;
+}
 
-	for (i = 0; i < engine->port_max; i++)
-		engine->internal_ports[i].connections = 0;
+/* the ring of `client' after its ports changed. caller must hold the
+   graph lock */
+static void
+jack_client_ring_update (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	if (jack_client_is_decimated (client) &&
+	    jack_client_ring_layout (engine, client)) {
+		/* it is not woken again until a layout works */
+		jack_client_ring_release (client);
+	}
+}
 
-	if (make_sockets (engine->server_name, engine->fds) < 0) {
-		jack_error ("cannot create server sockets");
-		return NULL;
-	}
-
-	engine->control->port_max = engine->port_max;
-	engine->control->real_time = realtime;
-
-	/* leave some headroom for other client threads to run
-	   with priority higher than the regular client threads
-	   but less than the server. see thread.h for
-	   jack_client_real_time_priority() and jack_client_max_real_time_priority()
-	   which are affected by this.
-	 */
-
-	engine->control->client_priority = (realtime
-					    ? engine->rtpriority - 5
-					    : 0);
-	engine->control->max_client_priority = (realtime
-						? engine->rtpriority - 1
-						: 0);
-	engine->control->do_mlock = do_mlock;
-	engine->control->do_munlock = do_unlock;
-	engine->control->cpu_load = 0;
-	engine->control->xrun_delayed_usecs = 0;
-	engine->control->max_delayed_usecs = 0;
-
-	jack_set_clock_source (clock_source);
-	engine->control->clock_source = clock_source;
-	engine->get_microseconds = jack_get_microseconds_pointer ();
-
-	VERBOSE (engine, "clock source = %s", jack_clock_source_name (clock_source));
-
-	engine->control->frame_timer.frames = frame_time_offset;
-	engine->control->frame_timer.reset_pending = 0;
-	engine->control->frame_timer.current_wakeup = 0;
-	engine->control->frame_timer.next_wakeup = 0;
-	engine->control->frame_timer.initialized = 0;
-	engine->control->frame_timer.filter_omega = 0;  /* Initialised later */
-	engine->control->frame_timer.period_usecs = 0;  /* Initialised later */
+/* every decimated client's ring, after the period changed */
+static void
+jack_engine_ring_relayout (jack_engine_t *engine)
+{
+	/* caller must hold the graph lock */
+	JSList *node;
 
-	engine->first_wakeup = 1;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-	engine->control->buffer_size = 0;
-	jack_transport_init (engine);
-	jack_set_sample_rate (engine, 0);
-	engine->control->internal = 0;
+		if (client->ring_frames != engine->control->buffer_size) {
+			jack_client_ring_update (engine, client);
+		}
+	}
+}
 
-	engine->control->has_capabilities = 0;
+static void
+jack_engine_ring_accumulate (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	/* precondition: caller holds the graph lock. */
+	jack_exec_plan_t *plan = __atomic_load_n (&engine->plan, __ATOMIC_ACQUIRE);
+	uint32_t serial = engine->control->cycle_serial;
+	unsigned int i, j;
+	JSList *node;
 
-#ifdef JACK_USE_MACH_THREADS
-	/* specific resources for server/client real-time thread
-	 * communication */
-	engine->servertask = mach_task_self ();
-	if (task_get_bootstrap_port (engine->servertask, &engine->bp)) {
-		jack_error ("Jackd: Can't find bootstrap mach port");
-		return NULL;
+	if (plan == NULL) {
+		return;
 	}
-	engine->portnum = 0;
-#endif  /* JACK_USE_MACH_THREADS */
 
+	for (i = 0; i < plan->ndecimated; i++) {
+		jack_client_internal_t *client = plan->decimated[i];
+		jack_default_audio_sample_t *dst;
+		char *ring = (char*)client->ring_shm.attached_at;
 
-#ifdef USE_CAPABILITIES
-	if (uid == 0 || euid == 0) {
-		VERBOSE (engine, "running with uid=%d and euid=%d, "
-			 "will not try to use capabilites",
-			 uid, euid);
-	} else {
-		/* only try to use capabilities if not running as root */
-		engine->control->has_capabilities = check_capabilities (engine);
-		if (engine->control->has_capabilities == 0) {
-			VERBOSE (engine, "required capabilities not "
-				 "available");
-		}
-		if (engine->verbose) {
-			size_t size;
-			cap_t cap = cap_init ();
-			capgetp (0, cap);
-			VERBOSE (engine, "capabilities: %s",
-				 cap_to_text (cap, &size));
+		if (!jack_client_is_decimated (client) ||
+		    client->ring_frames != nframes ||
+		    (ring == NULL && client->nring_ports)) {
+			client->ring_due = 0;
+			continue;
 		}
-	}
-#endif  /* USE_CAPABILITIES */
 
-	engine->control->engine_ok = 1;
+		/* it has just had the last batch */
+		if (client->ring_due) {
+			client->ring_filled = 0;
+		}
 
-	snprintf (engine->fifo_prefix, sizeof(engine->fifo_prefix),
-		  "%s/jack-ack-fifo-%d",
-		  jack_server_dir (engine->server_name, server_dir), getpid ());
+		for (j = 0; j < client->nring_ports; j++) {
+			jack_port_internal_t *port = client->ring_ports[j];
+			int first = TRUE;
+			jack_nframes_t k;
+
+			dst = (jack_default_audio_sample_t*)
+			      (ring + port->shared->ring_offset) +
+			      client->ring_filled * nframes;
+
+			for (node = port->connections; node;
+			     node = jack_slist_next (node)) {
+				jack_connection_internal_t *connection =
+					(jack_connection_internal_t*)node->data;
+				jack_port_internal_t *src = connection->source;
+				jack_default_audio_sample_t *buf;
+				float gain = connection->gain;
+
+				if (connection->muted || gain == 0.0f ||
+				    src->shared->silent_cycle == serial) {
+					continue;
+				}
 
-	(void)jack_get_fifo_fd (engine, 0);
+				buf = (jack_default_audio_sample_t*)
+				      (jack_shm_addr (&engine->port_segment[src->shared->ptype_id]) +
+				       (src->shared->passthrough_cycle == serial ?
+					src->shared->passthrough_offset :
+					src->shared->offset));
+
+				if (first && gain == 1.0f) {
+					memcpy (dst, buf, nframes * sizeof(*dst));
+				} else if (first) {
+					for (k = 0; k < nframes; k++) {
+						dst[k] = buf[k] * gain;
+					}
+				} else {
+					for (k = 0; k < nframes; k++) {
+						dst[k] += buf[k] * gain;
+					}
+				}
+				first = FALSE;
+			}
 
-	jack_client_create_thread (NULL, &engine->server_thread, 0, FALSE,
-				   &jack_server_thread, engine);
+			if (first) {
+				memset (dst, 0, nframes * sizeof(*dst));
+			}
+		}
 
-	return engine;
+		client->ring_filled++;
+		client->ring_due = (client->ring_filled >= client->decimation);
+	}
 }
 
 static void
-jack_engine_delay (jack_engine_t *engine, float delayed_usecs)
+jack_engine_post_process (jack_engine_t *engine)
 {
-	jack_event_t event;
+	/* precondition: caller holds the graph lock. */
 
-	engine->control->frame_timer.reset_pending = 1;
+	jack_transport_cycle_end (engine);
+	jack_engine_ring_accumulate (engine, engine->control->buffer_size);
+	jack_calc_cpu_load (engine);
+	jack_engine_record_timing (engine);
+	jack_engine_trace_clients (engine);
+	jack_check_clients (engine, 0);
+}
 
-	engine->control->xrun_delayed_usecs = delayed_usecs;
 
-	if (delayed_usecs > engine->control->max_delayed_usecs) {
-		engine->control->max_delayed_usecs = delayed_usecs;
-	}
+static jack_driver_info_t *
+jack_load_driver (jack_engine_t *engine, jack_driver_desc_t * driver_desc)
+{
+	const char *errstr;
+	jack_driver_info_t *info;
 
-	event.type = XRun;
+	info = (jack_driver_info_t*)calloc (1, sizeof(*info));
 
-	jack_deliver_event_to_all (engine, &event);
-}
+	info->handle = dlopen (driver_desc->file, RTLD_NOW | RTLD_GLOBAL);
 
-static void*
-jack_engine_freewheel (void *arg)
-{
-	jack_engine_t* engine = (jack_engine_t*)arg;
-	jack_client_internal_t* client;
+	if (info->handle == NULL) {
+		if ((errstr = dlerror ()) != 0) {
+			jack_error ("can't load \"%s\": %s", driver_desc->file,
+				    errstr);
+		} else {
+			jack_error ("bizarre error loading driver shared "
+				    "object %s", driver_desc->file);
+		}
+		goto fail;
+	}
 
-	VERBOSE (engine, "freewheel thread starting ...");
+	info->initialize = dlsym (info->handle, "driver_initialize");
 
-	/* we should not be running SCHED_FIFO, so we don't
-	   have to do anything about scheduling.
-	 */
+	if ((errstr = dlerror ()) != 0) {
+		jack_error ("no initialize function in shared object %s\n",
+			    driver_desc->file);
+		goto fail;
+	}
 
-	client = jack_client_internal_by_id (engine, engine->fwclient);
+	info->finish = dlsym (info->handle, "driver_finish");
 
-	while (!engine->stop_freewheeling) {
+	if ((errstr = dlerror ()) != 0) {
+		jack_error ("no finish function in in shared driver object %s",
+			    driver_desc->file);
+		goto fail;
+	}
 
-		jack_run_one_cycle (engine, engine->control->buffer_size, 0.0f);
+	info->client_name = (char*)dlsym (info->handle, "driver_client_name");
 
-		if (client && client->error) {
-			/* run one cycle() will already have told the server thread
-			   about issues, and the server thread will clean up.
-			   however, its time for us to depart this world ...
-			 */
-			break;
-		}
+	if ((errstr = dlerror ()) != 0) {
+		jack_error ("no client name in in shared driver object %s",
+			    driver_desc->file);
+		goto fail;
 	}
 
-	VERBOSE (engine, "freewheel came to an end, naturally");
-	return 0;
+	return info;
+
+fail:
+	if (info->handle) {
+		dlclose (info->handle);
+	}
+	free (info);
+	return NULL;
+
 }
 
-static void
-jack_slave_driver_remove (jack_engine_t *engine, jack_driver_t *sdriver)
+void
+jack_driver_unload (jack_driver_t *driver)
 {
-	sdriver->detach (sdriver, engine);
-	engine->slave_drivers = jack_slist_remove (engine->slave_drivers, sdriver);
+	void* handle = driver->handle;
 
-	jack_driver_unload (sdriver);
+	driver->finish (driver);
+	dlclose (handle);
 }
+
 int
-jack_drivers_start (jack_engine_t *engine)
+jack_engine_load_driver (jack_engine_t *engine,
+			 jack_driver_desc_t * driver_desc,
+			 JSList * driver_params)
 {
-	JSList *node;
-	JSList *failed_drivers = NULL;
+	jack_client_internal_t *client;
+	jack_driver_t *driver;
+	jack_driver_info_t *info;
 
-	/* first start the slave drivers */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		if (sdriver->start (sdriver)) {
-			failed_drivers = jack_slist_append (failed_drivers, sdriver);
-		}
+	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
+		return -1;
 	}
 
-	// Clean up drivers which failed to start.
-	for (node = failed_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		jack_error ( "slave driver %s failed to start, removing it", sdriver->internal_client->control->name );
-		jack_slave_driver_remove (engine, sdriver);
+	if ((client = jack_create_driver_client (engine, info->client_name)
+	     ) == NULL) {
+		return -1;
 	}
 
-	/* now the master driver is started */
-	return engine->driver->start (engine->driver);
-}
+	if ((driver = info->initialize (client->private_client,
+					driver_params)) == NULL) {
+		free (info);
+		return -1;
+	}
 
-static int
-jack_drivers_stop (jack_engine_t *engine)
-{
-	JSList *node;
-	/* first stop the master driver */
-	int retval = engine->driver->stop (engine->driver);
+	driver->handle = info->handle;
+	driver->finish = info->finish;
+	driver->internal_client = client;
+	free (info);
 
-	/* now the slave drivers are stopped */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		sdriver->stop ( sdriver );
+	if (jack_use_driver (engine, driver) < 0) {
+		jack_remove_client (engine, client);
+		return -1;
 	}
 
-	return retval;
+	engine->driver_desc   = driver_desc;
+	engine->driver_params = driver_params;
+
+	return 0;
 }
 
-static int
-jack_drivers_read (jack_engine_t *engine, jack_nframes_t nframes)
-{
-	JSList *node;
-
-	/* first read the slave drivers */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		sdriver->read (sdriver, nframes);
-	}
-
-	/* now the master driver is read */
-	return engine->driver->read (engine->driver, nframes);
-}
-
-static int
-jack_drivers_write (jack_engine_t *engine, jack_nframes_t nframes)
-{
-	JSList *node;
-
-	/* first start the slave drivers */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		sdriver->write (sdriver, nframes);
-	}
-
-	/* now the master driver is written */
-	return engine->driver->write (engine->driver, nframes);
-}
-static int
-jack_start_freewheeling (jack_engine_t* engine, jack_uuid_t client_id)
+int
+jack_engine_load_slave_driver (jack_engine_t *engine,
+			       jack_driver_desc_t * driver_desc,
+			       JSList * driver_params)
 {
-	jack_event_t event;
 	jack_client_internal_t *client;
+	jack_driver_t *driver;
+	jack_driver_info_t *info;
 
-	if (engine->freewheeling) {
-		return 0;
-	}
-
-	if (engine->driver == NULL) {
-		jack_error ("cannot start freewheeling without a driver!");
+	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
+		jack_info ("Loading slave failed\n");
 		return -1;
 	}
 
-	/* stop driver before telling anyone about it so
-	   there are no more process() calls being handled.
-	 */
-
-	if (jack_drivers_stop (engine)) {
-		jack_error ("could not stop driver for freewheeling");
+	if ((client = jack_create_driver_client (engine, info->client_name)
+	     ) == NULL) {
+		jack_info ("Creating slave failed\n");
 		return -1;
 	}
 
-	client = jack_client_internal_by_id (engine, client_id);
-
-	if (client->control->process_cbset || client->control->thread_cb_cbset) {
-		jack_uuid_copy (&engine->fwclient, client_id);
+	if ((driver = info->initialize (client->private_client,
+					driver_params)) == NULL) {
+		free (info);
+		jack_info ("Initializing slave failed\n");
+		return -1;
 	}
 
-	engine->freewheeling = 1;
-	engine->stop_freewheeling = 0;
-
-	event.type = StartFreewheel;
-	jack_deliver_event_to_all (engine, &event);
+	driver->handle = info->handle;
+	driver->finish = info->finish;
+	driver->internal_client = client;
+	free (info);
 
-	if (jack_client_create_thread (NULL, &engine->freewheel_thread, 0, FALSE,
-				       jack_engine_freewheel, engine)) {
-		jack_error ("could not start create freewheel thread");
+	if (jack_add_slave_driver (engine, driver) < 0) {
+		jack_info ("Adding slave failed\n");
+		jack_client_delete (engine, client);
 		return -1;
 	}
 
+	//engine->driver_desc   = driver_desc;
+	//engine->driver_params = driver_params;
+
 	return 0;
 }
 
-int
-jack_stop_freewheeling (jack_engine_t* engine, int engine_exiting)
+/* a connection of a master driver port, by port names, to be made
+   again with the next master, see jack_engine_switch_master() */
+typedef struct {
+	char source[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	char destination[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+	float gain;
+	int muted;
+} jack_driver_link_t;
+
+static JSList *
+jack_driver_links (jack_engine_t *engine, jack_client_internal_t *client)
 {
-	jack_event_t event;
-	void *ftstatus;
+	JSList *links = NULL, *pnode, *cnode;
+	jack_connection_internal_t *c;
+	jack_driver_link_t *link;
 
-	if (!engine->freewheeling) {
-		return 0;
-	}
+	jack_lock_graph (engine);
 
-	if (engine->driver == NULL) {
-		jack_error ("cannot start freewheeling without a driver!");
-		return -1;
-	}
+	for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+		jack_port_internal_t *port = (jack_port_internal_t*)pnode->data;
 
-	if (!engine->freewheeling) {
-		VERBOSE (engine, "stop freewheel when not freewheeling");
-		return 0;
+		for (cnode = port->connections; cnode;
+		     cnode = jack_slist_next (cnode)) {
+			c = (jack_connection_internal_t*)cnode->data;
+			if ((link = (jack_driver_link_t*)
+				    malloc (sizeof(*link))) == NULL) {
+				break;
+			}
+			snprintf (link->source, sizeof(link->source), "%s",
+				  c->source->names->name);
+			snprintf (link->destination, sizeof(link->destination),
+				  "%s", c->destination->names->name);
+			link->gain = c->gain;
+			link->muted = c->muted;
+			links = jack_slist_prepend (links, link);
+		}
 	}
 
-	/* tell the freewheel thread to stop, and wait for it
-	   to exit.
-	 */
+	jack_unlock_graph (engine);
 
-	engine->stop_freewheeling = 1;
+	return links;
+}
 
-	VERBOSE (engine, "freewheeling stopped, waiting for thread");
-	pthread_join (engine->freewheel_thread, &ftstatus);
-	VERBOSE (engine, "freewheel thread has returned");
+/* give a connection made again the gain and mute it had */
+static void
+jack_driver_link_gain (jack_engine_t *engine, jack_driver_link_t *link)
+{
+	jack_request_t req;
 
-	jack_uuid_clear (&engine->fwclient);
-	engine->freewheeling = 0;
-	engine->control->frame_timer.reset_pending = 1;
+	memset (&req, 0, sizeof(req));
+	req.type = SetConnectionGain;
+	snprintf (req.x.connection_gain.source_port,
+		  sizeof(req.x.connection_gain.source_port), "%s",
+		  link->source);
+	snprintf (req.x.connection_gain.destination_port,
+		  sizeof(req.x.connection_gain.destination_port), "%s",
+		  link->destination);
+	req.x.connection_gain.what = JackConnectionGain | JackConnectionMute;
+	req.x.connection_gain.gain = link->gain;
+	req.x.connection_gain.mute = link->muted;
+
+	jack_port_do_set_connection_gain (engine, &req);
+}
 
-	if (!engine_exiting) {
-		/* tell everyone we've stopped */
+/* take the master driver away altogether: its client and ports go,
+   and the backend port names start again from 1 */
+static void
+jack_engine_drop_master (jack_engine_t *engine, int started)
+{
+	jack_driver_t *driver = engine->driver;
 
-		event.type = StopFreewheel;
-		jack_deliver_event_to_all (engine, &event);
+	if (started) {
+		driver->stop (driver);
+	}
+	jack_use_driver (engine, NULL);
 
-		/* restart the driver */
+	pthread_mutex_lock (&engine->request_lock);
+	jack_lock_graph (engine);
+	jack_remove_client (engine, driver->internal_client);
+	jack_unlock_graph (engine);
+	pthread_mutex_unlock (&engine->request_lock);
 
-		if (jack_drivers_start (engine)) {
-			jack_error ("could not restart driver after freewheeling");
-			return -1;
-		}
-	}
+	jack_driver_unload (driver);
 
-	return 0;
+	engine->audio_out_cnt = 0;
+	engine->audio_in_cnt = 0;
+	engine->midi_out_cnt = 0;
+	engine->midi_in_cnt = 0;
 }
 
 static int
-jack_check_client_status (jack_engine_t* engine)
+jack_engine_start_master (jack_engine_t *engine,
+			  jack_driver_desc_t *driver_desc,
+			  JSList *driver_params)
 {
-	JSList *node;
-	int err = 0;
-
-	/* we are already late, or something else went wrong,
-	   so it can't hurt to check the existence of all
-	   clients.
-	 */
-
-	for (node = engine->clients; node;
-	     node = jack_slist_next (node)) {
-		jack_client_internal_t *client =
-			(jack_client_internal_t*)node->data;
-
-		if (client->control->type == ClientExternal) {
-			if (kill (client->control->pid, 0)) {
-				VERBOSE (engine,
-					 "client %s has died/exited",
-					 client->control->name);
-				client->error++;
-				err++;
-			}
-			if (client->control->last_status != 0) {
-				VERBOSE (engine,
-					 "client %s has nonzero process callback status (%d)\n",
-					 client->control->name, client->control->last_status);
-				client->error++;
-				err++;
-			}
-		}
+	if (jack_engine_load_driver (engine, driver_desc, driver_params)) {
+		jack_error ("cannot load driver module %s", driver_desc->name);
+		return -1;
+	}
 
-		DEBUG ("client %s errors = %d", client->control->name,
-		       client->error);
+	if (engine->driver->start (engine->driver)) {
+		jack_error ("cannot start driver %s", driver_desc->name);
+		jack_engine_drop_master (engine, FALSE);
+		return -1;
 	}
 
-	return err;
+	return 0;
 }
 
-static int
-jack_run_one_cycle (jack_engine_t *engine, jack_nframes_t nframes,
-		    float delayed_usecs)
+/* Replace the master driver of a running server. Clients stay, and so
+ * do their connections to the driver's ports: they are noted by name
+ * and made again with whichever ports of the new driver have the same
+ * names, which with the backend names given by
+ * jack_port_register_internal() ("system:capture_1" and so on) is the
+ * same channels of another device. A new period resizes the port
+ * buffers when the new driver attaches. If the new driver cannot be
+ * started the old one is brought back, and -1 returned.
+ */
+int
+jack_engine_switch_master (jack_engine_t *engine,
+			   jack_driver_desc_t *driver_desc,
+			   JSList *driver_params)
 {
-	jack_driver_t* driver = engine->driver;
-	int ret = -1;
-	static int consecutive_excessive_delays = 0;
-
-#define WORK_SCALE 1.0f
-
-	if (!engine->freewheeling &&
-	    engine->control->real_time &&
-	    engine->spare_usecs &&
-	    ((WORK_SCALE * engine->spare_usecs) <= delayed_usecs)) {
-
-		MESSAGE ("delay of %.3f usecs exceeds estimated spare"
-			 " time of %.3f; restart ...\n",
-			 delayed_usecs, WORK_SCALE * engine->spare_usecs);
-
-		if (++consecutive_excessive_delays > 10) {
-			jack_error ("too many consecutive interrupt delays "
-				    "... engine pausing");
-			return -1;      /* will exit the thread loop */
-		}
-
-		jack_engine_delay (engine, delayed_usecs);
-
-		return 0;
-
-	} else {
-		consecutive_excessive_delays = 0;
-	}
+	jack_driver_desc_t *old_desc = engine->driver_desc;
+	JSList *old_params = engine->driver_params;
+	JSList *links = NULL, *node;
+	jack_driver_link_t *link;
+	int restored = 0;
+	int ret = 0;
 
-	DEBUG ("trying to acquire read lock (FW = %d)", engine->freewheeling);
-	if (jack_try_rdlock_graph (engine)) {
-		VERBOSE (engine, "lock-driven null cycle");
-		if (!engine->freewheeling) {
-			driver->null_cycle (driver, nframes);
-		} else {
-			/* don't return too fast */
-			usleep (1000);
+	if (engine->driver) {
+		links = jack_driver_links (engine,
+					   engine->driver->internal_client);
+		jack_engine_drop_master (engine, TRUE);
+	}
+
+	if (jack_engine_start_master (engine, driver_desc, driver_params)) {
+		ret = -1;
+		if (old_desc == NULL ||
+		    jack_engine_start_master (engine, old_desc, old_params)) {
+			jack_error ("could not bring back the old driver, "
+				    "leaving without driver");
+			old_desc = NULL;
 		}
-		return 0;
 	}
 
-	if (jack_trylock_problems (engine)) {
-		VERBOSE (engine, "problem-lock-driven null cycle");
-		jack_unlock_graph (engine);
-		if (!engine->freewheeling) {
-			driver->null_cycle (driver, nframes);
-		} else {
-			/* don't return too fast */
-			usleep (1000);
+	for (node = links; node; node = jack_slist_next (node)) {
+		link = (jack_driver_link_t*)node->data;
+		if (engine->driver &&
+		    jack_port_do_connect (engine, link->source,
+					  link->destination) == 0) {
+			restored++;
+			if (link->gain != 1.0f || link->muted) {
+				jack_driver_link_gain (engine, link);
+			}
 		}
-		return 0;
+		free (link);
 	}
+	jack_slist_free (links);
 
-	if (engine->problems || (engine->timeout_count_threshold && (engine->timeout_count > (1 + engine->timeout_count_threshold * 1000 / engine->driver->period_usecs) ))) {
-		VERBOSE (engine, "problem-driven null cycle problems=%d", engine->problems);
-		jack_unlock_problems (engine);
-		jack_unlock_graph (engine);
-		if (!engine->freewheeling) {
-			driver->null_cycle (driver, nframes);
-		} else {
-			/* don't return too fast */
-			usleep (1000);
-		}
-		return 0;
+	if (engine->driver) {
+		VERBOSE (engine, "master driver is now %s, %d connection(s) "
+			 "made again", engine->driver_desc->name, restored);
 	}
 
-	jack_unlock_problems (engine);
+	return ret;
+}
 
-	if (!engine->freewheeling) {
-		DEBUG ("waiting for driver read\n");
-		if (jack_drivers_read (engine, nframes)) {
-			goto unlock;
-		}
-	}
+#ifdef USE_CAPABILITIES
 
-	DEBUG ("run process\n");
+static int check_capabilities (jack_engine_t *engine)
+{
+	cap_t caps = cap_init ();
+	cap_flag_value_t cap;
+	pid_t pid;
+	int have_all_caps = 1;
 
-	if (jack_engine_process (engine, nframes) != 0) {
-		DEBUG ("engine process cycle failed");
-		jack_check_client_status (engine);
+	if (caps == NULL) {
+		VERBOSE (engine, "check: could not allocate capability"
+			 " working storage");
+		return 0;
 	}
-
-	if (!engine->freewheeling) {
-		if (jack_drivers_write (engine, nframes)) {
-			goto unlock;
-		}
+	pid = getpid ();
+	cap_clear (caps);
+	if (capgetp (pid, caps)) {
+		VERBOSE (engine, "check: could not get capabilities "
+			 "for process %d", pid);
+		return 0;
+	}
+	/* check that we are able to give capabilites to other processes */
+	cap_get_flag (caps, CAP_SETPCAP, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
+	}
+	/* check that we have the capabilities we want to transfer */
+	cap_get_flag (caps, CAP_SYS_NICE, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
+	}
+	cap_get_flag (caps, CAP_SYS_RESOURCE, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
+	}
+	cap_get_flag (caps, CAP_IPC_LOCK, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
 	}
+done:
+	cap_free (caps);
+	return have_all_caps;
+}
 
-	jack_engine_post_process (engine);
 
-	if (delayed_usecs > engine->control->max_delayed_usecs) {
-		engine->control->max_delayed_usecs = delayed_usecs;
+static int give_capabilities (jack_engine_t *engine, pid_t pid)
+{
+	cap_t caps = cap_init ();
+	const unsigned caps_size = 3;
+	cap_value_t cap_list[] = { CAP_SYS_NICE, CAP_SYS_RESOURCE, CAP_IPC_LOCK };
+
+	if (caps == NULL) {
+		VERBOSE (engine, "give: could not allocate capability"
+			 " working storage");
+		return -1;
+	}
+	cap_clear (caps);
+	if (capgetp (pid, caps)) {
+		VERBOSE (engine, "give: could not get current "
+			 "capabilities for process %d", pid);
+		cap_clear (caps);
+	}
+	cap_set_flag (caps, CAP_EFFECTIVE, caps_size, cap_list, CAP_SET);
+	cap_set_flag (caps, CAP_INHERITABLE, caps_size, cap_list, CAP_SET);
+	cap_set_flag (caps, CAP_PERMITTED, caps_size, cap_list, CAP_SET);
+	if (capsetp (pid, caps)) {
+		cap_free (caps);
+		return -1;
 	}
+	cap_free (caps);
+	return 0;
+}
 
-	ret = 0;
+static int
+jack_set_client_capabilities (jack_engine_t *engine, pid_t cap_pid)
+{
+	int ret = -1;
 
-unlock:
-	jack_unlock_graph (engine);
-	DEBUG ("cycle finished, status = %d", ret);
+	/* before sending this request the client has
+	   already checked that the engine has
+	   realtime capabilities, that it is running
+	   realtime and that the pid is defined
+	 */
+
+	if ((ret = give_capabilities (engine, cap_pid)) != 0) {
+		jack_error ("could not give capabilities to "
+			    "process %d",
+			    cap_pid);
+	} else {
+		VERBOSE (engine, "gave capabilities to"
+			 " process %d",
+			 cap_pid);
+	}
 
 	return ret;
 }
 
+#endif /* USE_CAPABILITIES */
+
+/* perform internal or external client request
+ *
+ * reply_fd is NULL for internal requests
+ */
 static void
-jack_engine_driver_exit (jack_engine_t* engine)
+do_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
 {
-	jack_driver_t* driver = engine->driver;
+	/* The request_lock serializes internal requests (from any
+	 * thread in the server) with external requests (always from "the"
+	 * server thread).
+	 */
+	pthread_mutex_lock (&engine->request_lock);
 
-	VERBOSE (engine, "stopping driver");
-	driver->stop (driver);
-	VERBOSE (engine, "detaching driver");
-	driver->detach (driver, engine);
+	DEBUG ("got a request of type %d (%s)", req->type, jack_event_type_name (req->type));
 
-	/* tell anyone waiting that the driver exited. */
-	kill (engine->wait_pid, SIGUSR2);
+	switch (req->type) {
+	case RegisterPort:
+		req->status = jack_port_do_register (engine, req, reply_fd ? FALSE : TRUE);
+		break;
 
-	engine->driver = NULL;
-}
+	case UnRegisterPort:
+		req->status = jack_port_do_unregister (engine, req);
+		break;
 
-static int
-jack_run_cycle (jack_engine_t *engine, jack_nframes_t nframes,
-		float delayed_usecs)
-{
-	jack_time_t now = engine->driver->last_wait_ust;
-	jack_time_t dus = 0;
-	jack_time_t p_usecs = engine->driver->period_usecs;
-	jack_nframes_t b_size = engine->control->buffer_size;
-	jack_nframes_t left;
-	jack_frame_timer_t* timer = &engine->control->frame_timer;
+	case RegisterPorts:
+		req->status = jack_port_do_register_many (engine, req, reply_fd ? FALSE : TRUE);
+		break;
 
-	if (engine->verbose) {
-		if (nframes != b_size) {
-			VERBOSE (engine,
-				 "late driver wakeup: nframes to process = %"
-				 PRIu32 ".", nframes);
-		}
-	}
+	case UnRegisterPorts:
+		req->status = jack_port_do_unregister_many (engine, req);
+		break;
 
-	/* Run as many cycles as it takes to consume nframes */
+	case ConnectPorts:
+		req->status = jack_port_do_connect
+				      (engine, req->x.connect.source_port,
+				      req->x.connect.destination_port);
+		break;
 
-	for (left = nframes; left >= b_size; left -= b_size) {
-		/* Change: the DLL code is now inside this loop which ensures
-		   that more than one period is run if more than a buffer size
-		   of frames is available. This is a very unlikely event, but
-		   it is possible and now handled correctly.
-		   FA 25/06/2014
-		 */
-		/* Change: 'first_wakeup' now means only the very first wakeup
-		   after the engine was created. In that case frame time is not
-		   modified, it stays at the initialised value.
-		   OTOH 'reset_pending' is  used after freewheeling or an xrun.
-		   In those cases frame time is adjusted by using the difference
-		   in usecs time between the end of the previous period and the
-		   start of the current one. This way, a client monitoring the
-		   frame time for the start of each period will have a correct
-		   idea of the number of frames that were skipped.
-		   FA 25/06/2014
-		 */
-		/* Change: in contrast to previous versions, the DLL is *not*
-		   run if any of the two conditions above is true, it is just
-		   initialised correctly for the current period. Previously it
-		   was initialised and then run, which meant that the requred
-		   initialisation was rather counter-intiutive.
-		   FA 25/06/2014
-		 */
-		/* Added initialisation of timer->period_usecs, required
-		   due to the modified implementation of the DLL itself.
-		   OTOH, this should maybe not be repeated after e.g.
-		   freewheeling or an xrun, as the current value would be
-		   more accurate than the nominal one. But it doesn't really
-		   harm either.
-		   FA 13/02/2012
-		 */
-		/* Added initialisation of timer->filter_omega. This makes
-		   the DLL bandwidth independent of the actual period time.
-		   The bandwidth is now 1/8 Hz in all cases. The value of
-		   timer->filter_omega is 2 * pi * BW * Tperiod.
-		   FA 13/02/2012
-		 */
+	case DisconnectPort:
+		req->status = jack_port_do_disconnect_all
+				      (engine, req->x.port_info.port_id);
+		break;
 
-		// maybe need a memory barrier here
-		timer->guard1++;
+	case DisconnectPorts:
+		req->status = jack_port_do_disconnect
+				      (engine, req->x.connect.source_port,
+				      req->x.connect.destination_port);
+		break;
 
-		if (timer->reset_pending) {
-			// Adjust frame time after a discontinuity.
-			// The frames of the previous period.
-			timer->frames += b_size;
-			// The frames that were skipped.
-			dus = now - timer->next_wakeup;
-			timer->frames += (dus * b_size) / p_usecs;
-		}
-		if (engine->first_wakeup || timer->reset_pending) {
-			// First wakeup or after discontinuity.
-			// Initialiase the DLL.
-			timer->current_wakeup = now;
-			timer->next_wakeup = now + p_usecs;
-			timer->period_usecs = (float)p_usecs;
-			timer->filter_omega = timer->period_usecs * 7.854e-7f;
-			timer->initialized = 1;
+	case ConnectPortsBatch:
+		req->status = jack_port_do_connect_batch (engine, req, TRUE);
+		break;
 
-			// Reset both conditions.
-			engine->first_wakeup = 0;
-			timer->reset_pending = 0;
-		} else {
-			// Normal cycle. This code was originally in
-			// jack_inc_frame_time() but only used here.
-			// Moving it here means that now all code
-			// related to timekeeping is close together
-			// and easy to understand.
-			float delta = (float)((int64_t)now - (int64_t)timer->next_wakeup);
-			delta *= timer->filter_omega;
-			timer->current_wakeup = timer->next_wakeup;
-			timer->frames += b_size;
-			timer->period_usecs += timer->filter_omega * delta;
-			timer->next_wakeup += (int64_t)floorf (timer->period_usecs + 1.41f * delta + 0.5f);
-		}
+	case DisconnectPortsBatch:
+		req->status = jack_port_do_connect_batch (engine, req, FALSE);
+		break;
 
-		// maybe need a memory barrier here
-		timer->guard2++;
+	case SetConnectionGain:
+		req->status = jack_port_do_set_connection_gain (engine, req);
+		break;
 
-		if (jack_run_one_cycle (engine, b_size, delayed_usecs)) {
-			jack_error ("cycle execution failure, exiting");
-			return EIO;
-		}
-	}
+	case ActivateClient:
+		req->status = jack_client_activate (engine, req->x.client_id);
+		break;
 
-	return 0;
-}
+	case DeactivateClient:
+		req->status = jack_client_deactivate (engine, req->x.client_id);
+		break;
 
-void
-jack_engine_delete (jack_engine_t *engine)
+	case SetTimeBaseClient:
+		req->status = jack_timebase_set (engine,
+						 req->x.timebase.client_id,
+						 req->x.timebase.conditional);
+		break;
+
+	case ResetTimeBaseClient:
+		req->status = jack_timebase_reset (engine, req->x.client_id);
+		break;
+
+	case SetSyncClient:
+		req->status =
+			jack_transport_client_set_sync (engine,
+							req->x.client_id);
+		break;
+
+	case ResetSyncClient:
+		req->status =
+			jack_transport_client_reset_sync (engine,
+							  req->x.client_id);
+		break;
+
+	case SetSyncTimeout:
+		req->status = jack_transport_set_sync_timeout (engine,
+							       req->x.timeout);
+		break;
+
+#ifdef USE_CAPABILITIES
+	case SetClientCapabilities:
+		req->status = jack_set_client_capabilities (engine,
+							    req->x.cap_pid);
+		break;
+#endif          /* USE_CAPABILITIES */
+
+	case GetPortConnections:
+	case GetPortNConnections:
+		//JOQ bug: reply_fd may be NULL if internal request
+		if ((req->status =
+			     jack_do_get_port_connections (engine, req, *reply_fd))
+		    == 0) {
+			/* we have already replied, don't do it again */
+			*reply_fd = -1;
+		}
+		break;
+
+	case FreeWheel:
+		req->status = jack_start_freewheeling (engine, req->x.client_id);
+		break;
+
+	case StopFreeWheel:
+		req->status = jack_stop_freewheeling (engine, 0);
+		break;
+
+	case SetBufferSize:
+		req->status = jack_set_buffer_size_request (engine, req->x.nframes);
+		jack_lock_graph (engine);
+		jack_engine_ring_relayout (engine);
+		jack_latency_mark_all (engine);
+		jack_compute_new_latency (engine);
+		jack_unlock_graph (engine);
+		break;
+
+	case IntClientHandle:
+		jack_intclient_handle_request (engine, req);
+		break;
+
+	case IntClientLoad:
+		jack_intclient_load_request (engine, req);
+		break;
+
+	case IntClientName:
+		jack_intclient_name_request (engine, req);
+		break;
+
+	case IntClientUnload:
+		jack_intclient_unload_request (engine, req);
+		break;
+
+	case RecomputeTotalLatencies:
+		jack_lock_graph (engine);
+		jack_compute_all_port_total_latencies (engine);
+		jack_latency_mark_all (engine);
+		jack_compute_new_latency (engine);
+		jack_unlock_graph (engine);
+		req->status = 0;
+		break;
+
+	case RecomputeTotalLatency:
+		jack_lock_graph (engine);
+		if (req->x.port_info.port_id < engine->port_max) {
+			jack_compute_port_total_latency (engine, jack_engine_port (engine, req->x.port_info.port_id));
+		}
+		jack_unlock_graph (engine);
+		req->status = 0;
+		break;
+
+	case GetClientByUUID:
+		jack_rdlock_graph (engine);
+		jack_do_get_client_by_uuid (engine, req);
+		jack_unlock_graph (engine);
+		break;
+	case GetUUIDByClientName:
+		jack_rdlock_graph (engine);
+		jack_do_get_uuid_by_client_name (engine, req);
+		jack_unlock_graph (engine);
+		break;
+	case ReserveName:
+		jack_rdlock_graph (engine);
+		jack_do_reserve_name (engine, req);
+		jack_unlock_graph (engine);
+		break;
+	case SessionReply:
+		jack_rdlock_graph (engine);
+		jack_do_session_reply (engine, req);
+		jack_unlock_graph (engine);
+		break;
+	case SessionNotify:
+		jack_rdlock_graph (engine);
+		if ((req->status =
+			     jack_do_session_notify (engine, req, *reply_fd))
+		    >= 0) {
+			/* we have already replied, don't do it again */
+			*reply_fd = -1;
+		}
+		jack_unlock_graph (engine);
+		break;
+	case SessionHasCallback:
+		jack_rdlock_graph (engine);
+		req->status = jack_do_has_session_cb (engine, req);
+		jack_unlock_graph (engine);
+		break;
+	case PropertyChangeNotify:
+		jack_property_change_notify (engine, req->x.property.change, req->x.property.uuid, req->x.property.key);
+		break;
+
+	case SetProperty:
+		req->status = jack_do_set_property (engine, req);
+		break;
+
+	case RemoveProperties:
+		req->status = jack_do_remove_properties (engine, req);
+		break;
+
+	case RemoveAllProperties:
+		jack_propstore_clear (engine->propstore);
+		jack_property_change_notify (engine, PropertyDeleted, req->x.property.uuid, NULL);
+		req->status = 0;
+		break;
+
+	case CreateRingbuffer:
+		jack_ringbuffer_create_request (engine, req);
+		break;
+
+	case OpenRingbuffer:
+		jack_ringbuffer_open_request (engine, req);
+		break;
+
+	case DestroyRingbuffer:
+		jack_ringbuffer_destroy_request (engine, req);
+		break;
+
+	case SetWorkerPool:
+		req->status = jack_do_set_worker_pool (engine, req);
+		break;
+
+	case PortNameChanged:
+		jack_rdlock_graph (engine);
+		jack_port_rename_notify (engine, req->x.connect.source_port, req->x.connect.destination_port);
+		jack_unlock_graph (engine);
+		break;
+
+	default:
+		/* some requests are handled entirely on the client
+		 * side, by adjusting the shared memory area(s) */
+		break;
+	}
+
+	pthread_mutex_unlock (&engine->request_lock);
+
+	DEBUG ("status of request: %d", req->status);
+}
+
+int
+internal_client_request (void* ptr, jack_request_t *request)
+{
+	do_request ((jack_engine_t*)ptr, request, NULL);
+	return request->status;
+}
+
+static int
+jack_read_port_batch (jack_client_internal_t *client, jack_request_t *req)
+{
+	size_t size, got;
+	ssize_t r;
+	char *ports;
+	uint32_t i;
+
+	/* the port names of a batched (dis)connection follow the
+	   request, see oop_client_deliver_request()
+	 */
+
+	req->x.batch.ports = NULL;
+
+	if (req->x.batch.npairs == 0) {
+		return 0;
+	}
+
+	if (req->x.batch.npairs > JACK_PORT_BATCH_MAX) {
+		jack_error ("client %s sent a batch of %" PRIu32 " port pairs "
+			    "(limit is %d)", client->control->name,
+			    req->x.batch.npairs, JACK_PORT_BATCH_MAX);
+		return -1;
+	}
+
+	size = 2 * req->x.batch.npairs * JACK_PORT_NAME_SIZE;
+
+	if ((ports = (char*)malloc (size)) == NULL) {
+		jack_error ("cannot allocate %zu bytes for a port batch", size);
+		return -1;
+	}
+
+	for (got = 0; got < size; got += r) {
+		if ((r = read (client->request_fd, ports + got, size - got)) <= 0) {
+			if (r < 0 && errno == EINTR) {
+				r = 0;
+				continue;
+			}
+			jack_error ("cannot read port batch from client (%d/%zu/%s)",
+				    (int)r, size, strerror (errno));
+			free (ports);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < 2 * req->x.batch.npairs; i++) {
+		ports[(i + 1) * JACK_PORT_NAME_SIZE - 1] = '\0';
+	}
+
+	req->x.batch.ports = ports;
+
+	return 0;
+}
+
+static int
+jack_read_request_data (jack_client_internal_t *client, void *data, size_t size)
+{
+	size_t got;
+	ssize_t r;
+
+	for (got = 0; got < size; got += r) {
+		if ((r = read (client->request_fd, (char*)data + got, size - got)) <= 0) {
+			if (r < 0 && errno == EINTR) {
+				r = 0;
+				continue;
+			}
+			jack_error ("cannot read request data from client (%d/%zu/%s)",
+				    (int)r, size, strerror (errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+jack_read_port_registration (jack_client_internal_t *client, jack_request_t *req)
+{
+	uint32_t n = req->x.port_batch.nports;
+	uint32_t i;
+
+	/* the names (RegisterPorts) or ids (UnRegisterPorts) follow
+	   the request, see oop_client_deliver_request()
+	 */
+
+	req->x.port_batch.names = NULL;
+	req->x.port_batch.port_ids = NULL;
+
+	if (n > JACK_PORT_BATCH_MAX) {
+		jack_error ("client %s sent a batch of %" PRIu32 " ports "
+			    "(limit is %d)", client->control->name,
+			    n, JACK_PORT_BATCH_MAX);
+		return -1;
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if ((req->x.port_batch.port_ids = (jack_port_id_t*)
+					  malloc (n * sizeof(jack_port_id_t))) == NULL) {
+		return -1;
+	}
+
+	if (req->type == UnRegisterPorts) {
+		return jack_read_request_data (client, req->x.port_batch.port_ids,
+					       n * sizeof(jack_port_id_t));
+	}
+
+	if ((req->x.port_batch.names = (char*)malloc (n * JACK_PORT_NAME_SIZE)) == NULL ||
+	    jack_read_request_data (client, req->x.port_batch.names,
+				    n * JACK_PORT_NAME_SIZE)) {
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		req->x.port_batch.names[(i + 1) * JACK_PORT_NAME_SIZE - 1] = '\0';
+	}
+
+	return 0;
+}
+
+static int
+handle_shm_client_request (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	/* CALLER holds read lock on graph */
+
+	jack_client_control_t *ctl = client->control;
+	jack_request_t *slot = jack_client_request_slot (ctl);
+	jack_request_t req;
+	int reply_fd;
+	int size;
+	char bell;
+	ssize_t r;
+
+	/* the doorbell */
+	if ((r = read (client->request_fd, &bell, 1)) != 1) {
+		if (r == 0) {
+			return 1;
+		}
+		jack_error ("cannot read request doorbell from client (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	/* work on a copy, the client could change the slot under us */
+
+	req.type = slot->type;
+
+	if ((size = jack_request_payload (req.type)) < 0) {
+		jack_error ("client %s posted request type %" PRIu32 " that "
+			    "needs the socket", ctl->name, req.type);
+		req.status = -1;
+	} else {
+		memcpy (&req.x, &slot->x, size);
+		reply_fd = client->request_fd;
+
+		jack_unlock_graph (engine);
+		do_request (engine, &req, &reply_fd);
+		jack_lock_graph (engine);
+
+		memcpy (&slot->x, &req.x, size);
+	}
+
+	slot->status = req.status;
+	__atomic_store_n (&ctl->request_state, JackRequestDone, __ATOMIC_RELEASE);
+	jack_futex_wake (&ctl->request_state, 1);
+
+	return 0;
+}
+
+static int
+handle_external_client_request (jack_engine_t *engine, int fd)
+{
+	/* CALLER holds read lock on graph */
+
+	jack_request_t req;
+	jack_client_internal_t *client = 0;
+	int reply_fd;
+	JSList *node;
+	ssize_t r;
+	int ret = 0;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		if (((jack_client_internal_t*)node->data)->request_fd == fd) {
+			client = (jack_client_internal_t*)node->data;
+			break;
+		}
+	}
+
+	if (client == NULL) {
+		jack_error ("client input on unknown fd %d!", fd);
+		return -1;
+	}
+
+	if (__atomic_load_n (&client->control->request_state, __ATOMIC_ACQUIRE)
+	    == JackRequestPosted) {
+		return handle_shm_client_request (engine, client);
+	}
+
+	if ((r = read (client->request_fd, &req, sizeof(req)))
+	    < (ssize_t)sizeof(req)) {
+		if (r == 0) {
+#if defined(JACK_USE_MACH_THREADS) || defined(__OpenBSD__)
+			/* poll is implemented using
+			   select (see the macosx/fakepoll
+			   code). When the socket is closed
+			   select does not return any error,
+			   POLLIN is true and the next read
+			   will return 0 bytes. This
+			   behaviour is diffrent from the
+			   Linux poll behaviour. Thus we use
+			   this condition as a socket error
+			   and remove the client.
+			 */
+			jack_mark_client_socket_error (engine, fd);
+#endif                  /* JACK_USE_MACH_THREADS */
+			return 1;
+		} else {
+			jack_error ("cannot read request from client (%d/%d/%s)",
+				    r, sizeof(req), strerror (errno));
+			// XXX: shouldnt we mark this client as error now ?
+
+			return -1;
+		}
+	}
+
+	if (req.type == PropertyChangeNotify || req.type == SetProperty ||
+	    req.type == RemoveProperties) {
+		if (req.x.property.keylen > JACK_PROPSTORE_RECORD_MAX) {
+			jack_error ("client %s sent %zu bytes of metadata",
+				    client->control->name, req.x.property.keylen);
+			return -1;
+		}
+		if (req.x.property.keylen) {
+			if ((req.x.property.key = (char*)malloc (req.x.property.keylen)) == NULL) {
+				jack_error ("cannot allocate %zu bytes for a property key",
+					    req.x.property.keylen);
+				return -1;
+			}
+			if ((r = read (client->request_fd, (char*)req.x.property.key, req.x.property.keylen)) != req.x.property.keylen) {
+				jack_error ("cannot read property key from client (%d/%d/%s)",
+					    r, sizeof(req), strerror (errno));
+				free ((char*)req.x.property.key);
+				return -1;
+			}
+		} else {
+			req.x.property.key = 0;
+		}
+	}
+
+	if (req.type == ConnectPortsBatch || req.type == DisconnectPortsBatch) {
+		if (jack_read_port_batch (client, &req)) {
+			return -1;
+		}
+	}
+
+	if (req.type == RegisterPorts || req.type == UnRegisterPorts) {
+		if (jack_read_port_registration (client, &req)) {
+			free (req.x.port_batch.names);
+			free (req.x.port_batch.port_ids);
+			return -1;
+		}
+	}
+
+	reply_fd = client->request_fd;
+
+	jack_unlock_graph (engine);
+	do_request (engine, &req, &reply_fd);
+	jack_lock_graph (engine);
+
+	if ((req.type == PropertyChangeNotify || req.type == SetProperty ||
+	     req.type == RemoveProperties) && req.x.property.key) {
+		free ((char*)req.x.property.key);
+	}
+
+	if ((req.type == ConnectPortsBatch || req.type == DisconnectPortsBatch)
+	    && req.x.batch.ports) {
+		free ((char*)req.x.batch.ports);
+	}
+
+	if (reply_fd >= 0) {
+		DEBUG ("replying to client");
+		if (write (reply_fd, &req, sizeof(req))
+		    < (ssize_t)sizeof(req)) {
+			jack_error ("cannot write request result to client");
+			ret = -1;
+		} else if (req.type == RegisterPorts && req.status == 0) {
+			/* the ids of the new ports follow the result */
+			size_t size = req.x.port_batch.nports * sizeof(jack_port_id_t);
+			if (write (reply_fd, req.x.port_batch.port_ids, size)
+			    < (ssize_t)size) {
+				jack_error ("cannot write registered port ids to client");
+				ret = -1;
+			}
+		}
+	} else {
+		DEBUG ("*not* replying to client");
+	}
+
+	if (req.type == RegisterPorts || req.type == UnRegisterPorts) {
+		free (req.x.port_batch.names);
+		free (req.x.port_batch.port_ids);
+	}
+
+	return ret;
+}
+
+static int
+handle_client_ack_connection (jack_engine_t *engine, int client_fd)
+{
+	jack_client_internal_t *client;
+	jack_client_connect_ack_request_t req;
+	jack_client_connect_ack_result_t res;
+
+	if (read (client_fd, &req, sizeof(req)) != sizeof(req)) {
+		jack_error ("cannot read ACK connection request from client");
+		return -1;
+	}
+
+	if ((client = jack_client_internal_by_id (engine, req.client_id))
+	    == NULL) {
+		jack_error ("unknown client ID in ACK connection request");
+		return -1;
+	}
+
+	client->event_fd = client_fd;
+	VERBOSE (engine, "new client %s using %d for events", client->control->name,
+		 client->event_fd);
+
+	res.status = 0;
+
+	if (write (client->event_fd, &res, sizeof(res)) != sizeof(res)) {
+		jack_error ("cannot write ACK connection response to client");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Client request sockets.
+ *
+ * With epoll, the server thread waits on one epoll set that holds the
+ * two server sockets, the cleanup FIFO and the request socket of every
+ * external client. Clients are added when they are set up and taken
+ * out when their socket fails or they are removed, so nothing has to be
+ * rebuilt per wakeup, and all the requests that are ready by then are
+ * handled under one graph lock. Zombies stay in the set, but only for
+ * hangups. Elsewhere the thread rebuilds a poll() array every time.
+ */
+
+#define JACK_SERVER_EVENTS 64
+
+void
+jack_engine_watch_client (jack_engine_t *engine, jack_client_internal_t *client)
+{
+#ifdef HAVE_EPOLL_CREATE1
+	struct epoll_event ev;
+	int events;
+
+	/* CALLER MUST HOLD GRAPH LOCK */
+
+	if (engine->epoll_fd < 0 || client->request_fd < 0 ||
+	    client->error >= JACK_ERROR_WITH_SOCKETS) {
+		return;
+	}
+
+	/* errors and hangups are always reported */
+	events = client->control->dead ? 0 : (EPOLLIN | EPOLLPRI);
+
+	if (events == client->watch_events) {
+		return;
+	}
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = client->request_fd;
+
+	if (epoll_ctl (engine->epoll_fd,
+		       client->watch_events < 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+		       client->request_fd, &ev)) {
+		jack_error ("cannot watch request socket of client %s (%s)",
+			    client->control->name, strerror (errno));
+		return;
+	}
+
+	client->watch_events = events;
+#endif  /* HAVE_EPOLL_CREATE1 */
+}
+
+void
+jack_engine_unwatch_client (jack_engine_t *engine, jack_client_internal_t *client)
+{
+#ifdef HAVE_EPOLL_CREATE1
+	struct epoll_event ev;
+
+	/* CALLER MUST HOLD GRAPH LOCK */
+
+	/* kernels before 2.6.9 want a non-NULL event, even for DEL */
+	memset (&ev, 0, sizeof(ev));
+
+	/* once it has fired, the pidfd would fire forever */
+	if (client->pid_fd >= 0 && engine->epoll_fd >= 0) {
+		epoll_ctl (engine->epoll_fd, EPOLL_CTL_DEL, client->pid_fd, &ev);
+	}
+
+	if (client->watch_events < 0) {
+		return;
+	}
+
+	epoll_ctl (engine->epoll_fd, EPOLL_CTL_DEL, client->request_fd, &ev);
+	client->watch_events = -1;
+#endif  /* HAVE_EPOLL_CREATE1 */
+}
+
+/* Client processes.
+ *
+ * On Linux 5.3 and later every external client also gets a pidfd for
+ * the process at the other end of its request socket, in the server
+ * thread's poll set next to the socket. It becomes readable when the
+ * process exits, so a client that dies is seen at once, even in the
+ * middle of a cycle, and jack_deliver_event() and
+ * jack_check_client_status() need not kill(2) it to find out.
+ * Elsewhere, or when the kernel says no, client->pid_fd stays -1 and
+ * kill(pid, 0) does the job as before.
+ */
+
+void
+jack_engine_watch_pid (jack_engine_t *engine, jack_client_internal_t *client)
+{
+#if defined(SO_PEERCRED) && defined(SYS_pidfd_open)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+#ifdef HAVE_EPOLL_CREATE1
+	struct epoll_event ev;
+#endif
+
+	/* CALLER MUST HOLD GRAPH LOCK */
+
+	if (client->pid_fd >= 0 || client->request_fd < 0) {
+		return;
+	}
+
+	if (getsockopt (client->request_fd, SOL_SOCKET, SO_PEERCRED,
+			&cred, &len) || cred.pid <= 0) {
+		return;
+	}
+
+	if ((client->pid_fd = syscall (SYS_pidfd_open, cred.pid, 0)) < 0) {
+		VERBOSE (engine, "no pidfd for client %s (%s)",
+			 client->control->name, strerror (errno));
+		client->pid_fd = -1;
+		return;
+	}
+
+	fcntl (client->pid_fd, F_SETFD, FD_CLOEXEC);
+
+#ifdef HAVE_EPOLL_CREATE1
+	if (engine->epoll_fd >= 0) {
+		memset (&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = client->pid_fd;
+		if (epoll_ctl (engine->epoll_fd, EPOLL_CTL_ADD,
+			       client->pid_fd, &ev)) {
+			close (client->pid_fd);
+			client->pid_fd = -1;
+		}
+	}
+#endif  /* HAVE_EPOLL_CREATE1 */
+#endif  /* SO_PEERCRED && SYS_pidfd_open */
+}
+
+/* has the process of external client `client' gone? */
+static int
+jack_client_process_gone (jack_client_internal_t *client)
+{
+	struct pollfd pfd;
+
+	if (client->pid_fd < 0) {
+		return kill (client->control->pid, 0) != 0;
+	}
+
+	pfd.fd = client->pid_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return poll (&pfd, 1, 0) > 0;
+}
+
+#ifdef HAVE_EPOLL_CREATE1
+static int
+jack_engine_watch_fd (jack_engine_t *engine, int fd)
+{
+	struct epoll_event ev;
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl (engine->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static short
+jack_epoll_revents (uint32_t events)
+{
+	return ((events & EPOLLIN) ? POLLIN : 0)
+	       | ((events & EPOLLPRI) ? POLLPRI : 0)
+	       | ((events & EPOLLERR) ? POLLERR : 0)
+	       | ((events & EPOLLHUP) ? POLLHUP : 0);
+}
+#endif  /* HAVE_EPOLL_CREATE1 */
+
+static void
+jack_server_client_events (jack_engine_t *engine, int fd, short revents)
+{
+	/* CALLER holds read lock on graph */
+
+	if (revents && jack_mark_client_exited (engine, fd)) {
+		jack_engine_signal_problems (engine);
+	} else if (revents & ~POLLIN) {
+
+		jack_mark_client_socket_error (engine, fd);
+		jack_engine_signal_problems (engine);
+		VERBOSE (engine, "non-POLLIN events on fd %d", fd);
+	} else if (revents & POLLIN) {
+
+		if (handle_external_client_request (engine, fd)) {
+			jack_error ("could not handle external"
+				    " client request");
+			jack_engine_signal_problems (engine);
+		}
+	}
+}
+
+static void *
+jack_server_thread (void *arg)
+
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+	struct sockaddr_un client_addr;
+	socklen_t client_addrlen;
+	int problemsProblemsPROBLEMS = 0;
+	int client_socket;
+	int done = 0;
+	int i;
+	int stop_freewheeling;
+	short server_events, ack_events, cleanup_events;
+
+#ifdef HAVE_EPOLL_CREATE1
+	struct epoll_event events[JACK_SERVER_EVENTS];
+	int nevents;
+#else
+	const int fixed_fd_cnt = 3;
+#endif
+
+	while (!done) {
+#ifdef HAVE_EPOLL_CREATE1
+
+		/* go to sleep for a long, long time, or until a request
+		   arrives, or until a communication channel is broken
+		 */
+
+		if ((nevents = epoll_wait (engine->epoll_fd, events,
+					   JACK_SERVER_EVENTS,
+					   jack_server_timeout (engine))) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			jack_error ("epoll_wait failed (%s)", strerror (errno));
+			break;
+		}
+
+		VERBOSE (engine, "server thread back from epoll_wait, %d events",
+			 nevents);
+
+		pthread_testcancel ();
+
+		server_events = ack_events = cleanup_events = 0;
+
+		for (i = 0; i < nevents; i++) {
+			if (events[i].data.fd == engine->fds[0]) {
+				server_events = jack_epoll_revents (events[i].events);
+			} else if (events[i].data.fd == engine->fds[1]) {
+				ack_events = jack_epoll_revents (events[i].events);
+			} else if (events[i].data.fd == engine->cleanup_fifo[0]) {
+				cleanup_events = jack_epoll_revents (events[i].events);
+			}
+		}
+
+#else   /* !HAVE_EPOLL_CREATE1 */
+		JSList* node;
+		int clients;
+
+		jack_rdlock_graph (engine);
+
+		clients = jack_slist_length (engine->clients);
+
+		/* a request socket and a pidfd each */
+		clients *= 2;
+
+		if (engine->pfd_size < fixed_fd_cnt + clients) {
+			if (engine->pfd) {
+				free (engine->pfd);
+			}
+
+			engine->pfd = (struct pollfd*)malloc (sizeof(struct pollfd) *
+							      (fixed_fd_cnt + clients));
+
+			if (engine->pfd == NULL) {
+				/*
+				 * this can happen if limits.conf was changed
+				 * but the user hasn't logged out and back in yet
+				 */
+				if (errno == EAGAIN) {
+					jack_error ("malloc failed (%s) - make"
+						    "sure you log out and back"
+						    "in after changing limits"
+						    ".conf!", strerror (errno));
+				} else {
+					jack_error ("malloc failed (%s)", strerror (errno));
+				}
+
+				break;
+			}
+		}
+
+		engine->pfd[0].fd = engine->fds[0];
+		engine->pfd[0].events = POLLIN | POLLERR;
+		engine->pfd[1].fd = engine->fds[1];
+		engine->pfd[1].events = POLLIN | POLLERR;
+		engine->pfd[2].fd = engine->cleanup_fifo[0];
+		engine->pfd[2].events = POLLIN | POLLERR;
+		engine->pfd_max = fixed_fd_cnt;
+
+		for (node = engine->clients; node; node = node->next) {
+
+			jack_client_internal_t* client = (jack_client_internal_t*)(node->data);
+
+			if (client->request_fd < 0 || client->error >= JACK_ERROR_WITH_SOCKETS) {
+				continue;
+			}
+			if ( client->control->dead ) {
+				engine->pfd[engine->pfd_max].fd = client->request_fd;
+				engine->pfd[engine->pfd_max].events = POLLHUP | POLLNVAL;
+				engine->pfd_max++;
+				continue;
+			}
+			engine->pfd[engine->pfd_max].fd = client->request_fd;
+			engine->pfd[engine->pfd_max].events = POLLIN | POLLPRI | POLLERR | POLLHUP | POLLNVAL;
+			engine->pfd_max++;
+			if (client->pid_fd >= 0) {
+				engine->pfd[engine->pfd_max].fd = client->pid_fd;
+				engine->pfd[engine->pfd_max].events = POLLIN;
+				engine->pfd_max++;
+			}
+		}
+
+		jack_unlock_graph (engine);
+
+		VERBOSE (engine, "start poll on %d fd's", engine->pfd_max);
+
+		/* go to sleep for a long, long time, or until a request
+		   arrives, or until a communication channel is broken
+		 */
+
+		if (poll (engine->pfd, engine->pfd_max,
+			  jack_server_timeout (engine)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			jack_error ("poll failed (%s)", strerror (errno));
+			break;
+		}
+
+		VERBOSE (engine, "server thread back from poll");
+
+		/* Stephane Letz: letz@grame.fr : has to be added
+		 * otherwise pthread_cancel() does not work on MacOSX */
+		pthread_testcancel ();
+
+		server_events = engine->pfd[0].revents;
+		ack_events = engine->pfd[1].revents;
+		cleanup_events = engine->pfd[2].revents;
+#endif  /* HAVE_EPOLL_CREATE1 */
+
+		/* empty cleanup FIFO if necessary */
+
+		if (cleanup_events & ~POLLIN) {
+			/* time to die */
+			break;
+		}
+
+		if (cleanup_events & POLLIN) {
+			char c;
+			while (read (engine->cleanup_fifo[0], &c, 1) == 1) ;
+		}
+
+		/* check each client socket before handling other request*/
+
+		jack_rdlock_graph (engine);
+
+#ifdef HAVE_EPOLL_CREATE1
+		for (i = 0; i < nevents; i++) {
+			if (events[i].data.fd != engine->fds[0] &&
+			    events[i].data.fd != engine->fds[1] &&
+			    events[i].data.fd != engine->cleanup_fifo[0]) {
+				jack_server_client_events (engine, events[i].data.fd,
+							   jack_epoll_revents (events[i].events));
+			}
+		}
+#else
+		for (i = fixed_fd_cnt; i < engine->pfd_max; i++) {
+
+			if (engine->pfd[i].fd < 0) {
+				continue;
+			}
+
+			jack_server_client_events (engine, engine->pfd[i].fd,
+						   engine->pfd[i].revents);
+		}
+#endif
+
+		problemsProblemsPROBLEMS = engine->problems;
+
+		jack_unlock_graph (engine);
+
+		/* need to take write lock since we may/will rip out some clients,
+		   and reset engine->problems
+		 */
+
+		stop_freewheeling = 0;
+
+		while (problemsProblemsPROBLEMS) {
+
+			VERBOSE (engine, "trying to lock graph to remove %d problems", problemsProblemsPROBLEMS);
+			jack_lock_graph (engine);
+			VERBOSE (engine, "we have problem clients (problems = %d", problemsProblemsPROBLEMS);
+			jack_remove_clients (engine, &stop_freewheeling);
+			if (stop_freewheeling) {
+				VERBOSE (engine, "need to stop freewheeling once problems are cleared");
+			}
+			jack_unlock_graph (engine);
+
+			/* the failed clients are out of the processing
+			   chain now: tell the others about it while the
+			   graph runs, then get rid of them for good.
+			 */
+
+			jack_rdlock_graph (engine);
+			jack_send_disconnect_notices (engine);
+			jack_unlock_graph (engine);
+
+			jack_lock_graph (engine);
+			jack_teardown_clients (engine);
+			jack_unlock_graph (engine);
+
+			jack_lock_problems (engine);
+			engine->problems -= problemsProblemsPROBLEMS;
+			problemsProblemsPROBLEMS = engine->problems;
+			jack_unlock_problems (engine);
+
+			VERBOSE (engine, "after removing clients, problems = %d", problemsProblemsPROBLEMS);
+		}
+
+		if (engine->freewheeling && stop_freewheeling) {
+			jack_stop_freewheeling (engine, 0);
+		}
+
+		if (engine->graph_epoch_pending &&
+		    jack_graph_epoch_timeout (engine) == 0) {
+			jack_rdlock_graph (engine);
+			jack_graph_epoch_flush (engine);
+			jack_unlock_graph (engine);
+		}
+
+		if (engine->session_reply_fd >= 0 &&
+		    jack_get_microseconds () >= engine->session_deadline) {
+			jack_rdlock_graph (engine);
+			jack_session_expire (engine);
+			jack_unlock_graph (engine);
+		}
+
+		/* check the master server socket */
+
+		if (server_events & POLLERR) {
+			jack_error ("error on server socket");
+			break;
+		}
+
+		if (engine->control->engine_ok && server_events & POLLIN) {
+			DEBUG ("server socket POLLIN");
+
+			memset (&client_addr, 0, sizeof(client_addr));
+			client_addrlen = sizeof(client_addr);
+
+			if ((client_socket =
+				     accept (engine->fds[0],
+					     (struct sockaddr*)&client_addr,
+					     &client_addrlen)) < 0) {
+				jack_error ("cannot accept new connection (%s)",
+					    strerror (errno));
+			} else if (!engine->new_clients_allowed || jack_client_create (engine, client_socket) < 0) {
+				jack_error ("cannot complete client "
+					    "connection process");
+				close (client_socket);
+			}
+		}
+
+		/* check the ACK server socket */
+
+		if (ack_events & POLLERR) {
+			jack_error ("error on server ACK socket");
+			break;
+		}
+
+		if (engine->control->engine_ok && ack_events & POLLIN) {
+			DEBUG ("ACK socket POLLIN");
+
+			memset (&client_addr, 0, sizeof(client_addr));
+			client_addrlen = sizeof(client_addr);
+
+			if ((client_socket =
+				     accept (engine->fds[1],
+					     (struct sockaddr*)&client_addr,
+					     &client_addrlen)) < 0) {
+				jack_error ("cannot accept new ACK connection"
+					    " (%s)", strerror (errno));
+			} else if (handle_client_ack_connection
+					   (engine, client_socket)) {
+				jack_error ("cannot complete client ACK "
+					    "connection process");
+				close (client_socket);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* the lowest numbered cpu that shares an L2 cache with `cpu', or
+   `cpu' itself if the cache topology is not known (it is read from
+   sysfs, so only Linux knows it).
+ */
+static int
+jack_cpu_l2_domain (int cpu)
+{
+	char path[PATH_MAX + 1];
+	char buf[1024];
+	FILE *f;
+	int index, level, first;
+
+	for (index = 0;; index++) {
+		snprintf (path, sizeof(path),
+			  "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+			  cpu, index);
+		if ((f = fopen (path, "r")) == NULL) {
+			break;
+		}
+		if (fscanf (f, "%d", &level) != 1) {
+			level = 0;
+		}
+		fclose (f);
+
+		if (level != 2) {
+			continue;
+		}
+
+		snprintf (path, sizeof(path),
+			  "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+			  cpu, index);
+		if ((f = fopen (path, "r")) == NULL) {
+			break;
+		}
+		if (fgets (buf, sizeof(buf), f) == NULL) {
+			buf[0] = '\0';
+		}
+		fclose (f);
+
+		buf[strcspn (buf, "\n")] = '\0';
+		if (jack_cpu_list_parse (buf, &first, 1) > 0) {
+			return first;
+		}
+		break;
+	}
+
+	return cpu;
+}
+
+/* keep the cpus of `list' for jack_engine_suggest_cpus(), grouped by
+   the L2 cache they share
+ */
+static void
+jack_engine_set_client_cpus (jack_engine_t *engine, const char *list)
+{
+	int *cpus, *domain;
+	int n, i, j, cpu, dom;
+
+	if ((n = jack_cpu_list_parse (list, NULL, 0)) <= 0) {
+		jack_error ("invalid client cpu list \"%s\", ignored", list);
+		return;
+	}
+
+	cpus = (int*)malloc (n * sizeof(int));
+	domain = (int*)malloc (n * sizeof(int));
+
+	if (cpus == NULL || domain == NULL) {
+		free (cpus);
+		free (domain);
+		return;
+	}
+
+	jack_cpu_list_parse (list, cpus, n);
+
+	for (i = 0; i < n; i++) {
+		domain[i] = jack_cpu_l2_domain (cpus[i]);
+	}
+
+	/* a stable sort by domain: the list is in ascending order, so
+	   this keeps domains in the order of their lowest cpu, and
+	   cpus ascending within each domain */
+
+	for (i = 1; i < n; i++) {
+		cpu = cpus[i];
+		dom = domain[i];
+		for (j = i; j > 0 && domain[j - 1] > dom; j--) {
+			cpus[j] = cpus[j - 1];
+			domain[j] = domain[j - 1];
+		}
+		cpus[j] = cpu;
+		domain[j] = dom;
+	}
+
+	for (i = 0; i < n; i++) {
+		VERBOSE (engine, "client cpu %d: %d (L2 shared with cpu %d)",
+			 i, cpus[i], domain[i]);
+	}
+
+	free (domain);
+	engine->client_cpus = cpus;
+	engine->nclient_cpus = n;
+}
+
+jack_engine_t *
+jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
+		 const char *server_name, int temporary, int verbose,
+		 int client_timeout, unsigned int port_max, pid_t wait_pid,
+		 jack_nframes_t frame_time_offset, int nozombies, int timeout_count_threshold,
+		 int parallel, unsigned int pipeline_stages,
+		 int activation_type, const char *trace_file,
+		 jack_nframes_t freewheel_period, int freewheel_parallel,
+		 int hugepages, uint32_t load_window, const char *engine_cpus,
+		 const char *client_cpus, int deadline, int slave_threads,
+		 jack_nframes_t max_buffer_size, int pm_qos,
+		 float dll_bandwidth, unsigned int internal_threads,
+		 int freewheel_keep_driver, const char *metadata_file,
+		 int share_buffers, const char *checkpoint_file,
+		 unsigned int spin_usecs, int cpu_times, JSList *drivers)
+{
+	jack_engine_t *engine;
+	unsigned int i;
+	unsigned int port_hash_size;
+	size_t port_hash_offset;
+	size_t timing_offset;
+	size_t xrun_reports_offset;
+	char server_dir[PATH_MAX + 1] = "";
+
+#ifdef USE_CAPABILITIES
+	uid_t uid = getuid ();
+	uid_t euid = geteuid ();
+#endif  /* USE_CAPABILITIES */
+
+	/* before we start allocating resources, make sure that if realtime was requested that we can
+	   actually do it.
+	 */
+
+	if (realtime) {
+		if (jack_acquire_real_time_scheduling (pthread_self (), 10) != 0) {
+			/* can't run realtime - time to bomb */
+			return NULL;
+		}
+
+		jack_drop_real_time_scheduling (pthread_self ());
+
+#ifdef USE_MLOCK
+
+		if (do_mlock && (mlockall (MCL_CURRENT | MCL_FUTURE) != 0)) {
+			jack_error ("cannot lock down memory for jackd (%s)",
+				    strerror (errno));
+#ifdef ENSURE_MLOCK
+			return NULL;
+#endif  /* ENSURE_MLOCK */
+		}
+#endif  /* USE_MLOCK */
+	}
+
+	/* start a thread to display messages from realtime threads */
+	jack_messagebuffer_init ();
+
+	jack_init_time ();
+
+	/* allocate the engine, zero the structure to ease debugging */
+	engine = (jack_engine_t*)calloc (1, sizeof(jack_engine_t));
+
+	engine->drivers = drivers;
+	engine->driver = NULL;
+	engine->driver_desc = NULL;
+	engine->driver_params = NULL;
+
+	engine->slave_drivers = NULL;
+	engine->slave_io = NULL;
+	engine->slave_threads = slave_threads;
+	engine->workers = NULL;
+	engine->nworkers = internal_threads;
+	engine->steal_deques = NULL;
+	engine->nsteal_deques = 0;
+	engine->steal_left = 0;
+	engine->steal_sleeping = 0;
+	engine->max_buffer_size = max_buffer_size;
+	engine->port_buffer_frames = 0;
+	engine->pm_qos = pm_qos;
+	engine->pm_qos_fd = -1;
+	engine->pm_qos_usecs = 0;
+	engine->dll_bandwidth = dll_bandwidth > 0.0f ?
+				dll_bandwidth : JACK_DLL_BANDWIDTH;
+
+	engine->set_sample_rate = jack_set_sample_rate;
+	engine->set_buffer_size = jack_driver_buffer_size;
+	engine->run_cycle = jack_run_cycle;
+	engine->delay = jack_engine_delay;
+	engine->driver_exit = jack_engine_driver_exit;
+	engine->transport_cycle_start = jack_transport_cycle_start;
+	engine->client_timeout_msecs = client_timeout;
+	engine->timeout_count = 0;
+	engine->late_since = 0;
+	engine->problems = 0;
+
+	/* this is only the initial size of the port table */
+	engine->port_max = port_max ? port_max : 1;
+	engine->hugepages = hugepages;
+	engine->share_buffers = share_buffers;
+	engine->share_pool = NULL;
+	engine->server_thread = 0;
+	engine->rtpriority = rtpriority;
+	engine->silent_buffer = 0;
+	engine->verbose = verbose;
+	engine->server_name = server_name;
+	engine->temporary = temporary;
+	engine->freewheeling = 0;
+	engine->stop_freewheeling = 0;
+	if (freewheel_period && !jack_power_of_two (freewheel_period)) {
+		jack_error ("freewheel period %" PRIu32 " not a power of 2, "
+			    "ignored", freewheel_period);
+		freewheel_period = 0;
+	}
+	engine->freewheel_period = freewheel_period;
+	engine->freewheel_parallel = freewheel_parallel;
+	engine->saved_buffer_size = 0;
+	engine->saved_parallel = 0;
+	engine->freewheel_keep_driver = freewheel_keep_driver;
+	engine->freewheel_driver_live = 0;
+	engine->freewheel_driver_idle = 0;
+	jack_uuid_clear (&engine->fwclient);
+	engine->feedbackcount = 0;
+	engine->graph_epoch_pending = FALSE;
+	engine->graph_epoch_deadline = 0;
+	engine->wait_pid = wait_pid;
+	engine->nozombies = nozombies;
+	engine->timeout_count_threshold = timeout_count_threshold;
+	/* the stages of a pipeline run side by side like the
+	   independent parts of a parallel graph */
+	if (pipeline_stages > 1) {
+		parallel = 1;
+	}
+#ifdef JACK_USE_MACH_THREADS
+	if (parallel || freewheel_parallel) {
+		jack_error ("parallel graph execution is not supported "
+			    "on this platform");
+		parallel = 0;
+		pipeline_stages = 0;
+		engine->freewheel_parallel = 0;
+	}
+#endif
+	engine->parallel = parallel;
+	engine->pipeline_stages = pipeline_stages;
+	engine->dag_nstages = 0;
+	if (!parallel && !engine->freewheel_parallel) {
+		/* nothing runs beside the internal clients */
+		engine->nworkers = 0;
+	}
+#if !JACK_HAVE_FUTEX
+	if (activation_type == JackActivationFutex) {
+		jack_error ("futex activation is not supported on this "
+			    "platform, using FIFOs");
+		activation_type = JackActivationFIFO;
+	}
+#endif
+	memset (engine->activation_used, 0, sizeof(engine->activation_used));
+	engine->plan = NULL;
+	engine->dag_clients = NULL;
+	engine->dag_ready = NULL;
+	engine->dag_order = NULL;
+	engine->dag_nclients = 0;
+	engine->dag_running = NULL;
+	engine->dag_pfd = NULL;
+	engine->dag_size = 0;
+	engine->dag_mark = 0;
+	engine->dag_direct = 0;
+	engine->early_ports = NULL;
+	engine->early_nframes = 0;
+	engine->reach_used = NULL;
+	engine->reach_size = 0;
+	engine->reach_dirty = FALSE;
+	engine->trace = NULL;
+	if (trace_file) {
+		if ((engine->trace = jack_trace_start (trace_file)) == NULL) {
+			jack_error ("cannot trace engine cycles to %s",
+				    trace_file);
+		} else {
+			VERBOSE (engine, "tracing engine cycles to %s",
+				 trace_file);
+		}
+	}
+	engine->engine_cpus = NULL;
+	engine->client_cpus = NULL;
+	engine->nclient_cpus = 0;
+	if (engine_cpus) {
+		if (jack_cpu_list_parse (engine_cpus, NULL, 0) < 0) {
+			jack_error ("invalid engine cpu list \"%s\", ignored",
+				    engine_cpus);
+		} else {
+			engine->engine_cpus = strdup (engine_cpus);
+		}
+	}
+	if (client_cpus) {
+		jack_engine_set_client_cpus (engine, client_cpus);
+	}
+	engine->removing_clients = 0;
+	engine->defer_disconnect_notices = FALSE;
+	engine->disconnect_notices = NULL;
+	engine->new_clients_allowed = 1;
+
+	engine->session_reply_fd = -1;
+	engine->session_pending_replies = 0;
+	engine->session_started = 0;
+	engine->session_deadline = 0;
+	engine->session_replies = 0;
+	engine->session_slowest_usecs = 0;
+	engine->session_slowest[0] = '\0';
+
+	engine->audio_out_cnt = 0;
+	engine->audio_in_cnt = 0;
+	engine->midi_out_cnt = 0;
+	engine->midi_in_cnt = 0;
+
+	jack_engine_reset_rolling_usecs (engine);
+	engine->max_usecs = 0.0f;
+
+	pthread_rwlock_init (&engine->client_lock, 0);
+	pthread_mutex_init (&engine->port_lock, 0);
+	pthread_mutex_init (&engine->request_lock, 0);
+	pthread_mutex_init (&engine->problem_lock, 0);
+
+	engine->clients = 0;
+	engine->reserved_client_names = 0;
+
+	engine->pfd_size = 0;
+	engine->pfd_max = 0;
+	engine->pfd = 0;
+	engine->epoll_fd = -1;
+
+	engine->fifo_size = 16;
+	engine->fifo = (int*)malloc (sizeof(int) * engine->fifo_size);
+	for (i = 0; i < engine->fifo_size; i++)
+		engine->fifo[i] = -1;
+
+	if (pipe (engine->cleanup_fifo)) {
+		jack_error ("cannot create cleanup FIFOs (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (fcntl (engine->cleanup_fifo[0], F_SETFL, O_NONBLOCK)) {
+		jack_error ("cannot set O_NONBLOCK on cleanup read FIFO (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (fcntl (engine->cleanup_fifo[1], F_SETFL, O_NONBLOCK)) {
+		jack_error ("cannot set O_NONBLOCK on cleanup write FIFO (%s)", strerror (errno));
+		return NULL;
+	}
+
+	engine->external_client_cnt = 0;
+
+	srandom (time ((time_t*)0));
+
+	/* the port name index goes after the port array, and is kept
+	   at most half full. It is sized for the largest port table,
+	   so that it need not move when the table grows.
+	 */
+
+	for (port_hash_size = 16;
+	     port_hash_size < 2 * engine->port_max * JACK_PORT_SEGMENTS_MAX;
+	     port_hash_size <<= 1) {
+		;
+	}
+
+	port_hash_offset = (sizeof(jack_control_t)
+			    + (sizeof(jack_port_shared_t) * engine->port_max)
+			    + 7) & ~((size_t)7);
+
+	/* and the client timing table after that */
+
+	timing_offset = (port_hash_offset
+			 + (sizeof(jack_port_id_t) * port_hash_size)
+			 + 63) & ~((size_t)63);
+
+	/* and the xrun reports after that */
+
+	xrun_reports_offset = (timing_offset
+			       + (sizeof(jack_client_timing_t) * JACK_TIMING_MAX)
+			       + 63) & ~((size_t)63);
+
+	if (jack_shmalloc (xrun_reports_offset
+			   + (sizeof(jack_xrun_report_t) * JACK_XRUN_REPORTS),
+			   &engine->control_shm)) {
+		jack_error ("cannot create engine control shared memory "
+			    "segment (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (jack_attach_shm (&engine->control_shm)) {
+		jack_error ("cannot attach to engine control shared memory"
+			    " (%s)", strerror (errno));
+		jack_destroy_shm (&engine->control_shm);
+		return NULL;
+	}
+
+	engine->control = (jack_control_t*)
+			  jack_shm_addr (&engine->control_shm);
+
+	engine->control->propstore_index = JACK_SHM_NULL_INDEX;
+	if ((engine->propstore = jack_propstore_new (&engine->control->propstore_index,
+						     metadata_file)) == NULL) {
+		jack_release_shm (&engine->control_shm);
+		jack_destroy_shm (&engine->control_shm);
+		return NULL;
+	}
+	jack_property_store_attach (engine->control);
+
+	/* one segment for the control blocks of external clients, rather
+	   than one each; without it every client gets its own */
+	{
+		long page = sysconf (_SC_PAGESIZE);
+		size_t table_size = jack_client_control_slot_size ()
+				    * JACK_CLIENT_TABLE_MAX;
+
+		if (page <= 0) {
+			page = 4096;
+		}
+		table_size = (table_size + page - 1) & ~((size_t)page - 1);
+
+		memset (engine->client_table_used, 0,
+			sizeof(engine->client_table_used));
+
+		if (jack_shmalloc (table_size, &engine->client_table_shm)) {
+			jack_error ("cannot create client table shared memory"
+				    " segment (%s), clients will get one each",
+				    strerror (errno));
+			engine->client_table_shm.index = JACK_SHM_NULL_INDEX;
+		} else if (jack_attach_shm (&engine->client_table_shm)) {
+			jack_error ("cannot attach to client table shared"
+				    " memory (%s), clients will get one each",
+				    strerror (errno));
+			jack_destroy_shm (&engine->client_table_shm);
+			engine->client_table_shm.index = JACK_SHM_NULL_INDEX;
+		}
+	}
+
+	engine->checkpoint = NULL;
+	if (checkpoint_file) {
+		engine->checkpoint = jack_checkpoint_new (engine, checkpoint_file);
+	}
+
+	/* Setup port type information from builtins. buffer space is
+	 * allocated when the driver calls jack_driver_buffer_size().
+	 */
+	for (i = 0; jack_builtin_port_types[i].type_name[0]; ++i) {
+
+		memcpy (&engine->control->port_types[i],
+			&jack_builtin_port_types[i],
+			sizeof(jack_port_type_info_t));
+
+		VERBOSE (engine, "registered builtin port type %s",
+			 engine->control->port_types[i].type_name);
+
+		/* the port type id is index into port_types array */
+		engine->control->port_types[i].ptype_id = i;
+
+		/* be sure to initialize mutex correctly */
+		pthread_mutex_init (&engine->port_buffers[i].lock, NULL);
+
+		/* set buffer list info correctly */
+		engine->port_buffers[i].freelist = NULL;
+		engine->port_buffers[i].info = NULL;
+
+		/* mark each port segment as not allocated */
+		engine->port_segment[i].index = -1;
+		engine->port_segment[i].attached_at = 0;
+	}
+
+	engine->control->n_port_types = i;
+
+	/* The port table starts out as the port array in the control
+	   segment. Mark all ports as available.
+	 */
+
+	engine->control->port_max = engine->port_max;
+	engine->control->port_segment_size = engine->port_max;
+	engine->control->n_port_segments = 1;
+	engine->control->port_segment_index[0] = engine->control_shm.index;
+	memset (&engine->port_table, 0, sizeof(engine->port_table));
+	engine->port_table.segment[0] = engine->control->ports;
+	pthread_mutex_init (&engine->port_table.lock, NULL);
+
+	if (jack_port_names_alloc (engine, 0)) {
+		return NULL;
+	}
+	engine->port_table.n_segments = 1;
+
+	for (i = 0; i < engine->port_max; i++) {
+		engine->control->ports[i].in_use = 0;
+		engine->control->ports[i].id = i;
+	}
+
+	/* allocate internal port structures so that we can keep track
+	 * of port connections. Clients keep pointers to them, so
+	 * there is one for every port the table can grow to.
+	 */
+	engine->internal_ports = (jack_port_internal_t*)
+				 malloc (sizeof(jack_port_internal_t) *
+					 jack_port_table_max (engine));
+
+	for (i = 0; i < jack_port_table_max (engine); i++) {
+		engine->internal_ports[i].connections = 0;
+		engine->internal_ports[i].share_info = NULL;
+	}
+
+	if (make_sockets (engine->server_name, engine->fds) < 0) {
+		jack_error ("cannot create server sockets");
+		return NULL;
+	}
+
+#ifdef USE_MEMFD_SHM
+	/* clients get the segments from here, see libjack/shm.c */
+	if (jack_shm_broker_start ()) {
+		return NULL;
+	}
+#endif
+
+#ifdef HAVE_EPOLL_CREATE1
+	if ((engine->epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) < 0 ||
+	    jack_engine_watch_fd (engine, engine->fds[0]) ||
+	    jack_engine_watch_fd (engine, engine->fds[1]) ||
+	    jack_engine_watch_fd (engine, engine->cleanup_fifo[0])) {
+		jack_error ("cannot set up the server epoll set (%s)",
+			    strerror (errno));
+		return NULL;
+	}
+#endif  /* HAVE_EPOLL_CREATE1 */
+
+	engine->control->port_hash_size = port_hash_size;
+	engine->control->port_hash_offset = port_hash_offset;
+	for (i = 0; i < port_hash_size; i++) {
+		jack_port_hash_table (engine->control)[i] = JACK_PORT_HASH_EMPTY;
+	}
+	engine->port_hash_deleted = 0;
+	engine->control->port_generation = 0;
+	engine->control->graph_epoch = 0;
+	engine->control->graph_changes_head = 0;
+	engine->control->timing_offset = timing_offset;
+	memset (jack_client_timing (engine->control, 0), 0,
+		sizeof(jack_client_timing_t) * JACK_TIMING_MAX);
+	engine->control->xrun_reports_offset = xrun_reports_offset;
+	memset (jack_xrun_report (engine->control, 0), 0,
+		sizeof(jack_xrun_report_t) * JACK_XRUN_REPORTS);
+	memset (engine->load_history, 0, sizeof(engine->load_history));
+	engine->load_history_next = 0;
+	engine->control->real_time = realtime;
+	engine->control->deadline = realtime && deadline;
+	if (deadline && !realtime) {
+		jack_error ("SCHED_DEADLINE needs realtime scheduling, ignored");
+	}
+
+	engine->control->activation_type = activation_type;
+	for (i = 0; i < JACK_ACTIVATION_MAX; i++) {
+		engine->control->activation[i].word = 0;
+		engine->control->activation[i].sleepers = 0;
+	}
+	engine->activation_used[JACK_ACTIVATION_ENGINE] = 1;
+	VERBOSE (engine, "graph activation uses %s",
+		 activation_type == JackActivationFutex ? "futexes" : "FIFOs");
+
+	/* spinning watches the activation words, FIFOs have none */
+	if (spin_usecs && activation_type != JackActivationFutex) {
+		jack_error ("--spin-wait needs futex activation, ignored");
+		spin_usecs = 0;
+	}
+	engine->control->spin_usecs = spin_usecs;
+	engine->control->cpu_times = cpu_times;
+	memset (&engine->graph_spin, 0, sizeof(engine->graph_spin));
+	engine->graph_spin.limit = spin_usecs;
+	if (spin_usecs) {
+		VERBOSE (engine, "graph waits spin for up to %u usecs",
+			 spin_usecs);
+	}
+
+	/* leave some headroom for other client threads to run
+	   with priority higher than the regular client threads
+	   but less than the server. see thread.h for
+	   jack_client_real_time_priority() and jack_client_max_real_time_priority()
+	   which are affected by this.
+	 */
+
+	engine->control->client_priority = (realtime
+					    ? engine->rtpriority - 5
+					    : 0);
+	engine->control->max_client_priority = (realtime
+						? engine->rtpriority - 1
+						: 0);
+	engine->control->do_mlock = do_mlock;
+	engine->control->do_munlock = do_unlock;
+	engine->control->cpu_load = 0;
+	memset (&engine->control->load_stats, 0,
+		sizeof(engine->control->load_stats));
+	engine->control->load_stats.window =
+		load_window ? load_window : JACK_TIMING_WINDOW;
+	engine->control->xrun_delayed_usecs = 0;
+	engine->control->max_delayed_usecs = 0;
+	engine->control->cycles = 0;
+	engine->control->cycle_serial = 0;
+	engine->control->xruns = 0;
+	engine->control->driver_wait_usecs = 0;
+	engine->control->driver_process_usecs = 0;
+	engine->control->n_counters = 0;
+
+	if (clock_source == JACK_TIMER_TSC &&
+	    jack_tsc_clock_init (&engine->control->tsc_clock, TRUE)) {
+		jack_info ("falling back to the system clock");
+		clock_source = JACK_TIMER_SYSTEM_CLOCK;
+	}
+	jack_set_clock_source (clock_source);
+	engine->control->clock_source = clock_source;
+	engine->get_microseconds = jack_get_microseconds_pointer ();
+
+	VERBOSE (engine, "clock source = %s", jack_clock_source_name (clock_source));
+
+	engine->control->frame_timer.frames = frame_time_offset;
+	engine->control->frame_timer.reset_pending = 0;
+	engine->control->frame_timer.current_wakeup = 0;
+	engine->control->frame_timer.next_wakeup = 0;
+	engine->control->frame_timer.initialized = 0;
+	engine->control->frame_timer.filter_omega = 0;  /* Initialised later */
+	engine->control->frame_timer.bandwidth = 0;     /* Initialised later */
+	engine->control->frame_timer.period_usecs = 0;  /* Initialised later */
+	engine->control->frame_timer.error_usecs = 0;
+
+	engine->first_wakeup = 1;
+
+	engine->control->buffer_size = 0;
+	jack_transport_init (engine);
+	jack_set_sample_rate (engine, 0);
+	engine->control->internal = 0;
+
+	engine->control->has_capabilities = 0;
+
+#ifdef JACK_USE_MACH_THREADS
+	/* specific resources for server/client real-time thread
+	 * communication */
+	engine->servertask = mach_task_self ();
+	if (task_get_bootstrap_port (engine->servertask, &engine->bp)) {
+		jack_error ("Jackd: Can't find bootstrap mach port");
+		return NULL;
+	}
+	engine->portnum = 0;
+	engine->control->workgroup = -1;
+#endif  /* JACK_USE_MACH_THREADS */
+
+
+#ifdef USE_CAPABILITIES
+	if (uid == 0 || euid == 0) {
+		VERBOSE (engine, "running with uid=%d and euid=%d, "
+			 "will not try to use capabilites",
+			 uid, euid);
+	} else {
+		/* only try to use capabilities if not running as root */
+		engine->control->has_capabilities = check_capabilities (engine);
+		if (engine->control->has_capabilities == 0) {
+			VERBOSE (engine, "required capabilities not "
+				 "available");
+		}
+		if (engine->verbose) {
+			size_t size;
+			cap_t cap = cap_init ();
+			capgetp (0, cap);
+			VERBOSE (engine, "capabilities: %s",
+				 cap_to_text (cap, &size));
+		}
+	}
+#endif  /* USE_CAPABILITIES */
+
+	engine->control->engine_ok = 1;
+
+	snprintf (engine->fifo_prefix, sizeof(engine->fifo_prefix),
+		  "%s/jack-ack-fifo-%d",
+		  jack_server_dir (engine->server_name, server_dir), getpid ());
+
+	(void)jack_get_fifo_fd (engine, 0);
+
+	jack_workers_start (engine);
+
+	jack_client_create_thread (NULL, &engine->server_thread, 0, FALSE,
+				   &jack_server_thread, engine);
+
+	return engine;
+}
+
+static uint32_t
+jack_xrun_usecs (jack_time_t t, jack_time_t start)
+{
+	return t > start ? (uint32_t)(t - start) : 0;
+}
+
+/* Write down the cycle before xrun number `xrun' (see
+ * jack_xrun_report_t). It runs before the engine starts the next
+ * cycle, which is what resets the clients' times.
+ */
+static void
+jack_engine_xrun_report (jack_engine_t *engine, uint32_t xrun,
+			 float delayed_usecs)
+{
+	jack_control_t *control = engine->control;
+	jack_xrun_report_t *report;
+	jack_xrun_client_t *xc;
+	jack_client_internal_t *client;
+	jack_client_control_t *ctl;
+	jack_time_t start;
+	JSList *node;
+	unsigned int i, h;
+
+	if ((report = jack_xrun_report (control, xrun)) == NULL) {
+		return;
+	}
+
+	report->seq++;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	start = control->current_time.usecs;
+
+	report->xrun = xrun;
+	report->when = jack_get_microseconds ();
+	report->cycle_usecs = start;
+	report->cycle = control->cycles;
+	report->delayed_usecs = delayed_usecs;
+	report->period_usecs = engine->driver ? engine->driver->period_usecs : 0;
+	report->driver_wait_usecs = control->driver_wait_usecs;
+	report->driver_process_usecs = control->driver_process_usecs;
+	report->recovery_usecs = control->driver_recovery_usecs;
+	report->graph_epoch = control->graph_epoch;
+	report->current_client[0] = '\0';
+
+	for (i = 0, h = engine->load_history_next; i < JACK_XRUN_LOAD_HISTORY;
+	     i++, h = (h + 1) % JACK_XRUN_LOAD_HISTORY) {
+		report->load[i] = engine->load_history[h];
+	}
+
+	report->nclients = 0;
+
+	jack_rdlock_graph (engine);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		ctl = client->control;
+
+		if (!jack_client_is_runnable (client)) {
+			continue;
+		}
+
+		/* only trust current_client while it is still here */
+		if (client == engine->current_client) {
+			snprintf (report->current_client,
+				  sizeof(report->current_client), "%s",
+				  ctl->name);
+		}
+
+		if (report->nclients < JACK_XRUN_CLIENTS) {
+			xc = &report->clients[report->nclients];
+			snprintf (xc->name, sizeof(xc->name), "%s", ctl->name);
+			xc->state = ctl->state;
+			xc->signalled_usecs = jack_xrun_usecs (ctl->signalled_at, start);
+			xc->awake_usecs = jack_xrun_usecs (ctl->awake_at, start);
+			xc->finished_usecs = jack_xrun_usecs (ctl->finished_at, start);
+			xc->cpu_usecs = ctl->finished_at ? ctl->process_cpu_usecs : 0;
+			xc->preemptions = ctl->finished_at ?
+					  ctl->process_preemptions : 0;
+		}
+		report->nclients++;
+	}
+	jack_unlock_graph (engine);
+
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	report->seq++;
+}
+
+static void
+jack_engine_delay (jack_engine_t *engine, float delayed_usecs)
+{
+	jack_event_t event;
+
+	engine->control->frame_timer.reset_pending = 1;
+
+	engine->control->xrun_delayed_usecs = delayed_usecs;
+	engine->control->xruns++;
+
+	jack_engine_xrun_report (engine, engine->control->xruns, delayed_usecs);
+
+	JACK_PROBE2 (xrun, engine->control->xruns, (int64_t)delayed_usecs);
+
+	jack_trace_at (engine->trace, jack_get_microseconds (), JackTraceXRun,
+		       0, (uint32_t)delayed_usecs);
+
+	if (delayed_usecs > engine->control->max_delayed_usecs) {
+		engine->control->max_delayed_usecs = delayed_usecs;
+	}
+
+	event.type = XRun;
+
+	jack_deliver_event_to_all (engine, &event);
+}
+
+static void*
+jack_engine_freewheel (void *arg)
+{
+	jack_engine_t* engine = (jack_engine_t*)arg;
+	jack_client_internal_t* client;
+	jack_time_t start, now;
+	uint64_t frames = 0;
+
+	VERBOSE (engine, "freewheel thread starting ...");
+
+	if (engine->engine_cpus) {
+		jack_set_thread_cpus (pthread_self (), engine->engine_cpus);
+	}
+
+	/* we should not be running SCHED_FIFO, so we don't
+	   have to do anything about scheduling.
+	 */
+
+	client = jack_client_internal_by_id (engine, engine->fwclient);
+
+	start = jack_get_microseconds ();
+	engine->control->freewheel_rate = 0.0f;
+
+	while (!engine->stop_freewheeling) {
+
+		jack_run_one_cycle (engine, engine->control->buffer_size, 0.0f);
+
+		/* average render speed since freewheeling started,
+		   for jack_get_freewheel_rate()
+		 */
+		frames += engine->control->buffer_size;
+		now = jack_get_microseconds ();
+		if (now > start) {
+			engine->control->freewheel_rate =
+				(float)((double)frames * 1000000.0 / (now - start));
+		}
+
+		if (client && client->error) {
+			/* run one cycle() will already have told the server thread
+			   about issues, and the server thread will clean up.
+			   however, its time for us to depart this world ...
+			 */
+			break;
+		}
+	}
+
+	VERBOSE (engine, "freewheel came to an end, naturally, after %" PRIu64
+		 " frames at %.0f frames/sec", frames,
+		 engine->control->freewheel_rate);
+	return 0;
+}
+
+/* Slave driver I/O.
+ *
+ * Every slave driver has a jack_slave_io_t on engine->slave_io. With
+ * --slave-threads each of them also gets a helper thread at the
+ * engine's realtime priority: jack_drivers_read() and
+ * jack_drivers_write() hand the slaves' read (write) to their helpers,
+ * do the master's on the engine thread, and wait for every helper to
+ * finish before going on. Without it the slaves run one after the
+ * other on the engine thread, as they always did. Either way the time
+ * each driver spends in read and write goes to the timing entry of its
+ * client (see jack_drivers_record_timing()).
+ */
+typedef enum {
+	JackSlaveIdle,
+	JackSlaveRead,
+	JackSlaveWrite,
+	JackSlaveQuit
+} jack_slave_op_t;
+
+typedef struct {
+	jack_engine_t *engine;
+	jack_driver_t *driver;
+	int threaded;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	jack_slave_op_t op;             /* protected by lock */
+	jack_nframes_t nframes;
+	jack_time_t posted_at;
+	jack_time_t wake_usecs;         /* helper wakeup latency of the read */
+	jack_time_t io_usecs;           /* read plus write, this cycle */
+} jack_slave_io_t;
+
+static void
+jack_slave_io_do (jack_slave_io_t *sio, jack_slave_op_t op)
+{
+	jack_driver_t *driver = sio->driver;
+	jack_time_t start = jack_get_microseconds ();
+
+	if (op == JackSlaveRead) {
+		sio->wake_usecs = (sio->threaded && start > sio->posted_at) ?
+				  start - sio->posted_at : 0;
+		driver->read (driver, sio->nframes);
+		sio->io_usecs = jack_get_microseconds () - start;
+	} else {
+		driver->write (driver, sio->nframes);
+		sio->io_usecs += jack_get_microseconds () - start;
+	}
+}
+
+static void *
+jack_slave_io_thread (void *arg)
+{
+	jack_slave_io_t *sio = (jack_slave_io_t*)arg;
+	jack_slave_op_t op;
+
+	pthread_mutex_lock (&sio->lock);
+
+	while (1) {
+		while (sio->op == JackSlaveIdle) {
+			pthread_cond_wait (&sio->start_cond, &sio->lock);
+		}
+		if ((op = sio->op) == JackSlaveQuit) {
+			break;
+		}
+		pthread_mutex_unlock (&sio->lock);
+
+		jack_slave_io_do (sio, op);
+
+		pthread_mutex_lock (&sio->lock);
+		sio->op = JackSlaveIdle;
+		pthread_cond_signal (&sio->done_cond);
+	}
+
+	pthread_mutex_unlock (&sio->lock);
+
+	return NULL;
+}
+
+static void
+jack_slave_io_start (jack_slave_io_t *sio, jack_slave_op_t op,
+		     jack_nframes_t nframes)
+{
+	if (!sio->threaded) {
+		sio->nframes = nframes;
+		jack_slave_io_do (sio, op);
+		return;
+	}
+
+	pthread_mutex_lock (&sio->lock);
+	sio->nframes = nframes;
+	sio->posted_at = jack_get_microseconds ();
+	sio->op = op;
+	pthread_cond_signal (&sio->start_cond);
+	pthread_mutex_unlock (&sio->lock);
+}
+
+static void
+jack_slave_io_wait (jack_slave_io_t *sio)
+{
+	if (!sio->threaded) {
+		return;
+	}
+
+	pthread_mutex_lock (&sio->lock);
+	while (sio->op != JackSlaveIdle) {
+		pthread_cond_wait (&sio->done_cond, &sio->lock);
+	}
+	pthread_mutex_unlock (&sio->lock);
+}
+
+static jack_slave_io_t *
+jack_slave_io_new (jack_engine_t *engine, jack_driver_t *driver)
+{
+	jack_slave_io_t *sio;
+
+	if ((sio = (jack_slave_io_t*)calloc (1, sizeof(*sio))) == NULL) {
+		return NULL;
+	}
+
+	sio->engine = engine;
+	sio->driver = driver;
+	sio->op = JackSlaveIdle;
+
+	if (!engine->slave_threads) {
+		return sio;
+	}
+
+	pthread_mutex_init (&sio->lock, NULL);
+	pthread_cond_init (&sio->start_cond, NULL);
+	pthread_cond_init (&sio->done_cond, NULL);
+
+	if (jack_client_create_thread (NULL, &sio->thread, engine->rtpriority,
+				       engine->control->real_time,
+				       jack_slave_io_thread, sio)) {
+		jack_error ("cannot create I/O thread for slave driver %s, "
+			    "running it on the driver thread",
+			    driver->internal_client->control->name);
+		pthread_cond_destroy (&sio->done_cond);
+		pthread_cond_destroy (&sio->start_cond);
+		pthread_mutex_destroy (&sio->lock);
+		return sio;
+	}
+
+	sio->threaded = 1;
+	VERBOSE (engine, "slave driver %s does its I/O on a helper thread",
+		 driver->internal_client->control->name);
+
+	return sio;
+}
+
+static void
+jack_slave_io_free (jack_slave_io_t *sio)
+{
+	if (sio->threaded) {
+		pthread_mutex_lock (&sio->lock);
+		sio->op = JackSlaveQuit;
+		pthread_cond_signal (&sio->start_cond);
+		pthread_mutex_unlock (&sio->lock);
+		pthread_join (sio->thread, NULL);
+		pthread_cond_destroy (&sio->done_cond);
+		pthread_cond_destroy (&sio->start_cond);
+		pthread_mutex_destroy (&sio->lock);
+	}
+
+	free (sio);
+}
+
+static void
+jack_slave_driver_remove (jack_engine_t *engine, jack_driver_t *sdriver)
+{
+	JSList *node;
+	jack_slave_io_t *sio;
+
+	for (node = engine->slave_io; node; node = jack_slist_next (node)) {
+		sio = (jack_slave_io_t*)node->data;
+		if (sio->driver == sdriver) {
+			engine->slave_io = jack_slist_remove (engine->slave_io, sio);
+			jack_slave_io_free (sio);
+			break;
+		}
+	}
+
+	sdriver->detach (sdriver, engine);
+	engine->slave_drivers = jack_slist_remove (engine->slave_drivers, sdriver);
+
+	jack_driver_unload (sdriver);
+}
+
+/* the buffer size the checkpoint had, if it was changed while the
+   server ran rather than on its command line: a driver that starts
+   with what the last one started with was asked for the same thing */
+static void
+jack_checkpoint_restore_buffer_size (jack_engine_t *engine)
+{
+	jack_checkpoint_t *cp = engine->checkpoint;
+
+	if (cp == NULL) {
+		return;
+	}
+
+	cp->driver_buffer_size = engine->control->buffer_size;
+
+	if (cp->buffer_size &&
+	    cp->start_buffer_size == cp->driver_buffer_size &&
+	    cp->buffer_size != engine->control->buffer_size) {
+		VERBOSE (engine, "restoring buffer size %" PRIu32 " from %s",
+			 cp->buffer_size, cp->path);
+		pthread_mutex_lock (&engine->request_lock);
+		jack_set_buffer_size_request (engine, cp->buffer_size);
+		pthread_mutex_unlock (&engine->request_lock);
+	}
+
+	cp->buffer_size = 0;
+}
+
+int
+jack_drivers_start (jack_engine_t *engine)
+{
+	JSList *node;
+	JSList *failed_drivers = NULL;
+
+	/* first start the slave drivers */
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		if (sdriver->start (sdriver)) {
+			failed_drivers = jack_slist_append (failed_drivers, sdriver);
+		}
+	}
+
+	// Clean up drivers which failed to start.
+	for (node = failed_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		jack_error ( "slave driver %s failed to start, removing it", sdriver->internal_client->control->name );
+		jack_slave_driver_remove (engine, sdriver);
+	}
+
+	/* now the master driver is started */
+	if (engine->driver->start (engine->driver)) {
+		return -1;
+	}
+
+	jack_checkpoint_restore_buffer_size (engine);
+
+	jack_pm_qos_update (engine);
+
+	return 0;
+}
+
+static int
+jack_drivers_stop (jack_engine_t *engine)
+{
+	JSList *node;
+	/* first stop the master driver */
+	int retval = engine->driver->stop (engine->driver);
+
+	jack_pm_qos_release (engine);
+
+	/* now the slave drivers are stopped */
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		sdriver->stop ( sdriver );
+	}
+
+	return retval;
+}
+
+/* keep every driver going without the engine, for freewheeling with
+   --freewheel-keep-driver */
+static void
+jack_drivers_null_cycle (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	JSList *node;
+	jack_driver_t *sdriver;
+
+	engine->driver->null_cycle (engine->driver, nframes);
+
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		sdriver = (jack_driver_t*)node->data;
+		sdriver->null_cycle (sdriver, nframes);
+	}
+}
+
+static int
+jack_drivers_read (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	JSList *node;
+	jack_time_t start;
+	int ret;
+
+	/* first start (or with no helper threads, do) the slave reads */
+	for (node = engine->slave_io; node; node = jack_slist_next (node)) {
+		jack_slave_io_start ((jack_slave_io_t*)node->data,
+				     JackSlaveRead, nframes);
+	}
+
+	/* now the master driver is read */
+	start = jack_get_microseconds ();
+	ret = engine->driver->read (engine->driver, nframes);
+	engine->driver_io_usecs = jack_get_microseconds () - start;
+
+	for (node = engine->slave_io; node; node = jack_slist_next (node)) {
+		jack_client_t *private_client = ((jack_slave_io_t*)node->data)->
+						driver->internal_client->private_client;
+
+		jack_slave_io_wait ((jack_slave_io_t*)node->data);
+		jack_client_mark_unwritten (private_client);
+		jack_client_update_meters (private_client, nframes);
+	}
+
+	/* the capture ports are the drivers' outputs */
+	jack_client_mark_unwritten (engine->driver->internal_client->private_client);
+	jack_client_update_meters (engine->driver->internal_client->private_client,
+				   nframes);
+
+	return ret;
+}
+
+static int
+jack_drivers_write (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	JSList *node;
+	jack_time_t start;
+	int ret;
+
+	/* first start the slave drivers */
+	for (node = engine->slave_io; node; node = jack_slist_next (node)) {
+		jack_slave_io_start ((jack_slave_io_t*)node->data,
+				     JackSlaveWrite, nframes);
+	}
+
+	/* now the master driver is written */
+	start = jack_get_microseconds ();
+	ret = engine->driver->write (engine->driver, nframes);
+	engine->driver_io_usecs += jack_get_microseconds () - start;
+
+	for (node = engine->slave_io; node; node = jack_slist_next (node)) {
+		jack_slave_io_wait ((jack_slave_io_t*)node->data);
+	}
+
+	jack_drivers_record_timing (engine);
+
+	return ret;
+}
+static int
+jack_start_freewheeling (jack_engine_t* engine, jack_uuid_t client_id)
+{
+	jack_event_t event;
+	jack_client_internal_t *client;
+
+	if (engine->freewheeling) {
+		return 0;
+	}
+
+	if (engine->driver == NULL) {
+		jack_error ("cannot start freewheeling without a driver!");
+		return -1;
+	}
+
+	/* stop driver before telling anyone about it so
+	   there are no more process() calls being handled. With
+	   --freewheel-keep-driver the hardware keeps running on null
+	   cycles instead, so that it is in step the moment freewheeling
+	   stops; that needs the buffer size to stay the same.
+	 */
+
+	engine->freewheel_driver_live = engine->freewheel_keep_driver &&
+					(engine->freewheel_period == 0 ||
+					 engine->freewheel_period ==
+					 engine->control->buffer_size);
+
+	if (engine->freewheel_driver_live) {
+		jack_pm_qos_release (engine);
+	} else if (jack_drivers_stop (engine)) {
+		jack_error ("could not stop driver for freewheeling");
+		return -1;
+	}
+
+	client = jack_client_internal_by_id (engine, client_id);
+
+	if (client->control->process_cbset || client->control->thread_cb_cbset) {
+		jack_uuid_copy (&engine->fwclient, client_id);
+	}
+
+	/* freewheeling does not need to keep latency low, so it can
+	   render with a longer period and let independent clients run
+	   at the same time.
+	 */
+
+	engine->saved_buffer_size = engine->control->buffer_size;
+	engine->saved_parallel = engine->parallel;
+
+	if (engine->freewheel_period &&
+	    engine->freewheel_period != engine->control->buffer_size) {
+		VERBOSE (engine, "freewheeling with %" PRIu32 " frame periods",
+			 engine->freewheel_period);
+		jack_freewheel_set_buffer_size (engine, engine->freewheel_period);
+	}
+
+	if (engine->freewheel_parallel && !engine->parallel) {
+		VERBOSE (engine, "freewheeling with parallel execution");
+		jack_lock_graph (engine);
+		engine->parallel = 1;
+		jack_rechain_graph (engine);
+		jack_unlock_graph (engine);
+	}
+
+	engine->freewheel_driver_idle = 0;
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	engine->freewheeling = 1;
+	engine->stop_freewheeling = 0;
+
+	if (engine->freewheel_driver_live) {
+		jack_freewheel_wait_driver (engine);
+	}
+
+	event.type = StartFreewheel;
+	jack_deliver_event_to_all (engine, &event);
+
+	if (jack_client_create_thread (NULL, &engine->freewheel_thread, 0, FALSE,
+				       jack_engine_freewheel, engine)) {
+		jack_error ("could not start create freewheel thread");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* With the driver left running, wait until its thread has seen that the
+   engine is freewheeling, and so is done with any cycle of its own,
+   before the freewheel thread starts running them. */
+static void
+jack_freewheel_wait_driver (jack_engine_t *engine)
+{
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		if (__atomic_load_n (&engine->freewheel_driver_idle,
+				     __ATOMIC_ACQUIRE)) {
+			return;
+		}
+		usleep (1000);
+	}
+
+	jack_error ("driver thread did not go idle for freewheeling");
+}
+
+/* change the buffer size while the driver is stopped for freewheeling */
+static void
+jack_freewheel_set_buffer_size (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	if (jack_driver_buffer_size (engine, nframes)) {
+		jack_error ("cannot change the buffer size to %" PRIu32
+			    " frames for freewheeling", nframes);
+		return;
+	}
+
+	jack_lock_graph (engine);
+	jack_engine_ring_relayout (engine);
+	jack_latency_mark_all (engine);
+	jack_compute_new_latency (engine);
+	jack_unlock_graph (engine);
+}
+
+int
+jack_stop_freewheeling (jack_engine_t* engine, int engine_exiting)
+{
+	jack_event_t event;
+	void *ftstatus;
+
+	if (!engine->freewheeling) {
+		return 0;
+	}
+
+	if (engine->driver == NULL) {
+		jack_error ("cannot start freewheeling without a driver!");
+		return -1;
+	}
+
+	if (!engine->freewheeling) {
+		VERBOSE (engine, "stop freewheel when not freewheeling");
+		return 0;
+	}
+
+	/* tell the freewheel thread to stop, and wait for it
+	   to exit.
+	 */
+
+	engine->stop_freewheeling = 1;
+
+	VERBOSE (engine, "freewheeling stopped, waiting for thread");
+	pthread_join (engine->freewheel_thread, &ftstatus);
+	VERBOSE (engine, "freewheel thread has returned");
+
+	jack_uuid_clear (&engine->fwclient);
+
+	/* a driver that kept running takes the next cycle; it has to
+	   see the reset first */
+	engine->control->frame_timer.reset_pending = 1;
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	engine->freewheeling = 0;
+
+	if (engine->parallel != engine->saved_parallel) {
+		jack_lock_graph (engine);
+		engine->parallel = engine->saved_parallel;
+		jack_rechain_graph (engine);
+		jack_unlock_graph (engine);
+	}
+
+	if (!engine_exiting &&
+	    engine->control->buffer_size != engine->saved_buffer_size) {
+		jack_freewheel_set_buffer_size (engine, engine->saved_buffer_size);
+	}
+
+	if (!engine_exiting) {
+		/* tell everyone we've stopped */
+
+		event.type = StopFreewheel;
+		jack_deliver_event_to_all (engine, &event);
+
+		/* restart the driver */
+
+		if (engine->freewheel_driver_live) {
+			jack_pm_qos_update (engine);
+		} else if (jack_drivers_start (engine)) {
+			jack_error ("could not restart driver after freewheeling");
+			return -1;
+		}
+	}
+
+	engine->freewheel_driver_live = 0;
+
+	return 0;
+}
+
+static int
+jack_check_client_status (jack_engine_t* engine)
+{
+	JSList *node;
+	int err = 0;
+
+	/* we are already late, or something else went wrong,
+	   so it can't hurt to check the existence of all
+	   clients.
+	 */
+
+	for (node = engine->clients; node;
+	     node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+
+		if (client->control->type == ClientExternal) {
+			if (jack_client_process_gone (client)) {
+				VERBOSE (engine,
+					 "client %s has died/exited",
+					 client->control->name);
+				client->error++;
+				err++;
+			}
+			if (client->control->last_status != 0) {
+				VERBOSE (engine,
+					 "client %s has nonzero process callback status (%d)\n",
+					 client->control->name, client->control->last_status);
+				client->error++;
+				err++;
+			}
+		}
+
+		DEBUG ("client %s errors = %d", client->control->name,
+		       client->error);
+	}
+
+	return err;
+}
+
+/* After a cycle was given up on because a client was late (see
+ * jack_check_clients()), the engine does not wait for the clients
+ * still at work on it: it runs null cycles until they are done, drops
+ * the wakeups they left behind, and goes on. A client still at it a
+ * client timeout later has timed out after all. Returns TRUE while the
+ * graph is still busy with the old cycle.
+ */
+static int
+jack_engine_late_clients (jack_engine_t *engine)
+{
+	JSList *node;
+	jack_time_t timeout_usecs;
+	int busy = 0, errs = 0;
+
+	timeout_usecs = (engine->client_timeout_msecs > 0 ?
+			 engine->client_timeout_msecs * 1000 :
+			 engine->driver->period_usecs);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+
+		if (client->error ||
+		    (client->control->state != Triggered &&
+		     client->control->state != Running)) {
+			continue;
+		}
+
+		if (jack_get_microseconds () - engine->late_since > timeout_usecs) {
+			VERBOSE (engine, "client %s has timed out",
+				 client->control->name);
+			client->control->timed_out++;
+			client->error++;
+			errs++;
+		}
+		busy++;
+	}
+
+	if (errs) {
+		engine->late_since = 0;
+		jack_engine_signal_problems (engine);
+		return TRUE;
+	}
+
+	if (busy) {
+		return TRUE;
+	}
+
+	jack_clear_fifos (engine);
+	engine->late_since = 0;
+
+	return FALSE;
+}
+
+static int
+jack_run_one_cycle (jack_engine_t *engine, jack_nframes_t nframes,
+		    float delayed_usecs)
+{
+	jack_driver_t* driver = engine->driver;
+	int ret = -1;
+	static int consecutive_excessive_delays = 0;
+
+#define WORK_SCALE 1.0f
+
+	if (!engine->freewheeling &&
+	    engine->control->real_time &&
+	    engine->spare_usecs &&
+	    ((WORK_SCALE * engine->spare_usecs) <= delayed_usecs)) {
+
+		MESSAGE ("delay of %.3f usecs exceeds estimated spare"
+			 " time of %.3f; restart ...\n",
+			 delayed_usecs, WORK_SCALE * engine->spare_usecs);
+
+		if (++consecutive_excessive_delays > 10) {
+			jack_error ("too many consecutive interrupt delays "
+				    "... engine pausing");
+			return -1;      /* will exit the thread loop */
+		}
+
+		jack_engine_delay (engine, delayed_usecs);
+
+		return 0;
+
+	} else {
+		consecutive_excessive_delays = 0;
+	}
+
+	DEBUG ("trying to acquire read lock (FW = %d)", engine->freewheeling);
+	if (jack_try_rdlock_graph (engine)) {
+		VERBOSE (engine, "lock-driven null cycle");
+		if (!engine->freewheeling) {
+			driver->null_cycle (driver, nframes);
+		} else {
+			/* don't return too fast */
+			usleep (1000);
+		}
+		return 0;
+	}
+
+	if (jack_trylock_problems (engine)) {
+		VERBOSE (engine, "problem-lock-driven null cycle");
+		jack_unlock_graph (engine);
+		if (!engine->freewheeling) {
+			driver->null_cycle (driver, nframes);
+		} else {
+			/* don't return too fast */
+			usleep (1000);
+		}
+		return 0;
+	}
+
+	if (engine->problems || (engine->timeout_count_threshold && (engine->timeout_count > (1 + engine->timeout_count_threshold * 1000 / engine->driver->period_usecs) ))) {
+		VERBOSE (engine, "problem-driven null cycle problems=%d", engine->problems);
+		jack_unlock_problems (engine);
+		jack_unlock_graph (engine);
+		if (!engine->freewheeling) {
+			driver->null_cycle (driver, nframes);
+		} else {
+			/* don't return too fast */
+			usleep (1000);
+		}
+		return 0;
+	}
+
+	jack_unlock_problems (engine);
+
+	if (engine->late_since && jack_engine_late_clients (engine)) {
+		VERBOSE (engine, "late-client null cycle");
+		jack_unlock_graph (engine);
+		if (!engine->freewheeling) {
+			driver->null_cycle (driver, nframes);
+		} else {
+			/* don't return too fast */
+			usleep (1000);
+		}
+		return 0;
+	}
+
+	if (!engine->freewheeling && engine->cycle_end_at &&
+	    driver->last_wait_ust > engine->cycle_end_at) {
+		engine->control->driver_wait_usecs = (uint32_t)
+			(driver->last_wait_ust - engine->cycle_end_at);
+	}
+
+	jack_trace_at (engine->trace, jack_get_microseconds (),
+		       JackTraceCycleStart, 0, nframes);
+
+	/* port buffers that clients worked out last cycle are stale now */
+	engine->control->cycle_serial++;
+
+	JACK_PROBE2 (cycle_start, engine->control->cycle_serial, nframes);
+
+	if (!engine->freewheeling) {
+		DEBUG ("waiting for driver read\n");
+		if (jack_drivers_read (engine, nframes)) {
+			goto unlock;
+		}
+		jack_trace_at (engine->trace, jack_get_microseconds (),
+			       JackTraceReadDone, 0, 0);
+	}
+
+	DEBUG ("run process\n");
+
+	if (jack_engine_process (engine, nframes) != 0) {
+		DEBUG ("engine process cycle failed");
+		jack_check_client_status (engine);
+	}
+
+	if (!engine->freewheeling) {
+		if (jack_drivers_write (engine, nframes)) {
+			goto unlock;
+		}
+		jack_trace_at (engine->trace, jack_get_microseconds (),
+			       JackTraceWriteDone, 0, 0);
+	}
+
+	jack_engine_post_process (engine);
+
+	if (delayed_usecs > engine->control->max_delayed_usecs) {
+		engine->control->max_delayed_usecs = delayed_usecs;
+	}
+
+	engine->cycle_end_at = jack_get_microseconds ();
+	if (!engine->freewheeling) {
+		engine->control->driver_process_usecs =
+			(uint32_t)engine->driver_io_usecs;
+	}
+	engine->control->cycles++;
+
+	JACK_PROBE2 (cycle_end, engine->control->cycle_serial,
+		     engine->cycle_end_at - engine->control->current_time.usecs);
+
+	ret = 0;
+
+unlock:
+	jack_unlock_graph (engine);
+	DEBUG ("cycle finished, status = %d", ret);
+
+	return ret;
+}
+
+static void
+jack_engine_driver_exit (jack_engine_t* engine)
+{
+	jack_driver_t* driver = engine->driver;
+
+	VERBOSE (engine, "stopping driver");
+	driver->stop (driver);
+	jack_pm_qos_release (engine);
+	VERBOSE (engine, "detaching driver");
+	driver->detach (driver, engine);
+
+	/* tell anyone waiting that the driver exited. */
+	kill (engine->wait_pid, SIGUSR2);
+
+	engine->driver = NULL;
+}
+
+/* The frame timer DLL starts out JACK_DLL_LOCK_FACTOR times wider than
+   engine->dll_bandwidth, so that it locks within a few dozen periods
+   after a start or an xrun, and narrows by JACK_DLL_NARROW every period
+   from there, which gets it to the configured bandwidth in well under
+   a second at usual period sizes. error_usecs follows the magnitude of
+   the phase error with a time constant of 64 periods. */
+#define JACK_DLL_LOCK_FACTOR 16.0f
+#define JACK_DLL_NARROW      0.98f
+#define JACK_DLL_ERROR_GAIN  (1.0f / 64.0f)
+
+static inline float
+jack_dll_omega (float bandwidth, float period_usecs)
+{
+	return 2.0f * (float)M_PI * bandwidth * period_usecs * 1e-6f;
+}
+
+static int
+jack_run_cycle (jack_engine_t *engine, jack_nframes_t nframes,
+		float delayed_usecs)
+{
+	jack_time_t now = engine->driver->last_wait_ust;
+	jack_time_t dus = 0;
+	jack_time_t p_usecs = engine->driver->period_usecs;
+	jack_nframes_t b_size = engine->control->buffer_size;
+	jack_nframes_t left;
+	jack_frame_timer_t* timer = &engine->control->frame_timer;
+
+	JACK_PROBE2 (driver_wait, nframes, (int64_t)delayed_usecs);
+
+	if (engine->freewheeling && engine->freewheel_driver_live) {
+		/* the freewheel thread runs the cycles; keep the
+		   hardware going on silence */
+		for (left = nframes; left >= b_size; left -= b_size) {
+			jack_drivers_null_cycle (engine, b_size);
+		}
+		__atomic_store_n (&engine->freewheel_driver_idle, 1,
+				  __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	if (engine->verbose) {
+		if (nframes != b_size) {
+			VERBOSE (engine,
+				 "late driver wakeup: nframes to process = %"
+				 PRIu32 ".", nframes);
+		}
+	}
+
+	/* Run as many cycles as it takes to consume nframes */
+
+	for (left = nframes; left >= b_size; left -= b_size) {
+		/* Change: the DLL code is now inside this loop which ensures
+		   that more than one period is run if more than a buffer size
+		   of frames is available. This is a very unlikely event, but
+		   it is possible and now handled correctly.
+		   FA 25/06/2014
+		 */
+		/* Change: 'first_wakeup' now means only the very first wakeup
+		   after the engine was created. In that case frame time is not
+		   modified, it stays at the initialised value.
+		   OTOH 'reset_pending' is  used after freewheeling or an xrun.
+		   In those cases frame time is adjusted by using the difference
+		   in usecs time between the end of the previous period and the
+		   start of the current one. This way, a client monitoring the
+		   frame time for the start of each period will have a correct
+		   idea of the number of frames that were skipped.
+		   FA 25/06/2014
+		 */
+		/* Change: in contrast to previous versions, the DLL is *not*
+		   run if any of the two conditions above is true, it is just
+		   initialised correctly for the current period. Previously it
+		   was initialised and then run, which meant that the requred
+		   initialisation was rather counter-intiutive.
+		   FA 25/06/2014
+		 */
+		/* Added initialisation of timer->period_usecs, required
+		   due to the modified implementation of the DLL itself.
+		   OTOH, this should maybe not be repeated after e.g.
+		   freewheeling or an xrun, as the current value would be
+		   more accurate than the nominal one. But it doesn't really
+		   harm either.
+		   FA 13/02/2012
+		 */
+		/* Added initialisation of timer->filter_omega. This makes
+		   the DLL bandwidth independent of the actual period time.
+		   The bandwidth is now 1/8 Hz in all cases. The value of
+		   timer->filter_omega is 2 * pi * BW * Tperiod.
+		   FA 13/02/2012
+		 */
+
+		// readers take guard2, the fields, then guard1; see
+		// jack_read_frame_time()
+		timer->guard1++;
+		__atomic_thread_fence (__ATOMIC_RELEASE);
+
+		if (timer->reset_pending) {
+			// Adjust frame time after a discontinuity.
+			// The frames of the previous period.
+			timer->frames += b_size;
+			// The frames that were skipped.
+			dus = now - timer->next_wakeup;
+			timer->frames += (dus * b_size) / p_usecs;
+		}
+		if (engine->first_wakeup || timer->reset_pending) {
+			// First wakeup or after discontinuity.
+			// Initialiase the DLL.
+			timer->current_wakeup = now;
+			timer->next_wakeup = now + p_usecs;
+			timer->period_usecs = (float)p_usecs;
+			timer->bandwidth = engine->dll_bandwidth *
+					   JACK_DLL_LOCK_FACTOR;
+			timer->filter_omega = jack_dll_omega (timer->bandwidth,
+							      timer->period_usecs);
+			timer->error_usecs = 0.0f;
+			timer->initialized = 1;
+
+			// Reset both conditions.
+			engine->first_wakeup = 0;
+			timer->reset_pending = 0;
+		} else {
+			// Normal cycle. This code was originally in
+			// jack_inc_frame_time() but only used here.
+			// Moving it here means that now all code
+			// related to timekeeping is close together
+			// and easy to understand.
+			float delta = (float)((int64_t)now - (int64_t)timer->next_wakeup);
+			timer->error_usecs += (fabsf (delta) - timer->error_usecs)
+					      * JACK_DLL_ERROR_GAIN;
+			delta *= timer->filter_omega;
+			timer->current_wakeup = timer->next_wakeup;
+			timer->frames += b_size;
+			timer->period_usecs += timer->filter_omega * delta;
+			timer->next_wakeup += (int64_t)floorf (timer->period_usecs + 1.41f * delta + 0.5f);
+
+			// Fast lock: narrow the loop down to the
+			// configured bandwidth.
+			if (timer->bandwidth > engine->dll_bandwidth) {
+				timer->bandwidth *= JACK_DLL_NARROW;
+				if (timer->bandwidth < engine->dll_bandwidth) {
+					timer->bandwidth = engine->dll_bandwidth;
+				}
+				timer->filter_omega =
+					jack_dll_omega (timer->bandwidth,
+							timer->period_usecs);
+			}
+		}
+
+		__atomic_thread_fence (__ATOMIC_RELEASE);
+		timer->guard2++;
+
+		if (jack_run_one_cycle (engine, b_size, delayed_usecs)) {
+			jack_error ("cycle execution failure, exiting");
+			return EIO;
+		}
+	}
+
+	return 0;
+}
+
+void
+jack_engine_delete (jack_engine_t *engine)
+{
+	int i;
+	JSList *node;
+
+	if (engine == NULL) {
+		return;
+	}
+
+	VERBOSE (engine, "starting server engine shutdown");
+
+	jack_stop_freewheeling (engine, 1);
+
+	/* the last snapshot has to be of the graph as it ran, so it is
+	   taken before the clients are told to go */
+	if (engine->checkpoint) {
+		jack_checkpoint_t *cp = engine->checkpoint;
+
+		jack_lock_graph (engine);
+		engine->checkpoint = NULL;
+		jack_unlock_graph (engine);
+		jack_checkpoint_delete (cp);
+	}
+
+	engine->control->engine_ok = 0; /* tell clients we're going away */
+
+	/* this will wake the server thread and cause it to exit. The
+	   write end goes first: an epoll set forgets a closed fd rather
+	   than reporting it, but it does report the hangup.
+	 */
+
+	close (engine->cleanup_fifo[1]);
+	close (engine->cleanup_fifo[0]);
+
+	/* shutdown master socket to prevent new clients arriving */
+	shutdown (engine->fds[0], SHUT_RDWR);
+	// close (engine->fds[0]);
+
+#ifdef USE_MEMFD_SHM
+	jack_shm_broker_stop ();
+#endif
+
+	/* now really tell them we're going away */
+
+	for (i = 0; i < engine->pfd_max; ++i)
+		shutdown (engine->pfd[i].fd, SHUT_RDWR);
+
+#ifdef HAVE_EPOLL_CREATE1
+	shutdown (engine->fds[1], SHUT_RDWR);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		if (client->watch_events >= 0) {
+			shutdown (client->request_fd, SHUT_RDWR);
+		}
+	}
+#endif  /* HAVE_EPOLL_CREATE1 */
+
+	if (engine->driver) {
+		jack_driver_t* driver = engine->driver;
+
+		VERBOSE (engine, "stopping driver");
+		driver->stop (driver);
+		// VERBOSE (engine, "detaching driver");
+		// driver->detach (driver, engine);
+		VERBOSE (engine, "unloading driver");
+		jack_driver_unload (driver);
+		engine->driver = NULL;
+	}
+
+	/* no cycles run any more, let the slave I/O threads go */
+	for (node = engine->slave_io; node; node = jack_slist_next (node)) {
+		jack_slave_io_free ((jack_slave_io_t*)node->data);
+	}
+	jack_slist_free (engine->slave_io);
+	engine->slave_io = NULL;
+
+	for (node = engine->workers; node; node = jack_slist_next (node)) {
+		jack_worker_free ((jack_worker_t*)node->data);
+	}
+	jack_slist_free (engine->workers);
+	engine->workers = NULL;
+	free (engine->steal_deques);
+	engine->steal_deques = NULL;
+	engine->nsteal_deques = 0;
+
+	VERBOSE (engine, "freeing shared port segments");
+	for (i = 0; i < engine->control->n_port_types; ++i) {
+		jack_release_shm (&engine->port_segment[i]);
+		jack_destroy_shm (&engine->port_segment[i]);
+	}
+
+	/* segment 0 of the port table is part of the control segment,
+	   but its names are not */
+	for (i = 0; i < engine->port_table.n_segments; ++i) {
+		if (i > 0) {
+			jack_release_shm (&engine->port_table.shm_info[i]);
+			jack_destroy_shm (&engine->port_table.shm_info[i]);
+		}
+		jack_port_names_free (engine, i);
+	}
+
+	/* stop the other engine threads */
+	VERBOSE (engine, "stopping server thread");
+
+#if JACK_USE_MACH_THREADS
+	// MacOSX pthread_cancel still not implemented correctly in Darwin
+	mach_port_t machThread = pthread_mach_thread_np (engine->server_thread);
+	thread_terminate (machThread);
+#else
+	pthread_cancel (engine->server_thread);
+	pthread_join (engine->server_thread, NULL);
+#endif
+
+	if (engine->epoll_fd >= 0) {
+		close (engine->epoll_fd);
+	}
+
+
+	jack_trace_stop (engine->trace);
+	engine->trace = NULL;
+
+	jack_pm_qos_release (engine);
+
+	free (engine->engine_cpus);
+	free (engine->client_cpus);
+
+	VERBOSE (engine, "last xrun delay: %.3f usecs",
+		 engine->control->xrun_delayed_usecs);
+	VERBOSE (engine, "max delay reported by backend: %.3f usecs",
+		 engine->control->max_delayed_usecs);
+
+	jack_property_store_detach (engine->control);
+	jack_propstore_delete (engine->propstore);
+	engine->propstore = NULL;
+
+	/* free engine control shm segment */
+	engine->control = NULL;
+	VERBOSE (engine, "freeing engine shared memory");
+	jack_release_shm (&engine->control_shm);
+	jack_destroy_shm (&engine->control_shm);
+
+	if (engine->client_table_shm.index != JACK_SHM_NULL_INDEX) {
+		jack_release_shm (&engine->client_table_shm);
+		jack_destroy_shm (&engine->client_table_shm);
+	}
+
+	VERBOSE (engine, "max usecs: %.3f, engine deleted", engine->max_usecs);
+
+	free (engine->plan);
+	bitset_destroy (&engine->reach_used);
+	jack_slist_free (engine->dag_clients);
+	jack_slist_free (engine->early_ports);
+	free (engine->dag_ready);
+	free (engine->dag_order);
+	free (engine->dag_running);
+	free (engine->dag_pfd);
+
+	free (engine);
+
+	jack_messagebuffer_exit ();
+}
+
+void
+jack_port_clear_connections (jack_engine_t *engine,
+			     jack_port_internal_t *port)
+{
+	JSList *node, *next;
+
+	for (node = port->connections; node; ) {
+		next = jack_slist_next (node);
+		jack_port_disconnect_internal (
+			engine, ((jack_connection_internal_t*)
+				 node->data)->source,
+			((jack_connection_internal_t*)
+			 node->data)->destination, TRUE);
+		node = next;
+	}
+
+	jack_slist_free (port->connections);
+	port->connections = 0;
+}
+
+static void
+jack_deliver_event_to_all (jack_engine_t *engine, jack_event_t *event)
+{
+	JSList *node;
+
+	jack_rdlock_graph (engine);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_deliver_event (engine,
+				    (jack_client_internal_t*)node->data,
+				    event);
+	}
+	jack_unlock_graph (engine);
+}
+
+static void jack_do_get_client_by_uuid (jack_engine_t *engine, jack_request_t *req)
+{
+	JSList *node;
+
+	req->status = -1;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (jack_uuid_compare (client->control->uuid, req->x.client_id) == 0) {
+			snprintf ( req->x.port_info.name, sizeof(req->x.port_info.name), "%s", client->control->name );
+			req->status = 0;
+			return;
+		}
+	}
+}
+
+static void jack_do_get_uuid_by_client_name (jack_engine_t *engine, jack_request_t *req)
+{
+	JSList *node;
+
+	req->status = -1;
+
+	if (strcmp (req->x.name, "system") == 0) {
+		/* request concerns the driver */
+		if (engine->driver) {
+			jack_uuid_copy (&req->x.client_id, engine->driver->internal_client->control->uuid);
+			req->status = 0;
+		}
+		return;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (strcmp (client->control->name, req->x.name) == 0) {
+			jack_uuid_copy (&req->x.client_id, client->control->uuid);
+			req->status = 0;
+			return;
+		}
+	}
+}
+
+static void jack_do_reserve_name (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_reserved_name_t *reservation;
+
+	// check is name is free...
+	if (jack_client_lookup_name (engine, req->x.reservename.name)) {
+		req->status = -1;
+		return;
+	}
+
+	reservation = malloc (sizeof(jack_reserved_name_t));
+	if (reservation == NULL) {
+		req->status = -1;
+		return;
+	}
+
+	snprintf (reservation->name, sizeof(reservation->name), "%s", req->x.reservename.name);
+	jack_uuid_copy (&reservation->uuid, req->x.reservename.uuid);
+	jack_client_reservation_add (engine, reservation);
+
+	req->status = 0;
+}
+
+static int jack_send_session_reply ( jack_engine_t *engine, jack_client_internal_t *client )
+{
+	jack_time_t usecs = jack_get_microseconds () - client->session_sent;
+
+	VERBOSE (engine, "client %s saved its session in %lld usecs",
+		 client->control->name, usecs);
+
+	engine->session_replies++;
+	if (usecs > engine->session_slowest_usecs) {
+		engine->session_slowest_usecs = usecs;
+		snprintf (engine->session_slowest, sizeof(engine->session_slowest),
+			  "%s", client->control->name);
+	}
+
+	if (write (engine->session_reply_fd, (const void*)&client->control->uuid, sizeof(client->control->uuid))
+	    < (ssize_t)sizeof(client->control->uuid)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
+	}
+	if (write (engine->session_reply_fd, (const void*)client->control->name, sizeof(client->control->name))
+	    < (ssize_t)sizeof(client->control->name)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
+	}
+	if (write (engine->session_reply_fd, (const void*)client->control->session_command,
+		   sizeof(client->control->session_command))
+	    < (ssize_t)sizeof(client->control->session_command)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
+	}
+	if (write (engine->session_reply_fd, (const void*)( &client->control->session_flags ),
+		   sizeof(client->control->session_flags))
+	    < (ssize_t)sizeof(client->control->session_flags)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* write the empty uuid that ends the reply to jack_session_notify() */
+int
+jack_session_finish (jack_engine_t *engine)
+{
+	jack_uuid_t finalizer = JACK_UUID_EMPTY_INITIALIZER;
+	int ret = 0;
+
+	jack_uuid_clear (&finalizer);
+
+	if (write (engine->session_reply_fd, &finalizer, sizeof(finalizer))
+	    < (ssize_t)sizeof(finalizer)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		ret = -1;
+	}
+
+	if (engine->session_replies) {
+		jack_info ("session saved by %d clients in %lld msecs, "
+			   "slowest was %s after %lld msecs",
+			   engine->session_replies,
+			   (jack_get_microseconds () - engine->session_started) / 1000,
+			   engine->session_slowest,
+			   engine->session_slowest_usecs / 1000);
+	}
+
+	engine->session_reply_fd = -1;
+
+	return ret;
+}
+
+/* Give up on the clients that said they would reply later, but did
+   not do so by the deadline, so that the next session can be saved.
+ */
+static void
+jack_session_expire (jack_engine_t *engine)
+{
+	JSList *node;
+	jack_client_internal_t *client;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (client->session_reply_pending) {
+			jack_error ("client %s did not reply to the session "
+				    "save within %d secs",
+				    client->control->name,
+				    JACKD_SESSION_REPLY_TIMEOUT / 1000);
+			client->session_reply_pending = FALSE;
+		}
+	}
+
+	engine->session_pending_replies = 0;
+	jack_session_finish (engine);
+}
+
+/* The answer of a client to SaveSession: 1 means it will send a
+   SessionReply later, 2 that its reply is already in its control block.
+ */
+static int
+jack_session_answer (jack_engine_t *engine, jack_client_internal_t *client,
+		     int reply)
+{
+	if (reply == 1) {
+		engine->session_pending_replies += 1;
+		client->session_reply_pending = TRUE;
+	} else if (reply == 2) {
+		return jack_send_session_reply (engine, client);
+	}
+
+	return 0;
+}
+
+/* Read the answers to the SaveSession events posted by
+   jack_do_session_notify(). The clients save at the same time, so
+   together they get the timeout a single event would have.
+ */
+static int
+jack_session_collect (jack_engine_t *engine, struct pollfd *pfd,
+		      jack_client_internal_t **waiting, int posted)
+{
+	jack_time_t timeout = JACKD_CLIENT_EVENT_TIMEOUT;
+	jack_time_t now, deadline;
+	int left = posted;
+	int ret = 0;
+	int i;
+	char status;
+
+	if (!engine->control->real_time && (engine->client_timeout_msecs > timeout)) {
+		timeout = engine->client_timeout_msecs;
+	}
+
+	deadline = jack_get_microseconds () + timeout * 1000;
+
+	while (left > 0 && (now = jack_get_microseconds ()) < deadline) {
+
+		if (poll (pfd, posted, (int)((deadline - now + 999) / 1000)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			jack_error ("poll on session event replies failed (%s)",
+				    strerror (errno));
+			break;
+		}
+
+		for (i = 0; i < posted; i++) {
+
+			if (pfd[i].fd < 0 || pfd[i].revents == 0) {
+				continue;
+			}
+
+			if ((pfd[i].revents & ~POLLIN) ||
+			    read (pfd[i].fd, &status, sizeof(status)) != sizeof(status)) {
+				jack_error ("lost client %s while it was saving its session",
+					    waiting[i]->control->name);
+				waiting[i]->error += JACK_ERROR_WITH_SOCKETS;
+				jack_engine_signal_problems (engine);
+			} else if (jack_session_answer (engine, waiting[i], status)) {
+				ret = -1;
+			}
+
+			/* poll(2) skips it from now on */
+			pfd[i].fd = -1;
+			left--;
+		}
+	}
+
+	for (i = 0; i < posted; i++) {
+		if (pfd[i].fd >= 0) {
+			jack_error ("timeout waiting for client %s to handle a %s event",
+				    waiting[i]->control->name,
+				    jack_event_type_name (SaveSession));
+			waiting[i]->error += JACK_ERROR_WITH_SOCKETS;
+			jack_engine_signal_problems (engine);
+		}
+	}
+
+	return ret;
+}
+
+/* SaveSession goes out to all the clients before any answer is read,
+   so a session takes as long as its slowest client, not as long as all
+   of them together.
+ */
+static int
+jack_do_session_notify (jack_engine_t *engine, jack_request_t *req, int reply_fd )
+{
+	JSList *node;
+	jack_event_t event;
+	jack_client_internal_t **waiting = NULL;
+	struct pollfd *pfd = NULL;
+	int nclients;
+	int posted = 0;
+	int err = 0;
+
+	int reply;
+	jack_uuid_t finalizer;
+	struct stat sbuf;
+
+	jack_uuid_clear (&finalizer);
+
+	if (engine->session_reply_fd != -1) {
+		// we should have a notion of busy or somthing.
+		// just sending empty reply now, and leave the
+		// session in progress alone.
+		if (write (reply_fd, &finalizer, sizeof(finalizer))
+		    < (ssize_t)sizeof(finalizer)) {
+			jack_error ("cannot write SessionNotify result "
+				    "to client via fd = %d (%s)",
+				    reply_fd, strerror (errno));
+			return -3;
+		}
+		return 0;
+	}
+
+	engine->session_reply_fd = reply_fd;
+	engine->session_pending_replies = 0;
+	engine->session_started = jack_get_microseconds ();
+	engine->session_deadline = engine->session_started +
+				   JACKD_SESSION_REPLY_TIMEOUT * 1000;
+	engine->session_replies = 0;
+	engine->session_slowest_usecs = 0;
+	engine->session_slowest[0] = '\0';
+
+	event.type = SaveSession;
+	event.y.n = req->x.session.type;
+
+	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
+	 */
+
+	if (stat (req->x.session.path, &sbuf) != 0 || !S_ISDIR (sbuf.st_mode)) {
+		jack_error ("session parent directory (%s) does not exist", req->x.session.path);
+		goto send_final;
+	}
+
+	nclients = jack_slist_length (engine->clients);
+	pfd = (struct pollfd*)malloc (sizeof(struct pollfd) * (nclients + 1));
+	waiting = (jack_client_internal_t**)
+		  malloc (sizeof(jack_client_internal_t*) * (nclients + 1));
+
+	if (pfd == NULL || waiting == NULL) {
+		jack_error ("cannot allocate memory for session notification");
+		goto send_final;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (client->control->session_cbset) {
+
+			// in case we only want to send to a special client.
+			// uuid assign is still complete. not sure if thats necessary.
+			if ( (req->x.session.target[0] != 0) && strcmp (req->x.session.target, (char*)client->control->name) ) {
+				continue;
+			}
+
+			/* the caller of jack_session_notify() is required to have created the session dir
+			 */
+
+			if (req->x.session.path[strlen (req->x.session.path) - 1] == '/') {
+				snprintf (event.x.name, sizeof(event.x.name), "%s%s/", req->x.session.path, client->control->name );
+			} else {
+				snprintf (event.x.name, sizeof(event.x.name), "%s/%s/", req->x.session.path, client->control->name );
+			}
+			if (mkdir (event.x.name, 0777) != 0) {
+				jack_error ("cannot create session directory (%s) for client %s: %s",
+					    event.x.name, client->control->name, strerror (errno));
+				break;
+			}
+
+			client->session_sent = jack_get_microseconds ();
+
+			if (jack_client_is_internal (client) ||
+			    !client->control->active ||
+			    client->control->dead ||
+			    client->error >= JACK_ERROR_WITH_SOCKETS) {
+				/* nothing to wait for */
+				reply = jack_deliver_event (engine, client, &event);
+				if (jack_session_answer (engine, client, reply)) {
+					err = -1;
+				}
+				continue;
+			}
+
+			jack_post_event (engine, client, &event, NULL, 0);
+
+			if (client->error < JACK_ERROR_WITH_SOCKETS) {
+				pfd[posted].fd = client->event_fd;
+				pfd[posted].events = POLLERR | POLLIN | POLLHUP | POLLNVAL;
+				waiting[posted] = client;
+				posted++;
+			}
+		}
+	}
+
+	VERBOSE (engine, "session event sent to %d clients", posted);
+
+	if (jack_session_collect (engine, pfd, waiting, posted)) {
+		err = -1;
+	}
+
+	free (pfd);
+	free (waiting);
+
+	if (err) {
+		goto error_out;
+	}
+
+	if (engine->session_pending_replies != 0) {
+		return 0;
+	}
+
+	return jack_session_finish (engine) ? -3 : 0;
+
+send_final:
+	free (pfd);
+	free (waiting);
+
+	return jack_session_finish (engine) ? -3 : 0;
+
+error_out:
+	/* the reply socket is broken, so nothing more goes there */
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		((jack_client_internal_t*)node->data)->session_reply_pending = FALSE;
+	}
+	engine->session_pending_replies = 0;
+	engine->session_reply_fd = -1;
+
+	return -3;
+}
+
+static int
+jack_do_has_session_cb (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_client_internal_t *client;
+	int retval = -1;
+
+	client = jack_client_by_name (engine, req->x.name);
+	if (client == NULL) {
+		goto out;
+	}
+
+	retval = client->control->session_cbset ? 1 : 0;
+out:
+	return retval;
+}
+
+static void jack_do_session_reply (jack_engine_t *engine, jack_request_t *req )
+{
+	jack_uuid_t client_id;
+	jack_client_internal_t *client;
+
+	jack_uuid_copy (&client_id, req->x.client_id);
+	client = jack_client_internal_by_id (engine, client_id);
+
+	req->status = 0;
+
+	/* a late reply to a session that has expired, or been finished by
+	   one of its clients going away, must not count for the next one */
+
+	if (engine->session_reply_fd == -1 ||
+	    client == NULL || !client->session_reply_pending) {
+		jack_error ("spurious Session Reply");
+		return;
+	}
+
+	client->session_reply_pending = 0;
+
+	engine->session_pending_replies -= 1;
+
+	if (jack_send_session_reply (engine, client)) {
+		// maybe need to fix all client pendings.
+		// but we will just get a set of spurious replies now.
+		engine->session_reply_fd = -1;
+		return;
+	}
+
+	if (engine->session_pending_replies == 0) {
+		if (jack_session_finish (engine)) {
+			req->status = -1;
+		}
+	}
+}
+
+static void
+jack_notify_all_port_interested_clients (jack_engine_t *engine, jack_uuid_t src, jack_uuid_t dst, jack_port_id_t a, jack_port_id_t b, int connected)
+{
+	JSList *node;
+	jack_event_t event;
+
+	jack_checkpoint_dirty (engine->checkpoint);
+
+	event.type = (connected ? PortConnected : PortDisconnected);
+	event.x.self_id = a;
+	event.y.other_id = b;
+
+	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
+	 */
+
+	jack_client_internal_t* src_client = jack_client_internal_by_id (engine, src);
+	jack_client_internal_t* dst_client = jack_client_internal_by_id (engine, dst);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (src_client != client &&  dst_client  != client && client->control->port_connect_cbset != FALSE &&
+		    !client->control->graph_changed_cbset) {
+
+			/* one of the ports belong to this client or it has a port connect callback */
+			jack_deliver_event (engine, client, &event);
+		}
+	}
+}
+
+/* Graph epochs.
+ *
+ * A patchbay that makes hundreds of connections would otherwise cost
+ * every client with a port connect callback one synchronous event per
+ * connection. Clients that set a graph changed callback get none of
+ * those (the owners of the ports still do, libjack needs them): the
+ * changes are logged in the engine segment, and one GraphChanged
+ * event announces all those made within JACK_GRAPH_EPOCH_WINDOW_USECS
+ * of the first, or by one batch request.
+ */
+
+#define JACK_GRAPH_EPOCH_WINDOW_USECS 20000
+
+static void
+jack_graph_change_note (jack_engine_t *engine, jack_port_id_t src,
+			jack_port_id_t dst, int connected)
+{
+	/* caller must hold the graph lock */
+	jack_control_t *control = engine->control;
+	uint32_t head = control->graph_changes_head;
+	volatile jack_graph_change_t *change =
+		&control->graph_changes[head & (JACK_GRAPH_CHANGES_MAX - 1)];
+
+	change->epoch = control->graph_epoch + 1;
+	change->source = src;
+	change->destination = dst;
+	change->connected = connected;
+
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	control->graph_changes_head = head + 1;
+
+	if (!engine->graph_epoch_pending) {
+		engine->graph_epoch_pending = TRUE;
+		engine->graph_epoch_deadline =
+			jack_get_microseconds () + JACK_GRAPH_EPOCH_WINDOW_USECS;
+		if (!pthread_equal (pthread_self (), engine->server_thread)) {
+			jack_wake_server_thread (engine);
+		}
+	}
+}
+
+static void
+jack_graph_epoch_flush (jack_engine_t *engine)
+{
+	/* caller must hold the graph lock */
+	jack_event_t event;
+	JSList *node;
+	jack_client_internal_t *client;
+
+	if (!engine->graph_epoch_pending) {
+		return;
+	}
+
+	engine->graph_epoch_pending = FALSE;
+
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	engine->control->graph_epoch++;
+
+	VALGRIND_MEMSET (&event, 0, sizeof(event));
+	event.type = GraphChanged;
+	event.x.n = engine->control->graph_epoch;
+
+	VERBOSE (engine, "graph epoch %" PRIu32, event.x.n);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (client->control->graph_changed_cbset) {
+			jack_deliver_event (engine, client, &event);
+		}
+	}
+}
+
+/* msecs until the pending epoch is due, -1 if there is none */
+static int
+jack_graph_epoch_timeout (jack_engine_t *engine)
+{
+	jack_time_t now;
+
+	if (!engine->graph_epoch_pending) {
+		return -1;
+	}
+
+	now = jack_get_microseconds ();
+
+	if (now >= engine->graph_epoch_deadline) {
+		return 0;
+	}
+
+	return (int)((engine->graph_epoch_deadline - now + 999) / 1000);
+}
+
+/* msecs until the server thread has something to do other than
+   waiting for requests, -1 if nothing */
+static int
+jack_server_timeout (jack_engine_t *engine)
+{
+	int timeout = jack_graph_epoch_timeout (engine);
+	int session;
+	jack_time_t now;
+
+	if (engine->session_reply_fd < 0) {
+		return timeout;
+	}
+
+	now = jack_get_microseconds ();
+	session = (now >= engine->session_deadline ? 0 :
+		   (int)((engine->session_deadline - now + 999) / 1000));
+
+	if (timeout < 0 || session < timeout) {
+		timeout = session;
+	}
+
+	return timeout;
+}
+
+/* events that the engine does not need an answer to */
+static int
+jack_event_is_async (JackEventType type)
+{
+	switch (type) {
+	case PortRegistered:
+	case PortUnregistered:
+	case ClientRegistered:
+	case ClientUnregistered:
+	case XRun:
+	case PropertyChange:
+	case PortRename:
+	case GraphChanged:
+	case PortsRegistered:
+	case PortsUnregistered:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Put an event into the client's queue, and ring its event socket if
+ * the queue was idle. Returns -1 if the event must be delivered
+ * synchronously instead, because the queue is full or the key is too
+ * long.
+ */
+static int
+jack_queue_event (jack_engine_t *engine, jack_client_internal_t *client,
+		  const jack_event_t *event, const char *key, size_t keylen)
+{
+	jack_client_control_t *ctl = client->control;
+	jack_queued_event_t *qe;
+	jack_activation_t *act;
+	jack_event_t wakeup;
+	jack_time_t then;
+	uint32_t head;
+
+	if (keylen > JACK_EVENT_QUEUE_KEY_SIZE) {
+		return -1;
+	}
+
+	pthread_mutex_lock (&client->event_lock);
+
+	head = ctl->event_head;
+	then = 0;
+
+	while (head - __atomic_load_n (&ctl->event_tail, __ATOMIC_ACQUIRE)
+	       >= JACK_EVENT_QUEUE_SIZE) {
+
+		/* the socket is handled by the client's process thread,
+		   which must not see notifications when the client has
+		   an event thread: give that thread time to catch up.
+		 */
+
+		if (!ctl->event_thread) {
+			pthread_mutex_unlock (&client->event_lock);
+			return -1;
+		}
+
+		if (then == 0) {
+			then = jack_get_microseconds ();
+		} else if (jack_get_microseconds () - then >
+			   JACKD_CLIENT_EVENT_TIMEOUT * 1000) {
+			jack_error ("timeout waiting for client %s to handle "
+				    "its queued events", ctl->name);
+			client->error += JACK_ERROR_WITH_SOCKETS;
+			jack_engine_signal_problems (engine);
+			pthread_mutex_unlock (&client->event_lock);
+			return 0;
+		}
+
+		jack_futex_wake (&ctl->event_signalled, 1);
+		usleep (100);
+	}
+
+	qe = (jack_queued_event_t*)&ctl->event_queue[head & (JACK_EVENT_QUEUE_SIZE - 1)];
+	memcpy (&qe->event, event, sizeof(*event));
+	if (keylen) {
+		memcpy (qe->key, key, keylen);
+	}
+
+	/* the client clears `event_signalled' before it looks at
+	   `event_head', so one of us sees the other's store.
+	 */
+	__atomic_store_n (&ctl->event_head, head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n (&ctl->event_signalled, 1, __ATOMIC_SEQ_CST) == 0) {
+
+		if (ctl->event_thread) {
+			jack_futex_wake (&ctl->event_signalled, 1);
+			pthread_mutex_unlock (&client->event_lock);
+			return 0;
+		}
+
+		memset (&wakeup, 0, sizeof(wakeup));
+		wakeup.type = EventsQueued;
+
+		if (write (client->event_fd, &wakeup, sizeof(wakeup)) != sizeof(wakeup)) {
+			jack_error ("cannot send event to client [%s] (%s)",
+				    ctl->name, strerror (errno));
+			client->error += JACK_ERROR_WITH_SOCKETS;
+			jack_engine_signal_problems (engine);
+		}
+
+		act = jack_activation_slot (engine->control, ctl->activation_slot);
+		if (act) {
+			jack_activation_post_event (act);
+		}
+	}
+
+	pthread_mutex_unlock (&client->event_lock);
+
+	return 0;
+}
+
+/* Write an event to an external client's event socket without waiting
+ * for the answer, which the caller must read before sending another.
+ */
+static void
+jack_post_event (jack_engine_t *engine, jack_client_internal_t *client,
+		 const jack_event_t *event, const char *key, size_t keylen)
+{
+	jack_activation_t *act;
+
+	DEBUG ("engine writing on event fd");
+
+	if (write (client->event_fd, event, sizeof(*event)) != sizeof(*event)) {
+		jack_error ("cannot send event to client [%s] (%s)",
+			    client->control->name,
+			    strerror (errno));
+		client->error += JACK_ERROR_WITH_SOCKETS;
+		jack_engine_signal_problems (engine);
+	}
+
+	/* for property changes, deliver the extra data representing
+	   the variable length "key" that has changed in some way.
+	 */
+
+	if (event->type == PropertyChange) {
+		if (keylen) {
+			if (write (client->event_fd, key, keylen) != keylen) {
+				jack_error ("cannot send property change key to client [%s] (%s)",
+					    client->control->name,
+					    strerror (errno));
+				client->error += JACK_ERROR_WITH_SOCKETS;
+				jack_engine_signal_problems (engine);
+			}
+		}
+	}
+
+	/* a client waiting on its activation slot is not
+	   polling the event socket, so tell it to look.
+	 */
+
+	act = jack_activation_slot (engine->control,
+				    client->control->activation_slot);
+	if (act) {
+		jack_activation_post_event (act);
+	}
+}
+
+int
+jack_deliver_event (jack_engine_t *engine, jack_client_internal_t *client,
+		    const jack_event_t *event, ...)
+{
+	va_list ap;
+	char status = 0;
+	char* key = 0;
+	size_t keylen = 0;
+
+	va_start (ap, event);
+
+	/* caller must hold the graph lock */
+
+	DEBUG ("delivering event (type %s)", jack_event_type_name (event->type));
+
+	if (client->control->dead || client->error >= JACK_ERROR_WITH_SOCKETS) {
+		DEBUG ("client %s is dead - no event sent",
+		       client->control->name);
+		va_end (ap);
+		return 0;
+	}
+
+	/* Check property change events for matching key_size and keys */
+
+	if (event->type == PropertyChange) {
+		key = va_arg (ap, char*);
+		if (key && key[0] != '\0') {
+			keylen = strlen (key) + 1;
+			if (event->y.key_size != keylen) {
+				jack_error ("property change key %s sent with wrong length (%d vs %d)", key, event->y.key_size, keylen);
+				va_end (ap);
+				return -1;
+			}
+		}
+	}
+
+	va_end (ap);
+
+	if (jack_client_is_internal (client)) {
+
+		switch (event->type) {
+		case PortConnected:
+		case PortDisconnected:
+			jack_client_handle_port_connection
+				(client->private_client, event);
+			break;
+
+		case BufferSizeChange:
+			jack_client_fix_port_buffers (client->private_client);
+
+			if (client->control->bufsize_cbset) {
+				if (event->x.n < 16) {
+					abort ();
+				}
+				client->private_client->bufsize
+					(event->x.n, client->private_client->bufsize_arg);
+			}
+			break;
+
+		case SampleRateChange:
+			if (client->control->srate_cbset) {
+				client->private_client->srate
+					(event->x.n,
+					client->private_client->srate_arg);
+			}
+			break;
+
+		case GraphReordered:
+			if (client->control->graph_order_cbset) {
+				client->private_client->graph_order
+					(client->private_client->graph_order_arg);
+			}
+			break;
+
+		case XRun:
+			if (client->control->xrun_cbset) {
+				client->private_client->xrun
+					(client->private_client->xrun_arg);
+			}
+			break;
+
+		case PropertyChange:
+			if (client->control->property_cbset) {
+				client->private_client->property_cb
+					(event->x.uuid, key, event->z.property_change, client->private_client->property_cb_arg);
+			}
+			break;
+
+		case LatencyCallback:
+			jack_client_handle_latency_callback (client->private_client, event, (client->control->type == ClientDriver));
+			break;
+
+		case PortsRegistered:
+		case PortsUnregistered:
+			jack_client_handle_ports_registration (client->private_client, event);
+			break;
+
+		case GraphChanged:
+			if (client->control->graph_changed_cbset) {
+				client->private_client->graph_changed_cb
+					(event->x.n, client->private_client->graph_changed_arg);
+			}
+			break;
+
+		default:
+			/* internal clients don't need to know */
+			break;
+		}
+
+	} else {
+
+		if (client->control->active) {
+
+			/* there's a thread waiting for events, so
+			 * it's worth telling the client */
+
+			if (jack_event_is_async (event->type) &&
+			    jack_queue_event (engine, client, event, key, keylen) == 0) {
+				return 0;
+			}
+
+			/* we are about to wait for the client, so use
+			   kill(2) to beef up our check on its continued
+			   well-being, unless its pidfd is watched anyway
+			 */
+
+			if (client->pid_fd < 0 && kill (client->control->pid, 0)) {
+				DEBUG ("client %s is dead - no event sent",
+				       client->control->name);
+				return 0;
+			}
+
+			jack_post_event (engine, client, event, key, keylen);
+
+			if (client->error) {
+				status = -1;
+			} else {
+				// then we check whether there really is an error.... :)
+
+				struct pollfd pfd[1];
+				pfd[0].fd = client->event_fd;
+				pfd[0].events = POLLERR | POLLIN | POLLHUP | POLLNVAL;
+				jack_time_t poll_timeout = JACKD_CLIENT_EVENT_TIMEOUT;
+				int poll_ret;
+				jack_time_t then = jack_get_microseconds ();
+				jack_time_t now;
+
+				/* if we're not running realtime and there is a client timeout set
+				   that exceeds the default client event timeout (which is not
+				   bound by RT limits, then use the larger timeout.
+				 */
+
+				if (!engine->control->real_time && (engine->client_timeout_msecs > poll_timeout)) {
+					poll_timeout = engine->client_timeout_msecs;
+				}
+
+#ifdef __linux
+again:
+#endif
+				VERBOSE (engine, "client event poll on %d for %s starts at %lld",
+					 client->event_fd, client->control->name, then);
+				if ((poll_ret = poll (pfd, 1, poll_timeout)) < 0) {
+					DEBUG ("client event poll not ok! (-1) poll returned an error");
+					jack_error ("poll on subgraph processing failed (%s)", strerror (errno));
+					status = -1;
+				} else {
+
+					DEBUG ("\n\n\n\n\n back from client event poll, revents = 0x%x\n\n\n", pfd[0].revents);
+					now = jack_get_microseconds ();
+					VERBOSE (engine, "back from client event poll after %lld usecs", now - then);
+
+					if (pfd[0].revents & ~POLLIN) {
+
+						/* some kind of OOB socket event */
+
+						DEBUG ("client event poll not ok! (-2), revents = %d\n", pfd[0].revents);
+						jack_error ("subgraph starting at %s lost client", client->control->name);
+						status = -2;
+
+					} else if (pfd[0].revents & POLLIN) {
+
+						/* client responded normally */
+
+						DEBUG ("client event poll ok!");
+						status = 0;
+
+					} else if (poll_ret == 0) {
+
+						/* no events, no errors, we woke up because poll()
+						   decided that time was up ...
+						 */
+
+#ifdef __linux
+						if (linux_poll_bug_encountered (engine, then, &poll_timeout)) {
+							goto again;
+						}
+
+						if (poll_timeout < 200) {
+							VERBOSE (engine, "FALSE WAKEUP skipped, remaining = %lld usec", poll_timeout);
+							status = 0;
+						} else {
+#endif
+						DEBUG ("client event poll not ok! (1 = poll timed out, revents = 0x%04x, poll_ret = %d)", pfd[0].revents, poll_ret);
+						VERBOSE (engine, "client %s did not respond to event type %d in time"
+							 "(fd=%d, revents = 0x%04x, timeout was %lld)",
+							 client->control->name, event->type,
+							 client->event_fd,
+							 pfd[0].revents,
+							 poll_timeout);
+						status = -2;
+#ifdef __linux
+					}
+#endif
+					}
+				}
+			}
+
+			if (status == 0) {
+				if (read (client->event_fd, &status, sizeof(status)) != sizeof(status)) {
+					jack_error ("cannot read event response from client [%s] (%s)",
+						    client->control->name,
+						    strerror (errno));
+					status = -1;
+				}
+
+			} else {
+				switch (status) {
+				case -1:
+					jack_error ("internal poll failure reading response from client %s to a %s event",
+						    client->control->name,
+						    jack_event_type_name (event->type));
+					break;
+				case -2:
+					jack_error ("timeout waiting for client %s to handle a %s event",
+						    client->control->name,
+						    jack_event_type_name (event->type));
+					break;
+				default:
+					jack_error ("bad status (%d) from client %s while handling a %s event",
+						    (int)status,
+						    client->control->name,
+						    jack_event_type_name (event->type));
+				}
+			}
+
+			if (status < 0) {
+				client->error += JACK_ERROR_WITH_SOCKETS;
+				jack_engine_signal_problems (engine);
+			}
+		}
+	}
+	DEBUG ("event delivered");
+
+	return status;
+}
+
+static void
+jack_dag_add_successors (jack_client_internal_t *source,
+			 jack_client_internal_t *via, unsigned int mark)
 {
-	int i;
+	JSList *node;
 
-	if (engine == NULL) {
-		return;
-	}
+	/* clients that do not run (no process callback, inactive)
+	   still pass on the ordering constraints of the clients that
+	   feed them, so look through them.
+	 */
 
-	VERBOSE (engine, "starting server engine shutdown");
+	for (node = via->sortfeeds; node; node = jack_slist_next (node)) {
 
-	jack_stop_freewheeling (engine, 1);
+		jack_client_internal_t *dst =
+			(jack_client_internal_t*)node->data;
 
-	engine->control->engine_ok = 0; /* tell clients we're going away */
+		/* reads its inputs from the ring, after the cycle */
+		if (dst->dag_mark == mark || jack_client_is_decimated (dst)) {
+			continue;
+		}
 
-	/* this will wake the server thread and cause it to exit */
+		dst->dag_mark = mark;
 
-	close (engine->cleanup_fifo[0]);
-	close (engine->cleanup_fifo[1]);
+		if (jack_client_is_runnable (dst)) {
+			source->dag_successors =
+				jack_slist_prepend (source->dag_successors, dst);
+			dst->dag_fedcount++;
+		} else {
+			jack_dag_add_successors (source, dst, mark);
+		}
+	}
+}
 
-	/* shutdown master socket to prevent new clients arriving */
-	shutdown (engine->fds[0], SHUT_RDWR);
-	// close (engine->fds[0]);
+static void
+jack_dag_plan_activation (jack_engine_t *engine)
+{
+	/* caller must hold client_lock */
+	JSList *node, *snode;
 
-	/* now really tell them we're going away */
+	/* the engine thread shares internal clients with the workers
+	   through the steal deques, so those have to be there too */
+	engine->dag_direct = (engine->control->activation_type ==
+			      JackActivationFutex &&
+			      engine->steal_deques != NULL);
 
-	for (i = 0; i < engine->pfd_max; ++i)
-		shutdown (engine->pfd[i].fd, SHUT_RDWR);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-	if (engine->driver) {
-		jack_driver_t* driver = engine->driver;
+		jack_slist_free (client->dag_engine_successors);
+		client->dag_engine_successors = NULL;
+		client->dag_notify = 0;
+		client->control->activation_nsuccessors = 0;
 
-		VERBOSE (engine, "stopping driver");
-		driver->stop (driver);
-		// VERBOSE (engine, "detaching driver");
-		// driver->detach (driver, engine);
-		VERBOSE (engine, "unloading driver");
-		jack_driver_unload (driver);
-		engine->driver = NULL;
-	}
+		/* every client in the plan must be reachable through
+		   its slot, otherwise stay with engine-driven
+		   execution.
+		 */
 
-	VERBOSE (engine, "freeing shared port segments");
-	for (i = 0; i < engine->control->n_port_types; ++i) {
-		jack_release_shm (&engine->port_segment[i]);
-		jack_destroy_shm (&engine->port_segment[i]);
+		if (jack_client_is_runnable (client) &&
+		    !jack_client_is_internal (client) &&
+		    client->control->activation_slot < 0) {
+			engine->dag_direct = 0;
+		}
 	}
 
-	/* stop the other engine threads */
-	VERBOSE (engine, "stopping server thread");
+	if (!engine->dag_direct) {
+		return;
+	}
 
-#if JACK_USE_MACH_THREADS
-	// MacOSX pthread_cancel still not implemented correctly in Darwin
-	mach_port_t machThread = pthread_mach_thread_np (engine->server_thread);
-	thread_terminate (machThread);
-#else
-	pthread_cancel (engine->server_thread);
-	pthread_join (engine->server_thread, NULL);
-#endif
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+		jack_client_control_t *ctl = client->control;
+		int32_t n = 0;
 
+		if (jack_client_is_internal (client)) {
+			continue;
+		}
 
-	VERBOSE (engine, "last xrun delay: %.3f usecs",
-		 engine->control->xrun_delayed_usecs);
-	VERBOSE (engine, "max delay reported by backend: %.3f usecs",
-		 engine->control->max_delayed_usecs);
+		/* keep one entry free for the engine */
 
-	/* free engine control shm segment */
-	engine->control = NULL;
-	VERBOSE (engine, "freeing engine shared memory");
-	jack_release_shm (&engine->control_shm);
-	jack_destroy_shm (&engine->control_shm);
+		for (snode = client->dag_successors; snode;
+		     snode = jack_slist_next (snode)) {
+			jack_client_internal_t *dst =
+				(jack_client_internal_t*)snode->data;
 
-	VERBOSE (engine, "max usecs: %.3f, engine deleted", engine->max_usecs);
+			if (!jack_client_is_internal (dst) &&
+			    n < JACK_ACTIVATION_MAX_SUCCESSORS - 1) {
+				ctl->activation_successors[n++] =
+					dst->control->activation_slot;
+			} else {
+				client->dag_engine_successors =
+					jack_slist_prepend (client->dag_engine_successors, dst);
+			}
+		}
 
-	free (engine);
+		if (client->dag_engine_successors || !client->dag_successors) {
+			ctl->activation_successors[n++] = JACK_ACTIVATION_ENGINE;
+			client->dag_notify = 1;
+		}
 
-	jack_messagebuffer_exit ();
+		ctl->activation_nsuccessors = n;
+	}
 }
 
-void
-jack_port_clear_connections (jack_engine_t *engine,
-			     jack_port_internal_t *port)
+/* Pipelined execution.
+ *
+ * With pipeline_stages set, jack_dag_build() cuts the plan into that
+ * many stages by depth, the longest chain of runnable clients above a
+ * client: stage s holds the depths in the s'th of pipeline_stages
+ * equal slices. The edges between stages are left out of the plan, so
+ * all stages start with the cycle and run side by side, stage s on
+ * cycle n while stage s + 1 is on what stage s made in cycle n - 1.
+ * An output that a later stage reads gets a second buffer in its
+ * segment, which jack_engine_pipeline_snapshot() fills with last
+ * cycle's data before anything runs; libjack has the later stage read
+ * that (see jack_port_source_buffer()). Every stage boundary on a path
+ * adds a period to its latency.
+ */
+
+static int
+jack_pipeline_port_crosses (jack_port_internal_t *port)
 {
-	JSList *node, *next;
+	JSList *node;
+	jack_connection_internal_t *connection;
 
-	for (node = port->connections; node; ) {
-		next = jack_slist_next (node);
-		jack_port_disconnect_internal (
-			engine, ((jack_connection_internal_t*)
-				 node->data)->source,
-			((jack_connection_internal_t*)
-			 node->data)->destination);
-		node = next;
+	for (node = port->connections; node; node = jack_slist_next (node)) {
+		connection = (jack_connection_internal_t*)node->data;
+		if (connection->source == port &&
+		    connection->destination->shared->stage > port->shared->stage) {
+			return TRUE;
+		}
 	}
 
-	jack_slist_free (port->connections);
-	port->connections = 0;
+	return FALSE;
 }
 
-static void
-jack_deliver_event_to_all (jack_engine_t *engine, jack_event_t *event)
+static int
+jack_pipeline_set_delay (jack_engine_t *engine, jack_port_internal_t *port,
+			 int onoff)
 {
-	JSList *node;
+	jack_port_buffer_list_t *blist = jack_port_buffer_list (engine, port);
+	jack_port_buffer_info_t *bi;
 
-	jack_rdlock_graph (engine);
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_deliver_event (engine,
-				    (jack_client_internal_t*)node->data,
-				    event);
+	if (!onoff) {
+		if (port->delay_info) {
+			port->shared->delayed = 0;
+			pthread_mutex_lock (&blist->lock);
+			blist->freelist = jack_slist_prepend (blist->freelist,
+							      port->delay_info);
+			port->delay_info = NULL;
+			pthread_mutex_unlock (&blist->lock);
+		}
+		return 0;
 	}
-	jack_unlock_graph (engine);
+
+	if (port->delay_info) {
+		return 0;
+	}
+
+	pthread_mutex_lock (&blist->lock);
+	if (blist->freelist == NULL) {
+		pthread_mutex_unlock (&blist->lock);
+		return -1;
+	}
+	bi = (jack_port_buffer_info_t*)blist->freelist->data;
+	blist->freelist = jack_slist_remove_link (blist->freelist,
+						  blist->freelist);
+	port->delay_info = bi;
+	pthread_mutex_unlock (&blist->lock);
+
+	port->shared->delay_offset = bi->offset;
+	port->shared->delay_silent_cycle = 0;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	port->shared->delayed = 1;
+
+	return 0;
 }
 
-static void jack_do_get_client_by_uuid (jack_engine_t *engine, jack_request_t *req)
+/* give every client and its ports a stage, -1 for all of them when
+   `nstages' is below two */
+static int
+jack_pipeline_assign_stages (jack_engine_t *engine, unsigned int nstages,
+			     unsigned int maxdepth)
 {
-	JSList *node;
+	JSList *node, *pnode;
+	int changed = FALSE;
 
-	req->status = -1;
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (jack_uuid_compare (client->control->uuid, req->x.client_id) == 0) {
-			snprintf ( req->x.port_info.name, sizeof(req->x.port_info.name), "%s", client->control->name );
-			req->status = 0;
-			return;
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+		int stage = -1;
+
+		if (nstages > 1 && jack_client_is_runnable (client)) {
+			stage = client->dag_depth * nstages / (maxdepth + 1);
+		}
+
+		if (client->pipeline_stage != stage) {
+			client->pipeline_stage = stage;
+			client->latency_dirty = (1 << JackCaptureLatency) |
+						(1 << JackPlaybackLatency);
+			changed = TRUE;
+		}
+
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			((jack_port_internal_t*)pnode->data)->shared->stage = stage;
 		}
 	}
+
+	return changed;
 }
 
-static void jack_do_get_uuid_by_client_name (jack_engine_t *engine, jack_request_t *req)
+/* A client's rank is its own process time plus the longest chain of
+ * process times downstream of it, that is, how much of the cycle is
+ * left once it may start if no other client got in the way. Times are
+ * the smoothed durations jack_engine_record_timing() keeps; a client
+ * that has not run yet counts as taking no time at all.
+ * caller must hold client_lock or the graph lock.
+ */
+static void
+jack_dag_rank (jack_engine_t *engine)
 {
-	JSList *node;
-
-	req->status = -1;
+	JSList *snode;
+	jack_client_internal_t *client;
+	float longest, rank;
+	unsigned int i;
 
-	if (strcmp (req->x.name, "system") == 0) {
-		/* request concerns the driver */
-		if (engine->driver) {
-			jack_uuid_copy (&req->x.client_id, engine->driver->internal_client->control->uuid);
-			req->status = 0;
+	/* dag_order is in execution order, so walking it backwards
+	   ranks every successor before the clients that feed it */
+	for (i = engine->dag_nclients; i > 0; i--) {
+		client = engine->dag_order[i - 1];
+		longest = 0.0f;
+
+		for (snode = client->dag_successors; snode;
+		     snode = jack_slist_next (snode)) {
+			rank = ((jack_client_internal_t*)snode->data)->dag_rank;
+			if (rank > longest) {
+				longest = rank;
+			}
 		}
-		return;
-	}
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (strcmp (client->control->name, req->x.name) == 0) {
-			jack_uuid_copy (&req->x.client_id, client->control->uuid);
-			req->status = 0;
-			return;
-		}
+		client->dag_rank = client->dag_weight + longest;
 	}
 }
 
-static void jack_do_reserve_name (jack_engine_t *engine, jack_request_t *req)
+static void
+jack_pipeline_plan (jack_engine_t *engine)
 {
-	jack_reserved_name_t *reservation;
-	JSList *node;
+	/* caller must hold client_lock */
+	JSList *node, *snode, *pnode, *next;
+	unsigned int nstages = engine->pipeline_stages;
+	unsigned int maxdepth = 0;
+	int changed, failed = FALSE;
 
-	// check is name is free...
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if ( !strcmp ( (char*)client->control->name, req->x.reservename.name )) {
-			req->status = -1;
-			return;
+	/* dag_clients is in execution order, so a client's depth is
+	   final by the time it is passed on */
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		((jack_client_internal_t*)node->data)->dag_depth = 0;
+	}
+
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+
+		if (client->dag_depth > maxdepth) {
+			maxdepth = client->dag_depth;
+		}
+		for (snode = client->dag_successors; snode;
+		     snode = jack_slist_next (snode)) {
+			jack_client_internal_t *dst =
+				(jack_client_internal_t*)snode->data;
+			if (dst->dag_depth < client->dag_depth + 1) {
+				dst->dag_depth = client->dag_depth + 1;
+			}
 		}
 	}
 
-	reservation = malloc (sizeof(jack_reserved_name_t));
-	if (reservation == NULL) {
-		req->status = -1;
-		return;
+	if (nstages > maxdepth + 1) {
+		nstages = maxdepth + 1;
 	}
 
-	snprintf (reservation->name, sizeof(reservation->name), "%s", req->x.reservename.name);
-	jack_uuid_copy (&reservation->uuid, req->x.reservename.uuid);
-	engine->reserved_client_names = jack_slist_append (engine->reserved_client_names, reservation);
+	changed = jack_pipeline_assign_stages (engine, nstages, maxdepth);
 
-	req->status = 0;
-}
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-static int jack_send_session_reply ( jack_engine_t *engine, jack_client_internal_t *client )
-{
-	if (write (engine->session_reply_fd, (const void*)&client->control->uuid, sizeof(client->control->uuid))
-	    < (ssize_t)sizeof(client->control->uuid)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
-	}
-	if (write (engine->session_reply_fd, (const void*)client->control->name, sizeof(client->control->name))
-	    < (ssize_t)sizeof(client->control->name)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			jack_port_internal_t *port =
+				(jack_port_internal_t*)pnode->data;
+			int crosses = (client->pipeline_stage >= 0 &&
+				       (port->shared->flags & JackPortIsOutput) &&
+				       jack_pipeline_port_crosses (port));
+
+			if (jack_pipeline_set_delay (engine, port, crosses)) {
+				failed = TRUE;
+			}
+		}
 	}
-	if (write (engine->session_reply_fd, (const void*)client->control->session_command,
-		   sizeof(client->control->session_command))
-	    < (ssize_t)sizeof(client->control->session_command)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
+
+	if (failed) {
+		jack_error ("not enough port buffers to pipeline the graph, "
+			    "running it in one stage");
+		nstages = 1;
+		changed |= jack_pipeline_assign_stages (engine, nstages, maxdepth);
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			jack_client_internal_t *client =
+				(jack_client_internal_t*)node->data;
+			for (pnode = client->ports; pnode;
+			     pnode = jack_slist_next (pnode)) {
+				jack_pipeline_set_delay (engine,
+							 (jack_port_internal_t*)pnode->data,
+							 FALSE);
+			}
+		}
 	}
-	if (write (engine->session_reply_fd, (const void*)( &client->control->session_flags ),
-		   sizeof(client->control->session_flags))
-	    < (ssize_t)sizeof(client->control->session_flags)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
+
+	/* the stages only meet through the snapshots */
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+
+		for (snode = client->dag_successors; snode; snode = next) {
+			jack_client_internal_t *dst =
+				(jack_client_internal_t*)snode->data;
+			next = jack_slist_next (snode);
+			if (dst->pipeline_stage != client->pipeline_stage) {
+				client->dag_successors =
+					jack_slist_remove_link (client->dag_successors,
+								snode);
+				jack_slist_free_1 (snode);
+				dst->dag_fedcount--;
+			}
+		}
 	}
 
-	return 0;
+	engine->dag_nstages = nstages;
+
+	VERBOSE (engine, "graph pipelined in %u stage(s), depth %u",
+		 nstages, maxdepth + 1);
+
+	if (changed) {
+		jack_compute_new_latency (engine);
+	}
 }
 
-static int
-jack_do_session_notify (jack_engine_t *engine, jack_request_t *req, int reply_fd )
+/* Early playback writes.
+ *
+ * A driver with a write_port function can take a playback port as soon
+ * as every client feeding it has finished, instead of waiting for the
+ * rest of the graph, so that the conversion to the device format of
+ * the early channels overlaps the clients still running. Each feeder
+ * carries the list of such ports it feeds, and the engine counts them
+ * down in jack_dag_client_finished(). This is only done where the
+ * engine sees every client finish: with FIFO activation, and when the
+ * plan is not pipelined. A port fed by a client outside the plan, or a
+ * decimated one, is left to the driver's write function, like ports
+ * only the driver itself feeds. caller must hold client_lock.
+ */
+static void
+jack_dag_plan_early_writes (jack_engine_t *engine)
 {
-	JSList *node;
-	jack_event_t event;
+	jack_driver_t *driver = engine->driver;
+	jack_client_internal_t *dclient;
+	JSList *node, *pnode, *cnode, *feeders;
 
-	int reply;
-	jack_uuid_t finalizer;
-	struct stat sbuf;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-	jack_uuid_clear (&finalizer);
+		jack_slist_free (client->early_ports);
+		client->early_ports = NULL;
+	}
+	jack_slist_free (engine->early_ports);
+	engine->early_ports = NULL;
 
-	if (engine->session_reply_fd != -1) {
-		// we should have a notion of busy or somthing.
-		// just sending empty reply now.
-		goto send_final;
+	if (driver == NULL || driver->write_port == NULL ||
+	    driver->internal_client == NULL ||
+	    engine->dag_direct || engine->dag_nstages > 1) {
+		return;
 	}
 
-	engine->session_reply_fd = reply_fd;
-	engine->session_pending_replies = 0;
+	dclient = driver->internal_client;
 
-	event.type = SaveSession;
-	event.y.n = req->x.session.type;
+	for (pnode = dclient->ports; pnode; pnode = jack_slist_next (pnode)) {
+		jack_port_internal_t *port = (jack_port_internal_t*)pnode->data;
+		int eligible = TRUE;
 
-	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
-	 */
+		if (!(port->shared->flags & JackPortIsInput)) {
+			continue;
+		}
 
-	if (stat (req->x.session.path, &sbuf) != 0 || !S_ISDIR (sbuf.st_mode)) {
-		jack_error ("session parent directory (%s) does not exist", req->x.session.path);
-		goto send_final;
-	}
+		feeders = NULL;
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (client->control->session_cbset) {
+		for (cnode = port->connections; cnode; cnode = jack_slist_next (cnode)) {
+			jack_connection_internal_t *c =
+				(jack_connection_internal_t*)cnode->data;
+			jack_client_internal_t *src = c->srcclient;
 
-			// in case we only want to send to a special client.
-			// uuid assign is still complete. not sure if thats necessary.
-			if ( (req->x.session.target[0] != 0) && strcmp (req->x.session.target, (char*)client->control->name) ) {
+			if (c->destination != port || src == dclient) {
 				continue;
 			}
-
-			/* the caller of jack_session_notify() is required to have created the session dir
-			 */
-
-			if (req->x.session.path[strlen (req->x.session.path) - 1] == '/') {
-				snprintf (event.x.name, sizeof(event.x.name), "%s%s/", req->x.session.path, client->control->name );
-			} else {
-				snprintf (event.x.name, sizeof(event.x.name), "%s/%s/", req->x.session.path, client->control->name );
-			}
-			if (mkdir (event.x.name, 0777) != 0) {
-				jack_error ("cannot create session directory (%s) for client %s: %s",
-					    event.x.name, client->control->name, strerror (errno));
+			if (jack_client_is_decimated (src) ||
+			    !jack_slist_find (engine->dag_clients, src)) {
+				eligible = FALSE;
 				break;
 			}
-
-			reply = jack_deliver_event (engine, client, &event);
-			if (reply == 1) {
-				// delayed reply
-				engine->session_pending_replies += 1;
-				client->session_reply_pending = TRUE;
-			} else if (reply == 2) {
-				// immediate reply
-				if (jack_send_session_reply (engine, client)) {
-					goto error_out;
-				}
+			if (!jack_slist_find (feeders, src)) {
+				feeders = jack_slist_prepend (feeders, src);
 			}
 		}
-	}
 
-	if (engine->session_pending_replies != 0) {
-		return 0;
-	}
+		port->early_feeders = jack_slist_length (feeders);
 
-send_final:
-	if (write (reply_fd, &finalizer, sizeof(finalizer))
-	    < (ssize_t)sizeof(finalizer)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    reply_fd, strerror (errno));
-		goto error_out;
+		if (eligible && port->early_feeders) {
+			for (node = feeders; node; node = jack_slist_next (node)) {
+				jack_client_internal_t *src =
+					(jack_client_internal_t*)node->data;
+				src->early_ports =
+					jack_slist_prepend (src->early_ports, port);
+			}
+			engine->early_ports =
+				jack_slist_prepend (engine->early_ports, port);
+		}
+
+		jack_slist_free (feeders);
 	}
 
-	engine->session_reply_fd = -1;
-	return 0;
-error_out:
-	return -3;
+	VERBOSE (engine, "%d playback port(s) written as soon as they are complete",
+		 jack_slist_length (engine->early_ports));
 }
 
 static int
-jack_do_has_session_cb (jack_engine_t *engine, jack_request_t *req)
+jack_dag_build (jack_engine_t *engine)
 {
-	jack_client_internal_t *client;
-	int retval = -1;
+	/* caller must hold client_lock */
+	JSList *node;
+	unsigned int n = 0;
 
-	client = jack_client_by_name (engine, req->x.name);
-	if (client == NULL) {
-		goto out;
-	}
+	jack_slist_free (engine->dag_clients);
+	engine->dag_clients = NULL;
 
-	retval = client->control->session_cbset ? 1 : 0;
-out:
-	return retval;
-}
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-static void jack_do_session_reply (jack_engine_t *engine, jack_request_t *req )
-{
-	jack_uuid_t client_id;
-	jack_client_internal_t *client;
-	jack_uuid_t finalizer = JACK_UUID_EMPTY_INITIALIZER;
+		jack_slist_free (client->dag_successors);
+		client->dag_successors = NULL;
+		client->dag_fedcount = 0;
 
-	jack_uuid_copy (&client_id, req->x.client_id);
-	client = jack_client_internal_by_id (engine, client_id);
-	jack_uuid_clear (&finalizer);
+		if (jack_client_is_runnable (client)) {
+			engine->dag_clients =
+				jack_slist_append (engine->dag_clients, client);
+			n++;
+		}
+	}
 
-	req->status = 0;
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-	client->session_reply_pending = 0;
+		jack_dag_add_successors (client, client, ++engine->dag_mark);
+	}
 
-	if (engine->session_reply_fd == -1) {
-		jack_error ("spurious Session Reply");
-		return;
+	if (engine->pipeline_stages > 1) {
+		jack_pipeline_plan (engine);
 	}
 
-	engine->session_pending_replies -= 1;
+	if (n > engine->dag_size) {
+		engine->dag_ready = (jack_client_internal_t**)
+				    realloc (engine->dag_ready, n * sizeof(jack_client_internal_t*));
+		engine->dag_order = (jack_client_internal_t**)
+				    realloc (engine->dag_order, n * sizeof(jack_client_internal_t*));
+		engine->dag_running = (jack_client_internal_t**)
+				      realloc (engine->dag_running, n * sizeof(jack_client_internal_t*));
+		engine->dag_pfd = (struct pollfd*)
+				  realloc (engine->dag_pfd, n * sizeof(struct pollfd));
 
-	if (jack_send_session_reply (engine, client)) {
-		// maybe need to fix all client pendings.
-		// but we will just get a set of spurious replies now.
-		engine->session_reply_fd = -1;
-		return;
+		if (!engine->dag_ready || !engine->dag_order ||
+		    !engine->dag_running || !engine->dag_pfd) {
+			jack_error ("cannot allocate parallel execution plan "
+				    "for %u clients", n);
+			jack_slist_free (engine->dag_clients);
+			engine->dag_clients = NULL;
+			engine->dag_nclients = 0;
+			engine->dag_size = 0;
+			return -1;
+		}
+
+		engine->dag_size = n;
 	}
 
-	if (engine->session_pending_replies == 0) {
-		if (write (engine->session_reply_fd, &finalizer, sizeof(finalizer))
-		    < (ssize_t)sizeof(finalizer)) {
-			jack_error ("cannot write SessionNotify result "
-				    "to client via fd = %d (%s)",
-				    engine->session_reply_fd, strerror (errno));
-			req->status = -1;
+	n = 0;
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		engine->dag_order[n++] = (jack_client_internal_t*)node->data;
+	}
+	engine->dag_nclients = n;
+	jack_dag_rank (engine);
+
+	jack_dag_plan_activation (engine);
+	jack_dag_plan_early_writes (engine);
+
+	if (engine->verbose) {
+		for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+			jack_client_internal_t *client =
+				(jack_client_internal_t*)node->data;
+			VERBOSE (engine, "client %s: %d upstream, %d downstream, "
+				 "%d woken directly, stage %d",
+				 client->control->name, client->dag_fedcount,
+				 jack_slist_length (client->dag_successors),
+				 client->control->activation_nsuccessors -
+				 client->dag_notify, client->pipeline_stage);
 		}
-		engine->session_reply_fd = -1;
 	}
+
+	return 0;
 }
 
-static void
-jack_notify_all_port_interested_clients (jack_engine_t *engine, jack_uuid_t src, jack_uuid_t dst, jack_port_id_t a, jack_port_id_t b, int connected)
+void
+jack_dag_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 {
+	/* caller must hold client_lock */
 	JSList *node;
-	jack_event_t event;
+	unsigned int i;
 
-	event.type = (connected ? PortConnected : PortDisconnected);
-	event.x.self_id = a;
-	event.y.other_id = b;
+	if (!jack_slist_find (engine->dag_clients, client)) {
+		return;
+	}
 
-	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
-	 */
+	engine->dag_clients = jack_slist_remove (engine->dag_clients, client);
 
-	jack_client_internal_t* src_client = jack_client_internal_by_id (engine, src);
-	jack_client_internal_t* dst_client = jack_client_internal_by_id (engine, dst);
+	for (i = 0; i < engine->dag_nclients; i++) {
+		if (engine->dag_order[i] == client) {
+			memmove (&engine->dag_order[i], &engine->dag_order[i + 1],
+				 (--engine->dag_nclients - i) *
+				 sizeof(jack_client_internal_t*));
+			break;
+		}
+	}
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (src_client != client &&  dst_client  != client && client->control->port_connect_cbset != FALSE) {
+	for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *other =
+			(jack_client_internal_t*)node->data;
+		other->dag_successors =
+			jack_slist_remove (other->dag_successors, client);
+		other->dag_engine_successors =
+			jack_slist_remove (other->dag_engine_successors, client);
+	}
 
-			/* one of the ports belong to this client or it has a port connect callback */
-			jack_deliver_event (engine, client, &event);
+	for (node = client->dag_successors; node; node = jack_slist_next (node)) {
+		((jack_client_internal_t*)node->data)->dag_fedcount--;
+	}
+
+	jack_slist_free (client->dag_successors);
+	client->dag_successors = NULL;
+	jack_slist_free (client->dag_engine_successors);
+	client->dag_engine_successors = NULL;
+	client->dag_notify = 0;
+
+	for (node = engine->early_ports; node; node = jack_slist_next (node)) {
+		jack_port_internal_t *port = (jack_port_internal_t*)node->data;
+
+		if (jack_slist_find (client->early_ports, port)) {
+			/* never completes this way now */
+			port->early_feeders = -1;
 		}
 	}
+	jack_slist_free (client->early_ports);
+	client->early_ports = NULL;
 }
 
-int
-jack_deliver_event (jack_engine_t *engine, jack_client_internal_t *client,
-		    const jack_event_t *event, ...)
+/* Suggest a cpu from engine->client_cpus to each external client,
+ * in execution order. Clients that are next to each other in the
+ * order feed each other, and get neighbouring entries of client_cpus,
+ * which share an L2 cache wherever the topology allows it. The threads
+ * of a client's worker pool take the entries right after its own.
+ * caller must hold client_lock.
+ */
+static void
+jack_engine_suggest_cpus (jack_engine_t *engine)
 {
-	va_list ap;
-	char status = 0;
-	char* key = 0;
-	size_t keylen = 0;
+	JSList *node;
+	unsigned int n = 0;
+	int i;
 
-	va_start (ap, event);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
 
-	/* caller must hold the graph lock */
+		if (engine->nclient_cpus == 0 ||
+		    jack_client_is_internal (client) ||
+		    !jack_client_is_runnable (client)) {
+			client->control->suggested_cpu = -1;
+			for (i = 0; i < client->control->pool_threads; i++) {
+				client->control->pool_cpus[i] = -1;
+			}
+			continue;
+		}
 
-	DEBUG ("delivering event (type %s)", jack_event_type_name (event->type));
+		client->control->suggested_cpu =
+			engine->client_cpus[n++ % engine->nclient_cpus];
+		for (i = 0; i < client->control->pool_threads; i++) {
+			client->control->pool_cpus[i] =
+				engine->client_cpus[n++ % engine->nclient_cpus];
+		}
+	}
+}
 
-	/* we are not RT-constrained here, so use kill(2) to beef up
-	   our check on a client's continued well-being
-	 */
+/* Grant a client the worker pool threads it asks for, as far as the
+ * cpus allow: one is left to the driver thread, and one to each of
+ * the --internal-threads workers and the threads already granted to
+ * other pools. Grants are never taken back to make room for another.
+ */
+static int
+jack_do_set_worker_pool (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_client_internal_t *client;
+	JSList *node;
+	long budget;
+	int32_t granted;
+	int i;
 
-	if (client->control->dead || client->error >= JACK_ERROR_WITH_SOCKETS
-	    || (client->control->type == ClientExternal && kill (client->control->pid, 0))) {
-		DEBUG ("client %s is dead - no event sent",
-		       client->control->name);
-		va_end (ap);
-		return 0;
-	}
+	jack_lock_graph (engine);
 
-	DEBUG ("client %s is still alive", client->control->name);
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.pool.client_id))
+	    == NULL) {
+		jack_unlock_graph (engine);
+		return -1;
+	}
 
-	/* Check property change events for matching key_size and keys */
+	if (engine->nclient_cpus) {
+		budget = engine->nclient_cpus;
+	} else if ((budget = sysconf (_SC_NPROCESSORS_ONLN)) < 1) {
+		budget = 1;
+	}
+	budget -= 1 + engine->nworkers;
 
-	if (event->type == PropertyChange) {
-		key = va_arg (ap, char*);
-		if (key && key[0] != '\0') {
-			keylen = strlen (key) + 1;
-			if (event->y.key_size != keylen) {
-				jack_error ("property change key %s sent with wrong length (%d vs %d)", key, event->y.key_size, keylen);
-				va_end (ap);
-				return -1;
-			}
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *other =
+			(jack_client_internal_t*)node->data;
+		if (other != client) {
+			budget -= other->control->pool_threads;
 		}
 	}
 
-	va_end (ap);
-
-	if (jack_client_is_internal (client)) {
+	client->pool_requested = req->x.pool.nthreads;
+	granted = client->pool_requested;
+	if (granted > JACK_POOL_MAX_THREADS) {
+		granted = JACK_POOL_MAX_THREADS;
+	}
+	if (granted > budget) {
+		granted = budget > 0 ? budget : 0;
+	}
 
-		switch (event->type) {
-		case PortConnected:
-		case PortDisconnected:
-			jack_client_handle_port_connection
-				(client->private_client, event);
-			break;
+	for (i = 0; i < JACK_POOL_MAX_THREADS; i++) {
+		client->control->pool_cpus[i] = -1;
+	}
+	client->control->pool_threads = granted;
+	jack_engine_suggest_cpus (engine);
 
-		case BufferSizeChange:
-			jack_client_fix_port_buffers (client->private_client);
+	VERBOSE (engine, "client %s: %d of %u worker pool threads granted",
+		 client->control->name, granted, client->pool_requested);
 
-			if (client->control->bufsize_cbset) {
-				if (event->x.n < 16) {
-					abort ();
-				}
-				client->private_client->bufsize
-					(event->x.n, client->private_client->bufsize_arg);
-			}
-			break;
+	jack_unlock_graph (engine);
 
-		case SampleRateChange:
-			if (client->control->srate_cbset) {
-				client->private_client->srate
-					(event->x.n,
-					client->private_client->srate_arg);
-			}
-			break;
+	return 0;
+}
 
-		case GraphReordered:
-			if (client->control->graph_order_cbset) {
-				client->private_client->graph_order
-					(client->private_client->graph_order_arg);
-			}
-			break;
+static int
+jack_rechain_graph_parallel (jack_engine_t *engine)
+{
+	JSList *node;
+	unsigned long n;
+	jack_event_t event;
 
-		case XRun:
-			if (client->control->xrun_cbset) {
-				client->private_client->xrun
-					(client->private_client->xrun_arg);
-			}
-			break;
+	VALGRIND_MEMSET (&event, 0, sizeof(event));
 
-		case PropertyChange:
-			if (client->control->property_cbset) {
-				client->private_client->property_cb
-					(event->x.uuid, key, event->z.property_change, client->private_client->property_cb_arg);
-			}
-			break;
+	jack_clear_fifos (engine);
 
-		case LatencyCallback:
-			jack_client_handle_latency_callback (client->private_client, event, (client->control->type == ClientDriver));
-			break;
+	VERBOSE (engine, "++ jack_rechain_graph_parallel():");
 
-		default:
-			/* internal clients don't need to know */
-			break;
-		}
+	event.type = GraphReordered;
 
-	} else {
+	/* every external client is the start of its own
+	   subgraph: it waits on FIFO n, which the engine writes when
+	   the client's inputs are complete, and signals completion
+	   on FIFO n + 1, which only the engine reads.
+	 */
 
-		if (client->control->active) {
+	for (n = 0, node = engine->clients; node; node = jack_slist_next (node)) {
 
-			/* there's a thread waiting for events, so
-			 * it's worth telling the client */
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
 
-			DEBUG ("engine writing on event fd");
+		if (!jack_client_is_runnable (client)) {
+			continue;
+		}
 
-			if (write (client->event_fd, event, sizeof(*event)) != sizeof(*event)) {
-				jack_error ("cannot send event to client [%s] (%s)",
-					    client->control->name,
-					    strerror (errno));
-				client->error += JACK_ERROR_WITH_SOCKETS;
-				jack_engine_signal_problems (engine);
-			}
+		client->execution_order = n;
+		client->next_client = NULL;
 
-			/* for property changes, deliver the extra data representing
-			   the variable length "key" that has changed in some way.
-			 */
+		if (jack_client_is_internal (client)) {
+			VERBOSE (engine, "client %s: internal client",
+				 client->control->name);
+			jack_deliver_event (engine, client, &event);
+			continue;
+		}
 
-			if (event->type == PropertyChange) {
-				if (keylen) {
-					if (write (client->event_fd, key, keylen) != keylen) {
-						jack_error ("cannot send property change key to client [%s] (%s)",
-							    client->control->name,
-							    strerror (errno));
-						client->error += JACK_ERROR_WITH_SOCKETS;
-						jack_engine_signal_problems (engine);
-					}
-				}
-			}
+		client->subgraph_start_fd = jack_get_fifo_fd (engine, n);
+		client->subgraph_wait_fd = jack_get_fifo_fd (engine, n + 1);
 
-			if (client->error) {
-				status = -1;
-			} else {
-				// then we check whether there really is an error.... :)
+		VERBOSE (engine, "client %s: start_fd=%d wait_fd=%d "
+			 "execution_order=%lu.", client->control->name,
+			 client->subgraph_start_fd, client->subgraph_wait_fd, n);
 
-				struct pollfd pfd[1];
-				pfd[0].fd = client->event_fd;
-				pfd[0].events = POLLERR | POLLIN | POLLHUP | POLLNVAL;
-				jack_time_t poll_timeout = JACKD_CLIENT_EVENT_TIMEOUT;
-				int poll_ret;
-				jack_time_t then = jack_get_microseconds ();
-				jack_time_t now;
+		event.x.n = n;
+		event.y.n = 1;  /* upstream is always jackd */
+		event.z.next_slot = -1;
+		jack_deliver_event (engine, client, &event);
 
-				/* if we're not running realtime and there is a client timeout set
-				   that exceeds the default client event timeout (which is not
-				   bound by RT limits, then use the larger timeout.
-				 */
+		n += 2;
+	}
 
-				if (!engine->control->real_time && (engine->client_timeout_msecs > poll_timeout)) {
-					poll_timeout = engine->client_timeout_msecs;
-				}
+	VERBOSE (engine, "-- jack_rechain_graph_parallel()");
 
-#ifdef __linux
-again:
-#endif
-				VERBOSE (engine, "client event poll on %d for %s starts at %lld",
-					 client->event_fd, client->control->name, then);
-				if ((poll_ret = poll (pfd, 1, poll_timeout)) < 0) {
-					DEBUG ("client event poll not ok! (-1) poll returned an error");
-					jack_error ("poll on subgraph processing failed (%s)", strerror (errno));
-					status = -1;
-				} else {
+	return jack_dag_build (engine);
+}
 
-					DEBUG ("\n\n\n\n\n back from client event poll, revents = 0x%x\n\n\n", pfd[0].revents);
-					now = jack_get_microseconds ();
-					VERBOSE (engine, "back from client event poll after %lld usecs", now - then);
+/* the activation slot that the client preceding `node' in the serial
+   chain has to wake: the next external client, or the engine if the
+   subgraph ends there.
+ */
+static int32_t
+jack_rechain_next_slot (JSList *node)
+{
+	for (; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *next =
+			(jack_client_internal_t*)node->data;
 
-					if (pfd[0].revents & ~POLLIN) {
+		if (!next->control->active ||
+		    (!next->control->process_cbset &&
+		     !next->control->thread_cb_cbset) ||
+		    jack_client_is_decimated (next)) {
+			continue;
+		}
 
-						/* some kind of OOB socket event */
+		if (jack_client_is_internal (next)) {
+			break;
+		}
 
-						DEBUG ("client event poll not ok! (-2), revents = %d\n", pfd[0].revents);
-						jack_error ("subgraph starting at %s lost client", client->control->name);
-						status = -2;
+		return next->control->activation_slot;
+	}
 
-					} else if (pfd[0].revents & POLLIN) {
+	return JACK_ACTIVATION_ENGINE;
+}
 
-						/* client responded normally */
+/* Flatten the sorted client list into a new execution plan and put it in
+ * place of the old one. The steps are the subgraphs of
+ * jack_rechain_graph(): every runnable internal client, and every
+ * runnable external client that is not chained to the one before it,
+ * then the decimated clients, one subgraph each.
+ * caller must hold client_lock.
+ */
+void
+jack_engine_compile_plan (jack_engine_t *engine)
+{
+	jack_exec_plan_t *plan, *old;
+	jack_client_internal_t *client;
+	jack_client_control_t *ctl;
+	jack_exec_step_t *step;
+	JSList *node;
+	unsigned int n = 0, i;
+	int chained = FALSE;
 
-						DEBUG ("client event poll ok!");
-						status = 0;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (jack_client_is_runnable (client)) {
+			n++;
+		} else {
+			/* not reset by the cycles from now on */
+			ctl = client->control;
+			ctl->state = NotTriggered;
+			ctl->timed_out = 0;
+			ctl->signalled_at = 0;
+			ctl->awake_at = 0;
+			ctl->finished_at = 0;
+			ctl->process_cpu_usecs = 0;
+			ctl->process_preemptions = 0;
+		}
+	}
 
-					} else if (poll_ret == 0) {
+	/* steps first: they are the ones that need the alignment */
+	plan = (jack_exec_plan_t*)
+	       malloc (sizeof(jack_exec_plan_t) +
+		       n * (sizeof(jack_exec_step_t) +
+			    sizeof(jack_client_control_t*) +
+			    sizeof(jack_client_internal_t*)));
 
-						/* no events, no errors, we woke up because poll()
-						   decided that time was up ...
-						 */
+	if (plan) {
+		plan->steps = (jack_exec_step_t*)(plan + 1);
+		plan->controls = (jack_client_control_t**)(plan->steps + n);
+		plan->decimated = (jack_client_internal_t**)(plan->controls + n);
+		plan->ncontrols = 0;
+		plan->nsteps = 0;
+		plan->ndecimated = 0;
 
-#ifdef __linux
-						if (linux_poll_bug_encountered (engine, then, &poll_timeout)) {
-							goto again;
-						}
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			client = (jack_client_internal_t*)node->data;
 
-						if (poll_timeout < 200) {
-							VERBOSE (engine, "FALSE WAKEUP skipped, remaining = %lld usec", poll_timeout);
-							status = 0;
-						} else {
-#endif
-						DEBUG ("client event poll not ok! (1 = poll timed out, revents = 0x%04x, poll_ret = %d)", pfd[0].revents, poll_ret);
-						VERBOSE (engine, "client %s did not respond to event type %d in time"
-							 "(fd=%d, revents = 0x%04x, timeout was %lld)",
-							 client->control->name, event->type,
-							 client->event_fd,
-							 pfd[0].revents,
-							 poll_timeout);
-						status = -2;
-#ifdef __linux
-					}
-#endif
-					}
-				}
+			if (!jack_client_is_runnable (client)) {
+				continue;
 			}
 
-			if (status == 0) {
-				if (read (client->event_fd, &status, sizeof(status)) != sizeof(status)) {
-					jack_error ("cannot read event response from client [%s] (%s)",
-						    client->control->name,
-						    strerror (errno));
-					status = -1;
-				}
+			plan->controls[plan->ncontrols++] = client->control;
 
-			} else {
-				switch (status) {
-				case -1:
-					jack_error ("internal poll failure reading response from client %s to a %s event",
-						    client->control->name,
-						    jack_event_type_name (event->type));
-					break;
-				case -2:
-					jack_error ("timeout waiting for client %s to handle a %s event",
-						    client->control->name,
-						    jack_event_type_name (event->type));
-					break;
-				default:
-					jack_error ("bad status (%d) from client %s while handling a %s event",
-						    (int)status,
-						    client->control->name,
-						    jack_event_type_name (event->type));
-				}
+			if (jack_client_is_decimated (client)) {
+				plan->decimated[plan->ndecimated++] = client;
+				continue;
 			}
 
-			if (status < 0) {
-				client->error += JACK_ERROR_WITH_SOCKETS;
-				jack_engine_signal_problems (engine);
+#ifndef JACK_USE_MACH_THREADS
+			/* with Mach threads every client gets resumed by us */
+			if (!jack_client_is_internal (client) && chained) {
+				continue;
 			}
+#endif
+
+			step = &plan->steps[plan->nsteps++];
+			step->client = client;
+			step->control = client->control;
+			step->internal = jack_client_is_internal (client);
+			step->decimated = FALSE;
+			step->start_act = step->internal ? NULL :
+					  jack_activation_slot (engine->control,
+								client->control->activation_slot);
+
+			chained = !step->internal;
 		}
+
+		for (i = 0; i < plan->ndecimated; i++) {
+			client = plan->decimated[i];
+			step = &plan->steps[plan->nsteps++];
+			step->client = client;
+			step->control = client->control;
+			step->internal = FALSE;
+			step->decimated = TRUE;
+			step->start_act = jack_activation_slot (engine->control,
+								client->control->activation_slot);
+		}
+
+		VERBOSE (engine, "execution plan: %u clients, %u steps, "
+			 "%u decimated", plan->ncontrols, plan->nsteps,
+			 plan->ndecimated);
+	} else {
+		jack_error ("cannot allocate execution plan for %u clients", n);
 	}
-	DEBUG ("event delivered");
 
-	return status;
+	/* the driver thread only looks at the plan with the graph read
+	   lock held, which our caller's write lock rules out, so nobody
+	   can be using the old one any more.
+	 */
+
+	old = engine->plan;
+	__atomic_store_n (&engine->plan, plan, __ATOMIC_RELEASE);
+	free (old);
 }
 
-int
-jack_rechain_graph (jack_engine_t *engine)
+static int
+jack_rechain_clients (jack_engine_t *engine)
 {
 	JSList *node, *next;
 	unsigned long n;
@@ -3195,6 +7944,12 @@ jack_rechain_graph (jack_engine_t *engine)
 	jack_event_t event;
 	int upstream_is_jackd;
 
+	jack_engine_suggest_cpus (engine);
+
+	if (engine->parallel) {
+		return jack_rechain_graph_parallel (engine);
+	}
+
 	VALGRIND_MEMSET (&event, 0, sizeof(event));
 
 	jack_clear_fifos (engine);
@@ -3215,6 +7970,11 @@ jack_rechain_graph (jack_engine_t *engine)
 			continue;
 		}
 
+		/* in subgraphs of their own, below */
+		if (jack_client_is_decimated (client)) {
+			continue;
+		}
+
 		VERBOSE (engine, "+++ client is now %s active ? %d",
 			 client->control->name, client->control->active);
 
@@ -3313,38 +8073,249 @@ jack_rechain_graph (jack_engine_t *engine)
 						 control->name, n);
 					subgraph_client->subgraph_wait_fd = -1;
 
-					/* this external client after
-					   this will have another
-					   client as its upstream
-					   connection.
-					 */
+					/* this external client after
+					   this will have another
+					   client as its upstream
+					   connection.
+					 */
+
+					upstream_is_jackd = 0;
+				}
+
+				/* make sure fifo for 'n + 1' exists
+				 * before issuing client reorder
+				 */
+				(void)jack_get_fifo_fd (
+					engine, client->execution_order + 1);
+				event.x.n = client->execution_order;
+				event.y.n = upstream_is_jackd;
+				event.z.next_slot = jack_rechain_next_slot (next);
+				jack_deliver_event (engine, client, &event);
+				n++;
+			}
+		}
+	}
+
+	if (subgraph_client) {
+		subgraph_client->subgraph_wait_fd =
+			jack_get_fifo_fd (engine, n);
+		VERBOSE (engine, "client %s: wait_fd=%d, "
+			 "execution_order=%lu (last client).",
+			 subgraph_client->control->name,
+			 subgraph_client->subgraph_wait_fd, n);
+		n++;
+	}
+
+	/* decimated clients do not run in most cycles, so none of them
+	   can be in a chain that the others depend on: each starts on
+	   the nth FIFO and ends on the next one, and reports straight
+	   back to the engine */
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+
+		if (!jack_client_is_decimated (client) ||
+		    !client->control->active ||
+		    (!client->control->process_cbset &&
+		     !client->control->thread_cb_cbset)) {
+			continue;
+		}
+
+		client->execution_order = n;
+		client->next_client = NULL;
+		client->subgraph_start_fd = jack_get_fifo_fd (engine, n);
+		client->subgraph_wait_fd = jack_get_fifo_fd (engine, n + 1);
+
+		VERBOSE (engine, "client %s: decimated, start_fd=%d, "
+			 "wait_fd=%d, execution_order=%lu.",
+			 client->control->name, client->subgraph_start_fd,
+			 client->subgraph_wait_fd, n);
+
+		event.x.n = n;
+		event.y.n = 1;
+		event.z.next_slot = JACK_ACTIVATION_ENGINE;
+		jack_deliver_event (engine, client, &event);
+		n += 2;
+	}
+
+	VERBOSE (engine, "-- jack_rechain_graph()");
+
+	return err;
+}
+
+/* With --share-buffers, give the audio outputs of a serial graph
+ * buffers by lifetime. An output's data is only needed from the time
+ * its client writes it until the last of its readers has run, so
+ * outputs whose lifetimes do not overlap can use the same buffer, one
+ * of a pool the engine takes off the free list. However many ports
+ * there are, a cycle then touches about as many buffers as there are
+ * outputs live at once. Every output still owns the buffer it was
+ * registered with, and goes back to it whenever it cannot share:
+ *
+ *   - when the graph runs in parallel, as there is no order then;
+ *   - when its client is not in the order, as a driver's or a
+ *     decimated client's is not, and so does not write it every cycle
+ *     at a known point;
+ *   - when one of its readers runs no later than its client, which
+ *     is a feedback loop that reads the last cycle's data;
+ *   - when it carries several channels.
+ *
+ * An output read by a client that is not in the order, or by the
+ * engine at the end of the cycle, keeps its pooled buffer to the end.
+ * caller must hold client_lock and the graph lock.
+ */
+#define JACK_SHARE_END UINT32_MAX
+
+static void
+jack_engine_share_port_buffers (jack_engine_t *engine)
+{
+	jack_port_buffer_list_t *blist =
+		&engine->port_buffers[JACK_AUDIO_PORT_TYPE];
+	jack_port_buffer_info_t **slots = NULL;
+	jack_client_internal_t *client;
+	jack_connection_internal_t *connection;
+	jack_port_internal_t *port;
+	JSList *node, *pnode, *cnode;
+	uint32_t *order = NULL, *busy_until = NULL;
+	uint32_t start, end, reader, n, i, nslots = 0, nshared = 0;
+
+	if (!engine->share_buffers || blist->info == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&blist->lock);
+
+	/* everyone back to their own buffers, and the pool to the head
+	   of the free list, so that the same buffers are taken again */
+	for (i = 0; i < engine->port_max; i++) {
+		port = &engine->internal_ports[i];
+		if (port->share_info) {
+			port->share_info = NULL;
+			port->shared->pooled = 0;
+			port->shared->offset = port->buffer_info->offset;
+		}
+	}
+	blist->freelist = jack_slist_concat (engine->share_pool,
+					     blist->freelist);
+	engine->share_pool = NULL;
+
+	if (engine->parallel) {
+		goto out;
+	}
+
+	order = (uint32_t*)calloc (engine->port_max, sizeof(uint32_t));
+	busy_until = (uint32_t*)malloc (engine->port_max * sizeof(uint32_t));
+	slots = (jack_port_buffer_info_t**)
+		malloc (engine->port_max * sizeof(jack_port_buffer_info_t*));
+
+	if (order == NULL || busy_until == NULL || slots == NULL) {
+		jack_error ("cannot allocate memory to share port buffers");
+		goto out;
+	}
+
+	/* where each port's client runs, from 1; 0 is not at all */
+	n = 0;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (!jack_client_is_runnable (client) ||
+		    jack_client_is_decimated (client)) {
+			continue;
+		}
+		++n;
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			port = (jack_port_internal_t*)pnode->data;
+			order[port->shared->id] = n;
+		}
+	}
+
+	/* the clients in order give the lifetimes by start, so the
+	   first buffer free before a start is as good as any */
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (!jack_client_is_runnable (client) ||
+		    jack_client_is_decimated (client)) {
+			continue;
+		}
+
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			port = (jack_port_internal_t*)pnode->data;
+
+			if (!(port->shared->flags & JackPortIsOutput) ||
+			    port->shared->ptype_id != JACK_AUDIO_PORT_TYPE ||
+			    port->shared->channels > 1 ||
+			    port->buffer_info == NULL) {
+				continue;
+			}
+
+			start = end = order[port->shared->id];
+
+			for (cnode = port->connections; cnode;
+			     cnode = jack_slist_next (cnode)) {
+				connection = (jack_connection_internal_t*)
+					     cnode->data;
+				if (connection->source != port) {
+					continue;
+				}
+				reader = order[connection->destination->shared->id];
+				if (reader == 0) {
+					end = JACK_SHARE_END;
+				} else if (reader <= start) {
+					break;
+				} else if (reader > end) {
+					end = reader;
+				}
+			}
+
+			if (cnode) {
+				continue;
+			}
 
-					upstream_is_jackd = 0;
+			for (i = 0; i < nslots; i++) {
+				if (busy_until[i] < start) {
+					break;
 				}
+			}
 
-				/* make sure fifo for 'n + 1' exists
-				 * before issuing client reorder
-				 */
-				(void)jack_get_fifo_fd (
-					engine, client->execution_order + 1);
-				event.x.n = client->execution_order;
-				event.y.n = upstream_is_jackd;
-				jack_deliver_event (engine, client, &event);
-				n++;
+			if (i == nslots) {
+				if (blist->freelist == NULL) {
+					continue;
+				}
+				slots[nslots++] = (jack_port_buffer_info_t*)
+						  blist->freelist->data;
+				blist->freelist = jack_slist_remove (
+					blist->freelist, slots[i]);
 			}
+
+			busy_until[i] = end;
+			port->share_info = slots[i];
+			port->shared->offset = slots[i]->offset;
+			port->shared->pooled = 1;
+			nshared++;
 		}
 	}
 
-	if (subgraph_client) {
-		subgraph_client->subgraph_wait_fd =
-			jack_get_fifo_fd (engine, n);
-		VERBOSE (engine, "client %s: wait_fd=%d, "
-			 "execution_order=%lu (last client).",
-			 subgraph_client->control->name,
-			 subgraph_client->subgraph_wait_fd, n);
+	for (i = 0; i < nslots; i++) {
+		engine->share_pool = jack_slist_append (engine->share_pool,
+							slots[i]);
 	}
 
-	VERBOSE (engine, "-- jack_rechain_graph()");
+	VERBOSE (engine, "%" PRIu32 " audio outputs share %" PRIu32
+		 " buffers", nshared, nslots);
+
+out:
+	pthread_mutex_unlock (&blist->lock);
+	free (order);
+	free (busy_until);
+	free (slots);
+}
+
+int
+jack_rechain_graph (jack_engine_t *engine)
+{
+	int err = jack_rechain_clients (engine);
+
+	jack_engine_compile_plan (engine);
+	jack_engine_share_port_buffers (engine);
 
 	return err;
 }
@@ -3381,7 +8352,7 @@ jack_get_port_total_latency (jack_engine_t *engine,
 	}
 
 #ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
-	jack_info ("%sFor port %s (%s)", prefix, port->shared->name, (toward_port ? "toward" : "away"));
+	jack_info ("%sFor port %s (%s)", prefix, port->names->name, (toward_port ? "toward" : "away"));
 #endif
 
 	for (node = port->connections; node; node = jack_slist_next (node)) {
@@ -3400,8 +8371,8 @@ jack_get_port_total_latency (jack_engine_t *engine,
 #ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
 			jack_info ("%s\tskip connection %s->%s",
 				   prefix,
-				   connection->source->shared->name,
-				   connection->destination->shared->name);
+				   connection->source->names->name,
+				   connection->destination->names->name);
 #endif
 
 			continue;
@@ -3410,8 +8381,8 @@ jack_get_port_total_latency (jack_engine_t *engine,
 #ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
 		jack_info ("%s\tconnection %s->%s ... ",
 			   prefix,
-			   connection->source->shared->name,
-			   connection->destination->shared->name);
+			   connection->source->names->name,
+			   connection->destination->names->name);
 #endif
 		/* if we're a destination in the connection, recurse
 		   on the source to get its total latency
@@ -3475,20 +8446,21 @@ jack_compute_port_total_latency (jack_engine_t* engine, jack_port_shared_t* port
 static void
 jack_compute_all_port_total_latencies (jack_engine_t *engine)
 {
-	jack_port_shared_t *shared = engine->control->ports;
+	jack_port_shared_t *shared;
 	unsigned int i;
 	int toward_port;
 
-	for (i = 0; i < engine->control->port_max; i++) {
-		if (shared[i].in_use) {
+	for (i = 0; i < engine->port_max; i++) {
+		shared = jack_engine_port (engine, i);
+		if (shared->in_use) {
 
-			if (shared[i].flags & JackPortIsOutput) {
+			if (shared->flags & JackPortIsOutput) {
 				toward_port = FALSE;
 			} else {
 				toward_port = TRUE;
 			}
 
-			shared[i].total_latency =
+			shared->total_latency =
 				jack_get_port_total_latency (
 					engine, &engine->internal_ports[i],
 					0, toward_port);
@@ -3496,45 +8468,263 @@ jack_compute_all_port_total_latencies (jack_engine_t *engine)
 	}
 }
 
+/* Latency propagation.
+ *
+ * Each client has a bit per pass (1 << JackCaptureLatency, 1 <<
+ * JackPlaybackLatency) in latency_dirty, set when a latency it reads
+ * may have changed: it is at one end of a connection that was made
+ * or broken, or it is connected to a port whose range just changed.
+ * A pass only visits marked clients, and only a client with its own
+ * latency callback gets the (synchronous) LatencyCallback event; for
+ * the rest the engine does what libjack's default handler would.
+ * So a change costs a round trip per affected client that cares,
+ * rather than two per client in the graph.
+ */
+
 static void
-jack_compute_new_latency (jack_engine_t *engine)
+jack_latency_mark_all (jack_engine_t *engine)
 {
 	JSList *node;
-	JSList *reverse_list = NULL;
-	jack_event_t event;
 
-	VALGRIND_MEMSET (&event, 0, sizeof(event));
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		((jack_client_internal_t*)node->data)->latency_dirty =
+			(1 << JackCaptureLatency) | (1 << JackPlaybackLatency);
+	}
+}
 
-	event.type = LatencyCallback;
-	event.x.n  = 0;
+static void
+jack_port_shared_get_latency (jack_port_shared_t *shared,
+			      jack_latency_callback_mode_t mode,
+			      jack_latency_range_t *range)
+{
+	if (mode == JackCaptureLatency) {
+		range->min = shared->capture_latency.min;
+		range->max = shared->capture_latency.max;
+	} else {
+		range->min = shared->playback_latency.min;
+		range->max = shared->playback_latency.max;
+	}
+}
 
-	/* iterate over all clients in graph order, and emit
-	 * capture latency callback.
-	 * also builds up list in reverse graph order.
-	 */
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
+/* same as jack_port_set_latency_range(), including the hack for
+ * backend ports */
+static void
+jack_port_shared_set_latency (jack_port_shared_t *shared,
+			      jack_latency_callback_mode_t mode,
+			      const jack_latency_range_t *range)
+{
+	if (mode == JackCaptureLatency) {
+		shared->capture_latency.min = range->min;
+		shared->capture_latency.max = range->max;
+		if ((shared->flags & JackPortIsOutput) && (shared->flags & JackPortIsPhysical)) {
+			shared->latency = (range->min + range->max) / 2;
+		}
+	} else {
+		shared->playback_latency.min = range->min;
+		shared->playback_latency.max = range->max;
+		if ((shared->flags & JackPortIsInput) && (shared->flags & JackPortIsPhysical)) {
+			shared->latency = (range->min + range->max) / 2;
+		}
+	}
+}
 
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		reverse_list = jack_slist_prepend (reverse_list, client);
+static void
+jack_latency_range_merge (jack_latency_range_t *latency,
+			  const jack_latency_range_t *other)
+{
+	if (other->max > latency->max) {
+		latency->max = other->max;
+	}
+	if (other->min < latency->min) {
+		latency->min = other->min;
+	}
+}
+
+/* what jack_port_recalculate_latency() does in the client: the
+ * range of everything connected to `port' */
+static void
+jack_port_recalculate_latency_internal (jack_engine_t *engine,
+					jack_port_internal_t *port,
+					jack_latency_callback_mode_t mode)
+{
+	jack_latency_range_t latency = { UINT32_MAX, 0 };
+	jack_latency_range_t other;
+	jack_connection_internal_t *connection;
+	JSList *node;
+
+	for (node = port->connections; node; node = jack_slist_next (node)) {
+		connection = (jack_connection_internal_t*)node->data;
+		jack_port_shared_get_latency (
+			(connection->source == port ?
+			 connection->destination : connection->source)->shared,
+			mode, &other);
+		/* a pipeline stage boundary, see jack_pipeline_plan() */
+		if (connection->source->shared->delayed &&
+		    connection->destination->shared->stage >
+		    connection->source->shared->stage) {
+			other.min += engine->control->buffer_size;
+			other.max += engine->control->buffer_size;
+		}
+		jack_latency_range_merge (&latency, &other);
+	}
+
+	if (latency.min == UINT32_MAX) {
+		latency.min = 0;
+	}
+
+	jack_port_shared_set_latency (port->shared, mode, &latency);
+}
+
+static void
+jack_client_compute_latency (jack_engine_t *engine,
+			     jack_client_internal_t *client,
+			     jack_latency_callback_mode_t mode)
+{
+	/* in capture mode latency flows from the inputs of a client
+	   to its outputs and on to whatever they are connected to;
+	   in playback mode the other way round */
+	unsigned long in = (mode == JackCaptureLatency) ?
+			   JackPortIsInput : JackPortIsOutput;
+	jack_latency_range_t latency = { UINT32_MAX, 0 };
+	jack_latency_range_t *before = NULL, now;
+	jack_port_internal_t *port;
+	jack_connection_internal_t *connection;
+	jack_event_t event;
+	JSList *node, *cnode;
+	unsigned int n;
+
+	if (client->control->latency_cbset) {
+
+		/* the callback may change any of the ranges the
+		   neighbours read, so keep them to compare */
+		before = (jack_latency_range_t*)
+			 malloc (jack_slist_length (client->ports) *
+				 sizeof(jack_latency_range_t) + 1);
+
+		for (n = 0, node = client->ports; before && node;
+		     node = jack_slist_next (node), n++) {
+			port = (jack_port_internal_t*)node->data;
+			jack_port_shared_get_latency (port->shared, mode,
+						      &before[n]);
+		}
+
+		VALGRIND_MEMSET (&event, 0, sizeof(event));
+		event.type = LatencyCallback;
+		event.x.n = (mode == JackCaptureLatency) ? 0 : 1;
 		jack_deliver_event (engine, client, &event);
+
+	} else {
+
+		/* libjack's default: the client's ports all depend on
+		   each other. a driver's don't depend on each other at
+		   all, there only the ports fed from the graph move.
+		 */
+		for (node = client->ports; node; node = jack_slist_next (node)) {
+			port = (jack_port_internal_t*)node->data;
+			if (port->shared->flags & in) {
+				jack_port_recalculate_latency_internal (engine, port,
+									mode);
+				jack_port_shared_get_latency (port->shared, mode, &now);
+				jack_latency_range_merge (&latency, &now);
+			}
+		}
+
+		if (client->control->type == ClientDriver) {
+			return;
+		}
+
+		if (latency.min == UINT32_MAX) {
+			latency.min = 0;
+		}
+
+		/* one period behind, everything it passes on is a
+		   cycle older */
+		if (client->control->process_async) {
+			latency.min += engine->control->buffer_size;
+			latency.max += engine->control->buffer_size;
+		}
 	}
 
-	if (engine->driver) {
-		jack_deliver_event (engine, engine->driver->internal_client, &event);
+	for (n = 0, node = client->ports; node;
+	     node = jack_slist_next (node), n++) {
+
+		port = (jack_port_internal_t*)node->data;
+
+		if (port->shared->flags & in) {
+			continue;
+		}
+
+		jack_port_shared_get_latency (port->shared, mode, &now);
+
+		if (client->control->latency_cbset) {
+			if (before &&
+			    before[n].min == now.min && before[n].max == now.max) {
+				continue;
+			}
+		} else if (latency.min == now.min && latency.max == now.max) {
+			continue;
+		} else {
+			jack_port_shared_set_latency (port->shared, mode,
+						      &latency);
+		}
+
+		for (cnode = port->connections; cnode;
+		     cnode = jack_slist_next (cnode)) {
+			connection = (jack_connection_internal_t*)cnode->data;
+			if (connection->source == port) {
+				connection->dstclient->latency_dirty |=
+					(1 << mode);
+			} else {
+				connection->srcclient->latency_dirty |=
+					(1 << mode);
+			}
+		}
 	}
 
-	/* now issue playback latency callbacks in reverse graphorder
+	free (before);
+}
+
+static void
+jack_latency_pass (jack_engine_t *engine, JSList *order,
+		   jack_latency_callback_mode_t mode)
+{
+	jack_client_internal_t *client;
+	JSList *node;
+	int pass;
+
+	/* drivers run first, so in graph order they are visited
+	   before the clients that feed their playback ports. those
+	   get a second look, as the driver got a second event before.
 	 */
-	event.x.n  = 1;
-	for (node = reverse_list; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		jack_deliver_event (engine, client, &event);
+	for (pass = 0; pass < 2; pass++) {
+		for (node = order; node; node = jack_slist_next (node)) {
+			client = (jack_client_internal_t*)node->data;
+			if ((client->latency_dirty & (1 << mode)) &&
+			    (pass == 0 || client->control->type == ClientDriver)) {
+				client->latency_dirty &= ~(1 << mode);
+				jack_client_compute_latency (engine, client, mode);
+			}
+		}
 	}
+}
 
-	if (engine->driver) {
-		jack_deliver_event (engine, engine->driver->internal_client, &event);
+static void
+jack_compute_new_latency (jack_engine_t *engine)
+{
+	JSList *node;
+	JSList *reverse_list = NULL;
+
+	/* capture latencies in graph order, then playback latencies
+	 * in reverse graph order.
+	 */
+	jack_latency_pass (engine, engine->clients, JackCaptureLatency);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		reverse_list = jack_slist_prepend (reverse_list, node->data);
 	}
 
+	jack_latency_pass (engine, reverse_list, JackPlaybackLatency);
+
 	jack_slist_free (reverse_list);
 }
 
@@ -3564,61 +8754,358 @@ jack_compute_new_latency (jack_engine_t *engine)
  * except that feedback connections appear normally instead of reversed.
  * This is used to detect whether the graph has become acyclic.
  *
+ * The order of engine->clients is kept topologically sorted at all
+ * times, and each client's position is cached in sort_index. Removing
+ * a connection cannot invalidate the order, and a new connection from
+ * A to B only needs work if B currently runs before A: then, unless
+ * B reaches A (one bit of B's reach set, see jack_client_reaches()),
+ * the clients that B reaches and that run before A are moved, in
+ * their current order, to just after A. Everything else keeps its
+ * place, so a connection costs time in proportion to the part of the
+ * graph it affects rather than a full sort. jack_sort_clients() does the full
+ * sort, which is only needed when clients are activated or when
+ * feedback connections are turned around.
+ */
+
+void
+jack_sort_graph (jack_engine_t *engine)
+{
+	/* called, obviously, must hold engine->client_lock */
+
+	VERBOSE (engine, "++ jack_sort_graph");
+	jack_sort_clients (engine);
+	jack_latency_mark_all (engine);
+	jack_update_graph (engine);
+	VERBOSE (engine, "-- jack_sort_graph");
+}
+
+static void
+jack_update_graph (jack_engine_t *engine)
+{
+	/* caller must hold engine->client_lock */
+
+	jack_compute_all_port_total_latencies (engine);
+	jack_compute_new_latency (engine);
+	jack_rechain_graph (engine);
+	engine->timeout_count = 0;
+}
+
+static void
+jack_renumber_clients (jack_engine_t *engine)
+{
+	JSList *node;
+	unsigned int n;
+
+	for (n = 0, node = engine->clients; node;
+	     node = jack_slist_next (node), n++) {
+		((jack_client_internal_t*)node->data)->sort_index = n;
+	}
+}
+
+static void
+jack_sort_clients (jack_engine_t *engine)
+{
+	/* caller must hold engine->client_lock */
+	jack_client_internal_t **order;
+	jack_client_internal_t *client;
+	JSList *node, *fnode;
+	unsigned int n, i, head, tail;
+	int pass;
+
+	if ((n = jack_slist_length (engine->clients)) == 0) {
+		return;
+	}
+
+	if ((order = (jack_client_internal_t**)
+		     malloc (n * sizeof(jack_client_internal_t*))) == NULL) {
+		jack_error ("cannot allocate memory to sort %u clients", n);
+		return;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		((jack_client_internal_t*)node->data)->sort_pending = 0;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		for (fnode = client->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			((jack_client_internal_t*)fnode->data)->sort_pending++;
+		}
+	}
+
+	/* Kahn's algorithm. drivers are forced to the front, ie
+	   considered as sources rather than sinks for purposes of the
+	   sort, and since nothing is ever sorted as feeding a driver
+	   they are all ready at the start.
+	 */
+
+	tail = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			client = (jack_client_internal_t*)node->data;
+			if (client->sort_pending == 0 &&
+			    (client->control->type == ClientDriver) == (pass == 0)) {
+				order[tail++] = client;
+			}
+		}
+	}
+
+	for (head = 0; head < tail; head++) {
+		for (fnode = order[head]->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			client = (jack_client_internal_t*)fnode->data;
+			if (--client->sort_pending == 0) {
+				order[tail++] = client;
+			}
+		}
+	}
+
+	if (tail < n) {
+		/* cannot happen while the sortfeeds relation is acyclic */
+		jack_error ("client graph could not be sorted (%u of %u "
+			    "clients left over)", n - tail, n);
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			client = (jack_client_internal_t*)node->data;
+			if (client->sort_pending > 0) {
+				order[tail++] = client;
+			}
+		}
+	}
+
+	for (i = 0, node = engine->clients; node;
+	     node = jack_slist_next (node), i++) {
+		node->data = order[i];
+		order[i]->sort_index = i;
+	}
+
+	free (order);
+}
+
+/* Reachability.
+ *
+ * Each client has a bitset of the clients it feeds along the sortfeeds
+ * relation, directly or through others, indexed by reach_index. A new
+ * sortfeeds entry adds to the set of its client and to those of all the
+ * clients that reach it. Removing one can shrink any number of sets, so
+ * it only marks them dirty: the next question rebuilds them all in one
+ * pass backwards over the execution order, which is topologically
+ * sorted. Caller must hold client_lock for all of these.
  */
 
-void
-jack_sort_graph (jack_engine_t *engine)
+static void
+jack_reach_grow (jack_engine_t *engine)
+{
+	unsigned int size = engine->reach_size ? engine->reach_size * 2 : 64;
+	bitset_t used;
+	JSList *node;
+	unsigned int i;
+
+	bitset_create (&used, size);
+	for (i = 0; i < engine->reach_size; i++) {
+		if (bitset_contains (engine->reach_used, i)) {
+			bitset_add (used, i);
+		}
+	}
+	bitset_destroy (&engine->reach_used);
+	engine->reach_used = used;
+	engine->reach_size = size;
+
+	/* the sets themselves are rebuilt the next time they are needed */
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+		bitset_destroy (&client->reach);
+		bitset_create (&client->reach, size);
+	}
+	engine->reach_dirty = TRUE;
+}
+
+/* give a client that has just been added to engine->clients its bit */
+void
+jack_reach_attach (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	unsigned int i;
+
+	for (i = 0; i < engine->reach_size; i++) {
+		if (!bitset_contains (engine->reach_used, i)) {
+			break;
+		}
+	}
+
+	if (i == engine->reach_size) {
+		jack_reach_grow (engine);
+	}
+
+	bitset_add (engine->reach_used, i);
+	client->reach_index = i;
+
+	if (client->reach == NULL) {
+		bitset_create (&client->reach, engine->reach_size);
+	}
+}
+
+void
+jack_reach_detach (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	JSList *node;
+
+	if (client->reach == NULL) {
+		return;
+	}
+
+	/* the bit may be handed out again before the next rebuild */
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *other =
+			(jack_client_internal_t*)node->data;
+		if (other->reach) {
+			bitset_remove (other->reach, client->reach_index);
+		}
+	}
+
+	bitset_remove (engine->reach_used, client->reach_index);
+	bitset_destroy (&client->reach);
+}
+
+static void
+jack_reach_rebuild (jack_engine_t *engine)
 {
-	/* called, obviously, must hold engine->client_lock */
+	jack_client_internal_t **order;
+	JSList *node, *fnode;
+	unsigned int n, i;
 
-	VERBOSE (engine, "++ jack_sort_graph");
-	engine->clients = jack_slist_sort (engine->clients,
-					   (JCompareFunc)jack_client_sort);
-	jack_compute_all_port_total_latencies (engine);
-	jack_compute_new_latency (engine);
-	jack_rechain_graph (engine);
-	engine->timeout_count = 0;
-	VERBOSE (engine, "-- jack_sort_graph");
+	if ((n = jack_slist_length (engine->clients)) == 0) {
+		engine->reach_dirty = FALSE;
+		return;
+	}
+
+	if ((order = (jack_client_internal_t**)
+		     malloc (n * sizeof(jack_client_internal_t*))) == NULL) {
+		jack_error ("cannot allocate memory to update the reach "
+			    "of %u clients", n);
+		return;
+	}
+
+	for (i = 0, node = engine->clients; node; node = jack_slist_next (node)) {
+		order[i++] = (jack_client_internal_t*)node->data;
+	}
+
+	/* everything a client feeds comes after it */
+	while (i--) {
+		bitset_clear (order[i]->reach);
+		for (fnode = order[i]->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			jack_client_internal_t *dst =
+				(jack_client_internal_t*)fnode->data;
+			bitset_add (order[i]->reach, dst->reach_index);
+			bitset_union (order[i]->reach, dst->reach);
+		}
+	}
+
+	free (order);
+
+	engine->reach_dirty = FALSE;
 }
 
-static int
-jack_client_sort (jack_client_internal_t *a, jack_client_internal_t *b)
+/* `dst' has just been put on the sortfeeds list of `src' */
+static void
+jack_reach_add (jack_engine_t *engine, jack_client_internal_t *src,
+		jack_client_internal_t *dst)
 {
-	/* drivers are forced to the front, ie considered as sources
-	   rather than sinks for purposes of the sort */
+	JSList *node;
 
-	if (jack_client_feeds_transitive (a, b) ||
-	    (a->control->type == ClientDriver &&
-	     b->control->type != ClientDriver)) {
-		return -1;
-	} else if (jack_client_feeds_transitive (b, a) ||
-		   (b->control->type == ClientDriver &&
-		    a->control->type != ClientDriver)) {
-		return 1;
-	} else {
-		return 0;
+	if (engine->reach_dirty) {
+		return;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+
+		if (client == src ||
+		    bitset_contains (client->reach, src->reach_index)) {
+			bitset_add (client->reach, dst->reach_index);
+			bitset_union (client->reach, dst->reach);
+		}
 	}
 }
 
-/* transitive closure of the relation expressed by the sortfeeds lists. */
+/* does `client' feed `target', directly or not? */
 static int
-jack_client_feeds_transitive (jack_client_internal_t *source,
-			      jack_client_internal_t *dest )
+jack_client_reaches (jack_engine_t *engine, jack_client_internal_t *client,
+		     jack_client_internal_t *target)
 {
-	jack_client_internal_t *med;
-	JSList *node;
+	if (engine->reach_dirty) {
+		jack_reach_rebuild (engine);
+	}
 
-	if (jack_slist_find (source->sortfeeds, dest)) {
-		return 1;
+	return bitset_contains (client->reach, target->reach_index);
+}
+
+/* make the execution order allow for a new connection from `src' to
+   `dst'. returns -1 if dst already feeds src, ie the connection is a
+   feedback connection, 0 otherwise.
+ */
+static int
+jack_client_order_connection (jack_engine_t *engine,
+			      jack_client_internal_t *src,
+			      jack_client_internal_t *dst)
+{
+	JSList *node, *prev, *next;
+	JSList *moved = NULL, *moved_tail = NULL;
+
+	if (dst->sort_index > src->sort_index) {
+		return 0;
 	}
 
-	for (node = source->sortfeeds; node; node = jack_slist_next (node)) {
+	if (jack_client_reaches (engine, dst, src)) {
+		return -1;
+	}
 
-		med = (jack_client_internal_t*)node->data;
+	/* dst and everything it feeds that runs before src have to move,
+	   in order, to just after src.
+	 */
 
-		if (jack_client_feeds_transitive (med, dest)) {
-			return 1;
+	for (prev = NULL, node = engine->clients; node; node = next) {
+
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+
+		next = jack_slist_next (node);
+
+		if (client == src) {
+			break;
+		}
+
+		if (client != dst &&
+		    !bitset_contains (dst->reach, client->reach_index)) {
+			prev = node;
+			continue;
+		}
+
+		if (prev) {
+			prev->next = next;
+		} else {
+			engine->clients = next;
+		}
+
+		node->next = NULL;
+
+		if (moved_tail) {
+			moved_tail->next = node;
+		} else {
+			moved = node;
 		}
+		moved_tail = node;
+	}
+
+	if (moved) {
+		moved_tail->next = node->next;
+		node->next = moved;
+		jack_renumber_clients (engine);
+		VERBOSE (engine, "%s now runs before %s",
+			 src->control->name, dst->control->name);
 	}
 
 	return 0;
@@ -3628,8 +9115,10 @@ jack_client_feeds_transitive (jack_client_internal_t *source,
  * Checks whether the graph has become acyclic and if so modifies client
  * sortfeeds lists to turn leftover feedback connections into normal ones.
  * This lowers latency, but at the expense of some data corruption.
+ * Returns 1 if any connection was turned around, in which case the
+ * clients have to be sorted again.
  */
-static void
+static int
 jack_check_acyclic (jack_engine_t *engine)
 {
 	JSList *srcnode, *dstnode, *portnode, *connnode;
@@ -3681,6 +9170,7 @@ jack_check_acyclic (jack_engine_t *engine)
 	if (stuck) {
 
 		VERBOSE (engine, "graph is still cyclic" );
+		return 0;
 	} else {
 
 		VERBOSE (engine, "graph has become acyclic");
@@ -3726,7 +9216,10 @@ jack_check_acyclic (jack_engine_t *engine)
 			}
 		}
 		engine->feedbackcount = 0;
+		engine->reach_dirty = TRUE;
 	}
+
+	return 1;
 }
 
 /**
@@ -3747,27 +9240,34 @@ void jack_dump_configuration (jack_engine_t *engine, int take_lock)
 		jack_rdlock_graph (engine);
 	}
 
+	if (engine->dag_nstages > 1) {
+		jack_info ("pipelined in %u stages", engine->dag_nstages);
+	}
+
 	for (n = 0, clientnode = engine->clients; clientnode;
 	     clientnode = jack_slist_next (clientnode)) {
 		client = (jack_client_internal_t*)clientnode->data;
 		ctl = client->control;
 
 		jack_info ("client #%d: %s (type: %d, process? %s, thread ? %s"
-			   " start=%d wait=%d",
+			   " start=%d wait=%d stage=%d",
 			   ++n,
 			   ctl->name,
 			   ctl->type,
 			   ctl->process_cbset ? "yes" : "no",
 			   ctl->thread_cb_cbset ? "yes" : "no",
 			   client->subgraph_start_fd,
-			   client->subgraph_wait_fd);
+			   client->subgraph_wait_fd,
+			   client->pipeline_stage);
 
 		for (m = 0, portnode = client->ports; portnode;
 		     portnode = jack_slist_next (portnode)) {
 			port = (jack_port_internal_t*)portnode->data;
 
-			jack_info ("\t port #%d: %s", ++m,
-				   port->shared->name);
+			jack_info ("\t port #%d: %s%s", ++m,
+				   port->names->name,
+				   port->shared->delayed ?
+				   " (read a cycle late by later stages)" : "");
 
 			for (o = 0, connectionnode = port->connections;
 			     connectionnode;
@@ -3780,8 +9280,8 @@ void jack_dump_configuration (jack_engine_t *engine, int take_lock)
 					   (port->shared->flags
 					    & JackPortIsInput) ? "<-" : "->",
 					   (port->shared->flags & JackPortIsInput) ?
-					   connection->source->shared->name :
-					   connection->destination->shared->name);
+					   connection->source->names->name :
+					   connection->destination->names->name);
 			}
 		}
 	}
@@ -3799,6 +9299,50 @@ jack_port_do_connect (jack_engine_t *engine,
 		      const char *source_port,
 		      const char *destination_port)
 {
+	int ret;
+
+	jack_lock_graph (engine);
+	ret = jack_port_connect_internal (engine, source_port,
+					  destination_port, TRUE);
+	jack_unlock_graph (engine);
+
+	return ret;
+}
+
+/* Both ends of a multichannel connection carry the same number of
+   channels; an end that has no count yet takes the other's. */
+static int
+jack_port_negotiate_channels (jack_port_internal_t *srcport,
+			      jack_port_internal_t *dstport)
+{
+	uint32_t src = srcport->shared->channels;
+	uint32_t dst = dstport->shared->channels;
+
+	if (src == 0 && dst == 0) {
+		jack_error ("cannot connect %s and %s: neither has a channel"
+			    " count", srcport->names->name,
+			    dstport->names->name);
+		return -1;
+	}
+
+	if (src && dst && src != dst) {
+		jack_error ("cannot connect %s (%u channels) and %s (%u"
+			    " channels)", srcport->names->name, src,
+			    dstport->names->name, dst);
+		return -1;
+	}
+
+	srcport->shared->channels = dstport->shared->channels = src ? src : dst;
+	return 0;
+}
+
+static int
+jack_port_connect_internal (jack_engine_t *engine,
+			    const char *source_port,
+			    const char *destination_port,
+			    int sort_graph)
+{
+	/* caller must hold engine->client_lock */
 	jack_connection_internal_t *connection;
 	jack_port_internal_t *srcport, *dstport;
 	jack_port_id_t src_id, dst_id;
@@ -3873,6 +9417,11 @@ jack_port_do_connect (jack_engine_t *engine,
 		}
 	}
 
+	if (srcport->shared->ptype_id == JACK_MULTICHANNEL_PORT_TYPE &&
+	    jack_port_negotiate_channels (srcport, dstport)) {
+		return -1;
+	}
+
 	connection = (jack_connection_internal_t*)
 		     malloc (sizeof(jack_connection_internal_t));
 
@@ -3880,19 +9429,18 @@ jack_port_do_connect (jack_engine_t *engine,
 	connection->destination = dstport;
 	connection->srcclient = srcclient;
 	connection->dstclient = dstclient;
+	connection->gain = 1.0f;
+	connection->muted = FALSE;
 
 	src_id = srcport->shared->id;
 	dst_id = dstport->shared->id;
 
-	jack_lock_graph (engine);
-
 	if (dstport->connections && !dstport->shared->has_mixdown) {
 		jack_port_type_info_t *port_type =
 			jack_port_type_info (engine, dstport);
 		jack_error ("cannot make multiple connections to a port of"
 			    " type [%s]", port_type->type_name);
 		free (connection);
-		jack_unlock_graph (engine);
 		return -1;
 	} else {
 
@@ -3905,8 +9453,8 @@ jack_port_do_connect (jack_engine_t *engine,
 
 			VERBOSE (engine,
 				 "connect %s and %s (output)",
-				 srcport->shared->name,
-				 dstport->shared->name);
+				 srcport->names->name,
+				 dstport->names->name);
 
 			connection->dir = 1;
 
@@ -3917,21 +9465,22 @@ jack_port_do_connect (jack_engine_t *engine,
 
 			dstclient->fedcount++;
 
-			if (jack_client_feeds_transitive (dstclient,
-							  srcclient ) ||
-			    (dstclient->control->type == ClientDriver &&
-			     srcclient->control->type != ClientDriver)) {
+			if ((dstclient->control->type == ClientDriver &&
+			     srcclient->control->type != ClientDriver) ||
+			    jack_client_order_connection (engine, srcclient,
+							  dstclient) < 0) {
 
 				/* dest is running before source so
 				   this is a feedback connection */
 
 				VERBOSE (engine,
 					 "connect %s and %s (feedback)",
-					 srcport->shared->name,
-					 dstport->shared->name);
+					 srcport->names->name,
+					 dstport->names->name);
 
 				dstclient->sortfeeds = jack_slist_prepend
 							       (dstclient->sortfeeds, srcclient);
+				jack_reach_add (engine, dstclient, srcclient);
 
 				connection->dir = -1;
 				engine->feedbackcount++;
@@ -3945,11 +9494,12 @@ jack_port_do_connect (jack_engine_t *engine,
 
 				VERBOSE (engine,
 					 "connect %s and %s (forward)",
-					 srcport->shared->name,
-					 dstport->shared->name);
+					 srcport->names->name,
+					 dstport->names->name);
 
 				srcclient->sortfeeds = jack_slist_prepend
 							       (srcclient->sortfeeds, dstclient);
+				jack_reach_add (engine, srcclient, dstclient);
 
 				connection->dir = 1;
 			}
@@ -3958,8 +9508,8 @@ jack_port_do_connect (jack_engine_t *engine,
 
 			VERBOSE (engine,
 				 "connect %s and %s (self)",
-				 srcport->shared->name,
-				 dstport->shared->name);
+				 srcport->names->name,
+				 dstport->names->name);
 
 			connection->dir = 0;
 		}
@@ -3968,6 +9518,11 @@ jack_port_do_connect (jack_engine_t *engine,
 			jack_slist_prepend (dstport->connections, connection);
 		srcport->connections =
 			jack_slist_prepend (srcport->connections, connection);
+		jack_port_publish_connections (srcport);
+		jack_port_publish_connections (dstport);
+
+		dstclient->latency_dirty |= (1 << JackCaptureLatency);
+		srcclient->latency_dirty |= (1 << JackPlaybackLatency);
 
 		DEBUG ("actually sorted the graph...");
 
@@ -3983,19 +9538,113 @@ jack_port_do_connect (jack_engine_t *engine,
 		/* send a port connection notification just once to everyone who cares excluding clients involved in the connection */
 
 		jack_notify_all_port_interested_clients (engine, srcport->shared->client_id, dstport->shared->client_id, src_id, dst_id, 1);
+		jack_graph_change_note (engine, src_id, dst_id, TRUE);
 
-		jack_sort_graph (engine);
+		if (sort_graph) {
+			jack_update_graph (engine);
+		}
 	}
 
-	jack_unlock_graph (engine);
-
 	return 0;
 }
 
+/* copy the connections of `port' to its shared part, for
+ * jack_port_get_connection_ids() */
+static void
+jack_port_publish_connections (jack_port_internal_t *port)
+{
+	/* caller must hold the graph lock */
+	jack_port_shared_t *shared = port->shared;
+	jack_connection_internal_t *connection;
+	JSList *node;
+	uint32_t n = 0;
+
+	shared->conn_seq++;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	for (node = port->connections; node; node = jack_slist_next (node), n++) {
+		if (n < JACK_PORT_CONNECTIONS_SHARED) {
+			connection = (jack_connection_internal_t*)node->data;
+			shared->connection_ids[n] =
+				(connection->source == port ?
+				 connection->destination : connection->source)->shared->id;
+			shared->connection_gains[n] =
+				connection->muted ? 0.0f : connection->gain;
+		}
+	}
+	shared->n_connections = n;
+
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	shared->conn_seq++;
+}
+
+static void
+jack_port_disconnect_notify (jack_engine_t *engine, jack_uuid_t src_client,
+			     jack_uuid_t dst_client, jack_port_id_t src_id,
+			     jack_port_id_t dst_id)
+{
+	jack_send_connection_notification (engine, src_client, src_id,
+					   dst_id, FALSE);
+	jack_send_connection_notification (engine, dst_client, dst_id,
+					   src_id, FALSE);
+
+	/* send a port connection notification just once to everyone who cares excluding clients involved in the connection */
+
+	jack_notify_all_port_interested_clients (engine, src_client, dst_client, src_id, dst_id, 0);
+}
+
+static void
+jack_port_defer_disconnect_notice (jack_engine_t *engine, jack_uuid_t src_client,
+				   jack_uuid_t dst_client, jack_port_id_t src_id,
+				   jack_port_id_t dst_id)
+{
+	jack_disconnect_notice_t *notice;
+
+	if ((notice = (jack_disconnect_notice_t*)
+		      malloc (sizeof(jack_disconnect_notice_t))) == NULL) {
+		jack_port_disconnect_notify (engine, src_client, dst_client,
+					     src_id, dst_id);
+		return;
+	}
+
+	jack_uuid_copy (&notice->src_client, src_client);
+	jack_uuid_copy (&notice->dst_client, dst_client);
+	notice->src = src_id;
+	notice->dst = dst_id;
+
+	engine->disconnect_notices =
+		jack_slist_append (engine->disconnect_notices, notice);
+}
+
+/* Send the notifications that jack_port_disconnect_internal() held
+   back while failed clients were unlinked. A read lock will do, so the
+   graph keeps running while the clients take their time to answer.
+ */
+void
+jack_send_disconnect_notices (jack_engine_t *engine)
+{
+	JSList *node, *notices;
+	jack_disconnect_notice_t *notice;
+
+	notices = engine->disconnect_notices;
+	engine->disconnect_notices = NULL;
+
+	for (node = notices; node; node = jack_slist_next (node)) {
+		notice = (jack_disconnect_notice_t*)node->data;
+		jack_port_disconnect_notify (engine, notice->src_client,
+					     notice->dst_client,
+					     notice->src, notice->dst);
+		free (notice);
+	}
+
+	jack_slist_free (notices);
+}
+
 int
 jack_port_disconnect_internal (jack_engine_t *engine,
 			       jack_port_internal_t *srcport,
-			       jack_port_internal_t *dstport )
+			       jack_port_internal_t *dstport,
+			       int sort_graph)
 
 {
 	JSList *node;
@@ -4014,8 +9663,8 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 		    connect->destination == dstport) {
 
 			VERBOSE (engine, "DIS-connect %s and %s",
-				 srcport->shared->name,
-				 dstport->shared->name);
+				 srcport->names->name,
+				 dstport->names->name);
 
 			srcport->connections =
 				jack_slist_remove (srcport->connections,
@@ -4023,6 +9672,13 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 			dstport->connections =
 				jack_slist_remove (dstport->connections,
 						   connect);
+			jack_port_publish_connections (srcport);
+			jack_port_publish_connections (dstport);
+
+			connect->dstclient->latency_dirty |=
+				(1 << JackCaptureLatency);
+			connect->srcclient->latency_dirty |=
+				(1 << JackPlaybackLatency);
 
 			src_id = srcport->shared->id;
 			dst_id = dstport->shared->id;
@@ -4039,16 +9695,16 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 				srcport->shared->monitor_requests = 0;
 			}
 
-			jack_send_connection_notification (
-				engine, srcport->shared->client_id, src_id,
-				dst_id, FALSE);
-			jack_send_connection_notification (
-				engine, dstport->shared->client_id, dst_id,
-				src_id, FALSE);
-
-			/* send a port connection notification just once to everyone who cares excluding clients involved in the connection */
-
-			jack_notify_all_port_interested_clients (engine, srcport->shared->client_id, dstport->shared->client_id, src_id, dst_id, 0);
+			if (engine->defer_disconnect_notices) {
+				jack_port_defer_disconnect_notice (
+					engine, srcport->shared->client_id,
+					dstport->shared->client_id, src_id, dst_id);
+			} else {
+				jack_port_disconnect_notify (
+					engine, srcport->shared->client_id,
+					dstport->shared->client_id, src_id, dst_id);
+			}
+			jack_graph_change_note (engine, src_id, dst_id, FALSE);
 
 			if (connect->dir) {
 
@@ -4065,6 +9721,7 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 							 (src->truefeeds, dst);
 
 				dst->fedcount--;
+				engine->reach_dirty = TRUE;
 
 				if (connect->dir == 1) {
 					/* normal connection: remove dest from
@@ -4090,11 +9747,19 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 		}
 	}
 
-	if (check_acyclic) {
-		jack_check_acyclic (engine);
+	if (!sort_graph) {
+		return ret;
 	}
 
-	jack_sort_graph (engine);
+	/* the execution order is still valid after removing a
+	   connection, unless a feedback connection was turned around.
+	 */
+
+	if (check_acyclic && jack_check_acyclic (engine)) {
+		jack_sort_graph (engine);
+	} else {
+		jack_update_graph (engine);
+	}
 
 	return ret;
 }
@@ -4110,7 +9775,7 @@ jack_port_do_disconnect_all (jack_engine_t *engine,
 	}
 
 	VERBOSE (engine, "clear connections for %s",
-		 engine->internal_ports[port_id].shared->name);
+		 engine->internal_ports[port_id].names->name);
 
 	jack_lock_graph (engine);
 	jack_port_clear_connections (engine, &engine->internal_ports[port_id]);
@@ -4143,11 +9808,231 @@ jack_port_do_disconnect (jack_engine_t *engine,
 
 	jack_lock_graph (engine);
 
-	ret = jack_port_disconnect_internal (engine, srcport, dstport);
+	ret = jack_port_disconnect_internal (engine, srcport, dstport, TRUE);
+
+	jack_unlock_graph (engine);
+
+	return ret;
+}
+
+/* Set the gain or mute of a connection. Both ends publish it again;
+ * the input's mixdown picks it up in the next cycle, and ramps to it
+ * over that cycle.
+ */
+static int
+jack_port_do_set_connection_gain (jack_engine_t *engine, jack_request_t *req)
+{
+	const char *source_port = req->x.connection_gain.source_port;
+	const char *destination_port = req->x.connection_gain.destination_port;
+	jack_connection_internal_t *connection = NULL;
+	jack_port_internal_t *srcport, *dstport;
+	jack_port_type_id_t ptype_id;
+	JSList *node;
+	uint32_t n = 0;
+	float gain = req->x.connection_gain.gain;
+
+	if ((req->x.connection_gain.what & JackConnectionGain) &&
+	    !(gain >= 0.0f && gain <= JACK_CONNECTION_GAIN_MAX)) {
+		jack_error ("gain %f of the connection of %s and %s is out"
+			    " of range", gain, source_port, destination_port);
+		return -1;
+	}
+
+	if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL) {
+		jack_error ("unknown source port in attempted gain change"
+			    " [%s]", source_port);
+		return -1;
+	}
+
+	if ((dstport = jack_get_port_by_name (engine, destination_port))
+	    == NULL) {
+		jack_error ("unknown destination port in attempted gain"
+			    " change [%s]", destination_port);
+		return -1;
+	}
+
+	ptype_id = dstport->shared->ptype_id;
+	if (ptype_id != JACK_AUDIO_PORT_TYPE &&
+	    ptype_id != JACK_MULTICHANNEL_PORT_TYPE &&
+	    ptype_id != JACK_DOUBLE_PORT_TYPE) {
+		jack_error ("cannot set the gain of the connection of %s and"
+			    " %s: not an audio connection", source_port,
+			    destination_port);
+		return -1;
+	}
+
+	jack_lock_graph (engine);
+
+	for (node = dstport->connections; node;
+	     node = jack_slist_next (node), n++) {
+		if (((jack_connection_internal_t*)node->data)->source
+		    == srcport) {
+			connection = (jack_connection_internal_t*)node->data;
+			break;
+		}
+	}
+
+	if (connection == NULL) {
+		jack_unlock_graph (engine);
+		jack_error ("%s and %s are not connected", source_port,
+			    destination_port);
+		return -1;
+	}
+
+	if (n >= JACK_PORT_CONNECTIONS_SHARED) {
+		jack_unlock_graph (engine);
+		jack_error ("cannot set the gain of the connection of %s and"
+			    " %s: only the first %d connections of a port"
+			    " can have one", source_port, destination_port,
+			    JACK_PORT_CONNECTIONS_SHARED);
+		return -1;
+	}
+
+	if (req->x.connection_gain.what & JackConnectionGain) {
+		connection->gain = gain;
+	}
+	if (req->x.connection_gain.what & JackConnectionMute) {
+		connection->muted = req->x.connection_gain.mute ? TRUE : FALSE;
+	}
+
+	jack_port_publish_connections (srcport);
+	jack_port_publish_connections (dstport);
+
+	jack_unlock_graph (engine);
+
+	return 0;
+}
+
+static int
+jack_port_do_connect_batch (jack_engine_t *engine, jack_request_t *req,
+			    int connect)
+{
+	jack_port_internal_t *srcport, *dstport;
+	const char *source_port, *destination_port;
+	uint32_t i;
+	int status = 0;
+	int r;
+
+	/* make or break all the connections first, then sort the
+	   graph and tell the clients about it just once.
+	 */
+
+	jack_lock_graph (engine);
+
+	for (i = 0; i < req->x.batch.npairs; i++) {
+
+		source_port = req->x.batch.ports +
+			      (2 * i) * JACK_PORT_NAME_SIZE;
+		destination_port = source_port + JACK_PORT_NAME_SIZE;
+
+		if (connect) {
+			r = jack_port_connect_internal (engine, source_port,
+							destination_port, FALSE);
+			if (r == EEXIST) {
+				r = 0;
+			}
+		} else if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL) {
+			jack_error ("unknown source port in attempted "
+				    "disconnection [%s]", source_port);
+			r = -1;
+		} else if ((dstport = jack_get_port_by_name (engine, destination_port)) == NULL) {
+			jack_error ("unknown destination port in attempted "
+				    "disconnection [%s]", destination_port);
+			r = -1;
+		} else {
+			r = jack_port_disconnect_internal (engine, srcport,
+							   dstport, FALSE);
+		}
+
+		if (r && status == 0) {
+			status = r;
+		}
+	}
+
+	if (!connect && engine->feedbackcount && jack_check_acyclic (engine)) {
+		jack_sort_graph (engine);
+	} else {
+		jack_update_graph (engine);
+	}
+
+	/* a batch is one epoch, there is no point waiting for more */
+	jack_graph_epoch_flush (engine);
+
+	jack_unlock_graph (engine);
+
+	VERBOSE (engine, "%s %" PRIu32 " port pairs, status = %d",
+		 connect ? "connected" : "disconnected",
+		 req->x.batch.npairs, status);
+
+	return status;
+}
+
+/* whether a port is there and its owner is active, so that it can be
+   connected; called with the graph lock */
+static int
+jack_checkpoint_port_ready (jack_engine_t *engine, const char *name)
+{
+	jack_port_internal_t *port;
+	jack_client_internal_t *client;
+
+	return (port = jack_get_port_by_name (engine, name)) != NULL &&
+	       (client = jack_client_internal_by_id (engine,
+						     port->shared->client_id))
+	       != NULL &&
+	       client->control->active;
+}
+
+/* make the connections the checkpoint still holds whose ports are
+   both back, as one batch; called with the graph lock when a client
+   has been activated and its ports announced */
+void
+jack_checkpoint_reconnect (jack_engine_t *engine)
+{
+	jack_checkpoint_t *cp = engine->checkpoint;
+	jack_checkpoint_connection_t *c;
+	JSList *ready = NULL, *node, *next;
+	uint32_t made = 0;
+
+	if (cp == NULL) {
+		return;
+	}
+
+	/* connecting tells the checkpoint about it, so take them off
+	   its list first */
+	pthread_mutex_lock (&cp->lock);
+	for (node = cp->connections; node; node = next) {
+		next = jack_slist_next (node);
+		c = (jack_checkpoint_connection_t*)node->data;
+		if (jack_checkpoint_port_ready (engine, c->source) &&
+		    jack_checkpoint_port_ready (engine, c->destination)) {
+			cp->connections = jack_slist_remove_link (cp->connections,
+								  node);
+			ready = jack_slist_concat (node, ready);
+		}
+	}
+	pthread_mutex_unlock (&cp->lock);
+
+	if (ready == NULL) {
+		return;
+	}
+
+	for (node = ready; node; node = jack_slist_next (node)) {
+		c = (jack_checkpoint_connection_t*)node->data;
+		if (jack_port_connect_internal (engine, c->source,
+						c->destination, FALSE) == 0) {
+			made++;
+		}
+		free (c);
+	}
+	jack_slist_free (ready);
 
-	jack_unlock_graph (engine);
+	if (made) {
+		jack_update_graph (engine);
+		jack_graph_epoch_flush (engine);
+	}
 
-	return ret;
+	VERBOSE (engine, "restored %" PRIu32 " connections from %s", made,
+		 cp->path);
 }
 
 int
@@ -4231,6 +10116,341 @@ jack_clear_fifos (jack_engine_t *engine)
 			}
 		}
 	}
+
+	/* same for the activation slots */
+	for (i = 0; i < JACK_ACTIVATION_MAX; i++) {
+		jack_activation_reset (&engine->control->activation[i]);
+	}
+}
+
+int
+jack_activation_slot_alloc (jack_engine_t *engine)
+{
+	/* called with the request_lock while setting up a client */
+	int slot;
+
+	if (engine->control->activation_type != JackActivationFutex) {
+		return -1;
+	}
+
+	for (slot = JACK_ACTIVATION_ENGINE + 1; slot < JACK_ACTIVATION_MAX; slot++) {
+		if (!engine->activation_used[slot]) {
+			engine->activation_used[slot] = 1;
+			engine->control->activation[slot].word = 0;
+			engine->control->activation[slot].sleepers = 0;
+			return slot;
+		}
+	}
+
+	VERBOSE (engine, "no free activation slot, client will use FIFOs");
+	return -1;
+}
+
+void
+jack_activation_slot_free (jack_engine_t *engine, int slot)
+{
+	if (slot > JACK_ACTIVATION_ENGINE && slot < JACK_ACTIVATION_MAX) {
+		engine->activation_used[slot] = 0;
+	}
+}
+
+int
+jack_client_table_slot_alloc (jack_engine_t *engine)
+{
+	/* called with the request_lock while setting up a client */
+	int slot;
+
+	if (engine->client_table_shm.index == JACK_SHM_NULL_INDEX) {
+		return -1;
+	}
+
+	for (slot = 0; slot < JACK_CLIENT_TABLE_MAX; slot++) {
+		if (!engine->client_table_used[slot]) {
+			engine->client_table_used[slot] = 1;
+			return slot;
+		}
+	}
+
+	VERBOSE (engine, "client table full, client will get a segment "
+		 "of its own");
+	return -1;
+}
+
+void
+jack_client_table_slot_free (jack_engine_t *engine, int slot)
+{
+	if (slot >= 0 && slot < JACK_CLIENT_TABLE_MAX) {
+		engine->client_table_used[slot] = 0;
+	}
+}
+
+int
+jack_timing_slot_alloc (jack_engine_t *engine, const char *name)
+{
+	/* called with the request_lock while setting up a client */
+	jack_client_timing_t *timing;
+	int slot;
+
+	for (slot = 0; slot < JACK_TIMING_MAX; slot++) {
+		timing = jack_client_timing (engine->control, slot);
+		if (!timing->in_use) {
+			memset (timing, 0, sizeof(*timing));
+			snprintf (timing->name, sizeof(timing->name), "%s", name);
+			timing->in_use = 1;
+			return slot;
+		}
+	}
+
+	VERBOSE (engine, "no free timing slot, %s will not be profiled",
+		 name);
+	return -1;
+}
+
+void
+jack_timing_slot_free (jack_engine_t *engine, int slot)
+{
+	jack_client_timing_t *timing;
+
+	if ((timing = jack_client_timing (engine->control, slot)) != NULL) {
+		timing->in_use = 0;
+	}
+}
+
+volatile uint64_t *
+jack_engine_counter (jack_engine_t *engine, const char *name)
+{
+	/* called by drivers when they attach, which the engine never
+	   does from more than one thread at a time */
+	jack_control_t *control = engine->control;
+	jack_counter_t *counter;
+	uint32_t i;
+
+	for (i = 0; i < control->n_counters; i++) {
+		if (strncmp (control->counters[i].name, name,
+			     JACK_COUNTER_NAME_SIZE) == 0) {
+			return &control->counters[i].value;
+		}
+	}
+
+	if (i == JACK_COUNTERS_MAX) {
+		VERBOSE (engine, "no room for counter %s", name);
+		return NULL;
+	}
+
+	counter = &control->counters[i];
+	snprintf (counter->name, sizeof(counter->name), "%s", name);
+	counter->value = 0;
+
+	/* readers only look at counters below n_counters */
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	control->n_counters = i + 1;
+
+	return &counter->value;
+}
+
+static void
+jack_timing_add (jack_client_timing_t *timing, uint32_t window,
+		 jack_time_t wake, jack_time_t process, jack_time_t period,
+		 jack_time_t cpu, uint32_t preemptions)
+{
+	uint32_t h;
+
+	timing->seq++;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	if (timing->cycles[timing->current] >= window) {
+		h = timing->current = !timing->current;
+		timing->cycles[h] = 0;
+		timing->wake_max[h] = 0;
+		timing->process_max[h] = 0;
+		timing->process_total[h] = 0;
+		timing->period_total[h] = 0;
+		timing->cpu_total[h] = 0;
+		timing->preempted[h] = 0;
+		memset (timing->wake[h], 0, sizeof(timing->wake[h]));
+		memset (timing->process[h], 0, sizeof(timing->process[h]));
+	}
+
+	h = timing->current;
+	timing->cycles[h]++;
+	timing->wake[h][jack_timing_bucket (wake)]++;
+	timing->process[h][jack_timing_bucket (process)]++;
+	timing->process_total[h] += process;
+	timing->period_total[h] += period;
+	/* the two clocks do not tick together, cpu time may come out
+	   a little longer */
+	timing->cpu_total[h] += cpu < process ? cpu : process;
+	if (preemptions) {
+		timing->preempted[h]++;
+	}
+	if (wake > timing->wake_max[h]) {
+		timing->wake_max[h] = wake;
+	}
+	if (process > timing->process_max[h]) {
+		timing->process_max[h] = process;
+	}
+
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	timing->seq++;
+}
+
+static void
+jack_engine_record_timing (jack_engine_t *engine)
+{
+	/* precondition: caller holds the graph lock */
+	JSList *node, *snode;
+	jack_client_internal_t *client, *dst;
+	jack_client_control_t *ctl;
+	jack_client_timing_t *timing;
+	jack_time_t prev_finished = 0;
+
+	/* a client could run either when the engine triggered it
+	   (signalled_at), or when the last of its upstream clients
+	   finished: the previous client of the chain, or with
+	   parallel execution, the latest of its predecessors.
+	 */
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		ctl = client->control;
+
+		if (!jack_client_is_runnable (client)) {
+			client->ready_at = 0;
+			continue;
+		}
+
+		/* started by the engine, in no chain */
+		if (jack_client_is_decimated (client)) {
+			client->ready_at = ctl->signalled_at;
+			continue;
+		}
+
+		if (ctl->signalled_at) {
+			client->ready_at = ctl->signalled_at;
+		} else if (engine->parallel) {
+			client->ready_at = 0;
+		} else {
+			client->ready_at = prev_finished;
+		}
+
+		prev_finished = ctl->finished_at;
+	}
+
+	if (engine->parallel) {
+		for (node = engine->dag_clients; node; node = jack_slist_next (node)) {
+			client = (jack_client_internal_t*)node->data;
+			for (snode = client->dag_successors; snode;
+			     snode = jack_slist_next (snode)) {
+				dst = (jack_client_internal_t*)snode->data;
+				if (!dst->control->signalled_at &&
+				    client->control->finished_at > dst->ready_at) {
+					dst->ready_at = client->control->finished_at;
+				}
+			}
+		}
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		ctl = client->control;
+
+		if (!client->ready_at || !ctl->awake_at || !ctl->finished_at ||
+		    (timing = jack_client_timing (engine->control,
+						  ctl->timing_slot)) == NULL) {
+			continue;
+		}
+
+		jack_timing_add (timing, engine->control->load_stats.window,
+				 ctl->awake_at > client->ready_at ?
+				 ctl->awake_at - client->ready_at : 0,
+				 ctl->finished_at > ctl->awake_at ?
+				 ctl->finished_at - ctl->awake_at : 0,
+				 engine->driver->period_usecs,
+				 ctl->process_cpu_usecs,
+				 ctl->process_preemptions);
+
+		if (engine->parallel && ctl->finished_at > ctl->awake_at) {
+			client->dag_weight += ((float)(ctl->finished_at -
+						       ctl->awake_at) -
+					       client->dag_weight) * 0.125f;
+		}
+	}
+
+	if (engine->parallel) {
+		jack_dag_rank (engine);
+	}
+}
+
+static void
+jack_drivers_record_timing (jack_engine_t *engine)
+{
+	/* precondition: caller holds the graph lock */
+	JSList *node;
+	jack_slave_io_t *sio;
+	jack_client_timing_t *timing;
+
+	/* drivers have no process callback, so their entries (named
+	   after the driver's client) hold read plus write time instead,
+	   and for a slave with a helper thread, the wakeup latency of
+	   its read. that is not sampled for cpu time, which with
+	   --cpu-times is taken to be all of it.
+	 */
+
+	if ((timing = jack_client_timing (engine->control,
+					  engine->driver->internal_client->control->timing_slot)) != NULL) {
+		jack_timing_add (timing, engine->control->load_stats.window,
+				 0, engine->driver_io_usecs,
+				 engine->driver->period_usecs,
+				 engine->control->cpu_times ?
+				 engine->driver_io_usecs : 0, 0);
+	}
+
+	for (node = engine->slave_io; node; node = jack_slist_next (node)) {
+		sio = (jack_slave_io_t*)node->data;
+		if ((timing = jack_client_timing (engine->control,
+						  sio->driver->internal_client->control->timing_slot)) != NULL) {
+			jack_timing_add (timing, engine->control->load_stats.window,
+					 sio->wake_usecs, sio->io_usecs,
+					 engine->driver->period_usecs,
+					 engine->control->cpu_times ?
+					 sio->io_usecs : 0, 0);
+		}
+	}
+}
+
+static void
+jack_engine_trace_clients (jack_engine_t *engine)
+{
+	/* precondition: caller holds the graph lock */
+	JSList *node;
+	jack_client_control_t *ctl;
+
+	/* clients stamp their own wakeup and completion times in their
+	   control block, so the records for them are made here, once
+	   the cycle is over, rather than as things happen.
+	 */
+
+	if (engine->trace == NULL) {
+		return;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		ctl = ((jack_client_internal_t*)node->data)->control;
+
+		if (ctl->signalled_at) {
+			jack_trace_at (engine->trace, ctl->signalled_at,
+				       JackTraceClientTriggered, ctl->uuid, 0);
+		}
+		if (ctl->awake_at) {
+			jack_trace_at (engine->trace, ctl->awake_at,
+				       JackTraceClientAwake, ctl->uuid, 0);
+		}
+		if (ctl->finished_at) {
+			jack_trace_at (engine->trace, ctl->finished_at,
+				       JackTraceClientFinished, ctl->uuid,
+				       (uint32_t)ctl->last_status);
+		}
+	}
 }
 
 int
@@ -4259,13 +10479,21 @@ jack_use_driver (jack_engine_t *engine, jack_driver_t *driver)
 int
 jack_add_slave_driver (jack_engine_t *engine, jack_driver_t *driver)
 {
+	jack_slave_io_t *sio;
+
 	if (driver) {
 		if (driver->attach (driver, engine)) {
 			jack_info ("could not attach slave %s\n", driver->internal_client->control->name);
 			return -1;
 		}
 
+		if ((sio = jack_slave_io_new (engine, driver)) == NULL) {
+			driver->detach (driver, engine);
+			return -1;
+		}
+
 		engine->slave_drivers = jack_slist_append (engine->slave_drivers, driver);
+		engine->slave_io = jack_slist_append (engine->slave_io, sio);
 	}
 
 	return 0;
@@ -4274,17 +10502,105 @@ jack_add_slave_driver (jack_engine_t *engine, jack_driver_t *driver)
 /* PORT RELATED FUNCTIONS */
 
 
+/* Add a segment to the port table, and room for the buffers of its
+ * ports to every port buffer segment. The caller must hold the graph
+ * lock, so that no cycle runs while the buffer segments move.
+ */
+static int
+jack_port_table_grow (jack_engine_t *engine)
+{
+	jack_port_table_t *table = &engine->port_table;
+	jack_control_t *ctl = engine->control;
+	uint32_t seg = table->n_segments;
+	jack_shm_info_t *shm_info = &table->shm_info[seg];
+	jack_port_shared_t *ports;
+	jack_event_t event;
+	unsigned int i;
+
+	if (seg == JACK_PORT_SEGMENTS_MAX) {
+		return -1;
+	}
+
+	if (jack_shmalloc (sizeof(jack_port_shared_t) * ctl->port_segment_size,
+			   shm_info)) {
+		jack_error ("cannot create new port table segment (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	if (jack_attach_shm (shm_info)) {
+		jack_error ("cannot attach to new port table segment (%s)",
+			    strerror (errno));
+		jack_destroy_shm (shm_info);
+		return -1;
+	}
+
+	ports = (jack_port_shared_t*)jack_shm_addr (shm_info);
+
+	if (jack_port_names_alloc (engine, seg)) {
+		jack_release_shm (shm_info);
+		jack_destroy_shm (shm_info);
+		return -1;
+	}
+
+	for (i = 0; i < ctl->port_segment_size; i++) {
+		ports[i].in_use = 0;
+		ports[i].id = engine->port_max + i;
+	}
+
+	/* buffer segments that do not exist yet are sized from
+	   control->port_max when the driver sets the buffer size.
+	 */
+	for (i = 0; i < ctl->n_port_types; ++i) {
+		if (engine->port_segment[i].attached_at &&
+		    jack_resize_port_segment (engine, i, engine->port_max
+					      + ctl->port_segment_size)) {
+			jack_port_names_free (engine, seg);
+			jack_release_shm (shm_info);
+			jack_destroy_shm (shm_info);
+			return -1;
+		}
+	}
+
+	/* clients must be able to reach the segment before they can
+	   see a port id in it.
+	 */
+	table->segment[seg] = ports;
+	__atomic_store_n (&table->n_segments, seg + 1, __ATOMIC_RELEASE);
+	ctl->port_segment_index[seg] = shm_info->index;
+	__atomic_store_n (&ctl->n_port_segments, seg + 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock (&engine->port_lock);
+	engine->port_max += ctl->port_segment_size;
+	__atomic_store_n (&ctl->port_max, engine->port_max, __ATOMIC_RELEASE);
+	pthread_mutex_unlock (&engine->port_lock);
+
+	VERBOSE (engine, "port table grown to %u ports", engine->port_max);
+
+	event.type = AttachPortSegment;
+	event.x.n = seg;
+	event.y.ptid = JACK_PORT_TABLE_SEGMENT;
+	jack_deliver_event_to_all (engine, &event);
+
+	return 0;
+}
+
 static jack_port_id_t
 jack_get_free_port (jack_engine_t *engine)
 
 {
 	jack_port_id_t i;
+	jack_port_shared_t *port;
 
+	/* caller must hold the graph lock */
+
+again:
 	pthread_mutex_lock (&engine->port_lock);
 
 	for (i = 0; i < engine->port_max; i++) {
-		if (engine->control->ports[i].in_use == 0) {
-			engine->control->ports[i].in_use = 1;
+		port = jack_engine_port (engine, i);
+		if (port->in_use == 0) {
+			port->in_use = 1;
 			break;
 		}
 	}
@@ -4292,6 +10608,9 @@ jack_get_free_port (jack_engine_t *engine)
 	pthread_mutex_unlock (&engine->port_lock);
 
 	if (i == engine->port_max) {
+		if (jack_port_table_grow (engine) == 0) {
+			goto again;
+		}
 		return (jack_port_id_t)-1;
 	}
 
@@ -4304,18 +10623,20 @@ jack_port_release (jack_engine_t *engine, jack_port_internal_t *port)
 	char buf[JACK_UUID_STRING_SIZE];
 
 	jack_uuid_unparse (port->shared->uuid, buf);
-	if (jack_remove_properties (NULL, port->shared->uuid) > 0) {
-		/* have to do the notification ourselves, since the client argument
-		   to jack_remove_properties() was NULL
-		 */
+	if (jack_propstore_remove (engine->propstore, port->shared->uuid, NULL) > 0) {
 		jack_property_change_notify (engine, PropertyDeleted, port->shared->uuid, NULL);
 	}
 
 
 	pthread_mutex_lock (&engine->port_lock);
+	jack_port_hash_remove (engine, port->shared->id, port->names->name);
 	port->shared->in_use = 0;
-	port->shared->alias1[0] = '\0';
-	port->shared->alias2[0] = '\0';
+	/* after in_use, so that anyone who sees the new generation
+	   sees the port gone */
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	engine->control->port_generation++;
+	port->names->alias1[0] = '\0';
+	port->names->alias2[0] = '\0';
 
 	if (port->buffer_info) {
 		jack_port_buffer_list_t *blist =
@@ -4325,79 +10646,223 @@ jack_port_release (jack_engine_t *engine, jack_port_internal_t *port)
 			jack_slist_prepend (blist->freelist,
 					    port->buffer_info);
 		port->buffer_info = NULL;
+		/* a pooled buffer stays in the pool */
+		port->share_info = NULL;
+		port->shared->pooled = 0;
+		if (port->delay_info) {
+			blist->freelist =
+				jack_slist_prepend (blist->freelist,
+						    port->delay_info);
+			port->delay_info = NULL;
+			port->shared->delayed = 0;
+		}
 		pthread_mutex_unlock (&blist->lock);
 	}
 	pthread_mutex_unlock (&engine->port_lock);
 }
 
+/* the port name index is only changed with port_lock held */
+
+static void
+jack_port_hash_rebuild (jack_engine_t *engine)
+{
+	volatile jack_port_id_t *table = jack_port_hash_table (engine->control);
+	jack_port_id_t id;
+	uint32_t i;
+
+	/* clients may miss a port while this runs, and then find it
+	   by scanning the port array.
+	 */
+
+	for (i = 0; i < engine->control->port_hash_size; i++) {
+		table[i] = JACK_PORT_HASH_EMPTY;
+	}
+
+	engine->port_hash_deleted = 0;
+
+	for (id = 0; id < engine->port_max; id++) {
+		if (jack_engine_port (engine, id)->in_use) {
+			jack_port_hash_insert (engine, id);
+		}
+	}
+}
+
+static void
+jack_port_hash_insert (jack_engine_t *engine, jack_port_id_t id)
+{
+	volatile jack_port_id_t *table = jack_port_hash_table (engine->control);
+	uint32_t mask = engine->control->port_hash_size - 1;
+	uint32_t i;
+
+	/* there are at least twice as many entries as ports, so this
+	   always finds a free one.
+	 */
+
+	for (i = jack_port_name_hash (jack_engine_port_names (engine, id)->name) & mask;
+	     table[i] != JACK_PORT_HASH_EMPTY && table[i] != JACK_PORT_HASH_DELETED;
+	     i = (i + 1) & mask) {
+		;
+	}
+
+	if (table[i] == JACK_PORT_HASH_DELETED) {
+		engine->port_hash_deleted--;
+	}
+
+	table[i] = id;
+}
+
+static void
+jack_port_hash_remove (jack_engine_t *engine, jack_port_id_t id,
+		       const char *name)
+{
+	volatile jack_port_id_t *table = jack_port_hash_table (engine->control);
+	uint32_t mask = engine->control->port_hash_size - 1;
+	uint32_t i, n;
+
+	/* look where `name' would have put it, then everywhere: the
+	   client may have renamed the port behind our back.
+	 */
+
+	for (i = jack_port_name_hash (name) & mask, n = 0;
+	     n <= mask && table[i] != JACK_PORT_HASH_EMPTY;
+	     i = (i + 1) & mask, n++) {
+		if (table[i] == id) {
+			break;
+		}
+	}
+
+	if (n > mask || table[i] != id) {
+		for (i = 0; i <= mask && table[i] != id; i++) {
+			;
+		}
+		if (i > mask) {
+			return;
+		}
+	}
+
+	table[i] = JACK_PORT_HASH_DELETED;
+
+	if (++engine->port_hash_deleted > engine->control->port_hash_size / 4) {
+		jack_port_hash_rebuild (engine);
+	}
+}
+
 jack_port_internal_t *
 jack_get_port_internal_by_name (jack_engine_t *engine, const char *name)
 {
+	jack_port_shared_t *shared;
 	jack_port_id_t id;
 
-	pthread_mutex_lock (&engine->port_lock);
+	pthread_mutex_lock (&engine->port_lock);
+
+	if ((shared = jack_port_hash_lookup (engine->control,
+					     &engine->port_table, name)) != NULL) {
+		pthread_mutex_unlock (&engine->port_lock);
+		return &engine->internal_ports[shared->id];
+	}
+
+	for (id = 0; id < engine->port_max; id++) {
+		if (jack_port_name_equals (jack_engine_port_names (engine, id), name)) {
+			break;
+		}
+	}
+
+	pthread_mutex_unlock (&engine->port_lock);
+
+	if (id != engine->port_max) {
+		return &engine->internal_ports[id];
+	} else {
+		return NULL;
+	}
+}
+
+static int
+jack_port_type_index (jack_engine_t *engine, const char *type)
+{
+	unsigned long i;
+
+	for (i = 0; i < engine->control->n_port_types; ++i) {
+		if (strcmp (type, engine->control->port_types[i].type_name) == 0) {
+			return i;
+		}
+	}
+
+	jack_error ("cannot register a port of type \"%s\"", type);
+	return -1;
+}
+
+/* the aliases the port had before the server restarted, in the slots
+   the driver has not filled */
+static void
+jack_checkpoint_restore_aliases (jack_engine_t *engine,
+				 jack_port_names_t *names)
+{
+	jack_checkpoint_port_t *p;
+	const char *alias[2];
+	int i;
 
-	for (id = 0; id < engine->port_max; id++) {
-		if (jack_port_name_equals (&engine->control->ports[id], name)) {
-			break;
-		}
+	if ((p = jack_checkpoint_take_port (engine->checkpoint, names->name))
+	    == NULL) {
+		return;
 	}
 
-	pthread_mutex_unlock (&engine->port_lock);
+	alias[0] = p->alias1;
+	alias[1] = p->alias2;
 
-	if (id != engine->port_max) {
-		return &engine->internal_ports[id];
-	} else {
-		return NULL;
+	for (i = 0; i < 2; i++) {
+		if (alias[i][0] == '\0' ||
+		    strcmp (alias[i], names->alias1) == 0 ||
+		    strcmp (alias[i], names->alias2) == 0) {
+			continue;
+		}
+		if (names->alias1[0] == '\0') {
+			snprintf (names->alias1, sizeof(names->alias1), "%s",
+				  alias[i]);
+		} else if (names->alias2[0] == '\0') {
+			snprintf (names->alias2, sizeof(names->alias2), "%s",
+				  alias[i]);
+		}
 	}
+
+	free (p);
 }
 
-int
-jack_port_do_register (jack_engine_t *engine, jack_request_t *req, int internal)
+/* register one port of `client'. the caller holds the graph lock, and
+   tells the other clients */
+static jack_port_id_t
+jack_port_register_internal (jack_engine_t *engine,
+			     jack_client_internal_t *client,
+			     const char *name, int i, uint32_t flags,
+			     unsigned long buffer_size, int internal)
 {
 	jack_port_id_t port_id;
 	jack_port_shared_t *shared;
+	jack_port_names_t *names;
 	jack_port_internal_t *port;
-	jack_client_internal_t *client;
-	unsigned long i;
 	char *backend_client_name;
 	size_t len;
 
-	for (i = 0; i < engine->control->n_port_types; ++i) {
-		if (strcmp (req->x.port_info.type,
-			    engine->control->port_types[i].type_name) == 0) {
-			break;
-		}
-	}
-
-	if (i == engine->control->n_port_types) {
-		jack_error ("cannot register a port of type \"%s\"",
-			    req->x.port_info.type);
-		return -1;
-	}
-
-	jack_lock_graph (engine);
-	if ((client = jack_client_internal_by_id (engine,
-						  req->x.port_info.client_id))
-	    == NULL) {
-		jack_error ("unknown client id in port registration request");
-		jack_unlock_graph (engine);
-		return -1;
+	if ((port = jack_get_port_by_name (engine, name)) != NULL) {
+		jack_error ("duplicate port name (%s) in port registration request", name);
+		return (jack_port_id_t)-1;
 	}
 
-	if ((port = jack_get_port_by_name (engine, req->x.port_info.name)) != NULL) {
-		jack_error ("duplicate port name (%s) in port registration request", req->x.port_info.name);
-		jack_unlock_graph (engine);
-		return -1;
+	if (client->control->decimation &&
+	    ((flags & JackPortIsOutput) ||
+	     engine->control->port_types[i].ptype_id != JACK_AUDIO_PORT_TYPE)) {
+		jack_error ("%s is woken once every %" PRIu32 " cycles and can "
+			    "only have audio inputs (%s)", client->control->name,
+			    client->control->decimation, name);
+		return (jack_port_id_t)-1;
 	}
 
 	if ((port_id = jack_get_free_port (engine)) == (jack_port_id_t)-1) {
 		jack_error ("no ports available!");
-		jack_unlock_graph (engine);
-		return -1;
+		return (jack_port_id_t)-1;
 	}
 
-	shared = &engine->control->ports[port_id];
+	shared = jack_engine_port (engine, port_id);
+	names = jack_engine_port_names (engine, port_id);
 
 	if (!internal || !engine->driver) {
 		goto fallback;
@@ -4409,74 +10874,146 @@ jack_port_do_register (jack_engine_t *engine, jack_request_t *req, int internal)
 	backend_client_name = (char*)engine->driver->internal_client->control->name;
 	len = strlen (backend_client_name);
 
-	if (strncmp (req->x.port_info.name, backend_client_name, len) != 0) {
+	if (strncmp (name, backend_client_name, len) != 0) {
 		goto fallback;
 	}
 
 	/* use backend's original as an alias, use predefined names */
 
-	if (strcmp (req->x.port_info.type, JACK_DEFAULT_AUDIO_TYPE) == 0) {
-		if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
-			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":playback_%d", ++engine->audio_out_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+	if (strcmp (engine->control->port_types[i].type_name, JACK_DEFAULT_AUDIO_TYPE) == 0) {
+		if ((flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
+			snprintf (names->name, sizeof(names->name), JACK_BACKEND_ALIAS ":playback_%d", ++engine->audio_out_cnt);
+			strcpy (names->alias1, name);
 			goto next;
-		} else if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
-			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":capture_%d", ++engine->audio_in_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+		} else if ((flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
+			snprintf (names->name, sizeof(names->name), JACK_BACKEND_ALIAS ":capture_%d", ++engine->audio_in_cnt);
+			strcpy (names->alias1, name);
 			goto next;
 		}
 	}
 
 #if 0   // do not do this for MIDI
 
-	else if (strcmp (req->x.port_info.type, JACK_DEFAULT_MIDI_TYPE) == 0) {
-		if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
-			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":midi_playback_%d", ++engine->midi_out_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+	else if (strcmp (engine->control->port_types[i].type_name, JACK_DEFAULT_MIDI_TYPE) == 0) {
+		if ((flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
+			snprintf (names->name, sizeof(names->name), JACK_BACKEND_ALIAS ":midi_playback_%d", ++engine->midi_out_cnt);
+			strcpy (names->alias1, name);
 			goto next;
-		} else if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
-			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":midi_capture_%d", ++engine->midi_in_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+		} else if ((flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
+			snprintf (names->name, sizeof(names->name), JACK_BACKEND_ALIAS ":midi_capture_%d", ++engine->midi_in_cnt);
+			strcpy (names->alias1, name);
 			goto next;
 		}
 	}
 #endif
 
 fallback:
-	strcpy (shared->name, req->x.port_info.name);
+	strcpy (names->name, name);
 
 next:
 	shared->ptype_id = engine->control->port_types[i].ptype_id;
-	jack_uuid_copy (&shared->client_id, req->x.port_info.client_id);
+	jack_uuid_copy (&shared->client_id, client->control->uuid);
 	shared->uuid = jack_port_uuid_generate (port_id);
-	shared->flags = req->x.port_info.flags;
+	shared->flags = flags;
 	shared->latency = 0;
 	shared->capture_latency.min = shared->capture_latency.max = 0;
 	shared->playback_latency.min = shared->playback_latency.max = 0;
 	shared->monitor_requests = 0;
+	shared->n_connections = 0;
+	shared->silent_cycle = 0;
+	shared->passthrough_cycle = 0;
+	shared->pooled = 0;
+	shared->channels = 0;
+	shared->stage = -1;
+	shared->delay_offset = 0;
+	shared->delay_silent_cycle = 0;
+	shared->delayed = 0;
+	shared->buffer_bytes = 0;
+	shared->meter_requests = 0;
+	shared->meter_peak = 0.0f;
+	shared->meter_rms = 0.0f;
+	shared->meter_cycle = 0;
+
+	if (buffer_size && shared->ptype_id == JACK_MIDI_PORT_TYPE &&
+	    (flags & JackPortIsOutput)) {
+		shared->buffer_bytes = buffer_size < JACK_MIDI_MIN_BUFFER_BYTES
+				       ? JACK_MIDI_MIN_BUFFER_BYTES
+				       : (uint32_t)buffer_size;
+	}
+
+	pthread_mutex_lock (&engine->port_lock);
+	jack_port_hash_insert (engine, port_id);
+	engine->control->port_generation++;
+	pthread_mutex_unlock (&engine->port_lock);
 
 	port = &engine->internal_ports[port_id];
 
 	port->shared = shared;
+	port->names = names;
 	port->connections = 0;
 	port->buffer_info = NULL;
+	port->delay_info = NULL;
+	port->share_info = NULL;
 
-	if (jack_port_assign_buffer (engine, port)) {
+	if (jack_port_assign_buffer (engine, client, port)) {
 		jack_error ("cannot assign buffer for port");
 		jack_port_release (engine, &engine->internal_ports[port_id]);
+		return (jack_port_id_t)-1;
+	}
+
+	/* the buffer may come from a port that had another size */
+	if (shared->ptype_id == JACK_MIDI_PORT_TYPE && port->buffer_info) {
+		jack_port_buffer_init_hinted (engine, shared, port->buffer_info,
+					      engine->control->buffer_size);
+	}
+
+	client->ports = jack_slist_prepend (client->ports, port);
+
+	if (engine->checkpoint) {
+		jack_checkpoint_restore_aliases (engine, names);
+	}
+
+	VERBOSE (engine, "registered port %s, offset = %u",
+		 names->name, (unsigned int)shared->offset);
+
+	return port_id;
+}
+
+int
+jack_port_do_register (jack_engine_t *engine, jack_request_t *req, int internal)
+{
+	jack_port_id_t port_id;
+	jack_client_internal_t *client;
+	int i;
+
+	if ((i = jack_port_type_index (engine, req->x.port_info.type)) < 0) {
+		return -1;
+	}
+
+	jack_lock_graph (engine);
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.port_info.client_id))
+	    == NULL) {
+		jack_error ("unknown client id in port registration request");
+		jack_unlock_graph (engine);
+		return -1;
+	}
+
+	if ((port_id = jack_port_register_internal (engine, client,
+						    req->x.port_info.name, i,
+						    req->x.port_info.flags,
+						    req->x.port_info.buffer_size,
+						    internal)) == (jack_port_id_t)-1) {
 		jack_unlock_graph (engine);
 		return -1;
 	}
 
-	client->ports = jack_slist_prepend (client->ports, port);
 	if ( client->control->active ) {
+		jack_client_ring_update (engine, client);
 		jack_port_registration_notify (engine, port_id, TRUE);
 	}
 	jack_unlock_graph (engine);
 
-	VERBOSE (engine, "registered port %s, offset = %u",
-		 shared->name, (unsigned int)shared->offset);
-
 	req->x.port_info.port_id = port_id;
 
 	return 0;
@@ -4491,20 +11028,20 @@ jack_port_do_unregister (jack_engine_t *engine, jack_request_t *req)
 	jack_uuid_t uuid;
 
 	if (req->x.port_info.port_id < 0 ||
-	    req->x.port_info.port_id > engine->port_max) {
+	    req->x.port_info.port_id >= engine->port_max) {
 		jack_error ("invalid port ID %" PRIu32
 			    " in unregister request",
 			    req->x.port_info.port_id);
 		return -1;
 	}
 
-	shared = &engine->control->ports[req->x.port_info.port_id];
+	shared = jack_engine_port (engine, req->x.port_info.port_id);
 
 	if (jack_uuid_compare (shared->client_id, req->x.port_info.client_id) != 0) {
 		char buf[JACK_UUID_STRING_SIZE];
 		jack_uuid_unparse (req->x.port_info.client_id, buf);
 		jack_error ("Client %s is not allowed to remove port %s",
-			    buf, shared->name);
+			    buf, jack_engine_port_names (engine, req->x.port_info.port_id)->name);
 		return -1;
 	}
 
@@ -4524,6 +11061,7 @@ jack_port_do_unregister (jack_engine_t *engine, jack_request_t *req)
 	jack_port_release (engine, &engine->internal_ports[req->x.port_info.port_id]);
 
 	client->ports = jack_slist_remove (client->ports, port);
+	jack_client_ring_update (engine, client);
 	jack_port_registration_notify (engine, req->x.port_info.port_id,
 				       FALSE);
 	jack_unlock_graph (engine);
@@ -4531,6 +11069,141 @@ jack_port_do_unregister (jack_engine_t *engine, jack_request_t *req)
 	return 0;
 }
 
+/* RegisterPorts: all of the ports, or none of them */
+static int
+jack_port_do_register_many (jack_engine_t *engine, jack_request_t *req,
+			    int internal)
+{
+	jack_client_internal_t *client;
+	jack_port_id_t *ids = req->x.port_batch.port_ids;
+	uint32_t n = req->x.port_batch.nports;
+	uint32_t k, j;
+	int i;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if ((i = jack_port_type_index (engine, req->x.port_batch.type)) < 0) {
+		return -1;
+	}
+
+	jack_lock_graph (engine);
+
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.port_batch.client_id))
+	    == NULL) {
+		jack_error ("unknown client id in port registration request");
+		jack_unlock_graph (engine);
+		return -1;
+	}
+
+	for (k = 0; k < n; k++) {
+		if ((ids[k] = jack_port_register_internal (
+			     engine, client,
+			     req->x.port_batch.names + k * JACK_PORT_NAME_SIZE,
+			     i, req->x.port_batch.flags,
+			     req->x.port_batch.buffer_size, internal))
+		    == (jack_port_id_t)-1) {
+			break;
+		}
+	}
+
+	if (k < n) {
+		/* nobody has been told about them yet */
+		for (j = 0; j < k; j++) {
+			jack_port_internal_t *port = &engine->internal_ports[ids[j]];
+			jack_port_release (engine, port);
+			client->ports = jack_slist_remove (client->ports, port);
+		}
+		jack_unlock_graph (engine);
+		return -1;
+	}
+
+	if (client->control->active) {
+		jack_client_ring_update (engine, client);
+		jack_ports_registration_notify (engine, ids, n, TRUE);
+	}
+
+	jack_unlock_graph (engine);
+
+	VERBOSE (engine, "registered %" PRIu32 " ports for %s", n,
+		 client->control->name);
+
+	return 0;
+}
+
+static int
+jack_port_do_unregister_many (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_client_internal_t *client;
+	jack_port_internal_t *port;
+	jack_port_id_t *ids = req->x.port_batch.port_ids;
+	uint32_t n = req->x.port_batch.nports;
+	uint32_t k;
+	int disconnected = FALSE;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	jack_lock_graph (engine);
+
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.port_batch.client_id))
+	    == NULL) {
+		jack_error ("unknown client id in port unregistration request");
+		jack_unlock_graph (engine);
+		return -1;
+	}
+
+	for (k = 0; k < n; k++) {
+		if (ids[k] >= engine->port_max ||
+		    !jack_engine_port (engine, ids[k])->in_use ||
+		    jack_uuid_compare (jack_engine_port (engine, ids[k])->client_id,
+				       client->control->uuid) != 0) {
+			jack_error ("Client %s is not allowed to remove port %" PRIu32,
+				    client->control->name, ids[k]);
+			jack_unlock_graph (engine);
+			return -1;
+		}
+	}
+
+	/* break all the connections first, and update the graph once */
+
+	for (k = 0; k < n; k++) {
+		port = &engine->internal_ports[ids[k]];
+		while (port->connections) {
+			jack_connection_internal_t *c =
+				(jack_connection_internal_t*)port->connections->data;
+			jack_port_disconnect_internal (engine, c->source,
+						       c->destination, FALSE);
+			disconnected = TRUE;
+		}
+	}
+
+	if (disconnected) {
+		if (engine->feedbackcount && jack_check_acyclic (engine)) {
+			jack_sort_graph (engine);
+		} else {
+			jack_update_graph (engine);
+		}
+	}
+
+	for (k = 0; k < n; k++) {
+		port = &engine->internal_ports[ids[k]];
+		jack_port_release (engine, port);
+		client->ports = jack_slist_remove (client->ports, port);
+	}
+
+	jack_client_ring_update (engine, client);
+	jack_ports_registration_notify (engine, ids, n, FALSE);
+
+	jack_unlock_graph (engine);
+
+	return 0;
+}
+
 int
 jack_do_get_port_connections (jack_engine_t *engine, jack_request_t *req,
 			      int reply_fd)
@@ -4545,7 +11218,7 @@ jack_do_get_port_connections (jack_engine_t *engine, jack_request_t *req,
 
 	port = &engine->internal_ports[req->x.port_info.port_id];
 
-	DEBUG ("Getting connections for port '%s'.", port->shared->name);
+	DEBUG ("Getting connections for port '%s'.", port->names->name);
 
 	req->x.port_connections.nports = jack_slist_length (port->connections);
 	req->status = 0;
@@ -4600,7 +11273,7 @@ jack_do_get_port_connections (jack_engine_t *engine, jack_request_t *req,
 				 */
 				char **ports = (char**)req->x.port_connections.ports;
 
-				ports[i] = engine->control->ports[port_id].name;
+				ports[i] = jack_engine_port_names (engine, port_id)->name;
 
 			} else {
 
@@ -4635,6 +11308,8 @@ jack_port_registration_notify (jack_engine_t *engine,
 	jack_client_internal_t *client;
 	JSList *node;
 
+	jack_checkpoint_dirty (engine->checkpoint);
+
 	event.type = (yn ? PortRegistered : PortUnregistered);
 	event.x.port_id = port_id;
 
@@ -4657,6 +11332,51 @@ jack_port_registration_notify (jack_engine_t *engine,
 	}
 }
 
+/* like jack_port_registration_notify(), with many ports per event */
+static void
+jack_ports_registration_notify (jack_engine_t *engine,
+				const jack_port_id_t *ids, uint32_t n, int yn)
+{
+	jack_event_t event;
+	jack_client_internal_t *client;
+	JSList *node;
+	uint32_t done, cnt;
+
+	jack_checkpoint_dirty (engine->checkpoint);
+
+	VALGRIND_MEMSET (&event, 0, sizeof(event));
+
+	event.type = (yn ? PortsRegistered : PortsUnregistered);
+
+	for (done = 0; done < n; done += cnt) {
+
+		cnt = n - done;
+		if (cnt > JACK_EVENT_PORT_IDS) {
+			cnt = JACK_EVENT_PORT_IDS;
+		}
+
+		event.x.n = cnt;
+		memcpy (event.z.port_ids, ids + done, cnt * sizeof(jack_port_id_t));
+
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+
+			client = (jack_client_internal_t*)node->data;
+
+			if (!client->control->active ||
+			    !client->control->port_register_cbset) {
+				continue;
+			}
+
+			if (jack_deliver_event (engine, client, &event)) {
+				jack_error ("cannot send port registration"
+					    " notification to %s (%s)",
+					    client->control->name,
+					    strerror (errno));
+			}
+		}
+	}
+}
+
 static void
 jack_port_rename_notify (jack_engine_t *engine,
 			 const char* old_name,
@@ -4667,6 +11387,8 @@ jack_port_rename_notify (jack_engine_t *engine,
 	JSList *node;
 	jack_port_internal_t* port;
 
+	jack_checkpoint_dirty (engine->checkpoint);
+
 	if ((port = jack_get_port_by_name (engine, new_name)) == NULL) {
 		/* possible race condition: port renamed again
 		   since this rename happened. Oh well.
@@ -4674,6 +11396,12 @@ jack_port_rename_notify (jack_engine_t *engine,
 		return;
 	}
 
+	pthread_mutex_lock (&engine->port_lock);
+	jack_port_hash_remove (engine, port->shared->id, old_name);
+	jack_port_hash_insert (engine, port->shared->id);
+	engine->control->port_generation++;
+	pthread_mutex_unlock (&engine->port_lock);
+
 	event.type = PortRename;
 	event.y.other_id = port->shared->id;
 	snprintf (event.x.name, JACK_PORT_NAME_SIZE - 1, "%s", old_name);
@@ -4706,6 +11434,8 @@ jack_client_registration_notify (jack_engine_t *engine,
 	jack_client_internal_t *client;
 	JSList *node;
 
+	jack_checkpoint_dirty (engine->checkpoint);
+
 	event.type = (yn ? ClientRegistered : ClientUnregistered);
 	snprintf (event.x.name, sizeof(event.x.name), "%s", name);
 
@@ -4733,6 +11463,64 @@ jack_client_registration_notify (jack_engine_t *engine,
 	}
 }
 
+/* the payload of a SetProperty request is "key\0value\0type\0" */
+static int
+jack_do_set_property (jack_engine_t *engine, jack_request_t *req)
+{
+	const char *key = req->x.property.key;
+	const char *end, *value, *type;
+	jack_property_change_t change;
+
+	if (key == NULL) {
+		return -1;
+	}
+
+	end = key + req->x.property.keylen;
+	if (end[-1] != '\0' || key[0] == '\0') {
+		return -1;
+	}
+
+	value = key + strlen (key) + 1;
+	if (value >= end || value[0] == '\0') {
+		return -1;
+	}
+
+	type = value + strlen (value) + 1;
+	if (type >= end) {
+		return -1;
+	}
+
+	if (jack_propstore_set (engine->propstore, req->x.property.uuid, key,
+				value, type[0] ? type : NULL, &change)) {
+		return -1;
+	}
+
+	jack_property_change_notify (engine, change, req->x.property.uuid, key);
+
+	return 0;
+}
+
+/* one property if there is a key, all of the subject's if not.
+   answers how many went */
+static int
+jack_do_remove_properties (jack_engine_t *engine, jack_request_t *req)
+{
+	const char *key = req->x.property.key;
+	int n;
+
+	if (key && key[req->x.property.keylen - 1] != '\0') {
+		return -1;
+	}
+
+	if ((n = jack_propstore_remove (engine->propstore, req->x.property.uuid,
+					key)) > 0) {
+		jack_property_change_notify (engine, PropertyDeleted,
+					     req->x.property.uuid, key);
+	}
+
+	return n;
+}
+
 void
 jack_property_change_notify (jack_engine_t *engine,
 			     jack_property_change_t change,
@@ -4771,12 +11559,63 @@ jack_property_change_notify (jack_engine_t *engine,
 	}
 }
 
+/* Prefer the buffer right after the last one given to another output
+ * port of the same client and type, so that a client's buffers stay
+ * together in the segment, and in as few pages as possible.
+ */
+static jack_port_buffer_info_t *
+jack_port_next_buffer (jack_engine_t *engine, jack_client_internal_t *client,
+		       jack_port_internal_t *port)
+{
+	jack_port_buffer_list_t *blist = jack_port_buffer_list (engine, port);
+	jack_port_buffer_info_t *last = NULL, *want;
+	jack_port_internal_t *other;
+	JSList *node;
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		other = (jack_port_internal_t*)node->data;
+		if (other->buffer_info &&
+		    other->shared->ptype_id == port->shared->ptype_id &&
+		    (last == NULL || other->buffer_info > last)) {
+			last = other->buffer_info;
+		}
+	}
+
+	if (last == NULL || last + 1 >= blist->info + blist->nbuffers) {
+		return NULL;
+	}
+
+	want = last + 1;
+
+	for (node = blist->freelist; node; node = jack_slist_next (node)) {
+		if (node->data == want) {
+			return want;
+		}
+	}
+
+	return NULL;
+}
+
 int
-jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
+jack_port_assign_buffer (jack_engine_t *engine, jack_client_internal_t *client,
+			 jack_port_internal_t *port)
 {
 	jack_port_buffer_list_t *blist =
 		jack_port_buffer_list (engine, port);
 	jack_port_buffer_info_t *bi;
+	jack_port_type_id_t ptid = port->shared->ptype_id;
+
+	/* inputs need the segment too, for its zero buffer */
+	if (!engine->port_segment[ptid].attached_at) {
+		if (engine->port_buffer_frames == 0) {
+			jack_error ("cannot register a port before the"
+				    " buffer size is known");
+			return -1;
+		}
+		if (jack_resize_port_segment (engine, ptid, engine->port_max)) {
+			return -1;
+		}
+	}
 
 	if (port->shared->flags & JackPortIsInput) {
 		port->shared->offset = 0;
@@ -4794,7 +11633,9 @@ jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
 		return -1;
 	}
 
-	bi = (jack_port_buffer_info_t*)blist->freelist->data;
+	if ((bi = jack_port_next_buffer (engine, client, port)) == NULL) {
+		bi = (jack_port_buffer_info_t*)blist->freelist->data;
+	}
 	blist->freelist = jack_slist_remove (blist->freelist, bi);
 
 	port->shared->offset = bi->offset;
@@ -4807,15 +11648,22 @@ jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
 static jack_port_internal_t *
 jack_get_port_by_name (jack_engine_t *engine, const char *name)
 {
+	jack_port_shared_t *shared;
 	jack_port_id_t id;
 
+	if ((shared = jack_port_hash_lookup (engine->control,
+					     &engine->port_table, name)) != NULL) {
+		return &engine->internal_ports[shared->id];
+	}
+
 	/* Note the potential race on "in_use". Other design
 	   elements prevent this from being a problem.
 	 */
 
 	for (id = 0; id < engine->port_max; id++) {
-		if (engine->control->ports[id].in_use &&
-		    jack_port_name_equals (&engine->control->ports[id], name)) {
+		shared = jack_engine_port (engine, id);
+		if (shared->in_use &&
+		    jack_port_name_equals (jack_engine_port_names (engine, id), name)) {
 			return &engine->internal_ports[id];
 		}
 	}
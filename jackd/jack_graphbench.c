@@ -0,0 +1,713 @@
+/*
+    jack_graphbench -- whole-graph timing with the dummy driver
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* A server with the dummy driver is started in this process through
+   the control API, once for each scheduling mode asked for. N clients
+   that each copy their input to their output and then spin for a
+   given time are wired up in the given topology, and one more client,
+   fed by every client that feeds no other, notes how long after the
+   start of the cycle the graph was done. That is the cycle latency;
+   its histogram and the xruns are written out as JSON.
+
+   With -x the number of clients is instead raised until a run has an
+   xrun or a cycle that took longer than its period, and the largest
+   number without one is reported.
+ */
+
+#include <config.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <jack/jack.h>
+#include <jack/control.h>
+
+#define GB_SERVER_NAME  "graphbench"
+
+typedef struct {
+	const char *name;
+	const char *activation;
+	bool parallel;
+} gb_mode_t;
+
+static const gb_mode_t gb_modes[] = {
+	{ "fifo", "fifo", false },
+	{ "futex", "futex", false },
+	{ "parallel", "fifo", true },
+	{ "futex-parallel", "futex", true },
+	{ NULL, NULL, false }
+};
+
+typedef enum {
+	GBChain,
+	GBFanOut,
+	GBFanIn,
+	GBDag
+} gb_topology_t;
+
+static const char *gb_topology_names[] = { "chain", "fanout", "fanin", "dag", NULL };
+
+/* one synthetic client */
+typedef struct {
+	jack_client_t *client;
+	jack_port_t *in;
+	jack_port_t *out;
+	jack_time_t burn;
+	int feeds;                      /* has connections out */
+} gb_node_t;
+
+/* the client at the end of the graph */
+typedef struct {
+	jack_client_t *client;
+	jack_port_t *in;
+	jack_time_t period_usecs;
+	unsigned int bucket_usecs;
+	unsigned int nbuckets;
+	uint32_t *hist;                 /* last bucket: anything later */
+	uint64_t cycles;
+	uint64_t overruns;              /* done after the period was over */
+	double sum;
+	jack_time_t max;
+	int measuring;
+	uint32_t xruns;
+} gb_sink_t;
+
+typedef struct {
+	unsigned int clients;
+	uint64_t cycles;
+	uint64_t overruns;
+	uint32_t xruns;
+	double mean;
+	jack_time_t p50, p90, p99, p999, max;
+} gb_result_t;
+
+/* options */
+static gb_topology_t topology = GBChain;
+static unsigned int nclients = 8;
+static jack_time_t burn_usecs = 50;
+static double seconds = 3.0;
+static unsigned int period = 256;
+static unsigned int rate = 48000;
+static unsigned int bucket_usecs = 10;
+static unsigned int max_clients = 0;    /* -x */
+static unsigned int seed = 1;
+static bool realtime = false;
+static int show_histogram = 1;
+
+static int
+gb_node_process (jack_nframes_t nframes, void *arg)
+{
+	gb_node_t *node = (gb_node_t*)arg;
+	jack_time_t start = jack_get_time ();
+
+	memcpy (jack_port_get_buffer (node->out, nframes),
+		jack_port_get_buffer (node->in, nframes),
+		nframes * sizeof(jack_default_audio_sample_t));
+
+	while (jack_get_time () - start < node->burn) {
+	}
+
+	return 0;
+}
+
+static int
+gb_sink_process (jack_nframes_t nframes, void *arg)
+{
+	gb_sink_t *sink = (gb_sink_t*)arg;
+	jack_nframes_t frames;
+	jack_time_t cycle_usecs, next_usecs, now, latency;
+	float period_usecs;
+	unsigned int bucket;
+
+	if (!__atomic_load_n (&sink->measuring, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	now = jack_get_time ();
+	if (jack_get_cycle_times (sink->client, &frames, &cycle_usecs,
+				  &next_usecs, &period_usecs)) {
+		return 0;
+	}
+
+	latency = now > cycle_usecs ? now - cycle_usecs : 0;
+
+	bucket = latency / sink->bucket_usecs;
+	if (bucket >= sink->nbuckets) {
+		bucket = sink->nbuckets - 1;
+	}
+	sink->hist[bucket]++;
+	sink->cycles++;
+	sink->sum += latency;
+	if (latency > sink->max) {
+		sink->max = latency;
+	}
+	if (latency > sink->period_usecs) {
+		sink->overruns++;
+	}
+
+	return 0;
+}
+
+static int
+gb_sink_xrun (void *arg)
+{
+	gb_sink_t *sink = (gb_sink_t*)arg;
+
+	if (__atomic_load_n (&sink->measuring, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch (&sink->xruns, 1, __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+static jack_client_t *
+gb_client_open (const char *name)
+{
+	jack_status_t status;
+
+	return jack_client_open (name, JackNoStartServer | JackServerName,
+				 &status, GB_SERVER_NAME);
+}
+
+/* The connections of `topology' for n clients, as pairs of (from, to),
+   returned in `edges'; the number of them is returned. */
+static unsigned int
+gb_edges (unsigned int n, unsigned int *edges)
+{
+	unsigned int i, j, from, nedges = 0;
+	unsigned int state = seed;
+
+	for (i = 1; i < n; i++) {
+		switch (topology) {
+		case GBChain:
+			edges[2 * nedges] = i - 1;
+			edges[2 * nedges++ + 1] = i;
+			break;
+		case GBFanOut:
+			edges[2 * nedges] = 0;
+			edges[2 * nedges++ + 1] = i;
+			break;
+		case GBFanIn:
+			edges[2 * nedges] = i - 1;
+			edges[2 * nedges++ + 1] = n - 1;
+			break;
+		case GBDag:
+			/* one connection from somewhere earlier, and on
+			   average one more */
+			state = state * 1103515245 + 12345;
+			from = (state >> 8) % i;
+			edges[2 * nedges] = from;
+			edges[2 * nedges++ + 1] = i;
+			for (j = 0; j < i; j++) {
+				state = state * 1103515245 + 12345;
+				if (j != from &&
+				    (state >> 8) % i == 0) {
+					edges[2 * nedges] = j;
+					edges[2 * nedges++ + 1] = i;
+				}
+			}
+			break;
+		}
+	}
+
+	return nedges;
+}
+
+static jack_time_t
+gb_percentile (gb_sink_t *sink, double pct)
+{
+	uint64_t want = (uint64_t)(sink->cycles * pct / 100.0);
+	uint64_t seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < sink->nbuckets; b++) {
+		seen += sink->hist[b];
+		if (seen > want) {
+			break;
+		}
+	}
+
+	if (b >= sink->nbuckets - 1) {
+		return sink->max;
+	}
+
+	return (jack_time_t)(b + 1) * sink->bucket_usecs;
+}
+
+/* Run the graph with n clients for `seconds'. Returns 0 and fills in
+   `result' (and the sink's histogram) if the graph could be set up. */
+static int
+gb_trial (unsigned int n, gb_sink_t *sink, gb_result_t *result)
+{
+	gb_node_t *nodes;
+	unsigned int *edges;
+	unsigned int nedges, i;
+	char name[32];
+	int ret = -1;
+
+	nodes = (gb_node_t*)calloc (n, sizeof(gb_node_t));
+	edges = (unsigned int*)malloc (sizeof(unsigned int) * 2 * (n * n + 1));
+	if (nodes == NULL || edges == NULL) {
+		goto out;
+	}
+
+	memset (sink->hist, 0, sizeof(uint32_t) * sink->nbuckets);
+	sink->cycles = sink->overruns = 0;
+	sink->sum = 0;
+	sink->max = 0;
+	sink->xruns = 0;
+
+	if ((sink->client = gb_client_open ("gb_sink")) == NULL) {
+		fprintf (stderr, "jack_graphbench: cannot connect to the server\n");
+		goto out;
+	}
+	sink->in = jack_port_register (sink->client, "in", JACK_DEFAULT_AUDIO_TYPE,
+				       JackPortIsInput, 0);
+	jack_set_process_callback (sink->client, gb_sink_process, sink);
+	jack_set_xrun_callback (sink->client, gb_sink_xrun, sink);
+	if (sink->in == NULL || jack_activate (sink->client)) {
+		goto close;
+	}
+
+	for (i = 0; i < n; i++) {
+		snprintf (name, sizeof(name), "gb_%03u", i);
+		if ((nodes[i].client = gb_client_open (name)) == NULL) {
+			fprintf (stderr, "jack_graphbench: cannot open client %u\n", i);
+			goto close;
+		}
+		nodes[i].in = jack_port_register (nodes[i].client, "in",
+						  JACK_DEFAULT_AUDIO_TYPE,
+						  JackPortIsInput, 0);
+		nodes[i].out = jack_port_register (nodes[i].client, "out",
+						   JACK_DEFAULT_AUDIO_TYPE,
+						   JackPortIsOutput, 0);
+		nodes[i].burn = burn_usecs;
+		jack_set_process_callback (nodes[i].client, gb_node_process, &nodes[i]);
+		if (nodes[i].in == NULL || nodes[i].out == NULL ||
+		    jack_activate (nodes[i].client)) {
+			fprintf (stderr, "jack_graphbench: cannot set up client %u\n", i);
+			goto close;
+		}
+	}
+
+	nedges = gb_edges (n, edges);
+	for (i = 0; i < nedges; i++) {
+		nodes[edges[2 * i]].feeds = 1;
+		if (jack_connect (sink->client,
+				  jack_port_name (nodes[edges[2 * i]].out),
+				  jack_port_name (nodes[edges[2 * i + 1]].in))) {
+			goto close;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (!nodes[i].feeds &&
+		    jack_connect (sink->client, jack_port_name (nodes[i].out),
+				  jack_port_name (sink->in))) {
+			goto close;
+		}
+	}
+
+	/* let the graph settle before measuring */
+	usleep (500000);
+	__atomic_store_n (&sink->measuring, 1, __ATOMIC_RELEASE);
+	usleep ((useconds_t)(seconds * 1000000.0));
+	__atomic_store_n (&sink->measuring, 0, __ATOMIC_RELEASE);
+	usleep (4 * sink->period_usecs + 10000);
+
+	memset (result, 0, sizeof(*result));
+	result->clients = n;
+	result->cycles = sink->cycles;
+	result->overruns = sink->overruns;
+	result->xruns = sink->xruns;
+	if (sink->cycles) {
+		result->mean = sink->sum / sink->cycles;
+		result->p50 = gb_percentile (sink, 50.0);
+		result->p90 = gb_percentile (sink, 90.0);
+		result->p99 = gb_percentile (sink, 99.0);
+		result->p999 = gb_percentile (sink, 99.9);
+		result->max = sink->max;
+	}
+	ret = 0;
+
+close:
+	for (i = 0; i < n; i++) {
+		if (nodes[i].client) {
+			jack_client_close (nodes[i].client);
+		}
+	}
+	jack_client_close (sink->client);
+	sink->client = NULL;
+
+out:
+	free (edges);
+	free (nodes);
+
+	return ret;
+}
+
+static jackctl_parameter_t *
+gb_parameter (const JSList *list, const char *name)
+{
+	for (; list; list = jack_slist_next (list)) {
+		if (strcmp (jackctl_parameter_get_name ((jackctl_parameter_t*)list->data),
+			    name) == 0) {
+			return (jackctl_parameter_t*)list->data;
+		}
+	}
+
+	return NULL;
+}
+
+static bool
+gb_set_uint (const JSList *list, const char *name, unsigned int ui)
+{
+	union jackctl_parameter_value value;
+	jackctl_parameter_t *param = gb_parameter (list, name);
+
+	value.ui = ui;
+	return param && jackctl_parameter_set_value (param, &value);
+}
+
+static bool
+gb_set_bool (const JSList *list, const char *name, bool b)
+{
+	union jackctl_parameter_value value;
+	jackctl_parameter_t *param = gb_parameter (list, name);
+
+	value.b = b;
+	return param && jackctl_parameter_set_value (param, &value);
+}
+
+static bool
+gb_set_str (const JSList *list, const char *name, const char *str)
+{
+	union jackctl_parameter_value value;
+	jackctl_parameter_t *param = gb_parameter (list, name);
+
+	snprintf (value.str, sizeof(value.str), "%s", str);
+	return param && jackctl_parameter_set_value (param, &value);
+}
+
+static jackctl_server_t *
+gb_server_start (const gb_mode_t *mode, unsigned int most_clients)
+{
+	jackctl_server_t *server;
+	jackctl_driver_t *driver = NULL;
+	const JSList *params, *node;
+
+	if ((server = jackctl_server_create (NULL, NULL)) == NULL) {
+		return NULL;
+	}
+
+	params = jackctl_server_get_parameters (server);
+	if (!gb_set_str (params, "name", GB_SERVER_NAME) ||
+	    !gb_set_bool (params, "realtime", realtime) ||
+	    !gb_set_bool (params, "nozombies", true) ||
+	    !gb_set_uint (params, "port-max", 2 * most_clients + 16) ||
+	    !gb_set_str (params, "activation", mode->activation) ||
+	    !gb_set_bool (params, "parallel", mode->parallel)) {
+		fprintf (stderr, "jack_graphbench: cannot set server parameters\n");
+		goto fail;
+	}
+
+	for (node = jackctl_server_get_drivers_list (server); node;
+	     node = jack_slist_next (node)) {
+		if (strcmp (jackctl_driver_get_name ((jackctl_driver_t*)node->data),
+			    "dummy") == 0) {
+			driver = (jackctl_driver_t*)node->data;
+		}
+	}
+
+	if (driver == NULL) {
+		fprintf (stderr, "jack_graphbench: no dummy driver "
+			 "(set JACK_DRIVER_DIR to where it is)\n");
+		goto fail;
+	}
+
+	params = jackctl_driver_get_parameters (driver);
+	if (!gb_set_uint (params, "capture", 0) ||
+	    !gb_set_uint (params, "playback", 0) ||
+	    !gb_set_uint (params, "rate", rate) ||
+	    !gb_set_uint (params, "period", period)) {
+		fprintf (stderr, "jack_graphbench: cannot set driver parameters\n");
+		goto fail;
+	}
+
+	if (!jackctl_server_start (server, driver)) {
+		goto fail;
+	}
+
+	return server;
+
+fail:
+	jackctl_server_destroy (server);
+	return NULL;
+}
+
+static void
+gb_print_result (const gb_result_t *r)
+{
+	printf ("{\"clients\": %u, \"cycles\": %llu, \"xruns\": %u, "
+		"\"overruns\": %llu, \"latency_usecs\": {\"mean\": %.1f, "
+		"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, "
+		"\"max\": %llu}",
+		r->clients, (unsigned long long)r->cycles, r->xruns,
+		(unsigned long long)r->overruns, r->mean,
+		(unsigned long long)r->p50, (unsigned long long)r->p90,
+		(unsigned long long)r->p99, (unsigned long long)r->p999,
+		(unsigned long long)r->max);
+}
+
+static void
+gb_print_histogram (const gb_sink_t *sink)
+{
+	unsigned int b;
+	int first = 1;
+
+	printf (",\n     \"histogram\": {\"bucket_usecs\": %u, \"counts\": [",
+		sink->bucket_usecs);
+	for (b = 0; b < sink->nbuckets; b++) {
+		if (sink->hist[b]) {
+			printf ("%s[%u, %u]", first ? "" : ", ",
+				b * sink->bucket_usecs, sink->hist[b]);
+			first = 0;
+		}
+	}
+	printf ("]}");
+}
+
+static int
+gb_too_slow (const gb_result_t *r)
+{
+	return r->xruns || r->overruns || r->cycles == 0;
+}
+
+/* the most clients that run without an xrun: double until a run
+   fails, then bisect */
+static void
+gb_ramp (gb_sink_t *sink)
+{
+	gb_result_t result;
+	unsigned int good = 0, bad = 0, n = 1;
+	int first = 1;
+
+	printf (", \"trials\": [");
+
+	while (bad == 0 || bad - good > 1) {
+		if (gb_trial (n, sink, &result)) {
+			break;
+		}
+		printf ("%s\n     ", first ? "" : ",");
+		gb_print_result (&result);
+		printf ("}");
+		fflush (stdout);
+		first = 0;
+
+		if (gb_too_slow (&result)) {
+			bad = n;
+		} else {
+			good = n;
+			if (n == max_clients) {
+				break;
+			}
+		}
+
+		if (bad == 0) {
+			n = n * 2 < max_clients ? n * 2 : max_clients;
+		} else {
+			n = (good + bad) / 2;
+		}
+	}
+
+	printf ("],\n   \"max_clients\": %u", good);
+}
+
+static void
+usage (FILE *f)
+{
+	fprintf (f, "usage: jack_graphbench [ options ]\n"
+		 "  -m, --modes=LIST      fifo, futex, parallel, futex-parallel "
+		 "(default fifo,futex,parallel)\n"
+		 "  -t, --topology=NAME   chain, fanout, fanin or dag (default chain)\n"
+		 "  -c, --clients=N       synthetic clients (default 8)\n"
+		 "  -w, --burn=USECS      CPU time each client spends per cycle (default 50)\n"
+		 "  -d, --duration=SECS   measured time per run (default 3)\n"
+		 "  -p, --period=FRAMES   dummy driver period (default 256)\n"
+		 "  -r, --rate=HZ         dummy driver rate (default 48000)\n"
+		 "  -b, --bucket=USECS    histogram resolution (default 10)\n"
+		 "  -x, --max-clients=N   find the most clients (up to N) without an xrun\n"
+		 "  -s, --seed=N          seed of the dag topology (default 1)\n"
+		 "  -R, --realtime        run the server and clients realtime\n"
+		 "  -H, --no-histogram    leave the histograms out\n"
+		 "The dummy driver is looked for in $JACK_DRIVER_DIR.\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	const struct option long_options[] = {
+		{ "modes", 1, 0, 'm' },
+		{ "topology", 1, 0, 't' },
+		{ "clients", 1, 0, 'c' },
+		{ "burn", 1, 0, 'w' },
+		{ "duration", 1, 0, 'd' },
+		{ "period", 1, 0, 'p' },
+		{ "rate", 1, 0, 'r' },
+		{ "bucket", 1, 0, 'b' },
+		{ "max-clients", 1, 0, 'x' },
+		{ "seed", 1, 0, 's' },
+		{ "realtime", 0, 0, 'R' },
+		{ "no-histogram", 0, 0, 'H' },
+		{ "help", 0, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	char modes_arg[256] = "fifo,futex,parallel";
+	const gb_mode_t *mode;
+	jackctl_server_t *server;
+	gb_result_t result;
+	gb_sink_t sink;
+	char *tok, *save;
+	int opt, i, first = 1;
+
+	while ((opt = getopt_long (argc, argv, "m:t:c:w:d:p:r:b:x:s:RHh",
+				   long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'm':
+			snprintf (modes_arg, sizeof(modes_arg), "%s", optarg);
+			break;
+		case 't':
+			for (i = 0; gb_topology_names[i]; i++) {
+				if (strcmp (optarg, gb_topology_names[i]) == 0) {
+					break;
+				}
+			}
+			if (gb_topology_names[i] == NULL) {
+				fprintf (stderr, "jack_graphbench: unknown topology %s\n", optarg);
+				return 1;
+			}
+			topology = (gb_topology_t)i;
+			break;
+		case 'c':
+			nclients = strtoul (optarg, NULL, 0);
+			break;
+		case 'w':
+			burn_usecs = strtoull (optarg, NULL, 0);
+			break;
+		case 'd':
+			seconds = atof (optarg);
+			break;
+		case 'p':
+			period = strtoul (optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtoul (optarg, NULL, 0);
+			break;
+		case 'b':
+			bucket_usecs = strtoul (optarg, NULL, 0);
+			break;
+		case 'x':
+			max_clients = strtoul (optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul (optarg, NULL, 0);
+			break;
+		case 'R':
+			realtime = true;
+			break;
+		case 'H':
+			show_histogram = 0;
+			break;
+		case 'h':
+			usage (stdout);
+			return 0;
+		default:
+			usage (stderr);
+			return 1;
+		}
+	}
+
+	if (nclients == 0 || seconds <= 0 || period == 0 || rate == 0 ||
+	    bucket_usecs == 0 || optind < argc) {
+		usage (stderr);
+		return 1;
+	}
+
+	memset (&sink, 0, sizeof(sink));
+	sink.period_usecs = (jack_time_t)period * 1000000 / rate;
+	sink.bucket_usecs = bucket_usecs;
+	/* up to four periods, and one bucket for anything later */
+	sink.nbuckets = 4 * sink.period_usecs / bucket_usecs + 2;
+	if ((sink.hist = (uint32_t*)calloc (sink.nbuckets, sizeof(uint32_t))) == NULL) {
+		return 1;
+	}
+
+	printf ("{\"topology\": \"%s\", \"burn_usecs\": %llu, \"period\": %u, "
+		"\"rate\": %u, \"period_usecs\": %llu, \"realtime\": %s,\n \"runs\": [",
+		gb_topology_names[topology], (unsigned long long)burn_usecs,
+		period, rate, (unsigned long long)sink.period_usecs,
+		realtime ? "true" : "false");
+
+	for (tok = strtok_r (modes_arg, ",", &save); tok;
+	     tok = strtok_r (NULL, ",", &save)) {
+
+		for (mode = gb_modes; mode->name; mode++) {
+			if (strcmp (tok, mode->name) == 0) {
+				break;
+			}
+		}
+		if (mode->name == NULL) {
+			fprintf (stderr, "jack_graphbench: unknown mode %s\n", tok);
+			continue;
+		}
+
+		if ((server = gb_server_start (mode, max_clients ? max_clients : nclients)) == NULL) {
+			fprintf (stderr, "jack_graphbench: cannot start the server (%s)\n",
+				 mode->name);
+			continue;
+		}
+
+		printf ("%s\n  {\"mode\": \"%s\"", first ? "" : ",", mode->name);
+		first = 0;
+
+		if (max_clients) {
+			gb_ramp (&sink);
+		} else if (gb_trial (nclients, &sink, &result) == 0) {
+			printf (", \"result\": ");
+			gb_print_result (&result);
+			if (show_histogram) {
+				gb_print_histogram (&sink);
+			}
+			printf ("}");
+		}
+		printf ("}");
+		fflush (stdout);
+
+		jackctl_server_stop (server);
+		jackctl_server_destroy (server);
+	}
+
+	printf ("\n ]}\n");
+
+	free (sink.hist);
+
+	return 0;
+}
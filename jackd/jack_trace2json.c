@@ -0,0 +1,239 @@
+/*
+    jack_trace2json -- convert a jackd --trace file to Chrome trace JSON
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* one thread row per client in the output, tid 0 is the engine */
+typedef struct {
+	uint64_t uuid;
+	char *name;
+	uint64_t triggered_at;
+	uint64_t awake_at;
+} trace_client_t;
+
+static trace_client_t *clients = NULL;
+static unsigned int nclients = 0;
+static int first_event = 1;
+
+static unsigned int
+trace_client (uint64_t uuid)
+{
+	unsigned int i;
+
+	for (i = 0; i < nclients; i++) {
+		if (clients[i].uuid == uuid) {
+			return i;
+		}
+	}
+
+	clients = (trace_client_t*)realloc (clients,
+					    sizeof(trace_client_t) * (nclients + 1));
+	if (clients == NULL) {
+		fprintf (stderr, "jack_trace2json: out of memory\n");
+		exit (1);
+	}
+	memset (&clients[nclients], 0, sizeof(trace_client_t));
+	clients[nclients].uuid = uuid;
+
+	return nclients++;
+}
+
+static void
+print_string (FILE *out, const char *str)
+{
+	fputc ('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			fprintf (out, "\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			fprintf (out, "\\u%04x", (unsigned char)*str);
+		} else {
+			fputc (*str, out);
+		}
+	}
+	fputc ('"', out);
+}
+
+static void
+print_event (FILE *out, const char *name, char ph, unsigned int tid,
+	     uint64_t ts, uint64_t dur, uint32_t cycle)
+{
+	fprintf (out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,"
+		 "\"tid\":%u,\"ts\":%" PRIu64,
+		 first_event ? "" : ",", name, ph, tid, ts);
+	if (ph == 'X') {
+		fprintf (out, ",\"dur\":%" PRIu64, dur);
+	} else if (ph == 'i') {
+		fprintf (out, ",\"s\":\"g\"");
+	}
+	fprintf (out, ",\"args\":{\"cycle\":%u}}", cycle);
+	first_event = 0;
+}
+
+static void
+usage (void)
+{
+	fprintf (stderr, "usage: jack_trace2json TRACE-FILE [JSON-FILE]\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	FILE *in, *out = stdout;
+	jack_trace_header_t hdr;
+	jack_trace_record_t rec;
+	char *name;
+	uint64_t cycle_at = 0, read_at = 0;
+	unsigned int c, i;
+
+	if (argc < 2 || argc > 3) {
+		usage ();
+		return 1;
+	}
+
+	if ((in = fopen (argv[1], "rb")) == NULL) {
+		perror (argv[1]);
+		return 1;
+	}
+
+	if (fread (&hdr, sizeof(hdr), 1, in) != 1 ||
+	    hdr.magic != JACK_TRACE_MAGIC ||
+	    hdr.version != JACK_TRACE_VERSION ||
+	    hdr.record_size != sizeof(jack_trace_record_t)) {
+		fprintf (stderr, "%s is not a JACK trace file this program "
+			 "understands\n", argv[1]);
+		return 1;
+	}
+
+	if (argc == 3 && (out = fopen (argv[2], "w")) == NULL) {
+		perror (argv[2]);
+		return 1;
+	}
+
+	if ((name = (char*)calloc (1, hdr.name_size + 1)) == NULL) {
+		return 1;
+	}
+
+	/* the engine */
+	trace_client (0);
+	clients[0].name = strdup ("jackd");
+
+	fprintf (out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	while (fread (&rec, sizeof(rec), 1, in) == 1) {
+
+		switch (rec.type) {
+		case JackTraceClientName:
+			if (fread (name, hdr.name_size, 1, in) != 1) {
+				break;
+			}
+			c = trace_client (rec.uuid);
+			free (clients[c].name);
+			clients[c].name = strdup (name);
+			break;
+
+		case JackTraceCycleStart:
+			cycle_at = read_at = rec.time;
+			break;
+
+		case JackTraceReadDone:
+			if (cycle_at) {
+				print_event (out, "driver read", 'X', 0, cycle_at,
+					     rec.time - cycle_at, rec.cycle);
+			}
+			read_at = rec.time;
+			break;
+
+		case JackTraceWriteDone:
+			if (read_at) {
+				print_event (out, "process", 'X', 0, read_at,
+					     rec.time - read_at, rec.cycle);
+			}
+			break;
+
+		case JackTraceClientTriggered:
+			c = trace_client (rec.uuid);
+			clients[c].triggered_at = rec.time;
+			break;
+
+		case JackTraceClientAwake:
+			c = trace_client (rec.uuid);
+			clients[c].awake_at = rec.time;
+			if (clients[c].triggered_at &&
+			    clients[c].triggered_at <= rec.time) {
+				print_event (out, "wakeup", 'X', c,
+					     clients[c].triggered_at,
+					     rec.time - clients[c].triggered_at,
+					     rec.cycle);
+			}
+			clients[c].triggered_at = 0;
+			break;
+
+		case JackTraceClientFinished:
+			c = trace_client (rec.uuid);
+			if (clients[c].awake_at &&
+			    clients[c].awake_at <= rec.time) {
+				print_event (out, rec.arg ? "process (failed)" :
+					     "process", 'X', c,
+					     clients[c].awake_at,
+					     rec.time - clients[c].awake_at,
+					     rec.cycle);
+			}
+			clients[c].awake_at = 0;
+			break;
+
+		case JackTraceXRun:
+			print_event (out, "xrun", 'i', 0, rec.time, 0, rec.cycle);
+			break;
+
+		case JackTraceDropped:
+			print_event (out, "trace records dropped", 'i', 0,
+				     rec.time, 0, rec.cycle);
+			break;
+
+		default:
+			fprintf (stderr, "unknown trace record type %u\n",
+				 rec.type);
+			break;
+		}
+	}
+
+	for (i = 0; i < nclients; i++) {
+		fprintf (out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+			 "\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+			 first_event ? "" : ",", i);
+		print_string (out, clients[i].name ? clients[i].name : "?");
+		fprintf (out, "}}");
+		first_event = 0;
+	}
+
+	fprintf (out, "\n]}\n");
+
+	fclose (in);
+	if (out != stdout) {
+		fclose (out);
+	}
+
+	return 0;
+}
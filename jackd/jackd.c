@@ -31,6 +31,12 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <dlfcn.h>
 
 #include <jack/midiport.h>
@@ -39,11 +45,13 @@
 
 #include "engine.h"
 #include "internal.h"
+#include "drivercache.h"
 #include "driver.h"
 #include "shm.h"
 #include "driver_parse.h"
 #include "messagebuffer.h"
 #include "clientengine.h"
+#include "calibrate.h"
 
 #ifdef USE_CAPABILITIES
 
@@ -72,6 +80,31 @@ static int do_unlock = 0;
 static jack_nframes_t frame_time_offset = 0;
 static int nozombies = 0;
 static int timeout_count_threshold = 0;
+static int parallel = 0;
+static unsigned int pipeline_stages = 0;
+static int activation_type = JackActivationFIFO;
+static char *trace_file = NULL;
+static jack_nframes_t freewheel_period = 0;
+static int freewheel_parallel = 0;
+static int hugepages = 0;
+static uint32_t load_window = 0;
+static char *engine_cpus = NULL;
+static char *client_cpus = NULL;
+static int deadline = 0;
+static int slave_threads = 0;
+static unsigned int internal_threads = 0;
+static jack_nframes_t max_buffer_size = 0;
+static int pm_qos = 0;
+static float dll_bandwidth = 0.0f;
+static int freewheel_keep_driver = 0;
+static char *metadata_file = NULL;
+static char *checkpoint_file = NULL;
+static unsigned int spin_usecs = 0;
+static int cpu_times = 0;
+static int share_buffers = 0;
+static unsigned int calibrate_seconds = 0;
+static int calibrate_apply = 0;
+static double calibrate_target = 1e-5;
 
 extern int sanitycheck(int, int);
 
@@ -92,6 +125,94 @@ do_nothing_handler (int sig)
 	write (1, buf, strlen (buf));
 }
 
+/* A client that starts the server hands it the write end of a pipe in
+ * $JACK_READY_FD and waits at the other (start_server() in
+ * libjack/client.c), so that it can connect once, as soon as it can,
+ * instead of polling the socket. Under a service manager,
+ * $NOTIFY_SOCKET names the socket to tell instead. Both hear
+ * "READY=1" once the driver runs and the internal clients are loaded;
+ * a server that exits before that closes the pipe, which says as
+ * much.
+ */
+static int ready_fd = -1;
+
+static void
+jack_take_ready_fd ()
+{
+	const char *str;
+	char *end;
+	long fd;
+
+	if ((str = getenv ("JACK_READY_FD")) == NULL) {
+		return;
+	}
+
+	fd = strtol (str, &end, 10);
+	if (end != str && *end == '\0' && fd > 2 && fd < INT_MAX
+	    && fcntl ((int)fd, F_GETFD) >= 0) {
+		ready_fd = (int)fd;
+		/* not for whatever the drivers and internal clients run */
+		fcntl (ready_fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	unsetenv ("JACK_READY_FD");
+}
+
+static void
+jack_notify_ready ()
+{
+	static const char msg[] = "READY=1";
+	sigset_t pending, pipe_set;
+	int sig;
+#ifdef __linux__
+	const char *path;
+	struct sockaddr_un addr;
+	socklen_t len;
+	int fd;
+#endif
+
+	if (ready_fd >= 0) {
+		if (write (ready_fd, msg, sizeof(msg) - 1) < 0) {
+			/* the client gave up on us. SIGPIPE is blocked
+			   in this thread, and left pending it would
+			   end the sigwait() below */
+			sigemptyset (&pipe_set);
+			sigaddset (&pipe_set, SIGPIPE);
+			if (errno == EPIPE && sigpending (&pending) == 0
+			    && sigismember (&pending, SIGPIPE)) {
+				sigwait (&pipe_set, &sig);
+			}
+		}
+		close (ready_fd);
+		ready_fd = -1;
+	}
+
+#ifdef __linux__
+	if ((path = getenv ("NOTIFY_SOCKET")) == NULL
+	    || (path[0] != '/' && path[0] != '@')
+	    || strlen (path) >= sizeof(addr.sun_path)) {
+		return;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+	if (path[0] == '@') {
+		addr.sun_path[0] = '\0';       /* abstract namespace */
+	}
+	len = offsetof (struct sockaddr_un, sun_path) + strlen (path);
+
+	if ((fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+		return;
+	}
+	if (sendto (fd, msg, sizeof(msg) - 1, MSG_NOSIGNAL,
+		    (struct sockaddr*)&addr, len) < 0) {
+		jack_error ("cannot notify %s (%s)", path, strerror (errno));
+	}
+	close (fd);
+#endif
+}
+
 static void
 jack_load_internal_clients (JSList* load_list)
 {
@@ -237,6 +358,102 @@ jack_load_internal_clients (JSList* load_list)
 	}
 }
 
+static jack_driver_param_desc_t *
+jack_driver_param_desc_by_name (jack_driver_desc_t *desc, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < desc->nparams; i++) {
+		if (strcmp (desc->params[i].name, name) == 0) {
+			return &desc->params[i];
+		}
+	}
+
+	return NULL;
+}
+
+static jack_driver_param_t *
+jack_driver_param_find (JSList *params, char character)
+{
+	JSList *node;
+
+	for (node = params; node; node = jack_slist_next (node)) {
+		if (((jack_driver_param_t*)node->data)->character == character) {
+			return (jack_driver_param_t*)node->data;
+		}
+	}
+
+	return NULL;
+}
+
+/* give the driver parameter `name' the value `value', unless it is
+   not an unsigned one or the command line already set it */
+static void
+jack_driver_param_default (jack_driver_desc_t *desc, JSList **params,
+			   const char *name, uint32_t value)
+{
+	jack_driver_param_desc_t *pd;
+	jack_driver_param_t *param;
+
+	if ((pd = jack_driver_param_desc_by_name (desc, name)) == NULL ||
+	    pd->type != JackDriverParamUInt) {
+		return;
+	}
+
+	if (jack_driver_param_find (*params, pd->character)) {
+		jack_info ("calibration: keeping the %s given", name);
+		return;
+	}
+
+	if ((param = (jack_driver_param_t*)calloc (1, sizeof(*param))) == NULL) {
+		return;
+	}
+	param->character = pd->character;
+	param->value.ui = value;
+	*params = jack_slist_append (*params, param);
+
+	jack_info ("calibration: using %s %u", name, value);
+}
+
+/* --calibrate: measure wakeup latency and the cost of a client on the
+   way the engine will run, report what that allows, and with
+   --calibrate-apply set the driver's period and nperiods from it */
+static int
+jack_main_calibrate (jack_driver_desc_t *desc, JSList **params)
+{
+	jack_calibration_t cal;
+	jack_driver_param_desc_t *pd;
+	jack_driver_param_t *param;
+	jack_nframes_t rate = 48000, period;
+	unsigned int nperiods;
+
+	if ((pd = jack_driver_param_desc_by_name (desc, "rate")) != NULL &&
+	    pd->type == JackDriverParamUInt) {
+		param = jack_driver_param_find (*params, pd->character);
+		rate = param ? param->value.ui : pd->value.ui;
+	}
+
+	jack_info ("calibrating for %u seconds ...", calibrate_seconds);
+
+	if (jack_calibrate (&cal, calibrate_seconds, realtime, realtime_priority,
+			    activation_type, engine_cpus, client_cpus)) {
+		return -1;
+	}
+
+	jack_calibration_report (&cal, rate, calibrate_target, stdout);
+
+	if (calibrate_apply &&
+	    jack_calibration_recommend (&cal, rate, calibrate_target, 1,
+					&period, &nperiods) == 0) {
+		jack_driver_param_default (desc, params, "period", period);
+		jack_driver_param_default (desc, params, "nperiods", nperiods);
+	}
+
+	jack_calibration_free (&cal);
+
+	return 0;
+}
+
 static int
 jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * slave_names, JSList * load_list)
 {
@@ -306,7 +523,16 @@ jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * sl
 				       do_mlock, do_unlock, server_name,
 				       temporary, verbose, client_timeout,
 				       port_max, getpid (), frame_time_offset,
-				       nozombies, timeout_count_threshold, drivers)) == 0) {
+				       nozombies, timeout_count_threshold, parallel,
+				       pipeline_stages, activation_type, trace_file,
+				       freewheel_period, freewheel_parallel,
+				       hugepages, load_window, engine_cpus,
+				       client_cpus, deadline, slave_threads,
+				       max_buffer_size, pm_qos, dll_bandwidth,
+				       internal_threads, freewheel_keep_driver,
+				       metadata_file, share_buffers,
+				       checkpoint_file, spin_usecs,
+				       cpu_times, drivers)) == 0) {
 		jack_error ("cannot create engine");
 		return -1;
 	}
@@ -335,6 +561,8 @@ jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * sl
 
 	jack_load_internal_clients (load_list);
 
+	jack_notify_ready ();
+
 	/* install a do-nothing handler because otherwise pthreads
 	   behaviour is undefined when we enter sigwait.
 	 */
@@ -465,7 +693,6 @@ jack_drivers_load ()
 {
 	struct dirent * dir_entry;
 	DIR * dir_stream;
-	const char * ptr;
 	int err;
 	JSList * driver_list = NULL;
 	jack_driver_desc_t * desc;
@@ -475,6 +702,11 @@ jack_drivers_load ()
 		driver_dir = ADDON_DIR;
 	}
 
+	/* the cached descriptors, unless a driver changed since */
+	if ((driver_list = jack_driver_cache_load (driver_dir)) != NULL) {
+		return driver_list;
+	}
+
 	/* search through the driver_dir and add get descriptors
 	   from the .so files in it */
 	dir_stream = opendir (driver_dir);
@@ -486,16 +718,7 @@ jack_drivers_load ()
 
 	while ( (dir_entry = readdir (dir_stream)) ) {
 		/* check the filename is of the right format */
-		if (strncmp ("jack_", dir_entry->d_name, 5) != 0) {
-			continue;
-		}
-
-		ptr = strrchr (dir_entry->d_name, '.');
-		if (!ptr) {
-			continue;
-		}
-		ptr++;
-		if (strncmp ("so", ptr, 2) != 0) {
+		if (!jack_driver_file_name (dir_entry->d_name)) {
 			continue;
 		}
 
@@ -516,6 +739,8 @@ jack_drivers_load ()
 		return NULL;
 	}
 
+	jack_driver_cache_save (driver_dir, driver_list);
+
 	return driver_list;
 }
 
@@ -676,9 +901,9 @@ main (int argc, char *argv[])
 	int show_version = 0;
 
 #ifdef HAVE_ZITA_BRIDGE_DEPS
-	const char *options = "A:d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:";
+	const char *options = "A:a:d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:";
 #else
-	const char *options = "d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:";
+	const char *options = "a:d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:";
 #endif
 	struct option long_options[] =
 	{
@@ -687,21 +912,45 @@ main (int argc, char *argv[])
 #ifdef HAVE_ZITA_BRIDGE_DEPS
 		{ "alsa-add",	       1, 0,		     'A' },
 #endif
+		{ "activation",        1, 0,		     'a' },
 		{ "clock-source",      1, 0,		     'c' },
+		{ "checkpoint-file",   1, 0,		     'Y' },
+		{ "client-cpus",       1, 0,		     'j' },
+		{ "cpu-times",	       0, &cpu_times,	     1	 },
+		{ "deadline",	       0, &deadline,	     1	 },
+		{ "dll-bandwidth",     1, 0,		     'B' },
 		{ "driver",	       1, 0,		     'd' },
+		{ "engine-cpus",       1, 0,		     'e' },
+		{ "freewheel-period",  1, 0,		     'w' },
+		{ "freewheel-parallel", 0, &freewheel_parallel, 1 },
+		{ "freewheel-keep-driver", 0, &freewheel_keep_driver, 1 },
+		{ "calibrate",	       2, 0,		     'g' },
+		{ "calibrate-apply",   2, 0,		     'G' },
 		{ "help",	       0, 0,		     'h' },
+		{ "hugepages",	       0, &hugepages,	     1	 },
 		{ "tmpdir-location",   0, 0,		     'l' },
+		{ "load-window",       1, 0,		     'L' },
 		{ "internal-client",   0, 0,		     'I' },
+		{ "internal-threads",  1, 0,		     'W' },
+		{ "calibrate-target",  1, 0,		     'K' },
 		{ "no-mlock",	       0, 0,		     'm' },
+		{ "max-buffer-size",   1, 0,		     'b' },
 		{ "midi-bufsize",      1, 0,		     'M' },
+		{ "metadata-file",     1, 0,		     'D' },
 		{ "name",	       1, 0,		     'n' },
 		{ "no-sanity-checks",  0, 0,		     'N' },
+		{ "parallel",	       0, &parallel,	     1	 },
+		{ "pipeline",	       1, 0,		     'k' },
+		{ "pm-qos",	       0, &pm_qos,	     1	 },
 		{ "port-max",	       1, 0,		     'p' },
 		{ "realtime-priority", 1, 0,		     'P' },
 		{ "no-realtime",       0, 0,		     'r' },
 		{ "realtime",	       0, 0,		     'R' },
 		{ "replace-registry",  0, &replace_registry, 0	 },
+		{ "share-buffers",     0, &share_buffers,    1	 },
 		{ "silent",	       0, 0,		     's' },
+		{ "slave-threads",     0, &slave_threads,    1	 },
+		{ "spin-wait",	       1, 0,		     'Q' },
 		{ "sync",	       0, 0,		     'S' },
 		{ "timeout",	       1, 0,		     't' },
 		{ "temporary",	       0, 0,		     'T' },
@@ -711,6 +960,7 @@ main (int argc, char *argv[])
 		{ "slave-driver",      1, 0,		     'X' },
 		{ "nozombies",	       0, 0,		     'Z' },
 		{ "timeout-thres",     2, 0,		     'C' },
+		{ "trace",	       1, 0,		     'y' },
 		{ 0,		       0, 0,		     0	 }
 	};
 	int opt = 0;
@@ -733,6 +983,8 @@ main (int argc, char *argv[])
 #endif
 	setvbuf (stdout, NULL, _IOLBF, 0);
 
+	jack_take_ready_fd ();
+
 	maybe_use_capabilities ();
 
 	opterr = 0;
@@ -775,16 +1027,26 @@ main (int argc, char *argv[])
 			break;
 #endif
 
+		case 'a':
+			if (strcmp (optarg, "futex") == 0) {
+				activation_type = JackActivationFutex;
+			} else if (strcmp (optarg, "fifo") == 0) {
+				activation_type = JackActivationFIFO;
+			} else {
+				usage (stderr);
+				return -1;
+			}
+			break;
+
 		case 'c':
 			if (tolower (optarg[0]) == 'h') {
 				clock_source = JACK_TIMER_HPET;
-			} else if (tolower (optarg[0]) == 'c') {
-				/* For backwards compatibility with scripts,
-				 * allow the user to request the cycle clock
-				 * on the command line, but use the system
-				 * clock instead
+			} else if (tolower (optarg[0]) == 't' ||
+				   tolower (optarg[0]) == 'c') {
+				/* "c(ycle)" is the old name for the cycle
+				 * counter, kept for scripts.
 				 */
-				clock_source = JACK_TIMER_SYSTEM_CLOCK;
+				clock_source = JACK_TIMER_TSC;
 			} else if (tolower (optarg[0]) == 's') {
 				clock_source = JACK_TIMER_SYSTEM_CLOCK;
 			} else {
@@ -888,6 +1150,107 @@ main (int argc, char *argv[])
 			nozombies = 1;
 			break;
 
+		case 'y':
+			/* --trace, no short form */
+			trace_file = optarg;
+			break;
+
+		case 'D':
+			/* --metadata-file, no short form */
+			metadata_file = optarg;
+			break;
+
+		case 'Y':
+			/* --checkpoint-file, no short form */
+			checkpoint_file = optarg;
+			break;
+
+		case 'w':
+			/* --freewheel-period, no short form */
+			freewheel_period = (jack_nframes_t)atol (optarg);
+			if (freewheel_period & (freewheel_period - 1)) {
+				fprintf (stderr, "the freewheel period must "
+					 "be a power of two\n");
+				return -1;
+			}
+			break;
+
+		case 'W':
+			/* --internal-threads, no short form */
+			internal_threads = (unsigned int)atol (optarg);
+			break;
+
+		case 'k':
+			/* --pipeline, no short form */
+			pipeline_stages = (unsigned int)atol (optarg);
+			break;
+
+		case 'L':
+			/* --load-window, no short form */
+			load_window = (uint32_t)atol (optarg);
+			break;
+
+		case 'Q':
+			/* --spin-wait, no short form */
+			spin_usecs = (unsigned int)atol (optarg);
+			break;
+
+		case 'b':
+			/* --max-buffer-size, no short form */
+			max_buffer_size = (jack_nframes_t)atol (optarg);
+			if (max_buffer_size & (max_buffer_size - 1)) {
+				fprintf (stderr, "the maximum buffer size must "
+					 "be a power of two\n");
+				return -1;
+			}
+			break;
+
+		case 'B':
+			/* --dll-bandwidth, no short form */
+			dll_bandwidth = (float)atof (optarg);
+			if (dll_bandwidth <= 0.0f || dll_bandwidth > 10.0f) {
+				fprintf (stderr, "the DLL bandwidth must be "
+					 "above 0 and at most 10 Hz\n");
+				return -1;
+			}
+			break;
+
+		case 'e':
+			/* --engine-cpus, no short form */
+			engine_cpus = optarg;
+			break;
+
+		case 'j':
+			/* --client-cpus, no short form */
+			client_cpus = optarg;
+			break;
+
+		case 'g':
+		case 'G':
+			/* --calibrate[=SECS], --calibrate-apply[=SECS] */
+			calibrate_seconds = optarg ? (unsigned int)atol (optarg) : 10;
+			calibrate_apply = (opt == 'G');
+			if (calibrate_seconds == 0) {
+				fprintf (stderr, "the calibration needs to run "
+					 "for at least a second\n");
+				return -1;
+			}
+			break;
+
+		case 'K':
+			/* --calibrate-target, no short form */
+			calibrate_target = atof (optarg);
+			if (calibrate_target <= 0.0 || calibrate_target >= 1.0) {
+				fprintf (stderr, "the calibration target is a "
+					 "share of cycles, above 0 and below 1\n");
+				return -1;
+			}
+			break;
+
+		case 0:
+			/* long option that just sets a flag */
+			break;
+
 		default:
 			jack_error ("Unknown option character %c",
 				    optopt);
@@ -983,6 +1346,15 @@ main (int argc, char *argv[])
 		exit (0);
 	}
 
+	if (calibrate_seconds) {
+		if (jack_main_calibrate (desc, &driver_params)) {
+			exit (1);
+		}
+		if (!calibrate_apply) {
+			exit (0);
+		}
+	}
+
 	if (server_name == NULL) {
 		server_name = jack_default_server_name ();
 	}
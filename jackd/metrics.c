@@ -0,0 +1,495 @@
+/*
+    metrics -- internal client serving server statistics over HTTP
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Load it into jackd with
+ *
+ *    jackd -I metrics:metrics/[address:]port ...
+ *    jack_load metrics metrics -i [address:]port
+ *
+ * and it answers GET /metrics with the engine, driver and per-client
+ * statistics in OpenMetrics text format. Everything comes straight
+ * from the engine segment (the same counters and seqlocked histograms
+ * jack_cpu_load() and jack_get_client_timing() read), and the client
+ * never activates, so it takes no graph slot and the process cycle
+ * does not know it is there.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <jack/jack.h>
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "libjack/local.h"
+
+#define METRICS_ADDRESS "127.0.0.1"
+#define METRICS_PORT    "9197"
+
+typedef struct {
+	jack_client_t *client;
+	jack_native_thread_t thread;
+	int listen_fd;
+	int stop_fds[2];
+	char *out;
+	size_t len;
+	size_t size;
+} metrics_t;
+
+static void
+metrics_printf (metrics_t *m, const char *fmt, ...)
+{
+	va_list ap;
+	char *out;
+	int n;
+
+	if (m->out == NULL) {
+		return;
+	}
+
+	for (;; ) {
+		va_start (ap, fmt);
+		n = vsnprintf (m->out + m->len, m->size - m->len, fmt, ap);
+		va_end (ap);
+
+		if (n < 0) {
+			return;
+		}
+		if (m->len + n < m->size) {
+			m->len += n;
+			return;
+		}
+		if ((out = (char*)realloc (m->out, m->size * 2)) == NULL) {
+			free (m->out);
+			m->out = NULL;
+			m->len = 0;
+			return;
+		}
+		m->out = out;
+		m->size *= 2;
+	}
+}
+
+static void
+metrics_family (metrics_t *m, const char *name, const char *type,
+		const char *help)
+{
+	metrics_printf (m, "# TYPE %s %s\n# HELP %s %s\n",
+			name, type, name, help);
+}
+
+/* label values are client and counter names, which may hold anything */
+static void
+metrics_label (metrics_t *m, const char *value)
+{
+	for (; *value; value++) {
+		switch (*value) {
+		case '\\':
+			metrics_printf (m, "\\\\");
+			break;
+		case '"':
+			metrics_printf (m, "\\\"");
+			break;
+		case '\n':
+			metrics_printf (m, "\\n");
+			break;
+		default:
+			metrics_printf (m, "%c", *value);
+			break;
+		}
+	}
+}
+
+static void
+metrics_render (metrics_t *m)
+{
+	jack_control_t *control = m->client->engine;
+	jack_timing_summary_t sum[JACK_TIMING_MAX];
+	static const float percentiles[] = { 50.0f, 90.0f, 99.0f, 100.0f };
+	uint32_t n_counters, i;
+	int nclients = 0, slot, p;
+
+	if (m->out == NULL) {
+		/* ran out of memory last time */
+		if ((m->out = (char*)malloc (m->size)) == NULL) {
+			return;
+		}
+	}
+	m->len = 0;
+
+	metrics_family (m, "jack_cycles", "counter",
+			"Completed process cycles.");
+	metrics_printf (m, "jack_cycles_total %" PRIu64 "\n",
+			(uint64_t)control->cycles);
+
+	metrics_family (m, "jack_xruns", "counter",
+			"Cycles that started late.");
+	metrics_printf (m, "jack_xruns_total %u\n", control->xruns);
+
+	metrics_family (m, "jack_xrun_delayed_usecs", "gauge",
+			"Delay of the last xrun, microseconds.");
+	metrics_printf (m, "jack_xrun_delayed_usecs %f\n",
+			control->xrun_delayed_usecs);
+
+	metrics_family (m, "jack_max_delayed_usecs", "gauge",
+			"Largest xrun delay so far, microseconds.");
+	metrics_printf (m, "jack_max_delayed_usecs %f\n",
+			control->max_delayed_usecs);
+
+	metrics_family (m, "jack_xrun_recovery_usecs", "gauge",
+			"Time the driver took to recover from the last xrun, microseconds.");
+	metrics_printf (m, "jack_xrun_recovery_usecs %u\n",
+			control->driver_recovery_usecs);
+
+	metrics_family (m, "jack_cpu_load", "gauge",
+			"Smoothed DSP load, percent.");
+	metrics_printf (m, "jack_cpu_load %f\n", control->cpu_load);
+
+	metrics_family (m, "jack_dsp_load", "gauge",
+			"DSP load over the load window at a percentile, percent.");
+	for (p = 0; p < (int)(sizeof(percentiles) / sizeof(percentiles[0])); p++) {
+		metrics_printf (m, "jack_dsp_load{percentile=\"%g\"} %f\n",
+				percentiles[p],
+				jack_load_percentile (control, percentiles[p]));
+	}
+
+	metrics_family (m, "jack_driver_wait_usecs", "gauge",
+			"End of the last cycle to the next driver wakeup, microseconds.");
+	metrics_printf (m, "jack_driver_wait_usecs %u\n",
+			control->driver_wait_usecs);
+
+	metrics_family (m, "jack_driver_process_usecs", "gauge",
+			"Master driver read and write in the last cycle, microseconds.");
+	metrics_printf (m, "jack_driver_process_usecs %u\n",
+			control->driver_process_usecs);
+
+	metrics_family (m, "jack_buffer_size", "gauge", "Frames per period.");
+	metrics_printf (m, "jack_buffer_size %u\n",
+			jack_get_buffer_size (m->client));
+
+	metrics_family (m, "jack_sample_rate", "gauge", "Frames per second.");
+	metrics_printf (m, "jack_sample_rate %u\n",
+			jack_get_sample_rate (m->client));
+
+	/* counters published by the drivers */
+	n_counters = control->n_counters;
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+	if (n_counters) {
+		metrics_family (m, "jack_driver", "counter",
+				"Counters kept by the drivers.");
+	}
+	for (i = 0; i < n_counters && i < JACK_COUNTERS_MAX; i++) {
+		metrics_printf (m, "jack_driver_total{counter=\"");
+		metrics_label (m, control->counters[i].name);
+		metrics_printf (m, "\"} %" PRIu64 "\n",
+				(uint64_t)control->counters[i].value);
+	}
+
+	/* per client, over the timing window */
+	for (slot = 0; slot < JACK_TIMING_MAX; slot++) {
+		if (jack_timing_summarize (control, slot, 99.0f,
+					   &sum[nclients]) == 0) {
+			nclients++;
+		}
+	}
+
+#define CLIENT_METRIC(name, type, help, fmt, expr)			\
+	metrics_family (m, name, type, help);				\
+	for (slot = 0; slot < nclients; slot++) {			\
+		metrics_printf (m, name "{client=\"");			\
+		metrics_label (m, sum[slot].name);			\
+		metrics_printf (m, "\"} " fmt "\n", expr);		\
+	}
+
+	if (nclients) {
+		CLIENT_METRIC ("jack_client_window_cycles", "gauge",
+			       "Cycles in the client timing window.",
+			       "%u", sum[slot].cycles);
+		CLIENT_METRIC ("jack_client_wake_p99_usecs", "gauge",
+			       "99th percentile wake latency, microseconds.",
+			       "%" PRIu64, (uint64_t)sum[slot].wake_usecs);
+		CLIENT_METRIC ("jack_client_wake_max_usecs", "gauge",
+			       "Largest wake latency, microseconds.",
+			       "%" PRIu64, (uint64_t)sum[slot].wake_max);
+		CLIENT_METRIC ("jack_client_process_p99_usecs", "gauge",
+			       "99th percentile process() time, microseconds.",
+			       "%" PRIu64, (uint64_t)sum[slot].process_usecs);
+		CLIENT_METRIC ("jack_client_process_max_usecs", "gauge",
+			       "Longest process() time, microseconds.",
+			       "%" PRIu64, (uint64_t)sum[slot].process_max);
+		CLIENT_METRIC ("jack_client_load", "gauge",
+			       "Mean share of the period spent in process(), percent.",
+			       "%f", sum[slot].load);
+		CLIENT_METRIC ("jack_client_cpu_load", "gauge",
+			       "Mean share of the period process() ran on a cpu, percent.",
+			       "%f", sum[slot].cpu_load);
+		CLIENT_METRIC ("jack_client_preempted", "gauge",
+			       "Share of cycles process() was switched out in, percent.",
+			       "%f", sum[slot].preempted);
+	}
+
+#undef CLIENT_METRIC
+
+	metrics_printf (m, "# EOF\n");
+}
+
+static void
+metrics_write (int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		if ((n = write (fd, buf, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+static void
+metrics_serve (metrics_t *m, int fd)
+{
+	char request[1024];
+	char header[256];
+	struct timeval tv = { 1, 0 };
+	ssize_t n;
+	int hlen;
+
+	/* a scraper sends its request at once; nobody gets to hold the
+	   thread for longer than a second */
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if ((n = read (fd, request, sizeof(request) - 1)) <= 0) {
+		return;
+	}
+	request[n] = '\0';
+
+	if (strncmp (request, "GET ", 4) != 0) {
+		hlen = snprintf (header, sizeof(header),
+				 "HTTP/1.0 405 Method Not Allowed\r\n"
+				 "Allow: GET\r\nContent-Length: 0\r\n\r\n");
+		metrics_write (fd, header, hlen);
+		return;
+	}
+
+	if (strncmp (request + 4, "/metrics", 8) != 0 ||
+	    (request[12] != ' ' && request[12] != '?')) {
+		hlen = snprintf (header, sizeof(header),
+				 "HTTP/1.0 404 Not Found\r\n"
+				 "Content-Length: 0\r\n\r\n");
+		metrics_write (fd, header, hlen);
+		return;
+	}
+
+	metrics_render (m);
+
+	if (m->out == NULL) {
+		return;
+	}
+
+	hlen = snprintf (header, sizeof(header),
+			 "HTTP/1.0 200 OK\r\n"
+			 "Content-Type: application/openmetrics-text; "
+			 "version=1.0.0; charset=utf-8\r\n"
+			 "Content-Length: %zu\r\n\r\n", m->len);
+	metrics_write (fd, header, hlen);
+	metrics_write (fd, m->out, m->len);
+}
+
+static void *
+metrics_thread (void *arg)
+{
+	metrics_t *m = (metrics_t*)arg;
+	struct pollfd pfd[2];
+	int fd;
+
+	pfd[0].fd = m->listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = m->stop_fds[0];
+	pfd[1].events = POLLIN;
+
+	for (;; ) {
+		if (poll (pfd, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (pfd[1].revents) {
+			break;
+		}
+
+		if ((fd = accept (m->listen_fd, NULL, NULL)) < 0) {
+			continue;
+		}
+
+		metrics_serve (m, fd);
+		close (fd);
+	}
+
+	return NULL;
+}
+
+static int
+metrics_listen (const char *spec)
+{
+	char buf[256];
+	const char *address = METRICS_ADDRESS;
+	const char *port = METRICS_PORT;
+	struct addrinfo hints, *res, *ai;
+	char *colon;
+	int fd = -1, on = 1, err;
+
+	if (spec && *spec) {
+		snprintf (buf, sizeof(buf), "%s", spec);
+		if ((colon = strrchr (buf, ':')) != NULL) {
+			*colon = '\0';
+			address = buf;
+			port = colon + 1;
+		} else {
+			port = buf;
+		}
+	}
+
+	memset (&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if ((err = getaddrinfo (*address ? address : NULL, port,
+				&hints, &res)) != 0) {
+		jack_error ("metrics: cannot resolve %s:%s (%s)", address, port,
+			    gai_strerror (err));
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((fd = socket (ai->ai_family, ai->ai_socktype,
+				  ai->ai_protocol)) < 0) {
+			continue;
+		}
+		setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind (fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen (fd, 8) == 0) {
+			break;
+		}
+		close (fd);
+		fd = -1;
+	}
+
+	freeaddrinfo (res);
+
+	if (fd < 0) {
+		jack_error ("metrics: cannot listen on %s:%s (%s)", address, port,
+			    strerror (errno));
+		return -1;
+	}
+
+	jack_info ("metrics: serving on %s:%s", address, port);
+
+	return fd;
+}
+
+int
+jack_initialize (jack_client_t *client, const char *load_init)
+{
+	metrics_t *m;
+
+	if ((m = (metrics_t*)calloc (1, sizeof(metrics_t))) == NULL) {
+		return -1;
+	}
+
+	m->client = client;
+	m->size = 16384;
+
+	if ((m->out = (char*)malloc (m->size)) == NULL) {
+		free (m);
+		return -1;
+	}
+
+	if ((m->listen_fd = metrics_listen (load_init)) < 0) {
+		free (m->out);
+		free (m);
+		return -1;
+	}
+
+	if (pipe (m->stop_fds)) {
+		close (m->listen_fd);
+		free (m->out);
+		free (m);
+		return -1;
+	}
+
+	/* not realtime: it only ever reads */
+	if (jack_client_create_thread (client, &m->thread, 0, 0,
+				       metrics_thread, m)) {
+		jack_error ("metrics: cannot start the server thread");
+		close (m->stop_fds[0]);
+		close (m->stop_fds[1]);
+		close (m->listen_fd);
+		free (m->out);
+		free (m);
+		return -1;
+	}
+
+	/* jack_finish() gets the process argument; setting it directly
+	   rather than through jack_set_process_callback() keeps the
+	   client out of the graph */
+	client->process_arg = m;
+
+	return 0;
+}
+
+void
+jack_finish (void *arg)
+{
+	metrics_t *m = (metrics_t*)arg;
+	char c = 0;
+
+	if (m == NULL) {
+		return;
+	}
+
+	if (write (m->stop_fds[1], &c, 1) == 1) {
+		pthread_join (m->thread, NULL);
+	}
+
+	close (m->stop_fds[0]);
+	close (m->stop_fds[1]);
+	close (m->listen_fd);
+	free (m->out);
+	free (m);
+}
@@ -0,0 +1,461 @@
+/*
+    mixer -- internal client summing its inputs into buses
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Load it into jackd with
+ *
+ *    jackd -I monitor:mixer/inputs=64,outputs=2,matrix=all ...
+ *    jack_load monitor mixer -i inputs=64,outputs=2,gain=3:1:0.5,...
+ *
+ * and it has `inputs' input ports in_1 ... and `outputs' output ports
+ * out_1 ..., every output the sum of the inputs, each at the gain of
+ * its cell in the matrix. The init string is a comma separated list of
+ *
+ *    inputs=N        input ports (8)
+ *    outputs=N       output ports, the buses (2)
+ *    matrix=M        the gains to start from: "diagonal" has in_i at
+ *                    unity on out_(i mod outputs), "all" every input on
+ *                    every bus, "none" nothing (diagonal)
+ *    gain=I:O:G      linear gain G for in_I on out_O, after `matrix'
+ *
+ * While it runs, a cell is changed by setting the property
+ * MIXER_GAIN_KEY "I:O" of the client to the gain, for example with
+ *
+ *    jack_property -c monitor urn:jack1:mixer:gain:3:1 0.5
+ *
+ * and deleting the property puts the cell back to its loaded value.
+ * Gains move to their new value over one period, so changing them does
+ * not click.
+ *
+ * It runs inside the server, so the graph has no extra hop and no
+ * wakeup for it: an input connected to one port reads that port's
+ * buffer, and the matrix is summed with the engine's SIMD kernels. With
+ * --internal-threads it runs on an engine worker alongside the other
+ * clients of its stage rather than on the engine thread.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jack/jack.h>
+#include <jack/metadata.h>
+#include <jack/uuid.h>
+
+#include "internal.h"
+#include "intsimd.h"
+#include "libjack/local.h"
+
+#define MIXER_GAIN_KEY  "urn:jack1:mixer:gain:"
+#define MIXER_INPUTS    8
+#define MIXER_OUTPUTS   2
+#define MIXER_MAX_PORTS 1024
+
+/* inputs summed per pass over a bus */
+#define MIXER_PASS      8
+
+typedef enum {
+	MixerDiagonal,
+	MixerAll,
+	MixerNone
+} mixer_matrix_t;
+
+typedef struct {
+	volatile float target;          /* w: property callback */
+	float gain;                     /* where the last cycle ended */
+	float loaded;                   /* from the init string */
+} mixer_cell_t;
+
+typedef struct {
+	jack_client_t *client;
+	int ninputs;
+	int noutputs;
+	mixer_matrix_t matrix;
+	jack_port_t **inputs;
+	jack_port_t **outputs;
+	const float **in;               /* process(): this cycle's inputs */
+	mixer_cell_t *cells;            /* noutputs rows of ninputs */
+} mixer_t;
+
+static inline mixer_cell_t *
+mixer_cell (mixer_t *m, int in, int out)
+{
+	return &m->cells[out * m->ninputs + in];
+}
+
+#ifndef USE_DYNSIMD
+static void
+mixer_mixgainf (float *dest, const float **src, const float *gain,
+		const float *step, int nsrc, int length)
+{
+	int i, s;
+	float f;
+
+	for (i = 0; i < length; i++) {
+		f = src[0][i] * (gain[0] + step[0] * i);
+		for (s = 1; s < nsrc; s++)
+			f += src[s][i] * (gain[s] + step[s] * i);
+		dest[i] = f;
+	}
+}
+#endif  /* !USE_DYNSIMD */
+
+static inline void
+mixer_pass (float *dest, const float **src, const float *gain,
+	    const float *step, int nsrc, jack_nframes_t nframes)
+{
+#ifndef USE_DYNSIMD
+	mixer_mixgainf (dest, src, gain, step, nsrc, nframes);
+#else   /* USE_DYNSIMD */
+	jack_simd.mixgainf (dest, src, gain, step, nsrc, nframes);
+#endif /* USE_DYNSIMD */
+}
+
+static int
+mixer_process (jack_nframes_t nframes, void *arg)
+{
+	mixer_t *m = (mixer_t*)arg;
+	const float *src[MIXER_PASS];
+	float gain[MIXER_PASS];
+	float step[MIXER_PASS];
+	mixer_cell_t *cell;
+	float *out;
+	float from, to;
+	int i, o, nsrc;
+
+	/* inputs with nothing on them this cycle are left out */
+	for (i = 0; i < m->ninputs; i++) {
+		if (jack_port_buffer_is_silent (m->inputs[i], nframes)) {
+			m->in[i] = NULL;
+		} else {
+			m->in[i] = (const float*)
+				   jack_port_get_buffer (m->inputs[i], nframes);
+		}
+	}
+
+	for (o = 0; o < m->noutputs; o++) {
+		out = (float*)jack_port_get_buffer (m->outputs[o], nframes);
+		nsrc = 0;
+
+		for (i = 0; i < m->ninputs; i++) {
+			cell = mixer_cell (m, i, o);
+			from = cell->gain;
+			to = cell->target;
+			cell->gain = to;
+
+			if (m->in[i] == NULL || (from == 0.0f && to == 0.0f)) {
+				continue;
+			}
+			if (nsrc == MIXER_PASS) {
+				mixer_pass (out, src, gain, step, nsrc, nframes);
+				src[0] = out;
+				gain[0] = 1.0f;
+				step[0] = 0.0f;
+				nsrc = 1;
+			}
+			src[nsrc] = m->in[i];
+			gain[nsrc] = from;
+			step[nsrc] = (to - from) / nframes;
+			nsrc++;
+		}
+
+		if (nsrc == 0) {
+			jack_port_set_silent (m->outputs[o]);
+		} else {
+			mixer_pass (out, src, gain, step, nsrc, nframes);
+		}
+	}
+
+	return 0;
+}
+
+/* "I:O" (from 1) to a cell, or NULL */
+static mixer_cell_t *
+mixer_parse_cell (mixer_t *m, const char *spec, const char **rest)
+{
+	char *end;
+	long in, out;
+
+	in = strtol (spec, &end, 10);
+	if (*end != ':') {
+		return NULL;
+	}
+	out = strtol (end + 1, &end, 10);
+	if (in < 1 || in > m->ninputs || out < 1 || out > m->noutputs) {
+		return NULL;
+	}
+	if (rest) {
+		*rest = end;
+	}
+	return mixer_cell (m, in - 1, out - 1);
+}
+
+static void
+mixer_property_changed (jack_uuid_t subject, const char *key,
+			jack_property_change_t change, void *arg)
+{
+	mixer_t *m = (mixer_t*)arg;
+	mixer_cell_t *cell;
+	const char *rest;
+	char *value = NULL, *type = NULL, *end;
+	float gain;
+	int i;
+
+	if (jack_uuid_compare (subject, m->client->control->uuid) != 0) {
+		return;
+	}
+
+	if (key == NULL) {
+		/* all of them deleted */
+		for (i = 0; i < m->ninputs * m->noutputs; i++) {
+			m->cells[i].target = m->cells[i].loaded;
+		}
+		return;
+	}
+
+	if (strncmp (key, MIXER_GAIN_KEY, strlen (MIXER_GAIN_KEY)) != 0) {
+		return;
+	}
+	if ((cell = mixer_parse_cell (m, key + strlen (MIXER_GAIN_KEY),
+				      &rest)) == NULL || *rest != '\0') {
+		jack_error ("mixer: no cell %s", key);
+		return;
+	}
+
+	if (change == PropertyDeleted) {
+		cell->target = cell->loaded;
+		return;
+	}
+
+	if (jack_get_property (subject, key, &value, &type)) {
+		return;
+	}
+	gain = strtof (value, &end);
+	if (end == value || !(gain >= 0.0f && gain <= JACK_CONNECTION_GAIN_MAX)) {
+		jack_error ("mixer: bad gain \"%s\" for %s", value, key);
+	} else {
+		cell->target = gain;
+	}
+	jack_free (value);
+	jack_free (type);
+}
+
+static int
+mixer_parse (mixer_t *m, const char *load_init, int gains)
+{
+	char *args, *opt, *save = NULL, *value, *end;
+	const char *rest;
+	mixer_cell_t *cell;
+	float gain;
+	int ret = 0;
+
+	if (load_init == NULL || *load_init == '\0') {
+		return 0;
+	}
+
+	if ((args = strdup (load_init)) == NULL) {
+		return -1;
+	}
+
+	/* two rounds: the sizes first, then the gains once the matrix
+	   they go in exists */
+	for (opt = strtok_r (args, ",", &save); opt && ret == 0;
+	     opt = strtok_r (NULL, ",", &save)) {
+
+		if ((value = strchr (opt, '=')) == NULL) {
+			jack_error ("mixer: \"%s\" is not key=value", opt);
+			ret = -1;
+			break;
+		}
+		*value++ = '\0';
+
+		if (strcmp (opt, "gain") == 0) {
+			if (!gains) {
+				continue;
+			}
+			if ((cell = mixer_parse_cell (m, value, &rest)) == NULL ||
+			    *rest != ':') {
+				jack_error ("mixer: no cell %s", value);
+				ret = -1;
+				break;
+			}
+			gain = strtof (rest + 1, &end);
+			if (end == rest + 1 || *end != '\0' ||
+			    !(gain >= 0.0f && gain <= JACK_CONNECTION_GAIN_MAX)) {
+				jack_error ("mixer: bad gain %s", value);
+				ret = -1;
+				break;
+			}
+			cell->loaded = gain;
+		} else if (gains) {
+			continue;
+		} else if (strcmp (opt, "inputs") == 0) {
+			m->ninputs = atoi (value);
+		} else if (strcmp (opt, "outputs") == 0) {
+			m->noutputs = atoi (value);
+		} else if (strcmp (opt, "matrix") == 0) {
+			if (strcmp (value, "diagonal") == 0) {
+				m->matrix = MixerDiagonal;
+			} else if (strcmp (value, "all") == 0) {
+				m->matrix = MixerAll;
+			} else if (strcmp (value, "none") == 0) {
+				m->matrix = MixerNone;
+			} else {
+				jack_error ("mixer: unknown matrix \"%s\"",
+					    value);
+				ret = -1;
+			}
+		} else {
+			jack_error ("mixer: unknown option \"%s\"", opt);
+			ret = -1;
+		}
+	}
+
+	free (args);
+
+	return ret;
+}
+
+static void
+mixer_free (mixer_t *m)
+{
+	free (m->inputs);
+	free (m->outputs);
+	free (m->in);
+	free (m->cells);
+	free (m);
+}
+
+static int
+mixer_setup (mixer_t *m)
+{
+	char name[32];
+	mixer_cell_t *cell;
+	int i, o;
+
+	if (m->ninputs < 1 || m->ninputs > MIXER_MAX_PORTS ||
+	    m->noutputs < 1 || m->noutputs > MIXER_MAX_PORTS) {
+		jack_error ("mixer: from 1 to %d inputs and outputs",
+			    MIXER_MAX_PORTS);
+		return -1;
+	}
+
+	if ((m->inputs = (jack_port_t**)calloc (m->ninputs,
+						sizeof(jack_port_t*))) == NULL ||
+	    (m->outputs = (jack_port_t**)calloc (m->noutputs,
+						 sizeof(jack_port_t*))) == NULL ||
+	    (m->in = (const float**)calloc (m->ninputs,
+					    sizeof(float*))) == NULL ||
+	    (m->cells = (mixer_cell_t*)calloc (m->ninputs * m->noutputs,
+					       sizeof(mixer_cell_t))) == NULL) {
+		return -1;
+	}
+
+	for (o = 0; o < m->noutputs; o++) {
+		for (i = 0; i < m->ninputs; i++) {
+			cell = mixer_cell (m, i, o);
+			switch (m->matrix) {
+			case MixerDiagonal:
+				cell->loaded = (i % m->noutputs == o) ? 1.0f : 0.0f;
+				break;
+			case MixerAll:
+				cell->loaded = 1.0f;
+				break;
+			case MixerNone:
+				cell->loaded = 0.0f;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < m->ninputs; i++) {
+		snprintf (name, sizeof(name), "in_%d", i + 1);
+		if ((m->inputs[i] = jack_port_register (m->client, name,
+							JACK_DEFAULT_AUDIO_TYPE,
+							JackPortIsInput, 0)) == NULL) {
+			jack_error ("mixer: cannot register %s", name);
+			return -1;
+		}
+	}
+
+	for (o = 0; o < m->noutputs; o++) {
+		snprintf (name, sizeof(name), "out_%d", o + 1);
+		if ((m->outputs[o] = jack_port_register (m->client, name,
+							 JACK_DEFAULT_AUDIO_TYPE,
+							 JackPortIsOutput, 0)) == NULL) {
+			jack_error ("mixer: cannot register %s", name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int
+jack_initialize (jack_client_t *client, const char *load_init)
+{
+	mixer_t *m;
+	int i;
+
+	if ((m = (mixer_t*)calloc (1, sizeof(mixer_t))) == NULL) {
+		return -1;
+	}
+
+	m->client = client;
+	m->ninputs = MIXER_INPUTS;
+	m->noutputs = MIXER_OUTPUTS;
+	m->matrix = MixerDiagonal;
+
+	if (mixer_parse (m, load_init, FALSE) ||
+	    mixer_setup (m) ||
+	    mixer_parse (m, load_init, TRUE)) {
+		mixer_free (m);
+		return -1;
+	}
+
+	for (i = 0; i < m->ninputs * m->noutputs; i++) {
+		m->cells[i].target = m->cells[i].gain = m->cells[i].loaded;
+	}
+
+	if (jack_set_process_callback (client, mixer_process, m) ||
+	    jack_set_property_change_callback (client, mixer_property_changed,
+					       m) ||
+	    jack_activate (client)) {
+		client->process_arg = NULL;
+		mixer_free (m);
+		return -1;
+	}
+
+	jack_info ("mixer: %d input%s on %d bus%s", m->ninputs,
+		   m->ninputs == 1 ? "" : "s", m->noutputs,
+		   m->noutputs == 1 ? "" : "es");
+
+	return 0;
+}
+
+void
+jack_finish (void *arg)
+{
+	mixer_t *m = (mixer_t*)arg;
+
+	if (m == NULL) {
+		return;
+	}
+
+	mixer_free (m);
+}
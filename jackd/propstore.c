@@ -0,0 +1,608 @@
+/*
+    The metadata store -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "propstore.h"
+
+/* With "--metadata-file FILE", a non-realtime thread writes the live
+ * records to FILE a while after they changed, and once more when the
+ * server stops; the next server started with the same FILE begins
+ * with them. The file is a jack_propstore_snapshot_t followed by the
+ * records as they are laid out in the segment, and is replaced by
+ * rename(), so it is never seen half written.
+ */
+
+#define JACK_PROPSTORE_SNAPSHOT_MAGIC 0x4a4d5331        /* "JMS1" */
+#define JACK_PROPSTORE_SNAPSHOT_USECS 1000000           /* let changes pile up */
+
+typedef struct {
+	uint32_t magic;
+	uint32_t record_size;           /* sizeof(jack_propstore_record_t) */
+	uint32_t count;
+	uint32_t bytes;                 /* of the records that follow */
+} jack_propstore_snapshot_t;
+
+static uint32_t
+jack_propstore_record_size (size_t keylen, size_t valuelen, size_t typelen)
+{
+	return (sizeof(jack_propstore_record_t) + keylen + valuelen + typelen
+		+ 7) & ~((uint32_t)7);
+}
+
+/* the writer side of the seqlock; the callers hold ps->lock */
+
+static void
+jack_propstore_write_begin (jack_propstore_t *store)
+{
+	__atomic_store_n (&store->seq, store->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static void
+jack_propstore_write_end (jack_propstore_t *store)
+{
+	__atomic_store_n (&store->seq, store->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* the caller has made sure that there is room */
+static void
+jack_propstore_append (jack_propstore_t *store, jack_uuid_t subject,
+		       const char *key, uint32_t keylen,
+		       const char *value, uint32_t valuelen,
+		       const char *type, uint32_t typelen)
+{
+	uint32_t offset = store->used;
+	jack_propstore_record_t *rec = jack_propstore_at (store, offset);
+	unsigned int b = jack_propstore_hash (subject, key);
+
+	rec->dead = 0;
+	rec->size = jack_propstore_record_size (keylen, valuelen, typelen);
+	rec->keylen = keylen;
+	rec->valuelen = valuelen;
+	rec->typelen = typelen;
+	jack_uuid_copy (&rec->subject, subject);
+	memcpy (rec->data, key, keylen);
+	memcpy (rec->data + keylen, value, valuelen);
+	if (typelen) {
+		memcpy (rec->data + keylen + valuelen, type, typelen);
+	}
+	rec->next = store->buckets[b];
+
+	__atomic_store_n (&store->buckets[b], offset, __ATOMIC_RELEASE);
+	__atomic_store_n (&store->used, offset + rec->size, __ATOMIC_RELEASE);
+	store->count++;
+}
+
+static void
+jack_propstore_kill (jack_propstore_t *store, jack_propstore_record_t *rec)
+{
+	__atomic_store_n (&rec->dead, 1, __ATOMIC_RELEASE);
+	store->count--;
+	store->dead_bytes += rec->size;
+}
+
+/* Move the live records to a new segment with room for `need' more
+ * bytes, and twice as much again, so that a store that keeps
+ * replacing the same few properties is not copied over and over.
+ */
+static int
+jack_propstore_grow (jack_propstore_server_t *ps, uint32_t need)
+{
+	jack_propstore_t *old = ps->store;
+	jack_propstore_t *store;
+	jack_propstore_record_t *rec;
+	jack_shm_info_t si;
+	uint64_t live = 0;
+	uint64_t size = JACK_PROPSTORE_MIN_SIZE;
+	uint32_t off;
+
+	if (old) {
+		live = old->used - jack_propstore_first () - old->dead_bytes;
+	}
+
+	while (size < jack_propstore_first () + 2 * (live + need) &&
+	       size < JACK_PROPSTORE_MAX_SIZE) {
+		size *= 2;
+	}
+
+	if (jack_propstore_first () + live + need > size) {
+		jack_error ("the metadata store is full");
+		return -1;
+	}
+
+	si.index = JACK_SHM_NULL_INDEX;
+	si.attached_at = MAP_FAILED;
+
+	if (jack_shmalloc (size, &si)) {
+		jack_error ("cannot create the metadata store (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	if (jack_attach_shm (&si)) {
+		jack_error ("cannot attach the metadata store (%s)",
+			    strerror (errno));
+		jack_destroy_shm (&si);
+		return -1;
+	}
+
+	store = (jack_propstore_t*)jack_shm_addr (&si);
+	memset (store, 0, sizeof(jack_propstore_t));
+	store->magic = JACK_PROPSTORE_MAGIC;
+	store->size = size;
+	store->used = jack_propstore_first ();
+
+	if (old) {
+		for (off = jack_propstore_first (); off < old->used; off += rec->size) {
+			rec = jack_propstore_at (old, off);
+			if (!rec->dead) {
+				jack_propstore_append (store, rec->subject,
+						       rec->data, rec->keylen,
+						       jack_propstore_value (rec),
+						       rec->valuelen,
+						       jack_propstore_type (rec),
+						       rec->typelen);
+			}
+		}
+	}
+
+	/* the new index first: whoever sees `retired' must find it */
+
+	__atomic_store_n (ps->index, si.index, __ATOMIC_RELEASE);
+
+	if (old) {
+		__atomic_store_n (&old->retired, 1, __ATOMIC_RELEASE);
+		jack_release_shm (&ps->shm);
+		jack_destroy_shm (&ps->shm);
+	}
+
+	ps->shm = si;
+	ps->store = store;
+
+	return 0;
+}
+
+static void
+jack_propstore_dirty (jack_propstore_server_t *ps)
+{
+	if (ps->path) {
+		ps->dirty = 1;
+		pthread_cond_signal (&ps->dirty_cond);
+	}
+}
+
+int
+jack_propstore_set (jack_propstore_server_t *ps, jack_uuid_t subject,
+		    const char *key, const char *value, const char *type,
+		    jack_property_change_t *change)
+{
+	size_t keylen = strlen (key) + 1;
+	size_t valuelen = strlen (value) + 1;
+	size_t typelen = (type && type[0]) ? strlen (type) + 1 : 0;
+	jack_propstore_record_t *old;
+	jack_propstore_t *store;
+	uint32_t size;
+
+	if (keylen + valuelen + typelen > JACK_PROPSTORE_RECORD_MAX) {
+		jack_error ("metadata %s is too large (%zu bytes)", key,
+			    keylen + valuelen + typelen);
+		return -1;
+	}
+
+	size = jack_propstore_record_size (keylen, valuelen, typelen);
+
+	pthread_mutex_lock (&ps->lock);
+
+	if (ps->store->used + size > ps->store->size &&
+	    jack_propstore_grow (ps, size)) {
+		pthread_mutex_unlock (&ps->lock);
+		return -1;
+	}
+
+	store = ps->store;
+	old = jack_propstore_find (store, subject, key);
+
+	jack_propstore_write_begin (store);
+	jack_propstore_append (store, subject, key, keylen, value, valuelen,
+			       type, typelen);
+	if (old) {
+		jack_propstore_kill (store, old);
+	}
+	jack_propstore_write_end (store);
+
+	*change = old ? PropertyChanged : PropertyCreated;
+
+	jack_propstore_dirty (ps);
+	pthread_mutex_unlock (&ps->lock);
+
+	return 0;
+}
+
+int
+jack_propstore_remove (jack_propstore_server_t *ps, jack_uuid_t subject,
+		       const char *key)
+{
+	jack_propstore_t *store;
+	jack_propstore_record_t *rec;
+	uint32_t off;
+	int n = 0;
+
+	pthread_mutex_lock (&ps->lock);
+
+	store = ps->store;
+	jack_propstore_write_begin (store);
+
+	if (key) {
+		if ((rec = jack_propstore_find (store, subject, key)) != NULL) {
+			jack_propstore_kill (store, rec);
+			n++;
+		}
+	} else {
+		for (off = jack_propstore_first (); off < store->used; off += rec->size) {
+			rec = jack_propstore_at (store, off);
+			if (!rec->dead &&
+			    jack_uuid_compare (rec->subject, subject) == 0) {
+				jack_propstore_kill (store, rec);
+				n++;
+			}
+		}
+	}
+
+	jack_propstore_write_end (store);
+
+	if (n) {
+		jack_propstore_dirty (ps);
+	}
+
+	pthread_mutex_unlock (&ps->lock);
+
+	return n;
+}
+
+int
+jack_propstore_clear (jack_propstore_server_t *ps)
+{
+	jack_propstore_t *store;
+	jack_propstore_record_t *rec;
+	uint32_t off;
+	int n = 0;
+
+	pthread_mutex_lock (&ps->lock);
+
+	store = ps->store;
+	jack_propstore_write_begin (store);
+
+	for (off = jack_propstore_first (); off < store->used; off += rec->size) {
+		rec = jack_propstore_at (store, off);
+		if (!rec->dead) {
+			jack_propstore_kill (store, rec);
+			n++;
+		}
+	}
+
+	jack_propstore_write_end (store);
+
+	if (n) {
+		jack_propstore_dirty (ps);
+	}
+
+	pthread_mutex_unlock (&ps->lock);
+
+	return n;
+}
+
+static int
+jack_propstore_write (int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = write (fd, p, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+jack_propstore_read (int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = read (fd, p, len)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Copy the records out under the lock, which is a single memcpy, and
+ * write the live ones without it.
+ */
+static int
+jack_propstore_save (jack_propstore_server_t *ps)
+{
+	jack_propstore_snapshot_t hdr;
+	jack_propstore_record_t *rec;
+	char tmp[PATH_MAX + 1];
+	char *buf;
+	uint32_t bytes, off;
+	int fd, err = 0;
+
+	pthread_mutex_lock (&ps->lock);
+
+	ps->dirty = 0;
+	bytes = ps->store->used - jack_propstore_first ();
+
+	if ((buf = (char*)malloc (bytes ? bytes : 1)) == NULL) {
+		ps->dirty = 1;
+		pthread_mutex_unlock (&ps->lock);
+		return -1;
+	}
+
+	memcpy (buf, jack_propstore_at (ps->store, jack_propstore_first ()), bytes);
+
+	hdr.magic = JACK_PROPSTORE_SNAPSHOT_MAGIC;
+	hdr.record_size = sizeof(jack_propstore_record_t);
+	hdr.count = ps->store->count;
+	hdr.bytes = bytes - ps->store->dead_bytes;
+
+	pthread_mutex_unlock (&ps->lock);
+
+	snprintf (tmp, sizeof(tmp), "%s.tmp", ps->path);
+
+	if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		jack_error ("cannot write metadata to %s (%s)", tmp,
+			    strerror (errno));
+		free (buf);
+		return -1;
+	}
+
+	err = jack_propstore_write (fd, &hdr, sizeof(hdr));
+
+	for (off = 0; !err && off < bytes; off += rec->size) {
+		rec = (jack_propstore_record_t*)(buf + off);
+		if (!rec->dead) {
+			err = jack_propstore_write (fd, rec, rec->size);
+		}
+	}
+
+	free (buf);
+
+	if (err || fsync (fd)) {
+		jack_error ("cannot write metadata to %s (%s)", tmp,
+			    strerror (errno));
+		close (fd);
+		unlink (tmp);
+		return -1;
+	}
+
+	close (fd);
+
+	if (rename (tmp, ps->path)) {
+		jack_error ("cannot replace %s (%s)", ps->path, strerror (errno));
+		unlink (tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a file that cannot be read is reported, and the server starts with
+   no metadata rather than not at all */
+static void
+jack_propstore_load (jack_propstore_server_t *ps)
+{
+	jack_propstore_snapshot_t hdr;
+	jack_propstore_record_t *rec;
+	jack_property_change_t change;
+	const char *value, *type;
+	char *buf = NULL;
+	uint32_t off, n = 0;
+	size_t len;
+	int fd;
+
+	if ((fd = open (ps->path, O_RDONLY)) < 0) {
+		if (errno != ENOENT) {
+			jack_error ("cannot read metadata from %s (%s)",
+				    ps->path, strerror (errno));
+		}
+		return;
+	}
+
+	if (jack_propstore_read (fd, &hdr, sizeof(hdr)) ||
+	    hdr.magic != JACK_PROPSTORE_SNAPSHOT_MAGIC ||
+	    hdr.record_size != sizeof(jack_propstore_record_t) ||
+	    hdr.bytes > JACK_PROPSTORE_MAX_SIZE) {
+		jack_error ("%s does not hold JACK metadata", ps->path);
+		close (fd);
+		return;
+	}
+
+	if ((buf = (char*)malloc (hdr.bytes ? hdr.bytes : 1)) == NULL ||
+	    jack_propstore_read (fd, buf, hdr.bytes)) {
+		jack_error ("cannot read metadata from %s", ps->path);
+		free (buf);
+		close (fd);
+		return;
+	}
+
+	close (fd);
+
+	for (off = 0; off + sizeof(jack_propstore_record_t) <= hdr.bytes;
+	     off += rec->size) {
+
+		rec = (jack_propstore_record_t*)(buf + off);
+		len = (size_t)rec->keylen + rec->valuelen + rec->typelen;
+
+		if (rec->size < sizeof(jack_propstore_record_t) ||
+		    rec->size > hdr.bytes - off ||
+		    len > rec->size - sizeof(jack_propstore_record_t) ||
+		    rec->keylen < 2 || rec->valuelen < 2 ||
+		    rec->data[rec->keylen - 1] != '\0' ||
+		    rec->data[rec->keylen + rec->valuelen - 1] != '\0' ||
+		    (rec->typelen && rec->data[len - 1] != '\0')) {
+			jack_error ("%s is damaged after %" PRIu32 " properties",
+				    ps->path, n);
+			break;
+		}
+
+		value = jack_propstore_value (rec);
+		type = jack_propstore_type (rec);
+
+		if (jack_propstore_set (ps, rec->subject, rec->data, value,
+					type, &change)) {
+			break;
+		}
+		n++;
+	}
+
+	free (buf);
+
+	/* nothing to write back yet */
+	ps->dirty = 0;
+
+	jack_info ("%" PRIu32 " properties read from %s", n, ps->path);
+}
+
+static void *
+jack_propstore_thread (void *arg)
+{
+	jack_propstore_server_t *ps = (jack_propstore_server_t*)arg;
+
+	pthread_mutex_lock (&ps->lock);
+
+	while (ps->running) {
+		if (!ps->dirty) {
+			pthread_cond_wait (&ps->dirty_cond, &ps->lock);
+			continue;
+		}
+		pthread_mutex_unlock (&ps->lock);
+		usleep (JACK_PROPSTORE_SNAPSHOT_USECS);
+		jack_propstore_save (ps);
+		pthread_mutex_lock (&ps->lock);
+	}
+
+	pthread_mutex_unlock (&ps->lock);
+
+	return NULL;
+}
+
+jack_propstore_server_t *
+jack_propstore_new (volatile jack_shm_registry_index_t *index,
+		    const char *path)
+{
+	jack_propstore_server_t *ps;
+
+	if ((ps = (jack_propstore_server_t*)
+		  calloc (1, sizeof(jack_propstore_server_t))) == NULL) {
+		return NULL;
+	}
+
+	ps->index = index;
+	ps->shm.index = JACK_SHM_NULL_INDEX;
+	ps->shm.attached_at = MAP_FAILED;
+	pthread_mutex_init (&ps->lock, NULL);
+	pthread_cond_init (&ps->dirty_cond, NULL);
+
+	if (jack_propstore_grow (ps, 0)) {
+		pthread_cond_destroy (&ps->dirty_cond);
+		pthread_mutex_destroy (&ps->lock);
+		free (ps);
+		return NULL;
+	}
+
+	if (path == NULL) {
+		return ps;
+	}
+
+	if ((ps->path = strdup (path)) == NULL) {
+		return ps;
+	}
+
+	jack_propstore_load (ps);
+
+	ps->running = 1;
+
+	if (jack_client_create_thread (NULL, &ps->thread, 0, FALSE,
+				       jack_propstore_thread, ps)) {
+		jack_error ("cannot create the metadata snapshot thread; "
+			    "metadata will not be kept in %s", path);
+		ps->running = 0;
+		free (ps->path);
+		ps->path = NULL;
+	}
+
+	return ps;
+}
+
+void
+jack_propstore_delete (jack_propstore_server_t *ps)
+{
+	if (ps == NULL) {
+		return;
+	}
+
+	if (ps->path) {
+		pthread_mutex_lock (&ps->lock);
+		ps->running = 0;
+		pthread_cond_signal (&ps->dirty_cond);
+		pthread_mutex_unlock (&ps->lock);
+		pthread_join (ps->thread, NULL);
+
+		if (ps->dirty) {
+			jack_propstore_save (ps);
+		}
+		free (ps->path);
+	}
+
+	__atomic_store_n (ps->index, JACK_SHM_NULL_INDEX, __ATOMIC_RELEASE);
+	jack_release_shm (&ps->shm);
+	jack_destroy_shm (&ps->shm);
+
+	pthread_cond_destroy (&ps->dirty_cond);
+	pthread_mutex_destroy (&ps->lock);
+	free (ps);
+}
@@ -0,0 +1,1030 @@
+/*
+    recorder -- internal client writing ports straight to disk
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Load it into jackd with
+ *
+ *    jackd -I recorder:recorder/dir=/srv/takes,port=system:capture_1,... ...
+ *    jack_load recorder recorder -i dir=/srv/takes,format=w64,...
+ *
+ * and it records one mono 32 bit float file per port until it is
+ * unloaded. The init string is a comma separated list of
+ *
+ *    dir=PATH        where the files go (the server's working directory)
+ *    port=NAME       a port to record, once per port (all physical
+ *                    capture ports)
+ *    format=FMT      wav, w64 or caf (wav, which turns into RF64 past
+ *                    4 GiB)
+ *    buffer=SECS     memory per track between the process thread and
+ *                    the disk (10)
+ *    prealloc=SECS   disk space to reserve per file up front (0)
+ *    behind=N        blocks a file may have in flight to the disk (2)
+ *
+ * It runs in the server's process thread, so there is no graph hop and
+ * no context switch per cycle: an input connected to a single port
+ * reads that port's buffer, and process() only copies it into the
+ * track's ring of preallocated, page aligned blocks. A disk thread
+ * writes the full blocks with O_DIRECT, through io_uring when that is
+ * available, and keeps up to `behind' of them in flight per file.
+ * Filesystems that refuse O_DIRECT get buffered writes instead, with
+ * the same number of blocks of write-behind (sync_file_range() and
+ * POSIX_FADV_DONTNEED) so the page cache does not fill up with audio.
+ *
+ * The header is padded out to REC_ALIGN so the samples start aligned;
+ * the sizes in it are filled in when the file is closed (except for
+ * CAF, which can say "to the end of the file" and so stays readable
+ * after a crash).
+ */
+
+#define _GNU_SOURCE
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include <jack/jack.h>
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "libjack/local.h"
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+#define REC_ALIGN         4096          /* O_DIRECT alignment, and the header size */
+#define REC_BLOCK_FRAMES  32768         /* 128 kB per disk write */
+#define REC_BUFFER_SECS   10
+#define REC_BEHIND        2
+
+typedef enum {
+	RecWAV,
+	RecW64,
+	RecCAF
+} rec_format_t;
+
+static const char *rec_extension[] = { "wav", "w64", "caf" };
+
+struct _rec_track;
+
+typedef struct {
+	struct _rec_track *track;
+	uint32_t block;
+	uint32_t len;
+} rec_req_t;
+
+typedef struct _rec_track {
+	jack_port_t *port;
+	char *source;
+	char path[PATH_MAX + 1];
+	int fd;
+	int direct;
+	float *blocks;                  /* nblocks * REC_BLOCK_FRAMES */
+	uint8_t *written;               /* per slot, for out of order completions */
+	rec_req_t *reqs;                /* per slot */
+
+	/* process thread */
+	jack_nframes_t fill;            /* frames in block `head' */
+	uint32_t head;                  /* blocks filled */
+	uint32_t dropped;               /* frames lost to a full ring */
+
+	/* disk thread */
+	uint32_t tail;                  /* blocks written; their slots are free */
+	uint32_t submitted;             /* blocks handed to the disk */
+	uint32_t inflight;
+	uint32_t reported;
+	uint32_t good;                  /* blocks known to be on disk, on failure */
+	int failed;
+} rec_track_t;
+
+typedef struct {
+	jack_client_t *client;
+	jack_native_thread_t thread;
+	int thread_running;
+	sem_t wake;
+	int stopping;
+
+	char *dir;
+	rec_format_t format;
+	float buffer_secs;
+	float prealloc_secs;
+	uint32_t behind;
+	jack_nframes_t rate;
+
+	uint32_t nblocks;
+	int ntracks;
+	rec_track_t *tracks;
+	char *header;                   /* REC_ALIGN, aligned */
+
+#if HAVE_LIBURING
+	struct io_uring ring;
+	int uring;
+	uint32_t inflight;
+#endif
+} recorder_t;
+
+static inline float *
+rec_block (recorder_t *m, rec_track_t *t, uint32_t block)
+{
+	return t->blocks + (size_t)(block % m->nblocks) * REC_BLOCK_FRAMES;
+}
+
+static inline off_t
+rec_offset (uint32_t block)
+{
+	return REC_ALIGN + (off_t)block * REC_BLOCK_FRAMES * sizeof(float);
+}
+
+/* header fields */
+
+static char *
+put_le (char *p, uint64_t v, int bytes)
+{
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		*p++ = (char)(v >> (8 * i));
+	}
+	return p;
+}
+
+static char *
+put_be (char *p, uint64_t v, int bytes)
+{
+	int i;
+
+	for (i = bytes - 1; i >= 0; i--) {
+		*p++ = (char)(v >> (8 * i));
+	}
+	return p;
+}
+
+static char *
+put_id (char *p, const char *id, int len)
+{
+	memcpy (p, id, len);
+	return p + len;
+}
+
+/* the GUIDs of Sony Wave64 all end the same way, except riff's */
+static char *
+put_w64 (char *p, const char *id)
+{
+	static const unsigned char riff[12] = {
+		0x2e, 0x91, 0xcf, 0x11, 0xa5, 0xd6,
+		0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00
+	};
+	static const unsigned char other[12] = {
+		0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1,
+		0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a
+	};
+
+	p = put_id (p, id, 4);
+	memcpy (p, strcmp (id, "riff") ? other : riff, 12);
+	return p + 12;
+}
+
+/* The REC_ALIGN bytes in front of the samples, for `frames' of them;
+   `final' is false for the header written when the file is opened. */
+static void
+rec_header (recorder_t *m, uint64_t frames, int final)
+{
+	char *h = m->header;
+	char *p = h;
+	uint64_t bytes = frames * sizeof(float);
+	uint64_t riff = REC_ALIGN - 8 + bytes;
+	union {
+		double d;
+		uint64_t u;
+	} rate;
+	int rf64;
+
+	memset (h, 0, REC_ALIGN);
+
+	switch (m->format) {
+	case RecWAV:
+		/* the first chunk is a JUNK the size of a ds64, so a file
+		   that outgrows RIFF becomes RF64 in place */
+		rf64 = riff > 0xffffffffULL;
+		p = put_id (p, rf64 ? "RF64" : "RIFF", 4);
+		p = put_le (p, rf64 ? 0xffffffff : riff, 4);
+		p = put_id (p, "WAVE", 4);
+		p = put_id (p, rf64 ? "ds64" : "JUNK", 4);
+		p = put_le (p, 28, 4);
+		if (rf64) {
+			p = put_le (p, riff, 8);
+			p = put_le (p, bytes, 8);
+			p = put_le (p, frames, 8);
+			p = put_le (p, 0, 4);
+		} else {
+			p += 28;
+		}
+		p = put_id (p, "fmt ", 4);
+		p = put_le (p, 18, 4);
+		p = put_le (p, 3, 2);                   /* IEEE float */
+		p = put_le (p, 1, 2);
+		p = put_le (p, m->rate, 4);
+		p = put_le (p, m->rate * sizeof(float), 4);
+		p = put_le (p, sizeof(float), 2);
+		p = put_le (p, 32, 2);
+		p = put_le (p, 0, 2);
+		p = put_id (p, "fact", 4);
+		p = put_le (p, 4, 4);
+		p = put_le (p, rf64 ? 0xffffffff : frames, 4);
+		p = put_id (p, "JUNK", 4);
+		p = put_le (p, h + REC_ALIGN - 8 - (p + 4), 4);
+		p = put_id (h + REC_ALIGN - 8, "data", 4);
+		put_le (p, rf64 ? 0xffffffff : bytes, 4);
+		break;
+
+	case RecW64:
+		/* sizes count the 24 byte chunk header; chunks are 8 aligned */
+		p = put_w64 (p, "riff");
+		p = put_le (p, REC_ALIGN + bytes, 8);
+		p = put_w64 (p, "wave");
+		p = put_w64 (p, "fmt ");
+		p = put_le (p, 24 + 18, 8);
+		p = put_le (p, 3, 2);
+		p = put_le (p, 1, 2);
+		p = put_le (p, m->rate, 4);
+		p = put_le (p, m->rate * sizeof(float), 4);
+		p = put_le (p, sizeof(float), 2);
+		p = put_le (p, 32, 2);
+		p = put_le (p, 0, 2);
+		p += 6;
+		p = put_w64 (p, "fact");
+		p = put_le (p, 24 + 8, 8);
+		p = put_le (p, frames, 8);
+		p = put_w64 (p, "junk");
+		p = put_le (p, h + REC_ALIGN - 24 - (p - 16), 8);
+		p = put_w64 (h + REC_ALIGN - 24, "data");
+		put_le (p, 24 + bytes, 8);
+		break;
+
+	case RecCAF:
+		rate.d = m->rate;
+		p = put_id (p, "caff", 4);
+		p = put_be (p, 1, 2);
+		p = put_be (p, 0, 2);
+		p = put_id (p, "desc", 4);
+		p = put_be (p, 32, 8);
+		p = put_be (p, rate.u, 8);
+		p = put_id (p, "lpcm", 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		p = put_be (p, 1 | 2, 4);               /* float, little endian */
+#else
+		p = put_be (p, 1, 4);
+#endif
+		p = put_be (p, sizeof(float), 4);
+		p = put_be (p, 1, 4);
+		p = put_be (p, 1, 4);
+		p = put_be (p, 32, 4);
+		p = put_id (p, "free", 4);
+		p = put_be (p, h + REC_ALIGN - 16 - (p + 8), 8);
+		p = put_id (h + REC_ALIGN - 16, "data", 4);
+		/* -1: the samples run to the end of the file */
+		p = put_be (p, final ? 4 + bytes : (uint64_t)-1, 8);
+		put_be (p, 0, 4);                       /* edit count */
+		break;
+	}
+}
+
+static int
+rec_pwrite (int fd, const char *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len) {
+		if ((n = pwrite (fd, buf, len, off)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0) {
+			errno = ENOSPC;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+static int
+rec_open (recorder_t *m, rec_track_t *t, const char *take, int index)
+{
+	off_t reserve;
+
+	snprintf (t->path, sizeof(t->path), "%s/%s-%02d.%s",
+		  m->dir, take, index + 1, rec_extension[m->format]);
+
+	t->direct = O_DIRECT != 0;
+	t->fd = open (t->path, O_WRONLY | O_CREAT | O_EXCL | O_DIRECT, 0644);
+
+	if (t->fd < 0 && errno == EINVAL && t->direct) {
+		/* tmpfs and friends */
+		t->direct = 0;
+		t->fd = open (t->path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	}
+
+	if (t->fd < 0) {
+		jack_error ("recorder: cannot create %s (%s)", t->path,
+			    strerror (errno));
+		return -1;
+	}
+
+	/* Allocating (rather than only reserving) the space lets the
+	   writes land in extents that already exist, without growing the
+	   file on every one of them; the tail that is not used goes when
+	   the file is closed. */
+	if (m->prealloc_secs > 0.0f) {
+		reserve = REC_ALIGN +
+			  (off_t)(m->prealloc_secs * m->rate) * sizeof(float);
+#ifdef HAVE_FALLOCATE
+		if (fallocate (t->fd, 0, 0, reserve)) {
+#else
+		if ((errno = posix_fallocate (t->fd, 0, reserve))) {
+#endif
+			jack_info ("recorder: cannot preallocate %s (%s)",
+				   t->path, strerror (errno));
+		}
+	}
+
+	rec_header (m, 0, FALSE);
+
+	if (rec_pwrite (t->fd, m->header, REC_ALIGN, 0)) {
+		jack_error ("recorder: cannot write %s (%s)", t->path,
+			    strerror (errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+rec_fail (rec_track_t *t, uint32_t block, int err)
+{
+	if (!t->failed) {
+		jack_error ("recorder: stopped writing %s (%s)", t->path,
+			    strerror (err));
+		t->failed = TRUE;
+		t->good = block;
+	} else if (block < t->good) {
+		t->good = block;
+	}
+}
+
+/* block `block' of `t' is on its way to the disk; the WAV flavours are
+   little endian whatever the machine is */
+static void
+rec_prepare (recorder_t *m, rec_track_t *t, uint32_t block, size_t frames)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint32_t *s = (uint32_t*)rec_block (m, t, block);
+	size_t i;
+
+	if (m->format != RecCAF) {
+		for (i = 0; i < frames; i++) {
+			s[i] = __builtin_bswap32 (s[i]);
+		}
+	}
+#endif
+}
+
+static void
+rec_complete (recorder_t *m, rec_track_t *t, uint32_t block)
+{
+	t->written[block % m->nblocks] = 1;
+
+	while (t->tail < t->submitted && t->written[t->tail % m->nblocks]) {
+		t->written[t->tail % m->nblocks] = 0;
+		t->tail++;
+	}
+
+	/* hands the slots back to the process thread */
+	__atomic_store_n (&t->tail, t->tail, __ATOMIC_RELEASE);
+}
+
+/* Buffered files get their own write-behind: start writeback of each
+   block as it is written, and once `behind' more have followed, wait
+   for it and drop it from the page cache. */
+static void
+rec_write_behind (recorder_t *m, rec_track_t *t, uint32_t block)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	const off_t len = REC_BLOCK_FRAMES * sizeof(float);
+
+	sync_file_range (t->fd, rec_offset (block), len,
+			 SYNC_FILE_RANGE_WRITE);
+
+	if (block >= m->behind) {
+		sync_file_range (t->fd, rec_offset (block - m->behind), len,
+				 SYNC_FILE_RANGE_WAIT_BEFORE |
+				 SYNC_FILE_RANGE_WRITE |
+				 SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise (t->fd, rec_offset (block - m->behind), len,
+			       POSIX_FADV_DONTNEED);
+	}
+#endif
+}
+
+static void
+rec_write_block (recorder_t *m, rec_track_t *t, uint32_t block)
+{
+	const size_t len = REC_BLOCK_FRAMES * sizeof(float);
+
+	rec_prepare (m, t, block, REC_BLOCK_FRAMES);
+
+	if (rec_pwrite (t->fd, (const char*)rec_block (m, t, block), len,
+			rec_offset (block))) {
+		rec_fail (t, block, errno);
+	} else if (!t->direct) {
+		rec_write_behind (m, t, block);
+	}
+
+	t->submitted++;
+	rec_complete (m, t, block);
+}
+
+#if HAVE_LIBURING
+
+static int
+rec_queue_block (recorder_t *m, rec_track_t *t, uint32_t block)
+{
+	struct io_uring_sqe *sqe;
+	rec_req_t *req = &t->reqs[block % m->nblocks];
+
+	if ((sqe = io_uring_get_sqe (&m->ring)) == NULL) {
+		return -1;
+	}
+
+	rec_prepare (m, t, block, REC_BLOCK_FRAMES);
+
+	req->track = t;
+	req->block = block;
+	req->len = REC_BLOCK_FRAMES * sizeof(float);
+
+	io_uring_prep_write (sqe, t->fd, rec_block (m, t, block), req->len,
+			     rec_offset (block));
+	io_uring_sqe_set_data (sqe, req);
+
+	t->submitted++;
+	t->inflight++;
+	m->inflight++;
+
+	return 0;
+}
+
+static void
+rec_reap (recorder_t *m, int wait)
+{
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec ts = { 0, 20000000 };
+	rec_req_t *req;
+
+	if (wait && io_uring_wait_cqe_timeout (&m->ring, &cqe, &ts)) {
+		return;
+	}
+
+	while (io_uring_peek_cqe (&m->ring, &cqe) == 0) {
+		req = (rec_req_t*)io_uring_cqe_get_data (cqe);
+
+		if (cqe->res < 0) {
+			rec_fail (req->track, req->block, -cqe->res);
+		} else if ((uint32_t)cqe->res != req->len) {
+			/* short direct writes only come from a full disk */
+			rec_fail (req->track, req->block, ENOSPC);
+		}
+
+		req->track->inflight--;
+		m->inflight--;
+		rec_complete (m, req->track, req->block);
+
+		io_uring_cqe_seen (&m->ring, cqe);
+	}
+}
+
+#endif /* HAVE_LIBURING */
+
+/* hand every full block to the disk; true if there are none left */
+static int
+rec_submit (recorder_t *m)
+{
+	rec_track_t *t;
+	uint32_t head, dropped;
+	int idle = TRUE, i;
+#if HAVE_LIBURING
+	int queued = 0;
+#endif
+
+	for (i = 0; i < m->ntracks; i++) {
+		t = &m->tracks[i];
+		head = __atomic_load_n (&t->head, __ATOMIC_ACQUIRE);
+
+		dropped = __atomic_load_n (&t->dropped, __ATOMIC_RELAXED);
+		if (dropped != t->reported) {
+			jack_error ("recorder: the disk is too slow for %s, "
+				    "%u frames dropped so far", t->path, dropped);
+			t->reported = dropped;
+		}
+
+		if (t->failed) {
+			/* keep the ring moving so the others go on */
+			if (t->inflight == 0 && t->submitted != head) {
+				t->submitted = head;
+				t->tail = head;
+				__atomic_store_n (&t->tail, head, __ATOMIC_RELEASE);
+			}
+			idle = idle && t->inflight == 0;
+			continue;
+		}
+
+		while (t->submitted != head) {
+#if HAVE_LIBURING
+			if (m->uring && t->direct) {
+				if (t->inflight >= m->behind ||
+				    rec_queue_block (m, t, t->submitted)) {
+					break;
+				}
+				queued++;
+				continue;
+			}
+#endif
+			rec_write_block (m, t, t->submitted);
+		}
+
+		idle = idle && t->submitted == head && t->inflight == 0;
+	}
+
+#if HAVE_LIBURING
+	if (queued) {
+		io_uring_submit (&m->ring);
+	}
+#endif
+
+	return idle;
+}
+
+/* the frames in the block being filled, once the process thread has
+   stopped; the write is rounded up to the O_DIRECT alignment and the
+   file truncated back afterwards */
+static void
+rec_flush_partial (recorder_t *m, rec_track_t *t)
+{
+	char *buf = (char*)rec_block (m, t, t->head);
+	size_t len = t->fill * sizeof(float);
+	size_t padded = (len + REC_ALIGN - 1) & ~((size_t)REC_ALIGN - 1);
+
+	if (t->failed || len == 0) {
+		return;
+	}
+
+	memset (buf + len, 0, padded - len);
+	rec_prepare (m, t, t->head, t->fill);
+
+	if (rec_pwrite (t->fd, buf, padded, rec_offset (t->head))) {
+		rec_fail (t, t->head, errno);
+	}
+}
+
+static void
+rec_close (recorder_t *m, rec_track_t *t)
+{
+	uint64_t frames;
+
+	if (t->fd < 0) {
+		return;
+	}
+
+	frames = (uint64_t)t->head * REC_BLOCK_FRAMES + t->fill;
+	if (t->failed) {
+		frames = (uint64_t)t->good * REC_BLOCK_FRAMES;
+	}
+
+	if (ftruncate (t->fd, rec_offset (0) + frames * sizeof(float))) {
+		jack_error ("recorder: cannot truncate %s (%s)", t->path,
+			    strerror (errno));
+	}
+
+	rec_header (m, frames, TRUE);
+
+	if (rec_pwrite (t->fd, m->header, REC_ALIGN, 0) || fdatasync (t->fd)) {
+		jack_error ("recorder: cannot finish %s (%s)", t->path,
+			    strerror (errno));
+	} else {
+		jack_info ("recorder: wrote %s, %" PRIu64 " frames%s", t->path,
+			   frames, t->dropped ? " (with gaps)" : "");
+	}
+
+	close (t->fd);
+	t->fd = -1;
+}
+
+static void *
+recorder_thread (void *arg)
+{
+	recorder_t *m = (recorder_t*)arg;
+	struct timespec ts;
+	int stopping, idle, i;
+
+	for (;; ) {
+		stopping = __atomic_load_n (&m->stopping, __ATOMIC_ACQUIRE);
+		idle = rec_submit (m);
+
+		if (stopping && idle) {
+			break;
+		}
+
+#if HAVE_LIBURING
+		if (m->inflight) {
+			rec_reap (m, TRUE);
+			continue;
+		}
+#endif
+
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 200000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		sem_timedwait (&m->wake, &ts);
+	}
+
+	for (i = 0; i < m->ntracks; i++) {
+		rec_flush_partial (m, &m->tracks[i]);
+		rec_close (m, &m->tracks[i]);
+	}
+
+	return NULL;
+}
+
+static int
+recorder_process (jack_nframes_t nframes, void *arg)
+{
+	recorder_t *m = (recorder_t*)arg;
+	rec_track_t *t;
+	const float *src;
+	jack_nframes_t done, n;
+	uint32_t tail;
+	int wake = FALSE, i;
+
+	if (__atomic_load_n (&m->stopping, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+
+	for (i = 0; i < m->ntracks; i++) {
+		t = &m->tracks[i];
+		src = (const float*)jack_port_get_buffer (t->port, nframes);
+
+		for (done = 0; done < nframes; done += n) {
+			tail = __atomic_load_n (&t->tail, __ATOMIC_ACQUIRE);
+			if (t->head - tail >= m->nblocks) {
+				__atomic_store_n (&t->dropped,
+						  t->dropped + (nframes - done),
+						  __ATOMIC_RELAXED);
+				break;
+			}
+
+			n = REC_BLOCK_FRAMES - t->fill;
+			if (n > nframes - done) {
+				n = nframes - done;
+			}
+
+			memcpy (rec_block (m, t, t->head) + t->fill, src + done,
+				n * sizeof(float));
+			t->fill += n;
+
+			if (t->fill == REC_BLOCK_FRAMES) {
+				t->fill = 0;
+				__atomic_store_n (&t->head, t->head + 1,
+						  __ATOMIC_RELEASE);
+				wake = TRUE;
+			}
+		}
+	}
+
+	/* once per block, well under once a second */
+	if (wake) {
+		sem_post (&m->wake);
+	}
+
+	return 0;
+}
+
+static int
+rec_add_source (recorder_t *m, const char *name)
+{
+	rec_track_t *tracks;
+
+	if ((tracks = (rec_track_t*)realloc (m->tracks, (m->ntracks + 1) *
+					     sizeof(rec_track_t))) == NULL) {
+		return -1;
+	}
+	m->tracks = tracks;
+
+	memset (&tracks[m->ntracks], 0, sizeof(rec_track_t));
+	tracks[m->ntracks].fd = -1;
+	if ((tracks[m->ntracks].source = strdup (name)) == NULL) {
+		return -1;
+	}
+	m->ntracks++;
+
+	return 0;
+}
+
+static int
+rec_parse (recorder_t *m, const char *load_init)
+{
+	char *args, *opt, *save = NULL, *value;
+	int ret = 0;
+
+	if (load_init == NULL || *load_init == '\0') {
+		return 0;
+	}
+
+	if ((args = strdup (load_init)) == NULL) {
+		return -1;
+	}
+
+	for (opt = strtok_r (args, ",", &save); opt && ret == 0;
+	     opt = strtok_r (NULL, ",", &save)) {
+
+		if ((value = strchr (opt, '=')) == NULL) {
+			jack_error ("recorder: \"%s\" is not key=value", opt);
+			ret = -1;
+			break;
+		}
+		*value++ = '\0';
+
+		if (strcmp (opt, "dir") == 0) {
+			free (m->dir);
+			if ((m->dir = strdup (value)) == NULL) {
+				ret = -1;
+			}
+		} else if (strcmp (opt, "port") == 0) {
+			ret = rec_add_source (m, value);
+		} else if (strcmp (opt, "format") == 0) {
+			if (strcmp (value, "wav") == 0) {
+				m->format = RecWAV;
+			} else if (strcmp (value, "w64") == 0) {
+				m->format = RecW64;
+			} else if (strcmp (value, "caf") == 0) {
+				m->format = RecCAF;
+			} else {
+				jack_error ("recorder: unknown format \"%s\"",
+					    value);
+				ret = -1;
+			}
+		} else if (strcmp (opt, "buffer") == 0) {
+			m->buffer_secs = atof (value);
+		} else if (strcmp (opt, "prealloc") == 0) {
+			m->prealloc_secs = atof (value);
+		} else if (strcmp (opt, "behind") == 0) {
+			m->behind = (uint32_t)atoi (value);
+		} else {
+			jack_error ("recorder: unknown option \"%s\"", opt);
+			ret = -1;
+		}
+	}
+
+	free (args);
+
+	return ret;
+}
+
+/* `keep' is false when loading failed, and the files go too */
+static void
+recorder_free (recorder_t *m, int keep)
+{
+	int i;
+
+	if (m->thread_running) {
+		__atomic_store_n (&m->stopping, TRUE, __ATOMIC_RELEASE);
+		sem_post (&m->wake);
+		pthread_join (m->thread, NULL);
+		sem_destroy (&m->wake);
+	}
+
+#if HAVE_LIBURING
+	if (m->uring) {
+		io_uring_queue_exit (&m->ring);
+	}
+#endif
+
+	for (i = 0; i < m->ntracks; i++) {
+		if (m->tracks[i].fd >= 0) {
+			close (m->tracks[i].fd);
+		}
+		if (!keep && m->tracks[i].path[0]) {
+			unlink (m->tracks[i].path);
+		}
+		free (m->tracks[i].source);
+		free (m->tracks[i].blocks);
+		free (m->tracks[i].written);
+		free (m->tracks[i].reqs);
+	}
+
+	free (m->tracks);
+	free (m->header);
+	free (m->dir);
+	free (m);
+}
+
+static int
+rec_setup (recorder_t *m)
+{
+	char take[64], name[32];
+	time_t now = time (NULL);
+	struct tm tm;
+	size_t bytes;
+	rec_track_t *t;
+	const char **ports;
+	int i;
+
+	if (m->ntracks == 0) {
+		ports = jack_get_ports (m->client, NULL, JACK_DEFAULT_AUDIO_TYPE,
+					JackPortIsPhysical | JackPortIsOutput);
+		for (i = 0; ports && ports[i]; i++) {
+			if (rec_add_source (m, ports[i])) {
+				jack_free (ports);
+				return -1;
+			}
+		}
+		jack_free (ports);
+	}
+
+	if (m->ntracks == 0) {
+		jack_error ("recorder: nothing to record");
+		return -1;
+	}
+
+	if (m->behind < 1) {
+		m->behind = 1;
+	}
+	if (m->buffer_secs <= 0.0f) {
+		m->buffer_secs = REC_BUFFER_SECS;
+	}
+
+	m->rate = jack_get_sample_rate (m->client);
+	m->nblocks = (uint32_t)(m->buffer_secs * m->rate / REC_BLOCK_FRAMES) + 1;
+	if (m->nblocks < m->behind + 2) {
+		m->nblocks = m->behind + 2;
+	}
+	bytes = (size_t)m->nblocks * REC_BLOCK_FRAMES * sizeof(float);
+
+	if (posix_memalign ((void**)&m->header, REC_ALIGN, REC_ALIGN)) {
+		m->header = NULL;
+		return -1;
+	}
+
+	localtime_r (&now, &tm);
+	strftime (take, sizeof(take), "take-%Y%m%d-%H%M%S", &tm);
+
+	for (i = 0; i < m->ntracks; i++) {
+		t = &m->tracks[i];
+
+		if (posix_memalign ((void**)&t->blocks, REC_ALIGN, bytes)) {
+			t->blocks = NULL;
+			jack_error ("recorder: cannot allocate %zu bytes", bytes);
+			return -1;
+		}
+		/* fault it all in now, not in the process thread */
+		memset (t->blocks, 0, bytes);
+
+		if ((t->written = (uint8_t*)calloc (m->nblocks, 1)) == NULL ||
+		    (t->reqs = (rec_req_t*)calloc (m->nblocks,
+						   sizeof(rec_req_t))) == NULL) {
+			return -1;
+		}
+
+		snprintf (name, sizeof(name), "in_%d", i + 1);
+		if ((t->port = jack_port_register (m->client, name,
+						   JACK_DEFAULT_AUDIO_TYPE,
+						   JackPortIsInput |
+						   JackPortIsTerminal, 0)) == NULL) {
+			jack_error ("recorder: cannot register %s", name);
+			return -1;
+		}
+
+		if (rec_open (m, t, take, i)) {
+			return -1;
+		}
+	}
+
+#if HAVE_LIBURING
+	if (io_uring_queue_init (m->ntracks * m->behind, &m->ring, 0) == 0) {
+		m->uring = TRUE;
+	} else {
+		jack_info ("recorder: no io_uring, writing synchronously");
+	}
+#endif
+
+	return 0;
+}
+
+int
+jack_initialize (jack_client_t *client, const char *load_init)
+{
+	recorder_t *m;
+	int i;
+
+	if ((m = (recorder_t*)calloc (1, sizeof(recorder_t))) == NULL) {
+		return -1;
+	}
+
+	m->client = client;
+	m->format = RecWAV;
+	m->behind = REC_BEHIND;
+
+	if (rec_parse (m, load_init) ||
+	    (m->dir == NULL && (m->dir = strdup (".")) == NULL) ||
+	    rec_setup (m)) {
+		recorder_free (m, FALSE);
+		return -1;
+	}
+
+	if (sem_init (&m->wake, 0, 0)) {
+		recorder_free (m, FALSE);
+		return -1;
+	}
+
+	/* not realtime: it waits on the disk */
+	if (jack_client_create_thread (client, &m->thread, 0, 0,
+				       recorder_thread, m)) {
+		jack_error ("recorder: cannot start the disk thread");
+		sem_destroy (&m->wake);
+		recorder_free (m, FALSE);
+		return -1;
+	}
+	m->thread_running = TRUE;
+
+	if (jack_set_process_callback (client, recorder_process, m) ||
+	    jack_activate (client)) {
+		client->process_arg = NULL;
+		recorder_free (m, FALSE);
+		return -1;
+	}
+
+	for (i = 0; i < m->ntracks; i++) {
+		if (jack_connect (client, m->tracks[i].source,
+				  jack_port_name (m->tracks[i].port))) {
+			jack_error ("recorder: cannot connect %s",
+				    m->tracks[i].source);
+			jack_deactivate (client);
+			client->process_arg = NULL;
+			recorder_free (m, FALSE);
+			return -1;
+		}
+	}
+
+	jack_info ("recorder: recording %d track%s to %s", m->ntracks,
+		   m->ntracks == 1 ? "" : "s", m->dir);
+
+	return 0;
+}
+
+void
+jack_finish (void *arg)
+{
+	recorder_t *m = (recorder_t*)arg;
+
+	if (m == NULL) {
+		return;
+	}
+
+	/* the disk thread finishes the files on its way out */
+	recorder_free (m, TRUE);
+}
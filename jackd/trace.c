@@ -0,0 +1,221 @@
+/*
+    Engine cycle tracing -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "trace.h"
+
+typedef struct {
+	jack_trace_record_t rec;
+	char name[JACK_CLIENT_NAME_SIZE];
+} jack_trace_name_t;
+
+static int
+jack_trace_write (jack_trace_t *trace, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = write (trace->fd, p, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			jack_error ("cannot write trace (%s)", strerror (errno));
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void
+jack_trace_flush_names (jack_trace_t *trace)
+{
+	JSList *names, *node;
+
+	pthread_mutex_lock (&trace->names_lock);
+	names = trace->names;
+	trace->names = NULL;
+	pthread_mutex_unlock (&trace->names_lock);
+
+	for (node = names; node; node = jack_slist_next (node)) {
+		jack_trace_write (trace, node->data, sizeof(jack_trace_name_t));
+		free (node->data);
+	}
+
+	jack_slist_free (names);
+}
+
+static void
+jack_trace_drain (jack_trace_t *trace)
+{
+	jack_trace_record_t rec;
+	uint32_t head, tail, idx, n;
+	uint32_t dropped;
+
+	/* names first, so that a reader meets a client's name no later
+	   than the records of its first traced cycle.
+	 */
+	jack_trace_flush_names (trace);
+
+	head = __atomic_load_n (&trace->head, __ATOMIC_ACQUIRE);
+	tail = trace->tail;
+
+	while (tail != head) {
+		idx = tail & (JACK_TRACE_RING_SIZE - 1);
+		n = head - tail;
+		if (n > JACK_TRACE_RING_SIZE - idx) {
+			n = JACK_TRACE_RING_SIZE - idx;
+		}
+		jack_trace_write (trace, &trace->ring[idx],
+				  n * sizeof(jack_trace_record_t));
+		tail += n;
+		__atomic_store_n (&trace->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	if ((dropped = __atomic_exchange_n (&trace->dropped, 0,
+					    __ATOMIC_RELAXED)) != 0) {
+		memset (&rec, 0, sizeof(rec));
+		rec.time = jack_get_microseconds ();
+		rec.type = JackTraceDropped;
+		rec.arg = dropped;
+		jack_trace_write (trace, &rec, sizeof(rec));
+	}
+}
+
+static void *
+jack_trace_thread (void *arg)
+{
+	jack_trace_t *trace = (jack_trace_t*)arg;
+
+	while (trace->running) {
+		usleep (JACK_TRACE_FLUSH_USECS);
+		jack_trace_drain (trace);
+	}
+
+	jack_trace_drain (trace);
+
+	return NULL;
+}
+
+jack_trace_t *
+jack_trace_start (const char *path)
+{
+	jack_trace_t *trace;
+	jack_trace_header_t hdr;
+
+	if ((trace = (jack_trace_t*)calloc (1, sizeof(jack_trace_t))) == NULL) {
+		return NULL;
+	}
+
+	if ((trace->ring = (jack_trace_record_t*)
+			   calloc (JACK_TRACE_RING_SIZE,
+				   sizeof(jack_trace_record_t))) == NULL) {
+		free (trace);
+		return NULL;
+	}
+
+	if ((trace->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		jack_error ("cannot open trace file %s (%s)", path,
+			    strerror (errno));
+		free (trace->ring);
+		free (trace);
+		return NULL;
+	}
+
+	hdr.magic = JACK_TRACE_MAGIC;
+	hdr.version = JACK_TRACE_VERSION;
+	hdr.record_size = sizeof(jack_trace_record_t);
+	hdr.name_size = JACK_CLIENT_NAME_SIZE;
+
+	if (jack_trace_write (trace, &hdr, sizeof(hdr))) {
+		close (trace->fd);
+		free (trace->ring);
+		free (trace);
+		return NULL;
+	}
+
+	pthread_mutex_init (&trace->names_lock, NULL);
+	trace->running = 1;
+
+	if (jack_client_create_thread (NULL, &trace->thread, 0, FALSE,
+				       jack_trace_thread, trace)) {
+		jack_error ("cannot create trace thread");
+		pthread_mutex_destroy (&trace->names_lock);
+		close (trace->fd);
+		free (trace->ring);
+		free (trace);
+		return NULL;
+	}
+
+	return trace;
+}
+
+void
+jack_trace_stop (jack_trace_t *trace)
+{
+	if (trace == NULL) {
+		return;
+	}
+
+	trace->running = 0;
+	pthread_join (trace->thread, NULL);
+
+	jack_trace_flush_names (trace);
+
+	close (trace->fd);
+	pthread_mutex_destroy (&trace->names_lock);
+	free (trace->ring);
+	free (trace);
+}
+
+void
+jack_trace_client_name (jack_trace_t *trace, jack_uuid_t uuid,
+			const char *name)
+{
+	jack_trace_name_t *tn;
+
+	if (trace == NULL) {
+		return;
+	}
+
+	if ((tn = (jack_trace_name_t*)calloc (1, sizeof(*tn))) == NULL) {
+		return;
+	}
+
+	tn->rec.time = jack_get_microseconds ();
+	tn->rec.uuid = uuid;
+	tn->rec.type = JackTraceClientName;
+	snprintf (tn->name, sizeof(tn->name), "%s", name);
+
+	pthread_mutex_lock (&trace->names_lock);
+	trace->names = jack_slist_append (trace->names, tn);
+	pthread_mutex_unlock (&trace->names_lock);
+}
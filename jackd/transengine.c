@@ -32,6 +32,90 @@
 
 /********************** internal functions **********************/
 
+/* Clients read current_time from any thread, process threads included,
+ * so the engine changes it under control->position_seq: odd while
+ * the change is being made, even again when it is done. Readers retry
+ * until they saw the same even count before and after their copy.
+ */
+static inline void
+jack_transport_write_begin (jack_control_t *ectl)
+{
+	ectl->position_seq++;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static inline void
+jack_transport_write_end (jack_control_t *ectl)
+{
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	ectl->position_seq++;
+}
+
+static inline void
+jack_transport_event_add (jack_control_t *ectl,
+			  jack_transport_event_type_t type,
+			  jack_nframes_t offset, jack_nframes_t frame)
+{
+	jack_transport_event_t *ev;
+
+	if (ectl->transport_nevents == JACK_TRANSPORT_EVENTS_MAX) {
+		return;
+	}
+
+	ev = &ectl->transport_events[ectl->transport_nevents++];
+	memset (ev, 0, sizeof(*ev));
+	ev->type = type;
+	ev->offset = offset;
+	ev->frame = frame;
+
+	if (type == JackTransportEventTempo) {
+		ev->beats_per_bar = ectl->current_time.beats_per_bar;
+		ev->beat_type = ectl->current_time.beat_type;
+		ev->beats_per_minute = ectl->current_time.beats_per_minute;
+	}
+}
+
+/* pick up a jack_transport_locate_at() request, if a whole new one
+   arrived; the client writes unique_1 first and unique_2 last */
+static inline void
+jack_transport_locate_at_poll (jack_engine_t *engine)
+{
+	jack_control_t *ectl = engine->control;
+	jack_locate_at_t *req = &ectl->locate_at_request;
+	jack_unique_t id;
+	jack_nframes_t when, frame;
+
+	id = req->unique_2;
+	if (id == ectl->prev_locate_at) {
+		return;
+	}
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	when = req->when;
+	frame = req->frame;
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	if (req->unique_1 != id) {
+		return;                 /* being written, next cycle */
+	}
+
+	ectl->prev_locate_at = id;
+	ectl->locate_at_when = when;
+	ectl->locate_at_frame = frame;
+	ectl->locate_at_armed = 1;
+	VERBOSE (engine, "transport locate to %" PRIu32 " armed at %" PRIu32,
+		 frame, when);
+}
+
+/* a client becomes active_slowsync, and so one of the sync clients
+ *
+ *   precondition: caller holds the graph lock. */
+static inline void
+jack_sync_client_add (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	client->control->active_slowsync = 1;
+	engine->sync_clients = jack_slist_prepend (engine->sync_clients, client);
+	engine->control->sync_clients++;
+}
+
 /* initiate polling a new slow-sync client
  *
  *   precondition: caller holds the graph lock. */
@@ -69,6 +153,7 @@ jack_sync_poll_deactivate (jack_engine_t *engine,
 		VERBOSE (engine, "sync poll interrupted for client %s", client->control->name);
 	}
 	client->control->active_slowsync = 0;
+	engine->sync_clients = jack_slist_remove (engine->sync_clients, client);
 	engine->control->sync_clients--;
 	assert (engine->control->sync_clients >= 0);
 }
@@ -82,11 +167,10 @@ jack_sync_poll_stop (jack_engine_t *engine)
 	JSList *node;
 	long poll_count = 0;            /* count sync_poll clients */
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
+	for (node = engine->sync_clients; node; node = jack_slist_next (node)) {
 		jack_client_internal_t *client =
 			(jack_client_internal_t*)node->data;
-		if (client->control->active_slowsync &&
-		    client->control->sync_poll) {
+		if (client->control->sync_poll) {
 			client->control->sync_poll = 0;
 			poll_count++;
 		}
@@ -112,13 +196,11 @@ jack_sync_poll_start (jack_engine_t *engine)
 	JSList *node;
 	long sync_count = 0;            /* count slow-sync clients */
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
+	for (node = engine->sync_clients; node; node = jack_slist_next (node)) {
 		jack_client_internal_t *client =
 			(jack_client_internal_t*)node->data;
-		if (client->control->active_slowsync) {
-			client->control->sync_poll = 1;
-			sync_count++;
-		}
+		client->control->sync_poll = 1;
+		sync_count++;
 	}
 
 	//JOQ: check invariant for debugging...
@@ -160,7 +242,9 @@ jack_set_sample_rate (jack_engine_t *engine, jack_nframes_t nframes)
 {
 	jack_control_t *ectl = engine->control;
 
+	jack_transport_write_begin (ectl);
 	ectl->current_time.frame_rate = nframes;
+	jack_transport_write_end (ectl);
 	ectl->pending_time.frame_rate = nframes;
 	return 0;
 }
@@ -253,8 +337,7 @@ jack_transport_activate (jack_engine_t *engine, jack_client_internal_t *client)
 {
 	if (client->control->is_slowsync) {
 		assert (!client->control->active_slowsync);
-		client->control->active_slowsync = 1;
-		engine->control->sync_clients++;
+		jack_sync_client_add (engine, client);
 		jack_sync_poll_new (engine, client);
 	}
 
@@ -270,13 +353,20 @@ jack_transport_init (jack_engine_t *engine)
 	jack_control_t *ectl = engine->control;
 
 	engine->timebase_client = NULL;
+	engine->sync_clients = NULL;
 	ectl->transport_state = JackTransportStopped;
 	ectl->transport_cmd = TransportCommandStop;
 	ectl->previous_cmd = TransportCommandStop;
 	memset (&ectl->current_time, 0, sizeof(ectl->current_time));
+	ectl->position_seq = 0;
 	memset (&ectl->pending_time, 0, sizeof(ectl->pending_time));
 	memset (&ectl->request_time, 0, sizeof(ectl->request_time));
 	ectl->prev_request = 0;
+	ectl->transport_nevents = 0;
+	memset (&ectl->locate_at_request, 0, sizeof(ectl->locate_at_request));
+	ectl->prev_locate_at = 0;
+	ectl->locate_at_armed = 0;
+	ectl->pending_jump = 0;
 	ectl->seq_number = 1;           /* can't start at 0 */
 	ectl->new_pos = 0;
 	ectl->pending_pos = 0;
@@ -301,7 +391,9 @@ jack_transport_client_exit (jack_engine_t *engine,
 			engine->timebase_client = NULL;
 			VERBOSE (engine, "timebase master exit");
 		}
+		jack_transport_write_begin (engine->control);
 		engine->control->current_time.valid = 0;
+		jack_transport_write_end (engine->control);
 		engine->control->pending_time.valid = 0;
 	}
 
@@ -389,8 +481,7 @@ jack_transport_client_set_sync (jack_engine_t *engine,
 		if (!client->control->is_slowsync) {
 			client->control->is_slowsync = 1;
 			if (client->control->active) {
-				client->control->active_slowsync = 1;
-				engine->control->sync_clients++;
+				jack_sync_client_add (engine, client);
 			}
 		}
 
@@ -420,6 +511,14 @@ jack_transport_cycle_end (jack_engine_t *engine)
 {
 	jack_control_t *ectl = engine->control;
 	transport_command_t cmd;        /* latest transport command */
+	jack_position_t request;
+	jack_transport_state_t prev_state = ectl->transport_state;
+	jack_position_bits_t prev_bbt = ectl->current_time.valid & JackPositionBBT;
+	float prev_beats_per_bar = ectl->current_time.beats_per_bar;
+	float prev_beat_type = ectl->current_time.beat_type;
+	double prev_beats_per_minute = ectl->current_time.beats_per_minute;
+	jack_nframes_t jump_offset = 0;
+	int jump = 0;
 
 	/* Promote pending_time to current_time.  Maintain the usecs,
 	 * frame_rate and frame values, clients may not set them. */
@@ -427,7 +526,9 @@ jack_transport_cycle_end (jack_engine_t *engine)
 	ectl->pending_time.usecs = ectl->current_time.usecs;
 	ectl->pending_time.frame_rate = ectl->current_time.frame_rate;
 	ectl->pending_time.frame = ectl->pending_frame;
+	jack_transport_write_begin (ectl);
 	ectl->current_time = ectl->pending_time;
+	jack_transport_write_end (ectl);
 	ectl->new_pos = ectl->pending_pos;
 
 	/* check sync results from previous cycle */
@@ -511,29 +612,87 @@ jack_transport_cycle_end (jack_engine_t *engine)
 			ectl->current_time.frame + ectl->buffer_size;
 	}
 
+	/* A locate armed with jack_transport_locate_at() happens inside
+	 * the cycle that reaches its frame while rolling: from there on
+	 * that cycle plays the new position, so the one after starts
+	 * where that left off. It goes to the clients as an event; it
+	 * is not a reposition, and slow-sync clients are not polled.
+	 */
+	jack_transport_locate_at_poll (engine);
+	ectl->pending_jump = 0;
+	if (ectl->locate_at_armed) {
+		if (ectl->transport_state != JackTransportRolling) {
+			if (prev_state == JackTransportRolling) {
+				ectl->locate_at_armed = 0;
+			}
+		} else if (ectl->locate_at_when - ectl->current_time.frame
+			   < ectl->buffer_size) {
+			jump_offset = ectl->locate_at_when - ectl->current_time.frame;
+			ectl->pending_time.frame = ectl->locate_at_frame
+						   + ectl->buffer_size - jump_offset;
+			ectl->locate_at_armed = 0;
+			ectl->pending_jump = 1;
+			jump = 1;
+		}
+	}
+
 	/* See if an asynchronous position request arrived during the
 	 * last cycle.  The request_time could change during the
-	 * guarded copy.  If so, we use the newest request. */
+	 * guarded copy.  If so, we use the newest request, or if it
+	 * keeps changing, leave it for the next cycle. */
 	ectl->pending_pos = 0;
-	if (ectl->request_time.unique_1 != ectl->prev_request) {
-		jack_transport_copy_position (&ectl->request_time,
-					      &ectl->pending_time);
+	if (ectl->request_time.unique_1 != ectl->prev_request &&
+	    jack_transport_copy_position (&ectl->request_time, &request) == 0) {
+		ectl->pending_time = request;
 		VERBOSE (engine, "new transport position: %" PRIu32
 			 ", id=0x%" PRIx64, ectl->pending_time.frame,
 			 ectl->pending_time.unique_1);
 		ectl->prev_request = ectl->pending_time.unique_1;
 		ectl->pending_pos = 1;
+		ectl->locate_at_armed = 0;
 	}
 
 	/* clients can't set pending frame number, so save it here */
 	ectl->pending_frame = ectl->pending_time.frame;
+
+	/* what the next cycle sees change */
+	jack_transport_write_begin (ectl);
+	ectl->transport_nevents = 0;
+	if (ectl->transport_state != prev_state) {
+		if (ectl->transport_state == JackTransportRolling) {
+			jack_transport_event_add (ectl, JackTransportEventStart,
+						  0, ectl->current_time.frame);
+		} else if (prev_state == JackTransportRolling) {
+			jack_transport_event_add (ectl, JackTransportEventStop,
+						  0, ectl->current_time.frame);
+		}
+	}
+	if (ectl->new_pos) {
+		jack_transport_event_add (ectl, JackTransportEventLocate,
+					  0, ectl->current_time.frame);
+	}
+	if ((ectl->current_time.valid & JackPositionBBT) != prev_bbt ||
+	    (prev_bbt &&
+	     (ectl->current_time.beats_per_bar != prev_beats_per_bar ||
+	      ectl->current_time.beat_type != prev_beat_type ||
+	      ectl->current_time.beats_per_minute != prev_beats_per_minute))) {
+		jack_transport_event_add (ectl, JackTransportEventTempo,
+					  0, ectl->current_time.frame);
+	}
+	if (jump) {
+		jack_transport_event_add (ectl, JackTransportEventLocate,
+					  jump_offset, ectl->locate_at_frame);
+	}
+	jack_transport_write_end (ectl);
 }
 
 /* driver callback at start of cycle */
 void
 jack_transport_cycle_start (jack_engine_t *engine, jack_time_t time)
 {
+	jack_transport_write_begin (engine->control);
 	engine->control->current_time.usecs = time;
+	jack_transport_write_end (engine->control);
 }
 
 /* on SetSyncTimeout request */
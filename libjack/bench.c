@@ -0,0 +1,669 @@
+/*
+    Microbenchmarks for the libjack hot paths.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+    Built and run by `make bench'; not installed. The ringbuffer and
+    memops code is timed on its own. Port mixdown, port lookup and
+    frame time need a server: the benchmark opens two clients on the
+    one that is running (it never starts one), and reports those
+    groups as skipped if there is none. Results go to stdout as one
+    JSON object, so that runs can be kept and compared.
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <jack/ringbuffer.h>
+
+#include "memops.h"
+
+#define BENCH_ROUNDS       5
+#define BENCH_MAX_SOURCES  64
+#define BENCH_MIDI_EVENTS  16
+
+typedef void (*bench_func_t)(void *arg);
+
+static double bench_seconds = 0.1;      /* per benchmark, all rounds */
+static int bench_nresults = 0;
+
+static double
+bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+bench_cmp (const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Run `func' in batches, doubling the batch until a round lasts its
+   share of bench_seconds, and print the best and median round as one
+   result. `param' names the one thing the result depends on (NULL if
+   nothing does).
+ */
+static void
+bench_run (const char *name, const char *param, long value,
+	   bench_func_t func, void *arg)
+{
+	double round_ns = bench_seconds * 1e9 / BENCH_ROUNDS;
+	double ns[BENCH_ROUNDS];
+	double start, elapsed;
+	unsigned long batch = 1, ops = 0, i;
+	int r;
+
+	/* warm up, and find a batch long enough to time */
+	for (;; ) {
+		start = bench_now ();
+		for (i = 0; i < batch; i++) {
+			func (arg);
+		}
+		elapsed = bench_now () - start;
+		if (elapsed > round_ns / 16 || batch >= (1UL << 30)) {
+			break;
+		}
+		batch *= 2;
+	}
+
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		unsigned long n = 0;
+
+		start = bench_now ();
+		do {
+			for (i = 0; i < batch; i++) {
+				func (arg);
+			}
+			n += batch;
+			elapsed = bench_now () - start;
+		} while (elapsed < round_ns);
+
+		ns[r] = elapsed / n;
+		ops += n;
+	}
+
+	qsort (ns, BENCH_ROUNDS, sizeof(double), bench_cmp);
+
+	printf ("%s\n    {\"name\": \"%s\"", bench_nresults++ ? "," : "", name);
+	if (param) {
+		printf (", \"%s\": %ld", param, value);
+	}
+	printf (", \"ns_per_op\": %.2f, \"ns_per_op_median\": %.2f, \"ops\": %lu}",
+		ns[0], ns[BENCH_ROUNDS / 2], ops);
+	fflush (stdout);
+}
+
+/* ---- ringbuffer ---- */
+
+typedef struct {
+	jack_ringbuffer_t *rb;
+	char *data;
+	size_t bytes;
+} bench_ringbuffer_t;
+
+static void
+bench_ringbuffer_write_read (void *arg)
+{
+	bench_ringbuffer_t *b = (bench_ringbuffer_t*)arg;
+
+	jack_ringbuffer_write (b->rb, b->data, b->bytes);
+	jack_ringbuffer_read (b->rb, b->data, b->bytes);
+}
+
+static void
+bench_ringbuffer_vectors (void *arg)
+{
+	bench_ringbuffer_t *b = (bench_ringbuffer_t*)arg;
+	jack_ringbuffer_data_t vec[2];
+
+	jack_ringbuffer_get_write_vector (b->rb, vec);
+	jack_ringbuffer_write_advance (b->rb, b->bytes);
+	jack_ringbuffer_get_read_vector (b->rb, vec);
+	jack_ringbuffer_read_advance (b->rb, b->bytes);
+}
+
+static void
+bench_ringbuffer_space (void *arg)
+{
+	bench_ringbuffer_t *b = (bench_ringbuffer_t*)arg;
+	volatile size_t space;
+
+	space = jack_ringbuffer_write_space (b->rb);
+	space = jack_ringbuffer_read_space (b->rb);
+	(void)space;
+}
+
+static void
+bench_ringbuffer (void)
+{
+	static const size_t sizes[] = { 4, 64, 1024, 16384 };
+	bench_ringbuffer_t b;
+	unsigned int i;
+
+	b.rb = jack_ringbuffer_create (1 << 16);
+	b.data = (char*)calloc (1, 16384);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		b.bytes = sizes[i];
+		bench_run ("ringbuffer.write_read", "bytes", b.bytes,
+			   bench_ringbuffer_write_read, &b);
+	}
+
+	b.bytes = 64;
+	bench_run ("ringbuffer.vectors", "bytes", b.bytes,
+		   bench_ringbuffer_vectors, &b);
+	bench_run ("ringbuffer.space", NULL, 0,
+		   bench_ringbuffer_space, &b);
+
+	free (b.data);
+	jack_ringbuffer_free (b.rb);
+}
+
+/* ---- memops ---- */
+
+#define BENCH_MEMOPS_CHANNELS 2
+
+typedef struct {
+	jack_default_audio_sample_t *src[BENCH_MEMOPS_CHANNELS];
+	jack_default_audio_sample_t *dst;
+	char *hw[BENCH_MEMOPS_CHANNELS];
+	unsigned long skip[BENCH_MEMOPS_CHANNELS];
+	unsigned long nframes;
+	sample_read_func_t read;
+	sample_write_func_t write;
+	sample_write_multi_func_t write_multi;
+	dither_state_t state[BENCH_MEMOPS_CHANNELS];
+} bench_memops_t;
+
+static void
+bench_memops_write (void *arg)
+{
+	bench_memops_t *b = (bench_memops_t*)arg;
+
+	b->write (b->hw[0], b->src[0], b->nframes, b->skip[0], b->state);
+}
+
+static void
+bench_memops_read (void *arg)
+{
+	bench_memops_t *b = (bench_memops_t*)arg;
+
+	b->read (b->dst, b->hw[0], b->nframes, b->skip[0]);
+}
+
+static void
+bench_memops_write_multi (void *arg)
+{
+	bench_memops_t *b = (bench_memops_t*)arg;
+
+	b->write_multi (b->hw, b->src, BENCH_MEMOPS_CHANNELS, b->nframes,
+			b->skip, b->state);
+}
+
+typedef struct {
+	const char *name;
+	sample_write_func_t write;
+	sample_read_func_t read;
+	unsigned long bytes;                    /* per sample */
+	int simd;
+} bench_memops_func_t;
+
+static void
+bench_memops (unsigned long nframes, int simd)
+{
+	static const bench_memops_func_t funcs[] = {
+		{ "memops.d16_sS", sample_move_d16_sS, NULL, 2, 0 },
+		{ "memops.d16_sS_simd", sample_move_d16_sS_simd, NULL, 2, 1 },
+		{ "memops.d24_sS", sample_move_d24_sS, NULL, 3, 0 },
+		{ "memops.d24_sS_simd", sample_move_d24_sS_simd, NULL, 3, 1 },
+		{ "memops.d32u24_sS", sample_move_d32u24_sS, NULL, 4, 0 },
+		{ "memops.d32u24_sS_simd", sample_move_d32u24_sS_simd, NULL, 4, 1 },
+		{ "memops.d32l24_sS", sample_move_d32l24_sS, NULL, 4, 0 },
+		{ "memops.d32l24_sS_simd", sample_move_d32l24_sS_simd, NULL, 4, 1 },
+		{ "memops.d64f_sS", sample_move_d64f_sS, NULL, 8, 0 },
+		{ "memops.dither_tri_d16_sS", sample_move_dither_tri_d16_sS, NULL, 2, 0 },
+		{ "memops.dither_shaped_d16_sS", sample_move_dither_shaped_d16_sS, NULL, 2, 0 },
+		{ "memops.dS_s16", NULL, sample_move_dS_s16, 2, 0 },
+		{ "memops.dS_s16_simd", NULL, sample_move_dS_s16_simd, 2, 1 },
+		{ "memops.dS_s24", NULL, sample_move_dS_s24, 3, 0 },
+		{ "memops.dS_s24_simd", NULL, sample_move_dS_s24_simd, 3, 1 },
+		{ "memops.dS_s32u24", NULL, sample_move_dS_s32u24, 4, 0 },
+		{ "memops.dS_s32u24_simd", NULL, sample_move_dS_s32u24_simd, 4, 1 },
+		{ "memops.dS_s32l24", NULL, sample_move_dS_s32l24, 4, 0 },
+		{ "memops.dS_s32l24_simd", NULL, sample_move_dS_s32l24_simd, 4, 1 },
+		{ "memops.dS_s64f", NULL, sample_move_dS_s64f, 8, 0 },
+	};
+	bench_memops_t b;
+	unsigned long i;
+	int c;
+
+	memset (&b, 0, sizeof(b));
+	b.nframes = nframes;
+	b.dst = (jack_default_audio_sample_t*)
+		calloc (nframes, sizeof(jack_default_audio_sample_t));
+
+	/* interleaved stereo, as most hardware buffers are */
+	for (c = 0; c < BENCH_MEMOPS_CHANNELS; c++) {
+		b.src[c] = (jack_default_audio_sample_t*)
+			   malloc (nframes * sizeof(jack_default_audio_sample_t));
+		for (i = 0; i < nframes; i++) {
+			b.src[c][i] = 0.9f * sinf (i * 0.01f * (c + 1));
+		}
+		b.state[c].depth = 16;
+	}
+	b.hw[0] = (char*)calloc (nframes * BENCH_MEMOPS_CHANNELS, 8);
+
+	for (i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++) {
+		if (funcs[i].simd && !simd) {
+			continue;
+		}
+		b.skip[0] = funcs[i].bytes * BENCH_MEMOPS_CHANNELS;
+		if (funcs[i].write) {
+			b.write = funcs[i].write;
+			bench_run (funcs[i].name, "frames", nframes,
+				   bench_memops_write, &b);
+		} else {
+			b.read = funcs[i].read;
+			bench_run (funcs[i].name, "frames", nframes,
+				   bench_memops_read, &b);
+		}
+	}
+
+	for (c = 1; c < BENCH_MEMOPS_CHANNELS; c++) {
+		b.hw[c] = b.hw[0] + c * 2;
+	}
+	for (c = 0; c < BENCH_MEMOPS_CHANNELS; c++) {
+		b.skip[c] = 2 * BENCH_MEMOPS_CHANNELS;
+	}
+	b.write_multi = sample_move_dither_tri_d16_sS_multi;
+	bench_run ("memops.dither_tri_d16_sS_multi", "frames", nframes,
+		   bench_memops_write_multi, &b);
+	b.write_multi = sample_move_dither_shaped_d16_sS_multi;
+	bench_run ("memops.dither_shaped_d16_sS_multi", "frames", nframes,
+		   bench_memops_write_multi, &b);
+
+	for (c = 0; c < BENCH_MEMOPS_CHANNELS; c++) {
+		free (b.src[c]);
+	}
+	free (b.hw[0]);
+	free (b.dst);
+}
+
+/* ---- things that need a server ---- */
+
+typedef struct {
+	jack_client_t *client;          /* owns the inputs */
+	jack_client_t *source;          /* owns the outputs */
+	jack_port_t *in;
+	jack_port_t *out[BENCH_MAX_SOURCES];
+	jack_nframes_t nframes;
+	const char *pattern;
+	char name[JACK_PORT_NAME_SIZE];
+} bench_server_t;
+
+/* connections are seen by the client after jack_connect() returns,
+   once its event thread has heard about them */
+static int
+bench_wait_connected (jack_port_t *port, int n)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		if (jack_port_connected (port) == n) {
+			return 0;
+		}
+		usleep (1000);
+	}
+
+	return -1;
+}
+
+static void
+bench_get_buffer (void *arg)
+{
+	bench_server_t *b = (bench_server_t*)arg;
+
+	jack_port_get_buffer (b->in, b->nframes);
+}
+
+/* Mix `ports' output ports of `type' into one input, for each number
+   of connections in `counts'. There is no process callback: the
+   buffers are filled once with fill(), and mixed by asking for the
+   input's buffer as process() would.
+ */
+static void
+bench_mixdown (bench_server_t *b, const char *name, const char *type,
+	       const int *counts, int ncounts,
+	       void (*fill)(void *buffer, int n, jack_nframes_t nframes))
+{
+	char port_name[32];
+	int i, n, connected = 0;
+
+	if ((b->in = jack_port_register (b->client, "in", type,
+					 JackPortIsInput, 0)) == NULL) {
+		return;
+	}
+
+	for (i = 0; i < counts[ncounts - 1]; i++) {
+		snprintf (port_name, sizeof(port_name), "out%d", i);
+		if ((b->out[i] = jack_port_register (b->source, port_name, type,
+						     JackPortIsOutput, 0)) == NULL) {
+			break;
+		}
+		fill (jack_port_get_buffer (b->out[i], b->nframes), i, b->nframes);
+	}
+
+	for (n = 0; n < ncounts && counts[n] <= i; n++) {
+		while (connected < counts[n]) {
+			if (jack_connect (b->client, jack_port_name (b->out[connected]),
+					  jack_port_name (b->in))) {
+				goto out;
+			}
+			connected++;
+		}
+		if (bench_wait_connected (b->in, connected)) {
+			goto out;
+		}
+		bench_run (name, "connections", connected, bench_get_buffer, b);
+	}
+
+out:
+	while (i--) {
+		jack_port_unregister (b->source, b->out[i]);
+	}
+	jack_port_unregister (b->client, b->in);
+}
+
+static void
+bench_fill_audio (void *buffer, int n, jack_nframes_t nframes)
+{
+	jack_default_audio_sample_t *samples =
+		(jack_default_audio_sample_t*)buffer;
+	jack_nframes_t i;
+
+	for (i = 0; i < nframes; i++) {
+		samples[i] = 0.01f * sinf (i * 0.01f * (n + 1));
+	}
+}
+
+static void
+bench_fill_midi (void *buffer, int n, jack_nframes_t nframes)
+{
+	jack_midi_data_t note[3] = { 0x90, 60, 100 };
+	int i;
+
+	jack_midi_clear_buffer (buffer);
+	for (i = 0; i < BENCH_MIDI_EVENTS; i++) {
+		note[1] = (jack_midi_data_t)(n + i) & 0x7f;
+		jack_midi_event_write (buffer, (i * nframes / BENCH_MIDI_EVENTS + n)
+				       % nframes, note, sizeof(note));
+	}
+}
+
+static void
+bench_get_ports (void *arg)
+{
+	bench_server_t *b = (bench_server_t*)arg;
+
+	jack_free (jack_get_ports (b->client, b->pattern, NULL, 0));
+}
+
+static void
+bench_port_by_name (void *arg)
+{
+	bench_server_t *b = (bench_server_t*)arg;
+
+	jack_port_by_name (b->client, b->name);
+}
+
+/* Look ports up with `nports' more of them registered than the server
+   had already. */
+static void
+bench_lookup (bench_server_t *b, int nports)
+{
+	jack_port_t **ports;
+	char port_name[32];
+	char pattern[JACK_CLIENT_NAME_SIZE + 8];
+	int i;
+
+	if ((ports = (jack_port_t**)calloc (nports, sizeof(jack_port_t*))) == NULL) {
+		return;
+	}
+
+	for (i = 0; i < nports; i++) {
+		snprintf (port_name, sizeof(port_name), "p%d", i);
+		if ((ports[i] = jack_port_register (b->source, port_name,
+						    JACK_DEFAULT_AUDIO_TYPE,
+						    JackPortIsOutput, 0)) == NULL) {
+			/* port_max */
+			break;
+		}
+	}
+	nports = i;
+
+	if (nports) {
+		b->pattern = NULL;
+		bench_run ("ports.get_ports_all", "ports", nports,
+			   bench_get_ports, b);
+
+		snprintf (pattern, sizeof(pattern), "^%s:p1",
+			  jack_get_client_name (b->source));
+		b->pattern = pattern;
+		bench_run ("ports.get_ports_pattern", "ports", nports,
+			   bench_get_ports, b);
+
+		snprintf (b->name, sizeof(b->name), "%s",
+			  jack_port_name (ports[nports - 1]));
+		bench_run ("ports.port_by_name", "ports", nports,
+			   bench_port_by_name, b);
+
+		snprintf (b->name, sizeof(b->name), "%s:none",
+			  jack_get_client_name (b->source));
+		bench_run ("ports.port_by_name_missing", "ports", nports,
+			   bench_port_by_name, b);
+	}
+
+	while (i--) {
+		jack_port_unregister (b->source, ports[i]);
+	}
+	free (ports);
+}
+
+static void
+bench_frame_time (void *arg)
+{
+	jack_frame_time (((bench_server_t*)arg)->client);
+}
+
+static void
+bench_last_frame_time (void *arg)
+{
+	jack_last_frame_time (((bench_server_t*)arg)->client);
+}
+
+static void
+bench_frames_since_cycle_start (void *arg)
+{
+	jack_frames_since_cycle_start (((bench_server_t*)arg)->client);
+}
+
+static void
+bench_get_cycle_times (void *arg)
+{
+	jack_nframes_t frames;
+	jack_time_t usecs, next_usecs;
+	float period_usecs;
+
+	jack_get_cycle_times (((bench_server_t*)arg)->client, &frames,
+			      &usecs, &next_usecs, &period_usecs);
+}
+
+static void
+bench_frames_to_time (void *arg)
+{
+	bench_server_t *b = (bench_server_t*)arg;
+
+	jack_frames_to_time (b->client, jack_last_frame_time (b->client));
+}
+
+static void
+bench_time_to_frames (void *arg)
+{
+	bench_server_t *b = (bench_server_t*)arg;
+
+	jack_time_to_frames (b->client, jack_get_time ());
+}
+
+static void
+bench_frame_times (bench_server_t *b)
+{
+	bench_run ("time.frame_time", NULL, 0, bench_frame_time, b);
+	bench_run ("time.last_frame_time", NULL, 0, bench_last_frame_time, b);
+	bench_run ("time.frames_since_cycle_start", NULL, 0,
+		   bench_frames_since_cycle_start, b);
+	bench_run ("time.get_cycle_times", NULL, 0, bench_get_cycle_times, b);
+	bench_run ("time.frames_to_time", NULL, 0, bench_frames_to_time, b);
+	bench_run ("time.time_to_frames", NULL, 0, bench_time_to_frames, b);
+}
+
+static void
+usage (FILE *f)
+{
+	fprintf (f, "usage: jack_bench [ -t seconds ] [ -n frames ] [ -p ports ] [ -s ]\n"
+		 "  -t  time spent on each benchmark (default 0.1)\n"
+		 "  -n  frames per memops call (default 1024)\n"
+		 "  -p  ports registered for the lookup benchmarks (default 1024)\n"
+		 "  -s  do not use a server, even if one is running\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	static const int audio_counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+	static const int midi_counts[] = { 1, 2, 4, 8, 16 };
+	bench_server_t b;
+	jack_status_t status;
+	const char *simd;
+	unsigned long nframes = 1024;
+	int nports = 1024;
+	int no_server = 0;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "t:n:p:sh")) != -1) {
+		switch (opt) {
+		case 't':
+			bench_seconds = atof (optarg);
+			break;
+		case 'n':
+			nframes = strtoul (optarg, NULL, 0);
+			break;
+		case 'p':
+			nports = atoi (optarg);
+			break;
+		case 's':
+			no_server = 1;
+			break;
+		case 'h':
+			usage (stdout);
+			return 0;
+		default:
+			usage (stderr);
+			return 1;
+		}
+	}
+
+	if (bench_seconds <= 0 || nframes == 0 || nports < 0) {
+		usage (stderr);
+		return 1;
+	}
+
+	memset (&b, 0, sizeof(b));
+
+	/* opening a client is also what sets up the SIMD code, so do it
+	   before timing memops */
+	if (!no_server) {
+		b.client = jack_client_open ("bench", JackNoStartServer, &status);
+		b.source = jack_client_open ("bench_src", JackNoStartServer, &status);
+		if (b.client && b.source &&
+		    (jack_activate (b.client) || jack_activate (b.source))) {
+			fprintf (stderr, "jack_bench: cannot activate clients\n");
+			jack_client_close (b.source);
+			b.source = NULL;
+		}
+		if (b.client && !b.source) {
+			jack_client_close (b.client);
+			b.client = NULL;
+		}
+	}
+
+	simd = memops_simd_init ();
+
+	printf ("{\n  \"simd\": ");
+	if (simd) {
+		printf ("\"%s\"", simd);
+	} else {
+		printf ("null");
+	}
+	if (b.client) {
+		b.nframes = jack_get_buffer_size (b.client);
+		printf (",\n  \"server\": {\"buffer_size\": %u, \"sample_rate\": %u}",
+			b.nframes, jack_get_sample_rate (b.client));
+	} else {
+		printf (",\n  \"server\": null");
+	}
+	printf (",\n  \"results\": [");
+
+	bench_ringbuffer ();
+	bench_memops (nframes, simd != NULL);
+
+	if (b.client) {
+		bench_mixdown (&b, "mixdown.audio", JACK_DEFAULT_AUDIO_TYPE,
+			       audio_counts,
+			       sizeof(audio_counts) / sizeof(audio_counts[0]),
+			       bench_fill_audio);
+		bench_mixdown (&b, "mixdown.midi", JACK_DEFAULT_MIDI_TYPE,
+			       midi_counts,
+			       sizeof(midi_counts) / sizeof(midi_counts[0]),
+			       bench_fill_midi);
+		bench_lookup (&b, nports);
+		bench_frame_times (&b);
+
+		jack_client_close (b.source);
+		jack_client_close (b.client);
+	}
+
+	printf ("\n  ]");
+	if (!b.client) {
+		printf (",\n  \"skipped\": [\"mixdown\", \"ports\", \"time\"]");
+	}
+	printf ("\n}\n");
+
+	return 0;
+}
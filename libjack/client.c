@@ -38,6 +38,9 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include <jack/jack.h>
 #include <jack/jslist.h>
@@ -53,6 +56,7 @@
 #include "varargs.h"
 #include "intsimd.h"
 #include "messagebuffer.h"
+#include "probes.h"
 
 #include <sysdeps/time.h>
 
@@ -84,14 +88,17 @@ typedef struct {
 
 #ifdef USE_DYNSIMD
 
-#ifdef ARCH_X86
-
 int cpu_type = 0;
 
+#ifdef ARCH_X86
+
 static void
 init_cpu ()
 {
 	cpu_type = ((have_3dnow () << 8) | have_sse ());
+	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		cpu_type |= have_avx ();
+	}
 #if 0
 	if (ARCH_X86_HAVE_3DNOW (cpu_type)) {
 		jack_debug ("Enhanced3DNow! detected");
@@ -103,7 +110,16 @@ init_cpu ()
 		jack_debug ("No supported SIMD instruction sets detected");
 	}
 #endif
-	jack_port_set_funcs ();
+	jack_simd_init ();
+}
+
+#elif defined(ARCH_ARM64)
+
+static void
+init_cpu ()
+{
+	cpu_type = have_neon ();
+	jack_simd_init ();
 }
 
 #else /* ARCH_X86 */
@@ -111,7 +127,7 @@ init_cpu ()
 static void
 init_cpu ()
 {
-	jack_port_set_funcs ();
+	jack_simd_init ();
 }
 
 #endif  /* ARCH_X86 */
@@ -142,6 +158,58 @@ write_retry(int fd, const void *src, int size)
 	return (error);
 }
 
+/* read the server's answer to a connection request, and the event
+   socket that comes with it for an external client (see
+   jack_send_connect_result() in jackd/clientengine.c).
+ */
+static int
+read_connect_result (int fd, jack_client_connect_result_t *res, int *ev_fd)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE (sizeof(int))];
+	int n, got;
+
+	*ev_fd = -1;
+
+	memset (&msg, 0, sizeof(msg));
+	iov.iov_base = res;
+	iov.iov_len = sizeof(*res);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	do {
+		n = recvmsg (fd, &msg, 0);
+	} while (n == -1 && errno == EINTR);
+
+	if (n <= 0) {
+		return n;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy (ev_fd, CMSG_DATA (cmsg), sizeof(int));
+		}
+	}
+
+	for (got = n; got < (int)sizeof(*res); got += n) {
+		if ((n = read_retry (fd, (char*)res + got,
+				     sizeof(*res) - got)) <= 0) {
+			if (*ev_fd >= 0) {
+				close (*ev_fd);
+				*ev_fd = -1;
+			}
+			return n;
+		}
+	}
+
+	return got;
+}
+
 const char *
 jack_get_tmpdir ()
 {
@@ -269,19 +337,87 @@ jack_info (const char *fmt, ...)
 	va_end (ap);
 }
 
+#if JACK_HAVE_FUTEX
+/* see jack_client_request_slot() */
+static int
+oop_client_deliver_shm_request (jack_client_t *client, jack_request_t *req,
+				int size)
+{
+	jack_client_control_t *ctl = client->control;
+	jack_request_t *slot = jack_client_request_slot (ctl);
+	struct timespec ts;
+	char bell = 0;
+
+	slot->type = req->type;
+	memcpy (&slot->x, &req->x, size);
+
+	__atomic_store_n (&ctl->request_state, JackRequestPosted,
+			  __ATOMIC_RELEASE);
+
+	if (write_retry (client->request_fd, &bell, 1) != 1) {
+		ctl->request_state = JackRequestIdle;
+		req->status = -1;
+		if (client->engine->engine_ok) {
+			jack_error ("cannot send request type %d to server",
+				    req->type);
+		}
+		return req->status;
+	}
+
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+
+	while (__atomic_load_n (&ctl->request_state, __ATOMIC_ACQUIRE)
+	       == JackRequestPosted) {
+		if (client->engine->engine_ok == 0) {
+			break;
+		}
+		if (jack_futex_wait (&ctl->request_state, JackRequestPosted,
+				     &ts) < 0
+		    && errno != ETIMEDOUT && errno != EAGAIN && errno != EINTR) {
+			jack_error ("cannot wait for result of request type %d "
+				    "(%s)", req->type, strerror (errno));
+			break;
+		}
+	}
+
+	if (ctl->request_state != JackRequestDone) {
+		/* the server is gone, or we are: the slot is useless now */
+		req->status = -1;
+		return req->status;
+	}
+
+	memcpy (&req->x, &slot->x, size);
+	req->status = slot->status;
+	ctl->request_state = JackRequestIdle;
+
+	return req->status;
+}
+#endif  /* JACK_HAVE_FUTEX */
+
 static int
 oop_client_deliver_request (void *ptr, jack_request_t *req)
 {
 	int wok, rok;
 	jack_client_t *client = (jack_client_t*)ptr;
+	jack_port_id_t *port_ids = NULL;
+
+#if JACK_HAVE_FUTEX
+	int size;
+
+	if ((size = jack_request_payload (req->type)) >= 0) {
+		return oop_client_deliver_shm_request (client, req, size);
+	}
+#endif
 
 	wok = (write_retry (client->request_fd, req, sizeof(*req))
 	       == sizeof(*req));
 
-	/* if necessary, add variable length key data after a PropertyChange request
+	/* if necessary, add variable length key data after a property request
 	 */
 
-	if (req->type == PropertyChangeNotify) {
+	if (req->type == PropertyChangeNotify || req->type == SetProperty ||
+	    req->type == RemoveProperties) {
 		if (req->x.property.keylen) {
 			if (write_retry (client->request_fd, req->x.property.key, req->x.property.keylen) != req->x.property.keylen) {
 				jack_error ("cannot send property key of length %d to server",
@@ -292,9 +428,58 @@ oop_client_deliver_request (void *ptr, jack_request_t *req)
 		}
 	}
 
+	/* same for the port names of a batched (dis)connection */
+
+	if (req->type == ConnectPortsBatch || req->type == DisconnectPortsBatch) {
+		int size = 2 * req->x.batch.npairs * JACK_PORT_NAME_SIZE;
+		if (size && write_retry (client->request_fd, req->x.batch.ports, size) != size) {
+			jack_error ("cannot send %" PRIu32 " port pairs to server",
+				    req->x.batch.npairs);
+			req->status = -1;
+			return req->status;
+		}
+	}
+
+	/* and the names or ids of a batched port (un)registration */
+
+	if (req->type == RegisterPorts || req->type == UnRegisterPorts) {
+		int size;
+		const void *data;
+
+		port_ids = req->x.port_batch.port_ids;
+
+		if (req->type == RegisterPorts) {
+			size = req->x.port_batch.nports * JACK_PORT_NAME_SIZE;
+			data = req->x.port_batch.names;
+		} else {
+			size = req->x.port_batch.nports * sizeof(jack_port_id_t);
+			data = port_ids;
+		}
+
+		if (size && write_retry (client->request_fd, data, size) != size) {
+			jack_error ("cannot send %" PRIu32 " ports to server",
+				    req->x.port_batch.nports);
+			req->status = -1;
+			return req->status;
+		}
+	}
+
 	rok = (read_retry (client->request_fd, req, sizeof(*req))
 	       == sizeof(*req));
 
+	/* the ids of registered ports follow the result */
+
+	if (rok && req->type == RegisterPorts && req->status == 0) {
+		int size = req->x.port_batch.nports * sizeof(jack_port_id_t);
+		rok = (read_retry (client->request_fd, port_ids, size) == size);
+	}
+
+	if (port_ids) {
+		/* the server sent back its own pointers */
+		req->x.port_batch.port_ids = port_ids;
+		req->x.port_batch.names = NULL;
+	}
+
 	if (wok && rok) {               /* everything OK? */
 		return req->status;
 	}
@@ -335,6 +520,7 @@ jack_client_t *
 jack_client_alloc ()
 {
 	jack_client_t *client;
+	const char *cpus;
 
 	if ((client = (jack_client_t*)calloc (1, sizeof(jack_client_t))) == NULL) {
 		return NULL;
@@ -350,6 +536,8 @@ jack_client_alloc ()
 	client->event_fd = -1;
 	client->upstream_is_jackd = 0;
 	client->graph_next_fd = -1;
+	client->graph_next_slot = -1;
+	client->control_slot = -1;
 	client->ports = NULL;
 	client->ports_ext = NULL;
 	client->engine = NULL;
@@ -361,6 +549,17 @@ jack_client_alloc ()
 	client->on_info_shutdown = NULL;
 	client->n_port_types = 0;
 	client->port_segment = NULL;
+	client->ring_shm.index = JACK_SHM_NULL_INDEX;
+	client->ring_shm.attached_at = MAP_FAILED;
+	client->ring_serial = 0;
+	client->ring_base = NULL;
+	client->port_table = NULL;
+	pthread_mutex_init (&client->ports_cache_lock, NULL);
+
+	if ((cpus = getenv ("JACK_PROCESS_CPUS")) != NULL) {
+		client->process_cpus = strdup (cpus);
+	}
+	client->process_cpu = -1;
 
 #ifdef USE_DYNSIMD
 	init_cpu ();
@@ -375,6 +574,8 @@ jack_client_t *
 jack_client_alloc ()
 {
 	jack_client_t *client;
+	const char *cpus;
+	const char *spin;
 
 	if ((client = (jack_client_t*)calloc (1, sizeof(jack_client_t))) == NULL) {
 		return NULL;
@@ -390,16 +591,36 @@ jack_client_alloc ()
 	client->upstream_is_jackd = 0;
 	client->graph_wait_fd = -1;
 	client->graph_next_fd = -1;
+	client->graph_next_slot = -1;
+	client->control_slot = -1;
 	client->ports = NULL;
 	client->ports_ext = NULL;
 	client->engine = NULL;
 	client->control = NULL;
 	client->thread_ok = FALSE;
+	client->event_thread_ok = FALSE;
 	client->first_active = TRUE;
 	client->on_shutdown = NULL;
 	client->on_info_shutdown = NULL;
 	client->n_port_types = 0;
 	client->port_segment = NULL;
+	client->ring_shm.index = JACK_SHM_NULL_INDEX;
+	client->ring_shm.attached_at = MAP_FAILED;
+	client->ring_serial = 0;
+	client->ring_base = NULL;
+	client->port_table = NULL;
+	pthread_mutex_init (&client->ports_cache_lock, NULL);
+
+	if ((cpus = getenv ("JACK_PROCESS_CPUS")) != NULL) {
+		client->process_cpus = strdup (cpus);
+	}
+	client->process_cpu = -1;
+
+	if ((spin = getenv ("JACK_SPIN_WAIT")) != NULL) {
+		client->spin_usecs = atoi (spin);
+	} else {
+		client->spin_usecs = -1;
+	}
 
 #ifdef USE_DYNSIMD
 	init_cpu ();
@@ -425,17 +646,39 @@ jack_client_alloc_internal (jack_client_control_t *cc, jack_engine_t* engine)
 
 	client->n_port_types = client->engine->n_port_types;
 	client->port_segment = &engine->port_segment[0];
+	client->port_table = &engine->port_table;
+
+#ifdef USE_DYNSIMD
+	jack_simd_set_length (client->engine->buffer_size);
+#endif  /* USE_DYNSIMD */
 
 	return client;
 }
 
+static void
+jack_ports_cache_clear (jack_ports_cache_t *entry)
+{
+	free (entry->port_name_pattern);
+	free (entry->type_name_pattern);
+	free (entry->ports);
+	memset (entry, 0, sizeof(*entry));
+}
+
 static void
 jack_client_free (jack_client_t *client)
 {
+	int i;
+
 	if (client->pollfd) {
 		free (client->pollfd);
 	}
 
+	for (i = 0; i < JACK_PORTS_CACHE_SIZE; i++) {
+		jack_ports_cache_clear (&client->ports_cache[i]);
+	}
+	pthread_mutex_destroy (&client->ports_cache_lock);
+
+	free (client->process_cpus);
 	free (client);
 }
 
@@ -455,6 +698,7 @@ jack_client_fix_port_buffers (jack_client_t *client)
 		port = (jack_port_t*)node->data;
 
 		if (port->shared->flags & JackPortIsInput) {
+			port->buffer = NULL;
 			if (port->mix_buffer) {
 				size_t buffer_size =
 					jack_port_type_buffer_size ( port->type_info,
@@ -462,7 +706,7 @@ jack_client_fix_port_buffers (jack_client_t *client)
 				jack_pool_release (port->mix_buffer);
 				port->mix_buffer = NULL;
 				pthread_mutex_lock (&port->connection_lock);
-				if (jack_slist_length (port->connections) > 1) {
+				if (port->nsources > 0) {
 					port->mix_buffer = jack_pool_alloc (buffer_size);
 					port->fptr.buffer_init (port->mix_buffer,
 								buffer_size,
@@ -471,6 +715,13 @@ jack_client_fix_port_buffers (jack_client_t *client)
 				pthread_mutex_unlock (&port->connection_lock);
 			}
 		}
+
+		if (port->async_buffer) {
+			jack_port_set_async (client, port, TRUE);
+		}
+
+		/* what the buffer held was for the old size */
+		port->written = FALSE;
 	}
 }
 
@@ -482,8 +733,15 @@ jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
 	JSList *node;
 	int need_free = FALSE;
 
-	if (jack_uuid_compare (client->engine->ports[event->x.self_id].client_id, client->control->uuid) == 0 ||
-	    jack_uuid_compare (client->engine->ports[event->y.other_id].client_id, client->control->uuid) == 0) {
+	jack_port_shared_t *self_shared = jack_port_shared_by_id (client, event->x.self_id);
+	jack_port_shared_t *other_shared = jack_port_shared_by_id (client, event->y.other_id);
+
+	if (self_shared == NULL || other_shared == NULL) {
+		return 0;
+	}
+
+	if (jack_uuid_compare (self_shared->client_id, client->control->uuid) == 0 ||
+	    jack_uuid_compare (other_shared->client_id, client->control->uuid) == 0) {
 
 		/* its one of ours */
 
@@ -498,8 +756,10 @@ jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
 							    &need_free);
 			pthread_mutex_lock (&control_port->connection_lock);
 
+			/* a single connection needs the mix buffer too,
+			   once it is given a gain */
 			if ((control_port->shared->flags & JackPortIsInput)
-			    && (control_port->connections != NULL)
+			    && (control_port->fptr.mixdown != NULL)
 			    && (control_port->mix_buffer == NULL)  ) {
 				size_t buffer_size =
 					jack_port_type_buffer_size ( control_port->type_info,
@@ -513,6 +773,8 @@ jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
 			control_port->connections =
 				jack_slist_prepend (control_port->connections,
 						    (void*)other);
+			jack_port_update_sources (control_port);
+			control_port->buffer = NULL;
 			pthread_mutex_unlock (&control_port->connection_lock);
 			break;
 
@@ -539,6 +801,8 @@ jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
 					break;
 				}
 			}
+			jack_port_update_sources (control_port);
+			control_port->buffer = NULL;
 
 			pthread_mutex_unlock (&control_port->connection_lock);
 			break;
@@ -587,7 +851,8 @@ jack_client_handle_session_callback (jack_client_t *client, jack_event_t *event)
 }
 
 static void
-jack_port_recalculate_latency (jack_port_t *port, jack_latency_callback_mode_t mode)
+jack_port_recalculate_latency (jack_client_t *client, jack_port_t *port,
+			       jack_latency_callback_mode_t mode)
 {
 	jack_latency_range_t latency = { UINT32_MAX, 0 };
 	JSList *node;
@@ -599,6 +864,14 @@ jack_port_recalculate_latency (jack_port_t *port, jack_latency_callback_mode_t m
 
 		jack_port_get_latency_range (other, mode, &other_latency);
 
+		/* a stage boundary of a pipelined graph */
+		if ((port->shared->flags & JackPortIsInput) ?
+		    jack_port_source_delayed (port, other) :
+		    jack_port_source_delayed (other, port)) {
+			other_latency.min += client->engine->buffer_size;
+			other_latency.max += client->engine->buffer_size;
+		}
+
 		if (other_latency.max > latency.max) {
 			latency.max = other_latency.max;
 		}
@@ -616,6 +889,36 @@ jack_port_recalculate_latency (jack_port_t *port, jack_latency_callback_mode_t m
 	jack_port_set_latency_range (port, mode, &latency);
 }
 
+/* PortsRegistered and PortsUnregistered: one event for many ports,
+ * passed on to the callback one port at a time */
+int
+jack_client_handle_ports_registration (jack_client_t *client, jack_event_t *event)
+{
+	int yn = (event->type == PortsRegistered);
+	JSList *node;
+	jack_port_t *port;
+	uint32_t i;
+
+	for (i = 0; i < event->x.n && i < JACK_EVENT_PORT_IDS; i++) {
+
+		if (yn) {
+			for (node = client->ports_ext; node; node = jack_slist_next (node)) {
+				port = node->data;
+				if (port->shared->id == event->z.port_ids[i]) {
+					port->type_info = &client->engine->port_types[port->shared->ptype_id];
+				}
+			}
+		}
+
+		if (client->control->port_register_cbset) {
+			client->port_register (event->z.port_ids[i], yn,
+					       client->port_register_arg);
+		}
+	}
+
+	return 0;
+}
+
 int
 jack_client_handle_latency_callback (jack_client_t *client, jack_event_t *event, int is_driver)
 {
@@ -630,10 +933,10 @@ jack_client_handle_latency_callback (jack_client_t *client, jack_event_t *event,
 		jack_port_t *port = node->data;
 
 		if ((jack_port_flags (port) & JackPortIsOutput) && (mode == JackPlaybackLatency)) {
-			jack_port_recalculate_latency (port, mode);
+			jack_port_recalculate_latency (client, port, mode);
 		}
 		if ((jack_port_flags (port) & JackPortIsInput) && (mode == JackCaptureLatency)) {
-			jack_port_recalculate_latency (port, mode);
+			jack_port_recalculate_latency (client, port, mode);
 		}
 	}
 
@@ -723,6 +1026,23 @@ jack_client_handle_latency_callback (jack_client_t *client, jack_event_t *event,
 	 * lets use it...
 	 */
 	client->latency_cb ( mode, client->latency_cb_arg);
+
+	/* the callback knows nothing of the period the client runs
+	   behind, add it to what it set */
+	if (client->control->process_async) {
+		for (node = client->ports; node; node = jack_slist_next (node)) {
+			jack_port_t *port = node->data;
+			unsigned long flags = (mode == JackCaptureLatency) ?
+					      JackPortIsOutput : JackPortIsInput;
+
+			if (port->async_buffer && (port->shared->flags & flags)) {
+				jack_port_get_latency_range (port, mode, &latency);
+				latency.min += client->engine->buffer_size;
+				latency.max += client->engine->buffer_size;
+				jack_port_set_latency_range (port, mode, &latency);
+			}
+		}
+	}
 	return 0;
 }
 
@@ -783,6 +1103,7 @@ jack_handle_reorder (jack_client_t *client, jack_event_t *event)
 	}
 
 	client->upstream_is_jackd = event->y.n;
+	client->graph_next_slot = event->z.next_slot;
 	client->pollmax = 2;
 
 	DEBUG ("opened new graph_next_fd %d (%s) (upstream is jackd? %d)",
@@ -1013,11 +1334,64 @@ failure:
 	fprintf (stderr, "exec of JACK server (command = \"%s\") failed: %s\n", command, strerror (errno));
 }
 
+/* how long a server we started has to say that it is ready, see
+   jack_notify_ready() in jackd/jackd.c */
+#define JACK_SERVER_READY_MSECS 5000
+
+/* wait for the server at the other end of `fd' to say "READY=1": 0
+   once it did, 1 if it went away without saying it, and 2 if it said
+   nothing in time, as a server that does not know about the pipe
+   would. */
+static int
+jack_wait_server_ready (int fd)
+{
+	struct pollfd pfd;
+	char buf[16];
+	size_t len = 0;
+	ssize_t n;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (len < sizeof(buf) - 1) {
+		pfd.revents = 0;
+		if ((ret = poll (&pfd, 1, JACK_SERVER_READY_MSECS)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 2;
+		}
+		if (ret == 0) {
+			return 2;
+		}
+		if ((n = read (fd, buf + len, sizeof(buf) - 1 - len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 1;
+		}
+		if (n == 0) {
+			break;
+		}
+		len += n;
+		buf[len] = '\0';
+		if (strstr (buf, "READY=1")) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 int
 start_server (const char *server_name, jack_options_t options)
 {
 	int status;
 	pid_t first_child_pid;
+	int ready[2];
+	char fdstr[16];
+	int ret;
 
 	if ((options & JackNoStartServer)
 	    || getenv ("JACK_NO_START_SERVER")) {
@@ -1032,14 +1406,32 @@ start_server (const char *server_name, jack_options_t options)
 	 * Since fork() is usually implemented using copy-on-write
 	 * virtual memory tricks, the overhead of the second fork() is
 	 * probably relatively small.
+	 *
+	 * The server gets the write end of a pipe in $JACK_READY_FD,
+	 * and says on it when it can take clients. None of our other
+	 * children may hold that end, or we would not see the server
+	 * close it by exiting.
 	 */
 
+	if (pipe (ready) == 0) {
+		fcntl (ready[0], F_SETFD, FD_CLOEXEC);
+		fcntl (ready[1], F_SETFD, FD_CLOEXEC);
+	} else {
+		ready[0] = ready[1] = -1;
+	}
+
 	first_child_pid = fork ();
 
 	switch (first_child_pid) {
 	case 0:                         /* child process */
 		switch (fork ()) {
 		case 0:                 /* grandchild process */
+			if (ready[1] >= 0) {
+				close (ready[0]);
+				fcntl (ready[1], F_SETFD, 0);
+				snprintf (fdstr, sizeof(fdstr), "%d", ready[1]);
+				setenv ("JACK_READY_FD", fdstr, 1);
+			}
 			_start_server (server_name);
 			_exit (99);     /* exec failed */
 		case -1:
@@ -1048,25 +1440,48 @@ start_server (const char *server_name, jack_options_t options)
 			_exit (0);
 		}
 	case -1:                        /* fork() error */
+		if (ready[0] >= 0) {
+			close (ready[0]);
+			close (ready[1]);
+		}
 		return 1;               /* failed to start server */
 	}
 
+	if (ready[1] >= 0) {
+		close (ready[1]);
+	}
+
 	/* reap the initaial child */
 	waitpid (first_child_pid, &status, 0);
 
 	/* only the original parent process goes here */
-	return 0;                       /* (probably) successful */
+	if (WIFEXITED (status) && WEXITSTATUS (status) == 98) {
+		ret = 1;                /* the second fork() failed */
+	} else if (ready[0] < 0) {
+		ret = 2;
+	} else {
+		ret = jack_wait_server_ready (ready[0]);
+	}
+
+	if (ready[0] >= 0) {
+		close (ready[0]);
+	}
+
+	/* 0: up, 2: (probably) on its way */
+	return ret;
 }
 
 static int
 jack_request_client (ClientType type,
 		     const char* client_name, jack_options_t options,
 		     jack_status_t *status, jack_varargs_t *va,
-		     jack_client_connect_result_t *res, int *req_fd)
+		     jack_client_connect_result_t *res, int *req_fd,
+		     int *ev_fd)
 {
 	jack_client_connect_request_t req;
 
 	*req_fd = -1;
+	*ev_fd = -1;
 	memset (&req, 0, sizeof(req));
 	req.options = options;
 
@@ -1098,18 +1513,28 @@ jack_request_client (ClientType type,
 
 	if ((*req_fd = server_connect (va->server_name)) < 0) {
 		int trys;
-		if (start_server (va->server_name, options)) {
-			*status |= (JackFailure | JackServerFailed);
-			goto fail;
-		}
-		trys = 5;
-		do {
-			sleep (1);
-			if (--trys < 0) {
+		switch (start_server (va->server_name, options)) {
+		case 0:
+			/* it said it is ready, there is nothing to wait for */
+			if ((*req_fd = server_connect (va->server_name)) < 0) {
 				*status |= (JackFailure | JackServerFailed);
 				goto fail;
 			}
-		} while ((*req_fd = server_connect (va->server_name)) < 0);
+			break;
+		case 2:
+			trys = 5;
+			while ((*req_fd = server_connect (va->server_name)) < 0) {
+				if (--trys < 0) {
+					*status |= (JackFailure | JackServerFailed);
+					goto fail;
+				}
+				sleep (1);
+			}
+			break;
+		default:
+			*status |= (JackFailure | JackServerFailed);
+			goto fail;
+		}
 		*status |= JackServerStarted;
 	}
 
@@ -1140,7 +1565,7 @@ jack_request_client (ClientType type,
 		goto fail;
 	}
 
-	if (read_retry (*req_fd, res, sizeof(*res)) != sizeof(*res)) {
+	if (read_connect_result (*req_fd, res, ev_fd) != sizeof(*res)) {
 
 		if (errno == 0) {
 			/* server shut the socket */
@@ -1193,6 +1618,10 @@ fail:
 		close (*req_fd);
 		*req_fd = -1;
 	}
+	if (*ev_fd >= 0) {
+		close (*ev_fd);
+		*ev_fd = -1;
+	}
 	return -1;
 }
 
@@ -1244,9 +1673,146 @@ jack_attach_port_segment (jack_client_t *client, jack_port_type_id_t ptid)
 		return -1;
 	}
 
+	jack_prefault_shm (&client->port_segment[ptid]);
+
+	return 0;
+}
+
+/* Attach the names of port table segment `seg'. They are neither
+ * prefaulted nor kept locked: only name lookups read them, and those
+ * touch the pages of the ports they look at.
+ */
+static int
+jack_attach_port_names (jack_port_table_t *table, jack_control_t *engine,
+			uint32_t seg)
+{
+	table->names_info[seg].index = engine->port_names_index[seg];
+
+	if (jack_attach_shm (&table->names_info[seg])) {
+		jack_error ("cannot attach port names segment %u (%s)",
+			    seg, strerror (errno));
+		return -1;
+	}
+
+	if (engine->do_mlock) {
+		jack_unlock_shm (&table->names_info[seg]);
+	}
+
+	table->names[seg] = (jack_port_names_t*)
+			    jack_shm_addr (&table->names_info[seg]);
 	return 0;
 }
 
+/* Attach any port table segments that the server has added since we
+ * last looked, and return how many ports we can reach.
+ */
+unsigned long
+jack_attach_port_table (const jack_client_t *client)
+{
+	jack_port_table_t *table = client->port_table;
+	jack_control_t *engine = client->engine;
+	uint32_t seg, nsegs;
+
+	nsegs = __atomic_load_n (&engine->n_port_segments, __ATOMIC_ACQUIRE);
+
+	/* internal clients share the server's table, which is never
+	   behind.
+	 */
+	if (table->n_segments < nsegs &&
+	    client->control->type == ClientExternal) {
+
+		pthread_mutex_lock (&table->lock);
+
+		for (seg = table->n_segments; seg < nsegs; seg++) {
+			table->shm_info[seg].index =
+				engine->port_segment_index[seg];
+			if (jack_attach_shm (&table->shm_info[seg])) {
+				jack_error ("cannot attach port table segment"
+					    " %u (%s)", seg, strerror (errno));
+				break;
+			}
+			if (jack_attach_port_names (table, engine, seg)) {
+				jack_release_shm (&table->shm_info[seg]);
+				break;
+			}
+			table->segment[seg] = (jack_port_shared_t*)
+					      jack_shm_addr (&table->shm_info[seg]);
+			jack_prefault_shm (&table->shm_info[seg]);
+			__atomic_store_n (&table->n_segments, seg + 1,
+					  __ATOMIC_RELEASE);
+		}
+
+		pthread_mutex_unlock (&table->lock);
+	}
+
+	return (unsigned long)table->n_segments * engine->port_segment_size;
+}
+
+/* the pages of the client table that hold our own control block, and
+   not those of the other clients */
+static void
+jack_client_prefault_control (jack_client_t *client)
+{
+	if (client->control_slot >= 0) {
+		jack_prefault_shm_range (&client->control_shm,
+					 client->control_slot
+					 * jack_client_control_slot_size (),
+					 jack_client_control_size ());
+	} else {
+		jack_prefault_shm (&client->control_shm);
+	}
+}
+
+/* Fault in every segment the process thread works on: the engine and
+ * client control blocks, the port buffers and the port table. They
+ * were faulted in when they were attached, but unless the process is
+ * locked down, pages that went unused since then may have been
+ * reclaimed; taking those faults here, outside the process thread,
+ * keeps them out of the first cycles.
+ */
+static void
+jack_client_prefault (jack_client_t *client)
+{
+	uint32_t i;
+
+	if (client->control->type != ClientExternal) {
+		return;
+	}
+
+	jack_prefault_shm (&client->engine_shm);
+	jack_client_prefault_control (client);
+
+	for (i = 0; i < (uint32_t)client->n_port_types; i++) {
+		jack_prefault_shm (&client->port_segment[i]);
+	}
+
+	for (i = 0; i < client->port_table->n_segments; i++) {
+		jack_prefault_shm (&client->port_table->shm_info[i]);
+	}
+}
+
+jack_port_shared_t *
+jack_port_shared_by_id (const jack_client_t *client, jack_port_id_t id)
+{
+	if (id >= jack_attach_port_table (client)) {
+		return NULL;
+	}
+
+	return jack_port_table_entry (client->port_table, client->engine, id);
+}
+
+/* JACK_DEBUG_STARTUP timing. The clock source is only known once the
+   engine segment is attached, so this does not use jack_get_microseconds().
+ */
+static uint64_t
+jack_startup_usecs (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 jack_client_t *
 jack_client_open_aux (const char *client_name,
 		      jack_options_t options,
@@ -1261,6 +1827,8 @@ jack_client_open_aux (const char *client_name,
 	jack_client_t *client;
 	jack_port_type_id_t ptid;
 	jack_status_t my_status;
+	int debug_startup = (getenv ("JACK_DEBUG_STARTUP") != NULL);
+	uint64_t t_start = 0, t_connected = 0, t_shm = 0;
 
 	jack_messagebuffer_init ();
 
@@ -1293,12 +1861,20 @@ jack_client_open_aux (const char *client_name,
 	 */
 	jack_init_time ();
 
+	if (debug_startup) {
+		t_start = jack_startup_usecs ();
+	}
+
 	if (jack_request_client (ClientExternal, client_name, options, status,
-				 &va, &res, &req_fd)) {
+				 &va, &res, &req_fd, &ev_fd)) {
 		jack_messagebuffer_exit ();
 		return NULL;
 	}
 
+	if (debug_startup) {
+		t_connected = jack_startup_usecs ();
+	}
+
 	/* Allocate the jack_client_t structure in local memory.
 	 * Shared memory is not accessible yet. */
 	client = jack_client_alloc ();
@@ -1328,9 +1904,17 @@ jack_client_open_aux (const char *client_name,
 	}
 
 	client->engine = (jack_control_t*)jack_shm_addr (&client->engine_shm);
+	jack_prefault_shm (&client->engine_shm);
 
-	/* initialize clock source as early as possible */
+	/* initialize clock source as early as possible; if the TSC is
+	   not usable here, jack_set_clock_source() uses the system clock */
+	if (client->engine->clock_source == JACK_TIMER_TSC) {
+		jack_tsc_clock_init (&client->engine->tsc_clock, FALSE);
+	}
 	jack_set_clock_source (client->engine->clock_source);
+#ifdef USE_DYNSIMD
+	jack_simd_set_length (client->engine->buffer_size);
+#endif  /* USE_DYNSIMD */
 
 	/* now attach the client control block */
 	client->control_shm.index = res.client_shm_index;
@@ -1340,14 +1924,30 @@ jack_client_open_aux (const char *client_name,
 		goto fail;
 	}
 
-	client->control = (jack_client_control_t*)
-			  jack_shm_addr (&client->control_shm);
+	client->control_slot = res.client_table_slot;
+	if (client->control_slot >= 0) {
 
-	/* Nobody else needs to access this shared memory any more, so
-	 * destroy it.  Because we have it attached, it won't vanish
-	 * till we exit (and release it).
-	 */
-	jack_destroy_shm (&client->control_shm);
+		/* our slot of the table the engine keeps for all
+		   external clients; the engine destroys it, not us */
+
+		client->control = (jack_client_control_t*)
+				  ((char*)jack_shm_addr (&client->control_shm)
+				   + client->control_slot
+				   * jack_client_control_slot_size ());
+		jack_client_prefault_control (client);
+
+	} else {
+
+		client->control = (jack_client_control_t*)
+				  jack_shm_addr (&client->control_shm);
+		jack_client_prefault_control (client);
+
+		/* Nobody else needs to access this shared memory any
+		 * more, so destroy it.  Because we have it attached, it
+		 * won't vanish till we exit (and release it).
+		 */
+		jack_destroy_shm (&client->control_shm);
+	}
 
 	client->n_port_types = client->engine->n_port_types;
 	if ((client->port_segment = (jack_shm_info_t*)malloc (sizeof(jack_shm_info_t) * client->n_port_types)) == NULL) {
@@ -1363,13 +1963,36 @@ jack_client_open_aux (const char *client_name,
 		 */
 	}
 
+	/* port table segments are needed before that, so we attach
+	   them ourselves as we come across ports in them.
+	 */
+	if ((client->port_table = (jack_port_table_t*)
+				  calloc (1, sizeof(jack_port_table_t))) == NULL) {
+		goto fail;
+	}
+	pthread_mutex_init (&client->port_table->lock, NULL);
+	if (jack_attach_port_names (client->port_table, client->engine, 0)) {
+		goto fail;
+	}
+	client->port_table->segment[0] = client->engine->ports;
+	client->port_table->n_segments = 1;
+	jack_attach_port_table (client);
+
 	/* set up the client so that it does the right thing for an
 	 * external client
 	 */
 	client->deliver_request = oop_client_deliver_request;
 	client->deliver_arg = client;
 
-	if ((ev_fd = server_event_connect (client, va.server_name)) < 0) {
+	if (debug_startup) {
+		t_shm = jack_startup_usecs ();
+	}
+
+	/* the server passes the event socket along with its answer;
+	   connect back for one only if it did not.
+	 */
+	if (ev_fd < 0 &&
+	    (ev_fd = server_event_connect (client, va.server_name)) < 0) {
 		goto fail;
 	}
 
@@ -1391,6 +2014,19 @@ jack_client_open_aux (const char *client_name,
 	}
 	;
 #endif  /* JACK_USE_MACH_THREADS */
+
+	/* metadata are read from the server's store, see metadata.c */
+	jack_property_store_attach (client->engine);
+
+	if (debug_startup) {
+		uint64_t t_end = jack_startup_usecs ();
+		jack_info ("%s startup: connect %" PRIu64 " usecs, shm %" PRIu64
+			   " usecs, events %" PRIu64 " usecs, total %" PRIu64
+			   " usecs", client->name,
+			   t_connected - t_start, t_shm - t_connected,
+			   t_end - t_shm, t_end - t_start);
+	}
+
 	return client;
 
 fail:
@@ -1447,7 +2083,7 @@ jack_internal_client_new (const char *client_name,
 			  const char *so_name, const char *so_data)
 {
 	jack_client_connect_result_t res;
-	int req_fd;
+	int req_fd, ev_fd;
 	jack_varargs_t va;
 	jack_status_t status;
 	jack_options_t options = JackUseExactName;
@@ -1461,7 +2097,8 @@ jack_internal_client_new (const char *client_name,
 	va.load_init = (char*)so_data;
 
 	return jack_request_client (ClientInternal, client_name,
-				    options, &status, &va, &res, &req_fd);
+				    options, &status, &va, &res, &req_fd,
+				    &ev_fd);
 }
 
 char *
@@ -1815,14 +2452,195 @@ jack_client_thread_suicide (jack_client_t* client, const char* reason)
 	/*NOTREACHED*/
 }
 
+/* run the callbacks for one event, `key' is freed */
 static int
-jack_client_process_events (jack_client_t* client)
+jack_client_handle_event (jack_client_t* client, jack_event_t *event,
+			  char *key)
 {
-	jack_event_t event;
-	char status = 0;
 	jack_client_control_t *control = client->control;
 	JSList *node;
 	jack_port_t* port;
+	int status = 0;
+
+	switch (event->type) {
+	case PortRegistered:
+		for (node = client->ports_ext; node; node = jack_slist_next (node)) {
+			port = node->data;
+			if (port->shared->id == event->x.port_id) { // Found port, update port type
+				port->type_info = &client->engine->port_types[port->shared->ptype_id];
+			}
+		}
+		if (control->port_register_cbset) {
+			client->port_register
+				(event->x.port_id, TRUE,
+				client->port_register_arg);
+		}
+		break;
+
+	case PortUnregistered:
+		if (control->port_register_cbset) {
+			client->port_register
+				(event->x.port_id, FALSE,
+				client->port_register_arg);
+		}
+		break;
+
+	case PortsRegistered:
+	case PortsUnregistered:
+		jack_client_handle_ports_registration (client, event);
+		break;
+
+	case ClientRegistered:
+		if (control->client_register_cbset) {
+			client->client_register
+				(event->x.name, TRUE,
+				client->client_register_arg);
+		}
+		break;
+
+	case ClientUnregistered:
+		if (control->client_register_cbset) {
+			client->client_register
+				(event->x.name, FALSE,
+				client->client_register_arg);
+		}
+		break;
+
+	case GraphReordered:
+		status = jack_handle_reorder (client, event);
+		/* the engine may suggest another cpu for the new order */
+		jack_client_apply_process_cpus (client);
+		if (client->worker_pool) {
+			jack_worker_pool_apply_cpus (client->worker_pool);
+		}
+		break;
+
+	case PortConnected:
+	case PortDisconnected:
+		status = jack_client_handle_port_connection
+				 (client, event);
+		break;
+
+	case BufferSizeChange:
+#ifdef USE_DYNSIMD
+		jack_simd_set_length (client->engine->buffer_size);
+#endif  /* USE_DYNSIMD */
+		jack_client_fix_port_buffers (client);
+		jack_client_apply_deadline (client);
+		if (control->bufsize_cbset) {
+			status = client->bufsize
+					 (client->engine->buffer_size,
+					 client->bufsize_arg);
+		}
+		break;
+
+	case SampleRateChange:
+		jack_client_apply_deadline (client);
+		if (control->srate_cbset) {
+			status = client->srate
+					 (client->engine->current_time.frame_rate,
+					 client->srate_arg);
+		}
+		break;
+
+	case XRun:
+		if (control->xrun_cbset) {
+			status = client->xrun
+					 (client->xrun_arg);
+		}
+		break;
+
+	case AttachPortSegment:
+		if (event->y.ptid == JACK_PORT_TABLE_SEGMENT) {
+			jack_attach_port_table (client);
+		} else {
+			jack_attach_port_segment (client, event->y.ptid);
+		}
+		jack_client_prefault (client);
+		break;
+
+	case StartFreewheel:
+		jack_start_freewheel (client);
+		break;
+
+	case StopFreewheel:
+		jack_stop_freewheel (client);
+		break;
+	case SaveSession:
+		status = jack_client_handle_session_callback (client, event );
+		break;
+	case LatencyCallback:
+		status = jack_client_handle_latency_callback (client, event, 0 );
+		break;
+	case PropertyChange:
+		if (control->property_cbset) {
+			client->property_cb (event->x.uuid, key, event->z.property_change, client->property_cb_arg);
+		}
+		if (key) {
+			free (key);
+		}
+		break;
+	case PortRename:
+		if (control->port_rename_cbset) {
+			client->port_rename_cb (event->y.other_id, event->x.name, event->z.other_name, client->port_rename_arg);
+		}
+		break;
+	case GraphChanged:
+		if (control->graph_changed_cbset) {
+			client->graph_changed_cb (event->x.n, client->graph_changed_arg);
+		}
+		break;
+	}
+
+	return status;
+}
+
+/* handle everything the engine has put into our event queue */
+static void
+jack_client_process_queued_events (jack_client_t* client)
+{
+	jack_client_control_t *control = client->control;
+	jack_queued_event_t *qe;
+	jack_event_t event;
+	char *key;
+	uint32_t head, tail;
+
+	/* clear this before looking at `event_head', so that events
+	   queued from now on ring the event socket again.
+	 */
+	__atomic_store_n (&control->event_signalled, 0, __ATOMIC_SEQ_CST);
+
+	tail = control->event_tail;
+
+	while ((head = __atomic_load_n (&control->event_head,
+					__ATOMIC_SEQ_CST)) != tail) {
+
+		for (; tail != head; tail++) {
+			qe = (jack_queued_event_t*)
+			     &control->event_queue[tail & (JACK_EVENT_QUEUE_SIZE - 1)];
+			memcpy (&event, &qe->event, sizeof(event));
+			key = NULL;
+
+			if (event.type == PropertyChange && event.y.key_size) {
+				if ((key = (char*)malloc (event.y.key_size)) == NULL) {
+					continue;
+				}
+				memcpy (key, qe->key, event.y.key_size);
+			}
+
+			jack_client_handle_event (client, &event, key);
+		}
+
+		/* acknowledge the whole batch */
+		__atomic_store_n (&control->event_tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+static int
+jack_client_process_events (jack_client_t* client)
+{
+	jack_event_t event;
+	char status = 0;
 	char* key = 0;
 
 	DEBUG ("process events");
@@ -1842,6 +2660,18 @@ jack_client_process_events (jack_client_t* client)
 			return -1;
 		}
 
+		/* queued events come first, and need no reply. with an
+		   event thread, they are not ours to handle.
+		 */
+
+		if (!client->control->event_thread) {
+			jack_client_process_queued_events (client);
+		}
+
+		if (event.type == EventsQueued) {
+			return 0;
+		}
+
 		if (event.type == PropertyChange) {
 			if (event.y.key_size) {
 				key = (char*)malloc (event.y.key_size);
@@ -1854,112 +2684,7 @@ jack_client_process_events (jack_client_t* client)
 			}
 		}
 
-		status = 0;
-
-		switch (event.type) {
-		case PortRegistered:
-			for (node = client->ports_ext; node; node = jack_slist_next (node)) {
-				port = node->data;
-				if (port->shared->id == event.x.port_id) { // Found port, update port type
-					port->type_info = &client->engine->port_types[port->shared->ptype_id];
-				}
-			}
-			if (control->port_register_cbset) {
-				client->port_register
-					(event.x.port_id, TRUE,
-					client->port_register_arg);
-			}
-			break;
-
-		case PortUnregistered:
-			if (control->port_register_cbset) {
-				client->port_register
-					(event.x.port_id, FALSE,
-					client->port_register_arg);
-			}
-			break;
-
-		case ClientRegistered:
-			if (control->client_register_cbset) {
-				client->client_register
-					(event.x.name, TRUE,
-					client->client_register_arg);
-			}
-			break;
-
-		case ClientUnregistered:
-			if (control->client_register_cbset) {
-				client->client_register
-					(event.x.name, FALSE,
-					client->client_register_arg);
-			}
-			break;
-
-		case GraphReordered:
-			status = jack_handle_reorder (client, &event);
-			break;
-
-		case PortConnected:
-		case PortDisconnected:
-			status = jack_client_handle_port_connection
-					 (client, &event);
-			break;
-
-		case BufferSizeChange:
-			jack_client_fix_port_buffers (client);
-			if (control->bufsize_cbset) {
-				status = client->bufsize
-						 (client->engine->buffer_size,
-						 client->bufsize_arg);
-			}
-			break;
-
-		case SampleRateChange:
-			if (control->srate_cbset) {
-				status = client->srate
-						 (client->engine->current_time.frame_rate,
-						 client->srate_arg);
-			}
-			break;
-
-		case XRun:
-			if (control->xrun_cbset) {
-				status = client->xrun
-						 (client->xrun_arg);
-			}
-			break;
-
-		case AttachPortSegment:
-			jack_attach_port_segment (client, event.y.ptid);
-			break;
-
-		case StartFreewheel:
-			jack_start_freewheel (client);
-			break;
-
-		case StopFreewheel:
-			jack_stop_freewheel (client);
-			break;
-		case SaveSession:
-			status = jack_client_handle_session_callback (client, &event );
-			break;
-		case LatencyCallback:
-			status = jack_client_handle_latency_callback (client, &event, 0 );
-			break;
-		case PropertyChange:
-			if (control->property_cbset) {
-				client->property_cb (event.x.uuid, key, event.z.property_change, client->property_cb_arg);
-			}
-			if (key) {
-				free (key);
-			}
-			break;
-		case PortRename:
-			if (control->port_rename_cbset) {
-				client->port_rename_cb (event.y.other_id, event.x.name, event.z.other_name, client->port_rename_arg);
-			}
-			break;
-		}
+		status = jack_client_handle_event (client, &event, key);
 
 		DEBUG ("client has dealt with the event, writing "
 		       "response on event fd");
@@ -1983,9 +2708,36 @@ jack_wake_next_client (jack_client_t* client)
 	struct pollfd pfds[1];
 	int pret = 0;
 	char c = 0;
+	jack_activation_t *next_act;
+	int32_t i, n;
+
+	/* parallel execution with futexes: count down every client
+	   we feed, and wake those we were the last input of.
+	 */
+
+	if ((n = client->control->activation_nsuccessors) > 0) {
+		for (i = 0; i < n; i++) {
+			int32_t slot = client->control->activation_successors[i];
+
+			if ((next_act = jack_activation_slot (client->engine, slot)) == NULL) {
+				continue;
+			}
+			if (slot == JACK_ACTIVATION_ENGINE) {
+				jack_activation_signal (next_act);
+			} else {
+				jack_activation_complete (next_act);
+			}
+		}
+		return 0;
+	}
+
+	next_act = jack_activation_slot (client->engine,
+					 client->graph_next_slot);
 
-	if (write_retry (client->graph_next_fd, &c, sizeof(c))
-	    != sizeof(c)) {
+	if (next_act) {
+		jack_activation_signal (next_act);
+	} else if (write_retry (client->graph_next_fd, &c, sizeof(c))
+		   != sizeof(c)) {
 		DEBUG ("cannot write byte to fd %d", client->graph_next_fd);
 		jack_error ("cannot continue execution of the "
 			    "processing graph (%s)",
@@ -1996,6 +2748,16 @@ jack_wake_next_client (jack_client_t* client)
 	DEBUG ("client sent message to next stage by %" PRIu64 "",
 	       jack_get_microseconds ());
 
+	/* a futex wakeup was consumed in full by
+	 * jack_client_activation_wait(), so there is nothing to
+	 * clean up.
+	 */
+
+	if (jack_activation_slot (client->engine,
+				  client->control->activation_slot)) {
+		return 0;
+	}
+
 	DEBUG ("reading cleanup byte from pipe %d\n", client->graph_wait_fd);
 
 	/* "upstream client went away?  readability is checked in
@@ -2088,10 +2850,138 @@ jack_osx_event_thread_work (void* arg)
 
 #else /* !JACK_USE_MACH_THREADS */
 
+#if JACK_HAVE_FUTEX
+
+static void*
+jack_event_thread_work (void* arg)
+{
+	/* this is NOT the process() thread: it runs with normal
+	   priority and handles the notifications that the server
+	   puts into our event queue (port and client registration,
+	   property changes, xruns, renames), so that bursts of them
+	   do not delay process(). Events that need an answer, or
+	   that change what the process thread works with (graph
+	   order, connections, buffer size), still arrive on the
+	   event socket and are handled by the process thread.
+	 */
+
+	jack_client_t* client = (jack_client_t*)arg;
+	jack_client_control_t *control = client->control;
+	struct timespec ts;
+
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+
+	while (1) {
+
+		if (__atomic_load_n (&control->event_signalled,
+				     __ATOMIC_SEQ_CST) == 0) {
+			if (jack_futex_wait (&control->event_signalled, 0, &ts) < 0
+			    && errno != ETIMEDOUT && errno != EAGAIN
+			    && errno != EINTR) {
+				jack_error ("wait for events failed in client (%s)",
+					    strerror (errno));
+				break;
+			}
+		}
+
+		pthread_testcancel ();
+
+		if (control->dead || !client->engine->engine_ok) {
+			break;
+		}
+
+		jack_client_process_queued_events (client);
+	}
+
+	return 0;
+}
+
+#endif /* JACK_HAVE_FUTEX */
+
+static int
+jack_client_activation_wait (jack_client_t* client, jack_activation_t *act)
+{
+	jack_client_control_t *control = client->control;
+	int32_t bits;
+
+	/* the server marks our activation slot both when it is time to
+	   run process() and after it has written an event to our socket,
+	   so we only need to look at the event fd when told to (or
+	   once a second, which is also how we notice a dead server).
+	 */
+
+	DEBUG ("client waiting on activation slot %d",
+	       control->activation_slot);
+
+	/* with the server's --spin-wait or $JACK_SPIN_WAIT, watch the
+	   slot for a while before sleeping */
+	client->spin.limit = client->spin_usecs >= 0 ?
+			     client->spin_usecs : client->engine->spin_usecs;
+
+	while (1) {
+		if ((bits = jack_activation_spin_wait (act, &client->spin,
+						       1000000)) < 0) {
+			jack_error ("wait on activation slot failed in "
+				    "client (%s)", strerror (errno));
+			return -1;
+		}
+
+		pthread_testcancel ();
+
+		if (bits & JACK_ACTIVATION_COUNT) {
+			control->awake_at = jack_get_microseconds ();
+		}
+
+		if (bits == 0 || (bits & JACK_ACTIVATION_EVENT)) {
+			if (poll (client->pollfd, 1, 0) < 0) {
+				if (errno != EINTR) {
+					jack_error ("poll failed in client (%s)",
+						    strerror (errno));
+					return -1;
+				}
+				client->pollfd[EVENT_POLL_INDEX].revents = 0;
+			}
+
+			if (client->pollfd[EVENT_POLL_INDEX].revents & ~POLLIN) {
+				break;
+			}
+
+			if (jack_client_process_events (client)) {
+				DEBUG ("event processing failed\n");
+				return -1;
+			}
+		}
+
+		if (control->dead) {
+			break;
+		}
+
+		if (bits & JACK_ACTIVATION_COUNT) {
+			DEBUG ("time to run process()\n");
+			return 0;
+		}
+	}
+
+	DEBUG ("client appears dead or event pollfd has error status\n");
+	return -1;
+}
+
 static int
 jack_client_core_wait (jack_client_t* client)
 {
 	jack_client_control_t *control = client->control;
+	jack_activation_t *act;
+
+	/* once we are part of the graph, the server may be waking us
+	   through a futex word rather than our wait FIFO.
+	 */
+
+	if (client->graph_wait_fd >= 0
+	    && (act = jack_activation_slot (client->engine,
+					    control->activation_slot))) {
+		return jack_client_activation_wait (client, act);
+	}
 
 	/* this is not OS X - we're waiting on events & process wakeups */
 
@@ -2179,16 +3069,75 @@ jack_client_core_wait (jack_client_t* client)
 
 #endif
 
-static void*
-jack_process_thread_work (void* arg)
+/* One cycle of a client that runs one period behind the graph: hand
+ * over what process() made last time and take a copy of the inputs,
+ * let the graph go on, and only then run process() on the copies. The
+ * next client is not kept waiting for this one's process(), which only
+ * has to be done by the start of the next cycle.
+ */
+static int
+jack_client_process_async (jack_client_t *client, jack_nframes_t nframes)
 {
-	/* this is the RT process thread used to handle process()
-	   callbacks, and on non-OSX systems, server events/callbacks
-	   as well.
-	 */
+	JSList *node;
+	jack_port_t *port;
+	int status;
 
-	jack_client_t* client = (jack_client_t*)arg;
-	jack_client_control_t *control = client->control;
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_t*)node->data;
+		if (port->async_buffer) {
+			jack_port_async_exchange (port, nframes);
+		}
+	}
+
+	jack_cycle_signal (client, 0);
+
+	DEBUG ("client calls process() one period behind");
+	status = client->process (nframes, client->process_arg);
+
+	return status;
+}
+
+/* the engine laid out a new input ring for a decimated client: map
+   it before process() looks at it */
+static int
+jack_client_ring_attach (jack_client_t *client)
+{
+	jack_client_control_t *control = client->control;
+
+	if (client->ring_base) {
+		jack_release_shm (&client->ring_shm);
+		client->ring_base = NULL;
+	}
+
+	client->ring_serial = __atomic_load_n (&control->ring_serial,
+					       __ATOMIC_ACQUIRE);
+	client->ring_shm.index = control->ring_index;
+
+	/* no inputs, no ring */
+	if (client->ring_shm.index == JACK_SHM_NULL_INDEX) {
+		return 0;
+	}
+
+	if (jack_attach_shm (&client->ring_shm)) {
+		jack_error ("cannot attach the input ring (%s)", strerror (errno));
+		return -1;
+	}
+
+	client->ring_base = jack_shm_addr (&client->ring_shm);
+
+	return 0;
+}
+
+static void*
+jack_process_thread_work (void* arg)
+{
+	/* this is the RT process thread used to handle process()
+	   callbacks, and on non-OSX systems, server events/callbacks
+	   as well.
+	 */
+
+	jack_client_t* client = (jack_client_t*)arg;
+	jack_client_control_t *control = client->control;
 
 	/* notify the waiting client that this thread
 	   is up and running.
@@ -2203,8 +3152,15 @@ jack_process_thread_work (void* arg)
 	control->pid = getpid ();
 	control->pgrp = getpgrp ();
 
+#if defined(__linux__) && defined(SYS_gettid)
+	client->process_tid = syscall (SYS_gettid);
+	jack_client_apply_deadline (client);
+#endif
+
 #ifdef JACK_USE_MACH_THREADS
 	client->rt_thread_ok = TRUE;
+	/* run in the audio device's workgroup, with the engine cycle */
+	jack_client_join_workgroup (client);
 #endif
 
 	if (control->thread_cb_cbset) {
@@ -2229,7 +3185,33 @@ jack_process_thread_work (void* arg)
 				break;
 			}
 
-			if (control->process_cbset) {
+			if (control->process_async && control->process_cbset) {
+				if (jack_client_process_async (client,
+							       client->engine->buffer_size)) {
+					jack_client_thread_suicide (client, "process error");
+					/*NOTREACHED*/
+				}
+				continue;
+			}
+
+			if (control->process_cbset && control->decimation) {
+
+				/* woken for a batch of periods */
+
+				if (client->ring_serial != control->ring_serial &&
+				    jack_client_ring_attach (client)) {
+					jack_client_thread_suicide (client, "no input ring");
+					/*NOTREACHED*/
+				}
+
+				DEBUG ("client calls process() for %u periods",
+				       control->decimation);
+				status = client->process (client->engine->buffer_size *
+							  control->decimation,
+							  client->process_arg);
+				control->state = Finished;
+
+			} else if (control->process_cbset) {
 
 				/* run process callback, then wait... ad-infinitum */
 
@@ -2271,6 +3253,8 @@ jack_nframes_t jack_cycle_wait (jack_client_t* client)
 
 	/* SECTION TWO: WAIT FOR NEXT DATA PROCESSING TIME */
 
+	JACK_PROBE1 (cycle_wait, control->name);
+
 #ifdef JACK_USE_MACH_THREADS
 	/* on OS X systems, this thread is running a callback provided
 	   by the client that has called this function in order to wait
@@ -2293,8 +3277,14 @@ jack_nframes_t jack_cycle_wait (jack_client_t* client)
 	/* Time to do data processing */
 
 	control->awake_at = jack_get_microseconds ();
+	if (client->engine->cpu_times) {
+		jack_thread_usage (&client->cycle_cpu_nsecs,
+				   &client->cycle_preemptions);
+	}
 	client->control->state = Running;
 
+	JACK_PROBE2 (cycle_wake, control->name, client->engine->buffer_size);
+
 	/* begin preemption checking */
 	CHECK_PREEMPTION (client->engine, TRUE);
 
@@ -2307,8 +3297,13 @@ jack_nframes_t jack_cycle_wait (jack_client_t* client)
 
 void jack_cycle_signal (jack_client_t* client, int status)
 {
+	uint64_t cpu_nsecs;
+	uint32_t preemptions;
+
 	client->control->last_status = status;
 
+	JACK_PROBE2 (cycle_signal, client->control->name, status);
+
 	/* SECTION ONE: HOUSEKEEPING/CLEANUP FROM LAST DATA PROCESSING */
 
 	/* housekeeping/cleanup after data processing */
@@ -2317,9 +3312,24 @@ void jack_cycle_signal (jack_client_t* client, int status)
 		jack_call_timebase_master (client);
 	}
 
+	if (status == 0) {
+		jack_client_mark_unwritten (client);
+		jack_client_update_meters (client, client->engine->buffer_size);
+	}
+
 	/* end preemption checking */
 	CHECK_PREEMPTION (client->engine, FALSE);
 
+	/* published before finished_at, which the engine looks at
+	   first. the engine clears them each cycle */
+	if (client->engine->cpu_times) {
+		jack_thread_usage (&cpu_nsecs, &preemptions);
+		client->control->process_cpu_usecs =
+			(uint32_t)((cpu_nsecs - client->cycle_cpu_nsecs) / 1000);
+		client->control->process_preemptions =
+			preemptions - client->cycle_preemptions;
+	}
+
 	client->control->finished_at = jack_get_microseconds ();
 	client->control->state = Finished;
 
@@ -2364,6 +3374,13 @@ jack_start_thread (jack_client_t *client)
 		if (client->engine->do_munlock) {
 			cleanup_mlock ();
 		}
+
+		if (client->engine->do_mlock &&
+		    client->control->type == ClientExternal) {
+			uint32_t seg;
+			for (seg = 0; seg < client->port_table->n_segments; ++seg)
+				jack_unlock_shm (&client->port_table->names_info[seg]);
+		}
 	}
 #endif  /* USE_MLOCK */
 
@@ -2387,6 +3404,25 @@ jack_start_thread (jack_client_t *client)
 		return -1;
 	}
 
+#if JACK_HAVE_FUTEX
+	/* JACK_EVENT_THREAD asks for notifications to be handled on a
+	   separate, normal priority thread.
+	 */
+
+	if (!client->event_thread_ok && getenv ("JACK_EVENT_THREAD")) {
+		if (jack_client_create_thread (client,
+					       &client->event_thread,
+					       0, FALSE,
+					       jack_event_thread_work, client)) {
+			jack_error ("cannot create event thread, events "
+				    "will be handled by the process thread");
+		} else {
+			client->event_thread_ok = TRUE;
+			client->control->event_thread = 1;
+		}
+	}
+#endif
+
 #endif
 
 #ifdef JACK_USE_MACH_THREADS
@@ -2463,6 +3499,12 @@ jack_activate (jack_client_t *client)
 
 	if (client->first_active) {
 
+		/* set up the RT memory pool before anything runs on the
+		   process thread */
+
+		jack_pool_activate (client->engine->real_time &&
+				    client->engine->do_mlock);
+
 		pthread_mutex_init (&client_lock, NULL);
 		pthread_cond_init (&client_ready, NULL);
 
@@ -2482,8 +3524,13 @@ jack_activate (jack_client_t *client)
 		}
 
 		client->first_active = FALSE;
+
+		/* JACK_PROCESS_CPUS or jack_set_process_thread_cpus() */
+		jack_client_apply_process_cpus (client);
 	}
 
+	jack_client_prefault (client);
+
 startit:
 
 	req.type = ActivateClient;
@@ -2523,6 +3570,9 @@ jack_client_close_aux (jack_client_t *client)
 	void *status;
 	int rc;
 
+	/* its workers may be in the middle of a process callback */
+	jack_worker_pool_destroy (client->worker_pool);
+
 	rc = jack_deactivate_aux (client);
 	if (rc == ESRCH) {              /* already shut down? */
 		return rc;
@@ -2538,6 +3588,12 @@ jack_client_close_aux (jack_client_t *client)
 				pthread_mach_thread_np (client->process_thread);
 			thread_terminate (machThread);
 		}
+#ifdef JACK_USE_OS_WORKGROUP
+		if (client->workgroup) {
+			os_release (client->workgroup);
+			client->workgroup = NULL;
+		}
+#endif
 #endif
 
 		/* stop the thread that communicates with the jack
@@ -2549,11 +3605,19 @@ jack_client_close_aux (jack_client_t *client)
 			pthread_join (client->thread, &status);
 		}
 
+		if (client->event_thread_ok) {
+			client->control->event_thread = 0;
+			pthread_cancel (client->event_thread);
+			pthread_join (client->event_thread, &status);
+			client->event_thread_ok = FALSE;
+		}
+
 		if (client->control) {
 			jack_release_shm (&client->control_shm);
 			client->control = NULL;
 		}
 		if (client->engine) {
+			jack_property_store_detach (client->engine);
 			jack_release_shm (&client->engine_shm);
 			client->engine = NULL;
 		}
@@ -2566,6 +3630,22 @@ jack_client_close_aux (jack_client_t *client)
 			client->port_segment = NULL;
 		}
 
+		if (client->ring_base) {
+			jack_release_shm (&client->ring_shm);
+			client->ring_base = NULL;
+		}
+
+		if (client->port_table) {
+			uint32_t seg;
+			for (seg = 1; seg < client->port_table->n_segments; ++seg)
+				jack_release_shm (&client->port_table->shm_info[seg]);
+			for (seg = 0; seg < client->port_table->n_segments; ++seg)
+				jack_release_shm (&client->port_table->names_info[seg]);
+			pthread_mutex_destroy (&client->port_table->lock);
+			free (client->port_table);
+			client->port_table = NULL;
+		}
+
 #ifndef JACK_USE_MACH_THREADS
 		if (client->graph_wait_fd >= 0) {
 			close (client->graph_wait_fd);
@@ -2587,7 +3667,7 @@ jack_client_close_aux (jack_client_t *client)
 	}
 
 	for (node = client->ports; node; node = jack_slist_next (node))
-		free (node->data);
+		jack_port_free ((jack_port_t*)node->data);
 	jack_slist_free (client->ports);
 	for (node = client->ports_ext; node; node = jack_slist_next (node))
 		free (node->data);
@@ -2657,6 +3737,131 @@ jack_connect (jack_client_t *client, const char *source_port,
 	return jack_client_deliver_request (client, &req);
 }
 
+static int
+jack_connection_gain_request (jack_client_t *client, const char *source_port,
+			      const char *destination_port, uint32_t what,
+			      float gain, int mute)
+{
+	jack_request_t req;
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = SetConnectionGain;
+
+	snprintf (req.x.connection_gain.source_port,
+		  sizeof(req.x.connection_gain.source_port), "%s", source_port);
+	snprintf (req.x.connection_gain.destination_port,
+		  sizeof(req.x.connection_gain.destination_port),
+		  "%s", destination_port);
+	req.x.connection_gain.what = what;
+	req.x.connection_gain.gain = gain;
+	req.x.connection_gain.mute = mute ? 1 : 0;
+
+	return jack_client_deliver_request (client, &req);
+}
+
+/* Set the (linear) gain of the connection from `source_port' to
+ * `destination_port', which its input applies in the mixdown, ramping
+ * to it over one period. Audio connections only; they start at 1.0.
+ * Belongs in <jack/jack.h>.
+ */
+int
+jack_connection_set_gain (jack_client_t *client, const char *source_port,
+			  const char *destination_port, float gain)
+{
+	return jack_connection_gain_request (client, source_port,
+					     destination_port,
+					     JackConnectionGain, gain, 0);
+}
+
+/* Mute or unmute that connection, keeping its gain for when it is
+ * unmuted. Belongs in <jack/jack.h>.
+ */
+int
+jack_connection_set_mute (jack_client_t *client, const char *source_port,
+			  const char *destination_port, int onoff)
+{
+	return jack_connection_gain_request (client, source_port,
+					     destination_port,
+					     JackConnectionMute, 0.0f, onoff);
+}
+
+static int
+jack_port_batch_request (jack_client_t *client, RequestType type,
+			 const char **source_ports,
+			 const char **destination_ports,
+			 unsigned int npairs)
+{
+	jack_request_t req;
+	char *ports;
+	unsigned int i, n;
+	int status = 0;
+	int ret;
+
+	if (npairs == 0) {
+		return 0;
+	}
+
+	if ((ports = (char*)malloc (2 * JACK_PORT_NAME_SIZE *
+				    (npairs < JACK_PORT_BATCH_MAX ?
+				     npairs : JACK_PORT_BATCH_MAX))) == NULL) {
+		jack_error ("cannot allocate memory for %u port pairs", npairs);
+		return -1;
+	}
+
+	/* larger batches go out in several requests, each of which
+	   still sorts the graph only once.
+	 */
+
+	while (npairs) {
+
+		n = (npairs < JACK_PORT_BATCH_MAX ? npairs : JACK_PORT_BATCH_MAX);
+
+		for (i = 0; i < n; i++) {
+			snprintf (ports + (2 * i) * JACK_PORT_NAME_SIZE,
+				  JACK_PORT_NAME_SIZE, "%s", source_ports[i]);
+			snprintf (ports + (2 * i + 1) * JACK_PORT_NAME_SIZE,
+				  JACK_PORT_NAME_SIZE, "%s", destination_ports[i]);
+		}
+
+		VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+		req.type = type;
+		req.x.batch.npairs = n;
+		req.x.batch.ports = ports;
+
+		if ((ret = jack_client_deliver_request (client, &req)) && status == 0) {
+			status = ret;
+		}
+
+		source_ports += n;
+		destination_ports += n;
+		npairs -= n;
+	}
+
+	free (ports);
+
+	return status;
+}
+
+int
+jack_connect_batch (jack_client_t *client, const char **source_ports,
+		    const char **destination_ports, unsigned int npairs)
+{
+	return jack_port_batch_request (client, ConnectPortsBatch,
+					source_ports, destination_ports,
+					npairs);
+}
+
+int
+jack_disconnect_batch (jack_client_t *client, const char **source_ports,
+		       const char **destination_ports, unsigned int npairs)
+{
+	return jack_port_batch_request (client, DisconnectPortsBatch,
+					source_ports, destination_ports,
+					npairs);
+}
+
 int
 jack_port_disconnect (jack_client_t *client, jack_port_t *port)
 {
@@ -2773,6 +3978,121 @@ jack_set_process_callback (jack_client_t *client,
 	return 0;
 }
 
+/* Run process() one period behind the graph: the client's inputs are
+ * what its sources made a cycle earlier, and its outputs reach the
+ * clients after it a cycle late, but the ones after it do not wait for
+ * its process() to finish. The extra period shows in the latency of
+ * its ports.
+ */
+int
+jack_set_process_async (jack_client_t *client, int onoff)
+{
+	JSList *node;
+
+	if (client->control->active) {
+		jack_error ("You cannot change the process mode of an active client.");
+		return -1;
+	}
+
+	if (client->control->type != ClientExternal) {
+		jack_error ("Only external clients can process one period behind.");
+		return -1;
+	}
+
+	if (client->control->thread_cb_cbset || client->control->decimation) {
+		jack_error ("A client with a thread callback, or woken every few "
+			    "periods, cannot process one period behind.");
+		return -1;
+	}
+
+	onoff = (onoff != 0);
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		jack_port_t *port = (jack_port_t*)node->data;
+
+		/* unregistered ports linger here without a buffer */
+		if (onoff && (!port->shared->in_use ||
+			      jack_uuid_compare (port->shared->client_id,
+						 client->control->uuid) != 0)) {
+			continue;
+		}
+		if (jack_port_set_async (client, port, onoff)) {
+			for (node = client->ports; node; node = jack_slist_next (node)) {
+				jack_port_set_async (client, (jack_port_t*)node->data, FALSE);
+			}
+			return -1;
+		}
+	}
+
+	client->control->process_async = onoff;
+	return 0;
+}
+
+/* Belongs in <jack/jack.h>.
+ *
+ * Wake the client only once every `periods' cycles, with the audio its
+ * inputs got in all of them: process() is called with nframes =
+ * periods * jack_get_buffer_size(), and jack_port_get_buffer() on an
+ * input returns that many frames, oldest first. The first of them
+ * is at jack_last_frame_time() - nframes. The engine copies the
+ * periods aside at the end of every cycle, so the client may be up to
+ * `periods' periods late, but it takes one wakeup where it took
+ * `periods', and its process() still has to be done within the cycle
+ * it runs in. Meant for recorders, analyzers and encoders: the client
+ * can only have audio inputs. 1 goes back to a wakeup every cycle.
+ */
+int
+jack_set_process_decimation (jack_client_t *client, unsigned int periods)
+{
+	JSList *node;
+
+	if (client->control->active) {
+		jack_error ("You cannot change the process mode of an active client.");
+		return -1;
+	}
+
+	if (client->control->type != ClientExternal) {
+		jack_error ("Only external clients can be woken every few periods.");
+		return -1;
+	}
+
+	if (client->control->thread_cb_cbset || client->control->process_async) {
+		jack_error ("A client with a thread callback or one that processes "
+			    "one period behind cannot be woken every few periods.");
+		return -1;
+	}
+
+	if (periods == 0 || periods > JACK_DECIMATION_MAX) {
+		jack_error ("A client can be woken every 1 to %d periods, not %u.",
+			    JACK_DECIMATION_MAX, periods);
+		return -1;
+	}
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		jack_port_t *port = (jack_port_t*)node->data;
+
+		if (periods > 1 && port->shared->in_use &&
+		    jack_uuid_compare (port->shared->client_id,
+				       client->control->uuid) == 0 &&
+		    ((port->shared->flags & JackPortIsOutput) ||
+		     port->shared->ptype_id != JACK_AUDIO_PORT_TYPE)) {
+			jack_error ("A client woken every few periods can only have "
+				    "audio inputs (%s).", port->names->name);
+			return -1;
+		}
+	}
+
+	/* a ring from an earlier activation is gone: the engine lays
+	   out a new one when it activates us */
+	if (client->ring_base) {
+		jack_release_shm (&client->ring_shm);
+		client->ring_base = NULL;
+	}
+
+	client->control->decimation = (periods > 1 ? periods : 0);
+	return 0;
+}
+
 int
 jack_set_thread_init_callback (jack_client_t *client,
 			       JackThreadInitCallback callback, void *arg)
@@ -2832,6 +4152,83 @@ jack_set_port_rename_callback (jack_client_t *client,
 	return 0;
 }
 
+int
+jack_set_graph_changed_callback (jack_client_t *client,
+				 JackGraphChangedCallback callback,
+				 void *arg)
+{
+	if (client->control->active) {
+		jack_error ("You cannot set callbacks on an active client.");
+		return -1;
+	}
+	client->graph_changed_arg = arg;
+	client->graph_changed_cb = callback;
+	client->control->graph_changed_cbset = (callback != NULL);
+	return 0;
+}
+
+uint32_t
+jack_get_graph_epoch (jack_client_t *client)
+{
+	uint32_t epoch = client->engine->graph_epoch;
+
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	return epoch;
+}
+
+/* the connection changes announced after epoch `since', oldest first.
+ * returns how many there are, of which up to `max' are copied, or -1
+ * if some have already been overwritten: then the only way to catch
+ * up is to look at all the connections again.
+ */
+int
+jack_get_graph_changes (jack_client_t *client, uint32_t since,
+			jack_graph_change_t *changes, int max)
+{
+	jack_control_t *engine = client->engine;
+	volatile jack_graph_change_t *change;
+	uint32_t epoch, head, start, i;
+	int n = 0;
+
+	epoch = engine->graph_epoch;
+	head = engine->graph_changes_head;
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+	/* entries of epochs still to be announced are at the end */
+	while (head != 0 &&
+	       engine->graph_changes[(head - 1) & (JACK_GRAPH_CHANGES_MAX - 1)].epoch > epoch) {
+		head--;
+	}
+
+	for (start = head; start != 0; start--) {
+		if (head - start + 1 >= JACK_GRAPH_CHANGES_MAX) {
+			return -1;
+		}
+		change = &engine->graph_changes[(start - 1) & (JACK_GRAPH_CHANGES_MAX - 1)];
+		if (change->epoch <= since) {
+			break;
+		}
+	}
+
+	for (i = start; i != head; i++, n++) {
+		if (n < max) {
+			change = &engine->graph_changes[i & (JACK_GRAPH_CHANGES_MAX - 1)];
+			changes[n].epoch = change->epoch;
+			changes[n].source = change->source;
+			changes[n].destination = change->destination;
+			changes[n].connected = change->connected;
+		}
+	}
+
+	/* the engine may have lapped us while we were copying */
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	if (engine->graph_changes_head - start >= JACK_GRAPH_CHANGES_MAX) {
+		return -1;
+	}
+
+	return n;
+}
+
 int
 jack_set_port_registration_callback (jack_client_t *client,
 				     JackPortRegistrationCallback callback,
@@ -2998,6 +4395,138 @@ jack_reserve_client_name (jack_client_t *client, const char *name, const char *u
 	return jack_client_deliver_request (client, &request);
 }
 
+/* jack_get_ports() patterns that are plain strings, optionally
+   anchored at either end, are matched without the regex engine.
+ */
+typedef enum {
+	JackPatternAny,
+	JackPatternRegex,
+	JackPatternExact,
+	JackPatternPrefix,
+	JackPatternSuffix,
+	JackPatternSubstring
+} jack_pattern_kind_t;
+
+typedef struct {
+	jack_pattern_kind_t kind;
+	char literal[JACK_PORT_NAME_SIZE];
+	size_t len;
+	regex_t regex;
+} jack_port_pattern_t;
+
+static int
+jack_port_pattern_compile (jack_port_pattern_t *pat, const char *pattern)
+{
+	const char *p;
+	int head = 0, tail = 0;
+	size_t len = 0;
+
+	if (pattern == NULL || pattern[0] == '\0') {
+		pat->kind = JackPatternAny;
+		return 0;
+	}
+
+	p = pattern;
+
+	if (*p == '^') {
+		head = 1;
+		p++;
+	}
+
+	for (; *p; p++) {
+		if (*p == '$' && p[1] == '\0') {
+			tail = 1;
+			break;
+		}
+		if (*p == '\\' && p[1] && strchr (".[]()*+?{}|\\^$", p[1])) {
+			p++;
+		} else if (strchr (".[]()*+?{}|\\^$", *p)) {
+			goto regex;
+		}
+		if (len == sizeof(pat->literal) - 1) {
+			goto regex;
+		}
+		pat->literal[len++] = *p;
+	}
+
+	pat->literal[len] = '\0';
+	pat->len = len;
+
+	if (head && tail) {
+		pat->kind = JackPatternExact;
+	} else if (head) {
+		pat->kind = JackPatternPrefix;
+	} else if (tail) {
+		pat->kind = JackPatternSuffix;
+	} else {
+		pat->kind = JackPatternSubstring;
+	}
+
+	return 0;
+
+regex:
+	if (regcomp (&pat->regex, pattern, REG_EXTENDED | REG_NOSUB)) {
+		jack_error ("invalid port pattern \"%s\"", pattern);
+		return -1;
+	}
+	pat->kind = JackPatternRegex;
+	return 0;
+}
+
+static int
+jack_port_pattern_match (jack_port_pattern_t *pat, const char *str)
+{
+	size_t len;
+
+	switch (pat->kind) {
+	case JackPatternAny:
+		return 1;
+	case JackPatternExact:
+		return strcmp (str, pat->literal) == 0;
+	case JackPatternPrefix:
+		return strncmp (str, pat->literal, pat->len) == 0;
+	case JackPatternSuffix:
+		len = strlen (str);
+		return len >= pat->len &&
+		       strcmp (str + len - pat->len, pat->literal) == 0;
+	case JackPatternSubstring:
+		return strstr (str, pat->literal) != NULL;
+	case JackPatternRegex:
+		return regexec (&pat->regex, str, 0, NULL, 0) == 0;
+	}
+
+	return 0;
+}
+
+static void
+jack_port_pattern_free (jack_port_pattern_t *pat)
+{
+	if (pat->kind == JackPatternRegex) {
+		regfree (&pat->regex);
+	}
+}
+
+static int
+jack_port_list_add (const char ***list, unsigned long *cnt,
+		    unsigned long *size, const char *name)
+{
+	const char **bigger;
+
+	/* leave room for the terminating NULL */
+
+	if (*cnt + 1 >= *size) {
+		*size = (*size ? *size * 2 : 16);
+		if ((bigger = (const char**)realloc (*list, sizeof(char*) * *size)) == NULL) {
+			return -1;
+		}
+		*list = bigger;
+	}
+
+	(*list)[(*cnt)++] = name;
+
+	return 0;
+}
+
 const char **
 jack_get_ports (jack_client_t *client,
 		const char *port_name_pattern,
@@ -3005,87 +4534,264 @@ jack_get_ports (jack_client_t *client,
 		unsigned long flags)
 {
 	jack_control_t *engine;
-	const char **matching_ports;
-	unsigned long match_cnt;
+	const char **matching_ports = NULL;
+	unsigned long match_cnt = 0;
+	unsigned long match_size = 0;
 	jack_port_shared_t *psp;
-	unsigned long i;
-	regex_t port_regex;
-	regex_t type_regex;
-	int matching;
+	const char *name;
+	jack_port_pattern_t port_pat;
+	jack_port_pattern_t type_pat;
+	char type_ok[JACK_MAX_PORT_TYPES];
+	unsigned long i, limit;
 
 	engine = client->engine;
+	limit = jack_attach_port_table (client);
 
-	if (port_name_pattern && port_name_pattern[0]) {
-		regcomp (&port_regex, port_name_pattern,
-			 REG_EXTENDED | REG_NOSUB);
+	if (jack_port_pattern_compile (&port_pat, port_name_pattern)) {
+		return NULL;
 	}
-	if (type_name_pattern && type_name_pattern[0]) {
-		regcomp (&type_regex, type_name_pattern,
-			 REG_EXTENDED | REG_NOSUB);
+
+	if (jack_port_pattern_compile (&type_pat, type_name_pattern)) {
+		jack_port_pattern_free (&port_pat);
+		return NULL;
 	}
 
-	psp = engine->ports;
-	match_cnt = 0;
+	/* there are only a few port types, so match them up front */
 
-	if ((matching_ports = (const char**)malloc (sizeof(char *) * (engine->port_max + 1))) == NULL) {
-		return NULL;
+	for (i = 0; i < JACK_MAX_PORT_TYPES; i++) {
+		type_ok[i] = (i < engine->n_port_types &&
+			      jack_port_pattern_match (&type_pat,
+						       engine->port_types[i].type_name));
+	}
+
+	jack_port_pattern_free (&type_pat);
+
+	/* an exact name is usually in the port name index */
+
+	if (port_pat.kind == JackPatternExact &&
+	    (psp = jack_port_hash_lookup (engine, client->port_table,
+					  port_pat.literal)) != NULL) {
+		if ((psp->flags & flags) == flags &&
+		    psp->ptype_id < JACK_MAX_PORT_TYPES && type_ok[psp->ptype_id] &&
+		    jack_port_list_add (&matching_ports, &match_cnt, &match_size,
+					jack_port_table_names (client->port_table,
+							       engine, psp->id)->name) == 0) {
+			matching_ports[match_cnt] = 0;
+		}
+		return matching_ports;
 	}
 
-	for (i = 0; i < engine->port_max; i++) {
-		matching = 1;
+	for (i = 0; i < limit; i++) {
 
-		if (!psp[i].in_use) {
+		psp = jack_port_table_entry (client->port_table, engine, i);
+
+		if (!psp->in_use) {
 			continue;
 		}
 
-		if (flags) {
-			if ((psp[i].flags & flags) != flags) {
-				matching = 0;
-			}
+		if ((psp->flags & flags) != flags) {
+			continue;
 		}
 
-		if (matching && port_name_pattern && port_name_pattern[0]) {
-			if (regexec (&port_regex, psp[i].name, 0, NULL, 0)) {
-				matching = 0;
-			}
+		if (psp->ptype_id >= JACK_MAX_PORT_TYPES ||
+		    !type_ok[psp->ptype_id]) {
+			continue;
 		}
 
-		if (matching && type_name_pattern && type_name_pattern[0]) {
-			jack_port_type_id_t ptid = psp[i].ptype_id;
-			if (regexec (&type_regex,
-				     engine->port_types[ptid].type_name,
-				     0, NULL, 0)) {
-				matching = 0;
-			}
+		name = jack_port_table_names (client->port_table, engine, i)->name;
+
+		if (!jack_port_pattern_match (&port_pat, name)) {
+			continue;
 		}
 
-		if (matching) {
-			matching_ports[match_cnt++] = psp[i].name;
+		if (jack_port_list_add (&matching_ports, &match_cnt,
+					&match_size, name)) {
+			free (matching_ports);
+			matching_ports = 0;
+			match_cnt = 0;
+			break;
 		}
 	}
-	if (port_name_pattern && port_name_pattern[0]) {
-		regfree (&port_regex);
-	}
-	if (type_name_pattern && type_name_pattern[0]) {
-		regfree (&type_regex);
-	}
 
-	if (match_cnt == 0) {
-		free (matching_ports);
-		matching_ports = 0;
-	} else {
+	jack_port_pattern_free (&port_pat);
+
+	if (match_cnt) {
 		matching_ports[match_cnt] = 0;
 	}
 
 	return matching_ports;
 }
 
+static int
+jack_pattern_equals (const char *a, const char *b)
+{
+	if (a == NULL || a[0] == '\0') {
+		return b == NULL || b[0] == '\0';
+	}
+	return b && strcmp (a, b) == 0;
+}
+
+/* Like jack_get_ports(), but the result is reused until ports are
+   registered, unregistered or renamed. It belongs to the client: do
+   not free it, and do not use it after the next call to this
+   function.
+ */
+const char **
+jack_get_ports_cached (jack_client_t *client,
+		       const char *port_name_pattern,
+		       const char *type_name_pattern,
+		       unsigned long flags)
+{
+	jack_ports_cache_t *entry = NULL;
+	const char **ports;
+	uint32_t generation;
+	int i;
+
+	pthread_mutex_lock (&client->ports_cache_lock);
+
+	generation = client->engine->port_generation;
+
+	for (i = 0; i < JACK_PORTS_CACHE_SIZE; i++) {
+		jack_ports_cache_t *e = &client->ports_cache[i];
+		if (e->valid && e->flags == flags &&
+		    jack_pattern_equals (e->port_name_pattern, port_name_pattern) &&
+		    jack_pattern_equals (e->type_name_pattern, type_name_pattern)) {
+			entry = e;
+			break;
+		}
+	}
+
+	if (entry && entry->generation == generation) {
+		ports = entry->ports;
+		pthread_mutex_unlock (&client->ports_cache_lock);
+		return ports;
+	}
+
+	if (entry == NULL) {
+		entry = &client->ports_cache[client->ports_cache_next];
+		client->ports_cache_next =
+			(client->ports_cache_next + 1) % JACK_PORTS_CACHE_SIZE;
+	}
+
+	jack_ports_cache_clear (entry);
+
+	entry->ports = jack_get_ports (client, port_name_pattern,
+				       type_name_pattern, flags);
+	entry->port_name_pattern = (port_name_pattern ? strdup (port_name_pattern) : NULL);
+	entry->type_name_pattern = (type_name_pattern ? strdup (type_name_pattern) : NULL);
+	entry->flags = flags;
+	entry->generation = generation;
+	entry->valid = ((port_name_pattern == NULL) == (entry->port_name_pattern == NULL) &&
+			(type_name_pattern == NULL) == (entry->type_name_pattern == NULL));
+
+	ports = entry->ports;
+
+	pthread_mutex_unlock (&client->ports_cache_lock);
+
+	return ports;
+}
+
+/* A copy of the port table, kept by the caller and refreshed with
+   jack_port_snapshot_update(). Ids stay meaningful after a port is
+   unregistered (they just no longer resolve), which pointers to port
+   names in the engine segment do not. The layout is published with
+   the prototypes below. */
+typedef struct {
+	jack_port_id_t id;
+	uint32_t flags;
+	jack_port_type_id_t ptype_id;
+} jack_port_snapshot_entry_t;
+
+typedef struct {
+	jack_port_snapshot_entry_t *ports;      /* caller's buffer */
+	uint32_t size;                          /* entries it holds */
+	uint32_t count;                         /* ports in use */
+	uint32_t generation;                    /* port_generation copied at */
+	int valid;
+} jack_port_snapshot_t;
+
+
+void
+jack_port_snapshot_init (jack_port_snapshot_t *snapshot,
+			 jack_port_snapshot_entry_t *buffer, uint32_t size)
+{
+	snapshot->ports = buffer;
+	snapshot->size = size;
+	snapshot->count = 0;
+	snapshot->generation = 0;
+	snapshot->valid = FALSE;
+}
+
+
+/* Bring `snapshot' up to date. Returns 0 if nothing was registered,
+   unregistered or renamed since it was taken, which costs a single
+   load, 1 if it was copied again, or -1 if the buffer is too small:
+   then `count' is the number of entries needed. */
+int
+jack_port_snapshot_update (jack_client_t *client,
+			   jack_port_snapshot_t *snapshot)
+{
+	jack_control_t *engine = client->engine;
+	jack_port_shared_t *psp;
+	unsigned long i, limit;
+	uint32_t generation, n;
+
+	generation = engine->port_generation;
+
+	if (snapshot->valid && snapshot->generation == generation) {
+		return 0;
+	}
+
+	/* the engine bumps the generation once a change is in place;
+	   a copy that saw it move is taken again */
+
+	do {
+		generation = engine->port_generation;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+		limit = jack_attach_port_table (client);
+
+		for (n = 0, i = 0; i < limit; i++) {
+			psp = jack_port_table_entry (client->port_table, engine, i);
+			if (!psp->in_use) {
+				continue;
+			}
+			if (n < snapshot->size) {
+				snapshot->ports[n].id = psp->id;
+				snapshot->ports[n].flags = psp->flags;
+				snapshot->ports[n].ptype_id = psp->ptype_id;
+			}
+			n++;
+		}
+
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while (engine->port_generation != generation);
+
+	snapshot->count = n;
+
+	if (n > snapshot->size) {
+		snapshot->valid = FALSE;
+		return -1;
+	}
+
+	snapshot->generation = generation;
+	snapshot->valid = TRUE;
+
+	return 1;
+}
+
 float
 jack_cpu_load (jack_client_t *client)
 {
 	return client->engine->cpu_load;
 }
 
+float
+jack_get_freewheel_rate (jack_client_t *client)
+{
+	return client->engine->freewheel_rate;
+}
+
 float
 jack_get_xrun_delayed_usecs (jack_client_t *client)
 {
@@ -3159,6 +4865,10 @@ jack_event_type_name (JackEventType type)
 		return "port registered";
 	case PortUnregistered:
 		return "port unregistered";
+	case PortsRegistered:
+		return "ports registered";
+	case PortsUnregistered:
+		return "ports unregistered";
 	case XRun:
 		return "xrun";
 	case StartFreewheel:
@@ -3177,6 +4887,10 @@ jack_event_type_name (JackEventType type)
 		return "property change callback";
 	case PortRename:
 		return "port rename";
+	case GraphChanged:
+		return "graph changed";
+	case EventsQueued:
+		return "events queued";
 	default:
 		break;
 	}
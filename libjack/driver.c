@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
 
 #include <jack/thread.h>
 
@@ -116,10 +118,113 @@ static int dummy_nt_detach (jack_driver_nt_t *drv)
 #define DRIVER_NT_PAUSE 2
 #define DRIVER_NT_DYING 3
 
+/* the engine calls these instead of the driver's own read and write,
+   so that the nt layer can tell them from the rest of the cycle */
+static int
+jack_driver_nt_read (jack_driver_nt_t * driver, jack_nframes_t nframes)
+{
+	jack_time_t start = jack_get_microseconds ();
+	int ret;
+
+	ret = driver->nt_timed_read ((jack_driver_t*)driver, nframes);
+	driver->nt_timing.read_usecs += jack_get_microseconds () - start;
+
+	return ret;
+}
+
+static int
+jack_driver_nt_write (jack_driver_nt_t * driver, jack_nframes_t nframes)
+{
+	jack_time_t start = jack_get_microseconds ();
+	int ret;
+
+	ret = driver->nt_timed_write ((jack_driver_t*)driver, nframes);
+	driver->nt_timing.write_usecs += jack_get_microseconds () - start;
+
+	return ret;
+}
+
+static void
+jack_driver_nt_timing_add (jack_driver_nt_timing_t *timing, int phase,
+			   jack_time_t usecs)
+{
+	timing->sum[phase] += usecs;
+	if (usecs > timing->max[phase]) {
+		timing->max[phase] = usecs;
+	}
+}
+
+/* split the cycle that ran from `begin' to `end' into its phases. a
+   cycle that did not get as far as the driver's read (an xrun it
+   recovered from) is left out. drivers that date last_wait_ust back
+   to the period boundary may put it before `begin' */
+static void
+jack_driver_nt_timing_record (jack_driver_nt_t * driver, jack_time_t begin,
+			      jack_time_t end)
+{
+	jack_driver_nt_timing_t *timing = &driver->nt_timing;
+	jack_time_t woke = driver->last_wait_ust;
+	jack_time_t io = timing->read_usecs + timing->write_usecs;
+
+	if (woke < begin) {
+		woke = begin;
+	}
+
+	if (woke <= end && timing->read_usecs) {
+		timing->cycles++;
+		jack_driver_nt_timing_add (timing, JackDriverNTWait,
+					   woke - begin);
+		jack_driver_nt_timing_add (timing, JackDriverNTRead,
+					   timing->read_usecs);
+		jack_driver_nt_timing_add (timing, JackDriverNTProcess,
+					   end - woke > io ? end - woke - io : 0);
+		jack_driver_nt_timing_add (timing, JackDriverNTWrite,
+					   timing->write_usecs);
+	}
+
+	timing->read_usecs = 0;
+	timing->write_usecs = 0;
+}
+
+static void
+jack_driver_nt_timing_report (jack_driver_nt_t * driver)
+{
+	jack_driver_nt_timing_t *timing = &driver->nt_timing;
+	double n = timing->cycles;
+
+	if (timing->cycles == 0) {
+		return;
+	}
+
+	VERBOSE (driver->engine, "DRIVER NT: %lu cycles, wait/read/process/write "
+		 "mean %.1f/%.1f/%.1f/%.1f usecs, max %" PRIu64 "/%" PRIu64
+		 "/%" PRIu64 "/%" PRIu64 " usecs", timing->cycles,
+		 timing->sum[JackDriverNTWait] / n,
+		 timing->sum[JackDriverNTRead] / n,
+		 timing->sum[JackDriverNTProcess] / n,
+		 timing->sum[JackDriverNTWrite] / n,
+		 timing->max[JackDriverNTWait],
+		 timing->max[JackDriverNTRead],
+		 timing->max[JackDriverNTProcess],
+		 timing->max[JackDriverNTWrite]);
+}
+
 static int
 jack_driver_nt_attach (jack_driver_nt_t * driver, jack_engine_t * engine)
 {
 	driver->engine = engine;
+
+	/* drivers set read and write directly, which is as late as they
+	   can be taken over */
+	if (driver->read != (JackDriverReadFunction)jack_driver_nt_read) {
+		driver->nt_timed_read = driver->read;
+		driver->read = (JackDriverReadFunction)jack_driver_nt_read;
+	}
+	if (driver->write != (JackDriverWriteFunction)jack_driver_nt_write) {
+		driver->nt_timed_write = driver->write;
+		driver->write = (JackDriverWriteFunction)jack_driver_nt_write;
+	}
+
 	return driver->nt_attach (driver);
 }
 
@@ -131,6 +236,9 @@ jack_driver_nt_detach (jack_driver_nt_t * driver, jack_engine_t * engine)
 	ret = driver->nt_detach (driver);
 	driver->engine = NULL;
 
+	driver->read = driver->nt_timed_read;
+	driver->write = driver->nt_timed_write;
+
 	return ret;
 }
 
@@ -138,8 +246,8 @@ static void *
 jack_driver_nt_thread (void * arg)
 {
 	jack_driver_nt_t * driver = (jack_driver_nt_t*)arg;
+	jack_time_t begin, end;
 	int rc = 0;
-	int run;
 
 	/* This thread may start running before pthread_create()
 	 * actually stores the driver->nt_thread value.  It's safer to
@@ -148,24 +256,42 @@ jack_driver_nt_thread (void * arg)
 
 	driver->nt_thread = pthread_self ();
 
+	/* this thread runs the engine cycle: jackd --engine-cpus */
+	if (driver->engine->engine_cpus) {
+		jack_set_thread_cpus (driver->nt_thread,
+				      driver->engine->engine_cpus);
+	}
+
+	/* wait for jack_driver_nt_start() to finish starting the device */
 	pthread_mutex_lock (&driver->nt_run_lock);
+	pthread_mutex_unlock (&driver->nt_run_lock);
 
-	while ((run = driver->nt_run) == DRIVER_NT_RUN) {
-		pthread_mutex_unlock (&driver->nt_run_lock);
+	/* the driver has been started, so its period is known. the
+	   thread is restarted when the period changes */
+	if (driver->engine->control->deadline && driver->period_usecs) {
+		jack_set_deadline_scheduling (0, driver->period_usecs *
+					      JACK_DEADLINE_ENGINE_SHARE / 100,
+					      driver->period_usecs);
+	}
+
+	begin = jack_get_microseconds ();
+
+	while (__atomic_load_n (&driver->nt_run, __ATOMIC_ACQUIRE)
+	       == DRIVER_NT_RUN) {
 
 		if ((rc = driver->nt_run_cycle (driver)) != 0) {
 			jack_error ("DRIVER NT: could not run driver cycle");
-			goto out;
+			break;
 		}
 
-		pthread_mutex_lock (&driver->nt_run_lock);
+		end = jack_get_microseconds ();
+		jack_driver_nt_timing_record (driver, begin, end);
+		begin = end;
 	}
 
-	pthread_mutex_unlock (&driver->nt_run_lock);
-
-out:
 	if (rc) {
-		driver->nt_run = DRIVER_NT_DYING;
+		__atomic_store_n (&driver->nt_run, DRIVER_NT_DYING,
+				  __ATOMIC_RELEASE);
 		driver->engine->driver_exit (driver->engine);
 	}
 	pthread_exit (NULL);
@@ -181,20 +307,25 @@ jack_driver_nt_start (jack_driver_nt_t * driver)
 	 */
 
 	pthread_mutex_lock (&driver->nt_run_lock);
-	driver->nt_run = DRIVER_NT_RUN;
+	__atomic_store_n (&driver->nt_run, DRIVER_NT_RUN, __ATOMIC_RELEASE);
+
+	memset (&driver->nt_timing, 0, sizeof(driver->nt_timing));
+	driver->nt_next_wakeup = 0;
 
 	if ((err = jack_client_create_thread (NULL,
 					      &driver->nt_thread,
 					      driver->engine->rtpriority,
 					      driver->engine->control->real_time,
 					      jack_driver_nt_thread, driver)) != 0) {
+		pthread_mutex_unlock (&driver->nt_run_lock);
 		jack_error ("DRIVER NT: could not start driver thread!");
 		return err;
 	}
 
 	if ((err = driver->nt_start (driver)) != 0) {
 		/* make the thread run and exit immediately */
-		driver->nt_run = DRIVER_NT_EXIT;
+		__atomic_store_n (&driver->nt_run, DRIVER_NT_EXIT,
+				  __ATOMIC_RELEASE);
 		pthread_mutex_unlock (&driver->nt_run_lock);
 		jack_error ("DRIVER NT: could not start driver");
 		return err;
@@ -210,22 +341,27 @@ jack_driver_nt_start (jack_driver_nt_t * driver)
 static int
 jack_driver_nt_do_stop (jack_driver_nt_t * driver, int run)
 {
+	int running = DRIVER_NT_RUN;
 	int err;
 
-	pthread_mutex_lock (&driver->nt_run_lock);
-	if (driver->nt_run != DRIVER_NT_DYING) {
-		driver->nt_run = run;
+	/* a thread that is shutting itself down has set DYING, which
+	   must stay */
+	if (!__atomic_compare_exchange_n (&driver->nt_run, &running, run, 0,
+					  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+	    && running != DRIVER_NT_DYING) {
+		__atomic_store_n (&driver->nt_run, run, __ATOMIC_RELEASE);
 	}
-	pthread_mutex_unlock (&driver->nt_run_lock);
 
 	/* detect when called while the thread is shutting itself down */
-	if (driver->nt_thread && driver->nt_run != DRIVER_NT_DYING
+	if (driver->nt_thread && running != DRIVER_NT_DYING
 	    && (err = pthread_join (driver->nt_thread, NULL)) != 0) {
 		jack_error ("DRIVER NT: error waiting for driver thread: %s",
 			    strerror (err));
 		return err;
 	}
 
+	jack_driver_nt_timing_report (driver);
+
 	if ((err = driver->nt_stop (driver)) != 0) {
 		jack_error ("DRIVER NT: error stopping driver");
 		return err;
@@ -265,6 +401,63 @@ jack_driver_nt_bufsize (jack_driver_nt_t * driver, jack_nframes_t nframes)
 	return ret;
 }
 
+/* Sleep until the next deadline of CLOCK_MONOTONIC, one period after
+ * the last, so that neither sleep overshoot nor adjustments of the
+ * wall clock accumulate. The first call after a start does not sleep.
+ * Returns 0 with the wakeup lateness in *late_usecs, 1 if the
+ * following deadline had already passed too, in which case the
+ * deadlines start over from now: the driver should treat that as an
+ * xrun. -1 if the clock cannot be slept on.
+ */
+int
+jack_driver_nt_timer_wait (jack_driver_nt_t * driver,
+			   jack_time_t period_usecs, float *late_usecs)
+{
+#if HAVE_CLOCK_GETTIME && HAVE_CLOCK_NANOSLEEP
+	struct timespec ts;
+	uint64_t now;
+	int err;
+
+	*late_usecs = 0;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	if (driver->nt_next_wakeup == 0) {
+		/* first time through */
+		driver->nt_next_wakeup = now;
+	} else if (now < driver->nt_next_wakeup) {
+		ts.tv_sec = driver->nt_next_wakeup / 1000000000ULL;
+		ts.tv_nsec = driver->nt_next_wakeup % 1000000000ULL;
+		while ((err = clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &ts, NULL)) == EINTR) {
+		}
+		if (err) {
+			jack_error ("DRIVER NT: error while sleeping (%s)",
+				    strerror (err));
+			return -1;
+		}
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	if (now > driver->nt_next_wakeup) {
+		*late_usecs = (now - driver->nt_next_wakeup) / 1000.0f;
+	}
+
+	if (*late_usecs > period_usecs) {
+		driver->nt_next_wakeup = now + period_usecs * 1000ULL;
+		return 1;
+	}
+
+	driver->nt_next_wakeup += period_usecs * 1000ULL;
+	return 0;
+#else
+	*late_usecs = 0;
+	return -1;
+#endif
+}
+
 void
 jack_driver_nt_init (jack_driver_nt_t * driver)
 {
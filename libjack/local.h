@@ -1,6 +1,18 @@
 #ifndef __jack_libjack_local_h__
 #define __jack_libjack_local_h__
 
+/* Results kept by jack_get_ports_cached(). */
+#define JACK_PORTS_CACHE_SIZE 8
+
+typedef struct {
+	char *port_name_pattern;
+	char *type_name_pattern;
+	unsigned long flags;
+	uint32_t generation;
+	const char **ports;
+	int valid;
+} jack_ports_cache_t;
+
 /* Client data structure, in the client address space. */
 struct _jack_client {
 
@@ -8,12 +20,14 @@ struct _jack_client {
 	jack_client_control_t *control;
 	jack_shm_info_t engine_shm;
 	jack_shm_info_t control_shm;
+	int32_t control_slot;           /* in control_shm, -1: all of it */
 
 	struct pollfd*  pollfd;
 	int pollmax;
 	int graph_next_fd;
 	int request_fd;
 	int upstream_is_jackd;
+	int32_t graph_next_slot;        /* futex activation slot to wake, or -1 */
 
 	/* these two are copied from the engine when the
 	 * client is created.
@@ -22,9 +36,22 @@ struct _jack_client {
 	jack_port_type_id_t n_port_types;
 	jack_shm_info_t*    port_segment;
 
+	/* decimated clients: the engine's ring of input periods, as
+	   of control->ring_serial, see jack_set_process_decimation() */
+	jack_shm_info_t ring_shm;
+	uint32_t ring_serial;
+	char *ring_base;
+
+	/* the engine's own for internal clients */
+	jack_port_table_t  *port_table;
+
 	JSList *ports;
 	JSList *ports_ext;
 
+	pthread_mutex_t ports_cache_lock;
+	jack_ports_cache_t ports_cache[JACK_PORTS_CACHE_SIZE];
+	unsigned int ports_cache_next;
+
 	pthread_t thread;
 	char fifo_prefix[PATH_MAX + 1];
 	void (*on_shutdown)(void *arg);
@@ -33,16 +60,23 @@ struct _jack_client {
 	void *on_info_shutdown_arg;
 	char thread_ok : 1;
 	char first_active : 1;
+	char event_thread_ok : 1;
+	pthread_t event_thread;
 	pthread_t thread_id;
 	char name[JACK_CLIENT_NAME_SIZE];
 	int session_cb_immediate_reply;
 
 #ifdef JACK_USE_MACH_THREADS
 	/* specific ressources for server/client real-time thread communication */
-	mach_port_t clienttask, bp, serverport, replyport;
-	trivial_message message;
+	mach_port_t clienttask, bp;
+	semaphore_t wake_sem, done_sem;
+	int resumed;                    /* the next suspend finishes a cycle */
 	pthread_t process_thread;
 	char rt_thread_ok : 1;
+#ifdef JACK_USE_OS_WORKGROUP
+	os_workgroup_t workgroup;       /* the audio device's, or NULL */
+	os_workgroup_join_token_s workgroup_token;
+#endif
 #endif
 
 	/* callbacks
@@ -79,8 +113,22 @@ struct _jack_client {
 	void *latency_cb_arg;
 	JackPropertyChangeCallback property_cb;
 	void *property_cb_arg;
+
+	/* cpus for the process thread, "auto" to follow the engine's
+	   suggestion, NULL to leave it alone */
+	char *process_cpus;
+	int process_cpu;                /* suggestion followed, -1: none,
+					   JACK_MAX_CPUS: the list is set */
+	int process_tid;                /* kernel thread id, for SCHED_DEADLINE */
+	int spin_usecs;                 /* $JACK_SPIN_WAIT, -1: the server's */
+	jack_activation_spin_t spin;    /* the process thread's, see activation.h */
+	uint64_t cycle_cpu_nsecs;       /* at awake_at, see jack_thread_usage() */
+	uint32_t cycle_preemptions;
+	struct _jack_worker_pool *worker_pool; /* see workerpool.c */
 	JackPortRenameCallback port_rename_cb;
 	void *port_rename_arg;
+	JackGraphChangedCallback graph_changed_cb;
+	void *graph_changed_arg;
 
 	/* external clients: set by libjack
 	 * internal clients: set by engine */
@@ -94,10 +142,30 @@ extern int jack_client_deliver_request(const jack_client_t *client,
 extern jack_port_t *jack_port_new(const jack_client_t *client,
 				  jack_port_id_t port_id,
 				  jack_control_t *control);
+extern void jack_port_update_sources(jack_port_t *port);
+extern void jack_port_free(jack_port_t *port);
+extern unsigned long jack_attach_port_table(const jack_client_t *client);
+extern jack_port_shared_t *jack_port_shared_by_id(const jack_client_t *client,
+						  jack_port_id_t id);
 
 extern void *jack_zero_filled_buffer;
 
 extern void jack_set_clock_source (jack_timer_type_t);
 extern char* jack_server_dir(const char* server_name, char* server_dir);
 
+extern void jack_property_store_attach (jack_control_t *engine);
+extern void jack_property_store_detach (jack_control_t *engine);
+
+extern int jack_client_apply_process_cpus (jack_client_t *client);
+extern int jack_client_apply_deadline (jack_client_t *client);
+extern int jack_worker_pool_apply_cpus (struct _jack_worker_pool *pool);
+extern void jack_worker_pool_destroy (struct _jack_worker_pool *pool);
+
+extern int jack_port_set_async (jack_client_t *client, jack_port_t *port,
+				int onoff);
+extern void jack_port_async_exchange (jack_port_t *port, jack_nframes_t nframes);
+extern void jack_client_mark_unwritten (jack_client_t *client);
+extern void jack_client_update_meters (jack_client_t *client,
+				       jack_nframes_t nframes);
+
 #endif /* __jack_libjack_local_h__ */
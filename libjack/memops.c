@@ -0,0 +1,1614 @@
+/*
+    Copyright (C) 2000 Paul Davis
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#define _ISOC9X_SOURCE  1
+#define _ISOC99_SOURCE  1
+
+#define __USE_ISOC9X    1
+#define __USE_ISOC99    1
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#if defined(__linux__) || defined(__GLIBC__)
+#include <endian.h>
+#endif
+
+/* elsewhere (every backend links memops now) the compiler's own */
+#ifndef __BYTE_ORDER
+#define __BYTE_ORDER    __BYTE_ORDER__
+#define __LITTLE_ENDIAN __ORDER_LITTLE_ENDIAN__
+#define __BIG_ENDIAN    __ORDER_BIG_ENDIAN__
+#endif
+
+#include "memops.h"
+
+/* Notes about these *_SCALING values.
+
+   the MAX_<N>BIT values are floating point. when multiplied by
+   a full-scale normalized floating point sample value (-1.0..+1.0)
+   they should give the maxium value representable with an integer
+   sample type of N bits. Note that this is asymmetric. Sample ranges
+   for signed integer, 2's complement values are -(2^(N-1) to +(2^(N-1)-1)
+
+   Complications
+   -------------
+   If we use +2^(N-1) for the scaling factors, we run into a problem:
+
+   if we start with a normalized float value of -1.0, scaling
+   to 24 bits would give -8388608 (-2^23), which is ideal.
+   But with +1.0, we get +8388608, which is technically out of range.
+
+   We never multiply a full range normalized value by this constant,
+   but we could multiply it by a positive value that is close enough to +1.0
+   to produce a value > +(2^(N-1)-1.
+
+   There is no way around this paradox without wasting CPU cycles to determine
+   which scaling factor to use (i.e. determine if its negative or not,
+   use the right factor).
+
+   So, for now (October 2008) we use 2^(N-1)-1 as the scaling factor.
+ */
+
+#define SAMPLE_24BIT_SCALING  8388607.0f
+#define SAMPLE_16BIT_SCALING  32767.0f
+
+/* all 32 bits, scaled so that a sample comes out at the same level as
+   through the 24 bit path: 8388607 << 8 is full scale in both */
+#define SAMPLE_32BIT_SCALING  2147483392.0
+
+/* these are just values to use if the floating point value was out of range
+
+   advice from Fons Adriaensen: make the limits symmetrical
+ */
+
+#define SAMPLE_24BIT_MAX  8388607
+#define SAMPLE_24BIT_MIN  -8388607
+#define SAMPLE_24BIT_MAX_F  8388607.0f
+#define SAMPLE_24BIT_MIN_F  -8388607.0f
+
+#define SAMPLE_16BIT_MAX  32767
+#define SAMPLE_16BIT_MIN  -32767
+#define SAMPLE_16BIT_MAX_F  32767.0f
+#define SAMPLE_16BIT_MIN_F  -32767.0f
+
+/* these mark the outer edges of the range considered "within" range
+   for a floating point sample value. values outside (and on the boundaries)
+   of this range will be clipped before conversion; values within this
+   range will be scaled to appropriate values for the target sample
+   type.
+ */
+
+#define NORMALIZED_FLOAT_MIN -1.0f
+#define NORMALIZED_FLOAT_MAX  1.0f
+
+/* define this in case we end up on a platform that is missing
+   the real lrintf functions
+ */
+
+#define f_round(f) lrintf (f)
+
+#define float_16(s, d) \
+	if ((s) <= NORMALIZED_FLOAT_MIN) { \
+		(d) = SAMPLE_16BIT_MIN;	\
+	} else if ((s) >= NORMALIZED_FLOAT_MAX) { \
+		(d) = SAMPLE_16BIT_MAX;	\
+	} else { \
+		(d) = f_round ((s) * SAMPLE_16BIT_SCALING); \
+	}
+
+/* call this when "s" has already been scaled (e.g. when dithering)
+ */
+
+#define float_16_scaled(s, d) \
+	if ((s) <= SAMPLE_16BIT_MIN_F) { \
+		(d) = SAMPLE_16BIT_MIN_F; \
+	} else if ((s) >= SAMPLE_16BIT_MAX_F) {	\
+		(d) = SAMPLE_16BIT_MAX;	\
+	} else { \
+		(d) = f_round ((s)); \
+	}
+
+#define float_24u32(s, d) \
+	if ((s) <= NORMALIZED_FLOAT_MIN) { \
+		(d) = SAMPLE_24BIT_MIN << 8; \
+	} else if ((s) >= NORMALIZED_FLOAT_MAX) { \
+		(d) = SAMPLE_24BIT_MAX << 8; \
+	} else { \
+		(d) = f_round ((s) * SAMPLE_24BIT_SCALING) << 8; \
+	}
+
+/* call this when "s" has already been scaled (e.g. when dithering)
+ */
+
+#define float_24u32_scaled(s, d) \
+	if ((s) <= SAMPLE_24BIT_MIN_F) { \
+		(d) = SAMPLE_24BIT_MIN << 8; \
+	} else if ((s) >= SAMPLE_24BIT_MAX_F) {	\
+		(d) = SAMPLE_24BIT_MAX << 8;		\
+	} else { \
+		(d) = f_round ((s)) << 8; \
+	}
+
+#define float_24(s, d) \
+	if ((s) <= NORMALIZED_FLOAT_MIN) { \
+		(d) = SAMPLE_24BIT_MIN;	\
+	} else if ((s) >= NORMALIZED_FLOAT_MAX) { \
+		(d) = SAMPLE_24BIT_MAX;	\
+	} else { \
+		(d) = f_round ((s) * SAMPLE_24BIT_SCALING); \
+	}
+
+/* call this when "s" has already been scaled (e.g. when dithering)
+ */
+
+#define float_24_scaled(s, d) \
+	if ((s) <= SAMPLE_24BIT_MIN_F) { \
+		(d) = SAMPLE_24BIT_MIN;	\
+	} else if ((s) >= SAMPLE_24BIT_MAX_F) {	\
+		(d) = SAMPLE_24BIT_MAX;		\
+	} else { \
+		(d) = f_round ((s)); \
+	}
+
+
+/* Linear Congruential noise generator. From the music-dsp list
+ * less random than rand(), but good enough and 10x faster
+ */
+
+static inline unsigned int fast_rand ()
+{
+	static unsigned int seed = 22222;
+
+	seed = (seed * 96314165) + 907633515;
+
+	return seed;
+}
+
+
+/* functions for native float sample data */
+
+void sample_move_floatLE_sSs (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* non-interleaved hardware float is already in JACK's format */
+	if (src_skip == sizeof(float)) {
+		memcpy (dst, src, nsamples * sizeof(float));
+		return;
+	}
+
+	while (nsamples--) {
+		*dst = *((float*)src);
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_floatLE (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	if (dst_skip == sizeof(float)) {
+		memcpy (dst, src, nsamples * sizeof(float));
+		return;
+	}
+
+	while (nsamples--) {
+		*((float*)dst) = *src;
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dS_s64f (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	while (nsamples--) {
+		*dst = (jack_default_audio_sample_t)*((double*)src);
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_d64f_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		*((double*)dst) = *src;
+		dst += dst_skip;
+		src++;
+	}
+}
+
+/* NOTES on function naming:
+
+   foo_bar_d<TYPE>_s<TYPE>
+
+   the "d<TYPE>" component defines the destination type for the operation
+   the "s<TYPE>" component defines the source type for the operation
+
+   TYPE can be one of:
+
+   S      - sample is a jack_default_audio_sample_t, currently (October 2008) a 32 bit floating point value
+   Ss     - like S but reverse endian from the host CPU
+   32u24  - sample is an signed 32 bit integer value, but data is in upper 24 bits only
+   32u24s - like 32u24 but reverse endian from the host CPU
+   32l24  - sample is a signed 24 bit integer value, sign extended to 32 bits
+   64f    - sample is a 64 bit floating point value
+   24     - sample is an signed 24 bit integer value
+   24s    - like 24 but reverse endian from the host CPU
+   16     - sample is an signed 16 bit integer value
+   16s    - like 16 but reverse endian from the host CPU
+
+   For obvious reasons, the reverse endian versions only show as source types.
+
+   This covers all known sample formats at 16 bits or larger.
+ */
+
+/* functions for native integer sample data */
+
+void sample_move_d32u24_sSs (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t z;
+
+	while (nsamples--) {
+
+		float_24u32 (*src, z);
+
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(z >> 24);
+		dst[1] = (char)(z >> 16);
+		dst[2] = (char)(z >> 8);
+		dst[3] = (char)(z);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(z);
+		dst[1] = (char)(z >> 8);
+		dst[2] = (char)(z >> 16);
+		dst[3] = (char)(z >> 24);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_d32u24_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		float_24u32 (*src, *((int32_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dS_s32u24s (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		int x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		x = (unsigned char)(src[0]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[3]);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		x = (unsigned char)(src[3]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[0]);
+#endif
+		*dst = (x >> 8) / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_s32u24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		*dst = (*((int*)src) >> 8) / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_d32l24_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		float_24 (*src, *((int32_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dS_s32l24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	while (nsamples--) {
+		*dst = *((int32_t*)src) / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dD_s32s (double *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	while (nsamples--) {
+		int32_t x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		x = (unsigned char)(src[0]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[3]);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		x = (unsigned char)(src[3]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[0]);
+#endif
+		*dst = x / SAMPLE_32BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dD_s32 (double *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	while (nsamples--) {
+		*dst = *((int32_t*)src) / SAMPLE_32BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_d24_sSs (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t z;
+
+	while (nsamples--) {
+		float_24 (*src, z);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(z >> 16);
+		dst[1] = (char)(z >> 8);
+		dst[2] = (char)(z);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(z);
+		dst[1] = (char)(z >> 8);
+		dst[2] = (char)(z >> 16);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_d24_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t z;
+
+	while (nsamples--) {
+		float_24 (*src, z);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		memcpy (dst, &z, 3);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		memcpy (dst, (char*)&z + 1, 3);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dS_s24s (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		int x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		x = (unsigned char)(src[0]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		/* correct sign bit and the rest of the top byte */
+		if (src[0] & 0x80) {
+			x |= 0xff << 24;
+		}
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		x = (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[0]);
+		/* correct sign bit and the rest of the top byte */
+		if (src[2] & 0x80) {
+			x |= 0xff << 24;
+		}
+#endif
+		*dst = x / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_s24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		int x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		memcpy ((char*)&x + 1, src, 3);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		memcpy (&x, src, 3);
+#endif
+		x >>= 8;
+		*dst = x / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+
+void sample_move_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int16_t tmp;
+
+	while (nsamples--) {
+		// float_16 (*src, tmp);
+
+		if (*src <= NORMALIZED_FLOAT_MIN) {
+			tmp = SAMPLE_16BIT_MIN;
+		} else if (*src >= NORMALIZED_FLOAT_MAX) {
+			tmp = SAMPLE_16BIT_MAX;
+		} else {
+			tmp = (int16_t)f_round (*src * SAMPLE_16BIT_SCALING);
+		}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		float_16 (*src, *((int16_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_rect_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+	int16_t tmp;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + fast_rand () / (float)UINT_MAX - 0.5f;
+		float_16_scaled (val, tmp);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_rect_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + fast_rand () / (float)UINT_MAX - 0.5f;
+		float_16_scaled (val, *((int16_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_tri_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+	int16_t tmp;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + ((float)fast_rand () + (float)fast_rand ()) / (float)UINT_MAX - 1.0f;
+		float_16_scaled (val, tmp);
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_tri_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + ((float)fast_rand () + (float)fast_rand ()) / (float)UINT_MAX - 1.0f;
+		float_16_scaled (val, *((int16_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_shaped_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t x;
+	jack_default_audio_sample_t xe;         /* the innput sample - filtered error */
+	jack_default_audio_sample_t xp;         /* x' */
+	float r;
+	float rm1 = state->rm1;
+	unsigned int idx = state->idx;
+	int16_t tmp;
+
+	while (nsamples--) {
+		x = *src * SAMPLE_16BIT_SCALING;
+		r = ((float)fast_rand () + (float)fast_rand ())  / (float)UINT_MAX - 1.0f;
+		/* Filter the error with Lipshitz's minimally audible FIR:
+		   [2.033 -2.165 1.959 -1.590 0.6149] */
+		xe = x
+		     - state->e[idx] * 2.033f
+		     + state->e[(idx - 1) & DITHER_BUF_MASK] * 2.165f
+		     - state->e[(idx - 2) & DITHER_BUF_MASK] * 1.959f
+		     + state->e[(idx - 3) & DITHER_BUF_MASK] * 1.590f
+		     - state->e[(idx - 4) & DITHER_BUF_MASK] * 0.6149f;
+		xp = xe + r - rm1;
+		rm1 = r;
+
+		float_16_scaled (xp, tmp);
+
+		/* Intrinsic z^-1 delay */
+		idx = (idx + 1) & DITHER_BUF_MASK;
+		state->e[idx] = xp - xe;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+	state->rm1 = rm1;
+	state->idx = idx;
+}
+
+void sample_move_dither_shaped_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t x;
+	jack_default_audio_sample_t xe;         /* the innput sample - filtered error */
+	jack_default_audio_sample_t xp;         /* x' */
+	float r;
+	float rm1 = state->rm1;
+	unsigned int idx = state->idx;
+
+	while (nsamples--) {
+		x = *src * SAMPLE_16BIT_SCALING;
+		r = ((float)fast_rand () + (float)fast_rand ()) / (float)UINT_MAX - 1.0f;
+		/* Filter the error with Lipshitz's minimally audible FIR:
+		   [2.033 -2.165 1.959 -1.590 0.6149] */
+		xe = x
+		     - state->e[idx] * 2.033f
+		     + state->e[(idx - 1) & DITHER_BUF_MASK] * 2.165f
+		     - state->e[(idx - 2) & DITHER_BUF_MASK] * 1.959f
+		     + state->e[(idx - 3) & DITHER_BUF_MASK] * 1.590f
+		     - state->e[(idx - 4) & DITHER_BUF_MASK] * 0.6149f;
+		xp = xe + r - rm1;
+		rm1 = r;
+
+		float_16_scaled (xp, *((int16_t*)dst));
+
+		/* Intrinsic z^-1 delay */
+		idx = (idx + 1) & DITHER_BUF_MASK;
+		state->e[idx] = *((int16_t*)dst) - xe;
+
+		dst += dst_skip;
+		src++;
+	}
+	state->rm1 = rm1;
+	state->idx = idx;
+}
+
+void sample_move_dS_s16s (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	short z;
+
+	/* ALERT: signed sign-extension portability !!! */
+	while (nsamples--) {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		z = (unsigned char)(src[0]);
+		z <<= 8;
+		z |= (unsigned char)(src[1]);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		z = (unsigned char)(src[1]);
+		z <<= 8;
+		z |= (unsigned char)(src[0]);
+#endif
+		*dst = z / SAMPLE_16BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_s16 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+
+{
+	/* ALERT: signed sign-extension portability !!! */
+	while (nsamples--) {
+		*dst = (*((short*)src)) / SAMPLE_16BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void memset_interleave (char *dst, char val, unsigned long bytes,
+			unsigned long unit_bytes,
+			unsigned long skip_bytes)
+{
+	switch (unit_bytes) {
+	case 1:
+		while (bytes--) {
+			*dst = val;
+			dst += skip_bytes;
+		}
+		break;
+	case 2:
+		while (bytes) {
+			*((short*)dst) = (short)val;
+			dst += skip_bytes;
+			bytes -= 2;
+		}
+		break;
+	case 4:
+		while (bytes) {
+			*((int*)dst) = (int)val;
+			dst += skip_bytes;
+			bytes -= 4;
+		}
+		break;
+	default:
+		while (bytes) {
+			memset (dst, val, unit_bytes);
+			dst += skip_bytes;
+			bytes -= unit_bytes;
+		}
+		break;
+	}
+}
+
+/* COPY FUNCTIONS: used to move data from an input channel to an
+   output channel. Note that we assume that the skip distance
+   is the same for both channels. This is completely fine
+   unless the input and output were on different audio interfaces that
+   were interleaved differently. We don't try to handle that.
+ */
+
+void
+memcpy_fake (char *dst, char *src, unsigned long src_bytes, unsigned long foo, unsigned long bar)
+{
+	memcpy (dst, src, src_bytes);
+}
+
+void
+memcpy_interleave_d16_s16 (char *dst, char *src, unsigned long src_bytes,
+			   unsigned long dst_skip_bytes, unsigned long src_skip_bytes)
+{
+	while (src_bytes) {
+		*((short*)dst) = *((short*)src);
+		dst += dst_skip_bytes;
+		src += src_skip_bytes;
+		src_bytes -= 2;
+	}
+}
+
+void
+memcpy_interleave_d24_s24 (char *dst, char *src, unsigned long src_bytes,
+			   unsigned long dst_skip_bytes, unsigned long src_skip_bytes)
+
+{
+	while (src_bytes) {
+		memcpy (dst, src, 3);
+		dst += dst_skip_bytes;
+		src += src_skip_bytes;
+		src_bytes -= 3;
+	}
+}
+
+void
+memcpy_interleave_d32_s32 (char *dst, char *src, unsigned long src_bytes,
+			   unsigned long dst_skip_bytes, unsigned long src_skip_bytes)
+
+{
+	while (src_bytes) {
+		*((int*)dst) = *((int*)src);
+		dst += dst_skip_bytes;
+		src += src_skip_bytes;
+		src_bytes -= 4;
+	}
+}
+
+
+/* SIMD sample conversion.
+
+   The kernels below convert between floats and contiguous arrays of
+   32 or 16 bit integers, clipping like the scalar macros above and
+   rounding to nearest like lrintf(). The *_simd sample movers call
+   them straight on the hardware buffer when it is non-interleaved,
+   and convert through a small stack buffer otherwise, so that only
+   the strided loads and stores of interleaved layouts stay scalar.
+
+   memops_simd_init() picks the widest kernels the CPU described by
+   libjack's cpu_type can run, and returns NULL if there are none, in
+   which case the *_simd movers must not be used.
+ */
+
+#define MEMOPS_SIMD_CHUNK 256
+
+typedef struct {
+	const char *name;
+	/* dst = round (clip (src) * scale) << shift */
+	void (*f2i)(int32_t *dst, const float *src, unsigned long n,
+		    float scale, int shift);
+	/* dst = round (clip (src) * SAMPLE_16BIT_SCALING) */
+	void (*f2s16)(int16_t *dst, const float *src, unsigned long n);
+	/* dst = (src >> shift) / scale */
+	void (*i2f)(float *dst, const int32_t *src, unsigned long n,
+		    float scale, int shift);
+	/* dst = src / SAMPLE_16BIT_SCALING */
+	void (*s162f)(float *dst, const int16_t *src, unsigned long n);
+} memops_simd_t;
+
+static memops_simd_t memops_simd;
+
+#ifdef USE_DYNSIMD
+
+#include "intsimd.h"
+
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif  /* ARCH_X86 */
+
+#ifdef ARCH_ARM64
+#include <arm_neon.h>
+#endif  /* ARCH_ARM64 */
+
+/* the scalar versions, for the tails the vector loops leave */
+
+static inline void
+gen_f2i (int32_t *dst, const float *src, unsigned long n, float scale,
+	 int shift)
+{
+	float f;
+
+	while (n--) {
+		f = *src++;
+		if (f <= NORMALIZED_FLOAT_MIN) {
+			f = NORMALIZED_FLOAT_MIN;
+		} else if (f >= NORMALIZED_FLOAT_MAX) {
+			f = NORMALIZED_FLOAT_MAX;
+		}
+		*dst++ = (int32_t)((uint32_t)f_round (f * scale) << shift);
+	}
+}
+
+static inline void
+gen_f2s16 (int16_t *dst, const float *src, unsigned long n)
+{
+	while (n--) {
+		float_16 (*src, *dst);
+		dst++;
+		src++;
+	}
+}
+
+static inline void
+gen_i2f (float *dst, const int32_t *src, unsigned long n, float scale,
+	 int shift)
+{
+	while (n--) {
+		*dst++ = (*src++ >> shift) / scale;
+	}
+}
+
+static inline void
+gen_s162f (float *dst, const int16_t *src, unsigned long n)
+{
+	while (n--) {
+		*dst++ = *src++ / SAMPLE_16BIT_SCALING;
+	}
+}
+
+#ifdef ARCH_X86
+
+/* built with target attributes like the kernels in libjack/simd.c,
+   so the driver still loads on CPUs without the instruction set */
+
+__attribute__((target ("sse2"))) static void
+sse2_f2i (int32_t *dst, const float *src, unsigned long n, float scale,
+	  int shift)
+{
+	unsigned long i, nv = n & ~0x3UL;
+	__m128 lo = _mm_set1_ps (NORMALIZED_FLOAT_MIN);
+	__m128 hi = _mm_set1_ps (NORMALIZED_FLOAT_MAX);
+	__m128 s = _mm_set1_ps (scale);
+	__m128i sh = _mm_cvtsi32_si128 (shift);
+	__m128 f;
+
+	for (i = 0; i < nv; i += 4) {
+		f = _mm_min_ps (_mm_max_ps (_mm_loadu_ps (src + i), lo), hi);
+		_mm_storeu_si128 ((__m128i*)(dst + i),
+				  _mm_sll_epi32 (_mm_cvtps_epi32 (
+							 _mm_mul_ps (f, s)), sh));
+	}
+	gen_f2i (dst + nv, src + nv, n - nv, scale, shift);
+}
+
+__attribute__((target ("sse2"))) static void
+sse2_f2s16 (int16_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m128 lo = _mm_set1_ps (NORMALIZED_FLOAT_MIN);
+	__m128 hi = _mm_set1_ps (NORMALIZED_FLOAT_MAX);
+	__m128 s = _mm_set1_ps (SAMPLE_16BIT_SCALING);
+	__m128i a, b;
+
+	for (i = 0; i < nv; i += 8) {
+		a = _mm_cvtps_epi32 (_mm_mul_ps (_mm_min_ps (_mm_max_ps (
+						_mm_loadu_ps (src + i), lo), hi), s));
+		b = _mm_cvtps_epi32 (_mm_mul_ps (_mm_min_ps (_mm_max_ps (
+						_mm_loadu_ps (src + i + 4), lo), hi), s));
+		_mm_storeu_si128 ((__m128i*)(dst + i), _mm_packs_epi32 (a, b));
+	}
+	gen_f2s16 (dst + nv, src + nv, n - nv);
+}
+
+__attribute__((target ("sse2"))) static void
+sse2_i2f (float *dst, const int32_t *src, unsigned long n, float scale,
+	  int shift)
+{
+	unsigned long i, nv = n & ~0x3UL;
+	__m128 s = _mm_set1_ps (scale);
+	__m128i sh = _mm_cvtsi32_si128 (shift);
+	__m128i x;
+
+	for (i = 0; i < nv; i += 4) {
+		x = _mm_sra_epi32 (_mm_loadu_si128 ((const __m128i*)(src + i)), sh);
+		_mm_storeu_ps (dst + i, _mm_div_ps (_mm_cvtepi32_ps (x), s));
+	}
+	gen_i2f (dst + nv, src + nv, n - nv, scale, shift);
+}
+
+__attribute__((target ("sse2"))) static void
+sse2_s162f (float *dst, const int16_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m128 s = _mm_set1_ps (SAMPLE_16BIT_SCALING);
+	__m128i x, a, b;
+
+	for (i = 0; i < nv; i += 8) {
+		x = _mm_loadu_si128 ((const __m128i*)(src + i));
+		a = _mm_srai_epi32 (_mm_unpacklo_epi16 (x, x), 16);
+		b = _mm_srai_epi32 (_mm_unpackhi_epi16 (x, x), 16);
+		_mm_storeu_ps (dst + i, _mm_div_ps (_mm_cvtepi32_ps (a), s));
+		_mm_storeu_ps (dst + i + 4, _mm_div_ps (_mm_cvtepi32_ps (b), s));
+	}
+	gen_s162f (dst + nv, src + nv, n - nv);
+}
+
+__attribute__((target ("avx2"))) static void
+avx2_f2i (int32_t *dst, const float *src, unsigned long n, float scale,
+	  int shift)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m256 lo = _mm256_set1_ps (NORMALIZED_FLOAT_MIN);
+	__m256 hi = _mm256_set1_ps (NORMALIZED_FLOAT_MAX);
+	__m256 s = _mm256_set1_ps (scale);
+	__m128i sh = _mm_cvtsi32_si128 (shift);
+	__m256 f;
+
+	for (i = 0; i < nv; i += 8) {
+		f = _mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (src + i), lo), hi);
+		_mm256_storeu_si256 ((__m256i*)(dst + i),
+				     _mm256_sll_epi32 (_mm256_cvtps_epi32 (
+							       _mm256_mul_ps (f, s)), sh));
+	}
+	gen_f2i (dst + nv, src + nv, n - nv, scale, shift);
+}
+
+__attribute__((target ("avx2"))) static void
+avx2_f2s16 (int16_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0xfUL;
+	__m256 lo = _mm256_set1_ps (NORMALIZED_FLOAT_MIN);
+	__m256 hi = _mm256_set1_ps (NORMALIZED_FLOAT_MAX);
+	__m256 s = _mm256_set1_ps (SAMPLE_16BIT_SCALING);
+	__m256i a, b;
+
+	for (i = 0; i < nv; i += 16) {
+		a = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_min_ps (_mm256_max_ps (
+							      _mm256_loadu_ps (src + i), lo), hi), s));
+		b = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_min_ps (_mm256_max_ps (
+							      _mm256_loadu_ps (src + i + 8), lo), hi), s));
+		/* packs works within 128 bit lanes, put them back in order */
+		_mm256_storeu_si256 ((__m256i*)(dst + i),
+				     _mm256_permute4x64_epi64 (
+					     _mm256_packs_epi32 (a, b), 0xd8));
+	}
+	gen_f2s16 (dst + nv, src + nv, n - nv);
+}
+
+__attribute__((target ("avx2"))) static void
+avx2_i2f (float *dst, const int32_t *src, unsigned long n, float scale,
+	  int shift)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m256 s = _mm256_set1_ps (scale);
+	__m128i sh = _mm_cvtsi32_si128 (shift);
+	__m256i x;
+
+	for (i = 0; i < nv; i += 8) {
+		x = _mm256_sra_epi32 (_mm256_loadu_si256 ((const __m256i*)(src + i)), sh);
+		_mm256_storeu_ps (dst + i, _mm256_div_ps (_mm256_cvtepi32_ps (x), s));
+	}
+	gen_i2f (dst + nv, src + nv, n - nv, scale, shift);
+}
+
+__attribute__((target ("avx2"))) static void
+avx2_s162f (float *dst, const int16_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	__m256 s = _mm256_set1_ps (SAMPLE_16BIT_SCALING);
+	__m256i x;
+
+	for (i = 0; i < nv; i += 8) {
+		x = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i*)(src + i)));
+		_mm256_storeu_ps (dst + i, _mm256_div_ps (_mm256_cvtepi32_ps (x), s));
+	}
+	gen_s162f (dst + nv, src + nv, n - nv);
+}
+
+#endif  /* ARCH_X86 */
+
+#ifdef ARCH_ARM64
+
+static void
+neon_f2i (int32_t *dst, const float *src, unsigned long n, float scale,
+	  int shift)
+{
+	unsigned long i, nv = n & ~0x3UL;
+	float32x4_t lo = vdupq_n_f32 (NORMALIZED_FLOAT_MIN);
+	float32x4_t hi = vdupq_n_f32 (NORMALIZED_FLOAT_MAX);
+	int32x4_t sh = vdupq_n_s32 (shift);
+	float32x4_t f;
+
+	for (i = 0; i < nv; i += 4) {
+		f = vminq_f32 (vmaxq_f32 (vld1q_f32 (src + i), lo), hi);
+		vst1q_s32 (dst + i, vshlq_s32 (vcvtnq_s32_f32 (
+						       vmulq_n_f32 (f, scale)), sh));
+	}
+	gen_f2i (dst + nv, src + nv, n - nv, scale, shift);
+}
+
+static void
+neon_f2s16 (int16_t *dst, const float *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	float32x4_t lo = vdupq_n_f32 (NORMALIZED_FLOAT_MIN);
+	float32x4_t hi = vdupq_n_f32 (NORMALIZED_FLOAT_MAX);
+	int32x4_t a, b;
+
+	for (i = 0; i < nv; i += 8) {
+		a = vcvtnq_s32_f32 (vmulq_n_f32 (vminq_f32 (vmaxq_f32 (
+						vld1q_f32 (src + i), lo), hi), SAMPLE_16BIT_SCALING));
+		b = vcvtnq_s32_f32 (vmulq_n_f32 (vminq_f32 (vmaxq_f32 (
+						vld1q_f32 (src + i + 4), lo), hi), SAMPLE_16BIT_SCALING));
+		vst1q_s16 (dst + i, vcombine_s16 (vqmovn_s32 (a), vqmovn_s32 (b)));
+	}
+	gen_f2s16 (dst + nv, src + nv, n - nv);
+}
+
+static void
+neon_i2f (float *dst, const int32_t *src, unsigned long n, float scale,
+	  int shift)
+{
+	unsigned long i, nv = n & ~0x3UL;
+	float32x4_t s = vdupq_n_f32 (scale);
+	int32x4_t sh = vdupq_n_s32 (-shift);
+
+	for (i = 0; i < nv; i += 4)
+		vst1q_f32 (dst + i, vdivq_f32 (vcvtq_f32_s32 (
+						       vshlq_s32 (vld1q_s32 (src + i), sh)), s));
+	gen_i2f (dst + nv, src + nv, n - nv, scale, shift);
+}
+
+static void
+neon_s162f (float *dst, const int16_t *src, unsigned long n)
+{
+	unsigned long i, nv = n & ~0x7UL;
+	float32x4_t s = vdupq_n_f32 (SAMPLE_16BIT_SCALING);
+	int16x8_t x;
+
+	for (i = 0; i < nv; i += 8) {
+		x = vld1q_s16 (src + i);
+		vst1q_f32 (dst + i, vdivq_f32 (vcvtq_f32_s32 (
+						       vmovl_s16 (vget_low_s16 (x))), s));
+		vst1q_f32 (dst + i + 4, vdivq_f32 (vcvtq_f32_s32 (
+							   vmovl_s16 (vget_high_s16 (x))), s));
+	}
+	gen_s162f (dst + nv, src + nv, n - nv);
+}
+
+#endif  /* ARCH_ARM64 */
+
+#endif  /* USE_DYNSIMD */
+
+const char *
+memops_simd_init ()
+{
+#ifdef USE_DYNSIMD
+#ifdef ARCH_X86
+	if (ARCH_X86_HAVE_AVX2 (cpu_type)) {
+		memops_simd.name = "AVX2";
+		memops_simd.f2i = avx2_f2i;
+		memops_simd.f2s16 = avx2_f2s16;
+		memops_simd.i2f = avx2_i2f;
+		memops_simd.s162f = avx2_s162f;
+	} else if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		memops_simd.name = "SSE2";
+		memops_simd.f2i = sse2_f2i;
+		memops_simd.f2s16 = sse2_f2s16;
+		memops_simd.i2f = sse2_i2f;
+		memops_simd.s162f = sse2_s162f;
+	}
+#endif  /* ARCH_X86 */
+
+#ifdef ARCH_ARM64
+	if (ARCH_ARM64_HAVE_NEON (cpu_type)) {
+		memops_simd.name = "NEON";
+		memops_simd.f2i = neon_f2i;
+		memops_simd.f2s16 = neon_f2s16;
+		memops_simd.i2f = neon_i2f;
+		memops_simd.s162f = neon_s162f;
+	}
+#endif  /* ARCH_ARM64 */
+#endif  /* USE_DYNSIMD */
+
+	return memops_simd.name;
+}
+
+void sample_move_d32u24_sS_simd (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	if (dst_skip == sizeof(int32_t)) {
+		memops_simd.f2i ((int32_t*)dst, src, nsamples,
+				 SAMPLE_24BIT_SCALING, 8);
+		return;
+	}
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		memops_simd.f2i (tmp, src, n, SAMPLE_24BIT_SCALING, 8);
+		for (i = 0; i < n; i++) {
+			*((int32_t*)dst) = tmp[i];
+			dst += dst_skip;
+		}
+		src += n;
+		nsamples -= n;
+	}
+}
+
+void sample_move_d32l24_sS_simd (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	if (dst_skip == sizeof(int32_t)) {
+		memops_simd.f2i ((int32_t*)dst, src, nsamples,
+				 SAMPLE_24BIT_SCALING, 0);
+		return;
+	}
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		memops_simd.f2i (tmp, src, n, SAMPLE_24BIT_SCALING, 0);
+		for (i = 0; i < n; i++) {
+			*((int32_t*)dst) = tmp[i];
+			dst += dst_skip;
+		}
+		src += n;
+		nsamples -= n;
+	}
+}
+
+void sample_move_d24_sS_simd (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		memops_simd.f2i (tmp, src, n, SAMPLE_24BIT_SCALING, 0);
+		for (i = 0; i < n; i++) {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+			memcpy (dst, &tmp[i], 3);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+			memcpy (dst, (char*)&tmp[i] + 1, 3);
+#endif
+			dst += dst_skip;
+		}
+		src += n;
+		nsamples -= n;
+	}
+}
+
+void sample_move_d16_sS_simd (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int16_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	if (dst_skip == sizeof(int16_t)) {
+		memops_simd.f2s16 ((int16_t*)dst, src, nsamples);
+		return;
+	}
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		memops_simd.f2s16 (tmp, src, n);
+		for (i = 0; i < n; i++) {
+			*((int16_t*)dst) = tmp[i];
+			dst += dst_skip;
+		}
+		src += n;
+		nsamples -= n;
+	}
+}
+
+void sample_move_dS_s32u24_simd (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	int32_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	if (src_skip == sizeof(int32_t)) {
+		memops_simd.i2f (dst, (const int32_t*)src, nsamples,
+				 SAMPLE_24BIT_SCALING, 8);
+		return;
+	}
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		for (i = 0; i < n; i++) {
+			tmp[i] = *((int32_t*)src);
+			src += src_skip;
+		}
+		memops_simd.i2f (dst, tmp, n, SAMPLE_24BIT_SCALING, 8);
+		dst += n;
+		nsamples -= n;
+	}
+}
+
+void sample_move_dS_s32l24_simd (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	int32_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	if (src_skip == sizeof(int32_t)) {
+		memops_simd.i2f (dst, (const int32_t*)src, nsamples,
+				 SAMPLE_24BIT_SCALING, 0);
+		return;
+	}
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		for (i = 0; i < n; i++) {
+			tmp[i] = *((int32_t*)src);
+			src += src_skip;
+		}
+		memops_simd.i2f (dst, tmp, n, SAMPLE_24BIT_SCALING, 0);
+		dst += n;
+		nsamples -= n;
+	}
+}
+
+void sample_move_dS_s24_simd (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	int32_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	/* the 3 bytes go to the top of tmp, the shift sign-extends them */
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		for (i = 0; i < n; i++) {
+			tmp[i] = 0;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+			memcpy ((char*)&tmp[i] + 1, src, 3);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+			memcpy (&tmp[i], src, 3);
+#endif
+			src += src_skip;
+		}
+		memops_simd.i2f (dst, tmp, n, SAMPLE_24BIT_SCALING, 8);
+		dst += n;
+		nsamples -= n;
+	}
+}
+
+void sample_move_dS_s16_simd (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	int16_t tmp[MEMOPS_SIMD_CHUNK];
+	unsigned long i, n;
+
+	if (src_skip == sizeof(int16_t)) {
+		memops_simd.s162f (dst, (const int16_t*)src, nsamples);
+		return;
+	}
+
+	while (nsamples) {
+		n = nsamples < MEMOPS_SIMD_CHUNK ? nsamples : MEMOPS_SIMD_CHUNK;
+		for (i = 0; i < n; i++) {
+			tmp[i] = *((int16_t*)src);
+			src += src_skip;
+		}
+		memops_simd.s162f (dst, tmp, n);
+		dst += n;
+		nsamples -= n;
+	}
+}
+
+/* The movers a backend without its own selection logic should use for
+   native-endian, undithered samples in `format': the SIMD versions
+   when the CPU has them. NULL for a format memops does not know.
+ */
+
+sample_read_func_t
+memops_read_func (memops_format_t format)
+{
+	int simd = memops_simd_init () != NULL;
+
+	switch (format) {
+	case MemopsS16:
+		return simd ? sample_move_dS_s16_simd : sample_move_dS_s16;
+	case MemopsS24:
+		return simd ? sample_move_dS_s24_simd : sample_move_dS_s24;
+	case MemopsS32L24:
+		return simd ? sample_move_dS_s32l24_simd : sample_move_dS_s32l24;
+	case MemopsS32:
+		return simd ? sample_move_dS_s32u24_simd : sample_move_dS_s32u24;
+	case MemopsFloat:
+		return sample_move_floatLE_sSs;
+	case MemopsDouble:
+		return sample_move_dS_s64f;
+	}
+
+	return NULL;
+}
+
+sample_write_func_t
+memops_write_func (memops_format_t format)
+{
+	int simd = memops_simd_init () != NULL;
+
+	switch (format) {
+	case MemopsS16:
+		return simd ? sample_move_d16_sS_simd : sample_move_d16_sS;
+	case MemopsS24:
+		return simd ? sample_move_d24_sS_simd : sample_move_d24_sS;
+	case MemopsS32L24:
+		return simd ? sample_move_d32l24_sS_simd : sample_move_d32l24_sS;
+	case MemopsS32:
+		return simd ? sample_move_d32u24_sS_simd : sample_move_d32u24_sS;
+	case MemopsFloat:
+		return sample_move_dS_floatLE;
+	case MemopsDouble:
+		return sample_move_d64f_sS;
+	}
+
+	return NULL;
+}
+
+/* BLOCKED FUNCTIONS: convert all channels of an interleaved buffer in
+   one sweep. Converting a whole channel at a time walks the entire
+   hardware buffer once per channel, which with many channels evicts
+   it from the cache before the next channel gets to it.
+ */
+
+void
+sample_move_blocked_dS (jack_default_audio_sample_t **dst, char **src,
+			unsigned long nchannels, unsigned long nsamples,
+			unsigned long *src_skip, sample_read_func_t read)
+{
+	unsigned long off, n, chn;
+
+	for (off = 0; off < nsamples; off += n) {
+		n = nsamples - off;
+		if (n > MEMOPS_BLOCK_FRAMES) {
+			n = MEMOPS_BLOCK_FRAMES;
+		}
+		for (chn = 0; chn < nchannels; chn++) {
+			if (dst[chn]) {
+				read (dst[chn] + off,
+				      src[chn] + off * src_skip[chn],
+				      n, src_skip[chn]);
+			}
+		}
+	}
+}
+
+void
+sample_move_blocked_d (char **dst, jack_default_audio_sample_t **src,
+		       unsigned long nchannels, unsigned long nsamples,
+		       unsigned long *dst_skip, dither_state_t *state,
+		       sample_write_func_t write)
+{
+	unsigned long off, n, chn;
+
+	for (off = 0; off < nsamples; off += n) {
+		n = nsamples - off;
+		if (n > MEMOPS_BLOCK_FRAMES) {
+			n = MEMOPS_BLOCK_FRAMES;
+		}
+		for (chn = 0; chn < nchannels; chn++) {
+			if (src[chn]) {
+				write (dst[chn] + off * dst_skip[chn],
+				       src[chn] + off, n, dst_skip[chn],
+				       state ? state + chn : NULL);
+			}
+		}
+	}
+}
+
+/* MULTI-CHANNEL DITHER: the serial dither functions draw every sample
+   from one global noise generator, so a channel's samples depend on
+   each other and cannot be computed side by side. These run
+   MEMOPS_DITHER_LANES channels in the lanes of a vector instead, each
+   lane with its own generator seed and error filter history kept in
+   that channel's dither_state_t. The arithmetic is written with GCC
+   vector extensions; on x86 and ARM it compiles to SSE2 and NEON.
+ */
+
+#define MEMOPS_DITHER_LANES 4
+
+typedef float dither_vf __attribute__((vector_size (16)));
+typedef int32_t dither_vi __attribute__((vector_size (16)));
+typedef uint32_t dither_vu __attribute__((vector_size (16)));
+
+/* adding and subtracting 1.5 * 2^23 rounds to nearest, like lrintf() */
+#define DITHER_ROUND_MAGIC 12582912.0f
+
+static inline dither_vf
+dither_clip_round (dither_vf x)
+{
+	const dither_vf lo = { SAMPLE_16BIT_MIN_F, SAMPLE_16BIT_MIN_F,
+			       SAMPLE_16BIT_MIN_F, SAMPLE_16BIT_MIN_F };
+	const dither_vf hi = { SAMPLE_16BIT_MAX_F, SAMPLE_16BIT_MAX_F,
+			       SAMPLE_16BIT_MAX_F, SAMPLE_16BIT_MAX_F };
+	dither_vi m;
+
+	m = x < lo;
+	x = (dither_vf)((m & (dither_vi)lo) | (~m & (dither_vi)x));
+	m = x > hi;
+	x = (dither_vf)((m & (dither_vi)hi) | (~m & (dither_vi)x));
+
+	return (x + DITHER_ROUND_MAGIC) - DITHER_ROUND_MAGIC;
+}
+
+/* triangular noise in [-1, 1) from two steps of each lane's generator */
+static inline dither_vf
+dither_tri_noise (dither_vu *seed)
+{
+	dither_vf a, b;
+
+	*seed = *seed * 96314165 + 907633515;
+	a = __builtin_convertvector ((dither_vi)*seed, dither_vf);
+	*seed = *seed * 96314165 + 907633515;
+	b = __builtin_convertvector ((dither_vi)*seed, dither_vf);
+
+	return (a + b) * (1.0f / (float)UINT_MAX);
+}
+
+typedef struct {
+	char *dst[MEMOPS_DITHER_LANES];
+	jack_default_audio_sample_t *src[MEMOPS_DITHER_LANES];
+	unsigned long skip[MEMOPS_DITHER_LANES];
+	dither_state_t *state[MEMOPS_DITHER_LANES];
+	dither_vu seed;
+} dither_lanes_t;
+
+/* Collect the next MEMOPS_DITHER_LANES channels with a source buffer,
+   starting at *chn. Missing lanes read silence and write nowhere.
+   Returns FALSE once there are none left.
+ */
+static int
+dither_lanes_next (dither_lanes_t *l, char **dst,
+		   jack_default_audio_sample_t **src, unsigned long nchannels,
+		   unsigned long *dst_skip, dither_state_t *state,
+		   unsigned long *chn, jack_default_audio_sample_t *silence,
+		   int16_t *sink, dither_state_t *spare)
+{
+	int lane = 0;
+
+	for (; *chn < nchannels && lane < MEMOPS_DITHER_LANES; (*chn)++) {
+		if (src[*chn] == NULL) {
+			continue;
+		}
+		l->dst[lane] = dst[*chn];
+		l->src[lane] = src[*chn];
+		l->skip[lane] = dst_skip[*chn];
+		l->state[lane] = state + *chn;
+		if (l->state[lane]->seed == 0) {
+			l->state[lane]->seed = fast_rand () | 1;
+		}
+		lane++;
+	}
+
+	if (lane == 0) {
+		return 0;
+	}
+
+	for (; lane < MEMOPS_DITHER_LANES; lane++) {
+		l->dst[lane] = (char*)sink;
+		l->src[lane] = silence;
+		l->skip[lane] = 0;
+		l->state[lane] = spare;
+		spare->seed = 1;
+	}
+
+	for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+		l->seed[lane] = l->state[lane]->seed;
+	}
+
+	return 1;
+}
+
+void sample_move_dither_tri_d16_sS_multi (char **dst, jack_default_audio_sample_t **src, unsigned long nchannels, unsigned long nsamples, unsigned long *dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t silence[1] = { 0.0f };
+	int16_t sink;
+	dither_state_t spare;
+	dither_lanes_t l;
+	unsigned long chn = 0, i;
+	dither_vf x, q;
+	int lane;
+
+	while (dither_lanes_next (&l, dst, src, nchannels, dst_skip, state,
+				  &chn, silence, &sink, &spare)) {
+		for (i = 0; i < nsamples; i++) {
+			for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+				x[lane] = l.src[lane][l.skip[lane] ? i : 0];
+			}
+			q = dither_clip_round (x * SAMPLE_16BIT_SCALING
+					       + dither_tri_noise (&l.seed));
+			for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+				*((int16_t*)(l.dst[lane] + i * l.skip[lane])) =
+					(int16_t)q[lane];
+			}
+		}
+		for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+			l.state[lane]->seed = l.seed[lane];
+		}
+	}
+}
+
+void sample_move_dither_shaped_d16_sS_multi (char **dst, jack_default_audio_sample_t **src, unsigned long nchannels, unsigned long nsamples, unsigned long *dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t silence[1] = { 0.0f };
+	int16_t sink;
+	dither_state_t spare;
+	dither_lanes_t l;
+	unsigned long chn = 0, i;
+	dither_vf x, xe, xp, q, r, rm1;
+	dither_vf h0, h1, h2, h3, h4;   /* error history, newest first */
+	dither_state_t *st;
+	unsigned int idx;
+	int lane;
+
+	memset (&spare, 0, sizeof(spare));
+
+	while (dither_lanes_next (&l, dst, src, nchannels, dst_skip, state,
+				  &chn, silence, &sink, &spare)) {
+
+		for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+			st = l.state[lane];
+			idx = st->idx;
+			rm1[lane] = st->rm1;
+			h0[lane] = st->e[idx];
+			h1[lane] = st->e[(idx - 1) & DITHER_BUF_MASK];
+			h2[lane] = st->e[(idx - 2) & DITHER_BUF_MASK];
+			h3[lane] = st->e[(idx - 3) & DITHER_BUF_MASK];
+			h4[lane] = st->e[(idx - 4) & DITHER_BUF_MASK];
+		}
+
+		for (i = 0; i < nsamples; i++) {
+			for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+				x[lane] = l.src[lane][l.skip[lane] ? i : 0];
+			}
+			x *= SAMPLE_16BIT_SCALING;
+			r = dither_tri_noise (&l.seed);
+			/* Lipshitz's minimally audible FIR, as in the
+			   serial version */
+			xe = x
+			     - h0 * 2.033f
+			     + h1 * 2.165f
+			     - h2 * 1.959f
+			     + h3 * 1.590f
+			     - h4 * 0.6149f;
+			xp = xe + r - rm1;
+			rm1 = r;
+			q = dither_clip_round (xp);
+			h4 = h3;
+			h3 = h2;
+			h2 = h1;
+			h1 = h0;
+			h0 = q - xe;
+			for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+				*((int16_t*)(l.dst[lane] + i * l.skip[lane])) =
+					(int16_t)q[lane];
+			}
+		}
+
+		for (lane = 0; lane < MEMOPS_DITHER_LANES; lane++) {
+			st = l.state[lane];
+			idx = (st->idx + nsamples) & DITHER_BUF_MASK;
+			st->idx = idx;
+			st->rm1 = rm1[lane];
+			st->seed = l.seed[lane];
+			st->e[idx] = h0[lane];
+			st->e[(idx - 1) & DITHER_BUF_MASK] = h1[lane];
+			st->e[(idx - 2) & DITHER_BUF_MASK] = h2[lane];
+			st->e[(idx - 3) & DITHER_BUF_MASK] = h3[lane];
+			st->e[(idx - 4) & DITHER_BUF_MASK] = h4[lane];
+		}
+	}
+}
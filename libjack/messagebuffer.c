@@ -29,47 +29,516 @@
 #include <string.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include "messagebuffer.h"
-#include "atomicity.h"
 #include "internal.h"
 
-/* MB_NEXT() relies on the fact that MB_BUFFERS is a power of two */
-#define MB_BUFFERS      128
-#define MB_NEXT(index) ((index + 1) & (MB_BUFFERS - 1))
-#define MB_BUFFERSIZE   256             /* message length limit */
+/* Messages are not formatted by the thread that adds them. A record
+ * holds a copy of the format and the raw arguments, with string
+ * arguments copied into the record, and the writer thread formats it
+ * later. Adding a message walks the format and does a few stores into
+ * a lock-free multi-producer ring (one sequence number per slot), so
+ * it is safe from any thread, including several realtime ones at once.
+ *
+ * The format is copied because the literals of a driver go away with
+ * its object when the engine unloads it, which may well be before the
+ * writer thread gets to the record.
+ *
+ * At most MB_RATE_LIMIT messages are taken per second, the rest are
+ * counted and reported, so an xrun storm cannot flood the log.
+ */
 
-static char mb_buffers[MB_BUFFERS][MB_BUFFERSIZE];
+/* MB_BUFFERS must be a power of two */
+#define MB_BUFFERS      256
+#define MB_BUFFERSIZE   256             /* message length limit */
+#define MB_MAXARGS      12
+#define MB_STRINGSIZE   192             /* room for copied string arguments */
+#define MB_FORMATSIZE   160             /* longer formats are cut short */
+#define MB_FLUSH_USECS  10000
+#define MB_RATE_LIMIT   200             /* messages per second */
+
+typedef union {
+	intmax_t i;
+	uintmax_t u;
+	double d;
+	long double ld;
+	const void *p;
+	unsigned int str;               /* offset into strings */
+} mb_arg_t;
+
+typedef struct {
+	volatile unsigned int seq;
+	unsigned int nargs;
+	unsigned int strused;
+	mb_arg_t args[MB_MAXARGS];
+	char format[MB_FORMATSIZE];
+	char strings[MB_STRINGSIZE];
+} mb_record_t;
+
+enum {
+	MB_LEN_NONE,
+	MB_LEN_HH,
+	MB_LEN_H,
+	MB_LEN_L,
+	MB_LEN_LL,
+	MB_LEN_J,
+	MB_LEN_Z,
+	MB_LEN_T,
+	MB_LEN_LD
+};
+
+/* one printf conversion specification */
+typedef struct {
+	const char *start;              /* the '%' */
+	const char *flags;
+	int nflags;
+	const char *width;
+	int nwidth;
+	int width_star;
+	int has_prec;
+	const char *prec;
+	int nprec;
+	int prec_star;
+	int length;
+	char conv;
+} mb_spec_t;
+
+static mb_record_t mb_ring[MB_BUFFERS];
+static unsigned int mb_head = 0;        /* w: producers */
+static unsigned int mb_tail = 0;        /* w: writer thread */
 static volatile unsigned int mb_initialized = 0;
-static volatile unsigned int mb_inbuffer = 0;
-static volatile unsigned int mb_outbuffer = 0;
-static volatile _Atomic_word mb_overruns = 0;
+static unsigned int mb_overruns = 0;
+static unsigned int mb_suppressed = 0;
+static unsigned int mb_rate_window = 0; /* second the count is for */
+static unsigned int mb_rate_count = 0;
 static pthread_t mb_writer_thread;
 static pthread_mutex_t mb_write_lock;
 static pthread_cond_t mb_ready_cond;
 static void (*mb_thread_init_callback)(void*) = 0;
 static void* mb_thread_init_callback_arg = 0;
 
+extern jack_time_t jack_get_microseconds_from_system (void);
+
+/* parse the specification starting after the '%' at p, and return a
+   pointer past it, or NULL at the end of the format.
+ */
+static const char *
+mb_parse_spec (const char *p, mb_spec_t *spec)
+{
+	spec->start = p - 1;
+
+	spec->flags = p;
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' ||
+	       *p == '0' || *p == '\'') {
+		p++;
+	}
+	spec->nflags = p - spec->flags;
+
+	spec->width = p;
+	spec->width_star = (*p == '*');
+	if (spec->width_star) {
+		p++;
+	} else {
+		while (*p >= '0' && *p <= '9') {
+			p++;
+		}
+	}
+	spec->nwidth = p - spec->width;
+
+	spec->has_prec = (*p == '.');
+	spec->prec_star = 0;
+	spec->prec = p;
+	if (spec->has_prec) {
+		spec->prec = ++p;
+		spec->prec_star = (*p == '*');
+		if (spec->prec_star) {
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9') {
+				p++;
+			}
+		}
+	}
+	spec->nprec = p - spec->prec;
+
+	switch (*p) {
+	case 'h':
+		if (*++p == 'h') {
+			p++;
+			spec->length = MB_LEN_HH;
+		} else {
+			spec->length = MB_LEN_H;
+		}
+		break;
+	case 'l':
+		if (*++p == 'l') {
+			p++;
+			spec->length = MB_LEN_LL;
+		} else {
+			spec->length = MB_LEN_L;
+		}
+		break;
+	case 'q':
+		p++;
+		spec->length = MB_LEN_LL;
+		break;
+	case 'j':
+		p++;
+		spec->length = MB_LEN_J;
+		break;
+	case 'z':
+		p++;
+		spec->length = MB_LEN_Z;
+		break;
+	case 't':
+		p++;
+		spec->length = MB_LEN_T;
+		break;
+	case 'L':
+		p++;
+		spec->length = MB_LEN_LD;
+		break;
+	default:
+		spec->length = MB_LEN_NONE;
+		break;
+	}
+
+	if ((spec->conv = *p) == '\0') {
+		return NULL;
+	}
+
+	return p + 1;
+}
+
+/* the realtime side: stash the arguments of fmt in rec */
+static void
+mb_capture (mb_record_t *rec, const char *fmt, va_list ap)
+{
+	const char *p = fmt;
+	const char *str;
+	mb_spec_t spec;
+	mb_arg_t *arg;
+	size_t len;
+
+	/* a format cut short only uses the first of the arguments
+	   taken below, see mb_format() */
+	len = strnlen (fmt, MB_FORMATSIZE - 1);
+	memcpy (rec->format, fmt, len);
+	rec->format[len] = '\0';
+	rec->nargs = 0;
+	rec->strused = 0;
+
+	while ((p = strchr (p, '%')) != NULL) {
+
+		if (*++p == '%') {
+			p++;
+			continue;
+		}
+
+		if ((p = mb_parse_spec (p, &spec)) == NULL) {
+			break;
+		}
+
+		/* a star width and precision each take an int, and
+		   the conversion up to one more argument */
+
+		if (rec->nargs + spec.width_star + spec.prec_star + 1
+		    > MB_MAXARGS) {
+			break;
+		}
+
+		if (spec.width_star) {
+			rec->args[rec->nargs++].i = va_arg (ap, int);
+		}
+		if (spec.prec_star) {
+			rec->args[rec->nargs++].i = va_arg (ap, int);
+		}
+
+		arg = &rec->args[rec->nargs++];
+
+		switch (spec.conv) {
+		case 'd':
+		case 'i':
+			switch (spec.length) {
+			case MB_LEN_L:
+				arg->i = va_arg (ap, long);
+				break;
+			case MB_LEN_LL:
+				arg->i = va_arg (ap, long long);
+				break;
+			case MB_LEN_J:
+				arg->i = va_arg (ap, intmax_t);
+				break;
+			case MB_LEN_Z:
+				arg->i = va_arg (ap, ssize_t);
+				break;
+			case MB_LEN_T:
+				arg->i = va_arg (ap, ptrdiff_t);
+				break;
+			default:
+				arg->i = va_arg (ap, int);
+				break;
+			}
+			break;
+
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			switch (spec.length) {
+			case MB_LEN_L:
+				arg->u = va_arg (ap, unsigned long);
+				break;
+			case MB_LEN_LL:
+				arg->u = va_arg (ap, unsigned long long);
+				break;
+			case MB_LEN_J:
+				arg->u = va_arg (ap, uintmax_t);
+				break;
+			case MB_LEN_Z:
+				arg->u = va_arg (ap, size_t);
+				break;
+			case MB_LEN_T:
+				arg->u = va_arg (ap, ptrdiff_t);
+				break;
+			default:
+				arg->u = va_arg (ap, unsigned int);
+				break;
+			}
+			break;
+
+		case 'c':
+			arg->i = va_arg (ap, int);
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (spec.length == MB_LEN_LD) {
+				arg->ld = va_arg (ap, long double);
+			} else {
+				arg->d = va_arg (ap, double);
+			}
+			break;
+
+		case 's':
+			if ((str = va_arg (ap, const char*)) == NULL) {
+				str = "(null)";
+			}
+			len = strnlen (str, MB_STRINGSIZE - rec->strused - 1);
+			arg->str = rec->strused;
+			memcpy (rec->strings + rec->strused, str, len);
+			rec->strings[rec->strused + len] = '\0';
+			rec->strused += len + 1;
+			if (rec->strused >= MB_STRINGSIZE - 1) {
+				/* later strings come out empty */
+				rec->strused = MB_STRINGSIZE - 1;
+			}
+			break;
+
+		case 'p':
+		case 'n':
+			arg->p = va_arg (ap, void*);
+			break;
+
+		default:
+			/* not understood, and nothing after it can be */
+			rec->nargs--;
+			return;
+		}
+	}
+}
+
+/* the writer side: format rec into buf */
+static void
+mb_format (mb_record_t *rec, char *buf, size_t size)
+{
+	const char *p = rec->format;
+	const char *next;
+	char spec_buf[64];
+	size_t used = 0, n;
+	unsigned int argn = 0;
+	mb_spec_t spec;
+	mb_arg_t *arg;
+	int len;
+
+	buf[0] = '\0';
+
+	while (*p && used < size - 1) {
+
+		if (*p != '%' || p[1] == '%') {
+			buf[used++] = *p;
+			p += (*p == '%') ? 2 : 1;
+			continue;
+		}
+
+		if ((next = mb_parse_spec (p + 1, &spec)) == NULL ||
+		    argn + spec.width_star + spec.prec_star + 1 > rec->nargs) {
+			/* the arguments ran out */
+			break;
+		}
+
+		/* rebuild the specification with star arguments filled
+		   in and the length modifier matching what we stored */
+
+		n = snprintf (spec_buf, sizeof(spec_buf), "%%%.*s", spec.nflags,
+			      spec.flags);
+		if (spec.width_star) {
+			n += snprintf (spec_buf + n, sizeof(spec_buf) - n, "%d",
+				       (int)rec->args[argn++].i);
+		} else {
+			n += snprintf (spec_buf + n, sizeof(spec_buf) - n, "%.*s",
+				       spec.nwidth, spec.width);
+		}
+		if (spec.has_prec) {
+			if (spec.prec_star) {
+				n += snprintf (spec_buf + n, sizeof(spec_buf) - n,
+					       ".%d", (int)rec->args[argn++].i);
+			} else {
+				n += snprintf (spec_buf + n, sizeof(spec_buf) - n,
+					       ".%.*s", spec.nprec, spec.prec);
+			}
+		}
+		if (n >= sizeof(spec_buf) - 3) {
+			break;
+		}
+
+		arg = &rec->args[argn++];
+		len = 0;
+
+		switch (spec.conv) {
+		case 'd':
+		case 'i':
+			snprintf (spec_buf + n, sizeof(spec_buf) - n, "j%c",
+				  spec.conv);
+			len = snprintf (buf + used, size - used, spec_buf, arg->i);
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			snprintf (spec_buf + n, sizeof(spec_buf) - n, "j%c",
+				  spec.conv);
+			len = snprintf (buf + used, size - used, spec_buf, arg->u);
+			break;
+		case 'c':
+			snprintf (spec_buf + n, sizeof(spec_buf) - n, "c");
+			len = snprintf (buf + used, size - used, spec_buf,
+					(int)arg->i);
+			break;
+		case 's':
+			snprintf (spec_buf + n, sizeof(spec_buf) - n, "s");
+			len = snprintf (buf + used, size - used, spec_buf,
+					rec->strings + arg->str);
+			break;
+		case 'p':
+			snprintf (spec_buf + n, sizeof(spec_buf) - n, "p");
+			len = snprintf (buf + used, size - used, spec_buf, arg->p);
+			break;
+		case 'n':
+			/* we do not write through pointers after the fact */
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (spec.length == MB_LEN_LD) {
+				snprintf (spec_buf + n, sizeof(spec_buf) - n, "L%c",
+					  spec.conv);
+				len = snprintf (buf + used, size - used, spec_buf,
+						arg->ld);
+			} else {
+				snprintf (spec_buf + n, sizeof(spec_buf) - n, "%c",
+					  spec.conv);
+				len = snprintf (buf + used, size - used, spec_buf,
+						arg->d);
+			}
+			break;
+		default:
+			/* mb_capture() stopped here too */
+			len = -1;
+			break;
+		}
+
+		if (len < 0) {
+			break;
+		}
+
+		if (len) {
+			used += len;
+			if (used > size - 1) {
+				used = size - 1;
+			}
+		}
+
+		p = next;
+	}
+
+	buf[used] = '\0';
+}
+
 static void
 mb_flush ()
 {
-	/* called WITHOUT the mb_write_lock */
-	while (mb_outbuffer != mb_inbuffer) {
-		jack_info (mb_buffers[mb_outbuffer]);
-		mb_outbuffer = MB_NEXT (mb_outbuffer);
+	char msg[MB_BUFFERSIZE];
+	mb_record_t *rec;
+	unsigned int n;
+
+	/* only the writer thread, or jack_messagebuffer_exit() after
+	   it is gone, takes records out */
+	for (;;) {
+		rec = &mb_ring[mb_tail & (MB_BUFFERS - 1)];
+
+		if (__atomic_load_n (&rec->seq, __ATOMIC_ACQUIRE) != mb_tail + 1) {
+			break;
+		}
+
+		mb_format (rec, msg, sizeof(msg));
+
+		/* hand the slot back to the producers, one lap ahead */
+		__atomic_store_n (&rec->seq, mb_tail + MB_BUFFERS,
+				  __ATOMIC_RELEASE);
+		mb_tail++;
+
+		jack_info ("%s", msg);
+	}
+
+	if ((n = __atomic_exchange_n (&mb_suppressed, 0, __ATOMIC_RELAXED))) {
+		jack_info ("%u messages suppressed", n);
 	}
 }
 
 static void *
 mb_thread_func (void *arg)
 {
-	/* The mutex is only to eliminate collisions between multiple
-	 * writer threads and protect the condition variable. */
+	struct timeval now;
+	struct timespec wake;
+
+	/* The mutex only protects the condition variable, which is for
+	 * thread init callbacks and exit. Producers never touch it, so
+	 * the ring is polled. */
 	pthread_mutex_lock (&mb_write_lock);
 
 	while (mb_initialized) {
-		pthread_cond_wait (&mb_ready_cond, &mb_write_lock);
+		gettimeofday (&now, NULL);
+		now.tv_usec += MB_FLUSH_USECS;
+		wake.tv_sec = now.tv_sec + now.tv_usec / 1000000;
+		wake.tv_nsec = (now.tv_usec % 1000000) * 1000;
+		pthread_cond_timedwait (&mb_ready_cond, &mb_write_lock, &wake);
 
 		if (mb_thread_init_callback) {
 			/* the client asked for all threads to run a thread
@@ -96,6 +565,8 @@ mb_thread_func (void *arg)
 void
 jack_messagebuffer_init ()
 {
+	unsigned int i;
+
 	if (mb_initialized) {
 		return;
 	}
@@ -103,7 +574,14 @@ jack_messagebuffer_init ()
 	pthread_mutex_init (&mb_write_lock, NULL);
 	pthread_cond_init (&mb_ready_cond, NULL);
 
+	/* slot i is free for the producer that claims position i */
+	mb_head = mb_tail = 0;
+	for (i = 0; i < MB_BUFFERS; i++) {
+		mb_ring[i].seq = i;
+	}
+
 	mb_overruns = 0;
+	mb_suppressed = 0;
 	mb_initialized = 1;
 
 	if (jack_thread_creator (&mb_writer_thread, NULL, &mb_thread_func, NULL) != 0) {
@@ -127,7 +605,7 @@ jack_messagebuffer_exit ()
 	mb_flush ();
 
 	if (mb_overruns) {
-		jack_error ("WARNING: %d message buffer overruns!",
+		jack_error ("WARNING: %u message buffer overruns!",
 			    mb_overruns);
 	}
 
@@ -135,34 +613,81 @@ jack_messagebuffer_exit ()
 	pthread_cond_destroy (&mb_ready_cond);
 }
 
+/* returns non-zero if this second's allowance is spent */
+static int
+mb_rate_limited ()
+{
+	unsigned int now = jack_get_microseconds_from_system () / 1000000;
+	unsigned int window = __atomic_load_n (&mb_rate_window, __ATOMIC_RELAXED);
+
+	if (now != window &&
+	    __atomic_compare_exchange_n (&mb_rate_window, &window, now, 0,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		/* we opened a new second. a racing producer may get
+		   counted against the old one, which is harmless */
+		__atomic_store_n (&mb_rate_count, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_fetch_add (&mb_rate_count, 1, __ATOMIC_RELAXED)
+	    >= MB_RATE_LIMIT) {
+		__atomic_fetch_add (&mb_suppressed, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	return 0;
+}
 
 void
 jack_messagebuffer_add (const char *fmt, ...)
 {
-	char msg[MB_BUFFERSIZE];
+	mb_record_t *rec;
+	unsigned int pos, seq;
 	va_list ap;
 
-	/* format the message first, to reduce lock contention */
-	va_start (ap, fmt);
-	vsnprintf (msg, MB_BUFFERSIZE, fmt, ap);
-	va_end (ap);
-
 	if (!mb_initialized) {
 		/* Unable to print message with realtime safety.
 		 * Complain and print it anyway. */
-		fprintf (stderr, "ERROR: messagebuffer not initialized: %s",
-			 msg);
+		fprintf (stderr, "ERROR: messagebuffer not initialized: ");
+		va_start (ap, fmt);
+		vfprintf (stderr, fmt, ap);
+		va_end (ap);
 		return;
 	}
 
-	if (pthread_mutex_trylock (&mb_write_lock) == 0) {
-		strncpy (mb_buffers[mb_inbuffer], msg, MB_BUFFERSIZE);
-		mb_inbuffer = MB_NEXT (mb_inbuffer);
-		pthread_cond_signal (&mb_ready_cond);
-		pthread_mutex_unlock (&mb_write_lock);
-	} else {                        /* lock collision */
-		exchange_and_add (&mb_overruns, 1);
+	if (mb_rate_limited ()) {
+		return;
 	}
+
+	/* claim a slot */
+
+	pos = __atomic_load_n (&mb_head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		rec = &mb_ring[pos & (MB_BUFFERS - 1)];
+		seq = __atomic_load_n (&rec->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n (&mb_head, &pos, pos + 1,
+							 1, __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED)) {
+				break;
+			}
+			/* pos was reloaded */
+		} else if ((int)(seq - pos) < 0) {
+			/* the writer thread is a lap behind: full */
+			__atomic_fetch_add (&mb_overruns, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n (&mb_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	va_start (ap, fmt);
+	mb_capture (rec, fmt, ap);
+	va_end (ap);
+
+	/* publish it */
+	__atomic_store_n (&rec->seq, pos + 1, __ATOMIC_RELEASE);
 }
 
 void
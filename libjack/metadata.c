@@ -16,15 +16,19 @@
    Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <errno.h>
 #include <string.h>
-#include <db.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <limits.h>
+#include <sys/mman.h>
 
 #include <jack/metadata.h>
 #include <jack/uuid.h>
 
 #include "internal.h"
 #include "local.h"
+#include "propstore.h"
 
 const char* JACK_METADATA_PRETTY_NAME = "http://jackaudio.org/metadata/pretty-name";
 const char* JACK_METADATA_HARDWARE    = "http://jackaudio.org/metadata/hardware";
@@ -33,64 +37,201 @@ const char* JACK_METADATA_PORT_GROUP  = "http://jackaudio.org/metadata/port-grou
 const char* JACK_METADATA_ICON_SMALL  = "http://jackaudio.org/metadata/icon-small";
 const char* JACK_METADATA_ICON_LARGE  = "http://jackaudio.org/metadata/icon-large";
 
-static DB* db = NULL;
-static DB_ENV* db_env = NULL;
+/* The server's metadata store, see propstore.h.
+ *
+ * Lookups are served from this process' mapping of it without taking
+ * a lock; changes are requests to the server, which notifies the
+ * clients that want to know. The store followed is that of the server
+ * of the oldest client still open. A retired mapping is kept until
+ * the last client is closed, since another thread may still be
+ * reading from it. With no client open, the store of the default
+ * server is looked up in the shm registry instead, so that the read
+ * only calls keep working without one, as they did when metadata were
+ * kept in files.
+ */
 
-static int
-jack_property_init (const char* server_name)
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static JSList* store_engines = NULL;    /* jack_control_t*, of open clients */
+static JSList* store_maps = NULL;       /* jack_shm_info_t*, newest first */
+static jack_propstore_t* store = NULL;
+
+#define JACK_PROPERTY_STORE_TRIES 8
+
+void
+jack_property_store_attach (jack_control_t* engine)
 {
-	int ret;
-	char dbpath[PATH_MAX + 1];
-	char server_dir[PATH_MAX + 1];
+	pthread_mutex_lock (&store_lock);
+	if (store_engines == NULL) {
+		/* follow this client's server from now on */
+		__atomic_store_n (&store, NULL, __ATOMIC_RELEASE);
+	}
+	store_engines = jack_slist_append (store_engines, engine);
+	pthread_mutex_unlock (&store_lock);
+}
+
+void
+jack_property_store_detach (jack_control_t* engine)
+{
+	JSList* node;
 
-	/* idempotent */
+	pthread_mutex_lock (&store_lock);
 
-	if (db_env) {
-		return 0;
+	if (store_engines && store_engines->data == engine) {
+		/* the next lookup follows the next client's server */
+		__atomic_store_n (&store, NULL, __ATOMIC_RELEASE);
 	}
 
-	if ((ret = db_env_create (&db_env, 0)) != 0) {
-		jack_error ("cannot initialize DB environment: %s\n", db_strerror (ret));
-		return -1;
+	store_engines = jack_slist_remove (store_engines, engine);
+
+	if (store_engines == NULL) {
+		for (node = store_maps; node; node = jack_slist_next (node)) {
+			jack_release_shm ((jack_shm_info_t*)node->data);
+			free (node->data);
+		}
+		jack_slist_free (store_maps);
+		store_maps = NULL;
 	}
 
-	if ((ret = db_env->open (db_env, jack_server_dir (server_name, server_dir), DB_CREATE | DB_INIT_LOCK | DB_INIT_MPOOL | DB_THREAD, 0)) != 0) {
-		jack_error ("cannot open DB environment: %s", db_strerror (ret));
-		return -1;
+	pthread_mutex_unlock (&store_lock);
+}
+
+/* call with store_lock held */
+static jack_propstore_t*
+jack_property_store_map (void)
+{
+	jack_control_t* engine = (jack_control_t*)store_engines->data;
+	jack_propstore_t* s;
+	jack_shm_info_t* si;
+	int tries;
+
+	/* the store may be replaced between reading its index and
+	   attaching it, and the segment be gone by then */
+
+	for (tries = 0; tries < JACK_PROPERTY_STORE_TRIES; tries++) {
+
+		if ((si = (jack_shm_info_t*)malloc (sizeof(jack_shm_info_t))) == NULL) {
+			return NULL;
+		}
+
+		si->index = __atomic_load_n (&engine->propstore_index, __ATOMIC_ACQUIRE);
+		si->attached_at = MAP_FAILED;
+
+		if (si->index == JACK_SHM_NULL_INDEX) {
+			free (si);
+			jack_error ("the server keeps no metadata");
+			return NULL;
+		}
+
+		if (jack_attach_shm (si)) {
+			free (si);
+			continue;
+		}
+
+		s = (jack_propstore_t*)jack_shm_addr (si);
+
+		if (s->magic != JACK_PROPSTORE_MAGIC) {
+			jack_release_shm (si);
+			free (si);
+			jack_error ("the server's metadata store is not one");
+			return NULL;
+		}
+
+		store_maps = jack_slist_prepend (store_maps, si);
+
+		if (!__atomic_load_n (&s->retired, __ATOMIC_ACQUIRE)) {
+			return s;
+		}
 	}
 
-	if ((ret = db_create (&db, db_env, 0)) != 0) {
-		jack_error ("Cannot initialize metadata DB (%s)", db_strerror (ret));
-		return -1;
+	jack_error ("cannot attach the server's metadata store (%s)",
+		    strerror (errno));
+
+	return NULL;
+}
+
+/* call with store_lock held, and no client open */
+static jack_propstore_t*
+jack_property_store_find (void)
+{
+	jack_shm_registry_index_t index = JACK_SHM_NULL_INDEX;
+	jack_shmsize_t size;
+	jack_propstore_t* s;
+	jack_shm_info_t* si;
+
+	if (jack_initialize_shm (jack_default_server_name ())) {
+		jack_error ("no server is running, so there are no metadata");
+		return NULL;
 	}
 
-	snprintf (dbpath, sizeof(dbpath), "%s/%s", jack_server_dir (server_name, server_dir), "metadata.db");
+	/* the registry does not tell which of the server's segments is
+	   the store, so look at each of them. Only the live store has
+	   the magic, the size the registry has for it, and no
+	   successor. */
 
-	if ((ret = db->open (db, NULL, dbpath, NULL, DB_HASH, DB_CREATE | DB_THREAD, 0666)) != 0) {
-		jack_error ("Cannot open metadata DB at %s: %s", dbpath, db_strerror (ret));
-		db->close (db, 0);
-		db = NULL;
-		return -1;
+	while ((index = jack_shm_next_server_segment (index, &size))
+	       != JACK_SHM_NULL_INDEX) {
+
+		if (size < sizeof(jack_propstore_t)) {
+			continue;
+		}
+
+		if ((si = (jack_shm_info_t*)malloc (sizeof(jack_shm_info_t))) == NULL) {
+			return NULL;
+		}
+
+		si->index = index;
+		si->attached_at = MAP_FAILED;
+
+		if (jack_attach_shm (si)) {
+			free (si);
+			continue;
+		}
+
+		s = (jack_propstore_t*)jack_shm_addr (si);
+
+		if (s->magic == JACK_PROPSTORE_MAGIC && s->size == size &&
+		    !__atomic_load_n (&s->retired, __ATOMIC_ACQUIRE)) {
+			store_maps = jack_slist_prepend (store_maps, si);
+			return s;
+		}
+
+		jack_release_shm (si);
+		free (si);
 	}
 
-	return 0;
-}
+	jack_error ("the server keeps no metadata");
 
-static void jack_properties_uninit() __attribute__ ((destructor));
+	return NULL;
+}
 
-void
-jack_properties_uninit ()
+static jack_propstore_t*
+jack_property_store (void)
 {
-	if (db) {
-		db->close (db, 0);
-		db = NULL;
+	jack_propstore_t* s = __atomic_load_n (&store, __ATOMIC_ACQUIRE);
+
+	if (s && !__atomic_load_n (&s->retired, __ATOMIC_ACQUIRE)) {
+		return s;
 	}
-	if (db_env) {
-		db_env->close (db_env, 0);
-		db_env = 0;
+
+	pthread_mutex_lock (&store_lock);
+
+	/* another thread may have got here first */
+
+	s = store;
+
+	if (s == NULL || s->retired) {
+		if (store_engines == NULL) {
+			s = jack_property_store_find ();
+		} else {
+			s = jack_property_store_map ();
+		}
+		__atomic_store_n (&store, s, __ATOMIC_RELEASE);
 	}
-}
 
+	pthread_mutex_unlock (&store_lock);
+
+	return s;
+}
 void
 jack_free_description (jack_description_t* desc, int free_actual_description_too)
 {
@@ -111,44 +252,33 @@ jack_free_description (jack_description_t* desc, int free_actual_description_too
 	}
 }
 
-static int
-jack_property_change_notify (jack_client_t* client, jack_uuid_t uuid, const char* key, jack_property_change_t change)
+/* "key\0value\0type\0", as SetProperty requests carry it */
+static char*
+jack_property_pack (const char* key, const char* value, const char* type,
+		    size_t* len)
 {
-	jack_request_t req;
+	size_t keylen = strlen (key) + 1;
+	size_t valuelen = strlen (value) + 1;
+	size_t typelen = type ? strlen (type) + 1 : 1;
+	char* buf;
 
-	/* the engine passes in a NULL client when it removes metadata during port or client removal
-	 */
+	*len = keylen + valuelen + typelen;
 
-	if (client == NULL) {
-		return 0;
+	if ((buf = (char*)malloc (*len)) == NULL) {
+		return NULL;
 	}
 
-	req.type = PropertyChangeNotify;
-	req.x.property.change = change;
-	jack_uuid_copy (&req.x.property.uuid, uuid);
-	req.x.property.keylen = key ? strlen (key) + 1 : 0;
-	req.x.property.key = key;
-	return jack_client_deliver_request (client, &req);
-}
+	memcpy (buf, key, keylen);
+	memcpy (buf + keylen, value, valuelen);
+	if (type) {
+		memcpy (buf + keylen + valuelen, type, typelen);
+	} else {
+		buf[keylen + valuelen] = '\0';
+	}
 
-static void
-make_key_dbt (DBT* dbt, jack_uuid_t subject, const char* key)
-{
-	char ustr[JACK_UUID_STRING_SIZE];
-	size_t len1, len2;
-
-	memset (dbt, 0, sizeof(DBT));
-	memset (ustr, 0, JACK_UUID_STRING_SIZE);
-	jack_uuid_unparse (subject, ustr);
-	len1 = JACK_UUID_STRING_SIZE;
-	len2 = strlen (key) + 1;
-	dbt->size = len1 + len2;
-	dbt->data = malloc (dbt->size);
-	memcpy (dbt->data, ustr, len1);         // copy subject+null
-	memcpy (dbt->data + len1, key, len2);   // copy key+null
+	return buf;
 }
 
-
 int
 jack_set_property (jack_client_t* client,
 		   jack_uuid_t subject,
@@ -156,11 +286,10 @@ jack_set_property (jack_client_t* client,
 		   const char* value,
 		   const char* type)
 {
-	DBT d_key;
-	DBT data;
+	jack_request_t req;
+	char* data;
+	size_t len;
 	int ret;
-	size_t len1, len2;
-	jack_property_change_t change;
 
 	if (!key || key[0] == '\0') {
 		jack_error ("empty key string for metadata not allowed");
@@ -172,62 +301,33 @@ jack_set_property (jack_client_t* client,
 		return -1;
 	}
 
-	if (jack_property_init (NULL)) {
+	if (client == NULL) {
+		jack_error ("metadata can only be set by a client");
 		return -1;
 	}
 
-	/* build a key */
-
-	make_key_dbt (&d_key, subject, key);
-
-	/* build data */
-
-	memset (&data, 0, sizeof(data));
-
-	len1 = strlen (value) + 1;
-	if (type && type[0] != '\0') {
-		len2 = strlen (type) + 1;
-	} else {
-		len2 = 0;
-	}
-
-	data.size = len1 + len2;
-	data.data = malloc (data.size);
-	memcpy (data.data, value, len1);
-
-	if (len2) {
-		memcpy (data.data + len1, type, len2);
-	}
-
-	if (db->exists (db, NULL, &d_key, 0) == DB_NOTFOUND) {
-		change = PropertyCreated;
-	} else {
-		change = PropertyChanged;
+	if ((data = jack_property_pack (key, value, type, &len)) == NULL) {
+		return -1;
 	}
 
-	if ((ret = db->put (db, NULL, &d_key, &data, 0)) != 0) {
+	if (len > JACK_PROPSTORE_RECORD_MAX) {
 		char ustr[JACK_UUID_STRING_SIZE];
 		jack_uuid_unparse (subject, ustr);
-		jack_error ("Cannot store metadata for %s/%s (%s)", ustr, key, db_strerror (ret));
-		if (d_key.size > 0) {
-			free (d_key.data);
-		}
-		if (data.size  > 0) {
-			free (data.data);
-		}
+		jack_error ("Cannot store metadata for %s/%s (%zu bytes is too large)",
+			    ustr, key, len);
+		free (data);
 		return -1;
 	}
 
-	jack_property_change_notify (client, subject, key, change);
+	req.type = SetProperty;
+	jack_uuid_copy (&req.x.property.uuid, subject);
+	req.x.property.keylen = len;
+	req.x.property.key = data;
 
-	if (d_key.size > 0) {
-		free (d_key.data);
-	}
-	if (data.size  > 0) {
-		free (data.data);
-	}
+	ret = jack_client_deliver_request (client, &req);
+	free (data);
 
-	return 0;
+	return ret;
 }
 
 int
@@ -236,335 +336,314 @@ jack_get_property (jack_uuid_t subject,
 		   char**      value,
 		   char**      type)
 {
-	DBT d_key;
-	DBT data;
-	int ret;
-	size_t len1, len2;
+	jack_propstore_t* s;
+	jack_propstore_record_t* rec;
+	const char* t;
 
 	if (key == NULL || key[0] == '\0') {
 		return -1;
 	}
 
-	if (jack_property_init (NULL)) {
+	if ((s = jack_property_store ()) == NULL) {
 		return -1;
 	}
 
-	/* build a key */
-
-	make_key_dbt (&d_key, subject, key);
-
-	/* setup data DBT */
+	/* a record does not change once it is found, even if it is
+	   replaced or removed right away */
 
-	memset (&data, 0, sizeof(data));
-	data.flags = DB_DBT_MALLOC;
-
-	if ((ret = db->get (db, NULL, &d_key, &data, 0)) != 0) {
-		if (ret != DB_NOTFOUND) {
-			char ustr[JACK_UUID_STRING_SIZE];
-			jack_uuid_unparse (subject, ustr);
-			jack_error ("Cannot  metadata for %s/%s (%s)", ustr, key, db_strerror (ret));
-		}
-		if (d_key.size > 0) {
-			free (d_key.data);
-		}
-		if (data.size  > 0) {
-			free (data.data);
-		}
+	if ((rec = jack_propstore_find (s, subject, key)) == NULL) {
 		return -1;
 	}
 
-	/* result must have at least 2 chars plus 2 nulls to be valid
-	 */
-
-	if (data.size < 4) {
-		if (d_key.size > 0) {
-			free (d_key.data);
-		}
-		if (data.size  > 0) {
-			free (data.data);
-		}
+	if ((*value = strdup (jack_propstore_value (rec))) == NULL) {
 		return -1;
 	}
 
-	len1 = strlen (data.data) + 1;
-	(*value) = (char*)malloc (len1);
-	memcpy (*value, data.data, len1);
-
-	if (len1 < data.size) {
-		len2 = strlen (data.data + len1) + 1;
-
-		(*type) = (char*)malloc (len2);
-		memcpy (*type, data.data + len1, len2);
+	if ((t = jack_propstore_type (rec)) != NULL) {
+		if ((*type = strdup (t)) == NULL) {
+			free (*value);
+			return -1;
+		}
 	} else {
 		/* no type specified, assume default */
 		*type = NULL;
 	}
 
-	if (d_key.size > 0) {
-		free (d_key.data);
-	}
-	if (data.size  > 0) {
-		free (data.data);
-	}
-
 	return 0;
 }
 
-int
-jack_get_properties (jack_uuid_t subject,
-		     jack_description_t* desc)
+/* append a copy of `rec' to the properties of `desc' */
+static int
+jack_description_add (jack_description_t* desc, jack_propstore_record_t* rec)
 {
-	DBT key;
-	DBT data;
-	DBC* cursor;
-	int ret;
-	size_t len1, len2;
-	size_t cnt = 0;
-	char ustr[JACK_UUID_STRING_SIZE];
-	size_t props_size = 0;
+	jack_property_t* props;
 	jack_property_t* prop;
+	const char* type = jack_propstore_type (rec);
 
-	desc->properties = NULL;
-	desc->property_cnt = 0;
+	if (desc->property_cnt == desc->property_size) {
+		uint32_t size = desc->property_size ? desc->property_size * 2 : 8;
 
-	memset (ustr, 0, JACK_UUID_STRING_SIZE);
-	jack_uuid_unparse (subject, ustr);
-
-	if (jack_property_init (NULL)) {
-		return -1;
+		if ((props = (jack_property_t*)
+			     realloc (desc->properties, sizeof(jack_property_t) * size)) == NULL) {
+			return -1;
+		}
+		desc->properties = props;
+		desc->property_size = size;
 	}
 
+	prop = &desc->properties[desc->property_cnt];
+
+	prop->key = strdup (jack_propstore_key (rec));
+	prop->data = strdup (jack_propstore_value (rec));
+	prop->type = type ? strdup (type) : NULL;
 
-	if ((ret = db->cursor (db, NULL, &cursor, 0)) != 0) {
-		jack_error ("Cannot create cursor for metadata search (%s)", db_strerror (ret));
+	if (prop->key == NULL || prop->data == NULL || (type && prop->type == NULL)) {
+		free ((char*)prop->key);
+		free ((char*)prop->data);
+		free ((char*)prop->type);
 		return -1;
 	}
 
-	memset (&key, 0, sizeof(key));
-	memset (&data, 0, sizeof(data));
-	data.flags = DB_DBT_MALLOC;
-
-	while ((ret = cursor->get (cursor, &key, &data, DB_NEXT)) == 0) {
-
-		/* require 2 extra chars (data+null) for key,
-		   which is composed of UUID str plus a key name
-		 */
-
-		if (key.size < JACK_UUID_STRING_SIZE + 2) {
-			/* if (key.size  > 0) free(key.data); */
-			if (data.size > 0) {
-				free (data.data);
-			}
-			continue;
-		}
-
-		if (memcmp (ustr, key.data, JACK_UUID_STRING_SIZE) != 0) {
-			/* not relevant */
-			/* if (key.size  > 0) free(key.data); */
-			if (data.size > 0) {
-				free (data.data);
-			}
-			continue;
-		}
+	desc->property_cnt++;
 
-		/* result must have at least 2 chars plus 2 nulls to be valid
-		 */
-
-		if (data.size < 4) {
-			/* if (key.size  > 0) free(key.data); */
-			if (data.size > 0) {
-				free (data.data);
-			}
-			continue;
-		}
-
-		/* realloc array if necessary */
-
-		if (cnt == props_size) {
-			if (props_size == 0) {
-				props_size = 8; /* a rough guess at a likely upper bound for the number of properties */
-			} else {
-				props_size *= 2;
-			}
-
-			desc->properties = (jack_property_t*)realloc (desc->properties, sizeof(jack_property_t) * props_size);
-		}
-
-		prop = &desc->properties[cnt];
-
-		/* store UUID/subject */
+	return 0;
+}
 
-		jack_uuid_copy (&desc->subject, subject);
+static void
+jack_description_init (jack_description_t* desc, jack_uuid_t subject)
+{
+	jack_uuid_copy (&desc->subject, subject);
+	desc->properties = NULL;
+	desc->property_cnt = 0;
+	desc->property_size = 0;
+}
 
-		/* copy key (without leading UUID as subject */
+/* the properties found by a walk that raced with a change */
+static void
+jack_description_reset (jack_description_t* desc)
+{
+	jack_uuid_t subject;
 
-		len1 = key.size - JACK_UUID_STRING_SIZE;
-		prop->key = malloc (len1);
-		memcpy ((char*)prop->key, key.data + JACK_UUID_STRING_SIZE, len1);
+	jack_uuid_copy (&subject, desc->subject);
+	jack_free_description (desc, 0);
+	jack_description_init (desc, subject);
+}
 
-		/* copy data (which contains 1 or 2 null terminated strings, the value
-		   and optionally a MIME type.
-		 */
+int
+jack_get_properties (jack_uuid_t subject,
+		     jack_description_t* desc)
+{
+	jack_propstore_t* s;
+	jack_propstore_record_t* rec;
+	uint32_t seq, off, end;
+	int err;
 
-		len1 = strlen (data.data) + 1;
-		prop->data = (char*)malloc (len1);
-		memcpy ((char*)prop->data, data.data, len1);
+	jack_description_init (desc, subject);
 
-		if (len1 < data.size) {
-			len2 = strlen (data.data + len1) + 1;
+	if ((s = jack_property_store ()) == NULL) {
+		return -1;
+	}
 
-			prop->type = (char*)malloc (len2);
-			memcpy ((char*)prop->type, data.data + len1, len2);
-		} else {
-			/* no type specified, assume default */
-			prop->type = NULL;
-		}
+	do {
+		jack_description_reset (desc);
+		err = 0;
+		seq = jack_propstore_read_begin (s);
+		end = __atomic_load_n (&s->used, __ATOMIC_ACQUIRE);
 
-		/* if (key.size  > 0) free(key.data);  */
-		if (data.size > 0) {
-			free (data.data);
+		for (off = jack_propstore_first (); !err && off < end; off += rec->size) {
+			rec = jack_propstore_at (s, off);
+			if (!__atomic_load_n (&rec->dead, __ATOMIC_ACQUIRE) &&
+			    jack_uuid_compare (rec->subject, subject) == 0) {
+				err = jack_description_add (desc, rec);
+			}
 		}
+	} while (jack_propstore_read_retry (s, seq));
 
-		++cnt;
+	if (err) {
+		jack_description_reset (desc);
+		return -1;
 	}
 
-	cursor->close (cursor);
-	desc->property_cnt = cnt;
-
-	return cnt;
+	return desc->property_cnt;
 }
 
 int
 jack_get_all_properties (jack_description_t** descriptions)
 {
-	DBT key;
-	DBT data;
-	DBC* cursor;
-	int ret;
+	jack_propstore_t* s;
+	jack_propstore_record_t* rec;
+	jack_description_t* desc = NULL;
+	jack_description_t* grown;
 	size_t dcnt = 0;
 	size_t dsize = 0;
-	size_t n = 0;
-	jack_description_t* desc = NULL;
-	jack_uuid_t uuid = JACK_UUID_EMPTY_INITIALIZER;
-	jack_description_t* current_desc = NULL;
-	jack_property_t* current_prop = NULL;
-	size_t len1, len2;
+	size_t n;
+	uint32_t seq, off, end;
+	int err;
 
-	if (jack_property_init (NULL)) {
+	if ((s = jack_property_store ()) == NULL) {
 		return -1;
 	}
 
-	if ((ret = db->cursor (db, NULL, &cursor, 0)) != 0) {
-		jack_error ("Cannot create cursor for metadata search (%s)", db_strerror (ret));
-		return -1;
-	}
+	do {
+		for (n = 0; n < dcnt; ++n) {
+			jack_free_description (&desc[n], 0);
+		}
+		dcnt = 0;
+		err = 0;
+		seq = jack_propstore_read_begin (s);
+		end = __atomic_load_n (&s->used, __ATOMIC_ACQUIRE);
 
-	memset (&key, 0, sizeof(key));
-	memset (&data, 0, sizeof(data));
-	data.flags = DB_DBT_MALLOC;
+		for (off = jack_propstore_first (); !err && off < end; off += rec->size) {
 
-	dsize = 8; /* initial guess at number of descriptions we need */
-	dcnt = 0;
-	desc = (jack_description_t*)malloc (dsize * sizeof(jack_description_t));
+			rec = jack_propstore_at (s, off);
 
-	while ((ret = cursor->get (cursor, &key, &data, DB_NEXT)) == 0) {
+			if (__atomic_load_n (&rec->dead, __ATOMIC_ACQUIRE)) {
+				continue;
+			}
 
-		/* require 2 extra chars (data+null) for key,
-		   which is composed of UUID str plus a key name
-		 */
+			/* do we have an existing description for this UUID */
 
-		if (key.size < JACK_UUID_STRING_SIZE + 2) {
-			/* if (key.size  > 0) free(key.data);  */
-			if (data.size > 0) {
-				free (data.data);
+			for (n = 0; n < dcnt; ++n) {
+				if (jack_uuid_compare (rec->subject, desc[n].subject) == 0) {
+					break;
+				}
 			}
-			continue;
-		}
 
-		if (jack_uuid_parse (key.data, &uuid) != 0) {
-			continue;
-		}
+			if (n == dcnt) {
+				/* we do not have an existing description, so grow the array */
+
+				if (dcnt == dsize) {
+					dsize = dsize ? dsize * 2 : 8;
+					if ((grown = (jack_description_t*)
+						     realloc (desc, sizeof(jack_description_t) * dsize)) == NULL) {
+						err = -1;
+						break;
+					}
+					desc = grown;
+				}
+
+				jack_description_init (&desc[n], rec->subject);
+				dcnt++;
+			}
 
-		/* do we have an existing description for this UUID */
+			err = jack_description_add (&desc[n], rec);
+		}
+	} while (jack_propstore_read_retry (s, seq));
 
+	if (err) {
 		for (n = 0; n < dcnt; ++n) {
-			if (jack_uuid_compare (uuid, desc[n].subject) == 0) {
-				break;
-			}
+			jack_free_description (&desc[n], 0);
 		}
+		free (desc);
+		return -1;
+	}
 
-		if (n == dcnt) {
-			/* we do not have an existing description, so grow the array */
+	(*descriptions) = desc;
 
-			if (dcnt == dsize) {
-				dsize *= 2;
-				desc = (jack_description_t*)realloc (desc, sizeof(jack_description_t) * dsize);
-			}
+	return dcnt;
+}
 
-			/* initialize */
+typedef struct {
+	jack_uuid_t subject;
+	int index;
+} jack_subject_index_t;
 
-			desc[n].property_size = 0;
-			desc[n].property_cnt = 0;
-			desc[n].properties = NULL;
+static int
+jack_subject_index_compare (const void* a, const void* b)
+{
+	return jack_uuid_compare (((const jack_subject_index_t*)a)->subject,
+				  ((const jack_subject_index_t*)b)->subject);
+}
 
-			/* set up UUID */
+/* like calling jack_get_properties() for each of the distinct
+   subjects, into descs[n] for subjects[n], but with a single pass
+   over the store. returns the total number of properties found.
+ */
+int
+jack_get_properties_for_subjects (const jack_uuid_t* subjects,
+				  int nsubjects,
+				  jack_description_t* descs)
+{
+	jack_propstore_t* s;
+	jack_propstore_record_t* rec;
+	jack_subject_index_t* index;
+	jack_subject_index_t* found;
+	jack_subject_index_t want;
+	uint32_t seq, off, end;
+	int n;
+	int total;
+	int err;
 
-			jack_uuid_copy (&desc[n].subject, uuid);
-			dcnt++;
-		}
+	for (n = 0; n < nsubjects; ++n) {
+		jack_description_init (&descs[n], subjects[n]);
+	}
 
-		current_desc = &desc[n];
+	if (nsubjects <= 0) {
+		return 0;
+	}
 
-		/* see if there is room for the new property or if we need to realloc
-		 */
+	if ((s = jack_property_store ()) == NULL) {
+		return -1;
+	}
 
-		if (current_desc->property_cnt == current_desc->property_size) {
-			if (current_desc->property_size == 0) {
-				current_desc->property_size = 8;
-			} else {
-				current_desc->property_size *= 2;
-			}
+	/* sorted, so that each record costs a binary search */
 
-			current_desc->properties = (jack_property_t*)realloc (current_desc->properties, sizeof(jack_property_t) * current_desc->property_size);
-		}
+	if ((index = (jack_subject_index_t*)
+		     malloc (sizeof(jack_subject_index_t) * nsubjects)) == NULL) {
+		return -1;
+	}
 
-		current_prop = &current_desc->properties[current_desc->property_cnt++];
+	for (n = 0; n < nsubjects; ++n) {
+		jack_uuid_copy (&index[n].subject, subjects[n]);
+		index[n].index = n;
+	}
 
-		/* copy key (without leading UUID) */
+	qsort (index, nsubjects, sizeof(jack_subject_index_t),
+	       jack_subject_index_compare);
 
-		len1 = key.size - JACK_UUID_STRING_SIZE;
-		current_prop->key = malloc (len1);
-		memcpy ((char*)current_prop->key, key.data + JACK_UUID_STRING_SIZE, len1);
+	do {
+		for (n = 0; n < nsubjects; ++n) {
+			jack_description_reset (&descs[n]);
+		}
+		total = 0;
+		err = 0;
+		seq = jack_propstore_read_begin (s);
+		end = __atomic_load_n (&s->used, __ATOMIC_ACQUIRE);
 
-		/* copy data (which contains 1 or 2 null terminated strings, the value
-		   and optionally a MIME type.
-		 */
+		for (off = jack_propstore_first (); !err && off < end; off += rec->size) {
 
-		len1 = strlen (data.data) + 1;
-		current_prop->data = (char*)malloc (len1);
-		memcpy ((char*)current_prop->data, data.data, len1);
+			rec = jack_propstore_at (s, off);
 
-		if (len1 < data.size) {
-			len2 = strlen (data.data + len1) + 1;
+			if (__atomic_load_n (&rec->dead, __ATOMIC_ACQUIRE)) {
+				continue;
+			}
 
-			current_prop->type = (char*)malloc (len2);
-			memcpy ((char*)current_prop->type, data.data + len1, len2);
-		} else {
-			/* no type specified, assume default */
-			current_prop->type = NULL;
-		}
+			jack_uuid_copy (&want.subject, rec->subject);
+
+			if ((found = (jack_subject_index_t*)
+				     bsearch (&want, index, nsubjects,
+					      sizeof(jack_subject_index_t),
+					      jack_subject_index_compare)) == NULL) {
+				/* not relevant */
+				continue;
+			}
 
-		/* if (key.size  > 0) free(key.data);  */
-		if (data.size > 0) {
-			free (data.data);
+			if ((err = jack_description_add (&descs[found->index], rec)) == 0) {
+				++total;
+			}
 		}
-	}
+	} while (jack_propstore_read_retry (s, seq));
 
-	cursor->close (cursor);
+	free (index);
 
-	(*descriptions) = desc;
+	if (err) {
+		for (n = 0; n < nsubjects; ++n) {
+			jack_description_reset (&descs[n]);
+		}
+		return -1;
+	}
 
-	return dcnt;
+	return total;
 }
 
 
@@ -595,128 +674,58 @@ jack_set_property_change_callback (jack_client_t *client,
 	return 0;
 }
 
-int
-jack_remove_property (jack_client_t* client, jack_uuid_t subject, const char* key)
+/* the server removes the properties of clients and ports itself, so
+   a NULL client has nothing to ask for */
+static int
+jack_property_remove_request (jack_client_t* client, RequestType type,
+			      jack_uuid_t subject, const char* key)
 {
-	DBT d_key;
-	int ret;
-
-	if (jack_property_init (NULL)) {
-		return -1;
-	}
+	jack_request_t req;
 
-	make_key_dbt (&d_key, subject, key);
-	if ((ret = db->del (db, NULL, &d_key, 0)) != 0) {
-		jack_error ("Cannot delete key %s (%s)", key, db_strerror (ret));
-		if (d_key.size > 0) {
-			free (d_key.data);
-		}
+	if (client == NULL) {
+		jack_error ("metadata can only be removed by a client");
 		return -1;
 	}
 
-	jack_property_change_notify (client, subject, key, PropertyDeleted);
-
-	if (d_key.size > 0) {
-		free (d_key.data);
-	}
+	req.type = type;
+	jack_uuid_copy (&req.x.property.uuid, subject);
+	req.x.property.keylen = key ? strlen (key) + 1 : 0;
+	req.x.property.key = key;
 
-	return 0;
+	return jack_client_deliver_request (client, &req);
 }
 
 int
-jack_remove_properties (jack_client_t* client, jack_uuid_t subject)
+jack_remove_property (jack_client_t* client, jack_uuid_t subject, const char* key)
 {
-	DBT key;
-	DBT data;
-	DBC* cursor;
-	int ret;
-	char ustr[JACK_UUID_STRING_SIZE];
-	int retval = 0;
-	uint32_t cnt = 0;
-
-	memset (ustr, 0, JACK_UUID_STRING_SIZE);
-	jack_uuid_unparse (subject, ustr);
-
-	if (jack_property_init (NULL)) {
+	if (key == NULL || key[0] == '\0') {
 		return -1;
 	}
 
-	if ((ret = db->cursor (db, NULL, &cursor, 0)) != 0) {
-		jack_error ("Cannot create cursor for metadata search (%s)", db_strerror (ret));
+	if (jack_property_remove_request (client, RemoveProperties, subject, key) <= 0) {
+		jack_error ("Cannot delete key %s", key);
 		return -1;
 	}
 
-	memset (&key, 0, sizeof(key));
-	memset (&data, 0, sizeof(data));
-	data.flags = DB_DBT_MALLOC;
-
-	while ((ret = cursor->get (cursor, &key, &data, DB_NEXT)) == 0) {
-
-		/* require 2 extra chars (data+null) for key,
-		   which is composed of UUID str plus a key name
-		 */
-
-		if (key.size < JACK_UUID_STRING_SIZE + 2) {
-			/* if (key.size  > 0) free(key.data); */
-			if (data.size > 0) {
-				free (data.data);
-			}
-			continue;
-		}
-
-		if (memcmp (ustr, key.data, JACK_UUID_STRING_SIZE) != 0) {
-			/* not relevant */
-			/* if (key.size  > 0) free(key.data); */
-			if (data.size > 0) {
-				free (data.data);
-			}
-			continue;
-		}
-
-		if ((ret = cursor->del (cursor, 0)) != 0) {
-			jack_error ("cannot delete property (%s)", db_strerror (ret));
-			/* don't return -1 here since this would leave things
-			   even more inconsistent. wait till the cursor is finished
-			 */
-			retval = -1;
-		}
-		cnt++;
-
-		/* if (key.size  > 0) free(key.data);  */
-		if (data.size > 0) {
-			free (data.data);
-		}
-	}
-
-	cursor->close (cursor);
-
-	if (cnt) {
-		jack_property_change_notify (client, subject, NULL, PropertyDeleted);
-	}
-
-	if (retval) {
-		return -1;
-	}
+	return 0;
+}
 
-	return cnt;
+int
+jack_remove_properties (jack_client_t* client, jack_uuid_t subject)
+{
+	return jack_property_remove_request (client, RemoveProperties, subject, NULL);
 }
 
 int
 jack_remove_all_properties (jack_client_t* client)
 {
-	int ret;
 	jack_uuid_t empty_uuid = JACK_UUID_EMPTY_INITIALIZER;
 
-	if (jack_property_init (NULL)) {
+	if (jack_property_remove_request (client, RemoveAllProperties,
+					  empty_uuid, NULL) < 0) {
+		jack_error ("Cannot clear properties");
 		return -1;
 	}
 
-	if ((ret = db->truncate (db, NULL, NULL, 0)) != 0) {
-		jack_error ("Cannot clear properties (%s)", db_strerror (ret));
-		return -1;
-	}
-
-	jack_property_change_notify (client, empty_uuid, NULL, PropertyDeleted);
-
 	return 0;
 }
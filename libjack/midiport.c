@@ -35,8 +35,10 @@ typedef struct _jack_midi_port_info_private {
 	uint32_t event_count;           /**< Number of events stored in this buffer */
 	jack_nframes_t last_write_loc;  /**< Used for both writing and mixdown */
 	uint32_t events_lost;           /**< Number of events lost in this buffer */
+	uint32_t high_water;            /**< Most bytes in use since buffer_init */
 } POST_PACKED_STRUCTURE jack_midi_port_info_private_t;
 
+
 typedef struct _jack_midi_port_internal_event {
 	uint16_t time;  /* offset within buffer limit to 64k */
 	uint16_t size;  /* event size limited to 64k */
@@ -46,6 +48,22 @@ typedef struct _jack_midi_port_internal_event {
 	} POST_PACKED_STRUCTURE;
 } POST_PACKED_STRUCTURE jack_midi_port_internal_event_t;
 
+/* Bytes of the buffer in use. The largest amount seen is kept across
+   cycles, jack_midi_clear_buffer() leaves it alone, so that the size a
+   port needs can be read off a running session. */
+static inline void
+jack_midi_update_high_water (jack_midi_port_info_private_t *info)
+{
+	uint32_t used = sizeof(jack_midi_port_info_private_t)
+			+ info->last_write_loc
+			+ info->event_count
+			* sizeof(jack_midi_port_internal_event_t);
+
+	if (used > info->high_water) {
+		info->high_water = used;
+	}
+}
+
 size_t
 jack_midi_internal_event_size ()
 {
@@ -79,6 +97,7 @@ jack_midi_buffer_init (void  *port_buffer,
 	info->event_count = 0;
 	info->last_write_loc = 0;
 	info->events_lost = 0;
+	info->high_water = sizeof(jack_midi_port_info_private_t);
 }
 
 
@@ -118,6 +137,52 @@ jack_midi_event_get (jack_midi_event_t *event,
 }
 
 
+/* Walks the events of a port buffer in order. The layout is published
+   with the prototypes below. */
+typedef struct {
+	void *port_buffer;
+	void *next;             /* next jack_midi_port_internal_event_t */
+	void *end;
+} jack_midi_iterator_t;
+
+
+void
+jack_midi_iterator_init (jack_midi_iterator_t *iter,
+			 void                 *port_buffer)
+{
+	jack_midi_port_info_private_t *info =
+		(jack_midi_port_info_private_t*)port_buffer;
+	jack_midi_port_internal_event_t *events =
+		(jack_midi_port_internal_event_t*)(info + 1);
+
+	iter->port_buffer = port_buffer;
+	iter->next = events;
+	iter->end = events + info->event_count;
+}
+
+
+/* Fill `event' with the next event, pointing into the port buffer,
+   and return 1; return 0 once all events have been seen. */
+int
+jack_midi_iterator_next (jack_midi_iterator_t *iter,
+			 jack_midi_event_t    *event)
+{
+	jack_midi_port_internal_event_t *port_event =
+		(jack_midi_port_internal_event_t*)iter->next;
+
+	if (iter->next == iter->end) {
+		return 0;
+	}
+
+	event->time = port_event->time;
+	event->size = port_event->size;
+	event->buffer = jack_midi_event_data (iter->port_buffer, port_event);
+	iter->next = port_event + 1;
+
+	return 1;
+}
+
+
 size_t
 jack_midi_max_event_size (void           *port_buffer)
 {
@@ -184,6 +249,7 @@ jack_midi_event_reserve (void           *port_buffer,
 				buffer_size - 1 - info->last_write_loc;
 		}
 		info->event_count += 1;
+		jack_midi_update_high_water (info);
 		return retbuf;
 	}
 failed:
@@ -210,6 +276,72 @@ jack_midi_event_write (void                   *port_buffer,
 }
 
 
+/* Write `count' events in one go. The free space is worked out once
+   and carried through the batch, and the buffer header is updated at
+   the end. Each event is checked as jack_midi_event_write() would
+   check it; those that do not fit or are out of order are counted as
+   lost and skipped. Returns the number of events written. */
+uint32_t
+jack_midi_event_write_batch (void                    *port_buffer,
+			     const jack_midi_event_t *events,
+			     uint32_t count)
+{
+	jack_midi_port_info_private_t *info =
+		(jack_midi_port_info_private_t*)port_buffer;
+	jack_midi_port_internal_event_t *event_buffer =
+		(jack_midi_port_internal_event_t*)(info + 1);
+	jack_midi_data_t *buf = (jack_midi_data_t*)port_buffer;
+	jack_midi_port_internal_event_t *event;
+	uint32_t event_count = info->event_count;
+	uint32_t last_write_loc = info->last_write_loc;
+	uint32_t buffer_size = info->buffer_size;
+	jack_nframes_t last_time = event_count ?
+				   event_buffer[event_count - 1].time : 0;
+	uint32_t written = 0;
+	size_t used_size;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		const jack_midi_event_t *in = &events[i];
+
+		used_size = sizeof(jack_midi_port_info_private_t)
+			    + last_write_loc
+			    + ((event_count + 1)
+			       * sizeof(jack_midi_port_internal_event_t));
+
+		if (in->time >= info->nframes || in->time < last_time ||
+		    in->size == 0 || used_size > buffer_size ||
+		    (in->size > MIDI_INLINE_MAX &&
+		     buffer_size - used_size < in->size)) {
+			info->events_lost++;
+			continue;
+		}
+
+		event = &event_buffer[event_count];
+		event->time = in->time;
+		event->size = in->size;
+
+		if (in->size <= MIDI_INLINE_MAX) {
+			memcpy (event->inline_data, in->buffer, in->size);
+		} else {
+			last_write_loc += in->size;
+			event->byte_offset = buffer_size - 1 - last_write_loc;
+			memcpy (&buf[event->byte_offset], in->buffer, in->size);
+		}
+
+		last_time = in->time;
+		event_count++;
+		written++;
+	}
+
+	info->event_count = event_count;
+	info->last_write_loc = last_write_loc;
+	jack_midi_update_high_water (info);
+
+	return written;
+}
+
+
 /* Can't check to make sure this port is an output anymore.  If this gets
  * called on an input port, all clients after the client that calls it
  * will think there are no events in the buffer as the event count has
@@ -227,97 +359,208 @@ jack_midi_clear_buffer (void           *port_buffer)
 }
 
 
+/* One connection taking part in a mixdown. */
+typedef struct {
+	jack_midi_port_info_private_t   *info;
+	jack_midi_port_internal_event_t *events;
+	uint32_t next;          /* index of the next event to mix */
+	uint32_t order;         /* position in the connection list */
+} jack_midi_mix_source_t;
+
+/* True if the next event of `a' goes out before that of `b'. Equal
+   times go in connection order, as they always have. */
+static inline int
+jack_midi_mix_before (const jack_midi_mix_source_t *a,
+		      const jack_midi_mix_source_t *b)
+{
+	uint16_t ta = a->events[a->next].time;
+	uint16_t tb = b->events[b->next].time;
+
+	return ta < tb || (ta == tb && a->order < b->order);
+}
+
+static void
+jack_midi_mix_sift_down (jack_midi_mix_source_t *heap, uint32_t n, uint32_t i)
+{
+	jack_midi_mix_source_t tmp;
+	uint32_t child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n &&
+		    jack_midi_mix_before (&heap[child + 1], &heap[child])) {
+			child++;
+		}
+		if (!jack_midi_mix_before (&heap[child], &heap[i])) {
+			break;
+		}
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/* Append `event', which lives in `in_buffer', to the mixdown buffer.
+   Events arrive in time order and were checked against nframes when
+   they were written, so of jack_midi_event_reserve()'s checks only
+   the one for space is left.
+ */
+static inline int
+jack_midi_mix_append (void *out_buffer, const void *in_buffer,
+		      const jack_midi_port_internal_event_t *event)
+{
+	jack_midi_port_info_private_t *info =
+		(jack_midi_port_info_private_t*)out_buffer;
+	jack_midi_port_internal_event_t *out_event =
+		(jack_midi_port_internal_event_t*)(info + 1) + info->event_count;
+	size_t used_size = sizeof(jack_midi_port_info_private_t)
+			   + info->last_write_loc
+			   + ((info->event_count + 1)
+			      * sizeof(jack_midi_port_internal_event_t));
+
+	if (used_size > info->buffer_size) {
+		return ENOBUFS;
+	}
+
+	if (event->size > MIDI_INLINE_MAX &&
+	    info->buffer_size - used_size < event->size) {
+		return ENOBUFS;
+	}
+
+	out_event->time = event->time;
+	out_event->size = event->size;
+
+	if (event->size <= MIDI_INLINE_MAX) {
+		memcpy (out_event->inline_data, event->inline_data, event->size);
+	} else {
+		info->last_write_loc += event->size;
+		out_event->byte_offset =
+			info->buffer_size - 1 - info->last_write_loc;
+		memcpy ((jack_midi_data_t*)out_buffer + out_event->byte_offset,
+			(const jack_midi_data_t*)in_buffer + event->byte_offset,
+			event->size);
+	}
+
+	info->event_count++;
+	return 0;
+}
+
+/* Copy a whole source buffer that is laid out like the output. The
+   data area is found from the events themselves, since other clients'
+   mixdowns may have used the source's last_write_loc as a cursor.
+ */
+static void
+jack_midi_mix_copy (void *out_buffer, const jack_midi_mix_source_t *src)
+{
+	jack_midi_port_info_private_t *out_info =
+		(jack_midi_port_info_private_t*)out_buffer;
+	uint32_t count = src->info->event_count;
+	jack_shmsize_t lowest = out_info->buffer_size - 1;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (src->events[i].size > MIDI_INLINE_MAX &&
+		    src->events[i].byte_offset < lowest) {
+			lowest = src->events[i].byte_offset;
+		}
+	}
+
+	memcpy (out_info + 1, src->events,
+		count * sizeof(jack_midi_port_internal_event_t));
+	memcpy ((jack_midi_data_t*)out_buffer + lowest,
+		(const jack_midi_data_t*)src->info + lowest,
+		out_info->buffer_size - 1 - lowest);
+
+	out_info->event_count = count;
+	out_info->last_write_loc = out_info->buffer_size - 1 - lowest;
+}
+
 /* jack_midi_port_functions.mixdown */
 static void
 jack_midi_port_mixdown (jack_port_t    *port, jack_nframes_t nframes)
 {
-	JSList         *node;
-	jack_port_t    *input;
+	jack_midi_port_info_private_t *in_info;
+	jack_midi_port_info_private_t *out_info;
+	jack_midi_mix_source_t *src;
 	jack_nframes_t num_events = 0;
-	jack_nframes_t i          = 0;
-	int err        = 0;
+	jack_nframes_t written = 0;
 	jack_nframes_t lost_events = 0;
+	uint32_t nconnections = port->nsources;
+	uint32_t n = 0;
+	uint32_t i;
 
-	/* The next (single) event to mix in to the buffer */
-	jack_midi_port_info_private_t   *earliest_info;
-	jack_midi_port_internal_event_t *earliest_event;
-	jack_midi_data_t                *earliest_buffer;
-
-	jack_midi_port_info_private_t   *in_info;       /* For finding next event */
-	jack_midi_port_internal_event_t *in_events;     /* Corresponds to in_info */
-	jack_midi_port_info_private_t   *out_info;      /* Output 'buffer' */
+	/* one slot per connection, on the stack: the RT thread must not
+	   allocate, and the connection count is small */
+	jack_midi_mix_source_t heap[nconnections ? nconnections : 1];
 
 	jack_midi_clear_buffer (port->mix_buffer);
 
 	out_info = (jack_midi_port_info_private_t*)port->mix_buffer;
 
-	/* This function uses jack_midi_port_info_private_t.last_write_loc of the
-	 * source ports to store indices of the last event read from that buffer
-	 * so far.  This is OK because last_write_loc is used when writing events
-	 * to a buffer, which at this stage is already complete so the value
-	 * can be safely smashed. */
-
-	/* Iterate through all connections to see how many events we need to mix,
-	 * and initialise their 'last event read' (last_write_loc) to 0 */
-	for (node = port->connections; node; node = jack_slist_next (node)) {
-		input = (jack_port_t*)node->data;
-		in_info =
-			(jack_midi_port_info_private_t*)jack_output_port_buffer (input);
+	/* Gather the connections that have events this cycle. The
+	 * source buffers belong to other clients and are left alone. */
+	for (i = 0; i < nconnections; i++) {
+		if (jack_port_source_silent (port, port->sources[i])) {
+			continue;
+		}
+		in_info = (jack_midi_port_info_private_t*)
+			  jack_port_source_buffer (port, port->sources[i]);
 		num_events += in_info->event_count;
 		lost_events += in_info->events_lost;
-		in_info->last_write_loc = 0;
+		if (in_info->event_count) {
+			heap[n].info = in_info;
+			heap[n].events =
+				(jack_midi_port_internal_event_t*)(in_info + 1);
+			heap[n].next = 0;
+			heap[n].order = i;
+			n++;
+		}
 	}
 
-	/* Write the events in the order of their timestamps */
-	for (i = 0; i < num_events; ++i) {
-		earliest_info = NULL;
-		earliest_event = NULL;
-		earliest_buffer = NULL;
-
-		/* Find the earliest unread event, to mix next
-		 * (search for an event earlier than earliest_event) */
-		for (node = port->connections; node; node = jack_slist_next (node)) {
-			in_info = (jack_midi_port_info_private_t*)
-				  jack_output_port_buffer (((jack_port_t*)node->data));
-			in_events = (jack_midi_port_internal_event_t*)(in_info + 1);
-
-			/* If there are unread events left in this port.. */
-			if (in_info->event_count > in_info->last_write_loc) {
-				/* .. and this event is the new earliest .. */
-				/* NOTE: that's why we compare time with <, not <= */
-				if (earliest_info == NULL
-				    || in_events[in_info->last_write_loc].time
-				    < earliest_event->time) {
-					/* .. then set this event as the next earliest */
-					earliest_info = in_info;
-					earliest_event = (jack_midi_port_internal_event_t*)
-							 (&in_events[in_info->last_write_loc]);
-				}
-			}
-		}
+	if (n == 1 && heap[0].info->buffer_size == out_info->buffer_size) {
 
-		if (earliest_info && earliest_event) {
-			earliest_buffer = (jack_midi_data_t*)earliest_info;
+		/* only one source has anything to say, take it as is */
 
-			/* Write event to output */
-			err = jack_midi_event_write (
-				jack_port_buffer (port),
-				earliest_event->time,
-				jack_midi_event_data (earliest_buffer, earliest_event),
-				earliest_event->size);
+		jack_midi_mix_copy (port->mix_buffer, &heap[0]);
+		written = num_events;
+		n = 0;
+	}
 
-			earliest_info->last_write_loc++;
+	for (i = n / 2; i-- > 0; ) {
+		jack_midi_mix_sift_down (heap, n, i);
+	}
 
-			if (err) {
-				out_info->events_lost = num_events - i;
-				break;
+	/* Write the events in the order of their timestamps: take the
+	 * source with the earliest next event, and copy its events for as
+	 * long as they stay ahead of both children, which hold the
+	 * earliest of the rest. */
+	while (n) {
+		src = &heap[0];
+
+		do {
+			if (jack_midi_mix_append (port->mix_buffer, src->info,
+						  &src->events[src->next])) {
+				out_info->events_lost = num_events - written;
+				goto done;
 			}
+			written++;
+			src->next++;
+		} while (src->next < src->info->event_count &&
+			 (n < 2 || jack_midi_mix_before (src, &heap[1])) &&
+			 (n < 3 || jack_midi_mix_before (src, &heap[2])));
+
+		if (src->next == src->info->event_count) {
+			heap[0] = heap[--n];
 		}
+		jack_midi_mix_sift_down (heap, n, 0);
 	}
+
+done:
 	assert (out_info->event_count == num_events - out_info->events_lost);
 
 	// inherit total lost events count from all connected ports.
 	out_info->events_lost += lost_events;
+	jack_midi_update_high_water (out_info);
 }
 
 
@@ -327,6 +570,15 @@ jack_midi_get_lost_event_count (void           *port_buffer)
 	return ((jack_midi_port_info_private_t*)port_buffer)->events_lost;
 }
 
+/* The most bytes `port_buffer' has held since its port got it, the
+   header included: what to give jack_port_register() as the buffer
+   size of a port like it. Belongs in <jack/midiport.h>. */
+uint32_t
+jack_midi_get_high_water (void           *port_buffer)
+{
+	return ((jack_midi_port_info_private_t*)port_buffer)->high_water;
+}
+
 jack_port_functions_t jack_builtin_midi_functions = {
 	.buffer_init	= jack_midi_buffer_init,
 	.mixdown	= jack_midi_port_mixdown,
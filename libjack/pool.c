@@ -17,24 +17,289 @@
 
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 
-#ifdef HAVE_POSIX_MEMALIGN
-#define _XOPEN_SOURCE 600
-#endif
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <config.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
+#include "internal.h"
 #include "pool.h"
 
-/* XXX need RT-pool based allocator here */
+/* RT-safe allocation for client-local memory.
+
+   The pool is one arena per process, mapped and locked when the first
+   client activates. It is cut into JACK_POOL_SPAN sized spans, and a
+   span is given over whole to one size class (powers of two from
+   JACK_POOL_MIN_BLOCK to JACK_POOL_SPAN) the first time that class
+   runs dry. Each class keeps a lock-free LIFO of free blocks. Its
+   head packs the block index with a counter that changes on every
+   update, so a thread that was preempted mid-pop cannot be fooled by
+   the same block coming back. A free block holds the index of the next
+   one in its first word.
+
+   Nothing on the alloc/release path takes a lock or enters the
+   kernel. Requests larger than a span, and requests made before the
+   arena exists or after it is used up, fall back to posix_memalign(),
+   which is not RT-safe; jack_pool_reserve() sizes the arena for
+   clients that need more than the default, and the mix buffers of the
+   input ports registered before then are added on top of that (see
+   jack_pool_expect()), so connecting them later cannot run it dry.
+ */
+
+#define JACK_POOL_SPAN          65536
+#define JACK_POOL_MIN_SHIFT     6
+#define JACK_POOL_MIN_BLOCK     (1 << JACK_POOL_MIN_SHIFT)
+#define JACK_POOL_CLASSES       11      /* 64 bytes ... 64 kB */
+#define JACK_POOL_DEFAULT_SIZE  (4 * 1024 * 1024)
+
+typedef struct {
+	/* (update counter << 32) | (block index + 1), 0 when empty */
+	volatile uint64_t head __attribute__((aligned (64)));
+} jack_pool_class_t;
+
+typedef struct {
+	char * volatile base;
+	size_t size;
+	uint32_t nspans;
+	volatile uint32_t next_span;
+	uint8_t *span_class;
+	int mlocked;
+	jack_pool_class_t classes[JACK_POOL_CLASSES];
+} jack_pool_t;
+
+static jack_pool_t pool;
+static size_t pool_size = JACK_POOL_DEFAULT_SIZE;
+static size_t pool_expected;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline char *
+jack_pool_block (char *base, uint32_t idx)
+{
+	return base + ((size_t)(idx - 1) << JACK_POOL_MIN_SHIFT);
+}
+
+static inline uint32_t
+jack_pool_index (char *base, void *ptr)
+{
+	return (uint32_t)(((char*)ptr - base) >> JACK_POOL_MIN_SHIFT) + 1;
+}
+
+static inline int
+jack_pool_class (size_t bytes)
+{
+	int cl = 0;
+
+	while (((size_t)JACK_POOL_MIN_BLOCK << cl) < bytes) {
+		cl++;
+	}
+
+	return cl;
+}
+
+static void *
+jack_pool_pop (char *base, int cl)
+{
+	volatile uint64_t *head = &pool.classes[cl].head;
+	uint64_t old, new;
+	uint32_t idx, next;
+
+	old = __atomic_load_n (head, __ATOMIC_ACQUIRE);
+
+	do {
+		if ((idx = (uint32_t)old) == 0) {
+			return NULL;
+		}
+		/* the block may be handed out under our feet, in which
+		   case this reads junk and the exchange below fails */
+		next = __atomic_load_n ((uint32_t*)jack_pool_block (base, idx),
+					__ATOMIC_RELAXED);
+		new = ((old >> 32) + 1) << 32 | next;
+	} while (!__atomic_compare_exchange_n (head, &old, new, 1,
+					       __ATOMIC_ACQUIRE,
+					       __ATOMIC_ACQUIRE));
+
+	return jack_pool_block (base, idx);
+}
+
+static void
+jack_pool_push (char *base, int cl, void *ptr)
+{
+	volatile uint64_t *head = &pool.classes[cl].head;
+	uint32_t idx = jack_pool_index (base, ptr);
+	uint64_t old, new;
+
+	old = __atomic_load_n (head, __ATOMIC_RELAXED);
+
+	do {
+		__atomic_store_n ((uint32_t*)ptr, (uint32_t)old, __ATOMIC_RELAXED);
+		new = ((old >> 32) + 1) << 32 | idx;
+	} while (!__atomic_compare_exchange_n (head, &old, new, 1,
+					       __ATOMIC_RELEASE,
+					       __ATOMIC_RELAXED));
+}
+
+/* Give a fresh span to class `cl' and return its first block. */
+
+static void *
+jack_pool_refill (char *base, int cl)
+{
+	size_t bsize = (size_t)JACK_POOL_MIN_BLOCK << cl;
+	uint32_t span;
+	char *start;
+	size_t off;
+
+	span = __atomic_load_n (&pool.next_span, __ATOMIC_RELAXED);
+
+	do {
+		if (span >= pool.nspans) {
+			return NULL;
+		}
+	} while (!__atomic_compare_exchange_n (&pool.next_span, &span, span + 1,
+					       1, __ATOMIC_RELAXED,
+					       __ATOMIC_RELAXED));
+
+	pool.span_class[span] = cl;
+	start = base + (size_t)span * JACK_POOL_SPAN;
+
+	for (off = bsize; off < JACK_POOL_SPAN; off += bsize) {
+		jack_pool_push (base, cl, start + off);
+	}
+
+	return start;
+}
+
+/* Map the arena, if that has not happened yet, and lock it down if
+   `do_mlock' is set. Called when a client activates, from a non-RT
+   thread. */
+
+void
+jack_pool_activate (int do_mlock)
+{
+	size_t page, off, size;
+	char *map, *base;
+
+	pthread_mutex_lock (&pool_lock);
+
+	if (pool.base == NULL) {
+
+		size = pool_size + ((pool_expected + JACK_POOL_SPAN - 1)
+				    & ~(size_t)(JACK_POOL_SPAN - 1));
+
+		/* map an extra span so the arena can start on a span
+		   boundary, which keeps every block aligned to its size */
+
+		map = mmap (NULL, size + JACK_POOL_SPAN,
+			    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			    -1, 0);
+		if (map == MAP_FAILED) {
+			jack_error ("cannot map %lu bytes for the client memory "
+				    "pool", (unsigned long)size);
+			pthread_mutex_unlock (&pool_lock);
+			return;
+		}
+
+		base = (char*)(((uintptr_t)map + JACK_POOL_SPAN - 1)
+			       & ~(uintptr_t)(JACK_POOL_SPAN - 1));
+
+		pool.size = size;
+		pool.nspans = size / JACK_POOL_SPAN;
+		if ((pool.span_class = calloc (pool.nspans, 1)) == NULL) {
+			munmap (map, size + JACK_POOL_SPAN);
+			pthread_mutex_unlock (&pool_lock);
+			return;
+		}
+
+		/* fault the pages in now rather than in process() */
+		page = sysconf (_SC_PAGESIZE);
+		for (off = 0; off < pool.size; off += page) {
+			base[off] = 0;
+		}
+
+		__atomic_store_n (&pool.base, base, __ATOMIC_RELEASE);
+	}
+
+#ifdef USE_MLOCK
+	if (do_mlock && !pool.mlocked) {
+		if (mlock (pool.base, pool.size)) {
+			jack_error ("cannot lock down the client memory pool "
+				    "(%s)", strerror (errno));
+		} else {
+			pool.mlocked = 1;
+		}
+	}
+#endif  /* USE_MLOCK */
+
+	pthread_mutex_unlock (&pool_lock);
+}
+
+/* Ask for an arena of at least `bytes'. This only has an effect
+   before the first client activates; returns -1 if the arena already
+   exists and is smaller. */
+
+int
+jack_pool_reserve (size_t bytes)
+{
+	int ret = 0;
+
+	pthread_mutex_lock (&pool_lock);
+
+	bytes = (bytes + JACK_POOL_SPAN - 1) & ~(size_t)(JACK_POOL_SPAN - 1);
+
+	if (pool.base) {
+		ret = (bytes <= pool.size) ? 0 : -1;
+	} else if (bytes > pool_size) {
+		pool_size = bytes;
+	}
+
+	pthread_mutex_unlock (&pool_lock);
+
+	return ret;
+}
+
+/* Count an allocation of `bytes' that is likely to be made later, such
+   as the mix buffer of an input port, towards the size of the arena.
+   Only has an effect before the arena is mapped; a block takes up the
+   whole of its size class. */
+
+void
+jack_pool_expect (size_t bytes)
+{
+	pthread_mutex_lock (&pool_lock);
+
+	if (pool.base == NULL && bytes <= JACK_POOL_SPAN) {
+		pool_expected += (size_t)JACK_POOL_MIN_BLOCK
+				 << jack_pool_class (bytes);
+	}
+
+	pthread_mutex_unlock (&pool_lock);
+}
+
 void *
 jack_pool_alloc (size_t bytes)
 {
+	char *base = __atomic_load_n (&pool.base, __ATOMIC_ACQUIRE);
+	void *m;
+	int cl;
+
+	if (base && bytes <= JACK_POOL_SPAN) {
+		cl = jack_pool_class (bytes);
+		if ((m = jack_pool_pop (base, cl)) != NULL ||
+		    (m = jack_pool_refill (base, cl)) != NULL) {
+			return m;
+		}
+	}
+
 #ifdef HAVE_POSIX_MEMALIGN
-	void* m;
-	int err = posix_memalign (&m, 64, bytes);
-	return (!err) ? m : 0;
+	if (posix_memalign (&m, 64, bytes)) {
+		return NULL;
+	}
+	return m;
 #else
 	return malloc (bytes);
 #endif  /* HAVE_POSIX_MEMALIGN */
@@ -43,5 +308,17 @@ jack_pool_alloc (size_t bytes)
 void
 jack_pool_release (void *ptr)
 {
+	char *base = __atomic_load_n (&pool.base, __ATOMIC_ACQUIRE);
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (base && (char*)ptr >= base && (char*)ptr < base + pool.size) {
+		jack_pool_push (base, pool.span_class[((char*)ptr - base)
+						      / JACK_POOL_SPAN], ptr);
+		return;
+	}
+
 	free (ptr);
 }
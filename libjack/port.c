@@ -18,6 +18,7 @@
 
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
@@ -37,6 +38,7 @@
 #include "pool.h"
 #include "port.h"
 #include "intsimd.h"
+#include "probes.h"
 
 #include "local.h"
 
@@ -47,6 +49,12 @@ static void    jack_generic_buffer_init(void *port_buffer,
 static void    jack_audio_port_mixdown(jack_port_t *port,
 				       jack_nframes_t nframes);
 
+static void    jack_multichannel_port_mixdown(jack_port_t *port,
+					      jack_nframes_t nframes);
+
+static void    jack_double_port_mixdown(jack_port_t *port,
+					jack_nframes_t nframes);
+
 /* These function pointers are local to each address space.  For
  * internal clients they reside within jackd; for external clients in
  * the application process. */
@@ -57,76 +65,116 @@ jack_port_functions_t jack_builtin_audio_functions = {
 
 extern jack_port_functions_t jack_builtin_midi_functions;
 
+jack_port_functions_t jack_builtin_multichannel_functions = {
+	.buffer_init	= jack_generic_buffer_init,
+	.mixdown	= jack_multichannel_port_mixdown,
+};
+
+jack_port_functions_t jack_builtin_double_functions = {
+	.buffer_init	= jack_generic_buffer_init,
+	.mixdown	= jack_double_port_mixdown,
+};
+
 jack_port_functions_t jack_builtin_NULL_functions = {
 	.buffer_init	= jack_generic_buffer_init,
 	.mixdown	= NULL,
 };
 
-/* Only the Audio and MIDI port types are currently built in. */
+/* Audio, MIDI, multichannel and double precision audio are built
+   in; the order matches the JACK_*_PORT_TYPE ids. */
 jack_port_type_info_t jack_builtin_port_types[] = {
 	{ .type_name = JACK_DEFAULT_AUDIO_TYPE,
 	  .buffer_scale_factor = 1, },
 	{ .type_name = JACK_DEFAULT_MIDI_TYPE,
 	  .buffer_scale_factor = -1,
 	  .buffer_size = 2048 },
+	{ .type_name = JACK_MULTICHANNEL_AUDIO_TYPE,
+	  .buffer_scale_factor = JACK_MULTICHANNEL_MAX_CHANNELS, },
+	{ .type_name = JACK_DOUBLE_AUDIO_TYPE,
+	  .buffer_scale_factor = sizeof(double)
+				 / sizeof(jack_default_audio_sample_t), },
 	{ .type_name = "", }
 };
 
-/* these functions have been taken from libDSP X86.c  -jl */
-
-#ifdef USE_DYNSIMD
+/* inputs summed per pass over a mix buffer */
+#define JACK_MIX_SOURCES 8
 
-static void (*opt_copy)(float *, const float *, int);
-static void (*opt_mix)(float *, const float *, int);
+#ifndef USE_DYNSIMD
 
+/* dest = src[0] + ... + src[nsrc - 1]; dest may be one of the sources.
+ * With dynamic SIMD, jack_simd.mixnf is used instead.
+ */
 static void
-gen_copyf (float *dest, const float *src, int length)
+gen_mixnf (float *dest, const float **src, int nsrc, int length)
 {
-	memcpy (dest, src, length * sizeof(float));
+	int i, s;
+	float f;
+
+	for (i = 0; i < length; i++) {
+		f = src[0][i];
+		for (s = 1; s < nsrc; s++)
+			f += src[s][i];
+		dest[i] = f;
+	}
 }
 
+/* dest = src[0] * gain[0] + ..., each gain moving by step[s] every
+ * sample. With dynamic SIMD, jack_simd.mixgainf is used instead.
+ */
 static void
-gen_mixf (float *dest, const float *src, int length)
+gen_mixgainf (float *dest, const float **src, const float *gain,
+	      const float *step, int nsrc, int length)
 {
-	int n;
-
-	n = length;
-	while (n--)
-		*dest++ += *src++;
-	/*for (iSample = 0; iSample < iDataLength; iSample++)
-	        fpDest[iSample] += fpSrc[iSample];*/
+	int i, s;
+	float f;
+
+	for (i = 0; i < length; i++) {
+		f = src[0][i] * (gain[0] + step[0] * i);
+		for (s = 1; s < nsrc; s++)
+			f += src[s][i] * (gain[s] + step[s] * i);
+		dest[i] = f;
+	}
 }
 
-#ifdef ARCH_X86
-
-void jack_port_set_funcs ()
+/* The largest magnitude in src and the sum of its squares. With
+ * dynamic SIMD, jack_simd.meterf is used instead.
+ */
+static void
+gen_meterf (const float *src, int length, float *peak, float *sumsq)
 {
-	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
-		opt_copy = x86_sse_copyf;
-		opt_mix = x86_sse_add2f;
-	} else if (ARCH_X86_HAVE_3DNOW (cpu_type)) {
-		opt_copy = x86_3dnow_copyf;
-		opt_mix = x86_3dnow_add2f;
-	} else {
-		opt_copy = gen_copyf;
-		opt_mix = gen_mixf;
+	int i;
+	float f, p = 0.0f, q = 0.0f;
+
+	for (i = 0; i < length; i++) {
+		f = src[i];
+		q += f * f;
+		if (f < 0.0f)
+			f = -f;
+		if (f > p)
+			p = f;
 	}
+	*peak = p;
+	*sumsq = q;
 }
 
-#else /* ARCH_X86 */
-
-void jack_port_set_funcs ()
+static void
+gen_mixnd (double *dest, const double **src, int nsrc, int length)
 {
-	opt_copy = gen_copyf;
-	opt_mix = gen_mixf;
+	int i, s;
+	double d;
+
+	for (i = 0; i < length; i++) {
+		d = src[0][i];
+		for (s = 1; s < nsrc; s++)
+			d += src[s][i];
+		dest[i] = d;
+	}
 }
 
-#endif  /* ARCH_X86 */
-
-#endif  /* USE_DYNSIMD */
+#endif  /* !USE_DYNSIMD */
 
 int
-jack_port_name_equals (jack_port_shared_t* port, const char* target)
+jack_port_name_equals (jack_port_names_t* port, const char* target)
 {
 	char buf[JACK_PORT_NAME_SIZE + 1];
 
@@ -155,6 +203,10 @@ jack_get_port_functions (jack_port_type_id_t ptid)
 		return &jack_builtin_audio_functions;
 	case JACK_MIDI_PORT_TYPE:
 		return &jack_builtin_midi_functions;
+	case JACK_MULTICHANNEL_PORT_TYPE:
+		return &jack_builtin_multichannel_functions;
+	case JACK_DOUBLE_PORT_TYPE:
+		return &jack_builtin_double_functions;
 	/* no other builtin functions */
 	default:
 		return NULL;
@@ -175,10 +227,16 @@ jack_port_t *
 jack_port_new (const jack_client_t *client, jack_port_id_t port_id,
 	       jack_control_t *control)
 {
-	jack_port_shared_t *shared = &control->ports[port_id];
-	jack_port_type_id_t ptid = shared->ptype_id;
+	jack_port_shared_t *shared = jack_port_shared_by_id (client, port_id);
+	jack_port_type_id_t ptid;
 	jack_port_t *port;
 
+	if (shared == NULL) {
+		return NULL;
+	}
+
+	ptid = shared->ptype_id;
+
 	if ((port = (jack_port_t*)malloc (sizeof(jack_port_t))) == NULL) {
 		return NULL;
 	}
@@ -186,10 +244,24 @@ jack_port_new (const jack_client_t *client, jack_port_id_t port_id,
 	port->mix_buffer = NULL;
 	port->client_segment_base = NULL;
 	port->shared = shared;
+	port->names = jack_port_table_names (client->port_table,
+					     client->engine, port_id);
 	port->type_info = &client->engine->port_types[ptid];
 	pthread_mutex_init (&port->connection_lock, NULL);
 	port->connections = 0;
+	port->sources = port->inline_sources;
+	port->nsources = 0;
+	port->gains = port->inline_gains;
 	port->tied = NULL;
+	port->cycle = &client->engine->cycle_serial;
+	port->buffer = NULL;
+	port->buffer_cycle = 0;
+	port->buffer_nframes = 0;
+	port->written = FALSE;
+	port->written_offset = 0;
+	port->async_buffer = NULL;
+	port->async_silent = FALSE;
+	port->ring_base = NULL;
 
 	if (jack_uuid_compare (client->control->uuid, port->shared->client_id) == 0) {
 
@@ -203,6 +275,17 @@ jack_port_new (const jack_client_t *client, jack_port_id_t port_id,
 		}
 		port->fptr = *port_functions;
 		port->shared->has_mixdown = (port->fptr.mixdown ? TRUE : FALSE);
+		port->ring_base = (char**)&client->ring_base;
+
+		/* leave room in the pool for a mix buffer, so that the
+		   second connection does not have to fall back to the
+		   heap */
+		if ((port->shared->flags & JackPortIsInput) &&
+		    port->fptr.mixdown) {
+			jack_pool_expect (jack_port_type_buffer_size (
+						  port->type_info,
+						  client->engine->buffer_size));
+		}
 	}
 
 	/* set up a base address so that port->offset can be used to
@@ -285,6 +368,10 @@ jack_port_register (jack_client_t *client,
 
 	client->ports = jack_slist_prepend (client->ports, port);
 
+	if (client->control->process_async) {
+		jack_port_set_async (client, port, TRUE);
+	}
+
 	return port;
 }
 
@@ -293,8 +380,9 @@ jack_port_unregister (jack_client_t *client, jack_port_t *port)
 {
 	jack_request_t req;
 
-	VALGRIND_MEMSET (&req, 0, sizeof(req));
+	jack_port_set_async (client, port, FALSE);
 
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
 
 	req.type = UnRegisterPort;
 	req.x.port_info.port_id = port->shared->id;
@@ -303,6 +391,265 @@ jack_port_unregister (jack_client_t *client, jack_port_t *port)
 	return jack_client_deliver_request (client, &req);
 }
 
+/* Register `nports' ports of one type and flags in a single request,
+ * and fill `ports' with them. Either all of them are registered, or
+ * none are and -1 is returned. Other clients hear about them in
+ * PortsRegistered events carrying many ports each, rather than one
+ * event per port.
+ */
+int
+jack_port_register_many (jack_client_t *client,
+			 const char **port_names,
+			 const char *port_type,
+			 unsigned long flags,
+			 unsigned long buffer_size,
+			 jack_port_t **ports,
+			 unsigned int nports)
+{
+	jack_request_t req;
+	jack_port_id_t *ids;
+	char *names;
+	unsigned int i, j;
+	int ret = -1;
+
+	if (nports == 0) {
+		return 0;
+	}
+
+	if (nports > JACK_PORT_BATCH_MAX) {
+		jack_error ("cannot register more than %d ports at once",
+			    JACK_PORT_BATCH_MAX);
+		return -1;
+	}
+
+	names = (char*)malloc (nports * JACK_PORT_NAME_SIZE);
+	ids = (jack_port_id_t*)malloc (nports * sizeof(jack_port_id_t));
+
+	if (names == NULL || ids == NULL) {
+		jack_error ("cannot allocate memory for %u ports", nports);
+		goto out;
+	}
+
+	for (i = 0; i < nports; i++) {
+		if (snprintf (names + i * JACK_PORT_NAME_SIZE, JACK_PORT_NAME_SIZE,
+			      "%s:%s", client->control->name, port_names[i])
+		    >= JACK_PORT_NAME_SIZE) {
+			jack_error ("\"%s:%s\" is too long to be used as a JACK port name.\n"
+				    "Please use %d characters or less.",
+				    client->control->name, port_names[i],
+				    JACK_PORT_NAME_SIZE - 1);
+			goto out;
+		}
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = RegisterPorts;
+	snprintf (req.x.port_batch.type, sizeof(req.x.port_batch.type),
+		  "%s", port_type);
+	req.x.port_batch.flags = flags;
+	req.x.port_batch.buffer_size = buffer_size;
+	jack_uuid_copy (&req.x.port_batch.client_id, client->control->uuid);
+	req.x.port_batch.nports = nports;
+	req.x.port_batch.names = names;
+	req.x.port_batch.port_ids = ids;
+
+	if (jack_client_deliver_request (client, &req)) {
+		jack_error ("cannot deliver port registration request");
+		goto out;
+	}
+
+	for (i = 0; i < nports; i++) {
+		if ((ports[i] = jack_port_new (client, ids[i],
+					       client->engine)) == NULL) {
+			jack_error ("cannot allocate client side port structure");
+			/* give back the ones we cannot use */
+			for (j = 0; j < i; j++) {
+				client->ports = jack_slist_remove (client->ports, ports[j]);
+			}
+			VALGRIND_MEMSET (&req, 0, sizeof(req));
+			req.type = UnRegisterPorts;
+			jack_uuid_copy (&req.x.port_batch.client_id, client->control->uuid);
+			req.x.port_batch.nports = nports;
+			req.x.port_batch.port_ids = ids;
+			jack_client_deliver_request (client, &req);
+			goto out;
+		}
+		client->ports = jack_slist_prepend (client->ports, ports[i]);
+		if (client->control->process_async) {
+			jack_port_set_async (client, ports[i], TRUE);
+		}
+	}
+
+	ret = 0;
+
+out:
+	free (names);
+	free (ids);
+	return ret;
+}
+
+/* Unregister `nports' ports of this client in a single request. */
+int
+jack_port_unregister_many (jack_client_t *client, jack_port_t **ports,
+			   unsigned int nports)
+{
+	jack_request_t req;
+	jack_port_id_t *ids;
+	unsigned int i;
+	int ret;
+
+	if (nports == 0) {
+		return 0;
+	}
+
+	if (nports > JACK_PORT_BATCH_MAX) {
+		jack_error ("cannot unregister more than %d ports at once",
+			    JACK_PORT_BATCH_MAX);
+		return -1;
+	}
+
+	if ((ids = (jack_port_id_t*)malloc (nports * sizeof(jack_port_id_t))) == NULL) {
+		jack_error ("cannot allocate memory for %u ports", nports);
+		return -1;
+	}
+
+	for (i = 0; i < nports; i++) {
+		jack_port_set_async (client, ports[i], FALSE);
+		ids[i] = ports[i]->shared->id;
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = UnRegisterPorts;
+	jack_uuid_copy (&req.x.port_batch.client_id, client->control->uuid);
+	req.x.port_batch.nports = nports;
+	req.x.port_batch.port_ids = ids;
+
+	ret = jack_client_deliver_request (client, &req);
+
+	free (ids);
+
+	return ret;
+}
+
+/* The gain the engine has for the connection of input `port' from
+ * `src', the i'th of its sources: 1.0 unless a client has set one.
+ * The engine keeps its connections in the order the client does, so
+ * the i'th shared entry is nearly always the one.
+ */
+static float
+jack_port_connection_gain (jack_port_t *port, jack_port_t *src, uint32_t i)
+{
+	jack_port_shared_t *shared = port->shared;
+	jack_port_id_t id = src->shared->id;
+	uint32_t n = shared->n_connections;
+	uint32_t j;
+
+	if (n > JACK_PORT_CONNECTIONS_SHARED) {
+		n = JACK_PORT_CONNECTIONS_SHARED;
+	}
+	if (i < n && shared->connection_ids[i] == id) {
+		return shared->connection_gains[i];
+	}
+	for (j = 0; j < n; j++) {
+		if (shared->connection_ids[j] == id) {
+			return shared->connection_gains[j];
+		}
+	}
+	return 1.0f;
+}
+
+/* is the i'th source of `port' muted, and was it already? */
+static inline int
+jack_port_source_muted (jack_port_t *port, uint32_t i)
+{
+	return port->gains[i] == 0.0f &&
+	       jack_port_connection_gain (port, port->sources[i], i) == 0.0f;
+}
+
+/* is it at unity gain, and was it already? */
+static inline int
+jack_port_source_unity (jack_port_t *port, uint32_t i)
+{
+	return port->gains[i] == 1.0f &&
+	       jack_port_connection_gain (port, port->sources[i], i) == 1.0f;
+}
+
+/* Copy `port->connections' into `port->sources'. Called with the
+ * connection lock held, from the event thread, whenever the list
+ * changes; if the array cannot grow, the connections beyond the inline
+ * ones are left out of the mix rather than the process thread walking
+ * the list. A source that was there before keeps the gain the last
+ * mixdown left it at; a new one starts at its own, without a ramp.
+ */
+void
+jack_port_update_sources (jack_port_t *port)
+{
+	jack_port_t **sources = port->inline_sources;
+	float *gains = port->inline_gains;
+	float inline_gains[JACK_PORT_INLINE_SOURCES];
+	float *new_gains = inline_gains;
+	uint32_t n = jack_slist_length (port->connections);
+	JSList *node;
+	uint32_t i, j;
+
+	if (n > JACK_PORT_INLINE_SOURCES) {
+		sources = (jack_port_t**) malloc (n * sizeof(jack_port_t*));
+		gains = (float*) malloc (n * sizeof(float));
+		if (sources == NULL || gains == NULL) {
+			jack_error ("cannot allocate source array for %u connections"
+				    " of %s", n, port->names->name);
+			free (sources);
+			free (gains);
+			sources = port->inline_sources;
+			gains = port->inline_gains;
+			n = JACK_PORT_INLINE_SOURCES;
+		} else {
+			new_gains = gains;
+		}
+	}
+
+	for (node = port->connections, i = 0; i < n;
+	     node = jack_slist_next (node), i++) {
+		new_gains[i] = jack_port_connection_gain (port, node->data, i);
+		for (j = 0; j < port->nsources; j++) {
+			if (port->sources[j] == node->data) {
+				new_gains[i] = port->gains[j];
+				break;
+			}
+		}
+	}
+
+	for (node = port->connections, i = 0; i < n;
+	     node = jack_slist_next (node), i++) {
+		sources[i] = (jack_port_t*)node->data;
+	}
+	if (new_gains != gains) {
+		memcpy (gains, new_gains, n * sizeof(float));
+	}
+
+	if (port->sources != port->inline_sources &&
+	    port->sources != sources) {
+		free (port->sources);
+		free (port->gains);
+	}
+
+	port->sources = sources;
+	port->gains = gains;
+	port->nsources = n;
+}
+
+void
+jack_port_free (jack_port_t *port)
+{
+	if (port->sources != port->inline_sources) {
+		free (port->sources);
+		free (port->gains);
+	}
+	free (port);
+}
+
 /* LOCAL (in-client) connection querying only */
 
 int
@@ -329,7 +676,7 @@ jack_port_connected_to (const jack_port_t *port, const char *portname)
 	for (node = port->connections; node; node = jack_slist_next (node)) {
 		jack_port_t *other_port = (jack_port_t*)node->data;
 
-		if (jack_port_name_equals (other_port->shared, portname)) {
+		if (jack_port_name_equals (other_port->names, portname)) {
 			ret = TRUE;
 			break;
 		}
@@ -368,7 +715,7 @@ jack_port_get_connections (const jack_port_t *port)
 		for (n = 0, node = port->connections; node;
 		     node = jack_slist_next (node), ++n) {
 			jack_port_t* other = (jack_port_t*)node->data;
-			ret[n] = other->shared->name;
+			ret[n] = other->names->name;
 		}
 		ret[n] = NULL;
 	}
@@ -428,7 +775,7 @@ jack_port_get_all_connections (const jack_client_t *client,
 			return 0;
 		}
 		tmp = jack_port_by_id_int (client, port_id, &need_free);
-		ret[i] = tmp->shared->name;
+		ret[i] = tmp->names->name;
 		if (need_free) {
 			free (tmp);
 			need_free = FALSE;
@@ -440,10 +787,104 @@ jack_port_get_all_connections (const jack_client_t *client,
 	return ret;
 }
 
+/* the GetPortConnections request of jack_port_get_all_connections(),
+ * for ports with more connections than the port table lists */
+static int
+jack_port_request_connection_ids (const jack_client_t *client,
+				  const jack_port_t *port,
+				  jack_port_id_t *ids, int max)
+{
+	jack_request_t req;
+	jack_port_id_t port_id;
+	const char *name;
+	unsigned int i;
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = GetPortConnections;
+	jack_uuid_clear (&req.x.port_info.client_id);
+	req.x.port_info.port_id = port->shared->id;
+
+	jack_client_deliver_request (client, &req);
+
+	if (req.status != 0) {
+		return -1;
+	}
+
+	if (req.x.port_connections.nports == 0) {
+		return 0;
+	}
+
+	for (i = 0; i < req.x.port_connections.nports; i++) {
+
+		if (client->request_fd < 0) {
+			/* internal client: the engine gave us the names
+			 * in the port table, they tell the ports */
+			name = req.x.port_connections.ports[i];
+			port_id = ((const jack_port_shared_t*)
+				   (name - offsetof (jack_port_shared_t, name)))->id;
+		} else if (read (client->request_fd, &port_id, sizeof(port_id))
+			   != sizeof(port_id)) {
+			jack_error ("cannot read port id from server");
+			return -1;
+		}
+
+		if (i < (unsigned int)max) {
+			ids[i] = port_id;
+		}
+	}
+
+	if (client->request_fd < 0) {
+		free (req.x.port_connections.ports);
+	}
+
+	return req.x.port_connections.nports;
+}
+
+/* Fill `ids' with up to `max' of the ports `port' is connected to,
+ * and return how many there are, or -1 on error. The engine keeps the
+ * list in the port table, so this neither asks the engine nor
+ * allocates, unless the port has more than
+ * JACK_PORT_CONNECTIONS_SHARED connections.
+ */
+int
+jack_port_get_connection_ids (const jack_client_t *client,
+			      const jack_port_t *port,
+			      jack_port_id_t *ids, int max)
+{
+	jack_port_shared_t *shared;
+	uint32_t seq, n, i;
+
+	if (port == NULL || max < 0) {
+		return -1;
+	}
+
+	shared = port->shared;
+
+	do {
+		seq = shared->conn_seq;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+		if ((n = shared->n_connections) > JACK_PORT_CONNECTIONS_SHARED) {
+			return jack_port_request_connection_ids (client, port,
+								 ids, max);
+		}
+
+		for (i = 0; i < n && i < (uint32_t)max; i++) {
+			ids[i] = shared->connection_ids[i];
+		}
+
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || shared->conn_seq != seq);
+
+	return n;
+}
+
 jack_port_t *
 jack_port_by_id_int (const jack_client_t *client, jack_port_id_t id, int* free)
 {
 	JSList *node;
+	jack_port_shared_t *shared;
 
 	for (node = client->ports; node; node = jack_slist_next (node)) {
 		if (((jack_port_t*)node->data)->shared->id == id) {
@@ -452,11 +893,11 @@ jack_port_by_id_int (const jack_client_t *client, jack_port_id_t id, int* free)
 		}
 	}
 
-	if (id >= client->engine->port_max) {
+	if ((shared = jack_port_shared_by_id (client, id)) == NULL) {
 		return NULL;
 	}
 
-	if (client->engine->ports[id].in_use) {
+	if (shared->in_use) {
 		*free = TRUE;
 		return jack_port_new (client, id, client->engine);
 	}
@@ -492,7 +933,7 @@ jack_port_by_name_int (jack_client_t *client, const char *port_name, int* free)
 {
 	JSList *node;
 	for (node = client->ports; node; node = jack_slist_next (node)) {
-		if (jack_port_name_equals(((jack_port_t *) node->data)->shared, port_name)) {
+		if (jack_port_name_equals (((jack_port_t *) node->data)->names, port_name)) {
 			*free = FALSE;
 			return (jack_port_t *) node->data;
 		}
@@ -501,13 +942,23 @@ jack_port_by_name_int (jack_client_t *client, const char *port_name, int* free)
 	unsigned long i, limit;
 	jack_port_shared_t *port;
 
-	limit = client->engine->port_max;
-	port = &client->engine->ports[0];
+	limit = jack_attach_port_table (client);
+
+	if ((port = jack_port_hash_lookup (client->engine, client->port_table,
+					   port_name)) != NULL) {
+		*free = TRUE;
+		return jack_port_new (client, port->id, client->engine);
+	}
 
 	for (i = 0; i < limit; i++) {
-		if (port[i].in_use && jack_port_name_equals (&port[i], port_name)) {
+		port = jack_port_table_entry (client->port_table,
+					      client->engine, i);
+		if (port->in_use &&
+		    jack_port_name_equals (jack_port_table_names (client->port_table,
+								  client->engine, i),
+					   port_name)) {
 			*free = TRUE;
-			return jack_port_new (client, port[i].id,
+			return jack_port_new (client, port->id,
 					      client->engine);
 		}
 	}
@@ -524,7 +975,7 @@ jack_port_by_name (jack_client_t *client,  const char *port_name)
 
 	for (node = client->ports_ext; node; node = jack_slist_next (node)) {
 		port = node->data;
-		if (jack_port_name_equals (port->shared, port_name)) {
+		if (jack_port_name_equals (port->names, port_name)) {
 			/* Found port, return the cached structure. */
 			return port;
 		}
@@ -570,61 +1021,369 @@ jack_port_set_latency (jack_port_t *port, jack_nframes_t nframes)
 	}
 }
 
-void *
-jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
+static void *jack_port_get_shared_buffer (jack_port_t *port,
+					  jack_nframes_t nframes);
+
+/* the buffer of output `src' as input `port' sees it */
+static void *
+jack_port_get_source_buffer (jack_port_t *port, jack_port_t *src,
+			     jack_nframes_t nframes)
 {
-	JSList *node, *next;
+	if (jack_port_source_delayed (port, src)) {
+		return jack_port_source_buffer (port, src);
+	}
+	return jack_port_get_shared_buffer (src, nframes);
+}
+
+static void *
+jack_port_resolve_input_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+	jack_port_t *src = NULL;
+	uint32_t i, si = 0, nsources;
+
+	/* Since this can only be called from the process() callback,
+	   and since no connections can be made/broken during this
+	   phase (enforced by the jack server), there is no need to
+	   take the connection lock here
+	 */
+	if (port->nsources == 0) {
+
+		if (port->client_segment_base == NULL || *port->client_segment_base == MAP_FAILED) {
+			return NULL;
+		}
+
+		/* no connections; return a zero-filled buffer */
+		return jack_port_zero_buffer (port);
+	}
+
+	/* Silent and muted sources do not take part in the mix; with
+	   one left at unity gain it is not needed at all: use zero-copy
+	   mode, and pass the buffer of the connected (output) port.
+	 */
+	for (i = 0, nsources = 0; i < port->nsources; i++) {
+		if (!jack_port_source_silent (port, port->sources[i]) &&
+		    !jack_port_source_muted (port, i)) {
+			src = port->sources[i];
+			si = i;
+			nsources++;
+		}
+	}
+
+	if (nsources == 0) {
+		return jack_port_zero_buffer (port);
+	}
+	if (nsources == 1 && jack_port_source_unity (port, si)) {
+		return jack_port_get_source_buffer (port, src, nframes);
+	}
+
+	/* Multiple connections, or one with a gain.  Use a local
+	   buffer and mix the incoming data into that buffer.  We have
+	   already established the existence of a mixdown function
+	   during the connection process.
+	 */
+	if (port->mix_buffer == NULL) {
+		jack_error ( "internal jack error: mix_buffer not allocated" );
+		return NULL;
+	}
+	JACK_PROBE3 (mixdown_start, port->names->name, port->nsources, nframes);
+	port->fptr.mixdown (port, nframes);
+	JACK_PROBE1 (mixdown_end, port->names->name);
+	return (void*)port->mix_buffer;
+}
 
+/* The buffer the graph sees for `port' this cycle. */
+static void *
+jack_port_get_shared_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
 	/* Output port.  The buffer was assigned by the engine
 	   when the port was registered.
 	 */
 	if (port->shared->flags & JackPortIsOutput) {
 		if (port->tied) {
-			return jack_port_get_buffer (port->tied, nframes);
+			return jack_port_get_shared_buffer (port->tied, nframes);
 		}
 
 		if (port->client_segment_base == NULL || *port->client_segment_base == MAP_FAILED) {
 			return NULL;
 		}
 
-		return jack_output_port_buffer (port);
+		return jack_output_port_graph_buffer (port);
 	}
 
-	/* Input port.  Since this can only be called from the
-	   process() callback, and since no connections can be
-	   made/broken during this phase (enforced by the jack
-	   server), there is no need to take the connection lock here
+	/* Input port.  Connections only change between cycles, so
+	   what it resolves to (and the mix, if it needs one) is the
+	   same for every call in a cycle: work it out on the first.
 	 */
-	if ((node = port->connections) == NULL) {
+	if (port->buffer && port->buffer_cycle == *port->cycle &&
+	    port->buffer_nframes == nframes) {
+		return port->buffer;
+	}
 
-		if (port->client_segment_base == NULL || *port->client_segment_base == MAP_FAILED) {
-			return NULL;
+	port->buffer = jack_port_resolve_input_buffer (port, nframes);
+	port->buffer_cycle = *port->cycle;
+	port->buffer_nframes = nframes;
+
+	return port->buffer;
+}
+
+void *
+jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+	/* an output counts as written once its owner has its buffer,
+	   whichever of the ones below that is */
+	if (port->shared->flags & JackPortIsOutput) {
+		port->written = TRUE;
+		port->written_offset = port->shared->offset;
+	}
+
+	/* the ports of a client that processes one period behind
+	   hand its process() the copies jack_port_async_exchange()
+	   made, not the graph's buffers */
+	if (port->async_buffer) {
+		return port->async_buffer;
+	}
+
+	/* and those of a decimated client the engine's ring of the
+	   last few periods */
+	if (port->ring_base && *port->ring_base) {
+		return *port->ring_base + port->shared->ring_offset;
+	}
+
+	return jack_port_get_shared_buffer (port, nframes);
+}
+
+/* Give `port' (one of the client's own) a private buffer to work on
+ * one period behind the graph, or take it away. Called outside the
+ * process cycle: on a change of mode, for new ports, and when the
+ * buffer size changes.
+ */
+int
+jack_port_set_async (jack_client_t *client, jack_port_t *port, int onoff)
+{
+	size_t size = jack_port_type_buffer_size (port->type_info,
+						  client->engine->buffer_size);
+
+	if (port->async_buffer) {
+		jack_pool_release (port->async_buffer);
+		port->async_buffer = NULL;
+	}
+	port->async_silent = FALSE;
+
+	if (!onoff) {
+		return 0;
+	}
+
+	if ((port->async_buffer = jack_pool_alloc (size)) == NULL) {
+		jack_error ("cannot allocate the private buffer of port %s",
+			    port->names->name);
+		return -1;
+	}
+	port->fptr.buffer_init (port->async_buffer, size,
+				client->engine->buffer_size);
+
+	return 0;
+}
+
+/* Swap buffers with the graph at the start of a cycle: an output gets
+ * what process() made last cycle, and the private copy of an input
+ * gets what the port carries now, for process() to work on while the
+ * graph goes on.
+ */
+void
+jack_port_async_exchange (jack_port_t *port, jack_nframes_t nframes)
+{
+	size_t size = jack_port_type_buffer_size (port->type_info, nframes);
+	void *buffer;
+
+	if ((buffer = jack_port_get_shared_buffer (port, nframes)) == NULL) {
+		return;
+	}
+
+	if (port->shared->flags & JackPortIsOutput) {
+		if (port->async_silent) {
+			port->shared->silent_cycle = *port->cycle;
+		} else {
+			memcpy (buffer, port->async_buffer, size);
+			port->written = TRUE;
+			port->written_offset = port->shared->offset;
 		}
+		port->async_silent = FALSE;
+	} else {
+		port->async_silent = (buffer == jack_port_zero_buffer (port));
+		memcpy (port->async_buffer, buffer, size);
+	}
+}
 
-		/* no connections; return a zero-filled buffer */
-		return (void*)(*(port->client_segment_base) + port->type_info->zero_buffer_offset);
+/* Say that what `port' (an output of this client) holds this cycle is
+ * silence, whatever is actually in the buffer. Readers get the zero
+ * buffer instead of it and mixdowns leave it out, until the next cycle
+ * starts. It is meant to be called from process(), after the port's
+ * buffer has been written or instead of writing it.
+ */
+void
+jack_port_set_silent (jack_port_t *port)
+{
+	if (!(port->shared->flags & JackPortIsOutput)) {
+		return;
 	}
 
-	if ((next = jack_slist_next (node)) == NULL) {
+	/* one period behind, the mark goes out with the buffer */
+	if (port->async_buffer) {
+		port->async_silent = TRUE;
+		return;
+	}
 
-		/* one connection: use zero-copy mode - just pass
-		   the buffer of the connected (output) port.
-		 */
-		return jack_port_get_buffer (((jack_port_t*)node->data),
-					     nframes);
+	port->shared->silent_cycle = *port->cycle;
+}
+
+/* True if `port' holds nothing but silence this cycle: an output that
+ * has been marked with jack_port_set_silent(), or an input whose
+ * connections all are (or that has none). For inputs this resolves
+ * the buffer as jack_port_get_buffer() would, so asking first and
+ * getting the buffer after costs no more than getting it.
+ */
+int
+jack_port_buffer_is_silent (jack_port_t *port, jack_nframes_t nframes)
+{
+	void *buffer;
+
+	if (port->async_buffer) {
+		return port->async_silent;
 	}
 
-	/* Multiple connections.  Use a local buffer and mix the
-	   incoming data into that buffer.  We have already
-	   established the existence of a mixdown function during the
-	   connection process.
-	 */
-	if (port->mix_buffer == NULL) {
-		jack_error ( "internal jack error: mix_buffer not allocated" );
-		return NULL;
+	if (port->shared->flags & JackPortIsOutput) {
+		if (port->tied) {
+			return jack_port_buffer_is_silent (port->tied, nframes);
+		}
+		return jack_port_is_silent (port);
 	}
-	port->fptr.mixdown (port, nframes);
-	return (void*)port->mix_buffer;
+
+	if ((buffer = jack_port_get_buffer (port, nframes)) == NULL) {
+		return FALSE;
+	}
+
+	return buffer == jack_port_zero_buffer (port);
+}
+
+/* Make output `port' carry this cycle whatever `input', an input of
+ * the same client and type, reads: its readers are handed the buffer
+ * behind `input' (the output it is connected to, usually) instead of
+ * a copy of it. This is for effects that are bypassed. Like
+ * jack_port_set_silent(), it is called from process() and lasts until
+ * the next cycle starts. The output's own buffer is left alone, and
+ * jack_port_get_buffer() on it returns the input's buffer from then
+ * on, which must not be written.
+ *
+ * Where no other client can see what `input' reads -- when it mixes
+ * several sources, or for a client running decimated or one period
+ * behind -- for outputs read by a later stage of a pipelined graph,
+ * and for a source whose buffer is pooled with --share-buffers, which
+ * need not last until this output's readers have run, the buffer is
+ * copied instead. Belongs in <jack/jack.h>.
+ */
+int
+jack_port_set_passthrough (jack_port_t *port, jack_port_t *input,
+			   jack_nframes_t nframes)
+{
+	void *buffer, *own;
+
+	if (!(port->shared->flags & JackPortIsOutput) ||
+	    !(input->shared->flags & JackPortIsInput) ||
+	    jack_uuid_compare (port->shared->client_id,
+			       input->shared->client_id) != 0 ||
+	    port->shared->ptype_id != input->shared->ptype_id || port->tied) {
+		jack_error ("cannot pass %s through %s", input->names->name,
+			    port->names->name);
+		return -1;
+	}
+
+	if (jack_port_buffer_is_silent (input, nframes)) {
+		jack_port_set_silent (port);
+		return 0;
+	}
+
+	if ((buffer = jack_port_get_buffer (input, nframes)) == NULL) {
+		return -1;
+	}
+
+	if (port->async_buffer || input->async_buffer ||
+	    (input->ring_base && *input->ring_base) ||
+	    buffer == input->mix_buffer || port->shared->delayed ||
+	    (input->nsources == 1 && input->sources[0]->shared->pooled)) {
+		if ((own = jack_port_get_buffer (port, nframes)) == NULL) {
+			return -1;
+		}
+		memcpy (own, buffer,
+			jack_port_type_buffer_size (port->type_info, nframes));
+		return 0;
+	}
+
+	/* anything else lives in the segment of the port type */
+	port->shared->passthrough_offset =
+		(char*)buffer - (char*)*port->client_segment_base;
+	__atomic_store_n (&port->shared->passthrough_cycle, *port->cycle,
+			  __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* The number of channels `port' carries: 1 for mono audio, 0 for
+ * MIDI, and for a multichannel port the count it was given or took
+ * from the first port it was connected to (0 until then).
+ */
+uint32_t
+jack_port_get_channel_count (const jack_port_t *port)
+{
+	switch (port->shared->ptype_id) {
+	case JACK_AUDIO_PORT_TYPE:
+	case JACK_DOUBLE_PORT_TYPE:
+		return 1;
+	case JACK_MULTICHANNEL_PORT_TYPE:
+		return port->shared->channels;
+	default:
+		return 0;
+	}
+}
+
+/* Give a multichannel port its channel count. This can only be done
+ * while it is not connected: connections are made between ports of
+ * the same count, and a port without one takes the count of the port
+ * it is first connected to.
+ */
+int
+jack_port_set_channel_count (jack_port_t *port, uint32_t channels)
+{
+	if (port->shared->ptype_id != JACK_MULTICHANNEL_PORT_TYPE) {
+		jack_error ("port %s is not a multichannel port",
+			    port->names->name);
+		return -1;
+	}
+
+	if (channels == 0 || channels > JACK_MULTICHANNEL_MAX_CHANNELS) {
+		jack_error ("multichannel ports carry 1 to %d channels, not %u",
+			    JACK_MULTICHANNEL_MAX_CHANNELS, channels);
+		return -1;
+	}
+
+	if (port->shared->n_connections) {
+		jack_error ("cannot change the channel count of connected"
+			    " port %s", port->names->name);
+		return -1;
+	}
+
+	port->shared->channels = channels;
+	return 0;
+}
+
+/* Channel `channel' of the multichannel port buffer `buffer', as
+ * returned by jack_port_get_buffer() for `nframes'. The channels are
+ * planar, one after another, nframes samples each.
+ */
+jack_default_audio_sample_t *
+jack_multichannel_get_channel (void *buffer, jack_nframes_t nframes,
+			       uint32_t channel)
+{
+	return (jack_default_audio_sample_t*)buffer + (size_t)channel * nframes;
 }
 
 size_t
@@ -661,7 +1420,7 @@ int
 jack_port_untie (jack_port_t *port)
 {
 	if (port->tied == NULL) {
-		jack_error ("port \"%s\" is not tied", port->shared->name);
+		jack_error ("port \"%s\" is not tied", port->names->name);
 		return -1;
 	}
 	port->tied = NULL;
@@ -715,13 +1474,22 @@ jack_port_request_monitor_by_name (jack_client_t *client,
 	unsigned long i, limit;
 	jack_port_shared_t *ports;
 
-	limit = client->engine->port_max;
-	ports = &client->engine->ports[0];
+	limit = jack_attach_port_table (client);
+
+	if ((ports = jack_port_hash_lookup (client->engine, client->port_table,
+					    port_name)) != NULL) {
+		port = jack_port_new (client, ports->id, client->engine);
+		return jack_port_request_monitor (port, onoff);
+	}
 
 	for (i = 0; i < limit; i++) {
-		if (ports[i].in_use &&
-		    strcmp (ports[i].name, port_name) == 0) {
-			port = jack_port_new (client, ports[i].id,
+		ports = jack_port_table_entry (client->port_table,
+					       client->engine, i);
+		if (ports->in_use &&
+		    strcmp (jack_port_table_names (client->port_table,
+						   client->engine, i)->name,
+			    port_name) == 0) {
+			port = jack_port_new (client, ports->id,
 					      client->engine);
 			return jack_port_request_monitor (port, onoff);
 			free (port);
@@ -754,10 +1522,191 @@ jack_port_monitoring_input (jack_port_t *port)
 	return port->shared->monitor_requests > 0;
 }
 
+/* Ask the owner of `port' (any client's audio output) to meter it
+ * every cycle, or say that it need not any more. Requests are counted
+ * like monitor requests; nothing is metered while there are none.
+ * Belongs in <jack/jack.h>.
+ */
+int
+jack_port_request_meter (jack_port_t *port, int onoff)
+{
+	uint32_t n;
+
+	if (!(port->shared->flags & JackPortIsOutput) ||
+	    (port->shared->ptype_id != JACK_AUDIO_PORT_TYPE &&
+	     port->shared->ptype_id != JACK_MULTICHANNEL_PORT_TYPE)) {
+		return -1;
+	}
+
+	if (onoff) {
+		__atomic_add_fetch (&port->shared->meter_requests, 1,
+				    __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	n = __atomic_load_n (&port->shared->meter_requests, __ATOMIC_RELAXED);
+	while (n && !__atomic_compare_exchange_n (&port->shared->meter_requests,
+						  &n, n - 1, FALSE,
+						  __ATOMIC_RELAXED,
+						  __ATOMIC_RELAXED)) {
+	}
+
+	return 0;
+}
+
+/* The last levels the owner of `port' metered, as linear magnitudes:
+ * the peak (with its falloff) and the RMS. Nothing but shared memory
+ * is read, so a meter display can call this as often as it redraws
+ * without being connected to anything. Returns the cycle the levels
+ * are from, which stops moving while the owner is not running, or 0
+ * if nobody has asked for `port' to be metered. Belongs in
+ * <jack/jack.h>.
+ */
+uint32_t
+jack_port_get_meter (const jack_port_t *port, float *peak, float *rms)
+{
+	if (!port->shared->meter_requests) {
+		*peak = *rms = 0.0f;
+		return 0;
+	}
+
+	*peak = port->shared->meter_peak;
+	*rms = port->shared->meter_rms;
+
+	return port->shared->meter_cycle;
+}
+
+/* Mark the outputs of `client' whose buffers it has never got since
+ * the engine assigned them silent, as if it had called
+ * jack_port_set_silent() on them, so that their readers take the zero
+ * buffer rather than whatever the memory held from before. The engine
+ * then need not clear the output buffers when they are laid out or the
+ * buffer size changes. An output that has been written keeps its last
+ * data in the cycles its owner leaves it alone, as it always did: a
+ * decimated client runs once every few periods, and one processing a
+ * period behind may not get every buffer every time. A decimated
+ * client does not run, and so cannot mark, in the cycles between, so
+ * the buffers of its outputs are cleared once instead. A pooled
+ * buffer (--share-buffers) holds other ports' data in other parts of
+ * the cycle, so a pooled output counts as written for the cycle only.
+ * Outputs tied to an input, or passing one through, are left alone.
+ * Called at the end of every cycle the client runs.
+ */
+void
+jack_client_mark_unwritten (jack_client_t *client)
+{
+	JSList *node;
+	jack_port_t *port;
+	void *buffer;
+	jack_nframes_t nframes = client->engine->buffer_size;
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_t*)node->data;
+
+		if (!(port->shared->flags & JackPortIsOutput) ||
+		    port->tied || jack_port_passes_through (port)) {
+			continue;
+		}
+
+		if (port->written && port->written_offset == port->shared->offset) {
+			if (port->shared->pooled) {
+				port->written = FALSE;
+			}
+			continue;
+		}
+
+		if (port->ring_base && *port->ring_base &&
+		    (buffer = jack_port_get_shared_buffer (port, nframes))) {
+			port->fptr.buffer_init (buffer,
+						jack_port_type_buffer_size (port->type_info, nframes),
+						nframes);
+			port->written = TRUE;
+			port->written_offset = port->shared->offset;
+		} else {
+			port->shared->silent_cycle = *port->cycle;
+		}
+	}
+}
+
+/* Meter the outputs of `client' that have been asked for, once its
+ * buffers for the cycle are final: one vector pass over each, and
+ * nothing at all for ports nobody is looking at.
+ */
+void
+jack_client_update_meters (jack_client_t *client, jack_nframes_t nframes)
+{
+	JSList *node;
+	jack_port_t *port;
+	jack_port_shared_t *shared;
+	float *buffer;
+	float peak, sumsq, fall = 0.0f, avg = 0.0f, dt;
+	uint32_t length;
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_t*)node->data;
+		shared = port->shared;
+
+		if (!shared->meter_requests ||
+		    !(shared->flags & JackPortIsOutput)) {
+			continue;
+		}
+
+		switch (shared->ptype_id) {
+		case JACK_AUDIO_PORT_TYPE:
+			length = nframes;
+			break;
+		case JACK_MULTICHANNEL_PORT_TYPE:
+			length = nframes * shared->channels;
+			break;
+		default:
+			continue;
+		}
+
+		if (fall == 0.0f) {
+			dt = (float)nframes /
+			     client->engine->current_time.frame_rate;
+			fall = powf (10.0f, -dt);       /* 20dB/s */
+			avg = 1.0f - expf (-dt / 0.3f);
+		}
+
+		if (length == 0 ||
+		    (port->tied ? jack_port_buffer_is_silent (port->tied, nframes)
+		     : jack_port_is_silent (port)) ||
+		    (buffer = jack_port_get_shared_buffer (port, nframes)) == NULL) {
+			peak = sumsq = 0.0f;
+		} else {
+#ifdef USE_DYNSIMD
+			jack_simd.meterf (buffer, length, &peak, &sumsq);
+#else
+			gen_meterf (buffer, length, &peak, &sumsq);
+#endif
+			sumsq /= length;
+		}
+
+		if (peak < shared->meter_peak * fall) {
+			peak = shared->meter_peak * fall;
+		}
+		port->meter_ms += avg * (sumsq - port->meter_ms);
+
+		/* let them run down to zero, not into denormals */
+		if (peak < 1e-6f) {
+			peak = 0.0f;
+		}
+		if (port->meter_ms < 1e-12f) {
+			port->meter_ms = 0.0f;
+		}
+
+		shared->meter_peak = peak;
+		shared->meter_rms = sqrtf (port->meter_ms);
+		__atomic_store_n (&shared->meter_cycle, *port->cycle,
+				  __ATOMIC_RELEASE);
+	}
+}
+
 const char *
 jack_port_name (const jack_port_t *port)
 {
-	return port->shared->name;
+	return port->names->name;
 }
 
 jack_uuid_t
@@ -771,13 +1720,13 @@ jack_port_get_aliases (const jack_port_t *port, char* const aliases[2])
 {
 	int cnt = 0;
 
-	if (port->shared->alias1[0] != '\0') {
-		snprintf (aliases[0], JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE, "%s", port->shared->alias1);
+	if (port->names->alias1[0] != '\0') {
+		snprintf (aliases[0], JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE, "%s", port->names->alias1);
 		cnt++;
 	}
 
-	if (port->shared->alias2[0] != '\0') {
-		snprintf (aliases[1], JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE, "%s", port->shared->alias2);
+	if (port->names->alias2[0] != '\0') {
+		snprintf (aliases[1], JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE, "%s", port->names->alias2);
 		cnt++;
 	}
 
@@ -791,7 +1740,7 @@ jack_port_short_name (const jack_port_t *port)
 	   it there ...
 	 */
 
-	return strchr (port->shared->name, ':') + 1;
+	return strchr (port->names->name, ':') + 1;
 }
 
 int
@@ -816,7 +1765,7 @@ int
 jack_port_rename (jack_client_t* client, jack_port_t *port, const char *new_name)
 {
 	int ret;
-	char* old_name = strdup (port->shared->name);
+	char* old_name = strdup (port->names->name);
 
 	if ((ret = jack_port_set_name (port, new_name)) == 0) {
 
@@ -842,13 +1791,13 @@ jack_port_set_name (jack_port_t *port, const char *new_name)
 	char *colon;
 	int len;
 
-	if (strcmp (new_name, port->shared->name) == 0) {
+	if (strcmp (new_name, port->names->name) == 0) {
 		return 0;
 	}
 
-	colon = strchr (port->shared->name, ':');
-	len = sizeof(port->shared->name) -
-	      ((int)(colon - port->shared->name)) - 2;
+	colon = strchr (port->names->name, ':');
+	len = sizeof(port->names->name) -
+	      ((int)(colon - port->names->name)) - 2;
 	snprintf (colon + 1, len, "%s", new_name);
 
 
@@ -858,10 +1807,10 @@ jack_port_set_name (jack_port_t *port, const char *new_name)
 int
 jack_port_set_alias (jack_port_t *port, const char *alias)
 {
-	if (port->shared->alias1[0] == '\0') {
-		snprintf (port->shared->alias1, sizeof(port->shared->alias1), "%s", alias);
-	} else if (port->shared->alias2[0] == '\0') {
-		snprintf (port->shared->alias2, sizeof(port->shared->alias2), "%s", alias);
+	if (port->names->alias1[0] == '\0') {
+		snprintf (port->names->alias1, sizeof(port->names->alias1), "%s", alias);
+	} else if (port->names->alias2[0] == '\0') {
+		snprintf (port->names->alias2, sizeof(port->names->alias2), "%s", alias);
 	} else {
 		return -1;
 	}
@@ -872,10 +1821,10 @@ jack_port_set_alias (jack_port_t *port, const char *alias)
 int
 jack_port_unset_alias (jack_port_t *port, const char *alias)
 {
-	if (strcmp (port->shared->alias1, alias) == 0) {
-		port->shared->alias1[0] = '\0';
-	} else if (strcmp (port->shared->alias2, alias) == 0) {
-		port->shared->alias2[0] = '\0';
+	if (strcmp (port->names->alias1, alias) == 0) {
+		port->names->alias1[0] = '\0';
+	} else if (strcmp (port->names->alias2, alias) == 0) {
+		port->names->alias2[0] = '\0';
 	} else {
 		return -1;
 	}
@@ -930,22 +1879,64 @@ static inline float f_max (float x, float a)
 	return x;
 }
 
+/* One pass of jack_port_mix_sources() over `channels' channels of
+   `nframes' samples each. Without a gain that isn't 1 this is a plain
+   sum over the whole buffer; with one, every channel ramps the gains
+   from what they were to what they are. */
 static void
-jack_audio_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
+jack_port_mix_pass (float *buffer, const float **src, const float *gain,
+		    const float *step, int nsrc, int gained,
+		    jack_nframes_t nframes, uint32_t channels)
 {
-	JSList *node;
-	jack_port_t *input;
+	const float *csrc[JACK_MIX_SOURCES];
+	uint32_t c;
+	int s;
+#ifdef USE_DYNSIMD
+	const jack_simd_fixed_t *fixed;
+#endif /* USE_DYNSIMD */
 
-#ifndef ARCH_X86
-	jack_nframes_t n;
-	jack_default_audio_sample_t *dst, *src;
-#endif
-	jack_default_audio_sample_t *buffer;
+	if (!gained) {
+#ifndef USE_DYNSIMD
+		gen_mixnf (buffer, src, nsrc, nframes * channels);
+#else   /* USE_DYNSIMD */
+		fixed = __atomic_load_n (&jack_simd.fixed, __ATOMIC_ACQUIRE);
+		if (fixed && fixed->length == (int)(nframes * channels)) {
+			fixed->mixnf (buffer, src, nsrc, fixed->length);
+		} else {
+			jack_simd.mixnf (buffer, src, nsrc, nframes * channels);
+		}
+#endif /* USE_DYNSIMD */
+		return;
+	}
 
-	/* by the time we've called this, we've already established
-	   the existence of more than one connection to this input
-	   port and allocated a mix_buffer.
-	 */
+	for (c = 0; c < channels; c++) {
+		for (s = 0; s < nsrc; s++)
+			csrc[s] = src[s] + c * nframes;
+#ifndef USE_DYNSIMD
+		gen_mixgainf (buffer + c * nframes, csrc, gain, step, nsrc,
+			      nframes);
+#else           /* USE_DYNSIMD */
+		jack_simd.mixgainf (buffer + c * nframes, csrc, gain, step,
+				    nsrc, nframes);
+#endif /* USE_DYNSIMD */
+	}
+}
+
+/* Mix `channels' channels of `nframes' samples of every connection
+   that is neither silent nor muted into the mix buffer of `port',
+   each at its gain. */
+static void
+jack_port_mix_sources (jack_port_t *port, jack_nframes_t nframes,
+		       uint32_t channels)
+{
+	const jack_default_audio_sample_t *src[JACK_MIX_SOURCES];
+	float gain[JACK_MIX_SOURCES];
+	float step[JACK_MIX_SOURCES];
+	jack_default_audio_sample_t *buffer;
+	float from, to;
+	uint32_t i;
+	int nsrc = 0;
+	int gained = FALSE;
 
 	/* no need to take connection lock, since this is called
 	   from the process() callback, and the jack server
@@ -953,32 +1944,135 @@ jack_audio_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
 	   during this time.
 	 */
 
-	node = port->connections;
-	input = (jack_port_t*)node->data;
 	buffer = port->mix_buffer;
 
-#ifndef USE_DYNSIMD
-	memcpy (buffer, jack_output_port_buffer (input),
-		sizeof(jack_default_audio_sample_t) * nframes);
-#else   /* USE_DYNSIMD */
-	opt_copy (buffer, jack_output_port_buffer (input), nframes);
-#endif /* USE_DYNSIMD */
+	/* mix up to JACK_MIX_SOURCES inputs per pass over the mix
+	   buffer, carrying the partial sum into the next pass.
+	 */
 
-	for (node = jack_slist_next (node); node;
-	     node = jack_slist_next (node)) {
+	for (i = 0; i < port->nsources; i++) {
+		from = port->gains[i];
+		to = jack_port_connection_gain (port, port->sources[i], i);
+		port->gains[i] = to;
 
-		input = (jack_port_t*)node->data;
+		if (jack_port_source_silent (port, port->sources[i]) ||
+		    (from == 0.0f && to == 0.0f)) {
+			continue;
+		}
+		if (nsrc == JACK_MIX_SOURCES) {
+			jack_port_mix_pass (buffer, src, gain, step, nsrc,
+					    gained, nframes, channels);
+			src[0] = buffer;
+			gain[0] = 1.0f;
+			step[0] = 0.0f;
+			nsrc = 1;
+			gained = FALSE;
+		}
+		if (from != 1.0f || to != 1.0f) {
+			gained = TRUE;
+		}
+		src[nsrc] = jack_port_source_buffer (port, port->sources[i]);
+		gain[nsrc] = from;
+		step[nsrc] = (to - from) / nframes;
+		nsrc++;
+	}
 
-#ifndef USE_DYNSIMD
-		n = nframes;
-		dst = buffer;
-		src = jack_output_port_buffer (input);
+	if (nsrc == 0) {
+		memset (buffer, 0, nframes * channels *
+			sizeof(jack_default_audio_sample_t));
+		return;
+	}
 
-		while (n--)
-			*dst++ += *src++;
+	jack_port_mix_pass (buffer, src, gain, step, nsrc, gained,
+			    nframes, channels);
+}
 
+static void
+jack_audio_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
+{
+	/* by the time we've called this, we've already established
+	   the existence of a connection to this input port that
+	   needs mixing, and allocated a mix_buffer.
+	 */
+	jack_port_mix_sources (port, nframes, 1);
+}
+
+static void
+jack_double_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
+{
+	const double *src[JACK_MIX_SOURCES];
+	double *buffer = (double*)port->mix_buffer;
+	const double *in;
+	double g, step;
+	float from, to;
+	jack_nframes_t n;
+	uint32_t i;
+	int nsrc = 0;
+
+	/* as jack_port_mix_sources(), in doubles. the sources at unity
+	   gain are summed first; the rest are added to that one by one */
+
+	for (i = 0; i < port->nsources; i++) {
+		if (jack_port_source_silent (port, port->sources[i]) ||
+		    !jack_port_source_unity (port, i)) {
+			continue;
+		}
+		if (nsrc == JACK_MIX_SOURCES) {
+#ifndef USE_DYNSIMD
+			gen_mixnd (buffer, src, nsrc, nframes);
 #else           /* USE_DYNSIMD */
-		opt_mix (buffer, jack_output_port_buffer (input), nframes);
+			jack_simd.mixnd (buffer, src, nsrc, nframes);
+#endif /* USE_DYNSIMD */
+			src[0] = buffer;
+			nsrc = 1;
+		}
+		src[nsrc++] = (const double*)
+			      jack_port_source_buffer (port, port->sources[i]);
+	}
+
+	if (nsrc == 0) {
+		memset (buffer, 0, nframes * sizeof(double));
+	} else {
+#ifndef USE_DYNSIMD
+		gen_mixnd (buffer, src, nsrc, nframes);
+#else   /* USE_DYNSIMD */
+		jack_simd.mixnd (buffer, src, nsrc, nframes);
 #endif /* USE_DYNSIMD */
 	}
+
+	for (i = 0; i < port->nsources; i++) {
+		if (jack_port_source_unity (port, i)) {
+			continue;
+		}
+		from = port->gains[i];
+		to = jack_port_connection_gain (port, port->sources[i], i);
+		port->gains[i] = to;
+
+		if (jack_port_source_silent (port, port->sources[i]) ||
+		    (from == 0.0f && to == 0.0f)) {
+			continue;
+		}
+		in = (const double*)
+		     jack_port_source_buffer (port, port->sources[i]);
+		g = from;
+		step = (double)(to - from) / nframes;
+		for (n = 0; n < nframes; n++, g += step)
+			buffer[n] += in[n] * g;
+	}
+}
+
+/* The channels of a multichannel buffer follow one another, nframes
+   samples each, and every connection carries the channel count of the
+   port (the engine sees to that at connect time). So the buffers are
+   summed as one long mono buffer, through the same SIMD mix. */
+static void
+jack_multichannel_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
+{
+	uint32_t channels = port->shared->channels;
+
+	if (channels == 0 || channels > JACK_MULTICHANNEL_MAX_CHANNELS) {
+		channels = JACK_MULTICHANNEL_MAX_CHANNELS;
+	}
+
+	jack_port_mix_sources (port, nframes, channels);
 }
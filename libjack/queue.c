@@ -0,0 +1,225 @@
+/*
+   Bounded lock-free queue of fixed-size elements, after Dmitry Vyukov's
+   MPMC queue. Unlike jack_ringbuffer_t, any number of threads may push
+   and any number may pop at the same time.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#ifdef HAVE_POSIX_MEMALIGN
+#define _XOPEN_SOURCE 600
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_MLOCK
+#include <sys/mman.h>
+#endif /* USE_MLOCK */
+
+#define JACK_QUEUE_LINE 64
+
+/* Every slot carries a sequence number next to its element. A slot at
+   position `pos' is free for the producer that claims `pos' when its
+   sequence is `pos', and holds an element for the consumer that
+   claims `pos' when its sequence is `pos + 1'. Claiming a position is
+   a compare-and-swap on head (producers) or tail (consumers); the
+   element is then copied and the sequence published with release
+   ordering, which hands the slot to the other side.
+
+   A producer that is preempted between claiming a slot and publishing
+   it holds back consumers at that slot only; pop reports the queue as
+   empty until it catches up.
+ */
+
+typedef union {
+	volatile size_t seq;
+	char pad[16];           /* keeps the element after it aligned */
+} jack_queue_slot_t;
+
+typedef struct _jack_queue {
+	char *slots;
+	size_t slot_size;
+	size_t element_size;
+	size_t size;            /* number of slots, a power of two */
+	size_t size_mask;
+	int mlocked;
+
+	/* w: producers */
+	volatile size_t head __attribute__((aligned (JACK_QUEUE_LINE)));
+
+	/* w: consumers */
+	volatile size_t tail __attribute__((aligned (JACK_QUEUE_LINE)));
+} jack_queue_t;
+
+static inline jack_queue_slot_t *
+jack_queue_slot (const jack_queue_t *q, size_t pos)
+{
+	return (jack_queue_slot_t*)(q->slots + (pos & q->size_mask) * q->slot_size);
+}
+
+static void *
+jack_queue_alloc (size_t bytes)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+	void *m;
+
+	if (posix_memalign (&m, JACK_QUEUE_LINE, bytes)) {
+		return NULL;
+	}
+	return m;
+#else
+	return malloc (bytes);
+#endif  /* HAVE_POSIX_MEMALIGN */
+}
+
+/* Create a new queue for at least `count' elements of `element_size'
+   bytes each. The number of slots is rounded up to the next power of
+   two. */
+
+jack_queue_t *
+jack_queue_create (size_t element_size, size_t count)
+{
+	jack_queue_t *q;
+	size_t i;
+
+	if (element_size == 0 || count == 0) {
+		return NULL;
+	}
+
+	if ((q = jack_queue_alloc (sizeof(jack_queue_t))) == NULL) {
+		return NULL;
+	}
+	memset (q, 0, sizeof(jack_queue_t));
+
+	for (q->size = 2; q->size < count; q->size <<= 1) ;
+
+	q->size_mask = q->size - 1;
+	q->element_size = element_size;
+
+	q->slot_size = (sizeof(jack_queue_slot_t) + element_size + 15) & ~15;
+	if ((q->slots = jack_queue_alloc (q->size * q->slot_size)) == NULL) {
+		free (q);
+		return NULL;
+	}
+
+	for (i = 0; i < q->size; i++) {
+		jack_queue_slot (q, i)->seq = i;
+	}
+
+	return q;
+}
+
+/* Free all data associated with the queue `q'. */
+
+void
+jack_queue_free (jack_queue_t *q)
+{
+#ifdef USE_MLOCK
+	if (q->mlocked) {
+		munlock (q->slots, q->size * q->slot_size);
+	}
+#endif  /* USE_MLOCK */
+	free (q->slots);
+	free (q);
+}
+
+/* Lock the slots of `q' using the system call 'mlock'. */
+
+int
+jack_queue_mlock (jack_queue_t *q)
+{
+#ifdef USE_MLOCK
+	if (mlock (q->slots, q->size * q->slot_size)) {
+		return -1;
+	}
+#endif  /* USE_MLOCK */
+	q->mlocked = 1;
+	return 0;
+}
+
+/* Copy one element from `src' into `q'. Returns 0 on success, or -1
+   if the queue is full. Safe to call from any number of threads. */
+
+int
+jack_queue_push (jack_queue_t *q, const void *src)
+{
+	jack_queue_slot_t *slot;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n (&q->head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		slot = jack_queue_slot (q, pos);
+		seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n (&q->head, &pos, pos + 1,
+							 1, __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n (&q->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy (slot + 1, src, q->element_size);
+	__atomic_store_n (&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Copy the oldest element of `q' to `dest' and remove it. Returns 0
+   on success, or -1 if the queue is empty. Safe to call from any
+   number of threads. */
+
+int
+jack_queue_pop (jack_queue_t *q, void *dest)
+{
+	jack_queue_slot_t *slot;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n (&q->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		slot = jack_queue_slot (q, pos);
+		seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n (&q->tail, &pos, pos + 1,
+							 1, __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n (&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy (dest, slot + 1, q->element_size);
+	__atomic_store_n (&slot->seq, pos + q->size, __ATOMIC_RELEASE);
+
+	return 0;
+}
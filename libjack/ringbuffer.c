@@ -20,15 +20,132 @@
    This is safe for the case of one read thread and one write thread.
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef USE_MLOCK
+#include <unistd.h>
 #include <sys/mman.h>
-#endif /* USE_MLOCK */
 #include <jack/ringbuffer.h>
 
+#define JACK_RINGBUFFER_LINE 64
+
+/* The public jack_ringbuffer_t is the first member, so the pointer
+   handed out by jack_ringbuffer_create() is also a pointer to this.
+
+   A side only ever stores its own index, with release ordering after
+   it has finished with the data, and loads the other side's index with
+   acquire ordering before it touches the data. Each side also keeps
+   its last view of the other side's index on a cache line of its own;
+   the copying reader and writer only reload the shared index when
+   that view leaves too little data or room for the transfer at hand,
+   so a stream of small transfers doesn't pull the other side's line
+   over on every call.
+ */
+
+typedef struct {
+	jack_ringbuffer_t rb;
+	int mirrored;           /* buf is mapped twice, back to back */
+
+	/* w: reader */
+	size_t write_ptr_seen __attribute__((aligned (JACK_RINGBUFFER_LINE)));
+
+	/* w: writer */
+	size_t read_ptr_seen __attribute__((aligned (JACK_RINGBUFFER_LINE)));
+} jack_ringbuffer_priv_t;
+
+static inline jack_ringbuffer_priv_t *
+jack_ringbuffer_priv (const jack_ringbuffer_t *rb)
+{
+	return (jack_ringbuffer_priv_t*)rb;
+}
+
+static inline size_t
+jack_ringbuffer_own (const volatile size_t *ptr)
+{
+	return __atomic_load_n (ptr, __ATOMIC_RELAXED);
+}
+
+static inline size_t
+jack_ringbuffer_other (const volatile size_t *ptr)
+{
+	return __atomic_load_n (ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+jack_ringbuffer_publish (volatile size_t *ptr, size_t val)
+{
+	__atomic_store_n (ptr, val, __ATOMIC_RELEASE);
+}
+
+static inline size_t
+jack_ringbuffer_readable (const jack_ringbuffer_t *rb, size_t w, size_t r)
+{
+	return (w - r) & rb->size_mask;
+}
+
+static inline size_t
+jack_ringbuffer_writable (const jack_ringbuffer_t *rb, size_t w, size_t r)
+{
+	return (r - w - 1) & rb->size_mask;
+}
+
+static jack_ringbuffer_priv_t *
+jack_ringbuffer_priv_alloc (void)
+{
+	jack_ringbuffer_priv_t *priv;
+
+#ifdef HAVE_POSIX_MEMALIGN
+	if (posix_memalign ((void**)&priv, JACK_RINGBUFFER_LINE,
+			    sizeof(jack_ringbuffer_priv_t))) {
+		return NULL;
+	}
+#else
+	if ((priv = malloc (sizeof(jack_ringbuffer_priv_t))) == NULL) {
+		return NULL;
+	}
+#endif  /* HAVE_POSIX_MEMALIGN */
+
+	memset (priv, 0, sizeof(jack_ringbuffer_priv_t));
+
+	return priv;
+}
+
+/* Reader side: the write pointer to use for taking `cnt' bytes. */
+
+static inline size_t
+jack_ringbuffer_reader_sees (jack_ringbuffer_t *rb, size_t r, size_t cnt)
+{
+	jack_ringbuffer_priv_t *priv = jack_ringbuffer_priv (rb);
+	size_t w = priv->write_ptr_seen;
+
+	if (jack_ringbuffer_readable (rb, w, r) < cnt) {
+		w = jack_ringbuffer_other (&rb->write_ptr);
+		priv->write_ptr_seen = w;
+	}
+
+	return w;
+}
+
+/* Writer side: the read pointer to use for putting `cnt' bytes. */
+
+static inline size_t
+jack_ringbuffer_writer_sees (jack_ringbuffer_t *rb, size_t w, size_t cnt)
+{
+	jack_ringbuffer_priv_t *priv = jack_ringbuffer_priv (rb);
+	size_t r = priv->read_ptr_seen;
+
+	if (jack_ringbuffer_writable (rb, w, r) < cnt) {
+		r = jack_ringbuffer_other (&rb->read_ptr);
+		priv->read_ptr_seen = r;
+	}
+
+	return r;
+}
+
 /* Create a new ringbuffer to hold at least `sz' bytes of data. The
    actual buffer size is rounded up to the next power of two.  */
 
@@ -36,11 +153,13 @@ jack_ringbuffer_t *
 jack_ringbuffer_create (size_t sz)
 {
 	int power_of_two;
+	jack_ringbuffer_priv_t *priv;
 	jack_ringbuffer_t *rb;
 
-	if ((rb = malloc (sizeof(jack_ringbuffer_t))) == NULL) {
+	if ((priv = jack_ringbuffer_priv_alloc ()) == NULL) {
 		return NULL;
 	}
+	rb = &priv->rb;
 
 	for (power_of_two = 1; 1 << power_of_two < sz; power_of_two++) ;
 
@@ -50,7 +169,7 @@ jack_ringbuffer_create (size_t sz)
 	rb->write_ptr = 0;
 	rb->read_ptr = 0;
 	if ((rb->buf = malloc (rb->size)) == NULL) {
-		free (rb);
+		free (priv);
 		return NULL;
 	}
 	rb->mlocked = 0;
@@ -58,18 +177,122 @@ jack_ringbuffer_create (size_t sz)
 	return rb;
 }
 
+#if defined(HAVE_MEMFD_CREATE) || defined(USE_POSIX_SHM)
+
+/* An unnamed file to back a mirrored ringbuffer. */
+
+static int
+jack_ringbuffer_memfd (void)
+{
+#ifdef HAVE_MEMFD_CREATE
+	return memfd_create ("jack-ringbuffer", MFD_CLOEXEC);
+#else
+	static int serial = 0;
+	char name[64];
+	int fd;
+
+	snprintf (name, sizeof(name), "/jack-ringbuffer-%d-%d", getpid (),
+		  __atomic_fetch_add (&serial, 1, __ATOMIC_RELAXED));
+
+	if ((fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+		shm_unlink (name);
+	}
+
+	return fd;
+#endif  /* HAVE_MEMFD_CREATE */
+}
+
+#endif  /* HAVE_MEMFD_CREATE || USE_POSIX_SHM */
+
+/* Create a ringbuffer like jack_ringbuffer_create(), but with its
+   data block mapped twice in a row, so that buf[size + i] is buf[i].
+   Every readable or writable region is then contiguous: the vectors
+   from jack_ringbuffer_get_read_vector() and
+   jack_ringbuffer_get_write_vector() never have a second segment, and
+   the caller can process or write(2) vec[0] in place. The size is
+   rounded up to a power of two of at least one page. Returns NULL if
+   the system cannot map memory this way. */
+
+jack_ringbuffer_t *
+jack_ringbuffer_create_mirrored (size_t sz)
+{
+#if defined(HAVE_MEMFD_CREATE) || defined(USE_POSIX_SHM)
+	jack_ringbuffer_priv_t *priv;
+	jack_ringbuffer_t *rb;
+	size_t size;
+	char *base;
+	int fd;
+
+	for (size = sysconf (_SC_PAGESIZE); size < sz; size <<= 1) ;
+
+	if ((fd = jack_ringbuffer_memfd ()) < 0) {
+		return NULL;
+	}
+
+	if (ftruncate (fd, size)) {
+		close (fd);
+		return NULL;
+	}
+
+	/* reserve room for both views, then map the file into each half */
+
+	base = mmap (NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+		     -1, 0);
+	if (base == MAP_FAILED) {
+		close (fd);
+		return NULL;
+	}
+
+	if (mmap (base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		  fd, 0) == MAP_FAILED ||
+	    mmap (base + size, size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap (base, 2 * size);
+		close (fd);
+		return NULL;
+	}
+
+	close (fd);
+
+	if ((priv = jack_ringbuffer_priv_alloc ()) == NULL) {
+		munmap (base, 2 * size);
+		return NULL;
+	}
+
+	rb = &priv->rb;
+	rb->buf = base;
+	rb->size = size;
+	rb->size_mask = size - 1;
+	rb->write_ptr = 0;
+	rb->read_ptr = 0;
+	rb->mlocked = 0;
+	priv->mirrored = 1;
+
+	return rb;
+#else
+	return NULL;
+#endif  /* HAVE_MEMFD_CREATE || USE_POSIX_SHM */
+}
+
 /* Free all data associated with the ringbuffer `rb'. */
 
 void
 jack_ringbuffer_free (jack_ringbuffer_t * rb)
 {
+	if (jack_ringbuffer_priv (rb)->mirrored) {
+		/* unmapping drops any lock as well */
+		munmap (rb->buf, 2 * rb->size);
+		free (jack_ringbuffer_priv (rb));
+		return;
+	}
+
 #ifdef USE_MLOCK
 	if (rb->mlocked) {
 		munlock (rb->buf, rb->size);
 	}
 #endif  /* USE_MLOCK */
 	free (rb->buf);
-	free (rb);
+	free (jack_ringbuffer_priv (rb));
 }
 
 /* Lock the data block of `rb' using the system call 'mlock'.  */
@@ -78,7 +301,14 @@ int
 jack_ringbuffer_mlock (jack_ringbuffer_t * rb)
 {
 #ifdef USE_MLOCK
-	if (mlock (rb->buf, rb->size)) {
+	size_t len = rb->size;
+
+	/* lock both views, so the second one is faulted in too */
+	if (jack_ringbuffer_priv (rb)->mirrored) {
+		len *= 2;
+	}
+
+	if (mlock (rb->buf, len)) {
 		return -1;
 	}
 #endif  /* USE_MLOCK */
@@ -92,27 +322,28 @@ jack_ringbuffer_mlock (jack_ringbuffer_t * rb)
 void
 jack_ringbuffer_reset (jack_ringbuffer_t * rb)
 {
+	jack_ringbuffer_priv_t *priv = jack_ringbuffer_priv (rb);
+
 	rb->read_ptr = 0;
 	rb->write_ptr = 0;
+	priv->write_ptr_seen = 0;
+	priv->read_ptr_seen = 0;
 }
 
 /* Return the number of bytes available for reading.  This is the
    number of bytes in front of the read pointer and behind the write
-   pointer.  */
+   pointer.  Either side may ask, so this always looks at both
+   pointers and leaves the cached views alone. */
 
 size_t
 jack_ringbuffer_read_space (const jack_ringbuffer_t * rb)
 {
 	size_t w, r;
 
-	w = rb->write_ptr;
-	r = rb->read_ptr;
+	w = jack_ringbuffer_other (&rb->write_ptr);
+	r = jack_ringbuffer_other (&rb->read_ptr);
 
-	if (w > r) {
-		return w - r;
-	} else {
-		return (w - r + rb->size) & rb->size_mask;
-	}
+	return jack_ringbuffer_readable (rb, w, r);
 }
 
 /* Return the number of bytes available for writing.  This is the
@@ -124,15 +355,26 @@ jack_ringbuffer_write_space (const jack_ringbuffer_t * rb)
 {
 	size_t w, r;
 
-	w = rb->write_ptr;
-	r = rb->read_ptr;
+	w = jack_ringbuffer_other (&rb->write_ptr);
+	r = jack_ringbuffer_other (&rb->read_ptr);
 
-	if (w > r) {
-		return ((r - w + rb->size) & rb->size_mask) - 1;
-	} else if (w < r) {
-		return (r - w) - 1;
+	return jack_ringbuffer_writable (rb, w, r);
+}
+
+/* Copy `cnt' bytes starting at offset `r' of `rb' to `dest', wrapping
+   around the end of the buffer unless the mirror does it for us. */
+
+static inline void
+jack_ringbuffer_copy_out (const jack_ringbuffer_t *rb, char *dest,
+			  size_t r, size_t cnt)
+{
+	size_t n1 = rb->size - r;
+
+	if (n1 >= cnt || jack_ringbuffer_priv (rb)->mirrored) {
+		memcpy (dest, &(rb->buf[r]), cnt);
 	} else {
-		return rb->size - 1;
+		memcpy (dest, &(rb->buf[r]), n1);
+		memcpy (dest + n1, rb->buf, cnt - n1);
 	}
 }
 
@@ -143,33 +385,20 @@ size_t
 jack_ringbuffer_read (jack_ringbuffer_t * rb, char *dest, size_t cnt)
 {
 	size_t free_cnt;
-	size_t cnt2;
 	size_t to_read;
-	size_t n1, n2;
+	size_t w, r;
+
+	r = jack_ringbuffer_own (&rb->read_ptr);
+	w = jack_ringbuffer_reader_sees (rb, r, cnt);
 
-	if ((free_cnt = jack_ringbuffer_read_space (rb)) == 0) {
+	if ((free_cnt = jack_ringbuffer_readable (rb, w, r)) == 0) {
 		return 0;
 	}
 
 	to_read = cnt > free_cnt ? free_cnt : cnt;
 
-	cnt2 = rb->read_ptr + to_read;
-
-	if (cnt2 > rb->size) {
-		n1 = rb->size - rb->read_ptr;
-		n2 = cnt2 & rb->size_mask;
-	} else {
-		n1 = to_read;
-		n2 = 0;
-	}
-
-	memcpy (dest, &(rb->buf[rb->read_ptr]), n1);
-	rb->read_ptr = (rb->read_ptr + n1) & rb->size_mask;
-
-	if (n2) {
-		memcpy (dest + n1, &(rb->buf[rb->read_ptr]), n2);
-		rb->read_ptr = (rb->read_ptr + n2) & rb->size_mask;
-	}
+	jack_ringbuffer_copy_out (rb, dest, r, to_read);
+	jack_ringbuffer_publish (&rb->read_ptr, (r + to_read) & rb->size_mask);
 
 	return to_read;
 }
@@ -182,35 +411,19 @@ size_t
 jack_ringbuffer_peek (jack_ringbuffer_t * rb, char *dest, size_t cnt)
 {
 	size_t free_cnt;
-	size_t cnt2;
 	size_t to_read;
-	size_t n1, n2;
-	size_t tmp_read_ptr;
+	size_t w, r;
 
-	tmp_read_ptr = rb->read_ptr;
+	r = jack_ringbuffer_own (&rb->read_ptr);
+	w = jack_ringbuffer_reader_sees (rb, r, cnt);
 
-	if ((free_cnt = jack_ringbuffer_read_space (rb)) == 0) {
+	if ((free_cnt = jack_ringbuffer_readable (rb, w, r)) == 0) {
 		return 0;
 	}
 
 	to_read = cnt > free_cnt ? free_cnt : cnt;
 
-	cnt2 = tmp_read_ptr + to_read;
-
-	if (cnt2 > rb->size) {
-		n1 = rb->size - tmp_read_ptr;
-		n2 = cnt2 & rb->size_mask;
-	} else {
-		n1 = to_read;
-		n2 = 0;
-	}
-
-	memcpy (dest, &(rb->buf[tmp_read_ptr]), n1);
-	tmp_read_ptr = (tmp_read_ptr + n1) & rb->size_mask;
-
-	if (n2) {
-		memcpy (dest + n1, &(rb->buf[tmp_read_ptr]), n2);
-	}
+	jack_ringbuffer_copy_out (rb, dest, r, to_read);
 
 	return to_read;
 }
@@ -223,33 +436,29 @@ size_t
 jack_ringbuffer_write (jack_ringbuffer_t * rb, const char *src, size_t cnt)
 {
 	size_t free_cnt;
-	size_t cnt2;
 	size_t to_write;
-	size_t n1, n2;
+	size_t n1;
+	size_t w, r;
 
-	if ((free_cnt = jack_ringbuffer_write_space (rb)) == 0) {
+	w = jack_ringbuffer_own (&rb->write_ptr);
+	r = jack_ringbuffer_writer_sees (rb, w, cnt);
+
+	if ((free_cnt = jack_ringbuffer_writable (rb, w, r)) == 0) {
 		return 0;
 	}
 
 	to_write = cnt > free_cnt ? free_cnt : cnt;
 
-	cnt2 = rb->write_ptr + to_write;
+	n1 = rb->size - w;
 
-	if (cnt2 > rb->size) {
-		n1 = rb->size - rb->write_ptr;
-		n2 = cnt2 & rb->size_mask;
+	if (n1 >= to_write || jack_ringbuffer_priv (rb)->mirrored) {
+		memcpy (&(rb->buf[w]), src, to_write);
 	} else {
-		n1 = to_write;
-		n2 = 0;
+		memcpy (&(rb->buf[w]), src, n1);
+		memcpy (rb->buf, src + n1, to_write - n1);
 	}
 
-	memcpy (&(rb->buf[rb->write_ptr]), src, n1);
-	rb->write_ptr = (rb->write_ptr + n1) & rb->size_mask;
-
-	if (n2) {
-		memcpy (&(rb->buf[rb->write_ptr]), src + n1, n2);
-		rb->write_ptr = (rb->write_ptr + n2) & rb->size_mask;
-	}
+	jack_ringbuffer_publish (&rb->write_ptr, (w + to_write) & rb->size_mask);
 
 	return to_write;
 }
@@ -259,9 +468,9 @@ jack_ringbuffer_write (jack_ringbuffer_t * rb, const char *src, size_t cnt)
 void
 jack_ringbuffer_read_advance (jack_ringbuffer_t * rb, size_t cnt)
 {
-	size_t tmp = (rb->read_ptr + cnt) & rb->size_mask;
+	size_t tmp = (jack_ringbuffer_own (&rb->read_ptr) + cnt) & rb->size_mask;
 
-	rb->read_ptr = tmp;
+	jack_ringbuffer_publish (&rb->read_ptr, tmp);
 }
 
 /* Advance the write pointer `cnt' places. */
@@ -269,36 +478,36 @@ jack_ringbuffer_read_advance (jack_ringbuffer_t * rb, size_t cnt)
 void
 jack_ringbuffer_write_advance (jack_ringbuffer_t * rb, size_t cnt)
 {
-	size_t tmp = (rb->write_ptr + cnt) & rb->size_mask;
+	size_t tmp = (jack_ringbuffer_own (&rb->write_ptr) + cnt) & rb->size_mask;
 
-	rb->write_ptr = tmp;
+	jack_ringbuffer_publish (&rb->write_ptr, tmp);
 }
 
 /* The non-copying data reader.  `vec' is an array of two places.  Set
    the values at `vec' to hold the current readable data at `rb'.  If
-   the readable data is in one segment the second segment has zero
-   length.  */
+   the readable data is in one segment, which is always the case for a
+   mirrored ringbuffer, the second segment has zero length.  */
 
 void
 jack_ringbuffer_get_read_vector (const jack_ringbuffer_t * rb,
 				 jack_ringbuffer_data_t * vec)
 {
+	jack_ringbuffer_priv_t *priv = jack_ringbuffer_priv (rb);
 	size_t free_cnt;
 	size_t cnt2;
 	size_t w, r;
 
-	w = rb->write_ptr;
-	r = rb->read_ptr;
+	/* the caller wants everything there is, so look at the writer */
 
-	if (w > r) {
-		free_cnt = w - r;
-	} else {
-		free_cnt = (w - r + rb->size) & rb->size_mask;
-	}
+	r = jack_ringbuffer_own (&rb->read_ptr);
+	w = jack_ringbuffer_other (&rb->write_ptr);
+	priv->write_ptr_seen = w;
+
+	free_cnt = jack_ringbuffer_readable (rb, w, r);
 
 	cnt2 = r + free_cnt;
 
-	if (cnt2 > rb->size) {
+	if (cnt2 > rb->size && !priv->mirrored) {
 
 		/* Two part vector: the rest of the buffer after the current write
 		   ptr, plus some from the start of the buffer. */
@@ -320,31 +529,27 @@ jack_ringbuffer_get_read_vector (const jack_ringbuffer_t * rb,
 
 /* The non-copying data writer.  `vec' is an array of two places.  Set
    the values at `vec' to hold the current writeable data at `rb'.  If
-   the writeable data is in one segment the second segment has zero
-   length.  */
+   the writeable data is in one segment, which is always the case for a
+   mirrored ringbuffer, the second segment has zero length.  */
 
 void
 jack_ringbuffer_get_write_vector (const jack_ringbuffer_t * rb,
 				  jack_ringbuffer_data_t * vec)
 {
+	jack_ringbuffer_priv_t *priv = jack_ringbuffer_priv (rb);
 	size_t free_cnt;
 	size_t cnt2;
 	size_t w, r;
 
-	w = rb->write_ptr;
-	r = rb->read_ptr;
+	w = jack_ringbuffer_own (&rb->write_ptr);
+	r = jack_ringbuffer_other (&rb->read_ptr);
+	priv->read_ptr_seen = r;
 
-	if (w > r) {
-		free_cnt = ((r - w + rb->size) & rb->size_mask) - 1;
-	} else if (w < r) {
-		free_cnt = (r - w) - 1;
-	} else {
-		free_cnt = rb->size - 1;
-	}
+	free_cnt = jack_ringbuffer_writable (rb, w, r);
 
 	cnt2 = w + free_cnt;
 
-	if (cnt2 > rb->size) {
+	if (cnt2 > rb->size && !priv->mirrored) {
 
 		/* Two part vector: the rest of the buffer after the current write
 		   ptr, plus some from the start of the buffer. */
@@ -7,7 +7,8 @@
  *	- System V implementation
  *
  * The implementation used is determined by whether USE_POSIX_SHM was
- * set in the ./configure step.
+ * set in the ./configure step. On Linux, USE_MEMFD_SHM replaces the
+ * POSIX segments (but not the registry) with memfds.
  */
 
 /*
@@ -29,6 +30,7 @@
 
  */
 
+#define _GNU_SOURCE                     /* memfd_create(), F_ADD_SEALS */
 #include <config.h>
 
 #include <unistd.h>
@@ -46,12 +48,19 @@
 #include <sys/shm.h>
 #include <sys/sem.h>
 #include <sysdeps/ipc.h>
+#ifdef USE_MEMFD_SHM
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 #include "shm.h"
 #include "internal.h"
 #include "version.h"
 
-#ifdef USE_POSIX_SHM
+#if defined(USE_MEMFD_SHM)
+static jack_shmtype_t jack_shmtype = shm_MEMFD;
+#elif defined(USE_POSIX_SHM)
 static jack_shmtype_t jack_shmtype = shm_POSIX;
 #else
 static jack_shmtype_t jack_shmtype = shm_SYSV;
@@ -61,6 +70,10 @@ static jack_shmtype_t jack_shmtype = shm_SYSV;
 static int      jack_access_registry(jack_shm_info_t *ri);
 static int      jack_create_registry(jack_shm_info_t *ri);
 static void     jack_remove_shm(jack_shm_id_t *id);
+#ifdef USE_MEMFD_SHM
+static void     jack_shm_close_fd(jack_shm_registry_index_t index);
+static char     jack_shm_broker_path[PATH_MAX + 1] = "";
+#endif
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 * common interface-independent section
@@ -235,6 +248,13 @@ jack_set_server_prefix (const char *server_name)
 {
 	snprintf (jack_shm_server_prefix, sizeof(jack_shm_server_prefix),
 		  "/jack-%d:%s:", getuid (), server_name);
+#ifdef USE_MEMFD_SHM
+	{
+		char server_dir[PATH_MAX + 1] = "";
+		snprintf (jack_shm_broker_path, sizeof(jack_shm_broker_path),
+			  "%s/jack_shm", jack_server_dir (server_name, server_dir));
+	}
+#endif
 }
 
 /* gain server addressability to shared memory registration segment
@@ -330,37 +350,118 @@ jack_destroy_shm (jack_shm_info_t* si)
 
 	}
 	jack_remove_shm (&jack_shm_registry[si->index].id);
+#ifdef USE_MEMFD_SHM
+	jack_shm_close_fd (si->index);
+#endif
 	jack_release_shm_info (si->index);
 }
 
+/* touch every page of an attached segment, so that nobody takes
+   the page faults later, in a realtime thread. Reading a page only
+   maps it for reading, and the first write to it faults again; where
+   the kernel can populate a mapping for writing, that is done instead.
+ */
+void
+jack_prefault_shm (jack_shm_info_t* si)
+{
+	if (si->index == JACK_SHM_NULL_INDEX) {
+		return;
+	}
+
+	jack_prefault_shm_range (si, 0, jack_shm_registry[si->index].size);
+}
+
+/* the same, for the pages of `len' bytes at `offset' into the segment
+   only, for a process that works on its own part of a shared one */
+void
+jack_prefault_shm_range (jack_shm_info_t* si, jack_shmsize_t offset,
+			 jack_shmsize_t len)
+{
+	volatile char *addr = (volatile char*)si->attached_at;
+	jack_shmsize_t size, off, end;
+	long page = sysconf (_SC_PAGESIZE);
+
+	if (si->attached_at == MAP_FAILED || si->attached_at == NULL ||
+	    si->index == JACK_SHM_NULL_INDEX) {
+		return;
+	}
+
+	if (page <= 0) {
+		page = 4096;
+	}
+
+	size = jack_shm_registry[si->index].size;
+	if (offset >= size) {
+		return;
+	}
+	end = (len > size - offset) ? size : offset + len;
+	off = offset & ~((jack_shmsize_t)page - 1);
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise ((char*)si->attached_at + off, end - off,
+		     MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+
+	for (; off < end; off += page) {
+		(void)addr[off];
+	}
+}
+
+/* take an attached segment back out of mlockall(), for memory that
+   no realtime thread reads
+ */
+void
+jack_unlock_shm (jack_shm_info_t* si)
+{
+	if (si->attached_at == MAP_FAILED || si->attached_at == NULL ||
+	    si->index == JACK_SHM_NULL_INDEX) {
+		return;
+	}
+
+	munlock (si->attached_at, jack_shm_registry[si->index].size);
+}
+
+/* Registry entries are claimed and released without the registry
+ * lock: an entry belongs to whoever swaps its `allocator' from 0 to
+ * their PID, and goes back by storing 0 there once the rest of it has
+ * been cleared. Allocating and freeing segments (every client open and
+ * close, every port segment resize) then never waits for another
+ * process. The lock is still taken by the rare whole-registry
+ * operations: creating it, registering servers and jack_cleanup_shm().
+ */
 jack_shm_registry_t *
 jack_get_free_shm_info ()
 {
-	/* registry must be locked */
-	jack_shm_registry_t* si = NULL;
+	/* the registry need not be locked */
+	pid_t free_pid, my_pid = getpid ();
 	int i;
 
 	for (i = 0; i < MAX_SHM_ID; ++i) {
-		if (jack_shm_registry[i].size == 0) {
-			break;
+		free_pid = 0;
+		if (__atomic_load_n (&jack_shm_registry[i].allocator,
+				     __ATOMIC_RELAXED) == 0 &&
+		    __atomic_compare_exchange_n (&jack_shm_registry[i].allocator,
+						 &free_pid, my_pid, FALSE,
+						 __ATOMIC_ACQUIRE,
+						 __ATOMIC_RELAXED)) {
+			return &jack_shm_registry[i];
 		}
 	}
 
-	if (i < MAX_SHM_ID) {
-		si = &jack_shm_registry[i];
-	}
-
-	return si;
+	return NULL;
 }
 
 static inline void
 jack_release_shm_entry (jack_shm_registry_index_t index)
 {
-	/* the registry must be locked */
+	/* the registry need not be locked */
 	jack_shm_registry[index].size = 0;
-	jack_shm_registry[index].allocator = 0;
 	memset (&jack_shm_registry[index].id, 0,
 		sizeof(jack_shm_registry[index].id));
+	__atomic_store_n (&jack_shm_registry[index].allocator, 0,
+			  __ATOMIC_RELEASE);
 }
 
 void
@@ -368,9 +469,7 @@ jack_release_shm_info (jack_shm_registry_index_t index)
 {
 	/* must NOT have the registry locked */
 	if (jack_shm_registry[index].allocator == getpid ()) {
-		jack_shm_lock_registry ();
 		jack_release_shm_entry (index);
-		jack_shm_unlock_registry ();
 	}
 }
 
@@ -465,6 +564,49 @@ jack_unregister_server (const char *server_name /* unused */)
 	jack_shm_unlock_registry ();
 }
 
+/* the registry index of the next segment after `after' that belongs to
+ * the server the prefix names, or JACK_SHM_NULL_INDEX when there is no
+ * more or no such server is running. Lets a process that has no client
+ * open find a server segment it can tell by its contents.
+ */
+jack_shm_registry_index_t
+jack_shm_next_server_segment (jack_shm_registry_index_t after,
+			      jack_shmsize_t *size)
+{
+	jack_shm_registry_index_t found = JACK_SHM_NULL_INDEX;
+	pid_t pid = 0;
+	int i;
+
+	if (jack_shm_header == NULL) {
+		return JACK_SHM_NULL_INDEX;
+	}
+
+	jack_shm_lock_registry ();
+
+	for (i = 0; i < MAX_SERVERS; i++) {
+		if (strncmp (jack_shm_header->server[i].name,
+			     jack_shm_server_prefix,
+			     JACK_SERVER_NAME_SIZE) == 0) {
+			pid = jack_shm_header->server[i].pid;
+			break;
+		}
+	}
+
+	if (pid && kill (pid, 0) == 0) {
+		for (i = after + 1; i < MAX_SHM_ID; i++) {
+			if (jack_shm_registry[i].allocator == pid) {
+				found = i;
+				*size = jack_shm_registry[i].size;
+				break;
+			}
+		}
+	}
+
+	jack_shm_unlock_registry ();
+
+	return found;
+}
+
 /* called for server startup and termination */
 int
 jack_cleanup_shm ()
@@ -514,10 +656,11 @@ jack_cleanup_shm ()
 
 			if ((index >= 0)  && (index < MAX_SHM_ID)) {
 				jack_remove_shm (&jack_shm_registry[index].id);
-				jack_release_shm_entry (index);
+#ifdef USE_MEMFD_SHM
+				jack_shm_close_fd (index);
+#endif
 			}
-			r->size = 0;
-			r->allocator = 0;
+			jack_release_shm_entry (i);
 		}
 	}
 
@@ -669,6 +812,12 @@ jack_remove_shm (jack_shm_id_t *id)
 	   XXX it would be good to differentiate between these
 	   two conditions.
 	 */
+#ifdef USE_MEMFD_SHM
+	/* only the registry has a name */
+	if (((char*)id)[0] != '/') {
+		return;
+	}
+#endif
 	shm_unlink ((char*)id);
 }
 
@@ -681,6 +830,8 @@ jack_release_shm (jack_shm_info_t* si)
 	}
 }
 
+#ifndef USE_MEMFD_SHM
+
 /* allocate a POSIX shared memory segment */
 int
 jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
@@ -690,11 +841,9 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 	int rc = -1;
 	char name[SHM_NAME_MAX + 1];
 
-	jack_shm_lock_registry ();
-
 	if ((registry = jack_get_free_shm_info ()) == NULL) {
 		jack_error ("shm registry full");
-		goto unlock;
+		return -1;
 	}
 
 	/* On Mac OS X, the maximum length of a shared memory segment
@@ -708,13 +857,13 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 
 	if (strlen (name) >= sizeof(registry->id)) {
 		jack_error ("shm segment name too long %s", name);
-		goto unlock;
+		goto release;
 	}
 
 	if ((shm_fd = shm_open (name, O_RDWR | O_CREAT, 0666)) < 0) {
 		jack_error ("cannot create shm segment %s (%s)",
 			    name, strerror (errno));
-		goto unlock;
+		goto release;
 	}
 
 	if (ftruncate (shm_fd, size) < 0) {
@@ -722,19 +871,18 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 			    "registry 0 (%s)",
 			    strerror (errno));
 		close (shm_fd);
-		goto unlock;
+		goto release;
 	}
 
 	close (shm_fd);
 	registry->size = size;
 	strncpy (registry->id, name, sizeof(registry->id));
-	registry->allocator = getpid ();
 	si->index = registry->index;
 	si->attached_at = MAP_FAILED;   /* not attached */
-	rc = 0;                         /* success */
+	return 0;                       /* success */
 
-unlock:
-	jack_shm_unlock_registry ();
+release:
+	jack_release_shm_entry (registry->index);
 	return rc;
 }
 
@@ -765,6 +913,316 @@ jack_attach_shm (jack_shm_info_t* si)
 	return 0;
 }
 
+#else /* USE_MEMFD_SHM */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+* memfd segments (Linux)
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* The registry stays a named POSIX segment, but the segments it lists
+ * are memfds, which have no name to look up. The process that created
+ * a segment keeps its descriptor in jack_shm_fd[]; any other process
+ * gets a duplicate from that process' broker thread by connecting to
+ * the jack_shm socket in the server directory and sending the index,
+ * and it closes the duplicate as soon as it has mapped it. A segment
+ * therefore disappears as soon as the last process that maps it
+ * unmaps it or dies, crash or not: jack_cleanup_shm() only has
+ * registry entries left to tidy. The size is sealed, so a client
+ * cannot shrink a segment under the server.
+ */
+
+static int jack_shm_fd[MAX_SHM_ID];    /* descriptor + 1, 0 if none */
+static pthread_mutex_t jack_shm_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int jack_shm_broker_fd = -1;
+static pthread_t jack_shm_broker_thread;
+
+static int
+jack_shm_dup_fd (jack_shm_registry_index_t index)
+{
+	int fd = -1;
+
+	if (index < 0 || index >= MAX_SHM_ID) {
+		return -1;
+	}
+
+	pthread_mutex_lock (&jack_shm_fd_lock);
+	if (jack_shm_fd[index]) {
+		fd = fcntl (jack_shm_fd[index] - 1, F_DUPFD_CLOEXEC, 0);
+	}
+	pthread_mutex_unlock (&jack_shm_fd_lock);
+
+	return fd;
+}
+
+static void
+jack_shm_close_fd (jack_shm_registry_index_t index)
+{
+	if (index < 0 || index >= MAX_SHM_ID) {
+		return;
+	}
+
+	pthread_mutex_lock (&jack_shm_fd_lock);
+	if (jack_shm_fd[index]) {
+		close (jack_shm_fd[index] - 1);
+		jack_shm_fd[index] = 0;
+	}
+	pthread_mutex_unlock (&jack_shm_fd_lock);
+}
+
+/* the broker's answer: a status word, and the descriptor if it is 0 */
+static void
+jack_shm_send_fd (int sock, int fd)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE (sizeof(int))];
+	int32_t status = fd < 0 ? -1 : 0;
+
+	memset (&msg, 0, sizeof(msg));
+	iov.iov_base = &status;
+	iov.iov_len = sizeof(status);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fd >= 0) {
+		memset (cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+		cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN (sizeof(int));
+		memcpy (CMSG_DATA (cmsg), &fd, sizeof(int));
+	}
+
+	while (sendmsg (sock, &msg, MSG_NOSIGNAL) < 0 && errno == EINTR) {
+	}
+}
+
+static int
+jack_shm_receive_fd (jack_shm_registry_index_t index)
+{
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE (sizeof(int))];
+	int32_t status = -1;
+	int sock, fd = -1;
+	ssize_t n;
+
+	if ((sock = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf (addr.sun_path, sizeof(addr.sun_path), "%s",
+		  jack_shm_broker_path);
+
+	if (connect (sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+	    write (sock, &index, sizeof(index)) != sizeof(index)) {
+		close (sock);
+		return -1;
+	}
+
+	memset (&msg, 0, sizeof(msg));
+	iov.iov_base = &status;
+	iov.iov_len = sizeof(status);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	do {
+		n = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+
+	close (sock);
+
+	if (n != sizeof(status)) {
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy (&fd, CMSG_DATA (cmsg), sizeof(int));
+		}
+	}
+
+	if (status != 0 && fd >= 0) {
+		close (fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+static void *
+jack_shm_broker (void *arg)
+{
+	jack_shm_registry_index_t index;
+	struct timeval tv = { 1, 0 };
+	int sock, fd;
+
+	for (;; ) {
+		if ((sock = accept (jack_shm_broker_fd, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			break;  /* jack_shm_broker_stop() */
+		}
+
+		/* nobody gets to hold up everybody else's attach */
+		setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		if (read (sock, &index, sizeof(index)) == sizeof(index)) {
+			fd = jack_shm_dup_fd (index);
+			jack_shm_send_fd (sock, fd);
+			if (fd >= 0) {
+				close (fd);
+			}
+		}
+
+		close (sock);
+	}
+
+	return NULL;
+}
+
+int
+jack_shm_broker_start (void)
+{
+	struct sockaddr_un addr;
+
+	if ((jack_shm_broker_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC,
+					  0)) < 0) {
+		jack_error ("cannot create shm broker socket (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf (addr.sun_path, sizeof(addr.sun_path), "%s",
+		  jack_shm_broker_path);
+	unlink (addr.sun_path);
+
+	if (bind (jack_shm_broker_fd, (struct sockaddr*)&addr,
+		  sizeof(addr)) < 0 ||
+	    listen (jack_shm_broker_fd, 16) < 0) {
+		jack_error ("cannot listen on shm broker socket %s (%s)",
+			    addr.sun_path, strerror (errno));
+		close (jack_shm_broker_fd);
+		jack_shm_broker_fd = -1;
+		return -1;
+	}
+
+	if (pthread_create (&jack_shm_broker_thread, NULL, jack_shm_broker,
+			    NULL)) {
+		jack_error ("cannot start shm broker thread");
+		close (jack_shm_broker_fd);
+		jack_shm_broker_fd = -1;
+		unlink (addr.sun_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+jack_shm_broker_stop (void)
+{
+	if (jack_shm_broker_fd < 0) {
+		return;
+	}
+
+	/* makes accept() fail */
+	shutdown (jack_shm_broker_fd, SHUT_RDWR);
+	pthread_join (jack_shm_broker_thread, NULL);
+	close (jack_shm_broker_fd);
+	jack_shm_broker_fd = -1;
+	unlink (jack_shm_broker_path);
+}
+
+/* allocate a memfd segment */
+int
+jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
+{
+	jack_shm_registry_t* registry;
+	char name[32];
+	int fd;
+
+	if ((registry = jack_get_free_shm_info ()) == NULL) {
+		jack_error ("shm registry full");
+		return -1;
+	}
+
+	snprintf (name, sizeof(name), "jack-%d", registry->index);
+
+	if ((fd = memfd_create (name, MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+		jack_error ("cannot create shm segment %s (%s)",
+			    name, strerror (errno));
+		goto release;
+	}
+
+	if (ftruncate (fd, size) < 0 ||
+	    fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		jack_error ("cannot set size of shm segment %s (%s)",
+			    name, strerror (errno));
+		close (fd);
+		goto release;
+	}
+
+	pthread_mutex_lock (&jack_shm_fd_lock);
+	jack_shm_fd[registry->index] = fd + 1;
+	pthread_mutex_unlock (&jack_shm_fd_lock);
+
+	registry->size = size;
+	/* for the record only, nothing opens it by name */
+	snprintf (registry->id, sizeof(registry->id), "memfd:%s", name);
+	si->index = registry->index;
+	si->attached_at = MAP_FAILED;   /* not attached */
+	return 0;                       /* success */
+
+release:
+	jack_release_shm_entry (registry->index);
+	return -1;
+}
+
+int
+jack_attach_shm (jack_shm_info_t* si)
+{
+	jack_shm_registry_t *registry = &jack_shm_registry[si->index];
+	int fd;
+
+	if ((fd = jack_shm_dup_fd (si->index)) < 0 &&
+	    (fd = jack_shm_receive_fd (si->index)) < 0) {
+		jack_error ("cannot get shm segment %d from the server",
+			    si->index);
+		return -1;
+	}
+
+	/* populated, so that nobody takes the page faults later */
+	if ((si->attached_at = mmap (0, registry->size, PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, fd, 0))
+	    == MAP_FAILED) {
+		jack_error ("cannot mmap shm segment %s (%s)",
+			    registry->id, strerror (errno));
+		close (fd);
+		return -1;
+	}
+
+	close (fd);
+
+	return 0;
+}
+
+#endif /* USE_MEMFD_SHM */
+
 #else
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -885,8 +1343,6 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 	int rc = -1;
 	jack_shm_registry_t* registry;
 
-	jack_shm_lock_registry ();
-
 	if ((registry = jack_get_free_shm_info ())) {
 
 		shmflags = 0666 | IPC_CREAT | IPC_EXCL;
@@ -895,7 +1351,6 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 
 			registry->size = size;
 			registry->id = shmid;
-			registry->allocator = getpid ();
 			si->index = registry->index;
 			si->attached_at = MAP_FAILED; /* not attached */
 			rc = 0;
@@ -903,11 +1358,10 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 		} else {
 			jack_error ("cannot create shm segment (%s)",
 				    strerror (errno));
+			jack_release_shm_entry (registry->index);
 		}
 	}
 
-	jack_shm_unlock_registry ();
-
 	return rc;
 }
 
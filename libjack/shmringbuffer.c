@@ -0,0 +1,415 @@
+/*
+    Shared memory ringbuffers between clients.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+/* A client creates one under a name of its own choosing, and any other
+ * client opens it as "owner:name"; the server keeps the segment (see
+ * internal.h) until the owner closes it or goes away. It is the same
+ * single-reader, single-writer discipline as jack_ringbuffer_t, and
+ * the reads and writes take no lock and make no system call, so they
+ * are fine in a process callback. Which end writes and which reads is
+ * up to the two clients.
+ *
+ * Belongs in <jack/ringbuffer.h>:
+ *
+ *	typedef struct _jack_shm_ringbuffer jack_shm_ringbuffer_t;
+ *
+ * and the prototypes of the public functions below.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include <jack/uuid.h>
+
+#include "internal.h"
+#include "local.h"
+
+#define JACK_SHM_RINGBUFFER_LINE 64
+
+typedef struct _jack_shm_ringbuffer {
+	jack_shm_ringbuffer_shared_t *shared;
+	char *buf;
+	uint32_t size;
+	uint32_t size_mask;
+	jack_client_t *client;
+	int owner;                      /* it was created here */
+	jack_shm_info_t shm;
+	char name[JACK_PORT_NAME_SIZE];
+
+	/* as in ringbuffer.c, each side's last view of the other's
+	   pointer, so that small transfers don't reload it every time */
+
+	/* w: reader */
+	uint32_t write_ptr_seen __attribute__((aligned (JACK_SHM_RINGBUFFER_LINE)));
+
+	/* w: writer */
+	uint32_t read_ptr_seen __attribute__((aligned (JACK_SHM_RINGBUFFER_LINE)));
+} jack_shm_ringbuffer_t;
+
+static inline uint32_t
+jack_shm_ringbuffer_readable (jack_shm_ringbuffer_t *rb)
+{
+	uint32_t r = __atomic_load_n (&rb->shared->read_ptr, __ATOMIC_RELAXED);
+
+	return rb->write_ptr_seen - r;
+}
+
+static inline uint32_t
+jack_shm_ringbuffer_writable (jack_shm_ringbuffer_t *rb)
+{
+	uint32_t w = __atomic_load_n (&rb->shared->write_ptr, __ATOMIC_RELAXED);
+
+	return rb->size - (w - rb->read_ptr_seen);
+}
+
+static inline void
+jack_shm_ringbuffer_reader_sees (jack_shm_ringbuffer_t *rb)
+{
+	rb->write_ptr_seen = __atomic_load_n (&rb->shared->write_ptr,
+					      __ATOMIC_ACQUIRE);
+}
+
+static inline void
+jack_shm_ringbuffer_writer_sees (jack_shm_ringbuffer_t *rb)
+{
+	rb->read_ptr_seen = __atomic_load_n (&rb->shared->read_ptr,
+					     __ATOMIC_ACQUIRE);
+}
+
+static jack_shm_ringbuffer_t *
+jack_shm_ringbuffer_attach (jack_client_t *client, jack_request_t *req,
+			    int owner)
+{
+	jack_shm_ringbuffer_t *rb;
+
+	if ((rb = (jack_shm_ringbuffer_t*)
+		  calloc (1, sizeof(jack_shm_ringbuffer_t))) == NULL) {
+		return NULL;
+	}
+
+	rb->shm.index = req->x.ringbuffer.index;
+	rb->shm.attached_at = MAP_FAILED;
+
+	if (jack_attach_shm (&rb->shm)) {
+		jack_error ("cannot attach shared memory for ringbuffer %s",
+			    req->x.ringbuffer.name);
+		free (rb);
+		return NULL;
+	}
+
+	rb->shared = (jack_shm_ringbuffer_shared_t*)jack_shm_addr (&rb->shm);
+
+	if (__atomic_load_n (&rb->shared->magic, __ATOMIC_ACQUIRE) !=
+	    JACK_SHM_RINGBUFFER_MAGIC ||
+	    rb->shared->size != req->x.ringbuffer.size) {
+		jack_error ("ringbuffer %s is not what the server said",
+			    req->x.ringbuffer.name);
+		jack_release_shm (&rb->shm);
+		free (rb);
+		return NULL;
+	}
+
+	/* no page faults in the process callback */
+	jack_prefault_shm (&rb->shm);
+
+	rb->buf = jack_shm_ringbuffer_data (rb->shared);
+	rb->size = rb->shared->size;
+	rb->size_mask = rb->size - 1;
+	rb->client = client;
+	rb->owner = owner;
+	strcpy (rb->name, req->x.ringbuffer.name);
+
+	rb->write_ptr_seen = __atomic_load_n (&rb->shared->write_ptr,
+					      __ATOMIC_ACQUIRE);
+	rb->read_ptr_seen = __atomic_load_n (&rb->shared->read_ptr,
+					     __ATOMIC_ACQUIRE);
+
+	return rb;
+}
+
+/* a new ringbuffer of at least `sz' bytes, that other clients can open
+   as "<client name>:<name>". not realtime safe. */
+jack_shm_ringbuffer_t *
+jack_shm_ringbuffer_create (jack_client_t *client, const char *name,
+			    size_t sz)
+{
+	jack_request_t req;
+	jack_shm_ringbuffer_t *rb;
+
+	if (client == NULL || name == NULL || sz == 0 ||
+	    sz > JACK_SHM_RINGBUFFER_MAX ||
+	    strlen (name) >= sizeof(req.x.ringbuffer.name)) {
+		return NULL;
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = CreateRingbuffer;
+	strcpy (req.x.ringbuffer.name, name);
+	jack_uuid_copy (&req.x.ringbuffer.client_id, client->control->uuid);
+	req.x.ringbuffer.size = sz;
+
+	if (jack_client_deliver_request (client, &req)) {
+		jack_error ("cannot create ringbuffer %s", name);
+		return NULL;
+	}
+
+	if ((rb = jack_shm_ringbuffer_attach (client, &req, 1)) == NULL) {
+		req.type = DestroyRingbuffer;
+		jack_client_deliver_request (client, &req);
+	}
+
+	return rb;
+}
+
+/* the ringbuffer another client created, by its full name. not
+   realtime safe. */
+jack_shm_ringbuffer_t *
+jack_shm_ringbuffer_open (jack_client_t *client, const char *full_name)
+{
+	jack_request_t req;
+
+	if (client == NULL || full_name == NULL ||
+	    strlen (full_name) >= sizeof(req.x.ringbuffer.name)) {
+		return NULL;
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = OpenRingbuffer;
+	strcpy (req.x.ringbuffer.name, full_name);
+	jack_uuid_copy (&req.x.ringbuffer.client_id, client->control->uuid);
+
+	if (jack_client_deliver_request (client, &req)) {
+		return NULL;
+	}
+
+	return jack_shm_ringbuffer_attach (client, &req, 0);
+}
+
+/* unmaps it, and if this is the owner, destroys it: whoever has it
+   open sees jack_shm_ringbuffer_closed() become true. not realtime
+   safe. */
+void
+jack_shm_ringbuffer_close (jack_shm_ringbuffer_t *rb)
+{
+	jack_request_t req;
+
+	if (rb == NULL) {
+		return;
+	}
+
+	if (rb->owner) {
+		VALGRIND_MEMSET (&req, 0, sizeof(req));
+		req.type = DestroyRingbuffer;
+		strcpy (req.x.ringbuffer.name, rb->name);
+		jack_uuid_copy (&req.x.ringbuffer.client_id,
+				rb->client->control->uuid);
+		jack_client_deliver_request (rb->client, &req);
+	}
+
+	jack_release_shm (&rb->shm);
+	free (rb);
+}
+
+const char *
+jack_shm_ringbuffer_name (const jack_shm_ringbuffer_t *rb)
+{
+	return rb->name;
+}
+
+/* true once the owner has closed it, or gone away. what is left in
+   it can still be read. */
+int
+jack_shm_ringbuffer_closed (const jack_shm_ringbuffer_t *rb)
+{
+	return __atomic_load_n (&rb->shared->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+size_t
+jack_shm_ringbuffer_read_space (jack_shm_ringbuffer_t *rb)
+{
+	jack_shm_ringbuffer_reader_sees (rb);
+	return jack_shm_ringbuffer_readable (rb);
+}
+
+size_t
+jack_shm_ringbuffer_write_space (jack_shm_ringbuffer_t *rb)
+{
+	jack_shm_ringbuffer_writer_sees (rb);
+	return jack_shm_ringbuffer_writable (rb);
+}
+
+void
+jack_shm_ringbuffer_get_read_vector (jack_shm_ringbuffer_t *rb,
+				     jack_ringbuffer_data_t *vec)
+{
+	uint32_t r = __atomic_load_n (&rb->shared->read_ptr, __ATOMIC_RELAXED);
+	uint32_t start = r & rb->size_mask;
+	uint32_t n;
+
+	jack_shm_ringbuffer_reader_sees (rb);
+	n = rb->write_ptr_seen - r;
+
+	vec[0].buf = rb->buf + start;
+	if (start + n > rb->size) {
+		vec[0].len = rb->size - start;
+		vec[1].buf = rb->buf;
+		vec[1].len = n - vec[0].len;
+	} else {
+		vec[0].len = n;
+		vec[1].buf = rb->buf;
+		vec[1].len = 0;
+	}
+}
+
+void
+jack_shm_ringbuffer_get_write_vector (jack_shm_ringbuffer_t *rb,
+				      jack_ringbuffer_data_t *vec)
+{
+	uint32_t w = __atomic_load_n (&rb->shared->write_ptr, __ATOMIC_RELAXED);
+	uint32_t start = w & rb->size_mask;
+	uint32_t n;
+
+	jack_shm_ringbuffer_writer_sees (rb);
+	n = rb->size - (w - rb->read_ptr_seen);
+
+	vec[0].buf = rb->buf + start;
+	if (start + n > rb->size) {
+		vec[0].len = rb->size - start;
+		vec[1].buf = rb->buf;
+		vec[1].len = n - vec[0].len;
+	} else {
+		vec[0].len = n;
+		vec[1].buf = rb->buf;
+		vec[1].len = 0;
+	}
+}
+
+static void
+jack_shm_ringbuffer_copy_out (jack_shm_ringbuffer_t *rb, char *dest,
+			      uint32_t from, uint32_t cnt)
+{
+	uint32_t start = from & rb->size_mask;
+	uint32_t n1 = rb->size - start;
+
+	if (cnt <= n1) {
+		memcpy (dest, rb->buf + start, cnt);
+	} else {
+		memcpy (dest, rb->buf + start, n1);
+		memcpy (dest + n1, rb->buf, cnt - n1);
+	}
+}
+
+size_t
+jack_shm_ringbuffer_peek (jack_shm_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	uint32_t r = __atomic_load_n (&rb->shared->read_ptr, __ATOMIC_RELAXED);
+	uint32_t avail = jack_shm_ringbuffer_readable (rb);
+
+	if (avail < cnt) {
+		jack_shm_ringbuffer_reader_sees (rb);
+		avail = jack_shm_ringbuffer_readable (rb);
+	}
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt) {
+		jack_shm_ringbuffer_copy_out (rb, dest, r, cnt);
+	}
+
+	return cnt;
+}
+
+size_t
+jack_shm_ringbuffer_read (jack_shm_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	uint32_t r = __atomic_load_n (&rb->shared->read_ptr, __ATOMIC_RELAXED);
+
+	if ((cnt = jack_shm_ringbuffer_peek (rb, dest, cnt)) != 0) {
+		__atomic_store_n (&rb->shared->read_ptr, r + (uint32_t)cnt,
+				  __ATOMIC_RELEASE);
+	}
+
+	return cnt;
+}
+
+size_t
+jack_shm_ringbuffer_write (jack_shm_ringbuffer_t *rb, const char *src,
+			   size_t cnt)
+{
+	uint32_t w = __atomic_load_n (&rb->shared->write_ptr, __ATOMIC_RELAXED);
+	uint32_t avail = jack_shm_ringbuffer_writable (rb);
+	uint32_t start, n1;
+
+	if (avail < cnt) {
+		jack_shm_ringbuffer_writer_sees (rb);
+		avail = jack_shm_ringbuffer_writable (rb);
+	}
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt == 0) {
+		return 0;
+	}
+
+	start = w & rb->size_mask;
+	n1 = rb->size - start;
+
+	if (cnt <= n1) {
+		memcpy (rb->buf + start, src, cnt);
+	} else {
+		memcpy (rb->buf + start, src, n1);
+		memcpy (rb->buf, src + n1, cnt - n1);
+	}
+
+	__atomic_store_n (&rb->shared->write_ptr, w + (uint32_t)cnt,
+			  __ATOMIC_RELEASE);
+
+	return cnt;
+}
+
+/* after the caller has read from the read vector */
+void
+jack_shm_ringbuffer_read_advance (jack_shm_ringbuffer_t *rb, size_t cnt)
+{
+	uint32_t r = __atomic_load_n (&rb->shared->read_ptr, __ATOMIC_RELAXED);
+
+	__atomic_store_n (&rb->shared->read_ptr, r + (uint32_t)cnt,
+			  __ATOMIC_RELEASE);
+}
+
+/* after the caller has written to the write vector */
+void
+jack_shm_ringbuffer_write_advance (jack_shm_ringbuffer_t *rb, size_t cnt)
+{
+	uint32_t w = __atomic_load_n (&rb->shared->write_ptr, __ATOMIC_RELAXED);
+
+	__atomic_store_n (&rb->shared->write_ptr, w + (uint32_t)cnt,
+			  __ATOMIC_RELEASE);
+}
@@ -20,10 +20,195 @@
 
 
 #include <config.h>
+#include <string.h>
 #include "intsimd.h"
 
 #ifdef USE_DYNSIMD
 
+#ifdef ARCH_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif  /* ARCH_X86 */
+
+#ifdef ARCH_ARM64
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif  /* __linux__ */
+#endif  /* ARCH_ARM64 */
+
+static void
+gen_copyf (float *dest, const float *src, int length)
+{
+	memcpy (dest, src, length * sizeof(float));
+}
+
+static void
+gen_add2f (float *dest, const float *src, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		dest[i] += src[i];
+}
+
+static void
+gen_mixnf (float *dest, const float **src, int nsrc, int length)
+{
+	int i, s;
+	float f;
+
+	for (i = 0; i < length; i++) {
+		f = src[0][i];
+		for (s = 1; s < nsrc; s++)
+			f += src[s][i];
+		dest[i] = f;
+	}
+}
+
+/* dest = src[0] * gain[0] + ... , the gain of each source moving by
+ * step[s] every sample, so that a gain change ramps over the buffer.
+ * dest may be one of the sources.
+ */
+static void
+gen_mixgainf (float *dest, const float **src, const float *gain,
+	      const float *step, int nsrc, int length)
+{
+	int i, s;
+	float f;
+
+	for (i = 0; i < length; i++) {
+		f = src[0][i] * (gain[0] + step[0] * i);
+		for (s = 1; s < nsrc; s++)
+			f += src[s][i] * (gain[s] + step[s] * i);
+		dest[i] = f;
+	}
+}
+
+static void
+gen_mixnd (double *dest, const double **src, int nsrc, int length)
+{
+	int i, s;
+	double d;
+
+	for (i = 0; i < length; i++) {
+		d = src[0][i];
+		for (s = 1; s < nsrc; s++)
+			d += src[s][i];
+		dest[i] = d;
+	}
+}
+
+static void
+gen_f2i (int *dest, const float *src, int length, float scale)
+{
+	int i;
+	float f;
+
+	for (i = 0; i < length; i++) {
+		f = src[i];
+		if (f < -1.0f) {
+			f = -1.0f;
+		} else if (f > 1.0f) {
+			f = 1.0f;
+		}
+		f *= scale;
+		dest[i] = (int)(f < 0.0f ? f - 0.5f : f + 0.5f);
+	}
+}
+
+static void
+gen_i2f (float *dest, const int *src, int length, float scale)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		dest[i] = src[i] * scale;
+}
+
+static void
+gen_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	int i;
+	float f, p = 0.0f, q = 0.0f;
+
+	for (i = 0; i < length; i++) {
+		f = src[i];
+		q += f * f;
+		if (f < 0.0f)
+			f = -f;
+		if (f > p)
+			p = f;
+	}
+	*peak = p;
+	*sumsq = q;
+}
+
+/* Unity mixes of a fixed length, for every power of two period from
+ * 32 to 4096 frames. Port buffers are 64-byte aligned and a whole
+ * number of 64 bytes long, so these need neither unaligned loads nor
+ * a tail, and the compiler lowers the 16 float vectors to whatever
+ * the target of each set has. jack_simd_set_length() picks the one
+ * for the period from the set jack_simd_init() chose.
+ */
+typedef float v16sf __attribute__((vector_size (64)));
+
+#define JACK_MIXNF_FIXED(isa, target, len)				\
+	target static void						\
+	isa ## _mixnf_ ## len (float *dest, const float **src, int nsrc, \
+			       int length)				\
+	{								\
+		int i, s;						\
+		v16sf sum;						\
+									\
+		for (i = 0; i < len; i += 16) {				\
+			sum = *(const v16sf*)(src[0] + i);		\
+			for (s = 1; s < nsrc; s++)			\
+				sum += *(const v16sf*)(src[s] + i);	\
+			*(v16sf*)(dest + i) = sum;			\
+		}							\
+	}
+
+#define JACK_SIMD_FIXED(isa, target)					\
+	JACK_MIXNF_FIXED (isa, target, 32)				\
+	JACK_MIXNF_FIXED (isa, target, 64)				\
+	JACK_MIXNF_FIXED (isa, target, 128)				\
+	JACK_MIXNF_FIXED (isa, target, 256)				\
+	JACK_MIXNF_FIXED (isa, target, 512)				\
+	JACK_MIXNF_FIXED (isa, target, 1024)				\
+	JACK_MIXNF_FIXED (isa, target, 2048)				\
+	JACK_MIXNF_FIXED (isa, target, 4096)				\
+	static const jack_simd_fixed_t isa ## _fixed[] = {		\
+		{ 32, isa ## _mixnf_32 }, { 64, isa ## _mixnf_64 },	\
+		{ 128, isa ## _mixnf_128 }, { 256, isa ## _mixnf_256 },	\
+		{ 512, isa ## _mixnf_512 }, { 1024, isa ## _mixnf_1024 }, \
+		{ 2048, isa ## _mixnf_2048 }, { 4096, isa ## _mixnf_4096 }, \
+		{ 0, NULL }						\
+	};
+
+JACK_SIMD_FIXED (gen, )
+
+#ifdef ARCH_X86
+JACK_SIMD_FIXED (x86_sse, __attribute__((target ("sse2"))))
+JACK_SIMD_FIXED (x86_avx2, __attribute__((target ("avx2"))))
+JACK_SIMD_FIXED (x86_avx512, __attribute__((target ("avx512f"))))
+#endif  /* ARCH_X86 */
+
+static const jack_simd_fixed_t *fixed_kernels = gen_fixed;
+
+jack_simd_t jack_simd = {
+	.name	= "generic",
+	.copyf	= gen_copyf,
+	.add2f	= gen_add2f,
+	.mixnf	= gen_mixnf,
+	.mixgainf = gen_mixgainf,
+	.mixnd	= gen_mixnd,
+	.meterf	= gen_meterf,
+	.f2i	= gen_f2i,
+	.i2f	= gen_i2f,
+};
+
 #ifdef ARCH_X86
 
 int
@@ -318,6 +503,120 @@ sse_nonalign:
 	}
 }
 
+/* dest = src[0] + ... + src[nsrc - 1], in one pass over dest.
+ * dest may be one of the sources.
+ */
+void
+x86_sse_mixnf (float *dest, const float **src, int nsrc, int length)
+{
+	int i, s, si2;
+	v4sf sum;
+
+	si2 = 0;
+	if (__builtin_expect ((long)dest & 0xf, 0)) {
+		goto sse_nonalign;
+	}
+	for (s = 0; s < nsrc; s++) {
+		if (__builtin_expect ((long)src[s] & 0xf, 0)) {
+			goto sse_nonalign;
+		}
+	}
+	si2 = (length & ~0x3);
+	for (i = 0; i < si2; i += 4) {
+		sum = *(const v4sf*)(src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum += *(const v4sf*)(src[s] + i);
+		*(pv4sf)(dest + i) = sum;
+	}
+sse_nonalign:
+	for (i = si2; i < length; i++) {
+		float f = src[0][i];
+		for (s = 1; s < nsrc; s++)
+			f += src[s][i];
+		dest[i] = f;
+	}
+}
+
+__attribute__((target ("sse2"))) void
+x86_sse_mixnd (double *dest, const double **src, int nsrc, int length)
+{
+	int i, s, n = length & ~0x1;
+	const double *tail[nsrc];
+	__m128d sum;
+
+	for (i = 0; i < n; i += 2) {
+		sum = _mm_loadu_pd (src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum = _mm_add_pd (sum, _mm_loadu_pd (src[s] + i));
+		_mm_storeu_pd (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++)
+		tail[s] = src[s] + n;
+	gen_mixnd (dest + n, tail, nsrc, length - n);
+}
+
+__attribute__((target ("sse2"))) void
+x86_sse_mixgainf (float *dest, const float **src, const float *gain,
+		  const float *step, int nsrc, int length)
+{
+	int i, s, n = length & ~0x3;
+	const float *tail[nsrc];
+	float tailgain[nsrc];
+	__m128 g[nsrc], d[nsrc];
+	__m128 sum;
+	const __m128 ramp = _mm_set_ps (3.0f, 2.0f, 1.0f, 0.0f);
+
+	for (s = 0; s < nsrc; s++) {
+		g[s] = _mm_add_ps (_mm_set1_ps (gain[s]),
+				   _mm_mul_ps (_mm_set1_ps (step[s]), ramp));
+		d[s] = _mm_set1_ps (step[s] * 4.0f);
+	}
+
+	for (i = 0; i < n; i += 4) {
+		sum = _mm_mul_ps (_mm_loadu_ps (src[0] + i), g[0]);
+		g[0] = _mm_add_ps (g[0], d[0]);
+		for (s = 1; s < nsrc; s++) {
+			sum = _mm_add_ps (sum, _mm_mul_ps (_mm_loadu_ps (src[s] + i),
+							   g[s]));
+			g[s] = _mm_add_ps (g[s], d[s]);
+		}
+		_mm_storeu_ps (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++) {
+		tail[s] = src[s] + n;
+		tailgain[s] = gain[s] + step[s] * n;
+	}
+	gen_mixgainf (dest + n, tail, tailgain, step, nsrc, length - n);
+}
+
+__attribute__((target ("sse2"))) void
+x86_sse_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	int i, n = length & ~0x3;
+	float p[4], q[4], tp, tq;
+	const __m128 sign = _mm_set1_ps (-0.0f);
+	__m128 f, vp = _mm_setzero_ps (), vq = _mm_setzero_ps ();
+
+	for (i = 0; i < n; i += 4) {
+		f = _mm_loadu_ps (src + i);
+		vq = _mm_add_ps (vq, _mm_mul_ps (f, f));
+		vp = _mm_max_ps (vp, _mm_andnot_ps (sign, f));
+	}
+	_mm_storeu_ps (p, vp);
+	_mm_storeu_ps (q, vq);
+
+	gen_meterf (src + n, length - n, &tp, &tq);
+	for (i = 0; i < 4; i++) {
+		if (p[i] > tp)
+			tp = p[i];
+		tq += q[i];
+	}
+	*peak = tp;
+	*sumsq = tq;
+}
+
 void x86_sse_f2i (int *dest, const float *src, int length, float scale)
 {
 	int i;
@@ -410,7 +709,582 @@ sse_nonalign:
 	}
 }
 
+/* The AVX2 and AVX-512 kernels are compiled for their instruction
+ * set with target attributes, so that the rest of the library still
+ * runs on CPUs without it. They use unaligned loads and stores, which
+ * cost nothing extra on aligned buffers, and leave the tail of a
+ * buffer to the generic code.
+ */
+
+int
+have_avx ()
+{
+	unsigned int eax, ebx, ecx, edx, xcr0, xcr0_hi;
+	int res = 0;
+
+	if (!__get_cpuid (1, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+
+	/* the OS must save the YMM (and for AVX-512 the ZMM) state */
+	if (!(ecx & (1 << 27)) || !(ecx & (1 << 28))) {
+		return 0;
+	}
+
+	asm volatile ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+
+	if ((xcr0 & 0x6) != 0x6 ||
+	    !__get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+
+	if (ebx & (1 << 5)) {
+		res |= ARCH_X86_AVX2;
+	}
+
+	if ((ebx & (1 << 16)) && (xcr0 & 0xe0) == 0xe0) {
+		res |= ARCH_X86_AVX512F;
+	}
+
+	return res;
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_copyf (float *dest, const float *src, int length)
+{
+	int i, n = length & ~0x7;
+
+	for (i = 0; i < n; i += 8)
+		_mm256_storeu_ps (dest + i, _mm256_loadu_ps (src + i));
+	gen_copyf (dest + n, src + n, length - n);
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_add2f (float *dest, const float *src, int length)
+{
+	int i, n = length & ~0x7;
+
+	for (i = 0; i < n; i += 8)
+		_mm256_storeu_ps (dest + i,
+				  _mm256_add_ps (_mm256_loadu_ps (dest + i),
+						 _mm256_loadu_ps (src + i)));
+	gen_add2f (dest + n, src + n, length - n);
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_mixnf (float *dest, const float **src, int nsrc, int length)
+{
+	int i, s, n = length & ~0x7;
+	const float *tail[nsrc];
+	__m256 sum;
+
+	for (i = 0; i < n; i += 8) {
+		sum = _mm256_loadu_ps (src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum = _mm256_add_ps (sum, _mm256_loadu_ps (src[s] + i));
+		_mm256_storeu_ps (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++)
+		tail[s] = src[s] + n;
+	gen_mixnf (dest + n, tail, nsrc, length - n);
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_mixnd (double *dest, const double **src, int nsrc, int length)
+{
+	int i, s, n = length & ~0x3;
+	const double *tail[nsrc];
+	__m256d sum;
+
+	for (i = 0; i < n; i += 4) {
+		sum = _mm256_loadu_pd (src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum = _mm256_add_pd (sum, _mm256_loadu_pd (src[s] + i));
+		_mm256_storeu_pd (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++)
+		tail[s] = src[s] + n;
+	gen_mixnd (dest + n, tail, nsrc, length - n);
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_mixgainf (float *dest, const float **src, const float *gain,
+		   const float *step, int nsrc, int length)
+{
+	int i, s, n = length & ~0x7;
+	const float *tail[nsrc];
+	float tailgain[nsrc];
+	__m256 g[nsrc], d[nsrc];
+	__m256 sum;
+	const __m256 ramp = _mm256_set_ps (7.0f, 6.0f, 5.0f, 4.0f,
+					   3.0f, 2.0f, 1.0f, 0.0f);
+
+	/* not every AVX2 CPU has FMA, so this multiplies and adds */
+	for (s = 0; s < nsrc; s++) {
+		g[s] = _mm256_add_ps (_mm256_set1_ps (gain[s]),
+				      _mm256_mul_ps (_mm256_set1_ps (step[s]), ramp));
+		d[s] = _mm256_set1_ps (step[s] * 8.0f);
+	}
+
+	for (i = 0; i < n; i += 8) {
+		sum = _mm256_mul_ps (_mm256_loadu_ps (src[0] + i), g[0]);
+		g[0] = _mm256_add_ps (g[0], d[0]);
+		for (s = 1; s < nsrc; s++) {
+			sum = _mm256_add_ps (sum,
+					     _mm256_mul_ps (_mm256_loadu_ps (src[s] + i),
+							    g[s]));
+			g[s] = _mm256_add_ps (g[s], d[s]);
+		}
+		_mm256_storeu_ps (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++) {
+		tail[s] = src[s] + n;
+		tailgain[s] = gain[s] + step[s] * n;
+	}
+	gen_mixgainf (dest + n, tail, tailgain, step, nsrc, length - n);
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	int i, n = length & ~0x7;
+	float p[8], q[8], tp, tq;
+	const __m256 sign = _mm256_set1_ps (-0.0f);
+	__m256 f, vp = _mm256_setzero_ps (), vq = _mm256_setzero_ps ();
+
+	for (i = 0; i < n; i += 8) {
+		f = _mm256_loadu_ps (src + i);
+		vq = _mm256_add_ps (vq, _mm256_mul_ps (f, f));
+		vp = _mm256_max_ps (vp, _mm256_andnot_ps (sign, f));
+	}
+	_mm256_storeu_ps (p, vp);
+	_mm256_storeu_ps (q, vq);
+
+	gen_meterf (src + n, length - n, &tp, &tq);
+	for (i = 0; i < 8; i++) {
+		if (p[i] > tp)
+			tp = p[i];
+		tq += q[i];
+	}
+	*peak = tp;
+	*sumsq = tq;
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_f2i (int *dest, const float *src, int length, float scale)
+{
+	int i, n = length & ~0x7;
+	__m256 lo = _mm256_set1_ps (-1.0f);
+	__m256 hi = _mm256_set1_ps (1.0f);
+	__m256 s = _mm256_set1_ps (scale);
+	__m256 f;
+
+	for (i = 0; i < n; i += 8) {
+		f = _mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (src + i), lo), hi);
+		_mm256_storeu_si256 ((__m256i*)(dest + i),
+				     _mm256_cvtps_epi32 (_mm256_mul_ps (f, s)));
+	}
+	gen_f2i (dest + n, src + n, length - n, scale);
+}
+
+__attribute__((target ("avx2"))) void
+x86_avx2_i2f (float *dest, const int *src, int length, float scale)
+{
+	int i, n = length & ~0x7;
+	__m256 s = _mm256_set1_ps (scale);
+
+	for (i = 0; i < n; i += 8)
+		_mm256_storeu_ps (dest + i,
+				  _mm256_mul_ps (_mm256_cvtepi32_ps (
+							 _mm256_loadu_si256 ((const __m256i*)(src + i))), s));
+	gen_i2f (dest + n, src + n, length - n, scale);
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_copyf (float *dest, const float *src, int length)
+{
+	int i, n = length & ~0xf;
+
+	for (i = 0; i < n; i += 16)
+		_mm512_storeu_ps (dest + i, _mm512_loadu_ps (src + i));
+	gen_copyf (dest + n, src + n, length - n);
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_add2f (float *dest, const float *src, int length)
+{
+	int i, n = length & ~0xf;
+
+	for (i = 0; i < n; i += 16)
+		_mm512_storeu_ps (dest + i,
+				  _mm512_add_ps (_mm512_loadu_ps (dest + i),
+						 _mm512_loadu_ps (src + i)));
+	gen_add2f (dest + n, src + n, length - n);
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_mixnf (float *dest, const float **src, int nsrc, int length)
+{
+	int i, s, n = length & ~0xf;
+	const float *tail[nsrc];
+	__m512 sum;
+
+	for (i = 0; i < n; i += 16) {
+		sum = _mm512_loadu_ps (src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum = _mm512_add_ps (sum, _mm512_loadu_ps (src[s] + i));
+		_mm512_storeu_ps (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++)
+		tail[s] = src[s] + n;
+	gen_mixnf (dest + n, tail, nsrc, length - n);
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_mixnd (double *dest, const double **src, int nsrc, int length)
+{
+	int i, s, n = length & ~0x7;
+	const double *tail[nsrc];
+	__m512d sum;
+
+	for (i = 0; i < n; i += 8) {
+		sum = _mm512_loadu_pd (src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum = _mm512_add_pd (sum, _mm512_loadu_pd (src[s] + i));
+		_mm512_storeu_pd (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++)
+		tail[s] = src[s] + n;
+	gen_mixnd (dest + n, tail, nsrc, length - n);
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_mixgainf (float *dest, const float **src, const float *gain,
+		     const float *step, int nsrc, int length)
+{
+	int i, s, n = length & ~0xf;
+	const float *tail[nsrc];
+	float tailgain[nsrc];
+	__m512 g[nsrc], d[nsrc];
+	__m512 sum;
+	const __m512 ramp = _mm512_set_ps (15.0f, 14.0f, 13.0f, 12.0f,
+					   11.0f, 10.0f, 9.0f, 8.0f,
+					   7.0f, 6.0f, 5.0f, 4.0f,
+					   3.0f, 2.0f, 1.0f, 0.0f);
+
+	for (s = 0; s < nsrc; s++) {
+		g[s] = _mm512_fmadd_ps (_mm512_set1_ps (step[s]), ramp,
+					_mm512_set1_ps (gain[s]));
+		d[s] = _mm512_set1_ps (step[s] * 16.0f);
+	}
+
+	for (i = 0; i < n; i += 16) {
+		sum = _mm512_mul_ps (_mm512_loadu_ps (src[0] + i), g[0]);
+		g[0] = _mm512_add_ps (g[0], d[0]);
+		for (s = 1; s < nsrc; s++) {
+			sum = _mm512_fmadd_ps (_mm512_loadu_ps (src[s] + i),
+					       g[s], sum);
+			g[s] = _mm512_add_ps (g[s], d[s]);
+		}
+		_mm512_storeu_ps (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++) {
+		tail[s] = src[s] + n;
+		tailgain[s] = gain[s] + step[s] * n;
+	}
+	gen_mixgainf (dest + n, tail, tailgain, step, nsrc, length - n);
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	int i, n = length & ~0xf;
+	float tp, tq, vmax;
+	__m512 f, vp = _mm512_setzero_ps (), vq = _mm512_setzero_ps ();
+
+	for (i = 0; i < n; i += 16) {
+		f = _mm512_loadu_ps (src + i);
+		vq = _mm512_fmadd_ps (f, f, vq);
+		vp = _mm512_max_ps (vp, _mm512_abs_ps (f));
+	}
+
+	gen_meterf (src + n, length - n, &tp, &tq);
+	vmax = _mm512_reduce_max_ps (vp);
+	*peak = vmax > tp ? vmax : tp;
+	*sumsq = _mm512_reduce_add_ps (vq) + tq;
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_f2i (int *dest, const float *src, int length, float scale)
+{
+	int i, n = length & ~0xf;
+	__m512 lo = _mm512_set1_ps (-1.0f);
+	__m512 hi = _mm512_set1_ps (1.0f);
+	__m512 s = _mm512_set1_ps (scale);
+	__m512 f;
+
+	for (i = 0; i < n; i += 16) {
+		f = _mm512_min_ps (_mm512_max_ps (_mm512_loadu_ps (src + i), lo), hi);
+		_mm512_storeu_si512 ((void*)(dest + i),
+				     _mm512_cvtps_epi32 (_mm512_mul_ps (f, s)));
+	}
+	gen_f2i (dest + n, src + n, length - n, scale);
+}
+
+__attribute__((target ("avx512f"))) void
+x86_avx512_i2f (float *dest, const int *src, int length, float scale)
+{
+	int i, n = length & ~0xf;
+	__m512 s = _mm512_set1_ps (scale);
+
+	for (i = 0; i < n; i += 16)
+		_mm512_storeu_ps (dest + i,
+				  _mm512_mul_ps (_mm512_cvtepi32_ps (
+							 _mm512_loadu_si512 ((const void*)(src + i))), s));
+	gen_i2f (dest + n, src + n, length - n, scale);
+}
+
 #endif  /* ARCH_X86 */
 
+#ifdef ARCH_ARM64
+
+int
+have_neon ()
+{
+#if defined(__linux__) && defined(HWCAP_ASIMD)
+	return (getauxval (AT_HWCAP) & HWCAP_ASIMD) ? ARCH_ARM64_NEON : 0;
+#else
+	/* Advanced SIMD is part of the AArch64 base architecture */
+	return ARCH_ARM64_NEON;
+#endif
+}
+
+void
+arm64_neon_copyf (float *dest, const float *src, int length)
+{
+	int i, n = length & ~0x7;
+
+	for (i = 0; i < n; i += 8) {
+		vst1q_f32 (dest + i, vld1q_f32 (src + i));
+		vst1q_f32 (dest + i + 4, vld1q_f32 (src + i + 4));
+	}
+	gen_copyf (dest + n, src + n, length - n);
+}
+
+void
+arm64_neon_add2f (float *dest, const float *src, int length)
+{
+	int i, n = length & ~0x3;
+
+	for (i = 0; i < n; i += 4)
+		vst1q_f32 (dest + i, vaddq_f32 (vld1q_f32 (dest + i),
+						vld1q_f32 (src + i)));
+	gen_add2f (dest + n, src + n, length - n);
+}
+
+void
+arm64_neon_mixnf (float *dest, const float **src, int nsrc, int length)
+{
+	int i, s, n = length & ~0x3;
+	const float *tail[nsrc];
+	float32x4_t sum;
+
+	for (i = 0; i < n; i += 4) {
+		sum = vld1q_f32 (src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum = vaddq_f32 (sum, vld1q_f32 (src[s] + i));
+		vst1q_f32 (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++)
+		tail[s] = src[s] + n;
+	gen_mixnf (dest + n, tail, nsrc, length - n);
+}
+
+void
+arm64_neon_mixgainf (float *dest, const float **src, const float *gain,
+		     const float *step, int nsrc, int length)
+{
+	int i, s, n = length & ~0x3;
+	const float *tail[nsrc];
+	float tailgain[nsrc];
+	float32x4_t g[nsrc], d[nsrc];
+	float32x4_t sum;
+	static const float ramp_init[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	const float32x4_t ramp = vld1q_f32 (ramp_init);
+
+	for (s = 0; s < nsrc; s++) {
+		g[s] = vfmaq_n_f32 (vdupq_n_f32 (gain[s]), ramp, step[s]);
+		d[s] = vdupq_n_f32 (step[s] * 4.0f);
+	}
+
+	for (i = 0; i < n; i += 4) {
+		sum = vmulq_f32 (vld1q_f32 (src[0] + i), g[0]);
+		g[0] = vaddq_f32 (g[0], d[0]);
+		for (s = 1; s < nsrc; s++) {
+			sum = vfmaq_f32 (sum, vld1q_f32 (src[s] + i), g[s]);
+			g[s] = vaddq_f32 (g[s], d[s]);
+		}
+		vst1q_f32 (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++) {
+		tail[s] = src[s] + n;
+		tailgain[s] = gain[s] + step[s] * n;
+	}
+	gen_mixgainf (dest + n, tail, tailgain, step, nsrc, length - n);
+}
+
+void
+arm64_neon_mixnd (double *dest, const double **src, int nsrc, int length)
+{
+	int i, s, n = length & ~0x1;
+	const double *tail[nsrc];
+	float64x2_t sum;
+
+	for (i = 0; i < n; i += 2) {
+		sum = vld1q_f64 (src[0] + i);
+		for (s = 1; s < nsrc; s++)
+			sum = vaddq_f64 (sum, vld1q_f64 (src[s] + i));
+		vst1q_f64 (dest + i, sum);
+	}
+
+	for (s = 0; s < nsrc; s++)
+		tail[s] = src[s] + n;
+	gen_mixnd (dest + n, tail, nsrc, length - n);
+}
+
+void
+arm64_neon_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	int i, n = length & ~0x3;
+	float tp, tq, vmax;
+	float32x4_t f, vp = vdupq_n_f32 (0.0f), vq = vdupq_n_f32 (0.0f);
+
+	for (i = 0; i < n; i += 4) {
+		f = vld1q_f32 (src + i);
+		vq = vfmaq_f32 (vq, f, f);
+		vp = vmaxq_f32 (vp, vabsq_f32 (f));
+	}
+
+	gen_meterf (src + n, length - n, &tp, &tq);
+	vmax = vmaxvq_f32 (vp);
+	*peak = vmax > tp ? vmax : tp;
+	*sumsq = vaddvq_f32 (vq) + tq;
+}
+
+void
+arm64_neon_f2i (int *dest, const float *src, int length, float scale)
+{
+	int i, n = length & ~0x3;
+	float32x4_t lo = vdupq_n_f32 (-1.0f);
+	float32x4_t hi = vdupq_n_f32 (1.0f);
+	float32x4_t f;
+
+	for (i = 0; i < n; i += 4) {
+		f = vminq_f32 (vmaxq_f32 (vld1q_f32 (src + i), lo), hi);
+		vst1q_s32 (dest + i, vcvtnq_s32_f32 (vmulq_n_f32 (f, scale)));
+	}
+	gen_f2i (dest + n, src + n, length - n, scale);
+}
+
+void
+arm64_neon_i2f (float *dest, const int *src, int length, float scale)
+{
+	int i, n = length & ~0x3;
+
+	for (i = 0; i < n; i += 4)
+		vst1q_f32 (dest + i, vmulq_n_f32 (vcvtq_f32_s32 (vld1q_s32 (src + i)),
+						  scale));
+	gen_i2f (dest + n, src + n, length - n, scale);
+}
+
+#endif  /* ARCH_ARM64 */
+
+/* Pick the widest kernels the CPU described by cpu_type can run. */
+void
+jack_simd_init ()
+{
+#ifdef ARCH_X86
+	if (ARCH_X86_HAVE_AVX512F (cpu_type)) {
+		jack_simd.name = "AVX-512";
+		jack_simd.copyf = x86_avx512_copyf;
+		jack_simd.add2f = x86_avx512_add2f;
+		jack_simd.mixnf = x86_avx512_mixnf;
+		jack_simd.mixgainf = x86_avx512_mixgainf;
+		jack_simd.mixnd = x86_avx512_mixnd;
+		jack_simd.meterf = x86_avx512_meterf;
+		jack_simd.f2i = x86_avx512_f2i;
+		jack_simd.i2f = x86_avx512_i2f;
+		fixed_kernels = x86_avx512_fixed;
+	} else if (ARCH_X86_HAVE_AVX2 (cpu_type)) {
+		jack_simd.name = "AVX2";
+		jack_simd.copyf = x86_avx2_copyf;
+		jack_simd.add2f = x86_avx2_add2f;
+		jack_simd.mixnf = x86_avx2_mixnf;
+		jack_simd.mixgainf = x86_avx2_mixgainf;
+		jack_simd.mixnd = x86_avx2_mixnd;
+		jack_simd.meterf = x86_avx2_meterf;
+		jack_simd.f2i = x86_avx2_f2i;
+		jack_simd.i2f = x86_avx2_i2f;
+		fixed_kernels = x86_avx2_fixed;
+	} else if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+		jack_simd.name = "SSE2";
+		jack_simd.copyf = x86_sse_copyf;
+		jack_simd.add2f = x86_sse_add2f;
+		jack_simd.mixnf = x86_sse_mixnf;
+		jack_simd.mixgainf = x86_sse_mixgainf;
+		jack_simd.mixnd = x86_sse_mixnd;
+		jack_simd.meterf = x86_sse_meterf;
+		jack_simd.f2i = x86_sse_f2i;
+		jack_simd.i2f = x86_sse_i2f;
+		fixed_kernels = x86_sse_fixed;
+	} else if (ARCH_X86_HAVE_3DNOW (cpu_type)) {
+		jack_simd.name = "3DNow!";
+		jack_simd.copyf = x86_3dnow_copyf;
+		jack_simd.add2f = x86_3dnow_add2f;
+	}
+#endif  /* ARCH_X86 */
+
+#ifdef ARCH_ARM64
+	if (ARCH_ARM64_HAVE_NEON (cpu_type)) {
+		jack_simd.name = "NEON";
+		jack_simd.copyf = arm64_neon_copyf;
+		jack_simd.add2f = arm64_neon_add2f;
+		jack_simd.mixnf = arm64_neon_mixnf;
+		jack_simd.mixgainf = arm64_neon_mixgainf;
+		jack_simd.mixnd = arm64_neon_mixnd;
+		jack_simd.meterf = arm64_neon_meterf;
+		jack_simd.f2i = arm64_neon_f2i;
+		jack_simd.i2f = arm64_neon_i2f;
+	}
+#endif  /* ARCH_ARM64 */
+}
+
+/* Use the fixed length mix for `length' frames, if there is one. The
+ * period can change while other threads mix, so they test the length
+ * of the entry they see before they use it.
+ */
+void
+jack_simd_set_length (int length)
+{
+	const jack_simd_fixed_t *f;
+
+	for (f = fixed_kernels; f->length; f++) {
+		if (f->length == length) {
+			break;
+		}
+	}
+
+	__atomic_store_n (&jack_simd.fixed, f->length ? f : NULL,
+			  __ATOMIC_RELEASE);
+}
+
 #endif  /* USE_DYNSIMD */
 
@@ -21,6 +21,7 @@
 
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 
 #include <jack/jack.h>
@@ -31,18 +32,40 @@
 #include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #if defined(__FreeBSD__)
 #include <sys/types.h>
 #include <sys/rtprio.h>
 #include <unistd.h>
 #endif
+#ifdef __linux__
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 #include "local.h"
 
 #ifdef JACK_USE_MACH_THREADS
 #include <sysdeps/pThreadUtilities.h>
+
+/* the time constraint policy of a realtime thread is set up for the
+   engine's period, or 10 msecs where that is not known yet */
+static UInt64
+jack_mach_period_nsecs (jack_client_t* client)
+{
+	if (client && client->engine && client->engine->buffer_size &&
+	    client->engine->current_time.frame_rate) {
+		return (UInt64)client->engine->buffer_size * 1000000000ULL
+		       / client->engine->current_time.frame_rate;
+	}
+
+	return 10000000;
+}
 #endif
 
 jack_thread_creator_t jack_thread_creator = pthread_create;
@@ -107,19 +130,55 @@ maybe_get_capabilities (jack_client_t* client)
 }
 
 static void
-jack_thread_touch_stack ()
+jack_thread_touch_stack (size_t depth)
 {
-	char buf[JACK_THREAD_STACK_TOUCH];
-	int i;
+	char buf[depth ? depth : 1];
+	size_t i;
 	volatile char *buf_ptr = buf;
 
-	for (i = 0; i < JACK_THREAD_STACK_TOUCH; i++)
+	for (i = 0; i < depth; i++)
 		buf_ptr[i] = (char)(i & 0xff);
 }
 
-typedef void (*stack_touch_t)();
+typedef void (*stack_touch_t)(size_t);
 static volatile stack_touch_t ptr_jack_thread_touch_stack = jack_thread_touch_stack;
 
+/* a size in bytes from the environment, with an optional k or M
+   suffix; `dflt' if it is unset or not a size */
+static size_t
+jack_thread_env_size (const char *name, size_t dflt)
+{
+	const char *str;
+	char *end;
+	unsigned long val;
+
+	if ((str = getenv (name)) == NULL || *str == '\0') {
+		return dflt;
+	}
+
+	val = strtoul (str, &end, 10);
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		val *= 1024;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		val *= 1024 * 1024;
+		end++;
+		break;
+	}
+
+	if (*end != '\0') {
+		jack_error ("ignoring $%s: \"%s\" is not a size", name, str);
+		return dflt;
+	}
+
+	return val;
+}
+
 static void*
 jack_thread_proxy (void* varg)
 {
@@ -130,7 +189,7 @@ jack_thread_proxy (void* varg)
 	jack_client_t* client = arg->client;
 
 	if (arg->realtime) {
-		ptr_jack_thread_touch_stack ();
+		ptr_jack_thread_touch_stack (arg->stack_touch);
 		maybe_get_capabilities (client);
 		jack_acquire_real_time_scheduling (pthread_self (), arg->priority);
 	}
@@ -154,6 +213,7 @@ jack_client_create_thread (jack_client_t* client,
 #ifndef JACK_USE_MACH_THREADS
 	pthread_attr_t attr;
 	jack_thread_arg_t* thread_args;
+	size_t stack_size, stack_touch;
 #endif  /* !JACK_USE_MACH_THREADS */
 
 	int result = 0;
@@ -195,7 +255,24 @@ jack_client_create_thread (jack_client_t* client,
 		return result;
 	}
 
-	result = pthread_attr_setstacksize (&attr, THREAD_STACK);
+	/* $JACK_RT_STACK_SIZE for hosts whose plugins need more stack
+	   than the default, and $JACK_RT_STACK_PREFAULT for how much of
+	   it gets faulted in before the thread goes realtime. The touch
+	   stays clear of the top 64 kB, which the thread itself needs. */
+
+	stack_size = jack_thread_env_size ("JACK_RT_STACK_SIZE", THREAD_STACK);
+#ifdef PTHREAD_STACK_MIN
+	if (stack_size < PTHREAD_STACK_MIN) {
+		stack_size = PTHREAD_STACK_MIN;
+	}
+#endif
+	stack_touch = jack_thread_env_size ("JACK_RT_STACK_PREFAULT",
+					    JACK_THREAD_STACK_TOUCH);
+	if (stack_touch + 65536 > stack_size) {
+		stack_touch = stack_size > 65536 ? stack_size - 65536 : 0;
+	}
+
+	result = pthread_attr_setstacksize (&attr, stack_size);
 	if (result) {
 		log_result ("setting thread stack size", result);
 		return result;
@@ -210,6 +287,7 @@ jack_client_create_thread (jack_client_t* client,
 	thread_args->arg = arg;
 	thread_args->realtime = 1;
 	thread_args->priority = priority;
+	thread_args->stack_touch = stack_touch;
 
 	result = jack_thread_creator (thread, &attr, jack_thread_proxy, thread_args);
 	if (result) {
@@ -226,7 +304,7 @@ jack_client_create_thread (jack_client_t* client,
 	}
 
 	/* time constraint thread */
-	setThreadToPriority (*thread, 96, TRUE, 10000000);
+	setThreadToPriority (*thread, 96, TRUE, jack_mach_period_nsecs (client));
 
 #endif  /* JACK_USE_MACH_THREADS */
 
@@ -253,6 +331,162 @@ jack_client_max_real_time_priority (jack_client_t* client)
 	return client->engine->max_client_priority;
 }
 
+/* tie the process thread to client->process_cpus, or for "auto" to
+   the cpu the engine suggested, if that changed */
+int
+jack_client_apply_process_cpus (jack_client_t* client)
+{
+	char cpu[16];
+#ifdef JACK_USE_MACH_THREADS
+	pthread_t thread = client->process_thread;
+#else
+	pthread_t thread = client->thread;
+#endif
+
+	if (client->process_cpus == NULL || client->first_active) {
+		/* nothing asked for, or no thread yet */
+		return 0;
+	}
+
+	if (strcmp (client->process_cpus, "auto") != 0) {
+		if (client->process_cpu == JACK_MAX_CPUS) {
+			return 0;
+		}
+		client->process_cpu = JACK_MAX_CPUS;
+		return jack_set_thread_cpus (thread, client->process_cpus);
+	}
+
+	if (client->control->suggested_cpu < 0 ||
+	    client->control->suggested_cpu == client->process_cpu) {
+		return 0;
+	}
+
+	client->process_cpu = client->control->suggested_cpu;
+	snprintf (cpu, sizeof(cpu), "%d", client->process_cpu);
+
+	return jack_set_thread_cpus (thread, cpu);
+}
+
+int
+jack_set_process_thread_cpus (jack_client_t* client, const char* cpus)
+{
+	if (cpus && strcmp (cpus, "auto") != 0 &&
+	    jack_cpu_list_parse (cpus, NULL, 0) < 0) {
+		jack_error ("invalid cpu list \"%s\"", cpus);
+		return -1;
+	}
+
+	free (client->process_cpus);
+	client->process_cpus = cpus ? strdup (cpus) : NULL;
+	client->process_cpu = -1;
+
+	return jack_client_apply_process_cpus (client);
+}
+
+int
+jack_client_suggested_cpu (jack_client_t* client)
+{
+	return client->control->suggested_cpu;
+}
+
+#if defined(__linux__) && defined(SYS_sched_setattr)
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+
+/* glibc has no wrapper for sched_setattr(2) */
+struct jack_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;         /* nsecs */
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+#endif
+
+/* give the thread with kernel id `tid', 0 for the calling one,
+   `runtime_usecs' of every `period_usecs', with the end of the
+   period as its deadline. threads keep their SCHED_FIFO priority if
+   this fails. note that the kernel will not tie SCHED_DEADLINE
+   threads to fewer cpus than their root domain has.
+ */
+int
+jack_set_deadline_scheduling (int tid, jack_time_t runtime_usecs,
+			      jack_time_t period_usecs)
+{
+#if defined(__linux__) && defined(SYS_sched_setattr)
+	struct jack_sched_attr attr;
+
+	memset (&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+	attr.sched_runtime = runtime_usecs * 1000;
+	attr.sched_deadline = period_usecs * 1000;
+	attr.sched_period = period_usecs * 1000;
+
+	if (syscall (SYS_sched_setattr, tid, &attr, 0) != 0) {
+		jack_error ("cannot use SCHED_DEADLINE (%" PRIu64 " of %" PRIu64
+			    " usecs) (%s)", runtime_usecs, period_usecs,
+			    strerror (errno));
+		return -1;
+	}
+
+	return 0;
+#else
+	jack_error ("SCHED_DEADLINE is not supported on this system");
+	return -1;
+#endif
+}
+
+/* the process thread's SCHED_DEADLINE reservation follows the period */
+int
+jack_client_apply_deadline (jack_client_t* client)
+{
+	jack_control_t *engine = client->engine;
+	jack_time_t period, budget;
+
+	if (!engine->deadline || !engine->real_time ||
+	    client->process_tid == 0 || engine->current_time.frame_rate == 0) {
+		return 0;
+	}
+
+	period = (jack_time_t)engine->buffer_size * 1000000 /
+		 engine->current_time.frame_rate;
+
+	if ((budget = client->control->deadline_budget) == 0) {
+		budget = period * JACK_DEADLINE_CLIENT_SHARE / 100;
+	}
+	if (budget > period) {
+		budget = period;
+	}
+
+	return jack_set_deadline_scheduling (client->process_tid, budget,
+					     period);
+}
+
+int
+jack_set_process_budget (jack_client_t* client, jack_time_t usecs)
+{
+	if (client->control->active) {
+		jack_error ("the process budget of an active client "
+			    "cannot be changed");
+		return -1;
+	}
+
+	client->control->deadline_budget = usecs;
+
+	return 0;
+}
+
 #if JACK_USE_MACH_THREADS
 
 int
@@ -342,3 +576,84 @@ jack_acquire_real_time_scheduling (pthread_t thread, int priority)
 
 #endif /* JACK_USE_MACH_THREADS */
 
+
+/* cpu lists use the syntax of taskset -c and isolcpus: "2", "0-3",
+   "0,2,4-7". returns the number of cpus in the list, storing up to
+   `max' of them in ascending order, or -1 if it does not parse.
+ */
+int
+jack_cpu_list_parse (const char *list, int *cpus, int max)
+{
+	char *end;
+	long first, last, prev = -1;
+	int n = 0;
+
+	if (list == NULL || *list == '\0') {
+		return -1;
+	}
+
+	while (*list) {
+		first = strtol (list, &end, 10);
+		if (end == list || first <= prev || first >= JACK_MAX_CPUS) {
+			return -1;
+		}
+
+		last = first;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol (list, &end, 10);
+			if (end == list || last < first || last >= JACK_MAX_CPUS) {
+				return -1;
+			}
+		}
+
+		for (; first <= last; first++, n++) {
+			if (n < max) {
+				cpus[n] = first;
+			}
+		}
+		prev = last;
+
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			return -1;
+		}
+		list = end;
+	}
+
+	return n;
+}
+
+int
+jack_set_thread_cpus (pthread_t thread, const char *cpus)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	int list[JACK_MAX_CPUS];
+	cpu_set_t set;
+	int n, i, x;
+
+	if ((n = jack_cpu_list_parse (cpus, list, JACK_MAX_CPUS)) < 0) {
+		jack_error ("invalid cpu list \"%s\"", cpus);
+		return -1;
+	}
+
+	CPU_ZERO (&set);
+	for (i = 0; i < n; i++) {
+		if (list[i] < CPU_SETSIZE) {
+			CPU_SET (list[i], &set);
+		}
+	}
+
+	if ((x = pthread_setaffinity_np (thread, sizeof(set), &set)) != 0) {
+		jack_error ("cannot run thread on cpus %s (%s)", cpus,
+			    strerror (x));
+		return -1;
+	}
+
+	return 0;
+#else
+	jack_error ("this system cannot tie threads to cpus");
+	return -1;
+#endif  /* HAVE_PTHREAD_SETAFFINITY_NP */
+}
@@ -46,6 +46,8 @@ jack_clock_source_name (jack_timer_type_t src)
 	switch (src) {
 	case JACK_TIMER_HPET:
 		return "hpet";
+	case JACK_TIMER_TSC:
+		return "tsc";
 	case JACK_TIMER_SYSTEM_CLOCK:
 #if HAVE_CLOCK_GETTIME
 		return "system clock via clock_gettime";
@@ -0,0 +1,386 @@
+/*
+    Per-client cycle timing -- runs in the client process.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation; either version 2.1
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, write to the Free
+    Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+    02111-1307, USA.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "local.h"
+
+/* take a consistent copy of a timing entry, which the engine may be
+   updating at the same time.
+ */
+static int
+jack_timing_read (jack_client_timing_t *timing, jack_client_timing_t *copy)
+{
+	uint32_t seq;
+	int tries;
+
+	for (tries = 0; tries < 100; tries++) {
+		seq = __atomic_load_n (&timing->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+		memcpy (copy, timing, sizeof(*copy));
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (__atomic_load_n (&timing->seq, __ATOMIC_RELAXED) == seq) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* the largest value that falls into bucket `b' */
+static jack_time_t
+jack_timing_bucket_limit (int b)
+{
+	int log2;
+
+	if (b == 0) {
+		return 0;
+	}
+
+	log2 = (b - 1) / 2;
+
+	if ((b - 1) & 1) {
+		return (2ULL << log2) - 1;
+	}
+
+	return log2 ? (1ULL << log2) + (1ULL << (log2 - 1)) - 1 : 1;
+}
+
+static jack_time_t
+jack_timing_percentile (uint32_t hist[2][JACK_TIMING_BUCKETS],
+			uint32_t max[2], uint32_t cycles, float percentile)
+{
+	uint64_t want, seen = 0;
+	jack_time_t limit;
+	jack_time_t top = (max[0] > max[1] ? max[0] : max[1]);
+	int b;
+
+	if (percentile >= 100.0f) {
+		return top;
+	}
+
+	want = (uint64_t)((cycles * (double)percentile) / 100.0 + 0.5);
+
+	if (want == 0) {
+		want = 1;
+	}
+
+	for (b = 0; b < JACK_TIMING_BUCKETS; b++) {
+		seen += hist[0][b] + hist[1][b];
+		if (seen >= want) {
+			break;
+		}
+	}
+
+	limit = jack_timing_bucket_limit (b < JACK_TIMING_BUCKETS ? b : JACK_TIMING_BUCKETS - 1);
+
+	return limit < top ? limit : top;
+}
+
+int
+jack_get_client_timing (jack_client_t *client, const char *client_name,
+			float percentile, jack_time_t *wake_usecs,
+			jack_time_t *process_usecs)
+{
+	jack_client_timing_t *timing;
+	jack_client_timing_t copy;
+	uint32_t cycles;
+	int slot;
+
+	for (slot = 0; slot < JACK_TIMING_MAX; slot++) {
+
+		if ((timing = jack_client_timing (client->engine, slot)) == NULL) {
+			return -1;
+		}
+
+		if (!timing->in_use ||
+		    strncmp (timing->name, client_name, sizeof(timing->name)) != 0) {
+			continue;
+		}
+
+		if (jack_timing_read (timing, &copy)) {
+			return -1;
+		}
+
+		cycles = copy.cycles[0] + copy.cycles[1];
+
+		if (wake_usecs) {
+			*wake_usecs = cycles ?
+				      jack_timing_percentile (copy.wake, copy.wake_max,
+							      cycles, percentile) : 0;
+		}
+		if (process_usecs) {
+			*process_usecs = cycles ?
+					 jack_timing_percentile (copy.process, copy.process_max,
+								 cycles, percentile) : 0;
+		}
+
+		return cycles;
+	}
+
+	return -1;
+}
+
+float
+jack_get_client_cpu_load (jack_client_t *client, const char *client_name)
+{
+	jack_client_timing_t *timing;
+	jack_client_timing_t copy;
+	uint64_t period;
+	int slot;
+
+	for (slot = 0; slot < JACK_TIMING_MAX; slot++) {
+
+		if ((timing = jack_client_timing (client->engine, slot)) == NULL) {
+			return -1.0f;
+		}
+
+		if (!timing->in_use ||
+		    strncmp (timing->name, client_name, sizeof(timing->name)) != 0) {
+			continue;
+		}
+
+		if (jack_timing_read (timing, &copy)) {
+			return -1.0f;
+		}
+
+		period = copy.period_total[0] + copy.period_total[1];
+
+		return period ? (float)((copy.process_total[0] + copy.process_total[1])
+					* 100.0 / period) : 0.0f;
+	}
+
+	return -1.0f;
+}
+
+/* the load stats live in the packed jack_control_t, so they are read
+   through volatile accesses and fences rather than atomic loads.
+ */
+static int
+jack_load_stats_read (jack_control_t *ctl, jack_load_stats_t *copy)
+{
+	jack_load_stats_t *stats = &ctl->load_stats;
+	uint32_t seq;
+	int tries;
+
+	for (tries = 0; tries < 100; tries++) {
+		seq = stats->seq;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+		memcpy (copy, stats, sizeof(*copy));
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (stats->seq == seq) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+float
+jack_load_percentile (jack_control_t *ctl, float percentile)
+{
+	jack_load_stats_t copy;
+	uint64_t want, seen = 0;
+	uint32_t cycles;
+	float limit, top;
+	int b;
+
+	if (jack_load_stats_read (ctl, &copy)) {
+		return -1.0f;
+	}
+
+	if ((cycles = copy.cycles[0] + copy.cycles[1]) == 0) {
+		return 0.0f;
+	}
+
+	top = copy.max[0] > copy.max[1] ? copy.max[0] : copy.max[1];
+
+	if (percentile >= 100.0f) {
+		return top;
+	}
+
+	want = (uint64_t)((cycles * (double)percentile) / 100.0 + 0.5);
+
+	if (want == 0) {
+		want = 1;
+	}
+
+	for (b = 0; b < JACK_LOAD_BUCKETS - 1; b++) {
+		seen += copy.hist[0][b] + copy.hist[1][b];
+		if (seen >= want) {
+			break;
+		}
+	}
+
+	/* the last bucket has no upper edge */
+	if (b == JACK_LOAD_BUCKETS - 1) {
+		return top;
+	}
+
+	limit = (b + 1) * JACK_LOAD_STEP;
+
+	return limit < top ? limit : top;
+}
+
+float
+jack_cpu_load_percentile (jack_client_t *client, float percentile)
+{
+	return jack_load_percentile (client->engine, percentile);
+}
+
+const char **
+jack_get_timed_clients (jack_client_t *client)
+{
+	jack_client_timing_t *timing;
+	const char **names;
+	char *strings;
+	int slot, n = 0;
+
+	/* one block: the pointers, followed by the names they point
+	   to, so that jack_free() releases everything.
+	 */
+
+	if ((names = (const char**)malloc ((JACK_TIMING_MAX + 1) * sizeof(char*)
+					   + JACK_TIMING_MAX * JACK_CLIENT_NAME_SIZE)) == NULL) {
+		return NULL;
+	}
+
+	strings = (char*)(names + JACK_TIMING_MAX + 1);
+
+	for (slot = 0; slot < JACK_TIMING_MAX; slot++) {
+		if ((timing = jack_client_timing (client->engine, slot)) == NULL) {
+			break;
+		}
+		if (!timing->in_use) {
+			continue;
+		}
+		snprintf (strings, JACK_CLIENT_NAME_SIZE, "%s", timing->name);
+		names[n++] = strings;
+		strings += JACK_CLIENT_NAME_SIZE;
+	}
+
+	if (n == 0) {
+		free (names);
+		return NULL;
+	}
+
+	names[n] = NULL;
+
+	return names;
+}
+
+int
+jack_timing_summarize (jack_control_t *ctl, int32_t slot, float percentile,
+		       jack_timing_summary_t *sum)
+{
+	jack_client_timing_t *timing;
+	jack_client_timing_t copy;
+	uint64_t period;
+
+	if ((timing = jack_client_timing (ctl, slot)) == NULL ||
+	    !timing->in_use || jack_timing_read (timing, &copy) ||
+	    !copy.in_use) {
+		return -1;
+	}
+
+	memset (sum, 0, sizeof(*sum));
+	memcpy (sum->name, copy.name, sizeof(sum->name));
+	sum->name[sizeof(sum->name) - 1] = '\0';
+
+	if ((sum->cycles = copy.cycles[0] + copy.cycles[1]) == 0) {
+		return 0;
+	}
+
+	sum->wake_usecs = jack_timing_percentile (copy.wake, copy.wake_max,
+						  sum->cycles, percentile);
+	sum->wake_max = copy.wake_max[0] > copy.wake_max[1] ?
+			copy.wake_max[0] : copy.wake_max[1];
+	sum->process_usecs = jack_timing_percentile (copy.process,
+						     copy.process_max,
+						     sum->cycles, percentile);
+	sum->process_max = copy.process_max[0] > copy.process_max[1] ?
+			   copy.process_max[0] : copy.process_max[1];
+
+	period = copy.period_total[0] + copy.period_total[1];
+	sum->load = period ? (float)((copy.process_total[0] + copy.process_total[1])
+				     * 100.0 / period) : 0.0f;
+	sum->cpu_load = period ? (float)((copy.cpu_total[0] + copy.cpu_total[1])
+					 * 100.0 / period) : 0.0f;
+	sum->preempted = (float)((copy.preempted[0] + copy.preempted[1])
+				 * 100.0 / sum->cycles);
+
+	return 0;
+}
+
+/* take a consistent copy of xrun report number `xrun', which fails if
+   the engine has since written a later xrun over it (or is doing so).
+ */
+int
+jack_xrun_report_read (jack_control_t *ctl, uint32_t xrun,
+		       jack_xrun_report_t *copy)
+{
+	jack_xrun_report_t *report;
+	uint32_t seq;
+	int tries;
+
+	if ((report = jack_xrun_report (ctl, xrun)) == NULL) {
+		return -1;
+	}
+
+	for (tries = 0; tries < 100; tries++) {
+		seq = report->seq;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+		memcpy (copy, report, sizeof(*copy));
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (report->seq == seq) {
+			return copy->xrun == xrun && xrun != 0 ? 0 : -1;
+		}
+	}
+
+	return -1;
+}
+
+/* The report on xrun number `xrun' (counting from 1; 0 for the latest),
+ * as described with jack_xrun_report_t. The last JACK_XRUN_REPORTS are
+ * kept, and the one for an xrun is there by the time the XRun callback
+ * runs, so the callback can pass 0. Returns -1 once the report has been
+ * written over. Belongs in <jack/jack.h>.
+ */
+int
+jack_get_xrun_report (jack_client_t *client, uint32_t xrun,
+		      jack_xrun_report_t *report)
+{
+	if (xrun == 0) {
+		xrun = client->engine->xruns;
+	}
+
+	return jack_xrun_report_read (client->engine, xrun, report);
+}
@@ -42,68 +42,107 @@ jack_generate_unique_id (jack_control_t *ectl)
 	return exchange_and_add (&ectl->seq_number, 1);
 }
 
+/* Take a consistent copy of the client-visible frame timer fields.
+
+   The engine bumps guard1, then updates the fields, then bumps guard2,
+   with a release fence between each step. Reading in the opposite
+   order with acquire fences means that a copy taken while guard1 still
+   equals the guard2 seen before the copy cannot contain any field of a
+   later update.
+
+   The update is a handful of stores by the engine thread, so this
+   only ever retries for as long as those take; it does not sleep,
+   since it is called from process threads.
+ */
 static inline void
 jack_read_frame_time (const jack_client_t *client, jack_frame_timer_t *copy)
 {
-	int tries = 0;
-	long timeout = 1000;
+	const volatile jack_frame_timer_t *timer = &client->engine->frame_timer;
+	uint32_t guard;
 
 	do {
-		/* throttle the busy wait if we don't get
-		   the answer very quickly.
-
-		   XXX This is disgusting. on a UP
-		   system, it needs to sleep
-		   if the first try didn't work. on an SMP
-		   system, it should wait for half of
-		   the context switch time before
-		   sleeping.
-		 */
+		guard = timer->guard2;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
 
-		if (tries > 10) {
-			usleep (20);
-			tries = 0;
+		copy->frames = timer->frames;
+		copy->current_wakeup = timer->current_wakeup;
+		copy->next_wakeup = timer->next_wakeup;
+		copy->period_usecs = timer->period_usecs;
+		copy->initialized = timer->initialized;
+		copy->error_usecs = timer->error_usecs;
 
-			/* debug code to avoid system hangs... */
-			if (--timeout == 0) {
-				jack_error ("hung in loop copying position A");
-				abort ();
-			}
-		}
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
 
-		*copy = client->engine->frame_timer;
+	} while (timer->guard1 != guard);
 
-		tries++;
+	copy->guard1 = copy->guard2 = guard;
+}
 
-	} while (copy->guard1 != copy->guard2);
+/* The frame time at `usecs', going by the timer copy `time'. */
+static inline jack_nframes_t
+jack_frame_timer_frames (const jack_frame_timer_t *time, jack_time_t usecs,
+			 jack_nframes_t buffer_size)
+{
+	/*
+	   Make sure we have signed differences. It would make a lot  of sense
+	   to use the standard signed intNN_t types everywhere  instead of e.g.
+	   jack_nframes_t and jack_time_t. This would at least ensure that the
+	   types used below are the correct ones. There is no way to get a type
+	   that would be 'a signed version of jack_time_t' for example - the
+	   types below are inherently fragile and there is no automatic way to
+	   check they are the correct ones. The only way is to check manually
+	   against jack/types.h.  FA - 16/02/2012
+	 */
+	int64_t du = usecs - time->current_wakeup;
+	int64_t dp = time->next_wakeup - time->current_wakeup;
+
+	return time->frames + (int32_t)floor (((double)du / (double)dp
+					       * buffer_size) + 0.5);
 }
 
-/* copy a JACK transport position structure (thread-safe) */
-void
-jack_transport_copy_position (jack_position_t *from, jack_position_t *to)
+/* Copy a position that clients write to shared memory, request_time,
+   which has no lock: a copy is whole if its unique_1 and unique_2
+   match. Gives up after a few tries rather than wait for a writer
+   that may be gone, so that the engine can leave the request for the
+   next cycle; returns 0 if the copy is whole.
+ */
+int
+jack_transport_copy_position (const jack_position_t *from, jack_position_t *to)
 {
-	int tries = 0;
-	long timeout = 1000;
+	int tries;
 
-	do {
-		/* throttle the busy wait if we don't get the answer
-		 * very quickly. See comment above about this
-		 * design.
-		 */
-		if (tries > 10) {
-			usleep (20);
-			tries = 0;
-
-			/* debug code to avoid system hangs... */
-			if (--timeout == 0) {
-				jack_error ("hung in loop copying position B");
-				abort ();
-			}
-		}
+	for (tries = 0; tries < 100; tries++) {
 		*to = *from;
-		tries++;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (to->unique_1 == to->unique_2) {
+			return 0;
+		}
+	}
 
-	} while (to->unique_1 != to->unique_2);
+	return -1;
+}
+
+/* Take a consistent copy of current_time, which only the engine
+   writes, under position_seq. Like the frame timer, this spins for
+   at most as long as the engine takes to copy one jack_position_t.
+ */
+static inline jack_transport_state_t
+jack_transport_read_position (const jack_control_t *ectl, jack_position_t *pos)
+{
+	jack_transport_state_t state;
+	uint32_t seq;
+
+	do {
+		seq = ectl->position_seq;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+		state = ectl->transport_state;
+		memcpy (pos, (const void *)&ectl->current_time, sizeof(*pos));
+
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || ectl->position_seq != seq);
+
+	return state;
 }
 
 static inline int
@@ -119,7 +158,9 @@ jack_transport_request_new_pos (jack_client_t *client, jack_position_t *pos)
 	pos->frame_rate = ectl->current_time.frame_rate;
 
 	/* carefully copy requested postion into shared memory */
-	jack_transport_copy_position (pos, &ectl->request_time);
+	if (jack_transport_copy_position (pos, &ectl->request_time)) {
+		return EBUSY;
+	}
 
 	return 0;
 }
@@ -156,7 +197,7 @@ jack_call_timebase_master (jack_client_t *client)
 {
 	jack_client_control_t *control = client->control;
 	jack_control_t *ectl = client->engine;
-	int new_pos = (int)ectl->pending_pos;
+	int new_pos = (int)(ectl->pending_pos | ectl->pending_jump);
 
 
 	/* Make sure this is still the master; is_timebase is set in a
@@ -255,6 +296,67 @@ jack_get_cycle_times (const jack_client_t *client,
 	return 1;
 }
 
+/* How far, on average, period starts have lately been from where the
+   frame timer expected them, in usecs: how much to trust what
+   jack_frames_to_time() and jack_time_to_frames() say. It is large
+   right after the timer starts or restarts after an xrun, and comes
+   down as the timer locks. -1 if the timer is not running yet.
+   The prototype belongs in <jack/jack.h>. */
+float
+jack_get_frame_timer_error (const jack_client_t *client)
+{
+	jack_frame_timer_t time;
+
+	jack_read_frame_time (client, &time);
+	if (!time.initialized) {
+		return -1.0f;
+	}
+	return time.error_usecs;
+}
+
+/* Everything jack_frame_time() and jack_get_cycle_times() report, from a
+   single copy of the frame timer and a single clock read. Any of the
+   pointers may be NULL. Returns 1 if the timer is not running yet. */
+int
+jack_get_frame_timer (const jack_client_t *client,
+		      jack_nframes_t *frames_now,
+		      jack_time_t    *usecs_now,
+		      jack_nframes_t *current_frames,
+		      jack_time_t    *current_usecs,
+		      jack_time_t    *next_usecs,
+		      float          *period_usecs)
+{
+	jack_frame_timer_t time;
+	jack_time_t now = jack_get_microseconds ();
+
+	jack_read_frame_time (client, &time);
+	if (!time.initialized) {
+		return 1;
+	}
+
+	if (frames_now) {
+		*frames_now = jack_frame_timer_frames (&time, now,
+						       client->engine->buffer_size);
+	}
+	if (usecs_now) {
+		*usecs_now = now;
+	}
+	if (current_frames) {
+		*current_frames = time.frames;
+	}
+	if (current_usecs) {
+		*current_usecs = time.current_wakeup;
+	}
+	if (next_usecs) {
+		*next_usecs = time.next_wakeup;
+	}
+	if (period_usecs) {
+		*period_usecs = time.period_usecs;
+	}
+
+	return 0;
+}
+
 jack_time_t
 jack_get_time ()
 {
@@ -269,20 +371,7 @@ jack_time_to_frames (const jack_client_t *client, jack_time_t usecs)
 
 	jack_read_frame_time (client, &time);
 	if (time.initialized) {
-		/*
-		   Make sure we have signed differences. It would make a lot  of sense
-		   to use the standard signed intNN_t types everywhere  instead of e.g.
-		   jack_nframes_t and jack_time_t. This would at least ensure that the
-		   types used below are the correct ones. There is no way to get a type
-		   that would be 'a signed version of jack_time_t' for example - the
-		   types below are inherently fragile and there is no automatic way to
-		   check they are the correct ones. The only way is to check manually
-		   against jack/types.h.  FA - 16/02/2012
-		 */
-		int64_t du = usecs - time.current_wakeup;
-		int64_t dp = time.next_wakeup - time.current_wakeup;
-		return time.frames + (int32_t)floor (((double)du / (double)dp
-						      * ectl->buffer_size) + 0.5);
+		return jack_frame_timer_frames (&time, usecs, ectl->buffer_size);
 	}
 	return 0;
 }
@@ -446,6 +535,63 @@ jack_transport_locate (jack_client_t *client, jack_nframes_t frame)
 	return jack_transport_request_new_pos (client, &pos);
 }
 
+/* Arm a locate to `frame' at the exact sample where the rolling
+ * transport reaches `when'. It fires once, in the cycle that contains
+ * `when', and shows up as a JackTransportEventLocate with that offset;
+ * a client that loops arms the next one when it sees it. A new request
+ * replaces the armed one; stopping the transport or a locate disarm
+ * it. This belongs in <jack/transport.h>.
+ */
+int
+jack_transport_locate_at (jack_client_t *client, jack_nframes_t when,
+			  jack_nframes_t frame)
+{
+	jack_control_t *ectl = client->engine;
+	jack_locate_at_t *req = &ectl->locate_at_request;
+	jack_unique_t id = jack_generate_unique_id (ectl);
+
+	req->unique_1 = id;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	req->when = when;
+	req->frame = frame;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	req->unique_2 = id;
+
+	return 0;
+}
+
+/* The transport events of this cycle, in the order they happen: up to
+ * `max' of them are copied to `events', and the number there were is
+ * returned. No events means nothing changed but the frame moving on,
+ * so process() need not look at the position at all. Call it from
+ * process(); it belongs in <jack/transport.h>.
+ */
+uint32_t
+jack_transport_get_events (const jack_client_t *client,
+			   jack_transport_event_t *events, uint32_t max)
+{
+	const jack_control_t *ectl = client->engine;
+	uint32_t seq, n;
+
+	do {
+		seq = ectl->position_seq;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+		n = ectl->transport_nevents;
+		if (n > JACK_TRANSPORT_EVENTS_MAX) {
+			n = JACK_TRANSPORT_EVENTS_MAX;
+		}
+		if (events && max) {
+			memcpy (events, (const void *)ectl->transport_events,
+				sizeof(jack_transport_event_t) * (n < max ? n : max));
+		}
+
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || ectl->position_seq != seq);
+
+	return n;
+}
+
 jack_transport_state_t
 jack_transport_query (const jack_client_t *client, jack_position_t *pos)
 {
@@ -455,12 +601,72 @@ jack_transport_query (const jack_client_t *client, jack_position_t *pos)
 		/* the guarded copy makes this function work in any
 		 * thread
 		 */
-		jack_transport_copy_position (&ectl->current_time, pos);
+		return jack_transport_read_position (ectl, pos);
 	}
 
 	return ectl->transport_state;
 }
 
+/* The part of the transport position most clients look at, without
+ * the padding and the reserved fields of jack_position_t. This belongs
+ * in <jack/transport.h>.
+ */
+typedef struct {
+	jack_transport_state_t state;
+	jack_position_bits_t valid;     /* of the fields below */
+	jack_time_t usecs;
+	jack_nframes_t frame_rate;
+	jack_nframes_t frame;
+
+	/* JackPositionBBT */
+	int32_t bar;
+	int32_t beat;
+	int32_t tick;
+	double bar_start_tick;
+	float beats_per_bar;
+	float beat_type;
+	double ticks_per_beat;
+	double beats_per_minute;
+} jack_transport_snapshot_t;
+
+/* Fill in `snap' from the current position, as atomically as
+ * jack_transport_query() and from any thread, but copying only the
+ * fields it has. Returns the transport state.
+ */
+jack_transport_state_t
+jack_transport_snapshot (const jack_client_t *client,
+			 jack_transport_snapshot_t *snap)
+{
+	const jack_control_t *ectl = client->engine;
+	const volatile jack_position_t *cur = &ectl->current_time;
+	uint32_t seq;
+
+	do {
+		seq = ectl->position_seq;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+		snap->state = ectl->transport_state;
+		snap->valid = cur->valid;
+		snap->usecs = cur->usecs;
+		snap->frame_rate = cur->frame_rate;
+		snap->frame = cur->frame;
+		snap->bar = cur->bar;
+		snap->beat = cur->beat;
+		snap->tick = cur->tick;
+		snap->bar_start_tick = cur->bar_start_tick;
+		snap->beats_per_bar = cur->beats_per_bar;
+		snap->beat_type = cur->beat_type;
+		snap->ticks_per_beat = cur->ticks_per_beat;
+		snap->beats_per_minute = cur->beats_per_minute;
+
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || ectl->position_seq != seq);
+
+	snap->valid &= JackPositionBBT;
+
+	return snap->state;
+}
+
 int
 jack_transport_reposition (jack_client_t *client, const jack_position_t *pos)
 {
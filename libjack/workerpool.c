@@ -0,0 +1,327 @@
+/*
+    Realtime worker pools for process callbacks.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+/* A client that splits its process callback over several threads
+ * asks the server for a pool of them instead of starting its own: the
+ * server grants as many as the cpus allow once its driver thread, its
+ * --internal-threads workers and the pools of other clients have had
+ * theirs (see jack_do_set_worker_pool()), and with --client-cpus
+ * places them on the entries of the cpu list that follow the client's
+ * process thread. The threads run at the process thread's priority.
+ *
+ * Inside process(), jack_worker_pool_fork() hands out `ntasks' calls
+ * of a task, and jack_worker_pool_join() runs what the pool has not
+ * claimed yet on the calling thread and waits for the rest. Neither
+ * takes a lock; a fork wakes the workers it needs with one futex call,
+ * and a join sleeps only if its own share ran out before the others
+ * finished. Without futexes the pool has no threads and the join runs
+ * every task itself.
+ *
+ * Belongs in <jack/thread.h>:
+ *
+ *	typedef struct _jack_worker_pool jack_worker_pool_t;
+ *	typedef void (*JackWorkerTaskCallback)(void *arg, unsigned int task);
+ *
+ * and the prototypes of the public functions below.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <jack/jack.h>
+#include <jack/thread.h>
+#include <jack/uuid.h>
+
+#include <sysdeps/futex.h>
+
+#include "internal.h"
+#include "local.h"
+
+typedef void (*JackWorkerTaskCallback)(void *arg, unsigned int task);
+
+typedef struct _jack_worker_pool {
+	jack_client_t *client;
+	unsigned int nthreads;
+	pthread_t threads[JACK_POOL_MAX_THREADS];
+	int cpus[JACK_POOL_MAX_THREADS]; /* as last applied, -1: none */
+
+	volatile int32_t seq;           /* bumped by each fork, workers wait on it */
+	volatile int32_t running;
+
+	/* the fork in progress, written before `remaining' */
+	JackWorkerTaskCallback task;
+	void *arg;
+	int32_t ntasks;
+	volatile int32_t remaining;     /* tasks not yet claimed, may go below 0 */
+	volatile int32_t done;          /* tasks finished, the join waits on it */
+	volatile int32_t waiting;       /* the join sleeps on `done' */
+	int forked;
+} jack_worker_pool_t;
+
+/* claim and run tasks of the current fork until none are left. A
+   claim that finds none only drives `remaining' further below zero,
+   and the next fork stores over it; a worker that is late for one
+   fork can only claim tasks of the next, whose task and arg were
+   written before its `remaining'. */
+static void
+jack_worker_pool_drain (jack_worker_pool_t *pool)
+{
+	int32_t left, ntasks;
+
+	while ((left = __atomic_fetch_sub (&pool->remaining, 1,
+					   __ATOMIC_ACQ_REL)) > 0) {
+		ntasks = pool->ntasks;
+		pool->task (pool->arg, ntasks - left);
+		if (__atomic_add_fetch (&pool->done, 1, __ATOMIC_SEQ_CST)
+		    == ntasks &&
+		    __atomic_load_n (&pool->waiting, __ATOMIC_SEQ_CST)) {
+			jack_futex_wake (&pool->done, 1);
+		}
+	}
+}
+
+static void *
+jack_worker_pool_thread (void *arg)
+{
+	jack_worker_pool_t *pool = (jack_worker_pool_t*)arg;
+	int32_t seq = 0, now;
+
+	while (1) {
+		while ((now = __atomic_load_n (&pool->seq, __ATOMIC_ACQUIRE))
+		       == seq) {
+			jack_futex_wait (&pool->seq, seq, NULL);
+		}
+		seq = now;
+
+		if (!__atomic_load_n (&pool->running, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		jack_worker_pool_drain (pool);
+	}
+
+	return NULL;
+}
+
+static int
+jack_worker_pool_request (jack_client_t *client, unsigned int nthreads)
+{
+	jack_request_t req;
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = SetWorkerPool;
+	jack_uuid_copy (&req.x.pool.client_id, client->control->uuid);
+	req.x.pool.nthreads = nthreads;
+
+	return jack_client_deliver_request (client, &req);
+}
+
+/* tie the workers to the cpus the engine placed them on, if those
+   changed */
+int
+jack_worker_pool_apply_cpus (jack_worker_pool_t *pool)
+{
+	char cpu[16];
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < pool->nthreads; i++) {
+		int32_t want = pool->client->control->pool_cpus[i];
+
+		if (want < 0 || want == pool->cpus[i]) {
+			continue;
+		}
+		pool->cpus[i] = want;
+		snprintf (cpu, sizeof(cpu), "%d", want);
+		if (jack_set_thread_cpus (pool->threads[i], cpu)) {
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/* a pool of up to `nthreads' workers, fewer if the server cannot spare
+   that many cpus, none if it cannot spare any: the tasks then all run
+   in jack_worker_pool_join(). A client has at most one pool. not
+   realtime safe. */
+jack_worker_pool_t *
+jack_client_create_worker_pool (jack_client_t *client, unsigned int nthreads)
+{
+	jack_worker_pool_t *pool;
+	unsigned int i;
+
+	if (client == NULL || client->worker_pool) {
+		return NULL;
+	}
+
+	if ((pool = (jack_worker_pool_t*)calloc (1, sizeof(jack_worker_pool_t)))
+	    == NULL) {
+		return NULL;
+	}
+
+	pool->client = client;
+	pool->running = 1;
+	for (i = 0; i < JACK_POOL_MAX_THREADS; i++) {
+		pool->cpus[i] = -1;
+	}
+
+#if JACK_HAVE_FUTEX
+	if (nthreads > JACK_POOL_MAX_THREADS) {
+		nthreads = JACK_POOL_MAX_THREADS;
+	}
+
+	if (nthreads && jack_worker_pool_request (client, nthreads) == 0) {
+		nthreads = client->control->pool_threads;
+	} else {
+		nthreads = 0;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (jack_client_create_thread (client, &pool->threads[i],
+					       client->engine->client_priority,
+					       client->engine->real_time,
+					       jack_worker_pool_thread, pool)) {
+			jack_error ("cannot start worker pool thread %u of %u",
+				    i + 1, nthreads);
+			break;
+		}
+	}
+	pool->nthreads = i;
+
+	if (pool->nthreads < nthreads) {
+		jack_worker_pool_request (client, pool->nthreads);
+	}
+
+	jack_worker_pool_apply_cpus (pool);
+#endif
+
+	client->worker_pool = pool;
+
+	return pool;
+}
+
+/* the workers the pool has, besides the thread that joins it */
+unsigned int
+jack_worker_pool_size (const jack_worker_pool_t *pool)
+{
+	return pool->nthreads;
+}
+
+/* start `ntasks' calls of task (arg, 0 .. ntasks - 1) on the pool, in
+   no particular order; follow it with jack_worker_pool_join() before
+   forking again. realtime safe. */
+int
+jack_worker_pool_fork (jack_worker_pool_t *pool, unsigned int ntasks,
+		       JackWorkerTaskCallback task, void *arg)
+{
+	unsigned int nwake;
+
+	if (pool->forked || task == NULL || ntasks > INT32_MAX) {
+		return EINVAL;
+	}
+
+	pool->task = task;
+	pool->arg = arg;
+	pool->ntasks = ntasks;
+	pool->done = 0;
+	__atomic_store_n (&pool->remaining, (int32_t)ntasks, __ATOMIC_RELEASE);
+	pool->forked = 1;
+
+	/* the joining thread takes a share too */
+	nwake = ntasks > 1 ? ntasks - 1 : 0;
+	if (nwake > pool->nthreads) {
+		nwake = pool->nthreads;
+	}
+
+	if (nwake) {
+		__atomic_add_fetch (&pool->seq, 1, __ATOMIC_RELEASE);
+		jack_futex_wake (&pool->seq, nwake);
+	}
+
+	return 0;
+}
+
+/* run the tasks of the last fork that no worker has claimed, and
+   return once all of them have finished. realtime safe. */
+int
+jack_worker_pool_join (jack_worker_pool_t *pool)
+{
+	int32_t done;
+
+	if (!pool->forked) {
+		return EINVAL;
+	}
+
+	jack_worker_pool_drain (pool);
+
+	while ((done = __atomic_load_n (&pool->done, __ATOMIC_ACQUIRE))
+	       < pool->ntasks) {
+		__atomic_store_n (&pool->waiting, 1, __ATOMIC_SEQ_CST);
+		done = __atomic_load_n (&pool->done, __ATOMIC_SEQ_CST);
+		if (done < pool->ntasks) {
+			jack_futex_wait (&pool->done, done, NULL);
+		}
+	}
+
+	__atomic_store_n (&pool->waiting, 0, __ATOMIC_RELAXED);
+	pool->forked = 0;
+
+	return 0;
+}
+
+/* stop the workers and give their cpus back to the server. not
+   realtime safe, and not from inside a fork. */
+void
+jack_worker_pool_destroy (jack_worker_pool_t *pool)
+{
+	jack_client_t *client;
+	unsigned int i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	client = pool->client;
+
+	if (pool->nthreads) {
+		__atomic_store_n (&pool->running, 0, __ATOMIC_RELEASE);
+		__atomic_add_fetch (&pool->seq, 1, __ATOMIC_RELEASE);
+		jack_futex_wake (&pool->seq, INT_MAX);
+		for (i = 0; i < pool->nthreads; i++) {
+			pthread_join (pool->threads[i], NULL);
+		}
+		if (client->control) {
+			jack_worker_pool_request (client, 0);
+		}
+	}
+
+	if (client->worker_pool == pool) {
+		client->worker_pool = NULL;
+	}
+
+	free (pool);
+}
@@ -113,6 +113,36 @@ jackctl_server_switch_master = libjs.jackctl_server_switch_master
 jackctl_server_switch_master.argtypes = [ POINTER(jackctl_server_t), POINTER(jackctl_driver_t) ]
 jackctl_server_switch_master.restype  = c_bool
 
+class jackctl_client_stats_t( Structure ):
+    _fields_ = [ ( "name", c_char * 64 ),
+                 ( "cycles", c_uint32 ),
+                 ( "wake_p99_usecs", c_uint32 ),
+                 ( "wake_max_usecs", c_uint32 ),
+                 ( "process_p99_usecs", c_uint32 ),
+                 ( "process_max_usecs", c_uint32 ),
+                 ( "load", c_float ) ]
+
+class jackctl_server_stats_t( Structure ):
+    _fields_ = [ ( "cycles", c_uint64 ),
+                 ( "xruns", c_uint32 ),
+                 ( "cpu_load", c_float ),
+                 ( "load_p50", c_float ),
+                 ( "load_p90", c_float ),
+                 ( "load_p99", c_float ),
+                 ( "load_max", c_float ),
+                 ( "xrun_delayed_usecs", c_float ),
+                 ( "max_delayed_usecs", c_float ),
+                 ( "driver_wait_usecs", c_uint32 ),
+                 ( "driver_process_usecs", c_uint32 ),
+                 ( "nclients", c_uint32 ) ]
+
+jackctl_server_get_stats = libjs.jackctl_server_get_stats
+jackctl_server_get_stats.argtypes = [ POINTER(jackctl_server_t), POINTER(jackctl_server_stats_t), POINTER(jackctl_client_stats_t), c_uint ]
+jackctl_server_get_stats.restype  = c_int
+
+# JACK_TIMING_MAX
+MAX_TIMED_CLIENTS = 256
+
 
 class Parameter(object):
     def __init__( self, param_ptr ):
@@ -227,6 +257,30 @@ class Server(object):
     def stop( self ):
 	return jackctl_server_stop( self.srv_ptr )
 
+    def get_stats( self ):
+	if not hasattr( self, "client_stats" ):
+	    self.server_stats = jackctl_server_stats_t()
+	    self.client_stats = (jackctl_client_stats_t * MAX_TIMED_CLIENTS)()
+
+	n = jackctl_server_get_stats( self.srv_ptr, byref(self.server_stats),
+				      self.client_stats, MAX_TIMED_CLIENTS )
+	if n < 0:
+	    return None
+
+	stats = {}
+	for f in jackctl_server_stats_t._fields_:
+	    stats[ f[0] ] = getattr( self.server_stats, f[0] )
+
+	clients = {}
+	for c in self.client_stats[:min(n, MAX_TIMED_CLIENTS)]:
+	    cs = {}
+	    for f in jackctl_client_stats_t._fields_[1:]:
+		cs[ f[0] ] = getattr( c, f[0] )
+	    clients[ c.name ] = cs
+
+	stats[ "clients" ] = clients
+	return stats
+
 
     def acquire_card( self, cardname ):
 	if self.acquire_card_cb:
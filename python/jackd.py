@@ -132,6 +132,16 @@ while not quit:
 	    drv = srv.drivers[cmdv[1]]
 	    driver_parse_args( drv, cmdv[2:] )
 	    srv.switch_master( drv )
+    elif cmdv[0] == "stats":
+	st = srv.get_stats()
+	if not st:
+	    print "server not running"
+	    continue
+	print "cycles %d, xruns %d, max delay %.1f usecs" % (st["cycles"], st["xruns"], st["max_delayed_usecs"])
+	print "load %.1f%% (p50 %.1f%%, p90 %.1f%%, p99 %.1f%%, max %.1f%%)" % (st["cpu_load"], st["load_p50"], st["load_p90"], st["load_p99"], st["load_max"])
+	print "driver wait %d usecs, process %d usecs" % (st["driver_wait_usecs"], st["driver_process_usecs"])
+	for name, cs in st["clients"].items():
+	    print "  %-32s wake p99 %6d usecs, process p99 %6d usecs, load %.1f%%" % (name, cs["wake_p99_usecs"], cs["process_p99_usecs"], cs["load"])
 
 print "\nshutting down"
 srv.stop()